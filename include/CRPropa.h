@@ -2,23 +2,45 @@
 #ifndef CRPROPA_H
 #define CRPROPA_H
 
+#include "crpropa/BackTracking.h"
 #include "crpropa/Candidate.h"
+#include "crpropa/CandidateStream.h"
 #include "crpropa/Common.h"
+#include "crpropa/Configuration.h"
 #include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/EventReweighting.h"
 #include "crpropa/Geometry.h"
 #include "crpropa/Grid.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/InteractionTables.h"
 #include "crpropa/Logging.h"
+#include "crpropa/MemoryUsage.h"
+#include "crpropa/Numa.h"
+#include "crpropa/OffloadEngine.h"
+#include "crpropa/OrderedRecords.h"
 #include "crpropa/Module.h"
+#include "crpropa/ModuleChain.h"
 #include "crpropa/ModuleList.h"
+#include "crpropa/ParallelGzip.h"
+#include "crpropa/ParameterSweep.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/ParticleState.h"
+#include "crpropa/ParticleStateBatch.h"
+#include "crpropa/PerfCounters.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/PropagationResponse.h"
 #include "crpropa/Random.h"
+#include "crpropa/RedshiftCache.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Source.h"
+#include "crpropa/SymbolTable.h"
+#include "crpropa/TableRegistry.h"
+#include "crpropa/ThinningPolicy.h"
+#include "crpropa/Trace.h"
 #include "crpropa/Units.h"
 #include "crpropa/Variant.h"
 #include "crpropa/Vector3.h"
@@ -26,17 +48,26 @@
 
 #include "crpropa/module/AdiabaticCooling.h"
 #include "crpropa/module/Acceleration.h"
+#include "crpropa/module/BatchModule.h"
+#include "crpropa/module/BinaryOutput.h"
 #include "crpropa/module/Boundary.h"
 #include "crpropa/module/BreakCondition.h"
 #include "crpropa/module/CandidateSplitting.h"
+#include "crpropa/module/CompositePropagation.h"
 #include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/module/EMCascade.h"
 #include "crpropa/module/EMDoublePairProduction.h"
 #include "crpropa/module/EMInverseComptonScattering.h"
 #include "crpropa/module/EMPairProduction.h"
 #include "crpropa/module/EMTripletPairProduction.h"
 #include "crpropa/module/ElasticScattering.h"
+#include "crpropa/module/FastNeutralPropagation.h"
 #include "crpropa/module/ElectronPairProduction.h"
 #include "crpropa/module/HDF5Output.h"
+#include "crpropa/module/HDF5Reader.h"
+#include "crpropa/module/HistogramOutput.h"
+#include "crpropa/module/InteractionManager.h"
+#include "crpropa/module/ParquetOutput.h"
 #include "crpropa/module/MomentumDiffusion.h"
 #include "crpropa/module/NuclearDecay.h"
 #include "crpropa/module/Observer.h"
@@ -45,33 +76,42 @@
 #include "crpropa/module/PhotoDisintegration.h"
 #include "crpropa/module/PhotoPionProduction.h"
 #include "crpropa/module/PhotonOutput1D.h"
+#include "crpropa/module/Propagation1D.h"
 #include "crpropa/module/PropagationBP.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationDP.h"
+#include "crpropa/module/PropagationGC.h"
 #include "crpropa/module/Redshift.h"
 #include "crpropa/module/RestrictToRegion.h"
 #include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/StepPlanner.h"
+#include "crpropa/module/StreamOutput.h"
 #include "crpropa/module/SynchrotronRadiation.h"
 #include "crpropa/module/TextOutput.h"
 #include "crpropa/module/Tools.h"
 
 #include "crpropa/magneticField/ArchimedeanSpiralField.h"
+#include "crpropa/magneticField/CachedMagneticField.h"
 #include "crpropa/magneticField/JF12Field.h"
 #include "crpropa/magneticField/JF12FieldSolenoidal.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/magneticField/GalacticMagneticField.h"
 #include "crpropa/magneticField/MagneticFieldGrid.h"
 #include "crpropa/magneticField/PolarizedSingleModeMagneticField.h"
+#include "crpropa/magneticField/ProfiledMagneticField.h"
 #include "crpropa/magneticField/PT11Field.h"
 #include "crpropa/magneticField/QuimbyMagneticField.h"
 #include "crpropa/magneticField/TF17Field.h"
 #include "crpropa/magneticField/CMZField.h"
 #include "crpropa/magneticField/turbulentField/GridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/HelicalGridTurbulence.h"
+#include "crpropa/magneticField/turbulentField/PagedGridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 #include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/TurbulentField.h"
 
 #include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
 
 #include "crpropa/massDistribution/Density.h"
 #include "crpropa/massDistribution/Nakanishi.h"
@@ -79,6 +119,7 @@
 #include "crpropa/massDistribution/Massdistribution.h"
 #include "crpropa/massDistribution/Ferriere.h"
 #include "crpropa/massDistribution/ConstantDensity.h"
+#include "crpropa/massDistribution/TabulatedDensity.h"
 
 /** \namespace crpropa
  *  @brief CRPropa is a public astrophysical simulation framework for propagating extraterrestrial ultra-high energy particles.
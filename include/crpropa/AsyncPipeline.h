@@ -0,0 +1,177 @@
+#ifndef CRPROPA_ASYNCPIPELINE_H
+#define CRPROPA_ASYNCPIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class RingBuffer
+ @brief Lock-free ring buffer with a single producer and a single consumer
+ */
+template<class T>
+class RingBuffer {
+	std::vector<T> slots;
+	std::atomic<size_t> head; ///< next slot to read, written by the consumer
+	char padding[64]; // keep head and tail on separate cache lines
+	std::atomic<size_t> tail; ///< next slot to write, written by the producer
+public:
+	RingBuffer(size_t capacity) : slots(capacity + 1), head(0), tail(0) {
+	}
+
+	/** Move a value into the buffer, returns false if the buffer is full */
+	bool push(T &value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t + 1) % slots.size();
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+		std::swap(slots[t], value);
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/** Move a value out of the buffer, returns false if the buffer is empty */
+	bool pop(T &value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		std::swap(value, slots[h]);
+		head.store((h + 1) % slots.size(), std::memory_order_release);
+		return true;
+	}
+};
+
+/**
+ @class AsyncPipelineBase
+ @brief Writer thread of an AsyncPipeline
+
+ The writer thread repeatedly drains the buffers of the pipeline and sleeps
+ briefly if they are empty. The first exception of the consumer is kept and
+ rethrown by the next drain() or returned by close().
+ */
+class AsyncPipelineBase {
+public:
+	AsyncPipelineBase();
+	virtual ~AsyncPipelineBase();
+
+	/** Wait until all records pushed before the call are consumed and
+	 committed, then rethrow an exception of the consumer.
+	 Must not be called from the consumer. */
+	void drain();
+	/** Drain and join the writer thread. No records may be pushed afterwards.
+	 @return	the exception of the consumer, for the owner to rethrow after it closed its backend */
+	std::exception_ptr close();
+
+protected:
+	void start();
+	void stop(); ///< drain and join the writer thread, keeping an exception of the consumer
+
+	/** Slot of the calling OpenMP thread, or -1 if it has to use the locked fallback */
+	static int threadSlot(size_t nSlots);
+	static size_t maxThreads();
+
+	/** Consume all buffered records, returns false if there were none */
+	virtual bool consumeAll() = 0;
+	/** Commit the backend after all pending records were consumed */
+	virtual void commitAll() = 0;
+
+private:
+	void run();
+	void waitDrained();
+	void rethrowError();
+
+	std::thread writer;
+	std::atomic<bool> running;
+	std::atomic<size_t> drainRequest, drainDone;
+	std::mutex errorMutex;
+	std::exception_ptr error; ///< first exception of the consumer, not yet rethrown
+};
+
+/**
+ @class AsyncPipeline
+ @brief Decouples the producers of records from a single consumer
+
+ Every OpenMP thread pushes its records into its own lock-free ring buffer,
+ so producers never wait for each other or for the consumer; they only wait
+ if their buffer is full. A dedicated writer thread passes the records to
+ consume() of the consumer and calls its commit() when drain() is requested.
+ Records from threads that are not part of an active outermost OpenMP team,
+ e.g. the main thread or other threads, are queued under a lock.
+ */
+template<class T, class Consumer>
+class AsyncPipeline: public AsyncPipelineBase {
+	Consumer *consumer;
+	std::vector<RingBuffer<T> *> rings;
+	std::mutex overflowMutex;
+	std::deque<T> overflow;
+
+protected:
+	bool consumeAll() {
+		bool found = false;
+		T record;
+		for (size_t i = 0; i < rings.size(); i++) {
+			while (rings[i]->pop(record)) {
+				consumer->consume(record);
+				found = true;
+			}
+		}
+		std::lock_guard<std::mutex> lock(overflowMutex);
+		while (!overflow.empty()) {
+			consumer->consume(overflow.front());
+			overflow.pop_front();
+			found = true;
+		}
+		return found;
+	}
+
+	void commitAll() {
+		consumer->commit();
+	}
+
+public:
+	/**
+	 @param consumer	object with consume(T&) and commit() methods, called by the writer thread
+	 @param capacity	number of records buffered per thread
+	 */
+	AsyncPipeline(Consumer *consumer, size_t capacity = 4096) :
+			consumer(consumer) {
+		for (size_t i = 0; i < maxThreads(); i++)
+			rings.push_back(new RingBuffer<T>(capacity));
+		start();
+	}
+
+	~AsyncPipeline() {
+		stop();
+		for (size_t i = 0; i < rings.size(); i++)
+			delete rings[i];
+	}
+
+	/** Move a record into the pipeline, waits if the buffer of the thread is full */
+	void push(T &record) {
+		int slot = threadSlot(rings.size());
+		if (slot < 0) {
+			std::lock_guard<std::mutex> lock(overflowMutex);
+			overflow.push_back(T());
+			std::swap(overflow.back(), record);
+			return;
+		}
+		while (!rings[slot]->push(record))
+			std::this_thread::yield();
+	}
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_ASYNCPIPELINE_H
@@ -0,0 +1,118 @@
+#ifndef CRPROPA_BACKTRACKING_H
+#define CRPROPA_BACKTRACKING_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** State of a back-tracked anti-particle at the end of its trajectory */
+struct BackTrackingResult {
+	Vector3d position; ///< last position [m]
+	Vector3d direction; ///< direction at the last position
+	double trajectoryLength; ///< [m]
+	bool escaped; ///< reached the sphere of the galaxy
+	BackTrackingResult() : trajectoryLength(0), escaped(false) {
+	}
+};
+
+/**
+ @class BackTracking
+ @brief Back-tracking of observed events for many rigidities and field models, with a cache of the results.
+
+ The anti-particles of the events are started at the observer in the
+ direction of their arrival, i.e. pointing to the sky where the events came
+ from, and propagated with PropagationCK until they leave the sphere of the
+ galaxy or reach the maximum trajectory length. run() tracks every
+ combination of the added events, rigidities and field models which is not
+ in the cache yet, distributed dynamically over the OpenMP threads. Each
+ field model gets one module list, which all threads share, so a field is
+ loaded only once.
+
+ The results are cached by the name of the field model, the direction and
+ the rigidity, and the cache can be saved and loaded, so repeated analyses
+ reuse the earlier trajectories. Changing the observer, the galaxy or the
+ propagation settings clears the cache.
+ */
+class BackTracking: public Referenced {
+public:
+	/** Constructor
+	 @param observer	position of the observer, the galaxy is centered at the origin
+	 @param radius		radius of the galaxy
+	 */
+	BackTracking(const Vector3d &observer = Vector3d(-8.5 * kpc, 0, 0), double radius = 20 * kpc);
+
+	/** Add an event by its arrival direction, returns its index */
+	size_t addEvent(const Vector3d &direction);
+	/** Add a rigidity E / |Z| [J], returns its index */
+	size_t addRigidity(double rigidity);
+	/** Add a field model, returns its index. The name identifies the field in
+	 the cache, so it has to change if the field changes. */
+	size_t addField(const std::string &name, ref_ptr<MagneticField> field);
+	size_t getNumberOfEvents() const;
+	size_t getNumberOfRigidities() const;
+	size_t getNumberOfFields() const;
+
+	/** Particle id of the tracked particles (default anti-proton) */
+	void setParticleId(int id);
+	int getParticleId() const;
+	/** Settings of PropagationCK (default 1e-4, 0.1 pc, 100 pc) */
+	void setPropagation(double tolerance, double minStep, double maxStep);
+	/** Maximum trajectory length of a particle (default 1 Mpc) */
+	void setMaximumTrajectoryLength(double length);
+	double getMaximumTrajectoryLength() const;
+
+	/** Track all combinations that are not in the cache
+	 @returns	number of tracked particles
+	 */
+	size_t run();
+	/** Result of an event, rigidity and field model after run() */
+	BackTrackingResult getResult(size_t event, size_t rigidity, size_t field) const;
+	/** Check if the result of an event, rigidity and field model is cached */
+	bool isCached(size_t event, size_t rigidity, size_t field) const;
+
+	/** Number of cached results */
+	size_t getCacheSize() const;
+	void clearCache();
+	/** Write the cached results with the settings to a binary file */
+	void saveCache(const std::string &filename) const;
+	/** Add the results of a file, throws std::runtime_error if its settings differ */
+	void loadCache(const std::string &filename);
+
+	std::string getDescription() const;
+
+private:
+	typedef std::tuple<std::string, double, double, double, double> Key;
+	struct Field {
+		std::string name;
+		ref_ptr<MagneticField> field;
+	};
+	Vector3d observer;
+	double radius;
+	int id;
+	double tolerance, minStep, maxStep, maxLength;
+	std::vector<Vector3d> events;
+	std::vector<double> rigidities;
+	std::vector<Field> fields;
+	std::map<Key, BackTrackingResult> cache;
+
+	Key getKey(size_t event, size_t rigidity, size_t field) const;
+	std::vector<double> getSettings() const;
+	ref_ptr<ModuleList> createSimulation(MagneticField *field) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_BACKTRACKING_H
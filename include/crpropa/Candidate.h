@@ -1,10 +1,13 @@
 #ifndef CRPROPA_CANDIDATE_H
 #define CRPROPA_CANDIDATE_H
 
+#include "crpropa/MemoryUsage.h"
 #include "crpropa/ParticleState.h"
 #include "crpropa/Referenced.h"
-#include "crpropa/AssocVector.h"
+#include "crpropa/SymbolTable.h"
+#include "crpropa/SharedPropertyMap.h"
 #include "crpropa/Variant.h"
+#include "crpropa/ThinningPolicy.h"
 
 #include <vector>
 #include <map>
@@ -33,8 +36,8 @@ public:
 
 	std::vector<ref_ptr<Candidate> > secondaries; /**< Secondary particles from interactions */
 
-	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
-	PropertyMap properties; /**< Map of property names and their values. */
+	typedef SharedPropertyMap PropertyMap;
+	PropertyMap properties; /**< Map of property names (as Symbol, see SymbolTable) and their values, shared with the secondaries until modified. */
 
 	/** Parent candidate. 0 if no parent (initial particle). Must not be a ref_ptr to prevent circular referencing. */
 	Candidate *parent;
@@ -46,12 +49,39 @@ private:
 	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
 	double currentStep; /**< Size of the currently performed step in [m] comoving units */
 	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
-	std::string tagOrigin; /**< Name of interaction/source process which created this candidate*/
+	Symbol tagOrigin; /**< Name of interaction/source process which created this candidate*/
 
-	static uint64_t nextSerialNumber;
 	uint64_t serialNumber;
 
+	bool detached; /**< Parent linkage is kept as serial numbers only */
+	uint64_t sourceSerialNumber; /**< Serial number of the source candidate, if detached */
+	uint64_t createdSerialNumber; /**< Serial number of the parent candidate, if detached */
+
+	// accounts the live candidates in MemoryUsage, also for copies
+	struct LiveCount {
+		LiveCount() {
+			MemoryUsage::add(MemoryUsage::Candidates, sizeof(Candidate), 1);
+		}
+		LiveCount(const LiveCount &) {
+			MemoryUsage::add(MemoryUsage::Candidates, sizeof(Candidate), 1);
+		}
+		~LiveCount() {
+			MemoryUsage::add(MemoryUsage::Candidates, -int64_t(sizeof(Candidate)), -1);
+		}
+	} liveCount;
+
+	static int snapshots; // see setSnapshots
+	void copySnapshots(Candidate *secondary) const;
+
 public:
+	/** States kept up to date besides the current state, see setSnapshots */
+	enum Snapshot {
+		SnapshotNone = 0,
+		SnapshotPrevious = 1, ///< previous state, copied at the start of each step
+		SnapshotCreated = 2, ///< created state of the secondaries
+		SnapshotAll = 3
+	};
+
 	Candidate(
 		int id = 0,
 		double energy = 0,
@@ -59,7 +89,7 @@ public:
 		Vector3d direction = Vector3d(-1, 0, 0),
 		double z = 0,
 		double weight = 1., 
-		std::string tagOrigin = "PRIM"
+		const std::string &tagOrigin = "PRIM"
 	);
 
 	/**
@@ -102,8 +132,10 @@ public:
 	/**
 	 Sets the tagOrigin of the candidate. Can be used to trace back the interactions
 	 */
-	void setTagOrigin(std::string tagOrigin);
-	std::string getTagOrigin() const;
+	void setTagOrigin(const std::string &tagOrigin);
+	void setTagOrigin(Symbol tagOrigin);
+	const std::string &getTagOrigin() const;
+	Symbol getTagOriginSymbol() const;
 
 	/**
 	 Make a bid for the next step size: the lowest wins.
@@ -115,6 +147,15 @@ public:
 	bool removeProperty(const std::string &name);
 	bool hasProperty(const std::string &name) const;
 
+	/** Property access with the handle of the property name, see SymbolTable::intern */
+	void setProperty(Symbol name, const Variant &value);
+	const Variant &getProperty(Symbol name) const;
+	bool removeProperty(Symbol name);
+	bool hasProperty(Symbol name) const;
+	/** Value of a property, NULL if the candidate does not have it. One
+	 lookup instead of hasProperty and getProperty. */
+	const Variant *findProperty(Symbol name) const;
+
 	/**
 	 Add a new candidate to the list of secondaries.
 	 @param c Candidate
@@ -128,21 +169,24 @@ public:
 	inline void addSecondary(ref_ptr<Candidate> c) { addSecondary(c.get()); };
 	/**
 	 Add a new candidate to the list of secondaries.
+	 If a ThinningPolicy is set, the secondary may be dropped instead,
+	 kept secondaries then carry the inverse survival probability as weight;
+	 secondaries below its minimum energy are only added to its tally.
 	 @param id			particle ID of the secondary
 	 @param energy		energy of the secondary
 	 @param w			weight of the secondary
 	 @param tagOrigin 	tag of the secondary
 	 */
-	void addSecondary(int id, double energy, double w = 1., std::string tagOrigin = "SEC");
+	void addSecondary(int id, double energy, double w = 1., const std::string &tagOrigin = "SEC");
 	/**
-	 Add a new candidate to the list of secondaries.
+	 Add a new candidate to the list of secondaries, see above.
 	 @param id			particle ID of the secondary
 	 @param energy		energy of the secondary
 	 @param position	start position of the secondary
 	 @param w			weight of the secondary
 	 @param tagOrigin 	tag of the secondary
 	 */
-	void addSecondary(int id, double energy, Vector3d position, double w = 1., std::string tagOrigin = "SEC");
+	void addSecondary(int id, double energy, Vector3d position, double w = 1., const std::string &tagOrigin = "SEC");
 	void clearSecondaries();
 
 	std::string getDescription() const;
@@ -157,10 +201,30 @@ public:
 	/** Serial number of candidate at creation */
 	uint64_t getCreatedSerialNumber() const;
 
-	/** Set the next serial number to use */
+	/**
+	 Remove the link to the parent candidate.
+	 The serial numbers of the parent and of the source candidate are stored,
+	 so that the parent can be deleted while this candidate is still in use.
+	 */
+	void detachFromParent();
+
+	/**
+	 Set the serial numbers of the source and of the parent candidate of a
+	 candidate without parent, e.g. when it is restored from a file.
+	 */
+	void setParentSerialNumbers(uint64_t source, uint64_t created);
+
+	/** Set the next serial number to use.
+	 Serial numbers are handed out to the threads in blocks, which are all
+	 discarded by this call. It must not be called while candidates are
+	 created by other threads.
+	 */
 	static void setNextSerialNumber(uint64_t snr);
 
-	/** Get the next serial number that will be assigned */
+	/** Get the next serial number that will be assigned.
+	 When several threads created candidates, this is the end of the last
+	 reserved block, so that continuing from it does not repeat a number.
+	 */
 	static uint64_t getNextSerialNumber();
 
 	/**
@@ -169,6 +233,61 @@ public:
 	 */
 	ref_ptr<Candidate> clone(bool recursive = false) const;
 
+	/**
+	 Recycle the memory of deleted candidates in a thread-local pool.
+	 New candidates, e.g. from addSecondary() and clone(), are then allocated
+	 from the pool of the current thread, which avoids most calls to malloc/free
+	 in cascade simulations. The pooling only affects where the memory of a
+	 candidate comes from; candidates are still released via ref_ptr.
+	 See also ModuleList::setCandidatePool.
+	 */
+	static void setPoolAllocation(bool enable);
+	static bool getPoolAllocation();
+
+	/**
+	 Create new candidates with thread-confined reference counting.
+	 The reference counters of such candidates are updated without atomic
+	 operations (see Referenced::setThreadConfined). Candidates that are
+	 shared between threads, e.g. by ParticleCollector or the breadth-first
+	 queue of ModuleList, are switched to atomic counting when they are shared.
+	 Disabled by default; enable it only if the candidates are not referenced
+	 by several threads outside of these cases. See also
+	 ModuleList::setThreadConfinement.
+	 */
+	static void setThreadConfinement(bool enable);
+	static bool getThreadConfinement();
+
+	/**
+	 Thin the secondaries of all interaction modules, which add their
+	 secondaries with addSecondary(id, energy, ...). Set before the
+	 simulation starts; 0 (default) for no thinning.
+	 */
+	static void setThinningPolicy(ref_ptr<ThinningPolicy> policy);
+	static ref_ptr<ThinningPolicy> getThinningPolicy();
+
+	/**
+	 Select the states the simulation needs besides the current and the source
+	 state (default SnapshotAll), see ModuleList::setSnapshots. Without
+	 SnapshotPrevious, the propagation modules do not copy the current to
+	 the previous state in each step (savePrevious) and the secondaries do not
+	 copy the previous state of the parent; their created state is then the
+	 current state of the parent. Without SnapshotCreated the secondaries
+	 keep the default created state. Modules that read the previous state,
+	 e.g. the observers and boundaries detecting a crossing within the step,
+	 and outputs of the created state must not be used without them.
+	 @param snapshots	combination of Snapshot flags
+	 */
+	static void setSnapshots(int snapshots);
+	static int getSnapshots();
+	/** Copy the current to the previous state at the start of a step, if selected */
+	inline void savePrevious() {
+		if (snapshots & SnapshotPrevious)
+			previous = current;
+	}
+
+	static void *operator new(std::size_t size);
+	static void operator delete(void *p, std::size_t size);
+
 	/**
 	 Copy the source particle state to the current state
 	 and activate it if inactive, e.g. restart it
@@ -0,0 +1,64 @@
+#ifndef CRPROPA_CANDIDATESTREAM_H
+#define CRPROPA_CANDIDATESTREAM_H
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/Source.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class CandidateStream
+ @brief Sequential reader of the candidates of a run, see ModuleList::run(CandidateStream*).
+
+ A stream gives the candidates of an input too large for the memory, e.g.
+ the events of a previous stage, in the order of the input and in chunks.
+ ModuleList::run reads the chunks in a background thread while the candidates
+ of the previous chunks are propagated, so next() is never called
+ concurrently. In Python, next() can be implemented by a subclass, e.g. to
+ create the candidates from an iterator over NumPy arrays.
+ */
+class CandidateStream: public Referenced {
+public:
+	virtual ~CandidateStream() {
+	}
+	/** Up to n next candidates, none at the end of the stream */
+	virtual std::vector<ref_ptr<Candidate> > next(size_t n) = 0;
+	virtual std::string getDescription() const;
+};
+
+/**
+ @class SourceStream
+ @brief Stream of the candidates 0 ... count - 1 of a source.
+
+ The candidates are requested by their index with
+ SourceInterface::getCandidates, so that readers with random access such as
+ HDF5Reader read each chunk at once. The stream is read in a background
+ thread, which draws from random streams of its own (see
+ ModuleList::run(CandidateStream*)), so the source may draw random numbers;
+ they are not those of ModuleList::run(source, count).
+ */
+class SourceStream: public CandidateStream {
+	ref_ptr<SourceInterface> source;
+	size_t count, position;
+public:
+	/** Constructor
+	 @param source	source of the candidates, e.g. an HDF5Reader
+	 @param count	number of candidates
+	 */
+	SourceStream(ref_ptr<SourceInterface> source, size_t count);
+	std::vector<ref_ptr<Candidate> > next(size_t n);
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CANDIDATESTREAM_H
@@ -1,6 +1,7 @@
 #ifndef CRPROPA_COMMON_H
 #define CRPROPA_COMMON_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 /**
@@ -49,6 +50,30 @@ double interpolateEquidistant(double x, double lo, double hi,
 
 // Find index of value in a sorted vector X that is closest to x
 size_t closestIndex(double x, const std::vector<double> &X);
+
+// Variants with an index hint of the caller, e.g. a thread_local variable:
+// the search starts at the hint and gallops away from it (hunt, Numerical
+// Recipes 3.1), in O(1) for lookups close to the previous one, and stores
+// the index found in the hint. The results are those of the variants without hint.
+
+// Position of std::upper_bound(X.begin(), X.end(), x) in X
+size_t huntUpperBound(double x, const std::vector<double> &X, size_t &hint);
+// Position of std::lower_bound(X.begin(), X.end(), x) in X
+size_t huntLowerBound(double x, const std::vector<double> &X, size_t &hint);
+double interpolate(double x, const std::vector<double> &X,
+		const std::vector<double> &Y, size_t &hint);
+double interpolate2d(double x, double y, const std::vector<double> &X,
+		const std::vector<double> &Y, const std::vector<double> &Z,
+		size_t &hintX, size_t &hintY);
+size_t closestIndex(double x, const std::vector<double> &X, size_t &hint);
+
+// Write x as printf("%.<precision>E") would in the C locale, e.g. -1.23457E+05,
+// without locale and format parsing; buffer needs 32 chars, returns the length
+size_t formatScientific(char *buffer, double x, int precision = 5);
+
+// Write the integer x right-aligned to width as printf("%<width>i"), returns the length
+size_t formatInteger(char *buffer, int64_t x, int width = 0);
+size_t formatUnsigned(char *buffer, uint64_t x, int width = 0);
 /** @}*/
 
 
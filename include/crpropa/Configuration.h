@@ -0,0 +1,179 @@
+#ifndef CRPROPA_CONFIGURATION_H
+#define CRPROPA_CONFIGURATION_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/PhotonBackground.h"
+#include "crpropa/Source.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/Observer.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ConfigNode
+ @brief Value of a JSON document: null, boolean, number, string, array or object.
+
+ Physical quantities are given as numbers in SI units or as strings of a
+ number and units of Units.h, e.g. "10 Mpc", "1e18 eV", "3 * nG" or
+ "100 km / s". Vectors are arrays of three quantities.
+ */
+class ConfigNode {
+public:
+	enum Type {
+		Null, Boolean, Number, String, Array, Object
+	};
+
+private:
+	Type type;
+	bool boolean;
+	double number;
+	std::string string;
+	std::vector<ConfigNode> items;
+	std::vector<std::pair<std::string, ConfigNode> > members;
+
+public:
+	ConfigNode();
+
+	/** Parse a JSON document, throws std::runtime_error with the line of a syntax error */
+	static ConfigNode parse(const std::string &text);
+	/** Parse a JSON file */
+	static ConfigNode load(const std::string &filename);
+	/** Value of a quantity string "number units" in SI units */
+	static double parseQuantity(const std::string &quantity);
+
+	Type getType() const;
+	bool isNull() const;
+	/// number of items of an array or members of an object
+	size_t size() const;
+	bool has(const std::string &key) const;
+	std::vector<std::string> getKeys() const;
+
+	/// member of an object, throws std::runtime_error if it is missing
+	const ConfigNode &operator[](const std::string &key) const;
+	/// item of an array
+	const ConfigNode &operator[](size_t i) const;
+
+	/// set a member of an object (or of null, which becomes an object), e.g. to override a value of a file
+	void set(const std::string &key, const ConfigNode &value);
+	/// append an item to an array (or to null, which becomes an array)
+	void append(const ConfigNode &item);
+	static ConfigNode fromBool(bool value);
+	static ConfigNode fromNumber(double value);
+	static ConfigNode fromString(const std::string &value);
+	static ConfigNode emptyArray();
+	static ConfigNode emptyObject();
+
+	bool asBool() const;
+	double asNumber() const;
+	const std::string &asString() const;
+	/// number or quantity string in SI units
+	double asQuantity() const;
+	/// array of three quantities
+	Vector3d asVector() const;
+
+	/// members with default values
+	bool getBool(const std::string &key, bool defaultValue) const;
+	double getNumber(const std::string &key, double defaultValue) const;
+	double getQuantity(const std::string &key, double defaultValue) const;
+	std::string getString(const std::string &key, const std::string &defaultValue) const;
+	Vector3d getVector(const std::string &key, const Vector3d &defaultValue) const;
+};
+
+/**
+ @class SimulationConfig
+ @brief Builds a simulation from a declarative JSON configuration.
+
+ The configuration is an object with the members
+ - "magneticFields": object of named magnetic fields
+ - "modules": array of the modules of the ModuleList
+ - "source": object with the array "features" of the source features
+ - "run": options of the run: "count", "recursive", "secondariesFirst",
+   "seed", "threads", "showProgress", "batchSize" and "skipInactive", and
+   "initThreads", the number of threads constructing the modules (see
+   ModuleList::addParallel, default: all)
+
+ Every field, module and feature is an object with the member "type", the
+ class name, and the arguments of its constructor by name:
+
+ 	{
+ 	  "magneticFields": {"igmf": {"type": "UniformMagneticField", "value": ["1 nG", 0, 0]}},
+ 	  "modules": [
+ 	    {"type": "PropagationCK", "field": "igmf", "maxStep": "1 Mpc"},
+ 	    {"type": "PhotoPionProduction", "photonField": "CMB"},
+ 	    {"type": "MaximumTrajectoryLength", "length": "100 Mpc"},
+ 	    {"type": "Observer", "features": [{"type": "ObserverSurface", "surface":
+ 	        {"type": "Sphere", "center": [0, 0, 0], "radius": "10 Mpc"}}],
+ 	     "onDetection": {"type": "TextOutput", "filename": "events.txt", "outputType": "Event3D"}}
+ 	  ],
+ 	  "source": {"features": [{"type": "SourceParticleType", "nucleus": [1, 1]},
+ 	    {"type": "SourcePowerLawSpectrum", "Emin": "1 EeV", "Emax": "100 EeV", "index": -1}]},
+ 	  "run": {"count": 1000, "seed": 42}
+ 	}
+
+ Fields are referenced by name or given inline, photon fields by class name.
+ See the documentation of the simulation modules for the supported types;
+ further types can be added with registerModule, registerSourceFeature and
+ registerMagneticField; module factories must be thread-safe, as the modules
+ are constructed concurrently. The executable crpropa-run runs a configuration file.
+ */
+class SimulationConfig: public Referenced {
+public:
+	typedef ref_ptr<Module> (*ModuleFactory)(const ConfigNode &node, const SimulationConfig &config);
+	typedef ref_ptr<SourceFeature> (*SourceFeatureFactory)(const ConfigNode &node, const SimulationConfig &config);
+	typedef ref_ptr<MagneticField> (*MagneticFieldFactory)(const ConfigNode &node, const SimulationConfig &config);
+
+private:
+	ConfigNode config;
+	std::map<std::string, ref_ptr<MagneticField> > magneticFields;
+	mutable std::map<std::string, ref_ptr<PhotonField> > photonFields;
+	ref_ptr<ModuleList> moduleList;
+	ref_ptr<Source> source;
+
+	void build();
+
+public:
+	/** Constructor
+	 @param config	parsed configuration, see ConfigNode::load
+	 */
+	SimulationConfig(const ConfigNode &config);
+	static ref_ptr<SimulationConfig> fromFile(const std::string &filename);
+	static ref_ptr<SimulationConfig> fromString(const std::string &text);
+
+	const ConfigNode &getConfig() const;
+	ref_ptr<ModuleList> getModuleList() const;
+	ref_ptr<Source> getSource() const;
+	/** Number of candidates of the run */
+	size_t getCount() const;
+
+	/** Apply the options of "run" and run the simulation */
+	void run();
+
+	/** Build a module, a field or a photon field of the configuration */
+	ref_ptr<Module> createModule(const ConfigNode &node) const;
+	ref_ptr<SourceFeature> createSourceFeature(const ConfigNode &node) const;
+	ref_ptr<ObserverFeature> createObserverFeature(const ConfigNode &node) const;
+	/// field given inline or by the name of an entry of "magneticFields"
+	ref_ptr<MagneticField> getMagneticField(const ConfigNode &node) const;
+	/// photon field by class name, e.g. "CMB" or "IRB_Gilmore12", shared by all modules
+	ref_ptr<PhotonField> getPhotonField(const std::string &name) const;
+
+	/** Add a type to the supported modules, source features or fields */
+	static void registerModule(const std::string &type, ModuleFactory factory);
+	static void registerSourceFeature(const std::string &type, SourceFeatureFactory factory);
+	static void registerMagneticField(const std::string &type, MagneticFieldFactory factory);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CONFIGURATION_H
@@ -10,6 +10,9 @@ namespace crpropa {
 /**
  @file
  @brief Cosmology functions
+
+ The conversions interpolate tables of the redshift and the distances, the
+ table intervals are found in constant time.
  */
 
 /**
@@ -46,6 +49,13 @@ double comovingDistance2Redshift(double distance);
  */
 double redshift2ComovingDistance(double redshift);
 
+/**
+ Redshift of a candidate at redshift z after a step of the given comoving
+ distance towards the observer at z = 0, or 0 if the step reaches the observer.
+ Equivalent to comovingDistance2Redshift(redshift2ComovingDistance(z) - step).
+ */
+double redshiftAfterComovingStep(double redshift, double step);
+
 /**
  Redshift of a comoving object at a given luminosity distance to an observer at z = 0.
  d_luminosity(z) = (1 + z) * d_comoving(z)
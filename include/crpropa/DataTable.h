@@ -0,0 +1,76 @@
+#ifndef CRPROPA_DATATABLE_H
+#define CRPROPA_DATATABLE_H
+
+#include "crpropa/MappedFile.h"
+#include "crpropa/MemoryUsage.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class DataTable
+ @brief Rows of numbers of a text data file, loaded from a memory-mapped binary copy.
+
+ The text file holds whitespace separated numbers, one row per line; lines
+ starting with '#' and lines without numbers are skipped.
+ When a text file is parsed, its rows are also written to a binary copy,
+ filename + ".bin" or, if the environment variable CRPROPA_TABLE_CACHE names a
+ directory, a file in that directory. Later loads, by any process, map the
+ binary copy into memory (MappedFile) instead of parsing the text, as long as
+ it is not older than the text file and was made from a text of the same size.
+ If the copy cannot be written, e.g. in a read-only data directory, the text
+ is parsed on every load.
+ */
+class DataTable: public Referenced {
+	ref_ptr<MappedFile> file;
+	std::vector<double> parsedValues;
+	std::vector<uint64_t> parsedOffsets;
+	const double *values;
+	const uint64_t *offsets;
+	size_t nRows;
+	MemoryAccount memory;
+
+	static bool cacheEnabled;
+	bool loadBinary(const std::string &filename);
+	void parse(const std::string &filename);
+	void writeBinary(const std::string &filename) const;
+
+	DataTable(const DataTable &);
+	DataTable &operator=(const DataTable &);
+public:
+	/** Load a table, throws std::runtime_error if the file cannot be read */
+	DataTable(const std::string &filename);
+
+	/** Number of rows */
+	size_t size() const;
+	/** Number of values in row i */
+	size_t columns(size_t i) const;
+	/** Values of row i */
+	const double *row(size_t i) const;
+	/** Value in row i and column j, no range check */
+	double get(size_t i, size_t j) const;
+	/** All values, row after row */
+	const double *data() const;
+	/** Number of all values */
+	size_t count() const;
+	/** True if loaded from the binary copy */
+	bool isMapped() const;
+
+	/** Name of the binary copy of a text file */
+	static std::string binaryFilename(const std::string &filename);
+	/** Write the binary copies when text files are parsed (default) */
+	static void setCacheEnabled(bool enabled);
+	static bool getCacheEnabled();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_DATATABLE_H
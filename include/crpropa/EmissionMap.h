@@ -3,20 +3,28 @@
 
 #include "Referenced.h"
 #include "Candidate.h"
+#include "Random.h"
 
 namespace crpropa {
 
 /**
  @class CylindricalProjectionMap
  @brief 2D histogram of spherical coordinates in equal-area projection
+
+ The bins are filled atomically, so several threads may fill a map at once.
+ The cdf for drawDirection is rebuilt by one thread after the map changed.
+ After freeze() the map can not be filled anymore and the directions are
+ drawn in constant time from an alias table of the bins.
  */
 class CylindricalProjectionMap : public Referenced {
 private:
 	size_t nPhi, nTheta;
 	double sPhi, sTheta;
 	mutable bool dirty;
+	bool frozen;
 	std::vector<double> pdf;
 	mutable std::vector<double> cdf;
+	AliasTable alias;
 
 	/** Calculate the cdf from the pdf */
 	void updateCdf() const;
@@ -41,6 +49,15 @@ public:
 	/** Check if the direction has a non zero propabiliy. */
 	bool checkDirection(const Vector3d &direction) const;
 
+	/** Build the alias table for drawDirection, fillBin throws afterwards */
+	void freeze();
+	bool isFrozen() const;
+	/** Sum of all bins */
+	double getTotal() const;
+	/** Ratio of the isotropic and the map probability density in the direction,
+	 the weight of a direction drawn from the map instead of isotropically */
+	double getIsotropicWeight(const Vector3d &direction) const;
+
 	const std::vector<double>& getPdf() const;
 	std::vector<double>& getPdf();
 
@@ -61,6 +78,12 @@ public:
  @brief Particle Type and energy binned emission maps.
 
  Use SourceEmissionMap to suppress directions at the source. Use EmissionMapFiller to create EmissionMap from Observer.
+ fillMap and getMap may be called by several threads at once, the maps are
+ created under a lock and the bins are incremented atomically. Every
+ thread remembers the maps it found in a small table, so the lock is only
+ taken the first time a thread looks up a map. Drawing and filling at the
+ same time is not supported, neither is changing the maps through getMaps,
+ freeze or load while filling.
  */
 class EmissionMap : public Referenced {
 public:
@@ -113,6 +136,12 @@ public:
 
 	/** Get the map for the specified pid and energy */
 	ref_ptr<CylindricalProjectionMap> getMap(int pid, double energy);
+	/** Get the map for the specified pid and energy, 0 if there is none */
+	ref_ptr<CylindricalProjectionMap> findMap(int pid, double energy) const;
+
+	/** Remove the empty maps and freeze the others for drawing in constant time,
+	 see CylindricalProjectionMap::freeze. Returns the number of maps. */
+	size_t freeze();
 
 	/** Save the content of the maps into a text file */
 	void save(const std::string &filename);
@@ -129,6 +158,19 @@ protected:
 	double minEnergy, maxEnergy, logStep;
 	size_t nPhi, nTheta, nEnergy;
 	map_t maps;
+
+private:
+	/** Key of the entries in the lookup tables of the threads, new for
+	 copies and after the maps changed, so old entries are never found */
+	class LookupId {
+	public:
+		uint64_t id;
+		LookupId();
+		LookupId(const LookupId &);
+		LookupId &operator=(const LookupId &);
+		void renew();
+	};
+	LookupId lookupId;
 };
 
 } // namespace crpropa
@@ -0,0 +1,88 @@
+#ifndef CRPROPA_EVENTREWEIGHTING_H
+#define CRPROPA_EVENTREWEIGHTING_H
+
+#include "crpropa/Source.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class EventReweighting
+ @brief Weights of the events of one simulation for other source models.
+
+ The events of a simulation with the sampling source, e.g. a hard spectrum
+ and a wide range of distances, are reused for a target source by weighting
+ each event with the ratio of the probability densities of its source state
+ in the target and the sampling source, see Source::getDensity. Weighted sums
+ of the events, with the product of this ratio and the candidate weight,
+ then estimate the results of a simulation with the target source. Both
+ sources must set the same quantities, with a sampling density that is not
+ zero where the target density is not, e.g.
+
+ 	sampling: SourceUniform1D, SourceRedshift1D, SourcePowerLawSpectrum(1 EeV, 1000 EeV, -1), SourceParticleType
+ 	target:   SourceUniform1D, SourceRedshift1D, SourcePowerLawSpectrum(1 EeV, 200 EeV, -2.5), SourceParticleType
+
+ Events with a sampling density of zero have the weight zero.
+
+ The redshift at the source is not part of the event: by default it is the
+ redshift of the comoving distance of the source position to the observer
+ position (the origin in 1D), alternatively a property of the candidates,
+ e.g. a column of an HDF5Output file read by HDF5Reader.
+
+ The files of BinaryOutput are mapped into memory, those of HDF5Output read
+ in chunks of setChunkSize rows, and the weights of the events computed in
+ parallel with OpenMP.
+ */
+class EventReweighting: public Referenced {
+public:
+	/** Constructor
+	 @param sampling	source of the simulation
+	 @param target		source model of the weights
+	 */
+	EventReweighting(ref_ptr<Source> sampling, ref_ptr<Source> target);
+
+	/** Position of the observer for the distance of the sources (default origin) */
+	void setObserverPosition(const Vector3d &position);
+	Vector3d getObserverPosition() const;
+	/** Property with the redshift at the source, the distance is used if empty (default) */
+	void setRedshiftProperty(const std::string &name);
+	std::string getRedshiftProperty() const;
+	/** Number of rows of a HDF5 file read at once (default 65536) */
+	void setChunkSize(size_t rows);
+	size_t getChunkSize() const;
+
+	/** Ratio of the target and the sampling density of a source state and redshift */
+	double getWeight(const ParticleState &source, double redshift) const;
+	/** Weight of a detected candidate, without its candidate weight */
+	double getWeight(const Candidate *candidate) const;
+	/** Redshift at the source of a candidate */
+	double getSourceRedshift(const Candidate *candidate) const;
+
+	/** Weights of the candidates of a collector */
+	std::vector<double> reweight(const ParticleCollector *collector) const;
+	/** Weights of the events of a BinaryOutput or HDF5Output file, in the order of the file */
+	std::vector<double> reweight(const std::string &filename) const;
+
+	std::string getDescription() const;
+
+private:
+	ref_ptr<Source> sampling, target;
+	Vector3d observer;
+	std::string redshiftProperty;
+	size_t chunkSize;
+
+	double getRedshift(const Vector3d &position) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_EVENTREWEIGHTING_H
@@ -32,6 +32,12 @@ public:
 	 @param point	vector corresponding to the point to which compute the normal vector
 	 */
 	virtual Vector3d normal(const Vector3d& point) const = 0;
+	/** Axis aligned bounding box of the surface, used by SurfaceCollection.
+	 Returns false for unbounded surfaces (default).
+	 @param lower	lower corner of the box
+	 @param upper	upper corner of the box
+	 */
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const {return false;};
 	virtual std::string getDescription() const {return "Surface without description.";};
 };
 
@@ -62,8 +68,11 @@ private:
 	double radius;
 public:
 	Sphere(const Vector3d& center, double radius);
+	Vector3d getCenter() const;
+	double getRadius() const;
 	virtual double distance(const Vector3d &point) const;
 	virtual Vector3d normal(const Vector3d& point) const;
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
 	virtual std::string getDescription() const;
 };
 
@@ -79,6 +88,64 @@ public:
 	ParaxialBox(const Vector3d& corner, const Vector3d& size);
 	virtual double distance(const Vector3d &point) const;
 	virtual Vector3d normal(const Vector3d& point) const;
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
+	virtual std::string getDescription() const;
+};
+
+
+/**
+ @class SurfaceCollection
+ @brief Union of many surfaces with a bounding volume hierarchy.
+
+ The bounded surfaces (see Surface::getBounds) are sorted into a tree of
+ axis aligned boxes, so that queries only evaluate the surfaces near the
+ point instead of all of them. Unbounded surfaces, e.g. planes, are always
+ evaluated. As a Surface the collection is the union of its surfaces: the
+ distance is the minimum of the signed distances, negative inside any of
+ the closed surfaces. It can therefore replace many ObserverSurface or
+ RestrictToRegion modules with a single one, e.g. for hundreds of spheres
+ around the galaxies of a cluster.
+ */
+class SurfaceCollection: public Surface {
+private:
+	struct Node {
+		Vector3d lower, upper;
+		size_t first, count; // surfaces of a leaf in order
+		size_t left, right; // children, a leaf if count > 0
+	};
+	std::vector<ref_ptr<Surface> > surfaces;
+	std::vector<size_t> unbounded; // surfaces without bounding box
+	std::vector<Vector3d> lowers, uppers;
+	// tree, built at the first query after adding surfaces
+	mutable bool dirty;
+	mutable std::vector<size_t> order; // bounded surfaces in tree order
+	mutable std::vector<Node> nodes;
+
+	void update() const;
+	size_t buildNode(size_t first, size_t count) const;
+	// index of the surface with the smallest (signed or absolute) distance
+	size_t nearest(const Vector3d &point, bool absolute, double &distance) const;
+public:
+	SurfaceCollection();
+	/** Add a surface, the tree is rebuilt at the next query */
+	void add(Surface *surface);
+	size_t size() const;
+	Surface *get(size_t i) const;
+
+	/** Index of the surface nearest to the point, size() if empty
+	 @param point		position to query
+	 @param distance	absolute distance to this surface
+	 */
+	size_t nearestSurface(const Vector3d &point, double &distance) const;
+	/** Absolute distance to the nearest surface, e.g. for limitNextStep */
+	double nearestDistance(const Vector3d &point) const;
+	/** Indices of the surfaces crossed on the straight step from previous to
+	 current, same criterion as ObserverSurface */
+	std::vector<size_t> crossedSurfaces(const Vector3d &previous, const Vector3d &current) const;
+
+	virtual double distance(const Vector3d &point) const;
+	virtual Vector3d normal(const Vector3d& point) const;
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
 	virtual std::string getDescription() const;
 };
 
@@ -2,11 +2,18 @@
 #define CRPROPA_GRID_H
 
 #include "crpropa/Referenced.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/HalfFloat.h"
+#include "crpropa/MemoryUsage.h"
+#include "crpropa/Numa.h"
 #include "crpropa/Vector3.h"
 
 #include "kiss/string.h"
 #include "kiss/logger.h"
 
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
 #include <vector>
 #include <type_traits>
 #if HAVE_SIMD
@@ -25,6 +32,15 @@ enum interpolationType {
   NEAREST_NEIGHBOUR
 };
 
+/** Memory layout of the grid values.
+If set to ROW_MAJOR, the z index is running fastest (standard)
+If set to TILED, bricks of 4x4x4 grid points are stored contiguously, so that
+the neighbours of a position are mostly in the same few cache lines */
+enum GridLayout {
+  ROW_MAJOR = 0,
+  TILED
+};
+
 /** Lower and upper neighbour in a periodically continued unit grid */
 inline void periodicClamp(double x, int n, int &lo, int &hi) {
 	lo = ((int(floor(x)) % (n)) + (n)) % (n);
@@ -78,6 +94,7 @@ public:
 	bool reflective;	// using reflective repetition of the grid instead of periodic
 	interpolationType ipol;	// Interpolation type used between grid points
 	bool clipVolume;	// Set grid values to 0 outside the volume if true
+	GridLayout layout;	// Memory layout of the grid values
 
 	/** Constructor for cubic grid
 	 @param	origin	Position of the lower left front corner of the volume
@@ -85,7 +102,7 @@ public:
 	 @param spacing	Spacing between grid points
 	 */
 	GridProperties(Vector3d origin, size_t N, double spacing) :
-		origin(origin), Nx(N), Ny(N), Nz(N), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), clipVolume(false) {
+		origin(origin), Nx(N), Ny(N), Nz(N), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), clipVolume(false), layout(ROW_MAJOR) {
 	}
 
 	/** Constructor for non-cubic grid
@@ -96,7 +113,7 @@ public:
 	 @param spacing	Spacing between grid points
 	 */
 	GridProperties(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) :
-		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), clipVolume(false) {
+		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), clipVolume(false), layout(ROW_MAJOR) {
 	}
 
 	/** Constructor for non-cubic grid with spacing vector
@@ -107,7 +124,7 @@ public:
 	 @param spacing	Spacing vector between grid points
 	*/
 	GridProperties(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) :
-		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(spacing), reflective(false), ipol(TRILINEAR), clipVolume(false) {
+		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(spacing), reflective(false), ipol(TRILINEAR), clipVolume(false), layout(ROW_MAJOR) {
 	}
 	
 	virtual ~GridProperties() {
@@ -128,6 +145,156 @@ public:
 	void setClipVolume(bool b) {
 		clipVolume = b;
 	}
+
+	/** set the memory layout of the grid values.
+	 * @param l: GridLayout (ROW_MAJOR, TILED) */
+	void setLayout(GridLayout l) {
+		layout = l;
+	}
+};
+
+/**
+ @class GridTraits
+ @brief Conversion between the stored values of a Grid and the values it returns.
+
+ Grids of float, double, Vector3f and Vector3d return what they store.
+ Compressed value types, like Vector3h, are decoded and multiplied with the
+ storage scale of the grid, see Grid::setStorageScale.
+ */
+template<typename T>
+struct GridTraits {
+	typedef T Value;
+	static const Value &decode(const T &v, float scale) {
+		return v;
+	}
+	static const T &encode(const Value &v, float scale) {
+		return v;
+	}
+};
+
+template<>
+struct GridTraits<Vector3h> {
+	typedef Vector3f Value;
+	static Value decode(const Vector3h &v, float scale) {
+		return v.toVector3f() * scale;
+	}
+	static Vector3h encode(const Value &v, float scale) {
+		return Vector3h(v / scale);
+	}
+};
+
+/**
+ @class GridStorage
+ @brief Values of a Grid, either owned or in a MappedFile.
+
+ A mapped storage is replaced by an owned copy of the values as soon as it is
+ resized or its vector is requested. Copies of a storage always own their
+ values.
+ */
+template<typename T>
+class GridStorage {
+	std::vector<T> values;
+	ref_ptr<MappedFile> file;
+	T *data;
+	MemoryAccount memory;
+
+	void detach() {
+		bool mapped = file.valid();
+		if (mapped) {
+			std::vector<T>(data, data + size()).swap(values);
+			file = 0;
+		}
+		data = values.data();
+		if (mapped)
+			place();
+		account();
+	}
+
+	void account() {
+		memory.set(size() * sizeof(T));
+	}
+
+	// interleave new owned values over the NUMA nodes, if enabled
+	void place() {
+		Numa::place(data, values.size() * sizeof(T));
+	}
+public:
+	GridStorage() : data(0), memory(MemoryUsage::Grids) {
+	}
+
+	GridStorage(const GridStorage &s) : memory(MemoryUsage::Grids) {
+		if (s.file.valid())
+			values.assign(s.data, s.data + s.size());
+		else
+			values = s.values;
+		data = values.data();
+		place();
+		account();
+	}
+
+	GridStorage &operator=(const GridStorage &s) {
+		if (this != &s) {
+			GridStorage copy(s);
+			values.swap(copy.values);
+			file = 0;
+			data = values.data();
+			account();
+		}
+		return *this;
+	}
+
+	T &operator[](size_t i) {
+		return data[i];
+	}
+
+	const T &operator[](size_t i) const {
+		return data[i];
+	}
+
+	size_t size() const {
+		return file.valid() ? file->size() / sizeof(T) : values.size();
+	}
+
+	/** Resize the storage, the values are kept */
+	void resize(size_t n) {
+		detach();
+		values.resize(n);
+		data = values.data();
+		place();
+		account();
+	}
+
+	/** Replace the values by n default values */
+	void reset(size_t n) {
+		std::vector<T>(n).swap(values);
+		file = 0;
+		data = values.data();
+		place();
+		account();
+	}
+
+	/** Use the content of a mapped file as values */
+	void map(ref_ptr<MappedFile> f) {
+		std::vector<T>().swap(values);
+		file = f;
+		data = static_cast<T *>(f->data());
+		account();
+	}
+
+	bool isMapped() const {
+		return file.valid();
+	}
+
+	/** Name of the mapped file, empty if the values are owned */
+	std::string getFilename() const {
+		return file.valid() ? file->getFilename() : std::string();
+	}
+
+	/** Owned values, a mapped storage is copied first */
+	std::vector<T> &vector() {
+		detach();
+		return values;
+	}
 };
 
 /**
@@ -141,7 +308,11 @@ public:
  */
 template<typename T>
 class Grid: public Referenced {
-	std::vector<T> grid;
+public:
+	/** Type of the interpolated values */
+	typedef typename GridTraits<T>::Value Value;
+private:
+	GridStorage<T> grid;
 	size_t Nx, Ny, Nz; /**< Number of grid points */
 	Vector3d origin; /**< Origin of the volume that is represented by the grid. */
 	Vector3d gridOrigin; /**< Grid origin */
@@ -149,6 +320,35 @@ class Grid: public Referenced {
 	bool clipVolume; /**< If set to true, all values outside of the grid will be 0*/
 	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
 	interpolationType ipolType; /**< Type of interpolation between the grid points */
+	GridLayout layout; /**< Memory layout of the grid values */
+	float storageScale; /**< Scale of compressed values, see setStorageScale */
+	unsigned int shiftX, shiftY, shiftZ; /**< log2 of the edges of the tiles */
+	size_t tilesY, tilesZ; /**< Number of tiles in y- and z-direction */
+
+	/** Edges of the tiles are 4 or 1 for axes with less than 4 grid points */
+	static unsigned int tileShift(size_t n) {
+		return (n >= 4) ? 2 : 0;
+	}
+
+	/** Number of grid points and tiles, without resizing the storage */
+	void setDimensions(size_t Nx, size_t Ny, size_t Nz) {
+		this->Nx = Nx;
+		this->Ny = Ny;
+		this->Nz = Nz;
+		shiftX = tileShift(Nx);
+		shiftY = tileShift(Ny);
+		shiftZ = tileShift(Nz);
+		tilesY = (Ny + (1 << shiftY) - 1) >> shiftY;
+		tilesZ = (Nz + (1 << shiftZ) - 1) >> shiftZ;
+	}
+
+	/** Number of values stored for the size and layout of the grid */
+	size_t storageSize() const {
+		if (layout == ROW_MAJOR)
+			return Nx * Ny * Nz;
+		size_t tilesX = (Nx + (1 << shiftX) - 1) >> shiftX;
+		return (tilesX * tilesY * tilesZ) << (shiftX + shiftY + shiftZ);
+	}
 
 public:
 	/** Constructor for cubic grid
@@ -156,7 +356,7 @@ public:
 	 @param	N		Number of grid points in one direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t N, double spacing) {
+	Grid(Vector3d origin, size_t N, double spacing) : layout(ROW_MAJOR), storageScale(1) {
 		setOrigin(origin);
 		setGridSize(N, N, N);
 		setSpacing(Vector3d(spacing));
@@ -172,7 +372,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) {
+	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) : layout(ROW_MAJOR), storageScale(1) {
 		setOrigin(origin);
 		setGridSize(Nx, Ny, Nz);
 		setSpacing(Vector3d(spacing));
@@ -188,7 +388,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing vector between grid points
 	*/
-	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) {
+	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) : layout(ROW_MAJOR), storageScale(1) {
 		setOrigin(origin);
 		setGridSize(Nx, Ny, Nz);
 		setSpacing(spacing);
@@ -201,11 +401,24 @@ public:
 	 @param p	GridProperties instance
      */
 	Grid(const GridProperties &p) :
-		origin(p.origin), spacing(p.spacing), reflective(p.reflective), ipolType(p.ipol) {
+		origin(p.origin), spacing(p.spacing), reflective(p.reflective), ipolType(p.ipol), layout(p.layout), storageScale(1) {
 		setGridSize(p.Nx, p.Ny, p.Nz);
 		setClipVolume(p.clipVolume);
 	}
 
+	/** Constructor for GridProperties with the values of a mapped file,
+	 without allocating the values first, see map()
+	 @param p		GridProperties instance with the ROW_MAJOR layout
+	 @param file	mapped file or shared memory with the values
+	 */
+	Grid(const GridProperties &p, ref_ptr<MappedFile> file) :
+		origin(p.origin), spacing(p.spacing), reflective(p.reflective), ipolType(p.ipol), layout(p.layout), storageScale(1) {
+		setDimensions(p.Nx, p.Ny, p.Nz);
+		setOrigin(origin);
+		setClipVolume(p.clipVolume);
+		map(file);
+	}
+
 	void setOrigin(Vector3d origin) {
 		this->origin = origin;
 		this->gridOrigin = origin + spacing/2;
@@ -213,13 +426,92 @@ public:
 
 	/** Resize grid, also enlarges the volume as the spacing stays constant */
 	void setGridSize(size_t Nx, size_t Ny, size_t Nz) {
-		this->Nx = Nx;
-		this->Ny = Ny;
-		this->Nz = Nz;
-		grid.resize(Nx * Ny * Nz);
+		setDimensions(Nx, Ny, Nz);
+		grid.resize(storageSize());
 		setOrigin(origin);
 	}
 
+	/** Change the memory layout of the grid values, the values are reordered.
+	 get(), interpolate() and the grid tools work with any layout, only
+	 getGrid() exposes the storage order. */
+	void setLayout(GridLayout layout) {
+		if (layout == this->layout)
+			return;
+		std::vector<T> values(Nx * Ny * Nz);
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++)
+					values[(ix * Ny + iy) * Nz + iz] = get(ix, iy, iz);
+		this->layout = layout;
+		grid.reset(storageSize());
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++)
+					get(ix, iy, iz) = values[(ix * Ny + iy) * Nz + iz];
+	}
+
+	GridLayout getLayout() const {
+		return layout;
+	}
+
+	/** Use the content of a mapped file as grid values instead of a copy.
+	 The file has to contain the values of the grid points in row-major order
+	 (z running fastest) without any header, as written by dumpGrid. The
+	 grid keeps the file mapped until it is resized, its layout is changed or
+	 getGrid() is called. Modified values are never written to the file.
+	 Throws std::runtime_error if the file does not match the grid size. */
+	void map(ref_ptr<MappedFile> file) {
+		if (layout != ROW_MAJOR)
+			throw std::runtime_error("Grid::map: the grid must have the ROW_MAJOR layout");
+		if (file->size() != Nx * Ny * Nz * sizeof(T))
+			throw std::runtime_error("Grid::map: file and grid size do not match");
+		grid.map(file);
+	}
+
+	/** Map the file with the given name, see map(ref_ptr<MappedFile>) */
+	void mapFile(const std::string &filename) {
+		map(new MappedFile(filename));
+	}
+
+	/** True if the grid values are in a mapped file, see map() */
+	bool isMapped() const {
+		return grid.isMapped();
+	}
+
+	/** Name of the mapped file, empty if the grid is not mapped */
+	std::string getMappedFilename() const {
+		return grid.getFilename();
+	}
+
+	/** Write the stored values of the grid points in row-major order without
+	 header, the format of map(), for any layout. With mapFile, processes
+	 then share the values of a grid instead of holding copies. */
+	void dumpValues(const std::string &filename) const {
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		if (!out.good())
+			throw std::runtime_error("Grid::dumpValues: could not open file " + filename);
+		if (layout == ROW_MAJOR) {
+			out.write((const char *) &grid[0], Nx * Ny * Nz * sizeof(T));
+		} else {
+			for (size_t ix = 0; ix < Nx; ix++)
+				for (size_t iy = 0; iy < Ny; iy++)
+					for (size_t iz = 0; iz < Nz; iz++)
+						out.write((const char *) &get(ix, iy, iz), sizeof(T));
+		}
+		if (!out.good())
+			throw std::runtime_error("Grid::dumpValues: could not write file " + filename);
+	}
+
+	/** Position of the value of grid point (ix, iy, iz) in getGrid() */
+	size_t storageIndex(size_t ix, size_t iy, size_t iz) const {
+		if (layout == ROW_MAJOR)
+			return ix * Ny * Nz + iy * Nz + iz;
+		size_t tile = ((ix >> shiftX) * tilesY + (iy >> shiftY)) * tilesZ + (iz >> shiftZ);
+		size_t mx = (1 << shiftX) - 1, my = (1 << shiftY) - 1, mz = (1 << shiftZ) - 1;
+		size_t local = (((ix & mx) << shiftY) + (iy & my)) << shiftZ | (iz & mz);
+		return (tile << (shiftX + shiftY + shiftZ)) + local;
+	}
+
 	void setSpacing(Vector3d spacing) {
 		this->spacing = spacing;
 		setOrigin(origin);
@@ -281,10 +573,26 @@ public:
 		return reflective;
 	}
 
+	interpolationType getInterpolationType() const {
+		return ipolType;
+	}
+
+	/** Set the scale of compressed values, e.g. of a Grid3h: a stored value
+	 of 1 corresponds to the value scale. Choose it so that the largest value is
+	 well within the range of the storage type. Without effect for grids of
+	 float, double, Vector3f or Vector3d. Stored values are not converted. */
+	void setStorageScale(float scale) {
+		storageScale = scale;
+	}
+
+	float getStorageScale() const {
+		return storageScale;
+	}
+
 	/** Choose the interpolation algorithm based on the set interpolation type.
 	  By default this it the trilinear interpolation. The user can change the
 	  routine with the setInterpolationType function.*/
-	T interpolate(const Vector3d &position) {
+	Value interpolate(const Vector3d &position) {
 		// check for volume
 		if (clipVolume) {
 			Vector3d edge = origin + Vector3d(Nx, Ny, Nz) * spacing;
@@ -292,64 +600,114 @@ public:
 			isInVolume &= (position.y >= origin.y) && (position.y <= edge.y);
 			isInVolume &= (position.z >= origin.z) && (position.z <= edge.z);
 			if (!isInVolume) 
-				return T(0.);
+				return Value(0.);
 		} 
 
 		if (ipolType == TRICUBIC)
-			return tricubicInterpolate(T(), position);
+			return tricubicInterpolate(Value(), position);
 		else if (ipolType == NEAREST_NEIGHBOUR)
 			return closestValue(position);
 		else
 			return trilinearInterpolate(position);
 	}
 
+	/** Storage indices and weights of the 8 neighbours of the trilinear
+	  interpolation at a position, e.g. for interpolating several grids of
+	  the same geometry and layout at once. The volume is not checked. */
+	void getTrilinearWeights(const Vector3d &position, size_t index[8], double weight[8]) const {
+		trilinearWeights(position, index, weight);
+	}
+
+	/** Number of values in storage order, including the padding of the TILED layout */
+	size_t getStorageSize() const {
+		return storageSize();
+	}
+
+	/** Interpolate the grid at n positions at once.
+	  Gives the same values as interpolate for each position. For the trilinear
+	  interpolation the neighbours of a block of positions are determined
+	  before their values are gathered. */
+	void interpolateMany(const Vector3d *positions, Value *values, size_t n) {
+		if ((ipolType != TRILINEAR) || clipVolume) {
+			for (size_t i = 0; i < n; i++)
+				values[i] = interpolate(positions[i]);
+			return;
+		}
+
+		const size_t blockSize = 16;
+		size_t index[blockSize][8];
+		double weight[blockSize][8];
+		for (size_t first = 0; first < n; first += blockSize) {
+			size_t m = std::min(blockSize, n - first);
+			for (size_t i = 0; i < m; i++)
+				trilinearWeights(positions[first + i], index[i], weight[i]);
+			for (size_t i = 0; i < m; i++)
+				values[first + i] = trilinearSum(Value(), index[i], weight[i]);
+		}
+	}
+
 	/** Inspector & Mutator */
 	T &get(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[storageIndex(ix, iy, iz)];
 	}
 
 	/** Inspector */
 	const T &get(size_t ix, size_t iy, size_t iz) const {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[storageIndex(ix, iy, iz)];
 	}
 
 	const T &periodicGet(size_t ix, size_t iy, size_t iz) const {
 		ix = periodicBoundary(ix, Nx);
 		iy = periodicBoundary(iy, Ny);
 		iz = periodicBoundary(iz, Nz);
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[storageIndex(ix, iy, iz)];
 	}
 
 	const T &reflectiveGet(size_t ix, size_t iy, size_t iz) const {
 		ix = reflectiveBoundary(ix, Nx);
 		iy = reflectiveBoundary(iy, Ny);
 		iz = reflectiveBoundary(iz, Nz);
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[storageIndex(ix, iy, iz)];
 	}
 
-	T getValue(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+	/** Value of a grid point, compressed values are decoded */
+	Value getValue(size_t ix, size_t iy, size_t iz) {
+		return GridTraits<T>::decode(grid[storageIndex(ix, iy, iz)], storageScale);
 	}
 
-	void setValue(size_t ix, size_t iy, size_t iz, T value) {
-		grid[ix * Ny * Nz + iy * Nz + iz] = value;
+	/** Set the value of a grid point, compressed values are encoded.
+	 A mapped grid is copied to memory first. */
+	void setValue(size_t ix, size_t iy, size_t iz, Value value) {
+		if (grid.isMapped())
+			grid.vector();
+		grid[storageIndex(ix, iy, iz)] = GridTraits<T>::encode(value, storageScale);
 	}
 
-	/** Return a reference to the grid values */
+	/** Return a reference to the grid values in storage order, see storageIndex.
+	 With the TILED layout the values of padding points are included. A mapped
+	 grid is copied to memory first. */
 	std::vector<T> &getGrid() {
-		return grid;
+		return grid.vector();
 	}
 
-	/** Position of the grid point of a given index */
+	/** Position of the grid point of a given index in getGrid() */
 	Vector3d positionFromIndex(int index) const {
-		int ix = index / (Ny * Nz);
-		int iy = (index / Nz) % Ny;
-		int iz = index % Nz;
+		if (layout == ROW_MAJOR) {
+			int ix = index / (Ny * Nz);
+			int iy = (index / Nz) % Ny;
+			int iz = index % Nz;
+			return Vector3d(ix, iy, iz) * spacing + gridOrigin;
+		}
+		size_t tile = index >> (shiftX + shiftY + shiftZ);
+		size_t local = index & ((1 << (shiftX + shiftY + shiftZ)) - 1);
+		size_t ix = ((tile / tilesZ / tilesY) << shiftX) + (local >> (shiftY + shiftZ));
+		size_t iy = (((tile / tilesZ) % tilesY) << shiftY) + ((local >> shiftZ) & ((1 << shiftY) - 1));
+		size_t iz = ((tile % tilesZ) << shiftZ) + (local & ((1 << shiftZ) - 1));
 		return Vector3d(ix, iy, iz) * spacing + gridOrigin;
 	}
 
 	/** Value of a grid point that is closest to a given position / nearest neighbour interpolation */
-	T closestValue(const Vector3d &position) const {
+	Value closestValue(const Vector3d &position) const {
 		Vector3d r = (position - gridOrigin) / spacing;
 		int ix, iy, iz;
 		if (reflective) {
@@ -370,7 +728,7 @@ public:
 			iy = (iy + Ny * (iy < 0)) % Ny;
 			iz = (iz + Nz * (iz < 0)) % Nz;
 		}
-		return get(ix, iy, iz);
+		return GridTraits<T>::decode(get(ix, iy, iz), storageScale);
 	}
 
 private:
@@ -379,14 +737,14 @@ private:
 		ix = periodicBoundary(ix, Nx);
 		iy = periodicBoundary(iy, Ny);
 		iz = periodicBoundary(iz, Nz);
-		return convertVector3fToSimd(grid[ix * Ny * Nz + iy * Nz + iz]);
+		return convertVector3fToSimd(GridTraits<T>::decode(grid[storageIndex(ix, iy, iz)], storageScale));
 	}
 
 	__m128 simdreflectiveGet(size_t ix, size_t iy, size_t iz) const {
 		ix = reflectiveBoundary(ix, Nx);
 		iy = reflectiveBoundary(iy, Ny);
 		iz = reflectiveBoundary(iz, Nz);
-		return convertVector3fToSimd(grid[ix * Ny * Nz + iy * Nz + iz]);
+		return convertVector3fToSimd(GridTraits<T>::decode(grid[storageIndex(ix, iy, iz)], storageScale));
 	}
 
 	__m128 convertVector3fToSimd(const Vector3f v) const {
@@ -493,9 +851,9 @@ private:
 			for (int iLoopY = -1; iLoopY < nrCubicInterpolations-1; iLoopY++) {
 				for (int iLoopZ = -1; iLoopZ < nrCubicInterpolations-1; iLoopZ++) {
 					if (reflective)
-						interpolateVaryZ[iLoopZ+1] = reflectiveGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ);
+						interpolateVaryZ[iLoopZ+1] = GridTraits<T>::decode(reflectiveGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ), storageScale);
 					else
-						interpolateVaryZ[iLoopZ+1] = periodicGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ);
+						interpolateVaryZ[iLoopZ+1] = GridTraits<T>::decode(periodicGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ), storageScale);
 				}
 				interpolateVaryY[iLoopY+1] = CubicInterpolateScalar(interpolateVaryZ[0], interpolateVaryZ[1], interpolateVaryZ[2], interpolateVaryZ[3], fZ);
 			}
@@ -505,8 +863,8 @@ private:
 		return result;
 	}
 
-	/** Interpolate the grid trilinear at a given position */
-	T trilinearInterpolate(const Vector3d &position) const {
+	/** Flat indices and weights of the 8 neighbours of a position for the trilinear interpolation */
+	void trilinearWeights(const Vector3d &position, size_t index[8], double weight[8]) const {
 		/** position on a unit grid */
 		Vector3d r = (position - gridOrigin) / spacing;
 
@@ -537,25 +895,84 @@ private:
 		double fZ1 = 1 - fZ0;
 
 		/** trilinear interpolation (see http://paulbourke.net/miscellaneous/interpolation) */
-		T b(0.);
-		b += get(iX0, iY0, iZ0) * fX1 * fY1 * fZ1;
-		b += get(iX1, iY0, iZ0) * fX0 * fY1 * fZ1;
-		b += get(iX0, iY1, iZ0) * fX1 * fY0 * fZ1;
-		b += get(iX0, iY0, iZ1) * fX1 * fY1 * fZ0;
-		b += get(iX1, iY0, iZ1) * fX0 * fY1 * fZ0;
-		b += get(iX0, iY1, iZ1) * fX1 * fY0 * fZ0;
-		b += get(iX1, iY1, iZ0) * fX0 * fY0 * fZ1;
-		b += get(iX1, iY1, iZ1) * fX0 * fY0 * fZ0;
-
+		index[0] = storageIndex(iX0, iY0, iZ0); weight[0] = fX1 * fY1 * fZ1;
+		index[1] = storageIndex(iX1, iY0, iZ0); weight[1] = fX0 * fY1 * fZ1;
+		index[2] = storageIndex(iX0, iY1, iZ0); weight[2] = fX1 * fY0 * fZ1;
+		index[3] = storageIndex(iX0, iY0, iZ1); weight[3] = fX1 * fY1 * fZ0;
+		index[4] = storageIndex(iX1, iY0, iZ1); weight[4] = fX0 * fY1 * fZ0;
+		index[5] = storageIndex(iX0, iY1, iZ1); weight[5] = fX1 * fY0 * fZ0;
+		index[6] = storageIndex(iX1, iY1, iZ0); weight[6] = fX0 * fY0 * fZ1;
+		index[7] = storageIndex(iX1, iY1, iZ1); weight[7] = fX0 * fY0 * fZ0;
+	}
+
+	/** Decoded value at a position in the storage */
+	Value decoded(size_t index) const {
+		return GridTraits<T>::decode(grid[index], storageScale);
+	}
+
+	/** Weighted sum of the neighbours */
+	template<typename U>
+	U trilinearSum(U, const size_t index[8], const double weight[8]) const {
+		Value b(0.);
+		for (int i = 0; i < 8; i++)
+			b += decoded(index[i]) * weight[i];
 		return b;
 	}
 
+#ifdef HAVE_SIMD
+	/** Vectorized weighted sum of the neighbours for vector grids.
+	  With AVX two neighbours are summed at once in the two halves of a register. */
+	Vector3f trilinearSum(Vector3f, const size_t index[8], const double weight[8]) const {
+#ifdef __AVX__
+		__m256 sum = _mm256_setzero_ps();
+		for (int i = 0; i < 8; i += 2) {
+			__m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(convertVector3fToSimd(decoded(index[i]))),
+					convertVector3fToSimd(decoded(index[i + 1])), 1);
+			__m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weight[i])),
+					_mm_set1_ps(weight[i + 1]), 1);
+#ifdef __FMA__
+			sum = _mm256_fmadd_ps(v, w, sum);
+#else
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v, w));
+#endif
+		}
+		__m128 res = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+#else // __AVX__
+		__m128 res = _mm_setzero_ps();
+		for (int i = 0; i < 8; i++)
+			res = _mm_add_ps(res, _mm_mul_ps(convertVector3fToSimd(decoded(index[i])), _mm_set1_ps(weight[i])));
+#endif // __AVX__
+		return convertSimdToVector3f(res);
+	}
+
+	/** Vectorized weighted sum of the neighbours for scalar grids */
+	float trilinearSum(float, const size_t index[8], const double weight[8]) const {
+		__m128 v0 = _mm_set_ps(grid[index[3]], grid[index[2]], grid[index[1]], grid[index[0]]);
+		__m128 v1 = _mm_set_ps(grid[index[7]], grid[index[6]], grid[index[5]], grid[index[4]]);
+		__m128 w0 = _mm_set_ps(weight[3], weight[2], weight[1], weight[0]);
+		__m128 w1 = _mm_set_ps(weight[7], weight[6], weight[5], weight[4]);
+		__m128 res = _mm_add_ps(_mm_mul_ps(v0, w0), _mm_mul_ps(v1, w1));
+		res = _mm_hadd_ps(res, res);
+		res = _mm_hadd_ps(res, res);
+		return _mm_cvtss_f32(res);
+	}
+#endif // HAVE_SIMD
+
+	/** Interpolate the grid trilinear at a given position */
+	Value trilinearInterpolate(const Vector3d &position) const {
+		size_t index[8];
+		double weight[8];
+		trilinearWeights(position, index, weight);
+		return trilinearSum(Value(), index, weight);
+	}
+
 }; // class Grid
 
 typedef Grid<double> Grid1d;
 typedef Grid<float> Grid1f;
 typedef Grid<Vector3f> Grid3f;
 typedef Grid<Vector3d> Grid3d;
+typedef Grid<Vector3h> Grid3h;
 
 /** @}*/
 
@@ -3,6 +3,7 @@
 
 #include "crpropa/Grid.h"
 #include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/advectionField/AdvectionField.h"
 #include <string>
 #include <array>
 
@@ -29,6 +30,22 @@ namespace crpropa {
  * @{
  */
 
+/** Standard diagnostics of a vector grid, see gridStatistics */
+struct GridStatistics {
+	Vector3d meanFieldVector; ///< mean of the vectors
+	double meanFieldStrength; ///< mean of the vector lengths
+	double rmsFieldStrength; ///< root mean square of the vector lengths
+	Vector3d rmsFieldStrengthPerAxis; ///< root mean square of the components
+	double maxFieldStrength; ///< largest vector length
+};
+
+/** Evaluate all diagnostics of a vector grid in a single pass over the grid.
+ The grid is summed in parallel with OpenMP in a fixed order, the result
+ does not depend on the number of threads.
+ @param grid		a vector grid (Grid3f)
+ */
+GridStatistics gridStatistics(ref_ptr<Grid3f> grid);
+
 /** Evaluate the mean vector of all grid points.
  @param grid		a vector grid (Grid3f)
  @returns The mean of all grid points along each axis
@@ -85,6 +102,23 @@ void fromMagneticField(ref_ptr<Grid3f> grid, ref_ptr<MagneticField> field);
  */
 void fromMagneticFieldStrength(ref_ptr<Grid1f> grid, ref_ptr<MagneticField> field);
 
+/** Fill a vector grid and a scalar grid from provided advection field.
+ The field and its divergence are sampled at the cell centers, for use in an
+ AdvectionFieldGrid. Throws std::runtime_error if the grids differ in size.
+ @param grid		a vector grid (Grid3f) for the field
+ @param divergence	a scalar grid (Grid1f) for the divergence
+ @param field		the advection field
+ */
+void fromAdvectionField(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence, ref_ptr<AdvectionField> field);
+
+/** Copy a Grid3f to a new Grid3h with half precision values.
+ The storage scale of the new grid is set to fit the largest component, the
+ other properties of the grid are copied.
+ @param grid		a vector grid (Grid3f)
+ @returns		grid with half the memory footprint
+ */
+ref_ptr<Grid3h> toHalfPrecision(ref_ptr<Grid3f> grid);
+
 /** Load a Grid3f from a binary file with single precision.
  @param grid		a vector grid (Grid3f)
  @param filename	name of input file
@@ -101,6 +135,22 @@ void loadGrid(ref_ptr<Grid3f> grid, std::string filename,
 void loadGrid(ref_ptr<Grid1f> grid, std::string filename,
 		double conversion = 1);
 
+/** Map a binary file with single precision into the memory of a Grid3f.
+ Instead of reading a copy, the grid uses the pages of the file in the page
+ cache, which are shared by all processes mapping the same file. The file has
+ the format written by dumpGrid and has to match the size of the grid, see
+ Grid::map. Use loadGrid to convert the values while loading.
+ @param grid		a vector grid (Grid3f) with the ROW_MAJOR layout
+ @param filename	name of input file
+ */
+void mapGrid(ref_ptr<Grid3f> grid, std::string filename);
+
+/** Map a binary file with single precision into the memory of a Grid1f.
+ @param grid		a scalar grid (Grid1f) with the ROW_MAJOR layout
+ @param filename	name of input file
+ */
+void mapGrid(ref_ptr<Grid1f> grid, std::string filename);
+
 /** Dump a Grid3f to a binary file.
  @param grid		a vector grid (Grid3f)
  @param filename	name of input file
@@ -117,6 +167,36 @@ void dumpGrid(ref_ptr<Grid3f> grid, std::string filename,
 void dumpGrid(ref_ptr<Grid1f> grid, std::string filename,
 		double conversion = 1);
 
+/** Publish a Grid3f as a named POSIX shared memory object.
+ Further processes on the node then map the grid with mapSharedGrid3f
+ instead of loading their own copy, e.g. for a MagneticFieldGrid
+ 	new MagneticFieldGrid(mapSharedGrid3f("/crpropa-field"))
+ The object holds the grid properties and the values in row-major order and
+ stays until unlinkSharedGrid or a reboot, also after this process ends. An
+ existing object of the name is replaced; processes that mapped it keep
+ their mapping.
+ @param grid	a vector grid (Grid3f)
+ @param name	name of the shared memory object, starting with /
+ */
+void publishGrid(ref_ptr<Grid3f> grid, const std::string &name);
+
+/** Publish a Grid1f as a named POSIX shared memory object, see publishGrid(ref_ptr<Grid3f>, ...) */
+void publishGrid(ref_ptr<Grid1f> grid, const std::string &name);
+
+/** Map a Grid3f published by publishGrid. The values are not copied: the
+ processes mapping the object share its pages, and modified values are
+ private copies of the touched pages (see MappedFile). Throws
+ std::runtime_error if there is no complete grid of this type.
+ @param name	name of the shared memory object
+ */
+ref_ptr<Grid3f> mapSharedGrid3f(const std::string &name);
+
+/** Map a Grid1f published by publishGrid, see mapSharedGrid3f */
+ref_ptr<Grid1f> mapSharedGrid1f(const std::string &name);
+
+/** Remove a shared memory object of publishGrid, the existing mappings stay valid */
+void unlinkSharedGrid(const std::string &name);
+
 /** Load a Grid3f grid from a plain text file.
  @param grid		a vector grid (Grid3f) to which the points will be loaded
  @param filename	name of input file
@@ -149,6 +229,45 @@ void dumpGridToTxt(ref_ptr<Grid3f> grid, std::string filename,
 void dumpGridToTxt(ref_ptr<Grid1f> grid, std::string filename,
 		double conversion = 1);
 
+#ifdef CRPROPA_HAVE_HDF5
+/** Dump a Grid3f to a compressed, self-describing HDF5 file.
+ The values are stored in the dataset "grid" with the shape (Nx, Ny, Nz, 3)
+ in chunks of whole x-slices of about 4 MB, compressed with the shuffle and
+ deflate filters. The origin, spacing, repetition, interpolation type and
+ volume clipping are stored as attributes of the dataset.
+ @param grid		a vector grid (Grid3f)
+ @param filename	name of output file
+ @param conversion	divide every point in grid by a conversion factor
+ @param compression	deflate level from 0 (no compression) to 9
+ */
+void dumpGridToHDF5(ref_ptr<Grid3f> grid, std::string filename,
+		double conversion = 1, int compression = 4);
+
+/** Dump a Grid1f to a compressed, self-describing HDF5 file.
+ The dataset "grid" has the shape (Nx, Ny, Nz), see the Grid3f version.
+ */
+void dumpGridToHDF5(ref_ptr<Grid1f> grid, std::string filename,
+		double conversion = 1, int compression = 4);
+
+/** Read the size and properties of a grid stored by dumpGridToHDF5 */
+GridProperties loadGridPropertiesFromHDF5(std::string filename);
+
+/** Load a Grid3f from a file written by dumpGridToHDF5.
+ The grid is resized and its origin, spacing, repetition, interpolation type
+ and volume clipping are taken from the file. The compressed chunks are
+ read one after the other and decompressed in parallel.
+ @param grid		a vector grid (Grid3f)
+ @param filename	name of input file
+ @param conversion	multiply every point in grid by a conversion factor
+ */
+void loadGridFromHDF5(ref_ptr<Grid3f> grid, std::string filename,
+		double conversion = 1);
+
+/** Load a Grid1f from a file written by dumpGridToHDF5, see the Grid3f version */
+void loadGridFromHDF5(ref_ptr<Grid1f> grid, std::string filename,
+		double conversion = 1);
+#endif // CRPROPA_HAVE_HDF5
+
 #ifdef CRPROPA_HAVE_FFTW3F
 /**
  Calculate the omnidirectional power spectrum E(k) for a given turbulent field
@@ -0,0 +1,107 @@
+#ifndef CRPROPA_HALFFLOAT_H
+#define CRPROPA_HALFFLOAT_H
+
+#include "crpropa/Vector3.h"
+
+#include <cstring>
+#include <stdint.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** Convert a float to an IEEE 754 half precision number, rounding to the nearest even */
+inline uint16_t floatToHalf(float f) {
+#ifdef __F16C__
+	return _cvtss_sh(f, 0);
+#else
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t a = x & 0x7fffffff;
+	// infinity and NaN
+	if (a >= 0x7f800000)
+		return sign | 0x7c00 | ((a > 0x7f800000) ? 0x200 : 0);
+	// too large, rounds to infinity
+	if (a >= 0x477ff000)
+		return sign | 0x7c00;
+	// too small, rounds to zero
+	if (a < 0x33000000)
+		return sign;
+	// subnormal half
+	if (a < 0x38800000) {
+		uint32_t m = (a & 0x7fffff) | 0x800000;
+		unsigned int shift = 126 - (a >> 23);
+		uint32_t h = m >> shift;
+		uint32_t rest = m & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if ((rest > halfway) || ((rest == halfway) && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	// normal half, the exponent is rebiased from 127 to 15
+	uint32_t h = (a - 0x38000000) >> 13;
+	uint32_t rest = a & 0x1fff;
+	if ((rest > 0x1000) || ((rest == 0x1000) && (h & 1)))
+		h++;
+	return sign | h;
+#endif
+}
+
+/** Convert an IEEE 754 half precision number to a float */
+inline float halfToFloat(uint16_t h) {
+#ifdef __F16C__
+	return _cvtsh_ss(h);
+#else
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t e = (h >> 10) & 0x1f;
+	uint32_t m = h & 0x3ff;
+	uint32_t x;
+	if (e == 0) {
+		// zero and subnormal numbers m * 2^-24
+		float f = m * 5.9604644775390625e-8f;
+		return (sign) ? -f : f;
+	} else if (e == 31) {
+		x = sign | 0x7f800000 | (m << 13);
+	} else {
+		x = sign | ((e + 112) << 23) | (m << 13);
+	}
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+#endif
+}
+
+/**
+ @class Vector3h
+ @brief Three dimensional vector of half precision numbers, used as compact storage of Grid3h.
+
+ Half precision numbers have a relative precision of 1e-3 and cover
+ 6e-5 to 65504 as normal numbers. Vector3h only stores values, convert to
+ Vector3f for any arithmetic.
+ */
+class Vector3h {
+public:
+	uint16_t x, y, z;
+
+	Vector3h() : x(0), y(0), z(0) {
+	}
+
+	explicit Vector3h(const Vector3f &v) :
+			x(floatToHalf(v.x)), y(floatToHalf(v.y)), z(floatToHalf(v.z)) {
+	}
+
+	Vector3f toVector3f() const {
+		return Vector3f(halfToFloat(x), halfToFloat(y), halfToFloat(z));
+	}
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_HALFFLOAT_H
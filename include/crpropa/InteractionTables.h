@@ -0,0 +1,84 @@
+#ifndef CRPROPA_INTERACTIONTABLES_H
+#define CRPROPA_INTERACTIONTABLES_H
+
+#include "crpropa/PhotonBackground.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup PhotonFields
+ * @{
+ */
+
+/**
+ @class InteractionTables
+ @brief Interaction tables computed at run time for any photon field.
+
+ The interaction modules read their rates ("rate") and cumulative rates in
+ the kinematic center of mass energy s - m^2 ("cdf") per photon field from
+ the data directory, as produced by CRPropa3-data. For a photon field without
+ data files, e.g. a custom PhotonField, the tables of
+   - EMPairProduction (rate, cdf)
+   - EMDoublePairProduction (rate)
+   - EMTripletPairProduction (rate, cdf)
+   - EMInverseComptonScattering (rate, cdf)
+   - PhotoPionProduction (rate, without tabulated redshift dependence)
+ are computed by integrating the cross sections over the photon density of
+ the field at z = 0, in parallel over the tabulated energies (OpenMP).
+ They are written in the format of the data files to the cache directory,
+ under a name containing a hash of the photon density, and reused as long
+ as the photon field does not change.
+
+ The modules call getTable for their files, which returns the data file if it
+ exists and otherwise, if the generation is enabled, the generated table.
+ */
+class InteractionTables {
+	static std::string cacheDirectory;
+	static bool generationEnabled;
+	// photo-pion cross section of PhotoPionProduction [m^2] on the integration grid
+	static std::vector<double> photoPionCrossSection(bool onProton);
+
+public:
+	/**
+	 Table file for an interaction module.
+	 @param process	name of the module, e.g. "EMPairProduction"
+	 @param kind	"rate" or "cdf"
+	 @param field	target photon field
+	 @returns		the data file if it exists or the generation is disabled,
+					otherwise the generated table, computed if not yet cached
+	 */
+	static std::string getTable(const std::string &process, const std::string &kind, const PhotonField *field);
+	/** Compute a table and write it to filename, throws std::runtime_error if not supported */
+	static void generate(const std::string &process, const std::string &kind, const PhotonField *field, const std::string &filename);
+	static bool isSupported(const std::string &process, const std::string &kind);
+
+	/**
+	 Interaction rate at z = 0 [1/m] from the integrated cross section
+	 @param process	name of the module
+	 @param field	target photon field
+	 @param E		energy of the photon, electron or nucleon [J]
+	 @param onProton	proton or neutron for PhotoPionProduction
+	 */
+	static double computeRate(const std::string &process, const PhotonField *field, double E, bool onProton = true);
+
+	/** Hash of the name, energy range and photon density at z = 0 of a field */
+	static uint64_t hash(const PhotonField *field);
+	/** Name of the generated table in the cache directory */
+	static std::string cacheFilename(const std::string &process, const std::string &kind, const PhotonField *field);
+
+	/** Directory of the generated tables, default: the environment variable
+	 CRPROPA_TABLE_CACHE, else $HOME/.crpropa/tables */
+	static void setCacheDirectory(const std::string &directory);
+	static std::string getCacheDirectory();
+	/** Compute missing tables in getTable (default false) */
+	static void setGenerationEnabled(bool enabled);
+	static bool getGenerationEnabled();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_INTERACTIONTABLES_H
@@ -0,0 +1,61 @@
+#ifndef CRPROPA_MAPPEDFILE_H
+#define CRPROPA_MAPPEDFILE_H
+
+#include "crpropa/Referenced.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class MappedFile
+ @brief Private, copy-on-write memory mapping of a whole file.
+
+ The file is opened read-only and is never modified. As long as the mapped
+ memory is only read, all processes mapping the same file share the pages of
+ the page cache of the operating system. Writing to the memory creates a
+ private copy of the touched page. On systems without mmap the file is read
+ into memory instead.
+
+ openShared maps a POSIX shared memory object in the same way, e.g. a grid
+ published with publishGrid, so that the processes of a node share one copy
+ in memory without a file.
+ */
+class MappedFile: public Referenced {
+	std::string filename;
+	void *address;
+	size_t length;
+	std::vector<char> buffer;
+
+	MappedFile();
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+public:
+	/** Map the file, throws std::runtime_error if this is not possible */
+	MappedFile(const std::string &filename);
+	~MappedFile();
+
+	/** Map a POSIX shared memory object from the offset to its end
+	 @param name	name of the object, e.g. /crpropa-field
+	 @param offset	start of the mapping, a multiple of the page size
+	 */
+	static ref_ptr<MappedFile> openShared(const std::string &name, size_t offset = 0);
+
+	/** Start of the mapped memory */
+	void *data() const;
+	/** Size of the file in bytes */
+	size_t size() const;
+	/** Name of the mapped file */
+	const std::string &getFilename() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_MAPPEDFILE_H
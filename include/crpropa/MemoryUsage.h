@@ -0,0 +1,103 @@
+#ifndef CRPROPA_MEMORYUSAGE_H
+#define CRPROPA_MEMORYUSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class MemoryUsage
+ @brief Accounting of the bytes held by the subsystems of the simulation.
+
+ The live candidates, the interaction tables, the owned grid values, the
+ buffers of the outputs and the matrices of magnetic lenses report their
+ sizes. Every thread accounts in its own counters, which are summed when
+ queried, so objects may be released by another thread than the one that
+ created them. The sizes are the main allocations, e.g. sizeof(Candidate)
+ without its secondaries and properties; tables and grids mapped from files
+ are counted with their mapped size.
+
+ During ModuleList::run the usage is polled after the candidates of a
+ thread: with a report interval, the report is printed periodically; with
+ a soft limit, the outputs flush their buffers as soon as the resident set
+ size of the process (or the accounted bytes, if it is not available)
+ exceeds the limit, see ModuleList::setMemoryLimit.
+ */
+class MemoryUsage {
+public:
+	enum Subsystem {
+		Candidates, Tables, Grids, OutputBuffers, Lenses
+	};
+	static const size_t nSubsystems = 5;
+
+	/** Add bytes and objects to a subsystem, negative to release them */
+	static void add(Subsystem subsystem, int64_t bytes, int64_t objects = 0);
+	static int64_t getBytes(Subsystem subsystem);
+	/** Number of accounted objects, e.g. live candidates */
+	static int64_t getObjects(Subsystem subsystem);
+	static int64_t getTotalBytes();
+	static std::string getName(Subsystem subsystem);
+	/** Current resident set size of the process [bytes], 0 if not available */
+	static size_t getResidentSetSize();
+	/** Table of the subsystems, the total and the resident set size */
+	static std::string getReport();
+
+	/** Soft limit of the memory [bytes], 0 to disable */
+	static void setSoftLimit(size_t bytes);
+	static size_t getSoftLimit();
+	/** Interval of the periodic reports during runs [s], 0 to disable */
+	static void setReportInterval(double seconds);
+	static double getReportInterval();
+	/** Whether the soft limit was exceeded at the last poll; a cheap check for the outputs */
+	static bool isOverLimit();
+	/** Update the limit check and print the report if due; at most every 0.1 s
+	 and by one thread at a time. Returns isOverLimit(). */
+	static bool poll();
+	/** Whether poll() has anything to do */
+	static bool getPolling();
+};
+
+/**
+ @class MemoryAccount
+ @brief Bytes held by one object in a subsystem of the MemoryUsage.
+
+ Set the size with set() whenever it changes; it is released with the
+ object. Copies account their own bytes.
+ */
+class MemoryAccount {
+	MemoryUsage::Subsystem subsystem;
+	int64_t bytes;
+public:
+	MemoryAccount(MemoryUsage::Subsystem subsystem) : subsystem(subsystem), bytes(0) {
+		MemoryUsage::add(subsystem, 0, 1);
+	}
+	MemoryAccount(const MemoryAccount &other) : subsystem(other.subsystem), bytes(0) {
+		MemoryUsage::add(subsystem, 0, 1);
+		set(other.bytes);
+	}
+	MemoryAccount &operator=(const MemoryAccount &other) {
+		set(other.bytes);
+		return *this;
+	}
+	~MemoryAccount() {
+		MemoryUsage::add(subsystem, -bytes, -1);
+	}
+	void set(size_t size) {
+		MemoryUsage::add(subsystem, int64_t(size) - bytes);
+		bytes = size;
+	}
+	size_t get() const {
+		return bytes;
+	}
+};
+/** @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_MEMORYUSAGE_H
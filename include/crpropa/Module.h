@@ -17,16 +17,59 @@ class Candidate;
  */
 class Module: public Referenced {
 	std::string description;
+	bool runOnInactive;
 public:
 	Module();
 	virtual ~Module() {
 	}
 	virtual std::string getDescription() const;
 	void setDescription(const std::string &description);
+	/**
+	 Mark the module to be called for candidates which were deactivated
+	 earlier in the same step, see ModuleList::setSkipInactive. Outputs and
+	 observers are marked by default.
+	 @param run	call the module for inactive candidates
+	 */
+	void setRunOnInactive(bool run = true);
+	inline bool getRunOnInactive() const {
+		return runOnInactive;
+	}
 	virtual void process(Candidate *candidate) const = 0;
 	inline void process(ref_ptr<Candidate> candidate) const {
 		process(candidate.get());
 	}
+	/**
+	 Process several candidates at once.
+	 The default implementation calls process() for every candidate. Modules
+	 can override it to avoid the virtual call per candidate or to vectorise
+	 the computation across candidates.
+	 @param candidates	array of n candidates
+	 @param n			number of candidates
+	 */
+	virtual void processBatch(Candidate **candidates, size_t n) const;
+	/**
+	 Estimate the next step this module allows at the current state.
+	 It is the limit process() would set with Candidate::limitNextStep,
+	 but is computed without random numbers and without changing the
+	 candidate, see StepPlanner. By default no limit is imposed.
+	 @param candidate	candidate in the state before the next step
+	 @returns			step limit (std::numeric_limits<double>::max() for none)
+	 */
+	virtual double getStepLimit(const Candidate *candidate) const;
+	/**
+	 Total rate of the stochastic interactions of this module at the
+	 current state, per comoving distance, as used by process().
+	 Interaction modules implement it together with interact(), see
+	 InteractionManager. By default the module has no interactions.
+	 @param candidate	candidate in the current state
+	 @returns			interaction rate [1/m]
+	 */
+	virtual double getInteractionRate(const Candidate *candidate) const;
+	/**
+	 Perform one interaction of this module at the current state, selecting
+	 the channel according to the partial rates. By default nothing happens.
+	 */
+	virtual void interact(Candidate *candidate) const;
 };
 
 
@@ -0,0 +1,145 @@
+#ifndef CRPROPA_MODULECHAIN_H
+#define CRPROPA_MODULECHAIN_H
+
+#include "crpropa/Module.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace crpropa {
+
+/** Modules of a ModuleChain, one link per type */
+template<class... M>
+struct ModuleChainLinks {
+	void process(Candidate *candidate, bool skipInactive) const {
+	}
+	double getStepLimit(const Candidate *candidate) const {
+		return std::numeric_limits<double>::max();
+	}
+	void getModules(std::vector<ref_ptr<Module> > &modules) const {
+	}
+};
+
+template<class First, class... Rest>
+struct ModuleChainLinks<First, Rest...> {
+	static_assert(std::is_base_of<Module, First>::value, "ModuleChain: types must be modules");
+	static_assert(!std::is_abstract<First>::value, "ModuleChain: types must implement process");
+
+	ref_ptr<First> module;
+	ModuleChainLinks<Rest...> rest;
+
+	ModuleChainLinks(First *module, Rest *... rest) : module(module), rest(rest...) {
+	}
+
+	void process(Candidate *candidate, bool skipInactive) const {
+		// qualified call, not through the virtual table
+		if (!skipInactive || candidate->isActive() || module->getRunOnInactive())
+			module->First::process(candidate);
+		rest.process(candidate, skipInactive);
+	}
+
+	double getStepLimit(const Candidate *candidate) const {
+		return std::min(module->First::getStepLimit(candidate), rest.getStepLimit(candidate));
+	}
+
+	void getModules(std::vector<ref_ptr<Module> > &modules) const {
+		modules.push_back(module.get());
+		rest.getModules(modules);
+	}
+};
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ModuleChain
+ @brief Fixed sequence of modules of types known at compile time.
+
+ The chain calls the modules in the order of the template arguments like a
+ ModuleList, but with the concrete types: M::process is called directly,
+ without the virtual call through ref_ptr<Module>, so the compiler can inline
+ the modules whose process is visible (defined in a header, or with link
+ time optimization) and schedule them together. The chain is itself a
+ Module, so that it can be part of a ModuleList, e.g.
+
+ 	modules->add(makeModuleChain(new SimplePropagation(), new Redshift(),
+ 			new PhotoPionProduction(cmb), new ElectronPairProduction(cmb),
+ 			new PhotoDisintegration(cmb), new NuclearDecay(), observer));
+
+ Exactly the process of each type is called, also if an object of a derived
+ type is passed. With setSkipInactive, a module not marked with
+ setRunOnInactive is skipped for candidates deactivated before it, as in
+ ModuleList::setSkipInactive; the chain is marked if one of its modules is.
+ processBatch passes each candidate through the whole chain, and
+ getStepLimit is the smallest limit of the modules. The chain is not
+ available in Python, where the types are only known at run time.
+ */
+template<class... M>
+class ModuleChain: public Module {
+	ModuleChainLinks<M...> links;
+	bool skipInactive;
+
+public:
+	ModuleChain(M *... modules) : links(modules...), skipInactive(false) {
+		std::vector<ref_ptr<Module> > list = getModules();
+		bool runOnInactive = false;
+		for (size_t i = 0; i < list.size(); i++)
+			runOnInactive = runOnInactive || list[i]->getRunOnInactive();
+		setRunOnInactive(runOnInactive);
+	}
+
+	/** Skip the unmarked modules for inactive candidates (default false) */
+	void setSkipInactive(bool skip = true) {
+		skipInactive = skip;
+	}
+
+	bool getSkipInactive() const {
+		return skipInactive;
+	}
+
+	/** The modules in the order of the chain */
+	std::vector<ref_ptr<Module> > getModules() const {
+		std::vector<ref_ptr<Module> > modules;
+		links.getModules(modules);
+		return modules;
+	}
+
+	void process(Candidate *candidate) const {
+		links.process(candidate, skipInactive);
+	}
+
+	void processBatch(Candidate **candidates, size_t n) const {
+		for (size_t i = 0; i < n; i++)
+			links.process(candidates[i], skipInactive);
+	}
+
+	double getStepLimit(const Candidate *candidate) const {
+		return links.getStepLimit(candidate);
+	}
+
+	std::string getDescription() const {
+		std::vector<ref_ptr<Module> > modules = getModules();
+		std::stringstream ss;
+		ss << "ModuleChain\n";
+		for (size_t i = 0; i < modules.size(); i++)
+			ss << "  " << modules[i]->getDescription() << "\n";
+		return ss.str();
+	}
+};
+
+/** Chain of the modules with the types deduced from the arguments */
+template<class... M>
+ref_ptr<ModuleChain<M...> > makeModuleChain(M *... modules) {
+	return new ModuleChain<M...>(modules...);
+}
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_MODULECHAIN_H
@@ -5,11 +5,20 @@
 #include "crpropa/Module.h"
 #include "crpropa/Source.h"
 
+#include <deque>
+#include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <sstream>
+#include <thread>
 
 namespace crpropa {
 
+class CandidateStream;
+class ParticleCollector;
+class PerfCounters;
+
 /**
  @class ModuleList
  @brief The simulation itself: A list of simulation modules
@@ -19,22 +28,308 @@ public:
 	typedef std::list<ref_ptr<Module> > module_list_t;
 	typedef std::vector<ref_ptr<Candidate> > candidate_vector_t;
 
+	/** Random access to the candidates of a run */
+	struct CandidateSequence {
+		virtual ~CandidateSequence() {
+		}
+		virtual size_t size() const = 0;
+		virtual ref_ptr<Candidate> get(size_t i) const = 0;
+	};
+
+	/** OpenMP loop schedule for the parallel runs, see setSchedule */
+	enum SchedulePolicy {
+		ScheduleDefault, ///< schedule configured at build time (OMP_SCHEDULE)
+		ScheduleStatic,
+		ScheduleDynamic,
+		ScheduleGuided,
+		ScheduleAdaptive ///< chosen from the cost per primary observed in the previous run
+	};
+
+	/** Binding of the OpenMP threads to CPUs in the parallel runs, see setThreadAffinity */
+	enum ThreadAffinity {
+		AffinityNone, ///< threads are moved by the operating system (or OMP_PROC_BIND)
+		AffinityCompact, ///< thread i on the i-th CPU, filling one NUMA node after the other
+		AffinitySpread ///< threads round-robin over the NUMA nodes
+	};
+
+	/** Order of the propagation of secondaries, see setSecondaryGrouping */
+	enum SecondaryGrouping {
+		GroupNone, ///< order of creation
+		GroupSpecies, ///< by particle type
+		GroupSpeciesEnergy ///< by particle type and energy band, the highest energies first
+	};
+
 	ModuleList();
 	virtual ~ModuleList();
 	void setShowProgress(bool show = true); ///< activate a progress bar
 
+	/** Propagate secondaries as OpenMP tasks instead of plain recursion.
+	 Inside a parallel run, each secondary becomes a task that idle threads
+	 can steal, so a single large cascade is spread over all threads. The
+	 parent waits for its secondaries before it continues (secondariesFirst)
+	 or returns, so the order guarantees of the recursive mode are kept.
+	 @param tasks	enable the task based scheduling of secondaries
+	 */
+	void setSecondaryTasks(bool tasks = true);
+	bool getSecondaryTasks() const;
+
+	/** Propagate secondaries breadth-first from a shared, bounded queue.
+	 Secondaries are detached from their parent (see Candidate::detachFromParent)
+	 and moved to the queue right after the step that created them, and every
+	 candidate is released as soon as it is finished. The peak memory thus
+	 scales with the queue size instead of the size of the cascade. If the
+	 queue is full, a secondary is propagated directly by the current thread.
+	 The secondaries of a candidate are not available after the run and
+	 secondariesFirst has no effect in this mode.
+	 @param maxQueueSize	maximum number of queued candidates (0: disable)
+	 */
+	void setBreadthFirst(size_t maxQueueSize);
+	size_t getBreadthFirst() const;
+
+	/** Propagate the secondaries in groups of the same particle type, so that
+	 the interaction tables of the type stay in the caches. Particles and
+	 antiparticles form one group, nuclei a group per isotope, and with
+	 GroupSpeciesEnergy the groups are split into energy bands of 0.1 in
+	 log10(E). The secondaries of a candidate (of a batch with setBatchSize)
+	 are propagated group by group, each group in the order of creation;
+	 with setBreadthFirst the queue holds one queue per group and a thread
+	 takes the next candidate from the group it worked on last. The random
+	 streams of the secondaries with Random::seedStreams are drawn in the
+	 order of creation, so the results do not depend on the grouping.
+	 @param grouping	grouping of the secondaries (default GroupNone)
+	 */
+	void setSecondaryGrouping(SecondaryGrouping grouping);
+	SecondaryGrouping getSecondaryGrouping() const;
+
+	/** Allocate candidates from thread-local pools during run().
+	 The pooling is enabled for the duration of run() with a candidate vector
+	 or a source, see Candidate::setPoolAllocation.
+	 @param pool	use pooled allocation of candidates
+	 */
+	void setCandidatePool(bool pool = true);
+	bool getCandidatePool() const;
+
+	/** Create the candidates with thread-confined reference counting during run().
+	 The confinement is enabled for the duration of run() with a candidate
+	 vector or a source, see Candidate::setThreadConfinement. Only enable it
+	 if no module shares the candidates with other threads, except for the
+	 ParticleCollector and the breadth-first queue.
+	 @param confined	use non-atomic reference counting of new candidates
+	 */
+	void setThreadConfinement(bool confined = true);
+	bool getThreadConfinement() const;
+
+	/** States the modules of the list need besides the current and source
+	 state, for the duration of run() with a candidate vector or a source.
+	 Skipping the previous state saves a copy of the state in each step,
+	 see Candidate::setSnapshots.
+	 @param snapshots	combination of Candidate::Snapshot flags (default Candidate::SnapshotAll)
+	 */
+	void setSnapshots(int snapshots);
+	int getSnapshots() const;
+
+	/** Periodically save the progress of run() with a source to a file.
+	 The checkpoint contains the indices of the finished primaries, the states
+	 of the random number generators of all threads, the serial number of
+	 the first primary and the next candidate serial number. It is written every interval finished primaries, when the
+	 run is cancelled (SIGINT/SIGTERM) and at the end of the run. If the file
+	 exists when run() is called, the run is resumed from it and finished
+	 primaries are skipped. The outputs are not part of the checkpoint; use
+	 new output files for the resumed run and a low HDF5Output::setFlushLimit.
+	 @param filename	checkpoint file, empty to disable
+	 @param interval	number of finished primaries between two checkpoints
+	 */
+	void setCheckpoint(const std::string &filename, size_t interval = 10000);
+	std::string getCheckpointFile() const;
+
+	/** Set the OpenMP schedule used to distribute the primaries over the threads.
+	 Static scheduling is best for uniform workloads, dynamic scheduling with
+	 small chunks for heavy-tailed ones, e.g. nuclear cascades. With
+	 ScheduleAdaptive, the mean and spread of the wall time per primary are
+	 measured in every run and used to choose the schedule of the next run:
+	 static for uniform costs, otherwise dynamic with chunks of about 10 ms.
+	 @param policy		schedule policy
+	 @param chunkSize	chunk size, 0 for the OpenMP default (ignored for ScheduleDefault and ScheduleAdaptive)
+	 */
+	void setSchedule(SchedulePolicy policy, int chunkSize = 0);
+	SchedulePolicy getSchedulePolicy() const;
+	int getScheduleChunkSize() const;
+
+	/** Bind each OpenMP thread to one CPU during the parallel runs, so that it
+	 keeps its caches and the memory it allocates stays on its NUMA node.
+	 AffinitySpread uses the memory bandwidth of all sockets with few threads,
+	 AffinityCompact shares the caches of one socket. The calling thread is
+	 unbound again after the run. See Numa for the placement of the grids.
+	 */
+	void setThreadAffinity(ThreadAffinity affinity);
+	ThreadAffinity getThreadAffinity() const;
+
+	/** Propagate the candidates of run() in batches.
+	 The candidates of a batch are stepped together: in every step, each module
+	 is called once with all active candidates of the batch (see
+	 Module::processBatch). When all candidates of the batch are finished,
+	 their secondaries are propagated in batches of the same size. The
+	 secondariesFirst option, setSecondaryTasks and setBreadthFirst do not
+	 apply in this mode. If profiling is enabled, the modules are called per
+	 candidate.
+	 @param size	number of candidates per batch (0: disable)
+	 */
+	void setBatchSize(size_t size);
+	size_t getBatchSize() const;
+
+	/** Skip the remaining modules of a step once the candidate is inactive.
+	 Modules marked with Module::setRunOnInactive, e.g. outputs and
+	 observers, are still called for candidates which were deactivated
+	 earlier in the same step. Nested module lists are always called.
+	 @param skip	skip the unmarked modules for inactive candidates
+	 */
+	void setSkipInactive(bool skip = true);
+	bool getSkipInactive() const;
+
+	/** Record the time spent in each module.
+	 For every module the number of calls and the cumulative wall time are
+	 recorded in total and per particle species (id of the current state
+	 before the call). Every thread writes to its own counters, which are
+	 merged when the profile is retrieved.
+	 @param profile	enable the profiling
+	 */
+	void setProfiling(bool profile = true);
+	bool getProfiling() const;
+	void resetProfile(); ///< clear all recorded timings
+	std::string getProfileJSON() const; ///< profile as JSON document
+	std::string getProfileCSV() const; ///< profile as CSV table (module, description, id, calls, time)
+	/** Write the profile to a file, as JSON if the file name ends with .json, otherwise as CSV */
+	void writeProfile(const std::string &filename) const;
+	/** Number of recorded calls of a module, e.g. of the propagation module to
+	 scale the report of MagneticFieldProfile to calls per step */
+	uint64_t getProfileCalls(std::size_t i) const;
+	/** Record hardware performance counters per module while profiling, see PerfCounters.
+	 Every thread reads its counters before and after each module call and
+	 adds the difference to the total of the module ("counters" in JSON,
+	 further columns in CSV); with cycles and instructions, the instructions
+	 per cycle are given in JSON. Reading costs a system call per module
+	 call. Clears the recorded profile.
+	 @param names	counters, e.g. cycles, instructions, cache-misses; empty to disable
+	 */
+	void setProfileCounters(const std::vector<std::string> &names);
+	std::vector<std::string> getProfileCounters() const;
+	/** Recorded value of a counter of module i, 0 if not recorded */
+	uint64_t getProfileCounter(std::size_t i, const std::string &name) const;
+
+	/** Collect the RunStatistics during the runs and print their summary after each run with a source, candidates or a collector.
+	 Besides the reports of the modules, e.g. the interactions and rejected
+	 steps, the steps per candidate, the secondaries per primary and the
+	 depth of the cascades are recorded; the last two are exact without
+	 secondary tasks and breadth-first propagation. The statistics are shared
+	 by all module lists and accumulate until RunStatistics::clear.
+	 @param enable	collect the statistics
+	 */
+	void setStatistics(bool enable = true);
+	bool getStatistics() const;
+
+	/** Report the load of the threads after each run with a source, candidates or a collector.
+	 Every thread records its busy time and the wall time of each of its
+	 primaries including their secondaries (of each batch with
+	 setBatchSize). The report gives the busy time per thread, the fraction
+	 of the thread time lost to idle threads compared to the wall time of the
+	 run, the imbalance (maximum over mean busy time) and the slowest
+	 primaries with their serial numbers, e.g. to pick a schedule or to find
+	 pathological events.
+	 @param enable	record and print the report
+	 @param top		number of the slowest primaries to report
+	 */
+	void setLoadReport(bool enable = true, size_t top = 10);
+	bool getLoadReport() const;
+	/** Report of the last run with setLoadReport, empty before */
+	std::string getLoadSummary() const;
+	/** Busy time [s] of every thread in the last run with setLoadReport */
+	std::vector<double> getThreadBusyTime() const;
+	/** Fraction of the thread time the threads were idle in the last run with setLoadReport */
+	double getIdleFraction() const;
+
+	/** Record a timeline of the run, see Tracer.
+	 Every thread records the spans of its candidates, of the modules of every
+	 sampling-th step, the waits for the locks of the outputs and their
+	 flushes. The tracer is shared by all module lists.
+	 @param trace		enable the tracing
+	 @param sampling	record the module spans of every sampling-th step of a thread
+	 */
+	void setTracing(bool trace = true, size_t sampling = 100);
+	bool getTracing() const;
+	/** Write the recorded timeline as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev */
+	void writeTrace(const std::string &filename) const;
+
+	/** Soft limit of the memory during the runs, see MemoryUsage.
+	 Above the limit the outputs flush their buffers. With cancel, the run
+	 also stops after the current candidates and throws std::runtime_error;
+	 with a checkpoint file it can then be resumed.
+	 @param bytes	limit of the resident set size, 0 to disable
+	 @param cancel	stop the run above the limit
+	 */
+	void setMemoryLimit(size_t bytes, bool cancel = false);
+	size_t getMemoryLimit() const;
+	/** Print the MemoryUsage report every interval seconds during the runs, 0 to disable */
+	void setMemoryReport(double interval);
+
 	void add(Module* module);
+	/** Construct independent modules concurrently and add them in the order of
+	 the factories, e.g. the interaction modules of several photon fields,
+	 which then parse their tables at the same time. The factories must not
+	 depend on each other. If factories throw, the exception of the first of
+	 them is rethrown after all have finished and no module is added.
+	 @param factories	functions returning the modules
+	 @param threads		number of threads, the OpenMP default if 0
+	 */
+	void addParallel(const std::vector<std::function<ref_ptr<Module>()> > &factories, int threads = 0);
 	void remove(std::size_t i);
 	std::size_t size() const;
 	ref_ptr<Module> operator[](const std::size_t i);
 
 	void process(Candidate* candidate) const; ///< call process in all modules
 	void process(ref_ptr<Candidate> candidate) const; ///< call process in all modules
+	void processBatch(Candidate **candidates, size_t n) const; ///< call processBatch in all modules
 
 	void run(Candidate* candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(ref_ptr<Candidate> candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(const candidate_vector_t *candidates, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a candidate vector
-	void run(SourceInterface* source, size_t count, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a number of candidates from the given source
+	void run(SourceInterface* source, size_t count, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a number of candidates from the given source, the i-th primary gets the i-th of consecutive serial numbers
+	void run(const ParticleCollector *collector, bool recursive = true, bool secondariesFirst = false); ///< run simulation for the candidates of a collector, also in compact mode
+	/** Run the simulation for the candidates of a stream, e.g. a BinaryStream
+	 of the events of a previous stage. A background thread reads chunks of
+	 chunkSize candidates ahead, at most two of them, while the threads take
+	 the candidates (batches with setBatchSize) of the current chunk one
+	 after another, so that the memory stays bounded for any number of
+	 candidates. The random streams of the candidates are reserved in the
+	 order of the stream, the background thread draws from streams of its
+	 own; without Random::seedStreams, the streams are seeded for the run
+	 from the generator of the calling thread. There is no progress bar and
+	 no checkpoint. An exception of the stream is rethrown after the
+	 candidates read before have been propagated.
+	 @param stream		stream of the candidates
+	 @param chunkSize	number of candidates read at once
+	 */
+	void run(CandidateStream *stream, size_t chunkSize = 65536, bool recursive = true, bool secondariesFirst = false);
+
+#ifdef CRPROPA_HAVE_MPI
+	/** Run the simulation for a number of candidates distributed over all MPI ranks.
+	 Has to be called by all ranks of MPI_COMM_WORLD after MPI_Init (e.g. by
+	 importing mpi4py). The candidates are handed out in chunks through a
+	 shared counter, so faster ranks take more chunks. Each rank propagates
+	 its chunks with the OpenMP parallel run(). The candidate serial numbers
+	 of rank r start at r * 2^40 and, if a seed is given, the random number
+	 generators of rank r are seeded with seed + 256 * r. With streams of
+	 Random::seedStreams the candidates draw from the streams of their global
+	 indices, independent of the ranks. Each rank writes its
+	 own outputs, use getMPIRank() to make the output file names unique.
+	 @param source		source of the candidates
+	 @param count		total number of candidates of all ranks
+	 @param chunkSize	number of candidates handed out at once
+	 @param seed		seed of the random number generators, 0 to keep the current state
+	 @param recursive	propagate secondaries
+	 @param secondariesFirst	propagate secondaries before the next step of the parent
+	 */
+	void runMPI(SourceInterface* source, size_t count, size_t chunkSize = 1000, uint32_t seed = 0, bool recursive = true, bool secondariesFirst = false);
+#endif
 
 	std::string getDescription() const;
 	void showModules() const;
@@ -48,10 +343,87 @@ public:
 	const_iterator end() const;
 
 private:
+	struct ProfileEntry {
+		uint64_t calls;
+		double time;
+		ProfileEntry() : calls(0), time(0) {
+		}
+	};
+	struct ModuleProfile {
+		ProfileEntry total;
+		std::map<int, ProfileEntry> species;
+		std::vector<uint64_t> counters; ///< total per profile counter
+	};
+	struct ThreadProfile {
+		std::vector<ModuleProfile> modules;
+		std::shared_ptr<PerfCounters> counters;
+		std::thread::id countersThread; ///< thread which opened the counters
+		char padding[64]; // avoid false sharing between threads
+	};
+
+	struct ThreadCost {
+		double sum, sum2;
+		size_t n;
+		std::vector<std::pair<double, uint64_t> > slowest; ///< heap of the slowest primaries (time, serial)
+		char padding[64]; // avoid false sharing between threads
+	};
+
+	void applySchedule(size_t count);
+	void applyAffinity() const;
+	void updateCost(const std::vector<ThreadCost> &costs);
+	void updateLoad(const std::vector<ThreadCost> &costs, double wallTime);
+	void prepareProfile() const;
+	PerfCounters *threadCounters(size_t thread) const;
+	std::vector<ModuleProfile> mergeProfile() const;
+	void runSecondaries(Candidate *candidate, bool secondariesFirst);
+	void runBreadthFirst(Candidate *candidate);
+	void runDetached(Candidate *candidate);
+	void runBatch(Candidate **candidates, size_t n, bool recursive);
+	void runSequence(const CandidateSequence &candidates, bool recursive, bool secondariesFirst);
+	bool pollMemory() const;
+	bool loadCheckpoint(std::vector<char> &finished, uint64_t &firstSerial) const;
+	void saveCheckpoint(const std::vector<char> &finished, uint64_t firstSerial, const std::vector<std::string> &randomStates) const;
+
 	module_list_t modules;
 	bool showProgress;
+	bool secondaryTasks;
+	size_t maxQueueSize;
+	bool candidatePool;
+	bool threadConfinement;
+	int snapshots;
+	std::string checkpointFile;
+	size_t checkpointInterval;
+	size_t batchSize;
+	bool skipInactive;
+	bool profiling;
+	bool statistics;
+	bool loadReport;
+	size_t loadTop;
+	bool memoryCancel;
+	SchedulePolicy schedulePolicy;
+	int scheduleChunkSize;
+	ThreadAffinity threadAffinity;
+	double costMean, costSpread; ///< cost per primary [s] observed for ScheduleAdaptive
+	size_t indexOffset; ///< index of the first candidate of run() with a source, set by runMPI
+	std::string loadSummary;
+	std::vector<double> threadBusy;
+	double idleFraction;
+	mutable std::vector<ThreadProfile> profiles;
+	std::vector<std::string> profileCounters;
+	std::deque<ref_ptr<Candidate> > cascadeQueue;
+	SecondaryGrouping secondaryGrouping;
+	// queue of setBreadthFirst per group with setSecondaryGrouping
+	std::map<std::pair<int, int>, std::deque<ref_ptr<Candidate> > > groupedQueue;
+	size_t groupedQueueSize;
 };
 
+#ifdef CRPROPA_HAVE_MPI
+/** Rank of this process in MPI_COMM_WORLD */
+int getMPIRank();
+/** Number of ranks in MPI_COMM_WORLD */
+int getMPISize();
+#endif
+
 /**
  @class ModuleListRunner
  @brief Run the provided ModuleList when process is called.
@@ -0,0 +1,155 @@
+#ifndef CRPROPA_NESTEDGRID_H
+#define CRPROPA_NESTEDGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class NestedGrid
+ @brief Coarse grid with refined grids over selected boxes.
+
+ The value at a position is interpolated from the finest refinement that
+ contains the position, or from the coarse grid if there is none. The memory
+ scales with the volume of the refined boxes instead of the volume of the
+ coarse grid at the finest resolution.
+
+ The refinements are found through a uniform index over the volume of the
+ coarse grid with up to 32 cells per axis, each holding the refinements that
+ overlap it, finest first. The refinements are interpolated with reflective
+ repetition, so that the values near their faces do not wrap around.
+ Positions outside of the coarse volume use the repetition of the coarse grid.
+ */
+template<typename T>
+class NestedGrid: public Referenced {
+public:
+	typedef typename Grid<T>::Value Value;
+
+private:
+	ref_ptr<Grid<T> > coarse;
+	std::vector<ref_ptr<Grid<T> > > refinements; // finest first
+	size_t indexNx, indexNy, indexNz;
+	Vector3d indexSpacing;
+	std::vector<std::vector<size_t> > index;
+
+	static Vector3d extent(const Grid<T> *grid) {
+		return Vector3d(grid->getNx(), grid->getNy(), grid->getNz()) * grid->getSpacing();
+	}
+
+	static double cellVolume(const Grid<T> *grid) {
+		Vector3d s = grid->getSpacing();
+		return s.x * s.y * s.z;
+	}
+
+	static bool contains(const Grid<T> *grid, const Vector3d &position) {
+		Vector3d r = position - grid->getOrigin();
+		Vector3d e = extent(grid);
+		return (r.x >= 0) && (r.x < e.x) && (r.y >= 0) && (r.y < e.y) && (r.z >= 0) && (r.z < e.z);
+	}
+
+	/** Index cell along one axis, clamped to the index */
+	static size_t indexCell(double x, double spacing, size_t n) {
+		return std::min(size_t(std::max(x / spacing, 0.)), n - 1);
+	}
+
+	void buildIndex() {
+		std::vector<std::vector<size_t> >(indexNx * indexNy * indexNz).swap(index);
+		Vector3d o = coarse->getOrigin();
+		for (size_t i = 0; i < refinements.size(); i++) {
+			Vector3d lo = refinements[i]->getOrigin() - o;
+			Vector3d hi = lo + extent(refinements[i]);
+			for (size_t ix = indexCell(lo.x, indexSpacing.x, indexNx); ix <= indexCell(hi.x, indexSpacing.x, indexNx); ix++)
+				for (size_t iy = indexCell(lo.y, indexSpacing.y, indexNy); iy <= indexCell(hi.y, indexSpacing.y, indexNy); iy++)
+					for (size_t iz = indexCell(lo.z, indexSpacing.z, indexNz); iz <= indexCell(hi.z, indexSpacing.z, indexNz); iz++)
+						index[(ix * indexNy + iy) * indexNz + iz].push_back(i);
+		}
+	}
+
+public:
+	/** Constructor
+	 @param coarse	grid covering the whole volume
+	 */
+	NestedGrid(ref_ptr<Grid<T> > coarse) : coarse(coarse) {
+		indexNx = std::min(coarse->getNx(), size_t(32));
+		indexNy = std::min(coarse->getNy(), size_t(32));
+		indexNz = std::min(coarse->getNz(), size_t(32));
+		Vector3d e = extent(coarse);
+		indexSpacing = Vector3d(e.x / indexNx, e.y / indexNy, e.z / indexNz);
+		buildIndex();
+	}
+
+	/** Add a refined grid, which has to lie within the coarse volume.
+	 The grid is set to reflective repetition. */
+	void addRefinement(ref_ptr<Grid<T> > grid) {
+		Vector3d lo = grid->getOrigin() - coarse->getOrigin();
+		Vector3d hi = lo + extent(grid) - extent(coarse);
+		double eps = 1e-9 * extent(coarse).getR();
+		if ((lo.x < -eps) || (lo.y < -eps) || (lo.z < -eps) || (hi.x > eps) || (hi.y > eps) || (hi.z > eps))
+			throw std::runtime_error("NestedGrid: refinement outside of the coarse grid");
+		grid->setReflective(true);
+
+		size_t i = 0;
+		while ((i < refinements.size()) && (cellVolume(refinements[i]) <= cellVolume(grid)))
+			i++;
+		refinements.insert(refinements.begin() + i, grid);
+		buildIndex();
+	}
+
+	/** Finest grid that contains the position */
+	Grid<T> *findGrid(const Vector3d &position) const {
+		Vector3d r = position - coarse->getOrigin();
+		Vector3d e = extent(coarse);
+		if ((r.x < 0) || (r.x >= e.x) || (r.y < 0) || (r.y >= e.y) || (r.z < 0) || (r.z >= e.z))
+			return coarse;
+		size_t ix = indexCell(r.x, indexSpacing.x, indexNx);
+		size_t iy = indexCell(r.y, indexSpacing.y, indexNy);
+		size_t iz = indexCell(r.z, indexSpacing.z, indexNz);
+		const std::vector<size_t> &cell = index[(ix * indexNy + iy) * indexNz + iz];
+		for (size_t i = 0; i < cell.size(); i++)
+			if (contains(refinements[cell[i]], position))
+				return refinements[cell[i]];
+		return coarse;
+	}
+
+	/** Interpolate the finest grid that contains the position */
+	Value interpolate(const Vector3d &position) const {
+		return findGrid(position)->interpolate(position);
+	}
+
+	ref_ptr<Grid<T> > getCoarseGrid() const {
+		return coarse;
+	}
+
+	size_t getNumberOfRefinements() const {
+		return refinements.size();
+	}
+
+	/** Refinement i, ordered from the finest to the coarsest */
+	ref_ptr<Grid<T> > getRefinement(size_t i) const {
+		return refinements.at(i);
+	}
+
+	/** Total size of all grids in bytes */
+	size_t getSizeOf() const {
+		size_t size = coarse->getSizeOf();
+		for (size_t i = 0; i < refinements.size(); i++)
+			size += refinements[i]->getSizeOf();
+		return size;
+	}
+};
+
+typedef NestedGrid<float> NestedGrid1f;
+typedef NestedGrid<Vector3f> NestedGrid3f;
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_NESTEDGRID_H
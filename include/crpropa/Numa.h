@@ -0,0 +1,64 @@
+#ifndef CRPROPA_NUMA_H
+#define CRPROPA_NUMA_H
+
+#include <cstddef>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class Numa
+ @brief Placement of large read-only data and of threads on the NUMA nodes (Linux).
+
+ On machines with several sockets, the pages of a grid written by the main
+ thread are all placed on its node, so the threads of the other sockets
+ read them through the interconnect. With interleaving enabled, the owned
+ values of grids, the matrices of magnetic lenses and the rate tables of
+ at least getMinimumSize bytes are spread page by page over all nodes
+ (mbind with MPOL_INTERLEAVE), which balances the bandwidth of all memory
+ controllers. Interleaving is enabled by setInterleave or the environment
+ variable CRPROPA_NUMA_INTERLEAVE=1 and has no effect on machines with a
+ single node. Mapped grids and tables are left to the page cache.
+
+ pinThread binds the calling thread to one CPU, see
+ ModuleList::setThreadAffinity.
+ */
+class Numa {
+public:
+	/** Number of online NUMA nodes, 1 if not available */
+	static size_t getNodeCount();
+	/** CPUs the process may run on, ordered by node and number */
+	static std::vector<int> getCpus();
+	/** Node of a CPU, 0 if not available */
+	static size_t getNode(int cpu);
+
+	/** Spread large allocations over the nodes */
+	static void setInterleave(bool interleave);
+	static bool getInterleave();
+	/** Smallest allocation to interleave [bytes] (default 1 MB) */
+	static void setMinimumSize(size_t bytes);
+	static size_t getMinimumSize();
+
+	/** Interleave the pages of an allocation if enabled and large enough.
+	 The pages already touched are moved. Returns true if the memory policy
+	 was set. */
+	static bool place(const void *data, size_t bytes);
+	/** Interleave the pages fully inside the range, regardless of the settings */
+	static bool interleave(const void *data, size_t bytes);
+
+	/** Bind the calling thread to the CPU of a thread index: compact fills
+	 the CPUs of a node before the next one, otherwise the threads are
+	 spread round-robin over the nodes. Returns false if not available. */
+	static bool pinThread(size_t index, bool compact);
+	/** Allow the calling thread all CPUs of the process again */
+	static bool unpinThread();
+};
+/** @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_NUMA_H
@@ -0,0 +1,101 @@
+#ifndef CRPROPA_OFFLOADENGINE_H
+#define CRPROPA_OFFLOADENGINE_H
+
+#include "crpropa/MemoryUsage.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class OffloadEngine
+ @brief Propagation of charged particles in grid or plane-wave fields on an accelerator (OpenMP target offload).
+
+ For simulations that consist only of the propagation of charged particles
+ in a magnetic field and simple conditions, the trajectories are integrated
+ on the device with OpenMP target offload (ENABLE_OFFLOAD in cmake, e.g. for
+ NVIDIA GPUs with -foffload=nvptx-none or AMD GPUs with
+ -foffload=amdgcn-amdhsa); without offload support, or without a device, the
+ same kernel runs on the threads of the host.
+
+ The module list must start with PropagationBP or PropagationCK with a
+ MagneticFieldGrid (trilinear interpolation, Grid3f or Grid3h) or a
+ PlaneWaveTurbulence, followed by any of MaximumTrajectoryLength (without
+ observer positions), MinimumEnergy, CubicBoundary, SphericalBoundary and
+ Observer with ObserverSurface features of spheres. The device steps each
+ candidate with the same equations and step limits as the modules until one
+ of the conditions would act on it. This step is then repeated on the host
+ by the modules after the propagator, which flag, deactivate and pass the
+ candidate to the outputs as in ModuleList::run; a candidate that is still
+ active afterwards, and neutral or inactive candidates, are propagated by the
+ module list on the host. The plane waves are summed with the EXACT kernel,
+ the grid is interpolated with the same single precision sums as on the
+ host, so the trajectories agree with those of the host up to rounding.
+
+ With a module list that cannot be offloaded, run() uses ModuleList::run.
+ */
+class OffloadEngine: public Referenced {
+public:
+	OffloadEngine(ref_ptr<ModuleList> modules);
+
+	/** Whether the module list can be offloaded */
+	bool isSupported() const;
+	/** Why the module list cannot be offloaded, empty if it can */
+	std::string getUnsupportedReason() const;
+
+	/** Number of offload devices, 0 without ENABLE_OFFLOAD */
+	static int getDeviceCount();
+	/** Device of the runs, the OpenMP default device if negative */
+	void setDevice(int device);
+	int getDevice() const;
+	/** Number of candidates on the device at once (default 65536) */
+	void setBatchSize(size_t size);
+	size_t getBatchSize() const;
+	/** Maximum number of steps per candidate and kernel launch (default 100000) */
+	void setStepsPerLaunch(size_t steps);
+	size_t getStepsPerLaunch() const;
+
+	void run(const ModuleList::candidate_vector_t *candidates, bool recursive = true);
+	void run(SourceInterface *source, size_t count, bool recursive = true);
+
+	/** Number of steps integrated on the device in the last run */
+	uint64_t getDeviceSteps() const;
+	std::string getDescription() const;
+
+private:
+	ref_ptr<ModuleList> modules;
+	std::string reason;
+	int device;
+	size_t batchSize, stepsPerLaunch;
+	uint64_t deviceSteps;
+
+	// propagator
+	int scheme; ///< 0: Boris push, 1: Cash-Karp
+	double tolerance, minStep, maxStep;
+	// field
+	int fieldType;
+	std::vector<float> gridValues; ///< decoded values of the grid, row-major
+	int nx, ny, nz;
+	double origin[3], gridOrigin[3], spacing[3];
+	bool reflective, clipVolume;
+	std::vector<double> waveModes; ///< xi, kappa, Ak, k, beta of each mode
+	MemoryAccount memory;
+	std::vector<double> conditions; ///< type, x, y, z, size, margin, limitStep of each condition
+
+	void analyze();
+	bool analyzeField(ref_ptr<MagneticField> field);
+	void runBatch(Candidate **candidates, size_t n, bool recursive);
+	void replay(Candidate *candidate) const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_OFFLOADENGINE_H
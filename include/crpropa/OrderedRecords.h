@@ -0,0 +1,103 @@
+#ifndef CRPROPA_ORDEREDRECORDS_H
+#define CRPROPA_ORDEREDRECORDS_H
+
+#include "crpropa/MemoryUsage.h"
+
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class OrderedRecords
+ @brief Records of several threads, merged in the order of their keys.
+
+ Every OpenMP thread collects its records in its own buffer, so the threads
+ do not wait for each other. A full buffer is sorted by the keys and written
+ as a sorted run to a temporary file. Over the soft limit of MemoryUsage a
+ buffer is written early, but not before it holds a sixteenth of the run
+ size. The runs of a thread are merged in tiers of 8 runs, and all of them
+ into one when there are 16, so a thread keeps at most 16 temporary files
+ open. merge() joins the runs of all threads in a streaming k-way merge and
+ passes the records in the order of the keys to a consumer, holding only
+ one record per run in memory. Records with the
+ same keys keep the order in which a thread added them. Records from threads
+ that are not part of the outermost parallel OpenMP team, e.g. the main
+ thread outside of a parallel region, a std::thread or a nested team, are
+ collected under a lock.
+ */
+class OrderedRecords {
+public:
+	/** Consumer of the merged records: data and size of a record */
+	typedef std::function<void(const char *, size_t)> Consumer;
+
+	/** @param runSize	records buffered per thread before they are written as a sorted run */
+	OrderedRecords(size_t runSize = 65536);
+	~OrderedRecords();
+
+	/** Add a record of the calling thread, ordered by key and then by subkey */
+	void push(uint64_t key, uint64_t subkey, const char *data, size_t size);
+	/** Add a record of the calling thread with subkey 0 */
+	void push(uint64_t key, const char *data, size_t size);
+	/** Pass all records in the order of the keys to the consumer and remove them.
+	 Must not be called concurrently with push. */
+	void merge(const Consumer &consumer);
+	/** Number of records added since the last merge */
+	size_t size() const;
+
+private:
+	struct Entry {
+		uint64_t key, subkey;
+		uint64_t sequence; ///< order of the records of a thread with the same keys
+		size_t offset; ///< of the data in the buffer of the thread
+		uint32_t size;
+		bool operator<(const Entry &e) const {
+			if (key != e.key)
+				return key < e.key;
+			if (subkey != e.subkey)
+				return subkey < e.subkey;
+			return sequence < e.sequence;
+		}
+	};
+	struct Run {
+		std::FILE *file;
+		size_t count;
+		size_t level; ///< number of merges that built the run
+	};
+	struct Thread {
+		std::vector<Entry> entries;
+		std::string data;
+		std::vector<Run> runs;
+		uint64_t sequence;
+		MemoryAccount memory;
+		char padding[64]; // avoid false sharing between threads
+		Thread() : sequence(0), memory(MemoryUsage::OutputBuffers) {
+		}
+	};
+	size_t runSize;
+	std::vector<Thread> threads; ///< outermost team, the last one for the others
+	std::mutex overflowMutex;
+	OrderedRecords(const OrderedRecords &);
+	OrderedRecords &operator=(const OrderedRecords &);
+
+	void add(Thread &thread, uint64_t key, uint64_t subkey, const char *data, size_t size);
+	struct Cursor;
+	void writeRun(Thread &thread);
+	void compactRuns(Thread &thread);
+	void mergeRuns(Thread &thread, size_t first);
+	static void mergeCursors(std::vector<Cursor> &cursors,
+			const std::function<void(const Cursor &)> &consumer);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_ORDEREDRECORDS_H
@@ -0,0 +1,413 @@
+#ifndef CRPROPA_PAGEDGRID_H
+#define CRPROPA_PAGEDGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class PagedGridFile
+ @brief Binary file that can be read at arbitrary offsets by several threads at once.
+ */
+class PagedGridFile: public Referenced {
+	int fd;
+	size_t length;
+#ifdef _WIN32
+	std::ifstream *in;
+	std::mutex inMutex;
+#endif
+	PagedGridFile(const PagedGridFile &);
+	PagedGridFile &operator=(const PagedGridFile &);
+public:
+	PagedGridFile(const std::string &filename);
+	~PagedGridFile();
+	/** Size of the file in bytes */
+	size_t size() const;
+	/** Read size bytes at offset, throws std::runtime_error if this fails */
+	void read(size_t offset, void *buffer, size_t size);
+	/** Hint that size bytes at offset will be read soon. The operating system
+	 reads them into its page cache in the background, where supported. */
+	void willNeed(size_t offset, size_t size);
+};
+
+/**
+ @class PagedGrid
+ @brief Grid that loads tiles of a file on demand, for grids larger than the memory.
+
+ The file has the format written by dumpGrid: the values of the grid points
+ in row-major order (z running fastest) in single precision without header.
+ The grid is split into cubic tiles of tileEdge^3 points, which are read
+ when a value from them is needed and are kept in a least-recently-used
+ cache with room for a configurable number of bytes. The cache is split into
+ 16 shards with separate locks, which are not held while a tile is read,
+ and every thread of an OpenMP team remembers its last tile, so threads
+ following spatially coherent trajectories rarely lock.
+
+ Values are interpolated trilinearly with periodic or reflective repetition,
+ like in Grid.
+ */
+template<typename T>
+class PagedGrid: public Referenced {
+	struct Tile: public Referenced {
+		std::vector<T> values;
+	};
+
+	struct Shard {
+		typedef std::list<size_t> List;
+		typedef std::unordered_map<size_t, std::pair<ref_ptr<Tile>, List::iterator> > Map;
+		std::mutex mutex;
+		List lru; // most recently used first
+		Map tiles;
+		size_t loads;
+		size_t prefetches;
+	};
+
+	struct LastTile {
+		ref_ptr<Tile> tile;
+		size_t id;
+		size_t prefetched; // id + 1 of the last prefetched tile, 0 for none
+		char padding[64];
+	};
+
+	static const size_t nShards = 16;
+
+	ref_ptr<PagedGridFile> file;
+	size_t Nx, Ny, Nz;
+	Vector3d origin, gridOrigin, spacing;
+	bool reflective, clipVolume;
+	size_t tileEdge, tilesX, tilesY, tilesZ;
+	size_t tilesPerShard;
+	mutable Shard shards[nShards];
+	mutable std::vector<LastTile> lastTiles;
+	mutable LastTile shared; // last tile of the threads outside of a team
+	mutable std::mutex sharedMutex;
+
+	PagedGrid(const PagedGrid &);
+	PagedGrid &operator=(const PagedGrid &);
+
+	ref_ptr<Tile> loadTile(size_t id) const {
+		size_t tx = id / (tilesY * tilesZ), ty = (id / tilesZ) % tilesY, tz = id % tilesZ;
+		size_t x0 = tx * tileEdge, y0 = ty * tileEdge, z0 = tz * tileEdge;
+		size_t nx = std::min(tileEdge, Nx - x0), ny = std::min(tileEdge, Ny - y0), nz = std::min(tileEdge, Nz - z0);
+		ref_ptr<Tile> tile = new Tile();
+		tile->values.resize(tileEdge * tileEdge * tileEdge);
+		for (size_t ix = 0; ix < nx; ix++)
+			for (size_t iy = 0; iy < ny; iy++)
+				file->read((((x0 + ix) * Ny + y0 + iy) * Nz + z0) * sizeof(T),
+						&tile->values[(ix * tileEdge + iy) * tileEdge], nz * sizeof(T));
+		return tile;
+	}
+
+	/** Tile with the given id from the cache, loaded if necessary */
+	ref_ptr<Tile> findTile(size_t id) const {
+		Shard &shard = shards[id % nShards];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			typename Shard::Map::iterator i = shard.tiles.find(id);
+			if (i != shard.tiles.end()) {
+				shard.lru.splice(shard.lru.begin(), shard.lru, i->second.second);
+				return i->second.first;
+			}
+		}
+
+		// read without the lock, so that the other tiles of the shard stay
+		// available; a thread that loaded the same tile meanwhile wins
+		ref_ptr<Tile> tile = loadTile(id);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.loads++;
+		typename Shard::Map::iterator i = shard.tiles.find(id);
+		if (i != shard.tiles.end()) {
+			shard.lru.splice(shard.lru.begin(), shard.lru, i->second.second);
+			return i->second.first;
+		}
+		while (shard.tiles.size() >= tilesPerShard) {
+			shard.tiles.erase(shard.lru.back());
+			shard.lru.pop_back();
+		}
+		shard.lru.push_front(id);
+		shard.tiles[id] = std::make_pair(tile, shard.lru.begin());
+		return tile;
+	}
+
+	/** Slot of the calling thread in lastTiles, -1 if it uses the shared one.
+	 Only the threads of an active outermost OpenMP team own a slot; any
+	 other thread, e.g. the main thread, reports the thread number 0. */
+	int threadSlot() const {
+		int slot = -1;
+#ifdef _OPENMP
+		if (omp_in_parallel() && (omp_get_level() == 1))
+			slot = omp_get_thread_num();
+#endif
+		if (slot >= (int)lastTiles.size())
+			return -1;
+		return slot;
+	}
+
+	/** Tile with the given id for a thread without a slot */
+	ref_ptr<Tile> sharedTile(size_t id) const {
+		{
+			std::lock_guard<std::mutex> lock(sharedMutex);
+			if (shared.tile.valid() && (shared.id == id))
+				return shared.tile;
+		}
+		ref_ptr<Tile> tile = findTile(id);
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		shared.tile = tile;
+		shared.id = id;
+		return tile;
+	}
+
+	size_t tileId(size_t ix, size_t iy, size_t iz) const {
+		return ((ix / tileEdge) * tilesY + iy / tileEdge) * tilesZ + iz / tileEdge;
+	}
+
+	/** Value of grid point (ix, iy, iz) within the grid */
+	T value(size_t ix, size_t iy, size_t iz) const {
+		size_t id = tileId(ix, iy, iz);
+		size_t local = ((ix % tileEdge) * tileEdge + iy % tileEdge) * tileEdge + iz % tileEdge;
+
+		int slot = threadSlot();
+		if (slot < 0)
+			return sharedTile(id)->values[local];
+
+		// the tile stays alive while this thread references it, even if evicted
+		LastTile &last = lastTiles[slot];
+		if (!last.tile.valid() || (last.id != id)) {
+			last.tile = findTile(id);
+			last.id = id;
+		}
+		return last.tile->values[local];
+	}
+
+public:
+	/** Constructor
+	 @param filename	binary file as written by dumpGrid
+	 @param properties	size, origin, spacing and repetition of the grid
+	 @param cacheSize	maximum size of the cached tiles in bytes
+	 @param tileEdge	number of grid points along the edges of the tiles
+	 */
+	PagedGrid(const std::string &filename, const GridProperties &properties,
+			size_t cacheSize = 1 << 30, size_t tileEdge = 32) :
+			Nx(properties.Nx), Ny(properties.Ny), Nz(properties.Nz),
+			origin(properties.origin), spacing(properties.spacing),
+			reflective(properties.reflective), clipVolume(properties.clipVolume),
+			tileEdge(tileEdge), shared() {
+		if (tileEdge == 0)
+			throw std::runtime_error("PagedGrid: tile edge must be positive");
+		if (properties.ipol != TRILINEAR)
+			throw std::runtime_error("PagedGrid: only trilinear interpolation is supported");
+		file = new PagedGridFile(filename);
+		if (file->size() != Nx * Ny * Nz * sizeof(T))
+			throw std::runtime_error("PagedGrid: file and grid size do not match");
+		gridOrigin = origin + spacing / 2;
+		tilesX = (Nx + tileEdge - 1) / tileEdge;
+		tilesY = (Ny + tileEdge - 1) / tileEdge;
+		tilesZ = (Nz + tileEdge - 1) / tileEdge;
+		for (size_t i = 0; i < nShards; i++) {
+			shards[i].loads = 0;
+			shards[i].prefetches = 0;
+		}
+		setCacheSize(cacheSize);
+#ifdef _OPENMP
+		lastTiles.resize(omp_get_max_threads());
+#endif
+	}
+
+	/** Set the maximum size of the cached tiles in bytes.
+	 Every shard keeps at least one tile. Call outside of parallel regions. */
+	void setCacheSize(size_t bytes) {
+		size_t tileSize = tileEdge * tileEdge * tileEdge * sizeof(T);
+		tilesPerShard = std::max(bytes / tileSize / nShards, size_t(1));
+		for (size_t i = 0; i < nShards; i++) {
+			Shard &shard = shards[i];
+			while (shard.tiles.size() > tilesPerShard) {
+				shard.tiles.erase(shard.lru.back());
+				shard.lru.pop_back();
+			}
+		}
+	}
+
+	/** Maximum size of the cached tiles in bytes */
+	size_t getCacheSize() const {
+		return tilesPerShard * nShards * tileEdge * tileEdge * tileEdge * sizeof(T);
+	}
+
+	/** Number of tiles in the cache */
+	size_t getNumberOfCachedTiles() const {
+		size_t n = 0;
+		for (size_t i = 0; i < nShards; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			n += shards[i].tiles.size();
+		}
+		return n;
+	}
+
+	/** Number of tiles read from the file so far */
+	size_t getNumberOfLoads() const {
+		size_t n = 0;
+		for (size_t i = 0; i < nShards; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			n += shards[i].loads;
+		}
+		return n;
+	}
+
+	/** Number of tiles requested from the file by prefetch so far */
+	size_t getNumberOfPrefetches() const {
+		size_t n = 0;
+		for (size_t i = 0; i < nShards; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			n += shards[i].prefetches;
+		}
+		return n;
+	}
+
+	size_t getNx() const {
+		return Nx;
+	}
+
+	size_t getNy() const {
+		return Ny;
+	}
+
+	size_t getNz() const {
+		return Nz;
+	}
+
+	size_t getTileEdge() const {
+		return tileEdge;
+	}
+
+	/** Value of a grid point */
+	T get(size_t ix, size_t iy, size_t iz) const {
+		if ((ix >= Nx) || (iy >= Ny) || (iz >= Nz))
+			throw std::out_of_range("PagedGrid: grid point out of range");
+		return value(ix, iy, iz);
+	}
+
+	/** Hint that the values near a position will be needed soon, e.g. at
+	 the end of the next step of a candidate. If the tile of the position is
+	 not cached, its rows are requested from the file in the background (see
+	 PagedGridFile::willNeed), so that loading it later does not wait for
+	 the disk. Every thread requests each tile once in a row. */
+	void prefetch(const Vector3d &position) const {
+		if (clipVolume) {
+			Vector3d edge = origin + Vector3d(Nx, Ny, Nz) * spacing;
+			bool isInVolume = (position.x >= origin.x) && (position.x <= edge.x);
+			isInVolume &= (position.y >= origin.y) && (position.y <= edge.y);
+			isInVolume &= (position.z >= origin.z) && (position.z <= edge.z);
+			if (!isInVolume)
+				return;
+		}
+		Vector3d r = (position - gridOrigin) / spacing;
+		int iX0, iX1, iY0, iY1, iZ0, iZ1;
+		if (reflective) {
+			double res;
+			reflectiveClamp(r.x, Nx, iX0, iX1, res);
+			reflectiveClamp(r.y, Ny, iY0, iY1, res);
+			reflectiveClamp(r.z, Nz, iZ0, iZ1, res);
+		} else {
+			periodicClamp(r.x, Nx, iX0, iX1);
+			periodicClamp(r.y, Ny, iY0, iY1);
+			periodicClamp(r.z, Nz, iZ0, iZ1);
+		}
+		size_t id = tileId(iX0, iY0, iZ0);
+
+		int slot = threadSlot();
+		{
+			std::unique_lock<std::mutex> lock(sharedMutex, std::defer_lock);
+			if (slot < 0)
+				lock.lock();
+			LastTile &last = (slot < 0) ? shared : lastTiles[slot];
+			if ((last.tile.valid() && (last.id == id)) || (last.prefetched == id + 1))
+				return;
+			last.prefetched = id + 1;
+		}
+		Shard &shard = shards[id % nShards];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			if (shard.tiles.find(id) != shard.tiles.end())
+				return;
+			shard.prefetches++;
+		}
+
+		// the rows of the tile, each x slice from its first to its last row
+		size_t tx = id / (tilesY * tilesZ), ty = (id / tilesZ) % tilesY, tz = id % tilesZ;
+		size_t x0 = tx * tileEdge, y0 = ty * tileEdge, z0 = tz * tileEdge;
+		size_t nx = std::min(tileEdge, Nx - x0), ny = std::min(tileEdge, Ny - y0), nz = std::min(tileEdge, Nz - z0);
+		for (size_t ix = 0; ix < nx; ix++) {
+			size_t first = ((x0 + ix) * Ny + y0) * Nz + z0;
+			size_t last = ((x0 + ix) * Ny + y0 + ny - 1) * Nz + z0 + nz;
+			file->willNeed(first * sizeof(T), (last - first) * sizeof(T));
+		}
+	}
+
+	/** Interpolate the grid trilinear at a given position */
+	T interpolate(const Vector3d &position) const {
+		if (clipVolume) {
+			Vector3d edge = origin + Vector3d(Nx, Ny, Nz) * spacing;
+			bool isInVolume = (position.x >= origin.x) && (position.x <= edge.x);
+			isInVolume &= (position.y >= origin.y) && (position.y <= edge.y);
+			isInVolume &= (position.z >= origin.z) && (position.z <= edge.z);
+			if (!isInVolume)
+				return T(0.);
+		}
+
+		Vector3d r = (position - gridOrigin) / spacing;
+		int iX0, iX1, iY0, iY1, iZ0, iZ1;
+		double resX, resY, resZ, fX0, fY0, fZ0;
+		if (reflective) {
+			reflectiveClamp(r.x, Nx, iX0, iX1, resX);
+			reflectiveClamp(r.y, Ny, iY0, iY1, resY);
+			reflectiveClamp(r.z, Nz, iZ0, iZ1, resZ);
+			fX0 = resX - floor(resX);
+			fY0 = resY - floor(resY);
+			fZ0 = resZ - floor(resZ);
+		} else {
+			periodicClamp(r.x, Nx, iX0, iX1);
+			periodicClamp(r.y, Ny, iY0, iY1);
+			periodicClamp(r.z, Nz, iZ0, iZ1);
+			fX0 = r.x - floor(r.x);
+			fY0 = r.y - floor(r.y);
+			fZ0 = r.z - floor(r.z);
+		}
+		double fX1 = 1 - fX0;
+		double fY1 = 1 - fY0;
+		double fZ1 = 1 - fZ0;
+
+		T b(0.);
+		b += value(iX0, iY0, iZ0) * fX1 * fY1 * fZ1;
+		b += value(iX1, iY0, iZ0) * fX0 * fY1 * fZ1;
+		b += value(iX0, iY1, iZ0) * fX1 * fY0 * fZ1;
+		b += value(iX0, iY0, iZ1) * fX1 * fY1 * fZ0;
+		b += value(iX1, iY0, iZ1) * fX0 * fY1 * fZ0;
+		b += value(iX0, iY1, iZ1) * fX1 * fY0 * fZ0;
+		b += value(iX1, iY1, iZ0) * fX0 * fY0 * fZ1;
+		b += value(iX1, iY1, iZ1) * fX0 * fY0 * fZ0;
+		return b;
+	}
+};
+
+typedef PagedGrid<float> PagedGrid1f;
+typedef PagedGrid<Vector3f> PagedGrid3f;
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PAGEDGRID_H
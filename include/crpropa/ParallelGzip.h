@@ -0,0 +1,101 @@
+#ifndef CRPROPA_PARALLELGZIP_H
+#define CRPROPA_PARALLELGZIP_H
+
+#include <stdint.h>
+#include <deque>
+#include <future>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ParallelGzipBuffer
+ @brief Stream buffer compressing blocks as one gzip stream in background threads
+
+ The data is cut into blocks, which are deflated independently with the
+ last 32 kB of the previous block as dictionary and joined with sync flushes
+ into a single gzip member, as done by pigz. The file can be read by any gzip
+ reader. The blocks are compressed by up to threads background threads and
+ written in order to the underlying stream by the thread writing to the
+ buffer; without threads, they are compressed by the writing thread.
+ */
+class ParallelGzipBuffer: public std::streambuf {
+public:
+	struct Block {
+		std::string data; ///< deflated data, ending with a sync flush
+		uint32_t crc;
+		size_t size; ///< size of the uncompressed data
+		Block() : crc(0), size(0) {
+		}
+	};
+
+	ParallelGzipBuffer(std::ostream &out, size_t threads = 1, int level = -1, size_t blockSize = 1 << 20);
+	~ParallelGzipBuffer();
+
+	void setThreads(size_t threads);
+	size_t getThreads() const;
+	/** Write the remaining blocks and the end of the gzip stream, further output is discarded */
+	void close();
+
+protected:
+	int overflow(int c);
+	int sync();
+
+private:
+	std::ostream &out;
+	size_t threads;
+	int level;
+	std::vector<char> input;
+	std::string dictionary;
+	std::deque<std::future<Block> > pending;
+	uint32_t crc;
+	uint64_t size;
+	bool started, closed;
+
+	void submit();
+	void write(Block block);
+	void writeReady(size_t maxPending);
+
+	ParallelGzipBuffer(const ParallelGzipBuffer &);
+	ParallelGzipBuffer &operator=(const ParallelGzipBuffer &);
+};
+
+/**
+ @class ParallelGzipStream
+ @brief Output stream writing gzip compressed data with a ParallelGzipBuffer
+ */
+class ParallelGzipStream: public std::ostream {
+	ParallelGzipBuffer buffer;
+public:
+	/**
+	 @param out			stream of the compressed data
+	 @param threads		number of compression threads, 0 to compress in the writing thread
+	 @param level		zlib compression level, -1 for the default
+	 @param blockSize	size of the uncompressed blocks
+	 */
+	ParallelGzipStream(std::ostream &out, size_t threads = 1, int level = -1, size_t blockSize = 1 << 20) :
+			std::ostream(0), buffer(out, threads, level, blockSize) {
+		rdbuf(&buffer);
+	}
+	void setThreads(size_t threads) {
+		buffer.setThreads(threads);
+	}
+	size_t getThreads() const {
+		return buffer.getThreads();
+	}
+	void close() {
+		buffer.close();
+	}
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PARALLELGZIP_H
@@ -0,0 +1,77 @@
+#ifndef CRPROPA_PARAMETERSWEEP_H
+#define CRPROPA_PARAMETERSWEEP_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ParameterSweep
+ @brief Run many small simulations in one process on one thread pool.
+
+ Each job is a ModuleList with its own source, number of candidates and
+ outputs. Components which do not change, e.g. magnetic fields, photon fields
+ or interaction modules with their tables, can be shared by the module lists
+ of several jobs, so they are loaded only once. run() splits all jobs into
+ chunks of candidates and distributes the chunks of all jobs dynamically over
+ the OpenMP threads, so the threads are kept busy also with many small jobs.
+ The candidates of a job are propagated with ModuleList::run(Candidate*) and
+ draw from the streams of their index in the job if Random::seedStreams is
+ used, as in ModuleList::run with a source. The batch size and schedule of
+ the module lists are not used. The modules of a job are called from several
+ threads at the same time, as in a parallel ModuleList::run. The outputs of a
+ job receive only the candidates of this job; close them after run().
+ */
+class ParameterSweep: public Referenced {
+	struct Job {
+		ref_ptr<ModuleList> simulation;
+		ref_ptr<SourceInterface> source;
+		size_t count;
+		double time; ///< wall time of all threads spent on the job [s]
+	};
+	std::vector<Job> jobs;
+	size_t chunkSize;
+	bool showProgress;
+public:
+	ParameterSweep();
+
+	/** Add a job
+	 @param simulation	module list of the job
+	 @param source		source of the candidates of the job
+	 @param count		number of candidates
+	 @returns			index of the job
+	 */
+	size_t add(ModuleList *simulation, SourceInterface *source, size_t count);
+	size_t size() const;
+	ref_ptr<ModuleList> getSimulation(size_t i) const;
+	size_t getCount(size_t i) const;
+	/** Wall time of all threads spent on a job in the last run() [s] */
+	double getTime(size_t i) const;
+
+	/** Number of candidates of a job handed to a thread at once (default 16) */
+	void setChunkSize(size_t size);
+	size_t getChunkSize() const;
+	void setShowProgress(bool show = true); ///< activate a progress bar
+
+	/** Propagate the candidates of all jobs
+	 @param recursive			propagate secondaries
+	 @param secondariesFirst	propagate secondaries before the next step of the parent
+	 */
+	void run(bool recursive = true, bool secondariesFirst = false);
+
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PARAMETERSWEEP_H
@@ -0,0 +1,51 @@
+#ifndef CRPROPA_PARTICLE_STATE_BATCH_H
+#define CRPROPA_PARTICLE_STATE_BATCH_H
+
+#include "crpropa/Candidate.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ParticleStateBatch
+ @brief Current states of a batch of candidates as structure of arrays
+
+ The positions, directions and energies of the candidates are stored in
+ contiguous arrays, one per component, so that modules processing a batch of
+ candidates (see Module::processBatch) can vectorise their loops across the
+ particles. Slot i refers to the i-th candidate of the last load().
+ */
+class ParticleStateBatch {
+public:
+	std::vector<int> id;
+	std::vector<double> charge, mass, energy;
+	std::vector<double> x, y, z;    ///< position [m]
+	std::vector<double> dx, dy, dz; ///< direction unit vector
+
+	ParticleStateBatch(size_t n = 0);
+	void resize(size_t n);
+	size_t size() const;
+
+	/** Copy the current states of n candidates into the arrays */
+	void load(Candidate **candidates, size_t n);
+	/** Write the positions, directions and energies back to the current
+	 states of the candidates. The particle ids are not written back.
+	 @param candidates	the candidates of the last load()
+	 */
+	void store(Candidate **candidates) const;
+
+	Vector3d getPosition(size_t i) const;
+	void setPosition(size_t i, const Vector3d &position);
+	Vector3d getDirection(size_t i) const;
+	void setDirection(size_t i, const Vector3d &direction); ///< the direction is normalized
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PARTICLE_STATE_BATCH_H
@@ -0,0 +1,63 @@
+#ifndef CRPROPA_PERFCOUNTERS_H
+#define CRPROPA_PERFCOUNTERS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class PerfCounters
+ @brief Hardware performance counters of the calling thread (Linux perf_event).
+
+ The counters are opened as one group for the thread that calls open(),
+ only for user space, and read together with one system call. Known names
+ are the generic events of perf: cycles, instructions, cache-references,
+ cache-misses, branch-misses, stalled-cycles-frontend,
+ stalled-cycles-backend, L1-dcache-load-misses, LLC-load-misses,
+ dTLB-load-misses, page-faults and context-switches. CPU specific events,
+ e.g. the retired vector instructions, are given as raw:0xCONFIG with the
+ event code and umask from the manual of the CPU (e.g. raw:0x4c7 for
+ FP_ARITH_INST_RETIRED.256B_PACKED_DOUBLE on Intel Skylake).
+
+ The counters need a kernel.perf_event_paranoid of 2 or less and may not
+ be available in virtual machines; then open() returns false. Used by
+ ModuleList::setProfileCounters.
+ */
+class PerfCounters {
+	std::vector<std::string> names;
+	std::vector<int> fds;
+
+	PerfCounters(const PerfCounters &);
+	PerfCounters &operator=(const PerfCounters &);
+public:
+	static const size_t maxCounters = 8;
+
+	PerfCounters();
+	~PerfCounters();
+
+	/** Open the counters for the calling thread, false (and the reason in
+	 error) if one of them is not available */
+	bool open(const std::vector<std::string> &names, std::string &error);
+	void close();
+	bool isOpen() const;
+	size_t size() const;
+	const std::vector<std::string> &getNames() const;
+	/** Current values of the counters, size() values; the counters run
+	 from open() and are only compared */
+	void read(uint64_t *values) const;
+
+	/** Whether name is a known event or a raw:0x event */
+	static bool isKnown(const std::string &name);
+	static std::vector<std::string> getKnownNames();
+};
+/** @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_PERFCOUNTERS_H
@@ -3,6 +3,7 @@
 
 #include "crpropa/Common.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/RedshiftCache.h"
 
 #include <vector>
 #include <string>
@@ -67,10 +68,27 @@ protected:
  The first file must be a list of photon energies [J], named fieldName_photonEnergy.txt
  The second file must be a list of comoving photon field densities [1/m^3], named fieldName_photonDensity.txt
  Optionally, a third file contains redshifts, named fieldName_redshift.txt
+
+ The tabulated energy interval of a photon energy is found in constant time
+ from an index over equidistant bins in log(energy), and the densities of
+ redshift-dependent fields are interpolated from a slice at the redshift of
+ the calling thread, kept in a RedshiftCache.
  */
 class TabularPhotonField: public PhotonField {
 public:
 	TabularPhotonField(const std::string fieldName, const bool isRedshiftDependent = true);
+	/** Constructor from tables instead of files, as returned by the getters
+	 @param fieldName		name of the field, e.g. for the interaction tables
+	 @param photonEnergies	photon energies [J]
+	 @param photonDensity	comoving photon densities [1/m^3], for each energy the densities at all redshifts
+	 @param redshifts		redshifts, empty for a field without redshift dependence
+	 */
+	TabularPhotonField(const std::string fieldName, const std::vector<double> &photonEnergies,
+			const std::vector<double> &photonDensity, const std::vector<double> &redshifts);
+
+	const std::vector<double> &getPhotonEnergies() const;
+	const std::vector<double> &getPhotonDensities() const;
+	const std::vector<double> &getRedshifts() const;
 
 	double getPhotonDensity(double ePhoton, double z = 0.) const;
 	double getRedshiftScaling(double z) const;
@@ -83,11 +101,19 @@ protected:
 	void readRedshift(std::string filePath);
 	void initRedshiftScaling();
 	void checkInputData() const;
+	void initEnergyIndex();
+	// index i of the interval photonEnergies[i] <= E < photonEnergies[i + 1]
+	size_t energyInterval(double E) const;
+	double interpolateEnergy(double E, const double *density) const;
 
 	std::vector<double> photonEnergies;
 	std::vector<double> photonDensity;
 	std::vector<double> redshifts;
 	std::vector<double> redshiftScalings;
+	RedshiftCache scalingCache;
+	RedshiftCache densityCache;
+	std::vector<size_t> energyIndex;
+	double logEnergyMin, logEnergyStep;
 };
 
 /**
@@ -1,8 +1,15 @@
 #ifndef CRPROPA_PROGRESSBAR_H
 #define CRPROPA_PROGRESSBAR_H
 
-#include <string>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
 
 namespace crpropa {
 
@@ -11,33 +18,90 @@ namespace crpropa {
  * @{
  */
 
-/** 
+/**
  @class ProgressBar
  @brief Track the evolution of the simulations with a progress bar
+
+ The threads only add to atomic counters; a timer thread started by start()
+ redraws the bar with the candidates and steps per second, the time to go
+ and the fraction of the time the threads were busy. When stdout is not a
+ terminal, e.g. in a batch job, the progress is written as lines of
+ key=value pairs instead, by default every 60 s, the last one with the state
+ finished, stopped or error:
+
+	crpropa::progress done=1200 total=10000 percent=12.0 elapsed=30 eta=220 rate=40 steps_rate=8.1e+05 busy=0.98,0.97 state=running
+
+ The environment variable CRPROPA_PROGRESS=bar or CRPROPA_PROGRESS=lines
+ selects the format regardless of stdout.
  */
 class ProgressBar {
 private:
+	// work of one thread, only written by its thread
+	struct ThreadSlot {
+		std::atomic<uint64_t> steps;
+		std::atomic<double> busy;
+		char padding[64]; // avoid false sharing between threads
+		ThreadSlot() : steps(0), busy(0) {
+		}
+	};
+
 	unsigned long _steps;
-	unsigned long _currentCount;
+	std::atomic<unsigned long> _currentCount;
 	unsigned long _maxbarLength;
-	unsigned long _nextStep;
-	unsigned long _updateSteps;
+	size_t _nThreads;
+	std::unique_ptr<ThreadSlot[]> _threads;
+	std::chrono::steady_clock::time_point _startClock;
 	time_t _startTime;
-	std::string stringTmpl;
-	std::string arrow;
+	std::string _title;
+	double _interval;
+	bool _lines;
+	bool _started, _finished;
+
+	std::thread _timer;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _stopping;
+
+	void runTimer();
+	void finish(bool error);
+	void draw(bool finished, bool error = false);
 
+	static uint64_t &threadSteps() {
+		static thread_local uint64_t steps = 0;
+		return steps;
+	}
+
+	ProgressBar(const ProgressBar &);
+	ProgressBar &operator=(const ProgressBar &);
 public:
 	/** Constructor to initialize a progress bar
 	 @param steps		number of steps
-	 @param updateSteps	progress bar will be updated at the steps given by this parameter
+	 @param updateSteps	not used, the bar is redrawn by a timer (see setInterval)
 	 */
 	ProgressBar(unsigned long steps = 0, unsigned long updateSteps = 100);
+	~ProgressBar();
+
+	/** Number of threads reporting with addThreadWork, before start (default 1) */
+	void setThreads(size_t n);
+	/** Interval of the redraws [s], before start; default 1 s for the bar and 60 s for lines */
+	void setInterval(double seconds);
+	/** Write lines of key=value pairs instead of the bar, before start */
+	void setMachineReadable(bool lines);
+	bool getMachineReadable() const;
+
+	/** Print the title and start the timer thread */
 	void start(const std::string &title);
 
-	/** Update the progressbar
+	/** Update the progressbar by n finished steps, lock-free
 	 This should be called steps times in a loop.
 	*/
-	void update(); 
+	void update(unsigned long n = 1);
+
+	/** Add the simulation steps and the busy time of work done by a thread */
+	void addThreadWork(size_t thread, uint64_t steps, double busy);
+
+	/** Stop the timer thread and print the final state, also called by the destructor */
+	void stop();
 
 	/** Sets the position of the progress bar to a given value
 	 @param position	current position of the progress bar
@@ -47,6 +111,49 @@ public:
 	/** Mark the progress bar with an error
 	 */
 	void setError();
+
+	/** Current progress as a line of key=value pairs */
+	std::string getProgressLine();
+
+	/** Count n simulation steps of the calling thread, see ProgressWork */
+	static void countSteps(uint64_t n = 1) {
+		threadSteps() += n;
+	}
+	/** Simulation steps counted by the calling thread so far */
+	static uint64_t getThreadSteps() {
+		return threadSteps();
+	}
+};
+
+/**
+ @class ProgressWork
+ @brief Scope of a block of work of a thread for a ProgressBar.
+
+ At the end of the scope the candidates are added to the bar together with
+ the steps counted by the thread and the time spent in the scope.
+ */
+class ProgressWork {
+	ProgressBar *bar;
+	size_t thread;
+	uint64_t steps;
+	std::chrono::steady_clock::time_point start;
+public:
+	unsigned long candidates; ///< finished candidates of the block
+	/** @param bar	progress bar, may be NULL */
+	ProgressWork(ProgressBar *bar, size_t thread, unsigned long candidates = 0) :
+			bar(bar), thread(thread), steps(0), candidates(candidates) {
+		if (bar) {
+			steps = ProgressBar::getThreadSteps();
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	~ProgressWork() {
+		if (!bar)
+			return;
+		double busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		bar->addThreadWork(thread, ProgressBar::getThreadSteps() - steps, busy);
+		bar->update(candidates);
+	}
 };
 /** @}*/
 
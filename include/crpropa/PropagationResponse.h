@@ -0,0 +1,140 @@
+#ifndef CRPROPA_PROPAGATIONRESPONSE_H
+#define CRPROPA_PROPAGATIONRESPONSE_H
+
+#include "crpropa/Module.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class PropagationResponse
+ @brief Arrival spectra of 1D simulations for any injection, from one simulation per injection bin.
+
+ The propagation is linear in the injection: the arrival spectrum of a source
+ model is the sum of the arrivals of its injected particles. compute() runs a
+ 1D simulation for each injection bin, i.e. each species, logarithmic energy
+ bin and redshift bin, with count candidates at x = D(z) moving towards the
+ observer at the origin, the energy log-uniform and the redshift uniform in
+ the bin. The response is attached to the observer of the module list, e.g.
+
+ 	observer->onDetection(response);
+
+ and records the detected candidates and secondaries by their id and arrival
+ energy bin, weighted by the candidate weight and divided by count. The
+ response is stored as a sparse matrix, with the non-zero arrival bins of
+ each injection bin in a row.
+
+ convolve() sums the rows with the weights of a source model, see
+ getInjectionWeights for the weights of a SourceComposition or
+ SourceGenericComposition with a SourceRedshiftEvolution, in a time
+ proportional to the number of non-zero entries. The response is accurate for
+ spectra that vary little within the bins, so the bins should be narrow
+ compared to the features of the injection, e.g. 0.05 in log10(E). It can be
+ saved to and loaded from a binary file.
+ */
+class PropagationResponse: public Module {
+public:
+	/** Constructor
+	 @param Emin			lower edge of the injection and arrival energy bins [J]
+	 @param Emax			upper edge of the injection and arrival energy bins [J]
+	 @param energyBins		number of logarithmic energy bins
+	 @param zmin			lower edge of the redshift bins
+	 @param zmax			upper edge of the redshift bins
+	 @param redshiftBins	number of linear redshift bins
+	 */
+	PropagationResponse(double Emin, double Emax, size_t energyBins, double zmin, double zmax, size_t redshiftBins);
+
+	/** Add an injected species (particle id) */
+	void addSpecies(int id);
+	std::vector<int> getSpecies() const;
+	/** Other logarithmic arrival energy bins (default the injection bins) */
+	void setArrivalEnergyBins(double Emin, double Emax, size_t bins);
+
+	size_t getEnergyBins() const;
+	double getEnergyEdge(size_t i) const; ///< i = 0 ... getEnergyBins()
+	size_t getRedshiftBins() const;
+	double getRedshiftEdge(size_t i) const; ///< i = 0 ... getRedshiftBins()
+	size_t getArrivalEnergyBins() const;
+	double getArrivalEnergyEdge(size_t i) const; ///< i = 0 ... getArrivalEnergyBins()
+
+	/** Number of injection bins: species x energy bins x redshift bins */
+	size_t getInjectionSize() const;
+	/** Index of an injection bin in the weights of convolve */
+	size_t getInjectionIndex(size_t species, size_t energyBin, size_t redshiftBin) const;
+	/** Detected particle ids, in the order of the arrival spectra of convolve */
+	std::vector<int> getArrivalIds() const;
+	/** Number of non-zero entries of the response */
+	size_t getEntryCount() const;
+	/** Detected weight per injected candidate of an injection bin in an arrival bin */
+	double getResponse(size_t injection, int arrivalId, size_t arrivalEnergyBin) const;
+
+	/** Compute the response, replacing a previous one
+	 @param simulation	1D module list with an observer attached to this response
+	 @param count		number of candidates per injection bin
+	 @param recursive	propagate secondaries
+	 */
+	void compute(ModuleList *simulation, size_t count, bool recursive = true);
+	/** Record a detected candidate of compute() */
+	void process(Candidate *candidate) const;
+	void clear();
+
+	/** Arrival spectra of an injection
+	 @param weights	number of injected candidates in each injection bin, see getInjectionIndex
+	 @returns		detected weight in each arrival bin, getArrivalEnergyBins() values for each of getArrivalIds()
+	 */
+	std::vector<double> convolve(const std::vector<double> &weights) const;
+
+	/** Weights of the injection bins for SourceComposition(Emin, Rmax, index)
+	 with SourceRedshiftEvolution(m, zmin, zmax), with Emin and the redshift
+	 range of the response, normalized to 1
+	 @param abundances	abundance of each species, as in SourceComposition::add
+	 @param Rmax		maximum rigidity [J], the maximum energy is Z * Rmax
+	 @param index		spectral index, dN/dE ~ E^index
+	 @param m			source evolution, dN/dz ~ (1 + z)^m
+	 */
+	std::vector<double> getInjectionWeights(const std::vector<double> &abundances, double Rmax, double index, double m) const;
+#ifdef CRPROPA_HAVE_MUPARSER
+	/** Weights of the injection bins for a SourceGenericComposition with
+	 SourceRedshiftEvolution(m, zmin, zmax) and the redshift range of the
+	 response, normalized to 1. Its nuclei must be species of the response. */
+	std::vector<double> getInjectionWeights(const SourceGenericComposition &composition, double m) const;
+#endif
+
+	void save(const std::string &filename) const;
+	void load(const std::string &filename);
+	std::string getDescription() const;
+
+private:
+	std::vector<int> species;
+	double Emin, Emax, zmin, zmax, arrivalEmin, arrivalEmax;
+	size_t energyBins, redshiftBins, arrivalBins;
+	size_t count; ///< candidates per injection bin of compute()
+
+	// sparse matrix: row i holds the entries offsets[i] ... offsets[i + 1] - 1,
+	// column = arrival species index * arrivalBins + arrival energy bin
+	std::vector<size_t> offsets;
+	std::vector<size_t> columns;
+	std::vector<double> values;
+
+	// detections during compute(), by row and column
+	mutable std::vector<int> arrivalIds;
+	mutable std::map<std::pair<size_t, size_t>, double> pending;
+
+	std::vector<double> getRedshiftWeights(double m) const;
+	void finalize();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONRESPONSE_H
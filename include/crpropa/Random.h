@@ -86,6 +86,30 @@ namespace crpropa {
  * \addtogroup Core
  * @{
  */
+/**
+ @class AliasTable
+ @brief Walker/Vose alias table of a discrete distribution.
+
+ Built once from an (unnormalized) cumulative distribution function, as used by
+ Random::randBin, a bin is drawn in O(1) with one random number, with the same
+ distribution as from the binary search in the cumulative distribution.
+ */
+class AliasTable {
+	std::vector<double> probability; ///< probability to keep bin i instead of its alias
+	std::vector<uint32_t> alias;
+public:
+	AliasTable();
+	/// Table of the bins of a cumulative distribution function, without leading zero
+	AliasTable(const std::vector<float> &cdf);
+	AliasTable(const std::vector<double> &cdf);
+	/// Bin for a uniform random number u in [0, 1)
+	size_t sample(double u) const;
+	size_t size() const;
+	/// Probability to keep bin i and its alias
+	double getProbability(size_t i) const;
+	size_t getAlias(size_t i) const;
+};
+
 /**
  @class Random
  @brief Random number generator.
@@ -93,6 +117,17 @@ namespace crpropa {
  Mersenne Twister random number generator -- a C++ class Random
  Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
  Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
+
+ Alternatively a generator draws from a stream of the counter-based engine
+ Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3",
+ SC11), where the n-th random number of stream s is a function of the key,
+ s and n only. With Random::seedStreams, ModuleList::run draws the random
+ numbers of each source candidate and its secondaries from the stream of its
+ index in the run, which makes the results independent of the number of
+ threads and of the scheduling (with a fixed batch size, for detached
+ secondaries of the breadth-first queue the order is not reproducible).
+ Each secondary draws from a stream of its own, drawn from the stream of its
+ parent, so that the results do not depend on ModuleList::setSecondaryTasks.
  */
 class Random {
 public:
@@ -105,6 +140,12 @@ protected:
 	std::vector<uint32_t> initial_seed;//
 	uint32_t *pNext;// next value to get from state
 	int left;// number of values left before reload needed
+	// counter-based engine, used instead of the state above if enabled
+	bool counterBased;
+	uint32_t key[2];
+	uint64_t stream;
+	uint64_t counter; // number of values drawn from the stream
+	uint32_t block[4]; // values of the current counter block
 
 //Methods
 public:
@@ -128,6 +169,8 @@ public:
 	// Every other access function simply transforms the numbers extracted here
 	uint32_t randInt();///< integer in [0,2**32-1]
 	uint32_t randInt( const uint32_t& n );///< integer in [0,n] for n < 2**32
+	/// n integers in [0,2**32-1], the same as n calls of randInt()
+	void randInt(uint32_t *values, size_t n);
 
 	uint64_t randInt64(); ///< integer in [0, 2**64 -1]. PROBABLY NOT SECURE TO USE
 	uint64_t randInt64(const uint64_t &n); ///< integer in [0, n] for n < 2**64 -1. PROBABLY NOT SECURE TO USE
@@ -140,6 +183,14 @@ public:
 	double randExponential();
 	/// Normal distributed random number
 	double randNorm( const double& mean = 0.0, const double& variance = 1.0 );
+	/// n standard normal distributed random numbers, using both values of each Box-Muller pair
+	void randNorm(double *values, size_t n);
+	/// n real numbers in [0,1], the same as n calls of rand()
+	void rand(double *values, size_t n);
+	/// n exponentially distributed random numbers
+	void randExponential(double *values, size_t n);
+	/// n random points on a unit-sphere, the same as n calls of randVector()
+	void randVector(Vector3d *values, size_t n);
 	/// Uniform distribution in [min, max]
 	double randUniform(double min, double max);
 	/// Rayleigh distributed random number
@@ -150,6 +201,8 @@ public:
 	/// Draw a random bin from a (unnormalized) cumulative distribution function, without leading zero.
 	size_t randBin(const std::vector<float> &cdf);
 	size_t randBin(const std::vector<double> &cdf);
+	/// Draw a random bin from an alias table in O(1)
+	size_t randBin(const AliasTable &table);
 
 	/// Random point on a unit-sphere
 	Vector3d randVector();
@@ -170,6 +223,8 @@ public:
 
 	/// Power-law distribution of a given differential spectral index
 	double randPowerLaw(double index, double min, double max);
+	/// n power law distributed real numbers, the same as n calls of randPowerLaw
+	void randPowerLaw(double index, double min, double max, double *values, size_t n);
 	/// Broken power-law distribution
 	double randBrokenPowerLaw(double index1, double index2, double breakpoint, double min, double max );
 
@@ -197,9 +252,38 @@ public:
 	friend std::ostream& operator<<( std::ostream& os, const Random& mtrand );
 	friend std::istream& operator>>( std::istream& is, Random& mtrand );
 
+	/// Draw from the stream of the counter-based engine with the given key,
+	/// starting after counter values; until seeded again with seed()
+	void seedStream(uint64_t key, uint64_t stream, uint64_t counter = 0);
+	bool isCounterBased() const;
+	uint64_t getStream() const;
+	/// Number of values drawn from the stream, to continue it with seedStream
+	uint64_t getCounter() const;
+	/// Philox4x32-10 block function: out = bijection of counter, keyed by key
+	static void philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
 	static Random &instance();
 	static void seedThreads(const uint32_t oneSeed);
 	static std::vector< std::vector<uint32_t> > getSeedThreads();
+	/// Generator state of thread i, which must not draw numbers meanwhile
+	static std::string getThreadState(size_t i);
+	/// Write generator states of threads, e.g. from getThreadState, to a stream
+	static void saveThreads(std::ostream &os, const std::vector<std::string> &states);
+	/// Restore generator states written with saveThreads, returns the number of restored threads
+	static size_t loadThreads(std::istream &is);
+
+	/// Let instance() draw from streams of the counter-based engine keyed by
+	/// seed, selected by ModuleList::run per source candidate, on any number of threads
+	static void seedStreams(uint64_t seed);
+	/// Return to the Mersenne Twister of each thread
+	static void disableStreams();
+	static bool getStreamsEnabled();
+	/// Reserve n consecutive streams for the candidates of a run, returns the first
+	static uint64_t reserveStreams(uint64_t n);
+	/// First stream of the next reservation (starts at 0 with seedStreams)
+	static void setNextStream(uint64_t stream);
+	/// Continue the stream after counter values in instance(), if the streams are enabled
+	static void selectStream(uint64_t stream, uint64_t counter = 0);
 
 protected:
 	/// Initialize generator state with seed
@@ -207,6 +291,8 @@ protected:
 	/// In previous versions, most significant bits (MSBs) of the seed affect
 	/// only MSBs of the state array.  Modified 9 Jan 2002 by Makoto Matsumoto.
 	void initialize( const uint32_t oneSeed );
+	/// Compute the block of the stream containing the value at counter
+	void generateBlock();
 
 	/// Generate N new values in state
 	/// Made clearer and faster by Matthew Bellew (matthew.bellew@home.com)
@@ -0,0 +1,54 @@
+#ifndef CRPROPA_REDSHIFTCACHE_H
+#define CRPROPA_REDSHIFTCACHE_H
+
+#include <vector>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class RedshiftCache
+ @brief Per-thread cache of values that depend on the redshift only.
+
+ Redshift-dependent quantities, e.g. the scaling of a photon field or a
+ slice of a rate table at the redshift of the candidate, barely change
+ between the steps of a candidate. Each thread keeps the values of the last
+ redshift of a cache and reuses them as long as the redshift differs by no
+ more than the tolerance, which is shared by all caches. The default
+ tolerance 0 reuses values only for the same redshift. A positive tolerance
+ trades accuracy for speed, and the reused values then depend on the
+ redshifts each thread evaluated before, i.e. on the thread scheduling.
+ The threads have a small number of slots, caches sharing a slot replace
+ each others values.
+ */
+class RedshiftCache {
+	uint64_t id;
+	static double tolerance;
+public:
+	RedshiftCache();
+	RedshiftCache(const RedshiftCache &);
+	RedshiftCache &operator=(const RedshiftCache &);
+
+	/**
+	 Values of the calling thread for the redshift z.
+	 @param z		redshift
+	 @param valid	false if the values have to be computed for z by the caller
+	 @returns		values of this cache in the slot of the calling thread
+	 */
+	std::vector<double> &get(double z, bool &valid) const;
+	/** Discard the values of all threads, e.g. after the tables changed */
+	void clear();
+
+	/** Absolute tolerance in redshift, 0 (default) to reuse values only for the same redshift */
+	static void setTolerance(double tolerance);
+	static double getTolerance();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_REDSHIFTCACHE_H
@@ -23,16 +23,19 @@ namespace crpropa {
  Every reference increases the reference counter, every dereference decreases it.
  When the counter is decreased to 0, the object is deleted.
  Candidate, Module, MagneticField and Source inherit from this class
+
+ The counter is updated atomically, unless the object is marked as thread
+ confined, i.e. only referenced by one thread at a time (see setThreadConfined).
  */
 class Referenced {
 public:
 
 	inline Referenced() :
-			_referenceCount(0) {
+			_referenceCount(0), _threadConfined(false) {
 	}
 
 	inline Referenced(const Referenced&) :
-			_referenceCount(0) {
+			_referenceCount(0), _threadConfined(false) {
 	}
 
 	inline Referenced& operator =(const Referenced&) {
@@ -40,6 +43,8 @@ public:
 	}
 
 	inline size_t addReference() const {
+		if (_threadConfined)
+			return ++_referenceCount;
 		int newRef;
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
@@ -61,15 +66,19 @@ public:
 					<< typeid(*this).name() << std::endl;
 #endif
 		int newRef;
+		if (_threadConfined)
+			newRef = --_referenceCount;
+		else {
 #if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{newRef = _referenceCount--;}
+			#pragma omp atomic capture
+			{newRef = _referenceCount--;}
 #elif defined(__GNUC__)
-		newRef = __sync_sub_and_fetch(&_referenceCount, 1);
+			newRef = __sync_sub_and_fetch(&_referenceCount, 1);
 #else
-		#pragma omp critical
-		{newRef = _referenceCount--;}
+			#pragma omp critical
+			{newRef = _referenceCount--;}
 #endif
+		}
 
 		if (newRef == 0) {
 			delete this;
@@ -85,6 +94,21 @@ public:
 		return _referenceCount;
 	}
 
+	/** Use plain instead of atomic updates of the reference counter.
+	 This is only safe as long as the object is referenced by a single thread
+	 at a time. Code that hands the object to other threads or stores it in a
+	 shared container has to call setThreadConfined(false) first, while it
+	 still has exclusive access.
+	 @param confined	the object is referenced by one thread at a time
+	 */
+	inline void setThreadConfined(bool confined = true) const {
+		_threadConfined = confined;
+	}
+
+	inline bool isThreadConfined() const {
+		return _threadConfined;
+	}
+
 protected:
 
 	virtual inline ~Referenced() {
@@ -96,6 +120,7 @@ protected:
 	}
 
 	mutable size_t _referenceCount;
+	mutable bool _threadConfined;
 };
 
 inline void intrusive_ptr_add_ref(Referenced* p) {
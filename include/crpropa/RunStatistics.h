@@ -0,0 +1,99 @@
+#ifndef CRPROPA_RUNSTATISTICS_H
+#define CRPROPA_RUNSTATISTICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class RunStatistics
+ @brief Counters and histograms describing the shape of a workload.
+
+ Modules report into named counters, e.g. the interactions of a module or the
+ rejected steps of an adaptive propagation, and into histograms of integer
+ values, e.g. the steps per candidate. Every thread counts in its own maps,
+ which are merged when queried. The names have to be string literals or
+ otherwise outlive the statistics. The histograms have binary logarithmic
+ bins: bin 0 holds the value 0, bin k the values in [2^(k-1), 2^k).
+ When disabled, a report costs one relaxed atomic load. Usually enabled with
+ ModuleList::setStatistics, which also prints the summary after each run.
+ */
+class RunStatistics {
+public:
+	struct Histogram {
+		std::vector<uint64_t> bins;
+		uint64_t entries, sum, maximum;
+		Histogram() : entries(0), sum(0), maximum(0) {
+		}
+		void fill(uint64_t value);
+		void add(const Histogram &other);
+	};
+
+private:
+	struct ThreadData {
+		std::unordered_map<const char *, uint64_t> counters;
+		std::unordered_map<const char *, Histogram> histograms;
+	};
+
+	static std::atomic<bool> active;
+	mutable std::mutex mutex; ///< protects the list of thread data
+	std::vector<std::unique_ptr<ThreadData> > threads;
+
+	RunStatistics() {
+	}
+	ThreadData &getThreadData();
+	std::map<std::string, uint64_t> mergeCounters() const;
+	std::map<std::string, Histogram> mergeHistograms() const;
+
+public:
+	static RunStatistics &instance();
+
+	/** Fast check whether reports are recorded */
+	static bool enabled() {
+		return active.load(std::memory_order_relaxed);
+	}
+	/** Add n to the counter name of the calling thread, if enabled */
+	static void count(const char *name, uint64_t n = 1) {
+		if (enabled())
+			instance().addCount(name, n);
+	}
+	/** Fill value into the histogram name of the calling thread, if enabled */
+	static void fill(const char *name, uint64_t value) {
+		if (enabled())
+			instance().addValue(name, value);
+	}
+
+	void setEnabled(bool enable = true);
+	void addCount(const char *name, uint64_t n);
+	void addValue(const char *name, uint64_t value);
+	/** Reset all counters and histograms; not while threads report */
+	void clear();
+
+	std::vector<std::string> getCounterNames() const;
+	uint64_t getCount(const std::string &name) const;
+	std::vector<std::string> getHistogramNames() const;
+	/** Entries per bin, see the class description for the bins */
+	std::vector<uint64_t> getHistogram(const std::string &name) const;
+	uint64_t getEntries(const std::string &name) const;
+	double getMean(const std::string &name) const;
+	uint64_t getMaximum(const std::string &name) const;
+	/** Table of all counters and histograms. For counters "X: rejected steps"
+	 with a counter "X: trial steps" the rejected fraction is given. */
+	std::string getSummary() const;
+};
+/** @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_RUNSTATISTICS_H
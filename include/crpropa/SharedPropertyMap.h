@@ -0,0 +1,118 @@
+#ifndef CRPROPA_SHAREDPROPERTYMAP_H
+#define CRPROPA_SHAREDPROPERTYMAP_H
+
+#include "crpropa/AssocVector.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/SymbolTable.h"
+#include "crpropa/Variant.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class SharedPropertyMap
+ @brief Copy-on-write map of the candidate properties.
+
+ Copies share the entries, which are only copied by the first modification
+ of a map that is shared, e.g. the properties of a secondary, which are a
+ copy of those of its parent. An empty map holds no allocation. The shared
+ entries are immutable and their reference counter is atomic, so that the
+ copies can be used by different threads. Iterators are invalidated by any
+ modification.
+ */
+class SharedPropertyMap {
+public:
+	typedef Loki::AssocVector<Symbol, Variant> map_type;
+	typedef map_type::value_type value_type;
+	typedef map_type::const_iterator const_iterator;
+
+	SharedPropertyMap() {
+	}
+
+	size_t size() const {
+		return data.valid() ? data->entries.size() : 0;
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	const_iterator begin() const {
+		return entries().begin();
+	}
+
+	const_iterator end() const {
+		return entries().end();
+	}
+
+	const_iterator find(Symbol name) const {
+		return entries().find(name);
+	}
+
+	/** Value of a property, NULL if not present */
+	const Variant *get(Symbol name) const {
+		if (!data.valid())
+			return 0;
+		const_iterator i = data->entries.find(name);
+		return (i == data->entries.end()) ? 0 : &i->second;
+	}
+
+	void set(Symbol name, const Variant &value) {
+		detach();
+		data->entries[name] = value;
+	}
+
+	/** Value of a property for modification, inserted if not present */
+	Variant &operator[](Symbol name) {
+		detach();
+		return data->entries[name];
+	}
+
+	/** Remove a property, false if not present */
+	bool erase(Symbol name) {
+		if (get(name) == 0)
+			return false;
+		detach();
+		data->entries.erase(name);
+		return true;
+	}
+
+	void clear() {
+		data = 0;
+	}
+
+	/** Whether the entries are shared with a copy of the map */
+	bool isShared() const {
+		return data.valid() && (data->getReferenceCount() > 1);
+	}
+
+private:
+	struct Data: public Referenced {
+		map_type entries;
+	};
+	ref_ptr<Data> data;
+
+	const map_type &entries() const {
+		static const map_type none;
+		return data.valid() ? data->entries : none;
+	}
+
+	// own entries before a modification
+	void detach() {
+		if (!data.valid())
+			data = new Data;
+		else if (data->getReferenceCount() > 1) {
+			ref_ptr<Data> copy = new Data;
+			copy->entries = data->entries;
+			data = copy;
+		}
+	}
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_SHAREDPROPERTYMAP_H
@@ -4,6 +4,8 @@
 #include "crpropa/Candidate.h"
 #include "crpropa/Grid.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/Random.h"
 #include "crpropa/massDistribution/Density.h"
 
 
@@ -25,6 +27,20 @@ protected:
 public:
 	virtual void prepareParticle(ParticleState& particle) const {};
 	virtual void prepareCandidate(Candidate& candidate) const;
+	/** Prepare a batch of candidates, by default prepareCandidate for each of them.
+	 Frequently used features draw the random numbers of the batch at once. */
+	virtual void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	/** Probability density of the quantities set by the feature, see EventReweighting.
+	 Continuous quantities have the density of the energy [1/J], the
+	 comoving position [1/m, 1/m^3 in 3D], the direction [1/sr] or the
+	 redshift; a particle type or a fixed value has the probability 1 if the
+	 state has it and 0 otherwise. Features multiplying the candidate weight
+	 with a likelihood ratio give the density of the physical distribution.
+	 By default a std::runtime_error is thrown.
+	 @param source		state of the candidate at the source
+	 @param redshift	redshift at the source
+	 */
+	virtual double getDensity(const ParticleState &source, double redshift) const;
 	std::string getDescription() const;
 };
 
@@ -36,6 +52,12 @@ public:
 class SourceInterface : public Referenced {
 public:
 	virtual ref_ptr<Candidate> getCandidate() const = 0;
+	/** n new candidates, by default n calls of getCandidate */
+	virtual std::vector<ref_ptr<Candidate> > getCandidates(size_t n) const;
+	/** Candidates for the indices of a run, see ModuleList::run.
+	 By default getCandidates(indices.size()), the indices are only used by
+	 sources with random access such as SourceCatalogue. */
+	virtual std::vector<ref_ptr<Candidate> > getCandidates(const std::vector<size_t> &indices) const;
 	virtual std::string getDescription() const = 0;
 };
 
@@ -46,13 +68,18 @@ public:
 
  This class is a container for source features.
  The source prepares a new candidate by passing it to all its source features
- to be modified accordingly.
+ to be modified accordingly. getCandidates passes a batch of candidates to
+ each feature in turn.
  */
 class Source: public SourceInterface {
 	std::vector<ref_ptr<SourceFeature> > features;
 public:
 	void add(SourceFeature* feature);
 	ref_ptr<Candidate> getCandidate() const;
+	std::vector<ref_ptr<Candidate> > getCandidates(size_t n) const;
+	/** Probability density of a source state and redshift, the product of
+	 the densities of the features, see SourceFeature::getDensity */
+	double getDensity(const ParticleState &source, double redshift) const;
 	std::string getDescription() const;
 };
 
@@ -78,6 +105,66 @@ public:
 };
 
 
+/**
+ @class SourceCatalogue
+ @brief Pre-generated primaries read by index from a binary catalogue.
+
+ generate() draws the candidates of any source once and stores the id,
+ energy, position and direction of the source state, the redshift and the
+ weight as fixed size records. Tags and properties are not stored. The
+ catalogue maps the file into memory and creates the candidate of an index
+ without random numbers.
+
+ ModuleList::run passes the index of each candidate in the run, so that the
+ primaries do not depend on the number of threads or the scheduling. With
+ setRange, runs of several jobs cover disjoint ranges of one catalogue, e.g.
+ job k of 10 with setRange(k * n / 10, n / 10) and run(catalogue, n / 10).
+ getCandidate() without index hands out the primaries of the range in turn.
+ */
+class SourceCatalogue: public SourceInterface {
+public:
+	/** Record of one primary in the file */
+	struct Record {
+		double energy;
+		double position[3];
+		double direction[3];
+		double redshift;
+		double weight;
+		int32_t id;
+		int32_t padding;
+	};
+
+	/** Map a catalogue, throws std::runtime_error if the file is not a catalogue */
+	SourceCatalogue(const std::string &filename);
+
+	/** Draw count candidates from a source and write them to a catalogue.
+	 The candidates are drawn in chunks with SourceInterface::getCandidates. */
+	static void generate(SourceInterface *source, size_t count, const std::string &filename, size_t chunkSize = 4096);
+
+	/** Restrict the catalogue to count primaries starting at first */
+	void setRange(size_t first, size_t count);
+	/** Number of primaries in the range */
+	size_t size() const;
+	/** Primary at the index in the range */
+	ref_ptr<Candidate> getCandidate(size_t index) const;
+	/** Next primary of the range, throws std::runtime_error when the range is exhausted */
+	ref_ptr<Candidate> getCandidate() const;
+	std::vector<ref_ptr<Candidate> > getCandidates(size_t n) const;
+	std::vector<ref_ptr<Candidate> > getCandidates(const std::vector<size_t> &indices) const;
+	/** Start getCandidate() without index at the beginning of the range again */
+	void rewind();
+	std::string getDescription() const;
+
+private:
+	std::string filename;
+	ref_ptr<MappedFile> file;
+	const Record *records;
+	size_t nRecords;
+	size_t first, count;
+	mutable size_t next;
+};
+
+
 /**
  @class SourceParticleType
  @brief Particle type at the source
@@ -95,6 +182,7 @@ public:
 	*/
 	SourceParticleType(int id);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -121,6 +209,7 @@ public:
 	 */
 	void add(int id, double weight = 1);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -139,6 +228,7 @@ public:
 	 */
 	SourceEnergy(double energy);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -161,6 +251,42 @@ public:
 	 */
 	SourcePowerLawSpectrum(double Emin, double Emax, double index);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getDensity(const ParticleState &source, double redshift) const;
+	void setDescription();
+};
+
+
+/**
+ @class SourceBiasedPowerLawSpectrum
+ @brief Power-law spectrum sampled from a biasing power law, with importance weights
+
+ The energies are drawn from dN/dE ~ E^biasIndex in [Emin, Emax], e.g. a hard
+ spectrum for the statistics at the highest energies, and the weight of the
+ candidate is multiplied with the likelihood ratio p(E) / q(E) of the physical
+ spectrum dN/dE ~ E^index and the biasing spectrum. Weighted sums of the
+ detected candidates then estimate the results of the physical spectrum.
+ The weights of several biasing features, e.g. with SourceDirectedEmission
+ or SourceBiasedUniform1D, multiply.
+ */
+class SourceBiasedPowerLawSpectrum: public SourceFeature {
+	double Emin;
+	double Emax;
+	double index;
+	double biasIndex;
+	double normRatio; // normalization of the biasing over the physical power law
+public:
+	/** Constructor
+	 @param Emin		minimum energy (in Joules)
+	 @param Emax		maximum energy (in Joules)
+	 @param index		spectral index of the physical power law
+	 @param biasIndex	spectral index of the sampled power law
+	 */
+	SourceBiasedPowerLawSpectrum(double Emin, double Emax, double index, double biasIndex);
+	void prepareCandidate(Candidate &candidate) const;
+	/** Likelihood ratio p(E) / q(E) of the physical and the biasing spectrum */
+	double getWeight(double E) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -170,6 +296,8 @@ public:
  @brief Multiple nuclear species with a rigidity-dependent power-law spectrum
 
  The power law is of the form: E^index, for energies in the interval [Emin, Z * Rmax].
+ The species is drawn in O(1) from an alias table, the energy from the
+ inverse of the power law.
  */
 class SourceComposition: public SourceFeature {
 	double Emin;
@@ -177,6 +305,7 @@ class SourceComposition: public SourceFeature {
 	double index;
 	std::vector<int> nuclei;
 	std::vector<double> cdf;
+	AliasTable alias;	// alias table of cdf, rebuilt in add
 public:
 	/** Constructor
 	 @param Emin		minimum energy (in Joules)
@@ -195,7 +324,11 @@ public:
 	 @param abundance	relative abundance of the particle species
 	 */
 	void add(int A, int Z, double abundance);
+	/** Particle ids of the added species */
+	std::vector<int> getNuclei() const;
 	void prepareParticle(ParticleState &particle) const;
+	void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -217,6 +350,7 @@ public:
 	 */
 	SourcePosition(double d);
 	void prepareParticle(ParticleState &state) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -239,6 +373,7 @@ public:
 	 */
 	void add(Vector3d position, double weight = 1);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -257,6 +392,7 @@ public:
 	 */
 	SourceUniformSphere(Vector3d center, double radius);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -314,6 +450,7 @@ public:
 	 */
 	SourceUniformBox(Vector3d origin, Vector3d size);
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -347,6 +484,9 @@ public:
  The origin of the distribution is the Galactic center. The default maximum radius is set 
  to rMax=20 kpc and the default maximum height is zMax = 5 kpc.
  See G. Case and D. Bhattacharya (1996) for the details of the distribution.
+ The radius is drawn from a table of the inverse cumulative distribution,
+ rebuilt when a parameter changes, and the height from the inverse of the
+ truncated exponential distribution, without rejection.
  */
 class SourceSNRDistribution: public SourceFeature {
 	double rEarth; // parameter given by observation
@@ -358,7 +498,11 @@ class SourceSNRDistribution: public SourceFeature {
 	double rMax; // maximum radial distance - default 20 kpc 
 		      // (due to the extension of the JF12 field)
 	double zMax; // maximum distance from galactic plane - default 5 kpc
+	std::vector<double> tabR; // tabulated radii for sampling
+	std::vector<double> tabFr; // fr at the tabulated radii
+	AliasTable tabAlias; // alias table of the radial bins
 	void setFrMax(); // calculate frMax with the current parameter. 
+	void initSampling(); // tabulate fr with the current parameters
 
 public:
 	/** Default constructor. 
@@ -430,6 +574,8 @@ public:
  The pulsar distribution is explained in detail in C.-A. Faucher-Giguere
  and V. M. Kaspi, ApJ 643 (May, 2006) 332. The radial distribution is 
  parametrized as in Blasi and Amato, JCAP 1 (Jan., 2012) 10.
+ As for SourceSNRDistribution, the radius and height are drawn from inverse
+ cumulative distributions without rejection.
  */
 class SourcePulsarDistribution: public SourceFeature {
 	double rEarth; // parameter given by observation
@@ -441,6 +587,10 @@ class SourcePulsarDistribution: public SourceFeature {
 	double zMax; // maximum distance from galactic plane - default 5 kpc
 	double rBlur; // relative smearing factor for the radius
 	double thetaBlur; // smearing factor for the angle. Unit = [1/length]
+	std::vector<double> tabR; // tabulated radii for sampling
+	std::vector<double> tabFr; // fr at the tabulated radii
+	AliasTable tabAlias; // alias table of the radial bins
+	void initSampling(); // tabulate fr with the current parameters
 public:
 	/** Default constructor. 
 	 Default parameters are:
@@ -517,6 +667,36 @@ public:
 	 */
 	SourceUniform1D(double minD, double maxD, bool withCosmology = true);
 	void prepareParticle(ParticleState& particle) const;
+	void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getDensity(const ParticleState &source, double redshift) const;
+	void setDescription();
+};
+
+
+/**
+ @class SourceBiasedUniform1D
+ @brief Uniform source distribution in 1D, sampled from a biasing power law in distance
+
+ As SourceUniform1D, but the light-travel distance is drawn from p(D) ~ D^biasIndex,
+ e.g. with biasIndex < 0 to favour nearby sources, and the weight of the candidate
+ is multiplied with the likelihood ratio of the uniform and the biasing distribution.
+ */
+class SourceBiasedUniform1D: public SourceFeature {
+	double minD; // minimum light-travel distance
+	double maxD; // maximum light-travel distance
+	double biasIndex;
+	bool withCosmology;
+	double normRatio; // normalization of the biasing over the uniform distribution
+public:
+	/** Constructor
+	 @param minD			minimum distance; comoving if withCosmology is True
+	 @param maxD 			maximum distance; comoving if withCosmology is True
+	 @param biasIndex		index of the sampled power law in the light-travel distance
+	 @param withCosmology	whether to account for cosmological effects (expansion of the Universe)
+	 */
+	SourceBiasedUniform1D(double minD, double maxD, double biasIndex, bool withCosmology = true);
+	void prepareCandidate(Candidate &candidate) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -524,9 +704,16 @@ public:
 /**
  @class SourceDensityGrid
  @brief Random source positions from a density grid
+
+ The grid is left unchanged. The cells are grouped into blocks of 256
+ consecutive cells in storage order, a block is drawn in O(1) from an alias
+ table of the block sums and the cell by summing up the densities within the
+ block, which are contiguous in memory.
  */
 class SourceDensityGrid: public SourceFeature {
 	ref_ptr<Grid1f> grid;
+	std::vector<double> blockSum;	// density summed per block
+	AliasTable blockAlias;	// alias table of the blocks
 public:
 	/** Constructor
 	 @param densityGrid 	3D grid containing the density of sources in each cell
@@ -543,6 +730,7 @@ public:
  */
 class SourceDensityGrid1D: public SourceFeature {
 	ref_ptr<Grid1f> grid;	// 1D grid with Ny = Nz = 1
+	AliasTable alias;	// alias table of the cells, the grid is left unchanged
 public:
 	/** Constructor
 	 @param densityGrid 	1D grid containing the density of sources in each cell, Ny and Nz must be 1
@@ -563,6 +751,8 @@ public:
 	 */
 	SourceIsotropicEmission();
 	void prepareParticle(ParticleState &particle) const;
+	void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -575,9 +765,9 @@ public:
  with mean direction mu and concentration parameter kappa.
  The sampling from the vMF distribution follows this document by Julian Straub:
  http://people.csail.mit.edu/jstraub/download/straub2017vonMisesFisherInference.pdf
- The emitted particles are assigned a weight so that the detected particles can be
- reweighted to an isotropic emission distribution instead of a vMF distribution.
- For details, see PoS (ICRC2019) 447.
+ The weight of the emitted particles is multiplied with the likelihood ratio, so that
+ the detected particles can be reweighted to an isotropic emission distribution
+ instead of a vMF distribution. For details, see PoS (ICRC2019) 447.
  */
 class SourceDirectedEmission: public SourceFeature {
 	Vector3d mu; // Mean emission direction in the vMF distribution
@@ -629,6 +819,7 @@ public:
 	 */
 	SourceDirection(Vector3d direction = Vector3d(-1, 0, 0));
 	void prepareParticle(ParticleState &particle) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -639,16 +830,24 @@ public:
 
 	This feature does not change the direction of the candidate. Therefore a usefull direction feature (isotropic or directed emission)
 	must be added to the sources before. The propability of the emission map is not taken into account. 
+
+	With drawDirection the direction is instead drawn from the map of the
+	particle and energy, and the candidate is weighted with the ratio of the
+	isotropic and the map probability. Candidates without a map are deactivated.
+	Freeze the emission map before (EmissionMap::freeze) to draw in constant time.
  */
 class SourceEmissionMap: public SourceFeature {
 	ref_ptr<EmissionMap> emissionMap;
+	bool drawDirection;
 public:
 	/** Constructor
 	 @param emissionMap		emission map containing probabilities of emission in various directions
+	 @param drawDirection	draw the direction from the map instead of checking it
 	 */
-	SourceEmissionMap(EmissionMap *emissionMap);
+	SourceEmissionMap(EmissionMap *emissionMap, bool drawDirection = false);
 	void prepareCandidate(Candidate &candidate) const;
 	void setEmissionMap(EmissionMap *emissionMap);
+	void setDrawDirection(bool drawDirection);
 	void setDescription();
 };
 
@@ -696,6 +895,7 @@ public:
 	 */
 	SourceRedshift(double z);
 	void prepareCandidate(Candidate &candidate) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -723,6 +923,7 @@ public:
 	 */
 	SourceUniformRedshift(double zmin, double zmax);
 	void prepareCandidate(Candidate &candidate) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -751,6 +952,7 @@ public:
 	 */
 	SourceRedshiftEvolution(double m, double zmin, double zmax);
 	void prepareCandidate(Candidate &candidate) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 };
 
 
@@ -769,6 +971,8 @@ public:
 	 */
 	SourceRedshift1D();
 	void prepareCandidate(Candidate &candidate) const;
+	void prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 };
 
@@ -785,6 +989,8 @@ public:
  This property only works if muparser is available.
  For details about the library see:
  	https://beltoforion.de/en/muparser/
+ The nucleus and the energy bin are drawn together in O(1) from an alias
+ table over all pairs, rebuilt in add, and the energy uniformly within the bin.
  */
 class SourceGenericComposition: public SourceFeature {
 public:
@@ -820,6 +1026,17 @@ public:
 		}
 		return 0;
 	}
+	/** Edges of the energy bins of the nucleus cdfs */
+	const std::vector<double> &getEnergies() const {
+		return energy;
+	}
+	const std::vector<Nucleus> &getNuclei() const {
+		return nuclei;
+	}
+	/** Cumulative sum of the abundance times the integrated spectrum of the nuclei */
+	const std::vector<double> &getCDF() const {
+		return cdf;
+	}
 
 protected:
 	double Emin, Emax;
@@ -829,6 +1046,7 @@ protected:
 
 	std::vector<Nucleus> nuclei;
 	std::vector<double> cdf;
+	AliasTable alias;	// joint alias table of (nucleus, energy bin)
 
 };
 #endif
@@ -848,6 +1066,7 @@ private:
 public:
 	SourceTag(std::string tag);
 	void prepareCandidate(Candidate &candidate) const;
+	double getDensity(const ParticleState &source, double redshift) const;
 	void setDescription();
 	void setTag(std::string tag);
 };
@@ -860,6 +1079,11 @@ public:
 	If a weighting for different components is desired, the use of different densities in a densityList is recommended.
 
 	The sampling range of the position can be restricted. Default is a sampling for x in [-20, 20] * kpc, y in [-20, 20] * kpc and z in [-4, 4] * kpc.
+
+	By default the positions are rejection-sampled against the maximal density in the whole range. For peaked
+	distributions setSamplingGrid divides the range into cells, which are drawn with the maximal density at their
+	corners and center as weight, and the position is rejection-sampled within the cell against this local maximum.
+	Peaks narrower than a cell are underestimated.
 */
 class SourceMassDistribution: public SourceFeature {
 private: 
@@ -869,6 +1093,10 @@ private:
 	double yMin, yMax; 			//< y-range to sample positions
 	double zMin, zMax;			//< z-range to sample positions
 	int maxTries = 10000;		//< maximal number of tries to sample the position 
+	int nx = 0, ny = 0, nz = 0;	//< number of cells of the sampling grid, 0: no grid
+	std::vector<double> cellMax;	//< maximal density per cell
+	AliasTable cellAlias;		//< alias table of the cells weighted with cellMax
+	void initGrid();
 
 public: 
 	/** Constructor
@@ -916,6 +1144,11 @@ public:
 	*/
 	void setMaximalTries(int tries);
 
+	/** Sample the positions in cells of a grid over the sampling range, built once.
+		@param nx, ny, nz: number of cells in x, y and z, 0 to sample in the whole range
+	*/
+	void setSamplingGrid(int nx, int ny, int nz);
+
 	std::string getDescription();
 };
 
@@ -0,0 +1,41 @@
+#ifndef CRPROPA_SYMBOLTABLE_H
+#define CRPROPA_SYMBOLTABLE_H
+
+#include <string>
+#include <cstddef>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** Handle of an interned string, see SymbolTable */
+typedef int Symbol;
+
+/**
+ @class SymbolTable
+ @brief Global table of interned strings.
+
+ Candidate tags and property names are stored as small integer handles
+ (Symbol) instead of strings, which makes copying them free and comparing them
+ a single integer comparison. The handle of a string does not change during the
+ lifetime of the process. Looking up the string of a handle does not require
+ locking, and the handles of already known strings are cached per thread.
+ */
+class SymbolTable {
+public:
+	/** Get the handle of a string, the string is added to the table if necessary */
+	static Symbol intern(const std::string &name);
+	/** Get the handle of a string without adding it, -1 if it is not in the table */
+	static Symbol find(const std::string &name);
+	/** Get the string of a handle */
+	static const std::string &name(Symbol symbol);
+	/** Number of interned strings */
+	static size_t size();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_SYMBOLTABLE_H
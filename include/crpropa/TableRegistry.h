@@ -0,0 +1,226 @@
+#ifndef CRPROPA_TABLEREGISTRY_H
+#define CRPROPA_TABLEREGISTRY_H
+
+#include "crpropa/Referenced.h"
+#include "crpropa/MemoryUsage.h"
+#include "crpropa/Random.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class TableRegistry
+ @brief Process-wide registry of shared interaction tables.
+
+ Interaction modules load their tables through the registry, keyed by the
+ kind of table and the file name. Identical modules, e.g. in several
+ ModuleLists of a parameter scan, then share one immutable copy of each
+ table instead of parsing and storing it again. A table is released when
+ no module uses it anymore, at the next loading of a table or with clear().
+ */
+class TableRegistry {
+	static ref_ptr<Referenced> find(const std::string &key);
+	// registers the table, returns the table registered first in case of a race
+	static ref_ptr<Referenced> insert(const std::string &key, Referenced *table);
+public:
+	/** Shared table of type T for the key, new T(filename) if not registered.
+	 The tables must not be modified after loading. */
+	template<class T>
+	static ref_ptr<T> get(const std::string &kind, const std::string &filename) {
+		std::string key = kind + ":" + filename;
+		if (!getEnabled())
+			return new T(filename);
+		ref_ptr<Referenced> table = find(key);
+		if (!table.valid())
+			table = insert(key, new T(filename));
+		return static_cast<T *>(table.get());
+	}
+	/** Shared table of type T for the key and an option of the table,
+	 new T(filename, option) if not registered */
+	template<class T, class Option>
+	static ref_ptr<T> get(const std::string &kind, const std::string &filename, const Option &option) {
+		std::ostringstream key;
+		key.precision(17);
+		key << kind << "(" << option << "):" << filename;
+		if (!getEnabled())
+			return new T(filename, option);
+		ref_ptr<Referenced> table = find(key.str());
+		if (!table.valid())
+			table = insert(key.str(), new T(filename, option));
+		return static_cast<T *>(table.get());
+	}
+	/** Register a table that is not loaded from the file, e.g. computed by a
+	 plugin, under the key of get(kind, filename). Later calls of get return
+	 it, so it must have the type T the users of the kind request.
+	 @returns	the registered table, the earlier one if the key is taken */
+	template<class T>
+	static ref_ptr<T> add(const std::string &kind, const std::string &filename, T *table) {
+		ref_ptr<T> ref = table;
+		if (!getEnabled())
+			return ref;
+		return static_cast<T *>(insert(kind + ":" + filename, table).get());
+	}
+
+	/** Number of registered tables */
+	static size_t size();
+	/** Release all tables, the modules keep the tables they hold */
+	static void clear();
+	/** Share the tables (default true), otherwise every module loads its own */
+	static void setEnabled(bool enabled);
+	static bool getEnabled();
+};
+
+/**
+ @class CompactTable
+ @brief Piecewise linear function with single precision nodes in one contiguous array.
+
+ The nodes are optionally resampled: nodes that the linear interpolation
+ between the remaining neighbours reproduces within a relative tolerance are
+ removed, so that the interpolation of the compact table deviates from the
+ interpolation of the full table by at most the tolerance at each original
+ node (plus the float rounding of about 1e-7). The values are stored relative
+ to their maximum, which keeps small rates above the float range limits. For
+ equidistant nodes the interpolation takes O(1), otherwise a binary search.
+ */
+class CompactTable {
+	struct Node {
+		float x, y;
+	};
+	std::vector<Node> nodes;
+	double xmin, xmax, xscale, yscale;
+	double dx; ///< spacing of equidistant nodes, 0 otherwise
+public:
+	CompactTable();
+	/** Table of the nodes (x, y), x increasing
+	 @param tolerance	maximum relative deviation at the removed nodes, 0 keeps all nodes
+	 */
+	CompactTable(const std::vector<double> &x, const std::vector<double> &y, double tolerance = 0);
+	/** Linear interpolation, y of the first / last node outside of the range */
+	double interpolate(double x) const;
+	double getMinX() const;
+	double getMaxX() const;
+	double getX(size_t i) const;
+	double getY(size_t i) const;
+	/** Number of nodes */
+	size_t size() const;
+	/** Size of the nodes in bytes */
+	size_t getMemory() const;
+};
+
+/**
+ @class AdaptiveTable
+ @brief Piecewise linear function on segments of equidistant single precision nodes.
+
+ The range of the nodes (x, y) is split into segments with their own
+ equidistant spacing, so flat regions get a few nodes and resonances the
+ spacing of the table. Each segment is extended as long as one spacing with
+ at most as many nodes as the table has in the segment reproduces the
+ skipped nodes within the relative tolerance. As both interpolations are
+ linear between their nodes, the adaptive table deviates from the full table
+ by at most the tolerance at the nodes of the table and in between by at most
+ the deviation at the neighbouring nodes (plus the float rounding of about
+ 1e-7). A uniform directory of the segments and the equidistant nodes within
+ a segment make the interpolation O(1).
+ */
+class AdaptiveTable {
+	struct Segment {
+		double x0;
+		double scale; ///< intervals per unit of x
+		uint32_t offset; ///< of the first value of the segment
+		uint32_t intervals;
+	};
+	std::vector<Segment> segments;
+	std::vector<float> values; ///< relative to yscale
+	std::vector<uint32_t> directory; ///< segment at the start of each cell
+	double xmin, xmax, yscale, cellScale;
+public:
+	AdaptiveTable();
+	/** Table of the nodes (x, y), x strictly increasing
+	 @param tolerance	maximum relative deviation at the nodes, 0 reproduces all nodes
+	 */
+	AdaptiveTable(const std::vector<double> &x, const std::vector<double> &y, double tolerance = 0);
+	/** Linear interpolation, y of the first / last node outside of the range */
+	double interpolate(double x) const;
+	double getMinX() const;
+	double getMaxX() const;
+	/** Number of nodes of all segments */
+	size_t size() const;
+	size_t getNumberOfSegments() const;
+	/** Size of the segments, nodes and directory in bytes */
+	size_t getMemory() const;
+};
+
+/**
+ @class RateTable
+ @brief Interaction rate 1/lambda(E) of the CRPropa3-data files,
+ rows of log10(E/eV) and the rate in [1/Mpc].
+
+ A compact table holds the rates in a CompactTable instead of energy and
+ rate, optionally resampled within a relative tolerance.
+ */
+class RateTable: public Referenced {
+	MemoryAccount memory;
+	CompactTable compact;
+public:
+	std::vector<double> energy; ///< energy in [J], empty for a compact table
+	std::vector<double> rate; ///< interaction rate in [1/m], empty for a compact table
+	/** Load a table, throws std::runtime_error if the file cannot be read
+	 @param tolerance	negative: double precision table, otherwise compact table
+	 					resampled within the relative tolerance (0: all nodes)
+	 */
+	RateTable(const std::string &filename, double tolerance = -1);
+	/** Shared table of the file, see TableRegistry */
+	static ref_ptr<RateTable> load(const std::string &filename, double tolerance = -1);
+
+	bool isCompact() const;
+	/** Interpolated rate [1/m], the rate at the first / last energy outside of the range */
+	double getRate(double E) const;
+	double getMinEnergy() const;
+	double getMaxEnergy() const;
+};
+
+/**
+ @class CumulativeRateTable
+ @brief Cumulative differential interaction rate CDF(s_kin, E) of the
+ CRPropa3-data files, with alias tables for sampling s_kin.
+
+ The first row holds log10(s_kin/eV^2) after a leading value, the following
+ rows log10(E/eV) and the cumulative rates at s_kin in [1/Mpc].
+
+ A compact table drops the cdf and holds the alias tables of all energies in
+ two contiguous arrays, with single precision probabilities. The s_kin nodes
+ are the sampled bins and are not resampled.
+ */
+class CumulativeRateTable: public Referenced {
+	MemoryAccount memory;
+	std::vector<float> compactProbability; ///< alias tables of a compact table, s.size() per energy
+	std::vector<uint32_t> compactAlias;
+public:
+	std::vector<double> energy; ///< energy in [J]
+	std::vector<double> s; ///< s_kin = s - m^2 in [J**2]
+	std::vector<std::vector<double> > cdf; ///< cumulative interaction rate in [1/m], empty for a compact table
+	std::vector<AliasTable> alias; ///< alias tables of cdf for sampling, empty for a compact table
+	/** Load a table, throws std::runtime_error if the file cannot be read or has missing values */
+	CumulativeRateTable(const std::string &filename, bool compact = false);
+	/** Shared table of the file, see TableRegistry */
+	static ref_ptr<CumulativeRateTable> load(const std::string &filename, bool compact = false);
+
+	bool isCompact() const;
+	/** Index of the tabulated energy closest to E */
+	size_t getEnergyIndex(double E) const;
+	/** Bin of s for the energy index i and a uniform random number u in [0, 1),
+	 same as alias[i].sample(u) */
+	size_t sample(size_t i, double u) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_TABLEREGISTRY_H
@@ -0,0 +1,91 @@
+#ifndef CRPROPA_THINNINGPOLICY_H
+#define CRPROPA_THINNINGPOLICY_H
+
+#include "crpropa/Referenced.h"
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ThinningPolicy
+ @brief Importance thinning and energy cut of the secondaries of all interaction modules.
+
+ When a policy is set with Candidate::setThinningPolicy, every secondary
+ created with Candidate::addSecondary(id, energy, ...) is kept with the
+ probability
+   p = min(1, (E / (fraction * E_parent))^alpha)
+ and its weight is multiplied by 1 / p, so that the expected weighted
+ number and energy of the secondaries do not change.
+ E_parent is the energy of the parent when the secondary is added.
+ For alpha = 1 this is the thinning of Hillas relative to the parent
+ energy. For fraction = 1 it is the thinning of the EM interactions,
+ keeping a secondary of the energy fraction f with probability f^alpha.
+ Secondaries above maxEnergy (if > 0) are never thinned.
+ The parameters are set per species and apply to antiparticles alike.
+ Species without their own parameters use the default, which is no
+ thinning (alpha = 0).
+
+ Secondaries below the minimum energy of their species, e.g. the threshold
+ of a later MinimumEnergy condition, are not created at all. Their energy
+ times their weight is added to a tally of discarded energy instead.
+ */
+class ThinningPolicy: public Referenced {
+	struct Rule {
+		int id; // absolute value of the particle id, 0 for the default
+		double alpha;
+		double fraction;
+		double maxEnergy;
+	};
+	std::vector<Rule> rules; // default first
+	struct Cut {
+		int id; // absolute value of the particle id
+		double minEnergy;
+	};
+	std::vector<Cut> cuts;
+	double defaultMinEnergy;
+	mutable std::atomic<double> discardedEnergy;
+	mutable std::atomic<uint64_t> discardedNumber;
+	const Rule &rule(int id) const;
+	void checkParameters(double alpha, double fraction, double maxEnergy) const;
+public:
+	/** Constructor
+	 @param alpha	thinning exponent of species without own parameters
+	 */
+	ThinningPolicy(double alpha = 0);
+	/** Parameters of species without own parameters
+	 @param alpha		thinning exponent, 0 for no thinning
+	 @param fraction	fraction of the parent energy above which secondaries are kept
+	 @param maxEnergy	energy above which secondaries are kept [J], 0 for no limit
+	 */
+	void setDefault(double alpha, double fraction = 1, double maxEnergy = 0);
+	/** Parameters of the species id (and its antiparticle), see setDefault */
+	void set(int id, double alpha, double fraction = 1, double maxEnergy = 0);
+
+	/** Probability to keep a secondary of the species id and energy E */
+	double getSurvivalProbability(int id, double E, double parentEnergy) const;
+
+	/** Minimum energy of the secondaries of species without own cut [J], 0 (default) for none */
+	void setMinimumEnergy(double minEnergy);
+	/** Minimum energy of the secondaries of species id (and its antiparticle) [J] */
+	void setMinimumEnergy(int id, double minEnergy);
+	double getMinimumEnergy(int id) const;
+	/** Add a discarded secondary of energy E [J] and weight w to the tally */
+	void discard(double E, double w) const;
+	/** Weighted energy of the discarded secondaries [J] */
+	double getDiscardedEnergy() const;
+	/** Number of discarded secondaries */
+	uint64_t getDiscardedNumber() const;
+	void clearDiscarded();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_THINNINGPOLICY_H
@@ -0,0 +1,134 @@
+#ifndef CRPROPA_TRACE_H
+#define CRPROPA_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class Tracer
+ @brief Timeline of the events of all threads, exported as Chrome trace.
+
+ Every thread records its events in its own buffer, no locks are taken while
+ tracing. The names and categories of the events have to be string literals
+ or otherwise outlive the tracer, e.g. the type names of the modules. When
+ the tracer is disabled, an event costs one relaxed atomic load. The timeline
+ is written as Chrome trace JSON, which can be opened in chrome://tracing or
+ in the Perfetto UI (ui.perfetto.dev). Usually enabled with
+ ModuleList::setTracing.
+ */
+class Tracer {
+public:
+	struct Event {
+		const char *name;
+		const char *category;
+		double start; ///< [us] since the reset of the tracer
+		double duration; ///< [us], negative for instant events
+		int64_t argument; ///< e.g. the serial number of a candidate, -1 for none
+	};
+
+private:
+	struct ThreadBuffer {
+		std::vector<Event> events;
+		size_t thread; ///< index in the timeline
+		size_t dropped; ///< events not recorded as the buffer was full
+		uint64_t steps; ///< counter of the sampled module spans
+	};
+
+	static std::atomic<bool> active;
+	std::chrono::steady_clock::time_point epoch;
+	size_t capacity;
+	size_t sampling;
+	mutable std::mutex mutex; ///< protects the list of buffers
+	std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+
+	Tracer();
+	ThreadBuffer &getBuffer();
+
+public:
+	static Tracer &instance();
+
+	/** Fast check whether events are recorded */
+	static bool enabled() {
+		return active.load(std::memory_order_relaxed);
+	}
+
+	void setEnabled(bool enable = true);
+	/** Record the module spans of every n-th step of each thread */
+	void setSampling(size_t n);
+	size_t getSampling() const;
+	/** Maximum number of events per thread, later events are dropped */
+	void setCapacity(size_t events);
+	size_t getCapacity() const;
+	/** Remove all events and restart the time; not while threads trace */
+	void clear();
+
+	/** Time since the reset of the tracer [us] */
+	double now() const;
+	/** Record an event of the calling thread */
+	void record(const char *name, const char *category, double start, double duration, int64_t argument = -1);
+	void instant(const char *name, const char *category, int64_t argument = -1);
+	/** Whether the module spans of the current step of the calling thread are recorded */
+	bool sampleStep();
+
+	size_t getNumberOfEvents() const;
+	size_t getNumberOfDroppedEvents() const;
+	/** Events of all threads, in the order of the threads */
+	std::vector<Event> getEvents() const;
+	std::string getChromeTraceJSON() const;
+	void writeChromeTrace(const std::string &filename) const;
+};
+
+/**
+ @class TraceSpan
+ @brief Records the lifetime of the object as a span of the calling thread
+ */
+class TraceSpan {
+	const char *name, *category;
+	int64_t argument;
+	double start;
+public:
+	TraceSpan(const char *name, const char *category, int64_t argument = -1) :
+			name(name), category(category), argument(argument), start(-1) {
+		if (Tracer::enabled())
+			start = Tracer::instance().now();
+	}
+	~TraceSpan() {
+		if (start >= 0)
+			Tracer::instance().record(name, category, start, Tracer::instance().now() - start, argument);
+	}
+};
+
+/**
+ @class TraceWait
+ @brief Records the time until acquired() is called, e.g. on entering a critical section
+ */
+class TraceWait {
+	const char *name;
+	double start;
+public:
+	TraceWait(const char *name) : name(name), start(-1) {
+		if (Tracer::enabled())
+			start = Tracer::instance().now();
+	}
+	void acquired() {
+		if (start >= 0)
+			Tracer::instance().record(name, "wait", start, Tracer::instance().now() - start);
+		start = -1;
+	}
+};
+/** @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_TRACE_H
@@ -0,0 +1,192 @@
+#ifndef CRPROPA_TRICUBICGRID_H
+#define CRPROPA_TRICUBICGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class TricubicGrid
+ @brief Tricubic interpolation of a grid from precomputed polynomial coefficients.
+
+ For every cell between grid points the 64 coefficients of the tricubic
+ Catmull-Rom polynomial are computed once from the 4x4x4 neighbouring values.
+ A lookup then reads the coefficients of a single cell, which lie next to each
+ other in memory, and evaluates the polynomial, instead of gathering 64 values
+ and doing 21 cubic interpolations. The values are the same as from
+ Grid::interpolate with TRICUBIC up to rounding, for periodic and reflective
+ repetition and with volume clipping.
+
+ The coefficients take 64 times the memory of the grid values (one more cell
+ per axis for reflective grids). The grid properties and values are copied
+ on construction, later changes of the grid are not seen.
+ */
+template<typename T>
+class TricubicGrid: public Referenced {
+public:
+	typedef typename Grid<T>::Value Value;
+
+private:
+	std::vector<Value> coefficients; // 64 per cell, x^i y^j z^k at (i * 4 + j) * 4 + k
+	size_t Nx, Ny, Nz; /**< Number of grid points */
+	size_t cellsY, cellsZ; /**< Number of stored cells in y- and z-direction */
+	int first; /**< Index of the first stored cell, -1 for reflective grids */
+	Vector3d origin, gridOrigin, spacing;
+	bool reflective, clipVolume;
+
+	/** Cell and position within the cell along one axis */
+	void locate(double x, size_t n, int &cell, double &f) const {
+		if (reflective) {
+			while ((x < -0.5) or (x > (n - 0.5)))
+				x = 2 * n * (x > (n - 0.5)) - x - 1;
+		} else {
+			x = fmod(x, double(n));
+			if (x < 0)
+				x += n;
+		}
+		cell = floor(x);
+		f = x - cell;
+		// the folded position can round onto the upper edge
+		if (cell >= int(n)) {
+			cell = n - 1;
+			f = 1;
+		}
+	}
+
+	/** Coefficients of one cell from the grid values around it */
+	void computeCell(const Grid<T> &grid, int ix, int iy, int iz, Value *c) const {
+		// Catmull-Rom coefficients of the powers 0 to 3 from the values p0 to p3
+		static const double M[4][4] = {{0, 1, 0, 0}, {-0.5, 0, 0.5, 0},
+				{1, -2.5, 2, -0.5}, {-0.5, 1.5, -1.5, 0.5}};
+		Value p[64], q[64];
+		for (int a = 0; a < 4; a++)
+			for (int b = 0; b < 4; b++)
+				for (int d = 0; d < 4; d++)
+					p[(a * 4 + b) * 4 + d] = value(grid, ix + a - 1, iy + b - 1, iz + d - 1);
+
+		// transform along z, y and x in turn
+		for (int a = 0; a < 16; a++)
+			for (int k = 0; k < 4; k++) {
+				Value s(0.);
+				for (int d = 0; d < 4; d++)
+					s += p[a * 4 + d] * M[k][d];
+				q[a * 4 + k] = s;
+			}
+		for (int a = 0; a < 4; a++)
+			for (int j = 0; j < 4; j++)
+				for (int k = 0; k < 4; k++) {
+					Value s(0.);
+					for (int b = 0; b < 4; b++)
+						s += q[(a * 4 + b) * 4 + k] * M[j][b];
+					p[(a * 4 + j) * 4 + k] = s;
+				}
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 16; j++) {
+				Value s(0.);
+				for (int a = 0; a < 4; a++)
+					s += p[a * 16 + j] * M[i][a];
+				c[i * 16 + j] = s;
+			}
+	}
+
+	Value value(const Grid<T> &grid, int ix, int iy, int iz) const {
+		if (reflective) {
+			ix = reflectiveBoundary(ix, Nx);
+			iy = reflectiveBoundary(iy, Ny);
+			iz = reflectiveBoundary(iz, Nz);
+		} else {
+			ix = periodicBoundary(ix, Nx);
+			iy = periodicBoundary(iy, Ny);
+			iz = periodicBoundary(iz, Nz);
+		}
+		return GridTraits<T>::decode(grid.get(ix, iy, iz), grid.getStorageScale());
+	}
+
+public:
+	/** Constructor
+	 @param grid	grid to interpolate, its repetition and volume clipping are used
+	 */
+	TricubicGrid(ref_ptr<Grid<T> > grid) :
+			Nx(grid->getNx()), Ny(grid->getNy()), Nz(grid->getNz()),
+			origin(grid->getOrigin()), spacing(grid->getSpacing()),
+			reflective(grid->isReflective()), clipVolume(grid->getClipVolume()) {
+		gridOrigin = origin + spacing / 2;
+		// reflective grids need the cell from -1 to 0 below the first grid point
+		first = reflective ? -1 : 0;
+		size_t cellsX = Nx - first;
+		cellsY = Ny - first;
+		cellsZ = Nz - first;
+		coefficients.resize(cellsX * cellsY * cellsZ * 64);
+
+		const Grid<T> &g = *grid;
+#pragma omp parallel for
+		for (int ix = 0; ix < (int)cellsX; ix++)
+			for (size_t iy = 0; iy < cellsY; iy++)
+				for (size_t iz = 0; iz < cellsZ; iz++)
+					computeCell(g, ix + first, iy + first, iz + first,
+							&coefficients[((ix * cellsY + iy) * cellsZ + iz) * 64]);
+	}
+
+	/** Interpolate the grid tricubic at a given position */
+	Value interpolate(const Vector3d &position) const {
+		if (clipVolume) {
+			Vector3d edge = origin + Vector3d(Nx, Ny, Nz) * spacing;
+			bool isInVolume = (position.x >= origin.x) && (position.x <= edge.x);
+			isInVolume &= (position.y >= origin.y) && (position.y <= edge.y);
+			isInVolume &= (position.z >= origin.z) && (position.z <= edge.z);
+			if (!isInVolume)
+				return Value(0.);
+		}
+
+		Vector3d r = (position - gridOrigin) / spacing;
+		int ix, iy, iz;
+		double fX, fY, fZ;
+		locate(r.x, Nx, ix, fX);
+		locate(r.y, Ny, iy, fY);
+		locate(r.z, Nz, iz, fZ);
+		const Value *c = &coefficients[(((ix - first) * cellsY + iy - first) * cellsZ + iz - first) * 64];
+
+		// Horner scheme in z, y and x
+		Value b(0.);
+		for (int i = 3; i >= 0; i--) {
+			Value by(0.);
+			for (int j = 3; j >= 0; j--) {
+				const Value *cz = c + (i * 4 + j) * 4;
+				by = by * fY + (((cz[3] * fZ + cz[2]) * fZ + cz[1]) * fZ + cz[0]);
+			}
+			b = b * fX + by;
+		}
+		return b;
+	}
+
+	size_t getNx() const {
+		return Nx;
+	}
+
+	size_t getNy() const {
+		return Ny;
+	}
+
+	size_t getNz() const {
+		return Nz;
+	}
+
+	/** Size of the coefficients in bytes */
+	size_t getSizeOf() const {
+		return sizeof(*this) + coefficients.size() * sizeof(Value);
+	}
+};
+
+typedef TricubicGrid<float> TricubicGrid1f;
+typedef TricubicGrid<Vector3f> TricubicGrid3f;
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_TRICUBICGRID_H
@@ -0,0 +1,231 @@
+#ifndef CRPROPA_VECTOR3SIMD_H
+#define CRPROPA_VECTOR3SIMD_H
+
+#include "crpropa/Vector3.h"
+
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class Vector3dSimd
+ @brief 3-vector of doubles padded to four aligned lanes for the arithmetic of the propagators.
+
+ The components are held in registers: one 256 bit register with AVX2,
+ two 128 bit registers (x, y and z, 0) with SSE2 and four doubles otherwise.
+ The operations are performed in the same order as those of Vector3d, e.g.
+ the sum of the dot product is (x + y) + z, so the results are identical
+ unless the compiler contracts the products of one of them to fused
+ multiply-adds. The conversions from and to Vector3d are a load and a store
+ of the three components.
+
+ Intended for local variables of the kernels, not for containers.
+ */
+class Vector3dSimd {
+public:
+	Vector3dSimd() {
+#if defined(__AVX2__)
+		v = _mm256_setzero_pd();
+#elif defined(__SSE2__)
+		lo = _mm_setzero_pd();
+		hi = _mm_setzero_pd();
+#else
+		d[0] = d[1] = d[2] = d[3] = 0;
+#endif
+	}
+
+	Vector3dSimd(const Vector3d &a) {
+#if defined(__AVX2__)
+		v = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(a.data)),
+				_mm_load_sd(a.data + 2), 1);
+#elif defined(__SSE2__)
+		lo = _mm_loadu_pd(a.data);
+		hi = _mm_load_sd(a.data + 2);
+#else
+		d[0] = a.x;
+		d[1] = a.y;
+		d[2] = a.z;
+		d[3] = 0;
+#endif
+	}
+
+	Vector3dSimd(double x, double y, double z) {
+#if defined(__AVX2__)
+		v = _mm256_set_pd(0, z, y, x);
+#elif defined(__SSE2__)
+		lo = _mm_set_pd(y, x);
+		hi = _mm_set_sd(z);
+#else
+		d[0] = x;
+		d[1] = y;
+		d[2] = z;
+		d[3] = 0;
+#endif
+	}
+
+	operator Vector3d() const {
+		Vector3d a;
+#if defined(__AVX2__)
+		_mm_storeu_pd(a.data, _mm256_castpd256_pd128(v));
+		_mm_store_sd(a.data + 2, _mm256_extractf128_pd(v, 1));
+#elif defined(__SSE2__)
+		_mm_storeu_pd(a.data, lo);
+		_mm_store_sd(a.data + 2, hi);
+#else
+		a.x = d[0];
+		a.y = d[1];
+		a.z = d[2];
+#endif
+		return a;
+	}
+
+	double getX() const {
+		return Vector3d(*this).x;
+	}
+
+	double getY() const {
+		return Vector3d(*this).y;
+	}
+
+	double getZ() const {
+		return Vector3d(*this).z;
+	}
+
+	Vector3dSimd operator +(const Vector3dSimd &a) const {
+#if defined(__AVX2__)
+		return Vector3dSimd(_mm256_add_pd(v, a.v));
+#elif defined(__SSE2__)
+		return Vector3dSimd(_mm_add_pd(lo, a.lo), _mm_add_pd(hi, a.hi));
+#else
+		return Vector3dSimd(d[0] + a.d[0], d[1] + a.d[1], d[2] + a.d[2]);
+#endif
+	}
+
+	Vector3dSimd operator -(const Vector3dSimd &a) const {
+#if defined(__AVX2__)
+		return Vector3dSimd(_mm256_sub_pd(v, a.v));
+#elif defined(__SSE2__)
+		return Vector3dSimd(_mm_sub_pd(lo, a.lo), _mm_sub_pd(hi, a.hi));
+#else
+		return Vector3dSimd(d[0] - a.d[0], d[1] - a.d[1], d[2] - a.d[2]);
+#endif
+	}
+
+	Vector3dSimd operator *(double f) const {
+#if defined(__AVX2__)
+		return Vector3dSimd(_mm256_mul_pd(v, _mm256_set1_pd(f)));
+#elif defined(__SSE2__)
+		__m128d s = _mm_set1_pd(f);
+		return Vector3dSimd(_mm_mul_pd(lo, s), _mm_mul_pd(hi, s));
+#else
+		return Vector3dSimd(d[0] * f, d[1] * f, d[2] * f);
+#endif
+	}
+
+	Vector3dSimd operator /(double f) const {
+#if defined(__AVX2__)
+		return Vector3dSimd(_mm256_div_pd(v, _mm256_set1_pd(f)));
+#elif defined(__SSE2__)
+		__m128d s = _mm_set1_pd(f);
+		return Vector3dSimd(_mm_div_pd(lo, s), _mm_div_pd(hi, s));
+#else
+		return Vector3dSimd(d[0] / f, d[1] / f, d[2] / f);
+#endif
+	}
+
+	Vector3dSimd &operator +=(const Vector3dSimd &a) {
+		return *this = *this + a;
+	}
+
+	Vector3dSimd &operator -=(const Vector3dSimd &a) {
+		return *this = *this - a;
+	}
+
+	Vector3dSimd &operator *=(double f) {
+		return *this = *this * f;
+	}
+
+	// dot product
+	double dot(const Vector3dSimd &a) const {
+#if defined(__AVX2__)
+		__m256d m = _mm256_mul_pd(v, a.v);
+		__m128d l = _mm256_castpd256_pd128(m);
+		__m128d s = _mm_add_sd(l, _mm_unpackhi_pd(l, l));
+		return _mm_cvtsd_f64(_mm_add_sd(s, _mm256_extractf128_pd(m, 1)));
+#elif defined(__SSE2__)
+		__m128d l = _mm_mul_pd(lo, a.lo);
+		__m128d s = _mm_add_sd(l, _mm_unpackhi_pd(l, l));
+		return _mm_cvtsd_f64(_mm_add_sd(s, _mm_mul_sd(hi, a.hi)));
+#else
+		return d[0] * a.d[0] + d[1] * a.d[1] + d[2] * a.d[2];
+#endif
+	}
+
+	// cross product
+	Vector3dSimd cross(const Vector3dSimd &a) const {
+#if defined(__AVX2__)
+		// (y, z, x) and (z, x, y), the padding stays in the last lane
+		__m256d b1 = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m256d b2 = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 1, 0, 2));
+		__m256d a1 = _mm256_permute4x64_pd(a.v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m256d a2 = _mm256_permute4x64_pd(a.v, _MM_SHUFFLE(3, 1, 0, 2));
+		return Vector3dSimd(_mm256_sub_pd(_mm256_mul_pd(b1, a2), _mm256_mul_pd(b2, a1)));
+#elif defined(__SSE2__)
+		// (y, z | x, 0) and (z, x | y, 0)
+		__m128d b1l = _mm_shuffle_pd(lo, hi, 1), b1h = _mm_move_sd(hi, lo);
+		__m128d b2l = _mm_unpacklo_pd(hi, lo), b2h = _mm_shuffle_pd(lo, hi, 3);
+		__m128d a1l = _mm_shuffle_pd(a.lo, a.hi, 1), a1h = _mm_move_sd(a.hi, a.lo);
+		__m128d a2l = _mm_unpacklo_pd(a.hi, a.lo), a2h = _mm_shuffle_pd(a.lo, a.hi, 3);
+		return Vector3dSimd(_mm_sub_pd(_mm_mul_pd(b1l, a2l), _mm_mul_pd(b2l, a1l)),
+				_mm_sub_pd(_mm_mul_pd(b1h, a2h), _mm_mul_pd(b2h, a1h)));
+#else
+		return Vector3dSimd(d[1] * a.d[2] - a.d[1] * d[2], d[2] * a.d[0] - a.d[2] * d[0],
+				d[0] * a.d[1] - a.d[0] * d[1]);
+#endif
+	}
+
+	// square of magnitude of the vector
+	double getR2() const {
+		return dot(*this);
+	}
+
+	// magnitude (2-norm) of the vector
+	double getR() const {
+		return std::sqrt(getR2());
+	}
+
+	// return the unit-vector e_r
+	Vector3dSimd getUnitVector() const {
+		return *this / getR();
+	}
+
+private:
+#if defined(__AVX2__)
+	__m256d v;
+	explicit Vector3dSimd(__m256d v) : v(v) {
+	}
+#elif defined(__SSE2__)
+	__m128d lo, hi;
+	Vector3dSimd(__m128d lo, __m128d hi) : lo(lo), hi(hi) {
+	}
+#else
+	double d[4];
+#endif
+};
+
+inline Vector3dSimd operator *(double f, const Vector3dSimd &v) {
+	return v * f;
+}
+
+/** @}*/
+}  // namespace crpropa
+
+#endif  // CRPROPA_VECTOR3SIMD_H
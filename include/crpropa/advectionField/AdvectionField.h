@@ -26,6 +26,34 @@ public:
 	}
 	virtual Vector3d getField(const Vector3d &position) const = 0;
 	virtual double getDivergence(const Vector3d &position) const = 0;
+	/** Field and divergence at a position in one call.
+	 The fields override it to compute the terms shared by both once.
+	 @param position	position
+	 @param field		field at the position
+	 @param divergence	divergence of the field at the position
+	 */
+	virtual void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+		field = getField(position);
+		divergence = getDivergence(position);
+	}
+	/** Fields at n positions at once, by default getField for each position.
+	 Fields that can share work between positions, e.g. grids, override it. */
+	virtual void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = getField(positions[i]);
+	}
+	/** Divergences at n positions at once, by default getDivergence for each position */
+	virtual void getDivergences(const Vector3d *positions, double *divergences, size_t n) const {
+		for (size_t i = 0; i < n; i++)
+			divergences[i] = getDivergence(positions[i]);
+	}
+	/** Fields at n positions given as flat arrays, in parallel with OpenMP.
+	 The positions are passed to getFields in chunks.
+	 @param xyz		array of 3 n coordinates (x, y, z of each position)
+	 @param out		array of 3 n field components to fill
+	 @param n		number of positions
+	 */
+	void getFieldsAt(const double *xyz, double *out, size_t n) const;
 };
 
 
@@ -39,6 +67,7 @@ public:
 	void addField(ref_ptr<AdvectionField> field);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 };
 
 
@@ -52,6 +81,7 @@ public:
 	UniformAdvectionField(const Vector3d &value);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	std::string getDescription() const;
 };
@@ -75,6 +105,7 @@ public:
 	ConstantSphericalAdvectionField(const Vector3d origin, double vWind);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	void setOrigin(const Vector3d origin);
 	void setVWind(double vMax);
@@ -110,6 +141,7 @@ public:
 	SphericalAdvectionField(const Vector3d origin, double radius, double vMax, double tau, double alpha);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	double getV(const double &r) const;
 
@@ -146,6 +178,7 @@ public:
 	OneDimensionalCartesianShock(double compressionRatio, double vUp, double lShock);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	void setComp(double compressionRatio);
 	void setVup(double vUp);
@@ -180,6 +213,7 @@ public:
 	OneDimensionalSphericalShock(double rShock, double vUp, double compressionRatio, double lShock, bool coolUpstream);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	void setComp(double compressionRatio);
 	void setVup(double vUp);
@@ -219,6 +253,7 @@ public:
 	ObliqueAdvectionShock(double compressionRatio, double vXUp, double vY, double lShock);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	void setComp(double compressionRatio);
 	void setVup(double vXUp);
@@ -259,6 +294,7 @@ public:
 
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
 
 	double g(double R) const;
 	double g_prime(double R) const;
@@ -0,0 +1,43 @@
+#ifndef CRPROPA_ADVECTIONFIELDGRID_H
+#define CRPROPA_ADVECTIONFIELDGRID_H
+
+#include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/Grid.h"
+
+namespace crpropa {
+
+/**
+ @class AdvectionFieldGrid
+ @brief Advection field on a cartesian grid with trilinear interpolation.
+
+ The velocity is stored in a Grid3f and its divergence, precomputed, in a
+ Grid1f with the same origin, size and spacing, so that both are interpolated
+ at the same cost. Any advection field, also one defined in python, can be
+ sampled onto the grids with fromAdvectionField (GridTools.h).
+ */
+class AdvectionFieldGrid: public AdvectionField {
+	ref_ptr<Grid3f> grid;
+	ref_ptr<Grid1f> divergenceGrid;
+public:
+	/** Constructor
+	 @param grid		Grid3f storing the advection field vectors
+	 @param divergence	Grid1f storing the divergence of the field, with the same geometry
+	 */
+	AdvectionFieldGrid(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence);
+	/** Set both grids, throws std::runtime_error if their geometries differ */
+	void setGrids(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence);
+	ref_ptr<Grid3f> getGrid();
+	ref_ptr<Grid1f> getDivergenceGrid();
+
+	Vector3d getField(const Vector3d &position) const;
+	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getDivergences(const Vector3d *positions, double *divergences, size_t n) const;
+
+	std::string getDescription() const;
+};
+
+} // namespace crpropa
+
+#endif // CRPROPA_ADVECTIONFIELDGRID_H
@@ -0,0 +1,117 @@
+#ifndef CRPROPA_CACHEDMAGNETICFIELD_H
+#define CRPROPA_CACHEDMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class CachedMagneticField
+ @brief Magnetic field decorator that samples an expensive field once on a grid.
+
+ The wrapped field is evaluated in parallel at the nodes of a regular grid
+ within a region, and inside the region the field is interpolated trilinearly
+ from the nodes. Outside of the region the wrapped field is evaluated
+ directly. This is meant for analytic fields like JF12Field or TF17Field,
+ which are expensive to evaluate and smooth on the scale of the grid.
+
+ The grid is either cartesian, or cylindrical around the z-axis with nodes
+ in (r, phi, z), optionally spaced logarithmically in r. Cylindrical grids
+ store (B_r, B_phi, B_z) and are periodic in phi, which follows spiral arms
+ and azimuthal fields with few nodes.
+
+ If a tolerance is given, the interpolation is compared with the wrapped
+ field at the centre of every cell when the grid is sampled, and the wrapped
+ field is evaluated directly in the cells where they differ by more than the
+ tolerance. The grid can be saved to a file and loaded again, for the same
+ wrapped field.
+
+ Only the field at redshift 0 is cached: getField(position, z) returns
+ the cached field of getField(position).
+ */
+class CachedMagneticField: public MagneticField {
+public:
+	enum Coordinates {
+		CARTESIAN, CYLINDRICAL, LOG_CYLINDRICAL
+	};
+
+private:
+	ref_ptr<MagneticField> field;
+	Coordinates coordinates;
+	size_t N[3]; /**< Number of nodes along the grid axes */
+	Vector3d lower, upper; /**< Region in grid coordinates */
+	Vector3d spacing; /**< Distance of the nodes in grid coordinates */
+	double tolerance;
+	std::vector<Vector3f> values; /**< Field at the nodes, (B_r, B_phi, B_z) for cylindrical grids */
+	std::vector<char> exact; /**< Cells in which the wrapped field is evaluated */
+
+	void init(size_t n0, size_t n1, size_t n2);
+	void sample();
+	bool isPeriodic(int axis) const;
+	size_t numberOfCells(int axis) const;
+	Vector3d toGrid(const Vector3d &position) const;
+	Vector3d fromGrid(const Vector3d &u) const;
+	/** Field at a position in grid coordinates, in the components stored at the nodes */
+	Vector3f storedField(const Vector3d &u) const;
+	/** Cell and the distance to its lower node in units of the spacing, false outside of the region */
+	bool locate(const Vector3d &u, size_t cell[3], double f[3]) const;
+	Vector3f interpolate(const size_t cell[3], const double f[3]) const;
+	Vector3d toCartesian(const Vector3f &b, const Vector3d &position) const;
+
+public:
+	/** Cache a field on a cartesian grid
+	 @param field		field to cache
+	 @param origin		lower corner of the region
+	 @param size		size of the region
+	 @param spacing		maximum distance of the nodes
+	 @param tolerance	maximum difference of the interpolated and the wrapped field at the cell centres, not checked if 0
+	 */
+	CachedMagneticField(ref_ptr<MagneticField> field, const Vector3d &origin,
+			const Vector3d &size, double spacing, double tolerance = 0);
+
+	/** Cache a field on a grid cylindrical around the z-axis
+	 @param field		field to cache
+	 @param rMin		minimum radius of the region, positive if logRadial
+	 @param rMax		maximum radius of the region
+	 @param zMin		minimum height of the region
+	 @param zMax		maximum height of the region
+	 @param nR			number of nodes in r
+	 @param nPhi		number of nodes in phi
+	 @param nZ			number of nodes in z
+	 @param logRadial	space the nodes logarithmically in r
+	 @param tolerance	maximum difference of the interpolated and the wrapped field at the cell centres, not checked if 0
+	 */
+	CachedMagneticField(ref_ptr<MagneticField> field, double rMin, double rMax,
+			double zMin, double zMax, size_t nR, size_t nPhi, size_t nZ,
+			bool logRadial = false, double tolerance = 0);
+
+	/** Load a grid saved with save
+	 @param field		the field that was cached
+	 @param filename	file written by save
+	 */
+	CachedMagneticField(ref_ptr<MagneticField> field, const std::string &filename);
+
+	/** Save the grid to a binary file */
+	void save(const std::string &filename) const;
+
+	Vector3d getField(const Vector3d &position) const;
+
+	ref_ptr<MagneticField> getWrappedField() const;
+	Coordinates getCoordinates() const;
+	/** Number of grid cells in which the wrapped field is evaluated directly */
+	size_t getNumberOfExactCells() const;
+	/** Size of the grid in bytes */
+	size_t getSizeOf() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CACHEDMAGNETICFIELD_H
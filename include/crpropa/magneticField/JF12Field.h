@@ -45,6 +45,7 @@ protected:
 	double rArms[8];       // radii where each arm crosses the negative x-axis
 	double pitch;          // pitch angle
 	double sinPitch, cosPitch, tanPitch, cotPitch, tan90MinusPitch;
+	double armTurnFactor;  // change of the radius along a spiral per turn, exp(-2 pi / tan90MinusPitch)
 
 	// Regular field ----------------------------------------------------------
 	// disk
@@ -77,6 +78,13 @@ protected:
 	double rHaloTurb; // exponential scale length
 	double zHaloTurb; // Gaussian scale height
 
+	// Index of the spiral arm in rArms through the position (r, phi), r >= 5 kpc
+	int getSpiralArm(const double& r, const double& phi) const;
+	// Regular field at the in-plane radius r, height z and azimuth phi
+	Vector3d getRegularField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const;
+	// Brms of the turbulent field at the in-plane radius r, height z and azimuth phi
+	double getTurbulentStrength(const double& r, const double& z, const double& phi) const;
+
 public:
 	JF12Field();
 
@@ -136,6 +144,11 @@ public:
 
 	// All set field components
 	Vector3d getField(const Vector3d& pos) const;
+
+	/** All set field components at n positions at once. The cylindrical
+	 coordinates of a block of positions are computed once for all components,
+	 and the turbulent grid is interpolated for the whole block. */
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
 };
 /** @} */
 
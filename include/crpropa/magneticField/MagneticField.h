@@ -4,6 +4,9 @@
 #include "crpropa/Units.h"
 #include "crpropa/Vector3.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/RedshiftCache.h"
+
+#include <vector>
 
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
@@ -29,6 +32,71 @@ public:
 	virtual Vector3d getField(const Vector3d &position, double z) const {
 		return getField(position);
 	};
+	/** Field at n positions at once, by default calls getField for each position.
+	 Fields that can share work between positions, e.g. grids, override it.
+	 @param positions	array of n positions
+	 @param fields		array of n fields to fill
+	 @param n		number of positions
+	 @param z		redshift
+	 */
+	virtual void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = getField(positions[i], z);
+	};
+	/** Hint that the field near a position will be needed soon, e.g. at the
+	 end of the next step of a candidate, see PropagationCK and PropagationBP.
+	 Fields with slow storage, e.g. grids loaded in tiles, start loading it in
+	 the background. The hint does not change the field and by default
+	 nothing happens.
+	 @param position	position of the upcoming lookups
+	 @param z			redshift
+	 */
+	virtual void prefetch(const Vector3d &position, double z) const {
+	};
+	/** Field at n positions given as flat arrays, in parallel with OpenMP.
+	 The positions are passed to getFields in chunks.
+	 @param xyz		array of 3 n coordinates (x, y, z of each position)
+	 @param out		array of 3 n field components to fill
+	 @param n		number of positions
+	 @param z		redshift
+	 */
+	void getFieldsAt(const double *xyz, double *out, size_t n, double z = 0) const;
+	/** Axis-aligned box outside of which the field is zero or negligible.
+	 A frozen MagneticFieldList skips the field at positions outside of it.
+	 @param lower	lower corner of the box
+	 @param upper	upper corner of the box
+	 @return 		false if the field is not bounded
+	 */
+	virtual bool getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+		return false;
+	};
+};
+
+/**
+ @class BoundedMagneticField
+ @brief Magnetic field decorator restricting a field to a box.
+
+ Inside of the box the field is the wrapped field and outside of it zero. The
+ box is declared as bounding box, so that a frozen MagneticFieldList only
+ evaluates the field near it. This is meant for localised fields which are
+ negligible far away, e.g. a MagneticDipoleField or a CMZField.
+ */
+class BoundedMagneticField: public MagneticField {
+	ref_ptr<MagneticField> field;
+	Vector3d lower, upper;
+public:
+	/**
+	 * Constructor
+	 * @param field magnetic field reference pointer
+	 * @param lower lower corner of the box
+	 * @param upper upper corner of the box
+	*/
+	BoundedMagneticField(ref_ptr<MagneticField> field, const Vector3d &lower,
+			const Vector3d &upper);
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
+	ref_ptr<MagneticField> getWrappedField() const;
 };
 
 /**
@@ -77,21 +145,78 @@ public:
 /**
  @class MagneticFieldList
  @brief Magnetic field decorator implementing a superposition of fields.
+
+ After all fields are added, freeze flattens nested lists and
+ MagneticFieldEvolution decorators into one list of the remaining fields
+ with their evolution, and sums all UniformMagneticFields with the same
+ evolution into one constant. A lookup then calls each of the remaining
+ fields directly. Fields with a bounding box (see
+ MagneticField::getBoundingBox) are sorted into the cells of a regular grid
+ over their boxes, and are only evaluated at positions inside of their box.
+ The plan is discarded by addField; changes to nested lists after freeze are
+ not seen.
  */
 class MagneticFieldList: public MagneticField {
 	std::vector<ref_ptr<MagneticField> > fields;
+
+	/** Field scaled by (1+z)^m in the flattened plan, bounded by a box if given */
+	struct Term {
+		const MagneticField *field;
+		double m;
+		Vector3d lower, upper;
+	};
+	/** Sum of uniform fields scaled by (1+z)^m in the flattened plan */
+	struct Constant {
+		Vector3d value;
+		double m;
+	};
+	bool frozen;
+	std::vector<Term> terms; /**< Unbounded fields */
+	std::vector<Term> boundedTerms;
+	std::vector<Constant> constants;
+	// index of the bounded terms: cell c overlaps the boxes of the terms
+	// cellTerms[cellStart[c]] to cellTerms[cellStart[c + 1] - 1]
+	Vector3d indexLower, indexUpper, cellSize;
+	int nCells[3];
+	std::vector<size_t> cellStart;
+	std::vector<size_t> cellTerms;
+
+	void flatten(ref_ptr<MagneticField> field, double m, bool bounded,
+			Vector3d lower, Vector3d upper);
+	void addConstant(const Vector3d &value, double m);
+	void buildIndex();
+	Vector3d getConstantField(double z) const;
+	Vector3d getBoundedField(const Vector3d &position, double z) const;
 public:
+	MagneticFieldList();
 	void addField(ref_ptr<MagneticField> field);
+	/** Flatten nested lists and decorators into one evaluation plan */
+	void freeze();
+	bool isFrozen() const;
+	/** Number of fields that are evaluated per lookup, uniform fields count once per evolution */
+	size_t getNumberOfTerms() const;
+	/** Number of fields with a bounding box in the frozen plan */
+	size_t getNumberOfBoundedTerms() const;
 	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	/** Passes the hint to all fields */
+	void prefetch(const Vector3d &position, double z) const;
+	/** Union of the boxes of all fields, if all of them are bounded */
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
 };
 
 /**
  @class MagneticFieldEvolution
  @brief Magnetic field decorator implementing an evolution of type (1+z)^m.
+
+ The factor (1+z)^m is kept per thread in a RedshiftCache, so that it is
+ computed once per redshift of a candidate instead of at each lookup.
  */
 class MagneticFieldEvolution: public MagneticField {
 	ref_ptr<MagneticField> field;
 	double m;
+	RedshiftCache scalingCache;
 public:
 	/**
 	 * Constructor
@@ -99,7 +224,15 @@ public:
 	 * @param m cosmic evolution parameter 
 	*/
 	MagneticFieldEvolution(ref_ptr<MagneticField> field, double m);
-	Vector3d getField(const Vector3d &position, double z = 0) const;
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	void prefetch(const Vector3d &position, double z) const;
+	/** Factor (1+z)^m of the field at redshift z */
+	double getScaling(double z) const;
+	ref_ptr<MagneticField> getWrappedField() const;
+	double getEvolution() const;
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
 };
 
 /**
@@ -119,6 +252,9 @@ public:
 	Vector3d getField(const Vector3d &position) const {
 		return value;
 	}
+	Vector3d getValue() const {
+		return value;
+	}
 };
 
 /**
@@ -3,6 +3,10 @@
 
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/NestedGrid.h"
+#include "crpropa/PagedGrid.h"
+#include "crpropa/TricubicGrid.h"
+#include "crpropa/RedshiftCache.h"
 
 namespace crpropa {
 /**
@@ -14,18 +18,94 @@ namespace crpropa {
  @class MagneticFieldGrid
  @brief Magnetic field on a periodic (or reflective), cartesian grid with trilinear interpolation.
 
- This class wraps a Grid3f to serve as a MagneticField.
+ This class wraps a Grid3f, or a Grid3h with half the memory footprint, to
+ serve as a MagneticField.
  */
 class MagneticFieldGrid: public MagneticField {
 	ref_ptr<Grid3f> grid;
+	ref_ptr<Grid3h> halfGrid;
 public:
 	/**
 	 *Constructor
 	 @param grid Grid3f storing the magnetic field vectors
 	*/
 	MagneticFieldGrid(ref_ptr<Grid3f> grid);
+	/**
+	 *Constructor
+	 @param grid Grid3h storing the magnetic field vectors in half precision
+	*/
+	MagneticFieldGrid(ref_ptr<Grid3h> grid);
 	void setGrid(ref_ptr<Grid3f> grid);
+	void setGrid(ref_ptr<Grid3h> grid);
+	/** Grid of the field, null if the field uses a Grid3h */
 	ref_ptr<Grid3f> getGrid();
+	/** Half precision grid of the field, null if the field uses a Grid3f */
+	ref_ptr<Grid3h> getHalfGrid();
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	/** The grid volume, if it is clipped */
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
+};
+
+/**
+ @class NestedMagneticFieldGrid
+ @brief Magnetic field on a coarse grid with refined grids over selected boxes.
+
+ This class wraps a NestedGrid3f to serve as a MagneticField. The field is
+ interpolated from the finest grid covering a position.
+ */
+class NestedMagneticFieldGrid: public MagneticField {
+	ref_ptr<NestedGrid3f> grid;
+public:
+	/**
+	 *Constructor
+	 @param grid NestedGrid3f storing the magnetic field vectors
+	*/
+	NestedMagneticFieldGrid(ref_ptr<NestedGrid3f> grid);
+	void setGrid(ref_ptr<NestedGrid3f> grid);
+	ref_ptr<NestedGrid3f> getGrid();
+	Vector3d getField(const Vector3d &position) const;
+};
+
+/**
+ @class PagedMagneticFieldGrid
+ @brief Magnetic field on a grid that is loaded from a file in tiles on demand.
+
+ This class wraps a PagedGrid3f to serve as a MagneticField, for fields that
+ do not fit in the memory.
+ */
+class PagedMagneticFieldGrid: public MagneticField {
+	ref_ptr<PagedGrid3f> grid;
+public:
+	/**
+	 *Constructor
+	 @param grid PagedGrid3f storing the magnetic field vectors
+	*/
+	PagedMagneticFieldGrid(ref_ptr<PagedGrid3f> grid);
+	void setGrid(ref_ptr<PagedGrid3f> grid);
+	ref_ptr<PagedGrid3f> getGrid();
+	Vector3d getField(const Vector3d &position) const;
+	/** Requests the tile of the position from the file, see PagedGrid::prefetch */
+	void prefetch(const Vector3d &position, double z) const;
+};
+
+/**
+ @class TricubicMagneticFieldGrid
+ @brief Magnetic field on a grid with tricubic interpolation from precomputed coefficients.
+
+ This class wraps a TricubicGrid3f to serve as a MagneticField, for a smooth
+ field at a lookup cost close to the trilinear interpolation.
+ */
+class TricubicMagneticFieldGrid: public MagneticField {
+	ref_ptr<TricubicGrid3f> grid;
+public:
+	/**
+	 *Constructor
+	 @param grid TricubicGrid3f storing the coefficients of the magnetic field
+	*/
+	TricubicMagneticFieldGrid(ref_ptr<TricubicGrid3f> grid);
+	void setGrid(ref_ptr<TricubicGrid3f> grid);
+	ref_ptr<TricubicGrid3f> getGrid();
 	Vector3d getField(const Vector3d &position) const;
 };
 
@@ -36,10 +116,17 @@ public:
  This class wraps a Grid3f to serve as a MagneticField.
  The field is modulated on-the-fly with a Grid1f.
  The Grid3f and Grid1f do not need to share the same origin, spacing or size.
+
+ Grids of the same geometry can be fused (setFused): the field and the
+ modulation are interleaved into cells of 4 floats, which are interpolated
+ together with the weights of one index calculation, with SIMD in one
+ register per neighbour. The result is that of the two interpolations.
  */
 class ModulatedMagneticFieldGrid: public MagneticField {
 	ref_ptr<Grid3f> grid;
 	ref_ptr<Grid1f> modGrid;
+	std::vector<float> fused; // bx, by, bz, modulation of each grid point in storage order, see setFused
+	Vector3d fusedField(const Vector3d &position) const;
 public:
 	ModulatedMagneticFieldGrid() {
 	}
@@ -55,8 +142,60 @@ public:
 	ref_ptr<Grid3f> getGrid();
 	ref_ptr<Grid1f> getModulationGrid();
 	void setReflective(bool gridReflective, bool modGridReflective);
+	/** Interpolate the field and the modulation from one fused copy of both grids.
+	 The grids must have the same size, origin, spacing, boundary, clipping and
+	 layout and the trilinear interpolation, otherwise std::runtime_error is
+	 thrown. Later changes of the grid values are not seen, and setting a grid
+	 or the boundaries ends the fused mode. */
+	void setFused(bool fused);
+	bool isFused() const;
 	Vector3d getField(const Vector3d &position) const;
+	/** The volume of the clipped grids */
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
 };
+
+/**
+ @class SnapshotMagneticFieldGrid
+ @brief Time-dependent magnetic field interpolated linearly in redshift between snapshots.
+
+ The snapshots, e.g. the grids of a cosmological MHD simulation at a sequence
+ of redshifts, are fields at given redshifts. At redshift z the field is
+ (1 - w) B_i + w B_{i+1} of the two snapshots around z, and the field of the
+ first / last snapshot outside of their range. The pair of snapshots and the
+ weight are kept per thread in a RedshiftCache.
+
+ Snapshots too large for the memory are added as PagedGrid3f: their tiles are
+ loaded on demand into the tile cache of each grid, so that mostly the tiles
+ of the two active snapshots near the candidates are held in memory.
+ */
+class SnapshotMagneticFieldGrid: public MagneticField {
+	std::vector<double> redshifts;
+	std::vector<ref_ptr<MagneticField> > snapshots;
+	RedshiftCache weightCache;
+
+	// index of the lower snapshot and weight of the upper one at z
+	void getWeight(double z, size_t &i, double &w) const;
+public:
+	SnapshotMagneticFieldGrid();
+	/** Add the field of a snapshot, throws std::runtime_error if there is one at z */
+	void addSnapshot(double z, ref_ptr<MagneticField> field);
+	/** Add a snapshot grid, as MagneticFieldGrid */
+	void addSnapshot(double z, ref_ptr<Grid3f> grid);
+	/** Add a snapshot grid loaded in tiles, as PagedMagneticFieldGrid */
+	void addSnapshot(double z, ref_ptr<PagedGrid3f> grid);
+	size_t getNumberOfSnapshots() const;
+	double getSnapshotRedshift(size_t i) const;
+	ref_ptr<MagneticField> getSnapshot(size_t i) const;
+	/** Field at redshift 0 */
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	/** Passes the hint to the snapshots around z */
+	void prefetch(const Vector3d &position, double z) const;
+	/** Union of the boxes of the snapshots, if all of them are bounded */
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
+};
+
 /** @} */
 } // namespace crpropa
 
@@ -0,0 +1,112 @@
+#ifndef CRPROPA_PROFILEDMAGNETICFIELD_H
+#define CRPROPA_PROFILEDMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class ProfiledMagneticField
+ @brief Magnetic field decorator counting and timing the evaluations of a field.
+
+ Every evaluation of the wrapped field is counted, positions passed to
+ getFields count one each, and the wall time spent in the wrapped field is
+ recorded unless timing is disabled. Every OpenMP thread writes to its own
+ counters, which are summed when they are read. All profiled fields are
+ listed in MagneticFieldProfile, which reports them together.
+
+ To find out how often the components of a field are evaluated, wrap each
+ component before adding it to a MagneticFieldList, e.g.
+ list.addField(ProfiledMagneticField(turbulence, "turbulence")).
+ */
+class ProfiledMagneticField: public MagneticField {
+	struct Counter {
+		uint64_t calls;
+		double time;
+		char padding[64]; // avoid false sharing between threads
+		Counter() : calls(0), time(0) {
+		}
+	};
+
+	ref_ptr<MagneticField> field;
+	std::string name;
+	bool timing;
+	mutable std::vector<Counter> counters; // one per thread, the last for nested parallel regions
+
+	void record(uint64_t calls, double time) const;
+
+	ProfiledMagneticField(const ProfiledMagneticField &);
+	ProfiledMagneticField &operator=(const ProfiledMagneticField &);
+
+public:
+	/**
+	 * Constructor
+	 * @param field	magnetic field to profile
+	 * @param name	name of the field in the report of MagneticFieldProfile
+	 */
+	ProfiledMagneticField(ref_ptr<MagneticField> field, const std::string &name);
+	~ProfiledMagneticField();
+
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	bool getBoundingBox(Vector3d &lower, Vector3d &upper) const;
+
+	/** Record the wall time of the evaluations, on by default.
+	 Without timing only the evaluations are counted, which costs less. */
+	void setTiming(bool timing);
+	bool getTiming() const;
+
+	/** Number of evaluations so far */
+	uint64_t getCalls() const;
+	/** Wall time spent in the wrapped field so far in seconds */
+	double getTime() const;
+	/** Clear the counters. Call outside of parallel regions. */
+	void reset();
+
+	const std::string &getName() const;
+	ref_ptr<MagneticField> getWrappedField() const;
+};
+
+/**
+ @class MagneticFieldProfile
+ @brief Registry of all ProfiledMagneticFields, reporting their counters.
+
+ The report lists every existing ProfiledMagneticField in the order of
+ construction with its name, number of evaluations, time and time per
+ evaluation. If a number of steps is given, e.g. the calls of the propagation
+ module from ModuleList::getProfileCalls when profiling the simulation, the
+ evaluations per step are reported too.
+ */
+class MagneticFieldProfile {
+public:
+	/** All existing profiled fields in the order of construction */
+	static std::vector<ProfiledMagneticField *> getFields();
+	/** Clear the counters of all profiled fields */
+	static void reset();
+	/** Report as JSON document
+	 @param steps	number of propagation steps, no evaluations per step are reported if 0 */
+	static std::string getJSON(uint64_t steps = 0);
+	/** Report as CSV table (field, calls, time, timePerCall, callsPerStep) */
+	static std::string getCSV(uint64_t steps = 0);
+	/** Write the report to a file, as JSON if the file name ends with .json, otherwise as CSV */
+	static void write(const std::string &filename, uint64_t steps = 0);
+
+private:
+	friend class ProfiledMagneticField;
+	static void add(ProfiledMagneticField *field);
+	static void remove(ProfiledMagneticField *field);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PROFILEDMAGNETICFIELD_H
@@ -4,8 +4,12 @@
 #ifdef CRPROPA_HAVE_FFTW3F
 
 #include "crpropa/Grid.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
 #include "crpropa/magneticField/turbulentField/TurbulentField.h"
 
+#include <functional>
+
 #include "fftw3.h"
 
 namespace crpropa {
@@ -26,7 +30,21 @@ class GridTurbulence : public TurbulentField {
 	void initGrid(const GridProperties &grid);
 	void initTurbulence();
 
+	/** Constructor for derived classes, that generate the field themselves
+	 if initialize is false */
+	GridTurbulence(const TurbulenceSpectrum &spectrum,
+	               const GridProperties &gridProp, unsigned int seed,
+	               bool initialize);
+
   public:
+	/**
+	 Function setting the complex Fourier amplitude re + i * im of the field
+	 for the wave vector ek with length k (in units of the inverse grid
+	 spacing), drawing random numbers only from the given generator.
+	 */
+	typedef std::function<void(const Vector3f &ek, double k, Random &random,
+	                           Vector3f &re, Vector3f &im)> ModeFunction;
+
 	/**
 	 Create a random initialization of a turbulent field.
 	 @param spectrum    TurbulenceSpectrum instance to define the spectrum of
@@ -46,11 +64,45 @@ class GridTurbulence : public TurbulentField {
 	// Check the grid properties before the FFT procedure
 	static void checkGridRequirements(ref_ptr<Grid3f> grid, double lMin,
 	                                  double lMax);
+	static void checkGridRequirements(const GridProperties &gridProp,
+	                                  double lMin, double lMax);
 	// Execute inverse discrete FFT in-place for a 3D grid, from complex to real
 	// space
 	static void executeInverseFFTInplace(ref_ptr<Grid3f> grid,
 	                                     fftwf_complex *Bkx, fftwf_complex *Bky,
 	                                     fftwf_complex *Bkz);
+	/**
+	 Fill the grid with the inverse Fourier transform of the modes with
+	 kMin <= k <= kMax, as given by the mode function.
+
+	 The field components are transformed one after the other in a single
+	 buffer of half the grid size, so the peak memory is about 1.33 times the
+	 grid. For a ROW_MAJOR grid each component is transformed directly into
+	 the grid, without the copy. The modes are computed in parallel, with a random generator for
+	 every x-slab seeded from the seed and the slab, so that the field does
+	 not depend on the number of threads. With the threaded FFTW library the
+	 transforms use all OpenMP threads.
+	 @param seed	Random seed, a random seed is chosen if 0
+	 */
+	static void initFourierModes(ref_ptr<Grid3f> grid, double kMin,
+	                             double kMax, unsigned int seed,
+	                             const ModeFunction &mode);
+	/**
+	 Compute the modes of the x-slab ix of an n^3 grid, as in
+	 initFourierModes, in the layout of the complex to real FFTW transform
+	 (n * (n / 2 + 1) modes, z running fastest).
+	 @param baseSeed	the seed of the random generators, not 0
+	 @param Bk	arrays receiving the x-, y- and z-component, NULL to skip one
+	 */
+	static void initFourierSlab(size_t n, size_t ix, double kMin, double kMax,
+	                            uint32_t baseSeed, const ModeFunction &mode,
+	                            fftwf_complex *Bk[3]);
+	/**
+	 Mode function of the GridTurbulence model, for a grid with the given
+	 spacing. The spectrum is referenced and has to outlive the function.
+	 */
+	static ModeFunction modeFunction(const TurbulenceSpectrum &spectrum,
+	                                 double spacing);
 
 	// Usefull checks for a grid field
 	/** Evaluate the mean vector of all grid points */
@@ -61,6 +113,8 @@ class GridTurbulence : public TurbulentField {
 	double getRmsFieldStrength() const;
 	/** Evaluate the RMS of all grid points per axis */
 	std::array<float, 3> getRmsFieldStrengthPerAxis() const;
+	/** Evaluate all of the above in a single pass over the grid */
+	GridStatistics getStatistics() const;
 	/** Evaluate generated power-spectrum */
 	std::vector<std::pair<int, float>> getPowerSpectrum() const;
 	/** Dump a Grid3f to a binary file */
@@ -0,0 +1,76 @@
+#ifndef CRPROPA_PAGEDGRIDTURBULENCE_H
+#define CRPROPA_PAGEDGRIDTURBULENCE_H
+
+#ifdef CRPROPA_HAVE_FFTW3F
+
+#include "crpropa/PagedGrid.h"
+#include "crpropa/magneticField/turbulentField/GridTurbulence.h"
+
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class PagedGridTurbulence
+ @brief Turbulent grid-based magnetic field for grids larger than the memory.
+
+ The field of GridTurbulence with the same spectrum, grid and seed is
+ generated into a file, without holding the grid in memory, and is loaded
+ from there in tiles on demand by a PagedGrid3f, which keeps the recently
+ used tiles in a cache of bounded size.
+
+ Every value of the grid depends on all Fourier modes, so a tile can not be
+ computed on its own for less than the whole transform. Instead, the inverse
+ transform is split into two passes over the grid: the modes of every
+ x-slab are computed and transformed along y, and written to a temporary
+ file next to the output, then every y-plane is read back, transformed
+ along x and z and written to the output. The memory needed is of the order
+ of a few slabs per thread, the temporary file takes about twice the size
+ of the output and is removed afterwards. The values are the same as from
+ GridTurbulence up to rounding of the single precision transforms.
+ */
+class PagedGridTurbulence : public TurbulentField {
+	ref_ptr<PagedGrid3f> grid;
+
+  public:
+	/**
+	 Generate a random turbulent field into a file and load it in tiles.
+	 @param spectrum	TurbulenceSpectrum instance to define the spectrum of
+	 turbulence
+	 @param gridProp	GridProperties instance to define the underlying grid
+	 @param seed		Random seed, a random seed is chosen if 0
+	 @param filename	file the grid is written to, in the format of dumpGrid
+	 @param cacheSize	maximum size of the cached tiles in bytes
+	 @param tileEdge	number of grid points along the edges of the tiles
+	 */
+	PagedGridTurbulence(const TurbulenceSpectrum &spectrum,
+	                    const GridProperties &gridProp, unsigned int seed,
+	                    const std::string &filename,
+	                    size_t cacheSize = 1 << 30, size_t tileEdge = 32);
+
+	Vector3d getField(const Vector3d &pos) const;
+
+	/** Return the paged grid */
+	ref_ptr<PagedGrid3f> getGrid() const;
+
+	/**
+	 Write the field of GridTurbulence(spectrum, gridProp, seed) to a file in
+	 the format of dumpGrid, which can be loaded with PagedGrid3f or
+	 loadGrid later, without holding the grid in memory.
+	 @param seed	Random seed, a random seed is chosen if 0
+	 */
+	static void generate(const TurbulenceSpectrum &spectrum,
+	                     const GridProperties &gridProp, unsigned int seed,
+	                     const std::string &filename);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_FFTW3F
+
+#endif // CRPROPA_PAGEDGRIDTURBULENCE_H
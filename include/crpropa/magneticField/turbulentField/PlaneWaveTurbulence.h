@@ -34,19 +34,28 @@ Furthermore, depending on the exact setting, the implementation is somewhat slow
 
  ## Using the SIMD optimization
  In order to mitigate some of the performance impact that is inherent in this
-method of field generation, an optimized version is provided. According to our
-tests (see the paper above), this version runs 20-30x faster than the baseline
-implementation and matches the speed of trilinear interpolation on a grid at
-a bit less than 100 wavemodes. To do this, it uses special CPU instructions
-called AVX, which are unfortunately not supported by every CPU. On Linux, you
-can check whether your CPU supports AVX by using the `lscpu` command, and
-searching the flags section for the string "avx". Alternatively, if you are
-building on the same CPU that CRPropa will run on, you can have the compiler
-detect this for you automatically (see below).
-
- An additional speedup of about 1.33 can be achieved if the CPU supports the
-FMA extension in addition to AVX. Again, you can either check for this
-manually, or have the compiler figure it out for you.
+method of field generation, optimized kernels are provided. According to our
+tests (see the paper above), they run 20-30x faster than the baseline
+implementation and match the speed of trilinear interpolation on a grid at
+a bit less than 100 wavemodes. They evaluate the cosine with a polynomial
+approximation, using the widest vector instructions that the CPU running the
+code supports: AVX-512, AVX2 with FMA, or AVX. The instruction set is detected
+at run time, so the same build runs on every CPU, and falls back to a scalar
+version of the same computation on CPUs without AVX.
+
+ The kernel is chosen with setKernel:
+ - EXACT: the baseline implementation using std::cos. This is the default,
+   unless CRPropa is built with the FAST_WAVES flag in cmake.
+ - FAST: the optimized kernel in double precision.
+ - FAST_FLOAT: the optimized kernel in single precision, which processes twice
+   as many wavemodes per instruction. The phases are only accurate to about
+   1e-7 * |k * x| and it needs AVX2, so this is suitable for positions within
+   about 10^3 Lmin of the origin, where the error of the field stays below
+   10^-3 Brms.
+
+ setSimdLevel limits the instruction set, e.g. to compare the results of
+different CPUs. The SIMD_EXTENSIONS option in cmake is not needed for these
+kernels.
 
  **Note** that the optimized and non-optimized implementations to not return
 the exact same results. In fact, since the effective wave numbers used
@@ -54,36 +63,8 @@ by the optimized implementation are very slightly different from those
 used by the non-optimized version (a difference smaller than the precision
 of a double, but nevertheless relevant at some point), the wavemodes go
 out of phase for large distances from the origin, and the fields are no longer
-comparable at all.
-
- ### If you are building on the same machine that the code will run on:
-
-1. In cmake: enable the FAST_WAVES flag.
-2. Also in cmake: set SIMD_EXTENSIONS to "native". The compiler will automatically
-detect support for your CPU and run the build with the appropriate settings.
-3. Generate files and exit cmake, then build.
-3. If your CPU does not support the necessary extensions, the build will fail
-with an error telling you so. In this case, you won't be able to use the optimization;
-go back into cmake, disable FAST_WAVES, and build again.
-4. If the build runs through without errors, the code is built with the optimization.
-
- ### If you are building on a different machine from the one where the code will run:
-
-1. Figure out which extensions your target machine supports, using `lscpu | grep avx`
-for AVX, and `lscpu | grep fma` for FMA. Run these commands on your target machine,
-not on your build machine. If your target machine does not run Linux, you may have to
-use different commands.
-2. If the CPU does not support AVX, you can stop here, and build normally. The CPU
-does not support the necessary extensions, and will not run code that is compiled
-using them.
-3. If the CPU does support AVX, continue. In cmake, enable the FAST_WAVES flag.
-4. Also in cmake, set SIMD_EXTENSIONS to the appropriate value. If your target CPU
-supports only AVX, but not FMA, set it to "avx". If it supports both, set it to
-"avx+fma".
-5. Generate and exit cmake, then build.
-6. If you made a mistake and used the wrong flags, you should see an illegal
-instruction error when trying to import CRPropa, or (at the latest) when trying
-to call `getField`.
+comparable at all. The double precision kernels agree with each other up to
+rounding, on all instruction sets.
 
 [GJ99]: https://doi.org/10.1086/307452
 [TD13]: https://doi.org/10.1063/1.4789861
@@ -100,24 +81,36 @@ class PlaneWaveTurbulence : public TurbulentField {
 	std::vector<double> Ak;
 	std::vector<double> k;
 
-	// data for FAST_WAVES
+  public:
+	/** Evaluation of the wavemodes in getField */
+	enum Kernel {
+		EXACT, /**< sum with std::cos */
+		FAST, /**< SIMD sum in double precision */
+		FAST_FLOAT /**< SIMD sum in single precision */
+	};
+
+	/** Instruction sets of the FAST kernels, FAST_FLOAT needs at least AVX2 */
+	enum SimdLevel {
+		SIMD_NONE, SIMD_AVX, SIMD_AVX2, SIMD_AVX512
+	};
+
+  private:
+	Kernel kernel;
+	SimdLevel simdLevel;
+
+	// data for the FAST kernels: packed arrays of Ak * xi, k * kappa / pi and
+	// beta / pi, with avx_Nm elements each, starting at the alignment offset
 	int avx_Nm;
 	int align_offset;
+	int falign_offset;
 	std::vector<double> avx_data;
-	// the following are index bases into the avx_data array.
-	// since each subarray has avx_Nm elements, the start offset
-	// of each subarray can be computed by multiplying the two,
-	// and then adding on the alignment offset.
-	// iAxi is a combined array containing the product of Ak * xi
-	static const int iAxi0 = 0;
-	static const int iAxi1 = 1;
-	static const int iAxi2 = 2;
-	// ikkappa is a combined array containing the product of k * kappa
-	static const int ikkappa0 = 3;
-	static const int ikkappa1 = 4;
-	static const int ikkappa2 = 5;
-	static const int ibeta = 6;
-	static const int itotal = 7;
+	std::vector<float> avx_fdata;
+
+	/** Pack the modes into the arrays of the FAST kernels */
+	void initSimdData();
+
+	/** Sum of the modes from begin to end, multiples of 16, with the current kernel */
+	Vector3d sumWaves(int begin, int end, const Vector3d &pos) const;
 
   public:
 	/**
@@ -141,6 +134,41 @@ class PlaneWaveTurbulence : public TurbulentField {
 	   Theoretical runtime is O(Nm), where Nm is the number of wavemodes.
 	*/
 	Vector3d getField(const Vector3d &pos) const;
+
+	/**
+	   Evaluates the field at n positions, e.g. of several candidates.
+
+	   The modes are evaluated in tiles for all positions, so that they are
+	   read from memory only once. The fields are the same as from getField
+	   up to rounding.
+	*/
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+	               double z) const;
+
+	/** Number of values per mode in getModes: xi (3), kappa (3), phi,
+	   cos(theta), beta, Ak and k */
+	static const int modeSize = 11;
+
+	/**
+	   The wavemodes, modeSize values per mode, e.g. to restore the same
+	   field in another process with setModes instead of transferring or
+	   regenerating it.
+	*/
+	std::vector<double> getModes() const;
+	/** Replace the wavemodes by modes as returned by getModes */
+	void setModes(const std::vector<double> &modes);
+	int getNumberOfModes() const;
+
+	void setKernel(Kernel kernel);
+	Kernel getKernel() const;
+
+	/** Use at most the given instruction set, limited to the ones supported by the CPU */
+	void setSimdLevel(SimdLevel level);
+	/** Instruction set used by the FAST kernels */
+	SimdLevel getSimdLevel() const;
+
+	/** Widest instruction set supported by the CPU and the build */
+	static SimdLevel getSupportedSimdLevel();
 };
 
 /** @} */
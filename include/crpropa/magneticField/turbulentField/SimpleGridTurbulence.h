@@ -61,6 +61,13 @@ class SimpleTurbulenceSpectrum : public TurbulenceSpectrum {
  @brief Turbulent grid-based magnetic field with a simple power-law spectrum
  */
 class SimpleGridTurbulence : public GridTurbulence {
+  protected:
+	/** Constructor for derived classes, that generate the field themselves
+	 if initialize is false */
+	SimpleGridTurbulence(const SimpleTurbulenceSpectrum &spectrum,
+	                     const GridProperties &gridProp, unsigned int seed,
+	                     bool initialize);
+
   public:
 	/**
 	 Create a random initialization of a turbulent field.
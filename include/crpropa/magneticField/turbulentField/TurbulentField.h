@@ -107,6 +107,7 @@ class TurbulentField : public MagneticField {
 	virtual ~TurbulentField() {}
 
 	double getBrms() const { return spectrum.getBrms(); }
+	const TurbulenceSpectrum &getSpectrum() const { return spectrum; }
 	virtual double getCorrelationLength() const {
 		return spectrum.getCorrelationLength();
 	}
@@ -0,0 +1,90 @@
+#ifndef CRPROPA_LENSBUILDER_H
+#define CRPROPA_LENSBUILDER_H
+
+#include "crpropa/Module.h"
+#include "crpropa/magneticLens/ModelMatrix.h"
+#include "crpropa/magneticLens/Pixelization.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+class MagneticLens;
+
+/**
+ @class LensBuilder
+ @brief Builds the matrices of a MagneticLens from back-tracked candidates.
+
+ Anti-particles are started at the observer into the healpix pixels of the
+ sky and back-tracked to the edge of the galaxy, where an observer passes the
+ candidates to the builder, e.g. ObserverSurface(Sphere) with
+ onDetection(builder). The arrival pixel is taken from the source direction,
+ the extragalactic pixel from the current direction, and the rigidity
+ E / |Z| of the source state selects the lens part. The counts are collected
+ in buffers per thread and merged by build(), in parallel over the lens parts.
+ Normalized, the element (i, j) of a lens part is the fraction of the
+ candidates of arrival pixel i which left the galaxy in pixel j.
+ */
+class LensBuilder: public Module {
+	struct Buffer {
+		// entries (arrival pixel, extragalactic pixel, weight) per lens part
+		std::vector<std::vector<Eigen::Triplet<double> > > triplets;
+		char padding[64]; // avoid false sharing between threads
+	};
+	Pixelization pixelization;
+	double logRigidityMin, logRigidityMax;
+	size_t nBins;
+	bool useWeights;
+	mutable Buffer sharedBuffer; // for threads without an own buffer
+	mutable std::vector<Buffer> threadBuffers;
+	std::vector<ModelMatrixType> matrices;
+
+	void merge(const Buffer &buffer, size_t bin, std::vector<Eigen::Triplet<double> > &all) const;
+public:
+	/** Constructor
+	 @param order		healpix order of the lens
+	 @param rigidityMin	lower edge of the rigidities of the lens parts [Joule]
+	 @param rigidityMax	upper edge of the rigidities of the lens parts [Joule]
+	 @param nBins		number of lens parts, logarithmic in rigidity
+	 */
+	LensBuilder(uint8_t order, double rigidityMin, double rigidityMax, size_t nBins);
+
+	void process(Candidate *candidate) const;
+
+	/** Count the candidates with their weight instead of 1 (default false) */
+	void setUseWeights(bool use);
+
+	/** Merge the collected candidates into the matrices of the lens parts
+	 @param normalize	divide the rows by the number of candidates of their
+						arrival pixel
+	 */
+	void build(bool normalize = true);
+	/** Remove the collected candidates and the matrices */
+	void clear();
+
+	size_t getNumberOfBins() const;
+	/// lower and upper edge of the rigidity of a lens part [Joule]
+	double getRigidityMin(size_t bin) const;
+	double getRigidityMax(size_t bin) const;
+	/// Matrix of a lens part after build()
+	const ModelMatrixType &getMatrix(size_t bin) const;
+
+	/** Write the lens parts to filename_i.csc in the format of
+	 serializeCompressed and the lens file read by MagneticLens::loadLens
+	 to filename.cfg, lens parts without entries are skipped */
+	void write(const std::string &filename) const;
+	/** Add the lens parts with entries to a lens */
+	void addToLens(MagneticLens &lens) const;
+
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_LENSBUILDER_H
@@ -0,0 +1,63 @@
+#ifndef CRPROPA_LENSDEVICE_H
+#define CRPROPA_LENSDEVICE_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+class LensPart;
+
+/**
+ @class LensDevice
+ @brief Lens parts resident on a CUDA device.
+
+ The matrices of the lens parts are copied to the device at their first use
+ and kept there, the model vectors of a transformation are multiplied in one
+ sparse times dense matrix product (cuSPARSE SpMM). Only available with
+ ENABLE_LENS_CUDA, used by MagneticLens::setDeviceEnabled. The products are
+ serialized, the device is used by one thread at a time.
+ */
+class LensDevice {
+	struct Matrix;
+	std::map<const LensPart*, Matrix*> _matrices;
+	void *_handle; // cusparseHandle_t
+	int _device;
+	// buffers of the dense blocks and of cuSPARSE, grown on demand
+	void *_x, *_y, *_buffer;
+	size_t _xSize, _ySize, _bufferSize;
+	size_t _memoryUsed;
+	std::mutex _mutex;
+
+	Matrix *upload(LensPart *part);
+	void reserve(void *&buffer, size_t &size, size_t bytes);
+public:
+	/// Uses the CUDA device with the given number
+	LensDevice(int device = 0);
+	~LensDevice();
+
+	/// models[i] = M models[i] for count vectors of the number of pixels,
+	/// with the matrix M of the lens part
+	void transform(LensPart *part, double **models, size_t count);
+
+	/// Remove the matrix of the lens part from the device, e.g. after it
+	/// was changed on the host
+	void release(const LensPart *part);
+	/// Remove all matrices from the device
+	void release();
+
+	/// Device memory of the matrices in bytes
+	size_t getMemoryUsed() const;
+	/// Number of CUDA devices, 0 without CUDA
+	static int getDeviceCount();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_LENSDEVICE_H
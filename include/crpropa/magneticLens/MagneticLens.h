@@ -25,9 +25,11 @@
 
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
+#include "crpropa/MemoryUsage.h"
 #include "crpropa/Units.h"
 #include "crpropa/Vector3.h"
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -40,25 +42,67 @@
 namespace crpropa
 {
 
-/// Holds one matrix for the lens and information about the rigidity range
+class LensPart;
+class LensDevice;
+
+/// Bookkeeping of the loaded lens parts of a lens for lazy loading
+struct LensPartCache
+{
+	size_t memoryLimit; // bytes, 0 for no limit
+	size_t memoryUsed;
+	uint64_t clock;
+	std::vector<LensPart*> parts;
+	LensPartCache() : memoryLimit(0), memoryUsed(0), clock(0)
+	{
+	}
+};
+
+/// Holds one matrix for the lens and information about the rigidity range.
+/// The matrix of a part with a file is loaded at the first use if it was
+/// not loaded before, and may be released again to stay within the memory
+/// limit of the lens. Normalizations are repeated when it is reloaded.
 class LensPart
 {
 	string _filename;
 	double _rigidityMin;
 	double _rigidityMax;
-	ModelMatrixType M;
+	std::shared_ptr<ModelMatrixType> M;
+	std::shared_ptr<ModelMatrixFloatType> F; // instead of M in single precision
 	double _maximumSumOfColumns;
 	bool _maximumSumOfColumns_calculated;
-
+	// normalizations applied again when the matrix is reloaded
+	double _scale;
+	bool _columnsNormalized;
+	LensPartCache *_cache;
+	uint64_t _lastUse;
+	bool _fromFile;
+	bool _singlePrecision;
+	double _pruningThreshold;
+	MemoryAccount _memory;
+
+	friend class MagneticLens;
+	// release the least recently used parts of the cache above its limit
+	static void evict(LensPartCache *cache, const LensPart *keep);
+	// store the matrix as M or F, called with the lock held
+	void store(std::shared_ptr<ModelMatrixType> m);
+	void release();
+	size_t memory() const;
+	// load the matrix if necessary
+	void ensureLoaded();
 public:
-	LensPart()
+	LensPart() : _rigidityMin(0), _rigidityMax(0), _maximumSumOfColumns(0),
+			_maximumSumOfColumns_calculated(false), _scale(1),
+			_columnsNormalized(false), _cache(NULL), _lastUse(0), _fromFile(false),
+			_singlePrecision(false), _pruningThreshold(0), _memory(MemoryUsage::Lenses)
 	{
 	}
 	/// File containing the matrix to be used in the range rigidityMin,
 	/// rigidityMax in Joule
 	LensPart(const std::string &filename, double rigidityMin, double rigidityMax) :
-			_filename(filename), _rigidityMin(rigidityMin), _rigidityMax(rigidityMax), _maximumSumOfColumns_calculated(
-					false), _maximumSumOfColumns(0)
+			_filename(filename), _rigidityMin(rigidityMin), _rigidityMax(rigidityMax),
+			_maximumSumOfColumns(0), _maximumSumOfColumns_calculated(false),
+			_scale(1), _columnsNormalized(false), _cache(NULL), _lastUse(0), _fromFile(true),
+			_singlePrecision(false), _pruningThreshold(0), _memory(MemoryUsage::Lenses)
 	{
 	}
 
@@ -67,10 +111,13 @@ public:
 	}
 
 	/// Loads the matrix from file
-	void loadMatrixFromFile()
-	{
-		deserialize(_filename, M);
-	}
+	void loadMatrixFromFile();
+
+	/// True if the matrix is in memory
+	bool isLoaded() const;
+
+	/// Releases the matrix of a part with a file, it is loaded again at the next use
+	void unloadMatrix();
 
 	/// Returns the filename of the matrix
 	const std::string& getFilename()
@@ -79,15 +126,7 @@ public:
 	}
 
 	/// Calculates the maximum of the sums of columns for the matrix
-	double getMaximumOfSumsOfColumns()
-	{
-		if (!_maximumSumOfColumns_calculated)
-		{ // lazy calculation of maximum
-			_maximumSumOfColumns = maximumOfSumsOfColumns(M);
-			_maximumSumOfColumns_calculated = true;
-		}
-		return _maximumSumOfColumns;
-	}
+	double getMaximumOfSumsOfColumns();
 
 	/// Returns the minimum of the rigidity range for the lenspart in eV
 	double getMinimumRigidity()
@@ -101,19 +140,36 @@ public:
 		return _rigidityMax / eV;
 	}
 
-	/// Returns the modelmatrix
-	ModelMatrixType& getMatrix()
-	{
-		return M;
-	}
+	/// Returns a copy of the modelmatrix, loading it if necessary (thread-safe).
+	/// With a memory limit the part can be released to load another one at
+	/// any time, use getMatrixPointer to keep the matrix without a copy.
+	/// Throws std::runtime_error for a part in single precision.
+	ModelMatrixType getMatrix();
+
+	/// Returns the modelmatrix, loading it if necessary (thread-safe)
+	std::shared_ptr<ModelMatrixType> getMatrixPointer();
+
+	/// Returns a copy of the single precision modelmatrix, see getMatrix.
+	/// Throws std::runtime_error for a part in double precision.
+	ModelMatrixFloatType getMatrixFloat();
+	std::shared_ptr<ModelMatrixFloatType> getMatrixFloatPointer();
+
+	/// Store the matrix in single precision, a loaded matrix is converted
+	void setSinglePrecision(bool single);
+	bool isSinglePrecision() const;
+
+	/// Remove the elements below threshold at loading, see pruneMatrix
+	void setPruningThreshold(double threshold);
+	double getPruningThreshold() const;
 
 	/// Sets the modelmatrix
-	void setMatrix(const ModelMatrixType& m)
-	{
-		M = m;
-	}
+	void setMatrix(const ModelMatrixType& m);
 
+	/// Divides the matrix by norm, also after reloading
+	void normalizeMatrix(double norm);
 
+	/// Normalizes the columns of the matrix, also after reloading
+	void normalizeMatrixColumns();
 };
 
 /// Function to calculate the mean deflection [rad] of the matrix M, given a pixelization
@@ -159,29 +215,47 @@ class MagneticLens
 	// Checks Matrix, raises Errors if not ok - also generate
 	// _pixelization if called first time
 	void _checkMatrix(const ModelMatrixType &M);
+	void _checkMatrix(size_t rows, size_t cols);
 	// minimum / maximum rigidity that is covered by the lens [Joule]
 	double _minimumRigidity;
 	double _maximumRigidity;
 	static bool _randomSeeded;
 	double _norm;
+	// lens parts outside of this rigidity range are not loaded [Joule]
+	double _rangeMin;
+	double _rangeMax;
+	bool _lazyLoading;
+	bool _singlePrecision;
+	double _pruningThreshold;
+	LensPartCache _cache;
+	// matrices on a CUDA device, NULL if not enabled
+	LensDevice *_device;
+	// remove changed matrices from the device
+	void updateDevice();
 
 public:
 	/// Default constructor
 	MagneticLens() :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1),
+			_rangeMin(0), _rangeMax(DBL_MAX), _lazyLoading(false),
+			_singlePrecision(false), _pruningThreshold(0), _device(NULL)
 	{
 	}
 
 	/// Constructs lens with predefined healpix order
 	MagneticLens(uint8_t healpixorder) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1),
+			_rangeMin(0), _rangeMax(DBL_MAX), _lazyLoading(false),
+			_singlePrecision(false), _pruningThreshold(0), _device(NULL)
 	{
 		_pixelization = new Pixelization(healpixorder);
 	}
 
 	/// Construct lens and load lens from file
 	MagneticLens(const string &filename) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1),
+			_rangeMin(0), _rangeMax(DBL_MAX), _lazyLoading(false),
+			_singlePrecision(false), _pruningThreshold(0), _device(NULL)
 	{
 		loadLens(filename);
 	}
@@ -195,6 +269,7 @@ public:
 	/// Default destructor
 	~MagneticLens()
 	{
+		setDeviceEnabled(false);
 		if (_pixelization)
 			delete _pixelization;
 		for (std::vector<LensPart*>::iterator iter = _lensParts.begin();
@@ -218,6 +293,10 @@ public:
 	/// correct size. Rigidity is given in Joule
 	void transformModelVector(double* model, double rigidity) const;
 
+	/// transforms several model arrays with the lens part of the rigidity
+	/// [Joule] in one sparse matrix times dense matrix product
+	void transformModelVectors(double** models, size_t count, double rigidity) const;
+
 	/// Loads M as part of a lens and use it in given rigidity range with
 	/// rigidities given in Joule
 	void setLensPart(const ModelMatrixType &M, double rigidityMin, double rigidityMax);
@@ -227,6 +306,43 @@ public:
 	/// rigidities are given in logarithmic units [log10(E / eV)]
 	void loadLens(const string &filename);
 
+	/// Load the matrices of the lens parts at their first use instead of
+	/// in loadLens (default false). To be set before loadLens.
+	void setLazyLoading(bool lazy);
+	bool getLazyLoading() const;
+
+	/// Memory for the matrices of lazily loaded lens parts in bytes, the least
+	/// recently used parts are released above it. 0 for no limit (default).
+	void setMemoryLimit(size_t bytes);
+	size_t getMemoryLimit() const;
+	/// Memory used by the matrices of loaded lens parts with a file in bytes
+	size_t getMemoryUsed() const;
+
+	/// Store the matrices of the lens parts from files in single precision,
+	/// which halves the memory and its bandwidth in the transformations.
+	/// To be set before loadLens.
+	void setSinglePrecision(bool single);
+	bool getSinglePrecision() const;
+
+	/// Remove the elements of the lens parts from files below threshold
+	/// and rescale the columns to their previous sums, see pruneMatrix.
+	/// 0 keeps all elements (default). To be set before loadLens.
+	void setPruningThreshold(double threshold);
+	double getPruningThreshold() const;
+
+	/// Transform the model vectors on a CUDA device, with the matrices of
+	/// the lens parts kept on the device after their first use. Requires
+	/// ENABLE_LENS_CUDA at build time, throws std::runtime_error otherwise.
+	void setDeviceEnabled(bool enabled, int device = 0);
+	bool getDeviceEnabled() const;
+	/// Device memory used by the matrices of the lens parts in bytes
+	size_t getDeviceMemoryUsed() const;
+
+	/// Only parts overlapping this rigidity range [Joule] are added by
+	/// loadLens, the others are skipped without reading their files.
+	/// To be set before loadLens.
+	void setRigidityRange(double rigidityMin, double rigidityMax);
+
 	/// Normalizes the lens parts to the maximum of sums of columns of
 	/// every lenspart. By doing this, the lens won't distort the spectrum
 	void normalizeLens();
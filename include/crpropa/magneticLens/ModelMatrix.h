@@ -38,32 +38,77 @@ using namespace std;
 
 #include <Eigen/SparseCore>
 
+#include "crpropa/MappedFile.h"
+
 namespace crpropa 
 {
 
 	typedef Eigen::SparseMatrix<double> ModelMatrixType;
 	typedef Eigen::SparseVector<double> ModelVectorType;
+	/// Single precision matrix for lens parts, see MagneticLens::setSinglePrecision
+	typedef Eigen::SparseMatrix<float> ModelMatrixFloatType;
+	typedef Eigen::Map<const ModelMatrixType> MappedModelMatrixType;
 
 	/// Writes the ModelMatrix to disk as binary files with the format:
 	/// Int (number of non zero elements), Int (size1), Int (size2)
 	/// (Int, Int, Double) : (column, row, value) triples ...
 	void serialize(const string &filename, const ModelMatrixType &matrix);
 
-	/// Reads a matrix from file
+	/// Writes the ModelMatrix to disk in the compressed column format
+	/// of the matrix storage, which is read without parsing:
+	/// "CRPLENSC", UInt64 (rows, columns, non zero elements),
+	/// Int (column starts) [columns + 1], Int (rows) [non zero elements],
+	/// zero padding to a multiple of 8 bytes, Double (values) [non zero elements]
+	void serializeCompressed(const string &filename, const ModelMatrixType &matrix);
+
+	/// Reads a matrix from file, in the format of serialize or serializeCompressed
 	void deserialize(const string &filename, ModelMatrixType &matrix);
 
+	/// Reads only the size of a matrix in a file of serialize or serializeCompressed
+	void readMatrixSize(const string &filename, size_t &rows, size_t &columns);
+
+	/// Converts a matrix file of serialize to the format of serializeCompressed
+	void convertToCompressed(const string &filename, const string &compressedFilename);
+
+	/// Matrix in a file of serializeCompressed, mapped into memory without
+	/// copying or parsing. The matrix is read-only.
+	class MappedModelMatrix: public Referenced
+	{
+		ref_ptr<MappedFile> file;
+		MappedModelMatrixType *matrix;
+	public:
+		/// Maps the file, throws runtime_error if it is not in the compressed format
+		MappedModelMatrix(const string &filename);
+		~MappedModelMatrix();
+		const MappedModelMatrixType &getMatrix() const;
+	};
+
 	/// Normalizes each column j of the matrix so that, \f$ \Vert m_j \Vert_1 = 1 \f$ 
 	void normalizeColumns(ModelMatrixType &matrix);
+	void normalizeColumns(ModelMatrixFloatType &matrix);
+
+	/// Removes the elements below threshold. The remaining elements of each
+	/// column are rescaled with normalizeColumns to the sum of the column before.
+	void pruneMatrix(ModelMatrixType &matrix, double threshold);
 
 	/// Calculate the maximum of the unity norm of the column vectors of the matrix \f$\max_j(\Vert m_j \Vert_1) \f$
 	double maximumOfSumsOfColumns(const ModelMatrixType &matrix);
+	double maximumOfSumsOfColumns(const ModelMatrixFloatType &matrix);
 	
 	double norm_1(const ModelVectorType &v);
 
 	void normalizeMatrix(ModelMatrixType& matrix, double norm);
+	void normalizeMatrix(ModelMatrixFloatType& matrix, double norm);
 
 	// matrix vector product with update: model = matrix * model
+	// Parallel with OpenMP outside of parallel regions, with a workspace
+	// reused by the calls of each thread. Summed in double precision.
 	void prod_up(const ModelMatrixType& matrix, double* model);
+	void prod_up(const MappedModelMatrixType& matrix, double* model);
+	void prod_up(const ModelMatrixFloatType& matrix, double* model);
+	// matrix product with update for count models at once: models[i] = matrix * models[i]
+	void prod_up(const ModelMatrixType& matrix, double** models, size_t count);
+	void prod_up(const ModelMatrixFloatType& matrix, double** models, size_t count);
 } // namespace parsec
 
 #endif // MODELMATRIX_HH
@@ -6,6 +6,7 @@
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/MagneticLens.h"
 
+#include "crpropa/Random.h"
 #include "crpropa/Vector3.h"
 
 namespace crpropa {
@@ -20,10 +21,24 @@ namespace crpropa {
 
  The maps are stored with discrete energies on a logarithmic scale. The
  default energy width is 0.02 with an energy bin from 10**17.99 - 10**18.01 eV.
+ The maps are allocated in pooled blocks and found through a small index of
+ particle ids and energy bins, the pointers of getMap stay valid.
  */
 class ParticleMapsContainer {
 private:
-	std::map<int, std::map <int, double*> > _data;
+	// energy bin firstBin + i -> map slot, -1 if there is none
+	struct EnergyIndex {
+		int firstBin;
+		std::vector<int> slots;
+	};
+	std::map<int, EnergyIndex> _index;
+	std::vector<double*> _maps; // slot -> pixels
+	std::vector<int> _slotPid, _slotEnergyIdx;
+	std::vector<double*> _blocks; // pooled allocations of maps
+	size_t _blockFill; // maps used in the last block
+	// the last map looked up by addParticle
+	int _lastPid, _lastEnergyIdx, _lastSlot;
+
 	Pixelization _pixelization;
 	double _deltaLogE;
 	double _bin0lowerEdge;
@@ -31,22 +46,28 @@ private:
 	// get the bin number of the energy
 	int energy2Idx(double energy) const;
 	double idx2Energy(int idx) const;
+	// slot of the map, -1 if there is none
+	int findSlot(int pid, int energyIdx) const;
+	int getSlot(int pid, int energyIdx);
 
 	// weights of the particles
 	double _sumOfWeights;
 	std::map<int, double > _weightsPID;
-	std::map<int, map<int, double> > _weights_pidEnergy;
+	std::vector<double> _slotWeights;
+	AliasTable _slotAlias;
+	std::vector<AliasTable> _pixelAlias; // pixels of a map, built on demand
 
 	// lazy update of weights
 	bool _weightsUpToDate;
 	void _updateWeights();
+	const AliasTable &pixelAlias(int slot);
 
 public:
 	/** Constructor.
 	 @param deltaLogE		width of logarithmic energy bin [in eV]
 	 @param bin0lowerEdge	logarithm of energy of the lower edge of first bin [in log(eV)]
 	 */
-	ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _pixelization(6), _weightsUpToDate(false), _sumOfWeights(0) {
+	ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _blockFill(0), _lastPid(0), _lastEnergyIdx(0), _lastSlot(-1), _pixelization(6), _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _sumOfWeights(0), _weightsUpToDate(false) {
 	}
 	/** Destructor.
 	 */
@@ -79,6 +100,18 @@ public:
 	*/
 	void addParticle(const int particleId, double energy, const Vector3d &v, double weight = 1);
 
+	/** Adds n particles to the map container, see addParticle.
+	 @param n					number of particles
+	 @param particleIds			ids of the particles
+	 @param energies			energies of the particles [in Joules]
+	 @param galacticLongitudes	galactic longitudes [radians]
+	 @param galacticLatitudes	galactic latitudes [radians]
+	 @param weights				relative weights, NULL for weight 1
+	*/
+	void addParticles(size_t n, const int *particleIds, const double *energies,
+		const double *galacticLongitudes, const double *galacticLatitudes,
+		const double *weights = NULL);
+
 	/** Get all particle ids in the map.
 	 @returns Vector of all ids.
 	 */
@@ -104,6 +137,14 @@ public:
 		vector<double> &energy, vector<double> &galacticLongitudes,
 		vector<double> &galacticLatitudes);
 
+	/** Get N random particles into arrays of length N, see getRandomParticles.
+	 The particle, energy and pixel are drawn in O(1) from alias tables,
+	 the directions in the pixels are computed in parallel. The result
+	 does not depend on the number of threads.
+	 */
+	void getRandomParticles(size_t N, int *particleIds, double *energies,
+		double *galacticLongitudes, double *galacticLatitudes);
+
 	/** Places a particle with given id and energy according to the  probability maps. 
 	 @param pid					id of the particle following the PDG numbering scheme
 	 @param energy				energy of interest [in eV]
@@ -132,11 +173,7 @@ public:
 	 @param energy				energy of interest [in eV]
 	 @returns Weight for the chosen particle and energy.
 	 */
-	double getWeight(int pid, double energy) {
-		if (!_weightsUpToDate)
-			_updateWeights();
-		return _weights_pidEnergy[pid][energy2Idx(energy)];
-	}
+	double getWeight(int pid, double energy);
 };
 /** @}*/
 
@@ -27,6 +27,7 @@
 #include "healpix_base/healpix_base.h"
 #include <cmath>
 #include <stdint.h>
+#include <vector>
 
 namespace crpropa
 {
@@ -80,6 +81,13 @@ public:
 	/// phi in [-pi, pi], theta in [-pi/2, pi/2]
 	uint32_t direction2Pix(double longitude, double latitude) const;
 
+	/// Returns the number of the pixel which includes the direction of the
+	/// vector (x, y, z), which does not need to be normalized
+	uint32_t vector2Pix(double x, double y, double z) const;
+
+	/// Pixels of n directions, in parallel
+	void direction2Pix(size_t n, const double *longitudes, const double *latitudes, uint32_t *pixels) const;
+
 	/// Returns the number of pixels of the pixelization
 	uint32_t nPix() const
 	{
@@ -102,6 +110,21 @@ public:
 	/// Gives the center of pixel i in longitude [rad] and latitude [rad]
 	void pix2Direction(uint32_t i, double &longitude, double &latitude) const;
 
+	/// Centers of n pixels, in parallel
+	void pix2Direction(size_t n, const uint32_t *pixels, double *longitudes, double *latitudes) const;
+
+	/// Unit vector to the center of pixel i
+	void pix2Vector(uint32_t i, double &x, double &y, double &z) const;
+
+	/// Precompute the centers of all pixels, used by pix2Direction,
+	/// pix2Vector and angularDistance afterwards. Needs 40 bytes per pixel,
+	/// call before using the pixelization in several threads.
+	void cacheGeometry();
+	bool isGeometryCached() const
+	{
+		return !_centers.empty();
+	}
+
 	/// Calculate the angle [rad] between the vectors pointing to pixels i and j
 	double angularDistance(uint32_t i, uint32_t j) const;
 
@@ -119,6 +142,12 @@ public:
 
 	void getRandomDirectionInPixel(uint32_t pixel, double &longitude, double &latitude);
 
+	/// Number of sub pixels of the finest healpix order in a pixel
+	uint64_t getNumberOfSubPixels() const;
+	/// Direction of the sub pixel [0, getNumberOfSubPixels()) in pixel i,
+	/// thread safe, getRandomDirectionInPixel with a given random number
+	void getDirectionInPixel(uint32_t pixel, uint64_t subPixel, double &longitude, double &latitude) const;
+
 	void getPixelsInCone(double longitude, double latitude,double radius, std::vector<int>& listpix)
 	{
 		healpix::vec3 v;
@@ -132,6 +161,8 @@ private:
 	void spherCo2Vec(double phi, double theta, healpix::vec3 &V) const;
 	void vec2SphereCo(double &phi , double &theta, const healpix::vec3 &V) const;
 	healpix::T_Healpix_Base<int> *_healpix;
+	// cached pixel centers: x, y, z, longitude, latitude
+	std::vector<double> _centers;
 	static healpix::T_Healpix_Base<healpix::int64> _healpix_nest;
 };
 
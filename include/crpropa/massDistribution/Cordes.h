@@ -29,6 +29,9 @@ public:
 	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
 	 @return density of nucleons in parts/m^3, equal getDensity thus only HII is included for Cordes */
 	double getNucleonDensity(const Vector3d &position) const;
+	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
+	 @return all densities in parts/m^3, the HII density is computed once */
+	DensityValues getDensities(const Vector3d &position) const;
 
 	/** @return activation status of HI */
 	bool getIsForHI();
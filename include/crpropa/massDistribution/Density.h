@@ -7,6 +7,20 @@
 
 namespace crpropa {
 
+/**
+ @struct DensityValues
+ @brief Densities of all species at a position, see Density::getDensities
+ */
+struct DensityValues {
+	double HI;  ///< atomic hydrogen [1/m^3]
+	double HII;  ///< ionised hydrogen [1/m^3]
+	double H2;  ///< molecular hydrogen [1/m^3]
+	double total;  ///< sum of the activated species, as getDensity
+	double nucleon;  ///< nucleons of the activated species, as getNucleonDensity
+	DensityValues() : HI(0), HII(0), H2(0), total(0), nucleon(0) {
+	}
+};
+
 /**
  @class Density
  @brief Abstract base class for target densities
@@ -36,6 +50,25 @@ public:
 		return 0;
 	}
 
+	/** All densities at a position in one call. The models override it to
+	 share the coordinate transformations between the species. */
+	virtual DensityValues getDensities(const Vector3d &position) const {
+		DensityValues n;
+		n.HI = getHIDensity(position);
+		n.HII = getHIIDensity(position);
+		n.H2 = getH2Density(position);
+		n.total = getDensity(position);
+		n.nucleon = getNucleonDensity(position);
+		return n;
+	}
+
+	/** Total density at n positions given as flat arrays, in parallel with OpenMP.
+	 @param xyz		array of 3 n coordinates (x, y, z of each position)
+	 @param out		array of n densities to fill
+	 @param n		number of positions
+	 */
+	void getDensitiesAt(const double *xyz, double *out, size_t n) const;
+
 	virtual bool getIsForHI() {
 		return false;
 	}
@@ -24,6 +24,14 @@ private:
 	bool isforH2 = true;
 	double Rsun = 8.5 * kpc;  // distance sun-galactic center
 
+	// HI and H2 for R < 3 kpc from the coordinates of the CMZ and the disk
+	double getInnerHIDensity(const Vector3d &cmz, const Vector3d &disk) const;
+	double getInnerH2Density(const Vector3d &cmz, const Vector3d &disk) const;
+	// HI, HII and H2 at galactocentric radius R
+	double getOuterHIDensity(double R, double z) const;
+	double getOuterH2Density(double R, double z) const;
+	double getHIIDensity(const Vector3d &position, double R) const;
+
 public:
 	/** Coordinate transformation for the CentralMolecularZone region. Rotation arround z-axis such that X is the major axis and Y is the minor axis
 	@param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
@@ -52,6 +60,9 @@ public:
 	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
 	 @return nucleon density in parts/m^3, only activated parts are summed up and H2 is weighted twice */
 	double getNucleonDensity(const Vector3d &position) const;
+	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
+	 @return all densities, with one coordinate transformation for HI and H2 */
+	DensityValues getDensities(const Vector3d &position) const;
 
 	/** changes activation status for atomic hydrogen */
 	void setIsForHI(bool HI);
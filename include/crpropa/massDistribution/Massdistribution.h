@@ -4,6 +4,7 @@
 #include "crpropa/massDistribution/Density.h"
 #include "crpropa/Vector3.h"
 #include "crpropa/Grid.h"
+#include "crpropa/NestedGrid.h"
 
 #include "kiss/logger.h"
 
@@ -53,25 +54,34 @@ public:
 	 @returns Density of nucleons at given position in particles/m^3, sum up all nucleon densities from added densities 
 	 */
 	double getNucleonDensity(const Vector3d &position) const;
+	/** Get all densities in one call of each added density.
+	 @param position position in Galactic coordinates with Earth at (-8.5 kpc, 0, 0)
+	 @returns Densities at given position in particles/m^3, sum up the densities from added densities
+	 */
+	DensityValues getDensities(const Vector3d &position) const;
 
 	std::string getDescription();
 };
 
 /**
  @class DensityGrid
- @brief Wrapper to use a Grid1f for a density
+ @brief Wrapper to use a Grid1f or a NestedGrid1f for a density
 
  The DensityGrid uses a given grid for the chosen density type. More than one type can be chosen to follow the same distribution.
  If no type is chosen a warning will be raised and all densities are 0.
+ With a NestedGrid1f the density is interpolated from the finest grid covering a position.
 */
 class DensityGrid: public Density {
 private: 
 	ref_ptr<Grid1f> grid; //< Grid with data
+	ref_ptr<NestedGrid1f> nestedGrid; //< Nested grid with data, used instead of grid if set
 	bool isForHI, isForHII, isForH2; 
 	void checkAndWarn(); //< raise a warning if all density types are deactivated.
+	double interpolate(const Vector3d &position) const;
 
 public:
 	DensityGrid(ref_ptr<Grid1f> grid, bool isForHI = false, bool isForHII = false, bool isForH2 = false);
+	DensityGrid(ref_ptr<NestedGrid1f> grid, bool isForHI = false, bool isForHII = false, bool isForH2 = false);
 	
 	/** Get HI density at a given position.
 	 @param position position in Galactic coordinates with Earth at (-8.5 kpc, 0, 0)
@@ -104,6 +114,12 @@ public:
 	 */
 	double getNucleonDensity(const Vector3d &position) const;
 
+	/** Get all densities with one interpolation of the grid.
+	 @param position position in Galactic coordinates with Earth at (-8.5 kpc, 0, 0)
+	 @returns Densities at given position in particles/m^3
+	 */
+	DensityValues getDensities(const Vector3d &position) const;
+
 	bool getIsForHI();
 	bool getIsForHII();
 	bool getIsForH2();
@@ -128,6 +144,11 @@ public:
 	*/
 	void setGrid(ref_ptr<Grid1f> grid);
 
+	/* Change the grid for the density to a nested grid
+	 @param grid (NestedGrid1f) new grid for the density.
+	*/
+	void setGrid(ref_ptr<NestedGrid1f> grid);
+
 	std::string getDescription();
 };
 
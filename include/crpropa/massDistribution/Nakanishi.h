@@ -20,6 +20,10 @@ private:
 	bool isforHII = false;
 	bool isforH2 = true;
 
+	// HI and H2 density at galactocentric radius R
+	double getHIDensity(double R, double z) const;
+	double getH2Density(double R, double z) const;
+
 public:
 	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
 	 @returns density in parts/m^3, only activated parts are summed up */
@@ -33,6 +37,9 @@ public:
 	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
 	 @returns nucleon density in parts/m^3, only activated parts are summed up and H2 is weighted twice */
 	double getNucleonDensity(const Vector3d &position) const;
+	/** @param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
+	 @returns all densities in parts/m^3, the radius is computed once */
+	DensityValues getDensities(const Vector3d &position) const;
 
 	/** the scale height over the galactic plane of atomic hydrogen is fitted by polynom of degree 3
 	@param position position in galactic coordinates with Earth at (-8.5kpc, 0, 0)
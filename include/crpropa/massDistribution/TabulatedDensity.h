@@ -0,0 +1,96 @@
+#ifndef CRPROPA_TABULATEDDENSITY_H
+#define CRPROPA_TABULATEDDENSITY_H
+
+#include "crpropa/massDistribution/Density.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ @class TabulatedDensity
+ @brief Fast evaluation of a density model from a table.
+
+ The total, HI, HII, H2 and nucleon densities of a density model are sampled
+ in one pass onto a Cartesian or a cylindrical (R, phi, z) grid around the
+ z-axis, in parallel. Lookups inside the grid are interpolated trilinearly,
+ outside of it the model is evaluated. After sampling, every cell is checked
+ at its center: if an interpolated density deviates from the model by more
+ than relativeError * density + absoluteError, the model is evaluated in this
+ cell instead. The table can be saved and loaded, loading requires the same
+ model for the cells and positions evaluated exactly.
+ */
+class TabulatedDensity: public Density {
+public:
+	enum Geometry {
+		Cartesian, Cylindrical
+	};
+
+private:
+	ref_ptr<Density> density;
+	double relativeError, absoluteError;
+	Geometry geometry;
+	size_t n[3]; // nodes per axis, phi is periodic
+	double lower[3], upper[3], spacing[3];
+	std::vector<float> values; // 5 densities per node
+	std::vector<uint8_t> exact; // cells evaluated with the model
+
+	// coordinates of the grid of a position
+	void coordinates(const Vector3d &position, double u[3]) const;
+	Vector3d position(const double u[3]) const;
+	size_t node(size_t i, size_t j, size_t k) const;
+	size_t cells(size_t axis) const;
+	void evaluate(const Vector3d &position, double v[5]) const;
+	// interpolated density q, false if the model has to be used
+	bool interpolate(const Vector3d &position, int q, double &value) const;
+	bool interpolate(const double u[3], double v[5]) const;
+	// all interpolated densities, false if the model has to be used
+	bool interpolate(const Vector3d &position, double v[5]) const;
+	void setGrid(Geometry geometry, const double lower[3], const double upper[3], const size_t n[3]);
+	void tabulate();
+
+public:
+	/** Constructor
+	 @param density			density model to tabulate
+	 @param relativeError	maximum relative deviation of the interpolation
+	 @param absoluteError	additional absolute deviation [1/m^3]
+	 */
+	TabulatedDensity(ref_ptr<Density> density, double relativeError = 0.01, double absoluteError = 0);
+
+	/** Sample the model on a Cartesian grid of nx * ny * nz nodes (at least 2 per axis)
+	 in the box from origin to origin + size */
+	void tabulateCartesian(const Vector3d &origin, const Vector3d &size, size_t nx, size_t ny, size_t nz);
+	/** Sample the model on a cylindrical grid with nR nodes in [0, rMax],
+	 nPhi in [-pi, pi) and nZ in [zMin, zMax] */
+	void tabulateCylindrical(double rMax, double zMin, double zMax, size_t nR, size_t nPhi, size_t nZ);
+
+	/** Write the table to a binary file */
+	void save(const std::string &filename) const;
+	/** Read a table written by save, throws std::runtime_error if it cannot be read */
+	void load(const std::string &filename);
+
+	/** Number of grid nodes */
+	size_t getNumberOfNodes() const;
+	/** Fraction of the cells evaluated with the model */
+	double getExactFraction() const;
+
+	double getDensity(const Vector3d &position) const;
+	double getHIDensity(const Vector3d &position) const;
+	double getHIIDensity(const Vector3d &position) const;
+	double getH2Density(const Vector3d &position) const;
+	double getNucleonDensity(const Vector3d &position) const;
+	/** All densities with one interpolation */
+	DensityValues getDensities(const Vector3d &position) const;
+
+	bool getIsForHI();
+	bool getIsForHII();
+	bool getIsForH2();
+
+	std::string getDescription();
+};
+
+}  // namespace crpropa
+
+#endif  // CRPROPA_TABULATEDDENSITY_H
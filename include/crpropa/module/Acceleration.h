@@ -25,6 +25,32 @@ class StepLengthModifier : public Referenced {
 	///						included in the calculation of the updated
 	///						step length.
 	virtual double modify(double steplength, Candidate *candidate) = 0;
+	/// Updates the step lengths of n candidates at once, by default modify
+	/// is called for every candidate.
+	/// @param steplengths	array of n step lengths, modified in place
+	/// @param candidates	array of n candidates
+	/// @param n			number of candidates
+	virtual void modifyBatch(double *steplengths, Candidate **candidates, size_t n);
+	/// True if modify does not depend on the candidate. Constant modifiers
+	/// which are added before any other are folded into the step length of
+	/// the acceleration module.
+	virtual bool isConstant() const {
+		return false;
+	}
+};
+
+
+/// @class StepLengthScaling
+/// @brief Scales the steplength of an acceleration module by a constant factor.
+class StepLengthScaling : public StepLengthModifier {
+	double factor;
+  public:
+	/** Constructor
+	 * @param factor	factor of the step length
+	*/
+	StepLengthScaling(double factor);
+	double modify(double steplength, Candidate *candidate);
+	bool isConstant() const;
 };
 
 
@@ -34,6 +60,9 @@ class StepLengthModifier : public Referenced {
 /// @details The velocity field is implicity implemented in the derived classes
 ///  for performance reasons. Models for the dependence of the step length of
 ///  the scatter process are set via modifiers.
+///  A batch of candidates (see Module::processBatch) is scattered together:
+///  the step lengths, random numbers, scatter center velocities and Lorentz
+///  boosts are computed in arrays over the candidates which scatter next.
 class AbstractAccelerationModule : public Module {
 	double stepLength;
 	std::vector<ref_ptr<StepLengthModifier>> modifiers;
@@ -43,12 +72,21 @@ class AbstractAccelerationModule : public Module {
 	AbstractAccelerationModule(double _stepLength = 1. * parsec);
 	// add a step length modifier to the model
 	void add(StepLengthModifier *modifier);
+	/// Step length with the leading constant modifiers applied
+	double getStepLength() const;
+	/// Number of modifiers evaluated per candidate
+	size_t getNumberOfModifiers() const;
 	// update the candidate
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 
 	/// Returns the velocity vector of the scatter centers in the rest frame of
 	/// the candidate. Needs to be implemented in inheriting classes.
 	virtual Vector3d scatterCenterVelocity(Candidate *candidate) const = 0;
+	/// Velocities of the scatter centers of n candidates at once, by default
+	/// scatterCenterVelocity is called for every candidate.
+	virtual void scatterCenterVelocities(Candidate **candidates,
+	                                     Vector3d *velocities, size_t n) const;
 
 	/// Scatter the candidate with a center with given scatter center
 	/// velocity into a random direction. Assumes that the
@@ -77,6 +115,8 @@ class SecondOrderFermi : public AbstractAccelerationModule {
 	                 unsigned int sizeOfPitchangleTable = 10000);
 	virtual crpropa::Vector3d
 	scatterCenterVelocity(crpropa::Candidate *candidate) const;
+	void scatterCenterVelocities(Candidate **candidates, Vector3d *velocities,
+	                             size_t n) const;
 };
 
 
@@ -99,6 +139,8 @@ class DirectedFlowScattering : public AbstractAccelerationModule {
 	                       double stepLength = 1. * parsec);
 	virtual crpropa::Vector3d
 	scatterCenterVelocity(crpropa::Candidate *candidate) const;
+	void scatterCenterVelocities(Candidate **candidates, Vector3d *velocities,
+	                             size_t n) const;
 };
 
 
@@ -116,6 +158,7 @@ class DirectedFlowOfScatterCenters : public StepLengthModifier {
   */
 	DirectedFlowOfScatterCenters(const Vector3d &scatterCenterVelocity);
 	double modify(double steplength, Candidate *candidate);
+	void modifyBatch(double *steplengths, Candidate **candidates, size_t n);
 };
 
 
@@ -155,6 +198,7 @@ class QuasiLinearTheory : public StepLengthModifier {
 	                  double turbulenceIndex = 5. / 3,
 	                  double minimumRigidity = 0);
 	double modify(double steplength, Candidate *candidate);
+	void modifyBatch(double *steplengths, Candidate **candidates, size_t n);
 };
 
 
@@ -23,12 +23,18 @@ namespace crpropa {
 /**
 @class AdiabaticCooling
 @brief Implements adiabatic cooling/heating due to advection.
+
+With setExactLoss the energy change dE/dt = -E/3 div(V) is integrated over
+the step, E' = E exp(-div(V)/3 dt), instead of the linear approximation.
+A batch of candidates (see Module::processBatch) takes the divergences at
+all positions in one call of AdvectionField::getDivergences.
 */
 
 class AdiabaticCooling: public Module {
 private:
 	ref_ptr<AdvectionField> advectionField;
 	double limit;
+	bool exactLoss;
 
 public:
 	/** Default constructor.
@@ -41,10 +47,14 @@ public:
 	 */
 	AdiabaticCooling(ref_ptr<AdvectionField> advectionField, double limit);
 	void process(Candidate *c) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 
 	void setLimit(double l);
+	/** Integrate the energy change over the step instead of the linear approximation */
+	void setExactLoss(bool exact);
 
 	double getLimit() const;
+	bool getExactLoss() const;
 
 };
 /** @}*/
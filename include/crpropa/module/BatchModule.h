@@ -0,0 +1,65 @@
+#ifndef CRPROPA_BATCHMODULE_H
+#define CRPROPA_BATCHMODULE_H
+
+#include "crpropa/Module.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class CandidateArrays
+ @brief Current states of a block of candidates as structure of arrays.
+
+ Positions and directions hold x, y, z of each candidate consecutively. In
+ Python, the arrays are exposed as NumPy views (getEnergy(), getPosition(),
+ ...) which are valid during BatchModule.processCandidates only.
+ */
+class CandidateArrays: public Referenced {
+public:
+	std::vector<int> id;
+	std::vector<double> energy; ///< [Joule]
+	std::vector<double> position; ///< [m], 3 per candidate
+	std::vector<double> direction; ///< 3 per candidate
+	std::vector<double> weight;
+	std::vector<double> step; ///< current step [m], not written back
+	std::vector<uint8_t> active;
+
+	size_t size() const;
+	void resize(size_t n);
+	/** Copy the current states of n candidates */
+	void gather(Candidate **candidates, size_t n);
+	/** Write the states back to the candidates, the id is only set if it changed */
+	void scatter(Candidate **candidates, size_t n) const;
+};
+
+/**
+ @class BatchModule
+ @brief Base class for modules processing blocks of candidates at once.
+
+ The current states of the candidates are copied into CandidateArrays,
+ passed to processCandidates and written back. This is meant for modules
+ implemented in Python: the module is called once per block instead of once
+ per candidate, so the GIL is taken once per block. Use it with
+ ModuleList::setBatchSize to receive the candidates of a batch together,
+ otherwise every call passes a single candidate.
+ */
+class BatchModule: public Module {
+public:
+	/** Modify the states of a block of candidates
+	 @param candidates	states of the candidates, modified in place
+	 */
+	virtual void processCandidates(CandidateArrays &candidates) const = 0;
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_BATCHMODULE_H
@@ -0,0 +1,113 @@
+#ifndef CRPROPA_BINARYOUTPUT_H
+#define CRPROPA_BINARYOUTPUT_H
+
+#include "crpropa/CandidateStream.h"
+#include "crpropa/Module.h"
+#include "crpropa/OrderedRecords.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include <fstream>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class BinaryOutput
+ @brief Compact binary output of the full candidate state, which can be loaded quickly.
+
+ Every candidate is stored as one fixed size record in SI units with the
+ trajectory length, redshift, weight, the serial numbers and the id, energy,
+ position and direction of the current, source and created state. Tags and
+ properties are not stored. The records are written in the byte order of
+ the machine after a header with the magic string "CRPROPAB" and the record
+ size.
+
+ As the records have a fixed size, load() maps the file into memory and
+ creates the candidates without any parsing, which is orders of magnitude
+ faster than TextOutput::load. This is useful to restart a multi-stage
+ simulation, e.g. the galactic propagation of extragalactic events.
+ */
+class BinaryOutput: public Module {
+public:
+	/** Record of one candidate in the file */
+	struct Record {
+		double trajectoryLength;
+		double redshift;
+		double weight;
+		uint64_t serialNumber[3]; ///< current, source, created
+		int32_t id[3]; ///< current, source, created
+		int32_t padding;
+		double energy[3];
+		double position[3][3];
+		double direction[3][3];
+	};
+
+	/** Constructor
+	 @param filename	name of the output file
+	 */
+	BinaryOutput(const std::string &filename);
+	~BinaryOutput();
+
+	void process(Candidate *candidate) const;
+	/** Write the records in the order of the serial numbers, merged from
+	 sorted runs of the threads on close(), see TextOutput::setOrdered.
+	 @param ordered	enable the ordered output
+	 @param runSize	number of records buffered per thread before they are written to a temporary file
+	 */
+	void setOrdered(bool ordered = true, size_t runSize = 65536);
+	bool getOrdered() const;
+	/** Number of candidates written */
+	size_t size() const;
+	void close();
+	std::string getDescription() const;
+
+	/** Check if the file starts with the header of a BinaryOutput */
+	static bool isBinaryFile(const std::string &filename);
+	/** Loads a file to a particle collector.
+	 @param filename	name of the binary file
+	 @param collector	object of type ParticleCollector that will store the candidates
+	 */
+	static void load(const std::string &filename, ParticleCollector *collector);
+
+	/** Fill a record with the state of a candidate */
+	static void toRecord(const Candidate *candidate, Record &record);
+	/** Create a candidate from a record */
+	static ref_ptr<Candidate> fromRecord(const Record &record);
+
+private:
+	mutable std::ofstream out;
+	std::string filename;
+	mutable size_t count;
+	OrderedRecords *ordered;
+};
+
+/**
+ @class BinaryStream
+ @brief Stream of the candidates of a BinaryOutput file, read in chunks.
+
+ Unlike BinaryOutput::load, only the records of the requested chunk are held
+ in memory, for inputs of ModuleList::run(CandidateStream*) larger than the
+ memory.
+ */
+class BinaryStream: public CandidateStream {
+	std::ifstream in;
+	std::string filename;
+	size_t count, position;
+	std::vector<BinaryOutput::Record> records;
+public:
+	/** Open a BinaryOutput file, throws std::runtime_error if it cannot be read */
+	BinaryStream(const std::string &filename);
+	/** Number of candidates in the file */
+	size_t size() const;
+	std::vector<ref_ptr<Candidate> > next(size_t n);
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_BINARYOUTPUT_H
@@ -32,6 +32,7 @@ public:
 	 */
 	PeriodicBox(Vector3d origin, Vector3d size);
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 	void setOrigin(Vector3d origin);
 	void setSize(Vector3d size);
 	std::string getDescription() const;
@@ -60,6 +61,7 @@ public:
 	 */
 	ReflectiveBox(Vector3d origin, Vector3d size);
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 	void setOrigin(Vector3d origin);
 	void setSize(Vector3d size);
 	std::string getDescription() const;
@@ -72,6 +74,8 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setDirectionAware, the step of neutral particles, which move on straight lines,
+ is limited by the distance to the boundary along their direction instead of the closest distance.
  */
 class CubicBoundary: public AbstractCondition {
 private:
@@ -79,6 +83,7 @@ private:
 	double size;
 	double margin;
 	bool limitStep;
+	bool directionAware;
 
 public:
 	/** Default constructor
@@ -90,10 +95,18 @@ public:
 	 */
 	CubicBoundary(Vector3d origin, double size);
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+	double getStepLimit(const Candidate *candidate) const;
 	void setOrigin(Vector3d origin);
 	void setSize(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	void setDirectionAware(bool directionAware);
+	Vector3d getOrigin() const;
+	double getSize() const;
+	double getMargin() const;
+	bool getLimitStep() const;
+	bool getDirectionAware() const;
 	std::string getDescription() const;
 };
 
@@ -104,6 +117,7 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setDirectionAware, the step of neutral particles is limited by the distance to the sphere along their direction.
  */
 class SphericalBoundary: public AbstractCondition {
 private:
@@ -111,6 +125,7 @@ private:
 	double radius;
 	double margin;
 	bool limitStep;
+	bool directionAware;
 
 public:
 	/** Default constructor
@@ -122,10 +137,18 @@ public:
 	 */
 	SphericalBoundary(Vector3d center, double radius);
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+	double getStepLimit(const Candidate *candidate) const;
 	void setCenter(Vector3d center);
 	void setRadius(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	void setDirectionAware(bool directionAware);
+	Vector3d getCenter() const;
+	double getRadius() const;
+	double getMargin() const;
+	bool getLimitStep() const;
+	bool getDirectionAware() const;
 	std::string getDescription() const;
 };
 
@@ -200,6 +223,56 @@ public:
 	void setLimitStep(bool limitStep);
 	std::string getDescription() const;
 };
+
+/**
+ @class SimulationDomain
+ @brief Periodic wrapping, boundary and step limit of the simulation volume in one module.
+
+ Replaces a PeriodicBox followed by a CubicBoundary or SphericalBoundary:
+ the current position is read once, wrapped into the periodic box (moving
+ the other states as PeriodicBox does) and compared with the boundary in
+ the wrapped coordinates. Candidates outside the boundary are rejected, the
+ next step is limited to the distance to the boundary plus the margin (along
+ the direction for neutral particles with setDirectionAware). Both parts
+ are optional; without a boundary the module only wraps the positions.
+ */
+class SimulationDomain: public AbstractCondition {
+public:
+	enum Shape {
+		NoBoundary, Cube, Sphere
+	};
+private:
+	bool periodic;
+	Vector3d periodicOrigin, periodicSize;
+	Shape shape;
+	Vector3d origin; // lower corner of the cube or center of the sphere
+	double size; // edge of the cube or radius of the sphere
+	double margin;
+	bool limitStep;
+	bool directionAware;
+
+	void wrap(Candidate *candidate, const Vector3d &shift) const;
+	double boundaryDistance(const Vector3d &position, const Candidate *candidate) const;
+public:
+	SimulationDomain();
+	/** Wrap the positions into the box as PeriodicBox */
+	void setPeriodicBox(Vector3d origin, Vector3d size);
+	/** Reject candidates outside the cube as CubicBoundary */
+	void setCubicBoundary(Vector3d origin, double size);
+	/** Reject candidates outside the sphere as SphericalBoundary */
+	void setSphericalBoundary(Vector3d center, double radius);
+	/** Remove the periodic box and the boundary */
+	void clear();
+	Shape getShape() const;
+	bool isPeriodic() const;
+	void setMargin(double margin);
+	void setLimitStep(bool limitStep);
+	void setDirectionAware(bool directionAware);
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+	double getStepLimit(const Candidate *candidate) const;
+	std::string getDescription() const;
+};
 /** @}*/
 
 } // namespace crpropa
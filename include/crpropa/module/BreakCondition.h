@@ -9,6 +9,8 @@ namespace crpropa {
  * @{
  */
 
+class ConditionList;
+
 /**
  @class MaximumTrajectoryLength
  @brief Deactivates the candidate beyond a maximum trajectory length
@@ -20,6 +22,7 @@ namespace crpropa {
 class MaximumTrajectoryLength: public AbstractCondition {
 	double maxLength;
 	std::vector<Vector3d> observerPositions;
+	friend class ConditionList;
 public:
 	MaximumTrajectoryLength(double length = 0);
 	void setMaximumTrajectoryLength(double length);
@@ -28,6 +31,7 @@ public:
 	const std::vector<Vector3d>& getObserverPositions() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 };
 
 /**
@@ -39,12 +43,14 @@ public:
  */
 class MinimumEnergy: public AbstractCondition {
 	double minEnergy;
+	friend class ConditionList;
 public:
 	MinimumEnergy(double minEnergy = 0);
 	void setMinimumEnergy(double energy);
 	double getMinimumEnergy() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 };
 
 
@@ -57,6 +63,7 @@ public:
  */
 class MinimumRigidity: public AbstractCondition {
 	double minRigidity;
+	friend class ConditionList;
 public:
 	MinimumRigidity(double minRigidity = 0);
 	void setMinimumRigidity(double minRigidity);
@@ -74,6 +81,7 @@ public:
  */
 class MinimumRedshift: public AbstractCondition {
 	double zmin;
+	friend class ConditionList;
 public:
 	MinimumRedshift(double zmin = 0);
 	void setMinimumRedshift(double z);
@@ -93,6 +101,7 @@ public:
  */
 class MinimumChargeNumber: public AbstractCondition {
 	int minChargeNumber;
+	friend class ConditionList;
 public:
 	MinimumChargeNumber(int minChargeNumber = 0);
 	void setMinimumChargeNumber(int chargeNumber);
@@ -138,6 +147,32 @@ public:
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
 };
+
+/**
+ @class ConditionList
+ @brief Evaluates several conditions in one module
+
+ The conditions are evaluated in the order they were added, as in a
+ ModuleList. The candidate state is read once for the maximum trajectory
+ length (without observer positions), minimum energy, rigidity, redshift and
+ charge number conditions, which are compared in place and only processed
+ when they reject. Other conditions are processed as usual. The evaluation
+ stops at the first condition that deactivates the candidate, inactive
+ candidates are skipped. Flags and actions are those of the conditions.
+ */
+class ConditionList: public Module {
+	enum Kind {
+		Generic, TrajectoryLength, Energy, Rigidity, Redshift, ChargeNumber
+	};
+	std::vector<ref_ptr<AbstractCondition> > conditions;
+	std::vector<Kind> kinds;
+public:
+	void add(AbstractCondition *condition);
+	size_t size() const;
+	std::string getDescription() const;
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+};
 /** @}*/
 
 } // namespace crpropa
@@ -12,6 +12,9 @@
 #include "crpropa/Units.h"
 #include "kiss/logger.h"
 
+#include <stdint.h>
+#include <vector>
+
 
 namespace crpropa {
 /** @addtogroup Acceleration
@@ -22,13 +25,23 @@ namespace crpropa {
 @class CandidateSplitting
 @brief Candidates are split into n copies when they gain energy and cross specified energy bins. Weights are set accordingly.
 		In case of Diffusice Shock Acceleration, splitting number can be adapted to expected spectral index to 
-		compensate for the loss of particles per magnitude in energy
+		compensate for the loss of particles per magnitude in energy.
+		With population control, the number of candidates entering each energy bin is bounded:
+		candidates are split until a target number has entered a bin, afterwards a candidate
+		survives the crossing only with probability target / entries and its weight is raised
+		accordingly (Russian roulette), so that the weight is conserved on average.
 */
 class CandidateSplitting: public Module {
 private:
 	double nSplit;
 	double minWeight;
 	std::vector<double> Ebins;
+	uint64_t target; // candidates per bin with population control, 0 if off
+	mutable std::vector<uint64_t> entries; // candidates that entered a bin
+
+	void split(Candidate *c, int n, double currE) const;
+	// false if the candidate did not survive
+	bool control(Candidate *c, size_t bin, double currE) const;
 
 public:
 
@@ -61,6 +74,17 @@ public:
 
 	void setMinimalWeight(double w);
 
+	/** Bound the number of candidates per energy bin
+	 @param target	number of candidates entering a bin. Splitting stops beyond it and
+					Russian roulette thins the further candidates, 0 switches it off
+	 */
+	void setPopulationControl(uint64_t target);
+	uint64_t getPopulationControl() const;
+	/** Number of candidates which entered the bin above Ebins[i], counted with population control */
+	uint64_t getPopulation(size_t i) const;
+	/** Restart the counting of the candidates per bin */
+	void resetPopulation();
+
 	int getNsplit() const;
 
 	double getMinimalWeight() const;
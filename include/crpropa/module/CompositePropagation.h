@@ -0,0 +1,85 @@
+#ifndef CRPROPA_COMPOSITEPROPAGATION_H
+#define CRPROPA_COMPOSITEPROPAGATION_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Geometry.h"
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class CompositePropagation
+ @brief Chooses the propagation module for each step.
+
+ Before each step one of the added propagation modules is selected for the
+ candidate, in this order:
+ - the module of the first added region containing the position (distance < 0),
+ - the weak field module, if the field strength at the position is below the
+   minimum field strength or the Larmor radius E / (|q| c B) is larger than
+   the given multiple of the proposed next step,
+ - the default module.
+ This allows e.g. PropagationCK near the sources and SimplePropagation or
+ PropagationBP in the voids in between.
+
+ Each module proposes the next step for its own algorithm. When the module
+ changes between two steps, the next step is limited to the last step, so
+ that an adaptive module starts from a step of the resolution reached so
+ far. The index of the module of the last step is stored in the candidate
+ property "PropagationIndex".
+ */
+class CompositePropagation: public Module {
+private:
+	struct Region {
+		ref_ptr<Surface> surface;
+		size_t index;
+	};
+	std::vector<ref_ptr<Module> > propagations; // 0: default
+	std::vector<Region> regions;
+	ref_ptr<MagneticField> field;
+	size_t weakFieldIndex; // 0: no weak field module
+	double minFieldStrength;
+	double larmorRatio;
+
+	size_t addPropagation(ref_ptr<Module> propagation);
+
+public:
+	/** Constructor
+	 @param propagation	default propagation module
+	 */
+	CompositePropagation(ref_ptr<Module> propagation);
+
+	/** Use a propagation module inside a region
+	 @param region		closed surface, the module is used where its distance is negative
+	 @param propagation	propagation module used inside
+	 */
+	void addRegion(ref_ptr<Surface> region, ref_ptr<Module> propagation);
+
+	/** Use a propagation module in weak fields
+	 @param propagation		propagation module for weak fields, e.g. SimplePropagation
+	 @param field			magnetic field to decide on, usually the field of the other modules
+	 @param minFieldStrength	field strength below which the module is used
+	 @param larmorRatio		if > 0, the module is also used where the Larmor radius
+	 						is larger than larmorRatio times the proposed next step
+	 */
+	void setWeakField(ref_ptr<Module> propagation, ref_ptr<MagneticField> field,
+			double minFieldStrength, double larmorRatio = 0);
+
+	/** Index of the propagation module for the next step of the candidate */
+	size_t select(const Candidate *candidate) const;
+	ref_ptr<Module> getPropagation(size_t i) const;
+	size_t size() const;
+
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_COMPOSITEPROPAGATION_H
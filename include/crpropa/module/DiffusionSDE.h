@@ -13,6 +13,7 @@
 #include "crpropa/advectionField/AdvectionField.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/Grid.h"
 
 #include "kiss/logger.h"
 
@@ -29,6 +30,17 @@ namespace crpropa {
  * Here an Euler-Mayurama integration scheme is used. The diffusion tensor
  * can be anisotropic with respect to the magnetic field line coordinates.
  * The integration of field lines is done via the CK-algorithm.
+ *
+ * A batch of candidates (see Module::processBatch) is stepped together:
+ * the field line integration runs in rounds over the candidates, and the
+ * field at the stages of all candidates in a round is gathered with one
+ * MagneticField::getFields call. With the same random numbers the result is
+ * the same as from process.
+ *
+ * For a heterogeneous medium the parallel and perpendicular diffusion
+ * coefficients at the reference rigidity of 4 GV can be read from scalar
+ * grids (setDiffusionGrids), which are interpolated at the start of each step.
+ * The rigidity scaling (setAlpha) and setScale apply to the grid values too.
  */
 
 
@@ -43,6 +55,18 @@ private:
 	    double epsilon; // ratio of parallel and perpendicular diffusion coefficient D_par = epsilon*D_perp
 	    double alpha; // power law index of the energy dependent diffusion coefficient: D\propto E^alpha
 	    double scale; // scaling factor for the diffusion coefficient D = scale*D_0
+	    ref_ptr<Grid1f> parallelGrid; // spatially varying D_par at 4 GV, replaces D_0
+	    ref_ptr<Grid1f> perpendicularGrid; // spatially varying D_perp at 4 GV, replaces epsilon*D_par
+
+	    struct Step;
+	    /** Draw the random numbers of a step, false for neutral candidates, which are propagated rectilinearly */
+	    bool beginStep(Candidate *candidate, Step &step) const;
+	    /** Error check of a tried field line step, false if accepted */
+	    bool retryStep(Step &step) const;
+	    /** Field line steps of n candidates, from the field at their start if newStart */
+	    void tryStepBatch(Step **steps, size_t n, bool newStart) const;
+	    /** Diffusion perpendicular to the field line, advection and the new direction */
+	    void finishStep(Step &step) const;
 
 public:
 	/** Constructor
@@ -64,8 +88,12 @@ public:
 	DiffusionSDE(ref_ptr<crpropa::MagneticField> magneticField, ref_ptr<crpropa::AdvectionField> advectionField, double tolerance = 1e-4, double minStep = 10 * pc, double maxStep = 1 * kpc, double epsilon = 0.1);
 
 	void process(crpropa::Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 
 	void tryStep(const Vector3d &Pos, Vector3d &POut, Vector3d &PosErr, double z, double propStep ) const;
+	/** Step with the first stage k0, the field direction at Pos times c_light,
+	 which is the same for all step sizes tried from Pos */
+	void tryStep(const Vector3d &Pos, const Vector3d &k0, Vector3d &POut, Vector3d &PosErr, double z, double propStep ) const;
 	void driftStep(const Vector3d &Pos, Vector3d &LinProp, double h) const;
 	void calculateBTensor(double rig, double BTen[], Vector3d pos, Vector3d dir, double z) const;
 
@@ -77,6 +105,12 @@ public:
 	void setScale(double Scale);
 	void setMagneticField(ref_ptr<crpropa::MagneticField> magneticField);
 	void setAdvectionField(ref_ptr<crpropa::AdvectionField> advectionField);
+	/** Spatially varying diffusion coefficients
+	 @param parallel		grid of the parallel diffusion coefficient at 4 GV in [m^2/s]
+	 @param perpendicular	grid of the perpendicular diffusion coefficient at 4 GV in [m^2/s];
+	 						if not given D_perp = epsilon*D_par
+	 */
+	void setDiffusionGrids(ref_ptr<Grid1f> parallel, ref_ptr<Grid1f> perpendicular = NULL);
 
 	double getMinimumStep() const;
 	double getMaximumStep() const;
@@ -84,6 +118,8 @@ public:
 	double getEpsilon() const;
 	double getAlpha() const;
 	double getScale() const;
+	ref_ptr<Grid1f> getParallelDiffusionGrid() const;
+	ref_ptr<Grid1f> getPerpendicularDiffusionGrid() const;
 	std::string getDescription() const;
   
   ref_ptr<MagneticField> getMagneticField() const;
@@ -92,6 +128,8 @@ public:
 	 @param z	 current redshift is needed to calculate the magnetic field
 	 @return	  magnetic field vector at the position pos */
 	Vector3d getMagneticFieldAtPosition(Vector3d pos, double z) const;
+	/** get magnetic field vectors at n positions with MagneticField::getFields, zero without a field */
+	void getMagneticFieldsAtPositions(const Vector3d *pos, Vector3d *B, size_t n, double z) const;
 	ref_ptr<AdvectionField> getAdvectionField() const;
 	/** get advection field vector at current candidate position
 	 @param pos   current position of the candidate
@@ -0,0 +1,107 @@
+#ifndef CRPROPA_EMCASCADE_H
+#define CRPROPA_EMCASCADE_H
+
+#include "crpropa/module/InteractionManager.h"
+#include "crpropa/Units.h"
+
+#include <vector>
+#include <mutex>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class EMCascade
+ @brief Semi-analytic 1D transport of electromagnetic cascades to the observer.
+
+ Instead of tracking every photon, electron and positron of a cascade, this
+ module collects them in a histogram in energy and distance to the observer
+ (at the origin, as for PhotonOutput1D) and deactivates them. run() then
+ evolves the collected spectra deterministically to the observer with the
+ transport equation
+   dN_i/dx = -R_i N_i + sum_j R_j Y_ji N_j
+ for the energy bins i of photons and electrons / positrons, where R_i is
+ the total interaction rate and Y_ji the mean number of particles in bin i
+ produced per interaction in bin j (including the surviving primary).
+
+ The rates and yields are obtained from the registered interaction modules
+ (e.g. EMPairProduction, EMInverseComptonScattering, EMDoublePairProduction,
+ EMTripletPairProduction, created with their secondaries enabled) through
+ Module::getInteractionRate and Module::interact, so the same interaction
+ tables are used as in the Monte Carlo tracking. The yields are sampled once,
+ with a number of interactions per energy bin, at a fixed redshift.
+ The equation is integrated with implicit Euler steps of the distance bin
+ width, from the highest to the lowest energy, which is stable for mean
+ free paths much shorter than the step.
+
+ Continuous energy losses, deflections and the redshift evolution during
+ the propagation are not included. Candidates outside the energy or
+ distance range are not collected and are left to the other modules.
+ */
+class EMCascade: public Module {
+private:
+	InteractionManager interactions;
+	double minEnergy, maxEnergy;
+	size_t nEnergy;
+	double maxDistance, step;
+	size_t nDistance;
+	size_t nSamples;
+	double redshift;
+
+	mutable std::mutex mutex;
+	mutable std::vector<double> injected; // [distance][species][energy], species 0: photons, 1: electrons
+	std::vector<double> observed; // [species][energy]
+
+	// total rates [species][energy] and yields [species][energy][species][energy]
+	std::vector<double> rates;
+	std::vector<double> yields;
+
+	int species(int id) const;
+	long index(int id, double E, double D) const;
+	void initYields();
+	void evolve(std::vector<double> &N, double dx) const;
+
+public:
+	/** Constructor
+	 @param minEnergy	lower edge of the energy range [J]
+	 @param maxEnergy	upper edge of the energy range [J]
+	 @param nEnergy		number of logarithmic energy bins
+	 @param maxDistance	maximum distance to the observer [m]
+	 @param step		width of the distance bins and integration step [m]
+	 */
+	EMCascade(double minEnergy = 1 * GeV, double maxEnergy = 1000 * EeV,
+			size_t nEnergy = 120, double maxDistance = 1000 * Mpc,
+			double step = 1 * Mpc);
+	/** Register a module providing Module::getInteractionRate and Module::interact */
+	void add(Module *interaction);
+	/** Number of sampled interactions per energy bin for the yields (default 1000) */
+	void setSamples(size_t nSamples);
+	/** Redshift of the interaction rates and yields (default 0) */
+	void setRedshift(double z);
+
+	/** Collect photons, electrons and positrons and deactivate them */
+	void process(Candidate *candidate) const;
+	/** Add particles of id, energy E [J] at distance D [m] with weight w */
+	void inject(int id, double E, double D, double w = 1);
+	/** Evolve the collected particles to the observer */
+	void run();
+	/** Remove the collected particles and the results */
+	void clear();
+
+	size_t getNumberOfEnergyBins() const;
+	/** Logarithmic center of the energy bin i [J] */
+	double getEnergy(size_t i) const;
+	/** Weighted number of photons (22) or electrons and positrons (11) per energy bin at the observer */
+	std::vector<double> getSpectrum(int id) const;
+	/** Total interaction rate in the energy bin i [1/m] */
+	double getRate(int id, size_t i);
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_EMCASCADE_H
@@ -6,6 +6,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/TableRegistry.h"
 
 namespace crpropa {
 /**
@@ -31,10 +32,11 @@ private:
 	double limit;
 	double thinning;
 	std::string interactionTag = "EMDP";
+	bool compactTables = false;			// single precision tables, see setCompactTables
+	double tableTolerance = 0;			// relative tolerance of the resampled rates
 
-	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
-	std::vector<double> tabRate;  //!< interaction rate in [1/m]
+	// tabulated interaction rate 1/lambda(E), shared between instances (TableRegistry)
+	ref_ptr<RateTable> rates;
 
 public:
 	/** Constructor
@@ -61,6 +63,14 @@ public:
 	 */
 	void setThinning(double thinning);
 	
+	/** Use compact tables with single precision values in contiguous arrays
+	 * instead of double precision tables, see RateTable and CumulativeRateTable
+	 * @param compact	use compact tables
+	 * @param tolerance	resample the interaction rate to the fewest nodes
+	 *					within this relative interpolation error (0: all nodes)
+	 */
+	void setCompactTables(bool compact, double tolerance = 0);
+
 	/** set a custom interaction tag to trace back this interaction
 	 * @param tag string that will be added to the candidate and output
 	 */
@@ -70,6 +80,10 @@ public:
 	void initRate(std::string filename);
 	void process(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate) const;
+	/** Interaction rate at the current state, see Module::getInteractionRate */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Same as performInteraction, see InteractionManager */
+	void interact(Candidate *candidate) const;
 };
 /** @}*/
 
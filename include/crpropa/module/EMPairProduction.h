@@ -5,7 +5,9 @@
 #include <cmath>
 
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/TableRegistry.h"
 
 
 namespace crpropa {
@@ -33,15 +35,13 @@ private:
 	double limit;						// limit the step to a fraction of the mean free path
 	double thinning;					// factor of the thinning (0: no thinning, 1: maximum thinning)
 	std::string interactionTag = "EMPP";
+	bool compactTables = false;			// single precision tables, see setCompactTables
+	double tableTolerance = 0;			// relative tolerance of the resampled rates
 
-	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
-	std::vector<double> tabRate;  //!< interaction rate in [1/m]
-	
-	// tabulated CDF(s_kin, E) = cumulative differential interaction rate
-	std::vector<double> tabE;  //!< electron energy in [J]
-	std::vector<double> tabs;  //!< s_kin = s - m^2 in [J**2]
-	std::vector< std::vector<double> > tabCDF;  //!< cumulative interaction rate
+	// tabulated interaction rate 1/lambda(E) and CDF(s_kin, E) = cumulative
+	// differential interaction rate, shared between instances (TableRegistry)
+	ref_ptr<RateTable> rates;
+	ref_ptr<CumulativeRateTable> cdfs;
 
 public:
 	/** Constructor
@@ -68,6 +68,14 @@ public:
 	 */
 	void setThinning(double thinning);
 
+	/** Use compact tables with single precision values in contiguous arrays
+	 * instead of double precision tables, see RateTable and CumulativeRateTable
+	 * @param compact	use compact tables
+	 * @param tolerance	resample the interaction rate to the fewest nodes
+	 *					within this relative interpolation error (0: all nodes)
+	 */
+	void setCompactTables(bool compact, double tolerance = 0);
+
 	/** set a custom interaction tag to trace back this interaction
 	 * @param tag string that will be added to the candidate and output
 	 */	
@@ -78,7 +86,13 @@ public:
 	void initCumulativeRate(std::string filename);
 
 	void performInteraction(Candidate *candidate) const;
+	/** Interaction rate at the current state, see Module::getInteractionRate */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Same as performInteraction, see InteractionManager */
+	void interact(Candidate *candidate) const;
 	void process(Candidate *candidate) const;
+	/** Step limit at the current state, see Module::getStepLimit */
+	double getStepLimit(const Candidate *candidate) const;
 };
 /** @}*/
 
@@ -2,6 +2,7 @@
 #define CRPROPA_ELASTICSCATTERING_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
 
 #include <vector>
@@ -18,6 +19,7 @@ private:
 
 	std::vector<double> tabRate; // elastic scattering rate
 	std::vector<std::vector<double> > tabCDF; // CDF as function of background photon energy
+	std::vector<AliasTable> tabAlias; // alias tables of tabCDF for sampling
 	std::string interactionTag = "ES";
 
 	static const double lgmin; // minimum log10(Lorentz-factor)
@@ -2,6 +2,7 @@
 #define CRPROPA_ELECTRONPAIRPRODUCTION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
 
 namespace crpropa {
@@ -19,6 +20,12 @@ namespace crpropa {
  Several photon fields can be selected.\n
  The production of secondary e+/e- pairs and photons can by activated.\n
  By default, the module limits the step size to 10% of the energy loss length of the particle.
+ With setExactLoss the energy after a step is taken from a tabulated range
+ function instead of the linear loss, so that larger limits can be used.
+ With setPacketBins the pairs of a step are aggregated into one weighted
+ electron and positron per bin of the tabulated spectrum, whose weight is the
+ expected number of pairs of the step in that bin, instead of drawing the
+ pairs one by one until the energy loss is spent.
  */
 class ElectronPairProduction: public Module {
 private:
@@ -26,10 +33,21 @@ private:
 	std::vector<double> tabLossRate; /*< tabulated energy loss rate in [J/m] for protons at z = 0 */
 	std::vector<double> tabLorentzFactor; /*< tabulated Lorentz factor */
 	std::vector<std::vector<double> > tabSpectrum; /*< electron/positron cdf(Ee|log10(gamma)) for log10(Ee/eV)=7-24 in 170 steps and log10(gamma)=6-13 in 70 steps and*/
+	std::vector<AliasTable> tabSpectrumAlias; /*< alias tables of tabSpectrum for sampling */
+	std::vector<double> tabRange; /*< integral of dln(gamma) / (loss rate) for protons at z = 0, from the lowest tabulated gamma with a loss */
+	std::vector<double> tabLogLorentzFactor; /*< ln(gamma) of tabRange */
+	int packetBins; /*< number of bins of aggregated pairs, 0 for individual pairs */
+	std::vector<size_t> packetEdges; /*< first spectrum bin of each packet bin and the end */
+	std::vector<std::vector<double> > packetProbability; /*< fraction of the pairs per packet bin for each log10(gamma) */
+	std::vector<double> tabMeanEnergy; /*< mean electron energy in [J] for each log10(gamma) */
 	double limit; ///< fraction of energy loss length to limit the next step
 	bool haveElectrons; /*< if true, secondary electrons will be added to the simulation */
+	bool exactLoss; /*< if true, the energy after a step is taken from the range table */
 	std::string interactionTag = "EPP";
 
+	// tabulate the packet bins of the spectrum
+	void initPackets();
+
 public:
 	/**
 	 * @brief Constructor for the Electron Pair Production
@@ -51,6 +69,19 @@ public:
 	 * @param limit fraction of the mean free path
 	 */
 	void setLimit(double limit);
+
+	/** Apply the energy loss of a step with the tabulated range function
+	 (see lorentzFactorAfter) instead of the linear approximation dE/E = step / lossLength
+	 * @param exact	use the range function
+	 */
+	void setExactLoss(bool exact);
+	bool getExactLoss() const;
+	/** Aggregate the secondary pairs of a step into weighted pairs in bins of
+	 the tabulated spectrum (of 0.1 in log10(Ee)), instead of sampling individual pairs
+	 * @param nBins	number of bins (0: individual pairs)
+	 */
+	void setPacketBins(int nBins);
+	int getPacketBins() const;
 	
 	/** set a custom interaction tag to trace back this interaction
 	 * @param tag string that will be added to the candidate and output
@@ -61,6 +92,8 @@ public:
 	void initRate(std::string filename);
 	void initSpectrum(std::string filename);
 	void process(Candidate *candidate) const;
+	/** Step limit at the current state, see Module::getStepLimit */
+	double getStepLimit(const Candidate *candidate) const;
 
 	/**
 	 Calculates the energy loss length 1/beta = -E dx/dE in [m]
@@ -75,6 +108,22 @@ public:
 	 beta(E,z) = (1+z)^3 beta((1+z)E).
 	 */
 	double lossLength(int id, double lf, double z=0) const;
+
+	/**
+	 Lorentz factor after a step with continuous energy loss
+	 @param id		PDG particle ID
+	 @param lf		Lorentz factor at the start of the step
+	 @param z		redshift, constant during the step
+	 @param step	step in the local frame in [m]
+
+	 The loss rate of a nucleus is k * beta_p((1+z)gamma) with
+	 k = Z^2 / A (1+z)^3, see lossLength. With the range
+	 R(g) = int dln(g) / beta_p(g), tabulated on the loss rate table and
+	 continued analytically above it, the Lorentz factor after the step follows
+	 from R((1+z)gamma') = R((1+z)gamma) - k * step. The loss stops at the
+	 energy threshold of the table.
+	 */
+	double lorentzFactorAfter(int id, double lf, double z, double step) const;
 	
 };
 /** @}*/
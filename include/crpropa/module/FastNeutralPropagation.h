@@ -0,0 +1,83 @@
+#ifndef CRPROPA_FASTNEUTRALPROPAGATION_H
+#define CRPROPA_FASTNEUTRALPROPAGATION_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/Geometry.h"
+
+#include <set>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class FastNeutralPropagation
+ @brief Rectilinear propagation of non-interacting neutral particles from surface to surface.
+
+ Candidates with one of the registered particle ids (by default neutrinos)
+ are moved in a single step along a straight line to just behind the first
+ crossing of one of the added surfaces, or by the maximum step if no surface
+ is crossed. The crossing is found by stepping along the line by the
+ distance to the surfaces (Surface::distance) and bisecting a sign change,
+ and the candidate is placed by the tolerance behind it, so that an
+ ObserverSurface or a boundary on the same surface sees the crossing. Lines
+ grazing a surface converge slowly, after 1000 distance steps the candidate
+ is moved by the distance traced so far. The
+ modules of the ModuleList thus run once per surface instead of once per
+ step. All other candidates are propagated by the wrapped module.
+
+ The step limits of other modules are ignored for these candidates: add the
+ surfaces of all observers and boundaries they have to stop at, and note
+ that limits on the trajectory length are only applied after the step. The
+ redshift of the long steps is updated by the Redshift module, which uses
+ the comoving distance for steps with a large change in redshift. Only ids
+ of particles without interactions in the simulation should be registered,
+ photons e.g. only without EM interaction modules.
+ */
+class FastNeutralPropagation: public Module {
+private:
+	ref_ptr<Module> propagation;
+	std::vector<ref_ptr<Surface> > surfaces;
+	std::set<int> ids;
+	double maxStep;
+	double tolerance;
+
+	/** Distance along the line to the first crossing of a surface, at most maxStep */
+	double crossing(const Vector3d &position, const Vector3d &direction) const;
+
+public:
+	/** Constructor
+	 @param propagation	module propagating all other candidates, e.g. PropagationCK
+	 @param maxStep		maximum step of the registered particles
+	 @param tolerance	distance behind the crossed surface at which the candidates are placed
+	 */
+	FastNeutralPropagation(ref_ptr<Module> propagation = NULL,
+			double maxStep = 1 * Gpc, double tolerance = 1 * pc);
+
+	void process(Candidate *candidate) const;
+
+	/** Add a surface at which the registered particles stop */
+	void add(ref_ptr<Surface> surface);
+	/** Register a particle id, the id has to be neutral */
+	void addId(int id);
+	void removeId(int id);
+	bool hasId(int id) const;
+
+	void setPropagation(ref_ptr<Module> propagation);
+	void setMaximumStep(double maxStep);
+	void setTolerance(double tolerance);
+
+	ref_ptr<Module> getPropagation() const;
+	double getMaximumStep() const;
+	double getTolerance() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_FASTNEUTRALPROPAGATION_H
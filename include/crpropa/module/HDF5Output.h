@@ -5,8 +5,11 @@
 
 
 #include "crpropa/module/Output.h"
+#include "crpropa/AsyncPipeline.h"
+#include "crpropa/MemoryUsage.h"
 #include <stdint.h>
 #include <ctime>
+#include <cstring>
 
 #include <H5Ipublic.h>
 
@@ -22,7 +25,10 @@ const size_t propertyBufferSize = 1024;
 /**
  @class HDF5Output
  @brief Output to HDF5 Format.
-The base class gives an overview of possible columns
+The base class gives an overview of possible columns.
+Only the enabled columns are stored. The tag column holds the handles of
+the tags in the SymbolTable, their names are stored in the attribute TagNames
+(the tag of a row is TagNames[tag]).
 
 HDF5 structure:
 ```
@@ -52,51 +58,87 @@ DATASET "OUTPUTTYPE" {
  */
 class HDF5Output: public Output {
 
-	typedef struct OutputRow {
-		double D;
-		double z;
-		uint64_t SN;
-		int32_t ID;
-		double E;
-		double X;
-		double Y;
-		double Z;
-		double Px;
-		double Py;
-		double Pz;
-		uint64_t SN0;
-		int32_t ID0;
-		double E0;
-		double X0;
-		double Y0;
-		double Z0;
-		double P0x;
-		double P0y;
-		double P0z;
-		uint64_t SN1;
-		int32_t ID1;
-		double E1;
-		double X1;
-		double Y1;
-		double Z1;
-		double P1x;
-		double P1y;
-		double P1z;
-		double weight;
-		std::string tag;
-		unsigned char propertyBuffer[propertyBufferSize];
-	} OutputRow;
+	/** Columns of the fixed part of a row, the properties follow them */
+	enum RowColumn {
+		RowD, RowRedshift,
+		RowSN, RowID, RowE, RowX, RowY, RowZ, RowPx, RowPy, RowPz,
+		RowSN0, RowID0, RowE0, RowX0, RowY0, RowZ0, RowP0x, RowP0y, RowP0z,
+		RowSN1, RowID1, RowE1, RowX1, RowY1, RowZ1, RowP1x, RowP1y, RowP1z,
+		RowWeight, RowTag,
+		nRowColumns
+	};
+	struct RowColumnType {
+		std::string name;
+		hid_t type;
+		size_t size;
+	};
+	/// upper bound of the row size: all fixed columns plus the property buffer
+	static const size_t maxRowSize = 31 * sizeof(double) + propertyBufferSize;
+
+	// Rows are stored packed, only the enabled columns are written. The layout
+	// is determined in open(): offset of each column or -1 if disabled.
+	std::vector<long> rowOffsets;
+	size_t rowSize;
+	size_t propertyOffset;
+	void addColumn(std::vector<RowColumnType> &columns, const std::string &name, RowColumn column, hid_t type);
+	template<class T>
+	void pack(unsigned char *row, RowColumn column, T value) const {
+		long offset = rowOffsets[column];
+		if (offset >= 0)
+			memcpy(row + offset, &value, sizeof(T));
+	}
+	void packState(unsigned char *row, RowColumn id, const ParticleState &state) const;
+	void append(const unsigned char *row) const;
+	herr_t insertTagNames();
 
 	std::string filename;
 
 	hid_t file, sid;
 	hid_t dset, dataspace;
-	mutable std::vector<OutputRow> buffer;
+	mutable std::vector<unsigned char> buffer;
 
 	time_t lastFlush;
 	unsigned int flushLimit;
 	unsigned int candidatesSinceFlush;
+
+	AsyncPipeline<std::vector<unsigned char>, HDF5Output> *pipeline;
+	void consume(std::vector<unsigned char> &row) const;
+	void commit() const;
+	friend class AsyncPipeline<std::vector<unsigned char>, HDF5Output>;
+
+	struct Shard {
+		hid_t dset;
+		std::vector<unsigned char> buffer;
+		MemoryAccount memory;
+		char padding[64]; // avoid false sharing between threads
+		Shard() : dset(-1), memory(MemoryUsage::OutputBuffers) {
+		}
+	};
+	bool sharded;
+	mutable std::vector<Shard> shards;
+
+	bool collective;
+	void writeCollective() const;
+	void broadcast(std::vector<char> &data) const;
+
+	size_t chunkSize;
+	int compression;
+	int compressionLevel;
+	bool shuffle;
+	mutable MemoryAccount bufferMemory;
+	hid_t createDataset(const std::string &name) const;
+	void writeRows(hid_t dataset, std::vector<unsigned char> &rows) const;
+	void writeShard(size_t i) const;
+	void mergeShards();
 public:
+	/** Compression filter of the dataset, see setCompression */
+	enum Compression {
+		CompressionNone,
+		CompressionDeflate, ///< gzip, always available
+		CompressionZstd, ///< Zstandard filter plugin (id 32015)
+		CompressionBlosc ///< Blosc filter plugin (id 32001) with the LZ4 codec
+	};
+
 	/** Default constructor.
 	  	Does not run from scratch.
 	    At least open() has to be called in addition.
@@ -125,7 +167,74 @@ public:
 	/// with frequent output this should be set to a high number (default)
 	void setFlushLimit(unsigned int N);
 
+	/** Write the output from a background thread.
+	 The rows are filled by the calling threads and handed to the writer
+	 thread through per-thread buffers, so that the simulation does not wait
+	 for the file system. flush() waits until all rows are written, size()
+	 only counts the rows already passed to the writer thread.
+	 @param async		enable the asynchronous output
+	 @param capacity	number of rows buffered per thread
+	 */
+	void setAsync(bool async = true, size_t capacity = 1024);
+	bool getAsync() const;
+
+	/** Set the number of rows per chunk of the dataset (default 16384).
+	 Larger chunks compress better, smaller ones are read faster partially.
+	 Has to be set before the file is opened.
+	 */
+	void setChunkSize(size_t rows);
+	size_t getChunkSize() const;
+
+	/** Set the compression filter of the dataset (default: deflate, level 5).
+	 The filter plugins for Zstd and Blosc are loaded by HDF5 from
+	 HDF5_PLUGIN_PATH; if a plugin is not available, deflate is used instead.
+	 Has to be set before the file is opened.
+	 @param filter	compression filter
+	 @param level	compression level of the filter
+	 */
+	void setCompression(Compression filter, int level = 5);
+	Compression getCompression() const;
+	int getCompressionLevel() const;
+
+	/** Apply the byte shuffle filter before the compression (default: on).
+	 Reordering the bytes of the rows by significance lets the compression
+	 exploit the slowly varying high bytes of ids and positions.
+	 */
+	void setShuffle(bool shuffle = true);
+	bool getShuffle() const;
+
+	/** Write one dataset per OpenMP thread.
+	 Every thread fills its own buffer and appends it to its own dataset in
+	 the group CRPROPA3_shards, so the threads only synchronise to write a
+	 full buffer. close() joins the shards into the virtual dataset CRPROPA3
+	 (HDF5 >= 1.10), which readers see like the dataset of the normal
+	 output. size() only counts the rows written to the shards. Has to be
+	 set before the file is opened and is not used with setAsync.
+	 @param sharded	enable the per-thread datasets
+	 */
+	void setSharded(bool sharded = true);
+	bool getSharded() const;
+
+#ifdef CRPROPA_HAVE_MPI
+	/** Write the rows of all MPI ranks collectively into one file (parallel HDF5).
+	 All ranks of MPI_COMM_WORLD open the same file, e.g. with ModuleList::runMPI.
+	 The rows are kept by each rank until flush() or close(), which have to be
+	 called by all ranks: the counts of the ranks give the offsets of their
+	 rows in the dataset CRPROPA3, and the ranks write them in one collective
+	 operation. A long run should call flush() between the runs of its parts to
+	 bound the buffers. The attributes, including the seeds and the TagNames, are
+	 those of rank 0 and insertStringAttribute and insertDoubleAttribute have to
+	 be called by all ranks with the same values. size() counts the rows of the
+	 rank. Has to be set before the file is opened and is not used with
+	 setAsync or setSharded.
+	 @param collective	enable the collective output
+	 */
+	void setCollective(bool collective = true);
+	bool getCollective() const;
+#endif
+
 	/** Create and prepare a file as HDF5-file.
+	 Collective for all ranks with setCollective.
 	 */
 	void open(const std::string &filename);
 	void close();
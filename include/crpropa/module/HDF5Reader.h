@@ -0,0 +1,147 @@
+#ifdef CRPROPA_HAVE_HDF5
+
+#ifndef CRPROPA_HDF5READER_H
+#define CRPROPA_HDF5READER_H
+
+#include "crpropa/Source.h"
+#include "crpropa/Variant.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <H5Ipublic.h>
+
+namespace crpropa {
+
+class ParticleCollector;
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class HDF5Reader
+ @brief Read the candidates of an HDF5Output file, e.g. as the source of the next stage of a simulation.
+
+ The rows of the dataset (CRPROPA3 by default) are read in chunks of
+ setChunkSize rows, so that only one chunk is held in memory. The columns
+ are identified by their names as written by HDF5Output, columns missing in
+ the file keep the default of the candidate; if the file has no column of
+ the source or created state, these are set to the current state. Lengths
+ and energies are converted with the LengthScale and EnergyScale attributes
+ of the dataset, tags with the TagNames attribute. All other columns are
+ read as properties of the candidates with the Variant type matching their
+ HDF5 type (a boolean property is read as unsigned char).
+
+ With setRestart, the candidates start as new primaries at the stored
+ current state, which is then also the source, created and previous state,
+ and the trajectory length is zero.
+
+ getCandidate(index) gives random access, ModuleList::run passes the index
+ of each candidate in the run (see SourceCatalogue). load() streams all
+ rows of a file into a ParticleCollector, collect() those of the range.
+ */
+class HDF5Reader: public SourceInterface {
+public:
+	/** Open the dataset of a file, throws std::runtime_error if it cannot be read */
+	HDF5Reader(const std::string &filename, const std::string &dataset = "CRPROPA3");
+	~HDF5Reader();
+
+	/** Number of rows read at once (default 16384) */
+	void setChunkSize(size_t rows);
+	size_t getChunkSize() const;
+
+	/** Start the candidates as new primaries at the stored current state */
+	void setRestart(bool restart = true);
+	bool getRestart() const;
+
+	/** Restrict the reader to count rows starting at first */
+	void setRange(size_t first, size_t count);
+	/** Number of rows in the range */
+	size_t size() const;
+
+	/** Candidate of the row at the index in the range */
+	ref_ptr<Candidate> getCandidate(size_t index) const;
+	/** Next candidate of the range, throws std::runtime_error when the range is exhausted */
+	ref_ptr<Candidate> getCandidate() const;
+	std::vector<ref_ptr<Candidate> > getCandidates(size_t n) const;
+	std::vector<ref_ptr<Candidate> > getCandidates(const std::vector<size_t> &indices) const;
+	/** Candidates of count rows of the range starting at first, read with one access to the file */
+	std::vector<ref_ptr<Candidate> > readRows(size_t first, size_t count) const;
+	/** Start getCandidate() without index at the beginning of the range again */
+	void rewind();
+
+	/** Pass the candidates of the range in chunks to a collector */
+	void collect(ParticleCollector *collector) const;
+	/** Load all candidates of the CRPROPA3 dataset of a file into a collector */
+	static void load(const std::string &filename, ParticleCollector *collector);
+	/** Whether the file starts with the signature of an HDF5 file */
+	static bool isHDF5File(const std::string &filename);
+
+	/** Names of the columns read as properties */
+	std::vector<std::string> getPropertyNames() const;
+	/** Value of a string attribute of the dataset, empty if not present */
+	std::string getStringAttribute(const std::string &key) const;
+	double getLengthScale() const;
+	double getEnergyScale() const;
+
+	std::string getDescription() const;
+
+private:
+	/** Fixed columns of HDF5Output, the other columns are properties */
+	enum FixedColumn {
+		ColumnD, ColumnRedshift,
+		ColumnSN, ColumnID, ColumnE, ColumnX, ColumnY, ColumnZ, ColumnPx, ColumnPy, ColumnPz,
+		ColumnSN0, ColumnID0, ColumnE0, ColumnX0, ColumnY0, ColumnZ0, ColumnP0x, ColumnP0y, ColumnP0z,
+		ColumnSN1, ColumnID1, ColumnE1, ColumnX1, ColumnY1, ColumnZ1, ColumnP1x, ColumnP1y, ColumnP1z,
+		ColumnWeight, ColumnTag,
+		nFixedColumns
+	};
+	/** Column of the rows in memory */
+	struct Column {
+		std::string name;
+		size_t offset;
+		size_t size;
+		Variant::Type type;
+	};
+
+	std::string filename, datasetName;
+	hid_t file, dset, memType;
+	size_t rowSize;
+	std::vector<long> fixed; // index in columns of each FixedColumn or -1
+	std::vector<Column> columns;
+	std::vector<size_t> propertyColumns;
+	std::vector<std::string> tagNames;
+	std::vector<Symbol> tagSymbols;
+	double lengthScale, energyScale;
+	size_t nRows, first, count;
+	size_t chunkSize;
+	bool restart;
+	mutable size_t next;
+
+	// the last chunk read
+	mutable std::vector<unsigned char> chunk;
+	mutable size_t chunkFirst, chunkRows;
+
+	void readChunk(size_t row, size_t n, std::vector<unsigned char> &rows) const;
+	ref_ptr<Candidate> makeCandidate(const unsigned char *row) const;
+	Variant readValue(const unsigned char *row, const Column &column) const;
+	double readDouble(const unsigned char *row, FixedColumn column, double defaultValue) const;
+	void readState(const unsigned char *row, FixedColumn id, ParticleState &state) const;
+	bool hasState(FixedColumn id) const;
+	void readTagNames();
+	double readDoubleAttribute(const std::string &key, double defaultValue) const;
+	void close();
+
+	HDF5Reader(const HDF5Reader &);
+	HDF5Reader &operator=(const HDF5Reader &);
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_HDF5READER_H
+
+#endif // CRPROPA_HAVE_HDF5
@@ -0,0 +1,125 @@
+#ifndef CRPROPA_HISTOGRAMOUTPUT_H
+#define CRPROPA_HISTOGRAMOUTPUT_H
+
+#include "crpropa/Module.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+class Pixelization;
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class HistogramOutput
+ @brief Histogram the candidates on the fly instead of writing them to a file.
+
+ The candidates are binned into an N-dimensional histogram, e.g. (ID, E) for
+ the spectra of the species or (ID, E, pixel) for arrival maps. Every bin
+ holds the sum of the weights of its candidates. Candidates outside the range
+ of any axis are not counted.
+
+ Each OpenMP thread fills its own copy of the histogram, the copies are added
+ up by getHistogram() and when the histogram is saved. Use the module after
+ the simulation has finished. close() writes the non-empty bins to the
+ text file given in the constructor:
+ ```
+ # HistogramOutput
+ # axis 0: CurrentId 2 bins: 1000010010 1000260560
+ # axis 1: CurrentEnergy 40 bins: 1e+18 .. 1e+21 logarithmic
+ # bin0	bin1	content
+ 0	12	3.5
+ ...
+ ```
+ */
+class HistogramOutput: public Module {
+public:
+	/** Quantity binned along an axis */
+	enum Quantity {
+		CurrentEnergy, ///< energy [J]
+		SourceEnergy, ///< energy at the source [J]
+		TrajectoryLength, ///< trajectory length [m]
+		Redshift, ///< redshift
+		CurrentId, ///< particle id, see addIdAxis
+		SourceId, ///< source particle id, see addIdAxis
+		ArrivalDirection ///< HEALPix pixel of the arrival direction, see addPixelAxis
+	};
+
+private:
+	struct Axis {
+		Quantity quantity;
+		size_t nBins;
+		double min, max;
+		bool logarithmic;
+		std::vector<int> ids;
+	};
+	std::vector<Axis> axes;
+	std::vector<size_t> strides;
+	size_t nBins;
+	Pixelization *pixelization;
+
+	std::string filename;
+	// one histogram per thread, added by merge()
+	mutable std::vector<std::vector<double> > threadHistograms;
+	mutable std::vector<double> histogram;
+
+	void addAxis(const Axis &axis);
+	bool findBin(const Axis &axis, const Candidate *candidate, size_t &bin) const;
+	void merge() const;
+
+public:
+	/** Constructor
+	 @param filename	file the histogram is saved to by close(), nothing is written if empty
+	 */
+	HistogramOutput(const std::string &filename = "");
+	~HistogramOutput();
+
+	/** Add an axis with equally sized bins
+	 @param quantity	CurrentEnergy, SourceEnergy, TrajectoryLength or Redshift
+	 @param nBins		number of bins
+	 @param min		lower edge of the first bin
+	 @param max		upper edge of the last bin
+	 @param logarithmic	bins equally sized in log10 of the quantity
+	 */
+	void addAxis(Quantity quantity, size_t nBins, double min, double max, bool logarithmic = false);
+	/** Add an axis with one bin per particle id
+	 @param quantity	CurrentId or SourceId
+	 @param ids		particle ids, candidates with other ids are not counted
+	 */
+	void addIdAxis(Quantity quantity, const std::vector<int> &ids);
+	/** Add an axis with the HEALPix pixels (ring scheme) of the arrival direction.
+	 The arrival direction is the opposite of the current direction of the
+	 candidates. Requires CRPropa with ENABLE_GALACTICMAGNETICLENS.
+	 @param order	HEALPix order of the pixelization
+	 */
+	void addPixelAxis(unsigned int order);
+
+	/** Flattened index of the bin with the given indices along the axes */
+	size_t getIndex(const std::vector<size_t> &bins) const;
+	/** Total number of bins */
+	size_t getNumberOfBins() const;
+	size_t getNumberOfAxes() const;
+	/** Sum of the weights in the bin with the flattened index */
+	double getBinContent(size_t index) const;
+	/** All bins, the last axis is running fastest */
+	const std::vector<double> &getHistogram() const;
+
+	void process(Candidate *candidate) const;
+	/** Write the non-empty bins to a text file */
+	void save(const std::string &filename) const;
+	/** Save the histogram to the file given in the constructor */
+	void close();
+	/** Reset all bins to zero */
+	void clear();
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_HISTOGRAMOUTPUT_H
@@ -0,0 +1,65 @@
+#ifndef CRPROPA_INTERACTIONMANAGER_H
+#define CRPROPA_INTERACTIONMANAGER_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class InteractionManager
+ @brief Samples the stochastic interactions of several modules at once.
+
+ Each interaction module draws its own random interaction distance and
+ limits the next step in process(). The InteractionManager instead sums
+ Module::getInteractionRate of all registered modules, draws one
+ interaction distance from the total rate and lets the module selected with
+ the probability of its partial rate perform the interaction with
+ Module::interact. The competing processes are sampled with the same
+ statistics as with the modules in the ModuleList, but with two random
+ numbers per interaction and one per step without interaction.
+
+ The registered modules replace the modules in the ModuleList and must not
+ be added there as well. The next step is limited to limit / total rate,
+ the step limits of the registered modules are not used.
+ Continuous energy losses (e.g. ElectronPairProduction) have no interaction
+ rate and remain separate modules.
+ */
+class InteractionManager: public Module {
+private:
+	std::vector<ref_ptr<Module> > interactions;
+	double limit;
+
+public:
+	/** Constructor
+	 @param limit	step size limit as fraction of the total mean free path
+	 */
+	InteractionManager(double limit = 0.1);
+	/** Register a module providing Module::getInteractionRate and Module::interact */
+	void add(Module *interaction);
+	std::size_t size() const;
+	ref_ptr<Module> operator[](const std::size_t i);
+
+	void setLimit(double limit);
+	double getLimit() const;
+
+	/** Sum of the interaction rates of the registered modules */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Index of the module with the next interaction for the random number u in [0, 1) */
+	std::size_t select(const Candidate *candidate, double u) const;
+	/** Perform one interaction of a module selected by the partial rates */
+	void interact(Candidate *candidate) const;
+	double getStepLimit(const Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_INTERACTIONMANAGER_H
@@ -24,6 +24,11 @@ namespace crpropa {
 /**
  @class ConstantMomentumDiffusion
  * Simplest model for diffusion in momentum space
+ *
+ * A batch of candidates (see Module::processBatch) is updated together: the
+ * Gaussian random numbers of all charged candidates are drawn in one call
+ * of Random::randNorm(double *, size_t) and the momenta are updated in
+ * arrays over the batch.
  */
 
 class ConstantMomentumDiffusion: public Module {
@@ -45,6 +50,7 @@ public:
 	ConstantMomentumDiffusion(double Dpp, double limit);
 
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 	double calculateAScalar(double p) const;
 	double calculateBScalar() const;
 
@@ -2,10 +2,15 @@
 #define CRPROPA_NUCLEARDECAY_H
 
 #include "crpropa/Module.h"
+#include "crpropa/DataTable.h"
 
 #include <vector>
+#include <atomic>
 
 namespace crpropa {
+
+class SourceComposition;
+
 /**
  * \addtogroup EnergyLosses
  * @{
@@ -20,6 +25,10 @@ namespace crpropa {
  The resulting non-hadronic secondary particles (e+, e-, neutrinos, gamma) can optionally be created.
 
  For details on the preprocessing of the NuDat2 data refer to "CRPropa3-data/calc_decay.py".
+
+ The decay modes of a nucleus are stored together with their total and
+ cumulative rates, so that a step draws one decay distance from the total
+ rate and, if the nucleus decays, one channel from the cumulative rates.
  */
 class NuclearDecay: public Module {
 private:
@@ -30,12 +39,27 @@ private:
 	struct DecayMode {
 		int channel; // (#beta- #beta+ #alpha #proton #neutron)
 		double rate; // decay rate in [1/m]
-		std::vector<double> energy; // photon energies of ensuing gamma decays
-		std::vector<double> intensity; // probabilities of ensuing gamma decays
+		double cumulativeRate; // sum of the rates up to this mode in [1/m]
+		size_t firstGamma, nGamma; // ensuing gamma decays in Decays::gammaEnergy / gammaIntensity
+	};
+	struct Decays {
+		double totalRate; // total decay rate in [1/m]
+		std::vector<DecayMode> modes;
+		std::vector<double> gammaEnergy; // photon energies of all modes, contiguous per mode
+		std::vector<double> gammaIntensity; // emission probabilities of the photons
+		Decays() : totalRate(0) {
+		}
 	};
-	std::vector<std::vector<DecayMode> > decayTable; // decayTable[Z * 31 + N] = vector<DecayMode>
+	ref_ptr<DataTable> decayData;
+	mutable std::vector<Decays> decayTable; // decayTable[Z * 31 + N], loaded on first use
+	mutable std::vector<std::atomic<bool> > decayLoaded;
 	std::string interactionTag = "ND";
 
+	// decay modes of the nucleus (Z, N)
+	const Decays &getDecays(int Z, int N) const;
+	// decay mode with probability proportional to its rate
+	const DecayMode &selectMode(const Decays &decays) const;
+
 public:
 	/** Constructor.
 	 @param electrons		if true, add secondary photons as candidates
@@ -59,6 +83,17 @@ public:
 	// decide if secondary neutrinos are added to the simulation	
 	void setHaveNeutrinos(bool b);
 
+	/** The decay modes of a nucleus are loaded when it is first seen.
+	 Preload the nucleus id, e.g. before timing a simulation.
+	 */
+	void preload(int id);
+	/** Preload all nuclei up to the mass number of the heaviest nucleus
+	 of the composition.
+	 */
+	void preload(const SourceComposition &composition);
+	/** True if the decay modes of the nucleus id are loaded */
+	bool isLoaded(int id) const;
+
 	/** set a custom interaction tag to trace back this interaction
 	 * @param tag string that will be added to the candidate and output
 	 */
@@ -66,6 +101,12 @@ public:
 	std::string getInteractionTag() const;
 
 	void process(Candidate *candidate) const;
+	/** Step limit at the current state, see Module::getStepLimit */
+	double getStepLimit(const Candidate *candidate) const;
+	/** Interaction rate at the current state, see Module::getInteractionRate */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Perform one interaction in a channel selected by the partial rates, see InteractionManager */
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 	void gammaEmission(Candidate *candidate, int channel) const;
 	void betaDecay(Candidate *candidate, bool isBetaPlus) const;
@@ -69,6 +69,55 @@ public:
 	 @param deactivate	if true, deactivate detected particles; if false, continue tracking them
 	 */
 	void setDeactivateOnDetection(bool deactivate);
+	const std::vector<ref_ptr<ObserverFeature> > &getFeatures() const;
+};
+
+
+/**
+ @class FastObserver1D
+ @brief Observer at x = 0 with inline vetoes for one-dimensional simulations
+
+ Detects the candidates like an Observer with the features Observer1D and the
+ selected vetoes (ObserverNucleusVeto, ObserverNeutrinoVeto, ...), without
+ the loop over the features. The next step is limited to the distance to
+ x = 0, detected candidates are passed to the detection action, flagged and
+ deactivated in the same order as by the Observer.
+ */
+class FastObserver1D: public Module {
+	ref_ptr<Module> detectionAction;
+	bool clone;
+	bool makeInactive;
+	bool flag;
+	Symbol flagKey;
+	Variant flagValue;
+	bool inactiveVeto, nucleusVeto, neutrinoVeto, photonVeto, electronVeto;
+	std::vector<int> vetoParticleIds;
+
+	bool isVetoed(const Candidate *candidate) const;
+public:
+	FastObserver1D();
+	/** Perform some specific actions upon detection of candidate
+	 @param action		module that performs a given action when candidate is detected
+	 @param clone		if true, clone candidate
+	 */
+	void onDetection(Module *action, bool clone = false);
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
+	std::string getDescription() const;
+	void setFlag(std::string key, std::string value);
+	/** Determine whether candidate should be deactivated on detection
+	 @param deactivate	if true, deactivate detected particles; if false, continue tracking them
+	 */
+	void setDeactivateOnDetection(bool deactivate);
+
+	/// veto as ObserverInactiveVeto, ObserverNucleusVeto, ...
+	void setInactiveVeto(bool veto = true);
+	void setNucleusVeto(bool veto = true);
+	void setNeutrinoVeto(bool veto = true);
+	void setPhotonVeto(bool veto = true);
+	void setElectronVeto(bool veto = true);
+	/// veto as ObserverParticleIdVeto, can be called for several ids
+	void addParticleIdVeto(int id);
 };
 
 
@@ -95,6 +144,37 @@ public:
 	 @param surface		object with some specific geometric (see Geometry.h)
 	*/
 	ObserverSurface(Surface* surface);
+	ref_ptr<Surface> getSurface() const;
+	DetectionState checkDetection(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+
+/**
+ @class ObserverCatalog
+ @brief Detects particles crossing any sphere of a large catalogue of targets
+
+ The spheres, e.g. one per galaxy, are held in a SurfaceCollection, so that
+ each step only evaluates the spheres near the particle instead of all
+ targets. The index of the crossed target (the first one if several are
+ crossed in one step) is stored in the candidate property propertyName.
+ The step is limited to the distance to the nearest sphere.
+ */
+class ObserverCatalog: public ObserverFeature {
+private:
+	SurfaceCollection targets;
+	std::string propertyName;
+public:
+	/** Constructor
+	 @param propertyName	candidate property for the index of the detected target
+	 */
+	ObserverCatalog(const std::string &propertyName = "TargetIndex");
+	/** Add a target sphere, the targets are numbered in the order they are added
+	 @param center		center of the sphere
+	 @param radius		radius of the sphere
+	 */
+	void add(const Vector3d &center, double radius);
+	size_t size() const;
 	DetectionState checkDetection(Candidate *candidate) const;
 	std::string getDescription() const;
 };
@@ -238,6 +318,7 @@ public:
  @class ObserverTimeEvolution
  @brief Observes the time evolution of the candidates (phase-space elements)
  This observer is very useful if the time evolution of the particle density is needed. It detects all candidates in lin-spaced, log-spaced, or user-defined time intervals and limits the nextStep of candidates to prevent overshooting of detection intervals.
+ The detection times are kept sorted. The index of the next detection is stored in the candidate property "DetectionIndex", candidates without it, e.g. secondaries, start at the first detection time they have not passed.
  */
 class ObserverTimeEvolution: public ObserverFeature {
 private:
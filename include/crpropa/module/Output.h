@@ -67,7 +67,22 @@ protected:
 	bool oneDimensional;
 	mutable size_t count;
 
+	struct PropertyRange {
+		Symbol name;
+		double min, max;
+	};
+	bool filtered;
+	std::vector<int> filterIds;
+	double minEnergy, maxEnergy;
+	std::vector<PropertyRange> propertyRanges;
+
 	void modify();
+	void updateFiltered();
+	/** Whether the candidate passes the filters, tested before its row is prepared */
+	bool accept(const Candidate *candidate) const {
+		return !filtered || acceptFiltered(candidate);
+	}
+	bool acceptFiltered(const Candidate *candidate) const;
 
 public:
 	enum OutputColumn {
@@ -162,6 +177,27 @@ public:
 	 */
 	size_t size() const;
 
+	/** Write only candidates with one of the added ids of the current state.
+	 @param id	particle id, e.g. 22 for photons or nucleusId(1, 1) for protons
+	 */
+	void addIdFilter(int id);
+	/** Write only candidates with a current energy in [min, max).
+	 @param min	minimum energy (scale = 1 corresponds to 1 Joule)
+	 @param max	maximum energy
+	 */
+	void setEnergyRange(double min, double max);
+	/** Write only candidates with the property in [min, max), compared as double.
+	 Candidates without the property are not written.
+	 @param property	name of the property
+	 @param min		minimum value
+	 @param max		maximum value
+	 */
+	void addPropertyRange(const std::string &property, double min, double max);
+	/** Remove all filters, all candidates are written */
+	void clearFilters();
+	/** Whether filters are set */
+	bool isFiltered() const;
+
 	void process(Candidate *) const;
 };
 
@@ -17,6 +17,7 @@ namespace crpropa {
  */
 class ShellOutput: public Module {
 public:
+	ShellOutput();
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
 };
@@ -27,6 +28,7 @@ public:
  */
 class ShellOutput1D: public Module {
 public:
+	ShellOutput1D();
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
 };
@@ -37,7 +39,8 @@ public:
  */
 class ShellPropertyOutput: public Module {
 public:
-	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
+	typedef Candidate::PropertyMap PropertyMap;
+	ShellPropertyOutput();
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
 };
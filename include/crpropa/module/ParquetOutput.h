@@ -0,0 +1,101 @@
+#ifdef CRPROPA_HAVE_PARQUET
+
+#ifndef CRPROPA_PARQUETOUTPUT_H
+#define CRPROPA_PARQUETOUTPUT_H
+
+#include "crpropa/module/Output.h"
+#include "crpropa/AsyncPipeline.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class ParquetOutput
+ @brief Columnar output to Apache Parquet files.
+
+ The columns and their names are the same as in HDF5Output, selected with the
+ OutputColumn flags of the base class; custom properties (enableProperty)
+ become additional columns. The rows are formatted by the calling threads and
+ written by a background thread in row groups of a configurable size, each
+ column compressed separately. Requires CRPropa to be built with Apache Arrow
+ and Parquet (ENABLE_PARQUET).
+ */
+class ParquetOutput: public Output {
+public:
+	/** Compression codec of the columns */
+	enum Compression {
+		CompressionNone,
+		CompressionSnappy,
+		CompressionGzip,
+		CompressionZstd
+	};
+
+private:
+	struct Row {
+		double D, z;
+		uint64_t SN, SN0, SN1;
+		int32_t ID, ID0, ID1;
+		double E, X, Y, Z, Px, Py, Pz;
+		double E0, X0, Y0, Z0, P0x, P0y, P0z;
+		double E1, X1, Y1, Z1, P1x, P1y, P1z;
+		double weight;
+		std::string tag;
+		std::vector<Variant> properties;
+	};
+
+	struct Writer; // Parquet writer, hidden from the interface
+	Writer *writer;
+	std::string filename;
+	size_t rowGroupSize;
+	Compression compression;
+	size_t rowsInGroup;
+	AsyncPipeline<Row, ParquetOutput> *pipeline;
+
+	void consume(Row &row) const;
+	void commit() const;
+	friend class AsyncPipeline<Row, ParquetOutput>;
+
+public:
+	/** Default constructor, open() has to be called before the first candidate */
+	ParquetOutput();
+	/** Constructor with the default OutputType (everything).
+	 @param filename	name of the output file
+	 */
+	ParquetOutput(const std::string &filename);
+	/** Constructor
+	 @param filename	name of the output file
+	 @param outputType	type of output: Trajectory1D, Trajectory3D, Event1D, Event3D, Everything
+	 */
+	ParquetOutput(const std::string &filename, OutputType outputType);
+	~ParquetOutput();
+
+	/** Set the number of rows per row group (default 100000), before open() */
+	void setRowGroupSize(size_t rows);
+	size_t getRowGroupSize() const;
+	/** Set the compression codec of the columns (default Zstd), before open() */
+	void setCompression(Compression compression);
+	Compression getCompression() const;
+
+	/** Create the file and write the schema of the enabled columns */
+	void open(const std::string &filename);
+	void close();
+	/** Wait until all rows are written */
+	void flush() const;
+
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PARQUETOUTPUT_H
+
+#endif // CRPROPA_HAVE_PARQUET
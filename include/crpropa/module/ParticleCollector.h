@@ -5,6 +5,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/ModuleList.h"
+#include "crpropa/module/Output.h"
 
 namespace crpropa {
 /**
@@ -16,8 +17,24 @@ namespace crpropa {
 /**
  @class ParticleCollector
  @brief A helper ouput mechanism to keep candidates in-memory and directly transfer them to Python
+
+ In compact mode (see setCompact) only the selected parts of the state are
+ stored in flat arrays instead of the candidates, which needs a small
+ fraction of the memory. The candidates are rebuilt on access with
+ operator[] and by ModuleList::run(const ParticleCollector*).
  */
 class ParticleCollector: public Module {
+public:
+	/** Parts of the state kept in compact mode */
+	enum CompactField {
+		CompactCurrent = 1, ///< id, energy, position and direction of the current state
+		CompactSourceIdEnergy = 2, ///< id and energy of the source state
+		CompactSource = 6, ///< full source state
+		CompactCreated = 8, ///< full created state
+		CompactInfo = 16, ///< trajectory length, redshift, weight and serial numbers
+		CompactDefault = CompactCurrent | CompactSourceIdEnergy | CompactInfo
+	};
+
 protected:
         typedef std::vector<ref_ptr<Candidate> > tContainer;
         mutable tContainer container;
@@ -25,6 +42,36 @@ protected:
 	bool clone;
 	bool recursive;
 
+	/** Columns of the parts of one ParticleState */
+	struct CompactState {
+		std::vector<int> id;
+		std::vector<double> energy;
+		std::vector<double> x, y, z, dx, dy, dz;
+		void append(const ParticleState &state, bool full);
+		void append(const CompactState &other);
+		void restore(size_t i, ParticleState &state) const;
+		void clear();
+	};
+	/** Flat storage of the compact mode */
+	struct CompactStorage {
+		size_t size;
+		CompactState current, source, created;
+		std::vector<double> trajectoryLength, redshift, weight;
+		std::vector<uint64_t> serialNumber, sourceSerialNumber, createdSerialNumber;
+		CompactStorage() : size(0), padding() {
+		}
+		void append(const Candidate *candidate, unsigned int fields);
+		void append(const CompactStorage &other);
+		void clear();
+		char padding[64]; // avoid false sharing between threads
+	};
+	unsigned int compact;
+	mutable CompactStorage compactStorage;
+	// append buffers of the threads, moved to compactStorage when full or on access
+	mutable std::vector<CompactStorage> threadStorage;
+	void mergeCompact() const;
+	void readCompact(size_t i, Output::OutputColumn column, const Candidate &defaults, double *values) const;
+
 public:
         ParticleCollector();
         ParticleCollector(const std::size_t nBuffer);
@@ -35,7 +82,9 @@ public:
         void process(Candidate *candidate) const;
 	void process(ref_ptr<Candidate> c) const;
 	void reprocess(Module *action) const;
+	/** Write the candidates to a file, as BinaryOutput if the name ends with .bin, else as TextOutput */
 	void dump(const std::string &filename) const;
+	/** Load the candidates of a BinaryOutput, HDF5Output (see HDF5Reader) or TextOutput file */
 	void load(const std::string &filename);
 
         std::size_t size() const;
@@ -47,6 +96,40 @@ public:
 	void setClone(bool b);
 	bool getClone() const;
 
+	/** Store only parts of the state of the candidates (see CompactField).
+	 The candidates are rebuilt on access with operator[], the container and
+	 the iterators are not used. Has to be set while the collector is empty.
+	 @param fields	combination of CompactField, 0 to store the candidates
+	 */
+	void setCompact(unsigned int fields = CompactDefault);
+	unsigned int getCompact() const;
+
+	/** Number of values per candidate of a column in exportColumn:
+	 3 for positions, directions and the serial numbers (own, source,
+	 created), 0 for columns which cannot be exported (ColumnDensityColumn,
+	 CandidateTagColumn), else 1 */
+	static size_t getColumnWidth(Output::OutputColumn column);
+	/** Values of a column of one candidate in SI units
+	 @param candidate	candidate to read
+	 @param column		column as in Output
+	 @param values		array of getColumnWidth(column) values to fill
+	 */
+	static void readColumn(const Candidate &candidate, Output::OutputColumn column, double *values);
+	/** Values of a column of all candidates in SI units, getColumnWidth
+	 values per candidate. Ids and serial numbers are exact as double.
+	 In Python, toNumpy returns the columns as NumPy arrays.
+	 @param column	column as in Output
+	 @param values	array of size() * getColumnWidth(column) values to fill
+	 */
+	void exportColumn(Output::OutputColumn column, double *values) const;
+	/** Set a column of the first n candidates, candidates are appended if
+	 the collector has less than n. Not possible in compact mode.
+	 @param column	column as in Output
+	 @param values	array of n * getColumnWidth(column) values
+	 @param n		number of candidates
+	 */
+	void importColumn(Output::OutputColumn column, const double *values, size_t n);
+
 	/** iterator goodies */
         typedef tContainer::iterator iterator;
         typedef tContainer::const_iterator const_iterator;
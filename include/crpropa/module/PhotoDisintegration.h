@@ -3,11 +3,16 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/TableRegistry.h"
 
 #include <vector>
-#include <map>
+#include <atomic>
 
 namespace crpropa {
+
+class SourceComposition;
+
 /**
  * \addtogroup EnergyLosses
  * @{
@@ -23,25 +28,50 @@ private:
 	double limit; // fraction of mean free path for limiting the next step
 	bool havePhotons;
 	std::string interactionTag = "PD";
+	bool compactTables = false; // single precision tables, see setCompactTables
+	double tableTolerance = 0; // relative tolerance of the resampled rates
 
 	struct Branch {
 		int channel; // number of emitted (n, p, H2, H3, He3, He4)
 		std::vector<double> branchingRatio; // branching ratio as function of nucleus Lorentz factor
+		size_t photonBegin, photonEnd; // range of the photons emitted by the daughter nucleus
 	};
 
-	struct PhotonEmission {
-		double energy; // energy of emitted photon [J]
-		std::vector<double> emissionProbability; // emission probability as function of nucleus Lorentz factor
+	// tables of one nucleus, loaded on first use
+	struct Species {
+		std::vector<double> rate; // total interaction rate
+		std::vector<Branch> branches; // branching ratios
+		std::vector<double> photonEnergy; // energies of emitted photons [J], grouped by daughter nucleus
+		std::vector<double> photonProbability; // nlg emission probabilities per photon as function of nucleus Lorentz factor
+
+		// compact tables replacing rate, the branching ratios and photonProbability
+		AdaptiveTable compactRate; // total interaction rate over log10(Lorentz factor)
+		std::vector<float> compactBranchingRatio; // nlg branching ratios per branch
+		std::vector<float> compactPhotonProbability; // nlg emission probabilities per photon
+
+		bool empty() const;
+		double getRate(double lg) const;
+		double getBranchingRatio(size_t branch, size_t l) const; // at the tabulation point l
+		double getBranchingRatio(size_t branch, double lg) const; // interpolated
+		double getPhotonProbability(size_t photon, size_t l) const;
 	};
 
-	std::vector<std::vector<double> > pdRate; // pdRate[Z * 31 + N] = total interaction rate
-	std::vector<std::vector<Branch> > pdBranch; // pdTable[Z * 31 + N] = branching ratios
-	mutable std::map<int, std::vector<PhotonEmission> > pdPhoton; // map of emitted photon energies and photon emission probabilities
+	ref_ptr<DataTable> rateTable;
+	ref_ptr<DataTable> branchTable;
+	ref_ptr<DataTable> photonTable;
+	mutable std::vector<Species> pdSpecies; // pdSpecies[Z * 31 + N]
+	mutable std::vector<std::atomic<bool> > pdLoaded;
 
 	static const double lgmin; // minimum log10(Lorentz-factor)
 	static const double lgmax; // maximum log10(Lorentz-factor)
 	static const size_t nlg; // number of Lorentz-factor steps
 
+	// load a table with nKeys leading values and nlg values per row
+	ref_ptr<DataTable> loadTable(std::string filename, size_t nKeys) const;
+	void unloadSpecies();
+	// tables of the nucleus (Z, N) or 0 if there are none
+	const Species *getSpecies(int Z, int N) const;
+
 public:
 	/** Constructor.
 	 @param photonField		target photon field
@@ -67,11 +97,37 @@ public:
 	void setInteractionTag(std::string tag);
 	std::string getInteractionTag() const;
 
+	/** Use compact tables with single precision values in contiguous arrays
+	 * instead of double precision tables, the loaded nuclei are loaded again
+	 * @param compact	use compact tables
+	 * @param tolerance	tabulate the total interaction rate on segments as coarse
+	 *					as this relative interpolation error allows, see
+	 *					AdaptiveTable (0: all nodes)
+	 */
+	void setCompactTables(bool compact, double tolerance = 0);
+
 	void initRate(std::string filename);
 	void initBranching(std::string filename);
 	void initPhotonEmission(std::string filename);
 
+	/** The tables of a nucleus are loaded when it is first seen.
+	 Preload the nucleus id, e.g. before timing a simulation.
+	 */
+	void preload(int id);
+	/** Preload all nuclei up to the mass number of the heaviest nucleus
+	 of the composition, which are the ones its nuclei can disintegrate into.
+	 */
+	void preload(const SourceComposition &composition);
+	/** True if the tables of the nucleus id are loaded */
+	bool isLoaded(int id) const;
+
 	void process(Candidate *candidate) const;
+	/** Step limit at the current state, see Module::getStepLimit */
+	double getStepLimit(const Candidate *candidate) const;
+	/** Interaction rate at the current state, see Module::getInteractionRate */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Perform one interaction in a channel selected by the partial rates, see InteractionManager */
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 
 	/**
@@ -3,8 +3,11 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Units.h"
 
 #include <vector>
+#include <string>
+#include <stdint.h>
 
 namespace crpropa {
 /**
@@ -18,11 +21,72 @@ struct SophiaEventOutput {
 	std::vector<int> id;
 };
 
+/**
+ @class SophiaEventLibrary
+ @brief Pre-tabulated SOPHIA events for a fast sampling of photo-pion interactions.
+
+ The events of protons and neutrons on one photon field are binned
+ logarithmically in the nucleon energy at z = 0, with the same number of events
+ per bin. Each event is generated at a random energy in its bin, with the target
+ photon sampled from the photon field, and stores the SOPHIA particle ids and the
+ energies relative to the nucleon energy. A draw takes a random event from the bin
+ and scales it to the energy of the interacting nucleon.
+ The library is created with PhotoPionProduction::createEventLibrary.
+ */
+class SophiaEventLibrary: public Referenced {
+	std::string fieldName;
+	double logEmin, logEmax;
+	size_t nBins, nEvents;
+	std::vector<uint32_t> eventOffset[2]; ///< first particle of each event, index 0: proton, 1: neutron
+	std::vector<int8_t> eventId[2]; ///< SOPHIA particle ids
+	std::vector<float> eventFraction[2]; ///< particle energy / nucleon energy
+
+public:
+	/** Empty library, filled with addEvent
+	 @param fieldName	name of the photon field
+	 @param Emin		minimum nucleon energy
+	 @param Emax		maximum nucleon energy
+	 @param nBins		number of logarithmic energy bins
+	 @param nEvents		number of events per bin
+	 */
+	SophiaEventLibrary(std::string fieldName, double Emin, double Emax, size_t nBins, size_t nEvents);
+	/** Load a library written with save */
+	SophiaEventLibrary(std::string filename);
+	void save(std::string filename) const;
+
+	/** Append an event to the next bin that is not full
+	 @param onProton	proton or neutron
+	 @param id			SOPHIA ids of the out-going particles
+	 @param fraction	energies of the out-going particles relative to the nucleon energy
+	 */
+	void addEvent(bool onProton, const std::vector<int> &id, const std::vector<double> &fraction);
+	/** True if all bins are full for protons and neutrons */
+	bool isComplete() const;
+
+	/** Draw an event of the bin of the nucleon energy E
+	 @param onProton	proton or neutron
+	 @param E			nucleon energy
+	 @param id			points to the SOPHIA ids of the particles
+	 @param fraction	points to the energies of the particles relative to the nucleon energy
+	 @return			number of particles, -1 outside the energy range
+	 */
+	int sample(bool onProton, double E, const int8_t *&id, const float *&fraction) const;
+
+	std::string getFieldName() const;
+	double getMinimumEnergy() const;
+	double getMaximumEnergy() const;
+	size_t getNumberOfBins() const;
+	size_t getEventsPerBin() const;
+	/** Lower edge of the energy bin i, getBinEdge(nBins) is the maximum energy */
+	double getBinEdge(size_t i) const;
+};
+
 /**
  @class PhotoPionProduction
  @brief Photo-pion interactions of nuclei with background photons.
  */
 class PhotoPionProduction: public Module {
+	friend class InteractionTables;
 
 protected:
 	ref_ptr<PhotonField> photonField;
@@ -30,6 +94,8 @@ protected:
 	std::vector<double> tabRedshifts;  ///< redshifts (optional for haveRedshiftDependence)
 	std::vector<double> tabProtonRate; ///< interaction rate in [1/m] for protons
 	std::vector<double> tabNeutronRate; ///< interaction rate in [1/m] for neutrons
+	RedshiftCache protonSlice; ///< tabProtonRate at the redshift of the candidate (haveRedshiftDependence)
+	RedshiftCache neutronSlice; ///< tabNeutronRate at the redshift of the candidate (haveRedshiftDependence)
 	double limit; ///< fraction of mean free path to limit the next step
 	bool havePhotons;
 	bool haveNeutrinos;
@@ -37,11 +103,17 @@ protected:
 	bool haveAntiNucleons;
 	bool haveRedshiftDependence;
 	std::string interactionTag = "PPP";
+	ref_ptr<SophiaEventLibrary> eventLibrary;
+
+	// minimum nucleon energy for SOPHIA on the photon field
+	double energyThreshold() const;
+	// rates at all tabulated Lorentz factors at redshift z, cached per thread
+	const std::vector<double> &rateSlice(double z, bool onProton) const;
 
 	// called by: sampleEps
 	// - input: s [GeV^2]
 	// - output: (s-p^2) * sigma_(nucleon/gamma) [GeV^2 * mubarn]
-	double functs(double s, bool onProton) const;
+	static double functs(double s, bool onProton);
 
 	// called by: sampleEps, gaussInt
 	// - input: photon energy eps [eV], Ein [GeV]
@@ -65,30 +137,30 @@ protected:
 	// called by: functs
 	// - input: photon energy [eV]
 	// - output: crossection of nucleon-photon-interaction [mubarn]
-	double crossection(double eps, bool onProton) const;
+	static double crossection(double eps, bool onProton);
 
 	// called by: crossection
 	// - input: photon energy [eV], threshold [eV], max [eV], unknown [no unit]
 	// - output: unknown [no unit]
-	double Pl(double eps, double xth, double xMax, double alpha) const;
+	static double Pl(double eps, double xth, double xMax, double alpha);
 
 	// called by: crossection
 	// - input: photon energy [eV], threshold [eV], unknown [eV]
 	// - output: unknown [no unit]
-	double Ef(double eps, double epsTh, double w) const;
+	static double Ef(double eps, double epsTh, double w);
 
 	// called by: crossection
 	// - input: cross section [µbarn], width [GeV], mass [GeV/c^2], rest frame photon energy [GeV]
 	// - output: Breit-Wigner crossection of a resonance of width Gamma
-	double breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) const;
+	static double breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton);
 
 	// called by: probEps, crossection, breitwigner, functs
 	// - input: is proton [bool]
 	// - output: mass [Gev/c^2]
-	double mass(bool onProton) const;
+	static double mass(bool onProton);
 
 	// - output: [GeV^2] head-on collision 
-	double sMin() const;
+	static double sMin();
 
 	bool sampleLog = true;
 	double correctionFactor = 1.6; // increeses the maximum of the propability function
@@ -145,6 +217,23 @@ public:
 
 	void initRate(std::string filename);
 
+	/** Draw the interactions from a library of SOPHIA events instead of running
+	 SOPHIA and sampleEps for each interaction. Redshift is accounted for by the
+	 library bin at E(1+z), as for the interaction rates; nucleons outside the
+	 energy range of the library still run SOPHIA.
+	 @param library	events on the photon field of this module, NULL to switch off
+	 */
+	void setEventLibrary(ref_ptr<SophiaEventLibrary> library);
+	ref_ptr<SophiaEventLibrary> getEventLibrary() const;
+
+	/** Run SOPHIA on the photon field of this module at z = 0 for an event library
+	 @param nEvents	number of events per bin and nucleon
+	 @param Emin	minimum nucleon energy
+	 @param Emax	maximum nucleon energy
+	 @param nBins	number of logarithmic energy bins
+	 */
+	ref_ptr<SophiaEventLibrary> createEventLibrary(size_t nEvents = 1000, double Emin = 1e16 * eV, double Emax = 1e23 * eV, size_t nBins = 70) const;
+
 	/** get the mean free path (MFP) for a single nucleon. 
 	 *  To get the MFP for the full nucleus the nucleonMFP has to be divided by by the nucleiModification factor
 	 * @param gamma 	Lorentz factor of the nucleon
@@ -160,6 +249,12 @@ public:
 	 */
 	double nucleiModification(int A, int X) const;
 	void process(Candidate *candidate) const;
+	/** Step limit at the current state, see Module::getStepLimit */
+	double getStepLimit(const Candidate *candidate) const;
+	/** Interaction rate at the current state, see Module::getInteractionRate */
+	double getInteractionRate(const Candidate *candidate) const;
+	/** Perform one interaction in a channel selected by the partial rates, see InteractionManager */
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, bool onProton) const;
 
 	/**
@@ -0,0 +1,69 @@
+#ifndef CRPROPA_PROPAGATION1D_H
+#define CRPROPA_PROPAGATION1D_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/Redshift.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class Propagation1D
+ @brief Fused propagation of 1D simulations from the source to the observer at x = 0.
+
+ Replaces SimplePropagation, Redshift and Observer1D of a 1D simulation with
+ the candidates at the distance x > 0 from the observer, moving towards it.
+ A call of process() propagates the candidate in steps until it reaches
+ x = 0 or becomes inactive: each step moves it by the step towards the
+ observer, updates the redshift with the adiabatic loss as Redshift does and
+ then calls the added modules (interactions, break conditions) in the order
+ they were added. The distance to the observer is kept between the steps
+ and only the x-component of the position is updated, y and z are set to 0.
+
+ Reaching the observer, the detection action (e.g. an output) is called and
+ the candidate is deactivated. Secondaries are collected as usual and
+ propagated by the ModuleList after their parent, so the ModuleList of the
+ simulation contains only this module. The results agree with those of the
+ separate modules, but the module list is run once per candidate instead
+ of once per step.
+ */
+class Propagation1D: public Module {
+private:
+	std::vector<ref_ptr<Module> > modules;
+	ref_ptr<Module> detectionAction;
+	Redshift redshift;
+	double minStep, maxStep;
+
+public:
+	/** Constructor
+	 @param minStep		minimum step, as for SimplePropagation
+	 @param maxStep		maximum step, as for SimplePropagation
+	 */
+	Propagation1D(double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+
+	/** Add a module called after each step, e.g. an interaction */
+	void add(Module *module);
+	std::size_t size() const;
+	ref_ptr<Module> operator[](const std::size_t i);
+	/** Module called with the candidate when it reaches the observer */
+	void onDetection(Module *action);
+
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATION1D_H
@@ -22,6 +22,12 @@ namespace crpropa {
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
  For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+
+ With a fixed step size (minStep == maxStep) a batch of candidates
+ (see Module::processBatch) is pushed together: the fields of all charged
+ candidates are gathered with one MagneticField::getFields call per redshift
+ and the Boris push runs on structure of arrays, which the compiler
+ vectorises across the candidates. The result is the same as from process.
  */
 class PropagationBP: public Module {
 
@@ -77,6 +83,10 @@ public:
 	 * @param candidate	 The Candidate is a passive object, that holds the information about the state of the cosmic ray and the simulation itself. */
 	void process(Candidate *candidate) const;
 
+	/** Propagates a batch of candidates, vectorised across the candidates for a fixed step size.
+	 * With the adaptive step size each candidate is processed on its own. */
+	void processBatch(Candidate **candidates, size_t n) const;
+
 	/** Calculates the new position and direction of the particle based on the solution of the Lorentz force
 	 * @param pos	current position of the candidate
 	 * @param dir	current direction of the candidate
@@ -102,6 +112,17 @@ public:
 	 * @return	  magnetic field vector at the position pos 
 	 */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
+	/** Hint the field that it will be needed at pos, see MagneticField::prefetch.
+	 Called with the end of the next step after each step. */
+	void prefetchField(const Vector3d &pos, double z) const;
+
+	/** Get magnetic field vectors at n positions with MagneticField::getFields
+	 * @param pos	positions of the candidates
+	 * @param B		magnetic field vectors at the positions, zero without a field
+	 * @param n		number of positions
+	 * @param z		redshift of the candidates
+	 */
+	void getFieldsAtPositions(const Vector3d *pos, Vector3d *B, size_t n, double z) const;
 
 	/** Adapt step size if required and calculates the new position and direction of the particle with the usage of the function dY
 	 * @param y		 current position and direction of candidate
@@ -76,6 +76,11 @@ public:
 	void tryStep(const Y &y, Y &out, Y &error, double t,
 			ParticleState &p, double z) const;
 
+	/** Step with the derivative k0 = dYdt(y, p, z) at the start, which is
+	 the same for all step sizes tried from y */
+	void tryStep(const Y &y, const Y &k0, Y &out, Y &error, double t,
+			ParticleState &p, double z) const;
+
 	void setField(ref_ptr<MagneticField> field);
 	void setTolerance(double tolerance);
 	void setMinimumStep(double minStep);
@@ -89,6 +94,9 @@ public:
 	 * @param z	 current redshift is needed to calculate the magnetic field
 	 * @return	  magnetic field vector at the position pos */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
+	/** Hint the field that it will be needed at pos, see MagneticField::prefetch.
+	 Called with the end of the next step after each step. */
+	void prefetchField(const Vector3d &pos, double z) const;
 
 	double getTolerance() const;
 	double getMinimumStep() const;
@@ -0,0 +1,128 @@
+#ifndef CRPROPA_PROPAGATIONDP_H
+#define CRPROPA_PROPAGATIONDP_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "kiss/logger.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation 
+ * @{
+ */
+
+/**
+ @class PropagationDP
+ @brief Rectilinear propagation through magnetic fields using the Dormand-Prince method.
+
+ This module solves the equations of motion of a relativistic charged particle when propagating through a magnetic field.\n
+ It uses the embedded Runge-Kutta method of Dormand and Prince, which continues with the 5th order solution and estimates the error with the embedded 4th order one.\n
+ The last of the seven stages is the derivative at the end of the step, so a step needs six field evaluations and the field at the end of a step is reused as the first stage of the next step (first same as last).
+ It is remembered per thread and reused if the candidate starts the next step at the same position and redshift, e.g. it is not reused for alternating candidates or when the redshift changes in every step.\n
+ The step size control tries to keep the error of the direction close to, but smaller than the designated tolerance, like in PropagationCK, with a PI controller that also takes the error of the previous step into account.
+ Additionally a minimum and maximum size for the steps can be set.
+ For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ */
+class PropagationDP: public Module {
+public:
+	class Y {
+	public:
+		Vector3d x, u; /*< phase-point: position and direction */
+
+		Y() {
+		}
+
+		Y(const Vector3d &x, const Vector3d &u) :
+				x(x), u(u) {
+		}
+
+		Y(double f) :
+				x(Vector3d(f, f, f)), u(Vector3d(f, f, f)) {
+		}
+
+		Y operator *(double f) const {
+			return Y(x * f, u * f);
+		}
+
+		Y &operator +=(const Y &y) {
+			x += y.x;
+			u += y.u;
+			return *this;
+		}
+	};
+
+private:
+	struct LastStep {
+		Vector3d position; /*< end of the last step */
+		double redshift;
+		Vector3d field; /*< field at the end of the last step */
+		double errorRatio; /*< error of the last step relative to the tolerance */
+		bool valid;
+		char padding[64]; // avoid false sharing between threads
+		LastStep() : redshift(0), errorRatio(1), valid(false), padding() {
+		}
+	};
+
+	ref_ptr<MagneticField> field;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+	mutable std::vector<LastStep> lastSteps; /*< one per thread */
+
+	LastStep *lastStep() const;
+
+public:
+	/** Constructor for the adaptive Dormand-Prince method.
+	 * @param field
+	 * @param tolerance	 tolerance is criterion for step adjustment. Step adjustment takes place only if minStep < maxStep
+	 * @param minStep	   minStep/c_light is the minimum integration time step
+	 * @param maxStep	   maxStep/c_light is the maximum integration time step. 
+	 */
+	PropagationDP(ref_ptr<MagneticField> field = NULL, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+
+	void process(Candidate *candidate) const;
+
+	// derivative of phase point, dY/dt = d/dt(x, u) = (v, du/dt)
+	// du/dt = q*c^2/E * (u x B)
+	Y dYdt(const Y &y, ParticleState &p, double z) const;
+	/** Derivative of the phase point for the field B at its position */
+	Y dYdt(const Y &y, ParticleState &p, const Vector3d &B) const;
+
+	void tryStep(const Y &y, Y &out, Y &error, double t,
+			ParticleState &p, double z) const;
+
+	/** Step with the derivative k0 = dYdt(y, p, z) at the start.
+	 @param fieldOut	field at the position of out, from the last stage
+	 */
+	void tryStep(const Y &y, const Y &k0, Y &out, Y &error,
+			Vector3d &fieldOut, double t, ParticleState &p, double z) const;
+
+	/** Set the field, forgets the fields remembered from the last steps.
+	 Call outside of parallel regions. */
+	void setField(ref_ptr<MagneticField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	ref_ptr<MagneticField> getField() const;
+
+	/** get magnetic field vector at current candidate position
+	 * @param pos   current position of the candidate
+	 * @param z	 current redshift is needed to calculate the magnetic field
+	 * @return	  magnetic field vector at the position pos */
+	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONDP_H
@@ -0,0 +1,112 @@
+#ifndef CRPROPA_PROPAGATIONGC_H
+#define CRPROPA_PROPAGATIONGC_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/PropagationCK.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation 
+ * @{
+ */
+
+/**
+ @class PropagationGC
+ @brief Propagation through slowly varying magnetic fields following the guiding centre.
+
+ Where the field changes little over a Larmor radius, the module follows the
+ guiding centre of the gyration instead of resolving every gyration: it moves
+ along the field line with the parallel velocity, drifts due to the gradient
+ of the field strength and the curvature of the field lines, and the parallel
+ velocity changes with the mirror force, keeping the magnetic moment
+ constant. The steps are a fraction of the length scale of the field, which
+ can be many Larmor radii.
+
+ The field is considered slowly varying if the Larmor radius r_L = E / (|q| c B)
+ times the gradient of the field (derivatives along all axes, by central
+ differences over a tenth of the Larmor radius) divided by the field strength
+ is smaller than the adiabaticity parameter epsilon. Elsewhere the full orbit
+ is integrated with PropagationCK, so the module switches between both
+ automatically.
+
+ The candidate always keeps the position and direction of the particle: the
+ guiding centre is computed from them at the start of a step, and after the
+ step of the guiding centre the particle is placed on its gyration with the
+ phase advanced by the gyration frequency. The step size is the path length
+ of the particle, as for the other propagation modules. Each guiding centre
+ step takes 31 field evaluations.
+ */
+class PropagationGC: public Module {
+private:
+	ref_ptr<MagneticField> field;
+	ref_ptr<PropagationCK> fullOrbit;
+	double epsilon; /*< maximum Larmor radius relative to the length scale of the field for guiding centre steps */
+	double stepFraction; /*< guiding centre step relative to the length scale of the field */
+
+	/** Field at a position and its geometry from central differences with the given spacing
+	 @param gradB		gradient of the field strength
+	 @param curvature	curvature vector of the field lines (b . grad) b
+	 @return			length scale of the field, B / |dB_i/dx_j|
+	 */
+	double fieldGeometry(const Vector3d &position, double z, double delta,
+			Vector3d &B, Vector3d &gradB, Vector3d &curvature) const;
+
+	/** Time derivative of the guiding centre position and the parallel velocity */
+	double derivative(const Vector3d &R, double vPar, double z, double energy,
+			double charge, double delta, Vector3d &dRdt, double &dvPardt,
+			Vector3d &B) const;
+
+public:
+	/** Constructor
+	 * @param field
+	 * @param tolerance	 target error of the full orbit integration with PropagationCK
+	 * @param minStep	   minimum step
+	 * @param maxStep	   maximum step
+	 * @param epsilon	   maximum Larmor radius relative to the length scale of the field for guiding centre steps
+	 * @param stepFraction  guiding centre step relative to the length scale of the field
+	 */
+	PropagationGC(ref_ptr<MagneticField> field = NULL, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc),
+			double epsilon = 0.01, double stepFraction = 0.1);
+
+	void process(Candidate *candidate) const;
+
+	/** Guiding centre step, to be used where the field is slowly varying.
+	 @return false, and the candidate is not changed, if the field is not slowly varying
+	 */
+	bool guidingCentreStep(Candidate *candidate) const;
+
+	/** Larmor radius relative to the length scale of the field at a position,
+	 as compared to epsilon */
+	double getAdiabaticity(const Vector3d &position, double z, double energy,
+			double charge) const;
+
+	void setField(ref_ptr<MagneticField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+	void setEpsilon(double epsilon);
+	void setStepFraction(double stepFraction);
+
+	ref_ptr<MagneticField> getField() const;
+
+	/** get magnetic field vector at current candidate position
+	 * @param pos   current position of the candidate
+	 * @param z	 current redshift is needed to calculate the magnetic field
+	 * @return	  magnetic field vector at the position pos */
+	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	double getEpsilon() const;
+	double getStepFraction() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONGC_H
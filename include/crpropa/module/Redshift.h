@@ -12,10 +12,15 @@ namespace crpropa {
 /**
  @class Redshift
  @brief Updates redshift and applies adiabatic energy loss according to the traveled distance.
+
+ The change in redshift is dz = H(z) / c * ds for small steps. For steps
+ with dz > 1e-3, e.g. of FastNeutralPropagation, the redshift is taken from
+ the comoving distance to z minus the step.
  */
 class Redshift: public Module {
 public:
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 	std::string getDescription() const;
 };
 
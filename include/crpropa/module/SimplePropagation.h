@@ -25,6 +25,7 @@ private:
 public:
 	SimplePropagation(double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
 	void process(Candidate *candidate) const;
+	void processBatch(Candidate **candidates, size_t n) const;
 	void setMinimumStep(double minStep);
 	void setMaximumStep(double maxStep);
 	double getMinimumStep() const;
@@ -0,0 +1,54 @@
+#ifndef CRPROPA_STEPPLANNER_H
+#define CRPROPA_STEPPLANNER_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class StepPlanner
+ @brief Limits the next step with the estimates of the registered modules.
+
+ Interaction modules limit the next step in process() with the state after
+ their own interaction, so modules later in the list can change the state
+ after the limit has been set. The StepPlanner is put directly before the
+ propagation module and limits the next step with Module::getStepLimit of
+ all registered modules at the state the step starts from. The propagation
+ module thus starts its first trial with the binding limit of all modules.
+ The registered modules are not processed by the planner and still have to
+ be added to the ModuleList.
+ */
+class StepPlanner: public Module {
+private:
+	std::vector<ref_ptr<Module> > modules;
+	double minStep;
+
+public:
+	/** Constructor
+	 @param minStep	lower bound of the planned step, e.g. the minimum step of the propagation module
+	 */
+	StepPlanner(double minStep = 0);
+	/** Register a module providing Module::getStepLimit */
+	void add(Module *module);
+	std::size_t size() const;
+	ref_ptr<Module> operator[](const std::size_t i);
+
+	void setMinimumStep(double minStep);
+	double getMinimumStep() const;
+
+	/** Smallest step limit of the registered modules, at least minStep */
+	double getStepLimit(const Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_STEPPLANNER_H
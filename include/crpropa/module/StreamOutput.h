@@ -0,0 +1,107 @@
+#ifndef CRPROPA_STREAMOUTPUT_H
+#define CRPROPA_STREAMOUTPUT_H
+
+#include "crpropa/module/Output.h"
+#include "crpropa/AsyncPipeline.h"
+#include "crpropa/MemoryUsage.h"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class OutputChunk
+ @brief Rows of the candidates passed by a StreamOutput, row-major
+ */
+class OutputChunk: public Referenced {
+public:
+	std::vector<double> values; ///< rows * width values
+	size_t rows, width;
+	MemoryAccount memory; ///< reserved values in MemoryUsage::OutputBuffers
+
+	OutputChunk(size_t width);
+	size_t getRows() const;
+	size_t getWidth() const;
+};
+
+/**
+ @class StreamOutput
+ @brief Output passing the candidates in chunks of rows to the application.
+
+ For every candidate, the enabled columns (as for the other outputs, but
+ without the column density and the tag) and the enabled numerical
+ properties are written to one row of doubles. Energies and lengths are in
+ units of the energy and length scale, ids and serial numbers are exact.
+ Every chunkSize rows, onChunk is called with the chunk. By default the chunks
+ are queued until they are taken with popChunk; in Python, onChunk can be
+ overridden or the queued chunks can be read with popChunk while the
+ simulation runs in another thread, e.g. chunk.getArray() as NumPy array.
+ Call flush() or close() to pass the last, incomplete chunk.
+ With setAsync, the rows are collected by the writer thread of an
+ AsyncPipeline, which also calls onChunk, so the simulation threads do not
+ wait for the consumer.
+ */
+class StreamOutput: public Output {
+	size_t chunkSize;
+	mutable ref_ptr<OutputChunk> chunk; ///< chunk being filled
+	mutable std::mutex chunkMutex;
+	mutable std::mutex queueMutex;
+	mutable std::deque<ref_ptr<OutputChunk> > queue;
+	AsyncPipeline<std::vector<double>, StreamOutput> *pipeline;
+
+	void consume(std::vector<double> &row) const;
+	void commit() const;
+	friend class AsyncPipeline<std::vector<double>, StreamOutput>;
+
+	size_t getRowWidth() const;
+	void fillRow(const Candidate *candidate, double *row) const;
+	void append(const std::vector<double> &row) const;
+	void deliver() const; ///< pass the current chunk to onChunk
+
+public:
+	/** Constructor
+	 @param chunkSize	number of rows of a chunk
+	 @param outputType	type of output: Trajectory1D, Trajectory3D, Event1D, Event3D, Everything
+	 */
+	StreamOutput(size_t chunkSize = 1024, OutputType outputType = Everything);
+	~StreamOutput();
+
+	void process(Candidate *candidate) const;
+
+	/** Called with every full chunk and by flush() with the last rows.
+	 Queues the chunk by default. */
+	virtual void onChunk(OutputChunk *chunk) const;
+	/** Next queued chunk, NULL if there is none */
+	ref_ptr<OutputChunk> popChunk();
+	size_t getNumberOfQueuedChunks() const;
+
+	/** Names of the values of a row, e.g. "E" or "X0", as in HDF5Output */
+	std::vector<std::string> getColumnNames() const;
+	void setChunkSize(size_t size);
+	size_t getChunkSize() const;
+
+	/** Collect the rows in the writer thread of an AsyncPipeline
+	 @param async		enable the pipeline
+	 @param capacity	number of rows buffered per thread
+	 */
+	void setAsync(bool async = true, size_t capacity = 4096);
+	bool getAsync() const;
+
+	/** Pass the rows collected so far as a chunk to onChunk */
+	void flush() const;
+	void close();
+
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_STREAMOUTPUT_H
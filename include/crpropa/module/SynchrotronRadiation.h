@@ -2,6 +2,7 @@
 #define CRPROPA_SYNCHROTRONRADIATION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/magneticField/MagneticField.h"
 
 namespace crpropa {
@@ -17,10 +18,18 @@ namespace crpropa {
  This module simulates the continuous energy loss of charged particles in magnetic fields, c.f. Jackson.
  The magnetic field is specified either by a MagneticField or by a RMS field strength value.
  The module limits the next step size to ensure a fractional energy loss dE/E < limit (default = 0.1).
+ With setExactLoss the loss dE/dx ~ E^2 is integrated over the step, E' = E / (1 + dE/dx * step / E),
+ instead of the linear loss, so that larger limits can be used.
  Optionally, synchrotron photons above a threshold (default E > 10^6 eV) are created as secondary particles.
  Note that the large number of secondary photons per propagation can cause memory problems.
  To mitigate this, use thinning. However, this still does not solve the problem completely.
  For this reason, a break-condition stops tracking secondary photons and reweights the current ones. 
+ Alternatively, with setPacketBins the emission of a step is aggregated into
+ one weighted photon per bin of the tabulated spectrum, whose weight is the
+ expected number of photons of the step in that bin and whose energy is drawn
+ from the spectrum within the bin. The number of secondaries per step is then
+ at most the number of bins, independent of the energy loss, and the emitted
+ energy is conserved on average.
  */
 class SynchrotronRadiation: public Module {
 private:
@@ -29,10 +38,16 @@ private:
 	double limit; ///< fraction of energy loss length to limit the next step
 	double thinning; ///< thinning parameter for weighted-sampling (maximum 1, minimum 0)
 	bool havePhotons; ///< flag for production of secondary photons
+	bool exactLoss; ///< integrate the energy loss over the step
 	int maximumSamples; ///< maximum number of samples of synchrotron photons (break condition; defaults to 100; 0 or <0 means no sampling)
 	double secondaryThreshold; ///< threshold energy for secondary photons
 	std::vector<double> tabx; ///< tabulated fraction E_photon/E_critical from 10^-6 to 10^2 in 801 log-spaced steps
 	std::vector<double> tabCDF; ///< tabulated CDF of synchrotron spectrum
+	AliasTable tabAlias; ///< alias table of tabCDF for sampling
+	int packetBins; ///< number of bins of aggregated emission, 0 for individual photons
+	std::vector<size_t> packetEdges; ///< first tabulated bin of each packet bin and the end
+	std::vector<double> packetProbability; ///< fraction of the photons in each packet bin
+	double meanX; ///< mean fraction E_photon/E_critical of the photons
 	std::string interactionTag = "SYN";
 
 public:
@@ -72,6 +87,11 @@ public:
 	 */
 	void setLimit(double limit);
 
+	/** Integrate the energy loss dE/dx ~ E^2 over the step instead of the linear approximation
+	 * @param exact	integrate the energy loss
+	 */
+	void setExactLoss(bool exact);
+
 	/** Set the maximum number of synchrotron photons that will be allowed to be added as candidates. 
 	 This choice depends on the problem at hand. It must be such that all relevant physics is captured with the sample. Weights are added accordingly and the column 'weight' must be added to output.
 	 @param nmax	maximum number of synchrotron photons to be sampled
@@ -82,6 +102,12 @@ public:
 	 @param threshold	energy threshold above which photons will be added [in Joules]
 	 */
 	void setSecondaryThreshold(double threshold);	
+	/** Aggregate the synchrotron photons of a step into weighted packets in
+	 log-spaced bins of the tabulated spectrum, instead of sampling individual photons.
+	 The thinning and maximum number of samples do not apply to the packets.
+	 @param nBins	number of bins (0: individual photons)
+	 */
+	void setPacketBins(int nBins);
 	void setInteractionTag(std::string tag);
 	ref_ptr<MagneticField> getField();
 
@@ -89,8 +115,10 @@ public:
 	bool getHavePhotons();
 	double getThinning();
 	double getLimit();
+	bool getExactLoss() const;
 	int getMaximumSamples();
 	double getSecondaryThreshold() const;
+	int getPacketBins() const;
 	std::string getInteractionTag() const;
 
 	void initSpectrum();
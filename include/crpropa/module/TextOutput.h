@@ -3,6 +3,8 @@
 
 #include "crpropa/module/Output.h"
 #include "crpropa/module/ParticleCollector.h"
+#include "crpropa/AsyncPipeline.h"
+#include "crpropa/OrderedRecords.h"
 
 #include <fstream>
 
@@ -16,7 +18,8 @@ namespace crpropa {
  @class TextOutput
  @brief Configurable plain text output for particle information.
  This type of output can also be used to generate a .tar.gz file if
- the library zlib is available. For details see:
+ the library zlib is available, compressed by background threads.
+ For details see:
  	http://zlib.net/
  */
 class TextOutput: public Output {
@@ -25,8 +28,14 @@ protected:
 	std::ofstream outfile;
 	std::string filename;
 	bool storeRandomSeeds;
+	size_t compressionThreads;
+	AsyncPipeline<std::string, TextOutput> *pipeline;
+	OrderedRecords *ordered;
 	
 	void printHeader() const;
+	void consume(std::string &line) const;
+	void commit() const;
+	friend class AsyncPipeline<std::string, TextOutput>;
 
 public:
 	/** Default constructor
@@ -61,6 +70,34 @@ public:
 	 This enables reproducibility of each realisation of the simulation.
 	 */
 	void enableRandomSeeds() {storeRandomSeeds = true;};
+	/** Write the output from a background thread.
+	 The lines are formatted by the calling threads and handed to the writer
+	 thread through per-thread buffers, so that the simulation does not wait
+	 for the file system. size() only counts the lines already written.
+	 @param async		enable the asynchronous output
+	 @param capacity	number of lines buffered per thread
+	 */
+	void setAsync(bool async = true, size_t capacity = 4096);
+	bool getAsync() const;
+	/** Write the lines in the order of the source serial numbers and then
+	 the serial numbers. The threads collect their lines in sorted runs,
+	 which close() merges into the file. Lines of the same candidate, e.g.
+	 the steps of a trajectory, keep their order. ModuleList::run(source)
+	 numbers the primaries by their index, and the secondaries of a primary
+	 get increasing numbers on the thread that propagates it, so the order
+	 of the file does not depend on the number of threads. size() only
+	 counts the lines already written. Not used with setAsync.
+	 @param ordered	enable the ordered output
+	 @param runSize	number of lines buffered per thread before they are written to a temporary file
+	 */
+	void setOrdered(bool ordered = true, size_t runSize = 65536);
+	bool getOrdered() const;
+	/** Number of background threads compressing the gzip output, see ParallelGzipStream.
+	 The blocks of the file are compressed in parallel and written in order,
+	 0 compresses in the writing thread. Default 1.
+	 */
+	void setCompressionThreads(size_t threads);
+	size_t getCompressionThreads() const;
 	void close();
 	void gzip();
 	void process(Candidate *candidate) const;
@@ -1,8 +1,14 @@
 #ifndef KISS_LOG_H
 #define KISS_LOG_H
 
+#include <atomic>
 #include <iostream>
 
+/* Messages above this level are removed at compile time, 0 (errors only) to 3 (all, default) */
+#ifndef KISS_LOG_MIN_LEVEL
+#define KISS_LOG_MIN_LEVEL 3
+#endif
+
 namespace kiss {
 
 enum eLogLevel {
@@ -45,11 +51,36 @@ public:
 	}
 };
 
+/* Number of messages of one call site for the limited log macros */
+class LogLimit {
+	std::atomic<unsigned long> count;
+public:
+	LogLimit() : count(0) {
+	}
+	/* True for the first n calls, the call after them reports the suppression */
+	bool allow(unsigned long n, eLogLevel level, const char *file, int line);
+	unsigned long getCount() const {
+		return count.load(std::memory_order_relaxed);
+	}
+};
+
 } // namespace kiss
 
-#define KISS_LOG_ERROR if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_ERROR) {} else kiss::Logger(kiss::LOG_LEVEL_ERROR)
-#define KISS_LOG_WARNING if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_WARNING) {} else kiss::Logger(kiss::LOG_LEVEL_WARNING)
-#define KISS_LOG_INFO if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_INFO) {} else kiss::Logger(kiss::LOG_LEVEL_INFO)
-#define KISS_LOG_DEBUG if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_DEBUG) {} else kiss::Logger(kiss::LOG_LEVEL_DEBUG)
+/* The constant KISS_LOG_MIN_LEVEL lets the compiler remove disabled messages with their arguments */
+#define KISS_LOG_ENABLED(level) ((KISS_LOG_MIN_LEVEL >= level) && (kiss::Logger::getLogLevel() >= level))
+
+#define KISS_LOG_ERROR if (!KISS_LOG_ENABLED(kiss::LOG_LEVEL_ERROR)) {} else kiss::Logger(kiss::LOG_LEVEL_ERROR)
+#define KISS_LOG_WARNING if (!KISS_LOG_ENABLED(kiss::LOG_LEVEL_WARNING)) {} else kiss::Logger(kiss::LOG_LEVEL_WARNING)
+#define KISS_LOG_INFO if (!KISS_LOG_ENABLED(kiss::LOG_LEVEL_INFO)) {} else kiss::Logger(kiss::LOG_LEVEL_INFO)
+#define KISS_LOG_DEBUG if (!KISS_LOG_ENABLED(kiss::LOG_LEVEL_DEBUG)) {} else kiss::Logger(kiss::LOG_LEVEL_DEBUG)
+
+/* Log at most n messages of a call site, e.g. for warnings in every step;
+ the message after them notes that further ones are suppressed */
+#define KISS_LOG_LIMITED(level, n) if (!KISS_LOG_ENABLED(level) \
+	|| !([]() -> kiss::LogLimit & { static kiss::LogLimit limit; return limit; }()).allow(n, level, __FILE__, __LINE__)) {} \
+	else kiss::Logger(level)
+#define KISS_LOG_ERROR_LIMITED(n) KISS_LOG_LIMITED(kiss::LOG_LEVEL_ERROR, n)
+#define KISS_LOG_WARNING_LIMITED(n) KISS_LOG_LIMITED(kiss::LOG_LEVEL_WARNING, n)
+#define KISS_LOG_WARNING_ONCE KISS_LOG_LIMITED(kiss::LOG_LEVEL_WARNING, 1)
 
 #endif /* KISSLOG_H */
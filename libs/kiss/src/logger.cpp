@@ -53,6 +53,13 @@ eLogLevel Logger::getLogLevel() {
 	return (level);
 }
 
+bool LogLimit::allow(unsigned long n, eLogLevel level, const char *file, int line) {
+	unsigned long c = count.fetch_add(1, std::memory_order_relaxed);
+	if (c == n)
+		Logger(level) << "further messages from " << file << ":" << line << " are suppressed";
+	return c < n;
+}
+
 
 
 
@@ -0,0 +1,58 @@
+// messages above warnings are removed at compile time in this test
+#undef KISS_LOG_MIN_LEVEL
+#define KISS_LOG_MIN_LEVEL 1
+#include "kiss/logger.h"
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+
+using namespace kiss;
+
+static size_t countLines(const std::string &s) {
+	size_t n = 0;
+	for (size_t i = 0; i < s.size(); i++)
+		if (s[i] == '\n')
+			n++;
+	return n;
+}
+
+TEST(testLogger, minimumLevel) {
+	std::ostringstream out;
+	std::ostream &old = Logger::getLogStream();
+	eLogLevel oldLevel = Logger::getLogLevel();
+	Logger::setLogStream(out);
+	Logger::setLogLevel(LOG_LEVEL_DEBUG);
+
+	int evaluated = 0;
+	KISS_LOG_INFO << "info " << ++evaluated;
+	KISS_LOG_DEBUG << "debug " << ++evaluated;
+	EXPECT_EQ(0, evaluated);
+	EXPECT_TRUE(out.str().empty());
+	KISS_LOG_WARNING << "warning";
+	EXPECT_EQ(1, countLines(out.str()));
+
+	Logger::setLogStream(old);
+	Logger::setLogLevel(oldLevel);
+}
+
+TEST(testLogger, limited) {
+	std::ostringstream out;
+	std::ostream &old = Logger::getLogStream();
+	Logger::setLogStream(out);
+
+	for (size_t i = 0; i < 5; i++)
+		KISS_LOG_WARNING_LIMITED(2) << "step " << i;
+	// two messages and the note of the suppression
+	EXPECT_EQ(3, countLines(out.str()));
+	EXPECT_NE(std::string::npos, out.str().find("step 1"));
+	EXPECT_EQ(std::string::npos, out.str().find("step 2"));
+	EXPECT_NE(std::string::npos, out.str().find("suppressed"));
+
+	for (size_t i = 0; i < 3; i++)
+		KISS_LOG_WARNING_ONCE << "once";
+	EXPECT_EQ(5, countLines(out.str()));
+
+	Logger::setLogStream(old);
+}
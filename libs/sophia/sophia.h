@@ -10,6 +10,11 @@ void sophiaevent_(int& nature,                   // IN:  channel: 0 -> p, 1 -> n
 									int outPartID[2000],           // OUT: list of output particle IDs (see list below)
 									int& nParticles                // OUT: number of output particles
 		);
+
+// uniform random number in (0,1) for SOPHIA, implemented by the caller with
+// a generator per thread; SOPHIA keeps its state in thread private COMMON
+// blocks and may be called concurrently if compiled with OpenMP
+double sophiarandom_();
 }
 
 /*
@@ -1,7 +1,16 @@
 #include "myPlugin.h"
 
+#include <crpropa/Common.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 const std::string myPropertyName = "counter";
 
 // The parent's constructor need to be called on initialization!
@@ -32,3 +41,103 @@ void AddMyProperty::prepareCandidate(crpropa::Candidate &candidate) const
 {
 	candidate.setProperty(myPropertyName, crpropa::Variant::fromUInt32(0));
 }
+
+void MyModule::processBatch(crpropa::Candidate **candidates, size_t n) const
+{
+	// Overriding processBatch is optional, the default calls process() for
+	// each candidate. Batch kernels should loop over the candidates without
+	// virtual calls, here the counter is updated as in process().
+	for (size_t i = 0; i < n; i++) {
+		crpropa::Candidate *candidate = candidates[i];
+		if(candidate->hasProperty(myPropertyName)) {
+			uint32_t v = candidate->getProperty(myPropertyName);
+			candidate->setProperty(myPropertyName, crpropa::Variant::fromUInt32(v + 1));
+		}
+	}
+}
+
+// ------------------------------------------------------------------
+MyTable::MyTable(const std::string &filename)
+{
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		throw std::runtime_error("MyTable: could not open file " + filename);
+	std::string line;
+	while (std::getline(infile, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream ss(line);
+		double a, b;
+		if (ss >> a >> b) {
+			x.push_back(a);
+			y.push_back(b);
+		}
+	}
+	if (x.empty())
+		throw std::runtime_error("MyTable: no entries in " + filename);
+}
+
+crpropa::ref_ptr<MyTable> MyTable::load(const std::string &filename)
+{
+	// The kind of table, here "MyPlugin::MyTable", has to be unique. Tables
+	// computed instead of loaded can be provided with TableRegistry::add.
+	return crpropa::TableRegistry::get<MyTable>("MyPlugin::MyTable", filename);
+}
+
+double MyTable::interpolate(double v) const
+{
+	return crpropa::interpolate(v, x, y);
+}
+
+// ------------------------------------------------------------------
+MyField::MyField(double B0, double L) : B0(B0), L(L)
+{
+}
+
+crpropa::Vector3d MyField::getField(const crpropa::Vector3d &position) const
+{
+	return crpropa::Vector3d(0, position.x * (B0 / L), 0);
+}
+
+void MyField::getFields(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n, double z) const
+{
+	// The plugin is compiled for the generic instruction set, the variants
+	// for wider instruction sets are selected at runtime for the CPU.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	static const bool haveAVX2 = __builtin_cpu_supports("avx2");
+	if (haveAVX2) {
+		getFieldsAVX2(positions, fields, n);
+		return;
+	}
+#endif
+	getFieldsScalar(positions, fields, n);
+}
+
+void MyField::getFieldsScalar(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n) const
+{
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(positions[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("avx2")))
+void MyField::getFieldsAVX2(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n) const
+{
+	// four positions at once, the remainder as in the scalar variant
+	__m256d scale = _mm256_set1_pd(B0 / L);
+	double by[4];
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_set_pd(positions[i + 3].x, positions[i + 2].x, positions[i + 1].x, positions[i].x);
+		_mm256_storeu_pd(by, _mm256_mul_pd(x, scale));
+		for (size_t j = 0; j < 4; j++)
+			fields[i + j] = crpropa::Vector3d(0, by[j], 0);
+	}
+	getFieldsScalar(positions + i, fields + i, n - i);
+}
+#else
+void MyField::getFieldsAVX2(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n) const
+{
+	getFieldsScalar(positions, fields, n);
+}
+#endif
@@ -7,6 +7,11 @@
 
 #include <crpropa/Module.h>
 #include <crpropa/Source.h>
+#include <crpropa/TableRegistry.h>
+#include <crpropa/magneticField/MagneticField.h>
+
+#include <string>
+#include <vector>
 
 
 /// A custom C++ module
@@ -16,6 +21,9 @@ public:
 	/// The parent's constructor need to be called on initialization!
 	MyModule();
 	void process(crpropa::Candidate *candidate) const;
+	/// Optional: process several candidates at once, called by the batch
+	/// engines of the ModuleList instead of process for every candidate.
+	void processBatch(crpropa::Candidate **candidates, size_t n) const;
 };
 
 
@@ -27,3 +35,33 @@ public:
 	AddMyProperty();
 	void prepareCandidate(crpropa::Candidate &candidate) const;
 };
+
+
+/// A custom table, shared by all modules that load the same file through the
+/// TableRegistry of CRPropa. Tables must not be modified after loading.
+class MyTable : public crpropa::Referenced
+{
+public:
+	std::vector<double> x, y;
+	/// Loads two columns of a text file
+	MyTable(const std::string &filename);
+	/// Shared table of the file
+	static crpropa::ref_ptr<MyTable> load(const std::string &filename);
+	double interpolate(double x) const;
+};
+
+
+/// A custom magnetic field, B = B0 * x / L in y direction
+class MyField : public crpropa::MagneticField
+{
+	double B0, L;
+	void getFieldsScalar(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n) const;
+	void getFieldsAVX2(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n) const;
+public:
+	MyField(double B0, double L);
+	crpropa::Vector3d getField(const crpropa::Vector3d &position) const;
+	/// Optional: fields at several positions at once, called by the batch
+	/// propagation instead of getField for every position. The variant for
+	/// the instruction set of the CPU is selected at runtime.
+	void getFields(const crpropa::Vector3d *positions, crpropa::Vector3d *fields, size_t n, double z) const;
+};
@@ -18,6 +18,10 @@ source = crpropa.Source()
 source.add(myPlugin.AddMyProperty())
 print(source.getDescription())
 
+print("+++ Custom field")
+field = myPlugin.MyField(1*crpropa.nG, 1*crpropa.kpc)
+print(field.getField(crpropa.Vector3d(1*crpropa.kpc, 0, 0)) / crpropa.nG)
+
 print("+++ Starting Simulation")
 ml.run(source, 1)
 
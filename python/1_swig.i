@@ -89,6 +89,24 @@
   #include "numpy/ufuncobject.h"
 %}
 
+/* The GIL is released while the wrapped C++ functions run (threads="1"),
+   e.g. ModuleList::run, initTurbulence, loadGrid, MagneticLens::loadLens or
+   ParticleMapsContainer::applyLens, so Python threads keep running meanwhile.
+   Extensions working on Python objects are marked nothread and release the
+   GIL themselves with ReleaseGIL around their C++ part. The accessors of
+   vectors, particle states and candidates keep the GIL, see 2_headers.i. */
+%{
+// releases the GIL during its lifetime, also if the C++ code throws
+class ReleaseGIL {
+  PyThreadState *state;
+public:
+  ReleaseGIL() : state(PyEval_SaveThread()) {}
+  ~ReleaseGIL() {
+    PyEval_RestoreThread(state);
+  }
+};
+%}
+
 %init %{
   import_array();
   import_ufunc();
@@ -37,6 +37,8 @@
 %ignore operator crpropa::Candidate*;
 %ignore operator crpropa::Module*;
 %ignore operator crpropa::ModuleList*;
+%ignore crpropa::ModuleList::CandidateSequence;
+%ignore crpropa::ModuleList::addParallel;
 %ignore operator crpropa::Observer*;
 %ignore operator crpropa::ObserverFeature*;
 %ignore operator crpropa::MagneticField*;
@@ -50,7 +52,33 @@
 %ignore operator crpropa::Grid< crpropa::Vector3< double > >*;
 %ignore operator crpropa::Grid< float >*;
 %ignore operator crpropa::Grid< double >*;
+%ignore operator crpropa::Grid< crpropa::Vector3h >*;
 %ignore crpropa::TextOutput::load;
+%ignore crpropa::Candidate::operator new;
+%ignore crpropa::Candidate::operator delete;
+%ignore *::processBatch;
+%ignore *::prepareCandidates;
+%ignore *::getCandidates(const std::vector<size_t> &) const;
+%ignore crpropa::SourceCatalogue::Record;
+%ignore *::getFields;
+%ignore *::getDivergences;
+%ignore *::getFieldAndDivergence;
+%ignore *::getFieldsAt;
+%ignore *::getDensitiesAt;
+%ignore *::modifyBatch;
+%ignore *::scatterCenterVelocities;
+%ignore crpropa::Random::randNorm(double *, size_t);
+%ignore crpropa::Random::rand(double *, size_t);
+%ignore crpropa::Random::randInt(uint32_t *, size_t);
+%ignore crpropa::Random::randExponential(double *, size_t);
+%ignore crpropa::Random::randVector(Vector3d *, size_t);
+%ignore crpropa::Random::randPowerLaw(double, double, double, double *, size_t);
+%ignore crpropa::Random::philox;
+%ignore *::interpolateMany;
+%ignore crpropa::SophiaEventLibrary::sample;
+%ignore crpropa::DataTable::row;
+%ignore crpropa::DataTable::data;
+%ignore crpropa::RedshiftCache::get;
 
 %feature("ref")   crpropa::Referenced "$this->addReference();"
 %feature("unref") crpropa::Referenced "$this->removeReference();"
@@ -58,6 +86,11 @@
 
 %include "crpropa/Logging.h"
 
+/* vectors, particle states and candidates keep the GIL in their wrappers:
+   releasing it would take longer than their accessors, which are called for
+   every candidate by modules and observers implemented in Python */
+%nothread;
+
 /* ignore public references and replace with attributes for Vector3d and Vector3f*/
 %attribute(crpropa::Vector3<double>, double, x, getX, setX);
 %attribute(crpropa::Vector3<double>, double, y, getY, setY);
@@ -101,21 +134,32 @@
     return 3;
   }
 
-  PyObject* __array__() {
-    npy_intp shape[1];
-    shape[0] = 3;
-    PyObject *ro;
-    if (sizeof($self->data[0]) == NPY_SIZEOF_FLOAT) {
-      ro = PyArray_SimpleNewFromData(1, shape, NPY_FLOAT, $self->data);
-    } else if (sizeof($self->data[0]) == NPY_SIZEOF_DOUBLE) {
-      ro = PyArray_SimpleNewFromData(1, shape, NPY_DOUBLE, $self->data);
-    } else {
-      KISS_LOG_ERROR << "crpropa::Vector3 has fixed size of 3 elements!";
-    }
+  /* numpy array interface of the components, numpy.asarray(v) is a writable
+     view which keeps the vector alive */
+  PyObject *_arrayInterface() {
+    PyArray_Descr *descr = PyArray_DescrFromType((sizeof(T) == sizeof(float)) ? NPY_FLOAT : NPY_DOUBLE);
+    PyObject *typestr = PyObject_GetAttrString((PyObject *) descr, "str");
+    Py_DECREF(descr);
+    if (!typestr)
+      return NULL;
+    return Py_BuildValue("{s:(i),s:N,s:(N,O),s:i}", "shape", 3, "typestr", typestr,
+        "data", PyLong_FromVoidPtr($self->data), Py_False, "version", 3);
+  }
 
-    return ro;
+  /* components as tuple of floats, without a new vector */
+  PyObject *toTuple() {
+    return Py_BuildValue("(ddd)", (double) $self->x, (double) $self->y, (double) $self->z);
   }
 
+  %pythoncode %{
+    __array_interface__ = property(lambda self: self._arrayInterface())
+
+    def __array__(self, dtype=None, copy=None):
+        # numpy uses __array_interface__ first, the view keeps a reference to the vector
+        a = numpy.asarray(self)
+        return a if dtype is None else a.astype(dtype)
+  %}
+
   double __getitem__(size_t i) {
     if(i > 2) {
         throw RangeError();
@@ -145,6 +189,7 @@
 
 %template(Vector3d) crpropa::Vector3<double>;
 %template(Vector3f) crpropa::Vector3<float>;
+%thread;
 
 %include "crpropa/Referenced.h"
 %include "crpropa/Units.h"
@@ -153,17 +198,57 @@
 %template(RandomSeed) std::vector<uint32_t>;
 %template(RandomSeedThreads) std::vector< std::vector<uint32_t> >;
 %include "crpropa/Random.h"
+
+/* the objects account their sizes in C++ */
+%ignore crpropa::MemoryAccount;
+%ignore crpropa::MemoryUsage::add;
+%include "crpropa/MemoryUsage.h"
+%include "crpropa/Numa.h"
+%ignore crpropa::PerfCounters::read;
+%include "crpropa/PerfCounters.h"
+%implicitconv crpropa::ref_ptr<crpropa::DataTable>;
+%template(DataTableRefPtr) crpropa::ref_ptr<crpropa::DataTable>;
+%include "crpropa/DataTable.h"
+%include "crpropa/RedshiftCache.h"
+%nothread;
+%extend crpropa::ParticleState {
+  /* position and direction as tuples of floats, without a new vector */
+  PyObject *getPositionTuple() {
+    const crpropa::Vector3d &p = $self->getPosition();
+    return Py_BuildValue("(ddd)", p.x, p.y, p.z);
+  }
+
+  PyObject *getDirectionTuple() {
+    const crpropa::Vector3d &d = $self->getDirection();
+    return Py_BuildValue("(ddd)", d.x, d.y, d.z);
+  }
+}
 %include "crpropa/ParticleState.h"
+%thread;
 %include "crpropa/ParticleID.h"
 %include "crpropa/ParticleMass.h"
 %include "crpropa/Version.h"
 
 %import "crpropa/Variant.h"
+%include "crpropa/SymbolTable.h"
+%implicitconv crpropa::ref_ptr<crpropa::ThinningPolicy>;
+%template(ThinningPolicyRefPtr) crpropa::ref_ptr<crpropa::ThinningPolicy>;
+%include "crpropa/ThinningPolicy.h"
+%ignore crpropa::TableRegistry::get;
+%template(RateTableRefPtr) crpropa::ref_ptr<crpropa::RateTable>;
+%template(CumulativeRateTableRefPtr) crpropa::ref_ptr<crpropa::CumulativeRateTable>;
+%include "crpropa/TableRegistry.h"
+
+/* string based property access is provided below */
+%ignore crpropa::Candidate::setProperty(Symbol, const Variant &);
+%ignore crpropa::Candidate::getProperty(Symbol) const;
+%ignore crpropa::Candidate::removeProperty(Symbol);
+%ignore crpropa::Candidate::hasProperty(Symbol) const;
 
 /* override Candidate::getProperty() */
 %ignore crpropa::Candidate::getProperty(const std::string &) const;
 
-%nothread; /* disable threading for extend*/
+%nothread; /* disable threading for extend and the accessors of the candidate */
 %extend crpropa::Candidate {
   PyObject * getProperty(PyObject* name) {
 
@@ -262,12 +347,12 @@
     }
   }
 };
-%thread; /* reenable threading */
-
 
 %template(CandidateVector) std::vector< crpropa::ref_ptr<crpropa::Candidate> >;
 %template(CandidateRefPtr) crpropa::ref_ptr<crpropa::Candidate>;
 %include "crpropa/Candidate.h"
+%thread; /* reenable threading */
+
 
 %feature("director") crpropa::Surface;
 %feature("director") crpropa::ClosedSurface;
@@ -279,15 +364,229 @@
 %feature("director") crpropa::AbstractCondition;
 %include "crpropa/Module.h"
 
+/* evaluation of the fields at the positions of a numpy array (n, 3), with
+   the GIL released, see MagneticField::getFieldsAt */
+%{
+// contiguous double array of the shape (n, 3), NULL with a Python error otherwise
+static PyArrayObject *positionArray(PyObject *positions) {
+  PyArrayObject *a = (PyArrayObject *) PyArray_FROMANY(positions, NPY_DOUBLE, 2, 2, NPY_ARRAY_IN_ARRAY);
+  if (!a)
+    return NULL;
+  if (PyArray_DIM(a, 1) != 3) {
+    Py_DECREF(a);
+    PyErr_SetString(PyExc_ValueError, "positions must have the shape (n, 3)");
+    return NULL;
+  }
+  return a;
+}
+%}
+
+%feature("nothread") crpropa::MagneticField::getFieldsArray;
+%extend crpropa::MagneticField {
+  PyObject *getFieldsArray(PyObject *positions, double z = 0) {
+    PyArrayObject *p = positionArray(positions);
+    if (!p)
+      return NULL;
+    npy_intp dims[2] = {PyArray_DIM(p, 0), 3};
+    PyObject *fields = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (fields) {
+      const double *xyz = (const double *) PyArray_DATA(p);
+      double *out = (double *) PyArray_DATA((PyArrayObject *) fields);
+      ReleaseGIL release;
+      $self->getFieldsAt(xyz, out, dims[0], z);
+    }
+    Py_DECREF(p);
+    return fields;
+  }
+}
+
+%feature("nothread") crpropa::AdvectionField::getFieldsArray;
+%extend crpropa::AdvectionField {
+  PyObject *getFieldsArray(PyObject *positions) {
+    PyArrayObject *p = positionArray(positions);
+    if (!p)
+      return NULL;
+    npy_intp dims[2] = {PyArray_DIM(p, 0), 3};
+    PyObject *fields = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (fields) {
+      const double *xyz = (const double *) PyArray_DATA(p);
+      double *out = (double *) PyArray_DATA((PyArrayObject *) fields);
+      ReleaseGIL release;
+      $self->getFieldsAt(xyz, out, dims[0]);
+    }
+    Py_DECREF(p);
+    return fields;
+  }
+}
+
+%feature("nothread") crpropa::Density::getDensitiesArray;
+%extend crpropa::Density {
+  PyObject *getDensitiesArray(PyObject *positions) {
+    PyArrayObject *p = positionArray(positions);
+    if (!p)
+      return NULL;
+    npy_intp dims[1] = {PyArray_DIM(p, 0)};
+    PyObject *densities = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (densities) {
+      const double *xyz = (const double *) PyArray_DATA(p);
+      double *out = (double *) PyArray_DATA((PyArrayObject *) densities);
+      ReleaseGIL release;
+      $self->getDensitiesAt(xyz, out, dims[0]);
+    }
+    Py_DECREF(p);
+    return densities;
+  }
+}
+
 %implicitconv crpropa::ref_ptr<crpropa::MagneticField>;
 %template(MagneticFieldRefPtr) crpropa::ref_ptr<crpropa::MagneticField>;
 %feature("director") crpropa::MagneticField;
 %include "crpropa/magneticField/MagneticField.h"
 
+/* pickle support for grids, fields and photon fields, e.g. for
+   multiprocessing or Dask: large grids are passed through files which the
+   unpickled grids map, see setPickleSharing */
+%{
+static PyObject *doubleVectorToNumpy(const std::vector<double> &values) {
+  npy_intp size = values.size();
+  PyObject *array = PyArray_SimpleNew(1, &size, NPY_DOUBLE);
+  if (array && size > 0)
+    memcpy(PyArray_DATA((PyArrayObject *) array), values.data(), size * sizeof(double));
+  return array;
+}
+
+static bool numpyToDoubleVector(PyObject *object, std::vector<double> &values) {
+  PyArrayObject *a = (PyArrayObject *) PyArray_FROMANY(object, NPY_DOUBLE, 1, 1, NPY_ARRAY_IN_ARRAY);
+  if (!a)
+    return false;
+  const double *data = (const double *) PyArray_DATA(a);
+  values.assign(data, data + PyArray_DIM(a, 0));
+  Py_DECREF(a);
+  return true;
+}
+%}
+
+%pythoncode %{
+import atexit as _atexit
+import os as _os
+import tempfile as _tempfile
+
+_pickleSharing = {'threshold': 1 << 24, 'directory': '/dev/shm' if _os.path.isdir('/dev/shm') else None}
+_sharedFiles = []
+
+def setPickleSharing(threshold=1 << 24, directory=None):
+    """Pickle grids of at least threshold bytes through a file in directory
+    (default /dev/shm if it exists, else the temporary directory) instead of
+    copying their values into the pickle. The grid and the unpickled copies
+    map the file, so all processes share its pages. Later changes of the
+    values (setValue, getArray) copy the grid again. Files are removed at the
+    exit of the process that created them or by removeSharedFiles.
+    threshold=None always copies the values."""
+    _pickleSharing['threshold'] = threshold
+    if directory is None and _os.path.isdir('/dev/shm'):
+        directory = '/dev/shm'
+    _pickleSharing['directory'] = directory
+
+def removeSharedFiles():
+    """Remove the files created to pickle grids by this process. Processes
+    which already mapped a file keep its values."""
+    for pid, filename in list(_sharedFiles):
+        if pid == _os.getpid():
+            _sharedFiles.remove((pid, filename))
+            try:
+                _os.remove(filename)
+            except OSError:
+                pass
+
+_atexit.register(removeSharedFiles)
+
+def _reduceGrid(grid):
+    """Class and arguments of _restoreGrid for a grid or a grid RefPtr"""
+    cls = globals()[type(grid).__name__.replace('RefPtr', '')]
+    o, s = grid.getOrigin(), grid.getSpacing()
+    args = (cls, (o.x, o.y, o.z), grid.getNx(), grid.getNy(), grid.getNz(), (s.x, s.y, s.z),
+        grid.isReflective(), grid.getClipVolume(), grid.getInterpolationType(),
+        grid.getStorageScale(), grid.getLayout())
+    filename = grid.getMappedFilename()
+    threshold = _pickleSharing['threshold']
+    if not filename and (threshold is not None) and (grid.getSizeOf() >= threshold):
+        fd, filename = _tempfile.mkstemp(prefix='crpropa-grid-', dir=_pickleSharing['directory'])
+        _os.close(fd)
+        _sharedFiles.append((_os.getpid(), filename))
+        grid.dumpValues(filename)
+        if grid.getLayout() == ROW_MAJOR:
+            grid.mapFile(filename)
+    if filename:
+        return args + (filename, None)
+    return args + (None, grid._getStorage())
+
+def _restoreGrid(cls, origin, Nx, Ny, Nz, spacing, reflective, clipVolume, ipol, scale, layout, filename, storage):
+    grid = cls(Vector3d(*origin), Nx, Ny, Nz, Vector3d(*spacing))
+    grid.setReflective(reflective)
+    grid.setClipVolume(clipVolume)
+    grid.setInterpolationType(ipol)
+    grid.setStorageScale(scale)
+    if filename:
+        grid.mapFile(filename)
+        grid.setLayout(layout)
+    else:
+        grid.setLayout(layout)
+        grid._setStorage(storage)
+    return grid
+
+def _restoreMagneticFieldGrid(*args):
+    return MagneticFieldGrid(_restoreGrid(*args))
+
+def _restorePlaneWaveTurbulence(spectrum, modes, kernel, simdLevel):
+    field = PlaneWaveTurbulence(spectrum, 2, 1)
+    field._setModes(numpy.frombuffer(modes))
+    field.setKernel(kernel)
+    field.setSimdLevel(simdLevel)
+    field._spectrum = spectrum # the field refers to the spectrum
+    return field
+%}
+
+%feature("nothread") crpropa::TabularPhotonField::TabularPhotonField(std::string, PyObject *, PyObject *, PyObject *);
+%feature("nothread") crpropa::TabularPhotonField::_getTables;
+%extend crpropa::TabularPhotonField {
+  TabularPhotonField(std::string fieldName, PyObject *photonEnergies, PyObject *photonDensity, PyObject *redshifts) {
+    std::vector<double> e, n, z;
+    if (!numpyToDoubleVector(photonEnergies, e) || !numpyToDoubleVector(photonDensity, n) || !numpyToDoubleVector(redshifts, z))
+      throw std::runtime_error("TabularPhotonField: tables must be sequences of numbers");
+    return new crpropa::TabularPhotonField(fieldName, e, n, z);
+  }
+
+  PyObject *_getTables() {
+    PyObject *e = doubleVectorToNumpy($self->getPhotonEnergies());
+    PyObject *n = doubleVectorToNumpy($self->getPhotonDensities());
+    PyObject *z = doubleVectorToNumpy($self->getRedshifts());
+    if (!e || !n || !z) {
+      Py_XDECREF(e);
+      Py_XDECREF(n);
+      Py_XDECREF(z);
+      return NULL;
+    }
+    return Py_BuildValue("(NNN)", e, n, z);
+  }
+
+  %pythoncode %{
+    def __reduce__(self):
+        # the models of the data files are restored from them, like their interaction tables
+        if type(self) is not TabularPhotonField:
+            return (type(self), ())
+        e, n, z = self._getTables()
+        return (TabularPhotonField, (self.getFieldName(), e, n, z))
+  %}
+}
+%ignore crpropa::TabularPhotonField::getPhotonEnergies;
+%ignore crpropa::TabularPhotonField::getPhotonDensities;
+%ignore crpropa::TabularPhotonField::getRedshifts;
+
 %implicitconv crpropa::ref_ptr<crpropa::PhotonField>;
 %template(PhotonFieldRefPtr) crpropa::ref_ptr<crpropa::PhotonField>;
 %feature("director") crpropa::PhotonField;
 %include "crpropa/PhotonBackground.h"
+%include "crpropa/InteractionTables.h"
 
 %implicitconv crpropa::ref_ptr<crpropa::AdvectionField>;
 %template(AdvectionFieldRefPtr) crpropa::ref_ptr<crpropa::AdvectionField>;
@@ -299,9 +598,102 @@
 %feature("director") crpropa::Density;
 %include "crpropa/massDistribution/Density.h"
 
+%include "crpropa/HalfFloat.h"
+%ignore crpropa::GridStorage;
+%ignore crpropa::Grid::map;
 %include "crpropa/Grid.h"
 %include "crpropa/GridTools.h"
 
+/* writable numpy view of the grid values without copy, the array keeps a
+   reference to the grid; it is invalidated by a change of the layout */
+%{
+template<typename T>
+struct NumpyGridType;
+template<> struct NumpyGridType<float> {
+  static const int type = NPY_FLOAT;
+  static const int components = 1;
+};
+template<> struct NumpyGridType<double> {
+  static const int type = NPY_DOUBLE;
+  static const int components = 1;
+};
+template<> struct NumpyGridType<crpropa::Vector3<float> > {
+  static const int type = NPY_FLOAT;
+  static const int components = 3;
+};
+template<> struct NumpyGridType<crpropa::Vector3<double> > {
+  static const int type = NPY_DOUBLE;
+  static const int components = 3;
+};
+template<> struct NumpyGridType<crpropa::Vector3h> {
+  static const int type = NPY_HALF; // stored values, see Grid::setStorageScale
+  static const int components = 3;
+};
+
+static void releaseGridCapsule(PyObject *capsule) {
+  const crpropa::Referenced *grid = (const crpropa::Referenced *) PyCapsule_GetPointer(capsule, "crpropa.Grid");
+  if (grid)
+    grid->removeReference();
+}
+%}
+
+%feature("nothread") crpropa::Grid::getArray;
+%feature("nothread") crpropa::Grid::_getStorage;
+%feature("nothread") crpropa::Grid::_setStorage;
+%extend crpropa::Grid {
+  /* stored values in storage order, for pickling */
+  PyObject *_getStorage() {
+    std::vector<T> &values = $self->getGrid();
+    return PyBytes_FromStringAndSize((const char *) values.data(), values.size() * sizeof(T));
+  }
+
+  PyObject *_setStorage(PyObject *storage) {
+    char *data;
+    Py_ssize_t size;
+    if (PyBytes_AsStringAndSize(storage, &data, &size) != 0)
+      return NULL;
+    std::vector<T> &values = $self->getGrid();
+    if ((size_t) size != values.size() * sizeof(T)) {
+      PyErr_SetString(PyExc_ValueError, "Grid: size of the stored values does not match the grid");
+      return NULL;
+    }
+    memcpy(values.data(), data, size);
+    Py_RETURN_NONE;
+  }
+
+  %pythoncode %{
+    def __reduce__(self):
+        return (_restoreGrid, _reduceGrid(self))
+  %}
+
+  PyObject *getArray() {
+    if ($self->getLayout() != crpropa::ROW_MAJOR) {
+      PyErr_SetString(PyExc_ValueError, "Grid: the array view requires the ROW_MAJOR layout");
+      return NULL;
+    }
+    std::vector<T> &values = $self->getGrid();
+    npy_intp shape[4] = {(npy_intp) $self->getNx(), (npy_intp) $self->getNy(), (npy_intp) $self->getNz(), 3};
+    int nd = (NumpyGridType<T>::components == 3) ? 4 : 3;
+    PyObject *array = PyArray_SimpleNewFromData(nd, shape, NumpyGridType<T>::type, (void *) values.data());
+    if (!array)
+      return NULL;
+
+    $self->addReference();
+    PyObject *capsule = PyCapsule_New((void *) $self, "crpropa.Grid", releaseGridCapsule);
+    if (!capsule) {
+      $self->removeReference();
+      Py_DECREF(array);
+      return NULL;
+    }
+    if (PyArray_SetBaseObject((PyArrayObject *) array, capsule) != 0) {
+      Py_DECREF(capsule);
+      Py_DECREF(array);
+      return NULL;
+    }
+    return array;
+  }
+}
+
 %template(Array3d) std::array<double, 3>;
 %template(Array3f) std::array<float, 3>;
 
@@ -321,6 +713,38 @@
 %template(Grid1dRefPtr) crpropa::ref_ptr<crpropa::Grid<double> >;
 %template(Grid1d) crpropa::Grid<double>;
 
+%implicitconv crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3h> >;
+%template(Grid3hRefPtr) crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3h> >;
+%template(Grid3h) crpropa::Grid<crpropa::Vector3h>;
+
+%include "crpropa/NestedGrid.h"
+%implicitconv crpropa::ref_ptr<crpropa::NestedGrid<float> >;
+%template(NestedGrid1fRefPtr) crpropa::ref_ptr<crpropa::NestedGrid<float> >;
+%template(NestedGrid1f) crpropa::NestedGrid<float>;
+
+%implicitconv crpropa::ref_ptr<crpropa::NestedGrid<crpropa::Vector3<float> > >;
+%template(NestedGrid3fRefPtr) crpropa::ref_ptr<crpropa::NestedGrid<crpropa::Vector3<float> > >;
+%template(NestedGrid3f) crpropa::NestedGrid<crpropa::Vector3<float> >;
+
+%ignore crpropa::PagedGridFile;
+%include "crpropa/PagedGrid.h"
+%implicitconv crpropa::ref_ptr<crpropa::PagedGrid<float> >;
+%template(PagedGrid1fRefPtr) crpropa::ref_ptr<crpropa::PagedGrid<float> >;
+%template(PagedGrid1f) crpropa::PagedGrid<float>;
+
+%implicitconv crpropa::ref_ptr<crpropa::PagedGrid<crpropa::Vector3<float> > >;
+%template(PagedGrid3fRefPtr) crpropa::ref_ptr<crpropa::PagedGrid<crpropa::Vector3<float> > >;
+%template(PagedGrid3f) crpropa::PagedGrid<crpropa::Vector3<float> >;
+
+%include "crpropa/TricubicGrid.h"
+%implicitconv crpropa::ref_ptr<crpropa::TricubicGrid<float> >;
+%template(TricubicGrid1fRefPtr) crpropa::ref_ptr<crpropa::TricubicGrid<float> >;
+%template(TricubicGrid1f) crpropa::TricubicGrid<float>;
+
+%implicitconv crpropa::ref_ptr<crpropa::TricubicGrid<crpropa::Vector3<float> > >;
+%template(TricubicGrid3fRefPtr) crpropa::ref_ptr<crpropa::TricubicGrid<crpropa::Vector3<float> > >;
+%template(TricubicGrid3f) crpropa::TricubicGrid<crpropa::Vector3<float> >;
+
 %implicitconv std::pair<std::vector<int>, std::vector<float> >;
 %template(PairIntFloat) std::pair<int, float>;
 %template(PairVector) std::vector<std::pair<int, float> >;
@@ -331,7 +755,19 @@
 %implicitconv crpropa::ref_ptr<crpropa::CylindricalProjectionMap>;
 %template(CylindricalProjectionMapRefPtr) crpropa::ref_ptr<crpropa::CylindricalProjectionMap>;
 
+%extend crpropa::MagneticFieldGrid {
+  %pythoncode %{
+    def __reduce__(self):
+        grid = self.getHalfGrid()
+        if not grid.valid():
+            grid = self.getGrid()
+        return (_restoreMagneticFieldGrid, _reduceGrid(grid))
+  %}
+}
 %include "crpropa/magneticField/MagneticFieldGrid.h"
+%include "crpropa/advectionField/AdvectionFieldGrid.h"
+%include "crpropa/magneticField/CachedMagneticField.h"
+%include "crpropa/magneticField/ProfiledMagneticField.h"
 %include "crpropa/magneticField/GalacticMagneticField.h"
 %feature("notabstract") QuimbyMagneticFieldAdapter;
 %include "crpropa/magneticField/QuimbyMagneticField.h"
@@ -342,10 +778,49 @@
 %include "crpropa/magneticField/TF17Field.h"
 %include "crpropa/magneticField/ArchimedeanSpiralField.h"
 %include "crpropa/magneticField/CMZField.h"
+%extend crpropa::TurbulenceSpectrum {
+  %pythoncode %{
+    def __reduce__(self):
+        return (TurbulenceSpectrum, (self.getBrms(), self.getLmin(), self.getLmax(),
+            self.getLbendover(), self.getSindex(), self.getQindex()))
+  %}
+}
 %include "crpropa/magneticField/turbulentField/TurbulentField.h"
+%ignore crpropa::GridTurbulence::ModeFunction;
+%ignore crpropa::GridTurbulence::initFourierModes;
 %include "crpropa/magneticField/turbulentField/GridTurbulence.h"
 %include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
 %include "crpropa/magneticField/turbulentField/HelicalGridTurbulence.h"
+%include "crpropa/magneticField/turbulentField/PagedGridTurbulence.h"
+%ignore crpropa::PlaneWaveTurbulence::getModes;
+%ignore crpropa::PlaneWaveTurbulence::setModes;
+%feature("nothread") crpropa::PlaneWaveTurbulence::_getModes;
+%feature("nothread") crpropa::PlaneWaveTurbulence::_setModes;
+%extend crpropa::PlaneWaveTurbulence {
+  PyObject *_getModes() {
+    return doubleVectorToNumpy($self->getModes());
+  }
+
+  PyObject *_setModes(PyObject *modes) {
+    std::vector<double> values;
+    if (!numpyToDoubleVector(modes, values))
+      return NULL;
+    try {
+      $self->setModes(values);
+    } catch (std::exception &e) {
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return NULL;
+    }
+    Py_RETURN_NONE;
+  }
+
+  %pythoncode %{
+    def __reduce__(self):
+        # only the modes are transferred, not the SIMD arrays built from them
+        return (_restorePlaneWaveTurbulence, (self.getSpectrum(), self._getModes().tobytes(),
+            self.getKernel(), self.getSimdLevel()))
+  %}
+}
 %include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 %include "crpropa/module/BreakCondition.h"
 %include "crpropa/module/Boundary.h"
@@ -355,9 +830,16 @@
 %include "crpropa/module/Observer.h"
 %include "crpropa/module/SimplePropagation.h"
 %include "crpropa/module/PropagationCK.h"
+%include "crpropa/module/PropagationDP.h"
+%include "crpropa/module/PropagationGC.h"
 %include "crpropa/module/PropagationBP.h"
+%include "crpropa/module/FastNeutralPropagation.h"
+%include "crpropa/module/Propagation1D.h"
+%include "crpropa/module/CompositePropagation.h"
+%include "crpropa/module/StepPlanner.h"
 
 %ignore crpropa::Output::enableProperty(const std::string &property, const Variant& defaultValue, const std::string &comment = "");
+%feature("nothread") crpropa::Output::enableProperty;
 %extend crpropa::Output{
   PyObject* enableProperty(const std::string &name, PyObject* defaultValue, const std::string &comment="") {
 
@@ -398,19 +880,45 @@
 %include "crpropa/module/DiffusionSDE.h"
 %include "crpropa/module/TextOutput.h"
 %include "crpropa/module/HDF5Output.h"
+%include "crpropa/module/HDF5Reader.h"
+%include "crpropa/module/HistogramOutput.h"
+%include "crpropa/module/ParquetOutput.h"
+
+%feature("director") crpropa::StreamOutput;
+%ignore crpropa::OutputChunk::values;
+%ignore crpropa::OutputChunk::memory;
+%implicitconv crpropa::ref_ptr<crpropa::OutputChunk>;
+%template(OutputChunkRefPtr) crpropa::ref_ptr<crpropa::OutputChunk>;
+%feature("nothread") crpropa::OutputChunk::getArray;
+%extend crpropa::OutputChunk {
+  PyObject *getArray() {
+    npy_intp dims[2] = {(npy_intp) $self->rows, (npy_intp) $self->width};
+    PyObject *values = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (!values)
+      return NULL;
+    if (!$self->values.empty())
+      memcpy(PyArray_DATA((PyArrayObject *) values), $self->values.data(), $self->values.size() * sizeof(double));
+    return values;
+  }
+}
+%include "crpropa/module/StreamOutput.h"
 %include "crpropa/module/OutputShell.h"
 %include "crpropa/module/PhotonOutput1D.h"
 %include "crpropa/module/NuclearDecay.h"
 %include "crpropa/module/ElectronPairProduction.h"
+%implicitconv crpropa::ref_ptr<crpropa::SophiaEventLibrary>;
+%template(SophiaEventLibraryRefPtr) crpropa::ref_ptr<crpropa::SophiaEventLibrary>;
 %include "crpropa/module/PhotoPionProduction.h"
 %include "crpropa/module/PhotoDisintegration.h"
 %include "crpropa/module/ElasticScattering.h"
+%include "crpropa/module/InteractionManager.h"
 %include "crpropa/module/Redshift.h"
 %include "crpropa/module/RestrictToRegion.h"
 %include "crpropa/module/EMPairProduction.h"
 %include "crpropa/module/EMDoublePairProduction.h"
 %include "crpropa/module/EMTripletPairProduction.h"
 %include "crpropa/module/EMInverseComptonScattering.h"
+%include "crpropa/module/EMCascade.h"
 %include "crpropa/module/SynchrotronRadiation.h"
 %include "crpropa/module/AdiabaticCooling.h"
 %include "crpropa/module/MomentumDiffusion.h"
@@ -419,12 +927,66 @@
 %template(IntSet) std::set<int>;
 %include "crpropa/module/Tools.h"
 
+/* numpy views of the candidate states passed to BatchModule.processCandidates */
+%ignore crpropa::CandidateArrays::id;
+%ignore crpropa::CandidateArrays::energy;
+%ignore crpropa::CandidateArrays::position;
+%ignore crpropa::CandidateArrays::direction;
+%ignore crpropa::CandidateArrays::weight;
+%ignore crpropa::CandidateArrays::step;
+%ignore crpropa::CandidateArrays::active;
+%ignore crpropa::CandidateArrays::gather;
+%ignore crpropa::CandidateArrays::scatter;
+%feature("nothread") crpropa::CandidateArrays::getId;
+%feature("nothread") crpropa::CandidateArrays::getEnergy;
+%feature("nothread") crpropa::CandidateArrays::getPosition;
+%feature("nothread") crpropa::CandidateArrays::getDirection;
+%feature("nothread") crpropa::CandidateArrays::getWeight;
+%feature("nothread") crpropa::CandidateArrays::getStep;
+%feature("nothread") crpropa::CandidateArrays::getActive;
+%extend crpropa::CandidateArrays {
+  PyObject *getId() {
+    npy_intp dims[1] = {(npy_intp) $self->size()};
+    return PyArray_SimpleNewFromData(1, dims, NPY_INT, $self->id.data());
+  }
+  PyObject *getEnergy() {
+    npy_intp dims[1] = {(npy_intp) $self->size()};
+    return PyArray_SimpleNewFromData(1, dims, NPY_DOUBLE, $self->energy.data());
+  }
+  PyObject *getPosition() {
+    npy_intp dims[2] = {(npy_intp) $self->size(), 3};
+    return PyArray_SimpleNewFromData(2, dims, NPY_DOUBLE, $self->position.data());
+  }
+  PyObject *getDirection() {
+    npy_intp dims[2] = {(npy_intp) $self->size(), 3};
+    return PyArray_SimpleNewFromData(2, dims, NPY_DOUBLE, $self->direction.data());
+  }
+  PyObject *getWeight() {
+    npy_intp dims[1] = {(npy_intp) $self->size()};
+    return PyArray_SimpleNewFromData(1, dims, NPY_DOUBLE, $self->weight.data());
+  }
+  PyObject *getStep() {
+    npy_intp dims[1] = {(npy_intp) $self->size()};
+    return PyArray_SimpleNewFromData(1, dims, NPY_DOUBLE, $self->step.data());
+  }
+  PyObject *getActive() {
+    npy_intp dims[1] = {(npy_intp) $self->size()};
+    return PyArray_SimpleNewFromData(1, dims, NPY_BOOL, $self->active.data());
+  }
+}
+%feature("director") crpropa::BatchModule;
+%include "crpropa/module/BatchModule.h"
+
 %template(SourceInterfaceRefPtr) crpropa::ref_ptr<crpropa::SourceInterface>;
 %feature("director") crpropa::SourceInterface;
 %template(SourceFeatureRefPtr) crpropa::ref_ptr<crpropa::SourceFeature>;
 %feature("director") crpropa::SourceFeature;
 %include "crpropa/Source.h"
 
+%template(CandidateStreamRefPtr) crpropa::ref_ptr<crpropa::CandidateStream>;
+%feature("director") crpropa::CandidateStream;
+%include "crpropa/CandidateStream.h"
+
 %inline %{
   class ModuleListIterator {
     public:
@@ -467,8 +1029,39 @@
   }
 };
 
+/* the names have to outlive the statistics, reports are made in C++ */
+%ignore crpropa::RunStatistics::Histogram;
+%ignore crpropa::RunStatistics::count;
+%ignore crpropa::RunStatistics::fill;
+%ignore crpropa::RunStatistics::addCount;
+%ignore crpropa::RunStatistics::addValue;
+%template(StringVector) std::vector<std::string>;
+%template(UInt64Vector) std::vector<uint64_t>;
+%include "crpropa/RunStatistics.h"
+
+/* the event names have to outlive the tracer, events are recorded in C++ */
+%ignore crpropa::Tracer::Event;
+%ignore crpropa::Tracer::record;
+%ignore crpropa::Tracer::instant;
+%ignore crpropa::Tracer::getEvents;
+%ignore crpropa::TraceSpan;
+%ignore crpropa::TraceWait;
+%include "crpropa/Trace.h"
+
 %template(ModuleListRefPtr) crpropa::ref_ptr<crpropa::ModuleList>;
 %include "crpropa/ModuleList.h"
+%include "crpropa/ParameterSweep.h"
+%include "crpropa/BackTracking.h"
+%include "crpropa/OffloadEngine.h"
+%include "crpropa/PropagationResponse.h"
+
+/* factories are registered in C++ */
+%ignore crpropa::SimulationConfig::registerModule;
+%ignore crpropa::SimulationConfig::registerSourceFeature;
+%ignore crpropa::SimulationConfig::registerMagneticField;
+%ignore crpropa::ConfigNode::operator[];
+%template(SimulationConfigRefPtr) crpropa::ref_ptr<crpropa::SimulationConfig>;
+%include "crpropa/Configuration.h"
 
 %template(ParticleCollectorRefPtr) crpropa::ref_ptr<crpropa::ParticleCollector>;
 
@@ -497,6 +1090,9 @@
   }
 }
 
+%feature("nothread") crpropa::ParticleCollector::__getitem__;
+%feature("nothread") crpropa::ParticleCollector::_exportColumn;
+%feature("nothread") crpropa::ParticleCollector::_importColumn;
 %extend crpropa::ParticleCollector {
   ParticleCollectorIterator __iter__() {
     return ParticleCollectorIterator($self->begin(), $self->end());
@@ -534,15 +1130,117 @@
   size_t __len__() {
     return $self->size();
   }
+
+  PyObject *_exportColumn(int column) {
+    crpropa::Output::OutputColumn c = (crpropa::Output::OutputColumn) column;
+    npy_intp dims[2] = {(npy_intp) $self->size(), (npy_intp) crpropa::ParticleCollector::getColumnWidth(c)};
+    PyObject *values = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (!values)
+      return NULL;
+    try {
+      $self->exportColumn(c, (double *) PyArray_DATA((PyArrayObject *) values));
+    } catch (std::exception &e) {
+      Py_DECREF(values);
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return NULL;
+    }
+    return values;
+  }
+
+  PyObject *_importColumn(int column, PyObject *values) {
+    crpropa::Output::OutputColumn c = (crpropa::Output::OutputColumn) column;
+    PyArrayObject *a = (PyArrayObject *) PyArray_FROMANY(values, NPY_DOUBLE, 2, 2, NPY_ARRAY_IN_ARRAY);
+    if (!a)
+      return NULL;
+    if ((size_t) PyArray_DIM(a, 1) != crpropa::ParticleCollector::getColumnWidth(c)) {
+      Py_DECREF(a);
+      PyErr_SetString(PyExc_ValueError, "ParticleCollector: wrong number of values per candidate");
+      return NULL;
+    }
+    try {
+      $self->importColumn(c, (const double *) PyArray_DATA(a), PyArray_DIM(a, 0));
+    } catch (std::exception &e) {
+      Py_DECREF(a);
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return NULL;
+    }
+    Py_DECREF(a);
+    Py_RETURN_NONE;
+  }
+
+  %pythoncode %{
+    # name, column and component of the columns of toNumpy, named as in HDF5Output
+    _numpyColumns = [('D', 'TrajectoryLengthColumn', 0), ('z', 'RedshiftColumn', 0),
+        ('SN', 'SerialNumberColumn', 0), ('SN0', 'SerialNumberColumn', 1), ('SN1', 'SerialNumberColumn', 2),
+        ('W', 'WeightColumn', 0)]
+    for _s, _state in (('', 'Current'), ('0', 'Source'), ('1', 'Created')):
+        _numpyColumns += [('ID' + _s, _state + 'IdColumn', 0), ('E' + _s, _state + 'EnergyColumn', 0),
+            ('X' + _s, _state + 'PositionColumn', 0), ('Y' + _s, _state + 'PositionColumn', 1),
+            ('Z' + _s, _state + 'PositionColumn', 2), ('P' + _s + 'x', _state + 'DirectionColumn', 0),
+            ('P' + _s + 'y', _state + 'DirectionColumn', 1), ('P' + _s + 'z', _state + 'DirectionColumn', 2)]
+    del _s, _state
+
+    def toNumpy(self, columns=None):
+        """Columns of the candidates as dictionary of NumPy arrays in SI units.
+
+        The names are those of HDF5Output (D, z, SN, SN0, SN1, W, ID, E, X, Y,
+        Z, Px, Py, Pz and the same with 0 for the source and 1 for the created
+        state), columns selects a subset of them.
+        """
+        exported = {}
+        result = {}
+        for name, column, i in self._numpyColumns:
+            if (columns is not None) and (name not in columns):
+                continue
+            if column not in exported:
+                exported[column] = self._exportColumn(getattr(Output, column))
+            values = exported[column][:, i]
+            if name.startswith('ID'):
+                result[name] = values.astype(numpy.int32)
+            elif name.startswith('SN'):
+                result[name] = values.astype(numpy.uint64)
+            else:
+                result[name] = numpy.ascontiguousarray(values)
+        return result
+
+    @staticmethod
+    def fromNumpy(columns):
+        """Collector with candidates built from a dictionary of columns as
+        returned by toNumpy. Positions, directions and serial numbers need all
+        of their components, missing columns keep the values of a new candidate.
+        """
+        parts = {}
+        for name, column, i in ParticleCollector._numpyColumns:
+            if name in columns:
+                parts.setdefault(column, {})[i] = columns[name]
+        collector = ParticleCollector()
+        for column, components in parts.items():
+            c = getattr(Output, column)
+            width = ParticleCollector.getColumnWidth(c)
+            if len(components) != width:
+                raise ValueError("ParticleCollector: incomplete column " + column)
+            values = numpy.column_stack([components[i] for i in range(width)]).astype(numpy.float64)
+            collector._importColumn(c, values)
+        return collector
+  %}
 };
 
+%ignore crpropa::ParticleCollector::exportColumn;
+%ignore crpropa::ParticleCollector::importColumn;
+%ignore crpropa::ParticleCollector::readColumn;
 %include "crpropa/module/ParticleCollector.h"
+%ignore crpropa::BinaryOutput::Record;
+%ignore crpropa::BinaryOutput::toRecord;
+%ignore crpropa::BinaryOutput::fromRecord;
+%include "crpropa/module/BinaryOutput.h"
+%include "crpropa/EventReweighting.h"
 %include "crpropa/massDistribution/Density.h"
 %include "crpropa/massDistribution/Nakanishi.h"
 %include "crpropa/massDistribution/Cordes.h"
 %include "crpropa/massDistribution/Ferriere.h"
 %include "crpropa/massDistribution/Massdistribution.h"
 %include "crpropa/massDistribution/ConstantDensity.h"
+%include "crpropa/massDistribution/TabulatedDensity.h"
 
 
 %template(StepLengthModifierRefPtr) crpropa::ref_ptr<crpropa::StepLengthModifier>;
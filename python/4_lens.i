@@ -13,8 +13,13 @@
   #include "crpropa/magneticLens/Pixelization.h"
   #include "crpropa/magneticLens/MagneticLens.h"
   #include "crpropa/magneticLens/ParticleMapsContainer.h"
+  #include "crpropa/magneticLens/LensBuilder.h"
 %}
 
+%ignore crpropa::MappedModelMatrix::getMatrix;
+%ignore crpropa::prod_up(const MappedModelMatrixType &, double *);
+%ignore crpropa::prod_up(const ModelMatrixType &, double **, size_t);
+%ignore crpropa::prod_up(const ModelMatrixFloatType &, double **, size_t);
 %include "crpropa/magneticLens/ModelMatrix.h"
 %apply double &INOUT {double &longitude, double &latitude};
 %typemap(in,numinputs=0) double& longitude (double temp) "$1 = &temp;"
@@ -27,6 +32,9 @@
 }
 
 
+%ignore crpropa::Pixelization::direction2Pix(size_t, const double *, const double *, uint32_t *) const;
+%ignore crpropa::Pixelization::pix2Direction(size_t, const uint32_t *, double *, double *) const;
+%ignore crpropa::Pixelization::pix2Vector;
 
 %include "crpropa/magneticLens/Pixelization.h"
 
@@ -34,10 +42,15 @@
 
 %apply double &INOUT {double &phi, double &theta};
 %ignore MagneticLens::transformModelVector(double *, double) const;
+%ignore MagneticLens::transformModelVectors;
+%ignore crpropa::LensPartCache;
+%ignore crpropa::LensPart::getMatrixPointer;
+%ignore crpropa::LensPart::getMatrixFloatPointer;
 %include "crpropa/magneticLens/MagneticLens.h"
 %template(LenspartVector) std::vector<crpropa::LensPart*>;
 
 
+%feature("nothread") crpropa::MagneticLens::transformModelVector_numpyArray;
 %extend crpropa::MagneticLens {
   PyObject * transformModelVector_numpyArray(PyObject *input, double rigidity) {
     PyArrayObject *arr = NULL;
@@ -53,7 +66,10 @@
     }
 
     double *dataPointer = (double*) PyArray_DATA(arr);
-    $self->transformModelVector(dataPointer, rigidity);
+    {
+      ReleaseGIL release;
+      $self->transformModelVector(dataPointer, rigidity);
+    }
     return input;
   }
 };
@@ -61,15 +77,24 @@
 
 
 
+%include "crpropa/magneticLens/LensBuilder.h"
+
+
 /* 5. Particle Maps Container */
 
 %ignore ParticleMapsContainer::getMap;
 %ignore ParticleMapsContainer::getParticleIds;
 %ignore ParticleMapsContainer::getEnergies;
 %ignore ParticleMapsContainer::getRandomParticles;
+%ignore ParticleMapsContainer::addParticles(size_t, const int *, const double *, const double *, const double *, const double *);
 %include "crpropa/magneticLens/ParticleMapsContainer.h"
 
 
+%feature("nothread") crpropa::ParticleMapsContainer::addParticles;
+%feature("nothread") crpropa::ParticleMapsContainer::getMap_numpyArray;
+%feature("nothread") crpropa::ParticleMapsContainer::getParticleIds_numpyArray;
+%feature("nothread") crpropa::ParticleMapsContainer::getEnergies_numpyArray;
+%feature("nothread") crpropa::ParticleMapsContainer::getRandomParticles_numpyArray;
 %extend crpropa::ParticleMapsContainer {
   PyObject *addParticles(PyObject *particleIds,
                         PyObject *energies,
@@ -128,19 +153,22 @@
 
 
     npy_intp *D = PyArray_DIMS(particleIds_arr);
-    int arraySize = D[0];
+    size_t arraySize = D[0];
 
-    for(size_t i = 0; i < arraySize; i++) {
+    {
+      ReleaseGIL release;
       if (intSize == 32) {
-        $self->addParticle(((int32_t*) particleIds_dp)[i], energies_dp[i],
-            galacticLongitudes_dp[i], galacticLatitudes_dp[i], weights_dp[i]);
+        $self->addParticles(arraySize, (const int*) particleIds_dp, energies_dp,
+            galacticLongitudes_dp, galacticLatitudes_dp, weights_dp);
       } else if (intSize == 64) {
-        $self->addParticle(((int64_t*) particleIds_dp)[i], energies_dp[i],
-            galacticLongitudes_dp[i], galacticLatitudes_dp[i], weights_dp[i]);
+        std::vector<int> ids(arraySize);
+        for(size_t i = 0; i < arraySize; i++)
+          ids[i] = ((int64_t*) particleIds_dp)[i];
+        $self->addParticles(arraySize, ids.data(), energies_dp,
+            galacticLongitudes_dp, galacticLatitudes_dp, weights_dp);
       } else {
         throw std::runtime_error("ParticleMapsContainer::addParticles - unknown int size");
       }
-
     }
     Py_RETURN_TRUE;
   }
@@ -169,22 +197,18 @@
   }
 
   PyObject *getRandomParticles_numpyArray(size_t N) {
-    vector<int> particleId;
-    vector<double> energy;
-    vector<double> galacticLongitudes;
-    vector<double> galacticLatitudes;
-    $self->getRandomParticles(N, particleId, energy, galacticLongitudes, galacticLatitudes);
-
     npy_intp size = N;
     PyArrayObject *oId = (PyArrayObject*)PyArray_New(&PyArray_Type, 1, &size, NPY_INT, NULL, NULL, 0, NPY_ARRAY_CARRAY, NULL);
     PyArrayObject *oEnergy = (PyArrayObject*)PyArray_New(&PyArray_Type, 1, &size, NPY_DOUBLE, NULL, NULL, 0, NPY_ARRAY_CARRAY, NULL);
     PyArrayObject *oLon = (PyArrayObject*)PyArray_New(&PyArray_Type, 1, &size, NPY_DOUBLE, NULL, NULL, 0, NPY_ARRAY_CARRAY, NULL);
     PyArrayObject *oLat = (PyArrayObject*)PyArray_New(&PyArray_Type, 1, &size, NPY_DOUBLE, NULL, NULL, 0, NPY_ARRAY_CARRAY, NULL);
 
-    memcpy(PyArray_DATA(oId), &particleId[0], particleId.size() * sizeof(int));
-    memcpy(PyArray_DATA(oEnergy), &energy[0], energy.size() * sizeof(double));
-    memcpy(PyArray_DATA(oLon), &galacticLongitudes[0], galacticLongitudes.size() * sizeof(double));
-    memcpy(PyArray_DATA(oLat), &galacticLatitudes[0], galacticLatitudes.size() * sizeof(double));
+    // sampled directly into the arrays
+    {
+      ReleaseGIL release;
+      $self->getRandomParticles(N, (int*) PyArray_DATA(oId), (double*) PyArray_DATA(oEnergy),
+          (double*) PyArray_DATA(oLon), (double*) PyArray_DATA(oLat));
+    }
 
     PyObject *returnList = PyList_New(4);
     PyList_SET_ITEM(returnList, 0, (PyObject*) oId);
@@ -0,0 +1,120 @@
+#include "crpropa/AsyncPipeline.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+AsyncPipelineBase::AsyncPipelineBase() : running(false), drainRequest(0), drainDone(0) {
+}
+
+AsyncPipelineBase::~AsyncPipelineBase() {
+	// an exception nobody asked for with drain or close can not be thrown here
+	try {
+		rethrowError();
+	} catch (std::exception &e) {
+		std::cerr << "crpropa::AsyncPipeline: " << e.what() << std::endl;
+	} catch (...) {
+	}
+}
+
+void AsyncPipelineBase::start() {
+	running = true;
+	writer = std::thread(&AsyncPipelineBase::run, this);
+}
+
+void AsyncPipelineBase::stop() {
+	if (!writer.joinable())
+		return;
+	waitDrained();
+	running = false;
+	writer.join();
+}
+
+std::exception_ptr AsyncPipelineBase::close() {
+	stop();
+	std::lock_guard<std::mutex> lock(errorMutex);
+	std::exception_ptr e;
+	std::swap(e, error);
+	return e;
+}
+
+void AsyncPipelineBase::drain() {
+	waitDrained();
+	rethrowError();
+}
+
+void AsyncPipelineBase::waitDrained() {
+	if (!writer.joinable())
+		return;
+	if (std::this_thread::get_id() == writer.get_id())
+		throw std::runtime_error("AsyncPipeline: drain called from the writer thread");
+	size_t request = ++drainRequest;
+	while (drainDone.load() < request)
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void AsyncPipelineBase::rethrowError() {
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(errorMutex);
+		std::swap(e, error);
+	}
+	if (e)
+		std::rethrow_exception(e);
+}
+
+int AsyncPipelineBase::threadSlot(size_t nSlots) {
+	// a ring has a single producer, so only the threads of an active outermost
+	// team own one; any other thread, e.g. the main thread or a std::thread,
+	// reports the thread number 0
+#ifdef _OPENMP
+	if (!omp_in_parallel() || (omp_get_level() != 1))
+		return -1;
+	size_t i = omp_get_thread_num();
+	if (i >= nSlots)
+		return -1;
+	return i;
+#else
+	(void) nSlots;
+	return -1;
+#endif
+}
+
+size_t AsyncPipelineBase::maxThreads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+void AsyncPipelineBase::run() {
+	while (running) {
+		// records pushed before the request are in the buffers when it is read
+		size_t request = drainRequest.load();
+		bool found = false;
+		try {
+			found = consumeAll();
+			if (!found && (request > drainDone.load()))
+				commitAll();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+		}
+		if (found)
+			continue;
+		if (request > drainDone.load())
+			drainDone = request;
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+} // namespace crpropa
@@ -0,0 +1,262 @@
+#include "crpropa/BackTracking.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/PropagationCK.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+static const char backTrackingMagic[8] = {'C', 'R', 'P', 'B', 'T', 'R', 'C', 'K'};
+
+BackTracking::BackTracking(const Vector3d &observer, double radius) :
+		observer(observer), radius(radius), id(-nucleusId(1, 1)), tolerance(1e-4),
+		minStep(0.1 * parsec), maxStep(100 * parsec), maxLength(1 * Mpc) {
+	if (observer.getR() >= radius)
+		throw std::runtime_error("BackTracking: the observer has to be inside of the galaxy");
+}
+
+size_t BackTracking::addEvent(const Vector3d &direction) {
+	if (direction.getR() == 0)
+		throw std::runtime_error("BackTracking: the direction of an event must not be zero");
+	events.push_back(direction.getUnitVector());
+	return events.size() - 1;
+}
+
+size_t BackTracking::addRigidity(double rigidity) {
+	if (rigidity <= 0)
+		throw std::runtime_error("BackTracking: the rigidity must be positive");
+	rigidities.push_back(rigidity);
+	return rigidities.size() - 1;
+}
+
+size_t BackTracking::addField(const std::string &name, ref_ptr<MagneticField> field) {
+	if (!field)
+		throw std::runtime_error("BackTracking: the field " + name + " is missing");
+	for (size_t i = 0; i < fields.size(); i++)
+		if (fields[i].name == name)
+			throw std::runtime_error("BackTracking: a field named " + name + " is already added");
+	Field f = {name, field};
+	fields.push_back(f);
+	return fields.size() - 1;
+}
+
+size_t BackTracking::getNumberOfEvents() const {
+	return events.size();
+}
+
+size_t BackTracking::getNumberOfRigidities() const {
+	return rigidities.size();
+}
+
+size_t BackTracking::getNumberOfFields() const {
+	return fields.size();
+}
+
+void BackTracking::setParticleId(int id) {
+	if (chargeNumber(id) == 0)
+		throw std::runtime_error("BackTracking: the particles have to be charged");
+	if (id != this->id)
+		cache.clear();
+	this->id = id;
+}
+
+int BackTracking::getParticleId() const {
+	return id;
+}
+
+void BackTracking::setPropagation(double tolerance, double minStep, double maxStep) {
+	if (minStep > maxStep)
+		throw std::runtime_error("BackTracking: minStep > maxStep");
+	if ((tolerance != this->tolerance) || (minStep != this->minStep) || (maxStep != this->maxStep))
+		cache.clear();
+	this->tolerance = tolerance;
+	this->minStep = minStep;
+	this->maxStep = maxStep;
+}
+
+void BackTracking::setMaximumTrajectoryLength(double length) {
+	if (length != maxLength)
+		cache.clear();
+	maxLength = length;
+}
+
+double BackTracking::getMaximumTrajectoryLength() const {
+	return maxLength;
+}
+
+BackTracking::Key BackTracking::getKey(size_t event, size_t rigidity, size_t field) const {
+	if ((event >= events.size()) || (rigidity >= rigidities.size()) || (field >= fields.size()))
+		throw std::runtime_error("BackTracking: index out of range");
+	const Vector3d &d = events[event];
+	return Key(fields[field].name, d.x, d.y, d.z, rigidities[rigidity]);
+}
+
+std::vector<double> BackTracking::getSettings() const {
+	double settings[] = {double(id), observer.x, observer.y, observer.z, radius,
+		tolerance, minStep, maxStep, maxLength};
+	return std::vector<double>(settings, settings + sizeof(settings) / sizeof(double));
+}
+
+ref_ptr<ModuleList> BackTracking::createSimulation(MagneticField *field) const {
+	ref_ptr<ModuleList> simulation = new ModuleList();
+	simulation->add(new PropagationCK(field, tolerance, minStep, maxStep));
+	// the last step ends just outside of the sphere
+	ref_ptr<SphericalBoundary> boundary = new SphericalBoundary(Vector3d(0.), radius);
+	boundary->setLimitStep(true);
+	boundary->setMargin(minStep);
+	simulation->add(boundary);
+	simulation->add(new MaximumTrajectoryLength(maxLength));
+	return simulation;
+}
+
+size_t BackTracking::run() {
+	// the combinations without a result, grouped by field
+	struct Task {
+		size_t event, rigidity, field;
+	};
+	std::vector<Task> tasks;
+	for (size_t f = 0; f < fields.size(); f++)
+		for (size_t e = 0; e < events.size(); e++)
+			for (size_t r = 0; r < rigidities.size(); r++)
+				if (!cache.count(getKey(e, r, f))) {
+					Task t = {e, r, f};
+					tasks.push_back(t);
+				}
+
+	std::vector<ref_ptr<ModuleList> > simulations(fields.size());
+	for (size_t f = 0; f < fields.size(); f++)
+		simulations[f] = createSimulation(fields[f].field);
+
+	std::vector<BackTrackingResult> results(tasks.size());
+	int Z = std::abs(chargeNumber(id));
+	bool ok = true;
+	std::string error;
+	long n = tasks.size();
+#pragma omp parallel for schedule(dynamic, 1)
+	for (long i = 0; i < n; i++) {
+		if (!ok)
+			continue;
+		const Task &t = tasks[i];
+		try {
+			ref_ptr<Candidate> c = new Candidate(id, rigidities[t.rigidity] * Z, observer, events[t.event]);
+			simulations[t.field]->run(c, false);
+			BackTrackingResult &result = results[i];
+			result.position = c->current.getPosition();
+			result.direction = c->current.getDirection();
+			result.trajectoryLength = c->getTrajectoryLength();
+			result.escaped = result.position.getR() >= radius;
+		} catch (std::exception &e) {
+#pragma omp critical(BackTracking)
+			{
+				ok = false;
+				error = e.what();
+			}
+		}
+	}
+	if (!ok)
+		throw std::runtime_error(error);
+
+	for (size_t i = 0; i < tasks.size(); i++)
+		cache[getKey(tasks[i].event, tasks[i].rigidity, tasks[i].field)] = results[i];
+	return tasks.size();
+}
+
+BackTrackingResult BackTracking::getResult(size_t event, size_t rigidity, size_t field) const {
+	std::map<Key, BackTrackingResult>::const_iterator i = cache.find(getKey(event, rigidity, field));
+	if (i == cache.end())
+		throw std::runtime_error("BackTracking: no result, call run() first");
+	return i->second;
+}
+
+bool BackTracking::isCached(size_t event, size_t rigidity, size_t field) const {
+	return cache.count(getKey(event, rigidity, field)) > 0;
+}
+
+size_t BackTracking::getCacheSize() const {
+	return cache.size();
+}
+
+void BackTracking::clearCache() {
+	cache.clear();
+}
+
+// entries: field name, direction, rigidity, position, direction, length, escaped
+void BackTracking::saveCache(const std::string &filename) const {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out)
+		throw std::runtime_error("BackTracking: cannot create file " + filename);
+	out.write(backTrackingMagic, sizeof(backTrackingMagic));
+	std::vector<double> settings = getSettings();
+	uint64_t n = settings.size();
+	out.write((const char *) &n, sizeof(n));
+	out.write((const char *) settings.data(), n * sizeof(double));
+	n = cache.size();
+	out.write((const char *) &n, sizeof(n));
+	for (std::map<Key, BackTrackingResult>::const_iterator i = cache.begin(); i != cache.end(); ++i) {
+		const std::string &name = std::get<0>(i->first);
+		uint32_t length = name.size();
+		out.write((const char *) &length, sizeof(length));
+		out.write(name.data(), length);
+		const BackTrackingResult &r = i->second;
+		double values[] = {std::get<1>(i->first), std::get<2>(i->first), std::get<3>(i->first),
+			std::get<4>(i->first), r.position.x, r.position.y, r.position.z,
+			r.direction.x, r.direction.y, r.direction.z, r.trajectoryLength, r.escaped ? 1. : 0.};
+		out.write((const char *) values, sizeof(values));
+	}
+	if (!out)
+		throw std::runtime_error("BackTracking: cannot write file " + filename);
+}
+
+void BackTracking::loadCache(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in)
+		throw std::runtime_error("BackTracking: cannot open file " + filename);
+	char magic[sizeof(backTrackingMagic)];
+	uint64_t n = 0;
+	in.read(magic, sizeof(magic));
+	in.read((char *) &n, sizeof(n));
+	if (!in || (memcmp(magic, backTrackingMagic, sizeof(magic)) != 0) || (n > 64))
+		throw std::runtime_error("BackTracking: not a cache file " + filename);
+	std::vector<double> settings(n);
+	in.read((char *) settings.data(), n * sizeof(double));
+	if (settings != getSettings())
+		throw std::runtime_error("BackTracking: the settings of the cache file " + filename + " differ");
+
+	in.read((char *) &n, sizeof(n));
+	std::map<Key, BackTrackingResult> entries;
+	for (uint64_t k = 0; (k < n) && in; k++) {
+		uint32_t length = 0;
+		in.read((char *) &length, sizeof(length));
+		std::string name(length, '\0');
+		if (length > 0)
+			in.read(&name[0], length);
+		double values[12];
+		in.read((char *) values, sizeof(values));
+		BackTrackingResult r;
+		r.position = Vector3d(values[4], values[5], values[6]);
+		r.direction = Vector3d(values[7], values[8], values[9]);
+		r.trajectoryLength = values[10];
+		r.escaped = values[11] != 0;
+		entries[Key(name, values[0], values[1], values[2], values[3])] = r;
+	}
+	if (!in)
+		throw std::runtime_error("BackTracking: truncated cache file " + filename);
+	for (std::map<Key, BackTrackingResult>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		cache[i->first] = i->second;
+}
+
+std::string BackTracking::getDescription() const {
+	std::stringstream ss;
+	ss << "BackTracking: " << events.size() << " events, " << rigidities.size() << " rigidities, "
+		<< fields.size() << " fields, " << cache.size() << " cached results\n";
+	ss << "  observer " << observer / kpc << " kpc, galaxy radius " << radius / kpc << " kpc";
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -1,44 +1,149 @@
 #include "crpropa/Candidate.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Units.h"
+#include "crpropa/Random.h"
+#include "crpropa/RunStatistics.h"
 
+#include <atomic>
+#include <new>
 #include <stdexcept>
 
 namespace crpropa {
 
-Candidate::Candidate(int id, double E, Vector3d pos, Vector3d dir, double z, double weight, std::string tagOrigin) :
-  redshift(z), trajectoryLength(0), weight(weight), currentStep(0), nextStep(0), active(true), parent(0), tagOrigin(tagOrigin) {
+// Thread-local free list of candidate memory blocks, linked through the blocks
+// themselves. Only trivial thread_local variables are used for the list, so
+// candidates can be deleted at any time of the thread lifetime.
+static bool g_candidate_pool = false;
+static const size_t g_candidate_pool_max = 10000;
+static thread_local void *t_pool_head = 0;
+static thread_local size_t t_pool_size = 0;
+static thread_local bool t_pool_closed = false;
+
+struct CandidatePoolGuard {
+	bool used;
+	~CandidatePoolGuard() {
+		while (t_pool_head) {
+			void *next = *static_cast<void **>(t_pool_head);
+			::operator delete(t_pool_head);
+			t_pool_head = next;
+		}
+		t_pool_size = 0;
+		t_pool_closed = true;
+	}
+};
+static thread_local CandidatePoolGuard t_pool_guard;
+
+void *Candidate::operator new(std::size_t size) {
+	if ((size == sizeof(Candidate)) && t_pool_head) {
+		void *p = t_pool_head;
+		t_pool_head = *static_cast<void **>(p);
+		t_pool_size--;
+		return p;
+	}
+	return ::operator new(size);
+}
+
+void Candidate::operator delete(void *p, std::size_t size) {
+	if (g_candidate_pool && (size == sizeof(Candidate)) && !t_pool_closed
+			&& (t_pool_size < g_candidate_pool_max)) {
+		t_pool_guard.used = true; // registers the cleanup at thread exit
+		*static_cast<void **>(p) = t_pool_head;
+		t_pool_head = p;
+		t_pool_size++;
+		return;
+	}
+	::operator delete(p);
+}
+
+void Candidate::setPoolAllocation(bool enable) {
+	g_candidate_pool = enable;
+}
+
+bool Candidate::getPoolAllocation() {
+	return g_candidate_pool;
+}
+
+static ref_ptr<ThinningPolicy> g_thinning_policy;
+
+int Candidate::snapshots = Candidate::SnapshotAll;
+
+void Candidate::setSnapshots(int s) {
+	snapshots = s & SnapshotAll;
+}
+
+int Candidate::getSnapshots() {
+	return snapshots;
+}
+
+void Candidate::setThinningPolicy(ref_ptr<ThinningPolicy> policy) {
+	g_thinning_policy = policy;
+}
+
+ref_ptr<ThinningPolicy> Candidate::getThinningPolicy() {
+	return g_thinning_policy;
+}
+
+// weight factor of a new secondary, 0 if it is dropped or cut by the thinning policy
+static double thinningWeight(int id, double energy, double parentEnergy, double weight) {
+	if (not g_thinning_policy.valid())
+		return 1;
+	if (energy < g_thinning_policy->getMinimumEnergy(id)) {
+		g_thinning_policy->discard(energy, weight);
+		return 0;
+	}
+	double p = g_thinning_policy->getSurvivalProbability(id, energy, parentEnergy);
+	if (p >= 1)
+		return 1;
+	if (Random::instance().rand() >= p)
+		return 0;
+	return 1. / p;
+}
+
+static bool g_candidate_thread_confined = false;
+
+void Candidate::setThreadConfinement(bool enable) {
+	g_candidate_thread_confined = enable;
+}
+
+bool Candidate::getThreadConfinement() {
+	return g_candidate_thread_confined;
+}
+
+// Serial numbers are reserved from a global counter in blocks per thread, so
+// that creating a candidate does not touch a shared cache line. The epoch
+// invalidates all blocks when the counter is reset by setNextSerialNumber.
+static const uint64_t g_serial_block = 4096;
+static std::atomic<uint64_t> g_serial_counter(0); // last reserved number
+static std::atomic<uint64_t> g_serial_epoch(0);
+static thread_local uint64_t t_serial_last = 0; // last number assigned by this thread
+static thread_local uint64_t t_serial_end = 0; // last number of the block of this thread
+static thread_local uint64_t t_serial_epoch = ~uint64_t(0);
+
+static uint64_t allocateSerialNumber() {
+	uint64_t epoch = g_serial_epoch.load(std::memory_order_relaxed);
+	if ((t_serial_epoch != epoch) || (t_serial_last == t_serial_end)) {
+		t_serial_last = g_serial_counter.fetch_add(g_serial_block);
+		t_serial_end = t_serial_last + g_serial_block;
+		t_serial_epoch = epoch;
+	}
+	return ++t_serial_last;
+}
+
+Candidate::Candidate(int id, double E, Vector3d pos, Vector3d dir, double z, double weight, const std::string &tagOrigin) :
+  parent(0), active(true), weight(weight), redshift(z), trajectoryLength(0), currentStep(0), nextStep(0), tagOrigin(SymbolTable::intern(tagOrigin)), detached(false), sourceSerialNumber(0), createdSerialNumber(0) {
 	ParticleState state(id, E, pos, dir);
 	source = state;
 	created = state;
 	previous = state;
 	current = state;
-
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
-
+	serialNumber = allocateSerialNumber();
+	setThreadConfined(g_candidate_thread_confined);
 }
 
 Candidate::Candidate(const ParticleState &state) :
-		source(state), created(state), current(state), previous(state), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), active(true), parent(0), tagOrigin ("PRIM") {
-
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
-
+		source(state), created(state), current(state), previous(state), parent(0), active(true), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), tagOrigin(SymbolTable::intern("PRIM")), detached(false), sourceSerialNumber(0), createdSerialNumber(0) {
+	serialNumber = allocateSerialNumber();
+	setThreadConfined(g_candidate_thread_confined);
 }
 
 bool Candidate::isActive() const {
@@ -99,55 +204,92 @@ void Candidate::limitNextStep(double step) {
 }
 
 void Candidate::setProperty(const std::string &name, const Variant &value) {
-	properties[name] = value;
+	setProperty(SymbolTable::intern(name), value);
+}
+
+void Candidate::setProperty(Symbol name, const Variant &value) {
+	properties.set(name, value);
 }
 
-void Candidate::setTagOrigin (std::string tagOrigin) {
+void Candidate::setTagOrigin(const std::string &tagOrigin) {
+	this->tagOrigin = SymbolTable::intern(tagOrigin);
+}
+
+void Candidate::setTagOrigin(Symbol tagOrigin) {
 	this->tagOrigin = tagOrigin;
 }
 
-std::string Candidate::getTagOrigin () const {
+const std::string &Candidate::getTagOrigin() const {
+	return SymbolTable::name(tagOrigin);
+}
+
+Symbol Candidate::getTagOriginSymbol() const {
 	return tagOrigin;
 }
 
 const Variant &Candidate::getProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
-	if (i == properties.end())
+	// unknown names are not added to the table
+	Symbol symbol = SymbolTable::find(name);
+	if (symbol < 0)
 		throw std::runtime_error("Unknown candidate property: " + name);
-	return i->second;
+	return getProperty(symbol);
+}
+
+const Variant &Candidate::getProperty(Symbol name) const {
+	const Variant *value = properties.get(name);
+	if (value == NULL)
+		throw std::runtime_error("Unknown candidate property: " + SymbolTable::name(name));
+	return *value;
 }
 
 bool Candidate::removeProperty(const std::string& name) {
-	PropertyMap::iterator i = properties.find(name);
-	if (i == properties.end())
-		return false;
-	properties.erase(i);
-	return true;
+	Symbol symbol = SymbolTable::find(name);
+	return (symbol >= 0) && removeProperty(symbol);
+}
+
+bool Candidate::removeProperty(Symbol name) {
+	return properties.erase(name);
 }
 
 bool Candidate::hasProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
-	if (i == properties.end())
-		return false;
-	return true;
+	Symbol symbol = SymbolTable::find(name);
+	return (symbol >= 0) && hasProperty(symbol);
+}
+
+bool Candidate::hasProperty(Symbol name) const {
+	return properties.get(name) != NULL;
+}
+
+const Variant *Candidate::findProperty(Symbol name) const {
+	return properties.get(name);
+}
+
+void Candidate::copySnapshots(Candidate *secondary) const {
+	if (snapshots & SnapshotPrevious)
+		secondary->previous = previous;
+	if (snapshots & SnapshotCreated)
+		secondary->created = (snapshots & SnapshotPrevious) ? previous : current;
 }
 
 void Candidate::addSecondary(Candidate *c) {
 	secondaries.push_back(c);
 }
 
-void Candidate::addSecondary(int id, double energy, double w, std::string tagOrigin) {
+void Candidate::addSecondary(int id, double energy, double w, const std::string &tagOrigin) {
+	double thinning = thinningWeight(id, energy, current.getEnergy(), weight * w);
+	if (thinning == 0) {
+		RunStatistics::count("Candidate: thinned secondaries");
+		return;
+	}
+	RunStatistics::count("Candidate: secondaries");
 	ref_ptr<Candidate> secondary = new Candidate;
 	secondary->setRedshift(redshift);
 	secondary->setTrajectoryLength(trajectoryLength);
-	secondary->setWeight(weight * w);
+	secondary->setWeight(weight * w * thinning);
 	secondary->setTagOrigin(tagOrigin);
-	for (PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it) {
-		secondary->setProperty(it->first, it->second);		
-	}
+	secondary->properties = properties;
 	secondary->source = source;
-	secondary->previous = previous;
-	secondary->created = previous;
+	copySnapshots(secondary);
 	secondary->current = current;
 	secondary->current.setId(id);
 	secondary->current.setEnergy(energy);
@@ -155,23 +297,27 @@ void Candidate::addSecondary(int id, double energy, double w, std::string tagOri
 	secondaries.push_back(secondary);
 }
 
-void Candidate::addSecondary(int id, double energy, Vector3d position, double w, std::string tagOrigin) {
+void Candidate::addSecondary(int id, double energy, Vector3d position, double w, const std::string &tagOrigin) {
+	double thinning = thinningWeight(id, energy, current.getEnergy(), weight * w);
+	if (thinning == 0) {
+		RunStatistics::count("Candidate: thinned secondaries");
+		return;
+	}
+	RunStatistics::count("Candidate: secondaries");
 	ref_ptr<Candidate> secondary = new Candidate;
 	secondary->setRedshift(redshift);
 	secondary->setTrajectoryLength(trajectoryLength - (current.getPosition() - position).getR());
-	secondary->setWeight(weight * w);
+	secondary->setWeight(weight * w * thinning);
 	secondary->setTagOrigin(tagOrigin);
-	for (PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it) {
-		secondary->setProperty(it->first, it->second);		
-	}
+	secondary->properties = properties;
 	secondary->source = source;
-	secondary->previous = previous;
-	secondary->created = previous;
+	copySnapshots(secondary);
 	secondary->current = current;
 	secondary->current.setId(id);
 	secondary->current.setEnergy(energy);
 	secondary->current.setPosition(position);
-	secondary->created.setPosition(position);
+	if (snapshots & SnapshotCreated)
+		secondary->created.setPosition(position);
 	secondary->parent = this;
 	secondaries.push_back(secondary);
 }
@@ -224,6 +370,8 @@ void Candidate::setSerialNumber(const uint64_t snr) {
 uint64_t Candidate::getSourceSerialNumber() const {
 	if (parent)
 		return parent->getSourceSerialNumber();
+	else if (detached)
+		return sourceSerialNumber;
 	else
 		return serialNumber;
 }
@@ -231,20 +379,41 @@ uint64_t Candidate::getSourceSerialNumber() const {
 uint64_t Candidate::getCreatedSerialNumber() const {
 	if (parent)
 		return parent->getSerialNumber();
+	else if (detached)
+		return createdSerialNumber;
 	else
 		return serialNumber;
 }
 
+void Candidate::detachFromParent() {
+	if (!parent)
+		return;
+	sourceSerialNumber = parent->getSourceSerialNumber();
+	createdSerialNumber = parent->getSerialNumber();
+	detached = true;
+	parent = 0;
+}
+
+void Candidate::setParentSerialNumbers(uint64_t source, uint64_t created) {
+	sourceSerialNumber = source;
+	createdSerialNumber = created;
+	detached = true;
+	parent = 0;
+}
+
 void Candidate::setNextSerialNumber(uint64_t snr) {
-	nextSerialNumber = snr;
+	g_serial_counter = snr;
+	g_serial_epoch++;
 }
 
 uint64_t Candidate::getNextSerialNumber() {
-	return nextSerialNumber;
+	uint64_t counter = g_serial_counter.load();
+	// exact if the block of this thread is the last one reserved
+	if ((t_serial_epoch == g_serial_epoch.load()) && (t_serial_end == counter))
+		return t_serial_last;
+	return counter;
 }
 
-uint64_t Candidate::nextSerialNumber = 0;
-
 void Candidate::restart() {
 	setActive(true);
 	setTrajectoryLength(0);
@@ -0,0 +1,36 @@
+#include "crpropa/CandidateStream.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+std::string CandidateStream::getDescription() const {
+	return "CandidateStream";
+}
+
+SourceStream::SourceStream(ref_ptr<SourceInterface> source, size_t count) :
+		source(source), count(count), position(0) {
+	if (!source)
+		throw std::runtime_error("SourceStream: no source");
+}
+
+std::vector<ref_ptr<Candidate> > SourceStream::next(size_t n) {
+	n = std::min(n, count - position);
+	std::vector<size_t> indices(n);
+	for (size_t i = 0; i < n; i++)
+		indices[i] = position + i;
+	position += n;
+	if (n == 0)
+		return std::vector<ref_ptr<Candidate> >();
+	return source->getCandidates(indices);
+}
+
+std::string SourceStream::getDescription() const {
+	std::stringstream ss;
+	ss << "SourceStream: " << count << " candidates of " << source->getDescription();
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -3,28 +3,33 @@
 #include "kiss/path.h"
 #include "kiss/logger.h"
 
+#include <clocale>
+#include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <string>
 #include <cmath>
 #include <algorithm>
 
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
 #define index(i,j) ((j)+(i)*Y.size())
 
 namespace crpropa {
 
-std::string getDataPath(std::string filename) {
-	static std::string dataPath;
-	if (dataPath.size())
-		return concat_path(dataPath, filename);
+namespace {
 
+// resolved once, see getDataPath
+std::string resolveDataPath() {
 	const char *env_path = getenv("CRPROPA_DATA_PATH");
 	if (env_path) {
 		if (is_directory(env_path)) {
-			dataPath = env_path;
 			KISS_LOG_INFO << "getDataPath: use environment variable, "
-					<< dataPath << std::endl;
-			return concat_path(dataPath, filename);
+					<< env_path << std::endl;
+			return env_path;
 		}
 	}
 
@@ -32,10 +37,9 @@ std::string getDataPath(std::string filename) {
 	{
 		std::string _path = CRPROPA_INSTALL_PREFIX "/share/crpropa";
 		if (is_directory(_path)) {
-			dataPath = _path;
 			KISS_LOG_INFO
-			<< "getDataPath: use install prefix, " << dataPath << std::endl;
-			return concat_path(dataPath, filename);
+			<< "getDataPath: use install prefix, " << _path << std::endl;
+			return _path;
 		}
 	}
 #endif
@@ -43,15 +47,22 @@ std::string getDataPath(std::string filename) {
 	{
 		std::string _path = executable_path() + "../data";
 		if (is_directory(_path)) {
-			dataPath = _path;
-			KISS_LOG_INFO << "getDataPath: use executable path, " << dataPath
+			KISS_LOG_INFO << "getDataPath: use executable path, " << _path
 					<< std::endl;
-			return concat_path(dataPath, filename);
+			return _path;
 		}
 	}
 
-	dataPath = "data";
-	KISS_LOG_INFO << "getDataPath: use default, " << dataPath << std::endl;
+	KISS_LOG_INFO << "getDataPath: use default, data" << std::endl;
+	return "data";
+}
+
+} // namespace
+
+std::string getDataPath(std::string filename) {
+	// the directory is resolved and logged on the first call only, the
+	// initialization is thread-safe for modules constructed concurrently
+	static const std::string dataPath = resolveDataPath();
 	return concat_path(dataPath, filename);
 }
 
@@ -78,24 +89,33 @@ double interpolate(double x, const std::vector<double> &X,
 	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
 }
 
-double interpolate2d(double x, double y, const std::vector<double> &X,
-		const std::vector<double> &Y, const std::vector<double> &Z) {
+double interpolate(double x, const std::vector<double> &X,
+		const std::vector<double> &Y, size_t &hint) {
+	size_t i1 = huntUpperBound(x, X, hint);
+	if (i1 == 0)
+		return Y.front();
+	if (i1 == X.size())
+		return Y.back();
 
-	std::vector<double>::const_iterator itx = std::upper_bound(X.begin(), X.end(), x);
-	std::vector<double>::const_iterator ity = std::upper_bound(Y.begin(), Y.end(), y);
+	size_t i = i1 - 1;
+	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+}
 
+// bilinear interpolation in the cell of the upper bounds i1 of x in X and j1 of y in Y
+static double interpolate2dCell(double x, double y, const std::vector<double> &X,
+		const std::vector<double> &Y, const std::vector<double> &Z, size_t i1, size_t j1) {
 	if (x > X.back() || x < X.front())
 		return 0;
 	if (y > Y.back() || y < Y.front())
 		return 0;
 
-	if (itx == X.begin() && ity == Y.begin())
+	if (i1 == 0 && j1 == 0)
 		return Z.front();
-	if (itx == X.end() && ity == Y.end())
+	if (i1 == X.size() && j1 == Y.size())
 		return Z.back();
 
-	size_t i = itx - X.begin() - 1;
-	size_t j = ity - Y.begin() - 1;
+	size_t i = i1 - 1;
+	size_t j = j1 - 1;
 
 	double Q11 = Z[index(i,j)];
 	double Q12 = Z[index(i,j+1)];
@@ -108,6 +128,21 @@ double interpolate2d(double x, double y, const std::vector<double> &X,
 	return ((Y[j+1]-y)/(Y[j+1]-Y[j]))*R1+((y-Y[j])/(Y[j+1]-Y[j]))*R2;
 }
 
+double interpolate2d(double x, double y, const std::vector<double> &X,
+		const std::vector<double> &Y, const std::vector<double> &Z) {
+	size_t i1 = std::upper_bound(X.begin(), X.end(), x) - X.begin();
+	size_t j1 = std::upper_bound(Y.begin(), Y.end(), y) - Y.begin();
+	return interpolate2dCell(x, y, X, Y, Z, i1, j1);
+}
+
+double interpolate2d(double x, double y, const std::vector<double> &X,
+		const std::vector<double> &Y, const std::vector<double> &Z,
+		size_t &hintX, size_t &hintY) {
+	size_t i1 = huntUpperBound(x, X, hintX);
+	size_t j1 = huntUpperBound(y, Y, hintY);
+	return interpolate2dCell(x, y, X, Y, Z, i1, j1);
+}
+
 double interpolateEquidistant(double x, double lo, double hi,
 		const std::vector<double> &Y) {
 	if (x <= lo)
@@ -132,5 +167,185 @@ size_t closestIndex(double x, const std::vector<double> &X) {
 		return i1;
 }
 
+// first position k with not before(X[k], x), starting the search at the hint
+template<class Before>
+static size_t hunt(double x, const std::vector<double> &X, size_t &hint, Before before) {
+	size_t n = X.size();
+	size_t k = std::min(hint, n);
+	size_t lo = k, hi = k; // the position is in [lo, hi]
+	if ((k > 0) and not before(X[k - 1], x)) {
+		// gallop downwards
+		hi = k - 1;
+		lo = hi;
+		size_t step = 1;
+		while ((lo > 0) and not before(X[lo - 1], x)) {
+			hi = lo - 1;
+			lo = (hi > step) ? hi - step : 0;
+			step *= 2;
+		}
+	} else if ((k < n) and before(X[k], x)) {
+		// gallop upwards
+		lo = k + 1;
+		hi = lo;
+		size_t step = 1;
+		while ((hi < n) and before(X[hi], x)) {
+			lo = hi + 1;
+			hi = std::min(lo + step, n);
+			step *= 2;
+		}
+	}
+	// bisection in [lo, hi]
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (before(X[mid], x))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	hint = lo;
+	return lo;
+}
+
+static bool lessEqual(double a, double b) {
+	return a <= b;
+}
+
+static bool less(double a, double b) {
+	return a < b;
+}
+
+size_t huntUpperBound(double x, const std::vector<double> &X, size_t &hint) {
+	return hunt(x, X, hint, lessEqual);
+}
+
+size_t huntLowerBound(double x, const std::vector<double> &X, size_t &hint) {
+	return hunt(x, X, hint, less);
+}
+
+size_t closestIndex(double x, const std::vector<double> &X, size_t &hint) {
+	size_t i1 = huntLowerBound(x, X, hint);
+	if (i1 == 0)
+		return i1;
+	if (i1 == X.size())
+		return i1 - 1;
+	size_t i0 = i1 - 1;
+	if (std::fabs(X[i0] - x) < std::fabs(X[i1] - x))
+		return i0;
+	else
+		return i1;
+}
+
+namespace {
+
+// correctly rounded powers of ten 1e-308 ... 1e308
+std::vector<double> makePowersOfTen() {
+	std::vector<double> powers(617);
+	char text[16];
+	for (int k = -308; k <= 308; k++) {
+		std::snprintf(text, sizeof(text), "1e%i", k);
+		powers[k + 308] = std::strtod(text, 0);
+	}
+	return powers;
+}
+
+const double *powersOfTen() {
+	static const std::vector<double> powers = makePowersOfTen();
+	return &powers[308];
+}
+
+// printf in the C locale, independent of the locale of the program
+size_t printScientific(char *buffer, double x, int precision) {
+	static locale_t cLocale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+	locale_t old = uselocale(cLocale);
+	int n = std::snprintf(buffer, 32, "%.*E", precision, x);
+	uselocale(old);
+	return std::max(n, 0);
+}
+
+size_t formatDigits(char *buffer, uint64_t x, bool negative, int width) {
+	char digits[24];
+	int n = 0;
+	do {
+		digits[n++] = '0' + x % 10;
+		x /= 10;
+	} while (x);
+	if (negative)
+		digits[n++] = '-';
+	size_t p = 0;
+	for (int i = n; i < width; i++)
+		buffer[p++] = ' ';
+	while (n)
+		buffer[p++] = digits[--n];
+	return p;
+}
+
+} // namespace
+
+size_t formatScientific(char *buffer, double x, int precision) {
+	double a = std::fabs(x);
+	// the fast path covers the normal doubles, printf the rest
+	if (!std::isfinite(x) || (precision < 0) || (precision > 9) || ((a != 0) && ((a < 1e-290) || (a > 1e300))))
+		return printScientific(buffer, x, precision);
+
+	const double *pow10 = powersOfTen();
+	int exponent = 0;
+	uint64_t digits = 0;
+	if (a != 0) {
+		exponent = int(std::floor(std::log10(a)));
+		double lower = pow10[precision], upper = pow10[precision + 1];
+		double scaled = a * pow10[precision - exponent];
+		if (scaled < lower) {
+			exponent--;
+			scaled = a * pow10[precision - exponent];
+		} else if (scaled >= upper) {
+			exponent++;
+			scaled = a * pow10[precision - exponent];
+		}
+		// scaled carries a rounding error of a few ulp, printf rounds the
+		// exact value: values close to a tie are left to printf
+		double integral = std::floor(scaled);
+		double fraction = scaled - integral;
+		if (std::fabs(fraction - 0.5) < scaled * 1e-15)
+			return printScientific(buffer, x, precision);
+		digits = uint64_t(integral) + (fraction > 0.5 ? 1 : 0);
+		if (digits >= uint64_t(upper)) {
+			digits /= 10;
+			exponent++;
+		}
+	}
+
+	size_t p = 0;
+	if (std::signbit(x))
+		buffer[p++] = '-';
+	char mantissa[16];
+	for (int i = precision; i >= 0; i--) {
+		mantissa[i] = '0' + digits % 10;
+		digits /= 10;
+	}
+	buffer[p++] = mantissa[0];
+	if (precision > 0) {
+		buffer[p++] = '.';
+		for (int i = 1; i <= precision; i++)
+			buffer[p++] = mantissa[i];
+	}
+	buffer[p++] = 'E';
+	buffer[p++] = (exponent < 0) ? '-' : '+';
+	int e = std::abs(exponent);
+	if (e >= 100)
+		buffer[p++] = '0' + e / 100;
+	buffer[p++] = '0' + (e / 10) % 10;
+	buffer[p++] = '0' + e % 10;
+	return p;
+}
+
+size_t formatInteger(char *buffer, int64_t x, int width) {
+	uint64_t magnitude = (x < 0) ? uint64_t(0) - uint64_t(x) : uint64_t(x);
+	return formatDigits(buffer, magnitude, x < 0, width);
+}
+
+size_t formatUnsigned(char *buffer, uint64_t x, int width) {
+	return formatDigits(buffer, x, false, width);
+}
+
 } // namespace crpropa
 
@@ -0,0 +1,919 @@
+#include "crpropa/Configuration.h"
+#include "crpropa/Geometry.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/NuclearDecay.h"
+#include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/TextOutput.h"
+#ifdef CRPROPA_HAVE_HDF5
+#include "crpropa/module/HDF5Output.h"
+#endif
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+
+// recursive descent parser of JSON documents, # starts a comment
+class JSONParser {
+	const std::string &text;
+	size_t pos;
+
+	void fail(const std::string &message) const {
+		size_t line = 1;
+		for (size_t i = 0; (i < pos) && (i < text.size()); i++)
+			if (text[i] == '\n')
+				line++;
+		std::stringstream ss;
+		ss << "ConfigNode: " << message << " in line " << line;
+		throw std::runtime_error(ss.str());
+	}
+
+	void skip() {
+		while (pos < text.size()) {
+			if (isspace((unsigned char) text[pos])) {
+				pos++;
+			} else if (text[pos] == '#') {
+				while ((pos < text.size()) && (text[pos] != '\n'))
+					pos++;
+			} else {
+				break;
+			}
+		}
+	}
+
+	// skips white space and the character c if it follows
+	bool accept(char c) {
+		skip();
+		if ((pos < text.size()) && (text[pos] == c)) {
+			pos++;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c) {
+		if (!accept(c))
+			fail(std::string("expected '") + c + "'");
+	}
+
+	bool literal(const std::string &word) {
+		if (text.compare(pos, word.size(), word) != 0)
+			return false;
+		pos += word.size();
+		return true;
+	}
+
+	std::string parseString() {
+		expect('"');
+		std::string s;
+		while (true) {
+			if (pos >= text.size())
+				fail("unterminated string");
+			char c = text[pos++];
+			if (c == '"')
+				return s;
+			if (c != '\\') {
+				s += c;
+				continue;
+			}
+			if (pos >= text.size())
+				fail("unterminated string");
+			c = text[pos++];
+			if (c == 'n') {
+				s += '\n';
+			} else if (c == 't') {
+				s += '\t';
+			} else if (c == 'r') {
+				s += '\r';
+			} else if (c == 'b') {
+				s += '\b';
+			} else if (c == 'f') {
+				s += '\f';
+			} else if (c == 'u') {
+				if (pos + 4 > text.size())
+					fail("invalid escape sequence");
+				unsigned long code = strtoul(text.substr(pos, 4).c_str(), NULL, 16);
+				pos += 4;
+				// UTF-8 of the basic multilingual plane
+				if (code < 0x80) {
+					s += char(code);
+				} else if (code < 0x800) {
+					s += char(0xC0 | (code >> 6));
+					s += char(0x80 | (code & 0x3F));
+				} else {
+					s += char(0xE0 | (code >> 12));
+					s += char(0x80 | ((code >> 6) & 0x3F));
+					s += char(0x80 | (code & 0x3F));
+				}
+			} else {
+				s += c; // \" \\ \/
+			}
+		}
+	}
+
+	ConfigNode parseValue() {
+		skip();
+		if (pos >= text.size())
+			fail("unexpected end of the document");
+
+		if (accept('{')) {
+			ConfigNode object = ConfigNode::emptyObject();
+			if (accept('}'))
+				return object;
+			do {
+				std::string key = parseString();
+				expect(':');
+				if (object.has(key))
+					fail("duplicate key \"" + key + "\"");
+				object.set(key, parseValue());
+			} while (accept(','));
+			expect('}');
+			return object;
+		}
+
+		if (accept('[')) {
+			ConfigNode array = ConfigNode::emptyArray();
+			if (accept(']'))
+				return array;
+			do {
+				array.append(parseValue());
+			} while (accept(','));
+			expect(']');
+			return array;
+		}
+
+		if (text[pos] == '"')
+			return ConfigNode::fromString(parseString());
+		if (literal("true"))
+			return ConfigNode::fromBool(true);
+		if (literal("false"))
+			return ConfigNode::fromBool(false);
+		if (literal("null"))
+			return ConfigNode();
+
+		const char *begin = text.c_str() + pos;
+		char *end = NULL;
+		double value = strtod(begin, &end);
+		if (end == begin)
+			fail("invalid value");
+		pos += end - begin;
+		return ConfigNode::fromNumber(value);
+	}
+
+public:
+	JSONParser(const std::string &text) : text(text), pos(0) {
+	}
+
+	ConfigNode parseDocument() {
+		ConfigNode node = parseValue();
+		skip();
+		if (pos < text.size())
+			fail("unexpected characters after the document");
+		return node;
+	}
+};
+
+// units of Units.h by name
+std::map<std::string, double> unitValues() {
+	std::map<std::string, double> units;
+	{
+		units["meter"] = meter; units["m"] = meter;
+		units["centimeter"] = centimeter; units["cm"] = cm;
+		units["kilometer"] = kilometer; units["km"] = km;
+		units["au"] = au; units["ly"] = ly;
+		units["parsec"] = parsec; units["pc"] = pc;
+		units["kiloparsec"] = kiloparsec; units["kpc"] = kpc;
+		units["megaparsec"] = megaparsec; units["Mpc"] = Mpc;
+		units["gigaparsec"] = gigaparsec; units["Gpc"] = Gpc;
+		units["second"] = second; units["sec"] = sec; units["s"] = second;
+		units["ns"] = ns; units["mus"] = mus; units["ms"] = ms;
+		units["minute"] = minute; units["hour"] = hour;
+		units["kilogram"] = kilogram; units["kg"] = kilogram;
+		units["kelvin"] = kelvin; units["K"] = kelvin;
+		units["joule"] = joule; units["J"] = joule; units["erg"] = erg;
+		units["electronvolt"] = electronvolt; units["eV"] = eV;
+		units["keV"] = keV; units["MeV"] = MeV; units["GeV"] = GeV;
+		units["TeV"] = TeV; units["PeV"] = PeV; units["EeV"] = EeV;
+		units["ZeV"] = 1000 * EeV;
+		units["tesla"] = tesla; units["T"] = tesla;
+		units["gauss"] = gauss; units["G"] = gauss;
+		units["microgauss"] = microgauss; units["muG"] = muG;
+		units["nanogauss"] = nanogauss; units["nG"] = nG;
+		units["rad"] = rad; units["deg"] = deg;
+		units["barn"] = barn; units["ccm"] = ccm;
+		units["c_light"] = c_light; units["eplus"] = eplus;
+	}
+	return units;
+}
+
+double unitValue(const std::string &name) {
+	// initialized once, also if the modules are built concurrently
+	static const std::map<std::string, double> units = unitValues();
+	std::map<std::string, double>::const_iterator u = units.find(name);
+	if (u == units.end())
+		throw std::runtime_error("ConfigNode: unknown unit \"" + name + "\"");
+	return u->second;
+}
+
+} // namespace
+
+ConfigNode::ConfigNode() : type(Null), boolean(false), number(0) {
+}
+
+ConfigNode ConfigNode::parse(const std::string &text) {
+	return JSONParser(text).parseDocument();
+}
+
+ConfigNode ConfigNode::load(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	if (!in.good())
+		throw std::runtime_error("ConfigNode: could not open file " + filename);
+	std::stringstream ss;
+	ss << in.rdbuf();
+	try {
+		return parse(ss.str());
+	} catch (std::runtime_error &e) {
+		throw std::runtime_error(std::string(e.what()) + " of " + filename);
+	}
+}
+
+double ConfigNode::parseQuantity(const std::string &quantity) {
+	const char *begin = quantity.c_str();
+	char *end = NULL;
+	double value = strtod(begin, &end);
+	if (end == begin)
+		throw std::runtime_error("ConfigNode: invalid quantity \"" + quantity + "\"");
+
+	// units separated by white space, * or /
+	size_t i = end - begin;
+	bool divide = false;
+	while (i < quantity.size()) {
+		char c = quantity[i];
+		if (isspace((unsigned char) c) || (c == '*')) {
+			i++;
+			continue;
+		}
+		if (c == '/') {
+			divide = true;
+			i++;
+			continue;
+		}
+		size_t j = i;
+		while ((j < quantity.size()) && (isalnum((unsigned char) quantity[j]) || (quantity[j] == '_')))
+			j++;
+		if (j == i)
+			throw std::runtime_error("ConfigNode: invalid quantity \"" + quantity + "\"");
+		double unit = unitValue(quantity.substr(i, j - i));
+		value = divide ? value / unit : value * unit;
+		divide = false;
+		i = j;
+	}
+	return value;
+}
+
+ConfigNode::Type ConfigNode::getType() const {
+	return type;
+}
+
+bool ConfigNode::isNull() const {
+	return type == Null;
+}
+
+size_t ConfigNode::size() const {
+	if (type == Array)
+		return items.size();
+	if (type == Object)
+		return members.size();
+	return 0;
+}
+
+bool ConfigNode::has(const std::string &key) const {
+	for (size_t i = 0; i < members.size(); i++)
+		if (members[i].first == key)
+			return true;
+	return false;
+}
+
+std::vector<std::string> ConfigNode::getKeys() const {
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < members.size(); i++)
+		keys.push_back(members[i].first);
+	return keys;
+}
+
+const ConfigNode &ConfigNode::operator[](const std::string &key) const {
+	if (type != Object)
+		throw std::runtime_error("ConfigNode: \"" + key + "\" requested from a value which is not an object");
+	for (size_t i = 0; i < members.size(); i++)
+		if (members[i].first == key)
+			return members[i].second;
+	throw std::runtime_error("ConfigNode: missing \"" + key + "\"");
+}
+
+const ConfigNode &ConfigNode::operator[](size_t i) const {
+	if (type != Array)
+		throw std::runtime_error("ConfigNode: item requested from a value which is not an array");
+	if (i >= items.size())
+		throw std::runtime_error("ConfigNode: array index out of range");
+	return items[i];
+}
+
+void ConfigNode::set(const std::string &key, const ConfigNode &value) {
+	if (type == Null)
+		type = Object;
+	if (type != Object)
+		throw std::runtime_error("ConfigNode: \"" + key + "\" set in a value which is not an object");
+	for (size_t i = 0; i < members.size(); i++) {
+		if (members[i].first == key) {
+			members[i].second = value;
+			return;
+		}
+	}
+	members.push_back(std::make_pair(key, value));
+}
+
+void ConfigNode::append(const ConfigNode &item) {
+	if (type == Null)
+		type = Array;
+	if (type != Array)
+		throw std::runtime_error("ConfigNode: item appended to a value which is not an array");
+	items.push_back(item);
+}
+
+ConfigNode ConfigNode::fromBool(bool value) {
+	ConfigNode node;
+	node.type = Boolean;
+	node.boolean = value;
+	return node;
+}
+
+ConfigNode ConfigNode::fromNumber(double value) {
+	ConfigNode node;
+	node.type = Number;
+	node.number = value;
+	return node;
+}
+
+ConfigNode ConfigNode::fromString(const std::string &value) {
+	ConfigNode node;
+	node.type = String;
+	node.string = value;
+	return node;
+}
+
+ConfigNode ConfigNode::emptyArray() {
+	ConfigNode node;
+	node.type = Array;
+	return node;
+}
+
+ConfigNode ConfigNode::emptyObject() {
+	ConfigNode node;
+	node.type = Object;
+	return node;
+}
+
+bool ConfigNode::asBool() const {
+	if (type != Boolean)
+		throw std::runtime_error("ConfigNode: expected true or false");
+	return boolean;
+}
+
+double ConfigNode::asNumber() const {
+	if (type != Number)
+		throw std::runtime_error("ConfigNode: expected a number");
+	return number;
+}
+
+const std::string &ConfigNode::asString() const {
+	if (type != String)
+		throw std::runtime_error("ConfigNode: expected a string");
+	return string;
+}
+
+double ConfigNode::asQuantity() const {
+	if (type == Number)
+		return number;
+	if (type == String)
+		return parseQuantity(string);
+	throw std::runtime_error("ConfigNode: expected a number or a quantity string");
+}
+
+Vector3d ConfigNode::asVector() const {
+	if ((type != Array) || (items.size() != 3))
+		throw std::runtime_error("ConfigNode: expected an array of three values");
+	return Vector3d(items[0].asQuantity(), items[1].asQuantity(), items[2].asQuantity());
+}
+
+bool ConfigNode::getBool(const std::string &key, bool defaultValue) const {
+	return has(key) ? (*this)[key].asBool() : defaultValue;
+}
+
+double ConfigNode::getNumber(const std::string &key, double defaultValue) const {
+	return has(key) ? (*this)[key].asNumber() : defaultValue;
+}
+
+double ConfigNode::getQuantity(const std::string &key, double defaultValue) const {
+	return has(key) ? (*this)[key].asQuantity() : defaultValue;
+}
+
+std::string ConfigNode::getString(const std::string &key, const std::string &defaultValue) const {
+	return has(key) ? (*this)[key].asString() : defaultValue;
+}
+
+Vector3d ConfigNode::getVector(const std::string &key, const Vector3d &defaultValue) const {
+	return has(key) ? (*this)[key].asVector() : defaultValue;
+}
+
+// ----------------------------------------------------------------------------
+// factories of the supported types
+
+namespace {
+
+typedef std::map<std::string, SimulationConfig::ModuleFactory> ModuleFactories;
+typedef std::map<std::string, SimulationConfig::SourceFeatureFactory> SourceFeatureFactories;
+typedef std::map<std::string, SimulationConfig::MagneticFieldFactory> MagneticFieldFactories;
+
+// particle id given as "id" or as "nucleus": [A, Z]
+int particleId(const ConfigNode &node) {
+	if (node.has("nucleus")) {
+		const ConfigNode &nucleus = node["nucleus"];
+		return nucleusId((int) nucleus[0].asNumber(), (int) nucleus[1].asNumber());
+	}
+	return (int) node["id"].asNumber();
+}
+
+Output::OutputType outputType(const ConfigNode &node) {
+	std::string name = node.getString("outputType", "Everything");
+	if (name == "Trajectory1D")
+		return Output::Trajectory1D;
+	if (name == "Trajectory3D")
+		return Output::Trajectory3D;
+	if (name == "Event1D")
+		return Output::Event1D;
+	if (name == "Event3D")
+		return Output::Event3D;
+	if (name == "Everything")
+		return Output::Everything;
+	throw std::runtime_error("SimulationConfig: unknown output type " + name);
+}
+
+ref_ptr<Surface> createSurface(const ConfigNode &node) {
+	std::string type = node["type"].asString();
+	if (type == "Sphere")
+		return new Sphere(node.getVector("center", Vector3d(0.)), node["radius"].asQuantity());
+	if (type == "ParaxialBox")
+		return new ParaxialBox(node["corner"].asVector(), node["size"].asVector());
+	if (type == "Plane")
+		return new Plane(node["point"].asVector(), node["normal"].asVector());
+	throw std::runtime_error("SimulationConfig: unknown surface type " + type);
+}
+
+// modules
+
+ref_ptr<Module> createSimplePropagation(const ConfigNode &node, const SimulationConfig &config) {
+	return new SimplePropagation(node.getQuantity("minStep", 0.1 * kpc), node.getQuantity("maxStep", 1 * Gpc));
+}
+
+ref_ptr<Module> createPropagationCK(const ConfigNode &node, const SimulationConfig &config) {
+	return new PropagationCK(config.getMagneticField(node["field"]), node.getNumber("tolerance", 1e-4),
+		node.getQuantity("minStep", 0.1 * kpc), node.getQuantity("maxStep", 1 * Gpc));
+}
+
+ref_ptr<Module> createPropagationBP(const ConfigNode &node, const SimulationConfig &config) {
+	ref_ptr<MagneticField> field = config.getMagneticField(node["field"]);
+	if (node.has("fixedStep"))
+		return new PropagationBP(field, node["fixedStep"].asQuantity());
+	return new PropagationBP(field, node.getNumber("tolerance", 1e-4),
+		node.getQuantity("minStep", 0.1 * kpc), node.getQuantity("maxStep", 1 * Gpc));
+}
+
+ref_ptr<Module> createPhotoPionProduction(const ConfigNode &node, const SimulationConfig &config) {
+	return new PhotoPionProduction(config.getPhotonField(node["photonField"].asString()),
+		node.getBool("photons", false), node.getBool("neutrinos", false), node.getBool("electrons", false),
+		node.getBool("antiNucleons", false), node.getNumber("limit", 0.1), node.getBool("redshiftDependence", false));
+}
+
+ref_ptr<Module> createElectronPairProduction(const ConfigNode &node, const SimulationConfig &config) {
+	return new ElectronPairProduction(config.getPhotonField(node["photonField"].asString()),
+		node.getBool("electrons", false), node.getNumber("limit", 0.1));
+}
+
+ref_ptr<Module> createPhotoDisintegration(const ConfigNode &node, const SimulationConfig &config) {
+	return new PhotoDisintegration(config.getPhotonField(node["photonField"].asString()),
+		node.getBool("photons", false), node.getNumber("limit", 0.1));
+}
+
+ref_ptr<Module> createNuclearDecay(const ConfigNode &node, const SimulationConfig &config) {
+	return new NuclearDecay(node.getBool("electrons", false), node.getBool("photons", false),
+		node.getBool("neutrinos", false), node.getNumber("limit", 0.1));
+}
+
+ref_ptr<Module> createRedshift(const ConfigNode &node, const SimulationConfig &config) {
+	return new Redshift();
+}
+
+ref_ptr<Module> createMaximumTrajectoryLength(const ConfigNode &node, const SimulationConfig &config) {
+	return new MaximumTrajectoryLength(node["length"].asQuantity());
+}
+
+ref_ptr<Module> createMinimumEnergy(const ConfigNode &node, const SimulationConfig &config) {
+	return new MinimumEnergy(node["energy"].asQuantity());
+}
+
+ref_ptr<Module> createMinimumRedshift(const ConfigNode &node, const SimulationConfig &config) {
+	return new MinimumRedshift(node.getNumber("redshift", 0));
+}
+
+ref_ptr<Module> createMinimumChargeNumber(const ConfigNode &node, const SimulationConfig &config) {
+	return new MinimumChargeNumber((int) node.getNumber("chargeNumber", 0));
+}
+
+ref_ptr<Module> createObserver(const ConfigNode &node, const SimulationConfig &config) {
+	ref_ptr<Observer> observer = new Observer();
+	const ConfigNode &features = node["features"];
+	for (size_t i = 0; i < features.size(); i++)
+		observer->add(config.createObserverFeature(features[i]));
+	if (node.has("onDetection"))
+		observer->onDetection(config.createModule(node["onDetection"]), node.getBool("clone", false));
+	observer->setDeactivateOnDetection(node.getBool("deactivateOnDetection", true));
+	return observer;
+}
+
+ref_ptr<Module> createTextOutput(const ConfigNode &node, const SimulationConfig &config) {
+	return new TextOutput(node["filename"].asString(), outputType(node));
+}
+
+#ifdef CRPROPA_HAVE_HDF5
+ref_ptr<Module> createHDF5Output(const ConfigNode &node, const SimulationConfig &config) {
+	return new HDF5Output(node["filename"].asString(), outputType(node));
+}
+#endif
+
+ref_ptr<Module> createModuleList(const ConfigNode &node, const SimulationConfig &config) {
+	ref_ptr<ModuleList> list = new ModuleList();
+	const ConfigNode &modules = node["modules"];
+	for (size_t i = 0; i < modules.size(); i++)
+		list->add(config.createModule(modules[i]));
+	return list;
+}
+
+ModuleFactories &moduleFactories() {
+	static ModuleFactories factories;
+	if (factories.empty()) {
+		factories["SimplePropagation"] = createSimplePropagation;
+		factories["PropagationCK"] = createPropagationCK;
+		factories["PropagationBP"] = createPropagationBP;
+		factories["PhotoPionProduction"] = createPhotoPionProduction;
+		factories["ElectronPairProduction"] = createElectronPairProduction;
+		factories["PhotoDisintegration"] = createPhotoDisintegration;
+		factories["NuclearDecay"] = createNuclearDecay;
+		factories["Redshift"] = createRedshift;
+		factories["MaximumTrajectoryLength"] = createMaximumTrajectoryLength;
+		factories["MinimumEnergy"] = createMinimumEnergy;
+		factories["MinimumRedshift"] = createMinimumRedshift;
+		factories["MinimumChargeNumber"] = createMinimumChargeNumber;
+		factories["Observer"] = createObserver;
+		factories["TextOutput"] = createTextOutput;
+#ifdef CRPROPA_HAVE_HDF5
+		factories["HDF5Output"] = createHDF5Output;
+#endif
+		factories["ModuleList"] = createModuleList;
+	}
+	return factories;
+}
+
+// source features
+
+ref_ptr<SourceFeature> createSourceParticleType(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceParticleType(particleId(node));
+}
+
+ref_ptr<SourceFeature> createSourceEnergy(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceEnergy(node["energy"].asQuantity());
+}
+
+ref_ptr<SourceFeature> createSourcePowerLawSpectrum(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourcePowerLawSpectrum(node["Emin"].asQuantity(), node["Emax"].asQuantity(), node["index"].asNumber());
+}
+
+ref_ptr<SourceFeature> createSourceComposition(const ConfigNode &node, const SimulationConfig &config) {
+	ref_ptr<SourceComposition> composition = new SourceComposition(node["Emin"].asQuantity(),
+		node["Rmax"].asQuantity(), node["index"].asNumber());
+	const ConfigNode &nuclei = node["nuclei"];
+	for (size_t i = 0; i < nuclei.size(); i++)
+		composition->add(particleId(nuclei[i]), nuclei[i]["abundance"].asNumber());
+	return composition;
+}
+
+ref_ptr<SourceFeature> createSourcePosition(const ConfigNode &node, const SimulationConfig &config) {
+	if (node.has("distance"))
+		return new SourcePosition(node["distance"].asQuantity());
+	return new SourcePosition(node["position"].asVector());
+}
+
+ref_ptr<SourceFeature> createSourceUniform1D(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceUniform1D(node["minD"].asQuantity(), node["maxD"].asQuantity(), node.getBool("withCosmology", true));
+}
+
+ref_ptr<SourceFeature> createSourceUniformSphere(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceUniformSphere(node.getVector("center", Vector3d(0.)), node["radius"].asQuantity());
+}
+
+ref_ptr<SourceFeature> createSourceUniformBox(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceUniformBox(node["origin"].asVector(), node["size"].asVector());
+}
+
+ref_ptr<SourceFeature> createSourceIsotropicEmission(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceIsotropicEmission();
+}
+
+ref_ptr<SourceFeature> createSourceDirection(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceDirection(node.getVector("direction", Vector3d(-1, 0, 0)));
+}
+
+ref_ptr<SourceFeature> createSourceRedshift(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceRedshift(node["z"].asNumber());
+}
+
+ref_ptr<SourceFeature> createSourceUniformRedshift(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceUniformRedshift(node["zmin"].asNumber(), node["zmax"].asNumber());
+}
+
+ref_ptr<SourceFeature> createSourceRedshift1D(const ConfigNode &node, const SimulationConfig &config) {
+	return new SourceRedshift1D();
+}
+
+SourceFeatureFactories &sourceFeatureFactories() {
+	static SourceFeatureFactories factories;
+	if (factories.empty()) {
+		factories["SourceParticleType"] = createSourceParticleType;
+		factories["SourceEnergy"] = createSourceEnergy;
+		factories["SourcePowerLawSpectrum"] = createSourcePowerLawSpectrum;
+		factories["SourceComposition"] = createSourceComposition;
+		factories["SourcePosition"] = createSourcePosition;
+		factories["SourceUniform1D"] = createSourceUniform1D;
+		factories["SourceUniformSphere"] = createSourceUniformSphere;
+		factories["SourceUniformBox"] = createSourceUniformBox;
+		factories["SourceIsotropicEmission"] = createSourceIsotropicEmission;
+		factories["SourceDirection"] = createSourceDirection;
+		factories["SourceRedshift"] = createSourceRedshift;
+		factories["SourceUniformRedshift"] = createSourceUniformRedshift;
+		factories["SourceRedshift1D"] = createSourceRedshift1D;
+	}
+	return factories;
+}
+
+// magnetic fields
+
+ref_ptr<MagneticField> createUniformMagneticField(const ConfigNode &node, const SimulationConfig &config) {
+	return new UniformMagneticField(node["value"].asVector());
+}
+
+ref_ptr<MagneticField> createJF12Field(const ConfigNode &node, const SimulationConfig &config) {
+	return new JF12Field();
+}
+
+ref_ptr<MagneticField> createMagneticFieldList(const ConfigNode &node, const SimulationConfig &config) {
+	ref_ptr<MagneticFieldList> list = new MagneticFieldList();
+	const ConfigNode &fields = node["fields"];
+	for (size_t i = 0; i < fields.size(); i++)
+		list->addField(config.getMagneticField(fields[i]));
+	return list;
+}
+
+MagneticFieldFactories &magneticFieldFactories() {
+	static MagneticFieldFactories factories;
+	if (factories.empty()) {
+		factories["UniformMagneticField"] = createUniformMagneticField;
+		factories["JF12Field"] = createJF12Field;
+		factories["MagneticFieldList"] = createMagneticFieldList;
+	}
+	return factories;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+
+SimulationConfig::SimulationConfig(const ConfigNode &config) : config(config) {
+	build();
+}
+
+ref_ptr<SimulationConfig> SimulationConfig::fromFile(const std::string &filename) {
+	return new SimulationConfig(ConfigNode::load(filename));
+}
+
+ref_ptr<SimulationConfig> SimulationConfig::fromString(const std::string &text) {
+	return new SimulationConfig(ConfigNode::parse(text));
+}
+
+void SimulationConfig::build() {
+	// named fields in the order of the file, a field can use the fields before it
+	if (config.has("magneticFields")) {
+		const ConfigNode &fields = config["magneticFields"];
+		std::vector<std::string> names = fields.getKeys();
+		for (size_t i = 0; i < names.size(); i++)
+			magneticFields[names[i]] = getMagneticField(fields[names[i]]);
+	}
+
+	// the modules are constructed concurrently, so that the interaction
+	// modules parse their tables at the same time
+	moduleList = new ModuleList();
+	const ConfigNode &modules = config["modules"];
+	int threads = 0;
+	if (config.has("run"))
+		threads = (int) config["run"].getNumber("initThreads", 0);
+	moduleFactories(); // fill the registry before the threads read it
+	std::vector<std::function<ref_ptr<Module>()> > factories;
+	for (size_t i = 0; i < modules.size(); i++) {
+		const ConfigNode *node = &modules[i];
+		factories.push_back([this, node]() { return createModule(*node); });
+	}
+	moduleList->addParallel(factories, threads);
+
+	source = new Source();
+	if (config.has("source")) {
+		const ConfigNode &features = config["source"]["features"];
+		for (size_t i = 0; i < features.size(); i++)
+			source->add(createSourceFeature(features[i]));
+	}
+}
+
+const ConfigNode &SimulationConfig::getConfig() const {
+	return config;
+}
+
+ref_ptr<ModuleList> SimulationConfig::getModuleList() const {
+	return moduleList;
+}
+
+ref_ptr<Source> SimulationConfig::getSource() const {
+	return source;
+}
+
+size_t SimulationConfig::getCount() const {
+	if (!config.has("run"))
+		return 0;
+	return (size_t) config["run"].getNumber("count", 0);
+}
+
+void SimulationConfig::run() {
+	ConfigNode options = config.has("run") ? config["run"] : ConfigNode::emptyObject();
+#if _OPENMP
+	if (options.has("threads"))
+		omp_set_num_threads((int) options["threads"].asNumber());
+#endif
+	if (options.has("seed"))
+		Random::seedThreads((uint32_t) options["seed"].asNumber());
+	moduleList->setShowProgress(options.getBool("showProgress", false));
+	moduleList->setBatchSize((size_t) options.getNumber("batchSize", 0));
+	moduleList->setSkipInactive(options.getBool("skipInactive", false));
+	moduleList->run((SourceInterface *) source, getCount(), options.getBool("recursive", true),
+		options.getBool("secondariesFirst", false));
+}
+
+ref_ptr<Module> SimulationConfig::createModule(const ConfigNode &node) const {
+	std::string type = node["type"].asString();
+	ModuleFactories::const_iterator f = moduleFactories().find(type);
+	if (f == moduleFactories().end())
+		throw std::runtime_error("SimulationConfig: unknown module type " + type);
+	try {
+		return f->second(node, *this);
+	} catch (std::runtime_error &e) {
+		throw std::runtime_error(std::string(e.what()) + " (" + type + ")");
+	}
+}
+
+ref_ptr<SourceFeature> SimulationConfig::createSourceFeature(const ConfigNode &node) const {
+	std::string type = node["type"].asString();
+	SourceFeatureFactories::const_iterator f = sourceFeatureFactories().find(type);
+	if (f == sourceFeatureFactories().end())
+		throw std::runtime_error("SimulationConfig: unknown source feature type " + type);
+	try {
+		return f->second(node, *this);
+	} catch (std::runtime_error &e) {
+		throw std::runtime_error(std::string(e.what()) + " (" + type + ")");
+	}
+}
+
+ref_ptr<ObserverFeature> SimulationConfig::createObserverFeature(const ConfigNode &node) const {
+	std::string type = node["type"].asString();
+	if (type == "Observer1D")
+		return new Observer1D();
+	if (type == "ObserverDetectAll")
+		return new ObserverDetectAll();
+	if (type == "ObserverSurface")
+		return new ObserverSurface(createSurface(node["surface"]));
+	if (type == "ObserverRedshiftWindow")
+		return new ObserverRedshiftWindow(node.getNumber("zmin", 0), node.getNumber("zmax", 0.1));
+	if (type == "ObserverInactiveVeto")
+		return new ObserverInactiveVeto();
+	if (type == "ObserverNucleusVeto")
+		return new ObserverNucleusVeto();
+	if (type == "ObserverNeutrinoVeto")
+		return new ObserverNeutrinoVeto();
+	if (type == "ObserverPhotonVeto")
+		return new ObserverPhotonVeto();
+	if (type == "ObserverElectronVeto")
+		return new ObserverElectronVeto();
+	if (type == "ObserverParticleIdVeto")
+		return new ObserverParticleIdVeto(particleId(node));
+	throw std::runtime_error("SimulationConfig: unknown observer feature type " + type);
+}
+
+ref_ptr<MagneticField> SimulationConfig::getMagneticField(const ConfigNode &node) const {
+	if (node.getType() == ConfigNode::String) {
+		std::map<std::string, ref_ptr<MagneticField> >::const_iterator f = magneticFields.find(node.asString());
+		if (f == magneticFields.end())
+			throw std::runtime_error("SimulationConfig: unknown magnetic field " + node.asString());
+		return f->second;
+	}
+	std::string type = node["type"].asString();
+	MagneticFieldFactories::const_iterator f = magneticFieldFactories().find(type);
+	if (f == magneticFieldFactories().end())
+		throw std::runtime_error("SimulationConfig: unknown magnetic field type " + type);
+	return f->second(node, *this);
+}
+
+ref_ptr<PhotonField> SimulationConfig::getPhotonField(const std::string &name) const {
+	// shared by the modules constructed concurrently in build()
+	static std::mutex photonFieldMutex;
+	std::lock_guard<std::mutex> lock(photonFieldMutex);
+	std::map<std::string, ref_ptr<PhotonField> >::const_iterator f = photonFields.find(name);
+	if (f != photonFields.end())
+		return f->second;
+
+	ref_ptr<PhotonField> field;
+	if (name == "CMB")
+		field = new CMB();
+	else if (name == "IRB_Kneiske04")
+		field = new IRB_Kneiske04();
+	else if (name == "IRB_Stecker05")
+		field = new IRB_Stecker05();
+	else if (name == "IRB_Franceschini08")
+		field = new IRB_Franceschini08();
+	else if (name == "IRB_Finke10")
+		field = new IRB_Finke10();
+	else if (name == "IRB_Dominguez11")
+		field = new IRB_Dominguez11();
+	else if (name == "IRB_Gilmore12")
+		field = new IRB_Gilmore12();
+	else if (name == "IRB_Stecker16_upper")
+		field = new IRB_Stecker16_upper();
+	else if (name == "IRB_Stecker16_lower")
+		field = new IRB_Stecker16_lower();
+	else if (name == "IRB_Saldana21")
+		field = new IRB_Saldana21();
+	else if (name == "IRB_Saldana21_upper")
+		field = new IRB_Saldana21_upper();
+	else if (name == "IRB_Saldana21_lower")
+		field = new IRB_Saldana21_lower();
+	else if (name == "IRB_Finke22")
+		field = new IRB_Finke22();
+	else if (name == "URB_Protheroe96")
+		field = new URB_Protheroe96();
+	else if (name == "URB_Fixsen11")
+		field = new URB_Fixsen11();
+	else if (name == "URB_Nitu21")
+		field = new URB_Nitu21();
+	else
+		throw std::runtime_error("SimulationConfig: unknown photon field " + name);
+	photonFields[name] = field;
+	return field;
+}
+
+void SimulationConfig::registerModule(const std::string &type, ModuleFactory factory) {
+	moduleFactories()[type] = factory;
+}
+
+void SimulationConfig::registerSourceFeature(const std::string &type, SourceFeatureFactory factory) {
+	sourceFeatureFactories()[type] = factory;
+}
+
+void SimulationConfig::registerMagneticField(const std::string &type, MagneticFieldFactory factory) {
+	magneticFieldFactories()[type] = factory;
+}
+
+} // namespace crpropa
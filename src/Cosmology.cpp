@@ -4,10 +4,57 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <stdexcept>
 
 namespace crpropa {
 
+/**
+ Constant-time search of the interval X[i] <= x < X[i + 1] in a table that is
+ zero at X[0] and increasing from X[1], such as the redshifts and distances
+ below: each of the bins equidistant in log(x) points to the interval of its
+ lower edge, from which the interval of x is at most a few entries away.
+ */
+struct LogIndex {
+	double logMin, dlog;
+	std::vector<size_t> bins;
+
+	void init(const std::vector<double> &X) {
+		size_t nBins = 4 * X.size();
+		logMin = log(X[1]);
+		dlog = (log(X.back()) - logMin) / nBins;
+		bins.resize(nBins);
+		size_t i = 0;
+		for (size_t k = 0; k < nBins; k++) {
+			double x = exp(logMin + k * dlog);
+			while ((i + 2 < X.size()) and (X[i + 1] <= x))
+				i++;
+			bins[k] = i;
+		}
+	}
+
+	size_t find(double x, const std::vector<double> &X) const {
+		if (x < X[1])
+			return 0;
+		double p = (log(x) - logMin) / dlog;
+		size_t i = bins[(p > 0) ? std::min(size_t(p), bins.size() - 1) : 0];
+		// correct for rounding at the edges of the bins
+		while ((i > 0) and (X[i] > x))
+			i--;
+		while ((i + 2 < X.size()) and (X[i + 1] <= x))
+			i++;
+		return i;
+	}
+
+	// linear interpolation of Y(x), as interpolate(x, X, Y)
+	double interpolate(double x, const std::vector<double> &X, const std::vector<double> &Y) const {
+		if (x >= X.back())
+			return Y.back();
+		size_t i = find(x, X);
+		return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+	}
+};
+
 /**
  @class Cosmology
  @brief Cosmology calculations
@@ -25,6 +72,7 @@ struct Cosmology {
 	std::vector<double> Dc; // comoving distance [m]
 	std::vector<double> Dl; // luminosity distance [m]
 	std::vector<double> Dt; // light travel distance [m]
+	LogIndex indexZ, indexDc, indexDl, indexDt;
 
 	void update() {
 		double dH = c_light / H0; // Hubble distance
@@ -46,6 +94,11 @@ struct Cosmology {
 							* (1 / ((1 + Z[i]) * E[i])
 									+ 1 / ((1 + Z[i - 1]) * E[i - 1])) / 2;
 		}
+
+		indexZ.init(Z);
+		indexDc.init(Dc);
+		indexDl.init(Dl);
+		indexDt.init(Dt);
 	}
 
 	Cosmology() {
@@ -107,7 +160,7 @@ double comovingDistance2Redshift(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dc.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Z);
+	return cosmology.indexDc.interpolate(d, cosmology.Dc, cosmology.Z);
 }
 
 double redshift2ComovingDistance(double z) {
@@ -115,7 +168,18 @@ double redshift2ComovingDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dc);
+	return cosmology.indexZ.interpolate(z, cosmology.Z, cosmology.Dc);
+}
+
+double redshiftAfterComovingStep(double z, double step) {
+	if (z < 0)
+		throw std::runtime_error("Cosmology: z < 0");
+	if (z > cosmology.zmax)
+		throw std::runtime_error("Cosmology: z > zmax");
+	double d = cosmology.indexZ.interpolate(z, cosmology.Z, cosmology.Dc) - step;
+	if (d <= 0)
+		return 0;
+	return cosmology.indexDc.interpolate(d, cosmology.Dc, cosmology.Z);
 }
 
 double luminosityDistance2Redshift(double d) {
@@ -123,7 +187,7 @@ double luminosityDistance2Redshift(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dl.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dl, cosmology.Z);
+	return cosmology.indexDl.interpolate(d, cosmology.Dl, cosmology.Z);
 }
 
 double redshift2LuminosityDistance(double z) {
@@ -131,7 +195,7 @@ double redshift2LuminosityDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dl);
+	return cosmology.indexZ.interpolate(z, cosmology.Z, cosmology.Dl);
 }
 
 double lightTravelDistance2Redshift(double d) {
@@ -139,7 +203,7 @@ double lightTravelDistance2Redshift(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dt.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Z);
+	return cosmology.indexDt.interpolate(d, cosmology.Dt, cosmology.Z);
 }
 
 double redshift2LightTravelDistance(double z) {
@@ -147,7 +211,7 @@ double redshift2LightTravelDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dt);
+	return cosmology.indexZ.interpolate(z, cosmology.Z, cosmology.Dt);
 }
 
 double comoving2LightTravelDistance(double d) {
@@ -155,7 +219,7 @@ double comoving2LightTravelDistance(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dc.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Dt);
+	return cosmology.indexDc.interpolate(d, cosmology.Dc, cosmology.Dt);
 }
 
 double lightTravel2ComovingDistance(double d) {
@@ -163,7 +227,7 @@ double lightTravel2ComovingDistance(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dt.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Dc);
+	return cosmology.indexDt.interpolate(d, cosmology.Dt, cosmology.Dc);
 }
 
 } // namespace crpropa
@@ -0,0 +1,199 @@
+#include "crpropa/DataTable.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+static const char magic[8] = {'C', 'R', 'P', 'T', 'A', 'B', 'L', 'E'};
+
+struct DataTableHeader {
+	char magic[8];
+	uint64_t textSize;
+	uint64_t nRows;
+	uint64_t nValues;
+};
+
+bool DataTable::cacheEnabled = true;
+
+static bool fileStatus(const std::string &filename, uint64_t &size,
+		double &modified) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	size = st.st_size;
+	modified = st.st_mtime;
+	return true;
+}
+
+DataTable::DataTable(const std::string &filename) :
+		values(0), offsets(0), nRows(0), memory(MemoryUsage::Tables) {
+	if (!loadBinary(filename)) {
+		parse(filename);
+		if (cacheEnabled)
+			writeBinary(filename);
+	}
+	memory.set(count() * sizeof(double) + (nRows + 1) * sizeof(uint64_t));
+}
+
+bool DataTable::loadBinary(const std::string &filename) {
+	uint64_t textSize, binarySize;
+	double textModified, binaryModified;
+	std::string binary = binaryFilename(filename);
+	if (!fileStatus(filename, textSize, textModified))
+		return false;
+	if (!fileStatus(binary, binarySize, binaryModified))
+		return false;
+	if (binaryModified < textModified || binarySize < sizeof(DataTableHeader))
+		return false;
+
+	try {
+		file = new MappedFile(binary);
+	} catch (std::runtime_error &e) {
+		return false;
+	}
+	const DataTableHeader *header = (const DataTableHeader *) file->data();
+	if (memcmp(header->magic, magic, sizeof(magic)) != 0
+			|| header->textSize != textSize
+			|| file->size() != sizeof(DataTableHeader)
+					+ (header->nRows + 1) * sizeof(uint64_t)
+					+ header->nValues * sizeof(double)) {
+		file = 0;
+		return false;
+	}
+	nRows = header->nRows;
+	offsets = (const uint64_t *) (header + 1);
+	values = (const double *) (offsets + nRows + 1);
+	return true;
+}
+
+void DataTable::parse(const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		throw std::runtime_error("DataTable: could not open file " + filename);
+
+	parsedOffsets.clear();
+	parsedValues.clear();
+	parsedOffsets.push_back(0);
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(infile, line)) {
+		lineNumber++;
+		const char *c = line.c_str();
+		while (*c == ' ' || *c == '\t' || *c == '\r')
+			c++;
+		if (*c == '#' || *c == '\0')
+			continue;
+		while (*c != '\0' && *c != '#') {
+			char *end;
+			double value = strtod(c, &end);
+			if (end == c) {
+				std::ostringstream msg;
+				msg << "DataTable: invalid value in " << filename << " line "
+						<< lineNumber;
+				throw std::runtime_error(msg.str());
+			}
+			parsedValues.push_back(value);
+			c = end;
+			while (*c == ' ' || *c == '\t' || *c == '\r' || *c == ',')
+				c++;
+		}
+		parsedOffsets.push_back(parsedValues.size());
+	}
+
+	nRows = parsedOffsets.size() - 1;
+	offsets = &parsedOffsets[0];
+	values = parsedValues.empty() ? 0 : &parsedValues[0];
+}
+
+void DataTable::writeBinary(const std::string &filename) const {
+	DataTableHeader header;
+	memcpy(header.magic, magic, sizeof(magic));
+	double modified;
+	if (!fileStatus(filename, header.textSize, modified))
+		return;
+	header.nRows = nRows;
+	header.nValues = count();
+
+	// write to a file of its own and rename it, so that concurrent
+	// processes and threads never map a partially written table
+	std::string binary = binaryFilename(filename);
+	std::ostringstream tmp;
+	static std::atomic<unsigned int> counter(0);
+	tmp << binary << ".tmp";
+#ifndef _WIN32
+	tmp << getpid();
+#endif
+	tmp << "_" << counter++;
+	std::ofstream out(tmp.str().c_str(), std::ios::binary);
+	if (!out.good())
+		return;
+	out.write((const char *) &header, sizeof(header));
+	out.write((const char *) offsets, (nRows + 1) * sizeof(uint64_t));
+	if (header.nValues > 0)
+		out.write((const char *) values, header.nValues * sizeof(double));
+	out.close();
+	if (!out.good() || std::rename(tmp.str().c_str(), binary.c_str()) != 0)
+		std::remove(tmp.str().c_str());
+}
+
+size_t DataTable::size() const {
+	return nRows;
+}
+
+size_t DataTable::columns(size_t i) const {
+	return offsets[i + 1] - offsets[i];
+}
+
+const double *DataTable::row(size_t i) const {
+	return values + offsets[i];
+}
+
+double DataTable::get(size_t i, size_t j) const {
+	return values[offsets[i] + j];
+}
+
+const double *DataTable::data() const {
+	return values;
+}
+
+size_t DataTable::count() const {
+	return offsets[nRows];
+}
+
+bool DataTable::isMapped() const {
+	return file.valid();
+}
+
+std::string DataTable::binaryFilename(const std::string &filename) {
+	const char *dir = getenv("CRPROPA_TABLE_CACHE");
+	if (dir == 0 || dir[0] == '\0')
+		return filename + ".bin";
+
+	// flatten the path of the text file into a name in the cache directory
+	std::string name = filename;
+	for (size_t i = 0; i < name.size(); i++)
+		if (name[i] == '/' || name[i] == '\\' || name[i] == ':')
+			name[i] = '_';
+	return std::string(dir) + "/" + name + ".bin";
+}
+
+void DataTable::setCacheEnabled(bool enabled) {
+	cacheEnabled = enabled;
+}
+
+bool DataTable::getCacheEnabled() {
+	return cacheEnabled;
+}
+
+} // namespace crpropa
@@ -4,16 +4,19 @@
 
 #include "kiss/logger.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <stdexcept>
 
 namespace crpropa {
 
-CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), dirty(false), frozen(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
 	sPhi = 2. * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
 
-CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), dirty(false), frozen(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
 	sPhi = 2 * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
@@ -24,12 +27,23 @@ void CylindricalProjectionMap::fillBin(const Vector3d& direction, double weight)
 }
 
 void CylindricalProjectionMap::fillBin(size_t bin, double weight) {
-	pdf[bin] += weight;
+	if (frozen)
+		throw std::runtime_error("CylindricalProjectionMap: map is frozen");
+	double &value = pdf[bin];
+#pragma omp atomic
+	value += weight;
+#pragma omp atomic write
 	dirty = true;
 }
 
 Vector3d CylindricalProjectionMap::drawDirection() const {
-	if (dirty)
+	if (frozen)
+		return directionFromBin(Random::instance().randBin(alias));
+
+	bool d;
+#pragma omp atomic read
+	d = dirty;
+	if (d)
 		updateCdf();
 
 	size_t bin = Random::instance().randBin(cdf);
@@ -43,6 +57,31 @@ bool CylindricalProjectionMap::checkDirection(const Vector3d &direction) const {
 }
 
 
+void CylindricalProjectionMap::freeze() {
+	updateCdf();
+	if (cdf.back() <= 0)
+		throw std::runtime_error("CylindricalProjectionMap: cannot freeze an empty map");
+	alias = AliasTable(cdf);
+	frozen = true;
+}
+
+bool CylindricalProjectionMap::isFrozen() const {
+	return frozen;
+}
+
+double CylindricalProjectionMap::getTotal() const {
+	updateCdf();
+	return cdf.back();
+}
+
+double CylindricalProjectionMap::getIsotropicWeight(const Vector3d &direction) const {
+	// all bins cover the same solid angle
+	double p = pdf[binFromDirection(direction)];
+	if (p <= 0)
+		return 0;
+	return getTotal() / (pdf.size() * p);
+}
+
 const std::vector<double>& CylindricalProjectionMap::getPdf() const {
 	return pdf;
 }
@@ -78,8 +117,8 @@ size_t CylindricalProjectionMap::binFromDirection(const Vector3d& direction) con
 	double theta = sin(M_PI_2 - direction.getTheta()) + 1;
 
 	// to indices
-	size_t iPhi = phi / sPhi;
-	size_t iTheta = theta / sTheta;
+	size_t iPhi = std::min(size_t(phi / sPhi), nPhi - 1);
+	size_t iTheta = std::min(size_t(theta / sTheta), nTheta - 1);
 
 	// interleave
 	size_t bin =  iTheta * nPhi + iPhi;
@@ -109,15 +148,46 @@ Vector3d CylindricalProjectionMap::directionFromBin(size_t bin) const {
 }
 
 void CylindricalProjectionMap::updateCdf() const {
+	// one thread rebuilds the cdf, the others wait for it
+#pragma omp critical(CylindricalProjectionMap)
 	if (dirty) {
 		cdf[0] = pdf[0];
 		for (size_t i = 1; i < pdf.size(); i++) {
 			cdf[i] = cdf[i-1] + pdf[i];
 		}
+#pragma omp atomic write
 		dirty = false;
 	}
 }
 
+namespace {
+// maps found by getMap, per thread
+struct LookupSlot {
+	uint64_t owner; // id of the EmissionMap, 0 for none
+	int pid;
+	size_t bin;
+	CylindricalProjectionMap *map;
+};
+const size_t nLookupSlots = 64;
+thread_local LookupSlot lookupSlots[nLookupSlots];
+std::atomic<uint64_t> lastLookupId(0);
+}
+
+EmissionMap::LookupId::LookupId() : id(++lastLookupId) {
+}
+
+EmissionMap::LookupId::LookupId(const LookupId &) : id(++lastLookupId) {
+}
+
+EmissionMap::LookupId &EmissionMap::LookupId::operator=(const LookupId &) {
+	renew();
+	return *this;
+}
+
+void EmissionMap::LookupId::renew() {
+	id = ++lastLookupId;
+}
+
 EmissionMap::EmissionMap() : minEnergy(0.0001 * EeV), maxEnergy(10000 * EeV),
 	nEnergy(8*2), nPhi(360), nTheta(180) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
@@ -149,6 +219,8 @@ void EmissionMap::fillMap(const ParticleState& state, double weight) {
 }
 
 EmissionMap::map_t &EmissionMap::getMaps() {
+	// the maps may be changed by the caller
+	lookupId.renew();
 	return maps;
 }
 
@@ -157,15 +229,11 @@ const EmissionMap::map_t &EmissionMap::getMaps() const {
 }
 
 bool EmissionMap::drawDirection(int pid, double energy, Vector3d& direction) const {
-	key_t key(pid, binFromEnergy(energy));
-	map_t::const_iterator i = maps.find(key);
-
-	if (i == maps.end() || !i->second.valid()) {
+	ref_ptr<CylindricalProjectionMap> cpm = findMap(pid, energy);
+	if (!cpm.valid())
 		return false;
-	} else {
-		direction = i->second->drawDirection();
-		return true;
-	}
+	direction = cpm->drawDirection();
+	return true;
 }
 
 bool EmissionMap::drawDirection(const ParticleState& state, Vector3d& direction) const {
@@ -196,16 +264,61 @@ bool EmissionMap::hasMap(int pid, double energy) {
 		return true;
 }
 
+ref_ptr<CylindricalProjectionMap> EmissionMap::findMap(int pid, double energy) const {
+	key_t key(pid, binFromEnergy(energy));
+	map_t::const_iterator i = maps.find(key);
+	if (i == maps.end())
+		return ref_ptr<CylindricalProjectionMap>();
+	return i->second;
+}
+
+size_t EmissionMap::freeze() {
+	lookupId.renew();
+	size_t removed = 0;
+	map_t::iterator i = maps.begin();
+	while (i != maps.end()) {
+		if (!i->second.valid() || i->second->getTotal() <= 0) {
+			maps.erase(i++);
+			removed++;
+		} else {
+			if (!i->second->isFrozen())
+				i->second->freeze();
+			++i;
+		}
+	}
+	if (removed > 0) {
+		KISS_LOG_WARNING << "EmissionMap::freeze: removed " << removed << " empty maps\n";
+	}
+	if (maps.empty()) {
+		KISS_LOG_WARNING << "EmissionMap::freeze: no maps with entries\n";
+	}
+	return maps.size();
+}
+
 ref_ptr<CylindricalProjectionMap> EmissionMap::getMap(int pid, double energy) {
 	key_t key(pid, binFromEnergy(energy));
-	map_t::iterator i = maps.find(key);
-	if (i == maps.end() || !i->second.valid()) {
-		ref_ptr<CylindricalProjectionMap> cpm = new CylindricalProjectionMap(nPhi, nTheta);
-		maps[key] = cpm;
-		return cpm;
-	} else {
-		return i->second;
+	// maps found before by this thread are looked up without the lock
+	LookupSlot &slot = lookupSlots[(size_t(pid) * 31 + key.second) % nLookupSlots];
+	if ((slot.owner == lookupId.id) && (slot.pid == pid) && (slot.bin == key.second))
+		return slot.map;
+
+	ref_ptr<CylindricalProjectionMap> cpm;
+	// the maps are created on demand by any thread
+#pragma omp critical(EmissionMap)
+	{
+		map_t::iterator i = maps.find(key);
+		if (i == maps.end() || !i->second.valid()) {
+			cpm = new CylindricalProjectionMap(nPhi, nTheta);
+			maps[key] = cpm;
+		} else {
+			cpm = i->second;
+		}
 	}
+	slot.owner = lookupId.id;
+	slot.pid = pid;
+	slot.bin = key.second;
+	slot.map = cpm.get();
+	return cpm;
 }
 
 void EmissionMap::save(const std::string &filename) {
@@ -254,6 +367,7 @@ void EmissionMap::merge(const std::string &filename) {
 }
 
 void EmissionMap::load(const std::string &filename) {
+	lookupId.renew();
 	std::ifstream in(filename.c_str());
 	in.imbue(std::locale("C"));
 
@@ -0,0 +1,179 @@
+#include "crpropa/EventReweighting.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/BinaryOutput.h"
+
+#ifdef CRPROPA_HAVE_HDF5
+#include "crpropa/module/HDF5Reader.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+EventReweighting::EventReweighting(ref_ptr<Source> sampling, ref_ptr<Source> target) :
+		sampling(sampling), target(target), chunkSize(65536) {
+	if (!sampling || !target)
+		throw std::runtime_error("EventReweighting: a sampling and a target source are required");
+}
+
+void EventReweighting::setObserverPosition(const Vector3d &position) {
+	observer = position;
+}
+
+Vector3d EventReweighting::getObserverPosition() const {
+	return observer;
+}
+
+void EventReweighting::setRedshiftProperty(const std::string &name) {
+	redshiftProperty = name;
+}
+
+std::string EventReweighting::getRedshiftProperty() const {
+	return redshiftProperty;
+}
+
+void EventReweighting::setChunkSize(size_t rows) {
+	if (rows == 0)
+		throw std::runtime_error("EventReweighting: the chunk size must be positive");
+	chunkSize = rows;
+}
+
+size_t EventReweighting::getChunkSize() const {
+	return chunkSize;
+}
+
+double EventReweighting::getWeight(const ParticleState &source, double redshift) const {
+	double q = sampling->getDensity(source, redshift);
+	if (q == 0)
+		return 0;
+	return target->getDensity(source, redshift) / q;
+}
+
+double EventReweighting::getRedshift(const Vector3d &position) const {
+	return comovingDistance2Redshift((position - observer).getR());
+}
+
+double EventReweighting::getSourceRedshift(const Candidate *candidate) const {
+	if (redshiftProperty.empty())
+		return getRedshift(candidate->source.getPosition());
+	return candidate->getProperty(redshiftProperty).toDouble();
+}
+
+double EventReweighting::getWeight(const Candidate *candidate) const {
+	return getWeight(candidate->source, getSourceRedshift(candidate));
+}
+
+std::vector<double> EventReweighting::reweight(const ParticleCollector *collector) const {
+	long n = collector->size();
+	std::vector<double> weights(n);
+	bool ok = true;
+	std::string error;
+#pragma omp parallel for schedule(static)
+	for (long i = 0; i < n; i++) {
+		try {
+			weights[i] = getWeight((*collector)[i]);
+		} catch (std::exception &e) {
+#pragma omp critical(EventReweighting)
+			{
+				ok = false;
+				error = e.what();
+			}
+		}
+	}
+	if (!ok)
+		throw std::runtime_error(error);
+	return weights;
+}
+
+// weights of the records of a mapped BinaryOutput file
+static void reweightRecords(const EventReweighting &reweighting, const BinaryOutput::Record *records,
+		long n, double *weights, bool &ok, std::string &error) {
+#pragma omp parallel for schedule(static)
+	for (long i = 0; i < n; i++) {
+		const BinaryOutput::Record &r = records[i];
+		ParticleState source;
+		source.setId(r.id[1]);
+		source.setEnergy(r.energy[1]);
+		source.setPosition(Vector3d(r.position[1][0], r.position[1][1], r.position[1][2]));
+		source.setDirection(Vector3d(r.direction[1][0], r.direction[1][1], r.direction[1][2]));
+		try {
+			double z = comovingDistance2Redshift((source.getPosition() - reweighting.getObserverPosition()).getR());
+			weights[i] = reweighting.getWeight(source, z);
+		} catch (std::exception &e) {
+#pragma omp critical(EventReweighting)
+			{
+				ok = false;
+				error = e.what();
+			}
+		}
+	}
+}
+
+std::vector<double> EventReweighting::reweight(const std::string &filename) const {
+	std::vector<double> weights;
+	bool ok = true;
+	std::string error;
+	if (BinaryOutput::isBinaryFile(filename)) {
+		if (!redshiftProperty.empty())
+			throw std::runtime_error("EventReweighting: the files of BinaryOutput have no properties");
+		ref_ptr<MappedFile> file = new MappedFile(filename);
+		// header of magic string, record size and a reserved word
+		const size_t headerSize = 16;
+		uint32_t recordSize = 0;
+		if (file->size() >= headerSize)
+			memcpy(&recordSize, static_cast<const char *>(file->data()) + 8, sizeof(recordSize));
+		if (recordSize != sizeof(BinaryOutput::Record))
+			throw std::runtime_error("EventReweighting: incompatible record size in " + filename);
+		size_t n = (file->size() - headerSize) / sizeof(BinaryOutput::Record);
+		weights.resize(n);
+		if (n > 0)
+			reweightRecords(*this, reinterpret_cast<const BinaryOutput::Record *>(
+					static_cast<const char *>(file->data()) + headerSize), n, &weights[0], ok, error);
+#ifdef CRPROPA_HAVE_HDF5
+	} else if (HDF5Reader::isHDF5File(filename)) {
+		ref_ptr<HDF5Reader> reader = new HDF5Reader(filename);
+		size_t n = reader->size();
+		weights.resize(n);
+		for (size_t first = 0; (first < n) && ok; first += chunkSize) {
+			std::vector<ref_ptr<Candidate> > chunk = reader->readRows(first, std::min(chunkSize, n - first));
+			long m = chunk.size();
+#pragma omp parallel for schedule(static)
+			for (long i = 0; i < m; i++) {
+				try {
+					weights[first + i] = getWeight(chunk[i]);
+				} catch (std::exception &e) {
+#pragma omp critical(EventReweighting)
+					{
+						ok = false;
+						error = e.what();
+					}
+				}
+			}
+		}
+#endif
+	} else {
+		throw std::runtime_error("EventReweighting: unknown file format of " + filename);
+	}
+	if (!ok)
+		throw std::runtime_error(error);
+	return weights;
+}
+
+std::string EventReweighting::getDescription() const {
+	std::stringstream ss;
+	ss << "EventReweighting\n";
+	ss << "  sampling: " << sampling->getDescription() << "\n";
+	ss << "  target: " << target->getDescription() << "\n";
+	if (redshiftProperty.empty())
+		ss << "  redshift of the comoving distance to " << observer / Mpc << " Mpc";
+	else
+		ss << "  redshift of the property " << redshiftProperty;
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <limits>
+#include <stdexcept>
 #include <cmath>
 #include "kiss/logger.h"
 #include "crpropa/Geometry.h"
@@ -38,6 +40,14 @@ Vector3d Plane::normal(const Vector3d& point) const {
 Sphere::Sphere(const Vector3d& _center, double _radius) : center(_center), radius(_radius) {
 };
 
+Vector3d Sphere::getCenter() const {
+	return center;
+}
+
+double Sphere::getRadius() const {
+	return radius;
+}
+
 double Sphere::distance(const Vector3d &point) const {
 	Vector3d dR = point - center;
 	return dR.getR() - radius;
@@ -48,6 +58,12 @@ Vector3d Sphere::normal(const Vector3d& point) const {
 	return d.getUnitVector();
 }
 
+bool Sphere::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = center - Vector3d(radius);
+	upper = center + Vector3d(radius);
+	return true;
+}
+
 std::string Sphere::getDescription() const {
 	std::stringstream ss;
 	ss << "Sphere: " << std::endl
@@ -112,6 +128,12 @@ Vector3d ParaxialBox::normal(const Vector3d& point) const {
 	return n;
 }
 
+bool ParaxialBox::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = corner;
+	upper = corner + size;
+	return true;
+}
+
 std::string ParaxialBox::getDescription() const {
 	std::stringstream ss;
 	ss << "ParaxialBox: " << std::endl
@@ -121,4 +143,259 @@ std::string ParaxialBox::getDescription() const {
 };
 
 
+// SurfaceCollection -------------------------------------------------------
+namespace {
+const size_t surfacesPerLeaf = 4;
+
+// distance of a point to a box, 0 inside
+double boxDistance(const Vector3d &point, const Vector3d &lower, const Vector3d &upper) {
+	double d2 = 0;
+	for (int i = 0; i < 3; i++) {
+		double d = std::max(lower.data[i] - point.data[i], point.data[i] - upper.data[i]);
+		if (d > 0)
+			d2 += d * d;
+	}
+	return sqrt(d2);
+}
+
+bool boxInside(const Vector3d &point, const Vector3d &lower, const Vector3d &upper) {
+	for (int i = 0; i < 3; i++)
+		if (point.data[i] < lower.data[i] or point.data[i] > upper.data[i])
+			return false;
+	return true;
+}
+
+bool boxOverlap(const Vector3d &lower1, const Vector3d &upper1, const Vector3d &lower2, const Vector3d &upper2) {
+	for (int i = 0; i < 3; i++)
+		if (upper1.data[i] < lower2.data[i] or upper2.data[i] < lower1.data[i])
+			return false;
+	return true;
+}
+
+// same criterion as ObserverSurface::checkDetection
+bool crossed(const Surface *surface, const Vector3d &previous, const Vector3d &current) {
+	double currentDistance = surface->distance(current);
+	double previousDistance = surface->distance(previous);
+	return (currentDistance * previousDistance <= 0) and (previousDistance != 0);
+}
+
+struct CenterLess {
+	const std::vector<Vector3d> &lowers, &uppers;
+	int axis;
+	CenterLess(const std::vector<Vector3d> &lowers, const std::vector<Vector3d> &uppers, int axis) :
+		lowers(lowers), uppers(uppers), axis(axis) {
+	}
+	bool operator()(size_t a, size_t b) const {
+		return lowers[a].data[axis] + uppers[a].data[axis] < lowers[b].data[axis] + uppers[b].data[axis];
+	}
+};
+}
+
+SurfaceCollection::SurfaceCollection() : dirty(false) {
+}
+
+void SurfaceCollection::add(Surface *surface) {
+	surfaces.push_back(surface);
+	Vector3d lower, upper;
+	if (surface->getBounds(lower, upper)) {
+		lowers.push_back(lower);
+		uppers.push_back(upper);
+	} else {
+		lowers.push_back(Vector3d(-std::numeric_limits<double>::infinity()));
+		uppers.push_back(Vector3d(std::numeric_limits<double>::infinity()));
+		unbounded.push_back(surfaces.size() - 1);
+	}
+	dirty = true;
+}
+
+size_t SurfaceCollection::size() const {
+	return surfaces.size();
+}
+
+Surface *SurfaceCollection::get(size_t i) const {
+	return surfaces.at(i);
+}
+
+void SurfaceCollection::update() const {
+	bool d;
+#pragma omp atomic read
+	d = dirty;
+	if (!d)
+		return;
+
+	// one thread builds the tree, the others wait for it
+#pragma omp critical(SurfaceCollection)
+	if (dirty) {
+		order.clear();
+		nodes.clear();
+		for (size_t i = 0; i < surfaces.size(); i++)
+			if (!std::binary_search(unbounded.begin(), unbounded.end(), i))
+				order.push_back(i);
+		if (order.size() > 0)
+			buildNode(0, order.size());
+#pragma omp atomic write
+		dirty = false;
+	}
+}
+
+size_t SurfaceCollection::buildNode(size_t first, size_t count) const {
+	Node node;
+	node.lower = lowers[order[first]];
+	node.upper = uppers[order[first]];
+	Vector3d centerLower = (lowers[order[first]] + uppers[order[first]]) / 2.;
+	Vector3d centerUpper = centerLower;
+	for (size_t i = first + 1; i < first + count; i++) {
+		size_t j = order[i];
+		Vector3d center = (lowers[j] + uppers[j]) / 2.;
+		for (int k = 0; k < 3; k++) {
+			node.lower.data[k] = std::min(node.lower.data[k], lowers[j].data[k]);
+			node.upper.data[k] = std::max(node.upper.data[k], uppers[j].data[k]);
+			centerLower.data[k] = std::min(centerLower.data[k], center.data[k]);
+			centerUpper.data[k] = std::max(centerUpper.data[k], center.data[k]);
+		}
+	}
+	node.first = first;
+	node.count = count;
+	node.left = node.right = 0;
+	size_t index = nodes.size();
+	nodes.push_back(node);
+	if (count <= surfacesPerLeaf)
+		return index;
+
+	// split at the median center along the widest extent of the centers
+	Vector3d extent = centerUpper - centerLower;
+	int axis = 0;
+	if (extent.y > extent.data[axis])
+		axis = 1;
+	if (extent.z > extent.data[axis])
+		axis = 2;
+	size_t half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half,
+			order.begin() + first + count, CenterLess(lowers, uppers, axis));
+	size_t left = buildNode(first, half);
+	size_t right = buildNode(first + half, count - half);
+	nodes[index].count = 0;
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+size_t SurfaceCollection::nearest(const Vector3d &point, bool absolute, double &distance) const {
+	size_t best = surfaces.size();
+	distance = std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		double d = surfaces[unbounded[i]]->distance(point);
+		if (absolute)
+			d = fabs(d);
+		if (d < distance) {
+			distance = d;
+			best = unbounded[i];
+		}
+	}
+	update();
+	if (nodes.empty())
+		return best;
+
+	// the distance to a bounded surface is at least the distance to its box,
+	// inside a box the signed distance has no lower bound
+	std::vector<size_t> stack(1, 0);
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+		double bound = boxDistance(point, node.lower, node.upper);
+		if (!absolute and boxInside(point, node.lower, node.upper))
+			bound = -std::numeric_limits<double>::infinity();
+		if (bound >= distance)
+			continue;
+		if (node.count == 0) {
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+			continue;
+		}
+		for (size_t i = node.first; i < node.first + node.count; i++) {
+			double d = surfaces[order[i]]->distance(point);
+			if (absolute)
+				d = fabs(d);
+			if (d < distance) {
+				distance = d;
+				best = order[i];
+			}
+		}
+	}
+	return best;
+}
+
+size_t SurfaceCollection::nearestSurface(const Vector3d &point, double &distance) const {
+	return nearest(point, true, distance);
+}
+
+double SurfaceCollection::nearestDistance(const Vector3d &point) const {
+	double d;
+	nearest(point, true, d);
+	return d;
+}
+
+std::vector<size_t> SurfaceCollection::crossedSurfaces(const Vector3d &previous, const Vector3d &current) const {
+	std::vector<size_t> result;
+	for (size_t i = 0; i < unbounded.size(); i++)
+		if (crossed(surfaces[unbounded[i]], previous, current))
+			result.push_back(unbounded[i]);
+	update();
+	if (nodes.empty())
+		return result;
+
+	// a crossed surface intersects the box of the step
+	Vector3d lower(std::min(previous.x, current.x), std::min(previous.y, current.y), std::min(previous.z, current.z));
+	Vector3d upper(std::max(previous.x, current.x), std::max(previous.y, current.y), std::max(previous.z, current.z));
+	std::vector<size_t> stack(1, 0);
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!boxOverlap(lower, upper, node.lower, node.upper))
+			continue;
+		if (node.count == 0) {
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+			continue;
+		}
+		for (size_t i = node.first; i < node.first + node.count; i++) {
+			size_t j = order[i];
+			if (boxOverlap(lower, upper, lowers[j], uppers[j]) and crossed(surfaces[j], previous, current))
+				result.push_back(j);
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+double SurfaceCollection::distance(const Vector3d &point) const {
+	double d;
+	nearest(point, false, d);
+	return d;
+}
+
+Vector3d SurfaceCollection::normal(const Vector3d& point) const {
+	double d;
+	size_t i = nearest(point, false, d);
+	if (i == surfaces.size())
+		throw std::runtime_error("SurfaceCollection: no surfaces");
+	return surfaces[i]->normal(point);
+}
+
+bool SurfaceCollection::getBounds(Vector3d &lower, Vector3d &upper) const {
+	update();
+	if (!unbounded.empty() or nodes.empty())
+		return false;
+	lower = nodes[0].lower;
+	upper = nodes[0].upper;
+	return true;
+}
+
+std::string SurfaceCollection::getDescription() const {
+	std::stringstream ss;
+	ss << "SurfaceCollection: " << surfaces.size() << " surfaces, "
+	   << unbounded.size() << " unbounded" << std::endl;
+	return ss.str();
+};
+
 } // namespace
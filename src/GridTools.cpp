@@ -1,9 +1,28 @@
 #include "crpropa/GridTools.h"
 #include "crpropa/magneticField/MagneticField.h"
 
+#include <cstring>
 #include <fstream>
 #include <sstream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+#include <hdf5.h>
+#ifdef CRPROPA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 void scaleGrid(ref_ptr<Grid1f> grid, double a) {
@@ -20,85 +39,113 @@ void scaleGrid(ref_ptr<Grid3f> grid, double a) {
 				grid->get(ix, iy, iz) *= a;
 }
 
-Vector3f meanFieldVector(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
+/** Sums over the grid points of a vector grid */
+struct VectorSums {
+	Vector3d sum;
+	Vector3d sumSquares;
+	double sumStrength;
+	double sumStrength2;
+	double maxStrength;
+
+	VectorSums() : sum(0.), sumSquares(0.), sumStrength(0), sumStrength2(0), maxStrength(0) {
+	}
+
+	void add(const Vector3f &v) {
+		Vector3d b(v);
+		double b2 = b.getR2();
+		sum += b;
+		sumSquares += b * b;
+		sumStrength += std::sqrt(b2);
+		sumStrength2 += b2;
+		maxStrength = std::max(maxStrength, std::sqrt(b2));
+	}
+
+	void add(const VectorSums &s) {
+		sum += s.sum;
+		sumSquares += s.sumSquares;
+		sumStrength += s.sumStrength;
+		sumStrength2 += s.sumStrength2;
+		maxStrength = std::max(maxStrength, s.maxStrength);
+	}
+};
+
+/** Sums over the grid points of a scalar grid */
+struct ScalarSums {
+	double sum;
+	double sum2;
+
+	ScalarSums() : sum(0), sum2(0) {
+	}
+
+	void add(float v) {
+		sum += v;
+		sum2 += double(v) * v;
+	}
+
+	void add(const ScalarSums &s) {
+		sum += s.sum;
+		sum2 += s.sum2;
+	}
+};
+
+/** Sum over all grid points in a single pass. Every x-slab is summed by one
+ thread and the slabs are added in order, so the result does not depend on
+ the number of threads. */
+template<typename S, typename T>
+static S sumGrid(ref_ptr<Grid<T> > grid) {
+	int Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	Vector3f mean(0.);
+	std::vector<S> slabs(Nx);
+	#pragma omp parallel for schedule(static)
 	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz);
-	return mean / Nx / Ny / Nz;
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				slabs[ix].add(grid->get(ix, iy, iz));
+	S total;
+	for (int ix = 0; ix < Nx; ix++)
+		total.add(slabs[ix]);
+	return total;
+}
+
+GridStatistics gridStatistics(ref_ptr<Grid3f> grid) {
+	VectorSums s = sumGrid<VectorSums>(grid);
+	double n = double(grid->getNx()) * grid->getNy() * grid->getNz();
+	GridStatistics stats;
+	stats.meanFieldVector = s.sum / n;
+	stats.meanFieldStrength = s.sumStrength / n;
+	stats.rmsFieldStrength = std::sqrt(s.sumStrength2 / n);
+	stats.rmsFieldStrengthPerAxis = Vector3d(std::sqrt(s.sumSquares.x / n),
+			std::sqrt(s.sumSquares.y / n), std::sqrt(s.sumSquares.z / n));
+	stats.maxFieldStrength = s.maxStrength;
+	return stats;
+}
+
+Vector3f meanFieldVector(ref_ptr<Grid3f> grid) {
+	return gridStatistics(grid).meanFieldVector;
 }
 
 double meanFieldStrength(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double mean = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz).getR();
-	return mean / Nx / Ny / Nz;
+	return gridStatistics(grid).meanFieldStrength;
 }
 
 double meanFieldStrength(ref_ptr<Grid1f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double mean = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz);
-	return mean / Nx / Ny / Nz;
+	ScalarSums s = sumGrid<ScalarSums>(grid);
+	return s.sum / grid->getNx() / grid->getNy() / grid->getNz();
 }
 
 double rmsFieldStrength(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double sumV2 = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				sumV2 += grid->get(ix, iy, iz).getR2();
-	return std::sqrt(sumV2 / Nx / Ny / Nz);
+	return gridStatistics(grid).rmsFieldStrength;
 }
 
 double rmsFieldStrength(ref_ptr<Grid1f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double sumV2 = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				sumV2 += pow(grid->get(ix, iy, iz), 2);
-	return std::sqrt(sumV2 / Nx / Ny / Nz);
+	ScalarSums s = sumGrid<ScalarSums>(grid);
+	return std::sqrt(s.sum2 / grid->getNx() / grid->getNy() / grid->getNz());
 }
 
 std::array<float, 3> rmsFieldStrengthPerAxis(ref_ptr<Grid3f> grid) {
-    size_t Nx = grid->getNx();
-    size_t Ny = grid->getNy();
-    size_t Nz = grid->getNz();
-    float sumV2_x = 0;
-    float sumV2_y = 0;
-    float sumV2_z = 0;
-    for (int ix = 0; ix < Nx; ix++)
-        for (int iy = 0; iy < Ny; iy++)
-            for (int iz = 0; iz < Nz; iz++) {
-                sumV2_x += pow(grid->get(ix, iy, iz).x, 2);
-                sumV2_y += pow(grid->get(ix, iy, iz).y, 2);
-                sumV2_z += pow(grid->get(ix, iy, iz).z, 2);
-            }
-    return {
-        std::sqrt(sumV2_x / Nx / Ny / Nz),
-        std::sqrt(sumV2_y / Nx / Ny / Nz),
-        std::sqrt(sumV2_z / Nx / Ny / Nz)
-    };
+	Vector3d rms = gridStatistics(grid).rmsFieldStrengthPerAxis;
+	return {float(rms.x), float(rms.y), float(rms.z)};
 }
 
 void fromMagneticField(ref_ptr<Grid3f> grid, ref_ptr<MagneticField> field) {
@@ -131,6 +178,48 @@ void fromMagneticFieldStrength(ref_ptr<Grid1f> grid, ref_ptr<MagneticField> fiel
 	}
 }
 
+void fromAdvectionField(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence, ref_ptr<AdvectionField> field) {
+	Vector3d origin = grid->getOrigin();
+	Vector3d spacing = grid->getSpacing();
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	if ((divergence->getNx() != Nx) || (divergence->getNy() != Ny) || (divergence->getNz() != Nz))
+		throw std::runtime_error("fromAdvectionField: grids differ in size");
+	for (size_t ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++) {
+				Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+				grid->get(ix, iy, iz) = field->getField(pos);
+				divergence->get(ix, iy, iz) = field->getDivergence(pos);
+	}
+}
+
+ref_ptr<Grid3h> toHalfPrecision(ref_ptr<Grid3f> grid) {
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	ref_ptr<Grid3h> half = new Grid3h(grid->getOrigin(), Nx, Ny, Nz, grid->getSpacing());
+	half->setReflective(grid->isReflective());
+	half->setClipVolume(grid->getClipVolume());
+	half->setInterpolationType(grid->getInterpolationType());
+	half->setLayout(grid->getLayout());
+
+	float maxComponent = 0;
+	for (size_t ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				maxComponent = std::max(maxComponent, grid->get(ix, iy, iz).abs().max());
+
+	// the largest component is stored as 2^15, below the half precision maximum of 65504
+	half->setStorageScale((maxComponent > 0) ? maxComponent / 32768 : 1);
+	for (size_t ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				half->setValue(ix, iy, iz, grid->get(ix, iy, iz));
+	return half;
+}
+
 void loadGrid(ref_ptr<Grid3f> grid, std::string filename, double c) {
 	std::ifstream fin(filename.c_str(), std::ios::binary);
 	if (!fin) {
@@ -197,6 +286,136 @@ void loadGrid(ref_ptr<Grid1f> grid, std::string filename, double c) {
 	fin.close();
 }
 
+void mapGrid(ref_ptr<Grid3f> grid, std::string filename) {
+	static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Vector3f must consist of three packed floats");
+	grid->map(new MappedFile(filename));
+}
+
+void mapGrid(ref_ptr<Grid1f> grid, std::string filename) {
+	grid->map(new MappedFile(filename));
+}
+
+// header of a grid in shared memory, the values follow at offset
+struct SharedGridHeader {
+	char magic[8];
+	uint32_t valueSize;
+	uint32_t complete; ///< set after the values are written
+	uint64_t offset;
+	uint64_t N[3];
+	double origin[3];
+	double spacing[3];
+	int32_t reflective, clipVolume, interpolation, padding;
+};
+
+static const char sharedGridMagic[8] = {'C', 'R', 'P', 'G', 'R', 'I', 'D', 'S'};
+
+template<typename T>
+static void publishSharedGrid(const Grid<T> &grid, const std::string &name) {
+#ifndef _WIN32
+	size_t page = sysconf(_SC_PAGESIZE);
+	SharedGridHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, sharedGridMagic, sizeof(sharedGridMagic));
+	header.valueSize = sizeof(T);
+	header.offset = (sizeof(header) + page - 1) / page * page;
+	header.N[0] = grid.getNx();
+	header.N[1] = grid.getNy();
+	header.N[2] = grid.getNz();
+	Vector3d origin = grid.getOrigin(), spacing = grid.getSpacing();
+	header.origin[0] = origin.x;
+	header.origin[1] = origin.y;
+	header.origin[2] = origin.z;
+	header.spacing[0] = spacing.x;
+	header.spacing[1] = spacing.y;
+	header.spacing[2] = spacing.z;
+	header.reflective = grid.isReflective();
+	header.clipVolume = grid.getClipVolume();
+	header.interpolation = grid.getInterpolationType();
+	size_t n = header.N[0] * header.N[1] * header.N[2];
+	size_t length = header.offset + n * sizeof(T);
+
+	// a new object, processes mapping a previous one keep it
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		throw std::runtime_error("publishGrid: could not create shared memory " + name);
+	if (ftruncate(fd, length) != 0) {
+		::close(fd);
+		shm_unlink(name.c_str());
+		throw std::runtime_error("publishGrid: could not allocate shared memory " + name);
+	}
+	void *address = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (address == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		throw std::runtime_error("publishGrid: could not map shared memory " + name);
+	}
+	char *begin = static_cast<char *>(address);
+	T *values = reinterpret_cast<T *>(begin + header.offset);
+	size_t Ny = header.N[1], Nz = header.N[2];
+	for (size_t ix = 0; ix < header.N[0]; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				values[(ix * Ny + iy) * Nz + iz] = grid.get(ix, iy, iz);
+	memcpy(begin, &header, sizeof(header));
+	__atomic_store_n(&reinterpret_cast<SharedGridHeader *>(begin)->complete, 1, __ATOMIC_RELEASE);
+	munmap(address, length);
+#else
+	throw std::runtime_error("publishGrid: shared memory is not supported on this system");
+#endif
+}
+
+template<typename T>
+static ref_ptr<Grid<T> > mapSharedGrid(const std::string &name) {
+#ifndef _WIN32
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		throw std::runtime_error("mapSharedGrid: could not open shared memory " + name);
+	SharedGridHeader header;
+	ssize_t n = pread(fd, &header, sizeof(header), 0);
+	::close(fd);
+	if ((n != (ssize_t) sizeof(header)) || (memcmp(header.magic, sharedGridMagic, sizeof(sharedGridMagic)) != 0))
+		throw std::runtime_error("mapSharedGrid: no grid in shared memory " + name);
+	if (header.valueSize != sizeof(T))
+		throw std::runtime_error("mapSharedGrid: the grid in shared memory " + name + " has another value type");
+	if (!header.complete)
+		throw std::runtime_error("mapSharedGrid: the grid in shared memory " + name + " is incomplete");
+
+	GridProperties properties(Vector3d(header.origin[0], header.origin[1], header.origin[2]),
+			header.N[0], header.N[1], header.N[2],
+			Vector3d(header.spacing[0], header.spacing[1], header.spacing[2]));
+	properties.setReflective(header.reflective != 0);
+	properties.setClipVolume(header.clipVolume != 0);
+	properties.setInterpolationType((interpolationType) header.interpolation);
+	return new Grid<T>(properties, MappedFile::openShared(name, header.offset));
+#else
+	throw std::runtime_error("mapSharedGrid: shared memory is not supported on this system");
+#endif
+}
+
+void publishGrid(ref_ptr<Grid3f> grid, const std::string &name) {
+	publishSharedGrid(*grid, name);
+}
+
+void publishGrid(ref_ptr<Grid1f> grid, const std::string &name) {
+	publishSharedGrid(*grid, name);
+}
+
+ref_ptr<Grid3f> mapSharedGrid3f(const std::string &name) {
+	static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Vector3f must consist of three packed floats");
+	return mapSharedGrid<Vector3f>(name);
+}
+
+ref_ptr<Grid1f> mapSharedGrid1f(const std::string &name) {
+	return mapSharedGrid<float>(name);
+}
+
+void unlinkSharedGrid(const std::string &name) {
+#ifndef _WIN32
+	shm_unlink(name.c_str());
+#endif
+}
+
 void dumpGrid(ref_ptr<Grid3f> grid, std::string filename, double c) {
 	std::ofstream fout(filename.c_str(), std::ios::binary);
 	if (!fout) {
@@ -321,6 +540,349 @@ void dumpGridToTxt(ref_ptr<Grid1f> grid, std::string filename, double c) {
 	fout.close();
 }
 
+#ifdef CRPROPA_HAVE_HDF5
+
+static float *gridComponents(float &v) {
+	return &v;
+}
+
+static float *gridComponents(Vector3f &v) {
+	return v.data;
+}
+
+static size_t gridComponentCount(float) {
+	return 1;
+}
+
+static size_t gridComponentCount(const Vector3f &) {
+	return 3;
+}
+
+static void writeGridAttribute(hid_t dset, const char *name, hid_t type, hsize_t n, const void *value) {
+	hid_t space = (n == 1) ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, &n, NULL);
+	hid_t attr = H5Acreate2(dset, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(attr, type, value);
+	H5Aclose(attr);
+	H5Sclose(space);
+}
+
+static void readGridAttribute(hid_t dset, const char *name, hid_t type, void *value, const std::string &filename) {
+	if (H5Aexists(dset, name) <= 0)
+		throw std::runtime_error("loadGridFromHDF5: attribute " + std::string(name) + " missing in " + filename);
+	hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+	H5Aread(attr, type, value);
+	H5Aclose(attr);
+}
+
+template<typename T>
+static void dumpGridHDF5(ref_ptr<Grid<T> > grid, const std::string &filename, double c, int compression) {
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	size_t nc = gridComponentCount(T());
+	int rank = (nc == 1) ? 3 : 4;
+	size_t slice = Ny * Nz * nc;
+	// chunks of whole x-slices with about 4 MB
+	size_t cx = std::max(size_t(1), std::min(Nx, size_t(1 << 20) / slice));
+	hsize_t dims[4] = {Nx, Ny, Nz, nc};
+	hsize_t chunk[4] = {cx, Ny, Nz, nc};
+
+	hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("dumpGridToHDF5: cannot create file " + filename);
+	hid_t space = H5Screate_simple(rank, dims, NULL);
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(plist, rank, chunk);
+	if (compression > 0) {
+		H5Pset_shuffle(plist);
+		H5Pset_deflate(plist, std::min(compression, 9));
+	}
+	hid_t dset = H5Dcreate2(file, "grid", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+
+	Vector3d origin = grid->getOrigin();
+	Vector3d spacing = grid->getSpacing();
+	int reflective = grid->isReflective();
+	int clipVolume = grid->getClipVolume();
+	int ipol = grid->getInterpolationType();
+	writeGridAttribute(dset, "origin", H5T_NATIVE_DOUBLE, 3, origin.data);
+	writeGridAttribute(dset, "spacing", H5T_NATIVE_DOUBLE, 3, spacing.data);
+	writeGridAttribute(dset, "reflective", H5T_NATIVE_INT, 1, &reflective);
+	writeGridAttribute(dset, "clipVolume", H5T_NATIVE_INT, 1, &clipVolume);
+	writeGridAttribute(dset, "interpolationType", H5T_NATIVE_INT, 1, &ipol);
+
+	std::vector<float> buffer(cx * slice);
+	for (size_t x0 = 0; x0 < Nx; x0 += cx) {
+		int nx = std::min(cx, Nx - x0);
+		#pragma omp parallel for schedule(static)
+		for (int ix = 0; ix < nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++) {
+					float *v = gridComponents(grid->get(x0 + ix, iy, iz));
+					float *b = &buffer[((ix * Ny + iy) * Nz + iz) * nc];
+					for (size_t i = 0; i < nc; i++)
+						b[i] = v[i] / c;
+				}
+		hsize_t start[4] = {x0, 0, 0, 0};
+		hsize_t count[4] = {hsize_t(nx), Ny, Nz, nc};
+		hid_t memspace = H5Screate_simple(rank, count, NULL);
+		H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+		H5Dwrite(dset, H5T_NATIVE_FLOAT, memspace, space, H5P_DEFAULT, buffer.data());
+		H5Sclose(memspace);
+	}
+
+	H5Dclose(dset);
+	H5Pclose(plist);
+	H5Sclose(space);
+	H5Fclose(file);
+}
+
+void dumpGridToHDF5(ref_ptr<Grid3f> grid, std::string filename, double c, int compression) {
+	dumpGridHDF5(grid, filename, c, compression);
+}
+
+void dumpGridToHDF5(ref_ptr<Grid1f> grid, std::string filename, double c, int compression) {
+	dumpGridHDF5(grid, filename, c, compression);
+}
+
+/** Open the grid dataset of a file and read the grid properties */
+static hid_t openGridHDF5(const std::string &filename, hid_t &file, GridProperties &p, size_t &nc) {
+	if (H5Fis_hdf5(filename.c_str()) <= 0)
+		throw std::runtime_error("loadGridFromHDF5: " + filename + " is not an HDF5 file");
+	file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("loadGridFromHDF5: cannot open file " + filename);
+	if (H5Lexists(file, "grid", H5P_DEFAULT) <= 0) {
+		H5Fclose(file);
+		throw std::runtime_error("loadGridFromHDF5: no dataset grid in " + filename);
+	}
+	hid_t dset = H5Dopen2(file, "grid", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	int rank = H5Sget_simple_extent_ndims(space);
+	hsize_t dims[4] = {0, 0, 0, 1};
+	if ((rank == 3) || (rank == 4))
+		H5Sget_simple_extent_dims(space, dims, NULL);
+	H5Sclose(space);
+	if ((rank != 3) && (rank != 4)) {
+		H5Dclose(dset);
+		H5Fclose(file);
+		throw std::runtime_error("loadGridFromHDF5: unexpected shape of the grid in " + filename);
+	}
+	nc = dims[3];
+
+	try {
+		readGridAttribute(dset, "origin", H5T_NATIVE_DOUBLE, p.origin.data, filename);
+		readGridAttribute(dset, "spacing", H5T_NATIVE_DOUBLE, p.spacing.data, filename);
+		int flag;
+		readGridAttribute(dset, "reflective", H5T_NATIVE_INT, &flag, filename);
+		p.reflective = flag;
+		readGridAttribute(dset, "clipVolume", H5T_NATIVE_INT, &flag, filename);
+		p.clipVolume = flag;
+		readGridAttribute(dset, "interpolationType", H5T_NATIVE_INT, &flag, filename);
+		p.ipol = interpolationType(flag);
+	} catch (...) {
+		H5Dclose(dset);
+		H5Fclose(file);
+		throw;
+	}
+	p.Nx = dims[0];
+	p.Ny = dims[1];
+	p.Nz = dims[2];
+	return dset;
+}
+
+GridProperties loadGridPropertiesFromHDF5(std::string filename) {
+	GridProperties p(Vector3d(0.), 1, 1.);
+	hid_t file;
+	size_t nc;
+	hid_t dset = openGridHDF5(filename, file, p, nc);
+	H5Dclose(dset);
+	H5Fclose(file);
+	return p;
+}
+
+#if defined(CRPROPA_HAVE_ZLIB) && H5_VERSION_GE(1, 10, 2)
+/** Check if the chunks consist of whole x-slices and are only shuffled and
+ deflated, so that they can be decompressed without the HDF5 library */
+static bool canDecodeChunks(hid_t dset, size_t &cx, std::vector<H5Z_filter_t> &filters) {
+	hid_t plist = H5Dget_create_plist(dset);
+	bool ok = (H5Pget_layout(plist) == H5D_CHUNKED);
+	if (ok) {
+		hid_t space = H5Dget_space(dset);
+		int rank = H5Sget_simple_extent_ndims(space);
+		hsize_t dims[4], chunk[4];
+		H5Sget_simple_extent_dims(space, dims, NULL);
+		H5Sclose(space);
+		ok = (H5Pget_chunk(plist, rank, chunk) == rank);
+		for (int i = 1; i < rank; i++)
+			ok &= (chunk[i] == dims[i]);
+		cx = chunk[0];
+	}
+	int n = ok ? H5Pget_nfilters(plist) : 0;
+	filters.clear();
+	for (int i = 0; i < n; i++) {
+		unsigned int flags, config;
+		size_t nValues = 0;
+		H5Z_filter_t filter = H5Pget_filter2(plist, i, &flags, &nValues, NULL, 0, NULL, &config);
+		ok &= (filter == H5Z_FILTER_SHUFFLE) || (filter == H5Z_FILTER_DEFLATE);
+		filters.push_back(filter);
+	}
+	H5Pclose(plist);
+	return ok;
+}
+
+/** Undo the filters of a chunk, in reverse order, skipping those set in the filter mask */
+static void decodeChunk(std::vector<unsigned char> &chunk, uint32_t mask,
+		const std::vector<H5Z_filter_t> &filters, size_t size) {
+	std::vector<unsigned char> out;
+	for (int i = filters.size() - 1; i >= 0; i--) {
+		if (mask & (1u << i))
+			continue;
+		if (filters[i] == H5Z_FILTER_DEFLATE) {
+			out.resize(size);
+			uLongf length = size;
+			if (uncompress(&out[0], &length, &chunk[0], chunk.size()) != Z_OK)
+				throw std::runtime_error("loadGridFromHDF5: cannot decompress chunk");
+			out.resize(length);
+		} else {
+			// shuffle: the first bytes of all floats, then the second bytes, ...
+			size_t n = chunk.size() / sizeof(float);
+			out.resize(chunk.size());
+			for (size_t j = 0; j < n; j++)
+				for (size_t b = 0; b < sizeof(float); b++)
+					out[j * sizeof(float) + b] = chunk[b * n + j];
+			for (size_t j = n * sizeof(float); j < chunk.size(); j++)
+				out[j] = chunk[j];
+		}
+		chunk.swap(out);
+	}
+	if (chunk.size() != size)
+		throw std::runtime_error("loadGridFromHDF5: unexpected size of a chunk");
+}
+#endif
+
+template<typename T>
+static void loadGridHDF5(ref_ptr<Grid<T> > grid, const std::string &filename, double c) {
+	GridProperties p(Vector3d(0.), 1, 1.);
+	hid_t file;
+	size_t nc;
+	hid_t dset = openGridHDF5(filename, file, p, nc);
+	if (nc != gridComponentCount(T())) {
+		H5Dclose(dset);
+		H5Fclose(file);
+		throw std::runtime_error("loadGridFromHDF5: file and grid type do not match");
+	}
+
+	grid->setGridSize(p.Nx, p.Ny, p.Nz);
+	grid->setSpacing(p.spacing);
+	grid->setOrigin(p.origin);
+	grid->setReflective(p.reflective);
+	grid->setClipVolume(p.clipVolume);
+	grid->setInterpolationType(p.ipol);
+
+	size_t Nx = p.Nx, Ny = p.Ny, Nz = p.Nz;
+	size_t slice = Ny * Nz * nc;
+	bool error = false;
+
+#if defined(CRPROPA_HAVE_ZLIB) && H5_VERSION_GE(1, 10, 2)
+	size_t cx;
+	std::vector<H5Z_filter_t> filters;
+	if (canDecodeChunks(dset, cx, filters)) {
+		// read the raw chunks serially and decompress them in parallel
+		int nThreads = 1;
+#ifdef _OPENMP
+		nThreads = omp_get_max_threads();
+#endif
+		size_t nChunks = (Nx + cx - 1) / cx;
+		size_t batch = 2 * nThreads;
+		std::vector<std::vector<unsigned char> > chunks(batch);
+		std::vector<uint32_t> masks(batch);
+		for (size_t first = 0; (first < nChunks) && !error; first += batch) {
+			int n = std::min(batch, nChunks - first);
+			for (int i = 0; i < n; i++) {
+				hsize_t offset[4] = {(first + i) * cx, 0, 0, 0};
+				hsize_t size = 0;
+				H5Dget_chunk_storage_size(dset, offset, &size);
+				chunks[i].resize(size);
+				masks[i] = 0;
+				if ((size > 0) && (H5Dread_chunk(dset, H5P_DEFAULT, offset, &masks[i], &chunks[i][0]) < 0))
+					error = true;
+			}
+			#pragma omp parallel for schedule(dynamic)
+			for (int i = 0; i < n; i++) {
+				size_t x0 = (first + i) * cx;
+				size_t nx = std::min(cx, Nx - x0);
+				std::vector<unsigned char> &chunk = chunks[i];
+				if (chunk.empty()) {
+					// never written, filled with zeros
+					chunk.assign(cx * slice * sizeof(float), 0);
+				} else {
+					try {
+						decodeChunk(chunk, masks[i], filters, cx * slice * sizeof(float));
+					} catch (std::exception &e) {
+						#pragma omp critical(loadGridFromHDF5)
+						error = true;
+						continue;
+					}
+				}
+				const float *values = reinterpret_cast<const float *>(&chunk[0]);
+				for (size_t ix = 0; ix < nx; ix++)
+					for (size_t iy = 0; iy < Ny; iy++)
+						for (size_t iz = 0; iz < Nz; iz++) {
+							float *v = gridComponents(grid->get(x0 + ix, iy, iz));
+							const float *b = &values[((ix * Ny + iy) * Nz + iz) * nc];
+							for (size_t k = 0; k < nc; k++)
+								v[k] = b[k] * c;
+						}
+			}
+		}
+		H5Dclose(dset);
+		H5Fclose(file);
+		if (error)
+			throw std::runtime_error("loadGridFromHDF5: cannot read the chunks of " + filename);
+		return;
+	}
+#endif
+
+	// read the grid by x-slices through the HDF5 library
+	int rank = (nc == 1) ? 3 : 4;
+	size_t bx = std::max(size_t(1), std::min(Nx, size_t(1 << 20) / slice));
+	std::vector<float> buffer(bx * slice);
+	hid_t space = H5Dget_space(dset);
+	for (size_t x0 = 0; (x0 < Nx) && !error; x0 += bx) {
+		int nx = std::min(bx, Nx - x0);
+		hsize_t start[4] = {x0, 0, 0, 0};
+		hsize_t count[4] = {hsize_t(nx), Ny, Nz, nc};
+		hid_t memspace = H5Screate_simple(rank, count, NULL);
+		H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+		error = H5Dread(dset, H5T_NATIVE_FLOAT, memspace, space, H5P_DEFAULT, buffer.data()) < 0;
+		H5Sclose(memspace);
+		#pragma omp parallel for schedule(static)
+		for (int ix = 0; ix < nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++) {
+					float *v = gridComponents(grid->get(x0 + ix, iy, iz));
+					const float *b = &buffer[((ix * Ny + iy) * Nz + iz) * nc];
+					for (size_t k = 0; k < nc; k++)
+						v[k] = b[k] * c;
+				}
+	}
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	if (error)
+		throw std::runtime_error("loadGridFromHDF5: cannot read " + filename);
+}
+
+void loadGridFromHDF5(ref_ptr<Grid3f> grid, std::string filename, double c) {
+	loadGridHDF5(grid, filename, c);
+}
+
+void loadGridFromHDF5(ref_ptr<Grid1f> grid, std::string filename, double c) {
+	loadGridHDF5(grid, filename, c);
+}
+
+#endif // CRPROPA_HAVE_HDF5
+
 #ifdef CRPROPA_HAVE_FFTW3F
 
 std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
@@ -339,11 +901,11 @@ std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
   fftwf_complex *Bz = (fftwf_complex *)Bkz;
 
   // save to temp
-  int i;
-  for (size_t ix = 0; ix < n; ix++) {
+  #pragma omp parallel for schedule(static)
+  for (int ix = 0; ix < n; ix++) {
     for (size_t iy = 0; iy < n; iy++) {
       for (size_t iz = 0; iz < n; iz++) {
-        i = ix * n * n + iy * n + iz;
+        size_t i = ix * n * n + iy * n + iz;
         Vector3<float> &b = grid->get(ix, iy, iz);
         Bx[i][0] = b.x / rms;
         By[i][0] = b.y / rms;
@@ -369,41 +931,46 @@ std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
   fftwf_execute(plan_z);
   fftwf_destroy_plan(plan_z);
 
-  float power;
-  std::map<size_t, std::pair<float, int>> spectrum;
-  int k;
-
-  for (size_t ix = 0; ix < n; ix++) {
+  // bin the power in shells, every x-slab is binned by one thread and the
+  // slabs are added in order, so the result does not depend on the threads
+  size_t nBins = n / 2 + 1;
+  std::vector<double> slabPower(n * nBins, 0.);
+  std::vector<int> slabCount(n * nBins, 0);
+  #pragma omp parallel for schedule(static)
+  for (int ix = 0; ix < n; ix++) {
     for (size_t iy = 0; iy < n; iy++) {
       for (size_t iz = 0; iz < n; iz++) {
-        i = ix * n * n + iy * n + iz;
-        k = static_cast<int>(
+        size_t i = ix * n * n + iy * n + iz;
+        int k = static_cast<int>(
             std::floor(std::sqrt(ix * ix + iy * iy + iz * iz)));
         if (k > n / 2. || k == 0)
           continue;
-        power = ((Bkx[i][0] * Bkx[i][0] + Bkx[i][1] * Bkx[i][1]) +
-                 (Bky[i][0] * Bky[i][0] + Bky[i][1] * Bky[i][1]) +
-                 (Bkz[i][0] * Bkz[i][0] + Bkz[i][1] * Bkz[i][1]));
-        if (spectrum.find(k) == spectrum.end()) {
-          spectrum[k].first = power;
-          spectrum[k].second = 1;
-        } else {
-          spectrum[k].first += power;
-          spectrum[k].second += 1;
-        }
+        float power = ((Bkx[i][0] * Bkx[i][0] + Bkx[i][1] * Bkx[i][1]) +
+                       (Bky[i][0] * Bky[i][0] + Bky[i][1] * Bky[i][1]) +
+                       (Bkz[i][0] * Bkz[i][0] + Bkz[i][1] * Bkz[i][1]));
+        slabPower[ix * nBins + k] += power;
+        slabCount[ix * nBins + k] += 1;
       }
     }
   }
 
+  std::vector<double> power(nBins, 0.);
+  std::vector<int> count(nBins, 0);
+  for (size_t ix = 0; ix < n; ix++) {
+    for (size_t k = 0; k < nBins; k++) {
+      power[k] += slabPower[ix * nBins + k];
+      count[k] += slabCount[ix * nBins + k];
+    }
+  }
+
   fftwf_free(Bkx);
   fftwf_free(Bky);
   fftwf_free(Bkz);
 
   std::vector<std::pair<int, float>> points;
-  for (std::map<size_t, std::pair<float, int>>::iterator it = spectrum.begin();
-       it != spectrum.end(); ++it) {
-    points.push_back(
-        std::make_pair(it->first, (it->second).first / (it->second).second));
+  for (size_t k = 0; k < nBins; k++) {
+    if (count[k] > 0)
+      points.push_back(std::make_pair(int(k), float(power[k] / count[k])));
   }
 
   return points;
@@ -0,0 +1,363 @@
+#include "crpropa/InteractionTables.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/PhotoPionProduction.h"
+
+#include "kiss/logger.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+std::string InteractionTables::cacheDirectory;
+bool InteractionTables::generationEnabled = false;
+
+static const double me2 = pow_integer<2>(mass_electron * c_squared);
+
+// tabulation of the generated files, as in CRPropa3-data
+static const double logEnergyMin = 6, logEnergyMax = 23; // log10(E/eV)
+static const double logRateStep = 0.05, logCdfStep = 0.1;
+static const double logLorentzMin = 6, logLorentzMax = 16, logLorentzStep = 0.05;
+// integration grid in s - m^2 [eV^2], the cdf columns are every 4th point
+static const double logSkinMin = -4, logSkinMax = 30;
+static const int sPerDecade = 40;
+static const int sPerCdfColumn = 4;
+
+// total cross sections [m^2] for the center of mass energy squared s [J^2]
+// (cf. CRPropa3-data/calc_electromagnetic.py)
+static double sigmaPP(double s) {
+	if (s <= 4 * me2)
+		return 0;
+	double b = std::sqrt(1 - 4 * me2 / s);
+	// ln((1 + b) / (1 - b)) with 1 - b^2 = 4 m^2 / s, stable for b -> 1
+	double L = 2 * std::log1p(b) + std::log(s / (4 * me2));
+	return 3. / 16 * sigma_thomson * (4 * me2 / s) * ((3 - pow_integer<4>(b)) * L - 2 * b * (2 - b * b));
+}
+
+static double sigmaDPP(double s) {
+	if (s <= 16 * me2)
+		return 0;
+	return 6.45e-34 * pow_integer<6>(1 - 16 * me2 / s);
+}
+
+static double sigmaTPP(double s) {
+	double beta = 28. / 9 * std::log(s / me2) - 218. / 27;
+	if (beta <= 0)
+		return 0;
+	return sigma_thomson * 3. / 8 / M_PI * alpha_finestructure * beta;
+}
+
+static double sigmaICS(double s) {
+	double b = (s - me2) / (s + me2);
+	if (b < 1e-3)
+		return sigma_thomson; // Thomson limit, avoids the cancellation below
+	double A = 2 / b / (1 + b) * (2 + 2 * b - b * b - 2 * b * b * b);
+	// ln((1 + b) / (1 - b)) = ln(s / m^2), stable for b -> 1
+	double B = (2 - 3 * b * b - b * b * b) / b / b * std::log(s / me2);
+	return sigma_thomson * 3. / 8 * me2 / s / b * (A - B);
+}
+
+struct EMProcess {
+	double m2; // mass squared of the incoming particle [J^2]
+	double (*sigma)(double s);
+};
+
+static bool emProcess(const std::string &process, EMProcess &p) {
+	if (process == "EMPairProduction") {
+		p.m2 = 0;
+		p.sigma = sigmaPP;
+	} else if (process == "EMDoublePairProduction") {
+		p.m2 = 0;
+		p.sigma = sigmaDPP;
+	} else if (process == "EMTripletPairProduction") {
+		p.m2 = me2;
+		p.sigma = sigmaTPP;
+	} else if (process == "EMInverseComptonScattering") {
+		p.m2 = me2;
+		p.sigma = sigmaICS;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// I(x) = integral of n(eps) / eps^2 over eps >= x [1/(m^3 J^2)], with the
+// differential density n = getPhotonDensity / eps
+class PhotonIntegral {
+	double logMin, dlog;
+	std::vector<double> I;
+public:
+	PhotonIntegral(const PhotonField *field) {
+		double epsMin = field->getMinimumPhotonEnergy(0);
+		double epsMax = field->getMaximumPhotonEnergy(0);
+		if ((epsMin <= 0) or (epsMax <= epsMin))
+			throw std::runtime_error("InteractionTables: invalid energy range of photon field " + field->getFieldName());
+		size_t n = 2000;
+		logMin = std::log(epsMin);
+		dlog = std::log(epsMax / epsMin) / (n - 1);
+		std::vector<double> f(n);
+		for (size_t i = 0; i < n; i++) {
+			double eps = std::exp(logMin + i * dlog);
+			f[i] = field->getPhotonDensity(eps, 0) / eps / eps; // dn/dln(eps) / eps^2
+		}
+		I.assign(n, 0);
+		for (size_t i = n - 1; i-- > 0;)
+			I[i] = I[i + 1] + 0.5 * (f[i] + f[i + 1]) * dlog;
+	}
+
+	double operator()(double x) const {
+		double p = (std::log(x) - logMin) / dlog;
+		if (p <= 0)
+			return I.front();
+		if (p >= I.size() - 1)
+			return 0;
+		size_t i = p;
+		return I[i] + (p - i) * (I[i + 1] - I[i]);
+	}
+};
+
+// cumulative rate [1/m] in s - m^2 on the integration grid for the energy E
+static void cumulativeRate(const EMProcess &p, const PhotonIntegral &I, double E, std::vector<double> &C) {
+	size_t n = (logSkinMax - logSkinMin) * sPerDecade + 1;
+	double dlog = std::log(10.) / sPerDecade;
+	C.assign(n, 0);
+	double gOld = 0;
+	for (size_t k = 0; k < n; k++) {
+		double skin = std::pow(10, logSkinMin + double(k) / sPerDecade) * eV * eV;
+		// R = 1 / (8 E^2) int ds_kin sigma(s) s_kin I(s_kin / 4E), in log(s_kin)
+		double g = p.sigma(skin + p.m2) * skin * skin * I(skin / (4 * E));
+		if (k > 0)
+			C[k] = C[k - 1] + 0.5 * (g + gOld) * dlog;
+		gOld = g;
+	}
+	for (size_t k = 0; k < n; k++)
+		C[k] /= 8 * E * E;
+}
+
+// integration grid in the rest frame photon energy of photo-pion production
+static const double logEpsPrimeMin = -1, logEpsPrimeMax = 6; // log10(eps'/GeV)
+static const int epsPrimePerDecade = 40;
+
+static double epsPrime(size_t k) {
+	return std::pow(10, logEpsPrimeMin + double(k) / epsPrimePerDecade) * GeV;
+}
+
+std::vector<double> InteractionTables::photoPionCrossSection(bool onProton) {
+	size_t n = (logEpsPrimeMax - logEpsPrimeMin) * epsPrimePerDecade + 1;
+	std::vector<double> sigma(n);
+	// crossection takes the rest frame photon energy in GeV and returns mubarn
+	for (size_t k = 0; k < n; k++)
+		sigma[k] = PhotoPionProduction::crossection(epsPrime(k) / GeV, onProton) * 1e-34;
+	return sigma;
+}
+
+// rate [1/m] of a nucleon with Lorentz factor gamma,
+// R = 1 / (2 gamma^2) int deps' eps' sigma(eps') I(eps' / 2 gamma), in log(eps')
+static double photoPionRate(const PhotonIntegral &I, const std::vector<double> &sigma, double gamma) {
+	double dlog = std::log(10.) / epsPrimePerDecade;
+	double sum = 0, gOld = 0;
+	for (size_t k = 0; k < sigma.size(); k++) {
+		double e = epsPrime(k);
+		double g = e * e * sigma[k] * I(e / (2 * gamma));
+		if (k > 0)
+			sum += 0.5 * (g + gOld) * dlog;
+		gOld = g;
+	}
+	return sum / (2 * gamma * gamma);
+}
+
+bool InteractionTables::isSupported(const std::string &process, const std::string &kind) {
+	EMProcess p;
+	if (emProcess(process, p))
+		return (kind == "rate") or ((kind == "cdf") and (process != "EMDoublePairProduction"));
+	return (process == "PhotoPionProduction") and (kind == "rate");
+}
+
+double InteractionTables::computeRate(const std::string &process, const PhotonField *field, double E, bool onProton) {
+	PhotonIntegral I(field);
+	EMProcess p;
+	if (emProcess(process, p)) {
+		std::vector<double> C;
+		cumulativeRate(p, I, E, C);
+		return C.back();
+	}
+	if (process == "PhotoPionProduction") {
+		double m = (onProton ? mass_proton : mass_neutron) * c_squared;
+		return photoPionRate(I, photoPionCrossSection(onProton), E / m);
+	}
+	throw std::runtime_error("InteractionTables: unsupported process " + process);
+}
+
+void InteractionTables::generate(const std::string &process, const std::string &kind, const PhotonField *field, const std::string &filename) {
+	if (not isSupported(process, kind))
+		throw std::runtime_error("InteractionTables: cannot compute " + kind + " of " + process);
+	PhotonIntegral I(field);
+
+	// rows computed in parallel, written in order
+	std::vector<std::string> rows;
+	std::ostringstream header;
+	header << "# " << process << " " << kind << " on " << field->getFieldName()
+		<< ", computed by crpropa::InteractionTables, hash " << std::hex
+		<< hash(field) << std::dec << "\n";
+
+	EMProcess p;
+	if (emProcess(process, p) and (kind == "rate")) {
+		header << "# log10(E/eV), rate [1/Mpc]\n";
+		int n = (logEnergyMax - logEnergyMin) / logRateStep + 1.5;
+		rows.resize(n);
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < n; i++) {
+			double logE = logEnergyMin + i * logRateStep;
+			std::vector<double> C;
+			cumulativeRate(p, I, std::pow(10, logE) * eV, C);
+			char buffer[64];
+			std::snprintf(buffer, sizeof(buffer), "%.4f %.6e\n", logE, C.back() * Mpc);
+			rows[i] = buffer;
+		}
+	} else if (emProcess(process, p)) {
+		header << "# first row: 0, log10(s_kin/eV^2); following rows: log10(E/eV), cumulative rate [1/Mpc]\n";
+		std::ostringstream first;
+		first << "0";
+		size_t nS = (logSkinMax - logSkinMin) * sPerDecade + 1;
+		for (size_t k = 0; k < nS; k += sPerCdfColumn)
+			first << " " << logSkinMin + double(k) / sPerDecade;
+		first << "\n";
+		int n = (logEnergyMax - logEnergyMin) / logCdfStep + 1.5;
+		rows.resize(n + 1);
+		rows[0] = first.str();
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < n; i++) {
+			double logE = logEnergyMin + i * logCdfStep;
+			std::vector<double> C;
+			cumulativeRate(p, I, std::pow(10, logE) * eV, C);
+			std::ostringstream row;
+			row << logE;
+			char buffer[32];
+			for (size_t k = 0; k < C.size(); k += sPerCdfColumn) {
+				std::snprintf(buffer, sizeof(buffer), " %.6e", C[k] * Mpc);
+				row << buffer;
+			}
+			row << "\n";
+			rows[i + 1] = row.str();
+		}
+	} else {
+		header << "# log10(gamma), proton rate [1/Mpc], neutron rate [1/Mpc]\n";
+		int n = (logLorentzMax - logLorentzMin) / logLorentzStep + 1.5;
+		rows.resize(n);
+		std::vector<double> sigmaProton = photoPionCrossSection(true);
+		std::vector<double> sigmaNeutron = photoPionCrossSection(false);
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < n; i++) {
+			double logGamma = logLorentzMin + i * logLorentzStep;
+			double gamma = std::pow(10, logGamma);
+			char buffer[96];
+			std::snprintf(buffer, sizeof(buffer), "%.4f %.6e %.6e\n", logGamma,
+					photoPionRate(I, sigmaProton, gamma) * Mpc, photoPionRate(I, sigmaNeutron, gamma) * Mpc);
+			rows[i] = buffer;
+		}
+	}
+
+	// write to a file of its own and rename it, so that concurrent
+	// processes never read a partially written table
+	std::string dir = filename.substr(0, filename.find_last_of('/'));
+	for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+		mkdir(dir.substr(0, pos).c_str(), 0755);
+		if (pos == std::string::npos)
+			break;
+	}
+	std::ostringstream tmp;
+	tmp << filename << ".tmp";
+#ifndef _WIN32
+	tmp << getpid();
+#endif
+	std::ofstream out(tmp.str().c_str());
+	if (!out.good())
+		throw std::runtime_error("InteractionTables: could not write " + filename);
+	out << header.str();
+	for (size_t i = 0; i < rows.size(); i++)
+		out << rows[i];
+	out.close();
+	if (!out.good() || std::rename(tmp.str().c_str(), filename.c_str()) != 0) {
+		std::remove(tmp.str().c_str());
+		throw std::runtime_error("InteractionTables: could not write " + filename);
+	}
+}
+
+uint64_t InteractionTables::hash(const PhotonField *field) {
+	// FNV-1a over the name, the energy range and the sampled density
+	uint64_t h = 14695981039346656037ULL;
+	std::string name = field->getFieldName();
+	std::vector<double> values;
+	double epsMin = field->getMinimumPhotonEnergy(0);
+	double epsMax = field->getMaximumPhotonEnergy(0);
+	values.push_back(epsMin);
+	values.push_back(epsMax);
+	for (size_t i = 0; i < 256; i++)
+		values.push_back(field->getPhotonDensity(epsMin * std::pow(epsMax / epsMin, i / 255.), 0));
+	const unsigned char *bytes = (const unsigned char *) name.data();
+	for (size_t i = 0; i < name.size(); i++)
+		h = (h ^ bytes[i]) * 1099511628211ULL;
+	bytes = (const unsigned char *) &values[0];
+	for (size_t i = 0; i < values.size() * sizeof(double); i++)
+		h = (h ^ bytes[i]) * 1099511628211ULL;
+	return h;
+}
+
+std::string InteractionTables::cacheFilename(const std::string &process, const std::string &kind, const PhotonField *field) {
+	char key[17];
+	std::snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash(field));
+	return getCacheDirectory() + "/" + process + "/" + kind + "_" + field->getFieldName() + "_" + key + ".txt";
+}
+
+std::string InteractionTables::getTable(const std::string &process, const std::string &kind, const PhotonField *field) {
+	std::string filename = getDataPath(process + "/" + kind + "_" + field->getFieldName() + ".txt");
+	if ((not generationEnabled) or (not isSupported(process, kind)) or std::ifstream(filename.c_str()).good())
+		return filename;
+
+	static std::mutex generateMutex;
+	std::lock_guard<std::mutex> lock(generateMutex);
+	std::string cached = cacheFilename(process, kind, field);
+	if (not std::ifstream(cached.c_str()).good()) {
+		KISS_LOG_INFO << "InteractionTables: computing " << cached;
+		generate(process, kind, field, cached);
+	}
+	return cached;
+}
+
+void InteractionTables::setCacheDirectory(const std::string &directory) {
+	cacheDirectory = directory;
+}
+
+std::string InteractionTables::getCacheDirectory() {
+	if (cacheDirectory.size())
+		return cacheDirectory;
+	const char *dir = getenv("CRPROPA_TABLE_CACHE");
+	if (dir && dir[0] != '\0')
+		return dir;
+	const char *home = getenv("HOME");
+	if (home && home[0] != '\0')
+		return std::string(home) + "/.crpropa/tables";
+	return "crpropa_tables";
+}
+
+void InteractionTables::setGenerationEnabled(bool enabled) {
+	generationEnabled = enabled;
+}
+
+bool InteractionTables::getGenerationEnabled() {
+	return generationEnabled;
+}
+
+} // namespace crpropa
@@ -0,0 +1,100 @@
+#include "crpropa/MappedFile.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+MappedFile::MappedFile(const std::string &filename) :
+		filename(filename), address(0), length(0) {
+#ifndef _WIN32
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("MappedFile: could not open file " + filename);
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		throw std::runtime_error("MappedFile: could not read file " + filename);
+	}
+	length = st.st_size;
+	if (length > 0) {
+		// private, writable mapping: writes go to copies of the pages
+		address = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED) {
+			::close(fd);
+			throw std::runtime_error("MappedFile: could not map file " + filename);
+		}
+	}
+	::close(fd);
+#else
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("MappedFile: could not open file " + filename);
+	in.seekg(0, in.end);
+	length = in.tellg();
+	in.seekg(0, in.beg);
+	buffer.resize(length);
+	if (length > 0 && !in.read(&buffer[0], length))
+		throw std::runtime_error("MappedFile: could not read file " + filename);
+	address = length > 0 ? &buffer[0] : 0;
+#endif
+}
+
+MappedFile::MappedFile() : address(0), length(0) {
+}
+
+ref_ptr<MappedFile> MappedFile::openShared(const std::string &name, size_t offset) {
+	ref_ptr<MappedFile> file = new MappedFile();
+	file->filename = name;
+#ifndef _WIN32
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		throw std::runtime_error("MappedFile: could not open shared memory " + name);
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < offset)) {
+		::close(fd);
+		throw std::runtime_error("MappedFile: could not read shared memory " + name);
+	}
+	file->length = st.st_size - offset;
+	if (file->length > 0) {
+		file->address = mmap(0, file->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+		if (file->address == MAP_FAILED) {
+			file->address = 0;
+			::close(fd);
+			throw std::runtime_error("MappedFile: could not map shared memory " + name);
+		}
+	}
+	::close(fd);
+#else
+	throw std::runtime_error("MappedFile: shared memory is not supported on this system");
+#endif
+	return file;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+	if (address)
+		munmap(address, length);
+#endif
+}
+
+void *MappedFile::data() const {
+	return address;
+}
+
+size_t MappedFile::size() const {
+	return length;
+}
+
+const std::string &MappedFile::getFilename() const {
+	return filename;
+}
+
+} // namespace crpropa
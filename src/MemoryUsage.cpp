@@ -0,0 +1,192 @@
+#include "crpropa/MemoryUsage.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace crpropa {
+
+namespace {
+
+// counters of one thread, only written by their thread
+struct ThreadCounters {
+	std::atomic<int64_t> bytes[MemoryUsage::nSubsystems];
+	std::atomic<int64_t> objects[MemoryUsage::nSubsystems];
+	ThreadCounters() {
+		for (size_t i = 0; i < MemoryUsage::nSubsystems; i++) {
+			bytes[i].store(0);
+			objects[i].store(0);
+		}
+	}
+};
+
+// never destroyed, objects may be released during the static destruction
+std::mutex *countersMutex = new std::mutex();
+std::vector<ThreadCounters *> *allCounters = new std::vector<ThreadCounters *>();
+
+ThreadCounters &threadCounters() {
+	static thread_local ThreadCounters *counters = 0;
+	if (!counters) {
+		counters = new ThreadCounters();
+		std::lock_guard<std::mutex> lock(*countersMutex);
+		allCounters->push_back(counters);
+	}
+	return *counters;
+}
+
+// sum of the bytes or objects of all threads
+int64_t sum(size_t subsystem, bool objects) {
+	std::lock_guard<std::mutex> lock(*countersMutex);
+	int64_t total = 0;
+	for (size_t i = 0; i < allCounters->size(); i++) {
+		const ThreadCounters &counters = *(*allCounters)[i];
+		total += (objects ? counters.objects : counters.bytes)[subsystem].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+std::atomic<size_t> softLimit(0);
+std::atomic<double> reportInterval(0);
+std::atomic<bool> overLimit(false);
+std::mutex pollMutex;
+std::chrono::steady_clock::time_point lastCheck, lastReport;
+
+std::string formatBytes(double bytes) {
+	const char *units[] = {"B", "kB", "MB", "GB", "TB"};
+	size_t i = 0;
+	while ((bytes >= 1000) && (i < 4)) {
+		bytes /= 1000;
+		i++;
+	}
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.1f %s", bytes, units[i]);
+	return buffer;
+}
+
+} // namespace
+
+void MemoryUsage::add(Subsystem subsystem, int64_t bytes, int64_t objects) {
+	ThreadCounters &counters = threadCounters();
+	std::atomic<int64_t> &b = counters.bytes[subsystem];
+	b.store(b.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+	if (objects) {
+		std::atomic<int64_t> &o = counters.objects[subsystem];
+		o.store(o.load(std::memory_order_relaxed) + objects, std::memory_order_relaxed);
+	}
+}
+
+int64_t MemoryUsage::getBytes(Subsystem subsystem) {
+	return sum(subsystem, false);
+}
+
+int64_t MemoryUsage::getObjects(Subsystem subsystem) {
+	return sum(subsystem, true);
+}
+
+int64_t MemoryUsage::getTotalBytes() {
+	int64_t total = 0;
+	for (size_t i = 0; i < nSubsystems; i++)
+		total += getBytes(Subsystem(i));
+	return total;
+}
+
+std::string MemoryUsage::getName(Subsystem subsystem) {
+	const char *names[] = {"candidates", "tables", "grids", "output buffers", "lenses"};
+	return names[subsystem];
+}
+
+size_t MemoryUsage::getResidentSetSize() {
+	FILE *file = std::fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+	long pages = 0, resident = 0;
+	int n = std::fscanf(file, "%ld %ld", &pages, &resident);
+	std::fclose(file);
+	if (n != 2)
+		return 0;
+	return size_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+std::string MemoryUsage::getReport() {
+	std::stringstream ss;
+	for (size_t i = 0; i < nSubsystems; i++) {
+		ss << getName(Subsystem(i)) << " " << formatBytes(getBytes(Subsystem(i)));
+		if (i == Candidates)
+			ss << " (" << getObjects(Candidates) << ")";
+		ss << ", ";
+	}
+	ss << "total " << formatBytes(getTotalBytes());
+	size_t rss = getResidentSetSize();
+	if (rss)
+		ss << ", resident " << formatBytes(rss);
+	if (softLimit.load())
+		ss << ", soft limit " << formatBytes(softLimit.load());
+	return ss.str();
+}
+
+void MemoryUsage::setSoftLimit(size_t bytes) {
+	softLimit.store(bytes);
+	overLimit.store(false);
+	// the next poll checks the new limit
+	std::lock_guard<std::mutex> lock(pollMutex);
+	lastCheck = std::chrono::steady_clock::time_point();
+}
+
+size_t MemoryUsage::getSoftLimit() {
+	return softLimit.load();
+}
+
+void MemoryUsage::setReportInterval(double seconds) {
+	reportInterval.store(seconds);
+	std::lock_guard<std::mutex> lock(pollMutex);
+	lastReport = std::chrono::steady_clock::now();
+}
+
+double MemoryUsage::getReportInterval() {
+	return reportInterval.load();
+}
+
+bool MemoryUsage::isOverLimit() {
+	return overLimit.load(std::memory_order_relaxed);
+}
+
+bool MemoryUsage::getPolling() {
+	return (softLimit.load() > 0) || (reportInterval.load() > 0);
+}
+
+bool MemoryUsage::poll() {
+	std::unique_lock<std::mutex> lock(pollMutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return isOverLimit();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - lastCheck).count() < 0.1)
+		return isOverLimit();
+	lastCheck = now;
+
+	size_t limit = softLimit.load();
+	if (limit > 0) {
+		size_t used = getResidentSetSize();
+		if (used == 0)
+			used = std::max(getTotalBytes(), int64_t(0));
+		bool over = used > limit;
+		if (over && !overLimit.load())
+			std::cerr << "crpropa::MemoryUsage: soft limit exceeded, " << getReport() << std::endl;
+		overLimit.store(over);
+	}
+
+	double interval = reportInterval.load();
+	if ((interval > 0) && (std::chrono::duration<double>(now - lastReport).count() >= interval)) {
+		lastReport = now;
+		std::cout << "crpropa::MemoryUsage: " << getReport() << std::endl;
+	}
+	return isOverLimit();
+}
+
+} // namespace crpropa
@@ -1,10 +1,11 @@
 #include "crpropa/Module.h"
 
+#include <limits>
 #include <typeinfo>
 
 namespace crpropa {
 
-Module::Module() {
+Module::Module() : runOnInactive(false) {
 	const std::type_info &info = typeid(*this);
 	setDescription(info.name());
 }
@@ -17,6 +18,26 @@ void Module::setDescription(const std::string &d) {
 	description = d;
 }
 
+void Module::setRunOnInactive(bool run) {
+	runOnInactive = run;
+}
+
+void Module::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		process(candidates[i]);
+}
+
+double Module::getStepLimit(const Candidate *candidate) const {
+	return std::numeric_limits<double>::max();
+}
+
+double Module::getInteractionRate(const Candidate *candidate) const {
+	return 0;
+}
+
+void Module::interact(Candidate *candidate) const {
+}
+
 AbstractCondition::AbstractCondition() :
 		makeRejectedInactive(true), makeAcceptedInactive(false), rejectFlagKey(
 				"Rejected") {
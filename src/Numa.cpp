@@ -0,0 +1,216 @@
+#include "crpropa/Numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// memory policy constants of linux/mempolicy.h, not installed everywhere
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// numbers of a list like "0-3,8,10-11" as in /sys/devices/system
+std::vector<int> parseList(const std::string &text) {
+	std::vector<int> numbers;
+	std::stringstream ss(text);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty() || (item[0] < '0') || (item[0] > '9'))
+			continue;
+		size_t dash = item.find('-');
+		int first = atoi(item.c_str());
+		int last = (dash == std::string::npos) ? first : atoi(item.c_str() + dash + 1);
+		for (int i = first; i <= last; i++)
+			numbers.push_back(i);
+	}
+	return numbers;
+}
+
+std::string readFile(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	std::string line;
+	std::getline(in, line);
+	return line;
+}
+
+// nodes and CPUs of the process, read once before any thread is pinned
+struct Topology {
+	std::vector<int> nodes;
+	std::vector<int> cpus; ///< allowed CPUs ordered by node and number
+	std::vector<std::vector<int> > nodeCpus; ///< allowed CPUs of each entry of nodes
+#ifdef __linux__
+	cpu_set_t mask;
+	bool hasMask;
+#endif
+
+	Topology() {
+		std::vector<int> allowed;
+#ifdef __linux__
+		CPU_ZERO(&mask);
+		hasMask = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+		if (hasMask)
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+				if (CPU_ISSET(cpu, &mask))
+					allowed.push_back(cpu);
+		nodes = parseList(readFile("/sys/devices/system/node/online"));
+		for (size_t i = 0; i < nodes.size(); i++) {
+			std::stringstream name;
+			name << "/sys/devices/system/node/node" << nodes[i] << "/cpulist";
+			std::vector<int> list = parseList(readFile(name.str()));
+			std::vector<int> own;
+			for (size_t j = 0; j < list.size(); j++)
+				if (std::find(allowed.begin(), allowed.end(), list[j]) != allowed.end())
+					own.push_back(list[j]);
+			nodeCpus.push_back(own);
+			cpus.insert(cpus.end(), own.begin(), own.end());
+		}
+#endif
+		if (nodes.empty()) {
+			nodes.push_back(0);
+			nodeCpus.push_back(allowed);
+			cpus = allowed;
+		}
+		// CPUs without a node, e.g. if the node files are not readable
+		for (size_t i = 0; i < allowed.size(); i++)
+			if (std::find(cpus.begin(), cpus.end(), allowed[i]) == cpus.end())
+				cpus.push_back(allowed[i]);
+	}
+};
+
+const Topology &topology() {
+	static Topology t;
+	return t;
+}
+
+struct Settings {
+	bool interleave;
+	size_t minimumSize;
+	Settings() : interleave(false), minimumSize(1 << 20) {
+		const char *env = getenv("CRPROPA_NUMA_INTERLEAVE");
+		interleave = env && (atoi(env) != 0);
+	}
+};
+
+Settings &settings() {
+	static Settings s;
+	return s;
+}
+
+} // namespace
+
+size_t Numa::getNodeCount() {
+	return topology().nodes.size();
+}
+
+std::vector<int> Numa::getCpus() {
+	return topology().cpus;
+}
+
+size_t Numa::getNode(int cpu) {
+	const Topology &t = topology();
+	for (size_t i = 0; i < t.nodeCpus.size(); i++)
+		if (std::find(t.nodeCpus[i].begin(), t.nodeCpus[i].end(), cpu) != t.nodeCpus[i].end())
+			return t.nodes[i];
+	return 0;
+}
+
+void Numa::setInterleave(bool interleave) {
+	settings().interleave = interleave;
+}
+
+bool Numa::getInterleave() {
+	return settings().interleave;
+}
+
+void Numa::setMinimumSize(size_t bytes) {
+	settings().minimumSize = bytes;
+}
+
+size_t Numa::getMinimumSize() {
+	return settings().minimumSize;
+}
+
+bool Numa::place(const void *data, size_t bytes) {
+	if (!settings().interleave || (bytes < settings().minimumSize))
+		return false;
+	return interleave(data, bytes);
+}
+
+bool Numa::interleave(const void *data, size_t bytes) {
+#if defined(__linux__) && defined(__NR_mbind)
+	const Topology &t = topology();
+	if ((t.nodes.size() < 2) || (data == 0))
+		return false;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t(data) + page - 1) & ~(page - 1);
+	uintptr_t end = (uintptr_t(data) + bytes) & ~(page - 1);
+	if (end <= begin)
+		return false;
+
+	const size_t bits = 8 * sizeof(unsigned long);
+	int maxNode = *std::max_element(t.nodes.begin(), t.nodes.end());
+	std::vector<unsigned long> nodemask(maxNode / bits + 1, 0);
+	for (size_t i = 0; i < t.nodes.size(); i++)
+		nodemask[t.nodes[i] / bits] |= 1UL << (t.nodes[i] % bits);
+	// the kernel uses one bit less than maxnode
+	return syscall(__NR_mbind, (void *) begin, (unsigned long) (end - begin), MPOL_INTERLEAVE,
+			nodemask.data(), (unsigned long) (nodemask.size() * bits + 1), MPOL_MF_MOVE) == 0;
+#else
+	return false;
+#endif
+}
+
+bool Numa::pinThread(size_t index, bool compact) {
+#ifdef __linux__
+	const Topology &t = topology();
+	if (t.cpus.empty())
+		return false;
+	int cpu = t.cpus[index % t.cpus.size()];
+	if (!compact) {
+		// round-robin over the nodes with allowed CPUs
+		std::vector<size_t> used;
+		for (size_t i = 0; i < t.nodeCpus.size(); i++)
+			if (!t.nodeCpus[i].empty())
+				used.push_back(i);
+		if (!used.empty()) {
+			const std::vector<int> &own = t.nodeCpus[used[index % used.size()]];
+			cpu = own[(index / used.size()) % own.size()];
+		}
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+bool Numa::unpinThread() {
+#ifdef __linux__
+	const Topology &t = topology();
+	if (!t.hasMask)
+		return false;
+	return sched_setaffinity(0, sizeof(t.mask), &t.mask) == 0;
+#else
+	return false;
+#endif
+}
+
+} // namespace crpropa
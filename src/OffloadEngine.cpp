@@ -0,0 +1,766 @@
+#include "crpropa/OffloadEngine.h"
+#include "crpropa/Geometry.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/PropagationCK.h"
+
+#include "kiss/logger.h"
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+enum FieldType {
+	FieldNone, FieldGrid, FieldWaves
+};
+
+enum ConditionType {
+	ConditionMaximumLength, ConditionMinimumEnergy, ConditionCube, ConditionSphere, ConditionObserverSphere
+};
+
+enum Status {
+	StatusRunning, StatusStopped
+};
+
+const size_t conditionSize = 7; // type, x, y, z, size, margin, limitStep
+const size_t modeSize = 9; // xi, kappa, Ak, k, beta
+
+#if _OPENMP
+#pragma omp declare target
+#endif
+
+// Cash-Karp coefficients, as in PropagationCK
+const double ckA[36] = {
+	0., 0., 0., 0., 0., 0.,
+	1. / 5., 0., 0., 0., 0., 0.,
+	3. / 40., 9. / 40., 0., 0., 0., 0.,
+	3. / 10., -9. / 10., 6. / 5., 0., 0., 0.,
+	-11. / 54., 5. / 2., -70. / 27., 35. / 27., 0., 0.,
+	1631. / 55296., 175. / 512., 575. / 13824., 44275. / 110592., 253. / 4096., 0.
+};
+const double ckB[6] = {
+	37. / 378., 0, 250. / 621., 125. / 594., 0., 512. / 1771.
+};
+const double ckBs[6] = {
+	2825. / 27648., 0., 18575. / 48384., 13525. / 55296., 277. / 14336., 1. / 4.
+};
+
+// phase-point of the integrators: position and direction (or their derivatives)
+struct Phase {
+	double x[3], u[3];
+};
+
+inline double length3(const double *v) {
+	return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+inline void cross3(const double *a, const double *b, double *c) {
+	c[0] = a[1] * b[2] - a[2] * b[1];
+	c[1] = a[2] * b[0] - a[0] * b[2];
+	c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline int reflectiveClampIndex(double &x, int n, int &hi) {
+	while ((x < -0.5) || (x > (n - 0.5)))
+		x = 2 * n * (x > (n - 0.5)) - x - 1;
+	int lo = floor(x);
+	hi = lo + (lo < n - 1);
+	if (x < 0) {
+		lo = 0;
+		hi = 0;
+	}
+	return lo;
+}
+
+/** Restricted simulation on plain data, the same for the device and the host */
+struct Kernel {
+	int scheme; // 0: Boris push, 1: Cash-Karp
+	double tolerance, minStep, maxStep;
+
+	int fieldType;
+	const float *grid;
+	int nx, ny, nz;
+	double origin[3], gridOrigin[3], spacing[3];
+	int reflective, clipVolume;
+	const double *modes;
+	int nModes;
+
+	const double *conditions;
+	int nConditions;
+
+	// trilinear interpolation as Grid::trilinearInterpolate, summed in single precision
+	void gridField(const double *pos, double *B) const {
+		B[0] = B[1] = B[2] = 0;
+		if (clipVolume) {
+			for (int a = 0; a < 3; a++) {
+				int n = (a == 0) ? nx : ((a == 1) ? ny : nz);
+				if ((pos[a] < origin[a]) || (pos[a] > origin[a] + n * spacing[a]))
+					return;
+			}
+		}
+		int lo[3], hi[3];
+		double f0[3];
+		for (int a = 0; a < 3; a++) {
+			int n = (a == 0) ? nx : ((a == 1) ? ny : nz);
+			double r = (pos[a] - gridOrigin[a]) / spacing[a];
+			if (reflective) {
+				lo[a] = reflectiveClampIndex(r, n, hi[a]);
+			} else {
+				lo[a] = ((int(floor(r)) % n) + n) % n;
+				hi[a] = (lo[a] + 1) % n;
+			}
+			f0[a] = r - floor(r);
+		}
+		// corners in the order of Grid::trilinearWeights, bits of x, y and z
+		const int corners[8] = {0, 1, 2, 4, 5, 6, 3, 7};
+		float b[3] = {0, 0, 0};
+		for (int j = 0; j < 8; j++) {
+			int i = corners[j];
+			int ix = (i & 1) ? hi[0] : lo[0];
+			int iy = (i & 2) ? hi[1] : lo[1];
+			int iz = (i & 4) ? hi[2] : lo[2];
+			double w = ((i & 1) ? f0[0] : 1 - f0[0]) * ((i & 2) ? f0[1] : 1 - f0[1])
+					* ((i & 4) ? f0[2] : 1 - f0[2]);
+			const float *v = grid + 3 * ((size_t(ix) * ny + iy) * nz + iz);
+			for (int a = 0; a < 3; a++)
+				b[a] += v[a] * float(w);
+		}
+		for (int a = 0; a < 3; a++)
+			B[a] = b[a];
+	}
+
+	// plane waves as the EXACT kernel of PlaneWaveTurbulence
+	void wavesField(const double *pos, double *B) const {
+		B[0] = B[1] = B[2] = 0;
+		for (int i = 0; i < nModes; i++) {
+			const double *m = modes + modeSize * i;
+			double z = pos[0] * m[3] + pos[1] * m[4] + pos[2] * m[5];
+			double c = cos(m[7] * z + m[8]);
+			for (int a = 0; a < 3; a++)
+				B[a] += m[a] * m[6] * c;
+		}
+	}
+
+	void field(const double *pos, double *B) const {
+		if (fieldType == FieldGrid)
+			gridField(pos, B);
+		else if (fieldType == FieldWaves)
+			wavesField(pos, B);
+		else
+			B[0] = B[1] = B[2] = 0;
+	}
+
+	// Boris push of PropagationBP::dY
+	void borisStep(const Phase &y, double h, double q, double m, Phase &out) const {
+		double p[3], B[3], t[3], s[3], v[3], c[3], w[3];
+		for (int a = 0; a < 3; a++)
+			p[a] = y.x[a] + y.u[a] * h / 2.;
+		field(p, B);
+		for (int a = 0; a < 3; a++)
+			t[a] = B[a] * q / 2 / m * h / c_light;
+		double tt = 1 + (t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+		for (int a = 0; a < 3; a++)
+			s[a] = t[a] * 2 / tt;
+		cross3(y.u, t, c);
+		for (int a = 0; a < 3; a++)
+			v[a] = y.u[a] + c[a];
+		cross3(v, s, c);
+		for (int a = 0; a < 3; a++) {
+			w[a] = y.u[a] + c[a];
+			out.x[a] = p[a] + w[a] * h / 2.;
+			out.u[a] = w[a];
+		}
+	}
+
+	// error of the Boris push as PropagationBP::tryStep, |Y(S).u|
+	double borisTry(const Phase &y, double h, double q, double m, Phase &out) const {
+		Phase half, twice;
+		borisStep(y, h, q, m, out);
+		borisStep(y, h / 2, q, m, half);
+		borisStep(half, h / 2, q, m, twice);
+		double d[3];
+		for (int a = 0; a < 3; a++)
+			d[a] = out.x[a] - twice.x[a];
+		double S = length3(d) / (h * (1 - 1 / 4.));
+		return sqrt(3 * S * S);
+	}
+
+	// derivative of PropagationCK::dYdt
+	void derivative(const Phase &y, double q, double E, Phase &k) const {
+		double r = length3(y.u), B[3], c[3];
+		for (int a = 0; a < 3; a++)
+			k.x[a] = y.u[a] / r * c_light;
+		field(y.x, B);
+		cross3(k.x, B, c);
+		double f = q * c_light / E;
+		for (int a = 0; a < 3; a++)
+			k.u[a] = f * c[a];
+	}
+
+	// Cash-Karp step of PropagationCK::tryStep, returns |error.u|
+	double cashKarpTry(const Phase &y, const Phase &k0, double h, double q, double E, Phase &out) const {
+		Phase k[6], err;
+		out = y;
+		for (int a = 0; a < 3; a++)
+			err.x[a] = err.u[a] = 0;
+		for (int i = 0; i < 6; i++) {
+			Phase yn = y;
+			for (int j = 0; j < i; j++)
+				for (int a = 0; a < 3; a++) {
+					yn.x[a] += k[j].x[a] * ckA[i * 6 + j] * h;
+					yn.u[a] += k[j].u[a] * ckA[i * 6 + j] * h;
+				}
+			if (i == 0)
+				k[0] = k0;
+			else
+				derivative(yn, q, E, k[i]);
+			for (int a = 0; a < 3; a++) {
+				out.x[a] += k[i].x[a] * ckB[i] * h;
+				out.u[a] += k[i].u[a] * ckB[i] * h;
+				err.x[a] += k[i].x[a] * (ckB[i] - ckBs[i]) * h;
+				err.u[a] += k[i].u[a] * (ckB[i] - ckBs[i]) * h;
+			}
+		}
+		return length3(err.u);
+	}
+
+	// one step of the propagator, as PropagationBP::process or PropagationCK::process
+	void propagate(Phase &y, double q, double E, double &step, double &nextStep) const {
+		double m = E / (c_light * c_light);
+		Phase out, k0;
+		step = maxStep;
+		double newStep = step;
+		if (scheme == 1)
+			derivative(y, q, E, k0);
+		if (minStep == maxStep) {
+			if (scheme == 0)
+				borisStep(y, step, q, m, out);
+			else
+				cashKarpTry(y, k0, step / c_light, q, E, out);
+		} else {
+			step = fmax(minStep, fmin(nextStep, maxStep));
+			newStep = step;
+			while (true) {
+				double error = (scheme == 0) ? borisTry(y, step, q, m, out)
+					: cashKarpTry(y, k0, step / c_light, q, E, out);
+				double r = error / tolerance;
+				if (r > 1) {
+					if (step == minStep)
+						break;
+					newStep = step * 0.95 * pow(r, -0.2);
+					newStep = fmax(newStep, 0.1 * step);
+					newStep = fmax(newStep, minStep);
+					step = newStep;
+				} else {
+					if (step != maxStep) {
+						newStep = step * 0.95 * pow(r, -0.2);
+						newStep = fmin(newStep, 5 * step);
+						newStep = fmin(newStep, maxStep);
+					}
+					break;
+				}
+			}
+		}
+		// normalized twice as by getUnitVector and ParticleState::setDirection
+		double r = length3(out.u);
+		for (int a = 0; a < 3; a++) {
+			y.x[a] = out.x[a];
+			y.u[a] = out.u[a] / r;
+		}
+		r = length3(y.u);
+		for (int a = 0; a < 3; a++)
+			y.u[a] = y.u[a] / r;
+		nextStep = newStep;
+	}
+
+	// whether a condition acts on the candidate, otherwise its step limit
+	bool check(const double *c, const Phase &y, const double *previous, double length, double E,
+			double &limit) const {
+		const double infinity = 1.7976931348623157e308;
+		int type = int(c[0]);
+		limit = infinity;
+		if (type == ConditionMaximumLength) {
+			limit = c[4] - length;
+			return length >= c[4];
+		}
+		if (type == ConditionMinimumEnergy)
+			return !(E > c[4]);
+		double r[3];
+		for (int a = 0; a < 3; a++)
+			r[a] = y.x[a] - c[1 + a];
+		if (type == ConditionCube) {
+			double lo = fmin(r[0], fmin(r[1], r[2]));
+			double hi = fmax(r[0], fmax(r[1], r[2]));
+			if (c[6] != 0)
+				limit = fmin(lo, c[4] - hi) + c[5];
+			return (lo <= 0) || (hi >= c[4]);
+		}
+		double d = length3(r);
+		if (type == ConditionSphere) {
+			if (c[6] != 0)
+				limit = c[4] - d + c[5];
+			return d >= c[4];
+		}
+		// ObserverSurface of a sphere
+		double p[3];
+		for (int a = 0; a < 3; a++)
+			p[a] = previous[a] - c[1 + a];
+		double current = d - c[4];
+		double before = length3(p) - c[4];
+		limit = fabs(current);
+		return !(current * before > 0) && (before != 0);
+	}
+
+	/** Step the candidate until a condition acts on it, at most maxSteps times.
+	 Returns the number of steps. */
+	uint64_t run(double *pos, double *dir, double *previous, double *previousDir, double q, double E,
+			double &length, double &currentStep, double &nextStep, int &status, uint64_t maxSteps) const {
+		Phase y;
+		for (int a = 0; a < 3; a++) {
+			y.x[a] = pos[a];
+			y.u[a] = dir[a];
+		}
+		uint64_t steps = 0;
+		status = StatusRunning;
+		while (steps < maxSteps) {
+			for (int a = 0; a < 3; a++) {
+				previous[a] = y.x[a];
+				previousDir[a] = y.u[a];
+			}
+			propagate(y, q, E, currentStep, nextStep);
+			length += currentStep;
+			steps++;
+
+			double limit, minLimit = nextStep;
+			bool acts = false;
+			for (int i = 0; (i < nConditions) && !acts; i++) {
+				acts = check(conditions + conditionSize * i, y, previous, length, E, limit);
+				minLimit = fmin(minLimit, limit);
+			}
+			if (acts) {
+				// the modules repeat the conditions of this step on the host
+				status = StatusStopped;
+				break;
+			}
+			nextStep = minLimit;
+		}
+		for (int a = 0; a < 3; a++) {
+			pos[a] = y.x[a];
+			dir[a] = y.u[a];
+		}
+		return steps;
+	}
+};
+
+#if _OPENMP
+#pragma omp end declare target
+#endif
+
+template<typename G>
+void copyGrid(G &grid, std::vector<float> &values) {
+	size_t nx = grid.getNx(), ny = grid.getNy(), nz = grid.getNz();
+	values.resize(3 * nx * ny * nz);
+	for (size_t ix = 0; ix < nx; ix++)
+		for (size_t iy = 0; iy < ny; iy++)
+			for (size_t iz = 0; iz < nz; iz++) {
+				Vector3f v = grid.getValue(ix, iy, iz);
+				float *p = &values[3 * ((ix * ny + iy) * nz + iz)];
+				p[0] = v.x;
+				p[1] = v.y;
+				p[2] = v.z;
+			}
+}
+
+void addCondition(std::vector<double> &conditions, int type, const Vector3d &x, double size,
+		double margin, bool limitStep) {
+	double c[conditionSize] = {double(type), x.x, x.y, x.z, size, margin, limitStep ? 1. : 0.};
+	conditions.insert(conditions.end(), c, c + conditionSize);
+}
+
+} // namespace
+
+OffloadEngine::OffloadEngine(ref_ptr<ModuleList> modules) :
+		modules(modules), device(-1), batchSize(65536), stepsPerLaunch(100000), deviceSteps(0),
+		scheme(0), tolerance(0), minStep(0), maxStep(0), fieldType(FieldNone), nx(0), ny(0), nz(0),
+		reflective(false), clipVolume(false), memory(MemoryUsage::Grids) {
+	for (int a = 0; a < 3; a++)
+		origin[a] = gridOrigin[a] = spacing[a] = 0;
+	analyze();
+}
+
+bool OffloadEngine::analyzeField(ref_ptr<MagneticField> field) {
+	gridValues.clear();
+	waveModes.clear();
+	fieldType = FieldNone;
+	if (!field.valid())
+		return true;
+
+	if (MagneticFieldGrid *f = dynamic_cast<MagneticFieldGrid *>(field.get())) {
+		ref_ptr<Grid3f> grid = f->getGrid();
+		ref_ptr<Grid3h> half = f->getHalfGrid();
+		interpolationType ipol = grid.valid() ? grid->getInterpolationType() : half->getInterpolationType();
+		if (ipol != TRILINEAR) {
+			reason = "the grid is not interpolated trilinearly";
+			return false;
+		}
+		if (grid.valid())
+			copyGrid(*grid, gridValues);
+		else
+			copyGrid(*half, gridValues);
+		Vector3d o = grid.valid() ? grid->getOrigin() : half->getOrigin();
+		Vector3d s = grid.valid() ? grid->getSpacing() : half->getSpacing();
+		Vector3d g = o + s / 2;
+		double ov[3] = {o.x, o.y, o.z}, sv[3] = {s.x, s.y, s.z}, gv[3] = {g.x, g.y, g.z};
+		for (int a = 0; a < 3; a++) {
+			origin[a] = ov[a];
+			spacing[a] = sv[a];
+			gridOrigin[a] = gv[a];
+		}
+		if (grid.valid()) {
+			nx = grid->getNx(), ny = grid->getNy(), nz = grid->getNz();
+			reflective = grid->isReflective();
+			clipVolume = grid->getClipVolume();
+		} else {
+			nx = half->getNx(), ny = half->getNy(), nz = half->getNz();
+			reflective = half->isReflective();
+			clipVolume = half->getClipVolume();
+		}
+		fieldType = FieldGrid;
+		return true;
+	}
+
+	if (PlaneWaveTurbulence *f = dynamic_cast<PlaneWaveTurbulence *>(field.get())) {
+		std::vector<double> modes = f->getModes();
+		size_t n = modes.size() / PlaneWaveTurbulence::modeSize;
+		for (size_t i = 0; i < n; i++) {
+			const double *m = &modes[i * PlaneWaveTurbulence::modeSize];
+			double mode[modeSize] = {m[0], m[1], m[2], m[3], m[4], m[5], m[9], m[10], m[8]};
+			waveModes.insert(waveModes.end(), mode, mode + modeSize);
+		}
+		fieldType = FieldWaves;
+		return true;
+	}
+
+	reason = "the magnetic field is neither a MagneticFieldGrid nor a PlaneWaveTurbulence";
+	return false;
+}
+
+void OffloadEngine::analyze() {
+	reason.clear();
+	conditions.clear();
+	if (!modules.valid() || (modules->size() == 0)) {
+		reason = "the module list is empty";
+		return;
+	}
+
+	ModuleList::const_iterator m = modules->begin();
+	ref_ptr<MagneticField> field;
+	if (PropagationBP *p = dynamic_cast<PropagationBP *>(m->get())) {
+		scheme = 0;
+		field = p->getField();
+		tolerance = p->getTolerance();
+		minStep = p->getMinimumStep();
+		maxStep = p->getMaximumStep();
+	} else if (PropagationCK *p = dynamic_cast<PropagationCK *>(m->get())) {
+		scheme = 1;
+		field = p->getField();
+		tolerance = p->getTolerance();
+		minStep = p->getMinimumStep();
+		maxStep = p->getMaximumStep();
+	} else {
+		reason = "the first module is neither PropagationBP nor PropagationCK";
+		return;
+	}
+	if (!analyzeField(field))
+		return;
+	memory.set(gridValues.size() * sizeof(float) + waveModes.size() * sizeof(double));
+
+	for (m++; m != modules->end(); m++) {
+		Module *module = m->get();
+		if (MaximumTrajectoryLength *c = dynamic_cast<MaximumTrajectoryLength *>(module)) {
+			if (c->getObserverPositions().size()) {
+				reason = "MaximumTrajectoryLength with observer positions";
+				return;
+			}
+			addCondition(conditions, ConditionMaximumLength, Vector3d(0.), c->getMaximumTrajectoryLength(), 0, true);
+		} else if (MinimumEnergy *c = dynamic_cast<MinimumEnergy *>(module)) {
+			addCondition(conditions, ConditionMinimumEnergy, Vector3d(0.), c->getMinimumEnergy(), 0, false);
+		} else if (CubicBoundary *c = dynamic_cast<CubicBoundary *>(module)) {
+			addCondition(conditions, ConditionCube, c->getOrigin(), c->getSize(), c->getMargin(), c->getLimitStep());
+		} else if (SphericalBoundary *c = dynamic_cast<SphericalBoundary *>(module)) {
+			addCondition(conditions, ConditionSphere, c->getCenter(), c->getRadius(), c->getMargin(), c->getLimitStep());
+		} else if (Observer *o = dynamic_cast<Observer *>(module)) {
+			const std::vector<ref_ptr<ObserverFeature> > &features = o->getFeatures();
+			for (size_t i = 0; i < features.size(); i++) {
+				ObserverSurface *s = dynamic_cast<ObserverSurface *>(features[i].get());
+				Sphere *sphere = s ? dynamic_cast<Sphere *>(s->getSurface().get()) : 0;
+				if (!sphere) {
+					reason = "Observer with a feature other than ObserverSurface of a Sphere";
+					return;
+				}
+				addCondition(conditions, ConditionObserverSphere, sphere->getCenter(), sphere->getRadius(), 0, true);
+			}
+		} else {
+			reason = "unsupported module: " + module->getDescription();
+			return;
+		}
+	}
+}
+
+bool OffloadEngine::isSupported() const {
+	return reason.empty();
+}
+
+std::string OffloadEngine::getUnsupportedReason() const {
+	return reason;
+}
+
+int OffloadEngine::getDeviceCount() {
+#if defined(WITH_OFFLOAD) && _OPENMP
+	return omp_get_num_devices();
+#else
+	return 0;
+#endif
+}
+
+void OffloadEngine::setDevice(int d) {
+	device = d;
+}
+
+int OffloadEngine::getDevice() const {
+	return device;
+}
+
+void OffloadEngine::setBatchSize(size_t size) {
+	batchSize = std::max(size, (size_t) 1);
+}
+
+size_t OffloadEngine::getBatchSize() const {
+	return batchSize;
+}
+
+void OffloadEngine::setStepsPerLaunch(size_t steps) {
+	stepsPerLaunch = std::max(steps, (size_t) 1);
+}
+
+size_t OffloadEngine::getStepsPerLaunch() const {
+	return stepsPerLaunch;
+}
+
+uint64_t OffloadEngine::getDeviceSteps() const {
+	return deviceSteps;
+}
+
+// the modules after the propagator, as in ModuleList::process
+void OffloadEngine::replay(Candidate *candidate) const {
+	bool skipInactive = modules->getSkipInactive();
+	ModuleList::const_iterator m = modules->begin();
+	for (m++; m != modules->end(); m++) {
+		if (skipInactive && !candidate->isActive() && !(*m)->getRunOnInactive())
+			continue;
+		(*m)->process(candidate);
+	}
+}
+
+void OffloadEngine::runBatch(Candidate **candidates, size_t n, bool recursive) {
+	// charged active candidates are stepped by the kernel
+	std::vector<size_t> index;
+	for (size_t i = 0; i < n; i++)
+		if (candidates[i]->isActive() && (candidates[i]->current.getCharge() != 0))
+			index.push_back(i);
+	size_t m = index.size();
+
+	std::vector<double> pos(3 * m), dir(3 * m), previous(3 * m), previousDir(3 * m);
+	std::vector<double> charge(m), energy(m), length(m), currentStep(m), nextStep(m);
+	std::vector<int> status(m, StatusRunning);
+	std::vector<uint64_t> steps(m, 0);
+	for (size_t j = 0; j < m; j++) {
+		Candidate *c = candidates[index[j]];
+		Vector3d x = c->current.getPosition(), u = c->current.getDirection();
+		double xv[3] = {x.x, x.y, x.z}, uv[3] = {u.x, u.y, u.z};
+		for (int a = 0; a < 3; a++) {
+			pos[3 * j + a] = xv[a];
+			dir[3 * j + a] = uv[a];
+		}
+		charge[j] = c->current.getCharge();
+		energy[j] = c->current.getEnergy();
+		length[j] = c->getTrajectoryLength();
+		currentStep[j] = c->getCurrentStep();
+		nextStep[j] = c->getNextStep();
+	}
+
+	Kernel kernel;
+	kernel.scheme = scheme;
+	kernel.tolerance = tolerance;
+	kernel.minStep = minStep;
+	kernel.maxStep = maxStep;
+	kernel.fieldType = fieldType;
+	kernel.nx = nx;
+	kernel.ny = ny;
+	kernel.nz = nz;
+	for (int a = 0; a < 3; a++) {
+		kernel.origin[a] = origin[a];
+		kernel.gridOrigin[a] = gridOrigin[a];
+		kernel.spacing[a] = spacing[a];
+	}
+	kernel.reflective = reflective;
+	kernel.clipVolume = clipVolume;
+	kernel.nModes = waveModes.size() / modeSize;
+	kernel.nConditions = conditions.size() / conditionSize;
+
+	const float *grid = gridValues.data();
+	const double *modes = waveModes.data();
+	const double *conds = conditions.data();
+#if defined(WITH_OFFLOAD) && _OPENMP
+	size_t nGrid = gridValues.size(), nModes = waveModes.size(), nConds = conditions.size();
+#endif
+	double *x = pos.data(), *u = dir.data(), *px = previous.data(), *pu = previousDir.data();
+	double *q = charge.data(), *E = energy.data(), *l = length.data(), *h = currentStep.data(), *hn = nextStep.data();
+	int *st = status.data();
+	uint64_t *ns = steps.data();
+	uint64_t maxSteps = stepsPerLaunch;
+#if defined(WITH_OFFLOAD) && _OPENMP
+	int dev = (device < 0) ? omp_get_default_device() : device;
+#endif
+
+	// launch until all candidates are stopped, the state stays on the host between launches
+	bool running = m > 0;
+	while (running) {
+#if defined(WITH_OFFLOAD) && _OPENMP
+#pragma omp target teams distribute parallel for device(dev) \
+		map(to: kernel, grid[0:nGrid], modes[0:nModes], conds[0:nConds], q[0:m], E[0:m]) \
+		map(tofrom: x[0:3 * m], u[0:3 * m], px[0:3 * m], pu[0:3 * m], l[0:m], h[0:m], hn[0:m], st[0:m], ns[0:m])
+#elif _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for (size_t j = 0; j < m; j++) {
+			if (st[j] != StatusRunning)
+				continue;
+			Kernel k = kernel;
+			k.grid = grid;
+			k.modes = modes;
+			k.conditions = conds;
+			ns[j] += k.run(x + 3 * j, u + 3 * j, px + 3 * j, pu + 3 * j, q[j], E[j], l[j], h[j], hn[j], st[j],
+					maxSteps);
+		}
+		// the candidates still running have made maxSteps steps
+		running = false;
+		for (size_t j = 0; j < m; j++)
+			running |= status[j] == StatusRunning;
+	}
+
+	// write the states back, repeat the last step of the conditions and
+	// propagate the rest on the host
+	std::vector<char> offloaded(n, 0);
+	for (size_t j = 0; j < m; j++) {
+		offloaded[index[j]] = 1;
+		deviceSteps += steps[j];
+		if (steps[j] == 0)
+			continue;
+		Candidate *c = candidates[index[j]];
+		c->previous = c->current;
+		c->previous.setPosition(Vector3d(previous[3 * j], previous[3 * j + 1], previous[3 * j + 2]));
+		c->previous.setDirection(Vector3d(previousDir[3 * j], previousDir[3 * j + 1], previousDir[3 * j + 2]));
+		c->current.setPosition(Vector3d(pos[3 * j], pos[3 * j + 1], pos[3 * j + 2]));
+		c->current.setDirection(Vector3d(dir[3 * j], dir[3 * j + 1], dir[3 * j + 2]));
+		c->setTrajectoryLength(length[j] - currentStep[j]);
+		c->setCurrentStep(currentStep[j]);
+		c->setNextStep(nextStep[j]);
+	}
+
+#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t j = 0; j < m; j++) {
+		try {
+			if (status[j] == StatusStopped)
+				replay(candidates[index[j]]);
+			modules->run(candidates[index[j]], recursive);
+		} catch (std::exception &e) {
+			std::cerr << "Exception in crpropa::OffloadEngine::run: " << std::endl;
+			std::cerr << e.what() << std::endl;
+		}
+	}
+#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t i = 0; i < n; i++) {
+		if (offloaded[i])
+			continue;
+		try {
+			modules->run(candidates[i], recursive);
+		} catch (std::exception &e) {
+			std::cerr << "Exception in crpropa::OffloadEngine::run: " << std::endl;
+			std::cerr << e.what() << std::endl;
+		}
+	}
+}
+
+void OffloadEngine::run(const ModuleList::candidate_vector_t *candidates, bool recursive) {
+	analyze();
+	if (!isSupported()) {
+		KISS_LOG_WARNING << "OffloadEngine: " << reason << ", running on the host";
+		modules->run(candidates, recursive);
+		return;
+	}
+	deviceSteps = 0;
+	size_t count = candidates->size();
+	std::vector<Candidate *> batch;
+	for (size_t first = 0; first < count; first += batchSize) {
+		size_t n = std::min(batchSize, count - first);
+		batch.resize(n);
+		for (size_t i = 0; i < n; i++)
+			batch[i] = (*candidates)[first + i];
+		runBatch(&batch[0], n, recursive);
+	}
+}
+
+void OffloadEngine::run(SourceInterface *source, size_t count, bool recursive) {
+	analyze();
+	if (!isSupported()) {
+		KISS_LOG_WARNING << "OffloadEngine: " << reason << ", running on the host";
+		modules->run(source, count, recursive);
+		return;
+	}
+	deviceSteps = 0;
+	uint64_t firstStream = Random::reserveStreams(count);
+	std::vector<ref_ptr<Candidate> > refs;
+	std::vector<Candidate *> batch;
+	for (size_t first = 0; first < count; first += batchSize) {
+		size_t n = std::min(batchSize, count - first);
+		refs.assign(n, ref_ptr<Candidate>());
+		batch.resize(n);
+		// the random numbers of a candidate depend on its index only
+#pragma omp parallel for
+		for (size_t i = 0; i < n; i++) {
+			Random::selectStream(firstStream + first + i);
+			refs[i] = source->getCandidate();
+			batch[i] = refs[i];
+		}
+		runBatch(&batch[0], n, recursive);
+	}
+}
+
+std::string OffloadEngine::getDescription() const {
+	std::stringstream ss;
+	ss << "OffloadEngine: " << (scheme ? "PropagationCK" : "PropagationBP") << ", ";
+	ss << ((fieldType == FieldGrid) ? "grid" : ((fieldType == FieldWaves) ? "plane waves" : "no field"));
+	ss << ", " << conditions.size() / conditionSize << " conditions, ";
+	ss << getDeviceCount() << " devices";
+	if (!reason.empty())
+		ss << ", not supported: " << reason;
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,239 @@
+#include "crpropa/OrderedRecords.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+// temporary file in TMPDIR, removed when it is closed
+static std::FILE *createRunFile() {
+#ifndef _WIN32
+	const char *dir = std::getenv("TMPDIR");
+	std::string path = std::string((dir && *dir) ? dir : "/tmp") + "/crpropa-run-XXXXXX";
+	std::vector<char> name(path.begin(), path.end());
+	name.push_back('\0');
+	int fd = mkstemp(&name[0]);
+	if (fd < 0)
+		throw std::runtime_error("OrderedRecords: cannot create a temporary file in " + path);
+	unlink(&name[0]);
+	std::FILE *file = fdopen(fd, "w+b");
+#else
+	std::FILE *file = std::tmpfile();
+#endif
+	if (!file)
+		throw std::runtime_error("OrderedRecords: cannot create a temporary file");
+	return file;
+}
+
+OrderedRecords::OrderedRecords(size_t runSize) : runSize(std::max<size_t>(runSize, 1)) {
+	size_t n = 1;
+#ifdef _OPENMP
+	n = omp_get_max_threads();
+#endif
+	threads.resize(n + 1);
+}
+
+OrderedRecords::~OrderedRecords() {
+	for (size_t i = 0; i < threads.size(); i++)
+		for (size_t j = 0; j < threads[i].runs.size(); j++)
+			std::fclose(threads[i].runs[j].file);
+}
+
+void OrderedRecords::push(uint64_t key, const char *data, size_t size) {
+	push(key, 0, data, size);
+}
+
+void OrderedRecords::push(uint64_t key, uint64_t subkey, const char *data, size_t size) {
+	// only the threads of the outermost OpenMP team have their own buffer,
+	// any other thread might share slot 0 with another one
+	size_t slot = threads.size() - 1;
+#ifdef _OPENMP
+	if (omp_in_parallel() && (omp_get_level() == 1))
+		slot = omp_get_thread_num();
+#endif
+	if (slot + 1 < threads.size()) {
+		add(threads[slot], key, subkey, data, size);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(overflowMutex);
+	add(threads.back(), key, subkey, data, size);
+}
+
+void OrderedRecords::add(Thread &thread, uint64_t key, uint64_t subkey, const char *data, size_t size) {
+	Entry e = {key, subkey, thread.sequence++, thread.data.size(), uint32_t(size)};
+	thread.entries.push_back(e);
+	thread.data.append(data, size);
+	thread.memory.set(thread.data.capacity() + thread.entries.capacity() * sizeof(Entry));
+	// under memory pressure not every record becomes a run of its own
+	if ((thread.entries.size() >= runSize) || (MemoryUsage::isOverLimit()
+			&& (thread.entries.size() >= std::max<size_t>(runSize / 16, 1))))
+		writeRun(thread);
+}
+
+static void writeRecord(std::FILE *file, uint64_t key, uint64_t subkey, uint64_t sequence, const char *data, uint32_t size) {
+	bool ok = (std::fwrite(&key, sizeof(key), 1, file) == 1)
+			&& (std::fwrite(&subkey, sizeof(subkey), 1, file) == 1)
+			&& (std::fwrite(&sequence, sizeof(sequence), 1, file) == 1)
+			&& (std::fwrite(&size, sizeof(size), 1, file) == 1)
+			&& (std::fwrite(data, 1, size, file) == size);
+	if (!ok)
+		throw std::runtime_error("OrderedRecords: cannot write a sorted run");
+}
+
+void OrderedRecords::writeRun(Thread &thread) {
+	if (thread.entries.empty())
+		return;
+	std::sort(thread.entries.begin(), thread.entries.end());
+	Run run = {createRunFile(), thread.entries.size(), 0};
+	thread.runs.push_back(run);
+	for (size_t i = 0; i < thread.entries.size(); i++) {
+		const Entry &e = thread.entries[i];
+		writeRecord(run.file, e.key, e.subkey, e.sequence, &thread.data[e.offset], e.size);
+	}
+	std::fflush(run.file);
+	thread.entries.clear();
+	thread.data.clear();
+	compactRuns(thread);
+}
+
+// runs merged at once, and the most runs of a thread
+static const size_t runFanIn = 8;
+static const size_t maxRuns = 16;
+
+void OrderedRecords::compactRuns(Thread &thread) {
+	std::vector<Run> &runs = thread.runs;
+	// the runs are appended in order, so runs of the same level are at the back
+	while (runs.size() >= runFanIn) {
+		size_t first = runs.size() - runFanIn;
+		bool sameLevel = true;
+		for (size_t i = first; i < runs.size(); i++)
+			sameLevel = sameLevel && (runs[i].level == runs.back().level);
+		if (!sameLevel)
+			break;
+		mergeRuns(thread, first);
+	}
+	if (runs.size() >= maxRuns)
+		mergeRuns(thread, 0);
+}
+
+// current record of a sorted run in a file or in the buffer of a thread
+struct OrderedRecords::Cursor {
+	std::FILE *file;
+	Thread *thread;
+	size_t remaining, next;
+	uint64_t key, subkey, sequence;
+	std::string record;
+
+	bool advance() {
+		if (remaining == 0)
+			return false;
+		remaining--;
+		if (thread) {
+			const Entry &e = thread->entries[next++];
+			key = e.key;
+			subkey = e.subkey;
+			sequence = e.sequence;
+			record.assign(&thread->data[e.offset], e.size);
+			return true;
+		}
+		uint32_t size = 0;
+		bool ok = (std::fread(&key, sizeof(key), 1, file) == 1)
+				&& (std::fread(&subkey, sizeof(subkey), 1, file) == 1)
+				&& (std::fread(&sequence, sizeof(sequence), 1, file) == 1)
+				&& (std::fread(&size, sizeof(size), 1, file) == 1);
+		record.resize(size);
+		if (!ok || ((size > 0) && (std::fread(&record[0], 1, size, file) != size)))
+			throw std::runtime_error("OrderedRecords: cannot read a sorted run");
+		return true;
+	}
+};
+
+void OrderedRecords::mergeCursors(std::vector<Cursor> &cursors,
+		const std::function<void(const Cursor &)> &consumer) {
+	// min-heap of the cursors by key, subkey, sequence and cursor index
+	typedef std::tuple<uint64_t, uint64_t, uint64_t, size_t> Head;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+	for (size_t i = 0; i < cursors.size(); i++)
+		if (cursors[i].advance())
+			heads.push(Head(cursors[i].key, cursors[i].subkey, cursors[i].sequence, i));
+	while (!heads.empty()) {
+		size_t i = std::get<3>(heads.top());
+		heads.pop();
+		consumer(cursors[i]);
+		if (cursors[i].advance())
+			heads.push(Head(cursors[i].key, cursors[i].subkey, cursors[i].sequence, i));
+	}
+}
+
+void OrderedRecords::mergeRuns(Thread &thread, size_t first) {
+	std::vector<Run> &runs = thread.runs;
+	std::vector<Cursor> cursors;
+	Run merged = {createRunFile(), 0, 0};
+	for (size_t i = first; i < runs.size(); i++) {
+		std::rewind(runs[i].file);
+		Cursor c = {runs[i].file, 0, runs[i].count, 0, 0, 0, 0, std::string()};
+		cursors.push_back(c);
+		merged.count += runs[i].count;
+		merged.level = std::max(merged.level, runs[i].level + 1);
+	}
+	mergeCursors(cursors, [&merged](const Cursor &c) {
+		writeRecord(merged.file, c.key, c.subkey, c.sequence, c.record.data(), c.record.size());
+	});
+	std::fflush(merged.file);
+	for (size_t i = first; i < runs.size(); i++)
+		std::fclose(runs[i].file);
+	runs.resize(first);
+	runs.push_back(merged);
+}
+
+size_t OrderedRecords::size() const {
+	size_t n = 0;
+	for (size_t i = 0; i < threads.size(); i++) {
+		n += threads[i].entries.size();
+		for (size_t j = 0; j < threads[i].runs.size(); j++)
+			n += threads[i].runs[j].count;
+	}
+	return n;
+}
+
+void OrderedRecords::merge(const Consumer &consumer) {
+	std::vector<Cursor> cursors;
+	for (size_t i = 0; i < threads.size(); i++) {
+		Thread &t = threads[i];
+		for (size_t j = 0; j < t.runs.size(); j++) {
+			std::rewind(t.runs[j].file);
+			Cursor c = {t.runs[j].file, 0, t.runs[j].count, 0, 0, 0, 0, std::string()};
+			cursors.push_back(c);
+		}
+		std::sort(t.entries.begin(), t.entries.end());
+		Cursor c = {0, &t, t.entries.size(), 0, 0, 0, 0, std::string()};
+		cursors.push_back(c);
+	}
+
+	mergeCursors(cursors, [&consumer](const Cursor &c) {
+		consumer(c.record.data(), c.record.size());
+	});
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		Thread &t = threads[i];
+		for (size_t j = 0; j < t.runs.size(); j++)
+			std::fclose(t.runs[j].file);
+		t.runs.clear();
+		t.entries.clear();
+		t.data.clear();
+		t.memory.set(0);
+	}
+}
+
+} // namespace crpropa
@@ -0,0 +1,74 @@
+#include "crpropa/PagedGrid.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+PagedGridFile::PagedGridFile(const std::string &filename) : fd(-1), length(0) {
+#ifndef _WIN32
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("PagedGrid: could not open file " + filename);
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		throw std::runtime_error("PagedGrid: could not read file " + filename);
+	}
+	length = st.st_size;
+#else
+	in = new std::ifstream(filename.c_str(), std::ios::binary);
+	if (!in->good()) {
+		delete in;
+		throw std::runtime_error("PagedGrid: could not open file " + filename);
+	}
+	in->seekg(0, in->end);
+	length = in->tellg();
+#endif
+}
+
+PagedGridFile::~PagedGridFile() {
+#ifndef _WIN32
+	::close(fd);
+#else
+	delete in;
+#endif
+}
+
+size_t PagedGridFile::size() const {
+	return length;
+}
+
+void PagedGridFile::read(size_t offset, void *buffer, size_t size) {
+	if (offset + size > length)
+		throw std::runtime_error("PagedGrid: read beyond the end of the file");
+#ifndef _WIN32
+	// pread does not move a shared file position and can be called concurrently
+	char *p = static_cast<char *>(buffer);
+	while (size > 0) {
+		ssize_t n = pread(fd, p, size, offset);
+		if (n <= 0)
+			throw std::runtime_error("PagedGrid: could not read from file");
+		p += n;
+		offset += n;
+		size -= n;
+	}
+#else
+	std::lock_guard<std::mutex> lock(inMutex);
+	in->seekg(offset, in->beg);
+	if (!in->read(static_cast<char *>(buffer), size))
+		throw std::runtime_error("PagedGrid: could not read from file");
+#endif
+}
+
+void PagedGridFile::willNeed(size_t offset, size_t size) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+	// only a hint, errors are ignored
+	posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
+} // namespace crpropa
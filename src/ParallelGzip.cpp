@@ -0,0 +1,170 @@
+#include "crpropa/ParallelGzip.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#ifdef CRPROPA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+const size_t dictionarySize = 32768; // window of deflate
+
+#ifdef CRPROPA_HAVE_ZLIB
+ParallelGzipBuffer::Block deflateBlock(std::vector<char> input, std::string dictionary, int level) {
+	ParallelGzipBuffer::Block block;
+	block.size = input.size();
+	block.crc = crc32(0L, (const Bytef *) input.data(), input.size());
+
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	// raw deflate, the gzip header and trailer are written for the whole stream
+	if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("ParallelGzipBuffer: could not initialize zlib");
+	if (!dictionary.empty())
+		deflateSetDictionary(&stream, (const Bytef *) dictionary.data(), dictionary.size());
+
+	// the sync flush ends the block at a byte boundary
+	block.data.resize(deflateBound(&stream, input.size()) + 64);
+	stream.next_in = (Bytef *) input.data();
+	stream.avail_in = input.size();
+	stream.next_out = (Bytef *) &block.data[0];
+	stream.avail_out = block.data.size();
+	int status = deflate(&stream, Z_SYNC_FLUSH);
+	size_t written = block.data.size() - stream.avail_out;
+	deflateEnd(&stream);
+	if ((status != Z_OK) || (stream.avail_in != 0))
+		throw std::runtime_error("ParallelGzipBuffer: compression failed");
+	block.data.resize(written);
+	return block;
+}
+#endif
+
+void writeLittleEndian(std::ostream &out, uint32_t value) {
+	char bytes[4];
+	for (size_t i = 0; i < 4; i++)
+		bytes[i] = char((value >> (8 * i)) & 0xff);
+	out.write(bytes, 4);
+}
+
+} // namespace
+
+ParallelGzipBuffer::ParallelGzipBuffer(std::ostream &out, size_t threads, int level, size_t blockSize) :
+		out(out), threads(threads), level(level), input(std::max(blockSize, dictionarySize)),
+		crc(0), size(0), started(false), closed(false) {
+#ifndef CRPROPA_HAVE_ZLIB
+	throw std::runtime_error("CRPropa was built without Zlib compression!");
+#endif
+	setp(&input[0], &input[0] + input.size());
+}
+
+ParallelGzipBuffer::~ParallelGzipBuffer() {
+	try {
+		close();
+	} catch (std::exception &) {
+	}
+}
+
+void ParallelGzipBuffer::setThreads(size_t n) {
+	threads = n;
+}
+
+size_t ParallelGzipBuffer::getThreads() const {
+	return threads;
+}
+
+int ParallelGzipBuffer::overflow(int c) {
+	if (closed)
+		return traits_type::eof();
+	submit();
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+int ParallelGzipBuffer::sync() {
+	if (closed)
+		return 0;
+	submit();
+	writeReady(0);
+	out.flush();
+	return out.good() ? 0 : -1;
+}
+
+// compress the buffered input as the next block
+void ParallelGzipBuffer::submit() {
+#ifdef CRPROPA_HAVE_ZLIB
+	size_t n = pptr() - pbase();
+	if (n == 0)
+		return;
+	std::vector<char> data(pbase(), pptr());
+	std::string previous = dictionary;
+	size_t keep = std::min(n, dictionarySize);
+	if (keep < dictionarySize)
+		dictionary.append(pptr() - keep, pptr());
+	else
+		dictionary.assign(pptr() - keep, pptr());
+	if (dictionary.size() > dictionarySize)
+		dictionary.erase(0, dictionary.size() - dictionarySize);
+	setp(&input[0], &input[0] + input.size());
+
+	if (threads == 0) {
+		write(deflateBlock(std::move(data), std::move(previous), level));
+		return;
+	}
+	// at most threads blocks in compression
+	writeReady(threads - 1);
+	pending.push_back(std::async(std::launch::async, deflateBlock, std::move(data), std::move(previous), level));
+#endif
+}
+
+// write the finished blocks in order, waiting while more than maxPending are pending
+void ParallelGzipBuffer::writeReady(size_t maxPending) {
+	while (!pending.empty()) {
+		bool ready = pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		if (!ready && (pending.size() <= maxPending))
+			break;
+		Block block = pending.front().get();
+		pending.pop_front();
+		write(block);
+	}
+}
+
+void ParallelGzipBuffer::write(Block block) {
+#ifdef CRPROPA_HAVE_ZLIB
+	if (!started) {
+		// gzip header without name and time
+		const char header[10] = {char(0x1f), char(0x8b), 8, 0, 0, 0, 0, 0, 0, 3};
+		out.write(header, sizeof(header));
+		started = true;
+	}
+	out.write(block.data.data(), block.data.size());
+	crc = crc32_combine(crc, block.crc, block.size);
+	size += block.size;
+#endif
+}
+
+void ParallelGzipBuffer::close() {
+	if (closed)
+		return;
+	submit();
+	writeReady(0);
+	closed = true;
+	write(Block());
+	// empty final block with fixed codes, and the trailer
+	const char last[2] = {3, 0};
+	out.write(last, sizeof(last));
+	writeLittleEndian(out, crc);
+	writeLittleEndian(out, uint32_t(size));
+	out.flush();
+}
+
+} // namespace crpropa
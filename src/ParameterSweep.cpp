@@ -0,0 +1,157 @@
+#include "crpropa/ParameterSweep.h"
+#include "crpropa/ProgressBar.h"
+#include "crpropa/Random.h"
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#ifndef sighandler_t
+typedef void (*sighandler_t)(int);
+#endif
+
+namespace crpropa {
+
+// cancellation of the runs by SIGINT/SIGTERM, see ModuleList.cpp
+extern int g_cancel_signal_flag;
+void g_cancel_signal_callback(int sig);
+
+ParameterSweep::ParameterSweep() : chunkSize(16), showProgress(false) {
+}
+
+size_t ParameterSweep::add(ModuleList *simulation, SourceInterface *source, size_t count) {
+	if (!simulation || !source)
+		throw std::runtime_error("ParameterSweep: a job requires a module list and a source");
+	Job job;
+	job.simulation = simulation;
+	job.source = source;
+	job.count = count;
+	job.time = 0;
+	jobs.push_back(job);
+	return jobs.size() - 1;
+}
+
+size_t ParameterSweep::size() const {
+	return jobs.size();
+}
+
+ref_ptr<ModuleList> ParameterSweep::getSimulation(size_t i) const {
+	if (i >= jobs.size())
+		throw std::runtime_error("ParameterSweep: job index out of range");
+	return jobs[i].simulation;
+}
+
+size_t ParameterSweep::getCount(size_t i) const {
+	if (i >= jobs.size())
+		throw std::runtime_error("ParameterSweep: job index out of range");
+	return jobs[i].count;
+}
+
+double ParameterSweep::getTime(size_t i) const {
+	if (i >= jobs.size())
+		throw std::runtime_error("ParameterSweep: job index out of range");
+	return jobs[i].time;
+}
+
+void ParameterSweep::setChunkSize(size_t size) {
+	chunkSize = std::max(size, (size_t) 1);
+}
+
+size_t ParameterSweep::getChunkSize() const {
+	return chunkSize;
+}
+
+void ParameterSweep::setShowProgress(bool show) {
+	showProgress = show;
+}
+
+void ParameterSweep::run(bool recursive, bool secondariesFirst) {
+	// chunks (job, first candidate) of all jobs, and the streams of the jobs
+	std::vector<std::pair<size_t, size_t> > chunks;
+	std::vector<uint64_t> firstStream(jobs.size());
+	size_t total = 0;
+	for (size_t j = 0; j < jobs.size(); j++) {
+		firstStream[j] = Random::reserveStreams(jobs[j].count);
+		for (size_t first = 0; first < jobs[j].count; first += chunkSize)
+			chunks.push_back(std::make_pair(j, first));
+		total += jobs[j].count;
+		jobs[j].time = 0;
+		// let the profiling module lists know all threads
+		if (jobs[j].simulation->getProfiling())
+			jobs[j].simulation->setProfiling(true);
+	}
+
+#if _OPENMP
+	std::cout << "crpropa::ParameterSweep: " << jobs.size() << " jobs, Number of Threads: "
+		<< omp_get_max_threads() << std::endl;
+#endif
+
+	ProgressBar progressbar(total);
+	if (showProgress) {
+#if _OPENMP
+		progressbar.setThreads(omp_get_max_threads());
+#endif
+		progressbar.start("Run ParameterSweep");
+	}
+
+	g_cancel_signal_flag = 0;
+	sighandler_t old_sigint_handler = ::signal(SIGINT, g_cancel_signal_callback);
+	sighandler_t old_sigterm_handler = ::signal(SIGTERM, g_cancel_signal_callback);
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t c = 0; c < chunks.size(); c++) {
+		if (g_cancel_signal_flag != 0)
+			continue;
+		Job &job = jobs[chunks[c].first];
+		size_t first = chunks[c].second;
+		size_t last = std::min(first + chunkSize, job.count);
+		size_t thread = 0;
+#if _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		ProgressWork work(showProgress ? &progressbar : 0, thread, last - first);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = first; (i < last) && (g_cancel_signal_flag == 0); i++) {
+			// the random numbers of a candidate depend on its index in the job only
+			Random::selectStream(firstStream[chunks[c].first] + i);
+			try {
+				std::vector<ref_ptr<Candidate> > candidates = job.source->getCandidates(std::vector<size_t>(1, i));
+				for (size_t k = 0; k < candidates.size(); k++)
+					job.simulation->run(candidates[k], recursive, secondariesFirst);
+			} catch (std::exception &e) {
+				std::cerr << "Exception in crpropa::ParameterSweep::run: " << std::endl;
+				std::cerr << e.what() << std::endl;
+#pragma omp critical(g_cancel_signal_flag)
+				g_cancel_signal_flag = -1;
+			}
+		}
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#pragma omp atomic
+		job.time += dt;
+	}
+	progressbar.stop();
+
+	::signal(SIGINT, old_sigint_handler);
+	::signal(SIGTERM, old_sigterm_handler);
+	// Propagate signal to old handler.
+	if (g_cancel_signal_flag > 0)
+		raise(g_cancel_signal_flag);
+}
+
+std::string ParameterSweep::getDescription() const {
+	std::stringstream ss;
+	ss << "ParameterSweep: " << jobs.size() << " jobs, chunks of " << chunkSize << " candidates\n";
+	for (size_t j = 0; j < jobs.size(); j++)
+		ss << "  job " << j << ": " << jobs[j].count << " candidates, "
+			<< jobs[j].source->getDescription() << "\n";
+	return ss.str();
+}
+
+} // namespace crpropa
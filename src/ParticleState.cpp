@@ -8,6 +8,7 @@
 
 #include <cstdlib>
 #include <sstream>
+#include <vector>
 
 namespace crpropa {
 
@@ -47,18 +48,120 @@ double ParticleState::getRigidity() const {
 	return fabs(energy / charge);
 }
 
-void ParticleState::setId(int newId) {
-	id = newId;
+namespace {
+
+// mass and charge of a particle id as set by ParticleState::setId
+struct ParticleProperties {
+	double mass;
+	double charge;
+	bool hasMass; ///< false if the state keeps its mass, e.g. for photons
+	bool known; ///< entry of a table filled
+	ParticleProperties() : mass(0), charge(0), hasMass(false), known(false) {
+	}
+};
+
+ParticleProperties computeProperties(int id) {
+	ParticleProperties properties;
+	properties.known = true;
 	if (isNucleus(id)) {
-		pmass = nuclearMass(id);
-		charge = chargeNumber(id) * eplus;
+		properties.mass = nuclearMass(id);
+		properties.hasMass = true;
+		properties.charge = chargeNumber(id) * eplus;
 		if (id < 0)
-			charge *= -1; // anti-nucleus
+			properties.charge *= -1; // anti-nucleus
 	} else {
-		if (abs(id) == 11)
-			pmass = mass_electron;
-		charge = HepPID::charge(id) * eplus;
+		if (abs(id) == 11) {
+			properties.mass = mass_electron;
+			properties.hasMass = true;
+		}
+		properties.charge = HepPID::charge(id) * eplus;
+	}
+	return properties;
+}
+
+// nuclei and anti-nuclei of the nuclear mass table, indexed by Z and N
+class NucleusTable {
+	static const unsigned maxZ = 26, maxN = 30, maxA = 56;
+	std::vector<ParticleProperties> entries;
+	static size_t index(unsigned Z, unsigned N, bool anti) {
+		return 2 * (Z * (maxN + 1) + N) + anti;
+	}
+public:
+	NucleusTable() : entries(2 * (maxZ + 1) * (maxN + 1)) {
+		for (unsigned Z = 0; Z <= maxZ; Z++) {
+			for (unsigned N = 0; N <= maxN; N++) {
+				if ((Z + N < 1) || (Z + N > maxA))
+					continue;
+				int id = nucleusId(Z + N, Z);
+				entries[index(Z, N, false)] = computeProperties(id);
+				entries[index(Z, N, true)] = computeProperties(-id);
+			}
+		}
+	}
+	// NULL for other ids, e.g. isomers or nuclei outside of the mass table
+	static const ParticleProperties *get(int id) {
+		unsigned a = (id < 0) ? 0u - unsigned(id) : unsigned(id);
+		// 100ZZZAAA0 with L = 0 and I = 0
+		if ((a < 1000000000u) || (a >= 1010000000u) || (a % 10 != 0))
+			return 0;
+		unsigned Z = (a / 10000) % 1000, A = (a / 10) % 1000;
+		if ((Z > maxZ) || (A < Z) || (A - Z > maxN) || (A > maxA) || (A < 1))
+			return 0;
+		// filled on the first use, needs the nuclear mass table
+		static const NucleusTable table;
+		const ParticleProperties &properties = table.entries[index(Z, A - Z, id < 0)];
+		return properties.known ? &properties : 0;
+	}
+};
+
+// open addressing hash of the common elementary particles
+class ParticleTable {
+	static const size_t size = 64;
+	int ids[size];
+	ParticleProperties entries[size];
+	static size_t slot(int id) {
+		return (uint32_t(id) * 2654435761u) >> 26;
+	}
+public:
+	ParticleTable() {
+		// without 2112 and 2212, which are nuclei and need the mass table
+		const int common[] = {0, 11, 12, 13, 14, 15, 16, 22, 111, 130, 211, 310, 321};
+		for (size_t i = 0; i < sizeof(common) / sizeof(common[0]); i++) {
+			for (int sign = -1; sign <= 1; sign += 2) {
+				int id = sign * common[i];
+				size_t s = slot(id);
+				while (entries[s].known && (ids[s] != id))
+					s = (s + 1) % size;
+				ids[s] = id;
+				entries[s] = computeProperties(id);
+			}
+		}
+	}
+	static const ParticleProperties *get(int id) {
+		static const ParticleTable table;
+		for (size_t s = slot(id); table.entries[s].known; s = (s + 1) % size)
+			if (table.ids[s] == id)
+				return &table.entries[s];
+		return 0;
+	}
+};
+
+} // namespace
+
+void ParticleState::setId(int newId) {
+	id = newId;
+	// one table read for the common ids, computed for the others
+	const ParticleProperties *properties = NucleusTable::get(id);
+	if (!properties)
+		properties = ParticleTable::get(id);
+	ParticleProperties computed;
+	if (!properties) {
+		computed = computeProperties(id);
+		properties = &computed;
 	}
+	if (properties->hasMass)
+		pmass = properties->mass;
+	charge = properties->charge;
 }
 
 int ParticleState::getId() const {
@@ -0,0 +1,72 @@
+#include "crpropa/ParticleStateBatch.h"
+
+namespace crpropa {
+
+ParticleStateBatch::ParticleStateBatch(size_t n) {
+	resize(n);
+}
+
+void ParticleStateBatch::resize(size_t n) {
+	id.resize(n);
+	charge.resize(n);
+	mass.resize(n);
+	energy.resize(n);
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+	dx.resize(n);
+	dy.resize(n);
+	dz.resize(n);
+}
+
+size_t ParticleStateBatch::size() const {
+	return id.size();
+}
+
+void ParticleStateBatch::load(Candidate **candidates, size_t n) {
+	resize(n);
+	for (size_t i = 0; i < n; i++) {
+		const ParticleState &state = candidates[i]->current;
+		id[i] = state.getId();
+		charge[i] = state.getCharge();
+		mass[i] = state.getMass();
+		energy[i] = state.getEnergy();
+		setPosition(i, state.getPosition());
+		const Vector3d &direction = state.getDirection();
+		dx[i] = direction.x;
+		dy[i] = direction.y;
+		dz[i] = direction.z;
+	}
+}
+
+void ParticleStateBatch::store(Candidate **candidates) const {
+	for (size_t i = 0; i < size(); i++) {
+		ParticleState &state = candidates[i]->current;
+		state.setEnergy(energy[i]);
+		state.setPosition(getPosition(i));
+		state.setDirection(getDirection(i));
+	}
+}
+
+Vector3d ParticleStateBatch::getPosition(size_t i) const {
+	return Vector3d(x[i], y[i], z[i]);
+}
+
+void ParticleStateBatch::setPosition(size_t i, const Vector3d &position) {
+	x[i] = position.x;
+	y[i] = position.y;
+	z[i] = position.z;
+}
+
+Vector3d ParticleStateBatch::getDirection(size_t i) const {
+	return Vector3d(dx[i], dy[i], dz[i]);
+}
+
+void ParticleStateBatch::setDirection(size_t i, const Vector3d &direction) {
+	Vector3d d = direction / direction.getR();
+	dx[i] = d.x;
+	dy[i] = d.y;
+	dz[i] = d.z;
+}
+
+} // namespace crpropa
@@ -0,0 +1,166 @@
+#include "crpropa/PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace crpropa {
+
+namespace {
+
+struct EventType {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+#ifdef __linux__
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_ ## cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+const EventType events[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+	{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+	{"stalled-cycles-backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+	{"L1-dcache-load-misses", PERF_TYPE_HW_CACHE, CACHE_MISS(L1D)},
+	{"LLC-load-misses", PERF_TYPE_HW_CACHE, CACHE_MISS(LL)},
+	{"dTLB-load-misses", PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB)},
+	{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	{"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}
+};
+const size_t nEvents = sizeof(events) / sizeof(events[0]);
+
+#undef CACHE_MISS
+#endif
+
+// type and config of an event name, false if unknown
+bool lookup(const std::string &name, uint32_t &type, uint64_t &config) {
+#ifdef __linux__
+	if (name.compare(0, 4, "raw:") == 0) {
+		char *end = 0;
+		config = std::strtoull(name.c_str() + 4, &end, 0);
+		type = PERF_TYPE_RAW;
+		return (end != name.c_str() + 4) && (*end == 0);
+	}
+	for (size_t i = 0; i < nEvents; i++) {
+		if (name == events[i].name) {
+			type = events[i].type;
+			config = events[i].config;
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+} // namespace
+
+PerfCounters::PerfCounters() {
+}
+
+PerfCounters::~PerfCounters() {
+	close();
+}
+
+bool PerfCounters::open(const std::vector<std::string> &eventNames, std::string &error) {
+	close();
+#ifdef __linux__
+	if (eventNames.size() > maxCounters) {
+		error = "too many counters";
+		return false;
+	}
+	for (size_t i = 0; i < eventNames.size(); i++) {
+		struct perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		uint32_t type;
+		uint64_t config;
+		if (!lookup(eventNames[i], type, config)) {
+			error = "unknown counter " + eventNames[i];
+			close();
+			return false;
+		}
+		attr.type = type;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		int group = fds.empty() ? -1 : fds[0];
+		int fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+		if (fd < 0) {
+			error = eventNames[i] + ": " + std::strerror(errno);
+			close();
+			return false;
+		}
+		fds.push_back(fd);
+	}
+	names = eventNames;
+	return true;
+#else
+	error = "performance counters are only available on Linux";
+	return false;
+#endif
+}
+
+void PerfCounters::close() {
+#ifdef __linux__
+	for (size_t i = fds.size(); i > 0; i--)
+		::close(fds[i - 1]);
+#endif
+	fds.clear();
+	names.clear();
+}
+
+bool PerfCounters::isOpen() const {
+	return !fds.empty();
+}
+
+size_t PerfCounters::size() const {
+	return fds.size();
+}
+
+const std::vector<std::string> &PerfCounters::getNames() const {
+	return names;
+}
+
+void PerfCounters::read(uint64_t *values) const {
+	uint64_t buffer[maxCounters + 1] = {};
+	size_t n = fds.size();
+#ifdef __linux__
+	ssize_t r = fds.empty() ? 0 : ::read(fds[0], buffer, (n + 1) * sizeof(uint64_t));
+	if ((r == ssize_t((n + 1) * sizeof(uint64_t))) && (buffer[0] == n)) {
+		for (size_t i = 0; i < n; i++)
+			values[i] = buffer[i + 1];
+		return;
+	}
+#endif
+	for (size_t i = 0; i < n; i++)
+		values[i] = 0;
+}
+
+bool PerfCounters::isKnown(const std::string &name) {
+	uint32_t type;
+	uint64_t config;
+	return lookup(name, type, config);
+}
+
+std::vector<std::string> PerfCounters::getKnownNames() {
+	std::vector<std::string> names;
+#ifdef __linux__
+	for (size_t i = 0; i < nEvents; i++)
+		names.push_back(events[i].name);
+#endif
+	return names;
+}
+
+} // namespace crpropa
@@ -5,6 +5,7 @@
 #include "kiss/logger.h"
 
 #include <fstream>
+#include <algorithm>
 #include <stdexcept>
 #include <limits>
 #include <cmath>
@@ -21,11 +22,37 @@ TabularPhotonField::TabularPhotonField(std::string fieldName, bool isRedshiftDep
 		readRedshift(getDataPath("") + "Scaling/" + this->fieldName + "_redshift.txt");
 
 	checkInputData();
+	initEnergyIndex();
 
 	if (this->isRedshiftDependent)
 		initRedshiftScaling();
 }
 
+TabularPhotonField::TabularPhotonField(std::string fieldName, const std::vector<double> &photonEnergies,
+		const std::vector<double> &photonDensity, const std::vector<double> &redshifts) :
+		photonEnergies(photonEnergies), photonDensity(photonDensity), redshifts(redshifts) {
+	this->fieldName = fieldName;
+	this->isRedshiftDependent = !redshifts.empty();
+
+	checkInputData();
+	initEnergyIndex();
+
+	if (this->isRedshiftDependent)
+		initRedshiftScaling();
+}
+
+const std::vector<double> &TabularPhotonField::getPhotonEnergies() const {
+	return photonEnergies;
+}
+
+const std::vector<double> &TabularPhotonField::getPhotonDensities() const {
+	return photonDensity;
+}
+
+const std::vector<double> &TabularPhotonField::getRedshifts() const {
+	return redshifts;
+}
+
 
 double TabularPhotonField::getPhotonDensity(double Ephoton, double z) const {	
 	if ((this->isRedshiftDependent)) {
@@ -38,26 +65,76 @@ double TabularPhotonField::getPhotonDensity(double Ephoton, double z) const {
 				KISS_LOG_WARNING << "Photon Field " << fieldName << " uses FutureRedshift with z < -1. The photon density is set to n(Ephoton, z=0). \n";
 			}
 			return getPhotonDensity(Ephoton, zMin);
-		} else {
-			return interpolate2d(Ephoton, z, this->photonEnergies, this->redshifts, this->photonDensity);
 		}
+		// zero outside of the table, as in interpolate2d
+		if ((z > this->redshifts.back()) or (Ephoton < this->photonEnergies.front()) or (Ephoton > this->photonEnergies.back()))
+			return 0;
+
+		bool valid;
+		std::vector<double> &slice = densityCache.get(z, valid);
+		if (not valid) {
+			size_t nz = this->redshifts.size();
+			static thread_local size_t hint = 0;
+			size_t j = huntUpperBound(z, this->redshifts, hint);
+			j = std::min(std::max(j, size_t(1)), nz - 1) - 1;
+			double f = (z - this->redshifts[j]) / (this->redshifts[j + 1] - this->redshifts[j]);
+			slice.resize(this->photonEnergies.size());
+			for (size_t i = 0; i < slice.size(); i++) {
+				const double *row = &this->photonDensity[i * nz + j];
+				slice[i] = (1 - f) * row[0] + f * row[1];
+			}
+		}
+		return interpolateEnergy(Ephoton, &slice[0]);
 	} else {
-		return interpolate(Ephoton, this->photonEnergies, this->photonDensity);
+		if (Ephoton <= this->photonEnergies.front())
+			return this->photonDensity.front();
+		if (Ephoton >= this->photonEnergies.back())
+			return this->photonDensity.back();
+		return interpolateEnergy(Ephoton, &this->photonDensity[0]);
 	}
 }
 
+size_t TabularPhotonField::energyInterval(double E) const {
+	double p = (std::log(E) - logEnergyMin) / logEnergyStep;
+	size_t k = (p > 0) ? std::min(size_t(p), energyIndex.size() - 1) : 0;
+	size_t i = energyIndex[k];
+	// correct for rounding at the edges of the index bins
+	while ((i > 0) and (this->photonEnergies[i] > E))
+		i--;
+	while ((i + 2 < this->photonEnergies.size()) and (this->photonEnergies[i + 1] <= E))
+		i++;
+	return i;
+}
+
+double TabularPhotonField::interpolateEnergy(double E, const double *density) const {
+	size_t i = energyInterval(E);
+	double e0 = this->photonEnergies[i];
+	double e1 = this->photonEnergies[i + 1];
+	double n0 = density[i];
+	double n1 = density[i + 1];
+	return n0 + (E - e0) * (n1 - n0) / (e1 - e0);
+}
 
 double TabularPhotonField::getRedshiftScaling(double z) const {
 	if (!this->isRedshiftDependent)
 		return 1.;
- 
+
+	bool valid;
+	std::vector<double> &cached = scalingCache.get(z, valid);
+	if (valid)
+		return cached[0];
+
+	double scaling;
 	if (z < this->redshifts.front())
-		return 1.;
- 
-	if (z > this->redshifts.back())
-		return 0.;
- 
-	return interpolate(z, this->redshifts, this->redshiftScalings);
+		scaling = 1.;
+	else if (z > this->redshifts.back())
+		scaling = 0.;
+	else {
+		static thread_local size_t hint = 0;
+		scaling = interpolate(z, this->redshifts, this->redshiftScalings, hint);
+	}
+	cached.assign(1, scaling);
+	return scaling;
 }
 
 double TabularPhotonField::getMinimumPhotonEnergy(double z) const{
@@ -124,6 +201,23 @@ void TabularPhotonField::initRedshiftScaling() {
 	}
 }
 
+void TabularPhotonField::initEnergyIndex() {
+	// a few index bins per tabulated energy; each bin points to the interval
+	// containing its lower edge
+	size_t n = this->photonEnergies.size();
+	size_t nIndex = 4 * n;
+	logEnergyMin = std::log(this->photonEnergies.front());
+	logEnergyStep = (std::log(this->photonEnergies.back()) - logEnergyMin) / nIndex;
+	energyIndex.resize(nIndex);
+	size_t i = 0;
+	for (size_t k = 0; k < nIndex; k++) {
+		double E = std::exp(logEnergyMin + k * logEnergyStep);
+		while ((i + 2 < n) and (this->photonEnergies[i + 1] <= E))
+			i++;
+		energyIndex[k] = i;
+	}
+}
+
 void TabularPhotonField::checkInputData() const {
 	if (this->isRedshiftDependent) {
 		if (this->photonDensity.size() != this->photonEnergies.size() * this-> redshifts.size())
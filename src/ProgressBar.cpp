@@ -1,77 +1,217 @@
 #include "crpropa/ProgressBar.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
 
 namespace crpropa {
 
-/// Initialize a ProgressBar with [steps] number of steps, updated at [updateSteps] intervalls
+namespace {
+
+enum State {
+	Running, Finished, Stopped, Error
+};
+
+const char *stateNames[] = {"running", "finished", "stopped", "error"};
+
+// hh:mm:ss of a duration in seconds
+std::string formatDuration(double seconds) {
+	int t = int(std::max(seconds, 0.));
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%02i:%02i:%02i", t / 3600, (t % 3600) / 60, t % 60);
+	return buffer;
+}
+
+std::string formatRate(double rate) {
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.3g", rate);
+	return buffer;
+}
+
+} // namespace
+
+/// Initialize a ProgressBar with [steps] number of steps
 ProgressBar::ProgressBar(unsigned long steps, unsigned long updateSteps) :
-		_steps(steps), _currentCount(0), _maxbarLength(10), _updateSteps(
-				updateSteps), _nextStep(1), _startTime(0) {
-	if (_updateSteps > _steps)
-		_updateSteps = _steps;
-	arrow.append(">");
+		_steps(steps), _currentCount(0), _maxbarLength(10), _nThreads(1),
+		_threads(new ThreadSlot[1]), _startTime(0), _interval(-1),
+		_started(false), _finished(false), _stopping(false) {
+	_lines = !isatty(fileno(stdout));
+	const char *format = std::getenv("CRPROPA_PROGRESS");
+	if (format && (std::string(format) == "lines"))
+		_lines = true;
+	if (format && (std::string(format) == "bar"))
+		_lines = false;
+}
+
+ProgressBar::~ProgressBar() {
+	stop();
+}
+
+void ProgressBar::setThreads(size_t n) {
+	_nThreads = std::max(n, (size_t) 1);
+	_threads.reset(new ThreadSlot[_nThreads]);
+}
+
+void ProgressBar::setInterval(double seconds) {
+	_interval = seconds;
+}
+
+void ProgressBar::setMachineReadable(bool lines) {
+	_lines = lines;
+}
+
+bool ProgressBar::getMachineReadable() const {
+	return _lines;
 }
 
 void ProgressBar::start(const std::string &title) {
 	_startTime = time(NULL);
+	_startClock = std::chrono::steady_clock::now();
 	std::string s = ctime(&_startTime);
 	s.erase(s.end() - 1, s.end());
-	stringTmpl = "  Started ";
-	stringTmpl.append(s);
-	stringTmpl.append(" : [%-10s] %3i%%    %s: %02i:%02i:%02i %s\r");
+	_title = "  Started " + s;
 	std::cout << title << std::endl;
 
+	if (_interval <= 0)
+		_interval = _lines ? 60 : 1;
+	_started = true;
+	_timer = std::thread(&ProgressBar::runTimer, this);
 }
+
+void ProgressBar::runTimer() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stopping) {
+		_wake.wait_for(lock, std::chrono::duration<double>(_interval));
+		if (!_stopping)
+			draw(false);
+	}
+}
+
 /// update the progressbar
 /// should be called steps times in a loop
-void ProgressBar::update() {
-	_currentCount++;
-	if (_currentCount == _nextStep || _currentCount == _steps
-			|| _currentCount == 1000) {
-				_nextStep += long(_steps / float(_updateSteps));
-			setPosition(_currentCount);
-			}
+void ProgressBar::update(unsigned long n) {
+	_currentCount.fetch_add(n, std::memory_order_relaxed);
 }
 
-void ProgressBar::setPosition(unsigned long position) {
-	int percentage = int(100 * (position / float(_steps)));
-	time_t currentTime = time(NULL);
-	if (position < _steps) {
-		if (arrow.size() <= (_maxbarLength) * (position) / (_steps))
-			arrow.insert(0, "=");
-		float tElapsed = currentTime - _startTime;
-		float tToGo = (_steps - position) * tElapsed / position;
-		std::printf(stringTmpl.c_str(), arrow.c_str(), percentage, "Finish in",
-				int(tToGo / 3600), (int(tToGo) % 3600) / 60,
-				int(tToGo) % 60, "");
+void ProgressBar::addThreadWork(size_t thread, uint64_t steps, double busy) {
+	if (thread >= _nThreads)
+		return;
+	ThreadSlot &slot = _threads[thread];
+	slot.steps.store(slot.steps.load(std::memory_order_relaxed) + steps, std::memory_order_relaxed);
+	slot.busy.store(slot.busy.load(std::memory_order_relaxed) + busy, std::memory_order_relaxed);
+}
+
+void ProgressBar::stop() {
+	finish(false);
+}
+
+// stop the timer thread and draw the final state once
+void ProgressBar::finish(bool error) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_started || _finished)
+			return;
+		_stopping = true;
+	}
+	_wake.notify_all();
+	if (_timer.joinable())
+		_timer.join();
+	std::lock_guard<std::mutex> lock(_mutex);
+	draw(true, error);
+	_finished = true;
+}
+
+std::string ProgressBar::getProgressLine() {
+	unsigned long done = _currentCount.load(std::memory_order_relaxed);
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _startClock).count();
+	uint64_t steps = 0;
+	for (size_t i = 0; i < _nThreads; i++)
+		steps += _threads[i].steps.load(std::memory_order_relaxed);
+	double rate = (elapsed > 0) ? done / elapsed : 0;
+
+	std::stringstream ss;
+	ss << "crpropa::progress done=" << done << " total=" << _steps;
+	char percent[32];
+	std::snprintf(percent, sizeof(percent), "%.1f", _steps ? 100. * done / _steps : 100.);
+	ss << " percent=" << percent << " elapsed=" << int(elapsed);
+	if (rate > 0)
+		ss << " eta=" << int((_steps > done ? _steps - done : 0) / rate);
+	ss << " rate=" << formatRate(rate) << " steps_rate=" << formatRate((elapsed > 0) ? steps / elapsed : 0);
+	ss << " busy=";
+	for (size_t i = 0; i < _nThreads; i++) {
+		double busy = (elapsed > 0) ? _threads[i].busy.load(std::memory_order_relaxed) / elapsed : 0;
+		char fraction[16];
+		std::snprintf(fraction, sizeof(fraction), "%.2f", std::min(busy, 1.));
+		ss << (i ? "," : "") << fraction;
+	}
+	return ss.str();
+}
+
+// called with the mutex held
+void ProgressBar::draw(bool final, bool error) {
+	unsigned long done = _currentCount.load(std::memory_order_relaxed);
+	State state = error ? Error : (final ? ((done >= _steps) ? Finished : Stopped) : Running);
+
+	if (_lines) {
+		std::printf("%s state=%s\n", getProgressLine().c_str(), stateNames[state]);
 		fflush(stdout);
+		return;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _startClock).count();
+	uint64_t steps = 0;
+	double busy = 0;
+	for (size_t i = 0; i < _nThreads; i++) {
+		steps += _threads[i].steps.load(std::memory_order_relaxed);
+		busy += _threads[i].busy.load(std::memory_order_relaxed);
+	}
+	double rate = (elapsed > 0) ? done / elapsed : 0;
+	double stepsRate = (elapsed > 0) ? steps / elapsed : 0;
+	int busyPercent = (elapsed > 0) ? int(std::min(100 * busy / (elapsed * _nThreads), 100.)) : 0;
+	int percentage = _steps ? int(100 * (std::min(done, _steps) / float(_steps))) : 100;
+
+	std::string bar;
+	if (state == Running || state == Stopped) {
+		size_t length = _steps ? _maxbarLength * std::min(done, _steps) / _steps : _maxbarLength;
+		bar = std::string(std::min(length, _maxbarLength - 1), '=') + ">";
 	} else {
-		float tElapsed = currentTime - _startTime;
-		std::string s = " - Finished at ";
-		s.append(ctime(&currentTime));
 		char fs[255];
-		std::sprintf(fs, "%c[%d;%dm Finished %c[%dm", 27, 1, 32, 27, 0);
-		std::printf(stringTmpl.c_str(), fs, 100, "Needed",
-				int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
-				int(tElapsed) % 60, s.c_str());
+		if (state == Finished)
+			std::sprintf(fs, "%c[%d;%dm Finished %c[%dm", 27, 1, 32, 27, 0);
+		else
+			std::sprintf(fs, "%c[%d;%dm  ERROR   %c[%dm", 27, 1, 31, 27, 0);
+		bar = fs;
 	}
+
+	std::string timing;
+	if (state == Running) {
+		timing = "Finish in: " + (rate > 0 ? formatDuration((_steps - std::min(done, _steps)) / rate) : std::string("--:--:--"));
+	} else {
+		time_t currentTime = time(NULL);
+		timing = "Needed: " + formatDuration(elapsed) + " - Finished at " + ctime(&currentTime);
+		timing.erase(timing.end() - 1, timing.end());
+	}
+
+	std::printf("%s : [%-10s] %3i%%  %s/s  %s steps/s  busy %3i%%  %s%s", _title.c_str(), bar.c_str(),
+			percentage, formatRate(rate).c_str(), formatRate(stepsRate).c_str(), busyPercent,
+			timing.c_str(), (state == Running) ? "   \r" : "\n");
+	fflush(stdout);
 }
 
+void ProgressBar::setPosition(unsigned long position) {
+	_currentCount.store(position, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_started && !_finished)
+		draw(false);
+}
 
 /// Mark the progressbar with an error
 void ProgressBar::setError() {
-	time_t currentTime = time(NULL);
-	_currentCount++;
-	float tElapsed = currentTime - _startTime;
-	std::string s = " - Finished at ";
-	s.append(ctime(&currentTime));
-	char fs[255];
-	std::sprintf(fs, "%c[%d;%dm  ERROR   %c[%dm", 27, 1, 31, 27, 0);
-	std::printf(stringTmpl.c_str(), fs, _currentCount, "Needed",
-			int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
-			int(tElapsed) % 60, s.c_str());
+	finish(true);
 }
 
 } // namespace crpropa
@@ -0,0 +1,383 @@
+#include "crpropa/PropagationResponse.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/SymbolTable.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+static const char magic[8] = {'C', 'R', 'P', 'R', 'E', 'S', 'P', '1'};
+
+// property with the injection bin of the candidates of compute(), inherited by the secondaries
+static Symbol responseBinKey() {
+	static const Symbol key = SymbolTable::intern("ResponseBin");
+	return key;
+}
+
+template<typename T>
+static void writeVector(std::ostream &out, const std::vector<T> &v) {
+	uint64_t n = v.size();
+	out.write((const char *) &n, sizeof(n));
+	if (n > 0)
+		out.write((const char *) &v[0], n * sizeof(T));
+}
+
+template<typename T>
+static void readVector(std::istream &in, std::vector<T> &v) {
+	uint64_t n = 0;
+	in.read((char *) &n, sizeof(n));
+	v.resize(n);
+	if (n > 0)
+		in.read((char *) &v[0], n * sizeof(T));
+}
+
+// integral of E^index from a to b
+static double powerLawIntegral(double a, double b, double index) {
+	if (b <= a)
+		return 0;
+	double s = 1 + index;
+	if (std::abs(s) < std::numeric_limits<double>::min())
+		return log(b / a);
+	return (pow(b, s) - pow(a, s)) / s;
+}
+
+PropagationResponse::PropagationResponse(double Emin, double Emax, size_t energyBins, double zmin, double zmax, size_t redshiftBins) :
+		Emin(Emin), Emax(Emax), zmin(zmin), zmax(zmax), arrivalEmin(Emin), arrivalEmax(Emax),
+		energyBins(energyBins), redshiftBins(redshiftBins), arrivalBins(energyBins), count(0) {
+	if (Emin <= 0 || Emax <= Emin || energyBins == 0)
+		throw std::runtime_error("PropagationResponse: invalid energy bins");
+	if (zmin < 0 || zmax < zmin || redshiftBins == 0)
+		throw std::runtime_error("PropagationResponse: invalid redshift bins");
+	setDescription("PropagationResponse");
+}
+
+void PropagationResponse::addSpecies(int id) {
+	if (std::find(species.begin(), species.end(), id) != species.end())
+		throw std::runtime_error("PropagationResponse: species added twice");
+	clear();
+	species.push_back(id);
+}
+
+std::vector<int> PropagationResponse::getSpecies() const {
+	return species;
+}
+
+void PropagationResponse::setArrivalEnergyBins(double Emin, double Emax, size_t bins) {
+	if (Emin <= 0 || Emax <= Emin || bins == 0)
+		throw std::runtime_error("PropagationResponse: invalid arrival energy bins");
+	clear();
+	arrivalEmin = Emin;
+	arrivalEmax = Emax;
+	arrivalBins = bins;
+}
+
+size_t PropagationResponse::getEnergyBins() const {
+	return energyBins;
+}
+
+double PropagationResponse::getEnergyEdge(size_t i) const {
+	return Emin * pow(Emax / Emin, double(i) / energyBins);
+}
+
+size_t PropagationResponse::getRedshiftBins() const {
+	return redshiftBins;
+}
+
+double PropagationResponse::getRedshiftEdge(size_t i) const {
+	return zmin + (zmax - zmin) * i / redshiftBins;
+}
+
+size_t PropagationResponse::getArrivalEnergyBins() const {
+	return arrivalBins;
+}
+
+double PropagationResponse::getArrivalEnergyEdge(size_t i) const {
+	return arrivalEmin * pow(arrivalEmax / arrivalEmin, double(i) / arrivalBins);
+}
+
+size_t PropagationResponse::getInjectionSize() const {
+	return species.size() * energyBins * redshiftBins;
+}
+
+size_t PropagationResponse::getInjectionIndex(size_t s, size_t energyBin, size_t redshiftBin) const {
+	return (s * energyBins + energyBin) * redshiftBins + redshiftBin;
+}
+
+std::vector<int> PropagationResponse::getArrivalIds() const {
+	return arrivalIds;
+}
+
+size_t PropagationResponse::getEntryCount() const {
+	return values.size();
+}
+
+double PropagationResponse::getResponse(size_t injection, int arrivalId, size_t arrivalEnergyBin) const {
+	if (injection + 1 >= offsets.size() || arrivalEnergyBin >= arrivalBins)
+		return 0;
+	std::vector<int>::const_iterator a = std::find(arrivalIds.begin(), arrivalIds.end(), arrivalId);
+	if (a == arrivalIds.end())
+		return 0;
+	size_t column = (a - arrivalIds.begin()) * arrivalBins + arrivalEnergyBin;
+	std::vector<size_t>::const_iterator first = columns.begin() + offsets[injection];
+	std::vector<size_t>::const_iterator last = columns.begin() + offsets[injection + 1];
+	std::vector<size_t>::const_iterator c = std::lower_bound(first, last, column);
+	if (c == last || *c != column)
+		return 0;
+	return values[c - columns.begin()];
+}
+
+void PropagationResponse::compute(ModuleList *simulation, size_t count, bool recursive) {
+	if (species.empty())
+		throw std::runtime_error("PropagationResponse: no species added");
+	if (count == 0)
+		throw std::runtime_error("PropagationResponse: no candidates per bin");
+	clear();
+	this->count = count;
+
+	Random &random = Random::instance();
+	for (size_t s = 0; s < species.size(); s++) {
+		for (size_t iz = 0; iz < redshiftBins; iz++) {
+			// all energy bins of a species and redshift bin in one run
+			ModuleList::candidate_vector_t candidates;
+			candidates.reserve(energyBins * count);
+			for (size_t ie = 0; ie < energyBins; ie++) {
+				double lo = getEnergyEdge(ie), hi = getEnergyEdge(ie + 1);
+				uint64_t row = getInjectionIndex(s, ie, iz);
+				for (size_t i = 0; i < count; i++) {
+					double E = lo * pow(hi / lo, random.rand());
+					double z = random.randUniform(getRedshiftEdge(iz), getRedshiftEdge(iz + 1));
+					Vector3d position(redshift2ComovingDistance(z), 0, 0);
+					ref_ptr<Candidate> candidate = new Candidate(species[s], E, position, Vector3d(-1, 0, 0), z);
+					candidate->setProperty(responseBinKey(), Variant(row));
+					candidates.push_back(candidate);
+				}
+			}
+			simulation->run(&candidates, recursive);
+		}
+	}
+	finalize();
+}
+
+void PropagationResponse::process(Candidate *candidate) const {
+	const Variant *bin = candidate->findProperty(responseBinKey());
+	if (!bin)
+		return;
+	double E = candidate->current.getEnergy();
+	if (E < arrivalEmin || E >= arrivalEmax)
+		return;
+	size_t ie = std::min(size_t(log(E / arrivalEmin) / log(arrivalEmax / arrivalEmin) * arrivalBins), arrivalBins - 1);
+	size_t row = bin->toUInt64();
+	int id = candidate->current.getId();
+
+#pragma omp critical(PropagationResponse)
+	{
+		size_t a = std::find(arrivalIds.begin(), arrivalIds.end(), id) - arrivalIds.begin();
+		if (a == arrivalIds.size())
+			arrivalIds.push_back(id);
+		pending[std::make_pair(row, a * arrivalBins + ie)] += candidate->getWeight();
+	}
+}
+
+void PropagationResponse::clear() {
+	count = 0;
+	offsets.clear();
+	columns.clear();
+	values.clear();
+	arrivalIds.clear();
+	pending.clear();
+}
+
+void PropagationResponse::finalize() {
+	// the map is ordered by row and column
+	size_t rows = getInjectionSize();
+	offsets.assign(rows + 1, 0);
+	columns.clear();
+	values.clear();
+	columns.reserve(pending.size());
+	values.reserve(pending.size());
+	std::map<std::pair<size_t, size_t>, double>::const_iterator i;
+	for (i = pending.begin(); i != pending.end(); ++i) {
+		offsets[i->first.first + 1]++;
+		columns.push_back(i->first.second);
+		values.push_back(i->second / count);
+	}
+	for (size_t r = 0; r < rows; r++)
+		offsets[r + 1] += offsets[r];
+	pending.clear();
+}
+
+std::vector<double> PropagationResponse::convolve(const std::vector<double> &weights) const {
+	if (offsets.empty())
+		throw std::runtime_error("PropagationResponse: no response computed");
+	if (weights.size() != getInjectionSize())
+		throw std::runtime_error("PropagationResponse: number of weights differs from the number of injection bins");
+	std::vector<double> spectra(arrivalIds.size() * arrivalBins, 0.);
+	for (size_t r = 0; r < weights.size(); r++) {
+		double w = weights[r];
+		if (w == 0)
+			continue;
+		for (size_t j = offsets[r]; j < offsets[r + 1]; j++)
+			spectra[columns[j]] += w * values[j];
+	}
+	return spectra;
+}
+
+std::vector<double> PropagationResponse::getRedshiftWeights(double m) const {
+	// integrals of (1 + z)^m over the bins as in SourceRedshiftEvolution
+	std::vector<double> w(redshiftBins);
+	for (size_t iz = 0; iz < redshiftBins; iz++)
+		w[iz] = powerLawIntegral(1 + getRedshiftEdge(iz), 1 + getRedshiftEdge(iz + 1), m);
+	if (zmax == zmin)
+		w[0] = 1;
+	return w;
+}
+
+std::vector<double> PropagationResponse::getInjectionWeights(const std::vector<double> &abundances, double Rmax, double index, double m) const {
+	if (abundances.size() != species.size())
+		throw std::runtime_error("PropagationResponse: number of abundances differs from the number of species");
+	std::vector<double> zw = getRedshiftWeights(m);
+	std::vector<double> weights(getInjectionSize(), 0.);
+	double sum = 0;
+	for (size_t s = 0; s < species.size(); s++) {
+		// as SourceComposition::add, A and Z of at least 1 for the elementary particles
+		int A = std::max(massNumber(species[s]), 1);
+		int Z = std::max(std::abs(chargeNumber(species[s])), 1);
+		double abundance = abundances[s] * pow(A, -(1 + index));
+		for (size_t ie = 0; ie < energyBins; ie++) {
+			double e = abundance * powerLawIntegral(getEnergyEdge(ie), std::min(getEnergyEdge(ie + 1), Z * Rmax), index);
+			for (size_t iz = 0; iz < redshiftBins; iz++) {
+				double w = e * zw[iz];
+				weights[getInjectionIndex(s, ie, iz)] = w;
+				sum += w;
+			}
+		}
+	}
+	if (sum > 0)
+		for (size_t i = 0; i < weights.size(); i++)
+			weights[i] /= sum;
+	return weights;
+}
+
+#ifdef CRPROPA_HAVE_MUPARSER
+// cumulative distribution at E, linear between the edges
+static double interpolateCDF(const std::vector<double> &energy, const std::vector<double> &cdf, double E) {
+	if (E <= energy.front())
+		return cdf.front();
+	if (E >= energy.back())
+		return cdf.back();
+	size_t i = std::upper_bound(energy.begin(), energy.end(), E) - energy.begin();
+	double f = (E - energy[i - 1]) / (energy[i] - energy[i - 1]);
+	return cdf[i - 1] + f * (cdf[i] - cdf[i - 1]);
+}
+
+std::vector<double> PropagationResponse::getInjectionWeights(const SourceGenericComposition &composition, double m) const {
+	const std::vector<SourceGenericComposition::Nucleus> &nuclei = composition.getNuclei();
+	const std::vector<double> &cdf = composition.getCDF();
+	const std::vector<double> &energy = composition.getEnergies();
+	if (nuclei.empty() || cdf.back() <= 0)
+		throw std::runtime_error("PropagationResponse: no nuclei in the composition");
+	std::vector<double> zw = getRedshiftWeights(m);
+	double znorm = 0;
+	for (size_t iz = 0; iz < redshiftBins; iz++)
+		znorm += zw[iz];
+
+	std::vector<double> weights(getInjectionSize(), 0.);
+	for (size_t iN = 0; iN < nuclei.size(); iN++) {
+		const SourceGenericComposition::Nucleus &n = nuclei[iN];
+		size_t s = std::find(species.begin(), species.end(), n.id) - species.begin();
+		if (s == species.size())
+			throw std::runtime_error("PropagationResponse: nucleus of the composition is no species of the response");
+		double total = n.cdf.back();
+		if (total <= 0)
+			continue;
+		double abundance = (cdf[iN] - (iN > 0 ? cdf[iN - 1] : 0)) / cdf.back() / total / znorm;
+		for (size_t ie = 0; ie < energyBins; ie++) {
+			double e = abundance * (interpolateCDF(energy, n.cdf, getEnergyEdge(ie + 1))
+					- interpolateCDF(energy, n.cdf, getEnergyEdge(ie)));
+			for (size_t iz = 0; iz < redshiftBins; iz++)
+				weights[getInjectionIndex(s, ie, iz)] = e * zw[iz];
+		}
+	}
+	return weights;
+}
+#endif
+
+void PropagationResponse::save(const std::string &filename) const {
+	if (offsets.empty())
+		throw std::runtime_error("PropagationResponse: no response computed");
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out)
+		throw std::runtime_error("PropagationResponse: could not open " + filename);
+	out.write(magic, sizeof(magic));
+	double bounds[6] = {Emin, Emax, zmin, zmax, arrivalEmin, arrivalEmax};
+	out.write((const char *) bounds, sizeof(bounds));
+	uint64_t sizes[4] = {energyBins, redshiftBins, arrivalBins, count};
+	out.write((const char *) sizes, sizeof(sizes));
+	writeVector(out, species);
+	writeVector(out, arrivalIds);
+	std::vector<uint64_t> o(offsets.begin(), offsets.end());
+	std::vector<uint64_t> c(columns.begin(), columns.end());
+	writeVector(out, o);
+	writeVector(out, c);
+	writeVector(out, values);
+	if (!out)
+		throw std::runtime_error("PropagationResponse: could not write " + filename);
+}
+
+void PropagationResponse::load(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in)
+		throw std::runtime_error("PropagationResponse: could not open " + filename);
+	char m[8];
+	in.read(m, sizeof(m));
+	if (!in || memcmp(m, magic, sizeof(magic)) != 0)
+		throw std::runtime_error("PropagationResponse: " + filename + " is no response file");
+	double bounds[6];
+	in.read((char *) bounds, sizeof(bounds));
+	uint64_t sizes[4];
+	in.read((char *) sizes, sizeof(sizes));
+	clear();
+	readVector(in, species);
+	readVector(in, arrivalIds);
+	std::vector<uint64_t> o, c;
+	readVector(in, o);
+	readVector(in, c);
+	readVector(in, values);
+	if (!in)
+		throw std::runtime_error("PropagationResponse: could not read " + filename);
+	Emin = bounds[0];
+	Emax = bounds[1];
+	zmin = bounds[2];
+	zmax = bounds[3];
+	arrivalEmin = bounds[4];
+	arrivalEmax = bounds[5];
+	energyBins = sizes[0];
+	redshiftBins = sizes[1];
+	arrivalBins = sizes[2];
+	count = sizes[3];
+	offsets.assign(o.begin(), o.end());
+	columns.assign(c.begin(), c.end());
+	if (offsets.size() != getInjectionSize() + 1 || columns.size() != values.size())
+		throw std::runtime_error("PropagationResponse: inconsistent response in " + filename);
+}
+
+std::string PropagationResponse::getDescription() const {
+	std::stringstream ss;
+	ss << "PropagationResponse: " << species.size() << " species, ";
+	ss << energyBins << " energy bins E = " << Emin / EeV << " - " << Emax / EeV << " EeV, ";
+	ss << redshiftBins << " redshift bins z = " << zmin << " - " << zmax << ", ";
+	ss << arrivalBins << " arrival energy bins E = " << arrivalEmin / EeV << " - " << arrivalEmax / EeV << " EeV, ";
+	ss << values.size() << " entries from " << count << " candidates per bin";
+	return ss.str();
+}
+
+} // namespace crpropa
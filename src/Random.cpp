@@ -62,6 +62,7 @@
 #include "crpropa/base64.h"
 
 #include <cstdio>
+#include <sstream>
 
 namespace crpropa {
 
@@ -114,6 +115,59 @@ double Random::randNorm(const double& mean, const double& variance) {
 	return mean + r * cos(phi);
 }
 
+// the bulk functions draw the integers in chunks of this size
+static const size_t BULK_CHUNK = 256;
+
+void Random::randNorm(double *values, size_t n) {
+	uint32_t u[BULK_CHUNK];
+	for (size_t first = 0; first < n; first += BULK_CHUNK / 2) {
+		size_t m = std::min(BULK_CHUNK / 2, n - first);
+		size_t pairs = (m + 1) / 2;
+		randInt(u, 2 * pairs);
+		for (size_t j = 0; j < pairs; j++) {
+			double r = sqrt(-2.0 * log(1.0 - (double(u[2 * j]) + 0.5) * (1.0 / 4294967296.0)));
+			double phi = 2.0 * 3.14159265358979323846264338328 * double(u[2 * j + 1]) * (1.0 / 4294967296.0);
+			values[first + 2 * j] = r * cos(phi);
+			if (2 * j + 1 < m)
+				values[first + 2 * j + 1] = r * sin(phi);
+		}
+	}
+}
+
+void Random::rand(double *values, size_t n) {
+	uint32_t u[BULK_CHUNK];
+	for (size_t first = 0; first < n; first += BULK_CHUNK) {
+		size_t m = std::min(BULK_CHUNK, n - first);
+		randInt(u, m);
+		for (size_t j = 0; j < m; j++)
+			values[first + j] = double(u[j]) * (1.0 / 4294967295.0);
+	}
+}
+
+void Random::randExponential(double *values, size_t n) {
+	rand(values, n);
+	for (size_t i = 0; i < n; i++) {
+		// redraw the rare values below epsilon, as randExponential()
+		while (values[i] < std::numeric_limits<double>::epsilon())
+			values[i] = rand();
+		values[i] = -1.0 * log(values[i]);
+	}
+}
+
+void Random::randVector(Vector3d *values, size_t n) {
+	uint32_t u[BULK_CHUNK];
+	for (size_t first = 0; first < n; first += BULK_CHUNK / 2) {
+		size_t m = std::min(BULK_CHUNK / 2, n - first);
+		randInt(u, 2 * m);
+		for (size_t j = 0; j < m; j++) {
+			double z = -1.0 + 2.0 * (double(u[2 * j]) * (1.0 / 4294967295.0));
+			double t = -1.0 * M_PI + 2.0 * M_PI * (double(u[2 * j + 1]) * (1.0 / 4294967295.0));
+			double r = sqrt(1 - z * z);
+			values[first + j] = Vector3d(r * cos(t), r * sin(t), z);
+		}
+	}
+}
+
 double Random::randUniform(double min, double max) {
 	return min + (max - min) * rand();
 }
@@ -138,6 +192,10 @@ size_t Random::randBin(const std::vector<double> &cdf) {
 	return it - cdf.begin();
 }
 
+size_t Random::randBin(const AliasTable &table) {
+	return table.sample(rand());
+}
+
 Vector3d Random::randVector() {
 	double z = randUniform(-1.0, 1.0);
 	double t = randUniform(-1.0 * M_PI, M_PI);
@@ -204,6 +262,26 @@ double Random::randPowerLaw(double index, double min, double max) {
 	}
 }
 
+void Random::randPowerLaw(double index, double min, double max, double *values, size_t n) {
+	if ((min < 0) || (max < min)) {
+		throw std::runtime_error(
+				"Power law distribution only possible for 0 <= min <= max");
+	}
+	rand(values, n);
+	if ((std::abs(index + 1.0)) < std::numeric_limits<double>::epsilon()) {
+		double part1 = log(max);
+		double part2 = log(min);
+		for (size_t i = 0; i < n; i++)
+			values[i] = exp((part1 - part2) * values[i] + part2);
+	} else {
+		double part1 = pow(max, index + 1);
+		double part2 = pow(min, index + 1);
+		double ex = 1 / (index + 1);
+		for (size_t i = 0; i < n; i++)
+			values[i] = pow((part1 - part2) * values[i] + part2, ex);
+	}
+}
+
 double Random::randBrokenPowerLaw(double index1, double index2,
 		double breakpoint, double min, double max) {
 	if ((min <= 0) || (max < min)) {
@@ -247,6 +325,14 @@ double Random::randExponential() {
 }
 
 uint32_t Random::randInt() {
+	if (counterBased) {
+		uint32_t r = block[counter & 3];
+		counter++;
+		if ((counter & 3) == 0)
+			generateBlock();
+		return r;
+	}
+
 	if (left == 0)
 		reload();
 	--left;
@@ -259,6 +345,32 @@ uint32_t Random::randInt() {
 	return (s1 ^ (s1 >> 18));
 }
 
+void Random::randInt(uint32_t *values, size_t n) {
+	if (counterBased) {
+		for (size_t i = 0; i < n; i++)
+			values[i] = randInt();
+		return;
+	}
+
+	// temper the values of the state in one loop up to the next reload
+	while (n > 0) {
+		if (left == 0)
+			reload();
+		size_t m = std::min((size_t) left, n);
+		for (size_t i = 0; i < m; i++) {
+			uint32_t s1 = pNext[i];
+			s1 ^= (s1 >> 11);
+			s1 ^= (s1 << 7) & 0x9d2c5680UL;
+			s1 ^= (s1 << 15) & 0xefc60000UL;
+			values[i] = s1 ^ (s1 >> 18);
+		}
+		pNext += m;
+		left -= m;
+		values += m;
+		n -= m;
+	}
+}
+
 uint32_t Random::randInt(const uint32_t& n) {
 // Find which bits are used in n
 // Optimized by Magnus Jonsson (magnus@smartelectronix.com)
@@ -307,6 +419,7 @@ uint64_t Random::randInt64(const uint64_t &n)
 
 
 void Random::seed(const uint32_t oneSeed) {
+	counterBased = false;
 	initial_seed.resize(1);
 	initial_seed[0] = oneSeed;
 	initialize(oneSeed);
@@ -314,6 +427,7 @@ void Random::seed(const uint32_t oneSeed) {
 }
 
 void Random::seed(uint32_t * const bigSeed, const uint32_t seedLength) {
+	counterBased = false;
 
 	initial_seed.resize(seedLength);
 	for (size_t i =0; i< seedLength; i++)
@@ -376,6 +490,54 @@ void Random::seed() {
 }
 
 
+void Random::seedStream(uint64_t k, uint64_t s, uint64_t n) {
+	counterBased = true;
+	key[0] = uint32_t(k);
+	key[1] = uint32_t(k >> 32);
+	stream = s;
+	counter = n;
+	generateBlock();
+}
+
+bool Random::isCounterBased() const {
+	return counterBased;
+}
+
+uint64_t Random::getStream() const {
+	return stream;
+}
+
+uint64_t Random::getCounter() const {
+	return counter;
+}
+
+void Random::philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = uint64_t(0xD2511F53UL) * c0;
+		uint64_t p1 = uint64_t(0xCD9E8D57UL) * c2;
+		uint32_t hi0 = uint32_t(p0 >> 32), lo0 = uint32_t(p0);
+		uint32_t hi1 = uint32_t(p1 >> 32), lo1 = uint32_t(p1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += 0x9E3779B9UL;
+		k1 += 0xBB67AE85UL;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+void Random::generateBlock() {
+	uint64_t n = counter >> 2;
+	uint32_t c[4] = {uint32_t(n), uint32_t(n >> 32), uint32_t(stream), uint32_t(stream >> 32)};
+	philox(c, key, block);
+}
+
 void Random::initialize(const uint32_t seed) {
 	uint32_t *s = state;
 	uint32_t *r = state;
@@ -459,6 +621,45 @@ std::istream& operator>>(std::istream& is, Random& mtrand) {
 	return is;
 }
 
+// streams of the counter-based engine, see seedStreams
+static bool streamsEnabled = false;
+static uint64_t streamKey = 0;
+static uint64_t nextStream = 0;
+
+static Random &streamInstance() {
+	static thread_local Random random(0u);
+	return random;
+}
+
+void Random::seedStreams(uint64_t seed) {
+	streamKey = seed;
+	nextStream = 0;
+	streamsEnabled = true;
+}
+
+void Random::disableStreams() {
+	streamsEnabled = false;
+}
+
+bool Random::getStreamsEnabled() {
+	return streamsEnabled;
+}
+
+uint64_t Random::reserveStreams(uint64_t n) {
+	uint64_t first = nextStream;
+	nextStream += n;
+	return first;
+}
+
+void Random::setNextStream(uint64_t stream) {
+	nextStream = stream;
+}
+
+void Random::selectStream(uint64_t stream, uint64_t counter) {
+	if (streamsEnabled)
+		streamInstance().seedStream(streamKey, stream, counter);
+}
+
 #ifdef _OPENMP
 #include <omp.h>
 #include <stdexcept>
@@ -478,6 +679,8 @@ __attribute__ ((aligned(64))) static RANDOM_TLS_ITEM _tls[MAX_THREAD];
 #endif
 
 Random &Random::instance() {
+	if (streamsEnabled)
+		return streamInstance();
 	int i = omp_get_thread_num();
 	if (i >= MAX_THREAD)
 	throw std::runtime_error("crpropa::Random: more than MAX_THREAD threads!");
@@ -497,9 +700,37 @@ std::vector< std::vector<uint32_t> > Random::getSeedThreads()
 	return seeds;
 }
 
+std::string Random::getThreadState(size_t i) {
+	if (i >= MAX_THREAD)
+		throw std::runtime_error("crpropa::Random: more than MAX_THREAD threads!");
+	std::ostringstream os;
+	os << _tls[i].r;
+	return os.str();
+}
+
+void Random::saveThreads(std::ostream &os, const std::vector<std::string> &states) {
+	if (states.size() > MAX_THREAD)
+		throw std::runtime_error("crpropa::Random: more than MAX_THREAD states to save!");
+	os << states.size() << "\n";
+	for (size_t i = 0; i < states.size(); ++i)
+		os << states[i] << "\n";
+}
+
+size_t Random::loadThreads(std::istream &is) {
+	size_t n = 0;
+	is >> n;
+	if (n > MAX_THREAD)
+		throw std::runtime_error("crpropa::Random: more than MAX_THREAD states to load!");
+	for (size_t i = 0; i < n; ++i)
+		is >> _tls[i].r;
+	return n;
+}
+
 #else
 static Random _random;
 Random &Random::instance() {
+	if (streamsEnabled)
+		return streamInstance();
 	return _random;
 }
 void Random::seedThreads(const uint32_t oneSeed) {
@@ -511,6 +742,29 @@ std::vector< std::vector<uint32_t> > Random::getSeedThreads()
 		seeds.push_back(_random.getSeed() ); 
 	return seeds;
 }
+std::string Random::getThreadState(size_t i) {
+	if (i > 0)
+		throw std::runtime_error("crpropa::Random: only one thread without OpenMP!");
+	std::ostringstream os;
+	os << _random;
+	return os.str();
+}
+void Random::saveThreads(std::ostream &os, const std::vector<std::string> &states) {
+	os << states.size() << "\n";
+	for (size_t i = 0; i < states.size(); ++i)
+		os << states[i] << "\n";
+}
+size_t Random::loadThreads(std::istream &is) {
+	size_t n = 0;
+	is >> n;
+	if (n > 0)
+		is >> _random;
+	// states of additional threads cannot be used without OpenMP
+	Random skip(0);
+	for (size_t i = 1; i < n; ++i)
+		is >> skip;
+	return std::min(n, (size_t) 1);
+}
 #endif
 
 const std::string Random::getSeed_base64() const
@@ -525,5 +779,90 @@ void Random::seed(const std::string &b64Seed)
 	seed((uint32_t*)decoded_data.c_str(), seedSize );
 }
 
+// Vose's algorithm: bins with less than the mean weight are filled up to it
+// with the weight of a bin with more, which becomes their alias
+template<typename T>
+static void buildAliasTable(const std::vector<T> &cdf, std::vector<double> &probability, std::vector<uint32_t> &alias) {
+	size_t n = cdf.size();
+	std::vector<double> weight(n);
+	double total = 0;
+	for (size_t i = 0; i < n; i++) {
+		weight[i] = std::max(cdf[i] - ((i > 0) ? cdf[i - 1] : T(0)), T(0));
+		total += weight[i];
+	}
+	probability.assign(n, 0.);
+	alias.assign(n, 0);
+	if (!(total > 0))
+		return; // always bin 0, as from randBin
+
+	// alias of the bins without weight that are left over after rounding
+	uint32_t positive = 0;
+	while (!(weight[positive] > 0))
+		positive++;
+
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		weight[i] *= n / total;
+		if (weight[i] < 1)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		uint32_t s = small.back();
+		uint32_t l = large.back();
+		small.pop_back();
+		probability[s] = weight[s];
+		alias[s] = l;
+		weight[l] -= 1 - weight[s];
+		if (weight[l] < 1) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// the remaining bins have the mean weight up to rounding
+	for (size_t i = 0; i < large.size(); i++) {
+		probability[large[i]] = 1;
+		alias[large[i]] = large[i];
+	}
+	// bins without weight are never drawn, they always take their alias
+	for (size_t i = 0; i < small.size(); i++) {
+		bool drawn = weight[small[i]] > 0;
+		probability[small[i]] = drawn ? 1 : 0;
+		alias[small[i]] = drawn ? small[i] : positive;
+	}
+}
+
+AliasTable::AliasTable() {
+}
+
+AliasTable::AliasTable(const std::vector<float> &cdf) {
+	buildAliasTable(cdf, probability, alias);
+}
+
+AliasTable::AliasTable(const std::vector<double> &cdf) {
+	buildAliasTable(cdf, probability, alias);
+}
+
+size_t AliasTable::sample(double u) const {
+	if (probability.empty())
+		throw std::runtime_error("AliasTable: empty table");
+	double x = u * probability.size();
+	size_t i = std::min(static_cast<size_t>(x), probability.size() - 1);
+	return (x - i < probability[i]) ? i : alias[i];
+}
+
+size_t AliasTable::size() const {
+	return probability.size();
+}
+
+double AliasTable::getProbability(size_t i) const {
+	return probability.at(i);
+}
+
+size_t AliasTable::getAlias(size_t i) const {
+	return alias.at(i);
+}
+
 } // namespace crpropa
 
@@ -0,0 +1,58 @@
+#include "crpropa/RedshiftCache.h"
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+namespace crpropa {
+
+double RedshiftCache::tolerance = 0;
+
+namespace {
+struct Slot {
+	uint64_t owner; // id of the cache, 0 for none
+	double z;
+	std::vector<double> values;
+};
+const size_t nSlots = 16;
+thread_local Slot slots[nSlots];
+std::atomic<uint64_t> lastId(0);
+}
+
+RedshiftCache::RedshiftCache() : id(++lastId) {
+}
+
+RedshiftCache::RedshiftCache(const RedshiftCache &) : id(++lastId) {
+}
+
+RedshiftCache &RedshiftCache::operator=(const RedshiftCache &) {
+	clear();
+	return *this;
+}
+
+std::vector<double> &RedshiftCache::get(double z, bool &valid) const {
+	Slot &slot = slots[id % nSlots];
+	valid = (slot.owner == id) and (std::fabs(slot.z - z) <= tolerance);
+	if (not valid) {
+		slot.owner = id;
+		slot.z = z;
+	}
+	return slot.values;
+}
+
+void RedshiftCache::clear() {
+	// values stored under the old id are never found again
+	id = ++lastId;
+}
+
+void RedshiftCache::setTolerance(double t) {
+	if (t < 0)
+		throw std::runtime_error("RedshiftCache: tolerance < 0");
+	tolerance = t;
+}
+
+double RedshiftCache::getTolerance() {
+	return tolerance;
+}
+
+} // namespace crpropa
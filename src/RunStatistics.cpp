@@ -0,0 +1,161 @@
+#include "crpropa/RunStatistics.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace crpropa {
+
+std::atomic<bool> RunStatistics::active(false);
+
+void RunStatistics::Histogram::fill(uint64_t value) {
+	size_t bin = 0;
+	for (uint64_t v = value; v > 0; v >>= 1)
+		bin++;
+	if (bins.size() <= bin)
+		bins.resize(bin + 1, 0);
+	bins[bin]++;
+	entries++;
+	sum += value;
+	maximum = std::max(maximum, value);
+}
+
+void RunStatistics::Histogram::add(const Histogram &other) {
+	if (bins.size() < other.bins.size())
+		bins.resize(other.bins.size(), 0);
+	for (size_t i = 0; i < other.bins.size(); i++)
+		bins[i] += other.bins[i];
+	entries += other.entries;
+	sum += other.sum;
+	maximum = std::max(maximum, other.maximum);
+}
+
+RunStatistics &RunStatistics::instance() {
+	static RunStatistics statistics;
+	return statistics;
+}
+
+RunStatistics::ThreadData &RunStatistics::getThreadData() {
+	// the thread data is kept until the end of the program, also by clear()
+	static thread_local ThreadData *data = 0;
+	if (!data) {
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.push_back(std::unique_ptr<ThreadData>(new ThreadData()));
+		data = threads.back().get();
+	}
+	return *data;
+}
+
+void RunStatistics::setEnabled(bool enable) {
+	active.store(enable);
+}
+
+void RunStatistics::addCount(const char *name, uint64_t n) {
+	getThreadData().counters[name] += n;
+}
+
+void RunStatistics::addValue(const char *name, uint64_t value) {
+	getThreadData().histograms[name].fill(value);
+}
+
+void RunStatistics::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i]->counters.clear();
+		threads[i]->histograms.clear();
+	}
+}
+
+// the same literal can have different addresses in different libraries, merged by name
+std::map<std::string, uint64_t> RunStatistics::mergeCounters() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, uint64_t> merged;
+	for (size_t i = 0; i < threads.size(); i++) {
+		std::unordered_map<const char *, uint64_t>::const_iterator c;
+		for (c = threads[i]->counters.begin(); c != threads[i]->counters.end(); c++)
+			merged[c->first] += c->second;
+	}
+	return merged;
+}
+
+std::map<std::string, RunStatistics::Histogram> RunStatistics::mergeHistograms() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, Histogram> merged;
+	for (size_t i = 0; i < threads.size(); i++) {
+		std::unordered_map<const char *, Histogram>::const_iterator h;
+		for (h = threads[i]->histograms.begin(); h != threads[i]->histograms.end(); h++)
+			merged[h->first].add(h->second);
+	}
+	return merged;
+}
+
+std::vector<std::string> RunStatistics::getCounterNames() const {
+	std::map<std::string, uint64_t> counters = mergeCounters();
+	std::vector<std::string> names;
+	std::map<std::string, uint64_t>::const_iterator c;
+	for (c = counters.begin(); c != counters.end(); c++)
+		names.push_back(c->first);
+	return names;
+}
+
+uint64_t RunStatistics::getCount(const std::string &name) const {
+	std::map<std::string, uint64_t> counters = mergeCounters();
+	std::map<std::string, uint64_t>::const_iterator c = counters.find(name);
+	return (c == counters.end()) ? 0 : c->second;
+}
+
+std::vector<std::string> RunStatistics::getHistogramNames() const {
+	std::map<std::string, Histogram> histograms = mergeHistograms();
+	std::vector<std::string> names;
+	std::map<std::string, Histogram>::const_iterator h;
+	for (h = histograms.begin(); h != histograms.end(); h++)
+		names.push_back(h->first);
+	return names;
+}
+
+std::vector<uint64_t> RunStatistics::getHistogram(const std::string &name) const {
+	return mergeHistograms()[name].bins;
+}
+
+uint64_t RunStatistics::getEntries(const std::string &name) const {
+	return mergeHistograms()[name].entries;
+}
+
+double RunStatistics::getMean(const std::string &name) const {
+	Histogram h = mergeHistograms()[name];
+	return h.entries ? double(h.sum) / h.entries : 0;
+}
+
+uint64_t RunStatistics::getMaximum(const std::string &name) const {
+	return mergeHistograms()[name].maximum;
+}
+
+std::string RunStatistics::getSummary() const {
+	std::map<std::string, uint64_t> counters = mergeCounters();
+	std::map<std::string, Histogram> histograms = mergeHistograms();
+	const std::string rejected = ": rejected steps";
+
+	std::stringstream ss;
+	ss << "RunStatistics\n";
+	std::map<std::string, uint64_t>::const_iterator c;
+	for (c = counters.begin(); c != counters.end(); c++) {
+		ss << "  " << c->first << ": " << c->second;
+		const std::string &name = c->first;
+		if ((name.size() > rejected.size())
+				&& (name.compare(name.size() - rejected.size(), rejected.size(), rejected) == 0)) {
+			std::string trials = name.substr(0, name.size() - rejected.size()) + ": trial steps";
+			if (counters.count(trials) && counters[trials])
+				ss << " (" << 100. * c->second / counters[trials] << " %)";
+		}
+		ss << "\n";
+	}
+	std::map<std::string, Histogram>::const_iterator h;
+	for (h = histograms.begin(); h != histograms.end(); h++) {
+		const Histogram &histogram = h->second;
+		ss << "  " << h->first << ": " << histogram.entries << " entries, mean "
+			<< (histogram.entries ? double(histogram.sum) / histogram.entries : 0)
+			<< ", max " << histogram.maximum << "\n";
+	}
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -9,11 +9,26 @@
 #include "muParser.h"
 #endif
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
 
 namespace crpropa {
 
+// SourceInterface ------------------------------------------------------------
+std::vector<ref_ptr<Candidate> > SourceInterface::getCandidates(size_t n) const {
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	for (size_t i = 0; i < n; i++)
+		candidates[i] = getCandidate();
+	return candidates;
+}
+
+std::vector<ref_ptr<Candidate> > SourceInterface::getCandidates(const std::vector<size_t> &indices) const {
+	return getCandidates(indices.size());
+}
+
 // Source ---------------------------------------------------------------------
 void Source::add(SourceFeature* property) {
 	features.push_back(property);
@@ -21,15 +36,31 @@ void Source::add(SourceFeature* property) {
 
 ref_ptr<Candidate> Source::getCandidate() const {
 	ref_ptr<Candidate> candidate = new Candidate();
-	for (int i = 0; i < features.size(); i++)
+	for (size_t i = 0; i < features.size(); i++)
 		(*features[i]).prepareCandidate(*candidate);
 	return candidate;
 }
 
+std::vector<ref_ptr<Candidate> > Source::getCandidates(size_t n) const {
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	for (size_t i = 0; i < n; i++)
+		candidates[i] = new Candidate();
+	for (size_t i = 0; i < features.size(); i++)
+		(*features[i]).prepareCandidates(candidates);
+	return candidates;
+}
+
+double Source::getDensity(const ParticleState &source, double redshift) const {
+	double density = 1;
+	for (size_t i = 0; (i < features.size()) && (density != 0); i++)
+		density *= features[i]->getDensity(source, redshift);
+	return density;
+}
+
 std::string Source::getDescription() const {
 	std::stringstream ss;
 	ss << "Cosmic ray source\n";
-	for (int i = 0; i < features.size(); i++)
+	for (size_t i = 0; i < features.size(); i++)
 		ss << "    " << features[i]->getDescription();
 	return ss.str();
 }
@@ -57,19 +88,174 @@ std::string SourceList::getDescription() const {
 	return ss.str();
 }
 
+// SourceCatalogue-------------------------------------------------------------
+static const char catalogueMagic[8] = {'C', 'R', 'P', 'R', 'O', 'P', 'A', 'S'};
+
+struct CatalogueHeader {
+	char magic[8];
+	uint32_t recordSize;
+	uint32_t reserved;
+};
+
+SourceCatalogue::SourceCatalogue(const std::string &filename) :
+		filename(filename), file(new MappedFile(filename)), first(0), next(0) {
+	if ((file->size() < sizeof(CatalogueHeader))
+			or (memcmp(file->data(), catalogueMagic, sizeof(catalogueMagic)) != 0))
+		throw std::runtime_error("SourceCatalogue: not a catalogue " + filename);
+	const CatalogueHeader *header = static_cast<const CatalogueHeader *>(file->data());
+	if (header->recordSize != sizeof(Record))
+		throw std::runtime_error("SourceCatalogue: incompatible record size in " + filename);
+	records = reinterpret_cast<const Record *>(static_cast<const char *>(file->data()) + sizeof(CatalogueHeader));
+	nRecords = (file->size() - sizeof(CatalogueHeader)) / sizeof(Record);
+	count = nRecords;
+}
+
+void SourceCatalogue::generate(SourceInterface *source, size_t count, const std::string &filename, size_t chunkSize) {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.is_open())
+		throw std::runtime_error("SourceCatalogue: cannot create file " + filename);
+	CatalogueHeader header;
+	memcpy(header.magic, catalogueMagic, sizeof(catalogueMagic));
+	header.recordSize = sizeof(Record);
+	header.reserved = 0;
+	out.write((const char *) &header, sizeof(header));
+
+	chunkSize = std::max(chunkSize, (size_t) 1);
+	std::vector<Record> chunk;
+	for (size_t i = 0; i < count; i += chunkSize) {
+		std::vector<ref_ptr<Candidate> > candidates = source->getCandidates(std::min(chunkSize, count - i));
+		chunk.resize(candidates.size());
+		for (size_t j = 0; j < candidates.size(); j++) {
+			const ParticleState &state = candidates[j]->source;
+			Record &r = chunk[j];
+			r.energy = state.getEnergy();
+			r.position[0] = state.getPosition().x;
+			r.position[1] = state.getPosition().y;
+			r.position[2] = state.getPosition().z;
+			r.direction[0] = state.getDirection().x;
+			r.direction[1] = state.getDirection().y;
+			r.direction[2] = state.getDirection().z;
+			r.redshift = candidates[j]->getRedshift();
+			r.weight = candidates[j]->getWeight();
+			r.id = state.getId();
+			r.padding = 0;
+		}
+		out.write((const char *) chunk.data(), chunk.size() * sizeof(Record));
+	}
+	if (!out.good())
+		throw std::runtime_error("SourceCatalogue: could not write " + filename);
+}
+
+void SourceCatalogue::setRange(size_t first, size_t count) {
+	if ((first > nRecords) or (count > nRecords - first))
+		throw std::runtime_error("SourceCatalogue: range exceeds the catalogue " + filename);
+	this->first = first;
+	this->count = count;
+	rewind();
+}
+
+size_t SourceCatalogue::size() const {
+	return count;
+}
+
+ref_ptr<Candidate> SourceCatalogue::getCandidate(size_t index) const {
+	if (index >= count)
+		throw std::runtime_error("SourceCatalogue: index out of range");
+	const Record &r = records[first + index];
+	ref_ptr<Candidate> candidate = new Candidate();
+	ParticleState &state = candidate->source;
+	state.setId(r.id);
+	state.setEnergy(r.energy);
+	state.setPosition(Vector3d(r.position[0], r.position[1], r.position[2]));
+	state.setDirection(Vector3d(r.direction[0], r.direction[1], r.direction[2]));
+	candidate->created = state;
+	candidate->current = state;
+	candidate->previous = state;
+	candidate->setRedshift(r.redshift);
+	candidate->setWeight(r.weight);
+	return candidate;
+}
+
+ref_ptr<Candidate> SourceCatalogue::getCandidate() const {
+	size_t index;
+#pragma omp atomic capture
+	index = next++;
+	return getCandidate(index);
+}
+
+std::vector<ref_ptr<Candidate> > SourceCatalogue::getCandidates(size_t n) const {
+	size_t index;
+#pragma omp atomic capture
+	{ index = next; next += n; }
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	for (size_t i = 0; i < n; i++)
+		candidates[i] = getCandidate(index + i);
+	return candidates;
+}
+
+std::vector<ref_ptr<Candidate> > SourceCatalogue::getCandidates(const std::vector<size_t> &indices) const {
+	std::vector<ref_ptr<Candidate> > candidates(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		candidates[i] = getCandidate(indices[i]);
+	return candidates;
+}
+
+void SourceCatalogue::rewind() {
+	next = 0;
+}
+
+std::string SourceCatalogue::getDescription() const {
+	std::stringstream ss;
+	ss << "SourceCatalogue: " << count << " primaries from " << first << " of " << filename << "\n";
+	return ss.str();
+}
+
 // SourceFeature---------------------------------------------------------------
+// start the candidate with the prepared source state
+static void updateStates(Candidate &candidate) {
+	candidate.created = candidate.source;
+	candidate.current = candidate.source;
+	candidate.previous = candidate.source;
+}
+
 void SourceFeature::prepareCandidate(Candidate& candidate) const {
-	ParticleState &source = candidate.source;
-	prepareParticle(source);
-	candidate.created = source;
-	candidate.current = source;
-	candidate.previous = source;
+	prepareParticle(candidate.source);
+	updateStates(candidate);
+}
+
+void SourceFeature::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	for (size_t i = 0; i < candidates.size(); i++)
+		prepareCandidate(*candidates[i]);
+}
+
+double SourceFeature::getDensity(const ParticleState &source, double redshift) const {
+	throw std::runtime_error("SourceFeature: no density of the feature " + description);
 }
 
 std::string SourceFeature::getDescription() const {
 	return description;
 }
 
+static double powerLawIntegral(double index, double min, double max) {
+	if (std::abs(index + 1) < std::numeric_limits<double>::epsilon())
+		return log(max / min);
+	return (pow(max, index + 1) - pow(min, index + 1)) / (index + 1);
+}
+
+// equality of a stored value with a fixed value of a feature, up to the rounding of the output
+static bool sameValue(double a, double b) {
+	return std::abs(a - b) <= 1e-9 * std::max(std::abs(a), std::abs(b));
+}
+
+static bool sameValue(const Vector3d &a, const Vector3d &b) {
+	return (a - b).getR() <= 1e-9 * std::max(a.getR(), b.getR());
+}
+
+// probability of the entry i of a cumulative distribution
+static double binProbability(const std::vector<double> &cdf, size_t i) {
+	return (cdf[i] - ((i > 0) ? cdf[i - 1] : 0)) / cdf.back();
+}
+
 // ----------------------------------------------------------------------------
 SourceParticleType::SourceParticleType(int id) :
 		id(id) {
@@ -80,6 +266,10 @@ void SourceParticleType::prepareParticle(ParticleState& particle) const {
 	particle.setId(id);
 }
 
+double SourceParticleType::getDensity(const ParticleState &source, double redshift) const {
+	return (source.getId() == id) ? 1 : 0;
+}
+
 void SourceParticleType::setDescription() {
 	std::stringstream ss;
 	ss << "SourceParticleType: " << id << "\n";
@@ -106,6 +296,14 @@ void SourceMultipleParticleTypes::prepareParticle(ParticleState& particle) const
 	particle.setId(particleTypes[i]);
 }
 
+double SourceMultipleParticleTypes::getDensity(const ParticleState &source, double redshift) const {
+	double p = 0;
+	for (size_t i = 0; i < particleTypes.size(); i++)
+		if (particleTypes[i] == source.getId())
+			p += binProbability(cdf, i);
+	return p;
+}
+
 void SourceMultipleParticleTypes::setDescription() {
 	std::stringstream ss;
 	ss << "SourceMultipleParticleTypes: Random particle type\n";
@@ -124,6 +322,10 @@ void SourceEnergy::prepareParticle(ParticleState& p) const {
 	p.setEnergy(E);
 }
 
+double SourceEnergy::getDensity(const ParticleState &source, double redshift) const {
+	return sameValue(source.getEnergy(), E) ? 1 : 0;
+}
+
 void SourceEnergy::setDescription() {
 	std::stringstream ss;
 	ss << "SourceEnergy: " << E / EeV << " EeV\n";
@@ -143,6 +345,23 @@ void SourcePowerLawSpectrum::prepareParticle(ParticleState& particle) const {
 	particle.setEnergy(E);
 }
 
+void SourcePowerLawSpectrum::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	std::vector<double> E(candidates.size());
+	if (E.size() > 0)
+		Random::instance().randPowerLaw(index, Emin, Emax, &E[0], E.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		candidates[i]->source.setEnergy(E[i]);
+		updateStates(*candidates[i]);
+	}
+}
+
+double SourcePowerLawSpectrum::getDensity(const ParticleState &source, double redshift) const {
+	double E = source.getEnergy();
+	if ((E < Emin) || (E > Emax))
+		return 0;
+	return pow(E, index) / powerLawIntegral(index, Emin, Emax);
+}
+
 void SourcePowerLawSpectrum::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePowerLawSpectrum: Random energy ";
@@ -151,6 +370,43 @@ void SourcePowerLawSpectrum::setDescription() {
 	description = ss.str();
 }
 
+// ----------------------------------------------------------------------------
+// integral of x^index in [min, max]
+SourceBiasedPowerLawSpectrum::SourceBiasedPowerLawSpectrum(double Emin, double Emax,
+		double index, double biasIndex) :
+		Emin(Emin), Emax(Emax), index(index), biasIndex(biasIndex) {
+	if ((Emin <= 0) or (Emax < Emin))
+		throw std::runtime_error("SourceBiasedPowerLawSpectrum: energies must fulfill 0 < Emin <= Emax");
+	normRatio = powerLawIntegral(biasIndex, Emin, Emax) / powerLawIntegral(index, Emin, Emax);
+	setDescription();
+}
+
+double SourceBiasedPowerLawSpectrum::getWeight(double E) const {
+	return normRatio * pow(E, index - biasIndex);
+}
+
+void SourceBiasedPowerLawSpectrum::prepareCandidate(Candidate& candidate) const {
+	double E = Random::instance().randPowerLaw(biasIndex, Emin, Emax);
+	candidate.source.setEnergy(E);
+	updateStates(candidate);
+	candidate.setWeight(candidate.getWeight() * getWeight(E));
+}
+
+double SourceBiasedPowerLawSpectrum::getDensity(const ParticleState &source, double redshift) const {
+	double E = source.getEnergy();
+	if ((E < Emin) || (E > Emax))
+		return 0;
+	return pow(E, index) / powerLawIntegral(index, Emin, Emax);
+}
+
+void SourceBiasedPowerLawSpectrum::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBiasedPowerLawSpectrum: Random energy ";
+	ss << "E = " << Emin / EeV << " - " << Emax / EeV << " EeV, ";
+	ss << "dN/dE ~ E^" << index << ", sampled from E^" << biasIndex << " with weights\n";
+	description = ss.str();
+}
+
 // ----------------------------------------------------------------------------
 SourceComposition::SourceComposition(double Emin, double Rmax, double index) :
 		Emin(Emin), Rmax(Rmax), index(index) {
@@ -173,6 +429,7 @@ void SourceComposition::add(int id, double weight) {
 	if (cdf.size() > 0)
 		weight += cdf.back();
 	cdf.push_back(weight);
+	alias = AliasTable(cdf);
 	setDescription();
 }
 
@@ -180,6 +437,10 @@ void SourceComposition::add(int A, int Z, double a) {
 	add(nucleusId(A, Z), a);
 }
 
+std::vector<int> SourceComposition::getNuclei() const {
+	return nuclei;
+}
+
 void SourceComposition::prepareParticle(ParticleState& particle) const {
 	if (nuclei.size() == 0)
 		throw std::runtime_error("SourceComposition: No source isotope set");
@@ -187,7 +448,7 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 	// draw random particle type
-	size_t i = random.randBin(cdf);
+	size_t i = random.randBin(alias);
 	int id = nuclei[i];
 	particle.setId(id);
 
@@ -196,6 +457,33 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	particle.setEnergy(random.randPowerLaw(index, Emin, Z * Rmax));
 }
 
+void SourceComposition::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	if (nuclei.size() == 0)
+		throw std::runtime_error("SourceComposition: No source isotope set");
+
+	Random &random = Random::instance();
+	for (size_t i = 0; i < candidates.size(); i++) {
+		ParticleState &source = candidates[i]->source;
+		int id = nuclei[random.randBin(alias)];
+		source.setId(id);
+		source.setEnergy(random.randPowerLaw(index, Emin, chargeNumber(id) * Rmax));
+		updateStates(*candidates[i]);
+	}
+}
+
+double SourceComposition::getDensity(const ParticleState &source, double redshift) const {
+	double E = source.getEnergy();
+	for (size_t i = 0; i < nuclei.size(); i++) {
+		if (nuclei[i] != source.getId())
+			continue;
+		double Emax = chargeNumber(nuclei[i]) * Rmax;
+		if ((E < Emin) || (E > Emax))
+			return 0;
+		return binProbability(cdf, i) * pow(E, index) / powerLawIntegral(index, Emin, Emax);
+	}
+	return 0;
+}
+
 void SourceComposition::setDescription() {
 	std::stringstream ss;
 	ss << "SourceComposition: Random element and energy ";
@@ -221,6 +509,10 @@ void SourcePosition::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(position);
 }
 
+double SourcePosition::getDensity(const ParticleState &source, double redshift) const {
+	return sameValue(source.getPosition(), position) ? 1 : 0;
+}
+
 void SourcePosition::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePosition: " << position / Mpc << " Mpc\n";
@@ -246,6 +538,14 @@ void SourceMultiplePositions::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(positions[i]);
 }
 
+double SourceMultiplePositions::getDensity(const ParticleState &source, double redshift) const {
+	double p = 0;
+	for (size_t i = 0; i < positions.size(); i++)
+		if (sameValue(source.getPosition(), positions[i]))
+			p += binProbability(cdf, i);
+	return p;
+}
+
 void SourceMultiplePositions::setDescription() {
 	std::stringstream ss;
 	ss << "SourceMultiplePositions: Random position from list\n";
@@ -266,6 +566,12 @@ void SourceUniformSphere::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(center + random.randVector() * r);
 }
 
+double SourceUniformSphere::getDensity(const ParticleState &source, double redshift) const {
+	if ((source.getPosition() - center).getR() > radius)
+		return 0;
+	return 3 / (4 * M_PI * pow(radius, 3));
+}
+
 void SourceUniformSphere::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniformSphere: Random position within a sphere at ";
@@ -330,6 +636,13 @@ void SourceUniformBox::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(pos * size + origin);
 }
 
+double SourceUniformBox::getDensity(const ParticleState &source, double redshift) const {
+	Vector3d x = source.getPosition() - origin;
+	if ((x.x < 0) || (x.y < 0) || (x.z < 0) || (x.x > size.x) || (x.y > size.y) || (x.z > size.z))
+		return 0;
+	return 1 / (size.x * size.y * size.z);
+}
+
 void SourceUniformBox::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniformBox: Random uniform position in box with ";
@@ -360,9 +673,41 @@ void SourceUniformCylinder::setDescription() {
 	description = ss.str();
 }
 
+// ---------------------------------------------------------------------------
+// Tabulated radial distributions of SourceSNRDistribution and SourcePulsarDistribution.
+// The density is interpolated linearly between the tabulated radii, a bin is drawn
+// from the alias table of the trapezoidal bin weights and the radius within the bin
+// from the inverse of the linear density.
+static const size_t radialBins = 1024;
+
+static AliasTable radialAlias(const std::vector<double> &r, const std::vector<double> &f) {
+	std::vector<double> cdf(r.size() - 1);
+	double sum = 0;
+	for (size_t i = 0; i < cdf.size(); i++) {
+		sum += (f[i] + f[i + 1]) * (r[i + 1] - r[i]) / 2;
+		cdf[i] = sum;
+	}
+	return AliasTable(cdf);
+}
+
+static double sampleRadius(Random &random, const AliasTable &alias, const std::vector<double> &r, const std::vector<double> &f) {
+	size_t i = random.randBin(alias);
+	double f0 = f[i], f1 = f[i + 1];
+	double u = random.rand();
+	// solves f0 t + (f1 - f0) t^2 / 2 = u (f0 + f1) / 2 for the fraction t of the bin
+	double t = u * (f0 + f1) / (f0 + sqrt(f0 * f0 + u * (f1 * f1 - f0 * f0)));
+	return r[i] + t * (r[i + 1] - r[i]);
+}
+
+// height of the distribution exp(-|z| / zg) truncated at |z| < zMax
+static double sampleHeight(Random &random, double zg, double zMax) {
+	double z = -zg * log1p(random.rand() * expm1(-zMax / zg));
+	return random.randUniform(-1, 1) < 0 ? -z : z;
+}
+
 // ---------------------------------------------------------------------------
 SourceSNRDistribution::SourceSNRDistribution() :
-    rEarth(8.5 * kpc), beta(3.53), zg(0.3 * kpc) {
+    rEarth(8.5 * kpc), beta(3.53), zg(0.3 * kpc), rMax(20 * kpc), zMax(5 * kpc) {
 	setAlpha(2.);
 	setFrMax();
 	setFzMax(0.3 * kpc);
@@ -371,7 +716,7 @@ SourceSNRDistribution::SourceSNRDistribution() :
 }
 
 SourceSNRDistribution::SourceSNRDistribution(double rEarth, double alpha, double beta, double zg) :
-    rEarth(rEarth), beta(beta), zg(zg) {
+    rEarth(rEarth), beta(beta), zg(zg), rMax(20 * kpc), zMax(5 * kpc) {
 	setAlpha(alpha);
 	setFrMax();
 	setFzMax(zg);
@@ -380,30 +725,24 @@ SourceSNRDistribution::SourceSNRDistribution(double rEarth, double alpha, double
 }
 
 void SourceSNRDistribution::prepareParticle(ParticleState& particle) const {
-  	Random &random = Random::instance();
-	double RPos;
-	while (true) {
-		RPos = random.rand() * rMax;
-		double fTest = random.rand() * frMax;
-		double fR = fr(RPos);
-		if (fTest <= fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true) {
-		ZPos = (random.rand() - 0.5) * 2 * zMax;
-		double fTest = random.rand() * fzMax;
-		double fZ=fz(ZPos);
-		if (fTest<=fZ) {
-			break;
-		}
-	}
+	Random &random = Random::instance();
+	double RPos = sampleRadius(random, tabAlias, tabR, tabFr);
+	double ZPos = sampleHeight(random, zg, zMax);
 	double phi = random.rand() * 2 * M_PI;
 	Vector3d pos(cos(phi) * RPos, sin(phi) * RPos, ZPos);
 	particle.setPosition(pos);
 }
 
+void SourceSNRDistribution::initSampling() {
+	tabR.resize(radialBins + 1);
+	tabFr.resize(radialBins + 1);
+	for (size_t i = 0; i <= radialBins; i++) {
+		tabR[i] = rMax * i / radialBins;
+		tabFr[i] = fr(tabR[i]);
+	}
+	tabAlias = radialAlias(tabR, tabFr);
+}
+
 double SourceSNRDistribution::fr(double r) const {
 	return pow(r / rEarth, alpha) * exp(- beta * (r - rEarth) / rEarth);
 }
@@ -435,7 +774,7 @@ void SourceSNRDistribution::setFzMax(double zg) {
 
 void SourceSNRDistribution::setRMax(double r) {
 	rMax = r;
-	return;
+	initSampling();
 }
 
 void SourceSNRDistribution::setZMax(double z) {
@@ -502,25 +841,9 @@ SourcePulsarDistribution::SourcePulsarDistribution(double rEarth, double beta, d
 }
 
 void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
-  	Random &random = Random::instance();
-	double Rtilde;
-	while (true) {
-		Rtilde = random.rand() * rMax;
-		double fTest = random.rand() * frMax * 1.1;
-		double fR = fr(Rtilde);
-		if (fTest <= fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true) {
-		ZPos = (random.rand() - 0.5) * 2 * zMax;
-		double fTest = random.rand() * fzMax;
-		double fZ = fz(ZPos);
-		if (fTest <= fZ) {
-			break;
-		}
-	}
+	Random &random = Random::instance();
+	double Rtilde = sampleRadius(random, tabAlias, tabR, tabFr);
+	double ZPos = sampleHeight(random, zg, zMax);
 
 	int i = random.randInt(3);
 	double thetaTilde = ftheta(i, Rtilde);
@@ -529,7 +852,17 @@ void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
 	Vector3d pos(cos(phi) * RPos, sin(phi) * RPos, ZPos);
 
 	particle.setPosition(pos);
-  }
+}
+
+void SourcePulsarDistribution::initSampling() {
+	tabR.resize(radialBins + 1);
+	tabFr.resize(radialBins + 1);
+	for (size_t i = 0; i <= radialBins; i++) {
+		tabR[i] = rMax * i / radialBins;
+		tabFr[i] = fr(tabR[i]);
+	}
+	tabAlias = radialAlias(tabR, tabFr);
+}
 
 double SourcePulsarDistribution::fr(double r) const {
  	double f = r * pow(r / rEarth, 2.) * exp(-beta * (r - rEarth) / rEarth);
@@ -580,7 +913,7 @@ void SourcePulsarDistribution::setFzMax(double zg) {
 
 void SourcePulsarDistribution::setRMax(double r) {
 	rMax = r;
-	return;
+	initSampling();
 }
 
 void SourcePulsarDistribution::setZMax(double z) {
@@ -655,6 +988,29 @@ void SourceUniform1D::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(Vector3d(d, 0, 0));
 }
 
+void SourceUniform1D::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	std::vector<double> u(candidates.size());
+	if (u.size() > 0)
+		Random::instance().rand(&u[0], u.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		double d = u[i] * (maxD - minD) + minD;
+		if (withCosmology)
+			d = lightTravel2ComovingDistance(d);
+		candidates[i]->source.setPosition(Vector3d(d, 0, 0));
+		updateStates(*candidates[i]);
+	}
+}
+
+double SourceUniform1D::getDensity(const ParticleState &source, double redshift) const {
+	// uniform in the light-travel distance, d(light-travel) = d(comoving) / (1 + z)
+	double x = source.getPosition().getR();
+	double d = withCosmology ? comoving2LightTravelDistance(x) : x;
+	if ((d < minD) || (d > maxD))
+		return 0;
+	double jacobian = withCosmology ? 1 / (1 + comovingDistance2Redshift(x)) : 1;
+	return jacobian / (maxD - minD);
+}
+
 void SourceUniform1D::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniform1D: Random uniform position in D = ";
@@ -666,25 +1022,92 @@ void SourceUniform1D::setDescription() {
 }
 
 // ----------------------------------------------------------------------------
+SourceBiasedUniform1D::SourceBiasedUniform1D(double minD, double maxD, double biasIndex, bool withCosmology) :
+		biasIndex(biasIndex), withCosmology(withCosmology) {
+	if (withCosmology) {
+		this->minD = comoving2LightTravelDistance(minD);
+		this->maxD = comoving2LightTravelDistance(maxD);
+	} else {
+		this->minD = minD;
+		this->maxD = maxD;
+	}
+	if ((this->minD < 0) or (this->maxD <= this->minD) or ((this->minD == 0) and (biasIndex <= -1)))
+		throw std::runtime_error("SourceBiasedUniform1D: invalid distance range for the biasing");
+	normRatio = powerLawIntegral(biasIndex, this->minD, this->maxD) / (this->maxD - this->minD);
+	setDescription();
+}
+
+void SourceBiasedUniform1D::prepareCandidate(Candidate& candidate) const {
+	double d = Random::instance().randPowerLaw(biasIndex, minD, maxD);
+	double weight = normRatio * pow(d, -biasIndex);
+	if (withCosmology)
+		d = lightTravel2ComovingDistance(d);
+	candidate.source.setPosition(Vector3d(d, 0, 0));
+	updateStates(candidate);
+	candidate.setWeight(candidate.getWeight() * weight);
+}
+
+double SourceBiasedUniform1D::getDensity(const ParticleState &source, double redshift) const {
+	double x = source.getPosition().getR();
+	double d = withCosmology ? comoving2LightTravelDistance(x) : x;
+	if ((d < minD) || (d > maxD))
+		return 0;
+	double jacobian = withCosmology ? 1 / (1 + comovingDistance2Redshift(x)) : 1;
+	return jacobian / (maxD - minD);
+}
+
+void SourceBiasedUniform1D::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBiasedUniform1D: Random uniform position in D = ";
+	ss << minD / Mpc << " - " << maxD / Mpc << " Mpc";
+	if (withCosmology)
+		ss << " (including cosmology)";
+	ss << ", sampled from D^" << biasIndex << " with weights\n";
+	description = ss.str();
+}
+
+// ----------------------------------------------------------------------------
+static const size_t densityBlockSize = 256;
+
 SourceDensityGrid::SourceDensityGrid(ref_ptr<Grid1f> grid) :
 		grid(grid) {
-	float sum = 0;
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				sum += grid->get(ix, iy, iz);
-				grid->get(ix, iy, iz) = sum;
-			}
-		}
+	// sum up blocks in storage order, as the cells are drawn from getGrid()
+	const std::vector<float> &values = grid->getGrid();
+	size_t nBlocks = (values.size() + densityBlockSize - 1) / densityBlockSize;
+	blockSum.resize(nBlocks);
+	std::vector<double> cdf(nBlocks);
+	double sum = 0;
+	for (size_t b = 0; b < nBlocks; b++) {
+		size_t end = std::min(values.size(), (b + 1) * densityBlockSize);
+		double block = 0;
+		for (size_t i = b * densityBlockSize; i < end; i++)
+			block += values[i];
+		blockSum[b] = block;
+		sum += block;
+		cdf[b] = sum;
 	}
+	blockAlias = AliasTable(cdf);
 	setDescription();
 }
 
 void SourceDensityGrid::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
-	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
+	// draw random block, then the bin within the block
+	const std::vector<float> &values = grid->getGrid();
+	size_t b = random.randBin(blockAlias);
+	size_t i = b * densityBlockSize;
+	size_t last = std::min(values.size(), i + densityBlockSize) - 1;
+	double u = random.rand() * blockSum[b];
+	double sum = 0;
+	for (; i < last; i++) {
+		sum += values[i];
+		if (u < sum)
+			break;
+	}
+	// rounding at the end of the block: last bin with a density
+	while ((values[i] <= 0) and (i > b * densityBlockSize))
+		i--;
 	Vector3d pos = grid->positionFromIndex(i);
 
 	// draw uniform position within bin
@@ -708,11 +1131,13 @@ SourceDensityGrid1D::SourceDensityGrid1D(ref_ptr<Grid1f> grid) :
 	if (grid->getNz() != 1)
 		throw std::runtime_error("SourceDensityGrid1D: Nz != 1");
 
-	float sum = 0;
+	std::vector<double> cdf(grid->getNx());
+	double sum = 0;
 	for (int ix = 0; ix < grid->getNx(); ix++) {
 		sum += grid->get(ix, 0, 0);
-		grid->get(ix, 0, 0) = sum;
+		cdf[ix] = sum;
 	}
+	alias = AliasTable(cdf);
 	setDescription();
 }
 
@@ -720,7 +1145,7 @@ void SourceDensityGrid1D::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
+	size_t i = random.randBin(alias);
 	Vector3d pos = grid->positionFromIndex(i);
 
 	// draw uniform position within bin
@@ -744,6 +1169,20 @@ void SourceIsotropicEmission::prepareParticle(ParticleState& particle) const {
 	particle.setDirection(random.randVector());
 }
 
+void SourceIsotropicEmission::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	std::vector<Vector3d> directions(candidates.size());
+	if (directions.size() > 0)
+		Random::instance().randVector(&directions[0], directions.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		candidates[i]->source.setDirection(directions[i]);
+		updateStates(*candidates[i]);
+	}
+}
+
+double SourceIsotropicEmission::getDensity(const ParticleState &source, double redshift) const {
+	return 1 / (4 * M_PI);
+}
+
 void SourceIsotropicEmission::setDescription() {
 	description = "SourceIsotropicEmission: Random isotropic direction\n";
 }
@@ -770,7 +1209,7 @@ void SourceDirectedEmission::prepareCandidate(Candidate &candidate) const {
 	//set the weight of the particle, see eq. 3.1 of PoS(ICRC2019)447
 	double pdfVonMises = kappa / (2. * M_PI * (1. - exp(-2. * kappa))) * exp(-kappa * (1. - v.dot(mu)));
 	double weight = 1. / (4. * M_PI * pdfVonMises);
-	candidate.setWeight(weight);
+	candidate.setWeight(candidate.getWeight() * weight);
 }
 
 void SourceDirectedEmission::setDescription() {
@@ -814,6 +1253,10 @@ void SourceDirection::prepareParticle(ParticleState& particle) const {
 	particle.setDirection(direction);
 }
 
+double SourceDirection::getDensity(const ParticleState &source, double redshift) const {
+	return sameValue(source.getDirection(), direction) ? 1 : 0;
+}
+
 void SourceDirection::setDescription() {
 	std::stringstream ss;
 	ss <<  "SourceDirection: Emission direction = " << direction << "\n";
@@ -821,19 +1264,44 @@ void SourceDirection::setDescription() {
 }
 
 // ----------------------------------------------------------------------------
-SourceEmissionMap::SourceEmissionMap(EmissionMap *emissionMap) : emissionMap(emissionMap) {
+SourceEmissionMap::SourceEmissionMap(EmissionMap *emissionMap, bool drawDirection) :
+	emissionMap(emissionMap), drawDirection(drawDirection) {
 	setDescription();
 }
 
 void SourceEmissionMap::prepareCandidate(Candidate &candidate) const {
-	if (emissionMap) {
+	if (!emissionMap)
+		return;
+
+	if (!drawDirection) {
 		bool accept = emissionMap->checkDirection(candidate.source);
 		candidate.setActive(accept);
+		return;
 	}
+
+	ref_ptr<CylindricalProjectionMap> cpm = emissionMap->findMap(candidate.source.getId(), candidate.source.getEnergy());
+	if (!cpm.valid() || cpm->getTotal() <= 0) {
+		candidate.setActive(false);
+		return;
+	}
+	Vector3d v = cpm->drawDirection();
+	candidate.source.setDirection(v);
+	candidate.created.setDirection(v);
+	candidate.previous.setDirection(v);
+	candidate.current.setDirection(v);
+	candidate.setWeight(candidate.getWeight() * cpm->getIsotropicWeight(v));
+}
+
+void SourceEmissionMap::setDrawDirection(bool drawDirection) {
+	this->drawDirection = drawDirection;
+	setDescription();
 }
 
 void SourceEmissionMap::setDescription() {
-	description = "SourceEmissionMap: accept only directions from emission map\n";
+	if (drawDirection)
+		description = "SourceEmissionMap: draw directions from emission map\n";
+	else
+		description = "SourceEmissionMap: accept only directions from emission map\n";
 }
 
 void SourceEmissionMap::setEmissionMap(EmissionMap *emissionMap) {
@@ -879,6 +1347,10 @@ void SourceRedshift::prepareCandidate(Candidate& candidate) const {
 	candidate.setRedshift(z);
 }
 
+double SourceRedshift::getDensity(const ParticleState &source, double redshift) const {
+	return sameValue(redshift, z) ? 1 : 0;
+}
+
 void SourceRedshift::setDescription() {
 	std::stringstream ss;
 	ss << "SourceRedshift: Redshift z = " << z << "\n";
@@ -896,6 +1368,12 @@ void SourceUniformRedshift::prepareCandidate(Candidate& candidate) const {
 	candidate.setRedshift(z);
 }
 
+double SourceUniformRedshift::getDensity(const ParticleState &source, double redshift) const {
+	if ((redshift < zmin) || (redshift > zmax))
+		return 0;
+	return 1 / (zmax - zmin);
+}
+
 void SourceUniformRedshift::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniformRedshift: Uniform redshift in z = ";
@@ -926,6 +1404,17 @@ void SourceRedshiftEvolution::prepareCandidate(Candidate& candidate) const {
 	candidate.setRedshift(z);
 }
 
+double SourceRedshiftEvolution::getDensity(const ParticleState &source, double redshift) const {
+	if ((redshift < zmin) || (redshift > zmax))
+		return 0;
+	double norm;
+	if ((std::abs(m+1)) < std::numeric_limits<double>::epsilon())
+		norm = log1p(zmax) - log1p(zmin);
+	else
+		norm = ( pow(1+zmax, m+1) - pow(1+zmin, m+1) ) / (m+1);
+	return pow(1 + redshift, m) / norm;
+}
+
 // ----------------------------------------------------------------------------
 SourceRedshift1D::SourceRedshift1D() {
 	setDescription();
@@ -937,6 +1426,15 @@ void SourceRedshift1D::prepareCandidate(Candidate& candidate) const {
 	candidate.setRedshift(z);
 }
 
+void SourceRedshift1D::prepareCandidates(std::vector<ref_ptr<Candidate> > &candidates) const {
+	for (size_t i = 0; i < candidates.size(); i++)
+		candidates[i]->setRedshift(comovingDistance2Redshift(candidates[i]->source.getPosition().getR()));
+}
+
+double SourceRedshift1D::getDensity(const ParticleState &source, double redshift) const {
+	return sameValue(redshift, comovingDistance2Redshift(source.getPosition().getR())) ? 1 : 0;
+}
+
 void SourceRedshift1D::setDescription() {
 	description = "SourceRedshift1D: Redshift according to source distance\n";
 }
@@ -1008,6 +1506,20 @@ void SourceGenericComposition::add(int id, double weight) {
 		cdf.push_back(weight * n.cdf.back());
 	else
 		cdf.push_back(cdf.back() + weight * n.cdf.back());
+
+	// joint distribution of nucleus and energy bin, the bins of the nuclei in turn
+	std::vector<double> joint(nuclei.size() * bins);
+	double sum = 0;
+	for (size_t iN = 0; iN < nuclei.size(); iN++) {
+		const Nucleus &m = nuclei[iN];
+		double total = m.cdf.back();
+		double w = total > 0 ? (cdf[iN] - (iN > 0 ? cdf[iN - 1] : 0)) / total : 0;
+		for (size_t i = 0; i < bins; i++) {
+			sum += w * (m.cdf[i + 1] - m.cdf[i]);
+			joint[iN * bins + i] = sum;
+		}
+	}
+	alias = AliasTable(joint);
 }
 
 void SourceGenericComposition::add(int A, int Z, double a) {
@@ -1021,13 +1533,14 @@ void SourceGenericComposition::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 
-	// draw random particle type
-	size_t iN = random.randBin(cdf);
-	const Nucleus &n = nuclei.at(iN);
+	// draw random particle type and energy bin
+	size_t k = random.randBin(alias);
+	const Nucleus &n = nuclei.at(k / bins);
 	particle.setId(n.id);
 
-	// random energy
-	double E = interpolate(random.rand() * n.cdf.back(), n.cdf, energy);
+	// random energy, uniform within the bin as the cdf is linear in between
+	size_t i = k % bins;
+	double E = energy[i] + random.rand() * (energy[i + 1] - energy[i]);
 	particle.setEnergy(E);
 }
 
@@ -1047,6 +1560,10 @@ void SourceTag::prepareCandidate(Candidate &cand) const {
 	cand.setTagOrigin(sourceTag);
 }
 
+double SourceTag::getDensity(const ParticleState &source, double redshift) const {
+	return 1;
+}
+
 void SourceTag::setDescription() {
 	description = "SourceTag: " + sourceTag;
 }
@@ -1076,6 +1593,7 @@ void SourceMassDistribution::setXrange(double xMin, double xMax) {
 	}
 	this -> xMin = xMin;
 	this -> xMax = xMax;
+	initGrid();
 }
 
 void SourceMassDistribution::setYrange(double yMin, double yMax) {
@@ -1085,6 +1603,7 @@ void SourceMassDistribution::setYrange(double yMin, double yMax) {
 	}
 	this -> yMin = yMin;
 	this -> yMax = yMax;
+	initGrid();
 }
 
 void SourceMassDistribution::setZrange(double zMin, double zMax) {
@@ -1094,21 +1613,34 @@ void SourceMassDistribution::setZrange(double zMin, double zMax) {
 	}
 	this -> zMin = zMin;
 	this -> zMax = zMax;
+	initGrid();
 }
 
 Vector3d SourceMassDistribution::samplePosition() const {
 	Vector3d pos; 
 	Random &rand = Random::instance();
 
-	for (int i = 0; i < maxTries; i++) {
-		pos.x = rand.randUniform(xMin, xMax);
-		pos.y = rand.randUniform(yMin, yMax);
-		pos.z = rand.randUniform(zMin, zMax);
-
-		double n_density = density->getDensity(pos) / maxDensity;
-		double n_test = rand.rand();
-		if (n_test < n_density) {
-			return pos;
+	if (nx > 0) {
+		double dx = (xMax - xMin) / nx, dy = (yMax - yMin) / ny, dz = (zMax - zMin) / nz;
+		for (int i = 0; i < maxTries; i++) {
+			size_t cell = rand.randBin(cellAlias);
+			pos.x = xMin + (cell / (ny * nz) + rand.rand()) * dx;
+			pos.y = yMin + ((cell / nz) % ny + rand.rand()) * dy;
+			pos.z = zMin + (cell % nz + rand.rand()) * dz;
+			if (rand.rand() * cellMax[cell] < density->getDensity(pos))
+				return pos;
+		}
+	} else {
+		for (int i = 0; i < maxTries; i++) {
+			pos.x = rand.randUniform(xMin, xMax);
+			pos.y = rand.randUniform(yMin, yMax);
+			pos.z = rand.randUniform(zMin, zMax);
+
+			double n_density = density->getDensity(pos) / maxDensity;
+			double n_test = rand.rand();
+			if (n_test < n_density) {
+				return pos;
+			}
 		}
 	}
 	KISS_LOG_WARNING << "SourceMassDistribution: sampling a position was not possible within " 
@@ -1125,6 +1657,52 @@ void SourceMassDistribution::setMaximalTries(int tries) {
 	this -> maxTries = tries;
 }
 
+void SourceMassDistribution::setSamplingGrid(int nx, int ny, int nz) {
+	if ((nx < 0) or (ny < 0) or (nz < 0) or ((nx == 0) != (ny == 0)) or ((nx == 0) != (nz == 0))) {
+		KISS_LOG_WARNING << "SourceMassDistribution: number of grid cells must be positive or all 0. Nothing changed.\n";
+		return;
+	}
+	this -> nx = nx;
+	this -> ny = ny;
+	this -> nz = nz;
+	initGrid();
+}
+
+void SourceMassDistribution::initGrid() {
+	cellMax.clear();
+	cellAlias = AliasTable();
+	if (nx == 0)
+		return;
+
+	// density at the cell corners
+	double dx = (xMax - xMin) / nx, dy = (yMax - yMin) / ny, dz = (zMax - zMin) / nz;
+	std::vector<double> corners((nx + 1) * (ny + 1) * (nz + 1));
+	for (int ix = 0; ix <= nx; ix++)
+		for (int iy = 0; iy <= ny; iy++)
+			for (int iz = 0; iz <= nz; iz++)
+				corners[(ix * (ny + 1) + iy) * (nz + 1) + iz] = density->getDensity(
+						Vector3d(xMin + ix * dx, yMin + iy * dy, zMin + iz * dz));
+
+	// maximum of the corners and the center of each cell
+	cellMax.resize(nx * ny * nz);
+	std::vector<double> cdf(cellMax.size());
+	double sum = 0;
+	for (int ix = 0; ix < nx; ix++)
+		for (int iy = 0; iy < ny; iy++)
+			for (int iz = 0; iz < nz; iz++) {
+				double m = density->getDensity(Vector3d(xMin + (ix + 0.5) * dx, yMin + (iy + 0.5) * dy, zMin + (iz + 0.5) * dz));
+				for (int c = 0; c < 8; c++)
+					m = std::max(m, corners[((ix + (c >> 2)) * (ny + 1) + iy + ((c >> 1) & 1)) * (nz + 1) + iz + (c & 1)]);
+				size_t cell = (ix * ny + iy) * nz + iz;
+				cellMax[cell] = m;
+				sum += m;
+				cdf[cell] = sum;
+			}
+	if (sum <= 0)
+		throw std::runtime_error("SourceMassDistribution: density vanishes in the sampling range");
+	cellAlias = AliasTable(cdf);
+}
+
 std::string SourceMassDistribution::getDescription() {
 	std::stringstream ss;
 	ss << "SourceMassDistribuion: following the density distribution :\n";
@@ -1135,6 +1713,8 @@ std::string SourceMassDistribution::getDescription() {
 	ss << "\t y in [" << yMin / kpc << " ; " << yMax / kpc << "] kpc \n";
 	ss << "\t z in [" << zMin / kpc << " ; " << zMax / kpc << "] kpc \n";
 	ss << "with maximal number of tries for sampling of " << maxTries << "\n";
+	if (nx > 0)
+		ss << "in a sampling grid of " << nx << " x " << ny << " x " << nz << " cells \n";
 
 	return ss.str();
 }
@@ -0,0 +1,109 @@
+#include "crpropa/SymbolTable.h"
+
+#include <atomic>
+#include <unordered_map>
+#include <stdexcept>
+#include <sstream>
+
+namespace crpropa {
+
+// The strings are stored in fixed-size chunks which are never moved, so the
+// string of a handle can be read without holding the lock. The count is
+// published after the string is stored.
+static const size_t chunkBits = 10;
+static const size_t chunkSize = 1 << chunkBits;
+static const size_t maxChunks = 4096;
+
+struct SymbolStorage {
+	std::string *chunks[maxChunks];
+	std::unordered_map<std::string, Symbol> symbols;
+	std::atomic<size_t> count;
+
+	SymbolStorage() : count(0) {
+		for (size_t i = 0; i < maxChunks; i++)
+			chunks[i] = 0;
+	}
+
+	~SymbolStorage() {
+		for (size_t i = 0; i < maxChunks; i++)
+			delete[] chunks[i];
+	}
+};
+
+static SymbolStorage &storage() {
+	static SymbolStorage s;
+	return s;
+}
+
+// handles of the strings known to the calling thread
+static std::unordered_map<std::string, Symbol> &threadCache() {
+	static thread_local std::unordered_map<std::string, Symbol> cache;
+	return cache;
+}
+
+Symbol SymbolTable::intern(const std::string &name) {
+	std::unordered_map<std::string, Symbol> &cache = threadCache();
+	std::unordered_map<std::string, Symbol>::const_iterator i = cache.find(name);
+	if (i != cache.end())
+		return i->second;
+
+	SymbolStorage &s = storage();
+	Symbol symbol = -1;
+#pragma omp critical(SymbolTable)
+	{
+		std::unordered_map<std::string, Symbol>::const_iterator j = s.symbols.find(name);
+		if (j != s.symbols.end()) {
+			symbol = j->second;
+		} else {
+			size_t count = s.count.load(std::memory_order_relaxed);
+			if ((count >> chunkBits) < maxChunks) {
+				size_t chunk = count >> chunkBits;
+				if (s.chunks[chunk] == 0)
+					s.chunks[chunk] = new std::string[chunkSize];
+				s.chunks[chunk][count & (chunkSize - 1)] = name;
+				symbol = count;
+				s.symbols[name] = symbol;
+				s.count.store(count + 1, std::memory_order_release);
+			}
+		}
+	}
+	if (symbol < 0)
+		throw std::runtime_error("SymbolTable: too many symbols");
+	cache[name] = symbol;
+	return symbol;
+}
+
+Symbol SymbolTable::find(const std::string &name) {
+	std::unordered_map<std::string, Symbol> &cache = threadCache();
+	std::unordered_map<std::string, Symbol>::const_iterator i = cache.find(name);
+	if (i != cache.end())
+		return i->second;
+
+	SymbolStorage &s = storage();
+	Symbol symbol = -1;
+#pragma omp critical(SymbolTable)
+	{
+		std::unordered_map<std::string, Symbol>::const_iterator j = s.symbols.find(name);
+		if (j != s.symbols.end())
+			symbol = j->second;
+	}
+	if (symbol >= 0)
+		cache[name] = symbol;
+	return symbol;
+}
+
+const std::string &SymbolTable::name(Symbol symbol) {
+	SymbolStorage &s = storage();
+	if ((symbol < 0) || ((size_t)symbol >= s.count.load(std::memory_order_acquire))) {
+		std::stringstream ss;
+		ss << "SymbolTable: unknown symbol " << symbol;
+		throw std::runtime_error(ss.str());
+	}
+	return s.chunks[symbol >> chunkBits][symbol & (chunkSize - 1)];
+}
+
+size_t SymbolTable::size() {
+	return storage().count.load(std::memory_order_acquire);
+}
+
+} // namespace crpropa
@@ -0,0 +1,464 @@
+#include "crpropa/TableRegistry.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/Numa.h"
+#include "crpropa/Units.h"
+
+#include "crpropa/Common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+std::mutex registryMutex;
+std::map<std::string, ref_ptr<Referenced> > registry;
+bool registryEnabled = true;
+
+// tables only referenced by the registry, called with the lock held
+void release() {
+	std::map<std::string, ref_ptr<Referenced> >::iterator it = registry.begin();
+	while (it != registry.end()) {
+		if (it->second->getReferenceCount() == 1)
+			registry.erase(it++);
+		else
+			++it;
+	}
+}
+}
+
+ref_ptr<Referenced> TableRegistry::find(const std::string &key) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::map<std::string, ref_ptr<Referenced> >::iterator it = registry.find(key);
+	if (it == registry.end())
+		return ref_ptr<Referenced>();
+	return it->second;
+}
+
+ref_ptr<Referenced> TableRegistry::insert(const std::string &key, Referenced *table) {
+	ref_ptr<Referenced> ref = table;
+	std::lock_guard<std::mutex> lock(registryMutex);
+	release();
+	std::pair<std::map<std::string, ref_ptr<Referenced> >::iterator, bool> result =
+			registry.insert(std::make_pair(key, ref));
+	return result.first->second;
+}
+
+size_t TableRegistry::size() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return registry.size();
+}
+
+void TableRegistry::clear() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registry.clear();
+}
+
+void TableRegistry::setEnabled(bool enabled) {
+	registryEnabled = enabled;
+}
+
+bool TableRegistry::getEnabled() {
+	return registryEnabled;
+}
+
+CompactTable::CompactTable() : xmin(0), xmax(0), xscale(1), yscale(1), dx(0) {
+}
+
+CompactTable::CompactTable(const std::vector<double> &x, const std::vector<double> &y, double tolerance) :
+		xmin(0), xmax(0), xscale(1), yscale(1), dx(0) {
+	if (x.size() != y.size())
+		throw std::runtime_error("CompactTable: different number of x and y values");
+	if (x.empty())
+		return;
+	size_t n = x.size();
+	xmin = x.front();
+	xmax = x.back();
+	double xabs = std::max(std::fabs(xmin), std::fabs(xmax));
+	double yabs = 0;
+	for (size_t i = 0; i < n; i++)
+		yabs = std::max(yabs, std::fabs(y[i]));
+	if (xabs > 0)
+		xscale = xabs;
+	if (yabs > 0)
+		yscale = yabs;
+
+	// greedy resampling: extend each segment as long as it reproduces the skipped nodes
+	std::vector<size_t> keep(1, 0);
+	if (tolerance > 0) {
+		size_t a = 0;
+		for (size_t b = 2; b < n; b++) {
+			bool ok = true;
+			for (size_t i = a + 1; (i < b) && ok; i++) {
+				double yi = y[a] + (x[i] - x[a]) * (y[b] - y[a]) / (x[b] - x[a]);
+				ok = std::fabs(yi - y[i]) <= tolerance * std::fabs(y[i]);
+			}
+			if (!ok) {
+				a = b - 1;
+				keep.push_back(a);
+			}
+		}
+	} else {
+		for (size_t i = 1; i + 1 < n; i++)
+			keep.push_back(i);
+	}
+	if (n > 1)
+		keep.push_back(n - 1);
+
+	nodes.resize(keep.size());
+	for (size_t i = 0; i < keep.size(); i++) {
+		nodes[i].x = x[keep[i]] / xscale;
+		nodes[i].y = y[keep[i]] / yscale;
+	}
+
+	// O(1) interpolation for equidistant nodes
+	if (keep.size() > 1) {
+		double step = (xmax - xmin) / (keep.size() - 1);
+		bool equidistant = step > 0;
+		for (size_t i = 0; (i < keep.size()) && equidistant; i++)
+			equidistant = std::fabs(x[keep[i]] - (xmin + i * step)) <= 1e-9 * step;
+		if (equidistant)
+			dx = step;
+	}
+}
+
+double CompactTable::interpolate(double x) const {
+	if (nodes.empty())
+		throw std::runtime_error("CompactTable: empty table");
+	if (x <= xmin)
+		return nodes.front().y * yscale;
+	if (x >= xmax)
+		return nodes.back().y * yscale;
+	size_t i;
+	double t;
+	if (dx > 0) {
+		double p = (x - xmin) / dx;
+		i = std::min(static_cast<size_t>(p), nodes.size() - 2);
+		t = p - i;
+	} else {
+		// binary search of the last node with x_i <= x
+		double xs = x / xscale;
+		size_t lo = 0, hi = nodes.size() - 1;
+		while (hi - lo > 1) {
+			size_t mid = (lo + hi) / 2;
+			if (xs < nodes[mid].x)
+				hi = mid;
+			else
+				lo = mid;
+		}
+		i = lo;
+		t = (xs - nodes[i].x) / (nodes[i + 1].x - nodes[i].x);
+	}
+	double y0 = nodes[i].y, y1 = nodes[i + 1].y;
+	return (y0 + t * (y1 - y0)) * yscale;
+}
+
+double CompactTable::getMinX() const {
+	return xmin;
+}
+
+double CompactTable::getMaxX() const {
+	return xmax;
+}
+
+double CompactTable::getX(size_t i) const {
+	return nodes.at(i).x * xscale;
+}
+
+double CompactTable::getY(size_t i) const {
+	return nodes.at(i).y * yscale;
+}
+
+size_t CompactTable::size() const {
+	return nodes.size();
+}
+
+size_t CompactTable::getMemory() const {
+	return nodes.size() * sizeof(Node);
+}
+
+// values of m equidistant intervals on [x_a, x_b] from the linear interpolation
+// of the nodes a ... b, empty if they miss a node by more than the tolerance
+static std::vector<double> fitSegment(const std::vector<double> &x, const std::vector<double> &y,
+		size_t a, size_t b, size_t m, double tolerance) {
+	double h = (x[b] - x[a]) / m;
+	if (m == b - a) {
+		// the nodes of the table if they are equidistant
+		bool equidistant = true;
+		for (size_t k = 1; (k < m) && equidistant; k++)
+			equidistant = std::fabs(x[a + k] - (x[a] + k * h)) <= 1e-9 * h;
+		if (equidistant)
+			return std::vector<double>(y.begin() + a, y.begin() + b + 1);
+	}
+	std::vector<double> g(m + 1);
+	g[0] = y[a];
+	g[m] = y[b];
+	size_t j = a;
+	for (size_t k = 1; k < m; k++) {
+		double xk = x[a] + k * h;
+		while ((j + 1 < b) && (x[j + 1] <= xk))
+			j++;
+		g[k] = y[j] + (xk - x[j]) * (y[j + 1] - y[j]) / (x[j + 1] - x[j]);
+	}
+	for (size_t i = a + 1; i < b; i++) {
+		double t = (x[i] - x[a]) / h;
+		size_t k = std::min(static_cast<size_t>(t), m - 1);
+		double yi = g[k] + (t - k) * (g[k + 1] - g[k]);
+		if (std::fabs(yi - y[i]) > tolerance * std::fabs(y[i]))
+			return std::vector<double>();
+	}
+	return g;
+}
+
+namespace {
+struct SegmentPlan {
+	size_t a, b;
+	std::vector<double> values;
+};
+}
+
+// segments of the nodes a ... b with the fewest bytes: the coarsest fitting
+// spacing of the whole range or the segments of its halves
+static size_t planSegments(const std::vector<double> &x, const std::vector<double> &y,
+		size_t a, size_t b, double tolerance, size_t segmentSize, std::vector<SegmentPlan> &plan) {
+	SegmentPlan whole = {a, b, std::vector<double>()};
+	for (size_t m = 1; (m < b - a) && whole.values.empty(); m *= 2)
+		whole.values = fitSegment(x, y, a, b, m, tolerance);
+	if (whole.values.empty())
+		whole.values = fitSegment(x, y, a, b, b - a, tolerance);
+	size_t cost = whole.values.empty() ? size_t(-1) : segmentSize + whole.values.size() * sizeof(float);
+	if ((b - a > 1) && (whole.values.empty() || (whole.values.size() > 2))) {
+		std::vector<SegmentPlan> halves;
+		size_t split = planSegments(x, y, a, (a + b) / 2, tolerance, segmentSize, halves)
+				+ planSegments(x, y, (a + b) / 2, b, tolerance, segmentSize, halves);
+		if (split < cost) {
+			plan.insert(plan.end(), halves.begin(), halves.end());
+			return split;
+		}
+	}
+	plan.push_back(whole);
+	return cost;
+}
+
+AdaptiveTable::AdaptiveTable() : xmin(0), xmax(0), yscale(1), cellScale(0) {
+}
+
+AdaptiveTable::AdaptiveTable(const std::vector<double> &x, const std::vector<double> &y, double tolerance) :
+		xmin(0), xmax(0), yscale(1), cellScale(0) {
+	if (x.size() != y.size())
+		throw std::runtime_error("AdaptiveTable: different number of x and y values");
+	if (x.empty())
+		return;
+	size_t n = x.size();
+	for (size_t i = 1; i < n; i++)
+		if (!(x[i] > x[i - 1]))
+			throw std::runtime_error("AdaptiveTable: x has to be strictly increasing");
+	xmin = x.front();
+	xmax = x.back();
+	double yabs = 0;
+	for (size_t i = 0; i < n; i++)
+		yabs = std::max(yabs, std::fabs(y[i]));
+	if (yabs > 0)
+		yscale = yabs;
+
+	std::vector<SegmentPlan> plan;
+	if (n > 1)
+		planSegments(x, y, 0, n - 1, tolerance, sizeof(Segment), plan);
+	for (size_t i = 0; i < plan.size(); i++) {
+		const SegmentPlan &p = plan[i];
+		size_t m = p.values.size() - 1;
+		double scale = m / (x[p.b] - x[p.a]);
+		// join segments of the same spacing, which share the boundary node
+		if (!segments.empty() && (std::fabs(segments.back().scale - scale) <= 1e-9 * scale)) {
+			segments.back().intervals += m;
+			for (size_t k = 1; k <= m; k++)
+				values.push_back(p.values[k] / yscale);
+			continue;
+		}
+		Segment segment = {x[p.a], scale, uint32_t(values.size()), uint32_t(m)};
+		segments.push_back(segment);
+		for (size_t k = 0; k <= m; k++)
+			values.push_back(p.values[k] / yscale);
+	}
+	if (n == 1)
+		values.push_back(y[0] / yscale);
+
+	// cells narrower than the segments on average
+	if (!segments.empty()) {
+		size_t cells = std::min<size_t>(4 * segments.size(), 1 << 16);
+		cellScale = cells / (xmax - xmin);
+		directory.resize(cells);
+		size_t s = 0;
+		for (size_t c = 0; c < cells; c++) {
+			double xc = xmin + c / cellScale;
+			while ((s + 1 < segments.size()) && (segments[s + 1].x0 <= xc))
+				s++;
+			directory[c] = s;
+		}
+	}
+}
+
+double AdaptiveTable::interpolate(double x) const {
+	if (values.empty())
+		throw std::runtime_error("AdaptiveTable: empty table");
+	if (x <= xmin)
+		return values.front() * yscale;
+	if (x >= xmax)
+		return values.back() * yscale;
+	size_t c = std::min(static_cast<size_t>((x - xmin) * cellScale), directory.size() - 1);
+	size_t s = directory[c];
+	while ((s + 1 < segments.size()) && (x >= segments[s + 1].x0))
+		s++;
+	const Segment &segment = segments[s];
+	double p = (x - segment.x0) * segment.scale;
+	size_t i = std::min(static_cast<size_t>(p), size_t(segment.intervals - 1));
+	double t = p - i;
+	const float *v = &values[segment.offset + i];
+	return (v[0] + t * (v[1] - v[0])) * yscale;
+}
+
+double AdaptiveTable::getMinX() const {
+	return xmin;
+}
+
+double AdaptiveTable::getMaxX() const {
+	return xmax;
+}
+
+size_t AdaptiveTable::size() const {
+	return values.size();
+}
+
+size_t AdaptiveTable::getNumberOfSegments() const {
+	return segments.size();
+}
+
+size_t AdaptiveTable::getMemory() const {
+	return segments.size() * sizeof(Segment) + values.size() * sizeof(float)
+			+ directory.size() * sizeof(uint32_t);
+}
+
+RateTable::RateTable(const std::string &filename, double tolerance) : memory(MemoryUsage::Tables) {
+	DataTable table(filename);
+	for (size_t i = 0; i < table.size(); i++) {
+		if (table.columns(i) < 2)
+			continue;
+		energy.push_back(pow(10, table.get(i, 0)) * eV);
+		rate.push_back(table.get(i, 1) / Mpc);
+	}
+	if (tolerance >= 0) {
+		compact = CompactTable(energy, rate, tolerance);
+		std::vector<double>().swap(energy);
+		std::vector<double>().swap(rate);
+	}
+	memory.set((energy.size() + rate.size()) * sizeof(double) + compact.getMemory());
+	Numa::place(energy.data(), energy.size() * sizeof(double));
+	Numa::place(rate.data(), rate.size() * sizeof(double));
+}
+
+ref_ptr<RateTable> RateTable::load(const std::string &filename, double tolerance) {
+	if (tolerance < 0)
+		return TableRegistry::get<RateTable>("RateTable", filename);
+	return TableRegistry::get<RateTable>("RateTable", filename, tolerance);
+}
+
+bool RateTable::isCompact() const {
+	return compact.size() > 0;
+}
+
+double RateTable::getRate(double E) const {
+	if (compact.size() > 0)
+		return compact.interpolate(E);
+	return crpropa::interpolate(E, energy, rate);
+}
+
+double RateTable::getMinEnergy() const {
+	if (compact.size() > 0)
+		return compact.getMinX();
+	if (energy.empty())
+		throw std::runtime_error("RateTable: empty table");
+	return energy.front();
+}
+
+double RateTable::getMaxEnergy() const {
+	if (compact.size() > 0)
+		return compact.getMaxX();
+	if (energy.empty())
+		throw std::runtime_error("RateTable: empty table");
+	return energy.back();
+}
+
+CumulativeRateTable::CumulativeRateTable(const std::string &filename, bool compact) :
+		memory(MemoryUsage::Tables) {
+	DataTable table(filename);
+	if (table.size() == 0)
+		throw std::runtime_error("CumulativeRateTable: no values in file " + filename);
+
+	// s values in first row, skipping the first value
+	for (size_t j = 1; j < table.columns(0); j++)
+		s.push_back(pow(10, table.get(0, j)) * eV * eV);
+
+	// all following rows: E, cdf values
+	for (size_t i = 1; i < table.size(); i++) {
+		if (table.columns(i) < s.size() + 1)
+			throw std::runtime_error("CumulativeRateTable: missing values in file " + filename);
+		const double *row = table.row(i);
+		energy.push_back(pow(10, row[0]) * eV);
+		std::vector<double> values;
+		for (size_t j = 0; j < s.size(); j++)
+			values.push_back(row[j + 1] / Mpc);
+		AliasTable bins(values);
+		if (compact) {
+			for (size_t j = 0; j < bins.size(); j++) {
+				compactProbability.push_back(bins.getProbability(j));
+				compactAlias.push_back(bins.getAlias(j));
+			}
+		} else {
+			cdf.push_back(values);
+			alias.push_back(bins);
+		}
+	}
+	size_t bins = energy.size() * s.size();
+	if (compact) {
+		// probability and alias of each bin
+		memory.set((energy.size() + s.size()) * sizeof(double) + bins * (sizeof(float) + sizeof(uint32_t)));
+		Numa::place(compactProbability.data(), compactProbability.size() * sizeof(float));
+		Numa::place(compactAlias.data(), compactAlias.size() * sizeof(uint32_t));
+	} else {
+		// cdf values, and probability and alias of each bin
+		memory.set((energy.size() + s.size() + bins) * sizeof(double)
+				+ bins * (sizeof(double) + sizeof(uint32_t)));
+	}
+}
+
+ref_ptr<CumulativeRateTable> CumulativeRateTable::load(const std::string &filename, bool compact) {
+	if (!compact)
+		return TableRegistry::get<CumulativeRateTable>("CumulativeRateTable", filename);
+	return TableRegistry::get<CumulativeRateTable>("CumulativeRateTable", filename, true);
+}
+
+bool CumulativeRateTable::isCompact() const {
+	return alias.empty() && !compactAlias.empty();
+}
+
+size_t CumulativeRateTable::getEnergyIndex(double E) const {
+	return closestIndex(E, energy);
+}
+
+size_t CumulativeRateTable::sample(size_t i, double u) const {
+	if (!isCompact())
+		return alias.at(i).sample(u);
+	size_t n = s.size();
+	if ((n == 0) || (i >= energy.size()))
+		throw std::runtime_error("CumulativeRateTable: no alias table of the energy index");
+	const float *probability = &compactProbability[i * n];
+	double x = u * n;
+	size_t j = std::min(static_cast<size_t>(x), n - 1);
+	return (x - j < probability[j]) ? j : compactAlias[i * n + j];
+}
+
+} // namespace crpropa
@@ -0,0 +1,117 @@
+#include "crpropa/ThinningPolicy.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace crpropa {
+
+ThinningPolicy::ThinningPolicy(double alpha) :
+		defaultMinEnergy(0), discardedEnergy(0), discardedNumber(0) {
+	rules.resize(1);
+	rules[0].id = 0;
+	setDefault(alpha);
+}
+
+void ThinningPolicy::checkParameters(double alpha, double fraction, double maxEnergy) const {
+	if (alpha < 0)
+		throw std::runtime_error("ThinningPolicy: alpha < 0");
+	if (fraction <= 0)
+		throw std::runtime_error("ThinningPolicy: fraction <= 0");
+	if (maxEnergy < 0)
+		throw std::runtime_error("ThinningPolicy: maxEnergy < 0");
+}
+
+void ThinningPolicy::setDefault(double alpha, double fraction, double maxEnergy) {
+	checkParameters(alpha, fraction, maxEnergy);
+	rules[0].alpha = alpha;
+	rules[0].fraction = fraction;
+	rules[0].maxEnergy = maxEnergy;
+}
+
+void ThinningPolicy::set(int id, double alpha, double fraction, double maxEnergy) {
+	checkParameters(alpha, fraction, maxEnergy);
+	if (id == 0)
+		throw std::runtime_error("ThinningPolicy: invalid particle id 0");
+	Rule r;
+	r.id = std::abs(id);
+	r.alpha = alpha;
+	r.fraction = fraction;
+	r.maxEnergy = maxEnergy;
+	for (size_t i = 1; i < rules.size(); i++)
+		if (rules[i].id == r.id) {
+			rules[i] = r;
+			return;
+		}
+	rules.push_back(r);
+}
+
+const ThinningPolicy::Rule &ThinningPolicy::rule(int id) const {
+	id = std::abs(id);
+	for (size_t i = 1; i < rules.size(); i++)
+		if (rules[i].id == id)
+			return rules[i];
+	return rules[0];
+}
+
+double ThinningPolicy::getSurvivalProbability(int id, double E, double parentEnergy) const {
+	const Rule &r = rule(id);
+	if ((r.alpha == 0) or (parentEnergy <= 0))
+		return 1;
+	if ((r.maxEnergy > 0) and (E > r.maxEnergy))
+		return 1;
+	double x = E / (r.fraction * parentEnergy);
+	if (x >= 1)
+		return 1;
+	return std::pow(x, r.alpha);
+}
+
+void ThinningPolicy::setMinimumEnergy(double minEnergy) {
+	if (minEnergy < 0)
+		throw std::runtime_error("ThinningPolicy: minEnergy < 0");
+	defaultMinEnergy = minEnergy;
+}
+
+void ThinningPolicy::setMinimumEnergy(int id, double minEnergy) {
+	if (minEnergy < 0)
+		throw std::runtime_error("ThinningPolicy: minEnergy < 0");
+	Cut cut;
+	cut.id = std::abs(id);
+	cut.minEnergy = minEnergy;
+	for (size_t i = 0; i < cuts.size(); i++)
+		if (cuts[i].id == cut.id) {
+			cuts[i] = cut;
+			return;
+		}
+	cuts.push_back(cut);
+}
+
+double ThinningPolicy::getMinimumEnergy(int id) const {
+	id = std::abs(id);
+	for (size_t i = 0; i < cuts.size(); i++)
+		if (cuts[i].id == id)
+			return cuts[i].minEnergy;
+	return defaultMinEnergy;
+}
+
+void ThinningPolicy::discard(double E, double w) const {
+	double old = discardedEnergy.load(std::memory_order_relaxed);
+	while (not discardedEnergy.compare_exchange_weak(old, old + E * w, std::memory_order_relaxed))
+		;
+	discardedNumber.fetch_add(1, std::memory_order_relaxed);
+}
+
+double ThinningPolicy::getDiscardedEnergy() const {
+	return discardedEnergy.load();
+}
+
+uint64_t ThinningPolicy::getDiscardedNumber() const {
+	return discardedNumber.load();
+}
+
+void ThinningPolicy::clearDiscarded() {
+	discardedEnergy = 0;
+	discardedNumber = 0;
+}
+
+} // namespace crpropa
@@ -0,0 +1,178 @@
+#include "crpropa/Trace.h"
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+std::atomic<bool> Tracer::active(false);
+
+Tracer::Tracer() : epoch(std::chrono::steady_clock::now()), capacity(1000000), sampling(100) {
+}
+
+Tracer &Tracer::instance() {
+	static Tracer tracer;
+	return tracer;
+}
+
+Tracer::ThreadBuffer &Tracer::getBuffer() {
+	// the buffers are kept until the end of the program, also by clear()
+	static thread_local ThreadBuffer *buffer = 0;
+	if (!buffer) {
+		std::lock_guard<std::mutex> lock(mutex);
+		buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+		buffer = buffers.back().get();
+		buffer->thread = buffers.size() - 1;
+		buffer->dropped = 0;
+		buffer->steps = 0;
+	}
+	return *buffer;
+}
+
+void Tracer::setEnabled(bool enable) {
+	active.store(enable);
+}
+
+void Tracer::setSampling(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("Tracer: sampling interval must be positive");
+	sampling = n;
+}
+
+size_t Tracer::getSampling() const {
+	return sampling;
+}
+
+void Tracer::setCapacity(size_t events) {
+	capacity = events;
+}
+
+size_t Tracer::getCapacity() const {
+	return capacity;
+}
+
+void Tracer::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < buffers.size(); i++) {
+		std::vector<Event>().swap(buffers[i]->events);
+		buffers[i]->dropped = 0;
+		buffers[i]->steps = 0;
+	}
+	epoch = std::chrono::steady_clock::now();
+}
+
+double Tracer::now() const {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Tracer::record(const char *name, const char *category, double start, double duration, int64_t argument) {
+	ThreadBuffer &buffer = getBuffer();
+	if (buffer.events.size() >= capacity) {
+		buffer.dropped++;
+		return;
+	}
+	Event event = {name, category, start, duration, argument};
+	buffer.events.push_back(event);
+}
+
+void Tracer::instant(const char *name, const char *category, int64_t argument) {
+	if (enabled())
+		record(name, category, now(), -1, argument);
+}
+
+bool Tracer::sampleStep() {
+	ThreadBuffer &buffer = getBuffer();
+	return (buffer.steps++ % sampling) == 0;
+}
+
+size_t Tracer::getNumberOfEvents() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t n = 0;
+	for (size_t i = 0; i < buffers.size(); i++)
+		n += buffers[i]->events.size();
+	return n;
+}
+
+size_t Tracer::getNumberOfDroppedEvents() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t n = 0;
+	for (size_t i = 0; i < buffers.size(); i++)
+		n += buffers[i]->dropped;
+	return n;
+}
+
+std::vector<Tracer::Event> Tracer::getEvents() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Event> events;
+	for (size_t i = 0; i < buffers.size(); i++)
+		events.insert(events.end(), buffers[i]->events.begin(), buffers[i]->events.end());
+	return events;
+}
+
+// readable name of an event, e.g. the demangled type name of a module
+static std::string eventName(const char *name, const char *category) {
+	std::string result = name;
+#ifdef __GNUG__
+	if (std::string(category) == "module") {
+		int status = 0;
+		char *demangled = abi::__cxa_demangle(name, 0, 0, &status);
+		if (status == 0)
+			result = demangled;
+		free(demangled);
+	}
+#endif
+	if (result.compare(0, 9, "crpropa::") == 0)
+		result = result.substr(9);
+	std::string escaped;
+	for (size_t i = 0; i < result.size(); i++) {
+		if ((result[i] == '"') || (result[i] == '\\'))
+			escaped += '\\';
+		escaped += result[i];
+	}
+	return escaped;
+}
+
+std::string Tracer::getChromeTraceJSON() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::stringstream ss;
+	ss.precision(15);
+	ss << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	size_t dropped = 0;
+	for (size_t t = 0; t < buffers.size(); t++) {
+		const ThreadBuffer &buffer = *buffers[t];
+		dropped += buffer.dropped;
+		ss << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+			<< buffer.thread << ", \"args\": {\"name\": \"thread " << buffer.thread << "\"}}";
+		first = false;
+		for (size_t i = 0; i < buffer.events.size(); i++) {
+			const Event &e = buffer.events[i];
+			ss << ",\n{\"name\": \"" << eventName(e.name, e.category) << "\", \"cat\": \""
+				<< e.category << "\", \"pid\": 0, \"tid\": " << buffer.thread << ", \"ts\": " << e.start;
+			if (e.duration < 0)
+				ss << ", \"ph\": \"i\", \"s\": \"t\"";
+			else
+				ss << ", \"ph\": \"X\", \"dur\": " << e.duration;
+			if (e.argument >= 0)
+				ss << ", \"args\": {\"value\": " << e.argument << "}";
+			ss << "}";
+		}
+	}
+	ss << "\n], \"otherData\": {\"droppedEvents\": " << dropped << "}}\n";
+	return ss.str();
+}
+
+void Tracer::writeChromeTrace(const std::string &filename) const {
+	std::ofstream out(filename.c_str());
+	if (!out.good())
+		throw std::runtime_error("Tracer: could not open " + filename);
+	out << getChromeTraceJSON();
+}
+
+} // namespace crpropa
@@ -1,8 +1,30 @@
 #include "crpropa/advectionField/AdvectionField.h"
 
+#include <algorithm>
 
 namespace crpropa {
 
+void AdvectionField::getFieldsAt(const double *xyz, double *out, size_t n) const {
+	const size_t chunk = 64;
+	long nChunks = (n + chunk - 1) / chunk;
+#pragma omp parallel for schedule(static)
+	for (long c = 0; c < nChunks; c++) {
+		Vector3d positions[chunk], fields[chunk];
+		size_t i0 = c * chunk;
+		size_t m = std::min(chunk, n - i0);
+		const double *p = xyz + 3 * i0;
+		for (size_t j = 0; j < m; j++)
+			positions[j] = Vector3d(p[3 * j], p[3 * j + 1], p[3 * j + 2]);
+		getFields(positions, fields, m);
+		double *f = out + 3 * i0;
+		for (size_t j = 0; j < m; j++) {
+			f[3 * j] = fields[j].x;
+			f[3 * j + 1] = fields[j].y;
+			f[3 * j + 2] = fields[j].z;
+		}
+	}
+}
+
 
 
 void AdvectionFieldList::addField(ref_ptr<AdvectionField> field) {
@@ -24,6 +46,18 @@ double AdvectionFieldList::getDivergence(const Vector3d &position) const {
 	return D;
 }
 
+void AdvectionFieldList::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	field = Vector3d(0.);
+	divergence = 0.;
+	for (int i = 0; i < fields.size(); i++) {
+		Vector3d b;
+		double D;
+		fields[i]->getFieldAndDivergence(position, b, D);
+		field += b;
+		divergence += D;
+	}
+}
+
 
 //----------------------------------------------------------------
 UniformAdvectionField::UniformAdvectionField(const Vector3d &value) :
@@ -38,6 +72,11 @@ double UniformAdvectionField::getDivergence(const Vector3d &position) const {
 	return 0.;
 	}
 
+void UniformAdvectionField::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	field = value;
+	divergence = 0.;
+}
+
 std::string UniformAdvectionField::getDescription() const {
 	std::stringstream s;
 	s << "v0: " << value / km * sec << " km/s, ";
@@ -61,6 +100,12 @@ double ConstantSphericalAdvectionField::getDivergence(const Vector3d &position)
 	return 2*vWind/R;
 }
 
+void ConstantSphericalAdvectionField::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	Vector3d Pos = position-origin;
+	field = vWind * Pos.getUnitVector();
+	divergence = 2*vWind/Pos.getR();
+}
+
 void ConstantSphericalAdvectionField::setOrigin(const Vector3d o) {
 	origin=o;
 	return;
@@ -117,6 +162,20 @@ double SphericalAdvectionField::getDivergence(const Vector3d &position) const {
 	return D;
 }
 
+void SphericalAdvectionField::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	Vector3d Pos = position-origin;
+	double R = Pos.getR();
+	if (R>radius) {
+		field = Vector3d(0.);
+		divergence = 0.;
+		return;
+	}
+	// shared by field and divergence
+	double e = exp(-( pow(R, alpha)/tau ));
+	field = vMax * (1-e) * Pos.getUnitVector();
+	divergence = 2*vMax/R * ( 1-( 1-alpha*(pow(R, alpha)/(2*tau)) )*e );
+}
+
 double SphericalAdvectionField::getV(const double &r) const {
 	double f = vMax * (1-exp(-(pow(r, alpha)/tau)));
 	return f;
@@ -207,6 +266,15 @@ double OneDimensionalCartesianShock::getDivergence(const Vector3d &position) con
 	return -b / lShock * (1 - tanh(x / lShock) * tanh(x / lShock));
 }
 
+void OneDimensionalCartesianShock::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	double vDown = vUp / compressionRatio;
+	double a = (vUp + vDown) * 0.5;
+	double b = (vUp - vDown) * 0.5;
+	double c = tanh(position.x / lShock);
+	field = Vector3d(a - b * c, 0., 0.);
+	divergence = -b / lShock * (1 - c * c);
+}
+
 void OneDimensionalCartesianShock::setComp(double r) {
 	compressionRatio = r;
 	return;
@@ -294,6 +362,22 @@ double OneDimensionalSphericalShock::getDivergence(const Vector3d &position) con
 
 }
 
+void OneDimensionalSphericalShock::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	double r = position.getR();
+	double vDown = vUp / compressionRatio;
+	double a = (vUp + vDown) * 0.5;
+	double b = (vUp - vDown) * 0.5;
+	double c = tanh((r-rShock) / lShock);
+	double v = a - b * c;
+	if ((coolUpstream == true) && (r <= rShock)) {
+		divergence = 2 * a / r - 2 * b / r * c - b / lShock * (1 - c * c);
+	} else {
+		v = v * (rShock / r) * (rShock / r);
+		divergence = -(rShock / r) * (rShock / r) * b / lShock * (1 - c * c);
+	}
+	field = v * position.getUnitVector();
+}
+
 void OneDimensionalSphericalShock::setComp(double r) {
 	compressionRatio = r;
 	return;
@@ -382,6 +466,15 @@ double ObliqueAdvectionShock::getDivergence(const Vector3d &position) const {
 	return -b / lShock * (1 - tanh(x / lShock) * tanh(x / lShock));
 	}
 
+void ObliqueAdvectionShock::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	double vXDown = vXUp / compressionRatio;
+	double a = (vXUp + vXDown) * 0.5;
+	double b = (vXUp - vXDown) * 0.5;
+	double c = tanh(position.x / lShock);
+	field = Vector3d(a - b * c, vY, 0.);
+	divergence = -b / lShock * (1 - c * c);
+}
+
 void ObliqueAdvectionShock::setComp(double r) {
 	compressionRatio = r;
 	return;
@@ -461,6 +554,17 @@ double SphericalAdvectionShock::getDivergence(const Vector3d &pos) const {
 	return v_0 * (d1+d2);
 }
 
+void SphericalAdvectionShock::getFieldAndDivergence(const Vector3d &pos, Vector3d &field, double &divergence) const {
+	Vector3d R = pos-origin;
+	double r = R.getR();
+	double gr = g(r);
+	double s = pow(r_0/(2*r), 2.) -1;
+	double v_r = v_0 * ( 1 + s * gr);
+	double v_p = v_phi * (r_rot/r);
+	field = v_r * R.getUnitVector() + v_p * R.getUnitVectorPhi();
+	divergence = v_0 * (2./r*(1-gr) + s*g_prime(r));
+}
+
 
 double SphericalAdvectionShock::g(double r) const {
 	double a = (r-r_0)/lambda;
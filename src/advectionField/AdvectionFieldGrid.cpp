@@ -0,0 +1,74 @@
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+AdvectionFieldGrid::AdvectionFieldGrid(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence) {
+	setGrids(grid, divergence);
+}
+
+void AdvectionFieldGrid::setGrids(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence) {
+	if (!grid.valid() || !divergence.valid())
+		throw std::runtime_error("AdvectionFieldGrid: field and divergence grid needed");
+	if (!(grid->getOrigin() == divergence->getOrigin())
+			|| !(grid->getSpacing() == divergence->getSpacing())
+			|| (grid->getNx() != divergence->getNx())
+			|| (grid->getNy() != divergence->getNy())
+			|| (grid->getNz() != divergence->getNz()))
+		throw std::runtime_error("AdvectionFieldGrid: field and divergence grid differ in geometry");
+	this->grid = grid;
+	this->divergenceGrid = divergence;
+}
+
+ref_ptr<Grid3f> AdvectionFieldGrid::getGrid() {
+	return grid;
+}
+
+ref_ptr<Grid1f> AdvectionFieldGrid::getDivergenceGrid() {
+	return divergenceGrid;
+}
+
+Vector3d AdvectionFieldGrid::getField(const Vector3d &position) const {
+	return grid->interpolate(position);
+}
+
+double AdvectionFieldGrid::getDivergence(const Vector3d &position) const {
+	return divergenceGrid->interpolate(position);
+}
+
+void AdvectionFieldGrid::getFieldAndDivergence(const Vector3d &position, Vector3d &field, double &divergence) const {
+	field = grid->interpolate(position);
+	divergence = divergenceGrid->interpolate(position);
+}
+
+void AdvectionFieldGrid::getFields(const Vector3d *positions, Vector3d *fields, size_t n) const {
+	const size_t blockSize = 64;
+	Vector3f v[blockSize];
+	for (size_t first = 0; first < n; first += blockSize) {
+		size_t m = std::min(blockSize, n - first);
+		grid->interpolateMany(positions + first, v, m);
+		for (size_t i = 0; i < m; i++)
+			fields[first + i] = v[i];
+	}
+}
+
+void AdvectionFieldGrid::getDivergences(const Vector3d *positions, double *divergences, size_t n) const {
+	const size_t blockSize = 64;
+	float d[blockSize];
+	for (size_t first = 0; first < n; first += blockSize) {
+		size_t m = std::min(blockSize, n - first);
+		divergenceGrid->interpolateMany(positions + first, d, m);
+		for (size_t i = 0; i < m; i++)
+			divergences[first + i] = d[i];
+	}
+}
+
+std::string AdvectionFieldGrid::getDescription() const {
+	std::stringstream s;
+	s << "AdvectionFieldGrid: " << grid->getNx() << " x " << grid->getNy() << " x "
+			<< grid->getNz() << " cells with spacing " << grid->getSpacing() / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
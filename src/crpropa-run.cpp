@@ -0,0 +1,67 @@
+// Runs a simulation from a JSON configuration, see crpropa::SimulationConfig
+
+#include "crpropa/Configuration.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace crpropa;
+
+static void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [options] config.json\n"
+		<< "Options override the \"run\" section of the configuration:\n"
+		<< "  -n count    number of candidates\n"
+		<< "  -s seed     seed of the random number generators\n"
+		<< "  -t threads  number of OpenMP threads\n"
+		<< "  -p          show a progress bar\n"
+		<< "  -d          print the modules and the source and exit\n";
+}
+
+int main(int argc, char **argv) {
+	std::string filename;
+	ConfigNode overrides = ConfigNode::emptyObject();
+	bool describe = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (((arg == "-n") || (arg == "-s") || (arg == "-t")) && (i + 1 < argc)) {
+			const char *key = (arg == "-n") ? "count" : ((arg == "-s") ? "seed" : "threads");
+			overrides.set(key, ConfigNode::fromNumber(atof(argv[++i])));
+		} else if (arg == "-p") {
+			overrides.set("showProgress", ConfigNode::fromBool(true));
+		} else if (arg == "-d") {
+			describe = true;
+		} else if ((arg[0] != '-') && filename.empty()) {
+			filename = arg;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (filename.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	try {
+		ConfigNode config = ConfigNode::load(filename);
+		ConfigNode run = config.has("run") ? config["run"] : ConfigNode::emptyObject();
+		std::vector<std::string> keys = overrides.getKeys();
+		for (size_t i = 0; i < keys.size(); i++)
+			run.set(keys[i], overrides[keys[i]]);
+		config.set("run", run);
+
+		ref_ptr<SimulationConfig> simulation = new SimulationConfig(config);
+		if (describe) {
+			std::cout << simulation->getModuleList()->getDescription();
+			std::cout << simulation->getSource()->getDescription() << std::endl;
+			return 0;
+		}
+		simulation->run();
+	} catch (std::exception &e) {
+		std::cerr << "crpropa-run: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,242 @@
+#include "crpropa/magneticField/CachedMagneticField.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace crpropa {
+
+static const char cacheMagic[8] = {'C', 'R', 'P', 'B', 'C', 'A', 'C', 'H'};
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t coordinates;
+	uint32_t reserved;
+	uint64_t N[3];
+	double lower[3], upper[3], tolerance;
+};
+
+CachedMagneticField::CachedMagneticField(ref_ptr<MagneticField> field,
+		const Vector3d &origin, const Vector3d &size, double spacing,
+		double tolerance) :
+		field(field), coordinates(CARTESIAN), lower(origin),
+		upper(origin + size), tolerance(tolerance) {
+	if (spacing <= 0)
+		throw std::runtime_error("CachedMagneticField: spacing must be positive");
+	if ((size.x <= 0) || (size.y <= 0) || (size.z <= 0))
+		throw std::runtime_error("CachedMagneticField: empty region");
+	init(ceil(size.x / spacing) + 1, ceil(size.y / spacing) + 1, ceil(size.z / spacing) + 1);
+	sample();
+}
+
+CachedMagneticField::CachedMagneticField(ref_ptr<MagneticField> field,
+		double rMin, double rMax, double zMin, double zMax, size_t nR,
+		size_t nPhi, size_t nZ, bool logRadial, double tolerance) :
+		field(field), coordinates(logRadial ? LOG_CYLINDRICAL : CYLINDRICAL),
+		tolerance(tolerance) {
+	if ((rMin < 0) || (rMax <= rMin) || (zMax <= zMin))
+		throw std::runtime_error("CachedMagneticField: empty region");
+	if (logRadial && (rMin <= 0))
+		throw std::runtime_error("CachedMagneticField: logarithmic radii need rMin > 0");
+	double r0 = logRadial ? log(rMin) : rMin;
+	double r1 = logRadial ? log(rMax) : rMax;
+	lower = Vector3d(r0, -M_PI, zMin);
+	upper = Vector3d(r1, M_PI, zMax);
+	init(nR, nPhi, nZ);
+	sample();
+}
+
+CachedMagneticField::CachedMagneticField(ref_ptr<MagneticField> field,
+		const std::string &filename) : field(field) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("CachedMagneticField: could not open file " + filename);
+	CacheHeader header;
+	if (!in.read((char *) &header, sizeof(header))
+			|| (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0)
+			|| (header.coordinates > LOG_CYLINDRICAL))
+		throw std::runtime_error("CachedMagneticField: not a cached field file " + filename);
+	coordinates = Coordinates(header.coordinates);
+	lower = Vector3d(header.lower);
+	upper = Vector3d(header.upper);
+	tolerance = header.tolerance;
+	init(header.N[0], header.N[1], header.N[2]);
+	in.read((char *) values.data(), values.size() * sizeof(Vector3f));
+	in.read(exact.data(), exact.size());
+	if (!in)
+		throw std::runtime_error("CachedMagneticField: could not read file " + filename);
+}
+
+void CachedMagneticField::init(size_t n0, size_t n1, size_t n2) {
+	N[0] = n0;
+	N[1] = n1;
+	N[2] = n2;
+	for (int a = 0; a < 3; a++)
+		if (N[a] < (isPeriodic(a) ? 1 : 2))
+			throw std::runtime_error("CachedMagneticField: too few nodes");
+	Vector3d size = upper - lower;
+	for (int a = 0; a < 3; a++)
+		spacing.data[a] = size.data[a] / numberOfCells(a);
+	values.resize(N[0] * N[1] * N[2]);
+	exact.assign(numberOfCells(0) * numberOfCells(1) * numberOfCells(2), 0);
+}
+
+bool CachedMagneticField::isPeriodic(int axis) const {
+	return (axis == 1) && (coordinates != CARTESIAN);
+}
+
+size_t CachedMagneticField::numberOfCells(int axis) const {
+	return isPeriodic(axis) ? N[axis] : N[axis] - 1;
+}
+
+void CachedMagneticField::sample() {
+#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i < N[0]; i++)
+		for (size_t j = 0; j < N[1]; j++)
+			for (size_t k = 0; k < N[2]; k++) {
+				Vector3d u = lower + Vector3d(double(i), double(j), double(k)) * spacing;
+				values[(i * N[1] + j) * N[2] + k] = storedField(u);
+			}
+
+	if (tolerance <= 0)
+		return;
+
+	size_t c1 = numberOfCells(1), c2 = numberOfCells(2);
+#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i < numberOfCells(0); i++)
+		for (size_t j = 0; j < c1; j++)
+			for (size_t k = 0; k < c2; k++) {
+				size_t cell[3] = {i, j, k};
+				double f[3] = {0.5, 0.5, 0.5};
+				Vector3d u = lower + (Vector3d(double(i), double(j), double(k)) + 0.5) * spacing;
+				Vector3d p = fromGrid(u);
+				Vector3d b = field->getField(p);
+				if ((b - toCartesian(interpolate(cell, f), p)).getR() > tolerance)
+					exact[(i * c1 + j) * c2 + k] = 1;
+			}
+}
+
+Vector3d CachedMagneticField::toGrid(const Vector3d &p) const {
+	if (coordinates == CARTESIAN)
+		return p;
+	double r = sqrt(p.x * p.x + p.y * p.y);
+	return Vector3d((coordinates == LOG_CYLINDRICAL) ? log(r) : r, atan2(p.y, p.x), p.z);
+}
+
+Vector3d CachedMagneticField::fromGrid(const Vector3d &u) const {
+	if (coordinates == CARTESIAN)
+		return u;
+	double r = (coordinates == LOG_CYLINDRICAL) ? exp(u.x) : u.x;
+	return Vector3d(r * cos(u.y), r * sin(u.y), u.z);
+}
+
+Vector3f CachedMagneticField::storedField(const Vector3d &u) const {
+	Vector3d b = field->getField(fromGrid(u));
+	if (coordinates == CARTESIAN)
+		return Vector3f(b);
+	double c = cos(u.y), s = sin(u.y);
+	return Vector3f(b.x * c + b.y * s, -b.x * s + b.y * c, b.z);
+}
+
+Vector3d CachedMagneticField::toCartesian(const Vector3f &b, const Vector3d &p) const {
+	if (coordinates == CARTESIAN)
+		return Vector3d(b);
+	double r = sqrt(p.x * p.x + p.y * p.y);
+	if (r == 0)
+		return Vector3d(b);
+	double c = p.x / r, s = p.y / r;
+	return Vector3d(b.x * c - b.y * s, b.x * s + b.y * c, b.z);
+}
+
+bool CachedMagneticField::locate(const Vector3d &u, size_t cell[3], double f[3]) const {
+	for (int a = 0; a < 3; a++) {
+		double x = (u.data[a] - lower.data[a]) / spacing.data[a];
+		if (isPeriodic(a)) {
+			double i = floor(x);
+			f[a] = x - i;
+			cell[a] = ((long(i) % long(N[a])) + N[a]) % N[a];
+			continue;
+		}
+		if ((x < 0) || (x > numberOfCells(a)))
+			return false;
+		cell[a] = std::min(size_t(x), numberOfCells(a) - 1);
+		f[a] = x - cell[a];
+	}
+	return true;
+}
+
+Vector3f CachedMagneticField::interpolate(const size_t cell[3], const double f[3]) const {
+	size_t i0 = cell[0], j0 = cell[1], k0 = cell[2];
+	size_t i1 = i0 + 1, j1 = (j0 + 1) % N[1], k1 = k0 + 1;
+	if (!isPeriodic(1))
+		j1 = j0 + 1;
+	double fX0 = f[0], fY0 = f[1], fZ0 = f[2];
+	double fX1 = 1 - fX0, fY1 = 1 - fY0, fZ1 = 1 - fZ0;
+
+	const Vector3f *v = values.data();
+	size_t n1 = N[1], n2 = N[2];
+	Vector3f b(0.);
+	b += v[(i0 * n1 + j0) * n2 + k0] * (fX1 * fY1 * fZ1);
+	b += v[(i1 * n1 + j0) * n2 + k0] * (fX0 * fY1 * fZ1);
+	b += v[(i0 * n1 + j1) * n2 + k0] * (fX1 * fY0 * fZ1);
+	b += v[(i0 * n1 + j0) * n2 + k1] * (fX1 * fY1 * fZ0);
+	b += v[(i1 * n1 + j0) * n2 + k1] * (fX0 * fY1 * fZ0);
+	b += v[(i0 * n1 + j1) * n2 + k1] * (fX1 * fY0 * fZ0);
+	b += v[(i1 * n1 + j1) * n2 + k0] * (fX0 * fY0 * fZ1);
+	b += v[(i1 * n1 + j1) * n2 + k1] * (fX0 * fY0 * fZ0);
+	return b;
+}
+
+Vector3d CachedMagneticField::getField(const Vector3d &position) const {
+	size_t cell[3];
+	double f[3];
+	if (!locate(toGrid(position), cell, f))
+		return field->getField(position);
+	if (exact[(cell[0] * numberOfCells(1) + cell[1]) * numberOfCells(2) + cell[2]])
+		return field->getField(position);
+	return toCartesian(interpolate(cell, f), position);
+}
+
+void CachedMagneticField::save(const std::string &filename) const {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.is_open())
+		throw std::runtime_error("CachedMagneticField: could not create file " + filename);
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.coordinates = coordinates;
+	for (int a = 0; a < 3; a++) {
+		header.N[a] = N[a];
+		header.lower[a] = lower.data[a];
+		header.upper[a] = upper.data[a];
+	}
+	header.tolerance = tolerance;
+	out.write((const char *) &header, sizeof(header));
+	out.write((const char *) values.data(), values.size() * sizeof(Vector3f));
+	out.write(exact.data(), exact.size());
+	if (!out)
+		throw std::runtime_error("CachedMagneticField: could not write file " + filename);
+}
+
+ref_ptr<MagneticField> CachedMagneticField::getWrappedField() const {
+	return field;
+}
+
+CachedMagneticField::Coordinates CachedMagneticField::getCoordinates() const {
+	return coordinates;
+}
+
+size_t CachedMagneticField::getNumberOfExactCells() const {
+	size_t n = 0;
+	for (size_t i = 0; i < exact.size(); i++)
+		n += exact[i];
+	return n;
+}
+
+size_t CachedMagneticField::getSizeOf() const {
+	return values.size() * sizeof(Vector3f) + exact.size();
+}
+
+} // namespace crpropa
@@ -20,6 +20,7 @@ JF12Field::JF12Field() {
 	tanPitch = tan(pitch);
 	cotPitch =  1. / tanPitch;
 	tan90MinusPitch = tan(M_PI / 2 - pitch);
+	armTurnFactor = exp(-2 * M_PI / tan90MinusPitch);
 
 	rArms[0] = 5.1 * kpc;
 	rArms[1] = 6.3 * kpc;
@@ -195,6 +196,20 @@ double JF12Field::logisticFunction(const double& x, const double& x0, const doub
 	return 1. / (1. + exp(-2. * (fabs(x) - x0) / w));
 }
 
+int JF12Field::getSpiralArm(const double& r, const double& phi) const {
+	// radius where the spiral through (r, phi) crosses the negative x-axis,
+	// within the outermost arm after at most two more turns
+	double r_negx = r * exp(-(phi - M_PI) / tan90MinusPitch);
+	r_negx *= (r_negx > rArms[7]) ? armTurnFactor : 1.;
+	r_negx *= (r_negx > rArms[7]) ? armTurnFactor : 1.;
+
+	// first arm with r_negx < rArms[i], the radii are increasing
+	int arm = 0;
+	for (int i = 0; i < 7; i++)
+		arm += (r_negx >= rArms[i]);
+	return arm;
+}
+
 Vector3d JF12Field::getRegularField(const Vector3d& pos) const {
 	Vector3d b(0.);
 
@@ -203,17 +218,22 @@ Vector3d JF12Field::getRegularField(const Vector3d& pos) const {
 	if (d < 20 * kpc) {
 		double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
 		double phi = pos.getPhi(); // azimuth
-		double sinPhi = sin(phi);
-		double cosPhi = cos(phi);
-
-		b += getDiskField(r, pos.z, phi, sinPhi, cosPhi);
-		b += getToroidalHaloField(r, pos.z, sinPhi, cosPhi);
-		b += getXField(r, pos.z, sinPhi, cosPhi);
+		double sinPhi = (r > 0) ? pos.y / r : 0.;
+		double cosPhi = (r > 0) ? pos.x / r : 1.;
+		b = getRegularField(r, pos.z, phi, sinPhi, cosPhi);
 	}
 
 	return b;
 }
 
+Vector3d JF12Field::getRegularField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const {
+	Vector3d b(0.);
+	b += getDiskField(r, z, phi, sinPhi, cosPhi);
+	b += getToroidalHaloField(r, z, sinPhi, cosPhi);
+	b += getXField(r, z, sinPhi, cosPhi);
+	return b;
+}
+
 Vector3d JF12Field::getDiskField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const {
 	Vector3d b(0.);
 	if (useDiskField) {
@@ -227,16 +247,7 @@ Vector3d JF12Field::getDiskField(const double& r, const double& z, const double&
 				b.y += bMag * cosPhi;
 			} else {
 				// spiral region
-				double r_negx = r * exp(-(phi - M_PI) / tan90MinusPitch);
-				if (r_negx > rArms[7])
-					r_negx = r * exp(-(phi + M_PI) / tan90MinusPitch);
-				if (r_negx > rArms[7])
-					r_negx = r * exp(-(phi + 3 * M_PI) / tan90MinusPitch);
-
-				for (int i = 7; i >= 0; i--)
-					if (r_negx < rArms[i])
-						bMag = bDisk[i];
-
+				bMag = bDisk[getSpiralArm(r, phi)];
 				bMag *= (5 * kpc / r) * (1 - lfDisk);
 				b.x += bMag * (sinPitch * cosPhi - cosPitch * sinPhi);
 				b.y += bMag * (sinPitch * sinPhi + cosPitch * cosPhi);
@@ -275,12 +286,11 @@ Vector3d JF12Field::getXField(const double& r, const double& z, const double& si
 		if (r < rc) {
 			// varying elevation region
 			rp = r * rXc / rc;
-			bMagX = bX * exp(-1 * rp / rX) * pow(rXc / rc, 2.);
-			double thetaX = atan2(fabs(z), (r - rp));
-			if (z == 0)
-				thetaX = M_PI / 2.;
-			sinThetaX = sin(thetaX);
-			cosThetaX = cos(thetaX);
+			bMagX = bX * exp(-1 * rp / rX) * (rXc / rc) * (rXc / rc);
+			// elevation angle atan2(|z|, r - rp), pi / 2 in the plane
+			double h = sqrt(z * z + (r - rp) * (r - rp));
+			sinThetaX = (z == 0) ? 1. : fabs(z) / h;
+			cosThetaX = (z == 0) ? 0. : (r - rp) / h;
 		} else {
 			// constant elevation region
 			rp = r - fabs(z) / tanThetaX0;
@@ -307,33 +317,29 @@ double JF12Field::getTurbulentStrength(const Vector3d& pos) const {
 
 	double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
 	double phi = pos.getPhi(); // azimuth
+	return getTurbulentStrength(r, pos.z, phi);
+}
 
+double JF12Field::getTurbulentStrength(const double& r, const double& z, const double& phi) const {
 	// disk
 	double bDisk = 0;
 	if (r < 5 * kpc) {
 		bDisk = bDiskTurb5;
 	} else {
 		// spiral region
-		double r_negx = r * exp(-(phi - M_PI) / tan90MinusPitch);
-		if (r_negx > rArms[7])
-			r_negx = r * exp(-(phi + M_PI) / tan90MinusPitch);
-		if (r_negx > rArms[7])
-			r_negx = r * exp(-(phi + 3 * M_PI) / tan90MinusPitch);
-
-		for (int i = 7; i >= 0; i--)
-			if (r_negx < rArms[i])
-				bDisk = bDiskTurb[i];
-
+		bDisk = bDiskTurb[getSpiralArm(r, phi)];
 		bDisk *= (5 * kpc) / r;
 	}
-	bDisk *= exp(-0.5 * pow(pos.z / zDiskTurb, 2));
+	double zd = z / zDiskTurb;
+	bDisk *= exp(-0.5 * zd * zd);
 
 	// halo
+	double zh = z / zHaloTurb;
 	double bHalo = bHaloTurb * exp(-r / rHaloTurb)
-			* exp(-0.5 * pow(pos.z / zHaloTurb, 2));
+			* exp(-0.5 * zh * zh);
 
 	// modulate turbulent field
-	return sqrt(pow(bDisk, 2) + pow(bHalo, 2));
+	return sqrt(bDisk * bDisk + bHalo * bHalo);
 }
 
 Vector3d JF12Field::getTurbulentField(const Vector3d& pos) const {
@@ -351,7 +357,43 @@ Vector3d JF12Field::getField(const Vector3d& pos) const {
 	return b;
 }
 
-
+void JF12Field::getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+	const size_t blockSize = 16;
+	double r[blockSize], phi[blockSize], sinPhi[blockSize], cosPhi[blockSize];
+	bool inside[blockSize];
+	Vector3f turbulent[blockSize];
+
+	for (size_t first = 0; first < n; first += blockSize) {
+		size_t m = std::min(blockSize, n - first);
+		const Vector3d *pos = positions + first;
+
+		// cylindrical coordinates, shared by all components
+		for (size_t i = 0; i < m; i++) {
+			inside[i] = pos[i].getR() < 20 * kpc;
+			r[i] = sqrt(pos[i].x * pos[i].x + pos[i].y * pos[i].y);
+			sinPhi[i] = (r[i] > 0) ? pos[i].y / r[i] : 0.;
+			cosPhi[i] = (r[i] > 0) ? pos[i].x / r[i] : 1.;
+		}
+		for (size_t i = 0; i < m; i++)
+			phi[i] = pos[i].getPhi();
+
+		if (useTurbulentField)
+			turbulentGrid->interpolateMany(pos, turbulent, m);
+
+		for (size_t i = 0; i < m; i++) {
+			Vector3d b(0.);
+			if (useTurbulentField && (pos[i].getR() <= 20 * kpc))
+				b += Vector3d(turbulent[i]) * getTurbulentStrength(r[i], pos[i].z, phi[i]);
+			if ((useStriatedField || useRegularField) && inside[i]) {
+				Vector3d bReg = getRegularField(r[i], pos[i].z, phi[i], sinPhi[i], cosPhi[i]);
+				if (useStriatedField)
+					bReg *= 1. + sqrtbeta * striatedGrid->closestValue(pos[i]);
+				b += bReg;
+			}
+			fields[first + i] = b;
+		}
+	}
+}
 
 PlanckJF12bField::PlanckJF12bField() : JF12Field::JF12Field(){
 	// regular field parameters
@@ -1,7 +1,31 @@
 #include "crpropa/magneticField/MagneticField.h"
 
+#include <algorithm>
+
 namespace crpropa {
 
+void MagneticField::getFieldsAt(const double *xyz, double *out, size_t n,
+		double z) const {
+	const size_t chunk = 64;
+	long nChunks = (n + chunk - 1) / chunk;
+#pragma omp parallel for schedule(static)
+	for (long c = 0; c < nChunks; c++) {
+		Vector3d positions[chunk], fields[chunk];
+		size_t i0 = c * chunk;
+		size_t m = std::min(chunk, n - i0);
+		const double *p = xyz + 3 * i0;
+		for (size_t j = 0; j < m; j++)
+			positions[j] = Vector3d(p[3 * j], p[3 * j + 1], p[3 * j + 2]);
+		getFields(positions, fields, m, z);
+		double *f = out + 3 * i0;
+		for (size_t j = 0; j < m; j++) {
+			f[3 * j] = fields[j].x;
+			f[3 * j + 1] = fields[j].y;
+			f[3 * j + 2] = fields[j].z;
+		}
+	}
+}
+
 PeriodicMagneticField::PeriodicMagneticField(ref_ptr<MagneticField> field,
 		const Vector3d &extends) :
 		field(field), extends(extends), origin(0, 0, 0), reflective(false) {
@@ -57,25 +81,322 @@ Vector3d PeriodicMagneticField::getField(const Vector3d &position) const {
 	return field->getField(p);
 }
 
+BoundedMagneticField::BoundedMagneticField(ref_ptr<MagneticField> field,
+		const Vector3d &lower, const Vector3d &upper) :
+		field(field), lower(lower), upper(upper) {
+}
+
+static Vector3d componentMin(const Vector3d &a, const Vector3d &b) {
+	return Vector3d(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+
+static Vector3d componentMax(const Vector3d &a, const Vector3d &b) {
+	return Vector3d(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+static bool isInBox(const Vector3d &p, const Vector3d &lower, const Vector3d &upper) {
+	return (p.x >= lower.x) && (p.x <= upper.x) && (p.y >= lower.y)
+			&& (p.y <= upper.y) && (p.z >= lower.z) && (p.z <= upper.z);
+}
+
+Vector3d BoundedMagneticField::getField(const Vector3d &position) const {
+	if (!isInBox(position, lower, upper))
+		return Vector3d(0.);
+	return field->getField(position);
+}
+
+Vector3d BoundedMagneticField::getField(const Vector3d &position, double z) const {
+	if (!isInBox(position, lower, upper))
+		return Vector3d(0.);
+	return field->getField(position, z);
+}
+
+bool BoundedMagneticField::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	lower = this->lower;
+	upper = this->upper;
+	return true;
+}
+
+ref_ptr<MagneticField> BoundedMagneticField::getWrappedField() const {
+	return field;
+}
+
+MagneticFieldList::MagneticFieldList() : frozen(false) {
+}
+
 void MagneticFieldList::addField(ref_ptr<MagneticField> field) {
 	fields.push_back(field);
+	frozen = false;
+	terms.clear();
+	boundedTerms.clear();
+	constants.clear();
+}
+
+void MagneticFieldList::freeze() {
+	terms.clear();
+	boundedTerms.clear();
+	constants.clear();
+	for (size_t i = 0; i < fields.size(); i++)
+		flatten(fields[i], 0, false, Vector3d(0.), Vector3d(0.));
+	buildIndex();
+	frozen = true;
+}
+
+void MagneticFieldList::flatten(ref_ptr<MagneticField> field, double m,
+		bool bounded, Vector3d lower, Vector3d upper) {
+	if (const MagneticFieldList *list = dynamic_cast<const MagneticFieldList *>(field.get())) {
+		for (size_t i = 0; i < list->fields.size(); i++)
+			flatten(list->fields[i], m, bounded, lower, upper);
+		return;
+	}
+	if (const MagneticFieldEvolution *evolution = dynamic_cast<const MagneticFieldEvolution *>(field.get())) {
+		flatten(evolution->getWrappedField(), m + evolution->getEvolution(), bounded, lower, upper);
+		return;
+	}
+
+	// restrict to the box of the field, the box is checked by the index
+	Vector3d fieldLower, fieldUpper;
+	bool isBounded = field->getBoundingBox(fieldLower, fieldUpper);
+	if (isBounded && bounded) {
+		lower = componentMax(lower, fieldLower);
+		upper = componentMin(upper, fieldUpper);
+		if ((lower.x > upper.x) || (lower.y > upper.y) || (lower.z > upper.z))
+			return; // the boxes do not overlap
+	} else if (isBounded) {
+		lower = fieldLower;
+		upper = fieldUpper;
+	}
+	bounded |= isBounded;
+	if (const BoundedMagneticField *b = dynamic_cast<const BoundedMagneticField *>(field.get())) {
+		flatten(b->getWrappedField(), m, bounded, lower, upper);
+		return;
+	}
+
+	const UniformMagneticField *uniform = dynamic_cast<const UniformMagneticField *>(field.get());
+	if (uniform && !bounded) {
+		addConstant(uniform->getValue(), m);
+		return;
+	}
+	Term term = {field.get(), m, lower, upper};
+	if (bounded)
+		boundedTerms.push_back(term);
+	else
+		terms.push_back(term);
+}
+
+void MagneticFieldList::addConstant(const Vector3d &value, double m) {
+	for (size_t i = 0; i < constants.size(); i++)
+		if (constants[i].m == m) {
+			constants[i].value += value;
+			return;
+		}
+	Constant constant = {value, m};
+	constants.push_back(constant);
+}
+
+void MagneticFieldList::buildIndex() {
+	cellStart.clear();
+	cellTerms.clear();
+	if (boundedTerms.empty())
+		return;
+
+	indexLower = boundedTerms[0].lower;
+	indexUpper = boundedTerms[0].upper;
+	for (size_t i = 1; i < boundedTerms.size(); i++) {
+		indexLower = componentMin(indexLower, boundedTerms[i].lower);
+		indexUpper = componentMax(indexUpper, boundedTerms[i].upper);
+	}
+	Vector3d size = indexUpper - indexLower;
+	for (int a = 0; a < 3; a++) {
+		nCells[a] = (size.data[a] > 0) ? 16 : 1;
+		cellSize.data[a] = (size.data[a] > 0) ? size.data[a] / nCells[a] : 1;
+	}
+
+	// range of cells overlapping each box
+	std::vector<int> range(boundedTerms.size() * 6);
+	std::vector<size_t> count(nCells[0] * nCells[1] * nCells[2] + 1, 0);
+	for (size_t i = 0; i < boundedTerms.size(); i++) {
+		int *r = &range[i * 6];
+		for (int a = 0; a < 3; a++) {
+			r[a] = std::min(nCells[a] - 1, int(floor((boundedTerms[i].lower.data[a] - indexLower.data[a]) / cellSize.data[a])));
+			r[a + 3] = std::min(nCells[a] - 1, int(floor((boundedTerms[i].upper.data[a] - indexLower.data[a]) / cellSize.data[a])));
+		}
+		for (int ix = r[0]; ix <= r[3]; ix++)
+			for (int iy = r[1]; iy <= r[4]; iy++)
+				for (int iz = r[2]; iz <= r[5]; iz++)
+					count[(ix * nCells[1] + iy) * nCells[2] + iz + 1]++;
+	}
+	cellStart.resize(count.size(), 0);
+	for (size_t c = 1; c < count.size(); c++)
+		cellStart[c] = cellStart[c - 1] + count[c];
+	cellTerms.resize(cellStart.back());
+	std::vector<size_t> next(cellStart.begin(), cellStart.end() - 1);
+	for (size_t i = 0; i < boundedTerms.size(); i++) {
+		const int *r = &range[i * 6];
+		for (int ix = r[0]; ix <= r[3]; ix++)
+			for (int iy = r[1]; iy <= r[4]; iy++)
+				for (int iz = r[2]; iz <= r[5]; iz++)
+					cellTerms[next[(ix * nCells[1] + iy) * nCells[2] + iz]++] = i;
+	}
+}
+
+bool MagneticFieldList::isFrozen() const {
+	return frozen;
+}
+
+size_t MagneticFieldList::getNumberOfTerms() const {
+	if (!frozen)
+		return fields.size();
+	return terms.size() + boundedTerms.size() + constants.size();
+}
+
+size_t MagneticFieldList::getNumberOfBoundedTerms() const {
+	return boundedTerms.size();
+}
+
+static double evolution(double z, double m) {
+	return (m == 0) ? 1 : pow(1 + z, m);
+}
+
+Vector3d MagneticFieldList::getConstantField(double z) const {
+	Vector3d b(0.);
+	for (size_t i = 0; i < constants.size(); i++)
+		b += constants[i].value * evolution(z, constants[i].m);
+	return b;
+}
+
+Vector3d MagneticFieldList::getBoundedField(const Vector3d &position, double z) const {
+	Vector3d b(0.);
+	if (boundedTerms.empty() || !isInBox(position, indexLower, indexUpper))
+		return b;
+	int cell[3];
+	for (int a = 0; a < 3; a++)
+		cell[a] = std::min(nCells[a] - 1, int((position.data[a] - indexLower.data[a]) / cellSize.data[a]));
+	size_t c = (cell[0] * nCells[1] + cell[1]) * nCells[2] + cell[2];
+	for (size_t j = cellStart[c]; j < cellStart[c + 1]; j++) {
+		const Term &term = boundedTerms[cellTerms[j]];
+		if (isInBox(position, term.lower, term.upper))
+			b += term.field->getField(position, z) * evolution(z, term.m);
+	}
+	return b;
 }
 
 Vector3d MagneticFieldList::getField(const Vector3d &position) const {
-	Vector3d b;
-	for (int i = 0; i < fields.size(); i++)
-		b += fields[i]->getField(position);
+	return getField(position, 0);
+}
+
+Vector3d MagneticFieldList::getField(const Vector3d &position, double z) const {
+	Vector3d b(0.);
+	if (!frozen) {
+		for (size_t i = 0; i < fields.size(); i++)
+			b += fields[i]->getField(position, z);
+		return b;
+	}
+
+	b = getConstantField(z);
+	for (size_t i = 0; i < terms.size(); i++) {
+		Vector3d t = terms[i].field->getField(position, z);
+		b += (terms[i].m == 0) ? t : t * evolution(z, terms[i].m);
+	}
+	b += getBoundedField(position, z);
 	return b;
 }
 
+void MagneticFieldList::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	if (!frozen) {
+		MagneticField::getFields(positions, fields, n, z);
+		return;
+	}
+
+	Vector3d b = getConstantField(z);
+	for (size_t j = 0; j < n; j++)
+		fields[j] = b + getBoundedField(positions[j], z);
+
+	// evaluate every unbounded field in chunks, so that batched
+	// implementations are used
+	const size_t chunk = 64;
+	Vector3d t[chunk];
+	for (size_t i = 0; i < terms.size(); i++) {
+		double scale = evolution(z, terms[i].m);
+		for (size_t j0 = 0; j0 < n; j0 += chunk) {
+			size_t m = std::min(chunk, n - j0);
+			terms[i].field->getFields(positions + j0, t, m, z);
+			for (size_t j = 0; j < m; j++)
+				fields[j0 + j] += t[j] * scale;
+		}
+	}
+}
+
+void MagneticFieldList::prefetch(const Vector3d &position, double z) const {
+	for (size_t i = 0; i < fields.size(); i++)
+		fields[i]->prefetch(position, z);
+}
+
+bool MagneticFieldList::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	if (fields.empty())
+		return false;
+	for (size_t i = 0; i < fields.size(); i++) {
+		Vector3d l, u;
+		if (!fields[i]->getBoundingBox(l, u))
+			return false;
+		if (i == 0) {
+			lower = l;
+			upper = u;
+		} else {
+			lower = componentMin(lower, l);
+			upper = componentMax(upper, u);
+		}
+	}
+	return true;
+}
+
 MagneticFieldEvolution::MagneticFieldEvolution(ref_ptr<MagneticField> field,
 	double m) :
 	field(field), m(m) {
 }
 
+Vector3d MagneticFieldEvolution::getField(const Vector3d &position) const {
+	return field->getField(position);
+}
+
 Vector3d MagneticFieldEvolution::getField(const Vector3d &position,
 	double z) const {
-	return field->getField(position) * pow(1+z, m);
+	return field->getField(position, z) * getScaling(z);
+}
+
+void MagneticFieldEvolution::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	field->getFields(positions, fields, n, z);
+	double scale = getScaling(z);
+	for (size_t i = 0; i < n; i++)
+		fields[i] *= scale;
+}
+
+void MagneticFieldEvolution::prefetch(const Vector3d &position, double z) const {
+	field->prefetch(position, z);
+}
+
+double MagneticFieldEvolution::getScaling(double z) const {
+	if (m == 0)
+		return 1;
+	bool valid;
+	std::vector<double> &cached = scalingCache.get(z, valid);
+	if (!valid)
+		cached.assign(1, pow(1 + z, m));
+	return cached[0];
+}
+
+ref_ptr<MagneticField> MagneticFieldEvolution::getWrappedField() const {
+	return field;
+}
+
+double MagneticFieldEvolution::getEvolution() const {
+	return m;
+}
+
+bool MagneticFieldEvolution::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	return field->getBoundingBox(lower, upper);
 }
 
 Vector3d MagneticDipoleField::getField(const Vector3d &position) const {
@@ -1,20 +1,126 @@
 #include "crpropa/magneticField/MagneticFieldGrid.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace crpropa {
 
+/** Volume of a grid outside of which it is zero, if the volume is clipped */
+template<typename G>
+static bool gridBoundingBox(const G &grid, Vector3d &lower, Vector3d &upper) {
+	if (!grid.getClipVolume())
+		return false;
+	lower = grid.getOrigin();
+	upper = lower + Vector3d(grid.getNx(), grid.getNy(), grid.getNz()) * grid.getSpacing();
+	return true;
+}
+
 MagneticFieldGrid::MagneticFieldGrid(ref_ptr<Grid3f> grid) {
 	setGrid(grid);
 }
 
+MagneticFieldGrid::MagneticFieldGrid(ref_ptr<Grid3h> grid) {
+	setGrid(grid);
+}
+
 void MagneticFieldGrid::setGrid(ref_ptr<Grid3f> grid) {
 	this->grid = grid;
+	this->halfGrid = 0;
+}
+
+void MagneticFieldGrid::setGrid(ref_ptr<Grid3h> grid) {
+	this->grid = 0;
+	this->halfGrid = grid;
 }
 
 ref_ptr<Grid3f> MagneticFieldGrid::getGrid() {
 	return grid;
 }
 
+ref_ptr<Grid3h> MagneticFieldGrid::getHalfGrid() {
+	return halfGrid;
+}
+
 Vector3d MagneticFieldGrid::getField(const Vector3d &pos) const {
+	if (grid.valid())
+		return grid->interpolate(pos);
+	return halfGrid->interpolate(pos);
+}
+
+template<typename G>
+static void interpolateFields(G *grid, const Vector3d *positions, Vector3d *fields, size_t n) {
+	const size_t blockSize = 64;
+	Vector3f b[blockSize];
+	for (size_t first = 0; first < n; first += blockSize) {
+		size_t m = std::min(blockSize, n - first);
+		grid->interpolateMany(positions + first, b, m);
+		for (size_t i = 0; i < m; i++)
+			fields[first + i] = b[i];
+	}
+}
+
+void MagneticFieldGrid::getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+	if (grid.valid())
+		interpolateFields(grid.get(), positions, fields, n);
+	else
+		interpolateFields(halfGrid.get(), positions, fields, n);
+}
+
+bool MagneticFieldGrid::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	if (grid.valid())
+		return gridBoundingBox(*grid, lower, upper);
+	return gridBoundingBox(*halfGrid, lower, upper);
+}
+
+NestedMagneticFieldGrid::NestedMagneticFieldGrid(ref_ptr<NestedGrid3f> grid) {
+	setGrid(grid);
+}
+
+void NestedMagneticFieldGrid::setGrid(ref_ptr<NestedGrid3f> grid) {
+	this->grid = grid;
+}
+
+ref_ptr<NestedGrid3f> NestedMagneticFieldGrid::getGrid() {
+	return grid;
+}
+
+Vector3d NestedMagneticFieldGrid::getField(const Vector3d &pos) const {
+	return grid->interpolate(pos);
+}
+
+PagedMagneticFieldGrid::PagedMagneticFieldGrid(ref_ptr<PagedGrid3f> grid) {
+	setGrid(grid);
+}
+
+void PagedMagneticFieldGrid::setGrid(ref_ptr<PagedGrid3f> grid) {
+	this->grid = grid;
+}
+
+ref_ptr<PagedGrid3f> PagedMagneticFieldGrid::getGrid() {
+	return grid;
+}
+
+Vector3d PagedMagneticFieldGrid::getField(const Vector3d &pos) const {
+	return grid->interpolate(pos);
+}
+
+void PagedMagneticFieldGrid::prefetch(const Vector3d &pos, double z) const {
+	grid->prefetch(pos);
+}
+
+TricubicMagneticFieldGrid::TricubicMagneticFieldGrid(ref_ptr<TricubicGrid3f> grid) {
+	setGrid(grid);
+}
+
+void TricubicMagneticFieldGrid::setGrid(ref_ptr<TricubicGrid3f> grid) {
+	this->grid = grid;
+}
+
+ref_ptr<TricubicGrid3f> TricubicMagneticFieldGrid::getGrid() {
+	return grid;
+}
+
+Vector3d TricubicMagneticFieldGrid::getField(const Vector3d &pos) const {
 	return grid->interpolate(pos);
 }
 
@@ -28,6 +134,7 @@ ModulatedMagneticFieldGrid::ModulatedMagneticFieldGrid(ref_ptr<Grid3f> grid,
 
 void ModulatedMagneticFieldGrid::setGrid(ref_ptr<Grid3f> g) {
 	grid = g;
+	std::vector<float>().swap(fused);
 }
 
 ref_ptr<Grid3f> ModulatedMagneticFieldGrid::getGrid() {
@@ -36,6 +143,7 @@ ref_ptr<Grid3f> ModulatedMagneticFieldGrid::getGrid() {
 
 void ModulatedMagneticFieldGrid::setModulationGrid(ref_ptr<Grid1f> g) {
 	modGrid = g;
+	std::vector<float>().swap(fused);
 }
 
 ref_ptr<Grid1f> ModulatedMagneticFieldGrid::getModulationGrid() {
@@ -46,12 +154,209 @@ void ModulatedMagneticFieldGrid::setReflective(bool gridReflective,
 		bool modGridReflective) {
 	grid->setReflective(gridReflective);
 	modGrid->setReflective(modGridReflective);
+	std::vector<float>().swap(fused);
+}
+
+void ModulatedMagneticFieldGrid::setFused(bool enable) {
+	std::vector<float>().swap(fused);
+	if (!enable)
+		return;
+	if (!grid || !modGrid)
+		throw std::runtime_error("ModulatedMagneticFieldGrid: no grids to fuse");
+	bool same = (grid->getNx() == modGrid->getNx()) && (grid->getNy() == modGrid->getNy())
+			&& (grid->getNz() == modGrid->getNz()) && (grid->getOrigin() == modGrid->getOrigin())
+			&& (grid->getSpacing() == modGrid->getSpacing())
+			&& (grid->isReflective() == modGrid->isReflective())
+			&& (grid->getClipVolume() == modGrid->getClipVolume())
+			&& (grid->getLayout() == modGrid->getLayout());
+	if (!same)
+		throw std::runtime_error("ModulatedMagneticFieldGrid: only grids of the same geometry can be fused");
+	if ((grid->getInterpolationType() != TRILINEAR) || (modGrid->getInterpolationType() != TRILINEAR))
+		throw std::runtime_error("ModulatedMagneticFieldGrid: only trilinear grids can be fused");
+
+	std::vector<float> values(4 * grid->getStorageSize(), 0.f);
+	for (size_t ix = 0; ix < grid->getNx(); ix++)
+		for (size_t iy = 0; iy < grid->getNy(); iy++)
+			for (size_t iz = 0; iz < grid->getNz(); iz++) {
+				size_t k = 4 * grid->storageIndex(ix, iy, iz);
+				const Vector3f &b = grid->get(ix, iy, iz);
+				values[k] = b.x;
+				values[k + 1] = b.y;
+				values[k + 2] = b.z;
+				values[k + 3] = modGrid->get(ix, iy, iz);
+			}
+	fused.swap(values);
+}
+
+bool ModulatedMagneticFieldGrid::isFused() const {
+	return !fused.empty();
+}
+
+Vector3d ModulatedMagneticFieldGrid::fusedField(const Vector3d &pos) const {
+	if (grid->getClipVolume()) {
+		Vector3d lower, upper;
+		gridBoundingBox(*grid, lower, upper);
+		if ((pos.x < lower.x) || (pos.x > upper.x) || (pos.y < lower.y) || (pos.y > upper.y)
+				|| (pos.z < lower.z) || (pos.z > upper.z))
+			return Vector3d(0.);
+	}
+	size_t index[8];
+	double weight[8];
+	grid->getTrilinearWeights(pos, index, weight);
+#ifdef HAVE_SIMD
+	__m128 sum = _mm_setzero_ps();
+	for (int i = 0; i < 8; i++)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&fused[4 * index[i]]), _mm_set1_ps(weight[i])));
+	float v[4];
+	_mm_storeu_ps(v, sum);
+#else
+	float v[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 8; i++) {
+		const float *cell = &fused[4 * index[i]];
+		for (int c = 0; c < 4; c++)
+			v[c] += cell[c] * weight[i];
+	}
+#endif
+	return Vector3d(v[0], v[1], v[2]) * v[3];
 }
 
 Vector3d ModulatedMagneticFieldGrid::getField(const Vector3d &pos) const {
+	if (!fused.empty())
+		return fusedField(pos);
 	float m = modGrid->interpolate(pos);
 	Vector3d b = grid->interpolate(pos);
 	return b * m;
 }
 
+bool ModulatedMagneticFieldGrid::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	Vector3d modLower, modUpper;
+	bool bounded = gridBoundingBox(*grid, lower, upper);
+	if (!gridBoundingBox(*modGrid, modLower, modUpper))
+		return bounded;
+	if (!bounded) {
+		lower = modLower;
+		upper = modUpper;
+		return true;
+	}
+	// both grids clipped, the field is zero outside of the overlap
+	lower = Vector3d(std::max(lower.x, modLower.x), std::max(lower.y, modLower.y), std::max(lower.z, modLower.z));
+	upper = Vector3d(std::min(upper.x, modUpper.x), std::min(upper.y, modUpper.y), std::min(upper.z, modUpper.z));
+	return true;
+}
+
+SnapshotMagneticFieldGrid::SnapshotMagneticFieldGrid() {
+}
+
+void SnapshotMagneticFieldGrid::addSnapshot(double z, ref_ptr<MagneticField> field) {
+	if (!field)
+		throw std::runtime_error("SnapshotMagneticFieldGrid: no field of the snapshot");
+	size_t i = std::lower_bound(redshifts.begin(), redshifts.end(), z) - redshifts.begin();
+	if ((i < redshifts.size()) && (redshifts[i] == z))
+		throw std::runtime_error("SnapshotMagneticFieldGrid: two snapshots at the same redshift");
+	redshifts.insert(redshifts.begin() + i, z);
+	snapshots.insert(snapshots.begin() + i, field);
+	weightCache.clear();
+}
+
+void SnapshotMagneticFieldGrid::addSnapshot(double z, ref_ptr<Grid3f> grid) {
+	addSnapshot(z, new MagneticFieldGrid(grid));
+}
+
+void SnapshotMagneticFieldGrid::addSnapshot(double z, ref_ptr<PagedGrid3f> grid) {
+	addSnapshot(z, new PagedMagneticFieldGrid(grid));
+}
+
+size_t SnapshotMagneticFieldGrid::getNumberOfSnapshots() const {
+	return snapshots.size();
+}
+
+double SnapshotMagneticFieldGrid::getSnapshotRedshift(size_t i) const {
+	return redshifts.at(i);
+}
+
+ref_ptr<MagneticField> SnapshotMagneticFieldGrid::getSnapshot(size_t i) const {
+	return snapshots.at(i);
+}
+
+void SnapshotMagneticFieldGrid::getWeight(double z, size_t &i, double &w) const {
+	if (snapshots.empty())
+		throw std::runtime_error("SnapshotMagneticFieldGrid: no snapshots");
+	bool valid;
+	std::vector<double> &cached = weightCache.get(z, valid);
+	if (!valid) {
+		size_t j = std::upper_bound(redshifts.begin(), redshifts.end(), z) - redshifts.begin();
+		if (j == 0)
+			cached.assign({0., 0.});
+		else if (j == redshifts.size())
+			cached.assign({double(j - 1), 0.});
+		else
+			cached.assign({double(j - 1), (z - redshifts[j - 1]) / (redshifts[j] - redshifts[j - 1])});
+	}
+	i = cached[0];
+	w = cached[1];
+}
+
+Vector3d SnapshotMagneticFieldGrid::getField(const Vector3d &position) const {
+	return getField(position, 0);
+}
+
+Vector3d SnapshotMagneticFieldGrid::getField(const Vector3d &position, double z) const {
+	size_t i;
+	double w;
+	getWeight(z, i, w);
+	Vector3d b = snapshots[i]->getField(position, z);
+	if (w == 0)
+		return b;
+	return b * (1 - w) + snapshots[i + 1]->getField(position, z) * w;
+}
+
+void SnapshotMagneticFieldGrid::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	size_t i;
+	double w;
+	getWeight(z, i, w);
+	snapshots[i]->getFields(positions, fields, n, z);
+	if (w == 0)
+		return;
+
+	// add the upper snapshot in chunks, so that batched implementations are used
+	const size_t chunk = 64;
+	Vector3d t[chunk];
+	for (size_t j0 = 0; j0 < n; j0 += chunk) {
+		size_t m = std::min(chunk, n - j0);
+		snapshots[i + 1]->getFields(positions + j0, t, m, z);
+		for (size_t j = 0; j < m; j++)
+			fields[j0 + j] = fields[j0 + j] * (1 - w) + t[j] * w;
+	}
+}
+
+void SnapshotMagneticFieldGrid::prefetch(const Vector3d &position, double z) const {
+	if (snapshots.empty())
+		return;
+	size_t i;
+	double w;
+	getWeight(z, i, w);
+	snapshots[i]->prefetch(position, z);
+	if (w != 0)
+		snapshots[i + 1]->prefetch(position, z);
+}
+
+bool SnapshotMagneticFieldGrid::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	if (snapshots.empty())
+		return false;
+	for (size_t i = 0; i < snapshots.size(); i++) {
+		Vector3d l, u;
+		if (!snapshots[i]->getBoundingBox(l, u))
+			return false;
+		if (i == 0) {
+			lower = l;
+			upper = u;
+		} else {
+			lower = Vector3d(std::min(lower.x, l.x), std::min(lower.y, l.y), std::min(lower.z, l.z));
+			upper = Vector3d(std::max(upper.x, u.x), std::max(upper.y, u.y), std::max(upper.z, u.z));
+		}
+	}
+	return true;
+}
+
 } // namespace crpropa
@@ -0,0 +1,214 @@
+#include "crpropa/magneticField/ProfiledMagneticField.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+ProfiledMagneticField::ProfiledMagneticField(ref_ptr<MagneticField> field,
+		const std::string &name) : field(field), name(name), timing(true) {
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	counters.resize(nThreads + 1);
+	MagneticFieldProfile::add(this);
+}
+
+ProfiledMagneticField::~ProfiledMagneticField() {
+	MagneticFieldProfile::remove(this);
+}
+
+void ProfiledMagneticField::record(uint64_t calls, double time) const {
+	int slot = 0;
+#ifdef _OPENMP
+	slot = (omp_get_level() <= 1) ? omp_get_thread_num() : -1;
+#endif
+	if ((slot >= 0) && (slot < (int)counters.size() - 1)) {
+		counters[slot].calls += calls;
+		counters[slot].time += time;
+		return;
+	}
+
+	// threads of nested parallel regions share the last counter
+	Counter &shared = counters.back();
+#pragma omp critical(ProfiledMagneticField)
+	{
+		shared.calls += calls;
+		shared.time += time;
+	}
+}
+
+Vector3d ProfiledMagneticField::getField(const Vector3d &position) const {
+	if (!timing) {
+		record(1, 0);
+		return field->getField(position);
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Vector3d b = field->getField(position);
+	record(1, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	return b;
+}
+
+Vector3d ProfiledMagneticField::getField(const Vector3d &position, double z) const {
+	if (!timing) {
+		record(1, 0);
+		return field->getField(position, z);
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Vector3d b = field->getField(position, z);
+	record(1, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	return b;
+}
+
+void ProfiledMagneticField::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	if (!timing) {
+		record(n, 0);
+		field->getFields(positions, fields, n, z);
+		return;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	field->getFields(positions, fields, n, z);
+	record(n, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+bool ProfiledMagneticField::getBoundingBox(Vector3d &lower, Vector3d &upper) const {
+	return field->getBoundingBox(lower, upper);
+}
+
+void ProfiledMagneticField::setTiming(bool timing) {
+	this->timing = timing;
+}
+
+bool ProfiledMagneticField::getTiming() const {
+	return timing;
+}
+
+uint64_t ProfiledMagneticField::getCalls() const {
+	uint64_t calls = 0;
+	for (size_t i = 0; i < counters.size(); i++)
+		calls += counters[i].calls;
+	return calls;
+}
+
+double ProfiledMagneticField::getTime() const {
+	double time = 0;
+	for (size_t i = 0; i < counters.size(); i++)
+		time += counters[i].time;
+	return time;
+}
+
+void ProfiledMagneticField::reset() {
+	for (size_t i = 0; i < counters.size(); i++)
+		counters[i] = Counter();
+}
+
+const std::string &ProfiledMagneticField::getName() const {
+	return name;
+}
+
+ref_ptr<MagneticField> ProfiledMagneticField::getWrappedField() const {
+	return field;
+}
+
+static std::mutex registryMutex;
+
+static std::vector<ProfiledMagneticField *> &registry() {
+	static std::vector<ProfiledMagneticField *> fields;
+	return fields;
+}
+
+void MagneticFieldProfile::add(ProfiledMagneticField *field) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registry().push_back(field);
+}
+
+void MagneticFieldProfile::remove(ProfiledMagneticField *field) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::vector<ProfiledMagneticField *> &fields = registry();
+	fields.erase(std::remove(fields.begin(), fields.end(), field), fields.end());
+}
+
+std::vector<ProfiledMagneticField *> MagneticFieldProfile::getFields() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return registry();
+}
+
+void MagneticFieldProfile::reset() {
+	std::vector<ProfiledMagneticField *> fields = getFields();
+	for (size_t i = 0; i < fields.size(); i++)
+		fields[i]->reset();
+}
+
+static std::string escapeJSON(const std::string &in) {
+	std::string out;
+	for (size_t i = 0; i < in.size(); i++) {
+		char c = in[i];
+		if (c == '"' || c == '\\')
+			out += std::string("\\") + c;
+		else if (c == '\n')
+			out += "\\n";
+		else if (c == '\t')
+			out += "\\t";
+		else
+			out += c;
+	}
+	return out;
+}
+
+std::string MagneticFieldProfile::getJSON(uint64_t steps) {
+	std::vector<ProfiledMagneticField *> fields = getFields();
+	std::stringstream ss;
+	ss.precision(9);
+	ss << "{\n  \"steps\": " << steps << ",\n  \"fields\": [";
+	for (size_t i = 0; i < fields.size(); i++) {
+		uint64_t calls = fields[i]->getCalls();
+		double time = fields[i]->getTime();
+		ss << (i ? "," : "") << "\n    {\"name\": \"" << escapeJSON(fields[i]->getName()) << "\"";
+		ss << ", \"calls\": " << calls;
+		ss << ", \"time\": " << time;
+		ss << ", \"timePerCall\": " << (calls ? time / calls : 0.);
+		if (steps)
+			ss << ", \"callsPerStep\": " << double(calls) / steps;
+		ss << "}";
+	}
+	ss << "\n  ]\n}\n";
+	return ss.str();
+}
+
+std::string MagneticFieldProfile::getCSV(uint64_t steps) {
+	std::vector<ProfiledMagneticField *> fields = getFields();
+	std::stringstream ss;
+	ss.precision(9);
+	ss << "field,calls,time,timePerCall,callsPerStep\n";
+	for (size_t i = 0; i < fields.size(); i++) {
+		std::string name = fields[i]->getName();
+		std::replace(name.begin(), name.end(), ',', ';');
+		uint64_t calls = fields[i]->getCalls();
+		double time = fields[i]->getTime();
+		ss << name << "," << calls << "," << time << "," << (calls ? time / calls : 0.) << ",";
+		if (steps)
+			ss << double(calls) / steps;
+		ss << "\n";
+	}
+	return ss.str();
+}
+
+void MagneticFieldProfile::write(const std::string &filename, uint64_t steps) {
+	std::ofstream out(filename.c_str());
+	if (!out.good())
+		throw std::runtime_error("MagneticFieldProfile: could not open file " + filename);
+	bool json = (filename.size() >= 5) && (filename.substr(filename.size() - 5) == ".json");
+	out << (json ? getJSON(steps) : getCSV(steps));
+}
+
+} // namespace crpropa
@@ -4,6 +4,13 @@
 
 #ifdef CRPROPA_HAVE_FFTW3F
 
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 
@@ -16,6 +23,16 @@ GridTurbulence::GridTurbulence(const TurbulenceSpectrum &spectrum,
 	initTurbulence();
 }
 
+GridTurbulence::GridTurbulence(const TurbulenceSpectrum &spectrum,
+                               const GridProperties &gridProp,
+                               unsigned int seed, bool initialize)
+    : TurbulentField(spectrum), seed(seed) {
+	initGrid(gridProp);
+	checkGridRequirements(gridPtr, spectrum.getLmin(), spectrum.getLmax());
+	if (initialize)
+		initTurbulence();
+}
+
 void GridTurbulence::initGrid(const GridProperties &p) {
 	gridPtr = new Grid3f(p);
 }
@@ -27,108 +44,69 @@ Vector3d GridTurbulence::getField(const Vector3d &pos) const {
 const ref_ptr<Grid3f> &GridTurbulence::getGrid() const { return gridPtr; }
 
 void GridTurbulence::initTurbulence() {
+	double spacing = gridPtr->getSpacing().x;
+	double kMin = spacing / spectrum.getLmax();
+	double kMax = spacing / spectrum.getLmin();
 
-	Vector3d spacing = gridPtr->getSpacing();
-	size_t n = gridPtr->getNx(); // size of array
-	size_t n2 = (size_t)floor(n / 2) +
-	            1; // size array in z-direction in configuration space
-
-	// arrays to hold the complex vector components of the B(k)-field
-	fftwf_complex *Bkx, *Bky, *Bkz;
-	Bkx = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bky = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bkz = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+	initFourierModes(gridPtr, kMin, kMax, seed,
+	                 modeFunction(spectrum, spacing));
 
-	Random random;
-	if (seed != 0)
-		random.seed(seed); // use given seed
-
-	// calculate the n possible discrete wave numbers
-	double K[n];
-	for (size_t i = 0; i < n; i++)
-		K[i] = ((double)i / n - i / (n / 2));
+	scaleGrid(gridPtr, spectrum.getBrms() /
+	                       rmsFieldStrength(gridPtr)); // normalize to Brms
+}
 
-	// double kMin = 2*M_PI / lMax; // * 2 * spacing.x; // spacing.x / lMax;
-	// double kMax = 2*M_PI / lMin; // * 2 * spacing.x; // spacing.x / lMin;
-	double kMin = spacing.x / spectrum.getLmax();
-	double kMax = spacing.x / spectrum.getLmin();
-	auto lambda = 1 / spacing.x * 2 * M_PI;
+GridTurbulence::ModeFunction
+GridTurbulence::modeFunction(const TurbulenceSpectrum &spectrum,
+                             double spacing) {
+	double lambda = 1 / spacing * 2 * M_PI;
+
+	return [&spectrum, lambda](const Vector3f &ek, double k, Random &random,
+	                           Vector3f &re, Vector3f &im) {
+		Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
+		Vector3f e1, e2; // orthogonal base
+
+		// construct an orthogonal base ek, e1, e2
+		if (ek.isParallelTo(n0, float(1e-3))) {
+			// ek parallel to (1,1,1)
+			e1.setXYZ(-1., 1., 0);
+			e2.setXYZ(1., 1., -2.);
+		} else {
+			// ek not parallel to (1,1,1)
+			e1 = n0.cross(ek);
+			e2 = ek.cross(e1);
+		}
+		e1 /= e1.getR();
+		e2 /= e2.getR();
 
-	Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
+		// random orientation perpendicular to k
+		double theta = 2 * M_PI * random.rand();
+		Vector3f b = e1 * std::cos(theta) + e2 * std::sin(theta); // real b-field vector
 
-	for (size_t ix = 0; ix < n; ix++) {
-		for (size_t iy = 0; iy < n; iy++) {
-			for (size_t iz = 0; iz < n2; iz++) {
-	
-				Vector3f ek, e1, e2;  // orthogonal base
-
-				size_t i = ix * n * n2 + iy * n2 + iz;
-				ek.setXYZ(K[ix], K[iy], K[iz]);
-				double k = ek.getR();
-
-				// wave outside of turbulent range -> B(k) = 0
-				if ((k < kMin) || (k > kMax)) {
-					Bkx[i][0] = 0;
-					Bkx[i][1] = 0;
-					Bky[i][0] = 0;
-					Bky[i][1] = 0;
-					Bkz[i][0] = 0;
-					Bkz[i][1] = 0;
-					continue;
-				}
-
-				// construct an orthogonal base ek, e1, e2
-				if (ek.isParallelTo(n0, float(1e-3))) {
-					// ek parallel to (1,1,1)
-					e1.setXYZ(-1., 1., 0);
-					e2.setXYZ(1., 1., -2.);
-				} else {
-					// ek not parallel to (1,1,1)
-					e1 = n0.cross(ek);
-					e2 = ek.cross(e1);
-				}
-				e1 /= e1.getR();
-				e2 /= e2.getR();
-
-				// random orientation perpendicular to k
-				double theta = 2 * M_PI * random.rand();
-				Vector3f b = e1 * std::cos(theta) + e2 * std::sin(theta); // real b-field vector
-
-				// normal distributed amplitude with mean = 0
-				b *= std::sqrt(spectrum.energySpectrum(k*lambda));
-				
-				// uniform random phase
-				double phase = 2 * M_PI * random.rand();
-				double cosPhase = std::cos(phase); // real part
-				double sinPhase = std::sin(phase); // imaginary part
-
-				Bkx[i][0] = b.x * cosPhase;
-				Bkx[i][1] = b.x * sinPhase;
-				Bky[i][0] = b.y * cosPhase;
-				Bky[i][1] = b.y * sinPhase;
-				Bkz[i][0] = b.z * cosPhase;
-				Bkz[i][1] = b.z * sinPhase;
-			} // for iz
-		}     // for iy
-	}         // for ix
-
-	executeInverseFFTInplace(gridPtr, Bkx, Bky, Bkz);
-
-	fftwf_free(Bkx);
-	fftwf_free(Bky);
-	fftwf_free(Bkz);
+		// normal distributed amplitude with mean = 0
+		b *= std::sqrt(spectrum.energySpectrum(k*lambda));
 
-	scaleGrid(gridPtr, spectrum.getBrms() /
-	                       rmsFieldStrength(gridPtr)); // normalize to Brms
+		// uniform random phase
+		double phase = 2 * M_PI * random.rand();
+		re = b * std::cos(phase); // real part
+		im = b * std::sin(phase); // imaginary part
+	};
 }
 
 // Check the grid properties before the FFT procedure
 void GridTurbulence::checkGridRequirements(ref_ptr<Grid3f> grid, double lMin,
                                            double lMax) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	Vector3d spacing = grid->getSpacing();
+	checkGridRequirements(GridProperties(grid->getOrigin(), grid->getNx(),
+	                                     grid->getNy(), grid->getNz(),
+	                                     grid->getSpacing()),
+	                      lMin, lMax);
+}
+
+void GridTurbulence::checkGridRequirements(const GridProperties &gridProp,
+                                           double lMin, double lMax) {
+	size_t Nx = gridProp.Nx;
+	size_t Ny = gridProp.Ny;
+	size_t Nz = gridProp.Nz;
+	Vector3d spacing = gridProp.spacing;
 
 	if ((Nx != Ny) or (Ny != Nz))
 		throw std::runtime_error("turbulentField: only cubic grid supported");
@@ -142,6 +120,38 @@ void GridTurbulence::checkGridRequirements(ref_ptr<Grid3f> grid, double lMin,
 		throw std::runtime_error("lMax < lMin");
 }
 
+// Plan a complex to real, inverse 3D transform, in-place or into every stride-th
+// float of out. Planning is not thread-safe, with the threaded FFTW library
+// the plan uses all OpenMP threads.
+static fftwf_plan planInverseFFT(size_t n, fftwf_complex *Bk, float *out = NULL, int stride = 1) {
+	fftwf_plan plan;
+#pragma omp critical(FFTW)
+	{
+#ifdef CRPROPA_HAVE_FFTW3F_THREADS
+		static bool threadsInitialized = false;
+		if (!threadsInitialized)
+			threadsInitialized = fftwf_init_threads();
+#ifdef _OPENMP
+		fftwf_plan_with_nthreads(omp_get_max_threads());
+#endif
+#endif
+		if (out == NULL) {
+			plan = fftwf_plan_dft_c2r_3d(n, n, n, Bk, (float *)Bk, FFTW_ESTIMATE);
+		} else {
+			int dims[3] = {int(n), int(n), int(n)};
+			plan = fftwf_plan_many_dft_c2r(3, dims, 1, Bk, NULL, 1, 0, out, NULL, stride, 0, FFTW_ESTIMATE);
+		}
+	}
+	if (plan == NULL)
+		throw std::runtime_error("GridTurbulence: could not plan the Fourier transform");
+	return plan;
+}
+
+static void destroyFFTPlan(fftwf_plan plan) {
+#pragma omp critical(FFTW)
+	fftwf_destroy_plan(plan);
+}
+
 // Execute inverse discrete FFT in-place for a 3D grid, from complex to real
 // space
 void GridTurbulence::executeInverseFFTInplace(ref_ptr<Grid3f> grid,
@@ -156,21 +166,22 @@ void GridTurbulence::executeInverseFFTInplace(ref_ptr<Grid3f> grid,
 	// in-place, complex to real, inverse Fourier transformation on each
 	// component note that the last elements of B(x) are unused now
 	float *Bx = (float *)Bkx;
-	fftwf_plan plan_x = fftwf_plan_dft_c2r_3d(n, n, n, Bkx, Bx, FFTW_ESTIMATE);
+	fftwf_plan plan_x = planInverseFFT(n, Bkx);
 	fftwf_execute(plan_x);
-	fftwf_destroy_plan(plan_x);
+	destroyFFTPlan(plan_x);
 
 	float *By = (float *)Bky;
-	fftwf_plan plan_y = fftwf_plan_dft_c2r_3d(n, n, n, Bky, By, FFTW_ESTIMATE);
+	fftwf_plan plan_y = planInverseFFT(n, Bky);
 	fftwf_execute(plan_y);
-	fftwf_destroy_plan(plan_y);
+	destroyFFTPlan(plan_y);
 
 	float *Bz = (float *)Bkz;
-	fftwf_plan plan_z = fftwf_plan_dft_c2r_3d(n, n, n, Bkz, Bz, FFTW_ESTIMATE);
+	fftwf_plan plan_z = planInverseFFT(n, Bkz);
 	fftwf_execute(plan_z);
-	fftwf_destroy_plan(plan_z);
+	destroyFFTPlan(plan_z);
 
 	// save to grid
+#pragma omp parallel for
 	for (size_t ix = 0; ix < n; ix++) {
 		for (size_t iy = 0; iy < n; iy++) {
 			for (size_t iz = 0; iz < n; iz++) {
@@ -184,6 +195,104 @@ void GridTurbulence::executeInverseFFTInplace(ref_ptr<Grid3f> grid,
 	}
 }
 
+void GridTurbulence::initFourierModes(ref_ptr<Grid3f> grid, double kMin,
+                                      double kMax, unsigned int seed,
+                                      const ModeFunction &mode) {
+	size_t n = grid->getNx(); // size of array
+	size_t n2 = (size_t)floor(n / 2) +
+	            1; // size array in z-direction in configuration space
+
+	uint32_t baseSeed = seed;
+	if (seed == 0)
+		baseSeed = Random().randInt();
+
+	// one component after the other in a single buffer, the modes of every
+	// x-slab are computed again from the same random sequence for each one
+	fftwf_complex *Bk = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+	if (Bk == NULL)
+		throw std::runtime_error("GridTurbulence: could not allocate the Fourier modes");
+
+	// a row-major grid holds the components of each point in consecutive
+	// floats: the transform writes each component directly into the grid,
+	// with a stride of 3, otherwise in-place and copied into the grid
+	static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Vector3f must consist of three packed floats");
+	bool direct = (grid->getLayout() == ROW_MAJOR);
+	float *values = direct ? grid->getGrid()[0].data : NULL;
+	fftwf_plan plan = direct ? NULL : planInverseFFT(n, Bk);
+	float *B = (float *)Bk;
+
+	for (int c = 0; c < 3; c++) {
+#pragma omp parallel for schedule(dynamic)
+		for (size_t ix = 0; ix < n; ix++) {
+			fftwf_complex *slab[3] = {NULL, NULL, NULL};
+			slab[c] = Bk + ix * n * n2;
+			initFourierSlab(n, ix, kMin, kMax, baseSeed, mode, slab);
+		}
+
+		if (direct) {
+			// the out-of-place transform overwrites the modes, which are
+			// computed again for the next component
+			fftwf_plan componentPlan = planInverseFFT(n, Bk, values + c, 3);
+			fftwf_execute(componentPlan);
+			destroyFFTPlan(componentPlan);
+			continue;
+		}
+
+		fftwf_execute(plan);
+
+		// save to grid, note that the last elements of B(x) are unused
+#pragma omp parallel for
+		for (size_t ix = 0; ix < n; ix++)
+			for (size_t iy = 0; iy < n; iy++)
+				for (size_t iz = 0; iz < n; iz++)
+					grid->get(ix, iy, iz).data[c] = B[ix * n * 2 * n2 + iy * 2 * n2 + iz];
+	}
+
+	if (plan != NULL)
+		destroyFFTPlan(plan);
+	fftwf_free(Bk);
+}
+
+void GridTurbulence::initFourierSlab(size_t n, size_t ix, double kMin,
+                                     double kMax, uint32_t baseSeed,
+                                     const ModeFunction &mode,
+                                     fftwf_complex *Bk[3]) {
+	size_t n2 = (size_t)floor(n / 2) +
+	            1; // size array in z-direction in configuration space
+
+	// calculate the n possible discrete wave numbers
+	std::vector<double> K(n);
+	for (size_t i = 0; i < n; i++)
+		K[i] = (double)i / n - i / (n / 2);
+
+	uint32_t slabSeed[2] = {baseSeed, (uint32_t)ix};
+	Random random;
+	random.seed(slabSeed, 2);
+	Vector3f ek, re, im;
+	for (size_t iy = 0; iy < n; iy++) {
+		for (size_t iz = 0; iz < n2; iz++) {
+			size_t i = iy * n2 + iz;
+			ek.setXYZ(K[ix], K[iy], K[iz]);
+			double k = ek.getR();
+
+			// wave outside of turbulent range -> B(k) = 0
+			if ((k < kMin) || (k > kMax)) {
+				re = Vector3f(0.);
+				im = Vector3f(0.);
+			} else {
+				mode(ek, k, random, re, im);
+			}
+
+			for (int c = 0; c < 3; c++) {
+				if (Bk[c] == NULL)
+					continue;
+				Bk[c][i][0] = re.data[c];
+				Bk[c][i][1] = im.data[c];
+			}
+		}
+	}
+}
+
 Vector3f GridTurbulence::getMeanFieldVector() const {
 	return meanFieldVector(gridPtr);
 }
@@ -199,6 +308,10 @@ double GridTurbulence::getRmsFieldStrength() const {
 std::array<float, 3> GridTurbulence::getRmsFieldStrengthPerAxis() const {
 	return rmsFieldStrengthPerAxis(gridPtr);
 }
+
+GridStatistics GridTurbulence::getStatistics() const {
+	return gridStatistics(gridPtr);
+}
 	
 std::vector<std::pair<int, float>> GridTurbulence::getPowerSpectrum() const {
 	return gridPowerSpectrum(gridPtr);
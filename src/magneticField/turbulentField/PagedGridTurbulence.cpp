@@ -0,0 +1,224 @@
+#include "crpropa/magneticField/turbulentField/PagedGridTurbulence.h"
+#include "crpropa/Random.h"
+
+#ifdef CRPROPA_HAVE_FFTW3F
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace crpropa {
+
+PagedGridTurbulence::PagedGridTurbulence(const TurbulenceSpectrum &spectrum,
+                                         const GridProperties &gridProp,
+                                         unsigned int seed,
+                                         const std::string &filename,
+                                         size_t cacheSize, size_t tileEdge)
+    : TurbulentField(spectrum) {
+	if (gridProp.ipol != TRILINEAR)
+		throw std::runtime_error(
+		    "PagedGridTurbulence: only trilinear interpolation is supported");
+	generate(spectrum, gridProp, seed, filename);
+	grid = new PagedGrid3f(filename, gridProp, cacheSize, tileEdge);
+}
+
+Vector3d PagedGridTurbulence::getField(const Vector3d &pos) const {
+	return grid->interpolate(pos);
+}
+
+ref_ptr<PagedGrid3f> PagedGridTurbulence::getGrid() const { return grid; }
+
+// Plan a single threaded transform of length n along the first dimension of
+// an n x m array, for every one of the m columns. Planning is not thread-safe.
+static fftwf_plan planColumns(size_t n, size_t m, fftwf_complex *B) {
+	fftwf_plan plan;
+	int length = n;
+#pragma omp critical(FFTW)
+	{
+#ifdef CRPROPA_HAVE_FFTW3F_THREADS
+		static bool threadsInitialized = false;
+		if (!threadsInitialized)
+			threadsInitialized = fftwf_init_threads();
+		fftwf_plan_with_nthreads(1);
+#endif
+		plan = fftwf_plan_many_dft(1, &length, m, B, NULL, m, 1, B, NULL, m,
+		                           1, FFTW_BACKWARD, FFTW_ESTIMATE);
+	}
+	return plan;
+}
+
+// Plan a single threaded, complex to real transform of length n along every
+// row of an n x (n / 2 + 1) array to an n x n array.
+static fftwf_plan planRows(size_t n, fftwf_complex *Bk, float *B) {
+	fftwf_plan plan;
+	int length = n;
+	size_t n2 = n / 2 + 1;
+#pragma omp critical(FFTW)
+	{
+#ifdef CRPROPA_HAVE_FFTW3F_THREADS
+		fftwf_plan_with_nthreads(1);
+#endif
+		plan = fftwf_plan_many_dft_c2r(1, &length, n, Bk, NULL, 1, n2, B,
+		                               NULL, 1, n, FFTW_ESTIMATE);
+	}
+	return plan;
+}
+
+static void destroyPlan(fftwf_plan plan) {
+#pragma omp critical(FFTW)
+	fftwf_destroy_plan(plan);
+}
+
+void PagedGridTurbulence::generate(const TurbulenceSpectrum &spectrum,
+                                   const GridProperties &gridProp,
+                                   unsigned int seed,
+                                   const std::string &filename) {
+	GridTurbulence::checkGridRequirements(gridProp, spectrum.getLmin(),
+	                                      spectrum.getLmax());
+	size_t n = gridProp.Nx;
+	size_t n2 = n / 2 + 1;
+	double spacing = gridProp.spacing.x;
+	double kMin = spacing / spectrum.getLmax();
+	double kMax = spacing / spectrum.getLmin();
+	GridTurbulence::ModeFunction mode =
+	    GridTurbulence::modeFunction(spectrum, spacing);
+
+	uint32_t baseSeed = seed;
+	if (seed == 0)
+		baseSeed = Random().randInt();
+
+	// the modes transformed along y, three complex components for every
+	// (kx, y, kz) with kz running fastest
+	std::string tmpFilename = filename + ".tmp";
+	size_t rowSize = n2 * 3 * sizeof(fftwf_complex);
+	std::fstream tmp(tmpFilename.c_str(), std::ios::in | std::ios::out |
+	                                         std::ios::binary | std::ios::trunc);
+	if (!tmp.is_open())
+		throw std::runtime_error("PagedGridTurbulence: could not create file " +
+		                         tmpFilename);
+	std::fstream out(filename.c_str(), std::ios::in | std::ios::out |
+	                                      std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+		throw std::runtime_error("PagedGridTurbulence: could not create file " +
+		                         filename);
+	bool failed = false;
+
+	// first pass: modes of every x-slab, transformed along y
+#pragma omp parallel
+	{
+		std::vector<float> buffer(n * n2 * 6);
+		fftwf_complex *Bk[3];
+		fftwf_plan plan[3];
+		for (int c = 0; c < 3; c++) {
+			Bk[c] = (fftwf_complex *)&buffer[c * n * n2 * 2];
+			plan[c] = planColumns(n, n2, Bk[c]);
+		}
+		std::vector<float> slab(n * n2 * 6);
+
+#pragma omp for schedule(dynamic)
+		for (size_t ix = 0; ix < n; ix++) {
+			GridTurbulence::initFourierSlab(n, ix, kMin, kMax, baseSeed, mode,
+			                                Bk);
+			for (int c = 0; c < 3; c++) {
+				fftwf_execute(plan[c]);
+				for (size_t i = 0; i < n * n2; i++) {
+					slab[i * 6 + 2 * c] = Bk[c][i][0];
+					slab[i * 6 + 2 * c + 1] = Bk[c][i][1];
+				}
+			}
+#pragma omp critical(PagedGridTurbulence)
+			{
+				tmp.seekp(ix * n * rowSize);
+				tmp.write((const char *)slab.data(), n * rowSize);
+				failed |= !tmp;
+			}
+		}
+
+		for (int c = 0; c < 3; c++)
+			destroyPlan(plan[c]);
+	}
+	if (failed)
+		throw std::runtime_error("PagedGridTurbulence: could not write file " +
+		                         tmpFilename);
+
+	// second pass: every y-plane, transformed along x and z
+	double sumB2 = 0;
+#pragma omp parallel reduction(+ : sumB2)
+	{
+		std::vector<float> buffer(n * n2 * 6), field(n * n * 3);
+		fftwf_complex *Bk[3];
+		float *B[3];
+		fftwf_plan planX[3], planZ[3];
+		for (int c = 0; c < 3; c++) {
+			Bk[c] = (fftwf_complex *)&buffer[c * n * n2 * 2];
+			B[c] = &field[c * n * n];
+			planX[c] = planColumns(n, n2, Bk[c]);
+			planZ[c] = planRows(n, Bk[c], B[c]);
+		}
+		std::vector<float> plane(n * n2 * 6);
+		std::vector<Vector3f> row(n);
+
+#pragma omp for schedule(dynamic)
+		for (size_t iy = 0; iy < n; iy++) {
+#pragma omp critical(PagedGridTurbulence)
+			for (size_t ix = 0; ix < n; ix++) {
+				tmp.seekg((ix * n + iy) * rowSize);
+				tmp.read((char *)&plane[ix * n2 * 6], rowSize);
+				failed |= !tmp;
+			}
+			for (int c = 0; c < 3; c++) {
+				for (size_t i = 0; i < n * n2; i++) {
+					Bk[c][i][0] = plane[i * 6 + 2 * c];
+					Bk[c][i][1] = plane[i * 6 + 2 * c + 1];
+				}
+				fftwf_execute(planX[c]);
+				fftwf_execute(planZ[c]);
+			}
+			for (size_t ix = 0; ix < n; ix++) {
+				for (size_t iz = 0; iz < n; iz++) {
+					size_t i = ix * n + iz;
+					Vector3f &b = row[iz];
+					b.setXYZ(B[0][i], B[1][i], B[2][i]);
+					sumB2 += b.getR2();
+				}
+#pragma omp critical(PagedGridTurbulence)
+				{
+					out.seekp((ix * n + iy) * n * sizeof(Vector3f));
+					out.write((const char *)row.data(), n * sizeof(Vector3f));
+					failed |= !out;
+				}
+			}
+		}
+
+		for (int c = 0; c < 3; c++) {
+			destroyPlan(planX[c]);
+			destroyPlan(planZ[c]);
+		}
+	}
+	tmp.close();
+	std::remove(tmpFilename.c_str());
+	if (failed)
+		throw std::runtime_error("PagedGridTurbulence: could not transform the field in " +
+		                         filename);
+
+	// normalize to Brms
+	double a = spectrum.getBrms() / std::sqrt(sumB2 / (n * n * n));
+	std::vector<Vector3f> chunk(n * n);
+	for (size_t ix = 0; ix < n; ix++) {
+		size_t offset = ix * n * n * sizeof(Vector3f);
+		out.seekg(offset);
+		out.read((char *)chunk.data(), chunk.size() * sizeof(Vector3f));
+		for (size_t i = 0; i < chunk.size(); i++)
+			chunk[i] *= a;
+		out.seekp(offset);
+		out.write((const char *)chunk.data(), chunk.size() * sizeof(Vector3f));
+	}
+	if (!out)
+		throw std::runtime_error("PagedGridTurbulence: could not write file " +
+		                         filename);
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_FFTW3F
@@ -46,26 +46,81 @@
 
 #include "kiss/logger.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
 
-#if defined(FAST_WAVES)
-#if defined(__SSE__) && defined(__SSE2__) && defined(__SSE3__) && defined(__SSE4_1__) && defined(__SSE4_2__) && defined(__AVX__)
-#define ENABLE_FAST_WAVES
-#else
-#error "FAST_WAVES is enabled, but it appears that not all required SIMD extensions are enabled in the compiler. Without these extensions, the FAST_WAVES optimization cannot be used. Please make sure that the SIMD_EXTENSIONS option in cmake matches the capabilities of your target CPU, or (if your target CPU does not support the required extensions), disable the FAST_WAVES flag in cmake."
-#endif
-#endif
-
-
-#ifdef ENABLE_FAST_WAVES
+// The SIMD kernels are compiled for their instruction sets with target
+// attributes, independent of the compiler flags, and selected at run time.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CRPROPA_WAVES_SIMD
 #include <immintrin.h>
 #endif
 
 namespace crpropa {
-#ifdef ENABLE_FAST_WAVES
+
+// Index bases into the avx_data and avx_fdata arrays. Since each subarray has
+// avx_Nm elements, the start of each subarray is the index times avx_Nm.
+// iAxi is a combined array containing the product of Ak * xi
+static const int iAxi0 = 0;
+static const int iAxi1 = 1;
+static const int iAxi2 = 2;
+// ikkappa is a combined array containing the product of k * kappa / pi
+static const int ikkappa0 = 3;
+static const int ikkappa1 = 4;
+static const int ikkappa2 = 5;
+// the phase beta / pi
+static const int ibeta = 6;
+static const int itotal = 7;
+
+// Number of modes per tile in getFields, 28 kB of the double or single
+// precision data. Multiples of 16, the number of modes read at a time by the
+// SIMD kernels.
+static const int modeTile = 512;
+static const int modeTileFloat = 1024;
+
+// Coefficients of the polynomial in x^2 approximating cos(pi * x) for
+// -0.5 <= x <= 0.5, generated using sleefs gencoef.c.
+static const double cosCoeff0 = +0.2211852080653743946e+0;
+static const double cosCoeff1 = -0.1332560668688523853e+1;
+static const double cosCoeff2 = +0.4058509506474178075e+1;
+static const double cosCoeff3 = -0.4934797516664651162e+1;
+
+// Scalar version of the SIMD kernels, for CPUs without AVX. The argument
+// reduction and the polynomial are the same as in sumWavesAVX.
+template<typename T>
+static Vector3d sumWavesScalar(const T *data, int n, int begin, int end,
+                         const Vector3d &pos) {
+	T p0 = pos.x, p1 = pos.y, p2 = pos.z;
+	T acc0 = 0, acc1 = 0, acc2 = 0;
+	// adding and subtracting 2^52 + 2^51 (2^23 + 2^22 for floats) rounds to
+	// the nearest integer, without a call to nearbyint
+	const T shift = T(1.5) * T(1ll << (std::numeric_limits<T>::digits - 1));
+	for (int i = begin; i < end; i++) {
+		T cos_arg = p0 * data[i + n * ikkappa0] + (p1 * data[i + n * ikkappa1]
+				+ p2 * data[i + n * ikkappa2]) + data[i + n * ibeta];
+		T q = (cos_arg + shift) - shift;
+		T s = cos_arg - q;
+		s = s * s;
+		T u = T(cosCoeff0);
+		u = u * s + T(cosCoeff1);
+		u = u * s + T(cosCoeff2);
+		u = u * s + T(cosCoeff3);
+		u = (u * s + T(1)) * T(1 - 2 * ((long long)q & 1));
+		acc0 += u * data[i + n * iAxi0];
+		acc1 += u * data[i + n * iAxi1];
+		acc2 += u * data[i + n * iAxi2];
+	}
+	return Vector3d(acc0, acc1, acc2);
+}
+
+#ifdef CRPROPA_WAVES_SIMD
 // see
 // https://stackoverflow.com/questions/49941645/get-sum-of-values-stored-in-m256d-with-sse-avx
-double hsum_double_avx(__m256d v) {
+__attribute__((target("avx")))
+static double hsum_double_avx(__m256d v) {
 	__m128d vlow = _mm256_castpd256_pd128(v);
 	__m128d vhigh = _mm256_extractf128_pd(v, 1); // high 128
 	vlow = _mm_add_pd(vlow, vhigh);              // reduce down to 128
@@ -73,172 +128,19 @@ double hsum_double_avx(__m256d v) {
 	__m128d high64 = _mm_unpackhi_pd(vlow, vlow);
 	return _mm_cvtsd_f64(_mm_add_sd(vlow, high64)); // reduce to scalar
 }
-#endif // defined(ENABLE_FAST_WAVES)
-
-PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
-                                         int Nm, int seed)
-    : TurbulentField(spectrum), Nm(Nm) {
-
-#ifdef ENABLE_FAST_WAVES
-	KISS_LOG_INFO << "PlaneWaveTurbulence: Using SIMD TD13 implementation"
-	              << std::endl;
-
-	// There used to be a cpuid check here, to see if the cpu running
-	// this code would support SIMD (SSE + AVX). However, the library providing
-	// the relevant function is no longer being used, and doing this manually
-	// might be a bit too much work.
-#endif
-
-	if (Nm <= 1) {
-		throw std::runtime_error(
-		    "PlaneWaveTurbulence: Nm <= 1. Specify at least two wavemodes in "
-		    "order to generate the k distribution properly.");
-	}
-
-	Random random;
-	if (seed != 0)
-		random.seed(seed);
-
-	double kmax = 2 * M_PI / spectrum.getLmin();
-	double kmin = 2 * M_PI / spectrum.getLmax();
-
-	xi = std::vector<Vector3d>(Nm, Vector3d(0.));
-	kappa = std::vector<Vector3d>(Nm, Vector3d(0.));
-	phi = std::vector<double>(Nm, 0.);
-	costheta = std::vector<double>(Nm, 0.);
-	beta = std::vector<double>(Nm, 0.);
-	Ak = std::vector<double>(Nm, 0.);
-	k = std::vector<double>(Nm, 0.);
-
-	double delta = log10(kmax / kmin);
-	for (int i = 0; i < Nm; i++) {
-		k[i] = pow(10, log10(kmin) + ((double)i) / ((double)(Nm - 1)) * delta);
-	}
-
-	// * compute Ak *
-
-	double delta_k0 =
-	    (k[1] - k[0]) / k[1]; // multiply this by k[i] to get delta_k[i]
-	// Note: this is probably unnecessary since it's just a factor
-	// and will get normalized out anyways. It's not like this is
-	// performance-sensitive code though, and I don't want to change
-	// anything numerical now.
-
-	// For this loop, the Ak array actually contains Gk*delta_k (ie
-	// non-normalized Ak^2). Normalization happens in a second loop,
-	// once the total is known.
-	double Ak2_sum = 0; // sum of Ak^2 over all k
-	for (int i = 0; i < Nm; i++) {
-		double k = this->k[i];
-		double kHat = k * spectrum.getLbendover();
-		double Gk = spectrum.energySpectrum(k) * (1 + kHat * kHat);	// correct different implementation in TD 13 (eq. 5, missing + 1 in the denuminators exponent)
-		Ak[i] = Gk * delta_k0 * k;
-		Ak2_sum += Ak[i];
-
-		// phi, costheta, and sintheta are for drawing vectors with
-		// uniform distribution on the unit sphere.
-		// This is similar to Random::randVector(): their t is our phi,
-		// z is costheta, and r is sintheta. Our kappa is equivalent to
-		// the return value of randVector(); however, TD13 then reuse
-		// these values to generate a random vector perpendicular to kappa.
-		double phi = random.randUniform(-M_PI, M_PI);
-		double costheta = random.randUniform(-1., 1.);
-		double sintheta = sqrt(1 - costheta * costheta);
-
-		double alpha = random.randUniform(0, 2 * M_PI);
-		double beta = random.randUniform(0, 2 * M_PI);
-
-		Vector3d kappa =
-		    Vector3d(sintheta * cos(phi), sintheta * sin(phi), costheta);
-
-		// NOTE: all other variable names match the ones from the TD13 paper.
-		// However, our xi is actually their psi, and their xi isn't used at
-		// all. (Though both can be used for the polarization vector, according
-		// to the paper.) The reason for this discrepancy is that this code
-		// used to be based on the original GJ99 paper, which provided only a
-		// xi vector, and this xi happens to be almost the same as TD13's psi.
-		Vector3d xi =
-		    Vector3d(costheta * cos(phi) * cos(alpha) + sin(phi) * sin(alpha),
-		             costheta * sin(phi) * cos(alpha) - cos(phi) * sin(alpha),
-		             -sintheta * cos(alpha));
-
-		this->xi[i] = xi;
-		this->kappa[i] = kappa;
-		this->phi[i] = phi;
-		this->costheta[i] = costheta;
-		this->beta[i] = beta;
-	}
-
-	// Only in this loop are the actual Ak computed and stored.
-	// This two-step process is necessary in order to normalize the values
-	// properly.
-	for (int i = 0; i < Nm; i++) {
-		Ak[i] = sqrt(2 * Ak[i] / Ak2_sum) * spectrum.getBrms();
-	}
-
-#ifdef ENABLE_FAST_WAVES
-	// * copy data into AVX-compatible arrays *
-	//
-	// AVX requires all data to be aligned to 256 bit, or 32 bytes, which is the
-	// same as 4 double precision floating point numbers. Since support for
-	// alignments this big seems to be somewhat tentative in C++ allocators,
-	// we're aligning them manually by allocating a normal double array, and
-	// then computing the offset to the first value with the correct alignment.
-	// This is a little bit of work, so instead of doing it separately for each
-	// of the individual data arrays, we're doing it once for one big array that
-	// all of the component arrays get packed into.
-	//
-	// The other thing to keep in mind is that AVX always reads in units of 256
-	// bits, or 4 doubles. This means that our number of wavemodes must be
-	// divisible by 4. If it isn't, we simply pad it out with zeros. Since the
-	// final step of the computation of each wavemode is multiplication by the
-	// amplitude, which will be set to 0, these padding wavemodes won't affect
-	// the result.
-
-	avx_Nm = ((Nm + 4 - 1) / 4) * 4; // round up to next larger multiple of 4:
-	                                 // align is 256 = 4 * sizeof(double) bit
-	avx_data = std::vector<double>(itotal * avx_Nm + 3, 0.);
 
-	// get the first 256-bit aligned element
-	size_t size = avx_data.size() * sizeof(double);
-	void *pointer = avx_data.data();
-	align_offset =
-	    (double *)std::align(32, 32, pointer, size) - avx_data.data();
-
-	// copy into the AVX arrays
-	for (int i = 0; i < Nm; i++) {
-		avx_data[i + align_offset + avx_Nm * iAxi0] = Ak[i] * xi[i].x;
-		avx_data[i + align_offset + avx_Nm * iAxi1] = Ak[i] * xi[i].y;
-		avx_data[i + align_offset + avx_Nm * iAxi2] = Ak[i] * xi[i].z;
-
-		// The cosine implementation computes cos(pi*x), so we'll divide out the
-		// pi here.
-		avx_data[i + align_offset + avx_Nm * ikkappa0] =
-		    k[i] / M_PI * kappa[i].x;
-		avx_data[i + align_offset + avx_Nm * ikkappa1] =
-		    k[i] / M_PI * kappa[i].y;
-		avx_data[i + align_offset + avx_Nm * ikkappa2] =
-		    k[i] / M_PI * kappa[i].z;
-
-		// We also need to divide beta by pi, since that goes into the argument
-		// of the cosine as well.
-		avx_data[i + align_offset + avx_Nm * ibeta] = beta[i] / M_PI;
-	}
-#endif // ENABLE_FAST_WAVES
+__attribute__((target("avx")))
+static double hsum_float_avx(__m256 v) {
+	float f[8];
+	_mm256_storeu_ps(f, v);
+	return ((double(f[0]) + f[1]) + (double(f[2]) + f[3]))
+			+ ((double(f[4]) + f[5]) + (double(f[6]) + f[7]));
 }
 
-Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
-
-#ifndef ENABLE_FAST_WAVES
-	Vector3d B(0.);
-	for (int i = 0; i < Nm; i++) {
-		double z_ = pos.dot(kappa[i]);
-		B += xi[i] * Ak[i] * cos(k[i] * z_ + beta[i]);
-	}
-	return B;
-
-#else  // ENABLE_FAST_WAVES
-
+// AVX kernel, summing four wavemodes at a time
+__attribute__((target("avx")))
+static Vector3d sumWavesAVX(const double *data, int n, int begin, int end,
+                         const Vector3d &pos) {
 	// Initialize accumulators
 	//
 	// There is one accumulator per component of the result vector.
@@ -257,28 +159,25 @@ Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
 	__m256d pos1 = _mm256_set1_pd(pos.y);
 	__m256d pos2 = _mm256_set1_pd(pos.z);
 
-	for (int i = 0; i < avx_Nm; i += 4) {
+	for (int i = begin; i < end; i += 4) {
 
 		// Load data from memory into AVX registers:
 		//  - the three components of the vector A * xi
 		__m256d Axi0 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi0);
+		    _mm256_load_pd(data + i + n * iAxi0);
 		__m256d Axi1 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi1);
+		    _mm256_load_pd(data + i + n * iAxi1);
 		__m256d Axi2 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi2);
+		    _mm256_load_pd(data + i + n * iAxi2);
 
 		//  - the three components of the vector k * kappa
-		__m256d kkappa0 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa0);
-		__m256d kkappa1 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa1);
-		__m256d kkappa2 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa2);
+		__m256d kkappa0 = _mm256_load_pd(data + i + n * ikkappa0);
+		__m256d kkappa1 = _mm256_load_pd(data + i + n * ikkappa1);
+		__m256d kkappa2 = _mm256_load_pd(data + i + n * ikkappa2);
 
 		//  - the phase beta.
 		__m256d beta =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * ibeta);
+		    _mm256_load_pd(data + i + n * ibeta);
 
 		// Then, do the computation.
 
@@ -401,19 +300,15 @@ Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
 		// ******
 		// * Evaluate the cosine using a polynomial approximation for the zeroth
 		// half-wave.
-		// * The coefficients for this were generated using sleefs gencoef.c.
 		// * These coefficients are probably far from optimal; however, they
 		// should be sufficient for this case.
 		s = _mm256_mul_pd(s, s);
 
-		__m256d u = _mm256_set1_pd(+0.2211852080653743946e+0);
+		__m256d u = _mm256_set1_pd(cosCoeff0);
 
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(-0.1332560668688523853e+1));
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(+0.4058509506474178075e+1));
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(-0.4934797516664651162e+1));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(cosCoeff1));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(cosCoeff2));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(cosCoeff3));
 		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(1.));
 
 		// Then, flip the sign of each double for which invert is not zero.
@@ -435,7 +330,455 @@ Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
 
 	return Vector3d(hsum_double_avx(acc0), hsum_double_avx(acc1),
 	                hsum_double_avx(acc2));
-#endif // ENABLE_FAST_WAVES
+}
+
+// AVX2 kernel with fused multiply-adds; the same computation as sumWavesAVX
+__attribute__((target("avx2,fma")))
+static Vector3d sumWavesAVX2(const double *data, int n, int begin, int end,
+                         const Vector3d &pos) {
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	__m256d acc2 = _mm256_setzero_pd();
+	__m256d pos0 = _mm256_set1_pd(pos.x);
+	__m256d pos1 = _mm256_set1_pd(pos.y);
+	__m256d pos2 = _mm256_set1_pd(pos.z);
+	const __m256d shift = _mm256_set1_pd(0x0018000000000000);
+	const __m256i one = _mm256_set1_epi64x(1);
+
+	for (int i = begin; i < end; i += 4) {
+		__m256d cos_arg = _mm256_fmadd_pd(pos0, _mm256_load_pd(data + i + n * ikkappa0),
+				_mm256_fmadd_pd(pos1, _mm256_load_pd(data + i + n * ikkappa1),
+				_mm256_fmadd_pd(pos2, _mm256_load_pd(data + i + n * ikkappa2),
+				_mm256_load_pd(data + i + n * ibeta))));
+
+		__m256d q = _mm256_round_pd(
+		    cos_arg, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m256d s = _mm256_sub_pd(cos_arg, q);
+		// with AVX2, bit 0 of q + 2^52 + 2^51 can be moved into the sign bit
+		__m256i invert = _mm256_slli_epi64(_mm256_and_si256(
+		    _mm256_castpd_si256(_mm256_add_pd(q, shift)), one), 63);
+
+		s = _mm256_mul_pd(s, s);
+		__m256d u = _mm256_set1_pd(cosCoeff0);
+		u = _mm256_fmadd_pd(u, s, _mm256_set1_pd(cosCoeff1));
+		u = _mm256_fmadd_pd(u, s, _mm256_set1_pd(cosCoeff2));
+		u = _mm256_fmadd_pd(u, s, _mm256_set1_pd(cosCoeff3));
+		u = _mm256_fmadd_pd(u, s, _mm256_set1_pd(1.));
+		u = _mm256_xor_pd(u, _mm256_castsi256_pd(invert));
+
+		acc0 = _mm256_fmadd_pd(u, _mm256_load_pd(data + i + n * iAxi0), acc0);
+		acc1 = _mm256_fmadd_pd(u, _mm256_load_pd(data + i + n * iAxi1), acc1);
+		acc2 = _mm256_fmadd_pd(u, _mm256_load_pd(data + i + n * iAxi2), acc2);
+	}
+
+	return Vector3d(hsum_double_avx(acc0), hsum_double_avx(acc1),
+	                hsum_double_avx(acc2));
+}
+
+// AVX2 kernel in single precision, summing eight wavemodes at a time
+__attribute__((target("avx2,fma")))
+static Vector3d sumWavesAVX2(const float *data, int n, int begin, int end,
+                         const Vector3d &pos) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 pos0 = _mm256_set1_ps(pos.x);
+	__m256 pos1 = _mm256_set1_ps(pos.y);
+	__m256 pos2 = _mm256_set1_ps(pos.z);
+
+	for (int i = begin; i < end; i += 8) {
+		__m256 cos_arg = _mm256_fmadd_ps(pos0, _mm256_load_ps(data + i + n * ikkappa0),
+				_mm256_fmadd_ps(pos1, _mm256_load_ps(data + i + n * ikkappa1),
+				_mm256_fmadd_ps(pos2, _mm256_load_ps(data + i + n * ikkappa2),
+				_mm256_load_ps(data + i + n * ibeta))));
+
+		__m256 q = _mm256_round_ps(
+		    cos_arg, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m256 s = _mm256_sub_ps(cos_arg, q);
+		// q is exact in a 32 bit integer, whose bit 0 is moved into the sign bit
+		__m256i invert = _mm256_slli_epi32(_mm256_cvtps_epi32(q), 31);
+
+		s = _mm256_mul_ps(s, s);
+		__m256 u = _mm256_set1_ps(cosCoeff0);
+		u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(cosCoeff1));
+		u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(cosCoeff2));
+		u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(cosCoeff3));
+		u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(1.f));
+		u = _mm256_xor_ps(u, _mm256_castsi256_ps(invert));
+
+		acc0 = _mm256_fmadd_ps(u, _mm256_load_ps(data + i + n * iAxi0), acc0);
+		acc1 = _mm256_fmadd_ps(u, _mm256_load_ps(data + i + n * iAxi1), acc1);
+		acc2 = _mm256_fmadd_ps(u, _mm256_load_ps(data + i + n * iAxi2), acc2);
+	}
+
+	return Vector3d(hsum_float_avx(acc0), hsum_float_avx(acc1),
+	                hsum_float_avx(acc2));
+}
+
+// AVX-512 kernel, summing eight wavemodes at a time. Only AVX-512F
+// instructions are used, so the sign is flipped with integer operations.
+__attribute__((target("avx512f")))
+static Vector3d sumWavesAVX512(const double *data, int n, int begin, int end,
+                         const Vector3d &pos) {
+	__m512d acc0 = _mm512_setzero_pd();
+	__m512d acc1 = _mm512_setzero_pd();
+	__m512d acc2 = _mm512_setzero_pd();
+	__m512d pos0 = _mm512_set1_pd(pos.x);
+	__m512d pos1 = _mm512_set1_pd(pos.y);
+	__m512d pos2 = _mm512_set1_pd(pos.z);
+	const __m512d shift = _mm512_set1_pd(0x0018000000000000);
+	const __m512i one = _mm512_set1_epi64(1);
+
+	for (int i = begin; i < end; i += 8) {
+		__m512d cos_arg = _mm512_fmadd_pd(pos0, _mm512_load_pd(data + i + n * ikkappa0),
+				_mm512_fmadd_pd(pos1, _mm512_load_pd(data + i + n * ikkappa1),
+				_mm512_fmadd_pd(pos2, _mm512_load_pd(data + i + n * ikkappa2),
+				_mm512_load_pd(data + i + n * ibeta))));
+
+		__m512d q = _mm512_roundscale_pd(
+		    cos_arg, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m512d s = _mm512_sub_pd(cos_arg, q);
+		__m512i invert = _mm512_slli_epi64(_mm512_and_si512(
+		    _mm512_castpd_si512(_mm512_add_pd(q, shift)), one), 63);
+
+		s = _mm512_mul_pd(s, s);
+		__m512d u = _mm512_set1_pd(cosCoeff0);
+		u = _mm512_fmadd_pd(u, s, _mm512_set1_pd(cosCoeff1));
+		u = _mm512_fmadd_pd(u, s, _mm512_set1_pd(cosCoeff2));
+		u = _mm512_fmadd_pd(u, s, _mm512_set1_pd(cosCoeff3));
+		u = _mm512_fmadd_pd(u, s, _mm512_set1_pd(1.));
+		u = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(u), invert));
+
+		acc0 = _mm512_fmadd_pd(u, _mm512_load_pd(data + i + n * iAxi0), acc0);
+		acc1 = _mm512_fmadd_pd(u, _mm512_load_pd(data + i + n * iAxi1), acc1);
+		acc2 = _mm512_fmadd_pd(u, _mm512_load_pd(data + i + n * iAxi2), acc2);
+	}
+
+	return Vector3d(_mm512_reduce_add_pd(acc0), _mm512_reduce_add_pd(acc1),
+	                _mm512_reduce_add_pd(acc2));
+}
+
+// AVX-512 kernel in single precision, summing sixteen wavemodes at a time
+__attribute__((target("avx512f")))
+static Vector3d sumWavesAVX512(const float *data, int n, int begin, int end,
+                         const Vector3d &pos) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 pos0 = _mm512_set1_ps(pos.x);
+	__m512 pos1 = _mm512_set1_ps(pos.y);
+	__m512 pos2 = _mm512_set1_ps(pos.z);
+
+	for (int i = begin; i < end; i += 16) {
+		__m512 cos_arg = _mm512_fmadd_ps(pos0, _mm512_load_ps(data + i + n * ikkappa0),
+				_mm512_fmadd_ps(pos1, _mm512_load_ps(data + i + n * ikkappa1),
+				_mm512_fmadd_ps(pos2, _mm512_load_ps(data + i + n * ikkappa2),
+				_mm512_load_ps(data + i + n * ibeta))));
+
+		__m512 q = _mm512_roundscale_ps(
+		    cos_arg, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m512 s = _mm512_sub_ps(cos_arg, q);
+		__m512i invert = _mm512_slli_epi32(_mm512_cvtps_epi32(q), 31);
+
+		s = _mm512_mul_ps(s, s);
+		__m512 u = _mm512_set1_ps(cosCoeff0);
+		u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(cosCoeff1));
+		u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(cosCoeff2));
+		u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(cosCoeff3));
+		u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(1.f));
+		u = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(u), invert));
+
+		acc0 = _mm512_fmadd_ps(u, _mm512_load_ps(data + i + n * iAxi0), acc0);
+		acc1 = _mm512_fmadd_ps(u, _mm512_load_ps(data + i + n * iAxi1), acc1);
+		acc2 = _mm512_fmadd_ps(u, _mm512_load_ps(data + i + n * iAxi2), acc2);
+	}
+
+	return Vector3d(_mm512_reduce_add_ps(acc0), _mm512_reduce_add_ps(acc1),
+	                _mm512_reduce_add_ps(acc2));
+}
+#endif // CRPROPA_WAVES_SIMD
+
+PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
+                                         int Nm, int seed)
+    : TurbulentField(spectrum), Nm(Nm), kernel(EXACT),
+      simdLevel(getSupportedSimdLevel()) {
+
+#ifdef FAST_WAVES
+	kernel = FAST;
+	KISS_LOG_INFO << "PlaneWaveTurbulence: Using SIMD TD13 implementation"
+	              << std::endl;
+#endif
+
+	if (Nm <= 1) {
+		throw std::runtime_error(
+		    "PlaneWaveTurbulence: Nm <= 1. Specify at least two wavemodes in "
+		    "order to generate the k distribution properly.");
+	}
+
+	Random random;
+	if (seed != 0)
+		random.seed(seed);
+
+	double kmax = 2 * M_PI / spectrum.getLmin();
+	double kmin = 2 * M_PI / spectrum.getLmax();
+
+	xi = std::vector<Vector3d>(Nm, Vector3d(0.));
+	kappa = std::vector<Vector3d>(Nm, Vector3d(0.));
+	phi = std::vector<double>(Nm, 0.);
+	costheta = std::vector<double>(Nm, 0.);
+	beta = std::vector<double>(Nm, 0.);
+	Ak = std::vector<double>(Nm, 0.);
+	k = std::vector<double>(Nm, 0.);
+
+	double delta = log10(kmax / kmin);
+	for (int i = 0; i < Nm; i++) {
+		k[i] = pow(10, log10(kmin) + ((double)i) / ((double)(Nm - 1)) * delta);
+	}
+
+	// * compute Ak *
+
+	double delta_k0 =
+	    (k[1] - k[0]) / k[1]; // multiply this by k[i] to get delta_k[i]
+	// Note: this is probably unnecessary since it's just a factor
+	// and will get normalized out anyways. It's not like this is
+	// performance-sensitive code though, and I don't want to change
+	// anything numerical now.
+
+	// For this loop, the Ak array actually contains Gk*delta_k (ie
+	// non-normalized Ak^2). Normalization happens in a second loop,
+	// once the total is known.
+	double Ak2_sum = 0; // sum of Ak^2 over all k
+	for (int i = 0; i < Nm; i++) {
+		double k = this->k[i];
+		double kHat = k * spectrum.getLbendover();
+		double Gk = spectrum.energySpectrum(k) * (1 + kHat * kHat);	// correct different implementation in TD 13 (eq. 5, missing + 1 in the denuminators exponent)
+		Ak[i] = Gk * delta_k0 * k;
+		Ak2_sum += Ak[i];
+
+		// phi, costheta, and sintheta are for drawing vectors with
+		// uniform distribution on the unit sphere.
+		// This is similar to Random::randVector(): their t is our phi,
+		// z is costheta, and r is sintheta. Our kappa is equivalent to
+		// the return value of randVector(); however, TD13 then reuse
+		// these values to generate a random vector perpendicular to kappa.
+		double phi = random.randUniform(-M_PI, M_PI);
+		double costheta = random.randUniform(-1., 1.);
+		double sintheta = sqrt(1 - costheta * costheta);
+
+		double alpha = random.randUniform(0, 2 * M_PI);
+		double beta = random.randUniform(0, 2 * M_PI);
+
+		Vector3d kappa =
+		    Vector3d(sintheta * cos(phi), sintheta * sin(phi), costheta);
+
+		// NOTE: all other variable names match the ones from the TD13 paper.
+		// However, our xi is actually their psi, and their xi isn't used at
+		// all. (Though both can be used for the polarization vector, according
+		// to the paper.) The reason for this discrepancy is that this code
+		// used to be based on the original GJ99 paper, which provided only a
+		// xi vector, and this xi happens to be almost the same as TD13's psi.
+		Vector3d xi =
+		    Vector3d(costheta * cos(phi) * cos(alpha) + sin(phi) * sin(alpha),
+		             costheta * sin(phi) * cos(alpha) - cos(phi) * sin(alpha),
+		             -sintheta * cos(alpha));
+
+		this->xi[i] = xi;
+		this->kappa[i] = kappa;
+		this->phi[i] = phi;
+		this->costheta[i] = costheta;
+		this->beta[i] = beta;
+	}
+
+	// Only in this loop are the actual Ak computed and stored.
+	// This two-step process is necessary in order to normalize the values
+	// properly.
+	for (int i = 0; i < Nm; i++) {
+		Ak[i] = sqrt(2 * Ak[i] / Ak2_sum) * spectrum.getBrms();
+	}
+
+	initSimdData();
+}
+
+void PlaneWaveTurbulence::initSimdData() {
+	// * copy data into SIMD-compatible arrays *
+	//
+	// AVX-512 requires all data to be aligned to 512 bit, or 64 bytes, which is
+	// the same as 8 double or 16 single precision floating point numbers. Since
+	// support for alignments this big seems to be somewhat tentative in C++
+	// allocators, we're aligning them manually by allocating a normal array,
+	// and then computing the offset to the first value with the correct
+	// alignment. This is a little bit of work, so instead of doing it
+	// separately for each of the individual data arrays, we're doing it once
+	// for one big array that all of the component arrays get packed into.
+	//
+	// The other thing to keep in mind is that the kernels always read 512 bits
+	// at a time, or 16 floats. This means that our number of wavemodes must be
+	// divisible by 16. If it isn't, we simply pad it out with zeros. Since the
+	// final step of the computation of each wavemode is multiplication by the
+	// amplitude, which will be set to 0, these padding wavemodes won't affect
+	// the result.
+
+	avx_Nm = ((Nm + 16 - 1) / 16) * 16; // round up to next larger multiple of 16
+	avx_data = std::vector<double>(itotal * avx_Nm + 7, 0.);
+	avx_fdata = std::vector<float>(itotal * avx_Nm + 15, 0.f);
+
+	// get the first 512-bit aligned elements
+	size_t size = avx_data.size() * sizeof(double);
+	void *pointer = avx_data.data();
+	align_offset =
+	    (double *)std::align(64, 64, pointer, size) - avx_data.data();
+	size = avx_fdata.size() * sizeof(float);
+	pointer = avx_fdata.data();
+	falign_offset =
+	    (float *)std::align(64, 64, pointer, size) - avx_fdata.data();
+
+	// copy into the SIMD arrays
+	for (int i = 0; i < Nm; i++) {
+		avx_data[i + align_offset + avx_Nm * iAxi0] = Ak[i] * xi[i].x;
+		avx_data[i + align_offset + avx_Nm * iAxi1] = Ak[i] * xi[i].y;
+		avx_data[i + align_offset + avx_Nm * iAxi2] = Ak[i] * xi[i].z;
+
+		// The cosine implementation computes cos(pi*x), so we'll divide out the
+		// pi here.
+		avx_data[i + align_offset + avx_Nm * ikkappa0] =
+		    k[i] / M_PI * kappa[i].x;
+		avx_data[i + align_offset + avx_Nm * ikkappa1] =
+		    k[i] / M_PI * kappa[i].y;
+		avx_data[i + align_offset + avx_Nm * ikkappa2] =
+		    k[i] / M_PI * kappa[i].z;
+
+		// We also need to divide beta by pi, since that goes into the argument
+		// of the cosine as well.
+		avx_data[i + align_offset + avx_Nm * ibeta] = beta[i] / M_PI;
+	}
+	for (int j = 0; j < itotal; j++)
+		for (int i = 0; i < Nm; i++)
+			avx_fdata[i + falign_offset + avx_Nm * j] =
+			    avx_data[i + align_offset + avx_Nm * j];
+}
+
+Vector3d PlaneWaveTurbulence::sumWaves(int begin, int end,
+                                       const Vector3d &pos) const {
+	if (kernel == EXACT) {
+		Vector3d B(0.);
+		for (int i = begin; i < std::min(end, Nm); i++) {
+			double z_ = pos.dot(kappa[i]);
+			B += xi[i] * Ak[i] * cos(k[i] * z_ + beta[i]);
+		}
+		return B;
+	}
+
+	const double *data = avx_data.data() + align_offset;
+	const float *fdata = avx_fdata.data() + falign_offset;
+#ifdef CRPROPA_WAVES_SIMD
+	if (kernel == FAST_FLOAT) {
+		if (simdLevel == SIMD_AVX512)
+			return sumWavesAVX512(fdata, avx_Nm, begin, end, pos);
+		if (simdLevel == SIMD_AVX2)
+			return sumWavesAVX2(fdata, avx_Nm, begin, end, pos);
+	} else {
+		if (simdLevel == SIMD_AVX512)
+			return sumWavesAVX512(data, avx_Nm, begin, end, pos);
+		if (simdLevel == SIMD_AVX2)
+			return sumWavesAVX2(data, avx_Nm, begin, end, pos);
+		if (simdLevel == SIMD_AVX)
+			return sumWavesAVX(data, avx_Nm, begin, end, pos);
+	}
+#endif // CRPROPA_WAVES_SIMD
+	if (kernel == FAST_FLOAT)
+		return sumWavesScalar(fdata, avx_Nm, begin, end, pos);
+	return sumWavesScalar(data, avx_Nm, begin, end, pos);
+}
+
+Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
+	return sumWaves(0, avx_Nm, pos);
+}
+
+void PlaneWaveTurbulence::getFields(const Vector3d *positions, Vector3d *fields,
+                                    size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = Vector3d(0.);
+
+	// The modes are summed in tiles, which stay in the L1 cache while they are
+	// evaluated for all positions, instead of streaming the whole table from
+	// memory for each position.
+	int tile = (kernel == FAST_FLOAT) ? modeTileFloat : modeTile;
+	for (int begin = 0; begin < avx_Nm; begin += tile) {
+		int end = std::min(begin + tile, avx_Nm);
+		for (size_t i = 0; i < n; i++)
+			fields[i] += sumWaves(begin, end, positions[i]);
+	}
+}
+
+std::vector<double> PlaneWaveTurbulence::getModes() const {
+	std::vector<double> modes;
+	modes.reserve(Nm * modeSize);
+	for (int i = 0; i < Nm; i++) {
+		double mode[modeSize] = {xi[i].x, xi[i].y, xi[i].z, kappa[i].x,
+		    kappa[i].y, kappa[i].z, phi[i], costheta[i], beta[i], Ak[i], k[i]};
+		modes.insert(modes.end(), mode, mode + modeSize);
+	}
+	return modes;
+}
+
+void PlaneWaveTurbulence::setModes(const std::vector<double> &modes) {
+	if ((modes.size() % modeSize != 0) || (modes.size() < 2 * modeSize))
+		throw std::runtime_error(
+		    "PlaneWaveTurbulence: setModes needs at least two wavemodes of "
+		    "modeSize values each");
+
+	Nm = modes.size() / modeSize;
+	xi.resize(Nm);
+	kappa.resize(Nm);
+	phi.resize(Nm);
+	costheta.resize(Nm);
+	beta.resize(Nm);
+	Ak.resize(Nm);
+	k.resize(Nm);
+	for (int i = 0; i < Nm; i++) {
+		const double *mode = &modes[i * modeSize];
+		xi[i] = Vector3d(mode[0], mode[1], mode[2]);
+		kappa[i] = Vector3d(mode[3], mode[4], mode[5]);
+		phi[i] = mode[6];
+		costheta[i] = mode[7];
+		beta[i] = mode[8];
+		Ak[i] = mode[9];
+		k[i] = mode[10];
+	}
+	initSimdData();
+}
+
+int PlaneWaveTurbulence::getNumberOfModes() const {
+	return Nm;
+}
+
+void PlaneWaveTurbulence::setKernel(Kernel kernel) {
+	this->kernel = kernel;
+}
+
+PlaneWaveTurbulence::Kernel PlaneWaveTurbulence::getKernel() const {
+	return kernel;
+}
+
+void PlaneWaveTurbulence::setSimdLevel(SimdLevel level) {
+	simdLevel = std::min(level, getSupportedSimdLevel());
+}
+
+PlaneWaveTurbulence::SimdLevel PlaneWaveTurbulence::getSimdLevel() const {
+	return simdLevel;
+}
+
+PlaneWaveTurbulence::SimdLevel PlaneWaveTurbulence::getSupportedSimdLevel() {
+#ifdef CRPROPA_WAVES_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("avx"))
+		return SIMD_AVX;
+#endif
+	return SIMD_NONE;
 }
 
 } // namespace crpropa
@@ -0,0 +1,172 @@
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/magneticLens/MagneticLens.h"
+#include "crpropa/Units.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+LensBuilder::LensBuilder(uint8_t order, double rigidityMin, double rigidityMax,
+		size_t nBins) : pixelization(order), nBins(nBins), useWeights(false) {
+	if ((rigidityMin <= 0) || (rigidityMax <= rigidityMin) || (nBins == 0))
+		throw std::runtime_error("LensBuilder: invalid rigidity bins");
+	setRunOnInactive(true);
+	logRigidityMin = log10(rigidityMin);
+	logRigidityMax = log10(rigidityMax);
+	sharedBuffer.triplets.resize(nBins);
+#ifdef _OPENMP
+	threadBuffers.resize(omp_get_max_threads());
+#else
+	threadBuffers.resize(1);
+#endif
+	for (size_t i = 0; i < threadBuffers.size(); i++)
+		threadBuffers[i].triplets.resize(nBins);
+}
+
+void LensBuilder::process(Candidate *candidate) const {
+	const ParticleState &source = candidate->source;
+	double Z = fabs(source.getCharge() / eplus);
+	if (Z == 0)
+		return;
+	double logRigidity = log10(source.getEnergy() / Z);
+	if ((logRigidity < logRigidityMin) || (logRigidity >= logRigidityMax))
+		return;
+	size_t bin = (logRigidity - logRigidityMin) / (logRigidityMax - logRigidityMin) * nBins;
+	if (bin >= nBins)
+		bin = nBins - 1;
+
+	const Vector3d &arrival = source.getDirection();
+	const Vector3d &extragalactic = candidate->current.getDirection();
+	Eigen::Triplet<double> entry(
+			pixelization.vector2Pix(arrival.x, arrival.y, arrival.z),
+			pixelization.vector2Pix(extragalactic.x, extragalactic.y, extragalactic.z),
+			useWeights ? candidate->getWeight() : 1.);
+
+	int slot = 0;
+#ifdef _OPENMP
+	slot = (omp_get_level() > 1) ? -1 : omp_get_thread_num();
+#endif
+	if ((slot < 0) || (slot >= (int) threadBuffers.size())) {
+#pragma omp critical(LensBuilder)
+		sharedBuffer.triplets[bin].push_back(entry);
+		return;
+	}
+	threadBuffers[slot].triplets[bin].push_back(entry);
+}
+
+void LensBuilder::setUseWeights(bool use) {
+	useWeights = use;
+}
+
+void LensBuilder::merge(const Buffer &buffer, size_t bin,
+		std::vector<Eigen::Triplet<double> > &all) const {
+	const std::vector<Eigen::Triplet<double> > &t = buffer.triplets[bin];
+	all.insert(all.end(), t.begin(), t.end());
+}
+
+void LensBuilder::build(bool normalize) {
+	const size_t nPix = pixelization.nPix();
+	matrices.assign(nBins, ModelMatrixType());
+
+#pragma omp parallel for schedule(dynamic)
+	for (long bin = 0; bin < (long) nBins; bin++) {
+		std::vector<Eigen::Triplet<double> > all;
+		merge(sharedBuffer, bin, all);
+		for (size_t i = 0; i < threadBuffers.size(); i++)
+			merge(threadBuffers[i], bin, all);
+
+		if (normalize) {
+			// the candidates of an arrival pixel add up to 1
+			std::vector<double> rowSum(nPix, 0.);
+			for (size_t i = 0; i < all.size(); i++)
+				rowSum[all[i].row()] += all[i].value();
+			for (size_t i = 0; i < all.size(); i++)
+				all[i] = Eigen::Triplet<double>(all[i].row(), all[i].col(),
+						all[i].value() / rowSum[all[i].row()]);
+		}
+
+		ModelMatrixType M(nPix, nPix);
+		M.setFromTriplets(all.begin(), all.end());
+		M.makeCompressed();
+		matrices[bin].swap(M);
+	}
+}
+
+void LensBuilder::clear() {
+	for (size_t bin = 0; bin < nBins; bin++) {
+		std::vector<Eigen::Triplet<double> >().swap(sharedBuffer.triplets[bin]);
+		for (size_t i = 0; i < threadBuffers.size(); i++)
+			std::vector<Eigen::Triplet<double> >().swap(threadBuffers[i].triplets[bin]);
+	}
+	matrices.clear();
+}
+
+size_t LensBuilder::getNumberOfBins() const {
+	return nBins;
+}
+
+double LensBuilder::getRigidityMin(size_t bin) const {
+	return pow(10, logRigidityMin + (logRigidityMax - logRigidityMin) * bin / nBins);
+}
+
+double LensBuilder::getRigidityMax(size_t bin) const {
+	return getRigidityMin(bin + 1);
+}
+
+const ModelMatrixType &LensBuilder::getMatrix(size_t bin) const {
+	if (bin >= matrices.size())
+		throw std::runtime_error("LensBuilder: no matrix, call build() first");
+	return matrices[bin];
+}
+
+void LensBuilder::write(const std::string &filename) const {
+	if (matrices.size() != nBins)
+		throw std::runtime_error("LensBuilder: no matrices, call build() first");
+
+	// lens files are relative to the directory of the lens
+	std::string name = filename;
+	size_t sp = filename.find_last_of("/");
+	if (sp != std::string::npos)
+		name = filename.substr(sp + 1);
+
+	std::ofstream cfg((filename + ".cfg").c_str());
+	if (!cfg)
+		throw std::runtime_error("LensBuilder: cannot write " + filename + ".cfg");
+	cfg.precision(12);
+	cfg << "# lens part, log10(rigidity / eV) from, to\n";
+	for (size_t bin = 0; bin < nBins; bin++) {
+		if (matrices[bin].nonZeros() == 0)
+			continue;
+		std::ostringstream part;
+		part << "_" << bin << ".csc";
+		serializeCompressed(filename + part.str(), matrices[bin]);
+		cfg << name << part.str() << " " << log10(getRigidityMin(bin) / eV)
+				<< " " << log10(getRigidityMax(bin) / eV) << "\n";
+	}
+}
+
+void LensBuilder::addToLens(MagneticLens &lens) const {
+	if (matrices.size() != nBins)
+		throw std::runtime_error("LensBuilder: no matrices, call build() first");
+	for (size_t bin = 0; bin < nBins; bin++) {
+		if (matrices[bin].nonZeros() > 0)
+			lens.setLensPart(matrices[bin], getRigidityMin(bin), getRigidityMax(bin));
+	}
+}
+
+std::string LensBuilder::getDescription() const {
+	std::stringstream s;
+	s << "LensBuilder: " << nBins << " lens parts from "
+			<< getRigidityMin(0) / EeV << " EeV to " << getRigidityMax(nBins - 1) / EeV
+			<< " EeV, healpix order " << int(pixelization.getOrder());
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,218 @@
+#include "crpropa/magneticLens/LensDevice.h"
+#include "crpropa/magneticLens/MagneticLens.h"
+
+#include <cuda_runtime.h>
+#include <cusparse.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+namespace {
+void check(cudaError_t error, const char *what) {
+	if (error != cudaSuccess)
+		throw std::runtime_error(std::string("LensDevice: ") + what + ": " + cudaGetErrorString(error));
+}
+
+void check(cusparseStatus_t status, const char *what) {
+	if (status != CUSPARSE_STATUS_SUCCESS)
+		throw std::runtime_error(std::string("LensDevice: ") + what + ": " + cusparseGetErrorString(status));
+}
+
+// copy of a host array to new device memory
+template<typename T>
+T *toDevice(const T *data, size_t n) {
+	T *d = NULL;
+	check(cudaMalloc((void**) &d, n * sizeof(T)), "cudaMalloc");
+	check(cudaMemcpy(d, data, n * sizeof(T), cudaMemcpyHostToDevice), "cudaMemcpy");
+	return d;
+}
+}
+
+// The column compressed matrix M is the row compressed matrix M^T, the
+// products are computed with the transposed operation.
+struct LensDevice::Matrix {
+	int *outer, *inner;
+	void *values;
+	cusparseSpMatDescr_t descr;
+	cudaDataType type;
+	size_t size, memory;
+};
+
+LensDevice::LensDevice(int device) : _handle(NULL), _device(device), _x(NULL),
+		_y(NULL), _buffer(NULL), _xSize(0), _ySize(0), _bufferSize(0), _memoryUsed(0) {
+	check(cudaSetDevice(_device), "cudaSetDevice");
+	cusparseHandle_t handle;
+	check(cusparseCreate(&handle), "cusparseCreate");
+	_handle = handle;
+}
+
+LensDevice::~LensDevice() {
+	cudaSetDevice(_device);
+	release();
+	cudaFree(_x);
+	cudaFree(_y);
+	cudaFree(_buffer);
+	cusparseDestroy((cusparseHandle_t) _handle);
+}
+
+template<typename T>
+static void uploadMatrix(const Eigen::SparseMatrix<T> &source, int *&outer,
+		int *&inner, void *&values, size_t &memory) {
+	Eigen::SparseMatrix<T> compressed;
+	const Eigen::SparseMatrix<T> *M = &source;
+	if (!source.isCompressed()) {
+		compressed = source;
+		compressed.makeCompressed();
+		M = &compressed;
+	}
+	outer = toDevice(M->outerIndexPtr(), M->outerSize() + 1);
+	inner = toDevice(M->innerIndexPtr(), M->nonZeros());
+	values = toDevice(M->valuePtr(), M->nonZeros());
+	memory = (M->outerSize() + 1) * sizeof(int) + M->nonZeros() * (sizeof(int) + sizeof(T));
+}
+
+LensDevice::Matrix *LensDevice::upload(LensPart *part) {
+	std::map<const LensPart*, Matrix*>::iterator it = _matrices.find(part);
+	if (it != _matrices.end())
+		return it->second;
+
+	Matrix *m = new Matrix();
+	int64_t rows, cols, nonZeros;
+	if (part->isSinglePrecision()) {
+		const ModelMatrixFloatType &M = *part->getMatrixFloatPointer();
+		uploadMatrix(M, m->outer, m->inner, m->values, m->memory);
+		m->type = CUDA_R_32F;
+		rows = M.rows();
+		cols = M.cols();
+		nonZeros = M.nonZeros();
+	} else {
+		const ModelMatrixType &M = *part->getMatrixPointer();
+		uploadMatrix(M, m->outer, m->inner, m->values, m->memory);
+		m->type = CUDA_R_64F;
+		rows = M.rows();
+		cols = M.cols();
+		nonZeros = M.nonZeros();
+	}
+	m->size = rows;
+	check(cusparseCreateCsr(&m->descr, cols, rows, nonZeros, m->outer, m->inner,
+			m->values, CUSPARSE_INDEX_32I, CUSPARSE_INDEX_32I,
+			CUSPARSE_INDEX_BASE_ZERO, m->type), "cusparseCreateCsr");
+
+	_matrices[part] = m;
+	_memoryUsed += m->memory;
+	return m;
+}
+
+void LensDevice::reserve(void *&buffer, size_t &size, size_t bytes) {
+	if (bytes <= size)
+		return;
+	cudaFree(buffer);
+	buffer = NULL;
+	size = 0;
+	check(cudaMalloc(&buffer, bytes), "cudaMalloc");
+	size = bytes;
+}
+
+template<typename T>
+static void packModels(double **models, size_t count, size_t n, std::vector<T> &block) {
+	block.resize(n * count);
+	for (size_t k = 0; k < count; k++)
+		for (size_t j = 0; j < n; j++)
+			block[k * n + j] = models[k][j];
+}
+
+template<typename T>
+static void unpackModels(const std::vector<T> &block, size_t count, size_t n, double **models) {
+	for (size_t k = 0; k < count; k++)
+		for (size_t j = 0; j < n; j++)
+			models[k][j] = block[k * n + j];
+}
+
+void LensDevice::transform(LensPart *part, double **models, size_t count) {
+	if (count == 0)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	check(cudaSetDevice(_device), "cudaSetDevice");
+	Matrix *m = upload(part);
+	const size_t n = m->size;
+	const bool single = (m->type == CUDA_R_32F);
+	const size_t bytes = n * count * (single ? sizeof(float) : sizeof(double));
+
+	// the models as columns of a dense block
+	std::vector<float> blockFloat;
+	std::vector<double> blockDouble;
+	void *host;
+	if (single) {
+		packModels(models, count, n, blockFloat);
+		host = &blockFloat[0];
+	} else {
+		packModels(models, count, n, blockDouble);
+		host = &blockDouble[0];
+	}
+	reserve(_x, _xSize, bytes);
+	reserve(_y, _ySize, bytes);
+	check(cudaMemcpy(_x, host, bytes, cudaMemcpyHostToDevice), "cudaMemcpy");
+
+	cusparseHandle_t handle = (cusparseHandle_t) _handle;
+	cusparseDnMatDescr_t x, y;
+	check(cusparseCreateDnMat(&x, n, count, n, _x, m->type, CUSPARSE_ORDER_COL), "cusparseCreateDnMat");
+	check(cusparseCreateDnMat(&y, n, count, n, _y, m->type, CUSPARSE_ORDER_COL), "cusparseCreateDnMat");
+
+	float alphaFloat = 1, betaFloat = 0;
+	double alphaDouble = 1, betaDouble = 0;
+	const void *alpha = single ? (const void*) &alphaFloat : (const void*) &alphaDouble;
+	const void *beta = single ? (const void*) &betaFloat : (const void*) &betaDouble;
+
+	size_t bufferSize = 0;
+	check(cusparseSpMM_bufferSize(handle, CUSPARSE_OPERATION_TRANSPOSE,
+			CUSPARSE_OPERATION_NON_TRANSPOSE, alpha, m->descr, x, beta, y,
+			m->type, CUSPARSE_SPMM_ALG_DEFAULT, &bufferSize), "cusparseSpMM_bufferSize");
+	reserve(_buffer, _bufferSize, bufferSize);
+	check(cusparseSpMM(handle, CUSPARSE_OPERATION_TRANSPOSE,
+			CUSPARSE_OPERATION_NON_TRANSPOSE, alpha, m->descr, x, beta, y,
+			m->type, CUSPARSE_SPMM_ALG_DEFAULT, _buffer), "cusparseSpMM");
+	cusparseDestroyDnMat(x);
+	cusparseDestroyDnMat(y);
+
+	check(cudaMemcpy(host, _y, bytes, cudaMemcpyDeviceToHost), "cudaMemcpy");
+	if (single)
+		unpackModels(blockFloat, count, n, models);
+	else
+		unpackModels(blockDouble, count, n, models);
+}
+
+void LensDevice::release(const LensPart *part) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<const LensPart*, Matrix*>::iterator it = _matrices.find(part);
+	if (it == _matrices.end())
+		return;
+	Matrix *m = it->second;
+	cusparseDestroySpMat(m->descr);
+	cudaFree(m->outer);
+	cudaFree(m->inner);
+	cudaFree(m->values);
+	_memoryUsed -= m->memory;
+	delete m;
+	_matrices.erase(it);
+}
+
+void LensDevice::release() {
+	while (!_matrices.empty())
+		release(_matrices.begin()->first);
+}
+
+size_t LensDevice::getMemoryUsed() const {
+	return _memoryUsed;
+}
+
+int LensDevice::getDeviceCount() {
+	int count = 0;
+	if (cudaGetDeviceCount(&count) != cudaSuccess)
+		return 0;
+	return count;
+}
+
+} // namespace crpropa
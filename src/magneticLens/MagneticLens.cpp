@@ -21,16 +21,274 @@
 //----------------------------------------------------------------------
 
 #include "crpropa/magneticLens/MagneticLens.h"
+#ifdef WITH_LENS_CUDA
+#include "crpropa/magneticLens/LensDevice.h"
+#endif
 
+#include "crpropa/Numa.h"
 #include "crpropa/Random.h"
 #include "crpropa/Units.h"
 
 // needed for memcpy in gcc 4.3.2
 #include <cstring>
+#include <mutex>
 
 namespace crpropa 
 {
 
+namespace
+{
+// guards the matrix pointers of all lens parts and the caches
+std::mutex matrixMutex;
+
+template<class Matrix>
+size_t matrixMemory(const Matrix &M)
+{
+	return M.nonZeros() * (sizeof(typename Matrix::Scalar) + sizeof(typename Matrix::StorageIndex))
+			+ (M.cols() + 1) * sizeof(typename Matrix::StorageIndex);
+}
+
+// interleave the values and row indices over the NUMA nodes, if enabled
+template<class Matrix>
+void placeMatrix(const Matrix &M)
+{
+	Numa::place(M.valuePtr(), M.nonZeros() * sizeof(typename Matrix::Scalar));
+	Numa::place(M.innerIndexPtr(), M.nonZeros() * sizeof(typename Matrix::StorageIndex));
+}
+
+// draws the row in column c, returns false if the cosmic ray is lost
+template<class Matrix>
+bool drawRow(const Matrix &M, uint32_t c, double rn, uint32_t &row)
+{
+	double cpv = 0;
+	for (typename Matrix::InnerIterator i(M, c); i; ++i)
+	{
+		cpv += i.value();
+		if (rn < cpv)
+		{
+			row = i.index();
+			return true;
+		}
+	}
+	return false;
+}
+}
+
+size_t LensPart::memory() const
+{
+	if (M)
+		return matrixMemory(*M);
+	if (F)
+		return matrixMemory(*F);
+	return 0;
+}
+
+void LensPart::release()
+{
+	if (_cache)
+		_cache->memoryUsed -= memory();
+	M.reset();
+	F.reset();
+	_memory.set(0);
+}
+
+void LensPart::store(std::shared_ptr<ModelMatrixType> m)
+{
+	release();
+	if (_singlePrecision)
+	{
+		F = std::make_shared<ModelMatrixFloatType>(m->cast<float>());
+		placeMatrix(*F);
+	}
+	else
+	{
+		M = m;
+		placeMatrix(*M);
+	}
+	_memory.set(memory());
+	if (_cache)
+	{
+		_lastUse = ++_cache->clock;
+		_cache->memoryUsed += memory();
+	}
+}
+
+void LensPart::loadMatrixFromFile()
+{
+	std::shared_ptr<ModelMatrixType> m = std::make_shared<ModelMatrixType>();
+	deserialize(_filename, *m);
+	if (_pruningThreshold > 0)
+		pruneMatrix(*m, _pruningThreshold);
+	if (_columnsNormalized)
+		normalizeColumns(*m);
+	if (_scale != 1)
+		crpropa::normalizeMatrix(*m, 1. / _scale);
+
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	store(m);
+	if (_cache)
+		evict(_cache, this);
+}
+
+bool LensPart::isLoaded() const
+{
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	return M || F;
+}
+
+void LensPart::unloadMatrix()
+{
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	if (_fromFile)
+		release();
+}
+
+void LensPart::evict(LensPartCache *cache, const LensPart *keep)
+{
+	// called with matrixMutex held
+	while (cache->memoryLimit > 0 && cache->memoryUsed > cache->memoryLimit)
+	{
+		LensPart *oldest = NULL;
+		for (size_t i = 0; i < cache->parts.size(); i++)
+		{
+			LensPart *p = cache->parts[i];
+			if (p == keep || !(p->M || p->F))
+				continue;
+			if (!oldest || p->_lastUse < oldest->_lastUse)
+				oldest = p;
+		}
+		if (!oldest)
+			break;
+		oldest->release();
+	}
+}
+
+void LensPart::ensureLoaded()
+{
+	{
+		std::lock_guard<std::mutex> lock(matrixMutex);
+		if (M || F)
+		{
+			if (_cache)
+				_lastUse = ++_cache->clock;
+			return;
+		}
+		if (!_fromFile)
+		{
+			store(std::make_shared<ModelMatrixType>());
+			return;
+		}
+	}
+
+	// one thread loads the part, the others wait for it
+	#pragma omp critical(LensPart)
+	{
+		if (!isLoaded())
+			loadMatrixFromFile();
+	}
+}
+
+std::shared_ptr<ModelMatrixType> LensPart::getMatrixPointer()
+{
+	ensureLoaded();
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	if (F)
+		throw std::runtime_error("LensPart: matrix in single precision, use getMatrixFloat");
+	if (!M) // released again by another thread
+		throw std::runtime_error("LensPart: memory limit too small for " + _filename);
+	return M;
+}
+
+ModelMatrixType LensPart::getMatrix()
+{
+	return *getMatrixPointer();
+}
+
+std::shared_ptr<ModelMatrixFloatType> LensPart::getMatrixFloatPointer()
+{
+	ensureLoaded();
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	if (M)
+		throw std::runtime_error("LensPart: matrix in double precision, use getMatrix");
+	if (!F) // released again by another thread
+		throw std::runtime_error("LensPart: memory limit too small for " + _filename);
+	return F;
+}
+
+ModelMatrixFloatType LensPart::getMatrixFloat()
+{
+	return *getMatrixFloatPointer();
+}
+
+void LensPart::setMatrix(const ModelMatrixType& m)
+{
+	std::shared_ptr<ModelMatrixType> mp = std::make_shared<ModelMatrixType>(m);
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	_fromFile = false;
+	_scale = 1;
+	_columnsNormalized = false;
+	_maximumSumOfColumns_calculated = false;
+	store(mp);
+}
+
+void LensPart::setSinglePrecision(bool single)
+{
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	_singlePrecision = single;
+	// convert a loaded matrix
+	if (F && !single)
+		store(std::make_shared<ModelMatrixType>(F->cast<double>()));
+	else if (M && single)
+		store(M);
+}
+
+bool LensPart::isSinglePrecision() const
+{
+	return _singlePrecision;
+}
+
+void LensPart::setPruningThreshold(double threshold)
+{
+	_pruningThreshold = threshold;
+}
+
+double LensPart::getPruningThreshold() const
+{
+	return _pruningThreshold;
+}
+
+double LensPart::getMaximumOfSumsOfColumns()
+{
+	if (!_maximumSumOfColumns_calculated)
+	{ // lazy calculation of maximum
+		if (_singlePrecision)
+			_maximumSumOfColumns = maximumOfSumsOfColumns(*getMatrixFloatPointer());
+		else
+			_maximumSumOfColumns = maximumOfSumsOfColumns(*getMatrixPointer());
+		_maximumSumOfColumns_calculated = true;
+	}
+	return _maximumSumOfColumns;
+}
+
+void LensPart::normalizeMatrix(double norm)
+{
+	if (_singlePrecision)
+		crpropa::normalizeMatrix(*getMatrixFloatPointer(), norm);
+	else
+		crpropa::normalizeMatrix(*getMatrixPointer(), norm);
+	_scale /= norm;
+}
+
+void LensPart::normalizeMatrixColumns()
+{
+	if (_singlePrecision)
+		normalizeColumns(*getMatrixFloatPointer());
+	else
+		normalizeColumns(*getMatrixPointer());
+	_columnsNormalized = true;
+	_scale = 1;
+}
+
 void MagneticLens::loadLens(const string &filename)
 {
 	ifstream infile(filename.c_str());
@@ -85,29 +343,19 @@ bool MagneticLens::transformCosmicRay(double rigidity, double& phi,
 		return false;
 	}
 
-	ModelVectorType v = lenspart->getMatrix().col(c);
-
-	uint32_t r;
-
 	// the random number to compare with
 	double rn = Random::instance().rand();
 
-	ModelVectorType::InnerIterator i(v);
-  double cpv = 0;
-  while (i)
-  {
-		cpv += i.value();
-		if (rn < cpv)
-		{
-			_pixelization->pix2Direction(i.index(), phi, theta);
-			return true;
-    }
-    else
-    {
-			++i;
-    }
-   }
-  return false;
+	uint32_t r;
+	bool found;
+	if (lenspart->isSinglePrecision())
+		found = drawRow(*lenspart->getMatrixFloatPointer(), c, rn, r);
+	else
+		found = drawRow(*lenspart->getMatrixPointer(), c, rn, r);
+	if (!found)
+		return false;
+	_pixelization->pix2Direction(r, phi, theta);
+	return true;
 }
 
 bool MagneticLens::transformCosmicRay(double rigidity, Vector3d &p){
@@ -126,35 +374,65 @@ bool MagneticLens::transformCosmicRay(double rigidity, Vector3d &p){
 void MagneticLens::loadLensPart(const string &filename, double rigidityMin,
 		double rigidityMax)
 {
+	// skip parts outside of the rigidities in use
+	if (rigidityMax <= _rangeMin || rigidityMin >= _rangeMax)
+		return;
 	updateRigidityBounds(rigidityMin, rigidityMax);
 
 	LensPart *p = new LensPart(filename, rigidityMin, rigidityMax);
-	p->loadMatrixFromFile();
-	_checkMatrix(p->getMatrix());
-
+	p->_cache = &_cache;
+	p->setSinglePrecision(_singlePrecision);
+	p->setPruningThreshold(_pruningThreshold);
+	{
+		std::lock_guard<std::mutex> lock(matrixMutex);
+		_cache.parts.push_back(p);
+	}
 	_lensParts.push_back(p);
+
+	if (_lazyLoading)
+	{
+		size_t rows, cols;
+		readMatrixSize(filename, rows, cols);
+		_checkMatrix(rows, cols);
+	}
+	else
+	{
+		p->loadMatrixFromFile();
+		if (_singlePrecision)
+		{
+			std::shared_ptr<ModelMatrixFloatType> F = p->getMatrixFloatPointer();
+			_checkMatrix(F->rows(), F->cols());
+		}
+		else
+			_checkMatrix(*p->getMatrixPointer());
+	}
 }
 
 void MagneticLens::_checkMatrix(const ModelMatrixType &M)
 {
-	if (M.rows() != M.cols())
+	_checkMatrix(M.rows(), M.cols());
+}
+
+void MagneticLens::_checkMatrix(size_t rows, size_t cols)
+{
+	if (rows != cols)
 	{
 		throw std::runtime_error("Not a square Matrix!");
 	}
 
 	if (_pixelization)
 	{
-		if (_pixelization->nPix() != M.cols())
+		if (_pixelization->nPix() != cols)
 		{
 			std::cerr << "*** ERROR ***" << endl;
 			std::cerr << "  Pixelization: " << _pixelization->nPix() << endl;
-			std::cerr << "  Matrix Size : " << M.cols() << endl;
+			std::cerr << "  Matrix Size : " << cols << endl;
 			throw std::runtime_error("Matrix doesn't fit into Lense");
 		}
 	}
 	else
 	{
-		uint32_t morder = Pixelization::pix2Order(M.cols());
+		uint32_t morder = Pixelization::pix2Order(cols);
 		if (morder == 0)
 		{
 			throw std::runtime_error(
@@ -175,12 +453,101 @@ void MagneticLens::updateRigidityBounds(double rigidityMin, double rigidityMax)
 		_minimumRigidity = rigidityMin;
 	}
 
-	if (_maximumRigidity < rigidityMin)
+	if (_maximumRigidity < rigidityMax)
 	{
 		_maximumRigidity = rigidityMax;
 	}
 }
 
+void MagneticLens::setLazyLoading(bool lazy)
+{
+	_lazyLoading = lazy;
+}
+
+bool MagneticLens::getLazyLoading() const
+{
+	return _lazyLoading;
+}
+
+void MagneticLens::setMemoryLimit(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	_cache.memoryLimit = bytes;
+	LensPart::evict(&_cache, NULL);
+}
+
+size_t MagneticLens::getMemoryLimit() const
+{
+	return _cache.memoryLimit;
+}
+
+size_t MagneticLens::getMemoryUsed() const
+{
+	std::lock_guard<std::mutex> lock(matrixMutex);
+	return _cache.memoryUsed;
+}
+
+void MagneticLens::setSinglePrecision(bool single)
+{
+	_singlePrecision = single;
+}
+
+bool MagneticLens::getSinglePrecision() const
+{
+	return _singlePrecision;
+}
+
+void MagneticLens::setPruningThreshold(double threshold)
+{
+	_pruningThreshold = threshold;
+}
+
+double MagneticLens::getPruningThreshold() const
+{
+	return _pruningThreshold;
+}
+
+void MagneticLens::setDeviceEnabled(bool enabled, int device)
+{
+#ifdef WITH_LENS_CUDA
+	delete _device;
+	_device = NULL;
+	if (enabled)
+		_device = new LensDevice(device);
+#else
+	if (enabled)
+		throw std::runtime_error("MagneticLens: CRPropa was built without ENABLE_LENS_CUDA");
+#endif
+}
+
+bool MagneticLens::getDeviceEnabled() const
+{
+	return _device != NULL;
+}
+
+size_t MagneticLens::getDeviceMemoryUsed() const
+{
+#ifdef WITH_LENS_CUDA
+	if (_device)
+		return _device->getMemoryUsed();
+#endif
+	return 0;
+}
+
+void MagneticLens::updateDevice()
+{
+#ifdef WITH_LENS_CUDA
+	if (_device)
+		_device->release();
+#endif
+}
+
+void MagneticLens::setRigidityRange(double rigidityMin, double rigidityMax)
+{
+	_rangeMin = rigidityMin;
+	_rangeMax = rigidityMax;
+}
+
 void MagneticLens::setLensPart(const ModelMatrixType &M, double rigidityMin,
 		double rigidityMax)
 {
@@ -189,7 +556,7 @@ void MagneticLens::setLensPart(const ModelMatrixType &M, double rigidityMin,
 
 	p->setMatrix(M);
 
-	_checkMatrix(p->getMatrix());
+	_checkMatrix(*p->getMatrixPointer());
 	_lensParts.push_back(p);
 }
 
@@ -222,8 +589,9 @@ void MagneticLens::normalizeMatrixColumns()
 	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
 			++iter)
 	{
-		normalizeColumns((*iter)->getMatrix());
+		(*iter)->normalizeMatrixColumns();
 	}
+	updateDevice();
 }
 
 
@@ -242,9 +610,10 @@ void MagneticLens::normalizeLens()
 	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
 			++iter)
 	{
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalizeMatrix(norm);
 	}
   _norm = norm;
+	updateDevice();
 }
 
 void MagneticLens::normalizeLensparts()
@@ -253,8 +622,9 @@ void MagneticLens::normalizeLensparts()
 			++iter)
 	{
 		double norm = (*iter)->getMaximumOfSumsOfColumns();
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalizeMatrix(norm);
 	}
+	updateDevice();
 }
 
 void MagneticLens::transformModelVector(double* model, double rigidity) const
@@ -267,8 +637,41 @@ void MagneticLens::transformModelVector(double* model, double rigidity) const
 		return;
 	}
 
-	prod_up(lenspart->getMatrix(), model);
+#ifdef WITH_LENS_CUDA
+	if (_device)
+	{
+		_device->transform(lenspart, &model, 1);
+		return;
+	}
+#endif
+	if (lenspart->isSinglePrecision())
+		prod_up(*lenspart->getMatrixFloatPointer(), model);
+	else
+		prod_up(*lenspart->getMatrixPointer(), model);
+
+}
 
+void MagneticLens::transformModelVectors(double** models, size_t count, double rigidity) const
+{
+	LensPart* lenspart = getLensPart(rigidity);
+
+	if (!lenspart)
+	{
+		std::cerr << "Warning. Trying to transform vectors with rigidity " << rigidity / eV << "eV which is not covered by this lens!.\n" << std::endl;
+		return;
+	}
+
+#ifdef WITH_LENS_CUDA
+	if (_device)
+	{
+		_device->transform(lenspart, models, count);
+		return;
+	}
+#endif
+	if (lenspart->isSinglePrecision())
+		prod_up(*lenspart->getMatrixFloatPointer(), models, count);
+	else
+		prod_up(*lenspart->getMatrixPointer(), models, count);
 }
 
 
@@ -21,9 +21,16 @@
 //----------------------------------------------------------------------
 
 #include "crpropa/magneticLens/ModelMatrix.h"
+#include <algorithm>
+#include <cstring>
 #include <ctime>
 
 #include <Eigen/Core>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa 
 {
 
@@ -70,37 +77,201 @@ void serialize(const string &filename, const ModelMatrixType& matrix)
 }
 
 
-void deserialize(const string &filename, ModelMatrixType& matrix)
+namespace
 {
-	ifstream infile(filename.c_str(), ios::binary);
-	if (!infile)
-	{
-		throw runtime_error("Can't read file: " + filename);
-	}
+const char compressedMagic[8] = {'C', 'R', 'P', 'L', 'E', 'N', 'S', 'C'};
 
+struct CompressedHeader
+{
+	char magic[8];
+	uint64_t rows, columns, nonZeros;
+};
+
+// bytes of the column starts and rows, padded for the alignment of the values
+size_t indexBytes(uint64_t columns, uint64_t nonZeros)
+{
+	size_t n = (columns + 1 + nonZeros) * sizeof(ModelMatrixType::StorageIndex);
+	return (n + 7) / 8 * 8;
+}
+
+void readLegacy(ifstream &infile, const string &filename, ModelMatrixType& matrix)
+{
 	uint32_t nnz, nRows, nColumns;
 	infile.read((char*) &nnz, sizeof(uint32_t));
 	infile.read((char*) &nRows, sizeof(uint32_t));
 	infile.read((char*) &nColumns, sizeof(uint32_t));
 	matrix.resize(nRows, nColumns);
-	matrix.reserve(nnz);
 
-	uint32_t row, column;
-	double val;
+	// (row, column, value) records are read in blocks
+	const size_t recordSize = 2 * sizeof(uint32_t) + sizeof(double);
+	const size_t blockSize = 1 << 16;
+	std::vector<char> buffer(blockSize * recordSize);
 	std::vector< Eigen::Triplet<double> > triplets;
-	triplets.resize(nnz);
-	for (size_t i = 0; i < nnz; i++)
+	triplets.reserve(nnz);
+	for (size_t i = 0; i < nnz; i += blockSize)
 	{
-		infile.read((char*) &row, sizeof(uint32_t));
-		infile.read((char*) &column, sizeof(uint32_t));
-		infile.read((char*) &val, sizeof(double));
-		//M(size1,size2) = val;
-		triplets[i] = Eigen::Triplet<double>(row, column, val);
+		size_t n = std::min(blockSize, nnz - i);
+		infile.read(&buffer[0], n * recordSize);
+		if (!infile)
+			throw runtime_error("Error reading file: " + filename);
+		for (size_t j = 0; j < n; j++)
+		{
+			const char *record = &buffer[j * recordSize];
+			uint32_t row, column;
+			double val;
+			memcpy(&row, record, sizeof(uint32_t));
+			memcpy(&column, record + sizeof(uint32_t), sizeof(uint32_t));
+			memcpy(&val, record + 2 * sizeof(uint32_t), sizeof(double));
+			triplets.push_back(Eigen::Triplet<double>(row, column, val));
+		}
 	}
 	matrix.setFromTriplets(triplets.begin(), triplets.end());
 	matrix.makeCompressed();
 }
 
+void readCompressed(ifstream &infile, const string &filename, ModelMatrixType& matrix)
+{
+	CompressedHeader header;
+	infile.read((char*) &header, sizeof(header));
+	matrix.resize(header.rows, header.columns);
+	matrix.resizeNonZeros(header.nonZeros);
+
+	typedef ModelMatrixType::StorageIndex Index;
+	size_t padding = indexBytes(header.columns, header.nonZeros)
+			- (header.columns + 1 + header.nonZeros) * sizeof(Index);
+	char pad[8];
+	infile.read((char*) matrix.outerIndexPtr(), (header.columns + 1) * sizeof(Index));
+	infile.read((char*) matrix.innerIndexPtr(), header.nonZeros * sizeof(Index));
+	infile.read(pad, padding);
+	infile.read((char*) matrix.valuePtr(), header.nonZeros * sizeof(double));
+	if (!infile)
+		throw runtime_error("Error reading file: " + filename);
+}
+} // namespace
+
+
+void serializeCompressed(const string &filename, const ModelMatrixType &matrix)
+{
+	ofstream outfile(filename.c_str(), ios::binary);
+	if (!outfile)
+	{
+		throw runtime_error("Can't write file: " + filename);
+	}
+
+	ModelMatrixType m = matrix;
+	m.makeCompressed();
+
+	CompressedHeader header;
+	memcpy(header.magic, compressedMagic, sizeof(compressedMagic));
+	header.rows = m.rows();
+	header.columns = m.cols();
+	header.nonZeros = m.nonZeros();
+
+	typedef ModelMatrixType::StorageIndex Index;
+	size_t padding = indexBytes(header.columns, header.nonZeros)
+			- (header.columns + 1 + header.nonZeros) * sizeof(Index);
+	const char pad[8] = {0};
+	outfile.write((const char*) &header, sizeof(header));
+	outfile.write((const char*) m.outerIndexPtr(), (header.columns + 1) * sizeof(Index));
+	outfile.write((const char*) m.innerIndexPtr(), header.nonZeros * sizeof(Index));
+	outfile.write(pad, padding);
+	outfile.write((const char*) m.valuePtr(), header.nonZeros * sizeof(double));
+	if (outfile.fail())
+	{
+		throw runtime_error("Error writing file: " + filename);
+	}
+}
+
+
+void deserialize(const string &filename, ModelMatrixType& matrix)
+{
+	ifstream infile(filename.c_str(), ios::binary);
+	if (!infile)
+	{
+		throw runtime_error("Can't read file: " + filename);
+	}
+
+	char magic[8];
+	infile.read(magic, sizeof(magic));
+	bool compressed = infile && (memcmp(magic, compressedMagic, sizeof(magic)) == 0);
+	infile.clear();
+	infile.seekg(0);
+	if (compressed)
+		readCompressed(infile, filename, matrix);
+	else
+		readLegacy(infile, filename, matrix);
+}
+
+
+void readMatrixSize(const string &filename, size_t &rows, size_t &columns)
+{
+	ifstream infile(filename.c_str(), ios::binary);
+	if (!infile)
+	{
+		throw runtime_error("Can't read file: " + filename);
+	}
+
+	CompressedHeader header;
+	infile.read((char*) &header, sizeof(header));
+	if (infile && memcmp(header.magic, compressedMagic, sizeof(compressedMagic)) == 0)
+	{
+		rows = header.rows;
+		columns = header.columns;
+		return;
+	}
+
+	uint32_t size[3]; // non zero elements, rows, columns
+	infile.clear();
+	infile.seekg(0);
+	infile.read((char*) size, sizeof(size));
+	if (!infile)
+		throw runtime_error("Error reading file: " + filename);
+	rows = size[1];
+	columns = size[2];
+}
+
+
+void convertToCompressed(const string &filename, const string &compressedFilename)
+{
+	ModelMatrixType matrix;
+	deserialize(filename, matrix);
+	serializeCompressed(compressedFilename, matrix);
+}
+
+
+MappedModelMatrix::MappedModelMatrix(const string &filename) : matrix(0)
+{
+	file = new MappedFile(filename);
+	const char *data = (const char*) file->data();
+	CompressedHeader header;
+	if (file->size() < sizeof(header))
+		throw runtime_error("MappedModelMatrix: not a compressed matrix file: " + filename);
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, compressedMagic, sizeof(compressedMagic)) != 0)
+		throw runtime_error("MappedModelMatrix: not a compressed matrix file: " + filename);
+	if (file->size() != sizeof(header) + indexBytes(header.columns, header.nonZeros)
+			+ header.nonZeros * sizeof(double))
+		throw runtime_error("MappedModelMatrix: wrong file size: " + filename);
+
+	typedef ModelMatrixType::StorageIndex Index;
+	const Index *outer = (const Index*) (data + sizeof(header));
+	const Index *inner = outer + header.columns + 1;
+	const double *values = (const double*) (data + sizeof(header)
+			+ indexBytes(header.columns, header.nonZeros));
+	matrix = new MappedModelMatrixType(header.rows, header.columns,
+			header.nonZeros, outer, inner, values);
+}
+
+MappedModelMatrix::~MappedModelMatrix()
+{
+	delete matrix;
+}
+
+const MappedModelMatrixType &MappedModelMatrix::getMatrix() const
+{
+	return *matrix;
+}
+
 
 double norm_1(const ModelVectorType &v)
 {
@@ -118,7 +289,48 @@ void normalizeColumns(ModelMatrixType &matrix){
 }
 
 
+void normalizeColumns(ModelMatrixFloatType &matrix){
+	for (size_t i=0; i< matrix.cols(); i++)
+	{
+		Eigen::SparseVector<float> v = matrix.col(i);
+		float rn = v.cwiseAbs().sum();
+		matrix.col(i) = v/rn;
+	}
+}
+
+
+void pruneMatrix(ModelMatrixType &matrix, double threshold)
+{
+	std::vector<double> sums(matrix.cols());
+	for (size_t i = 0; i < matrix.cols(); i++)
+		sums[i] = matrix.col(i).sum();
+
+	matrix.prune([threshold](ModelMatrixType::Index, ModelMatrixType::Index, double value) {
+		return fabs(value) >= threshold;
+	});
+	matrix.makeCompressed();
+
+	// empty columns stay empty
+	normalizeColumns(matrix);
+	for (size_t i = 0; i < matrix.cols(); i++)
+		for (ModelMatrixType::InnerIterator it(matrix, i); it; ++it)
+			it.valueRef() *= sums[i];
+}
+
+
 double maximumOfSumsOfColumns(const ModelMatrixType &matrix) 
+{
+	double summax = 0;
+	for (size_t i = 0; i < matrix.cols(); i++)
+	{
+		double sum = matrix.col(i).sum();
+		if (sum > summax)
+			summax = sum;
+	}
+	return summax;
+}
+
+double maximumOfSumsOfColumns(const ModelMatrixFloatType &matrix) 
 {
 	double summax = 0;
 	for (size_t i = 0; i < matrix.cols(); i++)
@@ -135,27 +347,126 @@ double maximumOfSumsOfColumns(const ModelMatrixType &matrix)
 	matrix /= norm;
 }
 
-	void prod_up(const ModelMatrixType& matrix, double* model)
+void normalizeMatrix(ModelMatrixFloatType& matrix, double norm)
+{
+	matrix /= norm;
+}
+
+template<class Matrix>
+void prodUp(const Matrix& matrix, double* model, std::vector<double> &workspace)
+{
+	// the columns are split among the threads, each sums its products into
+	// its own part of the workspace, the parts are then added up in place
+	const long nRows = matrix.rows();
+	const long nCols = matrix.cols();
+	int nThreads = 1;
+#ifdef _OPENMP
+	if (!omp_in_parallel())
+		nThreads = omp_get_max_threads();
+#endif
+	workspace.assign(nRows * nThreads, 0.);
+
+#pragma omp parallel num_threads(nThreads) if(nThreads > 1)
+	{
+		int thread = 0;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		double *result = &workspace[nRows * thread];
+#pragma omp for schedule(static)
+		for (long col = 0; col < nCols; ++col)
+		{
+			double x = model[col];
+			if (x == 0)
+				continue;
+			for (typename Matrix::InnerIterator it(matrix, col); it; ++it)
+				result[it.row()] += it.value() * x;
+		}
+#pragma omp for schedule(static)
+		for (long row = 0; row < nRows; ++row)
+		{
+			double sum = 0;
+			for (int t = 0; t < nThreads; t++)
+				sum += workspace[nRows * t + row];
+			model[row] = sum;
+		}
+	}
+}
+
+// workspace of prod_up reused by the calls of a thread
+static std::vector<double> &prodWorkspace()
+{
+	static thread_local std::vector<double> workspace;
+	return workspace;
+}
+
+
+template<class Matrix>
+void prodUpMany(const Matrix& matrix, double** models, size_t count)
 {
+	// the models are rows of a dense matrix, so that every element of the
+	// lens matrix is applied to all models at once; the threads handle
+	// blocks of models
+	static thread_local std::vector<double> input, output;
+	const size_t nRows = matrix.rows();
+	const size_t nCols = matrix.cols();
+	input.resize(nCols * count);
+	output.assign(nRows * count, 0.);
+	for (size_t m = 0; m < count; m++)
+		for (size_t i = 0; i < nCols; i++)
+			input[i * count + m] = models[m][i];
+
+	const long blockSize = 8;
+	const long nBlocks = (count + blockSize - 1) / blockSize;
+	double *x = &input[0];
+	double *y = &output[0];
+#pragma omp parallel for schedule(dynamic) if(nBlocks > 1)
+	for (long b = 0; b < nBlocks; b++)
+	{
+		size_t first = b * blockSize;
+		size_t last = std::min(count, size_t(first + blockSize));
+		for (size_t col = 0; col < nCols; ++col)
+		{
+			const double *xc = x + col * count;
+			for (typename Matrix::InnerIterator it(matrix, col); it; ++it)
+			{
+				double v = it.value();
+				double *yr = y + it.row() * count;
+				for (size_t m = first; m < last; m++)
+					yr[m] += v * xc[m];
+			}
+		}
+	}
 
-	// copy storage of model, as matrix vector product cannot be done
-	// in place
-	
-	const size_t mSize = matrix.cols();
-	double *origVectorStorage = new double[mSize];
-	memcpy(origVectorStorage, model, mSize * sizeof(double));
+	for (size_t m = 0; m < count; m++)
+		for (size_t i = 0; i < nRows; i++)
+			models[m][i] = output[i * count + m];
+}
 
 
+void prod_up(const ModelMatrixType& matrix, double* model)
+{
+	prodUp(matrix, model, prodWorkspace());
+}
 
-	Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 1> > origVectorAdaptor(origVectorStorage, mSize);
-	Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 1> > modelVectorAdaptor(model, mSize);
+void prod_up(const ModelMatrixType& matrix, double** models, size_t count)
+{
+	prodUpMany(matrix, models, count);
+}
 
-	// perform the optimized product
-	modelVectorAdaptor = matrix * origVectorAdaptor;
+void prod_up(const ModelMatrixFloatType& matrix, double** models, size_t count)
+{
+	prodUpMany(matrix, models, count);
+}
 
-	// clean up
-	delete[] origVectorStorage;
+void prod_up(const MappedModelMatrixType& matrix, double* model)
+{
+	prodUp(matrix, model, prodWorkspace());
 }
 
+void prod_up(const ModelMatrixFloatType& matrix, double* model)
+{
+	prodUp(matrix, model, prodWorkspace());
+}
 
 } // namespace parsec
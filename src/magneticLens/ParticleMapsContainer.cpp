@@ -3,19 +3,20 @@
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
 
 namespace crpropa  {
 
+namespace {
+const size_t mapsPerBlock = 16;
+}
+
 ParticleMapsContainer::~ParticleMapsContainer() {
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-			delete[] (energy_iter->second);
-		}
-	}
+	for (size_t i = 0; i < _blocks.size(); i++)
+		delete[] _blocks[i];
 }
 
 int ParticleMapsContainer::energy2Idx(double energy) const {
@@ -27,37 +28,77 @@ double ParticleMapsContainer::idx2Energy(int idx) const {
 	return pow(10, idx * _deltaLogE + _bin0lowerEdge + _deltaLogE / 2) * eV;
 }
 
+int ParticleMapsContainer::findSlot(int pid, int energyIdx) const {
+	std::map<int, EnergyIndex>::const_iterator it = _index.find(pid);
+	if (it == _index.end())
+		return -1;
+	int i = energyIdx - it->second.firstBin;
+	if (i < 0 || i >= (int) it->second.slots.size())
+		return -1;
+	return it->second.slots[i];
+}
+
+int ParticleMapsContainer::getSlot(int pid, int energyIdx) {
+	if (_lastSlot >= 0 && pid == _lastPid && energyIdx == _lastEnergyIdx)
+		return _lastSlot;
+
+	int slot = findSlot(pid, energyIdx);
+	if (slot < 0) {
+		// extend the energy range of the particle
+		EnergyIndex &index = _index[pid];
+		if (index.slots.empty()) {
+			index.firstBin = energyIdx;
+			index.slots.push_back(-1);
+		} else if (energyIdx < index.firstBin) {
+			index.slots.insert(index.slots.begin(), index.firstBin - energyIdx, -1);
+			index.firstBin = energyIdx;
+		} else if (energyIdx - index.firstBin >= (int) index.slots.size()) {
+			index.slots.resize(energyIdx - index.firstBin + 1, -1);
+		}
+
+		// the next map of the pool
+		const size_t nPix = _pixelization.getNumberOfPixels();
+		if (_blocks.empty() || _blockFill == mapsPerBlock) {
+			double *block = new double[mapsPerBlock * nPix];
+			std::fill(block, block + mapsPerBlock * nPix, 0);
+			_blocks.push_back(block);
+			_blockFill = 0;
+		}
+		slot = _maps.size();
+		_maps.push_back(_blocks.back() + _blockFill * nPix);
+		_blockFill++;
+		_slotPid.push_back(pid);
+		_slotEnergyIdx.push_back(energyIdx);
+		index.slots[energyIdx - index.firstBin] = slot;
+	}
+
+	_lastPid = pid;
+	_lastEnergyIdx = energyIdx;
+	_lastSlot = slot;
+	return slot;
+}
+
 		
 double* ParticleMapsContainer::getMap(const int particleId, double energy) {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end()) {
+	if (_index.find(particleId) == _index.end()) {
 		std::cerr << "No map for ParticleID " << particleId << std::endl;
 		return NULL;
 	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end()) {
+	int slot = findSlot(particleId, energy2Idx(energy));
+	if (slot < 0) {
 		std::cerr << "No map for ParticleID and energy" << energy / eV << " eV" << std::endl;
 		return NULL;
 	}
-	return _data[particleId][energy2Idx(energy)];
+	return _maps[slot];
 }
 			
 			
 void ParticleMapsContainer::addParticle(const int particleId, double energy, double galacticLongitude, double galacticLatitude, double weight) {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end()) {
-		map<int, double*> M;
-		_data[particleId] = M;
-	}
-
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end()) {
-		_data[particleId][energyIdx] = new double[_pixelization.getNumberOfPixels()];
-		std::fill(_data[particleId][energyIdx], _data[particleId][energyIdx] + _pixelization.getNumberOfPixels(), 0);
-	}
-
+	int slot = getSlot(particleId, energy2Idx(energy));
 	uint32_t pixel = _pixelization.direction2Pix(galacticLongitude, galacticLatitude);
-	_data[particleId][energyIdx][pixel] += weight;
+	_maps[slot][pixel] += weight;
 }
 
 
@@ -68,10 +109,34 @@ void ParticleMapsContainer::addParticle(const int particleId, double energy, con
 }
 
 
+void ParticleMapsContainer::addParticles(size_t n, const int *particleIds, const double *energies,
+		const double *galacticLongitudes, const double *galacticLatitudes,
+		const double *weights) {
+	_weightsUpToDate = false;
+
+	// the pixels and energy bins of a chunk are computed in parallel,
+	// the maps are filled in order
+	const long chunkSize = 1 << 16;
+	std::vector<uint32_t> pixels(std::min(n, size_t(chunkSize)));
+	std::vector<int> energyIdx(pixels.size());
+	for (size_t first = 0; first < n; first += chunkSize) {
+		long count = std::min(n - first, size_t(chunkSize));
+		_pixelization.direction2Pix(count, galacticLongitudes + first, galacticLatitudes + first, &pixels[0]);
+#pragma omp parallel for schedule(static)
+		for (long i = 0; i < count; i++)
+			energyIdx[i] = energy2Idx(energies[first + i]);
+		for (long i = 0; i < count; i++) {
+			int slot = getSlot(particleIds[first + i], energyIdx[i]);
+			_maps[slot][pixels[i]] += weights ? weights[first + i] : 1.;
+		}
+	}
+}
+
+
 std::vector<int> ParticleMapsContainer::getParticleIds() {
 	std::vector<int> ids;
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
+	for(std::map<int, EnergyIndex>::iterator pid_iter = _index.begin(); 
+			pid_iter != _index.end(); ++pid_iter) {
 		ids.push_back(pid_iter->first);
 	}
 	return ids;
@@ -80,10 +145,11 @@ std::vector<int> ParticleMapsContainer::getParticleIds() {
 
 std::vector<double> ParticleMapsContainer::getEnergies(int pid) {
 	std::vector<double> energies;
-	if (_data.find(pid) != _data.end()) {
-		for(std::map<int, double*>::iterator iter = _data[pid].begin(); 
-			iter != _data[pid].end(); ++iter) {
-			energies.push_back( idx2Energy(iter->first) / eV );
+	std::map<int, EnergyIndex>::iterator it = _index.find(pid);
+	if (it != _index.end()) {
+		for (size_t i = 0; i < it->second.slots.size(); i++) {
+			if (it->second.slots[i] >= 0)
+				energies.push_back( idx2Energy(it->second.firstBin + i) / eV );
 		}
 	}
 	return energies;
@@ -94,22 +160,43 @@ void ParticleMapsContainer::applyLens(MagneticLens &lens) {
 	// if lens is normalized, this should not be necessary.
 	_weightsUpToDate = false;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-			// transform only nuclei
-			double energy = idx2Energy(energy_iter->first);
-			int chargeNumber = HepPID::Z(pid_iter->first);
-			if (chargeNumber != 0 && lens.rigidityCovered(energy / chargeNumber)) {
-				lens.transformModelVector(energy_iter->second, energy / chargeNumber);
-			} else { // still normalize the vectors 
-				for(size_t j=0; j< _pixelization.getNumberOfPixels() ; j++) {
-					energy_iter->second[j] /= lens.getNorm();
-				}
+	// the maps in the same lens part are transformed together
+	std::map<LensPart*, std::vector<double*> > groups;
+	std::map<LensPart*, double> rigidities;
+	for (size_t slot = 0; slot < _maps.size(); slot++) {
+		// transform only nuclei
+		double energy = idx2Energy(_slotEnergyIdx[slot]);
+		int chargeNumber = HepPID::Z(_slotPid[slot]);
+		LensPart *part = NULL;
+		if (chargeNumber != 0)
+			part = lens.getLensPart(energy / chargeNumber);
+		if (part) {
+			groups[part].push_back(_maps[slot]);
+			rigidities[part] = energy / chargeNumber;
+		} else { // still normalize the vectors 
+			for (int j = 0; j < _pixelization.getNumberOfPixels(); j++) {
+				_maps[slot][j] /= lens.getNorm();
 			}
 		}
 	}
+
+	// the groups are independent, a single map uses the parallel product
+	std::vector<std::vector<double*>*> groupMaps;
+	std::vector<double> groupRigidities;
+	for (std::map<LensPart*, std::vector<double*> >::iterator it = groups.begin();
+			it != groups.end(); ++it) {
+		groupMaps.push_back(&it->second);
+		groupRigidities.push_back(rigidities[it->first]);
+	}
+
+#pragma omp parallel for schedule(dynamic) if(groupMaps.size() > 1)
+	for (long i = 0; i < (long) groupMaps.size(); i++) {
+		std::vector<double*> &maps = *groupMaps[i];
+		if (maps.size() == 1)
+			lens.transformModelVector(maps[0], groupRigidities[i]);
+		else
+			lens.transformModelVectors(&maps[0], maps.size(), groupRigidities[i]);
+	}
 }
 
 
@@ -117,53 +204,95 @@ void ParticleMapsContainer::_updateWeights() {
 	if (_weightsUpToDate)
 		return;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		_weightsPID[pid_iter->first] = 0;
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	_slotWeights.assign(_maps.size(), 0.);
+#pragma omp parallel for schedule(static)
+	for (long slot = 0; slot < (long) _maps.size(); slot++) {
+		double sum = 0;
+		for (size_t j = 0; j < nPix; j++)
+			sum += _maps[slot][j];
+		_slotWeights[slot] = sum;
+	}
 
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter)  {
+	_sumOfWeights = 0;
+	_weightsPID.clear();
+	std::vector<double> cdf(_maps.size());
+	for (size_t slot = 0; slot < _maps.size(); slot++) {
+		_weightsPID[_slotPid[slot]] += _slotWeights[slot];
+		_sumOfWeights += _slotWeights[slot];
+		cdf[slot] = _sumOfWeights;
+	}
+	_slotAlias = AliasTable(cdf);
+	_pixelAlias.clear();
+	_pixelAlias.resize(_maps.size());
+	_weightsUpToDate = true;
+}
 
-			_weights_pidEnergy[pid_iter->first][energy_iter->first] = 0;
-			for(size_t j = 0; j< _pixelization.getNumberOfPixels() ; j++) {
-				_weights_pidEnergy[pid_iter->first][energy_iter->first] +=energy_iter->second[j];
-				_weightsPID[pid_iter->first]+=energy_iter->second[j];
-			}
-			_sumOfWeights+=_weights_pidEnergy[pid_iter->first][energy_iter->first];
+
+const AliasTable &ParticleMapsContainer::pixelAlias(int slot) {
+	AliasTable &alias = _pixelAlias[slot];
+	if (alias.size() == 0) {
+		const size_t nPix = _pixelization.getNumberOfPixels();
+		std::vector<double> cdf(nPix);
+		double sum = 0;
+		for (size_t j = 0; j < nPix; j++) {
+			sum += _maps[slot][j];
+			cdf[j] = sum;
 		}
+		alias = AliasTable(cdf);
 	}
-	_weightsUpToDate = true;
+	return alias;
+}
+
+
+double ParticleMapsContainer::getWeight(int pid, double energy) {
+	if (!_weightsUpToDate)
+		_updateWeights();
+	int slot = findSlot(pid, energy2Idx(energy));
+	if (slot < 0)
+		return 0;
+	return _slotWeights[slot];
 }
 
 
 void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId, 
 	vector<double> &energy, vector<double> &galacticLongitudes,
 	vector<double> &galacticLatitudes) {
-	_updateWeights();
-
 	particleId.resize(N);
 	energy.resize(N);
 	galacticLongitudes.resize(N);
 	galacticLatitudes.resize(N);
+	if (N > 0)
+		getRandomParticles(N, &particleId[0], &energy[0], &galacticLongitudes[0], &galacticLatitudes[0]);
+}
 
-	for(size_t i=0; i< N; i++) {
-		//get particle
-		double r = Random::instance().rand() * _sumOfWeights;
-		std::map<int, double>::iterator iter = _weightsPID.begin();
-		while ((r-= iter->second) > 0) {
-			++iter; 
-		}
-		particleId[i] = iter->first;
-	
-		//get energy
-		r = Random::instance().rand() * iter->second;
-		iter = _weights_pidEnergy[particleId[i]].begin();
-		while ((r-= iter->second) > 0) {
-		 ++iter; 
-		}
-		energy[i] = idx2Energy(iter->first) / eV;
 
-		placeOnMap(particleId[i], energy[i] * eV, galacticLongitudes[i], galacticLatitudes[i]);
+void ParticleMapsContainer::getRandomParticles(size_t N, int *particleIds, double *energies,
+		double *galacticLongitudes, double *galacticLatitudes) {
+	_updateWeights();
+	if (_sumOfWeights <= 0)
+		throw std::runtime_error("ParticleMapsContainer: no particles in the maps");
+
+	// the random numbers are drawn in order, the directions of a chunk in parallel
+	const long chunkSize = 1 << 16;
+	const uint64_t nSubPixels = _pixelization.getNumberOfSubPixels();
+	std::vector<uint32_t> pixels(std::min(N, size_t(chunkSize)));
+	std::vector<uint64_t> subPixels(pixels.size());
+	Random &random = Random::instance();
+	for (size_t first = 0; first < N; first += chunkSize) {
+		long count = std::min(N - first, size_t(chunkSize));
+		for (long i = 0; i < count; i++) {
+			// particle and energy in one draw
+			int slot = random.randBin(_slotAlias);
+			particleIds[first + i] = _slotPid[slot];
+			energies[first + i] = idx2Energy(_slotEnergyIdx[slot]) / eV;
+			pixels[i] = random.randBin(pixelAlias(slot));
+			subPixels[i] = random.randInt64(nSubPixels - 1);
+		}
+#pragma omp parallel for schedule(static)
+		for (long i = 0; i < count; i++)
+			_pixelization.getDirectionInPixel(pixels[i], subPixels[i],
+					galacticLongitudes[first + i], galacticLatitudes[first + i]);
 	}
 }
 
@@ -171,24 +300,14 @@ void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId
 bool ParticleMapsContainer::placeOnMap(int pid, double energy, double &galacticLongitude, double &galacticLatitude) {
 	_updateWeights();
 
-	if (_data.find(pid) == _data.end()) {
-		return false;
-	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[pid].find(energyIdx) == _data[pid].end()) {
+	int slot = findSlot(pid, energy2Idx(energy));
+	if (slot < 0 || _slotWeights[slot] <= 0) {
 		return false;
 	}
 
-	double r = Random::instance().rand() * _weights_pidEnergy[pid][energyIdx];
-
-	for(size_t j = 0; j< _pixelization.getNumberOfPixels(); j++) {
-		r -= _data[pid][energyIdx][j];
-		if (r <= 0) {
-			_pixelization.getRandomDirectionInPixel(j, galacticLongitude, galacticLatitude);
-			return true;
-		}
-	}
-	return false;
+	size_t pixel = Random::instance().randBin(pixelAlias(slot));
+	_pixelization.getRandomDirectionInPixel(pixel, galacticLongitude, galacticLatitude);
+	return true;
 }
 
 
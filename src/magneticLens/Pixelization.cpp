@@ -70,9 +70,33 @@ uint32_t Pixelization::direction2Pix(double longitude, double latitude) const
 	}
 }
 
+uint32_t Pixelization::vector2Pix(double x, double y, double z) const
+{
+	return (uint32_t) _healpix->vec2pix(healpix::vec3(x, y, z));
+}
+
+void Pixelization::direction2Pix(size_t n, const double *longitudes,
+		const double *latitudes, uint32_t *pixels) const
+{
+#pragma omp parallel for schedule(static)
+	for (long i = 0; i < (long) n; i++)
+	{
+		healpix::vec3 v;
+		spherCo2Vec(longitudes[i], latitudes[i], v);
+		pixels[i] = (uint32_t) _healpix->vec2pix(v);
+	}
+}
+
 void Pixelization::pix2Direction(uint32_t i, double &longitude,
 		double &latitude) const
 {
+	if (!_centers.empty() && i < nPix())
+	{
+		longitude = _centers[5 * i + 3];
+		latitude = _centers[5 * i + 4];
+		return;
+	}
+
 	healpix::vec3 v;
 	try{
 		v = _healpix->pix2vec(i);
@@ -88,6 +112,47 @@ void Pixelization::pix2Direction(uint32_t i, double &longitude,
 	vec2SphereCo(longitude, latitude, v);
 }
 
+void Pixelization::pix2Direction(size_t n, const uint32_t *pixels,
+		double *longitudes, double *latitudes) const
+{
+#pragma omp parallel for schedule(static)
+	for (long i = 0; i < (long) n; i++)
+		pix2Direction(pixels[i], longitudes[i], latitudes[i]);
+}
+
+void Pixelization::pix2Vector(uint32_t i, double &x, double &y, double &z) const
+{
+	if (!_centers.empty() && i < nPix())
+	{
+		x = _centers[5 * i];
+		y = _centers[5 * i + 1];
+		z = _centers[5 * i + 2];
+		return;
+	}
+	healpix::vec3 v = _healpix->pix2vec(i);
+	x = v.x;
+	y = v.y;
+	z = v.z;
+}
+
+void Pixelization::cacheGeometry()
+{
+	if (!_centers.empty())
+		return;
+	const long n = nPix();
+	std::vector<double> centers(5 * n);
+#pragma omp parallel for schedule(static)
+	for (long i = 0; i < n; i++)
+	{
+		healpix::vec3 v = _healpix->pix2vec(i);
+		centers[5 * i] = v.x;
+		centers[5 * i + 1] = v.y;
+		centers[5 * i + 2] = v.z;
+		vec2SphereCo(centers[5 * i + 3], centers[5 * i + 4], v);
+	}
+	_centers.swap(centers);
+}
+
 void Pixelization::spherCo2Vec(double phi, double theta,
 		healpix::vec3 &V) const
 {
@@ -107,8 +172,8 @@ void Pixelization::vec2SphereCo(double &phi, double &theta,
 double Pixelization::angularDistance(uint32_t i, uint32_t j) const
 {
 	healpix::vec3 v1, v2;
-	v1 = _healpix->pix2vec(i);
-	v2 = _healpix->pix2vec(j);
+	pix2Vector(i, v1.x, v1.y, v1.z);
+	pix2Vector(j, v2.x, v2.y, v2.z);
 	double s = v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
 	// Failsafe for numerical inaccuracies
 	return ((s > 1) ? 0 : ((s < -1) ? M_PI : acos(s)));
@@ -116,11 +181,18 @@ double Pixelization::angularDistance(uint32_t i, uint32_t j) const
 
 void Pixelization::getRandomDirectionInPixel(uint32_t i, double &longitude, double &latitude) 
 {
-	
+	getDirectionInPixel(i, Random::instance().randInt64(getNumberOfSubPixels() - 1), longitude, latitude);
+}
+
+uint64_t Pixelization::getNumberOfSubPixels() const
+{
+	return uint64_t(1) << (2 * (29 - _healpix->Order()));
+}
+
+void Pixelization::getDirectionInPixel(uint32_t i, uint64_t subPixel, double &longitude, double &latitude) const
+{
 	uint64_t inest = _healpix->ring2nest(i);
-	uint64_t nUp = 29 - _healpix->Order();
-	uint64_t iUp = inest * pow(4, nUp);
-	iUp += Random::instance().randInt64(pow(4, nUp));
+	uint64_t iUp = inest * getNumberOfSubPixels() + subPixel;
 
 	healpix::vec3 v = _healpix_nest.pix2vec(iUp);
 	
@@ -25,6 +25,14 @@ double Cordes::getNucleonDensity(const Vector3d &position) const {
 	return getHIIDensity(position);
 }
 
+DensityValues Cordes::getDensities(const Vector3d &position) const {
+	DensityValues n;
+	n.HII = getHIIDensity(position);
+	n.total = n.HII;
+	n.nucleon = n.HII;
+	return n;
+}
+
 bool Cordes::getIsForHI() {
 	return isforHI;
 }
@@ -56,60 +56,62 @@ Vector3d Ferriere::DiskTransformation(const Vector3d &position) const {
 	return pos;
 }
 
-double Ferriere::getHIDensity(const Vector3d &position) const {
-	double n = 0;
-	double R = sqrt(position.x*position.x+position.y*position.y);
+double Ferriere::getInnerHIDensity(const Vector3d &cmz, const Vector3d &disk) const {
+	// density at center
+	double x = cmz.x/pc;  // all units in pc
+	double y = cmz.y/pc;
+	double z = cmz.z/pc;
 
-	if(R<3*kpc)
-	{
-		// density at center
-		Vector3d pos = CMZTransformation(position);  // coordinate trafo
-		double x = pos.x/pc;  // all units in pc
-		double y = pos.y/pc;
-		double z = pos.z/pc;
-
-		double A = sqrt(x*x+2.5*2.5*y*y);
-		double nCMZ = 8.8/ccm*exp(-pow_integer<4>((A-125.)/137))*exp(-pow_integer<2>(z/54.));
-
-		// density in disk
-		pos = DiskTransformation(position);  // Corrdinate Trafo
-		x = pos.x/pc;  // all units in pc
-		y = pos.y/pc;
-		z = pos.z/pc;
-
-		A = sqrt(x*x+3.1*3.1*y*y);
-		double nDisk = 0.34/ccm*exp(-pow_integer<4>((A-1200.)/438.))*exp(-pow_integer<2>(z/120));
-
-		n = nCMZ + nDisk;
-	}
-	else{  // outer region
-		double z = position.z/pc;
-		double a;
-		if(R<=Rsun){
-			a = 1;
-		} else {
-			a = R/Rsun;
-		}
-
-		double nCold = 0.859*exp(-pow_integer<2>(z/(127*a))); // cold HI
-		nCold += 0.047*exp(-pow_integer<2>(z/(318*a)));
-		nCold += 0.094*exp(-fabs(z)/(403*a));
-		nCold *= 0.340/ccm/(a*a);
-
-		double nWarm = (1.745 - 1.289/a)*exp(-pow_integer<2>(z/(127*a)));  // warm HI
-		nWarm += (0.473 - 0.070/a)*exp(-pow_integer<2>(z/(318*a)));
-		nWarm += (0.283 - 0.142/a)*exp(-fabs(z)/(403*a));
-		nWarm *= 0.226/ccm/a;
-
-		n = nWarm + nCold;
+	double A = sqrt(x*x+2.5*2.5*y*y);
+	double nCMZ = 8.8/ccm*exp(-pow_integer<4>((A-125.)/137))*exp(-pow_integer<2>(z/54.));
+
+	// density in disk
+	x = disk.x/pc;  // all units in pc
+	y = disk.y/pc;
+	z = disk.z/pc;
+
+	A = sqrt(x*x+3.1*3.1*y*y);
+	double nDisk = 0.34/ccm*exp(-pow_integer<4>((A-1200.)/438.))*exp(-pow_integer<2>(z/120));
+
+	return nCMZ + nDisk;
+}
+
+double Ferriere::getOuterHIDensity(double R, double zPosition) const {
+	double z = zPosition/pc;
+	double a;
+	if(R<=Rsun){
+		a = 1;
+	} else {
+		a = R/Rsun;
 	}
 
-	return n;
+	double nCold = 0.859*exp(-pow_integer<2>(z/(127*a))); // cold HI
+	nCold += 0.047*exp(-pow_integer<2>(z/(318*a)));
+	nCold += 0.094*exp(-fabs(z)/(403*a));
+	nCold *= 0.340/ccm/(a*a);
+
+	double nWarm = (1.745 - 1.289/a)*exp(-pow_integer<2>(z/(127*a)));  // warm HI
+	nWarm += (0.473 - 0.070/a)*exp(-pow_integer<2>(z/(318*a)));
+	nWarm += (0.283 - 0.142/a)*exp(-fabs(z)/(403*a));
+	nWarm *= 0.226/ccm/a;
+
+	return nWarm + nCold;
+}
+
+double Ferriere::getHIDensity(const Vector3d &position) const {
+	double R = sqrt(position.x*position.x+position.y*position.y);
+	if(R<3*kpc)
+		return getInnerHIDensity(CMZTransformation(position), DiskTransformation(position));
+	return getOuterHIDensity(R, position.z);  // outer region
 }
 
 double Ferriere::getHIIDensity(const Vector3d &position) const {
-	double n = 0;
 	double R = sqrt(position.x*position.x+position.y*position.y);
+	return getHIIDensity(position, R);
+}
+
+double Ferriere::getHIIDensity(const Vector3d &position, double R) const {
+	double n = 0;
 
 	if(R< 3*kpc){   // inner
 		double x = position.x/pc;
@@ -150,40 +152,76 @@ double Ferriere::getHIIDensity(const Vector3d &position) const {
 	return n;
 }
 
+double Ferriere::getInnerH2Density(const Vector3d &cmz, const Vector3d &disk) const {
+	// density at center
+	double x = cmz.x/pc;  // all units in pc
+	double y = cmz.y/pc;
+	double z = cmz.z/pc;
+
+	double A = sqrt(x*x+pow(2.5*y,2));  // ellipticity
+	double nCMZ = exp(-pow((A-125.)/137.,4))*exp(-pow(z/18.,2));
+	nCMZ *= 150/ccm;  // rescaling
+
+	// density in disk
+	x=disk.x/pc;
+	y=disk.y/pc;
+	z=disk.z/pc;
+
+	A = sqrt(x*x+pow_integer<2>(3.1*y));
+	double nDISK = exp(-pow_integer<4>((A-1200)/438))*exp(-pow_integer<2>(z/42));
+	nDISK *= 4.8/ccm;  // rescaling
+
+	return nCMZ + nDISK;
+}
+
+double Ferriere::getOuterH2Density(double R, double zPosition) const {
+	double z = zPosition/pc;
+	double n = pow(R/Rsun, -0.58);
+	n *= exp(-(pow_integer<2>(R-4.5*kpc)-pow_integer<2>(Rsun-4.5*kpc))/pow_integer<2>(2.9*kpc));
+	n *= exp(-pow_integer<2>(z/(81*pow(R/Rsun,0.58))));
+	n *= 0.58/ccm;  // rescaling
+	return n;
+}
+
 double Ferriere::getH2Density(const Vector3d &position) const{
-	double n=0;
 	double R=sqrt(position.x*position.x+position.y*position.y);
+	if(R<3*kpc)
+		return getInnerH2Density(CMZTransformation(position), DiskTransformation(position));
+	return getOuterH2Density(R, position.z);  // outer region
+}
 
+DensityValues Ferriere::getDensities(const Vector3d &position) const {
+	DensityValues n;
+	double R = sqrt(position.x*position.x+position.y*position.y);
 	if(R<3*kpc) {
-		// density at center
-		Vector3d pos =CMZTransformation(position);  // coord trafo for CMZ
-		double x = pos.x/pc;  // all units in pc
-		double y = pos.y/pc;
-		double z = pos.z/pc;
-
-		double A = sqrt(x*x+pow(2.5*y,2));  // ellipticity
-		double nCMZ = exp(-pow((A-125.)/137.,4))*exp(-pow(z/18.,2));
-		nCMZ *= 150/ccm;  // rescaling
-
-		// density in disk
-		pos = DiskTransformation(position);  // coord trafo for disk
-		x=pos.x/pc;
-		y=pos.y/pc;
-		z=pos.z/pc;
-
-		A = sqrt(x*x+pow_integer<2>(3.1*y));
-		double nDISK = exp(-pow_integer<4>((A-1200)/438))*exp(-pow_integer<2>(z/42));
-		nDISK *= 4.8/ccm;  // rescaling
-
-		n = nCMZ + nDISK;
-	} else {  // outer region
-		double z = position.z/pc;
-		n = pow(R/Rsun, -0.58);
-		n *= exp(-(pow_integer<2>(R-4.5*kpc)-pow_integer<2>(Rsun-4.5*kpc))/pow_integer<2>(2.9*kpc));
-		n *= exp(-pow_integer<2>(z/(81*pow(R/Rsun,0.58))));
-		n *= 0.58/ccm;  // rescaling
+		Vector3d cmz = CMZTransformation(position);
+		Vector3d disk = DiskTransformation(position);
+		n.HI = getInnerHIDensity(cmz, disk);
+		n.H2 = getInnerH2Density(cmz, disk);
+	} else {
+		n.HI = getOuterHIDensity(R, position.z);
+		n.H2 = getOuterH2Density(R, position.z);
 	}
+	n.HII = getHIIDensity(position, R);
 
+	if(isforHI){
+		n.total += n.HI;
+		n.nucleon += n.HI;
+	}
+	if(isforHII){
+		n.total += n.HII;
+		n.nucleon += n.HII;
+	}
+	if(isforH2){
+		n.total += n.H2;
+		n.nucleon += 2*n.H2;
+	}
+	// check if all densities are deactivated and raise warning if so
+	if((isforHI || isforHII || isforH2) == false){
+		KISS_LOG_WARNING
+			<< "\nCalled getDensities on fully deactivated Ferriere \n"
+			<< "gas density model. The total density is set to 0.";
+	}
 	return n;
 }
 
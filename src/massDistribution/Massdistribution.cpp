@@ -2,6 +2,12 @@
 #include <sstream>
 namespace crpropa {
 
+void Density::getDensitiesAt(const double *xyz, double *out, size_t n) const {
+#pragma omp parallel for schedule(static, 64)
+	for (long i = 0; i < (long) n; i++)
+		out[i] = getDensity(Vector3d(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+}
+
 void DensityList::addDensity(ref_ptr<Density> dens) {
 	DensityList.push_back(dens);
 }
@@ -41,6 +47,19 @@ double DensityList::getNucleonDensity(const Vector3d &position) const {
 	return n;
 }
 
+DensityValues DensityList::getDensities(const Vector3d &position) const {
+	DensityValues n;
+	for (int i = 0; i < DensityList.size(); i++) {
+		DensityValues d = DensityList[i]->getDensities(position);
+		n.HI += d.HI;
+		n.HII += d.HII;
+		n.H2 += d.H2;
+		n.total += d.total;
+		n.nucleon += d.nucleon;
+	}
+	return n;
+}
+
 std::string DensityList::getDescription() {
 	std::stringstream ss; 
 	ss << "DensityList with " << DensityList.size() << " modules: \n";
@@ -58,6 +77,17 @@ DensityGrid::DensityGrid(ref_ptr<Grid1f> grid, bool isForHI, bool isForHII, bool
 		checkAndWarn();
 	}
 
+DensityGrid::DensityGrid(ref_ptr<NestedGrid1f> grid, bool isForHI, bool isForHII, bool isForH2) :
+	nestedGrid(grid), isForHI(isForHI), isForHII(isForHII), isForH2(isForH2) {
+		checkAndWarn();
+	}
+
+double DensityGrid::interpolate(const Vector3d &position) const {
+	if (nestedGrid.valid())
+		return nestedGrid->interpolate(position);
+	return grid->interpolate(position);
+}
+
 void DensityGrid::checkAndWarn() {
 	bool allDeactivated = (isForHI == false) && (isForHII == false) && (isForH2 == false);
 	if (allDeactivated) {
@@ -69,21 +99,21 @@ void DensityGrid::checkAndWarn() {
 
 double DensityGrid::getHIDensity(const Vector3d &position) const {
 	if (isForHI)
-		return grid -> interpolate(position);
+		return interpolate(position);
 	else 
 		return 0.;
 }
 
 double DensityGrid::getHIIDensity(const Vector3d &position) const {
 	if (isForHII) 
-		return grid -> interpolate(position);
+		return interpolate(position);
 	else
 		return 0.;
 }
 
 double DensityGrid::getH2Density(const Vector3d &position) const {
 	if (isForH2)
-		return grid -> interpolate(position);
+		return interpolate(position);
 	else
 		return 0.;
 }
@@ -106,6 +136,22 @@ double DensityGrid::getNucleonDensity(const Vector3d &position) const {
 	return n;
 }
 
+DensityValues DensityGrid::getDensities(const Vector3d &position) const {
+	DensityValues n;
+	if (!(isForHI || isForHII || isForH2))
+		return n;
+	double d = interpolate(position);
+	if (isForHI)
+		n.HI = d;
+	if (isForHII)
+		n.HII = d;
+	if (isForH2)
+		n.H2 = d;
+	n.total = n.HI + n.HII + n.H2;
+	n.nucleon = n.HI + n.HII + 2 * n.H2;
+	return n;
+}
+
 bool DensityGrid::getIsForHI() {
 	return isForHI;
 }
@@ -135,6 +181,12 @@ void DensityGrid::setIsForH2(bool b) {
 
 void DensityGrid::setGrid(ref_ptr<Grid1f> grid) {
 	this->grid = grid;
+	this->nestedGrid = 0;
+}
+
+void DensityGrid::setGrid(ref_ptr<NestedGrid1f> grid) {
+	this->grid = 0;
+	this->nestedGrid = grid;
 }
 
 std::string DensityGrid::getDescription() {
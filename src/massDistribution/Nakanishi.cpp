@@ -32,21 +32,48 @@ double Nakanishi::getH2Planedensity(const Vector3d &position) const {
 	return planedensity;
 }
 
-double Nakanishi::getHIDensity(const Vector3d &position) const {
-	double n = 0;  // density
-	double planedensity = getHIPlanedensity(position);
-	double scaleheight = getHIScaleheight(position);
-	n = planedensity*pow(0.5,pow_integer<2>(position.z/scaleheight));
+double Nakanishi::getHIDensity(double R, double z) const {
+	double scaleheight = 1.06*pc*(116.3 +19.3*R/kpc+4.1*pow_integer<2>(R/kpc)-0.05*pow_integer<3>(R/kpc));
+	double planedensity = 0.94/ccm*(0.6*exp(-R/(2.4*kpc))+0.24*exp(-pow_integer<2>((R-9.5*kpc)/(4.8*kpc))));
+	return planedensity*pow(0.5,pow_integer<2>(z/scaleheight));
+}
 
-	return n;
+double Nakanishi::getH2Density(double R, double z) const {
+	double scaleheight = 1.06*pc*( 10.8*exp(0.28*R/kpc)+42.78);
+	double planedensity =0.94/ccm*(11.2*exp(-R*R/(0.874*kpc*kpc)) +0.83*exp(-pow_integer<2>((R-4*kpc)/(3.2*kpc))));
+	return planedensity*pow(0.5,pow_integer<2>(z/scaleheight));
+}
+
+double Nakanishi::getHIDensity(const Vector3d &position) const {
+	double R = sqrt(pow_integer<2>(position.x)+pow_integer<2>(position.y));	 // radius in galactic plane
+	return getHIDensity(R, position.z);
 }
 
 double Nakanishi::getH2Density(const Vector3d &position) const {
-	double n = 0;  // density
-	double planedensity = getH2Planedensity(position);
-	double scaleheight = getH2Scaleheight(position);
-	n = planedensity*pow(0.5,pow_integer<2>(position.z/scaleheight));
+	double R = sqrt(pow_integer<2>(position.x)+pow_integer<2>(position.y));	 // radius in galactic plane
+	return getH2Density(R, position.z);
+}
+
+DensityValues Nakanishi::getDensities(const Vector3d &position) const {
+	DensityValues n;
+	double R = sqrt(pow_integer<2>(position.x)+pow_integer<2>(position.y));	 // radius in galactic plane
+	n.HI = getHIDensity(R, position.z);
+	n.H2 = getH2Density(R, position.z);
+	if(isforHI){
+		n.total += n.HI;
+		n.nucleon += n.HI;
+	}
+	if(isforH2){
+		n.total += n.H2;
+		n.nucleon += 2*n.H2;	// weight 2 for molecular hydrogen
+	}
 
+	// check if all densities are deactivated and raise warning if so
+	if((isforHI || isforH2) == false){
+		KISS_LOG_WARNING
+			<< "\n"<<"Called getDensities on fully deactivated Nakanishi \n"
+			<< "gas density model. The total density is set to 0.";
+	}
 	return n;
 }
 
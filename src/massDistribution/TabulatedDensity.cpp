@@ -0,0 +1,352 @@
+#include "crpropa/massDistribution/TabulatedDensity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+const char magic[8] = {'C', 'R', 'P', 'D', 'E', 'N', 'S', '1'};
+const int nQuantities = 5; // total, HI, HII, H2, nucleons
+
+// node and weight of the lower neighbour on an axis,
+// false outside of a non periodic axis
+bool locate(double u, size_t n, bool periodic, size_t &i0, size_t &i1, double &f) {
+	if (periodic) {
+		if (n == 1) {
+			i0 = i1 = 0;
+			f = 0;
+			return true;
+		}
+		double fl = floor(u);
+		f = u - fl;
+		long i = long(fl) % long(n);
+		if (i < 0)
+			i += n;
+		i0 = i;
+		i1 = (i0 + 1) % n;
+		return true;
+	}
+	if (!(u >= 0) || (u > n - 1))
+		return false;
+	i0 = std::min(size_t(u), n - 2);
+	i1 = i0 + 1;
+	f = u - i0;
+	return true;
+}
+}
+
+TabulatedDensity::TabulatedDensity(ref_ptr<Density> density, double relativeError,
+		double absoluteError) : density(density), relativeError(relativeError),
+		absoluteError(absoluteError), geometry(Cartesian) {
+	for (int a = 0; a < 3; a++) {
+		n[a] = 0;
+		lower[a] = upper[a] = spacing[a] = 0;
+	}
+}
+
+void TabulatedDensity::setGrid(Geometry g, const double lo[3], const double up[3], const size_t nodes[3]) {
+	geometry = g;
+	for (int a = 0; a < 3; a++) {
+		bool periodic = (geometry == Cylindrical) && (a == 1);
+		if ((nodes[a] < 2) && !(periodic && nodes[a] == 1))
+			throw std::runtime_error("TabulatedDensity: at least 2 nodes per axis needed");
+		if (!(up[a] > lo[a]))
+			throw std::runtime_error("TabulatedDensity: empty grid");
+		n[a] = nodes[a];
+		lower[a] = lo[a];
+		upper[a] = up[a];
+		spacing[a] = (upper[a] - lower[a]) / (periodic ? n[a] : n[a] - 1);
+	}
+}
+
+void TabulatedDensity::tabulateCartesian(const Vector3d &origin, const Vector3d &size,
+		size_t nx, size_t ny, size_t nz) {
+	double lo[3] = {origin.x, origin.y, origin.z};
+	double up[3] = {origin.x + size.x, origin.y + size.y, origin.z + size.z};
+	size_t nodes[3] = {nx, ny, nz};
+	setGrid(Cartesian, lo, up, nodes);
+	tabulate();
+}
+
+void TabulatedDensity::tabulateCylindrical(double rMax, double zMin, double zMax,
+		size_t nR, size_t nPhi, size_t nZ) {
+	double lo[3] = {0, -M_PI, zMin};
+	double up[3] = {rMax, M_PI, zMax};
+	size_t nodes[3] = {nR, nPhi, nZ};
+	setGrid(Cylindrical, lo, up, nodes);
+	tabulate();
+}
+
+void TabulatedDensity::coordinates(const Vector3d &p, double u[3]) const {
+	if (geometry == Cartesian) {
+		u[0] = (p.x - lower[0]) / spacing[0];
+		u[1] = (p.y - lower[1]) / spacing[1];
+	} else {
+		u[0] = sqrt(p.x * p.x + p.y * p.y) / spacing[0];
+		u[1] = (atan2(p.y, p.x) - lower[1]) / spacing[1];
+	}
+	u[2] = (p.z - lower[2]) / spacing[2];
+}
+
+Vector3d TabulatedDensity::position(const double u[3]) const {
+	double c[3];
+	for (int a = 0; a < 3; a++)
+		c[a] = lower[a] + u[a] * spacing[a];
+	if (geometry == Cartesian)
+		return Vector3d(c[0], c[1], c[2]);
+	return Vector3d(c[0] * cos(c[1]), c[0] * sin(c[1]), c[2]);
+}
+
+size_t TabulatedDensity::node(size_t i, size_t j, size_t k) const {
+	return ((i * n[1] + j) * n[2] + k) * nQuantities;
+}
+
+size_t TabulatedDensity::cells(size_t axis) const {
+	bool periodic = (geometry == Cylindrical) && (axis == 1);
+	return periodic ? n[axis] : n[axis] - 1;
+}
+
+void TabulatedDensity::evaluate(const Vector3d &p, double v[5]) const {
+	v[0] = density->getDensity(p);
+	v[1] = density->getHIDensity(p);
+	v[2] = density->getHIIDensity(p);
+	v[3] = density->getH2Density(p);
+	v[4] = density->getNucleonDensity(p);
+}
+
+bool TabulatedDensity::interpolate(const double u[3], double v[5]) const {
+	size_t i[3][2];
+	double f[3];
+	for (int a = 0; a < 3; a++) {
+		bool periodic = (geometry == Cylindrical) && (a == 1);
+		if (!locate(u[a], n[a], periodic, i[a][0], i[a][1], f[a]))
+			return false;
+	}
+	for (int q = 0; q < nQuantities; q++)
+		v[q] = 0;
+	for (int a = 0; a < 2; a++)
+		for (int b = 0; b < 2; b++)
+			for (int c = 0; c < 2; c++) {
+				double w = (a ? f[0] : 1 - f[0]) * (b ? f[1] : 1 - f[1]) * (c ? f[2] : 1 - f[2]);
+				const float *x = &values[node(i[0][a], i[1][b], i[2][c])];
+				for (int q = 0; q < nQuantities; q++)
+					v[q] += w * x[q];
+			}
+	return true;
+}
+
+bool TabulatedDensity::interpolate(const Vector3d &p, int q, double &value) const {
+	if (values.empty())
+		return false;
+	double u[3];
+	coordinates(p, u);
+	size_t i[3][2];
+	double f[3];
+	for (int a = 0; a < 3; a++) {
+		bool periodic = (geometry == Cylindrical) && (a == 1);
+		if (!locate(u[a], n[a], periodic, i[a][0], i[a][1], f[a]))
+			return false;
+	}
+	if (exact[(i[0][0] * cells(1) + i[1][0]) * cells(2) + i[2][0]])
+		return false;
+	value = 0;
+	for (int a = 0; a < 2; a++)
+		for (int b = 0; b < 2; b++)
+			for (int c = 0; c < 2; c++) {
+				double w = (a ? f[0] : 1 - f[0]) * (b ? f[1] : 1 - f[1]) * (c ? f[2] : 1 - f[2]);
+				value += w * values[node(i[0][a], i[1][b], i[2][c]) + q];
+			}
+	return true;
+}
+
+bool TabulatedDensity::interpolate(const Vector3d &p, double v[5]) const {
+	if (values.empty())
+		return false;
+	double u[3];
+	coordinates(p, u);
+	size_t i[3];
+	double f;
+	for (int a = 0; a < 3; a++) {
+		size_t i1;
+		bool periodic = (geometry == Cylindrical) && (a == 1);
+		if (!locate(u[a], n[a], periodic, i[a], i1, f))
+			return false;
+	}
+	if (exact[(i[0] * cells(1) + i[1]) * cells(2) + i[2]])
+		return false;
+	return interpolate(u, v);
+}
+
+void TabulatedDensity::tabulate() {
+	const long nNodes = n[0] * n[1] * n[2];
+	values.assign(nNodes * nQuantities, 0);
+
+	// all densities of a node in one pass
+#pragma omp parallel for schedule(dynamic, 64)
+	for (long index = 0; index < nNodes; index++) {
+		double u[3] = {double(index / (n[1] * n[2])), double((index / n[2]) % n[1]), double(index % n[2])};
+		double v[nQuantities];
+		evaluate(position(u), v);
+		for (int q = 0; q < nQuantities; q++)
+			values[index * nQuantities + q] = v[q];
+	}
+
+	// cells where the interpolation misses the error bound at the center
+	const long nCells = cells(0) * cells(1) * cells(2);
+	exact.assign(nCells, 0);
+#pragma omp parallel for schedule(dynamic, 64)
+	for (long index = 0; index < nCells; index++) {
+		double u[3] = {index / (cells(1) * cells(2)) + 0.5,
+				(index / cells(2)) % cells(1) + 0.5, index % cells(2) + 0.5};
+		if ((geometry == Cylindrical) && (n[1] == 1))
+			u[1] = 0.5;
+		double v[nQuantities], w[nQuantities];
+		evaluate(position(u), v);
+		interpolate(u, w);
+		for (int q = 0; q < nQuantities; q++) {
+			if (fabs(w[q] - v[q]) > relativeError * fabs(v[q]) + absoluteError)
+				exact[index] = 1;
+		}
+	}
+}
+
+void TabulatedDensity::save(const std::string &filename) const {
+	if (values.empty())
+		throw std::runtime_error("TabulatedDensity: nothing to save");
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out)
+		throw std::runtime_error("TabulatedDensity: cannot write " + filename);
+	uint32_t g = geometry;
+	uint64_t nodes[3] = {n[0], n[1], n[2]};
+	out.write(magic, sizeof(magic));
+	out.write((const char*) &g, sizeof(g));
+	out.write((const char*) nodes, sizeof(nodes));
+	out.write((const char*) lower, sizeof(lower));
+	out.write((const char*) upper, sizeof(upper));
+	out.write((const char*) &relativeError, sizeof(relativeError));
+	out.write((const char*) &absoluteError, sizeof(absoluteError));
+	out.write((const char*) &values[0], values.size() * sizeof(float));
+	out.write((const char*) &exact[0], exact.size());
+	if (!out)
+		throw std::runtime_error("TabulatedDensity: cannot write " + filename);
+}
+
+void TabulatedDensity::load(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in)
+		throw std::runtime_error("TabulatedDensity: cannot read " + filename);
+	char m[8];
+	uint32_t g;
+	uint64_t nodes[3];
+	double lo[3], up[3];
+	in.read(m, sizeof(m));
+	in.read((char*) &g, sizeof(g));
+	in.read((char*) nodes, sizeof(nodes));
+	in.read((char*) lo, sizeof(lo));
+	in.read((char*) up, sizeof(up));
+	in.read((char*) &relativeError, sizeof(relativeError));
+	in.read((char*) &absoluteError, sizeof(absoluteError));
+	if (!in || memcmp(m, magic, sizeof(magic)) != 0 || g > Cylindrical)
+		throw std::runtime_error("TabulatedDensity: no density table in " + filename);
+
+	size_t nn[3] = {size_t(nodes[0]), size_t(nodes[1]), size_t(nodes[2])};
+	setGrid(Geometry(g), lo, up, nn);
+	values.resize(n[0] * n[1] * n[2] * nQuantities);
+	exact.resize(cells(0) * cells(1) * cells(2));
+	in.read((char*) &values[0], values.size() * sizeof(float));
+	in.read((char*) &exact[0], exact.size());
+	if (!in) {
+		values.clear();
+		exact.clear();
+		throw std::runtime_error("TabulatedDensity: incomplete density table in " + filename);
+	}
+}
+
+size_t TabulatedDensity::getNumberOfNodes() const {
+	return values.size() / nQuantities;
+}
+
+double TabulatedDensity::getExactFraction() const {
+	if (exact.empty())
+		return 0;
+	size_t count = 0;
+	for (size_t i = 0; i < exact.size(); i++)
+		count += exact[i];
+	return double(count) / exact.size();
+}
+
+double TabulatedDensity::getDensity(const Vector3d &position) const {
+	double v;
+	if (interpolate(position, 0, v))
+		return v;
+	return density->getDensity(position);
+}
+
+double TabulatedDensity::getHIDensity(const Vector3d &position) const {
+	double v;
+	if (interpolate(position, 1, v))
+		return v;
+	return density->getHIDensity(position);
+}
+
+double TabulatedDensity::getHIIDensity(const Vector3d &position) const {
+	double v;
+	if (interpolate(position, 2, v))
+		return v;
+	return density->getHIIDensity(position);
+}
+
+double TabulatedDensity::getH2Density(const Vector3d &position) const {
+	double v;
+	if (interpolate(position, 3, v))
+		return v;
+	return density->getH2Density(position);
+}
+
+double TabulatedDensity::getNucleonDensity(const Vector3d &position) const {
+	double v;
+	if (interpolate(position, 4, v))
+		return v;
+	return density->getNucleonDensity(position);
+}
+
+DensityValues TabulatedDensity::getDensities(const Vector3d &position) const {
+	double v[nQuantities];
+	if (!interpolate(position, v))
+		return density->getDensities(position);
+	DensityValues d;
+	d.total = v[0];
+	d.HI = v[1];
+	d.HII = v[2];
+	d.H2 = v[3];
+	d.nucleon = v[4];
+	return d;
+}
+
+bool TabulatedDensity::getIsForHI() {
+	return density->getIsForHI();
+}
+
+bool TabulatedDensity::getIsForHII() {
+	return density->getIsForHII();
+}
+
+bool TabulatedDensity::getIsForH2() {
+	return density->getIsForH2();
+}
+
+std::string TabulatedDensity::getDescription() {
+	std::stringstream s;
+	s << "TabulatedDensity: " << ((geometry == Cartesian) ? "Cartesian" : "cylindrical")
+			<< " grid of " << n[0] << " x " << n[1] << " x " << n[2] << " nodes, "
+			<< getExactFraction() * 100 << "% of the cells exact, of\n"
+			<< density->getDescription();
+	return s.str();
+}
+
+}  // namespace crpropa
@@ -5,12 +5,68 @@
 
 namespace crpropa {
 
+/// Scatter a particle with energy E and momentum p with a center of velocity
+/// v into the direction r (in the rest frame of the center), m = 0.
+static inline void scatterParticle(double E, const Vector3d &p,
+		const Vector3d &v, const Vector3d &r, double &E_new, Vector3d &p_new) {
+	// transform to rest frame of scatter center (p: prime)
+	const double beta = v.getR() / crpropa::c_light;
+	const double gamma = 1. / sqrt(1 - beta * beta);
+	const double Ep = gamma * (E - v.dot(p));
+	const crpropa::Vector3d pp = (p - v * E /
+		(crpropa::c_light * crpropa::c_light)) * gamma;
+
+	// scatter into random direction
+	const crpropa::Vector3d pp_new = r * pp.getR();
+
+	// transform back
+	E_new = gamma * (Ep + v.dot(pp_new));
+	p_new = (pp_new + v * Ep /
+		(crpropa::c_light * crpropa::c_light)) * gamma;
+}
+
+
+void StepLengthModifier::modifyBatch(double *steplengths, Candidate **candidates, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		steplengths[i] = modify(steplengths[i], candidates[i]);
+}
+
+
+StepLengthScaling::StepLengthScaling(double factor) : factor(factor) {}
+
+
+double StepLengthScaling::modify(double steplength, Candidate *candidate) {
+	return steplength * factor;
+}
+
+
+bool StepLengthScaling::isConstant() const {
+	return true;
+}
+
+
 AbstractAccelerationModule::AbstractAccelerationModule(double _stepLength)
 	: crpropa::Module(), stepLength(_stepLength) {}
 
 
 void AbstractAccelerationModule::add(StepLengthModifier *modifier) {
-	modifiers.push_back(modifier);
+	ref_ptr<StepLengthModifier> m = modifier;
+	if (modifiers.empty() && m->isConstant()) {
+		// the same for all candidates, fold it into the step length
+		stepLength = m->modify(stepLength, NULL);
+		return;
+	}
+	modifiers.push_back(m);
+}
+
+
+double AbstractAccelerationModule::getStepLength() const {
+	return stepLength;
+}
+
+
+size_t AbstractAccelerationModule::getNumberOfModifiers() const {
+	return modifiers.size();
 }
 
 
@@ -21,20 +77,10 @@ void AbstractAccelerationModule::scatter(
 	const double E = candidate->current.getEnergy();
 	const crpropa::Vector3d p = candidate->current.getMomentum();
 
-	// transform to rest frame of scatter center (p: prime)
-	const double beta = scatter_center_velocity.getR() / crpropa::c_light;
-	const double gamma = 1. / sqrt(1 - beta * beta);
-	const double Ep = gamma * (E - scatter_center_velocity.dot(p));
-	const crpropa::Vector3d pp = (p - scatter_center_velocity* E /
-		(crpropa::c_light * crpropa::c_light)) * gamma;
-
-	// scatter into random direction
-	const crpropa::Vector3d pp_new = crpropa::Random::instance().randVector() * pp.getR();
-
-	// transform back
-	const double E_new = gamma * (Ep + scatter_center_velocity.dot(pp_new));
-	const crpropa::Vector3d p_new = (pp_new + scatter_center_velocity * Ep /
-		(crpropa::c_light * crpropa::c_light)) * gamma;
+	double E_new;
+	crpropa::Vector3d p_new;
+	scatterParticle(E, p, scatter_center_velocity,
+		crpropa::Random::instance().randVector(), E_new, p_new);
 
 	// update candidate properties
 	candidate->current.setEnergy(E_new);
@@ -42,6 +88,13 @@ void AbstractAccelerationModule::scatter(
 }
 
 
+void AbstractAccelerationModule::scatterCenterVelocities(
+	Candidate **candidates, Vector3d *velocities, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		velocities[i] = scatterCenterVelocity(candidates[i]);
+}
+
+
 void AbstractAccelerationModule::process(crpropa::Candidate *candidate) const {
 	double currentStepLength = stepLength;
 	for (auto m : modifiers) {
@@ -62,6 +115,71 @@ void AbstractAccelerationModule::process(crpropa::Candidate *candidate) const {
 }
 
 
+void AbstractAccelerationModule::processBatch(Candidate **candidates, size_t n) const {
+	static thread_local std::vector<double> lengths, steps, distances, energies;
+	static thread_local std::vector<size_t> active, next;
+	static thread_local std::vector<Candidate*> scattering;
+	static thread_local std::vector<Vector3d> velocities, directions;
+	if (n == 0)
+		return;
+
+	// step lengths of all candidates, one pass per modifier
+	lengths.assign(n, stepLength);
+	for (size_t j = 0; j < modifiers.size(); j++)
+		modifiers[j]->modifyBatch(&lengths[0], candidates, n);
+
+	steps.resize(n);
+	active.clear();
+	for (size_t i = 0; i < n; i++) {
+		steps[i] = candidates[i]->getCurrentStep();
+		if (steps[i] > 0)
+			active.push_back(i);
+	}
+
+	// in each round the remaining candidates draw their distance to the next
+	// scatter center, those that reach it are scattered together
+	Random &random = Random::instance();
+	while (!active.empty()) {
+		const size_t m = active.size();
+		distances.resize(m);
+		random.randExponential(&distances[0], m);
+
+		next.clear();
+		scattering.clear();
+		for (size_t k = 0; k < m; k++) {
+			const size_t i = active[k];
+			const double d = distances[k] * lengths[i];
+			if (steps[i] < d) {
+				candidates[i]->limitNextStep(0.1 * lengths[i]);
+				continue;
+			}
+			steps[i] -= d;
+			scattering.push_back(candidates[i]);
+			if (steps[i] > 0)
+				next.push_back(i);
+		}
+
+		const size_t q = scattering.size();
+		if (q == 0)
+			break;
+		velocities.resize(q);
+		directions.resize(q);
+		scatterCenterVelocities(&scattering[0], &velocities[0], q);
+		random.randVector(&directions[0], q);
+		for (size_t k = 0; k < q; k++) {
+			ParticleState &state = scattering[k]->current;
+			double E_new;
+			Vector3d p_new;
+			scatterParticle(state.getEnergy(), state.getMomentum(),
+				velocities[k], directions[k], E_new, p_new);
+			state.setEnergy(E_new);
+			state.setDirection(p_new / p_new.getR());
+		}
+		active.swap(next);
+	}
+}
+
+
 SecondOrderFermi::SecondOrderFermi(double scatterVelocity, double stepLength,
 								   unsigned int sizeOfPitchangleTable)
 	: AbstractAccelerationModule(stepLength),
@@ -89,6 +207,27 @@ crpropa::Vector3d SecondOrderFermi::scatterCenterVelocity(crpropa::Candidate *ca
 }
 
 
+void SecondOrderFermi::scatterCenterVelocities(Candidate **candidates,
+		Vector3d *velocities, size_t n) const {
+	static thread_local std::vector<double> u;
+	static thread_local std::vector<Vector3d> rv;
+	if (n == 0)
+		return;
+	u.resize(n);
+	rv.resize(n);
+	crpropa::Random &random = crpropa::Random::instance();
+	random.rand(&u[0], n);
+	random.randVector(&rv[0], n);
+
+	for (size_t i = 0; i < n; i++) {
+		size_t idx = crpropa::closestIndex(u[i], angleCDF);
+		const crpropa::Vector3d direction = candidates[i]->current.getDirection();
+		crpropa::Vector3d rotationAxis = direction.cross(rv[i]);
+		velocities[i] = direction.getRotated(rotationAxis, M_PI - angle[idx]) * scatterVelocity;
+	}
+}
+
+
 DirectedFlowOfScatterCenters::DirectedFlowOfScatterCenters(
 	const Vector3d &scatterCenterVelocity)
 	: __scatterVelocity(scatterCenterVelocity) {}
@@ -101,6 +240,15 @@ double DirectedFlowOfScatterCenters::modify(double steplength, Candidate* candid
 }
 
 
+void DirectedFlowOfScatterCenters::modifyBatch(double *steplengths,
+		Candidate **candidates, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		double directionModifier = (-1. * __scatterVelocity.dot(candidates[i]->current.getDirection()) + c_light) / c_light;
+		steplengths[i] /= directionModifier;
+	}
+}
+
+
 DirectedFlowScattering::DirectedFlowScattering(
 	crpropa::Vector3d scatterCenterVelocity, double stepLength)
 	: __scatterVelocity(scatterCenterVelocity),
@@ -119,6 +267,13 @@ crpropa::Vector3d DirectedFlowScattering::scatterCenterVelocity(
 }
 
 
+void DirectedFlowScattering::scatterCenterVelocities(Candidate **candidates,
+		Vector3d *velocities, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		velocities[i] = __scatterVelocity;
+}
+
+
 QuasiLinearTheory::QuasiLinearTheory(double referenecEnergy,
 									 double turbulenceIndex,
 									 double minimumRigidity)
@@ -174,11 +329,19 @@ void ParticleSplitting::process(Candidate *candidate) const {
 		// before the split are not affected
 		ref_ptr<Candidate> new_candidate = candidate->clone(false);
 		new_candidate->parent = candidate;
-		uint64_t snr = Candidate::getNextSerialNumber();
-		Candidate::setNextSerialNumber(snr + 1);
-		new_candidate->setSerialNumber(snr);
 		candidate->addSecondary(new_candidate);
 	}
 };
 
+void QuasiLinearTheory::modifyBatch(double *steplengths, Candidate **candidates,
+		size_t n) {
+	const double exponent = 2. - __turbulenceIndex;
+	const double reference = __referenceEnergy / eV;
+	for (size_t i = 0; i < n; i++) {
+		double rigidity = std::max(candidates[i]->current.getRigidity(), __minimumRigidity);
+		steplengths[i] *= std::pow(rigidity / reference, exponent);
+	}
+}
+
+
 } // namespace crpropa
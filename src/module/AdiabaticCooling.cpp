@@ -1,14 +1,16 @@
 #include "crpropa/module/AdiabaticCooling.h"
 
+#include <vector>
+
 namespace crpropa {
 
 AdiabaticCooling::AdiabaticCooling(ref_ptr<AdvectionField> advectionField) :
-	advectionField(advectionField) {
+	advectionField(advectionField), exactLoss(false) {
 	setLimit(0.1);
 }
 
 AdiabaticCooling::AdiabaticCooling(ref_ptr<AdvectionField> advectionField, double limit) :
-	advectionField(advectionField) {
+	advectionField(advectionField), exactLoss(false) {
 	setLimit(limit);
 }
 
@@ -22,7 +24,7 @@ void AdiabaticCooling::process(Candidate *c) const {
 		Div +=  advectionField->getDivergence(pos);
 	} 
 	catch (std::exception &e) {
-		KISS_LOG_ERROR 	<< "AdiabaticCooling: Exception in getDivergence.\n" 
+		KISS_LOG_ERROR_LIMITED(10) << "AdiabaticCooling: Exception in getDivergence.\n" 
 				<< e.what();
 	}
 	
@@ -31,6 +33,8 @@ void AdiabaticCooling::process(Candidate *c) const {
 					// (2012) 530-542)
 	double dt = c->getCurrentStep() / c_light;
 	double dE = dEdt * dt;
+	if (exactLoss)
+		dE = E * expm1(-Div / 3. * dt);
 	
 	c->current.setEnergy(E + dE);
 	if (dEdt==0) {
@@ -39,13 +43,60 @@ void AdiabaticCooling::process(Candidate *c) const {
 	c->limitNextStep(limit * E / fabs(dEdt) *c_light);
 }
 
+void AdiabaticCooling::processBatch(Candidate **candidates, size_t n) const {
+	static thread_local std::vector<Vector3d> positions;
+	static thread_local std::vector<double> divergences;
+	positions.resize(n);
+	divergences.resize(n);
+	for (size_t i = 0; i < n; i++)
+		positions[i] = candidates[i]->current.getPosition();
+	try {
+		advectionField->getDivergences(&positions[0], &divergences[0], n);
+	}
+	catch (std::exception &) {
+		// find the positions that fail, as in process
+		for (size_t i = 0; i < n; i++) {
+			try {
+				divergences[i] = advectionField->getDivergence(positions[i]);
+			}
+			catch (std::exception &e) {
+				divergences[i] = 0.;
+				KISS_LOG_ERROR_LIMITED(10) << "AdiabaticCooling: Exception in getDivergence.\n"
+						<< e.what();
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		Candidate *c = candidates[i];
+		double E = c->current.getEnergy();
+		double Div = divergences[i];
+		double dEdt = -E / 3. * Div;
+		double dt = c->getCurrentStep() / c_light;
+		double dE = dEdt * dt;
+		if (exactLoss)
+			dE = E * expm1(-Div / 3. * dt);
+		c->current.setEnergy(E + dE);
+		if (dEdt != 0)
+			c->limitNextStep(limit * E / fabs(dEdt) * c_light);
+	}
+}
+
 void AdiabaticCooling::setLimit(double l) {
 	limit = l;
 }
 
+void AdiabaticCooling::setExactLoss(bool exact) {
+	exactLoss = exact;
+}
+
 double AdiabaticCooling::getLimit() const {
 	return limit;
 }
+
+bool AdiabaticCooling::getExactLoss() const {
+	return exactLoss;
+}
 	
 	
 
@@ -0,0 +1,78 @@
+#include "crpropa/module/BatchModule.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+size_t CandidateArrays::size() const {
+	return id.size();
+}
+
+void CandidateArrays::resize(size_t n) {
+	id.resize(n);
+	energy.resize(n);
+	position.resize(3 * n);
+	direction.resize(3 * n);
+	weight.resize(n);
+	step.resize(n);
+	active.resize(n);
+}
+
+void CandidateArrays::gather(Candidate **candidates, size_t n) {
+	resize(n);
+	for (size_t i = 0; i < n; i++) {
+		const ParticleState &state = candidates[i]->current;
+		id[i] = state.getId();
+		energy[i] = state.getEnergy();
+		const Vector3d &p = state.getPosition();
+		position[3 * i] = p.x;
+		position[3 * i + 1] = p.y;
+		position[3 * i + 2] = p.z;
+		const Vector3d &d = state.getDirection();
+		direction[3 * i] = d.x;
+		direction[3 * i + 1] = d.y;
+		direction[3 * i + 2] = d.z;
+		weight[i] = candidates[i]->getWeight();
+		step[i] = candidates[i]->getCurrentStep();
+		active[i] = candidates[i]->isActive();
+	}
+}
+
+void CandidateArrays::scatter(Candidate **candidates, size_t n) const {
+	// only changed values are set, e.g. setDirection normalizes the direction
+	for (size_t i = 0; i < n; i++) {
+		Candidate *c = candidates[i];
+		ParticleState &state = c->current;
+		if (state.getId() != id[i])
+			state.setId(id[i]);
+		if (state.getEnergy() != energy[i])
+			state.setEnergy(energy[i]);
+		Vector3d p(position[3 * i], position[3 * i + 1], position[3 * i + 2]);
+		if (!(state.getPosition() == p))
+			state.setPosition(p);
+		Vector3d d(direction[3 * i], direction[3 * i + 1], direction[3 * i + 2]);
+		if (!(state.getDirection() == d))
+			state.setDirection(d);
+		if (c->getWeight() != weight[i])
+			c->setWeight(weight[i]);
+		if (c->isActive() != bool(active[i]))
+			c->setActive(active[i]);
+	}
+}
+
+void BatchModule::process(Candidate *candidate) const {
+	BatchModule::processBatch(&candidate, 1);
+}
+
+void BatchModule::processBatch(Candidate **candidates, size_t n) const {
+	if (n == 0)
+		return;
+	ref_ptr<CandidateArrays> arrays = new CandidateArrays();
+	arrays->gather(candidates, n);
+	processCandidates(*arrays);
+	if (arrays->size() != n)
+		throw std::runtime_error("BatchModule: the number of candidates was changed");
+	arrays->scatter(candidates, n);
+}
+
+} // namespace crpropa
@@ -0,0 +1,234 @@
+#include "crpropa/module/BinaryOutput.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+static const char binaryMagic[8] = {'C', 'R', 'P', 'R', 'O', 'P', 'A', 'B'};
+
+struct BinaryHeader {
+	char magic[8];
+	uint32_t recordSize;
+	uint32_t reserved;
+};
+
+BinaryOutput::BinaryOutput(const std::string &filename) :
+		out(filename.c_str(), std::ios::binary), filename(filename), count(0), ordered(0) {
+	setRunOnInactive(true);
+	if (!out.is_open())
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+	BinaryHeader header;
+	memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+	header.recordSize = sizeof(Record);
+	header.reserved = 0;
+	out.write((const char *) &header, sizeof(header));
+}
+
+BinaryOutput::~BinaryOutput() {
+	close();
+}
+
+static void storeState(const ParticleState &state, int i, BinaryOutput::Record &r) {
+	r.id[i] = state.getId();
+	r.energy[i] = state.getEnergy();
+	const Vector3d &x = state.getPosition();
+	r.position[i][0] = x.x;
+	r.position[i][1] = x.y;
+	r.position[i][2] = x.z;
+	const Vector3d &p = state.getDirection();
+	r.direction[i][0] = p.x;
+	r.direction[i][1] = p.y;
+	r.direction[i][2] = p.z;
+}
+
+static void loadState(ParticleState &state, int i, const BinaryOutput::Record &r) {
+	state.setId(r.id[i]);
+	state.setEnergy(r.energy[i]);
+	state.setPosition(Vector3d(r.position[i][0], r.position[i][1], r.position[i][2]));
+	state.setDirection(Vector3d(r.direction[i][0], r.direction[i][1], r.direction[i][2]));
+}
+
+void BinaryOutput::toRecord(const Candidate *c, Record &r) {
+	r.trajectoryLength = c->getTrajectoryLength();
+	r.redshift = c->getRedshift();
+	r.weight = c->getWeight();
+	r.serialNumber[0] = c->getSerialNumber();
+	r.serialNumber[1] = c->getSourceSerialNumber();
+	r.serialNumber[2] = c->getCreatedSerialNumber();
+	r.padding = 0;
+	storeState(c->current, 0, r);
+	storeState(c->source, 1, r);
+	storeState(c->created, 2, r);
+}
+
+ref_ptr<Candidate> BinaryOutput::fromRecord(const Record &r) {
+	ref_ptr<Candidate> c = new Candidate();
+	c->setTrajectoryLength(r.trajectoryLength);
+	c->setRedshift(r.redshift);
+	c->setWeight(r.weight);
+	c->setSerialNumber(r.serialNumber[0]);
+	c->setParentSerialNumbers(r.serialNumber[1], r.serialNumber[2]);
+	loadState(c->current, 0, r);
+	loadState(c->source, 1, r);
+	loadState(c->created, 2, r);
+	c->previous = c->current;
+	return c;
+}
+
+void BinaryOutput::process(Candidate *candidate) const {
+	Record r;
+	toRecord(candidate, r);
+	if (ordered) {
+		ordered->push(r.serialNumber[1], r.serialNumber[0], (const char *) &r, sizeof(r));
+		return;
+	}
+#pragma omp critical(BinaryOutput)
+	{
+		out.write((const char *) &r, sizeof(r));
+		count++;
+	}
+}
+
+size_t BinaryOutput::size() const {
+	return count;
+}
+
+void BinaryOutput::setOrdered(bool enable, size_t runSize) {
+	if (ordered && ordered->size())
+		throw std::runtime_error("BinaryOutput: setOrdered has to be called before the output");
+	delete ordered;
+	ordered = 0;
+	if (enable)
+		ordered = new OrderedRecords(runSize);
+}
+
+bool BinaryOutput::getOrdered() const {
+	return ordered != 0;
+}
+
+void BinaryOutput::close() {
+	if (ordered) {
+		ordered->merge([this](const char *record, size_t size) {
+			out.write(record, size);
+			count++;
+		});
+		delete ordered;
+		ordered = 0;
+	}
+	if (out.is_open())
+		out.close();
+}
+
+std::string BinaryOutput::getDescription() const {
+	return "BinaryOutput: " + filename;
+}
+
+static void checkHeader(const BinaryHeader &header, const std::string &filename) {
+	if (memcmp(header.magic, binaryMagic, sizeof(binaryMagic)) != 0)
+		throw std::runtime_error("crpropa::BinaryOutput: not a binary output file " + filename);
+	if (header.recordSize != sizeof(BinaryOutput::Record))
+		throw std::runtime_error("crpropa::BinaryOutput: incompatible record size in " + filename);
+}
+
+bool BinaryOutput::isBinaryFile(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char magic[sizeof(binaryMagic)];
+	if (!in.read(magic, sizeof(magic)))
+		return false;
+	return memcmp(magic, binaryMagic, sizeof(binaryMagic)) == 0;
+}
+
+static void loadRecords(const BinaryOutput::Record *records, size_t n, ParticleCollector *collector) {
+	std::vector<ref_ptr<Candidate> > &container = collector->getContainer();
+	container.reserve(container.size() + n);
+	for (size_t i = 0; i < n; i++)
+		collector->process(BinaryOutput::fromRecord(records[i]));
+}
+
+void BinaryOutput::load(const std::string &filename, ParticleCollector *collector) {
+#ifndef _WIN32
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("crpropa::BinaryOutput: could not open file " + filename);
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(BinaryHeader))) {
+		::close(fd);
+		throw std::runtime_error("crpropa::BinaryOutput: could not read file " + filename);
+	}
+	size_t length = st.st_size;
+	void *data = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		throw std::runtime_error("crpropa::BinaryOutput: could not map file " + filename);
+	madvise(data, length, MADV_SEQUENTIAL);
+
+	const char *begin = static_cast<const char *>(data);
+	try {
+		checkHeader(*reinterpret_cast<const BinaryHeader *>(begin), filename);
+	} catch (...) {
+		munmap(data, length);
+		throw;
+	}
+	size_t n = (length - sizeof(BinaryHeader)) / sizeof(Record);
+	loadRecords(reinterpret_cast<const Record *>(begin + sizeof(BinaryHeader)), n, collector);
+	munmap(data, length);
+#else
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("crpropa::BinaryOutput: could not open file " + filename);
+	BinaryHeader header;
+	if (!in.read((char *) &header, sizeof(header)))
+		throw std::runtime_error("crpropa::BinaryOutput: could not read file " + filename);
+	checkHeader(header, filename);
+	std::vector<Record> records(4096);
+	while (in.read((char *) records.data(), records.size() * sizeof(Record)) || in.gcount() > 0)
+		loadRecords(records.data(), in.gcount() / sizeof(Record), collector);
+#endif
+}
+
+BinaryStream::BinaryStream(const std::string &filename) :
+		in(filename.c_str(), std::ios::binary), filename(filename), count(0), position(0) {
+	if (!in.good())
+		throw std::runtime_error("crpropa::BinaryStream: could not open file " + filename);
+	BinaryHeader header;
+	if (!in.read((char *) &header, sizeof(header)))
+		throw std::runtime_error("crpropa::BinaryStream: could not read file " + filename);
+	checkHeader(header, filename);
+	in.seekg(0, in.end);
+	count = (size_t(in.tellg()) - sizeof(BinaryHeader)) / sizeof(BinaryOutput::Record);
+	in.seekg(sizeof(BinaryHeader), in.beg);
+}
+
+size_t BinaryStream::size() const {
+	return count;
+}
+
+std::vector<ref_ptr<Candidate> > BinaryStream::next(size_t n) {
+	n = std::min(n, count - position);
+	records.resize(n);
+	if ((n > 0) && !in.read((char *) records.data(), n * sizeof(BinaryOutput::Record)))
+		throw std::runtime_error("crpropa::BinaryStream: could not read file " + filename);
+	position += n;
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	for (size_t i = 0; i < n; i++)
+		candidates[i] = BinaryOutput::fromRecord(records[i]);
+	return candidates;
+}
+
+std::string BinaryStream::getDescription() const {
+	std::stringstream ss;
+	ss << "BinaryStream: " << count << " candidates of " << filename;
+	return ss.str();
+}
+
+} // namespace crpropa
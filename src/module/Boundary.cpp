@@ -1,10 +1,40 @@
 #include "crpropa/module/Boundary.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <limits>
 #include <sstream>
 
 namespace crpropa {
 
+// distance along the direction d from r (relative to the lower corner) to the
+// surface of the cube, for straight trajectories
+static double rayDistanceCube(const Vector3d &r, const Vector3d &d, double size) {
+	double t = std::numeric_limits<double>::max();
+	if (d.x > 0)
+		t = std::min(t, (size - r.x) / d.x);
+	else if (d.x < 0)
+		t = std::min(t, -r.x / d.x);
+	if (d.y > 0)
+		t = std::min(t, (size - r.y) / d.y);
+	else if (d.y < 0)
+		t = std::min(t, -r.y / d.y);
+	if (d.z > 0)
+		t = std::min(t, (size - r.z) / d.z);
+	else if (d.z < 0)
+		t = std::min(t, -r.z / d.z);
+	return t;
+}
+
+// distance along the direction d from r (relative to the center) to the sphere
+static double rayDistanceSphere(const Vector3d &r, const Vector3d &d, double radius) {
+	double b = r.dot(d);
+	double discriminant = b * b - r.getR2() + radius * radius;
+	if (discriminant < 0)
+		return 0;
+	return -b + std::sqrt(discriminant);
+}
+
 PeriodicBox::PeriodicBox() :
 		origin(Vector3d(0, 0, 0)), size(Vector3d(0, 0, 0)) {
 }
@@ -15,10 +45,12 @@ PeriodicBox::PeriodicBox(Vector3d o, Vector3d s) :
 
 void PeriodicBox::process(Candidate *c) const {
 	Vector3d pos = c->current.getPosition();
-	Vector3d n = ((pos - origin) / size).floor();
-
-	if ((n.x == 0) and (n.y == 0) and (n.z == 0))
-		return; // do nothing if candidate is inside the box
+	Vector3d r = pos - origin;
+	// do nothing if candidate is inside the box, without dividing
+	if ((r.x >= 0) and (r.x < size.x) and (r.y >= 0) and (r.y < size.y)
+			and (r.z >= 0) and (r.z < size.z))
+		return;
+	Vector3d n = (r / size).floor();
 
 	c->current.setPosition(pos - n * size);
 	c->previous.setPosition(c->previous.getPosition() - n * size);
@@ -26,6 +58,11 @@ void PeriodicBox::process(Candidate *c) const {
 	c->created.setPosition(c->created.getPosition() - n * size);
 }
 
+void PeriodicBox::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		PeriodicBox::process(candidates[i]);
+}
+
 void PeriodicBox::setOrigin(Vector3d o) {
 	origin = o;
 }
@@ -49,11 +86,12 @@ ReflectiveBox::ReflectiveBox(Vector3d o, Vector3d s) :
 }
 
 void ReflectiveBox::process(Candidate *c) const {
-	Vector3d cur = (c->current.getPosition() - origin) / size; // current position in cell units
-	Vector3d n = cur.floor();
-
-	if ((n.x == 0) and (n.y == 0) and (n.z == 0))
+	Vector3d r = c->current.getPosition() - origin;
+	if ((r.x >= 0) and (r.x < size.x) and (r.y >= 0) and (r.y < size.y)
+			and (r.z >= 0) and (r.z < size.z))
 		return; // do nothing if candidate is inside the box
+	Vector3d cur = r / size; // current position in cell units
+	Vector3d n = cur.floor();
 
 	// flip direction
 	Vector3d nReflect(pow(-1, n.x), pow(-1, n.y), pow(-1, n.z));
@@ -95,6 +133,11 @@ void ReflectiveBox::process(Candidate *c) const {
 	c->previous.setPosition(prv * size + origin);
 }
 
+void ReflectiveBox::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		ReflectiveBox::process(candidates[i]);
+}
+
 void ReflectiveBox::setOrigin(Vector3d o) {
 	origin = o;
 }
@@ -110,26 +153,44 @@ std::string ReflectiveBox::getDescription() const {
 }
 
 CubicBoundary::CubicBoundary() :
-		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), margin(0.1 * kpc) {
+		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), margin(0.1 * kpc), directionAware(false) {
 }
 
 CubicBoundary::CubicBoundary(Vector3d o, double s) :
-		origin(o), size(s), limitStep(true), margin(0.1 * kpc) {
+		origin(o), size(s), limitStep(true), margin(0.1 * kpc), directionAware(false) {
 }
 
 void CubicBoundary::process(Candidate *c) const {
 	Vector3d r = c->current.getPosition() - origin;
 	double lo = r.min();
 	double hi = r.max();
-	if ((lo <= 0) or (hi >= size)) {
+	bool outside = (lo <= 0) or (hi >= size);
+	if (outside) {
 		reject(c);
 	}
 	if (limitStep) {
-		c->limitNextStep(lo + margin);
-		c->limitNextStep(size - hi + margin);
+		double distance = std::min(lo, size - hi);
+		if (directionAware and not outside and (c->current.getCharge() == 0))
+			distance = std::max(distance, rayDistanceCube(r, c->current.getDirection(), size));
+		c->limitNextStep(distance + margin);
 	}
 }
 
+void CubicBoundary::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		CubicBoundary::process(candidates[i]);
+}
+
+double CubicBoundary::getStepLimit(const Candidate *c) const {
+	if (not limitStep)
+		return std::numeric_limits<double>::max();
+	Vector3d r = c->current.getPosition() - origin;
+	double distance = std::min(r.min(), size - r.max());
+	if (directionAware and (distance > 0) and (c->current.getCharge() == 0))
+		distance = std::max(distance, rayDistanceCube(r, c->current.getDirection(), size));
+	return distance + margin;
+}
+
 void CubicBoundary::setOrigin(Vector3d o) {
 	origin = o;
 }
@@ -142,6 +203,29 @@ void CubicBoundary::setMargin(double m) {
 void CubicBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void CubicBoundary::setDirectionAware(bool b) {
+	directionAware = b;
+}
+
+Vector3d CubicBoundary::getOrigin() const {
+	return origin;
+}
+
+double CubicBoundary::getSize() const {
+	return size;
+}
+
+double CubicBoundary::getMargin() const {
+	return margin;
+}
+
+bool CubicBoundary::getLimitStep() const {
+	return limitStep;
+}
+
+bool CubicBoundary::getDirectionAware() const {
+	return directionAware;
+}
 
 std::string CubicBoundary::getDescription() const {
 	std::stringstream s;
@@ -155,20 +239,41 @@ std::string CubicBoundary::getDescription() const {
 }
 
 SphericalBoundary::SphericalBoundary() :
-		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), margin(0.1 * kpc) {
+		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), margin(0.1 * kpc), directionAware(false) {
 }
 
 SphericalBoundary::SphericalBoundary(Vector3d c, double r) :
-		center(c), radius(r), limitStep(true), margin(0.1 * kpc) {
+		center(c), radius(r), limitStep(true), margin(0.1 * kpc), directionAware(false) {
 }
 
 void SphericalBoundary::process(Candidate *c) const {
-	double d = (c->current.getPosition() - center).getR();
-	if (d >= radius) {
+	Vector3d r = c->current.getPosition() - center;
+	double d = r.getR();
+	bool outside = d >= radius;
+	if (outside) {
 		reject(c);
 	}
-	if (limitStep)
-		c->limitNextStep(radius - d + margin);
+	if (limitStep) {
+		double distance = radius - d;
+		if (directionAware and not outside and (c->current.getCharge() == 0))
+			distance = rayDistanceSphere(r, c->current.getDirection(), radius);
+		c->limitNextStep(distance + margin);
+	}
+}
+
+void SphericalBoundary::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		SphericalBoundary::process(candidates[i]);
+}
+
+double SphericalBoundary::getStepLimit(const Candidate *c) const {
+	if (not limitStep)
+		return std::numeric_limits<double>::max();
+	Vector3d r = c->current.getPosition() - center;
+	double distance = radius - r.getR();
+	if (directionAware and (distance > 0) and (c->current.getCharge() == 0))
+		distance = rayDistanceSphere(r, c->current.getDirection(), radius);
+	return distance + margin;
 }
 
 void SphericalBoundary::setCenter(Vector3d c) {
@@ -183,6 +288,29 @@ void SphericalBoundary::setMargin(double m) {
 void SphericalBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void SphericalBoundary::setDirectionAware(bool b) {
+	directionAware = b;
+}
+
+Vector3d SphericalBoundary::getCenter() const {
+	return center;
+}
+
+double SphericalBoundary::getRadius() const {
+	return radius;
+}
+
+double SphericalBoundary::getMargin() const {
+	return margin;
+}
+
+bool SphericalBoundary::getLimitStep() const {
+	return limitStep;
+}
+
+bool SphericalBoundary::getDirectionAware() const {
+	return directionAware;
+}
 
 std::string SphericalBoundary::getDescription() const {
 	std::stringstream s;
@@ -291,4 +419,128 @@ std::string CylindricalBoundary::getDescription() const {
 	return s.str();
 }
 
+SimulationDomain::SimulationDomain() :
+		periodic(false), shape(NoBoundary), size(0), margin(0.1 * kpc), limitStep(true), directionAware(false) {
+}
+
+void SimulationDomain::setPeriodicBox(Vector3d o, Vector3d s) {
+	periodic = true;
+	periodicOrigin = o;
+	periodicSize = s;
+}
+
+void SimulationDomain::setCubicBoundary(Vector3d o, double s) {
+	shape = Cube;
+	origin = o;
+	size = s;
+}
+
+void SimulationDomain::setSphericalBoundary(Vector3d c, double r) {
+	shape = Sphere;
+	origin = c;
+	size = r;
+}
+
+void SimulationDomain::clear() {
+	periodic = false;
+	shape = NoBoundary;
+}
+
+SimulationDomain::Shape SimulationDomain::getShape() const {
+	return shape;
+}
+
+bool SimulationDomain::isPeriodic() const {
+	return periodic;
+}
+
+void SimulationDomain::setMargin(double m) {
+	margin = m;
+}
+
+void SimulationDomain::setLimitStep(bool b) {
+	limitStep = b;
+}
+
+void SimulationDomain::setDirectionAware(bool b) {
+	directionAware = b;
+}
+
+void SimulationDomain::wrap(Candidate *c, const Vector3d &shift) const {
+	c->current.setPosition(c->current.getPosition() - shift);
+	c->previous.setPosition(c->previous.getPosition() - shift);
+	c->source.setPosition(c->source.getPosition() - shift);
+	c->created.setPosition(c->created.getPosition() - shift);
+}
+
+// signed distance to the boundary, negative outside; along the direction for neutral particles if enabled
+double SimulationDomain::boundaryDistance(const Vector3d &position, const Candidate *c) const {
+	bool straight = directionAware and (c->current.getCharge() == 0);
+	if (shape == Cube) {
+		Vector3d r = position - origin;
+		double distance = std::min(r.min(), size - r.max());
+		if (straight and (distance > 0))
+			distance = std::max(distance, rayDistanceCube(r, c->current.getDirection(), size));
+		return distance;
+	}
+	Vector3d r = position - origin;
+	double distance = size - r.getR();
+	if (straight and (distance > 0))
+		distance = rayDistanceSphere(r, c->current.getDirection(), size);
+	return distance;
+}
+
+void SimulationDomain::process(Candidate *c) const {
+	Vector3d position = c->current.getPosition();
+	if (periodic) {
+		Vector3d r = position - periodicOrigin;
+		if ((r.x < 0) or (r.x >= periodicSize.x) or (r.y < 0) or (r.y >= periodicSize.y)
+				or (r.z < 0) or (r.z >= periodicSize.z)) {
+			Vector3d shift = (r / periodicSize).floor() * periodicSize;
+			wrap(c, shift);
+			position -= shift;
+		}
+	}
+	if (shape == NoBoundary)
+		return;
+
+	double distance = boundaryDistance(position, c);
+	if (distance <= 0)
+		reject(c);
+	if (limitStep)
+		c->limitNextStep(distance + margin);
+}
+
+void SimulationDomain::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		SimulationDomain::process(candidates[i]);
+}
+
+double SimulationDomain::getStepLimit(const Candidate *c) const {
+	if ((shape == NoBoundary) or not limitStep)
+		return std::numeric_limits<double>::max();
+	Vector3d position = c->current.getPosition();
+	if (periodic) {
+		Vector3d r = position - periodicOrigin;
+		position -= (r / periodicSize).floor() * periodicSize;
+	}
+	return boundaryDistance(position, c) + margin;
+}
+
+std::string SimulationDomain::getDescription() const {
+	std::stringstream s;
+	s << "Simulation domain: ";
+	if (periodic)
+		s << "periodic box: origin " << periodicOrigin / Mpc << " Mpc, size " << periodicSize / Mpc << " Mpc, ";
+	if (shape == Cube)
+		s << "cubic boundary: origin " << origin / Mpc << " Mpc, size " << size / Mpc << " Mpc, ";
+	else if (shape == Sphere)
+		s << "spherical boundary: radius " << size / Mpc << " Mpc around " << origin / Mpc << " Mpc, ";
+	s << "Flag: '" << rejectFlagKey << "' -> '" << rejectFlagValue << "', ";
+	s << "MakeInactive: " << (makeRejectedInactive ? "yes" : "no");
+	if (rejectAction.valid())
+		s << ", Action: " << rejectAction->getDescription();
+	return s.str();
+}
+
 } // namespace crpropa
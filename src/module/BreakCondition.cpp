@@ -63,6 +63,12 @@ void MaximumTrajectoryLength::process(Candidate *c) const {
 	}
 }
 
+void MaximumTrajectoryLength::processBatch(Candidate **candidates,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		MaximumTrajectoryLength::process(candidates[i]);
+}
+
 //*****************************************************************************
 MinimumEnergy::MinimumEnergy(double minEnergy) :
 		minEnergy(minEnergy) {
@@ -83,6 +89,11 @@ void MinimumEnergy::process(Candidate *c) const {
 		reject(c);
 }
 
+void MinimumEnergy::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		MinimumEnergy::process(candidates[i]);
+}
+
 std::string MinimumEnergy::getDescription() const {
 	std::stringstream s;
 	s << "Minimum energy: " << minEnergy / EeV << " EeV, ";
@@ -263,5 +274,95 @@ void DetectionLength::process(Candidate *c) const {
 	}
 }
 
+//*****************************************************************************
+void ConditionList::add(AbstractCondition *condition) {
+	Kind kind = Generic;
+	if (dynamic_cast<MaximumTrajectoryLength *>(condition))
+		kind = TrajectoryLength;
+	else if (dynamic_cast<MinimumEnergy *>(condition))
+		kind = Energy;
+	else if (dynamic_cast<MinimumRigidity *>(condition))
+		kind = Rigidity;
+	else if (dynamic_cast<MinimumRedshift *>(condition))
+		kind = Redshift;
+	else if (dynamic_cast<MinimumChargeNumber *>(condition))
+		kind = ChargeNumber;
+	conditions.push_back(condition);
+	kinds.push_back(kind);
+}
+
+size_t ConditionList::size() const {
+	return conditions.size();
+}
+
+std::string ConditionList::getDescription() const {
+	std::stringstream s;
+	s << "ConditionList: " << conditions.size() << " conditions\n";
+	for (size_t i = 0; i < conditions.size(); i++)
+		s << "  " << conditions[i]->getDescription() << "\n";
+	return s.str();
+}
+
+void ConditionList::process(Candidate *c) const {
+	if (!c->isActive())
+		return;
+
+	// candidate state, read again after a condition was processed
+	bool read = false;
+	double length = 0, energy = 0, rigidity = 0, redshift = 0;
+	int Z = 0;
+
+	for (size_t i = 0; i < conditions.size(); i++) {
+		const AbstractCondition *condition = conditions[i];
+		if (!read) {
+			const ParticleState &state = c->current;
+			length = c->getTrajectoryLength();
+			energy = state.getEnergy();
+			rigidity = state.getRigidity();
+			redshift = c->getRedshift();
+			Z = chargeNumber(state.getId());
+			read = true;
+		}
+
+		bool passed = false;
+		switch (kinds[i]) {
+		case TrajectoryLength: {
+			const MaximumTrajectoryLength *m =
+					static_cast<const MaximumTrajectoryLength *>(condition);
+			if (m->observerPositions.empty() && (length < m->maxLength)) {
+				c->limitNextStep(m->maxLength - length);
+				passed = true;
+			}
+			break;
+		}
+		case Energy:
+			passed = energy > static_cast<const MinimumEnergy *>(condition)->minEnergy;
+			break;
+		case Rigidity:
+			passed = !(rigidity < static_cast<const MinimumRigidity *>(condition)->minRigidity);
+			break;
+		case Redshift:
+			passed = redshift > static_cast<const MinimumRedshift *>(condition)->zmin;
+			break;
+		case ChargeNumber:
+			passed = Z > static_cast<const MinimumChargeNumber *>(condition)->minChargeNumber;
+			break;
+		default:
+			break;
+		}
+		if (passed)
+			continue;
+
+		condition->process(c);
+		if (!c->isActive())
+			return;
+		read = false;
+	}
+}
+
+void ConditionList::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		ConditionList::process(candidates[i]);
+}
 
 } // namespace crpropa
@@ -1,20 +1,23 @@
 #include "crpropa/module/CandidateSplitting.h"
+#include "crpropa/Random.h"
+
+#include <algorithm>
 
 namespace crpropa {
 
-CandidateSplitting::CandidateSplitting() {
+CandidateSplitting::CandidateSplitting() : target(0) {
 	// no particle splitting if EnergyBins and NSplit are not specified
 	setNsplit(0);
 	setMinimalWeight(1.);
 }
 
-CandidateSplitting::CandidateSplitting(int nSplit, double Emin, double Emax,  double nBins, double minWeight, bool log) {
+CandidateSplitting::CandidateSplitting(int nSplit, double Emin, double Emax,  double nBins, double minWeight, bool log) : target(0) {
 	setNsplit(nSplit);
 	setEnergyBins(Emin, Emax, nBins, log);
 	setMinimalWeight(minWeight);
 }
 
-CandidateSplitting::CandidateSplitting(double spectralIndex, double Emin, int nBins)  {
+CandidateSplitting::CandidateSplitting(double spectralIndex, double Emin, int nBins) : target(0) {
 	// to use with Diffusive Shock Acceleration
 	if (spectralIndex > 0){
 		throw std::runtime_error(
@@ -31,48 +34,67 @@ void CandidateSplitting::process(Candidate *c) const {
 	double currE = c->current.getEnergy(); 
 	double prevE = c->previous.getEnergy();
 
-	if (c->getWeight() <= minWeight){
-		// minimal weight reached, no splitting
+	if (nSplit == 0 || Ebins.empty())
 		return;
-	}
-	if (currE < Ebins[0] || nSplit == 0 ){
-		// current energy is smaller than first bin -> no splitting
-		// or, number of splits = 0
+	if ((target == 0) && (c->getWeight() <= minWeight)){
+		// minimal weight reached, no splitting
 		return;
 	}
-	for (size_t i = 0; i < Ebins.size(); ++i){
-		
-		if( prevE < Ebins[i] ){
-			// previous energy is in energy bin [i-1, i]
-			if(currE < Ebins[i]){
-				//assuming that dE greater than 0, prevE and E in same energy bin -> no splitting
-				return;
-			}
-			// current energy is in energy bin [i,i+1] or higher -> particle splitting for each crossing
-			for (size_t j = i; j < Ebins.size(); ++j ){
-
-				// adapted from Acceleration Module:
-				c->updateWeight(1. / nSplit); // * 1/n_split
-
-				for (int i = 1; i < nSplit; i++) {
-				
-					ref_ptr<Candidate> new_candidate = c->clone(false);
-					new_candidate->parent = c;
-					new_candidate->previous.setEnergy(currE); // so that new candidate is not split again in next step!
-					c->addSecondary(new_candidate);
-				}
-				if (j < Ebins.size()-1 && currE < Ebins[j+1]){
-					// candidate is in energy bin [j, j+1] -> no further splitting
-					return;
-				}
-			}
+
+	// bins [first, last) have prevE < Ebins[i] <= currE and are crossed
+	size_t first = std::upper_bound(Ebins.begin(), Ebins.end(), prevE) - Ebins.begin();
+	size_t last = std::upper_bound(Ebins.begin(), Ebins.end(), currE) - Ebins.begin();
+	for (size_t i = first; i < last; ++i) {
+		if (target == 0)
+			split(c, nSplit, currE); // particle splitting for each crossing
+		else if (!control(c, i, currE))
 			return;
+	}
+}
+
+void CandidateSplitting::split(Candidate *c, int n, double currE) const {
+	// adapted from Acceleration Module:
+	c->updateWeight(1. / n); // * 1/n_split
+
+	for (int i = 1; i < n; i++) {
+		ref_ptr<Candidate> new_candidate = c->clone(false);
+		new_candidate->parent = c;
+		new_candidate->previous.setEnergy(currE); // so that new candidate is not split again in next step!
+		c->addSecondary(new_candidate);
+	}
+}
+
+bool CandidateSplitting::control(Candidate *c, size_t bin, double currE) const {
+	uint64_t count;
+#pragma omp atomic capture
+	count = ++entries[bin];
+
+	if (count <= target) {
+		if (c->getWeight() <= minWeight)
+			return true;
+		// split, without overfilling the bin
+		int n = std::min<uint64_t>(nSplit, target - count + 1);
+		if (n > 1) {
+#pragma omp atomic
+			entries[bin] += n - 1;
+			split(c, n, currE);
 		}
+		return true;
+	}
+
+	// Russian roulette, the weight is conserved on average
+	double survival = double(target) / count;
+	if (Random::instance().rand() < survival) {
+		c->updateWeight(1. / survival);
+		return true;
 	}
+	c->setActive(false);
+	return false;
 }
 
 void CandidateSplitting::setEnergyBins(double Emin, double Emax, double nBins, bool log) {
 	Ebins.resize(0);
+	entries.assign(nBins, 0);
 	if (Emin > Emax){
 		throw std::runtime_error(
 				"CandidateSplitting: Emin > Emax!");
@@ -89,6 +111,7 @@ void CandidateSplitting::setEnergyBins(double Emin, double Emax, double nBins, b
 
 void CandidateSplitting::setEnergyBinsDSA(double Emin, double dE, int n) {
 	Ebins.resize(0);
+	entries.assign(n, 0);
 	for (size_t i = 1; i < n + 1; ++i) {
 		Ebins.push_back(Emin * pow(dE, i));
 	}
@@ -114,5 +137,24 @@ double CandidateSplitting::getMinimalWeight() const {
 	return minWeight;
 }
 
+void CandidateSplitting::setPopulationControl(uint64_t t) {
+	target = t;
+	resetPopulation();
+}
+
+uint64_t CandidateSplitting::getPopulationControl() const {
+	return target;
+}
+
+uint64_t CandidateSplitting::getPopulation(size_t i) const {
+	if (i >= entries.size())
+		throw std::runtime_error("CandidateSplitting: no energy bin " + std::to_string(i));
+	return entries[i];
+}
+
+void CandidateSplitting::resetPopulation() {
+	entries.assign(Ebins.size(), 0);
+}
+
 } // end namespace crpropa
 
@@ -0,0 +1,116 @@
+#include "crpropa/module/CompositePropagation.h"
+#include "crpropa/SymbolTable.h"
+#include "crpropa/Units.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+CompositePropagation::CompositePropagation(ref_ptr<Module> propagation) :
+		weakFieldIndex(0), minFieldStrength(0), larmorRatio(0) {
+	if (!propagation.valid())
+		throw std::runtime_error("CompositePropagation: no default propagation module");
+	propagations.push_back(propagation);
+}
+
+size_t CompositePropagation::addPropagation(ref_ptr<Module> propagation) {
+	if (!propagation.valid())
+		throw std::runtime_error("CompositePropagation: invalid propagation module");
+	for (size_t i = 0; i < propagations.size(); i++)
+		if (propagations[i] == propagation)
+			return i;
+	propagations.push_back(propagation);
+	return propagations.size() - 1;
+}
+
+void CompositePropagation::addRegion(ref_ptr<Surface> region, ref_ptr<Module> propagation) {
+	if (!region.valid())
+		throw std::runtime_error("CompositePropagation: invalid region");
+	Region r;
+	r.surface = region;
+	r.index = addPropagation(propagation);
+	regions.push_back(r);
+}
+
+void CompositePropagation::setWeakField(ref_ptr<Module> propagation,
+		ref_ptr<MagneticField> f, double minField, double ratio) {
+	if (minField < 0)
+		throw std::runtime_error("CompositePropagation: minFieldStrength < 0");
+	if (ratio < 0)
+		throw std::runtime_error("CompositePropagation: larmorRatio < 0");
+	weakFieldIndex = addPropagation(propagation);
+	field = f;
+	minFieldStrength = minField;
+	larmorRatio = ratio;
+}
+
+size_t CompositePropagation::select(const Candidate *candidate) const {
+	const Vector3d &pos = candidate->current.getPosition();
+	for (size_t i = 0; i < regions.size(); i++)
+		if (regions[i].surface->distance(pos) < 0)
+			return regions[i].index;
+
+	if (weakFieldIndex == 0)
+		return 0;
+
+	double B = 0;
+	if (field.valid())
+		B = field->getField(pos, candidate->getRedshift()).getR();
+	if (B < minFieldStrength)
+		return weakFieldIndex;
+
+	if (larmorRatio > 0) {
+		double q = std::fabs(candidate->current.getCharge());
+		if (q == 0)
+			return weakFieldIndex;
+		double rL = candidate->current.getEnergy() / (q * c_light * B);
+		if (rL > larmorRatio * candidate->getNextStep())
+			return weakFieldIndex;
+	}
+	return 0;
+}
+
+ref_ptr<Module> CompositePropagation::getPropagation(size_t i) const {
+	if (i >= propagations.size())
+		throw std::runtime_error("CompositePropagation: index out of range");
+	return propagations[i];
+}
+
+size_t CompositePropagation::size() const {
+	return propagations.size();
+}
+
+void CompositePropagation::process(Candidate *candidate) const {
+	static const Symbol PI = SymbolTable::intern("PropagationIndex");
+	size_t i = select(candidate);
+
+	// hand over the step resolution reached so far when the module changes
+	if (!candidate->hasProperty(PI)) {
+		candidate->setProperty(PI, Variant::fromUInt64(i));
+	} else if (candidate->getProperty(PI).asUInt64() != i) {
+		if (candidate->getCurrentStep() > 0)
+			candidate->limitNextStep(candidate->getCurrentStep());
+		candidate->setProperty(PI, Variant::fromUInt64(i));
+	}
+
+	propagations[i]->process(candidate);
+}
+
+std::string CompositePropagation::getDescription() const {
+	std::stringstream s;
+	s << "CompositePropagation\n    default: " << propagations[0]->getDescription();
+	for (size_t i = 0; i < regions.size(); i++)
+		s << "\n    in " << regions[i].surface->getDescription() << ": "
+				<< propagations[regions[i].index]->getDescription();
+	if (weakFieldIndex > 0) {
+		s << "\n    B < " << minFieldStrength / nG << " nG";
+		if (larmorRatio > 0)
+			s << " or r_L > " << larmorRatio << " * step";
+		s << ": " << propagations[weakFieldIndex]->getDescription();
+	}
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,4 +1,6 @@
 #include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/RunStatistics.h"
+#include "crpropa/Vector3Simd.h"
 
 
 using namespace crpropa;
@@ -44,16 +46,30 @@ DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, ref_ptr<Advecti
 	setAlpha(1./3.);
   	}
 
-void DiffusionSDE::process(Candidate *candidate) const {
-
+// State of one candidate during a step
+struct DiffusionSDE::Step {
+	Candidate *candidate;
+	double h; // time step
+	double z;
+	double TStep, NStep, BStep; // random steps along the field line coordinates
+	double propTime; // time of the tried or executed field line sub-steps
+	size_t counter; // number of tried sub-step sizes
+	size_t stepNumber; // number of executed sub-steps
+	Vector3d PosIn, Start, k0, PosOut, PosErr;
+	Vector3d normal; // random vector for the normal direction
+	double coneCos; // random cosine and vector of the direction around the tangent
+	Vector3d coneVector;
+};
+
+bool DiffusionSDE::beginStep(Candidate *candidate, Step &step) const {
     // save the new previous particle state
-
 	ParticleState &current = candidate->current;
-	candidate->previous = current;
+	candidate->savePrevious();
 
-	double h = clip(candidate->getNextStep(), minStep, maxStep) / c_light;
-	Vector3d PosIn = current.getPosition();
-	Vector3d DirIn = current.getDirection();
+	step.candidate = candidate;
+	step.h = clip(candidate->getNextStep(), minStep, maxStep) / c_light;
+	step.PosIn = current.getPosition();
+	double h = step.h;
 
     // rectilinear propagation for neutral particles
     // If an advection field is provided the drift is also included
@@ -69,62 +85,172 @@ void DiffusionSDE::process(Candidate *candidate) const {
 		current.setPosition(Pos + LinProp + dir*h*c_light);
 		candidate->setCurrentStep(h * c_light);
 		candidate->setNextStep(maxStep);
-		return;
+		return false;
 	}
 
-	double z = candidate->getRedshift();
+	step.z = candidate->getRedshift();
 	double rig = current.getEnergy() / current.getCharge();
 
-
     // Calculate the Diffusion tensor
 	double BTensor[] = {0., 0., 0., 0., 0., 0., 0., 0., 0.};
-	calculateBTensor(rig, BTensor, PosIn, DirIn, z);
-
+	calculateBTensor(rig, BTensor, step.PosIn, current.getDirection(), step.z);
 
-    // Generate random numbers
+    // Generate all random numbers of the step, in the same order for
+    // process and processBatch
+	Random &random = Random::instance();
 	double eta[] = {0., 0., 0.};
-	for(size_t i=0; i < 3; i++) {
-	  	eta[i] =  Random::instance().randNorm();
+	random.randNorm(eta, 3);
+	step.normal = random.randVector();
+	step.coneCos = random.randUniform(1, cos(M_PI/2.));
+	step.coneVector = random.randVector();
+
+	step.TStep = BTensor[0] * eta[0];
+	step.NStep = BTensor[4] * eta[1];
+	step.BStep = BTensor[8] * eta[2];
+
+	step.propTime = step.TStep * sqrt(h) / c_light;
+	step.counter = 0;
+	step.Start = step.PosIn;
+	return true;
+}
+
+bool DiffusionSDE::retryStep(Step &step) const {
+    // calculate the relative position error r and the next time step
+	double r = step.PosErr.getR() / tolerance;
+	step.propTime *= 0.5;
+	step.counter += 1;
+	RunStatistics::count("DiffusionSDE: trial steps");
+	if (r > 1 && fabs(step.propTime) >= minStep/c_light) {
+		RunStatistics::count("DiffusionSDE: rejected steps");
+		return true;
 	}
 
-	double TStep = BTensor[0] * eta[0];
-	double NStep = BTensor[4] * eta[1];
-	double BStep = BTensor[8] * eta[2];
+	step.stepNumber = pow(2, step.counter-1);
+	step.propTime = step.TStep * sqrt(step.h) / c_light / step.stepNumber;
+	return false;
+}
 
-	Vector3d TVec(0.);
-	Vector3d NVec(0.);
-	Vector3d BVec(0.);
+void DiffusionSDE::process(Candidate *candidate) const {
+	Step step;
+	if (!beginStep(candidate, step))
+		return;
 
-	Vector3d DirOut = Vector3d(0.);
+	// the field direction at PosIn is the same for all tried steps
+	step.k0 = getMagneticFieldAtPosition(step.PosIn, step.z).getUnitVector() * c_light;
+	do {
+		step.PosErr = Vector3d(0.);
+	  	tryStep(step.PosIn, step.k0, step.PosOut, step.PosErr, step.z, step.propTime);
+    // Check for better break condition
+	} while (retryStep(step));
 
+	// the accepted trial step is the first sub-step
+	for (size_t j=1; j<step.stepNumber; j++) {
+		step.Start = step.PosOut;
+		tryStep(step.Start, step.PosOut, step.PosErr, step.z, step.propTime);
+	}
 
-	double propTime = TStep * sqrt(h) / c_light;
-	size_t counter = 0;
-	double r=42.; //arbitrary number larger than one
+	finishStep(step);
+}
 
-	do {
-		Vector3d PosOut = Vector3d(0.);
-		Vector3d PosErr = Vector3d(0.);
-	  	tryStep(PosIn, PosOut, PosErr, z, propTime);
-	    // calculate the relative position error r and the next time step h
-	  	r = PosErr.getR() / tolerance;
-	  	propTime *= 0.5;
-		counter += 1;
+void DiffusionSDE::processBatch(Candidate **candidates, size_t n) const {
+	static thread_local std::vector<Step> steps;
+	static thread_local std::vector<Step *> charged, pending;
+	steps.resize(n);
+	charged.clear();
+	for (size_t i = 0; i < n; i++)
+		if (beginStep(candidates[i], steps[i]))
+			charged.push_back(&steps[i]);
+
+	// search the sub-step size in rounds over the candidates that still
+	// reduce it, the field direction at PosIn is the same for all rounds
+	pending = charged;
+	for (bool first = true; !pending.empty(); first = false) {
+		tryStepBatch(&pending[0], pending.size(), first);
+		size_t m = 0;
+		for (size_t i = 0; i < pending.size(); i++)
+			if (retryStep(*pending[i]))
+				pending[m++] = pending[i];
+		pending.resize(m);
+	}
 
-    // Check for better break condition
-	} while (r > 1 && fabs(propTime) >= minStep/c_light);
+	// the remaining sub-steps after the accepted trial step
+	pending.clear();
+	for (size_t i = 0; i < charged.size(); i++)
+		if (charged[i]->stepNumber > 1)
+			pending.push_back(charged[i]);
+	for (size_t j = 1; !pending.empty(); j++) {
+		for (size_t i = 0; i < pending.size(); i++)
+			pending[i]->Start = pending[i]->PosOut;
+		tryStepBatch(&pending[0], pending.size(), true);
+		size_t m = 0;
+		for (size_t i = 0; i < pending.size(); i++)
+			if (pending[i]->stepNumber > j + 1)
+				pending[m++] = pending[i];
+		pending.resize(m);
+	}
 
+	for (size_t i = 0; i < charged.size(); i++)
+		finishStep(*charged[i]);
+}
 
-	size_t stepNumber = pow(2, counter-1);
-	double allowedTime = TStep * sqrt(h) / c_light / stepNumber;
-	Vector3d Start = PosIn;
-	Vector3d PosOut = Vector3d(0.);
-	Vector3d PosErr = Vector3d(0.);
-	for (size_t j=0; j<stepNumber; j++) {
-		tryStep(Start, PosOut, PosErr, z, allowedTime);
-		Start = PosOut;
+void DiffusionSDE::tryStepBatch(Step **steps, size_t n, bool newStart) const {
+	static thread_local std::vector<Vector3d> k, positions, fields;
+	k.resize(6 * n);
+	positions.resize(n);
+	fields.resize(n);
+	for (size_t j = 0; j < n; j++) {
+		steps[j]->PosOut = steps[j]->Start;
+		steps[j]->PosErr = Vector3d(0.);
 	}
 
+	for (size_t i = 0; i < 6; i++) {
+		if ((i == 0) && !newStart) {
+			for (size_t j = 0; j < n; j++)
+				k[j * 6] = steps[j]->k0;
+		} else {
+			for (size_t j = 0; j < n; j++) {
+				Vector3d y_n = steps[j]->Start;
+				for (size_t l = 0; l < i; l++)
+					y_n += k[j * 6 + l] * a[i * 6 + l] * steps[j]->propTime;
+				positions[j] = y_n;
+			}
+			// one field call per run of equal redshift
+			for (size_t first = 0; first < n;) {
+				size_t last = first + 1;
+				while ((last < n) && (steps[last]->z == steps[first]->z))
+					last++;
+				getMagneticFieldsAtPositions(&positions[first], &fields[first], last - first, steps[first]->z);
+				first = last;
+			}
+			for (size_t j = 0; j < n; j++) {
+				k[j * 6 + i] = fields[j].getUnitVector() * c_light;
+				if (i == 0)
+					steps[j]->k0 = k[j * 6];
+			}
+		}
+
+		for (size_t j = 0; j < n; j++) {
+			Step &s = *steps[j];
+			s.PosOut += k[j * 6 + i] * b[i] * s.propTime;
+			s.PosErr +=  (k[j * 6 + i] * (b[i] - bs[i])) * s.propTime / kpc;
+		}
+	}
+}
+
+void DiffusionSDE::finishStep(Step &step) const {
+	Candidate *candidate = step.candidate;
+	ParticleState &current = candidate->current;
+	double h = step.h;
+	Vector3d PosIn = step.PosIn;
+	Vector3d PosOut = step.PosOut;
+	double NStep = step.NStep;
+	double BStep = step.BStep;
+
+	Vector3d TVec(0.);
+	Vector3d NVec(0.);
+	Vector3d BVec(0.);
+	Vector3d DirOut = Vector3d(0.);
+
     // Normalize the tangent vector
 	TVec = (PosOut-PosIn).getUnitVector();
     // Exception: If the magnetic field vanishes: Use only advection.
@@ -153,6 +279,7 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
     // Choose a random perpendicular vector as the Normal-vector.
     // Prevent 'nan's in the NVec-vector in the case of <TVec, NVec> = 0.
+	NVec = TVec.cross(step.normal);
 	while (NVec.getR()==0.){
 	  	Vector3d RandomVector = Random::instance().randVector();
 	  	NVec = TVec.cross( RandomVector );
@@ -176,12 +303,12 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	bool NaN = std::isnan(PO.getR());
 	if (NaN == true){
 		  candidate->setActive(false);
-		  KISS_LOG_WARNING
+		  KISS_LOG_WARNING_LIMITED(10)
 			<< "\nCandidate with 'nan'-position occured: \n"
 		 	<< "position = " << PO << "\n"
 		  	<< "PosIn = " << PosIn << "\n"
 		  	<< "TVec = " << TVec << "\n"
-		  	<< "TStep = " << std::abs(TStep) << "\n"
+		  	<< "TStep = " << std::abs(step.TStep) << "\n"
 		  	<< "NVec = " << NVec << "\n"
 		  	<< "NStep = " << NStep << "\n"
 		  	<< "BVec = " << BVec << "\n"
@@ -191,15 +318,16 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	}
 
 	//DirOut = (PO - PosIn - LinProp).getUnitVector(); //Advection does not change the momentum vector
-	// Random direction around the tangential direction accounts for the pitch angle average.
-	DirOut = Random::instance().randConeVector(TVec, M_PI/2.);
+	// Random direction around the tangential direction accounts for the pitch angle average,
+	// as Random::randConeVector(TVec, M_PI/2.) from the numbers drawn in beginStep
+	DirOut = TVec.getRotated(TVec.cross(step.coneVector), acos(step.coneCos));
 	current.setPosition(PO);
 	current.setDirection(DirOut);
 	candidate->setCurrentStep(h * c_light);
 
 	double nextStep;
-	if (stepNumber>1){
-		nextStep = h*pow(stepNumber, -2.)*c_light;
+	if (step.stepNumber>1){
+		nextStep = h*pow(step.stepNumber, -2.)*c_light;
 	}
 	else {
 		nextStep = 4 * h*c_light;
@@ -215,13 +343,13 @@ void DiffusionSDE::process(Candidate *candidate) const {
 /*
 	const std::string AL = "arcLength";
 	if (candidate->hasProperty(AL) == false){
-	  double arcLen = (TStep + NStep + BStep) * sqrt(h);
+	  double arcLen = (step.TStep + NStep + BStep) * sqrt(h);
 	  candidate->setProperty(AL, arcLen);
 	  return;
 	}
 	else {
 	  double arcLen = candidate->getProperty(AL);
-	  arcLen += (TStep + NStep + BStep) * sqrt(h);
+	  arcLen += (step.TStep + NStep + BStep) * sqrt(h);
 	  candidate->setProperty(AL, arcLen);
 	}
 */
@@ -230,25 +358,36 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
 
 void DiffusionSDE::tryStep(const Vector3d &PosIn, Vector3d &POut, Vector3d &PosErr,double z, double propStep) const {
+	Vector3d k0 = getMagneticFieldAtPosition(PosIn, z).getUnitVector() * c_light;
+	tryStep(PosIn, k0, POut, PosErr, z, propStep);
+}
+
+void DiffusionSDE::tryStep(const Vector3d &PosIn, const Vector3d &k0, Vector3d &POut, Vector3d &PosErr,double z, double propStep) const {
 
-	Vector3d k[] = {Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.)};
-	POut = PosIn;
+	Vector3dSimd k[6];
+	Vector3dSimd in(PosIn), out(PosIn), err(PosErr);
 	//calculate the sum k_i * b_i
 	for (size_t i = 0; i < 6; i++) {
 
-		Vector3d y_n = PosIn;
+		Vector3dSimd y_n = in;
 		for (size_t j = 0; j < i; j++)
 		  y_n += k[j] * a[i * 6 + j] * propStep;
 
-		// update k_i = direction of the regular magnetic mean field
-		Vector3d BField = getMagneticFieldAtPosition(y_n, z);
-
-		k[i] = BField.getUnitVector() * c_light;
+		// update k_i = direction of the regular magnetic mean field,
+		// the first stage does not depend on the step size
+		if (i == 0) {
+			k[i] = k0;
+		} else {
+			Vector3dSimd BField = getMagneticFieldAtPosition(y_n, z);
+			k[i] = BField.getUnitVector() * c_light;
+		}
 
-		POut += k[i] * b[i] * propStep;
-		PosErr +=  (k[i] * (b[i] - bs[i])) * propStep / kpc;
+		out += k[i] * b[i] * propStep;
+		err +=  (k[i] * (b[i] - bs[i])) * propStep / kpc;
 
 	}
+	POut = out;
+	PosErr = err;
 }
 
 void DiffusionSDE::driftStep(const Vector3d &pos, Vector3d &linProp, double h) const {
@@ -259,10 +398,16 @@ void DiffusionSDE::driftStep(const Vector3d &pos, Vector3d &linProp, double h) c
 
 void DiffusionSDE::calculateBTensor(double r, double BTen[], Vector3d pos, Vector3d dir, double z) const {
 
-    double DifCoeff = scale * 6.1e24 * pow((std::abs(r) / 4.0e9), alpha);
+    double rigScale = scale * pow((std::abs(r) / 4.0e9), alpha);
+    double DifCoeff = rigScale * 6.1e24;
+    if (parallelGrid.valid())
+        DifCoeff = rigScale * std::max(0., (double)parallelGrid->interpolate(pos));
+    double DifCoeffPerp = epsilon * DifCoeff;
+    if (perpendicularGrid.valid())
+        DifCoeffPerp = rigScale * std::max(0., (double)perpendicularGrid->interpolate(pos));
     BTen[0] = pow( 2  * DifCoeff, 0.5);
-    BTen[4] = pow(2 * epsilon * DifCoeff, 0.5);
-    BTen[8] = pow(2 * epsilon * DifCoeff, 0.5);
+    BTen[4] = pow(2 * DifCoeffPerp, 0.5);
+    BTen[8] = pow(2 * DifCoeffPerp, 0.5);
     return;
 
 }
@@ -320,6 +465,14 @@ void DiffusionSDE::setAdvectionField(ref_ptr<AdvectionField> f) {
 	advectionField = f;
 }
 
+void DiffusionSDE::setDiffusionGrids(ref_ptr<Grid1f> parallel, ref_ptr<Grid1f> perpendicular) {
+	if (perpendicular.valid() && !parallel.valid())
+		throw std::runtime_error(
+				"DiffusionSDE: perpendicular diffusion grid without parallel grid");
+	parallelGrid = parallel;
+	perpendicularGrid = perpendicular;
+}
+
 double DiffusionSDE::getMinimumStep() const {
 	return minStep;
 }
@@ -344,6 +497,14 @@ double DiffusionSDE::getScale() const {
 	return scale;
 }
 
+ref_ptr<Grid1f> DiffusionSDE::getParallelDiffusionGrid() const {
+	return parallelGrid;
+}
+
+ref_ptr<Grid1f> DiffusionSDE::getPerpendicularDiffusionGrid() const {
+	return perpendicularGrid;
+}
+
 ref_ptr<MagneticField> DiffusionSDE::getMagneticField() const {
 	return magneticField;
 }
@@ -357,12 +518,25 @@ Vector3d DiffusionSDE::getMagneticFieldAtPosition(Vector3d pos, double z) const
 			B = magneticField->getField(pos, z);
 	}
 	catch (std::exception &e) {
-		KISS_LOG_ERROR 	<< "DiffusionSDE: Exception in DiffusionSDE::getMagneticFieldAtPosition.\n"
+		KISS_LOG_ERROR_LIMITED(10) << "DiffusionSDE: Exception in DiffusionSDE::getMagneticFieldAtPosition.\n"
 				<< e.what();
 	}	
 	return B;
 }
 
+void DiffusionSDE::getMagneticFieldsAtPositions(const Vector3d *pos, Vector3d *B, size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		B[i] = Vector3d(0, 0, 0);
+	try {
+		if (magneticField.valid())
+			magneticField->getFields(pos, B, n, z);
+	}
+	catch (std::exception &e) {
+		KISS_LOG_ERROR_LIMITED(10) << "DiffusionSDE: Exception in DiffusionSDE::getMagneticFieldsAtPositions.\n"
+				<< e.what();
+	}
+}
+
 ref_ptr<AdvectionField> DiffusionSDE::getAdvectionField() const {
 	return advectionField;
 }
@@ -376,7 +550,7 @@ Vector3d DiffusionSDE::getAdvectionFieldAtPosition(Vector3d pos) const {
 			AdvField = advectionField->getField(pos);
 	}
 	catch (std::exception &e) {
-		KISS_LOG_ERROR 	<< "DiffusionSDE: Exception in DiffusionSDE::getAdvectionFieldAtPosition.\n"
+		KISS_LOG_ERROR_LIMITED(10) << "DiffusionSDE: Exception in DiffusionSDE::getAdvectionFieldAtPosition.\n"
 				<< e.what();
 	}
 	return AdvField;
@@ -400,5 +574,12 @@ std::string DiffusionSDE::getDescription() const {
 	  s << "D_0: " << scale*6.1e24 << " m^2/s" << "\n";
 	  }
 
+	if (parallelGrid.valid()) {
+	  s << "D_par from grid";
+	  if (perpendicularGrid.valid())
+	    s << ", D_perp from grid";
+	  s << "\n";
+	  }
+
 	return s.str();
 }
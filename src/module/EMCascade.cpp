@@ -0,0 +1,222 @@
+#include "crpropa/module/EMCascade.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+static const int speciesId[2] = {22, 11};
+
+EMCascade::EMCascade(double minEnergy, double maxEnergy, size_t nEnergy,
+		double maxDistance, double step) : minEnergy(minEnergy),
+		maxEnergy(maxEnergy), nEnergy(nEnergy), maxDistance(maxDistance),
+		step(step), nSamples(1000), redshift(0) {
+	if ((minEnergy <= 0) or (maxEnergy <= minEnergy))
+		throw std::runtime_error("EMCascade: invalid energy range");
+	if (nEnergy == 0)
+		throw std::runtime_error("EMCascade: no energy bins");
+	if ((step <= 0) or (maxDistance < step))
+		throw std::runtime_error("EMCascade: invalid distance range");
+	nDistance = size_t(std::ceil(maxDistance / step));
+	injected.assign(nDistance * 2 * nEnergy, 0);
+	observed.assign(2 * nEnergy, 0);
+}
+
+void EMCascade::add(Module *interaction) {
+	interactions.add(interaction);
+	rates.clear();
+	yields.clear();
+}
+
+void EMCascade::setSamples(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("EMCascade: no samples");
+	nSamples = n;
+	rates.clear();
+	yields.clear();
+}
+
+void EMCascade::setRedshift(double z) {
+	redshift = z;
+	rates.clear();
+	yields.clear();
+}
+
+int EMCascade::species(int id) const {
+	if (id == 22)
+		return 0;
+	if (std::abs(id) == 11)
+		return 1;
+	return -1;
+}
+
+long EMCascade::index(int id, double E, double D) const {
+	int s = species(id);
+	if ((s < 0) or (E < minEnergy) or (E >= maxEnergy) or (D < 0) or (D >= maxDistance))
+		return -1;
+	size_t i = std::min(nEnergy - 1, size_t(nEnergy * std::log(E / minEnergy) / std::log(maxEnergy / minEnergy)));
+	size_t k = std::min(nDistance - 1, size_t(D / step));
+	return (k * 2 + s) * nEnergy + i;
+}
+
+void EMCascade::process(Candidate *candidate) const {
+	long idx = index(candidate->current.getId(), candidate->current.getEnergy(),
+			candidate->current.getPosition().getR());
+	if (idx < 0)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		injected[idx] += candidate->getWeight();
+	}
+	candidate->setActive(false);
+}
+
+void EMCascade::inject(int id, double E, double D, double w) {
+	long idx = index(id, E, D);
+	if (idx < 0)
+		throw std::runtime_error("EMCascade: particle outside of the range");
+	std::lock_guard<std::mutex> lock(mutex);
+	injected[idx] += w;
+}
+
+void EMCascade::initYields() {
+	rates.assign(2 * nEnergy, 0);
+	yields.assign(4 * nEnergy * nEnergy, 0);
+	double dlog = std::log(maxEnergy / minEnergy) / nEnergy;
+	Random &random = Random::instance();
+
+	for (size_t s = 0; s < 2; s++) {
+		for (size_t i = 0; i < nEnergy; i++) {
+			Candidate probe(speciesId[s], getEnergy(i));
+			probe.setRedshift(redshift);
+			double rate = interactions.getInteractionRate(&probe);
+			rates[s * nEnergy + i] = rate;
+			if (rate <= 0)
+				continue;
+
+			// mean number of particles per interaction in each bin, energies
+			// sampled within the primary bin
+			double *y = &yields[(s * nEnergy + i) * 2 * nEnergy];
+			for (size_t n = 0; n < nSamples; n++) {
+				double E = minEnergy * std::exp((i + random.rand()) * dlog);
+				Candidate c(speciesId[s], E);
+				c.setRedshift(redshift);
+				if (interactions.getInteractionRate(&c) > 0)
+					interactions.interact(&c);
+				if (c.isActive())
+					c.secondaries.push_back(new Candidate(c.current));
+				for (size_t k = 0; k < c.secondaries.size(); k++) {
+					const Candidate *p = c.secondaries[k];
+					int t = species(p->current.getId());
+					double Ep = p->current.getEnergy();
+					if ((t < 0) or (Ep < minEnergy))
+						continue;
+					// particles cannot gain energy, only rounding can move them up
+					size_t j = std::min(i, size_t(std::log(Ep / minEnergy) / dlog));
+					y[t * nEnergy + j] += p->getWeight();
+				}
+			}
+			for (size_t j = 0; j < 2 * nEnergy; j++)
+				y[j] /= nSamples;
+		}
+	}
+}
+
+void EMCascade::evolve(std::vector<double> &N, double dx) const {
+	const size_t n = nEnergy;
+	// implicit Euler step; energies only decrease, so the bins are solved
+	// from the highest energy down, coupling photons and electrons per bin
+	for (size_t i = n; i-- > 0;) {
+		double src[2] = {N[i], N[n + i]};
+		for (size_t s = 0; s < 2; s++) {
+			for (size_t j = i + 1; j < n; j++) {
+				double flux = dx * rates[s * n + j] * N[s * n + j];
+				if (flux == 0)
+					continue;
+				const double *y = &yields[(s * n + j) * 2 * n];
+				src[0] += flux * y[i];
+				src[1] += flux * y[n + i];
+			}
+		}
+		double r0 = dx * rates[i];
+		double r1 = dx * rates[n + i];
+		const double *y0 = &yields[i * 2 * n];
+		const double *y1 = &yields[(n + i) * 2 * n];
+		double a00 = 1 + r0 * (1 - y0[i]);
+		double a01 = -r1 * y1[i];
+		double a10 = -r0 * y0[n + i];
+		double a11 = 1 + r1 * (1 - y1[n + i]);
+		double det = a00 * a11 - a01 * a10;
+		N[i] = (a11 * src[0] - a01 * src[1]) / det;
+		N[n + i] = (a00 * src[1] - a10 * src[0]) / det;
+	}
+}
+
+void EMCascade::run() {
+	if (yields.empty())
+		initYields();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const size_t n = 2 * nEnergy;
+	std::vector<double> N(n, 0);
+	bool started = false;
+	for (size_t k = nDistance; k-- > 0;) {
+		const double *inj = &injected[k * n];
+		if (not started) {
+			for (size_t i = 0; i < n; i++)
+				started |= (inj[i] != 0);
+			if (not started)
+				continue;
+		}
+		// particles are injected at the center of the distance bin
+		evolve(N, step / 2);
+		for (size_t i = 0; i < n; i++)
+			N[i] += inj[i];
+		evolve(N, step / 2);
+	}
+	observed = N;
+}
+
+void EMCascade::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	injected.assign(injected.size(), 0);
+	observed.assign(observed.size(), 0);
+}
+
+size_t EMCascade::getNumberOfEnergyBins() const {
+	return nEnergy;
+}
+
+double EMCascade::getEnergy(size_t i) const {
+	return minEnergy * std::pow(maxEnergy / minEnergy, (i + 0.5) / nEnergy);
+}
+
+std::vector<double> EMCascade::getSpectrum(int id) const {
+	int s = species(id);
+	if (s < 0)
+		throw std::runtime_error("EMCascade: only photons and electrons");
+	return std::vector<double>(observed.begin() + s * nEnergy,
+			observed.begin() + (s + 1) * nEnergy);
+}
+
+double EMCascade::getRate(int id, size_t i) {
+	int s = species(id);
+	if ((s < 0) or (i >= nEnergy))
+		throw std::runtime_error("EMCascade: invalid species or energy bin");
+	if (rates.empty())
+		initYields();
+	return rates[s * nEnergy + i];
+}
+
+std::string EMCascade::getDescription() const {
+	std::stringstream s;
+	s << "EMCascade: " << nEnergy << " energy bins from " << minEnergy / EeV
+		<< " to " << maxEnergy / EeV << " EeV, " << nDistance
+		<< " distance bins up to " << maxDistance / Mpc << " Mpc, "
+		<< interactions.size() << " interactions";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,6 +1,9 @@
 #include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/InteractionTables.h"
+#include "crpropa/DataTable.h"
 
 #include <fstream>
 #include <limits>
@@ -19,7 +22,7 @@ void EMDoublePairProduction::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
 	std::string fname = photonField->getFieldName();
 	setDescription("EMDoublePairProduction: " + fname);
-	initRate(getDataPath("EMDoublePairProduction/rate_" + fname + ".txt"));
+	initRate(InteractionTables::getTable("EMDoublePairProduction", "rate", photonField));
 }
 
 void EMDoublePairProduction::setHaveElectrons(bool haveElectrons) {
@@ -34,32 +37,22 @@ void EMDoublePairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
+void EMDoublePairProduction::setCompactTables(bool compact, double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("EMDoublePairProduction: the table tolerance must not be negative");
+	compactTables = compact;
+	tableTolerance = tolerance;
+	if (photonField.valid())
+		setPhotonField(photonField);
+}
+
 void EMDoublePairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMDoublePairProduction: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	tabEnergy.clear();
-	tabRate.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-	}
-	infile.close();
+	rates = RateTable::load(filename, compactTables ? tableTolerance : -1);
 }
 
 
 void EMDoublePairProduction::performInteraction(Candidate *candidate) const {
+	RunStatistics::count("EMDoublePairProduction: interactions");
 	// the photon is lost after the interaction
 	candidate->setActive(false);
 
@@ -82,11 +75,13 @@ void EMDoublePairProduction::performInteraction(Candidate *candidate) const {
 		if (random.rand() < pow(1 - f, thinning)) {
 			double w = 1. / pow(1 - f, thinning);
 			candidate->addSecondary( 11, Ee / (1 + z), pos, w, interactionTag);
-		} 
+		} else
+			RunStatistics::count("EMDoublePairProduction: thinned secondaries"); 
 		if (random.rand() < pow(f, thinning)) {
 			double w = 1. / pow(f, thinning);
 			candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTag);
-		}
+		} else
+			RunStatistics::count("EMDoublePairProduction: thinned secondaries");
 	}
 }
 
@@ -100,11 +95,11 @@ void EMDoublePairProduction::process(Candidate *candidate) const {
 	double E = (1 + z) * candidate->current.getEnergy();
 
 	// check if in tabulated energy range
-	if (E < tabEnergy.front() or (E > tabEnergy.back()))
+	if (E < rates->getMinEnergy() or (E > rates->getMaxEnergy()))
 		return;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
+	double rate = rates->getRate(E);
 	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
 
 	// check for interaction
@@ -121,6 +116,23 @@ void EMDoublePairProduction::process(Candidate *candidate) const {
 
 }
 
+double EMDoublePairProduction::getInteractionRate(const Candidate *candidate) const {
+	if (candidate->current.getId() != 22)
+		return 0;
+
+	double z = candidate->getRedshift();
+	double E = candidate->current.getEnergy() * (1 + z);
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
+		return 0;
+
+	double rate = rates->getRate(E);
+	return rate * pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+}
+
+void EMDoublePairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
 void EMDoublePairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
 }
@@ -1,6 +1,9 @@
 #include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/InteractionTables.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Common.h"
 
 #include <fstream>
@@ -22,8 +25,8 @@ void EMInverseComptonScattering::setPhotonField(ref_ptr<PhotonField> photonField
 	this->photonField = photonField;
 	std::string fname = photonField->getFieldName();
 	setDescription("EMInverseComptonScattering: " + fname);
-	initRate(getDataPath("EMInverseComptonScattering/rate_" + fname + ".txt"));
-	initCumulativeRate(getDataPath("EMInverseComptonScattering/cdf_" + fname + ".txt"));
+	initRate(InteractionTables::getTable("EMInverseComptonScattering", "rate", photonField));
+	initCumulativeRate(InteractionTables::getTable("EMInverseComptonScattering", "cdf", photonField));
 }
 
 void EMInverseComptonScattering::setHavePhotons(bool havePhotons) {
@@ -38,73 +41,27 @@ void EMInverseComptonScattering::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
+void EMInverseComptonScattering::setCompactTables(bool compact, double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("EMInverseComptonScattering: the table tolerance must not be negative");
+	compactTables = compact;
+	tableTolerance = tolerance;
+	if (photonField.valid())
+		setPhotonField(photonField);
+}
+
 void EMInverseComptonScattering::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
-
-	// clear previously loaded tables
-	tabEnergy.clear();
-	tabRate.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-	}
-	infile.close();
+	rates = RateTable::load(filename, compactTables ? tableTolerance : -1);
 }
 
 void EMInverseComptonScattering::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
-
-	// clear previously loaded tables
-	tabE.clear();
-	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
-
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
-		tabCDF.push_back(cdf);
-	}
-	infile.close();
+	cdfs = CumulativeRateTable::load(filename, compactTables);
 }
 
 // Class to calculate the energy distribution of the ICS photon and to sample from it
 class ICSSecondariesEnergyDistribution {
 	private:
-		std::vector< std::vector<double> > data;
+		std::vector<AliasTable> data; // alias tables of the energy distribution in each s bin
 		std::vector<double> s_values;
 		size_t Ns;
 		size_t Nrer;
@@ -126,7 +83,7 @@ class ICSSecondariesEnergyDistribution {
 			s_min = mec2 * mec2;
 			s_max = 2e23 * eV * eV;
 			dls = (log(s_max) - log(s_min)) / Ns;
-			data = std::vector< std::vector<double> >(1000, std::vector<double>(1000));
+			data = std::vector<AliasTable>(Ns);
 			std::vector<double> data_i(1000);
 
 			// tabulate s bin borders
@@ -150,16 +107,16 @@ class ICSSecondariesEnergyDistribution {
 					data_i[j] = dSigmadE(x, beta) * dx;
 					data_i[j] += data_i[j-1];
 				}
-				data[i] = data_i;
+				data[i] = AliasTable(data_i);
 			}
 		}
 
-		// draw random energy for the up-scattered photon Ep(Ee, s)
+		// draw random energy for the up-scattered photon Ep(Ee, s), without allocations
 		double sample(double Ee, double s) {
 			size_t idx = std::lower_bound(s_values.begin(), s_values.end(), s) - s_values.begin();
-			std::vector<double> s0 = data[idx];
+			idx = std::min(idx, data.size() - 1);
 			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1; // draw random bin (upper bin boundary returned)
+			size_t j = random.randBin(data[idx]) + 1; // draw random bin (upper bin boundary returned)
 			double beta = (s - s_min) / (s + s_min);
 			double x0 = (1 - beta) / (1 + beta);
 			double dlx = -log(x0) / Nrer;
@@ -170,18 +127,19 @@ class ICSSecondariesEnergyDistribution {
 };
 
 void EMInverseComptonScattering::performInteraction(Candidate *candidate) const {
+	RunStatistics::count("EMInverseComptonScattering: interactions");
 	// scale the particle energy instead of background photons
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
 
-	if (E < tabE.front() or E > tabE.back())
+	if (E < cdfs->energy.front() or E > cdfs->energy.back())
 		return;
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
-	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
+	size_t i = cdfs->getEnergyIndex(E);
+	size_t j = cdfs->sample(i, random.rand());
+	double s_kin = pow(10, log10(cdfs->s[j]) + (random.rand() - 0.5) * 0.1);
 	double s = s_kin + mec2 * mec2;
 
 	// sample electron energy after scattering
@@ -196,7 +154,8 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 			double w = 1. / pow(1 - f, thinning);
 			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 			candidate->addSecondary(22, Esecondary / (1 + z), pos, w, interactionTag);
-		}
+		} else
+			RunStatistics::count("EMInverseComptonScattering: thinned secondaries");
 	}
 
 	// update the primary particle energy; do this after adding the secondary to correctly set the secondary's parent
@@ -213,11 +172,11 @@ void EMInverseComptonScattering::process(Candidate *candidate) const {
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
 
-	if (E < tabEnergy.front() or (E > tabEnergy.back()))
+	if (E < rates->getMinEnergy() or (E > rates->getMaxEnergy()))
 		return;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
+	double rate = rates->getRate(E);
 	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
 
 	// run this loop at least once to limit the step size
@@ -238,6 +197,23 @@ void EMInverseComptonScattering::process(Candidate *candidate) const {
 	} while (step > 0);
 }
 
+double EMInverseComptonScattering::getInteractionRate(const Candidate *candidate) const {
+	if (abs(candidate->current.getId()) != 11)
+		return 0;
+
+	double z = candidate->getRedshift();
+	double E = candidate->current.getEnergy() * (1 + z);
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
+		return 0;
+
+	double rate = rates->getRate(E);
+	return rate * pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+}
+
+void EMInverseComptonScattering::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
 void EMInverseComptonScattering::setInteractionTag(std::string tag) {
 	interactionTag = tag;
 }
@@ -1,6 +1,9 @@
 #include "crpropa/module/EMPairProduction.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/InteractionTables.h"
+#include "crpropa/DataTable.h"
 
 #include <fstream>
 #include <limits>
@@ -22,8 +25,8 @@ void EMPairProduction::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
 	std::string fname = photonField->getFieldName();
 	setDescription("EMPairProduction: " + fname);
-	initRate(getDataPath("EMPairProduction/rate_" + fname + ".txt"));
-	initCumulativeRate(getDataPath("EMPairProduction/cdf_" + fname + ".txt"));
+	initRate(InteractionTables::getTable("EMPairProduction", "rate", photonField));
+	initCumulativeRate(InteractionTables::getTable("EMPairProduction", "cdf", photonField));
 }
 
 void EMPairProduction::setHaveElectrons(bool haveElectrons) {
@@ -38,74 +41,28 @@ void EMPairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
+void EMPairProduction::setCompactTables(bool compact, double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("EMPairProduction: the table tolerance must not be negative");
+	compactTables = compact;
+	tableTolerance = tolerance;
+	if (photonField.valid())
+		setPhotonField(photonField);
+}
+
 void EMPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMPairProduction: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	tabEnergy.clear();
-	tabRate.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-	}
-	infile.close();
+	rates = RateTable::load(filename, compactTables ? tableTolerance : -1);
 }
 
 void EMPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMPairProduction: could not open file " + filename);
-
-	// clear previously loaded tables
-	tabE.clear();
-	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
-
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
-		tabCDF.push_back(cdf);
-	}
-	infile.close();
+	cdfs = CumulativeRateTable::load(filename, compactTables);
 }
 
 // Hold an data array to interpolate the energy distribution on
 class PPSecondariesEnergyDistribution {
 	private:
 		std::vector<double> tab_s;
-		std::vector< std::vector<double> > data;
+		std::vector<AliasTable> data; // alias tables of the energy distribution in each s bin
 		size_t N;
 
 	public:
@@ -123,7 +80,7 @@ class PPSecondariesEnergyDistribution {
 			double s_min = 4 * mec2 * mec2;
 			double s_max = 1e23 * eV * eV;
 			double dls = log(s_max / s_min) / Ns;
-			data = std::vector< std::vector<double> >(Ns, std::vector<double>(N));
+			data = std::vector<AliasTable>(Ns);
 			tab_s = std::vector<double>(Ns + 1);
 
 			for (size_t i = 0; i < Ns + 1; ++i)
@@ -143,22 +100,20 @@ class PPSecondariesEnergyDistribution {
 					double binWidth = exp((j+1)*dx)-exp(j*dx);
 					data_i[j] = dSigmadE_PPx(x, beta) * binWidth + data_i[j-1];
 				}
-				data[i] = data_i;
+				data[i] = AliasTable(data_i);
 			}
 		}
 
-		// sample positron energy from cdf(E, s_kin)
+		// sample positron energy from cdf(E, s_kin), without allocations
 		double sample(double E0, double s) {
 			// get distribution for given s
 			size_t idx = std::lower_bound(tab_s.begin(), tab_s.end(), s) - tab_s.begin();
-			if (idx > data.size())
+			if (idx >= data.size())
 				return NAN;
-				
-			std::vector<double> s0 = data[idx];
 
 			// draw random bin
 			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1;
+			size_t j = random.randBin(data[idx]) + 1;
 
 			double s_min = 4. * mec2 * mec2;
 			double beta = sqrtl(1. - s_min / s);
@@ -173,6 +128,7 @@ class PPSecondariesEnergyDistribution {
 };
 
 void EMPairProduction::performInteraction(Candidate *candidate) const {
+	RunStatistics::count("EMPairProduction: interactions");
 	// scale particle energy instead of background photon energy
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
@@ -182,15 +138,15 @@ void EMPairProduction::performInteraction(Candidate *candidate) const {
 		return;
 
 	// check if in tabulated energy range
-	if (E < tabE.front() or (E > tabE.back()))
+	if (E < cdfs->energy.front() or (E > cdfs->energy.back()))
 		return;
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);  // find closest tabulation point
-	size_t j = random.randBin(tabCDF[i]);
-	double lo = std::max(4 * mec2 * mec2, tabs[j-1]);  // first s-tabulation point below min(s_kin) = (2 me c^2)^2; ensure physical value
-	double hi = tabs[j];
+	size_t i = cdfs->getEnergyIndex(E);  // find closest tabulation point
+	size_t j = cdfs->sample(i, random.rand());
+	double lo = std::max(4 * mec2 * mec2, cdfs->s[j-1]);  // first s-tabulation point below min(s_kin) = (2 me c^2)^2; ensure physical value
+	double hi = cdfs->s[j];
 	double s = lo + random.rand() * (hi - lo);
 
 	// sample electron / positron energy
@@ -212,11 +168,13 @@ void EMPairProduction::performInteraction(Candidate *candidate) const {
 	if (random.rand() < pow(f, thinning)) {
 		double w = 1. / pow(f, thinning);
 		candidate->addSecondary(11, Ep / (1 + z), pos, w, interactionTag);
-	}
-	if (random.rand() < pow(1 - f, thinning)){
+	} else
+		RunStatistics::count("EMPairProduction: thinned secondaries");
+	if (random.rand() < pow(1 - f, thinning)) {
 		double w = 1. / pow(1 - f, thinning);
 		candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTag);	
-	}
+	} else
+		RunStatistics::count("EMPairProduction: thinned secondaries");
 }
 
 void EMPairProduction::process(Candidate *candidate) const {
@@ -229,11 +187,11 @@ void EMPairProduction::process(Candidate *candidate) const {
 	double E = candidate->current.getEnergy() * (1 + z);
 
 	// check if in tabulated energy range
-	if ((E < tabEnergy.front()) or (E > tabEnergy.back()))
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
 		return;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
+	double rate = rates->getRate(E);
 	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
 
 	// run this loop at least once to limit the step size 
@@ -253,6 +211,30 @@ void EMPairProduction::process(Candidate *candidate) const {
 
 }
 
+double EMPairProduction::getStepLimit(const Candidate *candidate) const {
+	double rate = getInteractionRate(candidate);
+	if (rate <= 0)
+		return std::numeric_limits<double>::max();
+	return limit / rate;
+}
+
+double EMPairProduction::getInteractionRate(const Candidate *candidate) const {
+	if (candidate->current.getId() != 22)
+		return 0;
+
+	double z = candidate->getRedshift();
+	double E = candidate->current.getEnergy() * (1 + z);
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
+		return 0;
+
+	double rate = rates->getRate(E);
+	return rate * pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+}
+
+void EMPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
 void EMPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
 }
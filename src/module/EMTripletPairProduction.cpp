@@ -1,6 +1,9 @@
 #include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/InteractionTables.h"
+#include "crpropa/DataTable.h"
 
 #include <fstream>
 #include <limits>
@@ -21,8 +24,8 @@ void EMTripletPairProduction::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
 	std::string fname = photonField->getFieldName();
 	setDescription("EMTripletPairProduction: " + fname);
-	initRate(getDataPath("EMTripletPairProduction/rate_" + fname + ".txt"));
-	initCumulativeRate(getDataPath("EMTripletPairProduction/cdf_" + fname + ".txt"));
+	initRate(InteractionTables::getTable("EMTripletPairProduction", "rate", photonField));
+	initCumulativeRate(InteractionTables::getTable("EMTripletPairProduction", "cdf", photonField));
 }
 
 void EMTripletPairProduction::setHaveElectrons(bool haveElectrons) {
@@ -37,71 +40,25 @@ void EMTripletPairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
+void EMTripletPairProduction::setCompactTables(bool compact, double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("EMTripletPairProduction: the table tolerance must not be negative");
+	compactTables = compact;
+	tableTolerance = tolerance;
+	if (photonField.valid())
+		setPhotonField(photonField);
+}
+
 void EMTripletPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("EMTripletPairProduction: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	tabEnergy.clear();
-	tabRate.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-	}
-	infile.close();
+	rates = RateTable::load(filename, compactTables ? tableTolerance : -1);
 }
 
 void EMTripletPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error(
-				"EMTripletPairProduction: could not open file " + filename);
-
-	// clear previously loaded tables
-	tabE.clear();
-	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
-
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
-		tabCDF.push_back(cdf);
-	}
-	infile.close();
+	cdfs = CumulativeRateTable::load(filename, compactTables);
 }
 
 void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
+	RunStatistics::count("EMTripletPairProduction: interactions");
 	int id = candidate->current.getId();
 	if  (abs(id) != 11)
 		return;
@@ -110,14 +67,14 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
 
-	if (E < tabE.front() or E > tabE.back())
+	if (E < cdfs->energy.front() or E > cdfs->energy.back())
 		return;
 
 	// sample the value of eps
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
-	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
+	size_t i = cdfs->getEnergyIndex(E);
+	size_t j = cdfs->sample(i, random.rand());
+	double s_kin = pow(10, log10(cdfs->s[j]) + (random.rand() - 0.5) * 0.1);
 	double eps = s_kin / 4. / E; // random background photon energy
 
 	// Use approximation from A. Mastichiadis et al., Astroph. Journ. 300:178-189 (1986), eq. 30.
@@ -132,11 +89,13 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 		if (random.rand() < pow(1 - f, thinning)) {
 			double w = 1. / pow(1 - f, thinning);
 			candidate->addSecondary(11, Epp / (1 + z), pos, w, interactionTag);
-		}
+		} else
+			RunStatistics::count("EMTripletPairProduction: thinned secondaries");
 		if (random.rand() < pow(f, thinning)) {
 			double w = 1. / pow(f, thinning);
 			candidate->addSecondary(-11, Epp / (1 + z), pos, w, interactionTag);
-		}
+		} else
+			RunStatistics::count("EMTripletPairProduction: thinned secondaries");
 	}
 	// Update the primary particle energy.
 	// This is done after adding the secondaries to correctly set the secondaries parent
@@ -154,12 +113,12 @@ void EMTripletPairProduction::process(Candidate *candidate) const {
 	double E = (1 + z) * candidate->current.getEnergy();
 
 	// check if in tabulated energy range
-	if ((E < tabEnergy.front()) or (E > tabEnergy.back()))
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
 		return;
 
 	// cosmological scaling of interaction distance (comoving)
 	double scaling = pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
-	double rate = scaling * interpolate(E, tabEnergy, tabRate);
+	double rate = scaling * rates->getRate(E);
 
 	// run this loop at least once to limit the step size
 	double step = candidate->getCurrentStep();
@@ -176,6 +135,23 @@ void EMTripletPairProduction::process(Candidate *candidate) const {
 	} while (step > 0.);
 }
 
+double EMTripletPairProduction::getInteractionRate(const Candidate *candidate) const {
+	if (abs(candidate->current.getId()) != 11)
+		return 0;
+
+	double z = candidate->getRedshift();
+	double E = candidate->current.getEnergy() * (1 + z);
+	if ((E < rates->getMinEnergy()) or (E > rates->getMaxEnergy()))
+		return 0;
+
+	double rate = rates->getRate(E);
+	return rate * pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+}
+
+void EMTripletPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
 void EMTripletPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
 }
@@ -59,6 +59,7 @@ void ElasticScattering::initCDF(std::string filename) {
 		throw std::runtime_error("ElasticScattering: could not open file " + filename);
 
 	tabCDF.clear();
+	tabAlias.clear();
 	std::string line;
 	double a;
 	while (std::getline(infile, line)) {
@@ -74,6 +75,7 @@ void ElasticScattering::initCDF(std::string filename) {
 			cdf[i] = a;
 		}
 		tabCDF.push_back(cdf);
+		tabAlias.push_back(AliasTable(cdf));
 	}
 
 	infile.close();
@@ -109,7 +111,7 @@ void ElasticScattering::process(Candidate *candidate) const {
 
 		// draw random background photon energy from CDF
 		size_t i = floor((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest gamma tabulation point
-		size_t j = random.randBin(tabCDF[i]) - 1; // index of next lower tabulated eps value
+		size_t j = random.randBin(tabAlias[i]) - 1; // index of next lower tabulated eps value
 		double binWidth = (epsmax - epsmin) / (neps - 1); // logarithmic bin width
 		double eps = pow(10, epsmin + (j + random.rand()) * binWidth);
 
@@ -4,6 +4,7 @@
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -14,6 +15,8 @@ ElectronPairProduction::ElectronPairProduction(ref_ptr<PhotonField> photonField,
 		bool haveElectrons, double limit) {
 	this->haveElectrons = haveElectrons;
 	this->limit = limit;
+	this->exactLoss = false;
+	this->packetBins = 0;
 	setPhotonField(photonField);
 }
 
@@ -39,6 +42,14 @@ void ElectronPairProduction::setLimit(double limit) {
 	this->limit = limit;
 }
 
+void ElectronPairProduction::setExactLoss(bool exact) {
+	exactLoss = exact;
+}
+
+bool ElectronPairProduction::getExactLoss() const {
+	return exactLoss;
+}
+
 void ElectronPairProduction::initRate(std::string filename) {
 	std::ifstream infile(filename.c_str());
 
@@ -61,6 +72,24 @@ void ElectronPairProduction::initRate(std::string filename) {
 		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
 	}
 	infile.close();
+
+	// range function R = int dln(gamma) / rate, trapezoidal rule in ln(gamma),
+	// starting at the lowest tabulated Lorentz factor with a loss
+	tabRange.clear();
+	tabLogLorentzFactor.clear();
+	double previousRate = 0;
+	for (size_t i = 0; i < tabLorentzFactor.size(); i++) {
+		if (tabLossRate[i] <= 0)
+			continue;
+		double lg = log(tabLorentzFactor[i]);
+		double R = 0;
+		if (tabRange.size() > 0)
+			R = tabRange.back() + 0.5 * (lg - tabLogLorentzFactor.back())
+					* (1. / tabLossRate[i] + 1. / previousRate);
+		tabRange.push_back(R);
+		tabLogLorentzFactor.push_back(lg);
+		previousRate = tabLossRate[i];
+	}
 }
 
 void ElectronPairProduction::initSpectrum(std::string filename) {
@@ -70,6 +99,7 @@ void ElectronPairProduction::initSpectrum(std::string filename) {
 
 	double dNdE;
 	tabSpectrum.resize(70);
+	tabSpectrumAlias.resize(70);
 	for (size_t i = 0; i < 70; i++) {
 		tabSpectrum[i].resize(170);
 		for (size_t j = 0; j < 170; j++) {
@@ -79,8 +109,54 @@ void ElectronPairProduction::initSpectrum(std::string filename) {
 		for (size_t j = 1; j < 170; j++) {
 			tabSpectrum[i][j] += tabSpectrum[i][j - 1]; // cdf(Ee), unnormalized
 		}
+		tabSpectrumAlias[i] = AliasTable(tabSpectrum[i]);
 	}
 	infile.close();
+	initPackets();
+}
+
+void ElectronPairProduction::setPacketBins(int nBins) {
+	if (nBins < 0)
+		throw std::runtime_error("ElectronPairProduction: number of packet bins < 0");
+	packetBins = std::min(nBins, 170);
+	initPackets();
+}
+
+int ElectronPairProduction::getPacketBins() const {
+	return packetBins;
+}
+
+void ElectronPairProduction::initPackets() {
+	packetEdges.clear();
+	packetProbability.clear();
+	tabMeanEnergy.clear();
+	if ((packetBins == 0) or tabSpectrum.empty())
+		return;
+
+	// packet bins of equal numbers of spectrum bins
+	for (int k = 0; k <= packetBins; k++)
+		packetEdges.push_back((170 * k) / packetBins);
+
+	// mean energy of a bin, log-uniform within the bin as in process
+	double binMean = (pow(10, 0.1) - 1) / (0.1 * log(10));
+	packetProbability.resize(70);
+	tabMeanEnergy.resize(70);
+	for (size_t i = 0; i < 70; i++) {
+		const std::vector<double> &cdf = tabSpectrum[i];
+		double total = cdf.back();
+		packetProbability[i].resize(packetBins, 0.);
+		tabMeanEnergy[i] = 0;
+		if (total <= 0)
+			continue;
+		for (int k = 0; k < packetBins; k++) {
+			size_t j0 = packetEdges[k], j1 = packetEdges[k + 1];
+			packetProbability[i][k] = (cdf[j1 - 1] - ((j0 > 0) ? cdf[j0 - 1] : 0.)) / total;
+		}
+		for (size_t j = 0; j < 170; j++) {
+			double p = (cdf[j] - ((j > 0) ? cdf[j - 1] : 0.)) / total;
+			tabMeanEnergy[i] += p * pow(10, 6.95 + 0.1 * j) * binMean * eV;
+		}
+	}
 }
 
 double ElectronPairProduction::lossLength(int id, double lf, double z) const {
@@ -103,6 +179,39 @@ double ElectronPairProduction::lossLength(int id, double lf, double z) const {
 	return 1. / rate;
 }
 
+double ElectronPairProduction::lorentzFactorAfter(int id, double lf, double z, double step) const {
+	double Z = chargeNumber(id);
+	if ((Z == 0) or (tabRange.size() < 2))
+		return lf;
+
+	double g = lf * (1 + z);
+	if (g < exp(tabLogLorentzFactor.front()))
+		return lf; // below energy threshold
+
+	double A = nuclearMass(id) / mass_proton;
+	double k = Z * Z / A * pow_integer<3>(1 + z) * photonField->getRedshiftScaling(z);
+
+	// range at the start, power law continuation above the table as in lossLength
+	double gmax = tabLorentzFactor.back();
+	double rmax = tabLossRate.back();
+	double Rmax = tabRange.back();
+	double R;
+	if (g < gmax)
+		R = interpolate(log(g), tabLogLorentzFactor, tabRange);
+	else
+		R = Rmax + (pow(g / gmax, 0.6) - 1) / (0.6 * rmax);
+
+	// invert the range after the step
+	R -= k * step;
+	if (R <= 0)
+		g = exp(tabLogLorentzFactor.front());
+	else if (R < Rmax)
+		g = exp(interpolate(R, tabRange, tabLogLorentzFactor));
+	else
+		g = gmax * pow(1 + 0.6 * rmax * (R - Rmax), 1 / 0.6);
+	return std::min(g / (1 + z), lf);
+}
+
 void ElectronPairProduction::process(Candidate *c) const {
 	int id = c->current.getId();
 	if (not (isNucleus(id)))
@@ -116,6 +225,8 @@ void ElectronPairProduction::process(Candidate *c) const {
 
 	double step = c->getCurrentStep() / (1 + z); // step size in local frame
 	double loss = step / losslen;  // relative energy loss
+	if (exactLoss)
+		loss = 1 - lorentzFactorAfter(id, lf, z, step) / lf;
 
 	if (haveElectrons) {
 		double dE = c->current.getEnergy() * loss;  // energy loss
@@ -123,9 +234,30 @@ void ElectronPairProduction::process(Candidate *c) const {
 		i = std::min(std::max(i, 0), 69);
 		Random &random = Random::instance();
 
+		// aggregated pairs: the expected number of pairs per packet bin
+		if ((packetBins > 0) and (tabMeanEnergy[i] > 0)) {
+			const std::vector<double> &cdf = tabSpectrum[i];
+			double nPairs = dE / (2 * tabMeanEnergy[i]);
+			for (int k = 0; k < packetBins; k++) {
+				double w = nPairs * packetProbability[i][k];
+				if (w <= 0)
+					continue;
+				size_t j0 = packetEdges[k], j1 = packetEdges[k + 1];
+				double lo = (j0 > 0) ? cdf[j0 - 1] : 0.;
+				std::vector<double>::const_iterator it = std::lower_bound(cdf.begin() + j0,
+						cdf.begin() + j1, lo + random.rand() * (cdf[j1 - 1] - lo));
+				size_t j = std::min((size_t) (it - cdf.begin()), j1 - 1);
+				double Ee = pow(10, 6.95 + (j + random.rand()) * 0.1) * eV;
+				Vector3d pos = random.randomInterpolatedPosition(c->previous.getPosition(), c->current.getPosition());
+				c->addSecondary( 11, Ee, pos, w, interactionTag);
+				c->addSecondary(-11, Ee, pos, w, interactionTag);
+			}
+			dE = 0;
+		}
+
 		// draw pairs as long as their energy is smaller than the pair production energy loss
 		while (dE > 0) {
-			size_t j = random.randBin(tabSpectrum[i]);
+			size_t j = random.randBin(tabSpectrumAlias[i]);
 			double Ee = pow(10, 6.95 + (j + random.rand()) * 0.1) * eV;
 			double Epair = 2 * Ee; // NOTE: electron and positron in general don't have same lab frame energy, but averaged over many draws the result is consistent
 			// if the remaining energy is not sufficient check for random accepting
@@ -145,6 +277,17 @@ void ElectronPairProduction::process(Candidate *c) const {
 	c->limitNextStep(limit * losslen);
 }
 
+double ElectronPairProduction::getStepLimit(const Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (not (isNucleus(id)))
+		return std::numeric_limits<double>::max();
+
+	double losslen = lossLength(id, candidate->current.getLorentzFactor(), candidate->getRedshift());
+	if (losslen >= std::numeric_limits<double>::max())
+		return losslen;
+	return limit * losslen;
+}
+
 void ElectronPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
 }
@@ -0,0 +1,132 @@
+#include "crpropa/module/FastNeutralPropagation.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+FastNeutralPropagation::FastNeutralPropagation(ref_ptr<Module> propagation,
+		double maxStep, double tolerance) : propagation(propagation) {
+	setMaximumStep(maxStep);
+	setTolerance(tolerance);
+	// electron, muon and tau neutrinos
+	for (int i = 12; i <= 16; i += 2) {
+		addId(i);
+		addId(-i);
+	}
+}
+
+double FastNeutralPropagation::crossing(const Vector3d &x, const Vector3d &u) const {
+	double step = maxStep;
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		const Surface &s = *surfaces[i];
+		bool inside = (s.distance(x) < 0);
+
+		// step by the distance to the surface, which does not cross it, but at
+		// least by the tolerance to get away from surfaces touched at the start
+		double t = 0;
+		for (int n = 0; ; n++) {
+			if (n == 1000) {
+				// grazing the surface, only the traced distance is safe
+				step = t;
+				break;
+			}
+			double next = std::min(t + std::max(fabs(s.distance(x + u * t)), tolerance), step);
+			if ((s.distance(x + u * next) < 0) != inside) {
+				// bisect the sign change
+				double lo = t, hi = next;
+				while (hi - lo > tolerance / 2) {
+					double mid = (lo + hi) / 2;
+					if ((s.distance(x + u * mid) < 0) != inside)
+						hi = mid;
+					else
+						lo = mid;
+				}
+				step = hi;
+				break;
+			}
+			if (next == step)
+				break;
+			t = next;
+		}
+	}
+	return step;
+}
+
+void FastNeutralPropagation::process(Candidate *candidate) const {
+	ParticleState &current = candidate->current;
+	if ((current.getCharge() != 0) || (ids.count(current.getId()) == 0)) {
+		if (propagation.valid())
+			propagation->process(candidate);
+		return;
+	}
+
+	candidate->savePrevious();
+	Vector3d x = current.getPosition();
+	Vector3d u = current.getDirection();
+	double step = crossing(x, u);
+	if (step < maxStep)
+		step = std::min(step + tolerance, maxStep);
+	current.setPosition(x + u * step);
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(maxStep);
+}
+
+void FastNeutralPropagation::add(ref_ptr<Surface> surface) {
+	surfaces.push_back(surface);
+}
+
+void FastNeutralPropagation::addId(int id) {
+	if (ParticleState(id).getCharge() != 0)
+		throw std::runtime_error("FastNeutralPropagation: particle is not neutral");
+	ids.insert(id);
+}
+
+void FastNeutralPropagation::removeId(int id) {
+	ids.erase(id);
+}
+
+bool FastNeutralPropagation::hasId(int id) const {
+	return ids.count(id) > 0;
+}
+
+void FastNeutralPropagation::setPropagation(ref_ptr<Module> p) {
+	propagation = p;
+}
+
+void FastNeutralPropagation::setMaximumStep(double step) {
+	if (step <= 0)
+		throw std::runtime_error("FastNeutralPropagation: maxStep <= 0");
+	maxStep = step;
+}
+
+void FastNeutralPropagation::setTolerance(double tol) {
+	if (tol <= 0)
+		throw std::runtime_error("FastNeutralPropagation: tolerance <= 0");
+	tolerance = tol;
+}
+
+ref_ptr<Module> FastNeutralPropagation::getPropagation() const {
+	return propagation;
+}
+
+double FastNeutralPropagation::getMaximumStep() const {
+	return maxStep;
+}
+
+double FastNeutralPropagation::getTolerance() const {
+	return tolerance;
+}
+
+std::string FastNeutralPropagation::getDescription() const {
+	std::stringstream s;
+	s << "FastNeutralPropagation: " << ids.size() << " particle ids, "
+			<< surfaces.size() << " surfaces, maximum step " << maxStep / kpc
+			<< " kpc, tolerance " << tolerance / pc << " pc";
+	if (propagation.valid())
+		s << "\n    other particles: " << propagation->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,15 +1,34 @@
 #ifdef CRPROPA_HAVE_HDF5
 
+#ifdef CRPROPA_HAVE_MPI
+// only the C interface of MPI is used, also by a parallel hdf5.h
+#define OMPI_SKIP_MPICXX
+#define MPICH_SKIP_MPICXX
+#include <mpi.h>
+#endif
+
 #include "crpropa/module/HDF5Output.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
+#include "crpropa/Trace.h"
 #include "kiss/logger.h"
 
 #include <hdf5.h>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 const hsize_t RANK = 1;
 const hsize_t BUFFER_SIZE = 1024 * 16;
+const hsize_t SHARD_BUFFER_SIZE = 1024;
+
+// ids of the registered HDF5 filter plugins
+const H5Z_filter_t H5Z_FILTER_BLOSC = 32001;
+const H5Z_filter_t H5Z_FILTER_ZSTD = 32015;
 
 namespace crpropa {
 
@@ -48,17 +67,20 @@ hid_t variantTypeToH5T_NATIVE(Variant::Type type) {
 	}
 }
 
-HDF5Output::HDF5Output() :  Output(), filename(), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output() :  Output(), filename(), file(-1), sid(-1), dset(-1), dataspace(-1), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), pipeline(0), sharded(false), collective(false), chunkSize(BUFFER_SIZE), compression(CompressionDeflate), compressionLevel(5), shuffle(true), bufferMemory(MemoryUsage::OutputBuffers) {
 }
 
-HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), pipeline(0), sharded(false), collective(false), chunkSize(BUFFER_SIZE), compression(CompressionDeflate), compressionLevel(5), shuffle(true), bufferMemory(MemoryUsage::OutputBuffers) {
 }
 
-HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), pipeline(0), sharded(false), collective(false), chunkSize(BUFFER_SIZE), compression(CompressionDeflate), compressionLevel(5), shuffle(true), bufferMemory(MemoryUsage::OutputBuffers) {
 	outputtype = outputtype;
 }
 
 HDF5Output::~HDF5Output() {
+	// an exception of the writer thread can only be thrown by close()
+	delete pipeline;
+	pipeline = 0;
 	close();
 }
 
@@ -97,76 +119,136 @@ herr_t HDF5Output::insertDoubleAttribute(const std::string &key, const double &v
 
 
 
+herr_t HDF5Output::insertTagNames() {
+	// names of the SymbolTable handles written to the tag column
+	std::vector<std::string> tags;
+	for (size_t i = 0; i < SymbolTable::size(); i++)
+		tags.push_back(SymbolTable::name(i));
+	if (collective) {
+		// the names of rank 0, separated by '\0'
+		std::vector<char> joined;
+		for (size_t i = 0; i < tags.size(); i++)
+			joined.insert(joined.end(), tags[i].c_str(), tags[i].c_str() + tags[i].size() + 1);
+		broadcast(joined);
+		tags.clear();
+		for (size_t i = 0; i < joined.size(); i += tags.back().size() + 1)
+			tags.push_back(std::string(&joined[i]));
+	}
+	size_t n = tags.size(), length = 1;
+	for (size_t i = 0; i < n; i++)
+		length = std::max(length, tags[i].size() + 1);
+	std::vector<char> names(n * length, '\0');
+	for (size_t i = 0; i < n; i++)
+		tags[i].copy(&names[i * length], length - 1);
+
+	hid_t strtype = H5Tcopy(H5T_C_S1);
+	H5Tset_size(strtype, length);
+	hsize_t dims = n;
+	hid_t attr_space = H5Screate_simple(1, &dims, NULL);
+	hid_t attr = H5Acreate2(dset, "TagNames", strtype, attr_space, H5P_DEFAULT, H5P_DEFAULT);
+	herr_t status = H5Awrite(attr, strtype, names.data());
+	H5Aclose(attr);
+	H5Sclose(attr_space);
+	H5Tclose(strtype);
+	return status;
+}
+
+void HDF5Output::addColumn(std::vector<RowColumnType> &columns, const std::string &name, RowColumn column, hid_t type) {
+	size_t offset = 0;
+	for (size_t i = 0; i < columns.size(); i++)
+		offset += columns[i].size;
+	rowOffsets[column] = offset;
+	RowColumnType c = {name, type, H5Tget_size(type)};
+	columns.push_back(c);
+}
+
 void HDF5Output::open(const std::string& filename) {
-	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	hid_t access = H5P_DEFAULT;
+#if defined(CRPROPA_HAVE_MPI) && defined(H5_HAVE_PARALLEL)
+	if (collective) {
+		if (sharded || pipeline)
+			throw std::runtime_error("HDF5Output: the collective output is not used with setSharded or setAsync");
+		int initialized = 0;
+		MPI_Initialized(&initialized);
+		if (!initialized)
+			throw std::runtime_error("HDF5Output: MPI is not initialized");
+		access = H5Pcreate(H5P_FILE_ACCESS);
+		H5Pset_fapl_mpio(access, MPI_COMM_WORLD, MPI_INFO_NULL);
+	}
+#endif
+	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, access);
+	if (access != H5P_DEFAULT)
+		H5Pclose(access);
 	if (file < 0)
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 
 
-	sid = H5Tcreate(H5T_COMPOUND, sizeof(OutputRow));
+	// packed layout of the enabled columns
+	std::vector<RowColumnType> columns;
+	rowOffsets.assign(nRowColumns, -1);
 	if (fields.test(TrajectoryLengthColumn))
-		H5Tinsert(sid, "D", HOFFSET(OutputRow, D), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "D", RowD, H5T_NATIVE_DOUBLE);
 	if (fields.test(RedshiftColumn))
-		H5Tinsert(sid, "z", HOFFSET(OutputRow, z), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "z", RowRedshift, H5T_NATIVE_DOUBLE);
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN", HOFFSET(OutputRow, SN), H5T_NATIVE_UINT64);
+		addColumn(columns, "SN", RowSN, H5T_NATIVE_UINT64);
 	if (fields.test(CurrentIdColumn))
-		H5Tinsert(sid, "ID", HOFFSET(OutputRow, ID), H5T_NATIVE_INT32);
+		addColumn(columns, "ID", RowID, H5T_NATIVE_INT32);
 	if (fields.test(CurrentEnergyColumn))
-		H5Tinsert(sid, "E", HOFFSET(OutputRow, E), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "E", RowE, H5T_NATIVE_DOUBLE);
 	if (fields.test(CurrentPositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X", HOFFSET(OutputRow, X), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X", RowX, H5T_NATIVE_DOUBLE);
 	if (fields.test(CurrentPositionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "X", HOFFSET(OutputRow, X), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y", HOFFSET(OutputRow, Y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z", HOFFSET(OutputRow, Z), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X", RowX, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Y", RowY, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Z", RowZ, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(CurrentDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "Px", HOFFSET(OutputRow, Px), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Py", HOFFSET(OutputRow, Py), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Pz", HOFFSET(OutputRow, Pz), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Px", RowPx, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Py", RowPy, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Pz", RowPz, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN0", HOFFSET(OutputRow, SN0), H5T_NATIVE_UINT64);
+		addColumn(columns, "SN0", RowSN0, H5T_NATIVE_UINT64);
 	if (fields.test(SourceIdColumn))
-		H5Tinsert(sid, "ID0", HOFFSET(OutputRow, ID0), H5T_NATIVE_INT32);
+		addColumn(columns, "ID0", RowID0, H5T_NATIVE_INT32);
 	if (fields.test(SourceEnergyColumn))
-		H5Tinsert(sid, "E0", HOFFSET(OutputRow, E0), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "E0", RowE0, H5T_NATIVE_DOUBLE);
 	if (fields.test(SourcePositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X0", HOFFSET(OutputRow, X0), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X0", RowX0, H5T_NATIVE_DOUBLE);
 	if (fields.test(SourcePositionColumn) && not oneDimensional){
-		H5Tinsert(sid, "X0", HOFFSET(OutputRow, X0), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y0", HOFFSET(OutputRow, Y0), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z0", HOFFSET(OutputRow, Z0), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X0", RowX0, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Y0", RowY0, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Z0", RowZ0, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SourceDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "P0x", HOFFSET(OutputRow, P0x), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P0y", HOFFSET(OutputRow, P0y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P0z", HOFFSET(OutputRow, P0z), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P0x", RowP0x, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P0y", RowP0y, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P0z", RowP0z, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN1", HOFFSET(OutputRow, SN1), H5T_NATIVE_UINT64);
+		addColumn(columns, "SN1", RowSN1, H5T_NATIVE_UINT64);
 	if (fields.test(CreatedIdColumn))
-		H5Tinsert(sid, "ID1", HOFFSET(OutputRow, ID1), H5T_NATIVE_INT32);
+		addColumn(columns, "ID1", RowID1, H5T_NATIVE_INT32);
 	if (fields.test(CreatedEnergyColumn))
-		H5Tinsert(sid, "E1", HOFFSET(OutputRow, E1), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "E1", RowE1, H5T_NATIVE_DOUBLE);
 	if (fields.test(CreatedPositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X1", HOFFSET(OutputRow, X1), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X1", RowX1, H5T_NATIVE_DOUBLE);
 	if (fields.test(CreatedPositionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "X1", HOFFSET(OutputRow, X1), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y1", HOFFSET(OutputRow, Y1), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z1", HOFFSET(OutputRow, Z1), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "X1", RowX1, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Y1", RowY1, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "Z1", RowZ1, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(CreatedDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "P1x", HOFFSET(OutputRow, P1x), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P1y", HOFFSET(OutputRow, P1y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P1z", HOFFSET(OutputRow, P1z), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P1x", RowP1x, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P1y", RowP1y, H5T_NATIVE_DOUBLE);
+		addColumn(columns, "P1z", RowP1z, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(WeightColumn))
-		H5Tinsert(sid, "W", HOFFSET(OutputRow, weight), H5T_NATIVE_DOUBLE);
+		addColumn(columns, "W", RowWeight, H5T_NATIVE_DOUBLE);
 	
 	if (fields.test(CandidateTagColumn)) 
-		H5Tinsert(sid, "tag", HOFFSET(OutputRow, tag), H5T_C_S1);
+		addColumn(columns, "tag", RowTag, H5T_NATIVE_INT32);
 
 	size_t pos = 0;
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
@@ -179,7 +261,8 @@ void HDF5Output::open(const std::string& filename) {
 				H5Tset_size(type, (*iter).defaultValue.toString().size());
 			}
 
-			H5Tinsert(sid, (*iter).name.c_str(), HOFFSET(OutputRow, propertyBuffer) + pos, type);
+			RowColumnType column = {(*iter).name, type, (*iter).defaultValue.getSize()};
+			columns.push_back(column);
 		  pos += (*iter).defaultValue.getSize();
 	}
 	if (pos >= propertyBufferSize)
@@ -188,18 +271,35 @@ void HDF5Output::open(const std::string& filename) {
 		throw std::runtime_error("Size of property buffer exceeded");
 	}
 
-	// chunked prop
-	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
-	H5Pset_layout(plist, H5D_CHUNKED);
-	hsize_t chunk_dims[RANK] = {BUFFER_SIZE};
-	H5Pset_chunk(plist, RANK, chunk_dims);
-	H5Pset_deflate(plist, 5);
+	rowSize = 0;
+	for (size_t i = 0; i < columns.size(); i++)
+		rowSize += columns[i].size;
+	propertyOffset = rowSize - pos;
+	sid = H5Tcreate(H5T_COMPOUND, std::max(rowSize, (size_t) 1));
+	size_t offset = 0;
+	for (size_t i = 0; i < columns.size(); i++) {
+		H5Tinsert(sid, columns[i].name.c_str(), offset, columns[i].type);
+		offset += columns[i].size;
+	}
 
 	hsize_t dims[RANK] = {0};
 	hsize_t max_dims[RANK] = {H5S_UNLIMITED};
 	dataspace = H5Screate_simple(RANK, dims, max_dims);
 
-	dset = H5Dcreate2(file, "CRPROPA3", sid, dataspace, H5P_DEFAULT, plist, H5P_DEFAULT);
+	if (sharded) {
+		// the attributes are stored with the first shard until the merge
+		H5Gclose(H5Gcreate2(file, "CRPROPA3_shards", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+		size_t nThreads = 1;
+#ifdef _OPENMP
+		nThreads = omp_get_max_threads();
+#endif
+		shards.clear();
+		shards.resize(nThreads);
+		shards[0].dset = createDataset("CRPROPA3_shards/000");
+		dset = shards[0].dset;
+	} else {
+		dset = createDataset("CRPROPA3");
+	}
 
 	insertStringAttribute("OutputType", outputName);
 	insertStringAttribute("Version", g_GIT_DESC);
@@ -208,6 +308,26 @@ void HDF5Output::open(const std::string& filename) {
 
 	// add ranom seeds
 	std::vector< std::vector<uint32_t> > seeds = Random::getSeedThreads();
+	if (collective) {
+		// the seeds of rank 0, each with its length in front
+		std::vector<char> packed;
+		for (size_t i = 0; i < seeds.size(); i++) {
+			uint32_t length = seeds[i].size();
+			packed.insert(packed.end(), (char *) &length, (char *) (&length + 1));
+			packed.insert(packed.end(), (char *) seeds[i].data(), (char *) (seeds[i].data() + length));
+		}
+		broadcast(packed);
+		seeds.clear();
+		for (size_t i = 0; i < packed.size(); ) {
+			uint32_t length;
+			memcpy(&length, &packed[i], sizeof(length));
+			i += sizeof(length);
+			seeds.push_back(std::vector<uint32_t>(length));
+			if (length > 0)
+				memcpy(seeds.back().data(), &packed[i], length * sizeof(uint32_t));
+			i += length * sizeof(uint32_t);
+		}
+	}
 	for (size_t i = 0; i < seeds.size(); i++)
 	{
 		hid_t   type, attr_space, version_attr;
@@ -229,22 +349,65 @@ void HDF5Output::open(const std::string& filename) {
 
 	}
 
+	buffer.reserve(BUFFER_SIZE * rowSize);
+	bufferMemory.set(buffer.capacity());
+	time(&lastFlush);
+}
 
-	H5Pclose(plist);
+hid_t HDF5Output::createDataset(const std::string &name) const {
+	// chunked prop
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_layout(plist, H5D_CHUNKED);
+	hsize_t chunk_dims[RANK] = {chunkSize};
+	H5Pset_chunk(plist, RANK, chunk_dims);
 
-	buffer.reserve(BUFFER_SIZE);
-	time(&lastFlush);
+	int filter = compression;
+	if ((filter == CompressionZstd) && !H5Zfilter_avail(H5Z_FILTER_ZSTD)) {
+		KISS_LOG_WARNING << "HDF5Output: Zstd filter plugin not available, using deflate";
+		filter = CompressionDeflate;
+	}
+	if ((filter == CompressionBlosc) && !H5Zfilter_avail(H5Z_FILTER_BLOSC)) {
+		KISS_LOG_WARNING << "HDF5Output: Blosc filter plugin not available, using deflate";
+		filter = CompressionDeflate;
+	}
+
+	if (shuffle && (filter != CompressionNone) && (filter != CompressionBlosc))
+		H5Pset_shuffle(plist);
+	if (filter == CompressionDeflate) {
+		H5Pset_deflate(plist, compressionLevel);
+	} else if (filter == CompressionZstd) {
+		unsigned int values[1] = {(unsigned int) compressionLevel};
+		H5Pset_filter(plist, H5Z_FILTER_ZSTD, H5Z_FLAG_OPTIONAL, 1, values);
+	} else if (filter == CompressionBlosc) {
+		// Blosc shuffles internally; codec 1 is LZ4
+		unsigned int values[7] = {0, 0, 0, 0, (unsigned int) compressionLevel, shuffle ? 1u : 0u, 1};
+		H5Pset_filter(plist, H5Z_FILTER_BLOSC, H5Z_FLAG_OPTIONAL, 7, values);
+	}
+
+	hid_t dataset = H5Dcreate2(file, name.c_str(), sid, dataspace, H5P_DEFAULT, plist, H5P_DEFAULT);
+	H5Pclose(plist);
+	return dataset;
 }
 
 void HDF5Output::close() {
+	// the rows consumed before an error of the writer thread are still written
+	std::exception_ptr error = pipeline ? pipeline->close() : std::exception_ptr();
+	setAsync(false);
 	if (file >= 0) {
 		flush();
-		H5Dclose(dset);
+		if (fields.test(CandidateTagColumn))
+			insertTagNames();
+		if (sharded)
+			mergeShards();
+		else
+			H5Dclose(dset);
 		H5Tclose(sid);
 		H5Sclose(dataspace);
 		H5Fclose(file);
 		file = -1;
 	}
+	if (error)
+		std::rethrow_exception(error);
 }
 
 void HDF5Output::process(Candidate* candidate) const {
@@ -255,52 +418,27 @@ void HDF5Output::process(Candidate* candidate) const {
 		// file before processing the first candidate
 		const_cast<HDF5Output*>(this)->open(filename);
 	}
+	if (!accept(candidate))
+		return;
 
-	OutputRow r;
-	r.D = candidate->getTrajectoryLength() / lengthScale;
-	r.z = candidate->getRedshift();
-
-	r.SN = candidate->getSerialNumber();
-	r.ID = candidate->current.getId();
-	r.E = candidate->current.getEnergy() / energyScale;
-	Vector3d v = candidate->current.getPosition() / lengthScale;
-	r.X = v.x;
-	r.Y = v.y;
-	r.Z = v.z;
-	v = candidate->current.getDirection();
-	r.Px = v.x;
-	r.Py = v.y;
-	r.Pz = v.z;
-
-	r.SN0 = candidate->getSourceSerialNumber();
-	r.ID0 = candidate->source.getId();
-	r.E0 = candidate->source.getEnergy() / energyScale;
-	v = candidate->source.getPosition() / lengthScale;
-	r.X0 = v.x;
-	r.Y0 = v.y;
-	r.Z0 = v.z;
-	v = candidate->source.getDirection();
-	r.P0x = v.x;
-	r.P0y = v.y;
-	r.P0z = v.z;
-
-	r.SN1 = candidate->getCreatedSerialNumber();
-	r.ID1 = candidate->created.getId();
-	r.E1 = candidate->created.getEnergy() / energyScale;
-	v = candidate->created.getPosition() / lengthScale;
-	r.X1 = v.x;
-	r.Y1 = v.y;
-	r.Z1 = v.z;
-	v = candidate->created.getDirection();
-	r.P1x = v.x;
-	r.P1y = v.y;
-	r.P1z = v.z;
-
-	r.weight= candidate->getWeight();
-
-	r.tag = candidate->getTagOrigin();
+	// only the states of enabled columns are read
+	unsigned char r[maxRowSize];
+	pack(r, RowD, candidate->getTrajectoryLength() / lengthScale);
+	pack(r, RowRedshift, candidate->getRedshift());
 
-	size_t pos = 0;
+	pack(r, RowSN, candidate->getSerialNumber());
+	packState(r, RowID, candidate->current);
+	pack(r, RowSN0, candidate->getSourceSerialNumber());
+	packState(r, RowID0, candidate->source);
+	pack(r, RowSN1, candidate->getCreatedSerialNumber());
+	packState(r, RowID1, candidate->created);
+
+	pack(r, RowWeight, candidate->getWeight());
+
+	// tags are stored as SymbolTable handles, see the TagNames attribute
+	pack(r, RowTag, (int32_t) candidate->getTagOriginSymbol());
+
+	size_t pos = propertyOffset;
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
@@ -313,54 +451,146 @@ void HDF5Output::process(Candidate* candidate) const {
 			{
 				v = (*iter).defaultValue;
 			}
-			pos += v.copyToBuffer(&r.propertyBuffer[pos]);
+			pos += v.copyToBuffer(&r[pos]);
 	}
 
+	if (pipeline) {
+		std::vector<unsigned char> row(r, r + rowSize);
+		pipeline->push(row);
+		return;
+	}
+
+	if (sharded && shards.size()) {
+		size_t thread = 0;
+		bool nested = false;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		nested = omp_get_level() > 1;
+#endif
+		if (!nested && (thread < shards.size())) {
+			Shard &shard = shards[thread];
+			shard.buffer.insert(shard.buffer.end(), r, r + rowSize);
+			shard.memory.set(shard.buffer.capacity());
+			size_t rows = shard.buffer.size() / std::max(rowSize, (size_t) 1);
+			if ((rows >= SHARD_BUFFER_SIZE) || (rows >= flushLimit) || MemoryUsage::isOverLimit()) {
+				TraceWait wait("HDF5Output");
+				#pragma omp critical
+				{
+				wait.acquired();
+				writeShard(thread);
+				}
+			}
+			return;
+		}
+	}
+
+	TraceWait wait("HDF5Output");
 	#pragma omp critical
 	{
-		const_cast<HDF5Output*>(this)->candidatesSinceFlush++;
-		Output::process(candidate);
+	wait.acquired();
+	append(r);
+	}
+}
+
+// id, energy, position and direction follow the id column in RowColumn
+void HDF5Output::packState(unsigned char *row, RowColumn id, const ParticleState &state) const {
+	pack(row, id, (int32_t) state.getId());
+	pack(row, RowColumn(id + 1), state.getEnergy() / energyScale);
+	if (rowOffsets[id + 2] >= 0) {
+		Vector3d v = state.getPosition() / lengthScale;
+		pack(row, RowColumn(id + 2), v.x);
+		pack(row, RowColumn(id + 3), v.y);
+		pack(row, RowColumn(id + 4), v.z);
+	}
+	if (rowOffsets[id + 5] >= 0) {
+		Vector3d v = state.getDirection();
+		pack(row, RowColumn(id + 5), v.x);
+		pack(row, RowColumn(id + 6), v.y);
+		pack(row, RowColumn(id + 7), v.z);
+	}
+}
 
-		buffer.push_back(r);
+void HDF5Output::consume(std::vector<unsigned char> &row) const {
+	append(row.data());
+}
 
+void HDF5Output::append(const unsigned char *row) const {
+	const_cast<HDF5Output*>(this)->candidatesSinceFlush++;
+	count++;
 
-		if (buffer.size() >= buffer.capacity())
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to buffer capacity exceeded";
-			flush();
-		}
-		else if (candidatesSinceFlush >= flushLimit)
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
-			flush();
-		}
-		else if (difftime(time(NULL), lastFlush) > 60*10)
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
-			flush();
-		}
+	buffer.insert(buffer.end(), row, row + rowSize);
+	bufferMemory.set(buffer.capacity());
+
+	// written by all ranks together in flush
+	if (collective)
+		return;
+
+	if (buffer.size() >= BUFFER_SIZE * rowSize)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to buffer capacity exceeded";
+		commit();
+	}
+	else if (candidatesSinceFlush >= flushLimit)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
+		commit();
+	}
+	else if (difftime(time(NULL), lastFlush) > 60*10)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
+		commit();
+	}
+	else if (MemoryUsage::isOverLimit())
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to memory limit exceeded";
+		commit();
 	}
 }
 
 void HDF5Output::flush() const {
+	if (pipeline)
+		pipeline->drain();
+	else
+		commit();
+	for (size_t i = 0; i < shards.size(); i++)
+		writeShard(i);
+}
+
+void HDF5Output::commit() const {
+	TraceSpan span("HDF5Output::flush", "flush");
 	const_cast<HDF5Output*>(this)->lastFlush = time(NULL);
 	const_cast<HDF5Output*>(this)->candidatesSinceFlush = 0;
 
-	hsize_t n = buffer.size();
+	if (collective) {
+		writeCollective();
+	} else {
+		if (buffer.size() == 0)
+			return;
+		writeRows(dset, buffer);
+	}
+
+	H5Fflush(file, H5F_SCOPE_GLOBAL);
+}
+
+void HDF5Output::writeRows(hid_t dataset, std::vector<unsigned char> &rows) const {
+	// no columns and no properties enabled
+	if (rowSize == 0)
+		return;
+	hsize_t n = rows.size() / rowSize;
 
 	if (n == 0)
 		return;
 
-	hid_t file_space = H5Dget_space(dset);
+	hid_t file_space = H5Dget_space(dataset);
 	hsize_t count = H5Sget_simple_extent_npoints(file_space);
 
 	// resize dataset
 	hsize_t new_size[RANK] = {count + n};
-	H5Dset_extent(dset, new_size);
+	H5Dset_extent(dataset, new_size);
 
 	// get updated filespace
 	H5Sclose(file_space);
-	file_space = H5Dget_space(dset);
+	file_space = H5Dget_space(dataset);
 
 	hsize_t offset[RANK] = {count};
 	hsize_t cnt[RANK] = {n};
@@ -368,14 +598,143 @@ void HDF5Output::flush() const {
 	H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, cnt, NULL);
 	hid_t mspace_id = H5Screate_simple(RANK, cnt, NULL);
 
-	H5Dwrite(dset, sid, mspace_id, file_space, H5P_DEFAULT, buffer.data());
+	H5Dwrite(dataset, sid, mspace_id, file_space, H5P_DEFAULT, rows.data());
+
+	H5Sclose(mspace_id);
+	H5Sclose(file_space);
+
+	rows.clear();
+}
+
+void HDF5Output::writeCollective() const {
+#if defined(CRPROPA_HAVE_MPI) && defined(H5_HAVE_PARALLEL)
+	// the rows of a rank follow those of the lower ranks
+	int rank = 0, size = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	unsigned long long n = buffer.size() / std::max(rowSize, (size_t) 1);
+	std::vector<unsigned long long> counts(size);
+	MPI_Allgather(&n, 1, MPI_UNSIGNED_LONG_LONG, counts.data(), 1, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+	hsize_t total = 0, first = 0;
+	for (int i = 0; i < size; i++) {
+		if (i == rank)
+			first = total;
+		total += counts[i];
+	}
+	if (total == 0)
+		return;
+
+	hid_t file_space = H5Dget_space(dset);
+	hsize_t existing = H5Sget_simple_extent_npoints(file_space);
+	H5Sclose(file_space);
+	hsize_t new_size[RANK] = {existing + total};
+	H5Dset_extent(dset, new_size);
+	file_space = H5Dget_space(dset);
 
+	// ranks without rows take part in the collective write with empty selections
+	hsize_t offset[RANK] = {existing + first};
+	hsize_t cnt[RANK] = {std::max<hsize_t>(n, 1)};
+	hid_t mspace_id = H5Screate_simple(RANK, cnt, NULL);
+	if (n > 0) {
+		H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, cnt, NULL);
+	} else {
+		H5Sselect_none(file_space);
+		H5Sselect_none(mspace_id);
+	}
+	hid_t transfer = H5Pcreate(H5P_DATASET_XFER);
+	H5Pset_dxpl_mpio(transfer, H5FD_MPIO_COLLECTIVE);
+	H5Dwrite(dset, sid, mspace_id, file_space, transfer, buffer.data());
+	H5Pclose(transfer);
 	H5Sclose(mspace_id);
 	H5Sclose(file_space);
 
 	buffer.clear();
+#endif
+}
 
-	H5Fflush(file, H5F_SCOPE_GLOBAL);
+void HDF5Output::broadcast(std::vector<char> &data) const {
+#ifdef CRPROPA_HAVE_MPI
+	unsigned long long size = data.size();
+	MPI_Bcast(&size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+	data.resize(size);
+	if (size > 0)
+		MPI_Bcast(data.data(), size, MPI_CHAR, 0, MPI_COMM_WORLD);
+#endif
+}
+
+void HDF5Output::writeShard(size_t i) const {
+	Shard &shard = shards[i];
+	if (shard.buffer.empty())
+		return;
+	if (shard.dset < 0) {
+		char name[64];
+		std::sprintf(name, "CRPROPA3_shards/%03lu", (unsigned long) i);
+		shard.dset = createDataset(name);
+	}
+	count += shard.buffer.size() / rowSize;
+	writeRows(shard.dset, shard.buffer);
+}
+
+// copy an attribute to the dataset given by target, callback for H5Aiterate2
+static herr_t copyAttribute(hid_t location, const char *name, const H5A_info_t *, void *target) {
+	hid_t attr = H5Aopen(location, name, H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	hid_t space = H5Aget_space(attr);
+	std::vector<char> data(H5Tget_size(type) * std::max(H5Sget_simple_extent_npoints(space), (hssize_t) 1));
+	H5Aread(attr, type, data.data());
+	hid_t copy = H5Acreate2(*static_cast<hid_t *>(target), name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(copy, type, data.data());
+	H5Aclose(copy);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+	return 0;
+}
+
+void HDF5Output::mergeShards() {
+#if H5_VERSION_GE(1, 10, 0)
+	// map the shards one after the other into the virtual dataset
+	std::vector<hsize_t> sizes(shards.size(), 0);
+	hsize_t total = 0;
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (shards[i].dset < 0)
+			continue;
+		hid_t space = H5Dget_space(shards[i].dset);
+		sizes[i] = H5Sget_simple_extent_npoints(space);
+		H5Sclose(space);
+		total += sizes[i];
+	}
+
+	hsize_t dims[RANK] = {total};
+	hid_t vspace = H5Screate_simple(RANK, dims, NULL);
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	hsize_t offset = 0;
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (sizes[i] == 0)
+			continue;
+		hsize_t start[RANK] = {offset};
+		hsize_t cnt[RANK] = {sizes[i]};
+		H5Sselect_hyperslab(vspace, H5S_SELECT_SET, start, NULL, cnt, NULL);
+		hid_t source = H5Screate_simple(RANK, cnt, NULL);
+		char name[64];
+		std::sprintf(name, "CRPROPA3_shards/%03lu", (unsigned long) i);
+		H5Pset_virtual(plist, vspace, ".", name, source);
+		H5Sclose(source);
+		offset += sizes[i];
+	}
+	H5Sselect_all(vspace);
+
+	hid_t vds = H5Dcreate2(file, "CRPROPA3", sid, vspace, H5P_DEFAULT, plist, H5P_DEFAULT);
+	H5Aiterate2(shards[0].dset, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copyAttribute, &vds);
+	H5Dclose(vds);
+	H5Pclose(plist);
+	H5Sclose(vspace);
+
+	for (size_t i = 0; i < shards.size(); i++)
+		if (shards[i].dset >= 0)
+			H5Dclose(shards[i].dset);
+	shards.clear();
+#endif
 }
 
 std::string HDF5Output::getDescription() const  {
@@ -387,6 +746,86 @@ void HDF5Output::setFlushLimit(unsigned int N)
 	flushLimit = N;
 }
 
+void HDF5Output::setAsync(bool async, size_t capacity) {
+	if (async && collective)
+		throw std::runtime_error("HDF5Output: the collective output is not used with setAsync");
+	delete pipeline;
+	pipeline = 0;
+	if (async)
+		pipeline = new AsyncPipeline<std::vector<unsigned char>, HDF5Output>(this, capacity);
+}
+
+bool HDF5Output::getAsync() const {
+	return pipeline != 0;
+}
+
+void HDF5Output::setChunkSize(size_t rows) {
+	if (file >= 0)
+		throw std::runtime_error("HDF5Output: setChunkSize has to be called before the file is opened");
+	if (rows == 0)
+		throw std::runtime_error("HDF5Output: chunk size must be positive");
+	chunkSize = rows;
+}
+
+size_t HDF5Output::getChunkSize() const {
+	return chunkSize;
+}
+
+void HDF5Output::setCompression(Compression filter, int level) {
+	if (file >= 0)
+		throw std::runtime_error("HDF5Output: setCompression has to be called before the file is opened");
+	compression = filter;
+	compressionLevel = level;
+}
+
+HDF5Output::Compression HDF5Output::getCompression() const {
+	return (Compression) compression;
+}
+
+int HDF5Output::getCompressionLevel() const {
+	return compressionLevel;
+}
+
+void HDF5Output::setShuffle(bool shuffle) {
+	if (file >= 0)
+		throw std::runtime_error("HDF5Output: setShuffle has to be called before the file is opened");
+	this->shuffle = shuffle;
+}
+
+bool HDF5Output::getShuffle() const {
+	return shuffle;
+}
+
+void HDF5Output::setSharded(bool sharded) {
+	if (file >= 0)
+		throw std::runtime_error("HDF5Output: setSharded has to be called before the file is opened");
+#if !H5_VERSION_GE(1, 10, 0)
+	if (sharded)
+		throw std::runtime_error("HDF5Output: sharded output requires HDF5 1.10 or newer");
+#endif
+	this->sharded = sharded;
+}
+
+bool HDF5Output::getSharded() const {
+	return sharded;
+}
+
+#ifdef CRPROPA_HAVE_MPI
+void HDF5Output::setCollective(bool collective) {
+	if (file >= 0)
+		throw std::runtime_error("HDF5Output: setCollective has to be called before the file is opened");
+#ifndef H5_HAVE_PARALLEL
+	if (collective)
+		throw std::runtime_error("HDF5Output: collective output requires a parallel HDF5 library");
+#endif
+	this->collective = collective;
+}
+
+bool HDF5Output::getCollective() const {
+	return collective;
+}
+#endif
+
 } // namespace crpropa
 
 #endif // CRPROPA_HAVE_HDF5
@@ -0,0 +1,465 @@
+#ifdef CRPROPA_HAVE_HDF5
+
+#include "crpropa/module/HDF5Reader.h"
+#include "crpropa/module/ParticleCollector.h"
+#include "crpropa/Units.h"
+#include "kiss/logger.h"
+
+#include <hdf5.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// names of the fixed columns of HDF5Output, in the order of FixedColumn
+static const char *fixedColumnNames[] = {
+	"D", "z",
+	"SN", "ID", "E", "X", "Y", "Z", "Px", "Py", "Pz",
+	"SN0", "ID0", "E0", "X0", "Y0", "Z0", "P0x", "P0y", "P0z",
+	"SN1", "ID1", "E1", "X1", "Y1", "Z1", "P1x", "P1y", "P1z",
+	"W", "tag"
+};
+
+// Variant type of a member of the compound type, TYPE_NONE if not supported
+static Variant::Type H5TtoVariantType(hid_t type) {
+	size_t size = H5Tget_size(type);
+	H5T_class_t typeClass = H5Tget_class(type);
+	if (typeClass == H5T_INTEGER) {
+		bool isUnsigned = H5Tget_sign(type) == H5T_SGN_NONE;
+		if (size == 1)
+			return isUnsigned ? Variant::TYPE_UCHAR : Variant::TYPE_CHAR;
+		if (size == 2)
+			return isUnsigned ? Variant::TYPE_UINT16 : Variant::TYPE_INT16;
+		if (size == 4)
+			return isUnsigned ? Variant::TYPE_UINT32 : Variant::TYPE_INT32;
+		if (size == 8)
+			return isUnsigned ? Variant::TYPE_UINT64 : Variant::TYPE_INT64;
+	} else if (typeClass == H5T_FLOAT) {
+		if (size == sizeof(float))
+			return Variant::TYPE_FLOAT;
+		if (size == sizeof(double))
+			return Variant::TYPE_DOUBLE;
+		if (size == sizeof(long double))
+			return Variant::TYPE_LONGDOUBLE;
+	} else if ((typeClass == H5T_STRING) && (H5Tis_variable_str(type) <= 0)) {
+		return Variant::TYPE_STRING;
+	}
+	return Variant::TYPE_NONE;
+}
+
+template<class T>
+static Variant loadValue(const unsigned char *data) {
+	T value;
+	memcpy(&value, data, sizeof(T));
+	return Variant(value);
+}
+
+HDF5Reader::HDF5Reader(const std::string &filename, const std::string &dataset) :
+		filename(filename), datasetName(dataset), file(-1), dset(-1), memType(-1), rowSize(0),
+		fixed(nFixedColumns, -1), lengthScale(Mpc), energyScale(EeV), nRows(0), first(0), count(0),
+		chunkSize(16384), restart(false), next(0), chunkFirst(0), chunkRows(0) {
+	file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("HDF5Reader: cannot open file " + filename);
+	dset = H5Dopen2(file, dataset.c_str(), H5P_DEFAULT);
+	if (dset < 0) {
+		close();
+		throw std::runtime_error("HDF5Reader: no dataset " + dataset + " in " + filename);
+	}
+	hid_t fileType = H5Dget_type(dset);
+	if (H5Tget_class(fileType) != H5T_COMPOUND) {
+		H5Tclose(fileType);
+		close();
+		throw std::runtime_error("HDF5Reader: dataset " + dataset + " is not an output of HDF5Output");
+	}
+	// the rows are read with the native layout of the compound type
+	memType = H5Tget_native_type(fileType, H5T_DIR_ASCEND);
+	H5Tclose(fileType);
+	rowSize = H5Tget_size(memType);
+
+	int nMembers = H5Tget_nmembers(memType);
+	for (int i = 0; i < nMembers; i++) {
+		char *name = H5Tget_member_name(memType, i);
+		hid_t type = H5Tget_member_type(memType, i);
+		Column column;
+		column.name = name;
+		column.offset = H5Tget_member_offset(memType, i);
+		column.size = H5Tget_size(type);
+		column.type = H5TtoVariantType(type);
+		H5Tclose(type);
+		H5free_memory(name);
+
+		if (column.type == Variant::TYPE_NONE) {
+			KISS_LOG_WARNING << "HDF5Reader: column " << column.name << " has an unsupported type and is skipped";
+			continue;
+		}
+		const char **fixedName = std::find_if(fixedColumnNames, fixedColumnNames + nFixedColumns,
+				[&column](const char *n) { return column.name == n; });
+		if (fixedName != fixedColumnNames + nFixedColumns)
+			fixed[fixedName - fixedColumnNames] = columns.size();
+		else
+			propertyColumns.push_back(columns.size());
+		columns.push_back(column);
+	}
+
+	hid_t space = H5Dget_space(dset);
+	nRows = H5Sget_simple_extent_npoints(space);
+	H5Sclose(space);
+	count = nRows;
+
+	lengthScale = readDoubleAttribute("LengthScale", Mpc);
+	energyScale = readDoubleAttribute("EnergyScale", EeV);
+	readTagNames();
+}
+
+HDF5Reader::~HDF5Reader() {
+	close();
+}
+
+void HDF5Reader::close() {
+	if (memType >= 0)
+		H5Tclose(memType);
+	if (dset >= 0)
+		H5Dclose(dset);
+	if (file >= 0)
+		H5Fclose(file);
+	memType = dset = file = -1;
+}
+
+double HDF5Reader::readDoubleAttribute(const std::string &key, double defaultValue) const {
+	if (H5Aexists(dset, key.c_str()) <= 0)
+		return defaultValue;
+	double value = defaultValue;
+	hid_t attr = H5Aopen(dset, key.c_str(), H5P_DEFAULT);
+	if (H5Aread(attr, H5T_NATIVE_DOUBLE, &value) < 0)
+		value = defaultValue;
+	H5Aclose(attr);
+	return value;
+}
+
+std::string HDF5Reader::getStringAttribute(const std::string &key) const {
+	if (H5Aexists(dset, key.c_str()) <= 0)
+		return "";
+	hid_t attr = H5Aopen(dset, key.c_str(), H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	std::string value;
+	if ((H5Tget_class(type) == H5T_STRING) && (H5Tis_variable_str(type) <= 0)) {
+		size_t length = H5Tget_size(type);
+		std::vector<char> data(length + 1, '\0');
+		hid_t strtype = H5Tcopy(H5T_C_S1);
+		H5Tset_size(strtype, length);
+		if (H5Aread(attr, strtype, data.data()) >= 0)
+			value = data.data();
+		H5Tclose(strtype);
+	}
+	H5Tclose(type);
+	H5Aclose(attr);
+	return value;
+}
+
+void HDF5Reader::readTagNames() {
+	if ((fixed[ColumnTag] < 0) || (H5Aexists(dset, "TagNames") <= 0))
+		return;
+	hid_t attr = H5Aopen(dset, "TagNames", H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	hid_t space = H5Aget_space(attr);
+	size_t length = H5Tget_size(type);
+	size_t n = H5Sget_simple_extent_npoints(space);
+	std::vector<char> names(n * length);
+	hid_t strtype = H5Tcopy(H5T_C_S1);
+	H5Tset_size(strtype, length);
+	if ((H5Tis_variable_str(type) <= 0) && (H5Aread(attr, strtype, names.data()) >= 0)) {
+		for (size_t i = 0; i < n; i++) {
+			const char *name = &names[i * length];
+			tagNames.push_back(std::string(name, std::find(name, name + length, '\0')));
+			tagSymbols.push_back(SymbolTable::intern(tagNames.back()));
+		}
+	}
+	H5Tclose(strtype);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+}
+
+void HDF5Reader::setChunkSize(size_t rows) {
+	if (rows == 0)
+		throw std::runtime_error("HDF5Reader: chunk size must be positive");
+	chunkSize = rows;
+	chunkRows = 0;
+}
+
+size_t HDF5Reader::getChunkSize() const {
+	return chunkSize;
+}
+
+void HDF5Reader::setRestart(bool restart) {
+	this->restart = restart;
+}
+
+bool HDF5Reader::getRestart() const {
+	return restart;
+}
+
+void HDF5Reader::setRange(size_t first, size_t count) {
+	if ((first > nRows) or (count > nRows - first))
+		throw std::runtime_error("HDF5Reader: range exceeds the dataset of " + filename);
+	this->first = first;
+	this->count = count;
+	chunkRows = 0;
+	rewind();
+}
+
+size_t HDF5Reader::size() const {
+	return count;
+}
+
+void HDF5Reader::rewind() {
+	next = 0;
+}
+
+// read n rows starting at row of the dataset, the caller serialises the access to HDF5
+void HDF5Reader::readChunk(size_t row, size_t n, std::vector<unsigned char> &rows) const {
+	rows.resize(std::max(n * rowSize, (size_t) 1));
+	if (n == 0)
+		return;
+	hid_t space = H5Dget_space(dset);
+	hsize_t offset[1] = {row};
+	hsize_t cnt[1] = {n};
+	H5Sselect_hyperslab(space, H5S_SELECT_SET, offset, NULL, cnt, NULL);
+	hid_t mspace = H5Screate_simple(1, cnt, NULL);
+	herr_t status = H5Dread(dset, memType, mspace, space, H5P_DEFAULT, rows.data());
+	H5Sclose(mspace);
+	H5Sclose(space);
+	if (status < 0)
+		rows.clear();
+}
+
+std::vector<ref_ptr<Candidate> > HDF5Reader::readRows(size_t index, size_t n) const {
+	if ((index > count) or (n > count - index))
+		throw std::runtime_error("HDF5Reader: rows out of range");
+	std::vector<unsigned char> rows;
+	#pragma omp critical
+	{
+	readChunk(first + index, n, rows);
+	}
+	if (rows.size() < n * rowSize)
+		throw std::runtime_error("HDF5Reader: could not read " + filename);
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	for (size_t i = 0; i < n; i++)
+		candidates[i] = makeCandidate(&rows[i * rowSize]);
+	return candidates;
+}
+
+ref_ptr<Candidate> HDF5Reader::getCandidate(size_t index) const {
+	if (index >= count)
+		throw std::runtime_error("HDF5Reader: index out of range");
+	size_t row = first + index;
+	std::vector<unsigned char> data(rowSize);
+	bool ok = true;
+	// keep the chunk of the row, the chunks are aligned to the start of the range
+	#pragma omp critical
+	{
+	if ((chunkRows == 0) || (row < chunkFirst) || (row >= chunkFirst + chunkRows)) {
+		chunkFirst = row - index % chunkSize;
+		chunkRows = std::min(chunkSize, first + count - chunkFirst);
+		readChunk(chunkFirst, chunkRows, chunk);
+		if (chunk.size() < chunkRows * rowSize)
+			chunkRows = 0;
+	}
+	ok = chunkRows > 0;
+	if (ok)
+		memcpy(data.data(), &chunk[(row - chunkFirst) * rowSize], rowSize);
+	}
+	if (!ok)
+		throw std::runtime_error("HDF5Reader: could not read " + filename);
+	return makeCandidate(data.data());
+}
+
+ref_ptr<Candidate> HDF5Reader::getCandidate() const {
+	size_t index;
+#pragma omp atomic capture
+	index = next++;
+	return getCandidate(index);
+}
+
+std::vector<ref_ptr<Candidate> > HDF5Reader::getCandidates(size_t n) const {
+	size_t index;
+#pragma omp atomic capture
+	{ index = next; next += n; }
+	if ((index > count) or (n > count - index))
+		throw std::runtime_error("HDF5Reader: index out of range");
+	return readRows(index, n);
+}
+
+std::vector<ref_ptr<Candidate> > HDF5Reader::getCandidates(const std::vector<size_t> &indices) const {
+	// consecutive indices, as passed by ModuleList::run, are read at once
+	bool consecutive = !indices.empty();
+	for (size_t i = 1; consecutive && (i < indices.size()); i++)
+		consecutive = indices[i] == indices[0] + i;
+	if (consecutive)
+		return readRows(indices[0], indices.size());
+
+	std::vector<ref_ptr<Candidate> > candidates(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		candidates[i] = getCandidate(indices[i]);
+	return candidates;
+}
+
+Variant HDF5Reader::readValue(const unsigned char *row, const Column &column) const {
+	const unsigned char *data = row + column.offset;
+	switch (column.type) {
+	case Variant::TYPE_CHAR:
+		return loadValue<char>(data);
+	case Variant::TYPE_UCHAR:
+		return loadValue<unsigned char>(data);
+	case Variant::TYPE_INT16:
+		return loadValue<int16_t>(data);
+	case Variant::TYPE_UINT16:
+		return loadValue<uint16_t>(data);
+	case Variant::TYPE_INT32:
+		return loadValue<int32_t>(data);
+	case Variant::TYPE_UINT32:
+		return loadValue<uint32_t>(data);
+	case Variant::TYPE_INT64:
+		return loadValue<int64_t>(data);
+	case Variant::TYPE_UINT64:
+		return loadValue<uint64_t>(data);
+	case Variant::TYPE_FLOAT:
+		return loadValue<float>(data);
+	case Variant::TYPE_DOUBLE:
+		return loadValue<double>(data);
+	case Variant::TYPE_LONGDOUBLE:
+		return loadValue<long double>(data);
+	case Variant::TYPE_STRING: {
+		const char *s = reinterpret_cast<const char *>(data);
+		return Variant(std::string(s, std::find(s, s + column.size, '\0')));
+	}
+	default:
+		return Variant();
+	}
+}
+
+double HDF5Reader::readDouble(const unsigned char *row, FixedColumn column, double defaultValue) const {
+	if (fixed[column] < 0)
+		return defaultValue;
+	return readValue(row, columns[fixed[column]]).toDouble();
+}
+
+bool HDF5Reader::hasState(FixedColumn id) const {
+	for (int i = id; i <= id + (ColumnPz - ColumnID); i++)
+		if (fixed[i] >= 0)
+			return true;
+	return false;
+}
+
+// the columns of a state follow its id in the order of FixedColumn
+void HDF5Reader::readState(const unsigned char *row, FixedColumn id, ParticleState &state) const {
+	if (fixed[id] >= 0)
+		state.setId(readValue(row, columns[fixed[id]]).toInt32());
+	FixedColumn energy = FixedColumn(id + 1);
+	if (fixed[energy] >= 0)
+		state.setEnergy(readDouble(row, energy, 0) * energyScale);
+	Vector3d position = state.getPosition() / lengthScale;
+	position.x = readDouble(row, FixedColumn(id + 2), position.x);
+	position.y = readDouble(row, FixedColumn(id + 3), position.y);
+	position.z = readDouble(row, FixedColumn(id + 4), position.z);
+	state.setPosition(position * lengthScale);
+	FixedColumn direction = FixedColumn(id + 5);
+	if (fixed[direction] >= 0)
+		state.setDirection(Vector3d(readDouble(row, direction, 0),
+			readDouble(row, FixedColumn(id + 6), 0), readDouble(row, FixedColumn(id + 7), 0)));
+}
+
+ref_ptr<Candidate> HDF5Reader::makeCandidate(const unsigned char *row) const {
+	ref_ptr<Candidate> c = new Candidate();
+	readState(row, ColumnID, c->current);
+	c->previous = c->current;
+	if (hasState(ColumnID0) && !restart)
+		readState(row, ColumnID0, c->source);
+	else
+		c->source = c->current;
+	if (hasState(ColumnID1) && !restart)
+		readState(row, ColumnID1, c->created);
+	else
+		c->created = c->current;
+
+	if (!restart) {
+		c->setTrajectoryLength(readDouble(row, ColumnD, 0) * lengthScale);
+		if (fixed[ColumnSN] >= 0)
+			c->setSerialNumber(readValue(row, columns[fixed[ColumnSN]]).toUInt64());
+		uint64_t sourceSerialNumber = 0, createdSerialNumber = 0;
+		if (fixed[ColumnSN0] >= 0)
+			sourceSerialNumber = readValue(row, columns[fixed[ColumnSN0]]).toUInt64();
+		if (fixed[ColumnSN1] >= 0)
+			createdSerialNumber = readValue(row, columns[fixed[ColumnSN1]]).toUInt64();
+		c->setParentSerialNumbers(sourceSerialNumber, createdSerialNumber);
+	}
+	c->setRedshift(readDouble(row, ColumnRedshift, c->getRedshift()));
+	c->setWeight(readDouble(row, ColumnWeight, c->getWeight()));
+
+	if (fixed[ColumnTag] >= 0) {
+		int32_t tag = readValue(row, columns[fixed[ColumnTag]]).toInt32();
+		if ((tag >= 0) && (size_t(tag) < tagSymbols.size()))
+			c->setTagOrigin(tagSymbols[tag]);
+	}
+
+	for (size_t i = 0; i < propertyColumns.size(); i++) {
+		const Column &column = columns[propertyColumns[i]];
+		c->setProperty(column.name, readValue(row, column));
+	}
+	return c;
+}
+
+void HDF5Reader::collect(ParticleCollector *collector) const {
+	std::vector<ref_ptr<Candidate> > &container = collector->getContainer();
+	container.reserve(container.size() + count);
+	for (size_t i = 0; i < count; i += chunkSize) {
+		std::vector<ref_ptr<Candidate> > candidates = readRows(i, std::min(chunkSize, count - i));
+		for (size_t j = 0; j < candidates.size(); j++)
+			collector->process(candidates[j]);
+	}
+}
+
+void HDF5Reader::load(const std::string &filename, ParticleCollector *collector) {
+	HDF5Reader reader(filename);
+	reader.collect(collector);
+}
+
+bool HDF5Reader::isHDF5File(const std::string &filename) {
+	static const char signature[8] = {char(0x89), 'H', 'D', 'F', '\r', '\n', char(0x1a), '\n'};
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char header[8];
+	if (!in.read(header, sizeof(header)))
+		return false;
+	return memcmp(header, signature, sizeof(signature)) == 0;
+}
+
+std::vector<std::string> HDF5Reader::getPropertyNames() const {
+	std::vector<std::string> names;
+	for (size_t i = 0; i < propertyColumns.size(); i++)
+		names.push_back(columns[propertyColumns[i]].name);
+	return names;
+}
+
+double HDF5Reader::getLengthScale() const {
+	return lengthScale;
+}
+
+double HDF5Reader::getEnergyScale() const {
+	return energyScale;
+}
+
+std::string HDF5Reader::getDescription() const {
+	std::stringstream ss;
+	ss << "HDF5Reader: " << count << " candidates of " << datasetName << " in " << filename;
+	if (restart)
+		ss << ", restarted";
+	return ss.str();
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_HDF5
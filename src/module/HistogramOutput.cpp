@@ -0,0 +1,287 @@
+#include "crpropa/module/HistogramOutput.h"
+#ifdef WITH_GALACTIC_LENSES
+#include "crpropa/magneticLens/Pixelization.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+HistogramOutput::HistogramOutput(const std::string &filename) :
+		nBins(1), pixelization(0), filename(filename), histogram(1, 0.) {
+	setRunOnInactive(true);
+#ifdef _OPENMP
+	threadHistograms.resize(omp_get_max_threads());
+#else
+	threadHistograms.resize(1);
+#endif
+}
+
+HistogramOutput::~HistogramOutput() {
+	try {
+		close();
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+	}
+#ifdef WITH_GALACTIC_LENSES
+	delete pixelization;
+#endif
+}
+
+void HistogramOutput::addAxis(const Axis &axis) {
+	if (axis.nBins == 0)
+		throw std::runtime_error("HistogramOutput: axis without bins");
+	merge();
+	for (size_t i = 0; i < histogram.size(); i++)
+		if (histogram[i] != 0)
+			throw std::runtime_error("HistogramOutput: cannot add axis after candidates have been counted");
+
+	axes.push_back(axis);
+	nBins *= axis.nBins;
+	strides.assign(axes.size(), 1);
+	for (size_t i = axes.size() - 1; i > 0; i--)
+		strides[i - 1] = strides[i] * axes[i].nBins;
+	histogram.assign(nBins, 0.);
+}
+
+void HistogramOutput::addAxis(Quantity quantity, size_t nBins, double min, double max, bool logarithmic) {
+	if ((quantity == CurrentId) || (quantity == SourceId) || (quantity == ArrivalDirection))
+		throw std::runtime_error("HistogramOutput: use addIdAxis or addPixelAxis for this quantity");
+	if (max <= min)
+		throw std::runtime_error("HistogramOutput: axis maximum has to be larger than the minimum");
+	if (logarithmic && (min <= 0))
+		throw std::runtime_error("HistogramOutput: logarithmic axis needs a positive minimum");
+	Axis axis;
+	axis.quantity = quantity;
+	axis.nBins = nBins;
+	axis.min = logarithmic ? log10(min) : min;
+	axis.max = logarithmic ? log10(max) : max;
+	axis.logarithmic = logarithmic;
+	addAxis(axis);
+}
+
+void HistogramOutput::addIdAxis(Quantity quantity, const std::vector<int> &ids) {
+	if ((quantity != CurrentId) && (quantity != SourceId))
+		throw std::runtime_error("HistogramOutput: addIdAxis needs CurrentId or SourceId");
+	Axis axis;
+	axis.quantity = quantity;
+	axis.nBins = ids.size();
+	axis.min = 0;
+	axis.max = ids.size();
+	axis.logarithmic = false;
+	axis.ids = ids;
+	addAxis(axis);
+}
+
+void HistogramOutput::addPixelAxis(unsigned int order) {
+#ifdef WITH_GALACTIC_LENSES
+	if (pixelization)
+		throw std::runtime_error("HistogramOutput: only one pixel axis is supported");
+	pixelization = new Pixelization(order);
+	Axis axis;
+	axis.quantity = ArrivalDirection;
+	axis.nBins = pixelization->nPix();
+	axis.min = 0;
+	axis.max = axis.nBins;
+	axis.logarithmic = false;
+	addAxis(axis);
+#else
+	throw std::runtime_error("HistogramOutput: pixel axis requires CRPropa with ENABLE_GALACTICMAGNETICLENS");
+#endif
+}
+
+bool HistogramOutput::findBin(const Axis &axis, const Candidate *candidate, size_t &bin) const {
+	double x;
+	switch (axis.quantity) {
+	case CurrentId:
+	case SourceId: {
+		int id = (axis.quantity == CurrentId) ? candidate->current.getId() : candidate->source.getId();
+		std::vector<int>::const_iterator i = std::find(axis.ids.begin(), axis.ids.end(), id);
+		if (i == axis.ids.end())
+			return false;
+		bin = i - axis.ids.begin();
+		return true;
+	}
+	case ArrivalDirection: {
+#ifdef WITH_GALACTIC_LENSES
+		Vector3d d = candidate->current.getDirection() * -1;
+		bin = pixelization->vector2Pix(d.x, d.y, d.z);
+		return true;
+#else
+		return false;
+#endif
+	}
+	case CurrentEnergy:
+		x = candidate->current.getEnergy();
+		break;
+	case SourceEnergy:
+		x = candidate->source.getEnergy();
+		break;
+	case TrajectoryLength:
+		x = candidate->getTrajectoryLength();
+		break;
+	case Redshift:
+		x = candidate->getRedshift();
+		break;
+	default:
+		return false;
+	}
+
+	if (axis.logarithmic) {
+		if (x <= 0)
+			return false;
+		x = log10(x);
+	}
+	if ((x < axis.min) || (x >= axis.max))
+		return false;
+	bin = std::min(size_t((x - axis.min) / (axis.max - axis.min) * axis.nBins), axis.nBins - 1);
+	return true;
+}
+
+void HistogramOutput::process(Candidate *candidate) const {
+	size_t index = 0;
+	for (size_t i = 0; i < axes.size(); i++) {
+		size_t bin;
+		if (not findBin(axes[i], candidate, bin))
+			return;
+		index += bin * strides[i];
+	}
+
+	int slot = 0;
+#ifdef _OPENMP
+	slot = (omp_get_level() > 1) ? -1 : omp_get_thread_num();
+#endif
+	if ((slot < 0) || (slot >= (int)threadHistograms.size())) {
+		// nested or additional threads fill the merged histogram
+		#pragma omp critical(HistogramOutput)
+		histogram[index] += candidate->getWeight();
+		return;
+	}
+
+	// only this thread touches its histogram, allocate it on first use
+	std::vector<double> &h = threadHistograms[slot];
+	if (h.size() != nBins)
+		h.assign(nBins, 0.);
+	h[index] += candidate->getWeight();
+}
+
+void HistogramOutput::merge() const {
+	#pragma omp critical(HistogramOutput)
+	for (size_t t = 0; t < threadHistograms.size(); t++) {
+		std::vector<double> &h = threadHistograms[t];
+		if (h.size() == histogram.size())
+			for (size_t i = 0; i < h.size(); i++)
+				histogram[i] += h[i];
+		std::vector<double>().swap(h);
+	}
+}
+
+size_t HistogramOutput::getIndex(const std::vector<size_t> &bins) const {
+	if (bins.size() != axes.size())
+		throw std::runtime_error("HistogramOutput: number of bins does not match the number of axes");
+	size_t index = 0;
+	for (size_t i = 0; i < axes.size(); i++) {
+		if (bins[i] >= axes[i].nBins)
+			throw std::runtime_error("HistogramOutput: bin out of range");
+		index += bins[i] * strides[i];
+	}
+	return index;
+}
+
+size_t HistogramOutput::getNumberOfBins() const {
+	return nBins;
+}
+
+size_t HistogramOutput::getNumberOfAxes() const {
+	return axes.size();
+}
+
+double HistogramOutput::getBinContent(size_t index) const {
+	return getHistogram().at(index);
+}
+
+const std::vector<double> &HistogramOutput::getHistogram() const {
+	merge();
+	return histogram;
+}
+
+static const char *quantityName(HistogramOutput::Quantity quantity) {
+	switch (quantity) {
+	case HistogramOutput::CurrentEnergy: return "CurrentEnergy";
+	case HistogramOutput::SourceEnergy: return "SourceEnergy";
+	case HistogramOutput::TrajectoryLength: return "TrajectoryLength";
+	case HistogramOutput::Redshift: return "Redshift";
+	case HistogramOutput::CurrentId: return "CurrentId";
+	case HistogramOutput::SourceId: return "SourceId";
+	case HistogramOutput::ArrivalDirection: return "ArrivalDirection";
+	}
+	return "";
+}
+
+void HistogramOutput::save(const std::string &filename) const {
+	std::ofstream out(filename.c_str());
+	if (!out.is_open())
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+	const std::vector<double> &h = getHistogram();
+
+	out << "# HistogramOutput\n";
+	for (size_t i = 0; i < axes.size(); i++) {
+		const Axis &a = axes[i];
+		out << "# axis " << i << ": " << quantityName(a.quantity) << " " << a.nBins << " bins:";
+		if (!a.ids.empty()) {
+			for (size_t j = 0; j < a.ids.size(); j++)
+				out << " " << a.ids[j];
+		} else if (a.quantity == ArrivalDirection) {
+			out << " HEALPix pixels, ring scheme";
+		} else if (a.logarithmic) {
+			out << " " << pow(10, a.min) << " .. " << pow(10, a.max) << " logarithmic";
+		} else {
+			out << " " << a.min << " .. " << a.max;
+		}
+		out << "\n";
+	}
+	out << "# ";
+	for (size_t i = 0; i < axes.size(); i++)
+		out << "bin" << i << "\t";
+	out << "content\n";
+
+	out.precision(12);
+	for (size_t index = 0; index < h.size(); index++) {
+		if (h[index] == 0)
+			continue;
+		for (size_t i = 0; i < axes.size(); i++)
+			out << (index / strides[i]) % axes[i].nBins << "\t";
+		out << h[index] << "\n";
+	}
+}
+
+void HistogramOutput::close() {
+	if (filename.empty())
+		return;
+	save(filename);
+	filename.clear();
+}
+
+void HistogramOutput::clear() {
+	merge();
+	std::fill(histogram.begin(), histogram.end(), 0.);
+}
+
+std::string HistogramOutput::getDescription() const {
+	std::stringstream s;
+	s << "HistogramOutput: " << axes.size() << " axes, " << nBins << " bins";
+	if (!filename.empty())
+		s << ", file " << filename;
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,136 @@
+#include "crpropa/module/InteractionManager.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// number of rates kept on the stack
+static const size_t nStackRates = 16;
+
+InteractionManager::InteractionManager(double limit) {
+	setLimit(limit);
+}
+
+void InteractionManager::add(Module *interaction) {
+	if (interaction == 0)
+		throw std::runtime_error("InteractionManager: invalid module");
+	interactions.push_back(interaction);
+}
+
+std::size_t InteractionManager::size() const {
+	return interactions.size();
+}
+
+ref_ptr<Module> InteractionManager::operator[](const std::size_t i) {
+	if (i >= interactions.size())
+		throw std::runtime_error("InteractionManager: index out of range");
+	return interactions[i];
+}
+
+void InteractionManager::setLimit(double l) {
+	if (l <= 0)
+		throw std::runtime_error("InteractionManager: limit <= 0");
+	limit = l;
+}
+
+double InteractionManager::getLimit() const {
+	return limit;
+}
+
+double InteractionManager::getInteractionRate(const Candidate *candidate) const {
+	double rate = 0;
+	for (size_t i = 0; i < interactions.size(); i++)
+		rate += interactions[i]->getInteractionRate(candidate);
+	return rate;
+}
+
+std::size_t InteractionManager::select(const Candidate *candidate, double u) const {
+	if (interactions.size() == 0)
+		throw std::runtime_error("InteractionManager: no interactions");
+	std::vector<double> rates(interactions.size());
+	double total = 0;
+	for (size_t i = 0; i < interactions.size(); i++) {
+		rates[i] = interactions[i]->getInteractionRate(candidate);
+		total += rates[i];
+	}
+	double cmp = u * total;
+	for (size_t i = 0; i + 1 < rates.size(); i++) {
+		if (cmp < rates[i])
+			return i;
+		cmp -= rates[i];
+	}
+	return rates.size() - 1;
+}
+
+void InteractionManager::interact(Candidate *candidate) const {
+	if (interactions.size() == 0)
+		return;
+	size_t i = select(candidate, Random::instance().rand());
+	interactions[i]->interact(candidate);
+}
+
+double InteractionManager::getStepLimit(const Candidate *candidate) const {
+	double rate = getInteractionRate(candidate);
+	if (rate <= 0)
+		return std::numeric_limits<double>::max();
+	return limit / rate;
+}
+
+void InteractionManager::process(Candidate *candidate) const {
+	size_t n = interactions.size();
+	if (n == 0)
+		return;
+	double stackRates[nStackRates];
+	std::vector<double> heapRates;
+	double *rates = stackRates;
+	if (n > nStackRates) {
+		heapRates.resize(n);
+		rates = &heapRates[0];
+	}
+
+	Random &random = Random::instance();
+	double step = candidate->getCurrentStep();
+	// the loop is processed at least once for limiting the next step
+	do {
+		double total = 0;
+		for (size_t i = 0; i < n; i++) {
+			rates[i] = interactions[i]->getInteractionRate(candidate);
+			total += rates[i];
+		}
+		if (total <= 0)
+			return;
+
+		// check if an interaction occurs in this step
+		double randDistance = -log(random.rand()) / total;
+		if (step < randDistance) {
+			candidate->limitNextStep(limit / total);
+			return;
+		}
+
+		// select the interaction by its partial rate
+		double cmp = random.rand() * total;
+		size_t i = 0;
+		while ((i + 1 < n) and (cmp >= rates[i])) {
+			cmp -= rates[i];
+			i++;
+		}
+		interactions[i]->interact(candidate);
+
+		// repeat with remaining step
+		step -= randDistance;
+	} while ((step > 0) and candidate->isActive());
+}
+
+std::string InteractionManager::getDescription() const {
+	std::stringstream s;
+	s << "InteractionManager: limit " << limit << ", interactions:";
+	for (size_t i = 0; i < interactions.size(); i++)
+		s << "\n    " << interactions[i]->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
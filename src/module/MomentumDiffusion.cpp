@@ -33,6 +33,35 @@ void ConstantMomentumDiffusion::process(Candidate *c) const {
 	c->limitNextStep(limit * p / AScal * c_light);
 }
 
+void ConstantMomentumDiffusion::processBatch(Candidate **candidates, size_t n) const {
+	static thread_local std::vector<Candidate *> charged;
+	static thread_local std::vector<double> p, dt, eta;
+	charged.clear();
+	for (size_t i = 0; i < n; i++)
+		if (!std::isinf(candidates[i]->current.getRigidity()))
+			charged.push_back(candidates[i]);
+	size_t m = charged.size();
+	if (m == 0)
+		return;
+
+	p.resize(m);
+	dt.resize(m);
+	eta.resize(m);
+	for (size_t i = 0; i < m; i++) {
+		p[i] = charged[i]->current.getEnergy() / c_light;
+		dt[i] = charged[i]->getCurrentStep() / c_light;
+	}
+	Random::instance().randNorm(&eta[0], m);
+
+	double BScal = calculateBScalar();
+	for (size_t i = 0; i < m; i++) {
+		double AScal = calculateAScalar(p[i]);
+		double dp = AScal * dt[i] + BScal * eta[i] * sqrt(dt[i]);
+		charged[i]->current.setEnergy((p[i] + dp) * c_light);
+		charged[i]->limitNextStep(limit * p[i] / AScal * c_light);
+	}
+}
+
 double ConstantMomentumDiffusion::calculateAScalar(double p) const {
 	double a = + 2. / p * Dpp;
 	return a; 
@@ -1,13 +1,17 @@
 #include "crpropa/module/NuclearDecay.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/Source.h"
 
 #include <fstream>
 #include <limits>
 #include <cmath>
 #include <stdexcept>
+#include <algorithm>
+#include <mutex>
 
 #include "kiss/logger.h"
 
@@ -20,36 +24,82 @@ NuclearDecay::NuclearDecay(bool electrons, bool photons, bool neutrinos, double
 	limit = l;
 	setDescription("NuclearDecay");
 
-	// load decay table
-	std::string filename = getDataPath("nuclear_decay.txt");
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
-		throw std::runtime_error(
-				"crpropa::NuclearDecay: could not open file " + filename);
-
+	// the decay modes are parsed per nucleus on first use
+	decayData = new DataTable(getDataPath("nuclear_decay.txt"));
 	decayTable.resize(27 * 31);
-	std::string line;
-	while (std::getline(infile,line)) {
-		std::stringstream stream(line);
-		if (stream.peek() == '#')
-			continue;
-		DecayMode decay;
-		int Z, N;
-		double lifetime;
-		stream >> Z >> N >> decay.channel >> lifetime;
-		decay.rate = 1. / lifetime / c_light; // decay rate in [1/m]
-		std::vector<double> gamma;
-		double val;
-		while (stream >> val)
-			gamma.push_back(val);
-		for (int i = 0; i < gamma.size(); i += 2) {
-			decay.energy.push_back(gamma[i] * keV);
-			decay.intensity.push_back(gamma[i+1]);
+	decayLoaded = std::vector<std::atomic<bool> >(27 * 31);
+}
+
+static std::mutex loadMutex;
+
+const NuclearDecay::Decays &NuclearDecay::getDecays(int Z, int N) const {
+	static const Decays noDecays;
+	if ((Z < 0) or (Z > 26) or (N < 0) or (N > 30))
+		return noDecays;
+	size_t idx = Z * 31 + N;
+
+	if (not decayLoaded[idx].load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(loadMutex);
+		if (not decayLoaded[idx].load(std::memory_order_relaxed)) {
+			Decays &decays = decayTable[idx];
+			for (size_t i = 0; i < decayData->size(); i++) {
+				const double *row = decayData->row(i);
+				size_t n = decayData->columns(i);
+				if ((n < 4) or (row[0] != Z) or (row[1] != N))
+					continue;
+				DecayMode decay;
+				decay.channel = row[2];
+				decay.rate = 1. / row[3] / c_light; // decay rate in [1/m]
+				decays.totalRate += decay.rate;
+				decay.cumulativeRate = decays.totalRate;
+				decay.firstGamma = decays.gammaEnergy.size();
+				for (size_t j = 4; j + 1 < n; j += 2) {
+					decays.gammaEnergy.push_back(row[j] * keV);
+					decays.gammaIntensity.push_back(row[j + 1]);
+				}
+				decay.nGamma = decays.gammaEnergy.size() - decay.firstGamma;
+				decays.modes.push_back(decay);
+			}
+			decayLoaded[idx].store(true, std::memory_order_release);
 		}
-		if (infile)
-			decayTable[Z * 31 + N].push_back(decay);
 	}
-	infile.close();
+	return decayTable[idx];
+}
+
+const NuclearDecay::DecayMode &NuclearDecay::selectMode(const Decays &decays) const {
+	double cmp = Random::instance().rand() * decays.totalRate;
+	size_t i = 0;
+	while ((i + 1 < decays.modes.size()) and (cmp > decays.modes[i].cumulativeRate))
+		i++;
+	return decays.modes[i];
+}
+
+void NuclearDecay::preload(int id) {
+	if (not isNucleus(id))
+		return;
+	int Z = chargeNumber(id);
+	getDecays(Z, massNumber(id) - Z);
+}
+
+void NuclearDecay::preload(const SourceComposition &composition) {
+	std::vector<int> nuclei = composition.getNuclei();
+	int Amax = 0;
+	for (size_t i = 0; i < nuclei.size(); i++)
+		if (isNucleus(nuclei[i]))
+			Amax = std::max(Amax, massNumber(nuclei[i]));
+	for (int Z = 0; Z <= 26; Z++)
+		for (int N = 0; N <= 30 and Z + N <= Amax; N++)
+			getDecays(Z, N);
+}
+
+bool NuclearDecay::isLoaded(int id) const {
+	if (not isNucleus(id))
+		return false;
+	int Z = chargeNumber(id);
+	int N = massNumber(id) - Z;
+	if ((Z > 26) or (N > 30))
+		return false;
+	return decayLoaded[Z * 31 + N].load();
 }
 
 void NuclearDecay::setHaveElectrons(bool b) {
@@ -83,27 +133,15 @@ void NuclearDecay::process(Candidate *candidate) const {
 		int N = A - Z;
 
 		// check if particle can decay
-		const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-		if (decays.size() == 0)
+		const Decays &decays = getDecays(Z, N);
+		if (decays.modes.size() == 0)
 			return;
 
-		// find interaction mode with minimum random decay distance
-		Random &random = Random::instance();
-		double randDistance = std::numeric_limits<double>::max();
-		int channel;
-		double totalRate = 0;
-
-		for (size_t i = 0; i < decays.size(); i++) {
-			double rate = decays[i].rate;
-			rate /= candidate->current.getLorentzFactor();  // relativistic time dilation
-			rate /= (1 + z);  // rate per light travel distance -> rate per comoving distance
-			totalRate += rate;
-			double d = -log(random.rand()) / rate;
-			if (d > randDistance)
-				continue;
-			randDistance = d;
-			channel = decays[i].channel;
-		}
+		// random decay distance from the total rate
+		double totalRate = decays.totalRate;
+		totalRate /= candidate->current.getLorentzFactor();  // relativistic time dilation
+		totalRate /= (1 + z);  // rate per light travel distance -> rate per comoving distance
+		double randDistance = -log(Random::instance().rand()) / totalRate;
 
 		// check if interaction doesn't happen
 		if (step < randDistance) {
@@ -111,6 +149,7 @@ void NuclearDecay::process(Candidate *candidate) const {
 			candidate->limitNextStep(limit / totalRate);
 			return;
 		}
+		int channel = selectMode(decays).channel;
 
 		// interact and repeat with remaining step
 		performInteraction(candidate, channel);
@@ -118,7 +157,42 @@ void NuclearDecay::process(Candidate *candidate) const {
 	} while (step > 0);
 }
 
+double NuclearDecay::getStepLimit(const Candidate *candidate) const {
+	double totalRate = getInteractionRate(candidate);
+	if (totalRate <= 0)
+		return std::numeric_limits<double>::max();
+	return limit / totalRate;
+}
+
+double NuclearDecay::getInteractionRate(const Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (not (isNucleus(id)))
+		return 0;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	const Decays &decays = getDecays(Z, N);
+	// relativistic time dilation and rate per comoving distance
+	return decays.totalRate / (candidate->current.getLorentzFactor() * (1 + candidate->getRedshift()));
+}
+
+void NuclearDecay::interact(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (not (isNucleus(id)))
+		return;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	const Decays &decays = getDecays(Z, N);
+	if (decays.modes.size() == 0)
+		return;
+	performInteraction(candidate, selectMode(decays).channel);
+}
+
 void NuclearDecay::performInteraction(Candidate *candidate, int channel) const {
+	RunStatistics::count("NuclearDecay: interactions");
 	// interpret decay channel
 	int nBetaMinus = digit(channel, 10000);
 	int nBetaPlus = digit(channel, 1000);
@@ -147,24 +221,24 @@ void NuclearDecay::gammaEmission(Candidate *candidate, int channel) const {
 	int N = massNumber(id) - Z;
 
 	// get photon energies and emission probabilities for decay channel
-	const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-	size_t idecay = decays.size();
+	const Decays &decays = getDecays(Z, N);
+	size_t idecay = decays.modes.size();
 	while (idecay-- != 0) {
-		if (decays[idecay].channel == channel)
+		if (decays.modes[idecay].channel == channel)
 			break;
 	}
 
-	const std::vector<double> &energy = decays[idecay].energy;
-	const std::vector<double> &intensity = decays[idecay].intensity;
-
 	// check if photon emission available
-	if (energy.size() == 0)
+	if ((idecay >= decays.modes.size()) or (decays.modes[idecay].nGamma == 0))
 		return;
+	const double *energy = &decays.gammaEnergy[decays.modes[idecay].firstGamma];
+	const double *intensity = &decays.gammaIntensity[decays.modes[idecay].firstGamma];
+	size_t nGamma = decays.modes[idecay].nGamma;
 
 	Random &random = Random::instance();
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 
-	for (int i = 0; i < energy.size(); ++i) {
+	for (size_t i = 0; i < nGamma; ++i) {
 		// check if photon of specific energy is emitted
 		if (random.rand() > intensity[i])
 			continue;
@@ -293,19 +367,11 @@ double NuclearDecay::meanFreePath(int id, double gamma) {
 	int N = A - Z;
 
 	// check if particle can decay
-	const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-	if (decays.size() == 0)
+	const Decays &decays = getDecays(Z, N);
+	if (decays.modes.size() == 0)
 		return std::numeric_limits<double>::max();
 
-	double totalRate = 0;
-
-	for (size_t i = 0; i < decays.size(); i++) {
-		double rate = decays[i].rate;
-		rate /= gamma;
-		totalRate += rate;
-	}
-
-	return 1. / totalRate;
+	return gamma / decays.totalRate;
 }
 
 void NuclearDecay::setInteractionTag(std::string tag) {
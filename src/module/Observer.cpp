@@ -5,6 +5,7 @@
 
 #include "kiss/logger.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 
@@ -13,6 +14,7 @@ namespace crpropa {
 // Observer -------------------------------------------------------------------
 Observer::Observer() :
 		makeInactive(true), clone(false) {
+	setRunOnInactive(true);
 }
 
 void Observer::add(ObserverFeature *feature) {
@@ -77,6 +79,129 @@ void Observer::setDeactivateOnDetection(bool deactivate) {
 	makeInactive = deactivate;
 }
 
+const std::vector<ref_ptr<ObserverFeature> > &Observer::getFeatures() const {
+	return features;
+}
+
+// FastObserver1D -------------------------------------------------------------
+FastObserver1D::FastObserver1D() :
+		clone(false), makeInactive(true), flag(false), flagKey(0),
+		inactiveVeto(false), nucleusVeto(false), neutrinoVeto(false),
+		photonVeto(false), electronVeto(false) {
+	setRunOnInactive(true);
+}
+
+void FastObserver1D::onDetection(Module *action, bool clone_) {
+	detectionAction = action;
+	clone = clone_;
+}
+
+bool FastObserver1D::isVetoed(const Candidate *c) const {
+	int id = c->current.getId();
+	if (inactiveVeto && !c->isActive())
+		return true;
+	if (nucleusVeto && isNucleus(id))
+		return true;
+	int a = abs(id);
+	if (neutrinoVeto && ((a == 12) or (a == 14) or (a == 16)))
+		return true;
+	if (photonVeto && (id == 22))
+		return true;
+	if (electronVeto && (a == 11))
+		return true;
+	for (size_t i = 0; i < vetoParticleIds.size(); i++) {
+		if (id == vetoParticleIds[i])
+			return true;
+	}
+	return false;
+}
+
+void FastObserver1D::process(Candidate *candidate) const {
+	double x = candidate->current.getPosition().x;
+	if (x > 0) {
+		candidate->limitNextStep(x);
+		return;
+	}
+	if (isVetoed(candidate))
+		return;
+
+	if (detectionAction.valid()) {
+		if (clone)
+			detectionAction->process(candidate->clone(false));
+		else
+			detectionAction->process(candidate);
+	}
+
+	if (flag)
+		candidate->setProperty(flagKey, flagValue);
+
+	if (makeInactive)
+		candidate->setActive(false);
+}
+
+void FastObserver1D::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		FastObserver1D::process(candidates[i]);
+}
+
+void FastObserver1D::setFlag(std::string key, std::string value) {
+	flag = !key.empty();
+	if (flag)
+		flagKey = SymbolTable::intern(key);
+	flagValue = Variant(value);
+}
+
+void FastObserver1D::setDeactivateOnDetection(bool deactivate) {
+	makeInactive = deactivate;
+}
+
+void FastObserver1D::setInactiveVeto(bool veto) {
+	inactiveVeto = veto;
+}
+
+void FastObserver1D::setNucleusVeto(bool veto) {
+	nucleusVeto = veto;
+}
+
+void FastObserver1D::setNeutrinoVeto(bool veto) {
+	neutrinoVeto = veto;
+}
+
+void FastObserver1D::setPhotonVeto(bool veto) {
+	photonVeto = veto;
+}
+
+void FastObserver1D::setElectronVeto(bool veto) {
+	electronVeto = veto;
+}
+
+void FastObserver1D::addParticleIdVeto(int id) {
+	vetoParticleIds.push_back(id);
+}
+
+std::string FastObserver1D::getDescription() const {
+	std::stringstream ss;
+	ss << "FastObserver1D: observer at x = 0";
+	if (inactiveVeto)
+		ss << "\n    ObserverInactiveVeto";
+	if (nucleusVeto)
+		ss << "\n    ObserverNucleusVeto";
+	if (neutrinoVeto)
+		ss << "\n    ObserverNeutrinoVeto";
+	if (photonVeto)
+		ss << "\n    ObserverPhotonVeto";
+	if (electronVeto)
+		ss << "\n    ObserverElectronVeto";
+	for (size_t i = 0; i < vetoParticleIds.size(); i++)
+		ss << "\n    ObserverParticleIdVeto: " << vetoParticleIds[i];
+	if (flag)
+		ss << "\n    Flag: '" << SymbolTable::name(flagKey) << "' -> '" << flagValue.asString() << "'";
+	ss << "\n    MakeInactive: " << (makeInactive ? "yes\n" : "no\n");
+	if (detectionAction.valid())
+		ss << "    Action: " << detectionAction->getDescription() << ", clone: " << (clone ? "yes" : "no");
+	return ss.str();
+}
+
 // ObserverFeature ------------------------------------------------------------
 DetectionState ObserverFeature::checkDetection(Candidate *candidate) const {
 	return NOTHING;
@@ -261,19 +386,20 @@ DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
 	if (detList.size()) {
 		double length = c->getTrajectoryLength();
 		size_t index;
-		const std::string DI = "DetectionIndex";
-		std::string value;
+		static const Symbol DI = SymbolTable::intern("DetectionIndex");
 
-		// Load the last detection index
-		if (c->hasProperty(DI)) {
-			index = c->getProperty(DI).asUInt64();
+		// Load the last detection index, a new candidate starts at the first
+		// detection time it has not passed
+		const Variant *lastIndex = c->findProperty(DI);
+		if (lastIndex) {
+			index = lastIndex->asUInt64();
 		}
 		else {
-			index = 0;
+			index = std::lower_bound(detList.begin(), detList.end(), length) - detList.begin();
 		}
 
 		// Break if the particle has been detected once for all detList entries.
-		if (index > detList.size()) {
+		if (index >= detList.size()) {
 			return NOTHING;
 		}
 
@@ -300,7 +426,8 @@ DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
 }
 
 void ObserverTimeEvolution::addTime(const double& t) {
-	detList.push_back(t);
+	// keep the list sorted for the search of the first detection
+	detList.insert(std::upper_bound(detList.begin(), detList.end(), t), t);
 }
 
 void ObserverTimeEvolution::addTimeRange(double min, double max, double numb, bool log) {
@@ -328,6 +455,10 @@ std::string ObserverTimeEvolution::getDescription() const {
 // ObserverSurface--------------------------------------------------------------
 ObserverSurface::ObserverSurface(Surface* _surface) : surface(_surface) { }
 
+ref_ptr<Surface> ObserverSurface::getSurface() const {
+	return surface;
+}
+
 DetectionState ObserverSurface::checkDetection(Candidate *candidate) const
 {
 		double currentDistance = surface->distance(candidate->current.getPosition());
@@ -348,4 +479,35 @@ std::string ObserverSurface::getDescription() const {
 	return ss.str();
 }
 
+// ObserverCatalog ------------------------------------------------------------
+ObserverCatalog::ObserverCatalog(const std::string &propertyName) : propertyName(propertyName) {
+}
+
+void ObserverCatalog::add(const Vector3d &center, double radius) {
+	targets.add(new Sphere(center, radius));
+}
+
+size_t ObserverCatalog::size() const {
+	return targets.size();
+}
+
+DetectionState ObserverCatalog::checkDetection(Candidate *candidate) const {
+	if (targets.size() == 0)
+		return NOTHING;
+
+	candidate->limitNextStep(targets.nearestDistance(candidate->current.getPosition()));
+	std::vector<size_t> crossed = targets.crossedSurfaces(
+			candidate->previous.getPosition(), candidate->current.getPosition());
+	if (crossed.empty())
+		return NOTHING;
+	candidate->setProperty(propertyName, Variant::fromUInt64(crossed[0]));
+	return DETECTED;
+}
+
+std::string ObserverCatalog::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverCatalog: " << targets.size() << " target spheres, index in '" << propertyName << "'";
+	return ss.str();
+}
+
 } // namespace crpropa
@@ -1,16 +1,22 @@
 #include "crpropa/module/Output.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 namespace crpropa {
 
-Output::Output() : outputName(OutputTypeName(Everything)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0) {
+Output::Output() : lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0), filtered(false), outputName(OutputTypeName(Everything)) {
+	setRunOnInactive(true);
 	enableAll();
+	clearFilters();
 }
 
-Output::Output(OutputType outputType) : outputName(OutputTypeName(outputType)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0) {
+Output::Output(OutputType outputType) : lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0), filtered(false), outputName(OutputTypeName(outputType)) {
+	setRunOnInactive(true);
 	setOutputType(outputType);
+	clearFilters();
 }
 
 std::string Output::OutputTypeName(OutputType outputType) {
@@ -122,6 +128,62 @@ size_t Output::size() const {
 	return count;
 }
 
+void Output::addIdFilter(int id) {
+	std::vector<int>::iterator i = std::lower_bound(filterIds.begin(), filterIds.end(), id);
+	if ((i == filterIds.end()) || (*i != id))
+		filterIds.insert(i, id);
+	updateFiltered();
+}
+
+void Output::setEnergyRange(double min, double max) {
+	minEnergy = min;
+	maxEnergy = max;
+	updateFiltered();
+}
+
+void Output::addPropertyRange(const std::string &property, double min, double max) {
+	PropertyRange range;
+	range.name = SymbolTable::intern(property);
+	range.min = min;
+	range.max = max;
+	propertyRanges.push_back(range);
+	updateFiltered();
+}
+
+void Output::clearFilters() {
+	filterIds.clear();
+	minEnergy = 0;
+	maxEnergy = std::numeric_limits<double>::infinity();
+	propertyRanges.clear();
+	updateFiltered();
+}
+
+bool Output::isFiltered() const {
+	return filtered;
+}
+
+void Output::updateFiltered() {
+	filtered = !filterIds.empty() || (minEnergy > 0)
+		|| (maxEnergy < std::numeric_limits<double>::infinity()) || !propertyRanges.empty();
+}
+
+bool Output::acceptFiltered(const Candidate *c) const {
+	if (!filterIds.empty() && !std::binary_search(filterIds.begin(), filterIds.end(), c->current.getId()))
+		return false;
+	double E = c->current.getEnergy();
+	if ((E < minEnergy) || (E >= maxEnergy))
+		return false;
+	for (size_t i = 0; i < propertyRanges.size(); i++) {
+		const Variant *v = c->findProperty(propertyRanges[i].name);
+		if (!v)
+			return false;
+		double value = v->toDouble();
+		if ((value < propertyRanges[i].min) || (value >= propertyRanges[i].max))
+			return false;
+	}
+	return true;
+}
+
 void Output::enableProperty(const std::string &property, const Variant &defaultValue, const std::string &comment) {
 	modify();
 	Property prop;
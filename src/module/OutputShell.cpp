@@ -5,6 +5,10 @@
 
 namespace crpropa {
 
+ShellOutput::ShellOutput() {
+	setRunOnInactive(true);
+}
+
 void ShellOutput::process(Candidate* c) const {
 #pragma omp critical
 	{
@@ -24,6 +28,10 @@ std::string ShellOutput::getDescription() const {
 	return "Shell output";
 }
 
+ShellOutput1D::ShellOutput1D() {
+	setRunOnInactive(true);
+}
+
 void ShellOutput1D::process(Candidate* c) const {
 #pragma omp critical
 	{
@@ -41,12 +49,16 @@ std::string ShellOutput1D::getDescription() const {
 	return "Shell output for 1D";
 }
 
+ShellPropertyOutput::ShellPropertyOutput() {
+	setRunOnInactive(true);
+}
+
 void ShellPropertyOutput::process(Candidate* c) const {
 	Candidate::PropertyMap::const_iterator i = c->properties.begin();
 #pragma omp critical
 	{
 		for ( ; i != c->properties.end(); i++) {
-			std::cout << "  " << i->first << ", " << i->second << std::endl;
+			std::cout << "  " << SymbolTable::name(i->first) << ", " << i->second << std::endl;
 		}
 	}
 }
@@ -0,0 +1,390 @@
+#ifdef CRPROPA_HAVE_PARQUET
+
+#include "crpropa/module/ParquetOutput.h"
+
+#include <arrow/io/file.h>
+#include <parquet/exception.h>
+#include <parquet/stream_writer.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace crpropa {
+
+struct ParquetOutput::Writer {
+	std::shared_ptr<arrow::io::FileOutputStream> file;
+	parquet::StreamWriter stream;
+};
+
+ParquetOutput::ParquetOutput() : Output(), writer(0), rowGroupSize(100000),
+		compression(CompressionZstd), rowsInGroup(0), pipeline(0) {
+}
+
+ParquetOutput::ParquetOutput(const std::string &filename) : Output(), writer(0),
+		filename(filename), rowGroupSize(100000), compression(CompressionZstd),
+		rowsInGroup(0), pipeline(0) {
+}
+
+ParquetOutput::ParquetOutput(const std::string &filename, OutputType outputType) :
+		Output(outputType), writer(0), filename(filename), rowGroupSize(100000),
+		compression(CompressionZstd), rowsInGroup(0), pipeline(0) {
+}
+
+ParquetOutput::~ParquetOutput() {
+	// an exception of the writer thread can only be thrown by close()
+	delete pipeline;
+	pipeline = 0;
+	close();
+}
+
+void ParquetOutput::setRowGroupSize(size_t rows) {
+	if (writer)
+		throw std::runtime_error("ParquetOutput: setRowGroupSize has to be called before open");
+	rowGroupSize = std::max(rows, (size_t) 1);
+}
+
+size_t ParquetOutput::getRowGroupSize() const {
+	return rowGroupSize;
+}
+
+void ParquetOutput::setCompression(Compression compression) {
+	if (writer)
+		throw std::runtime_error("ParquetOutput: setCompression has to be called before open");
+	this->compression = compression;
+}
+
+ParquetOutput::Compression ParquetOutput::getCompression() const {
+	return compression;
+}
+
+static void addColumn(parquet::schema::NodeVector &columns, const std::string &name,
+		parquet::Type::type type, parquet::ConvertedType::type converted = parquet::ConvertedType::NONE) {
+	columns.push_back(parquet::schema::PrimitiveNode::Make(name,
+			parquet::Repetition::REQUIRED, type, converted));
+}
+
+static void addDoubleColumn(parquet::schema::NodeVector &columns, const std::string &name) {
+	addColumn(columns, name, parquet::Type::DOUBLE);
+}
+
+static void addPropertyColumn(parquet::schema::NodeVector &columns, const std::string &name, Variant::Type type) {
+	switch (type) {
+	case Variant::TYPE_BOOL:
+		addColumn(columns, name, parquet::Type::BOOLEAN);
+		break;
+	case Variant::TYPE_CHAR:
+	case Variant::TYPE_UCHAR:
+	case Variant::TYPE_INT16:
+	case Variant::TYPE_UINT16:
+	case Variant::TYPE_INT32:
+	case Variant::TYPE_UINT32:
+	case Variant::TYPE_INT64:
+		addColumn(columns, name, parquet::Type::INT64, parquet::ConvertedType::INT_64);
+		break;
+	case Variant::TYPE_UINT64:
+		addColumn(columns, name, parquet::Type::INT64, parquet::ConvertedType::UINT_64);
+		break;
+	case Variant::TYPE_FLOAT:
+		addColumn(columns, name, parquet::Type::FLOAT);
+		break;
+	case Variant::TYPE_DOUBLE:
+		addColumn(columns, name, parquet::Type::DOUBLE);
+		break;
+	case Variant::TYPE_STRING:
+		addColumn(columns, name, parquet::Type::BYTE_ARRAY, parquet::ConvertedType::UTF8);
+		break;
+	default:
+		throw std::runtime_error("ParquetOutput: no Parquet column type for property " + name);
+	}
+}
+
+void ParquetOutput::open(const std::string &filename) {
+	close();
+	this->filename = filename;
+
+	// the order of the columns has to match consume()
+	parquet::schema::NodeVector columns;
+	if (fields.test(TrajectoryLengthColumn))
+		addDoubleColumn(columns, "D");
+	if (fields.test(RedshiftColumn))
+		addDoubleColumn(columns, "z");
+	if (fields.test(SerialNumberColumn))
+		addColumn(columns, "SN", parquet::Type::INT64, parquet::ConvertedType::UINT_64);
+	if (fields.test(CurrentIdColumn))
+		addColumn(columns, "ID", parquet::Type::INT32, parquet::ConvertedType::INT_32);
+	if (fields.test(CurrentEnergyColumn))
+		addDoubleColumn(columns, "E");
+	if (fields.test(CurrentPositionColumn)) {
+		addDoubleColumn(columns, "X");
+		if (not oneDimensional) {
+			addDoubleColumn(columns, "Y");
+			addDoubleColumn(columns, "Z");
+		}
+	}
+	if (fields.test(CurrentDirectionColumn) && not oneDimensional) {
+		addDoubleColumn(columns, "Px");
+		addDoubleColumn(columns, "Py");
+		addDoubleColumn(columns, "Pz");
+	}
+	if (fields.test(SerialNumberColumn))
+		addColumn(columns, "SN0", parquet::Type::INT64, parquet::ConvertedType::UINT_64);
+	if (fields.test(SourceIdColumn))
+		addColumn(columns, "ID0", parquet::Type::INT32, parquet::ConvertedType::INT_32);
+	if (fields.test(SourceEnergyColumn))
+		addDoubleColumn(columns, "E0");
+	if (fields.test(SourcePositionColumn)) {
+		addDoubleColumn(columns, "X0");
+		if (not oneDimensional) {
+			addDoubleColumn(columns, "Y0");
+			addDoubleColumn(columns, "Z0");
+		}
+	}
+	if (fields.test(SourceDirectionColumn) && not oneDimensional) {
+		addDoubleColumn(columns, "P0x");
+		addDoubleColumn(columns, "P0y");
+		addDoubleColumn(columns, "P0z");
+	}
+	if (fields.test(SerialNumberColumn))
+		addColumn(columns, "SN1", parquet::Type::INT64, parquet::ConvertedType::UINT_64);
+	if (fields.test(CreatedIdColumn))
+		addColumn(columns, "ID1", parquet::Type::INT32, parquet::ConvertedType::INT_32);
+	if (fields.test(CreatedEnergyColumn))
+		addDoubleColumn(columns, "E1");
+	if (fields.test(CreatedPositionColumn)) {
+		addDoubleColumn(columns, "X1");
+		if (not oneDimensional) {
+			addDoubleColumn(columns, "Y1");
+			addDoubleColumn(columns, "Z1");
+		}
+	}
+	if (fields.test(CreatedDirectionColumn) && not oneDimensional) {
+		addDoubleColumn(columns, "P1x");
+		addDoubleColumn(columns, "P1y");
+		addDoubleColumn(columns, "P1z");
+	}
+	if (fields.test(WeightColumn))
+		addDoubleColumn(columns, "W");
+	if (fields.test(CandidateTagColumn))
+		addColumn(columns, "tag", parquet::Type::BYTE_ARRAY, parquet::ConvertedType::UTF8);
+	for (size_t i = 0; i < properties.size(); i++)
+		addPropertyColumn(columns, properties[i].name, properties[i].defaultValue.getType());
+
+	std::shared_ptr<parquet::schema::GroupNode> schema =
+			std::static_pointer_cast<parquet::schema::GroupNode>(
+					parquet::schema::GroupNode::Make("CRPROPA3",
+							parquet::Repetition::REQUIRED, columns));
+
+	parquet::WriterProperties::Builder builder;
+	if (compression == CompressionSnappy)
+		builder.compression(parquet::Compression::SNAPPY);
+	else if (compression == CompressionGzip)
+		builder.compression(parquet::Compression::GZIP);
+	else if (compression == CompressionZstd)
+		builder.compression(parquet::Compression::ZSTD);
+	else
+		builder.compression(parquet::Compression::UNCOMPRESSED);
+
+	Writer *w = new Writer;
+	try {
+		PARQUET_ASSIGN_OR_THROW(w->file, arrow::io::FileOutputStream::Open(filename));
+		w->stream = parquet::StreamWriter(parquet::ParquetFileWriter::Open(w->file, schema, builder.build()));
+	} catch (std::exception &e) {
+		delete w;
+		throw std::runtime_error(std::string("ParquetOutput: cannot create file ") + filename + ": " + e.what());
+	}
+	writer = w;
+	rowsInGroup = 0;
+	pipeline = new AsyncPipeline<Row, ParquetOutput>(this);
+}
+
+void ParquetOutput::close() {
+	// write all pending rows before the file is finalised
+	std::exception_ptr error = pipeline ? pipeline->close() : std::exception_ptr();
+	delete pipeline;
+	pipeline = 0;
+	if (writer) {
+		// the file writer writes the footer when the stream is destroyed
+		writer->stream = parquet::StreamWriter();
+		PARQUET_THROW_NOT_OK(writer->file->Close());
+		delete writer;
+		writer = 0;
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void ParquetOutput::flush() const {
+	if (pipeline)
+		pipeline->drain();
+}
+
+void ParquetOutput::process(Candidate *c) const {
+	#pragma omp critical
+	{
+	if (!writer)
+		const_cast<ParquetOutput*>(this)->open(filename);
+	}
+
+	if (!accept(c))
+		return;
+
+	// only the states of enabled columns are read, consume() writes only those
+	Row r = Row();
+	r.D = c->getTrajectoryLength() / lengthScale;
+	r.z = c->getRedshift();
+
+	r.SN = c->getSerialNumber();
+	r.ID = c->current.getId();
+	r.E = c->current.getEnergy() / energyScale;
+	if (fields.test(CurrentPositionColumn)) {
+		Vector3d v = c->current.getPosition() / lengthScale;
+		r.X = v.x;
+		r.Y = v.y;
+		r.Z = v.z;
+	}
+	if (fields.test(CurrentDirectionColumn)) {
+		Vector3d v = c->current.getDirection();
+		r.Px = v.x;
+		r.Py = v.y;
+		r.Pz = v.z;
+	}
+
+	r.SN0 = c->getSourceSerialNumber();
+	r.ID0 = c->source.getId();
+	r.E0 = c->source.getEnergy() / energyScale;
+	if (fields.test(SourcePositionColumn)) {
+		Vector3d v = c->source.getPosition() / lengthScale;
+		r.X0 = v.x;
+		r.Y0 = v.y;
+		r.Z0 = v.z;
+	}
+	if (fields.test(SourceDirectionColumn)) {
+		Vector3d v = c->source.getDirection();
+		r.P0x = v.x;
+		r.P0y = v.y;
+		r.P0z = v.z;
+	}
+
+	r.SN1 = c->getCreatedSerialNumber();
+	r.ID1 = c->created.getId();
+	r.E1 = c->created.getEnergy() / energyScale;
+	if (fields.test(CreatedPositionColumn)) {
+		Vector3d v = c->created.getPosition() / lengthScale;
+		r.X1 = v.x;
+		r.Y1 = v.y;
+		r.Z1 = v.z;
+	}
+	if (fields.test(CreatedDirectionColumn)) {
+		Vector3d v = c->created.getDirection();
+		r.P1x = v.x;
+		r.P1y = v.y;
+		r.P1z = v.z;
+	}
+
+	r.weight = c->getWeight();
+	if (fields.test(CandidateTagColumn))
+		r.tag = c->getTagOrigin();
+
+	for (size_t i = 0; i < properties.size(); i++) {
+		if (c->hasProperty(properties[i].name))
+			r.properties.push_back(c->getProperty(properties[i].name));
+		else
+			r.properties.push_back(properties[i].defaultValue);
+	}
+
+	pipeline->push(r);
+}
+
+static void writeProperty(parquet::StreamWriter &stream, const Variant &value, Variant::Type type) {
+	switch (type) {
+	case Variant::TYPE_BOOL:
+		stream << value.toBool();
+		break;
+	case Variant::TYPE_UINT64:
+		stream << value.toUInt64();
+		break;
+	case Variant::TYPE_FLOAT:
+		stream << value.toFloat();
+		break;
+	case Variant::TYPE_DOUBLE:
+		stream << value.toDouble();
+		break;
+	case Variant::TYPE_STRING:
+		stream << value.toString();
+		break;
+	default:
+		stream << value.toInt64();
+	}
+}
+
+void ParquetOutput::consume(Row &r) const {
+	parquet::StreamWriter &s = writer->stream;
+	if (fields.test(TrajectoryLengthColumn))
+		s << r.D;
+	if (fields.test(RedshiftColumn))
+		s << r.z;
+	if (fields.test(SerialNumberColumn))
+		s << r.SN;
+	if (fields.test(CurrentIdColumn))
+		s << r.ID;
+	if (fields.test(CurrentEnergyColumn))
+		s << r.E;
+	if (fields.test(CurrentPositionColumn)) {
+		s << r.X;
+		if (not oneDimensional)
+			s << r.Y << r.Z;
+	}
+	if (fields.test(CurrentDirectionColumn) && not oneDimensional)
+		s << r.Px << r.Py << r.Pz;
+	if (fields.test(SerialNumberColumn))
+		s << r.SN0;
+	if (fields.test(SourceIdColumn))
+		s << r.ID0;
+	if (fields.test(SourceEnergyColumn))
+		s << r.E0;
+	if (fields.test(SourcePositionColumn)) {
+		s << r.X0;
+		if (not oneDimensional)
+			s << r.Y0 << r.Z0;
+	}
+	if (fields.test(SourceDirectionColumn) && not oneDimensional)
+		s << r.P0x << r.P0y << r.P0z;
+	if (fields.test(SerialNumberColumn))
+		s << r.SN1;
+	if (fields.test(CreatedIdColumn))
+		s << r.ID1;
+	if (fields.test(CreatedEnergyColumn))
+		s << r.E1;
+	if (fields.test(CreatedPositionColumn)) {
+		s << r.X1;
+		if (not oneDimensional)
+			s << r.Y1 << r.Z1;
+	}
+	if (fields.test(CreatedDirectionColumn) && not oneDimensional)
+		s << r.P1x << r.P1y << r.P1z;
+	if (fields.test(WeightColumn))
+		s << r.weight;
+	if (fields.test(CandidateTagColumn))
+		s << r.tag;
+	for (size_t i = 0; i < properties.size(); i++)
+		writeProperty(s, r.properties[i], properties[i].defaultValue.getType());
+	s << parquet::EndRow;
+
+	count++;
+	if (++const_cast<ParquetOutput*>(this)->rowsInGroup >= rowGroupSize) {
+		s << parquet::EndRowGroup;
+		const_cast<ParquetOutput*>(this)->rowsInGroup = 0;
+	}
+}
+
+void ParquetOutput::commit() const {
+}
+
+std::string ParquetOutput::getDescription() const {
+	return "ParquetOutput: " + filename;
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_PARQUET
@@ -1,32 +1,71 @@
 #include "crpropa/module/ParticleCollector.h"
 #include "crpropa/module/TextOutput.h"
+#include "crpropa/module/BinaryOutput.h"
+#include "crpropa/module/HDF5Reader.h"
 #include "crpropa/Units.h"
 
+#include "kiss/string.h"
+
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
-ParticleCollector::ParticleCollector() : nBuffer(10e6), clone(false), recursive(false)  {
+// number of candidates in an append buffer of a thread
+static const size_t compactBufferSize = 4096;
+
+ParticleCollector::ParticleCollector() : nBuffer(10e6), clone(false), recursive(false), compact(0)  {
         container.reserve(nBuffer); // for 1e6 candidates ~ 500MB of RAM
+	setRunOnInactive(true);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer) : clone(false), recursive(false)  {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer) : clone(false), recursive(false), compact(0)  {
 	container.reserve(nBuffer);
+	setRunOnInactive(true);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : recursive(false) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : recursive(false), compact(0) {
 	container.reserve(nBuffer);
+	setRunOnInactive(true);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) : compact(0) {
 	container.reserve(nBuffer);
+	setRunOnInactive(true);
 }
 
 void ParticleCollector::process(Candidate *c) const {
+	if (compact) {
+		int slot = 0;
+#ifdef _OPENMP
+		slot = (omp_get_level() > 1) ? -1 : omp_get_thread_num();
+#endif
+		if ((slot < 0) || (slot >= (int) threadStorage.size())) {
+#pragma omp critical
+			compactStorage.append(c, compact);
+			return;
+		}
+		CompactStorage &buffer = threadStorage[slot];
+		buffer.append(c, compact);
+		if (buffer.size >= compactBufferSize) {
+#pragma omp critical
+			compactStorage.append(buffer);
+			buffer.clear();
+		}
+		return;
+	}
+
 #pragma omp critical
         {
 		if(clone)
 		       	container.push_back(c->clone(recursive));
-		else
+		else {
+			c->setThreadConfined(false); // shared with the collector
 			container.push_back(c);
+		}
         }
 }
 
@@ -35,6 +74,11 @@ void ParticleCollector::process(ref_ptr<Candidate> c) const {
 }
 
 void ParticleCollector::reprocess(Module *action) const {
+	if (compact) {
+		for (size_t i = 0; i < size(); i++)
+			action->process((*this)[i]);
+		return;
+	}
 	for (ParticleCollector::iterator itr = container.begin(); itr != container.end(); ++itr){
 		if (clone)
 			action->process((*(itr->get())).clone(false));
@@ -44,13 +88,26 @@ void ParticleCollector::reprocess(Module *action) const {
 }
 
 void ParticleCollector::dump(const std::string &filename) const {
+	if (kiss::ends_with(filename, ".bin")) {
+		BinaryOutput output(filename);
+		reprocess(&output);
+		output.close();
+		return;
+	}
 	TextOutput output(filename.c_str(), Output::Everything);
 	reprocess(&output);
 	output.close();
 }
 
 void ParticleCollector::load(const std::string &filename){
-	TextOutput::load(filename.c_str(), this);
+	if (BinaryOutput::isBinaryFile(filename))
+		BinaryOutput::load(filename, this);
+#ifdef CRPROPA_HAVE_HDF5
+	else if (HDF5Reader::isHDF5File(filename))
+		HDF5Reader::load(filename, this);
+#endif
+	else
+		TextOutput::load(filename.c_str(), this);
 }
 
 ParticleCollector::~ParticleCollector() {
@@ -58,15 +115,387 @@ ParticleCollector::~ParticleCollector() {
 }
 
 std::size_t ParticleCollector::size() const {
+	if (compact) {
+		mergeCompact();
+		return compactStorage.size;
+	}
         return container.size();
 }
 
 ref_ptr<Candidate> ParticleCollector::operator[](const std::size_t i) const {
-	return container[i];
+	if (!compact)
+		return container[i];
+
+	mergeCompact();
+	const CompactStorage &s = compactStorage;
+	ref_ptr<Candidate> c = new Candidate();
+	if (compact & CompactCurrent) {
+		s.current.restore(i, c->current);
+		c->previous = c->current;
+	}
+	if (compact & CompactSourceIdEnergy)
+		s.source.restore(i, c->source);
+	if (compact & CompactCreated)
+		s.created.restore(i, c->created);
+	if (compact & CompactInfo) {
+		c->setTrajectoryLength(s.trajectoryLength[i]);
+		c->setRedshift(s.redshift[i]);
+		c->setWeight(s.weight[i]);
+		c->setSerialNumber(s.serialNumber[i]);
+		c->setParentSerialNumbers(s.sourceSerialNumber[i], s.createdSerialNumber[i]);
+	}
+	return c;
+}
+
+size_t ParticleCollector::getColumnWidth(Output::OutputColumn column) {
+	switch (column) {
+	case Output::CurrentPositionColumn:
+	case Output::CurrentDirectionColumn:
+	case Output::SourcePositionColumn:
+	case Output::SourceDirectionColumn:
+	case Output::CreatedPositionColumn:
+	case Output::CreatedDirectionColumn:
+	case Output::SerialNumberColumn:
+		return 3;
+	case Output::ColumnDensityColumn:
+	case Output::CandidateTagColumn:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+// state of the candidate a column refers to
+static const ParticleState &columnState(const Candidate &c, Output::OutputColumn column) {
+	if ((column >= Output::CreatedIdColumn) && (column <= Output::CreatedDirectionColumn))
+		return c.created;
+	if ((column >= Output::SourceIdColumn) && (column <= Output::SourceDirectionColumn))
+		return c.source;
+	return c.current;
+}
+
+void ParticleCollector::readColumn(const Candidate &c, Output::OutputColumn column, double *v) {
+	const ParticleState &state = columnState(c, column);
+	switch (column) {
+	case Output::TrajectoryLengthColumn:
+		v[0] = c.getTrajectoryLength();
+		break;
+	case Output::RedshiftColumn:
+		v[0] = c.getRedshift();
+		break;
+	case Output::WeightColumn:
+		v[0] = c.getWeight();
+		break;
+	case Output::SerialNumberColumn:
+		v[0] = c.getSerialNumber();
+		v[1] = c.getSourceSerialNumber();
+		v[2] = c.getCreatedSerialNumber();
+		break;
+	case Output::CurrentIdColumn:
+	case Output::SourceIdColumn:
+	case Output::CreatedIdColumn:
+		v[0] = state.getId();
+		break;
+	case Output::CurrentEnergyColumn:
+	case Output::SourceEnergyColumn:
+	case Output::CreatedEnergyColumn:
+		v[0] = state.getEnergy();
+		break;
+	case Output::CurrentPositionColumn:
+	case Output::SourcePositionColumn:
+	case Output::CreatedPositionColumn:
+		v[0] = state.getPosition().x;
+		v[1] = state.getPosition().y;
+		v[2] = state.getPosition().z;
+		break;
+	case Output::CurrentDirectionColumn:
+	case Output::SourceDirectionColumn:
+	case Output::CreatedDirectionColumn:
+		v[0] = state.getDirection().x;
+		v[1] = state.getDirection().y;
+		v[2] = state.getDirection().z;
+		break;
+	default:
+		throw std::runtime_error("ParticleCollector: column cannot be exported");
+	}
+}
+
+static void writeColumn(Candidate &c, Output::OutputColumn column, const double *v) {
+	ParticleState &state = const_cast<ParticleState &>(columnState(c, column));
+	switch (column) {
+	case Output::TrajectoryLengthColumn:
+		c.setTrajectoryLength(v[0]);
+		break;
+	case Output::RedshiftColumn:
+		c.setRedshift(v[0]);
+		break;
+	case Output::WeightColumn:
+		c.setWeight(v[0]);
+		break;
+	case Output::SerialNumberColumn:
+		c.setSerialNumber(v[0]);
+		c.setParentSerialNumbers(v[1], v[2]);
+		break;
+	case Output::CurrentIdColumn:
+	case Output::SourceIdColumn:
+	case Output::CreatedIdColumn:
+		state.setId(v[0]);
+		break;
+	case Output::CurrentEnergyColumn:
+	case Output::SourceEnergyColumn:
+	case Output::CreatedEnergyColumn:
+		state.setEnergy(v[0]);
+		break;
+	case Output::CurrentPositionColumn:
+	case Output::SourcePositionColumn:
+	case Output::CreatedPositionColumn:
+		state.setPosition(Vector3d(v[0], v[1], v[2]));
+		break;
+	case Output::CurrentDirectionColumn:
+	case Output::SourceDirectionColumn:
+	case Output::CreatedDirectionColumn:
+		state.setDirection(Vector3d(v[0], v[1], v[2]));
+		break;
+	default:
+		throw std::runtime_error("ParticleCollector: column cannot be imported");
+	}
+}
+
+void ParticleCollector::readCompact(size_t i, Output::OutputColumn column,
+		const Candidate &defaults, double *v) const {
+	// the parts of the state which are not stored are those of a new candidate
+	const CompactStorage &s = compactStorage;
+	const CompactState *state = 0;
+	const ParticleState &reference = columnState(defaults, column);
+	if (&reference == &defaults.created) {
+		if (compact & CompactCreated)
+			state = &s.created;
+	} else if (&reference == &defaults.source) {
+		if (compact & CompactSourceIdEnergy)
+			state = &s.source;
+	} else if (compact & CompactCurrent) {
+		state = &s.current;
+	}
+
+	switch (column) {
+	case Output::TrajectoryLengthColumn:
+	case Output::RedshiftColumn:
+	case Output::WeightColumn:
+	case Output::SerialNumberColumn:
+		if (!(compact & CompactInfo))
+			break;
+		if (column == Output::TrajectoryLengthColumn)
+			v[0] = s.trajectoryLength[i];
+		else if (column == Output::RedshiftColumn)
+			v[0] = s.redshift[i];
+		else if (column == Output::WeightColumn)
+			v[0] = s.weight[i];
+		else {
+			v[0] = s.serialNumber[i];
+			v[1] = s.sourceSerialNumber[i];
+			v[2] = s.createdSerialNumber[i];
+		}
+		return;
+	case Output::CurrentIdColumn:
+	case Output::SourceIdColumn:
+	case Output::CreatedIdColumn:
+		if (!state)
+			break;
+		v[0] = state->id[i];
+		return;
+	case Output::CurrentEnergyColumn:
+	case Output::SourceEnergyColumn:
+	case Output::CreatedEnergyColumn:
+		if (!state)
+			break;
+		v[0] = state->energy[i];
+		return;
+	case Output::CurrentPositionColumn:
+	case Output::SourcePositionColumn:
+	case Output::CreatedPositionColumn:
+		if (!state || (i >= state->x.size()))
+			break;
+		v[0] = state->x[i];
+		v[1] = state->y[i];
+		v[2] = state->z[i];
+		return;
+	case Output::CurrentDirectionColumn:
+	case Output::SourceDirectionColumn:
+	case Output::CreatedDirectionColumn:
+		if (!state || (i >= state->dx.size()))
+			break;
+		{
+			// normalized as by setDirection in operator[]
+			Vector3d d(state->dx[i], state->dy[i], state->dz[i]);
+			d /= d.getR();
+			v[0] = d.x;
+			v[1] = d.y;
+			v[2] = d.z;
+		}
+		return;
+	default:
+		break;
+	}
+	readColumn(defaults, column, v);
+}
+
+void ParticleCollector::exportColumn(Output::OutputColumn column, double *values) const {
+	size_t width = getColumnWidth(column);
+	if (width == 0)
+		throw std::runtime_error("ParticleCollector: column cannot be exported");
+	size_t n = size();
+	if (!compact) {
+		for (size_t i = 0; i < n; i++)
+			readColumn(*container[i], column, values + i * width);
+		return;
+	}
+	Candidate defaults;
+	for (size_t i = 0; i < n; i++)
+		readCompact(i, column, defaults, values + i * width);
+}
+
+void ParticleCollector::importColumn(Output::OutputColumn column, const double *values, size_t n) {
+	if (compact)
+		throw std::runtime_error("ParticleCollector: cannot import columns in compact mode");
+	size_t width = getColumnWidth(column);
+	if (width == 0)
+		throw std::runtime_error("ParticleCollector: column cannot be imported");
+	while (container.size() < n)
+		container.push_back(new Candidate());
+	for (size_t i = 0; i < n; i++)
+		writeColumn(*container[i], column, values + i * width);
 }
 
 void ParticleCollector::clearContainer() {
         container.clear();
+	compactStorage = CompactStorage();
+	for (size_t i = 0; i < threadStorage.size(); i++)
+		threadStorage[i] = CompactStorage();
+}
+
+void ParticleCollector::setCompact(unsigned int fields) {
+	if (size() > 0)
+		throw std::runtime_error("ParticleCollector: cannot change the compact mode of a filled collector");
+	compact = fields;
+#ifdef _OPENMP
+	threadStorage.resize(fields ? omp_get_max_threads() : 0);
+#else
+	threadStorage.resize(fields ? 1 : 0);
+#endif
+}
+
+unsigned int ParticleCollector::getCompact() const {
+	return compact;
+}
+
+void ParticleCollector::mergeCompact() const {
+	bool pending = false;
+	for (size_t i = 0; i < threadStorage.size(); i++)
+		pending |= (threadStorage[i].size > 0);
+	if (!pending)
+		return;
+#pragma omp critical
+	for (size_t i = 0; i < threadStorage.size(); i++) {
+		if (threadStorage[i].size == 0)
+			continue;
+		compactStorage.append(threadStorage[i]);
+		threadStorage[i].clear();
+	}
+}
+
+void ParticleCollector::CompactState::append(const ParticleState &state, bool full) {
+	id.push_back(state.getId());
+	energy.push_back(state.getEnergy());
+	if (!full)
+		return;
+	const Vector3d &p = state.getPosition();
+	x.push_back(p.x);
+	y.push_back(p.y);
+	z.push_back(p.z);
+	const Vector3d &d = state.getDirection();
+	dx.push_back(d.x);
+	dy.push_back(d.y);
+	dz.push_back(d.z);
+}
+
+template<class T>
+static void appendVector(std::vector<T> &a, const std::vector<T> &b) {
+	a.insert(a.end(), b.begin(), b.end());
+}
+
+void ParticleCollector::CompactState::append(const CompactState &other) {
+	appendVector(id, other.id);
+	appendVector(energy, other.energy);
+	appendVector(x, other.x);
+	appendVector(y, other.y);
+	appendVector(z, other.z);
+	appendVector(dx, other.dx);
+	appendVector(dy, other.dy);
+	appendVector(dz, other.dz);
+}
+
+void ParticleCollector::CompactState::restore(size_t i, ParticleState &state) const {
+	state.setId(id[i]);
+	state.setEnergy(energy[i]);
+	if (i < x.size()) {
+		state.setPosition(Vector3d(x[i], y[i], z[i]));
+		state.setDirection(Vector3d(dx[i], dy[i], dz[i]));
+	}
+}
+
+void ParticleCollector::CompactState::clear() {
+	id.clear();
+	energy.clear();
+	x.clear();
+	y.clear();
+	z.clear();
+	dx.clear();
+	dy.clear();
+	dz.clear();
+}
+
+void ParticleCollector::CompactStorage::append(const Candidate *c, unsigned int fields) {
+	if (fields & CompactCurrent)
+		current.append(c->current, true);
+	if (fields & CompactSourceIdEnergy)
+		source.append(c->source, (fields & CompactSource) == CompactSource);
+	if (fields & CompactCreated)
+		created.append(c->created, true);
+	if (fields & CompactInfo) {
+		trajectoryLength.push_back(c->getTrajectoryLength());
+		redshift.push_back(c->getRedshift());
+		weight.push_back(c->getWeight());
+		serialNumber.push_back(c->getSerialNumber());
+		sourceSerialNumber.push_back(c->getSourceSerialNumber());
+		createdSerialNumber.push_back(c->getCreatedSerialNumber());
+	}
+	size++;
+}
+
+void ParticleCollector::CompactStorage::append(const CompactStorage &other) {
+	current.append(other.current);
+	source.append(other.source);
+	created.append(other.created);
+	appendVector(trajectoryLength, other.trajectoryLength);
+	appendVector(redshift, other.redshift);
+	appendVector(weight, other.weight);
+	appendVector(serialNumber, other.serialNumber);
+	appendVector(sourceSerialNumber, other.sourceSerialNumber);
+	appendVector(createdSerialNumber, other.createdSerialNumber);
+	size += other.size;
+}
+
+void ParticleCollector::CompactStorage::clear() {
+	current.clear();
+	source.clear();
+	created.clear();
+	trajectoryLength.clear();
+	redshift.clear();
+	weight.clear();
+	serialNumber.clear();
+	sourceSerialNumber.clear();
+	createdSerialNumber.clear();
+	size = 0;
 }
 
 std::vector<ref_ptr<Candidate> >& ParticleCollector::getContainer() const {
@@ -102,7 +531,7 @@ ParticleCollector::const_iterator ParticleCollector::end() const {
 }
 
 void ParticleCollector::getTrajectory(ModuleList* mlist, std::size_t i, Module *output) const {
-	ref_ptr<Candidate> c_tmp = container[i]->clone();
+	ref_ptr<Candidate> c_tmp = (*this)[i]->clone();
 
 	c_tmp->restart();
 
@@ -1,8 +1,11 @@
 #include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/Source.h"
 #include "kiss/logger.h"
 
 #include <cmath>
@@ -10,6 +13,8 @@
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <mutex>
 
 namespace crpropa {
 
@@ -40,109 +45,203 @@ void PhotoDisintegration::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void PhotoDisintegration::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	pdRate.clear();
-	pdRate.resize(27 * 31);
-
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
-		std::stringstream lineStream(line);
-
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
+void PhotoDisintegration::setCompactTables(bool compact, double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("PhotoDisintegration: the table tolerance must not be negative");
+	compactTables = compact;
+	tableTolerance = tolerance;
+	unloadSpecies();
+}
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			pdRate[Z * 31 + N].push_back(r / Mpc);
-		}
-	}
-	infile.close();
+void PhotoDisintegration::initRate(std::string filename) {
+	rateTable = loadTable(filename, 2);
+	unloadSpecies();
 }
 
 void PhotoDisintegration::initBranching(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	pdBranch.clear();
-	pdBranch.resize(27 * 31);
+	branchTable = loadTable(filename, 3);
+	unloadSpecies();
+}
 
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
+void PhotoDisintegration::initPhotonEmission(std::string filename) {
+	photonTable = loadTable(filename, 5);
+	unloadSpecies();
+}
 
-		std::stringstream lineStream(line);
+ref_ptr<DataTable> PhotoDisintegration::loadTable(std::string filename, size_t nKeys) const {
+	ref_ptr<DataTable> table = new DataTable(filename);
+	for (size_t i = 0; i < table->size(); i++)
+		if (table->columns(i) < nKeys + nlg)
+			throw std::runtime_error("PhotoDisintegration: missing values in file " + filename);
+	return table;
+}
 
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
+void PhotoDisintegration::unloadSpecies() {
+	pdSpecies.clear();
+	pdSpecies.resize(27 * 31);
+	pdLoaded = std::vector<std::atomic<bool> >(27 * 31);
+}
 
-		Branch branch;
-		lineStream >> branch.channel;
+static std::mutex loadMutex;
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			branch.branchingRatio.push_back(r);
-		}
+bool PhotoDisintegration::Species::empty() const {
+	return rate.empty() and (compactRate.size() == 0);
+}
 
-		pdBranch[Z * 31 + N].push_back(branch);
-	}
+double PhotoDisintegration::Species::getRate(double lg) const {
+	if (compactRate.size() > 0)
+		return compactRate.interpolate(lg);
+	return interpolateEquidistant(lg, lgmin, lgmax, rate);
+}
 
-	infile.close();
+double PhotoDisintegration::Species::getBranchingRatio(size_t branch, size_t l) const {
+	if (not compactBranchingRatio.empty())
+		return compactBranchingRatio[branch * nlg + l];
+	return branches[branch].branchingRatio[l];
 }
 
-void PhotoDisintegration::initPhotonEmission(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
+double PhotoDisintegration::Species::getBranchingRatio(size_t branch, double lg) const {
+	if (compactBranchingRatio.empty())
+		return interpolateEquidistant(lg, lgmin, lgmax, branches[branch].branchingRatio);
+	const float *ratio = &compactBranchingRatio[branch * nlg];
+	if (lg <= lgmin)
+		return ratio[0];
+	if (lg >= lgmax)
+		return ratio[nlg - 1];
+	double p = (lg - lgmin) / (lgmax - lgmin) * (nlg - 1);
+	size_t i = floor(p);
+	return ratio[i] + (p - i) * (ratio[i + 1] - ratio[i]);
+}
 
-	// clear previously loaded emission probabilities
-	pdPhoton.clear();
+double PhotoDisintegration::Species::getPhotonProbability(size_t photon, size_t l) const {
+	if (not compactPhotonProbability.empty())
+		return compactPhotonProbability[photon * nlg + l];
+	return photonProbability[photon * nlg + l];
+}
 
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
+// change of mass and charge number in a disintegration channel
+static void channelChange(int channel, int &dA, int &dZ) {
+	int nNeutron = digit(channel, 100000);
+	int nProton = digit(channel, 10000);
+	int nH2 = digit(channel, 1000);
+	int nH3 = digit(channel, 100);
+	int nHe3 = digit(channel, 10);
+	int nHe4 = digit(channel, 1);
+	dA = -nNeutron - nProton - 2 * nH2 - 3 * nH3 - 3 * nHe3 - 4 * nHe4;
+	dZ = -nProton - nH2 - nH3 - 2 * nHe3 - 2 * nHe4;
+}
 
-		std::stringstream lineStream(line);
+const PhotoDisintegration::Species *PhotoDisintegration::getSpecies(int Z, int N) const {
+	if ((Z < 0) or (Z > 26) or (N < 0) or (N > 30))
+		return 0;
+	size_t idx = Z * 31 + N;
 
-		int Z, N, Zd, Nd;
-		lineStream >> Z;
-		lineStream >> N;
-		lineStream >> Zd;
-		lineStream >> Nd;
+	if (not pdLoaded[idx].load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(loadMutex);
+		if (not pdLoaded[idx].load(std::memory_order_relaxed)) {
+			Species &species = pdSpecies[idx];
+			// parse the rows of this nucleus from the tables
+			if (rateTable.valid())
+				for (size_t i = 0; i < rateTable->size(); i++) {
+					const double *row = rateTable->row(i);
+					if ((row[0] != Z) or (row[1] != N))
+						continue;
+					species.rate.clear();
+					for (size_t j = 0; j < nlg; j++)
+						species.rate.push_back(row[2 + j] / Mpc);
+				}
+			if (branchTable.valid())
+				for (size_t i = 0; i < branchTable->size(); i++) {
+					const double *row = branchTable->row(i);
+					if ((row[0] != Z) or (row[1] != N))
+						continue;
+					Branch branch;
+					branch.channel = row[2];
+					branch.branchingRatio.assign(row + 3, row + 3 + nlg);
+					branch.photonBegin = branch.photonEnd = 0;
+					species.branches.push_back(branch);
+				}
+			// photons of each daughter nucleus, shared by the branches leading to it
+			for (size_t k = 0; k < species.branches.size(); k++) {
+				Branch &branch = species.branches[k];
+				int dA, dZ;
+				channelChange(branch.channel, dA, dZ);
+				int Zd = Z + dZ;
+				int Nd = N + dA - dZ;
+				size_t l = 0;
+				while (l < k) {
+					int dAl, dZl;
+					channelChange(species.branches[l].channel, dAl, dZl);
+					if ((dAl == dA) and (dZl == dZ))
+						break;
+					l++;
+				}
+				if (l < k) {
+					branch.photonBegin = species.branches[l].photonBegin;
+					branch.photonEnd = species.branches[l].photonEnd;
+					continue;
+				}
+				branch.photonBegin = species.photonEnergy.size();
+				if (photonTable.valid())
+					for (size_t i = 0; i < photonTable->size(); i++) {
+						const double *row = photonTable->row(i);
+						if ((row[0] != Z) or (row[1] != N) or (row[2] != Zd) or (row[3] != Nd))
+							continue;
+						species.photonEnergy.push_back(row[4] * eV);
+						species.photonProbability.insert(species.photonProbability.end(), row + 5, row + 5 + nlg);
+					}
+				branch.photonEnd = species.photonEnergy.size();
+			}
+			if (compactTables and not species.rate.empty()) {
+				std::vector<double> lg(nlg);
+				for (size_t j = 0; j < nlg; j++)
+					lg[j] = lgmin + j * (lgmax - lgmin) / (nlg - 1);
+				species.compactRate = AdaptiveTable(lg, species.rate, tableTolerance);
+				std::vector<double>().swap(species.rate);
+				for (size_t k = 0; k < species.branches.size(); k++) {
+					std::vector<double> &ratio = species.branches[k].branchingRatio;
+					species.compactBranchingRatio.insert(species.compactBranchingRatio.end(), ratio.begin(), ratio.end());
+					std::vector<double>().swap(ratio);
+				}
+				species.compactPhotonProbability.assign(species.photonProbability.begin(), species.photonProbability.end());
+				std::vector<double>().swap(species.photonProbability);
+			}
+			pdLoaded[idx].store(true, std::memory_order_release);
+		}
+	}
 
-		PhotonEmission em;
-		lineStream >> em.energy;
-		em.energy *= eV;
+	const Species &species = pdSpecies[idx];
+	if (species.empty())
+		return 0;
+	return &species;
+}
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			em.emissionProbability.push_back(r);
-		}
+void PhotoDisintegration::preload(int id) {
+	if (not isNucleus(id))
+		return;
+	int Z = chargeNumber(id);
+	getSpecies(Z, massNumber(id) - Z);
+}
 
-		int key = Z * 1000000 + N * 10000 + Zd * 100 + Nd;
-		if (pdPhoton.find(key) == pdPhoton.end()) {
-			std::vector<PhotonEmission> emissions;
-			pdPhoton[key] = emissions;
-		}
-		pdPhoton[key].push_back(em);
-	}
+void PhotoDisintegration::preload(const SourceComposition &composition) {
+	std::vector<int> nuclei = composition.getNuclei();
+	int Amax = 0;
+	for (size_t i = 0; i < nuclei.size(); i++)
+		if (isNucleus(nuclei[i]))
+			Amax = std::max(Amax, massNumber(nuclei[i]));
+	for (int Z = 0; Z <= 26; Z++)
+		for (int N = 0; N <= 30 and Z + N <= Amax; N++)
+			getSpecies(Z, N);
+}
 
-	infile.close();
+bool PhotoDisintegration::isLoaded(int id) const {
+	if (not isNucleus(id))
+		return false;
+	int Z = chargeNumber(id);
+	int N = massNumber(id) - Z;
+	if ((Z > 26) or (N > 30))
+		return false;
+	return pdLoaded[Z * 31 + N].load();
 }
 
 void PhotoDisintegration::process(Candidate *candidate) const {
@@ -157,12 +256,10 @@ void PhotoDisintegration::process(Candidate *candidate) const {
 		int A = massNumber(id);
 		int Z = chargeNumber(id);
 		int N = A - Z;
-		size_t idx = Z * 31 + N;
 
 		// check if disintegration data available
-		if ((Z > 26) or (N > 30))
-			return;
-		if (pdRate[idx].size() == 0)
+		const Species *species = getSpecies(Z, N);
+		if (not species)
 			return;
 
 		// check if in tabulated energy range
@@ -171,7 +268,7 @@ void PhotoDisintegration::process(Candidate *candidate) const {
 		if ((lg <= lgmin) or (lg >= lgmax))
 			return;
 
-		double rate = interpolateEquidistant(lg, lgmin, lgmax, pdRate[idx]);
+		double rate = species->getRate(lg);
 		rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z); // cosmological scaling, rate per comoving distance
 
 		// check if interaction occurs in this step
@@ -184,22 +281,72 @@ void PhotoDisintegration::process(Candidate *candidate) const {
 		}
 
 		// select channel and interact
-		const std::vector<Branch> &branches = pdBranch[idx];
-		double cmp = random.rand();
-		int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest tabulation point
-		size_t i = 0;
-		while ((i < branches.size()) and (cmp > 0)) {
-			cmp -= branches[i].branchingRatio[l];
-			i++;
-		}
-		performInteraction(candidate, branches[i-1].channel);
+		interact(candidate);
 
 		// repeat with remaining step
 		step -= randDist;
 	} while (step > 0);
 }
 
+double PhotoDisintegration::getStepLimit(const Candidate *candidate) const {
+	double rate = getInteractionRate(candidate);
+	if (rate <= 0)
+		return std::numeric_limits<double>::max();
+	return limit / rate;
+}
+
+double PhotoDisintegration::getInteractionRate(const Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (not isNucleus(id))
+		return 0;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	const Species *species = getSpecies(Z, N);
+	if (not species)
+		return 0;
+
+	double z = candidate->getRedshift();
+	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
+	if ((lg <= lgmin) or (lg >= lgmax))
+		return 0;
+
+	double rate = species->getRate(lg);
+	return rate * pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+}
+
+void PhotoDisintegration::interact(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (not isNucleus(id))
+		return;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	const Species *species = getSpecies(Z, A - Z);
+	if (not species)
+		return;
+
+	double z = candidate->getRedshift();
+	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
+	if ((lg <= lgmin) or (lg >= lgmax))
+		return;
+
+	const std::vector<Branch> &branches = species->branches;
+	if (branches.size() == 0)
+		return;
+	double cmp = Random::instance().rand();
+	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest tabulation point
+	size_t i = 0;
+	while ((i < branches.size()) and (cmp > 0)) {
+		cmp -= species->getBranchingRatio(i, (size_t) l);
+		i++;
+	}
+	performInteraction(candidate, branches[i-1].channel);
+}
+
 void PhotoDisintegration::performInteraction(Candidate *candidate, int channel) const {
+	RunStatistics::count("PhotoDisintegration: interactions");
 	KISS_LOG_DEBUG << "Photodisintegration::performInteraction. Channel " <<  channel << " on candidate " << candidate->getDescription(); 
 	// parse disintegration channel
 	int nNeutron = digit(channel, 100000);
@@ -256,16 +403,26 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 	double lf = candidate->current.getLorentzFactor();
 
 	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1));  // index of closest tabulation point
-	int key = Z*1e6 + (A-Z)*1e4 + (Z+dZ)*1e2 + (A+dA) - (Z+dZ);
+	const Species *species = getSpecies(Z, A - Z);
+	if (not species)
+		return;
+	const Branch *branch = 0;
+	for (size_t i = 0; i < species->branches.size(); i++)
+		if (species->branches[i].channel == channel) {
+			branch = &species->branches[i];
+			break;
+		}
+	if (not branch)
+		return;
 
-	for (int i = 0; i < pdPhoton[key].size(); i++) {
+	for (size_t i = branch->photonBegin; i < branch->photonEnd; i++) {
 		// check for random emission
-		if (random.rand() > pdPhoton[key][i].emissionProbability[l])
+		if (random.rand() > species->getPhotonProbability(i, l))
 			continue;
 
 		// boost to lab frame
 		double cosTheta = 2 * random.rand() - 1;
-		double E = pdPhoton[key][i].energy * lf * (1 - cosTheta);
+		double E = species->photonEnergy[i] * lf * (1 - cosTheta);
 		candidate->addSecondary(22, E, pos, 1., interactionTag);
 	}
 }
@@ -278,29 +435,25 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 	int A = massNumber(id);
 	int Z = chargeNumber(id);
 	int N = A - Z;
-	size_t idx = Z * 31 + N;
 
 	// check if disintegration data available
-	if ((Z > 26) or (N > 30))
+	const Species *species = getSpecies(Z, N);
+	if (not species)
 		return std::numeric_limits<double>::max();
-	const std::vector<double> &rate = pdRate[idx];
-	if (rate.size() == 0)
-		return std::numeric_limits<double>::max();
-
 	// check if in tabulated energy range
 	double lg = log10(gamma * (1 + z));
 	if ((lg <= lgmin) or (lg >= lgmax))
 		return std::numeric_limits<double>::max();
 
 	// total interaction rate
-	double lossRate = interpolateEquidistant(lg, lgmin, lgmax, rate);
+	double lossRate = species->getRate(lg);
 
 	// comological scaling, rate per physical distance
 	lossRate *= pow_integer<3>(1 + z) * photonField->getRedshiftScaling(z);
 
 	// average number of nucleons lost for all disintegration channels
 	double avg_dA = 0;
-	const std::vector<Branch> &branches = pdBranch[idx];
+	const std::vector<Branch> &branches = species->branches;
 	for (size_t i = 0; i < branches.size(); i++) {
 		int channel = branches[i].channel;
 		int dA = 0;
@@ -311,7 +464,7 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 		dA += 3 * digit(channel, 10);
 		dA += 4 * digit(channel, 1);
 
-		double br = interpolateEquidistant(lg, lgmin, lgmax, branches[i].branchingRatio);
+		double br = species->getBranchingRatio(i, lg);
 		avg_dA += br * dA;
 	}
 
@@ -1,20 +1,168 @@
 #include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/RunStatistics.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Random.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/InteractionTables.h"
 
 #include "kiss/convert.h"
 #include "kiss/logger.h"
 #include "sophia.h"
 
+#include <algorithm>
 #include <limits>
 #include <cmath>
+#include <cstring>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
 
+// random numbers of SOPHIA, from the generator of the calling thread
+extern "C" double sophiarandom_() {
+	return crpropa::Random::instance().randDblExc();
+}
+
 namespace crpropa {
 
+static void runSophia(int nature, double Ein, double eps, double outputEnergy[5][2000], int outPartID[2000], int &nParticles) {
+#ifdef CRPROPA_SOPHIA_SERIAL
+#pragma omp critical
+#endif
+	sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+}
+
+static const char libraryMagic[8] = {'C', 'R', 'P', 'S', 'O', 'P', 'H', 'L'};
+
+struct LibraryHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t fieldNameLength;
+	double logEmin, logEmax;
+	uint64_t nBins, nEvents;
+};
+
+SophiaEventLibrary::SophiaEventLibrary(std::string fieldName, double Emin, double Emax, size_t nBins, size_t nEvents) :
+		fieldName(fieldName), logEmin(log10(Emin)), logEmax(log10(Emax)), nBins(nBins), nEvents(nEvents) {
+	if (!(Emin > 0 && Emax > Emin))
+		throw std::runtime_error("SophiaEventLibrary: invalid energy range");
+	if (nBins == 0 || nEvents == 0)
+		throw std::runtime_error("SophiaEventLibrary: number of bins and events must be positive");
+	for (int k = 0; k < 2; k++)
+		eventOffset[k].push_back(0);
+}
+
+SophiaEventLibrary::SophiaEventLibrary(std::string filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("SophiaEventLibrary: could not open file " + filename);
+	LibraryHeader header;
+	if (!in.read((char *) &header, sizeof(header)) || memcmp(header.magic, libraryMagic, sizeof(libraryMagic)) != 0)
+		throw std::runtime_error("SophiaEventLibrary: not an event library " + filename);
+	if (header.version != 1)
+		throw std::runtime_error("SophiaEventLibrary: unknown version in " + filename);
+	fieldName.resize(header.fieldNameLength);
+	in.read(&fieldName[0], header.fieldNameLength);
+	logEmin = header.logEmin;
+	logEmax = header.logEmax;
+	nBins = header.nBins;
+	nEvents = header.nEvents;
+	for (int k = 0; k < 2; k++) {
+		uint64_t nParticles;
+		in.read((char *) &nParticles, sizeof(nParticles));
+		eventOffset[k].resize(nBins * nEvents + 1);
+		eventId[k].resize(nParticles);
+		eventFraction[k].resize(nParticles);
+		in.read((char *) eventOffset[k].data(), eventOffset[k].size() * sizeof(uint32_t));
+		in.read((char *) eventId[k].data(), nParticles * sizeof(int8_t));
+		in.read((char *) eventFraction[k].data(), nParticles * sizeof(float));
+		if (!in || eventOffset[k].back() != nParticles)
+			throw std::runtime_error("SophiaEventLibrary: truncated file " + filename);
+	}
+}
+
+void SophiaEventLibrary::save(std::string filename) const {
+	if (!isComplete())
+		throw std::runtime_error("SophiaEventLibrary: cannot save an incomplete library");
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("SophiaEventLibrary: could not create file " + filename);
+	LibraryHeader header;
+	memcpy(header.magic, libraryMagic, sizeof(libraryMagic));
+	header.version = 1;
+	header.fieldNameLength = fieldName.size();
+	header.logEmin = logEmin;
+	header.logEmax = logEmax;
+	header.nBins = nBins;
+	header.nEvents = nEvents;
+	out.write((const char *) &header, sizeof(header));
+	out.write(fieldName.data(), fieldName.size());
+	for (int k = 0; k < 2; k++) {
+		uint64_t nParticles = eventId[k].size();
+		out.write((const char *) &nParticles, sizeof(nParticles));
+		out.write((const char *) eventOffset[k].data(), eventOffset[k].size() * sizeof(uint32_t));
+		out.write((const char *) eventId[k].data(), nParticles * sizeof(int8_t));
+		out.write((const char *) eventFraction[k].data(), nParticles * sizeof(float));
+	}
+	if (!out)
+		throw std::runtime_error("SophiaEventLibrary: error writing file " + filename);
+}
+
+void SophiaEventLibrary::addEvent(bool onProton, const std::vector<int> &id, const std::vector<double> &fraction) {
+	int k = onProton ? 0 : 1;
+	if (eventOffset[k].size() > nBins * nEvents)
+		throw std::runtime_error("SophiaEventLibrary: library is full");
+	if (id.size() != fraction.size())
+		throw std::runtime_error("SophiaEventLibrary: number of ids and energies differ");
+	for (size_t i = 0; i < id.size(); i++) {
+		eventId[k].push_back(id[i]);
+		eventFraction[k].push_back(fraction[i]);
+	}
+	eventOffset[k].push_back(eventId[k].size());
+}
+
+bool SophiaEventLibrary::isComplete() const {
+	return (eventOffset[0].size() == nBins * nEvents + 1) && (eventOffset[1].size() == nBins * nEvents + 1);
+}
+
+int SophiaEventLibrary::sample(bool onProton, double E, const int8_t *&id, const float *&fraction) const {
+	double x = (log10(E) - logEmin) / (logEmax - logEmin) * nBins;
+	if (!(x >= 0 && x < nBins))
+		return -1;
+	int k = onProton ? 0 : 1;
+	size_t i = size_t(x) * nEvents + Random::instance().randInt(nEvents - 1);
+	if (i + 1 >= eventOffset[k].size())
+		return -1;
+	uint32_t first = eventOffset[k][i];
+	id = eventId[k].data() + first;
+	fraction = eventFraction[k].data() + first;
+	return eventOffset[k][i + 1] - first;
+}
+
+std::string SophiaEventLibrary::getFieldName() const {
+	return fieldName;
+}
+
+double SophiaEventLibrary::getMinimumEnergy() const {
+	return pow(10, logEmin);
+}
+
+double SophiaEventLibrary::getMaximumEnergy() const {
+	return pow(10, logEmax);
+}
+
+size_t SophiaEventLibrary::getNumberOfBins() const {
+	return nBins;
+}
+
+size_t SophiaEventLibrary::getEventsPerBin() const {
+	return nEvents;
+}
+
+double SophiaEventLibrary::getBinEdge(size_t i) const {
+	return pow(10, logEmin + (logEmax - logEmin) * i / nBins);
+}
+
 PhotoPionProduction::PhotoPionProduction(ref_ptr<PhotonField> field, bool photons, bool neutrinos, bool electrons, bool antiNucleons, double l, bool redshift) {
 	havePhotons = photons;
 	haveNeutrinos = neutrinos;
@@ -38,12 +186,17 @@ void PhotoPionProduction::setPhotonField(ref_ptr<PhotonField> field) {
 		}
 	}
 	
+	if (eventLibrary.valid() && (eventLibrary->getFieldName() != photonField->getFieldName())) {
+		KISS_LOG_WARNING << "PhotoPionProduction: event library of " << eventLibrary->getFieldName() << " removed for the photon field " << photonField->getFieldName();
+		eventLibrary = NULL;
+	}
+
 	setDescription("PhotoPionProduction: " + fname);
 	if (haveRedshiftDependence){
 		initRate(getDataPath("PhotoPionProduction/rate_" + fname.replace(0, 3, "IRBz") + ".txt"));
 	}
 	else
-		initRate(getDataPath("PhotoPionProduction/rate_" + fname + ".txt"));
+		initRate(InteractionTables::getTable("PhotoPionProduction", "rate", photonField));
 }
 
 void PhotoPionProduction::setHavePhotons(bool b) {
@@ -77,50 +230,104 @@ void PhotoPionProduction::initRate(std::string filename) {
 	tabRedshifts.clear();
 	tabProtonRate.clear();
 	tabNeutronRate.clear();
-
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
-		throw std::runtime_error("PhotoPionProduction: could not open file " + filename);
-
-	if (haveRedshiftDependence) {
-		double zOld = -1, aOld = -1;
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				continue;
-			}
-			double z, a, b, c;
-			infile >> z >> a >> b >> c;
-			if (!infile)
-				break;
+	protonSlice.clear();
+	neutronSlice.clear();
+
+	DataTable table(filename);
+	size_t nColumns = haveRedshiftDependence ? 4 : 3;
+	double zOld = -1, aOld = -1;
+	for (size_t i = 0; i < table.size(); i++) {
+		if (table.columns(i) < nColumns)
+			throw std::runtime_error("PhotoPionProduction: missing values in file " + filename);
+		const double *row = table.row(i);
+		if (haveRedshiftDependence) {
+			double z = *row++;
 			if (z > zOld) {
 				tabRedshifts.push_back(z);
 				zOld = z;
 			}
-			if (a > aOld) {
-				tabLorentz.push_back(pow(10, a));
-				aOld = a;
+			if (row[0] > aOld) {
+				tabLorentz.push_back(pow(10, row[0]));
+				aOld = row[0];
 			}
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
+		} else {
+			tabLorentz.push_back(pow(10, row[0]));
 		}
-	} else {
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		tabProtonRate.push_back(row[1] / Mpc);
+		tabNeutronRate.push_back(row[2] / Mpc);
+	}
+}
+
+void PhotoPionProduction::setEventLibrary(ref_ptr<SophiaEventLibrary> library) {
+	if (library.valid()) {
+		if (library->getFieldName() != photonField->getFieldName())
+			throw std::runtime_error("PhotoPionProduction: event library of " + library->getFieldName() + " for the photon field " + photonField->getFieldName());
+		if (!library->isComplete())
+			throw std::runtime_error("PhotoPionProduction: incomplete event library");
+	}
+	eventLibrary = library;
+}
+
+ref_ptr<SophiaEventLibrary> PhotoPionProduction::getEventLibrary() const {
+	return eventLibrary;
+}
+
+ref_ptr<SophiaEventLibrary> PhotoPionProduction::createEventLibrary(size_t nEvents, double Emin, double Emax, size_t nBins) const {
+	ref_ptr<SophiaEventLibrary> library = new SophiaEventLibrary(photonField->getFieldName(), Emin, Emax, nBins, nEvents);
+	size_t n = nBins * nEvents;
+	for (int nature = 0; nature < 2; nature++) {
+		bool onProton = (nature == 0);
+		std::vector<std::vector<int> > ids(n);
+		std::vector<std::vector<double> > fractions(n);
+#pragma omp parallel for schedule(dynamic, 100)
+		for (size_t i = 0; i < n; i++) {
+			// random energy in the bin, no event below the threshold
+			double E0 = library->getBinEdge(i / nEvents);
+			double E1 = library->getBinEdge(i / nEvents + 1);
+			double E = E0 * pow(E1 / E0, Random::instance().rand());
+			if (E < energyThreshold())
 				continue;
+
+			double Ein = E / GeV;
+			double eps = sampleEps(onProton, E, 0) / GeV;
+			double outputEnergy[5][2000];
+			int outPartID[2000];
+			int nParticles;
+			runSophia(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+			for (int j = 0; j < nParticles; j++) {
+				ids[i].push_back(outPartID[j]);
+				fractions[i].push_back(outputEnergy[3][j] / Ein);
 			}
-			double a, b, c;
-			infile >> a >> b >> c;
-			if (!infile)
-				break;
-			tabLorentz.push_back(pow(10, a));
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
 		}
+		for (size_t i = 0; i < n; i++)
+			library->addEvent(onProton, ids[i], fractions[i]);
 	}
+	return library;
+}
+
+const std::vector<double> &PhotoPionProduction::rateSlice(double z, bool onProton) const {
+	bool valid;
+	std::vector<double> &slice = (onProton ? protonSlice : neutronSlice).get(z, valid);
+	if (valid)
+		return slice;
 
-	infile.close();
+	// linear interpolation in redshift at each Lorentz factor, 0 outside the table
+	const std::vector<double> &tabRate = (onProton)? tabProtonRate : tabNeutronRate;
+	size_t n = tabLorentz.size();
+	slice.assign(n, 0.);
+	if ((z < tabRedshifts.front()) or (z > tabRedshifts.back()))
+		return slice;
+	if (tabRedshifts.size() < 2) {
+		slice.assign(tabRate.begin(), tabRate.begin() + n);
+		return slice;
+	}
+	static thread_local size_t hint = 0;
+	size_t i = huntUpperBound(z, tabRedshifts, hint);
+	i = std::min(std::max(i, size_t(1)), tabRedshifts.size() - 1) - 1;
+	double w = (z - tabRedshifts[i]) / (tabRedshifts[i + 1] - tabRedshifts[i]);
+	for (size_t j = 0; j < n; j++)
+		slice[j] = (1 - w) * tabRate[i * n + j] + w * tabRate[(i + 1) * n + j];
+	return slice;
 }
 
 double PhotoPionProduction::nucleonMFP(double gamma, double z, bool onProton) const {
@@ -131,11 +338,13 @@ double PhotoPionProduction::nucleonMFP(double gamma, double z, bool onProton) co
 	if (gamma < tabLorentz.front() or (gamma > tabLorentz.back()))
 		return std::numeric_limits<double>::max();
 
+	// the Lorentz factor changes little between the calls of a thread
+	static thread_local size_t hint = 0;
 	double rate;
 	if (haveRedshiftDependence)
-		rate = interpolate2d(z, gamma, tabRedshifts, tabLorentz, tabRate);
+		rate = interpolate(gamma, tabLorentz, rateSlice(z, onProton), hint);
 	else
-		rate = interpolate(gamma, tabLorentz, tabRate) * photonField->getRedshiftScaling(z);
+		rate = interpolate(gamma, tabLorentz, tabRate, hint) * photonField->getRedshiftScaling(z);
 
 	// cosmological scaling
 	rate *= pow_integer<2>(1 + z);
@@ -203,7 +412,55 @@ void PhotoPionProduction::process(Candidate *candidate) const {
 	} while (step > 0);
 }
 
+double PhotoPionProduction::getStepLimit(const Candidate *candidate) const {
+	double rate = getInteractionRate(candidate);
+	if (rate > 0.)
+		return limit / rate;
+	return std::numeric_limits<double>::max();
+}
+
+double PhotoPionProduction::getInteractionRate(const Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (!isNucleus(id))
+		return 0;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	double gamma = candidate->current.getLorentzFactor();
+	double z = candidate->getRedshift();
+	double totalRate = 0;
+	if (Z > 0)
+		totalRate += nucleiModification(A, Z) / nucleonMFP(gamma, z, true);
+	if (N > 0)
+		totalRate += nucleiModification(A, N) / nucleonMFP(gamma, z, false);
+	return totalRate;
+}
+
+void PhotoPionProduction::interact(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (!isNucleus(id))
+		return;
+
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	double gamma = candidate->current.getLorentzFactor();
+	double z = candidate->getRedshift();
+	double protonRate = 0, neutronRate = 0;
+	if (Z > 0)
+		protonRate = nucleiModification(A, Z) / nucleonMFP(gamma, z, true);
+	if (N > 0)
+		neutronRate = nucleiModification(A, N) / nucleonMFP(gamma, z, false);
+	if (protonRate + neutronRate <= 0.)
+		return;
+
+	bool onProton = Random::instance().rand() * (protonRate + neutronRate) < protonRate;
+	performInteraction(candidate, onProton);
+}
+
 void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton) const {
+	RunStatistics::count("PhotoPionProduction: interactions");
 	int id = candidate->current.getId();
 	int A = massNumber(id);
 	int Z = chargeNumber(id);
@@ -217,23 +474,31 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 	int sign = (id > 0) ? 1 : -1;
 
 	// check if below SOPHIA's energy threshold
-	double E_threshold = (photonField->getFieldName() == "CMB") ? 3.72e18 * eV : 5.83e15 * eV;
-	if (EpA * (1 + z) < E_threshold)
+	if (EpA * (1 + z) < energyThreshold())
 		return;
 
 	// SOPHIA - input:
 	int nature = 1 - static_cast<int>(onProton);  // 0=proton, 1=neutron
 	double Ein = EpA / GeV;  // GeV is the SOPHIA standard unit
-	double eps = sampleEps(onProton, EpA, z) / GeV;  // GeV for SOPHIA
 
 	// SOPHIA - output:
 	double outputEnergy[5][2000];  // [GeV/c, GeV/c, GeV/c, GeV, GeV/c^2]
 	int outPartID[2000];
-	int nParticles;
-
-#pragma omp critical
-	{
-		sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+	int nParticles = -1;
+
+	// event from the library, only the energies are tabulated
+	const int8_t *libraryId;
+	const float *libraryFraction;
+	if (eventLibrary.valid())
+		nParticles = eventLibrary->sample(onProton, EpA * (1 + z), libraryId, libraryFraction);
+	if (nParticles >= 0) {
+		for (int i = 0; i < nParticles; i++) {
+			outPartID[i] = libraryId[i];
+			outputEnergy[3][i] = libraryFraction[i] * Ein;
+		}
+	} else {
+		double eps = sampleEps(onProton, EpA, z) / GeV;  // GeV for SOPHIA
+		runSophia(nature, Ein, eps, outputEnergy, outPartID, nParticles);
 	}
 
 	Random &random = Random::instance();
@@ -366,7 +631,7 @@ SophiaEventOutput PhotoPionProduction::sophiaEvent(bool onProton, double Ein, do
 	int outPartID[2000];
 	int nParticles;
 
-	sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+	runSophia(nature, Ein, eps, outputEnergy, outPartID, nParticles);
 
 	// convert SOPHIA IDs to PDG naming convention & create particles
 	SophiaEventOutput output;
@@ -430,6 +695,10 @@ double PhotoPionProduction::sampleEps(bool onProton, double E, double z) const {
 	throw std::runtime_error("error: no photon found in sampleEps, please make sure that photon field provides photons for the interaction by adapting the energy range of the tabulated photon field.");
 }
 
+double PhotoPionProduction::energyThreshold() const {
+	return (photonField->getFieldName() == "CMB") ? 3.72e18 * eV : 5.83e15 * eV;
+}
+
 double PhotoPionProduction::epsMinInteraction(bool onProton, double Ein) const {
 	// labframe energy of least energetic photon where PPP can occur
 	// this kind-of ties samplingEps to the PPP and SOPHIA
@@ -468,7 +737,7 @@ double PhotoPionProduction::probEpsMax(bool onProton, double Ein, double z, doub
 	double pEpsMax = pEpsMaxTested * correctionFactor;
 
 	if(pEpsMax == 0) {
-		KISS_LOG_WARNING << "pEpsMax is 0 in the following configuration: \n"
+		KISS_LOG_WARNING_LIMITED(10) << "pEpsMax is 0 in the following configuration: \n"
 			<< "\t" << "onProton: " << onProton << "\n"
 			<< "\t" << "Ein: " << Ein << " [GeV] \n"
 			<< "\t" << "epsRange [eV] " << epsMin << "\t" << epsMax << "\n"
@@ -500,7 +769,7 @@ double PhotoPionProduction::momentum(bool onProton, double Ein) const {
 	return momentumHadron;
 }
 
-double PhotoPionProduction::crossection(double eps, bool onProton) const {
+double PhotoPionProduction::crossection(double eps, bool onProton) {
 	const double m = mass(onProton);
 	const double s = m * m + 2. * m * eps;
 	if (s < sMin())
@@ -552,8 +821,7 @@ double PhotoPionProduction::crossection(double eps, bool onProton) const {
 	double cross_diffr = 0.;
 	if (eps > 0.85) {
 		double ss1 = (eps - 0.85) / 0.69;
-		double ss2 = onProton? 29.3 : 26.4;
-		ss2 *= std::pow(s, -0.34) + 59.3 * std::pow(s, 0.095);
+		double ss2 = (onProton? 29.3 : 26.4) * std::pow(s, -0.34) + 59.3 * std::pow(s, 0.095);
 		cs_multidiff = (1. - std::exp(-ss1)) * ss2;
 		cs_multi = 0.89 * cs_multidiff;
 		// diffractive scattering:
@@ -581,7 +849,7 @@ double PhotoPionProduction::crossection(double eps, bool onProton) const {
 	return cross_res + cross_dir + cs_multidiff + cross_frag2;
 }
 
-double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double alpha) const {
+double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double alpha) {
 	if (epsTh > eps)
 		return 0.;
 	const double a = alpha * epsMax / epsTh;
@@ -590,7 +858,7 @@ double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double a
 	return prod1 * prod2;
 }
 
-double PhotoPionProduction::Ef(double eps, double epsTh, double w) const {
+double PhotoPionProduction::Ef(double eps, double epsTh, double w) {
 	const double wTh = w + epsTh;
 	if (eps <= epsTh) {
 		return 0.;
@@ -603,14 +871,14 @@ double PhotoPionProduction::Ef(double eps, double epsTh, double w) const {
 	}
 }
 
-double PhotoPionProduction::breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) const {
+double PhotoPionProduction::breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) {
 	const double m = mass(onProton);
 	const double s = m * m + 2. * m * epsPrime;
 	const double gam2s = gamma * gamma * s;
 	return sigma0 * (s / epsPrime / epsPrime) * gam2s / ((s - DMM * DMM) * (s - DMM * DMM) + gam2s);
 }
 
-double PhotoPionProduction::functs(double s, bool onProton) const {
+double PhotoPionProduction::functs(double s, bool onProton) {
 	const double m = mass(onProton);
 	const double factor = s - m * m;
 	const double epsPrime = factor / 2. / m;
@@ -618,12 +886,12 @@ double PhotoPionProduction::functs(double s, bool onProton) const {
 	return factor * sigmaPg;
 }
 
-double PhotoPionProduction::mass(bool onProton) const {
+double PhotoPionProduction::mass(bool onProton) {
 	const double m =  onProton ? mass_proton : mass_neutron;
 	return m / GeV * c_squared;
 }
 
-double PhotoPionProduction::sMin() const {
+double PhotoPionProduction::sMin() {
 	return 1.1646; // [GeV^2] head-on collision
 }
 
@@ -0,0 +1,89 @@
+#include "crpropa/module/Propagation1D.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+Propagation1D::Propagation1D(double minStep, double maxStep) :
+		minStep(minStep), maxStep(maxStep) {
+	if (minStep > maxStep)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+}
+
+void Propagation1D::add(Module *module) {
+	modules.push_back(module);
+}
+
+std::size_t Propagation1D::size() const {
+	return modules.size();
+}
+
+ref_ptr<Module> Propagation1D::operator[](const std::size_t i) {
+	if (i >= modules.size())
+		throw std::runtime_error("Propagation1D: index out of range");
+	return modules[i];
+}
+
+void Propagation1D::onDetection(Module *action) {
+	detectionAction = action;
+}
+
+void Propagation1D::process(Candidate *c) const {
+	double D = c->current.getPosition().x; // distance to the observer
+	const size_t n = modules.size();
+
+	while (c->isActive()) {
+		c->savePrevious();
+
+		// the observer limits the step as Observer1D does
+		double step = clip(std::min(c->getNextStep(), D), minStep, maxStep);
+		D -= step;
+		c->current.setPosition(Vector3d(D, 0, 0));
+		c->setCurrentStep(step);
+		c->setNextStep(maxStep);
+
+		redshift.Redshift::process(c);
+		for (size_t i = 0; i < n; i++)
+			modules[i]->process(c);
+
+		if (D <= 0) {
+			if (detectionAction.valid())
+				detectionAction->process(c);
+			c->setActive(false);
+		}
+	}
+}
+
+void Propagation1D::setMinimumStep(double step) {
+	if (step > maxStep)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+	minStep = step;
+}
+
+void Propagation1D::setMaximumStep(double step) {
+	if (minStep > step)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+	maxStep = step;
+}
+
+double Propagation1D::getMinimumStep() const {
+	return minStep;
+}
+
+double Propagation1D::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string Propagation1D::getDescription() const {
+	std::stringstream s;
+	s << "Propagation1D: observer at x = 0, minStep " << minStep / kpc
+			<< " kpc, maxStep " << maxStep / kpc << " kpc";
+	for (size_t i = 0; i < modules.size(); i++)
+		s << "\n    " << modules[i]->getDescription();
+	if (detectionAction.valid())
+		s << "\n    on detection: " << detectionAction->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
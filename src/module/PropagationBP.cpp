@@ -1,4 +1,7 @@
 #include "crpropa/module/PropagationBP.h"
+#include "crpropa/RunStatistics.h"
+#include "crpropa/ParticleStateBatch.h"
+#include "crpropa/Vector3Simd.h"
 
 #include <sstream>
 #include <stdexcept>
@@ -18,24 +21,26 @@ namespace crpropa {
 
 	PropagationBP::Y PropagationBP::dY(Vector3d pos, Vector3d dir, double step,
 			double z, double q, double m) const {
+		Vector3dSimd x(pos), u(dir);
+
 		// half leap frog step in the position
-		pos += dir * step / 2.;
+		x += u * step / 2.;
 
 		// get B field at particle position
-		Vector3d B = getFieldAtPosition(pos, z);
+		Vector3dSimd B = getFieldAtPosition(x, z);
 
 		// Boris help vectors
-		Vector3d t = B * q / 2 / m * step / c_light;
-		Vector3d s = t * 2 / (1 + t.dot(t));
-		Vector3d v_help;
+		Vector3dSimd t = B * q / 2 / m * step / c_light;
+		Vector3dSimd s = t * 2 / (1 + t.dot(t));
+		Vector3dSimd v_help;
 
 		// Boris push
-		v_help = dir + dir.cross(t);
-		dir = dir + v_help.cross(s);
+		v_help = u + u.cross(t);
+		u = u + v_help.cross(s);
 
 		// the other half leap frog step in the position
-		pos += dir * step / 2.;
-		return Y(pos, dir);
+		x += u * step / 2.;
+		return Y(x, u);
 	}
 
 
@@ -62,7 +67,7 @@ namespace crpropa {
 	void PropagationBP::process(Candidate *candidate) const {
 		// save the new previous particle state
 		ParticleState &current = candidate->current;
-		candidate->previous = current;
+		candidate->savePrevious();
 
 		Y yIn(current.getPosition(), current.getDirection());
 
@@ -97,10 +102,12 @@ namespace crpropa {
 			while (true) {
 				tryStep(yIn, yOut, yErr, step, current, z, q, m);
 				r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
+				RunStatistics::count("PropagationBP: trial steps");
 				if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
 					if (step == minStep)  // already minimum step size
 						break;
 					else {
+						RunStatistics::count("PropagationBP: rejected steps");
 						newStep = step * 0.95 * pow(r, -0.2);
 						newStep = std::max(newStep, 0.1 * step); // limit step size decrease
 						newStep = std::max(newStep, minStep); // limit step size to minStep
@@ -121,6 +128,96 @@ namespace crpropa {
 		current.setDirection(yOut.u.getUnitVector());
 		candidate->setCurrentStep(step);
 		candidate->setNextStep(newStep);
+		prefetchField(current.getPosition() + current.getDirection() * newStep, z);
+	}
+
+
+	void PropagationBP::processBatch(Candidate **candidates, size_t n) const {
+		// the step size control needs the error estimate of each candidate
+		if (minStep != maxStep) {
+			Module::processBatch(candidates, n);
+			return;
+		}
+
+		static thread_local ParticleStateBatch states;
+		static thread_local std::vector<Vector3d> positions, fields;
+		static thread_local std::vector<size_t> charged;
+		static thread_local std::vector<double> bx, by, bz;
+		states.load(candidates, n);
+		double step = maxStep;
+		charged.clear();
+		for (size_t i = 0; i < n; i++) {
+			Candidate *c = candidates[i];
+			c->savePrevious();
+			c->setCurrentStep(step);
+			c->setNextStep(step);
+			if (states.charge[i] != 0)
+				charged.push_back(i);
+		}
+
+		// gather the fields of the charged candidates at the half leap frog
+		// step, with one call per run of equal redshift
+		size_t nCharged = charged.size();
+		positions.resize(nCharged);
+		fields.resize(nCharged);
+		for (size_t j = 0; j < nCharged; j++) {
+			size_t i = charged[j];
+			positions[j] = states.getPosition(i) + states.getDirection(i) * step / 2.;
+		}
+		for (size_t first = 0; first < nCharged;) {
+			double z = candidates[charged[first]]->getRedshift();
+			size_t last = first + 1;
+			while ((last < nCharged) && (candidates[charged[last]]->getRedshift() == z))
+				last++;
+			getFieldsAtPositions(&positions[first], &fields[first], last - first, z);
+			first = last;
+		}
+		bx.assign(n, 0);
+		by.assign(n, 0);
+		bz.assign(n, 0);
+		for (size_t j = 0; j < nCharged; j++) {
+			bx[charged[j]] = fields[j].x;
+			by[charged[j]] = fields[j].y;
+			bz[charged[j]] = fields[j].z;
+		}
+
+		// Boris push on contiguous arrays with the same operations as dY,
+		// neutral particles are propagated rectilinearly
+		double *x = &states.x[0], *y = &states.y[0], *z = &states.z[0];
+		double *dx = &states.dx[0], *dy = &states.dy[0], *dz = &states.dz[0];
+		const double *charge = &states.charge[0], *energy = &states.energy[0];
+		for (size_t i = 0; i < n; i++) {
+			double q = charge[i];
+			double m = energy[i] / (c_light * c_light);
+			double tx = bx[i] * q / 2 / m * step / c_light;
+			double ty = by[i] * q / 2 / m * step / c_light;
+			double tz = bz[i] * q / 2 / m * step / c_light;
+			double tt = 1 + (tx * tx + ty * ty + tz * tz);
+			double sx = tx * 2 / tt, sy = ty * 2 / tt, sz = tz * 2 / tt;
+
+			double ux = dx[i], uy = dy[i], uz = dz[i];
+			double vx = ux + (uy * tz - uz * ty);
+			double vy = uy + (uz * tx - ux * tz);
+			double vz = uz + (ux * ty - uy * tx);
+			double wx = ux + (vy * sz - vz * sy);
+			double wy = uy + (vz * sx - vx * sz);
+			double wz = uz + (vx * sy - vy * sx);
+			double r = sqrt(wx * wx + wy * wy + wz * wz);
+
+			bool neutral = (q == 0);
+			double hx = x[i] + ux * step / 2., hy = y[i] + uy * step / 2., hz = z[i] + uz * step / 2.;
+			x[i] = neutral ? x[i] + ux * step : hx + wx * step / 2.;
+			y[i] = neutral ? y[i] + uy * step : hy + wy * step / 2.;
+			z[i] = neutral ? z[i] + uz * step : hz + wz * step / 2.;
+			dx[i] = neutral ? ux : wx / r;
+			dy[i] = neutral ? uy : wy / r;
+			dz[i] = neutral ? uz : wz / r;
+		}
+		for (size_t j = 0; j < nCharged; j++) {
+			size_t i = charged[j];
+			prefetchField(states.getPosition(i) + states.getDirection(i) * step, candidates[i]->getRedshift());
+		}
+		states.store(candidates);
 	}
 
 
@@ -134,6 +231,11 @@ namespace crpropa {
 	}
 
 
+	void PropagationBP::prefetchField(const Vector3d &pos, double z) const {
+		if (field.valid())
+			field->prefetch(pos, z);
+	}
+
 	Vector3d PropagationBP::getFieldAtPosition(Vector3d pos, double z) const {
 		Vector3d B(0, 0, 0);
 		try {
@@ -142,13 +244,26 @@ namespace crpropa {
 			if (field.valid())
 				B = field->getField(pos, z);
 		} catch (std::exception &e) {
-			KISS_LOG_ERROR 	<< "PropagationBP: Exception in PropagationBP::getFieldAtPosition.\n"
+			KISS_LOG_ERROR_LIMITED(10) << "PropagationBP: Exception in PropagationBP::getFieldAtPosition.\n"
 					<< e.what();
 		}	
 		return B;
 	}
 
 
+	void PropagationBP::getFieldsAtPositions(const Vector3d *pos, Vector3d *B, size_t n, double z) const {
+		for (size_t i = 0; i < n; i++)
+			B[i] = Vector3d(0, 0, 0);
+		try {
+			if (field.valid())
+				field->getFields(pos, B, n, z);
+		} catch (std::exception &e) {
+			KISS_LOG_ERROR_LIMITED(10) << "PropagationBP: Exception in PropagationBP::getFieldsAtPositions.\n"
+					<< e.what();
+		}
+	}
+
+
 	double PropagationBP::errorEstimation(const Vector3d x1, const Vector3d x2, double step) const {
 		// compare the position after one step with the position after two steps with step/2.
 		Vector3d diff = (x1 - x2);
@@ -1,4 +1,6 @@
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/RunStatistics.h"
+#include "crpropa/Vector3Simd.h"
 
 #include <limits>
 #include <sstream>
@@ -27,36 +29,53 @@ const double cash_karp_bs[] = {
 
 void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
 		ParticleState &particle, double z) const {
-	std::vector<Y> k;
-	k.reserve(6);
+	tryStep(y, dYdt(y, particle, z), out, error, h, particle, z);
+}
 
-	out = y;
-	error = Y(0);
+void PropagationCK::tryStep(const Y &y, const Y &k0, Y &out, Y &error,
+		double h, ParticleState &particle, double z) const {
+	// the stages are summed in padded vectors
+	Vector3dSimd kx[6], ku[6];
+	Vector3dSimd yx(y.x), yu(y.u);
+	Vector3dSimd outx = yx, outu = yu, errx, erru;
 
 	// calculate the sum of b_i * k_i
 	for (size_t i = 0; i < 6; i++) {
 
-		Y y_n = y;
-		for (size_t j = 0; j < i; j++)
-			y_n += k[j] * a[i * 6 + j] * h;
+		Vector3dSimd nx = yx, nu = yu;
+		for (size_t j = 0; j < i; j++) {
+			nx += kx[j] * a[i * 6 + j] * h;
+			nu += ku[j] * a[i * 6 + j] * h;
+		}
 
-		// update k_i
-		k[i] = dYdt(y_n, particle, z);
+		// update k_i, the first stage does not depend on the step size
+		if (i == 0) {
+			kx[0] = k0.x;
+			ku[0] = k0.u;
+		} else {
+			Y k = dYdt(Y(nx, nu), particle, z);
+			kx[i] = k.x;
+			ku[i] = k.u;
+		}
 
-		out += k[i] * b[i] * h;
-		error += k[i] * (b[i] - bs[i]) * h;
+		outx += kx[i] * b[i] * h;
+		outu += ku[i] * b[i] * h;
+		errx += kx[i] * (b[i] - bs[i]) * h;
+		erru += ku[i] * (b[i] - bs[i]) * h;
 	}
+	out = Y(outx, outu);
+	error = Y(errx, erru);
 }
 
 PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) const {
 	// normalize direction vector to prevent numerical losses
-	Vector3d velocity = y.u.getUnitVector() * c_light;
+	Vector3dSimd velocity = Vector3dSimd(y.u).getUnitVector() * c_light;
 	
 	// get B field at particle position
-	Vector3d B = getFieldAtPosition(y.x, z);
+	Vector3dSimd B = getFieldAtPosition(y.x, z);
 
 	// Lorentz force: du/dt = q*c/E * (v x B)
-	Vector3d dudt = p.getCharge() * c_light / p.getEnergy() * velocity.cross(B);
+	Vector3dSimd dudt = p.getCharge() * c_light / p.getEnergy() * velocity.cross(B);
 	return Y(velocity, dudt);
 }
 
@@ -77,7 +96,7 @@ PropagationCK::PropagationCK(ref_ptr<MagneticField> field, double tolerance,
 void PropagationCK::process(Candidate *candidate) const {
 	// save the new previous particle state
 	ParticleState &current = candidate->current;
-	candidate->previous = current;
+	candidate->savePrevious();
 
 	Y yIn(current.getPosition(), current.getDirection());
 	double step = maxStep;
@@ -104,15 +123,19 @@ void PropagationCK::process(Candidate *candidate) const {
 		step = clip(candidate->getNextStep(), minStep, maxStep);
 		newStep = step;
 		double r = 42;  // arbitrary value
+		// the derivative at the start is the same for all tried steps
+		Y k0 = dYdt(yIn, current, z);
 
 		// try performing step until the target error (tolerance) or the minimum/maximum step size has been reached
 		while (true) {
-			tryStep(yIn, yOut, yErr, step / c_light, current, z);
+			tryStep(yIn, k0, yOut, yErr, step / c_light, current, z);
 			r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
+			RunStatistics::count("PropagationCK: trial steps");
 			if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
 				if (step == minStep)  // already minimum step size
 					break;
 				else {
+					RunStatistics::count("PropagationCK: rejected steps");
 					newStep = step * 0.95 * pow(r, -0.2);
 					newStep = std::max(newStep, 0.1 * step); // limit step size decrease
 					newStep = std::max(newStep, minStep); // limit step size to minStep
@@ -133,6 +156,7 @@ void PropagationCK::process(Candidate *candidate) const {
 	current.setDirection(yOut.u.getUnitVector());
 	candidate->setCurrentStep(step);
 	candidate->setNextStep(newStep);
+	prefetchField(current.getPosition() + current.getDirection() * newStep, z);
 }
 
 void PropagationCK::setField(ref_ptr<MagneticField> f) {
@@ -143,6 +167,11 @@ ref_ptr<MagneticField> PropagationCK::getField() const {
 	return field;
 }
 
+void PropagationCK::prefetchField(const Vector3d &pos, double z) const {
+	if (field.valid())
+		field->prefetch(pos, z);
+}
+
 Vector3d PropagationCK::getFieldAtPosition(Vector3d pos, double z) const {
 	Vector3d B(0, 0, 0);
 	try {
@@ -151,7 +180,7 @@ Vector3d PropagationCK::getFieldAtPosition(Vector3d pos, double z) const {
 		if (field.valid())
 			B = field->getField(pos, z);
 	} catch (std::exception &e) {
-		KISS_LOG_ERROR 	<< "PropagationCK: Exception in PropagationCK::getFieldAtPosition.\n"
+		KISS_LOG_ERROR_LIMITED(10) << "PropagationCK: Exception in PropagationCK::getFieldAtPosition.\n"
 				<< e.what();
 	}	
 	return B;
@@ -0,0 +1,254 @@
+#include "crpropa/module/PropagationDP.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+// Dormand-Prince coefficients, the 5th order weights are the last row of a
+const double dormand_prince_a[] = {
+	0., 0., 0., 0., 0., 0., 0.,
+	1. / 5., 0., 0., 0., 0., 0., 0.,
+	3. / 40., 9. / 40., 0., 0., 0., 0., 0.,
+	44. / 45., -56. / 15., 32. / 9., 0., 0., 0., 0.,
+	19372. / 6561., -25360. / 2187., 64448. / 6561., -212. / 729., 0., 0., 0.,
+	9017. / 3168., -355. / 33., 46732. / 5247., 49. / 176., -5103. / 18656., 0., 0.,
+	35. / 384., 0., 500. / 1113., 125. / 192., -2187. / 6784., 11. / 84., 0.
+};
+
+const double dormand_prince_b[] = {
+	35. / 384., 0., 500. / 1113., 125. / 192., -2187. / 6784., 11. / 84., 0.
+};
+
+const double dormand_prince_bs[] = {
+	5179. / 57600., 0., 7571. / 16695., 393. / 640., -92097. / 339200., 187. / 2100., 1. / 40.
+};
+
+// exponents of the PI step size control for a 4th order error estimate
+const double controlAlpha = 0.2 - 0.75 * 0.04;
+const double controlBeta = 0.04;
+
+PropagationDP::PropagationDP(ref_ptr<MagneticField> field, double tolerance,
+		double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+PropagationDP::LastStep *PropagationDP::lastStep() const {
+	int slot = 0;
+#ifdef _OPENMP
+	slot = (omp_get_level() <= 1) ? omp_get_thread_num() : -1;
+#endif
+	if ((slot < 0) || (slot >= (int)lastSteps.size()))
+		return NULL;
+	return &lastSteps[slot];
+}
+
+void PropagationDP::tryStep(const Y &y, Y &out, Y &error, double h,
+		ParticleState &particle, double z) const {
+	Vector3d fieldOut;
+	tryStep(y, dYdt(y, particle, z), out, error, fieldOut, h, particle, z);
+}
+
+void PropagationDP::tryStep(const Y &y, const Y &k0, Y &out, Y &error,
+		Vector3d &fieldOut, double h, ParticleState &particle, double z) const {
+	Y k[7];
+	const double *a = dormand_prince_a;
+
+	out = y;
+	error = Y(0);
+	k[0] = k0;
+	for (size_t i = 1; i < 7; i++) {
+		Y y_n = y;
+		for (size_t j = 0; j < i; j++)
+			y_n += k[j] * a[i * 7 + j] * h;
+
+		// the last stage is at the end of the step
+		if (i == 6)
+			out = y_n;
+
+		Vector3d B = getFieldAtPosition(y_n.x, z);
+		k[i] = dYdt(y_n, particle, B);
+		if (i == 6)
+			fieldOut = B;
+	}
+
+	for (size_t i = 0; i < 7; i++)
+		error += k[i] * (dormand_prince_b[i] - dormand_prince_bs[i]) * h;
+}
+
+PropagationDP::Y PropagationDP::dYdt(const Y &y, ParticleState &p, double z) const {
+	return dYdt(y, p, getFieldAtPosition(y.x, z));
+}
+
+PropagationDP::Y PropagationDP::dYdt(const Y &y, ParticleState &p, const Vector3d &B) const {
+	// normalize direction vector to prevent numerical losses
+	Vector3d velocity = y.u.getUnitVector() * c_light;
+
+	// Lorentz force: du/dt = q*c/E * (v x B)
+	Vector3d dudt = p.getCharge() * c_light / p.getEnergy() * velocity.cross(B);
+	return Y(velocity, dudt);
+}
+
+void PropagationDP::process(Candidate *candidate) const {
+	// save the new previous particle state
+	ParticleState &current = candidate->current;
+	candidate->savePrevious();
+
+	Y yIn(current.getPosition(), current.getDirection());
+	double step = maxStep;
+
+	// rectilinear propagation for neutral particles
+	if (current.getCharge() == 0) {
+		step = clip(candidate->getNextStep(), minStep, maxStep);
+		current.setPosition(yIn.x + yIn.u * step);
+		candidate->setCurrentStep(step);
+		candidate->setNextStep(maxStep);
+		return;
+	}
+
+	Y yOut, yErr;
+	Vector3d fieldOut;
+	double newStep = step;
+	double z = candidate->getRedshift();
+
+	// the field at the end of the last step is the first stage of this one
+	LastStep *last = lastStep();
+	double lastRatio = 1;
+	Vector3d fieldIn;
+	if (last && last->valid && (last->position == yIn.x) && (last->redshift == z)) {
+		fieldIn = last->field;
+		lastRatio = last->errorRatio;
+	} else {
+		fieldIn = getFieldAtPosition(yIn.x, z);
+	}
+	Y k0 = dYdt(yIn, current, fieldIn);
+	double r = 0;
+
+	// if minStep is the same as maxStep the adaptive algorithm with its error
+	// estimation is not needed and the computation time can be saved:
+	if (minStep == maxStep) {
+		tryStep(yIn, k0, yOut, yErr, fieldOut, step / c_light, current, z);
+	} else {
+		step = clip(candidate->getNextStep(), minStep, maxStep);
+		newStep = step;
+		bool rejected = false;
+
+		// try performing step until the target error (tolerance) or the minimum/maximum step size has been reached
+		while (true) {
+			tryStep(yIn, k0, yOut, yErr, fieldOut, step / c_light, current, z);
+			r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
+			if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
+				if (step == minStep)  // already minimum step size
+					break;
+				newStep = step * 0.95 * pow(r, -0.2);
+				newStep = std::max(newStep, 0.1 * step); // limit step size decrease
+				newStep = std::max(newStep, minStep); // limit step size to minStep
+				step = newStep;
+				rejected = true;
+			} else {  // small direction error relative to tolerance, try to increase step size
+				if (step != maxStep) {  // only update once if maximum step size yet not reached
+					double ratio = std::max(r, 1e-4);
+					newStep = step * 0.9 * pow(ratio, -controlAlpha) * pow(lastRatio, controlBeta);
+					newStep = std::min(newStep, 5 * step); // limit step size increase
+					if (rejected)
+						newStep = std::min(newStep, step); // no increase right after a rejection
+					newStep = std::min(newStep, maxStep); // limit step size to maxStep
+				}
+				break;
+			}
+		}
+	}
+
+	if (last) {
+		last->position = yOut.x;
+		last->redshift = z;
+		last->field = fieldOut;
+		last->errorRatio = std::max(r, 1e-4);
+		last->valid = true;
+	}
+
+	current.setPosition(yOut.x);
+	current.setDirection(yOut.u.getUnitVector());
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(newStep);
+}
+
+void PropagationDP::setField(ref_ptr<MagneticField> f) {
+	field = f;
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	lastSteps.assign(nThreads, LastStep());
+}
+
+ref_ptr<MagneticField> PropagationDP::getField() const {
+	return field;
+}
+
+Vector3d PropagationDP::getFieldAtPosition(Vector3d pos, double z) const {
+	Vector3d B(0, 0, 0);
+	try {
+		// check if field is valid and use the field vector at the
+		// position pos with the redshift z
+		if (field.valid())
+			B = field->getField(pos, z);
+	} catch (std::exception &e) {
+		KISS_LOG_ERROR_LIMITED(10) << "PropagationDP: Exception in PropagationDP::getFieldAtPosition.\n"
+				<< e.what();
+	}
+	return B;
+}
+
+void PropagationDP::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationDP: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationDP::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationDP: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationDP: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationDP::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationDP: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationDP::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationDP::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationDP::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string PropagationDP::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in magnetic fields using the Dormand-Prince method.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / kpc << " kpc";
+	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,223 @@
+#include "crpropa/module/PropagationGC.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+PropagationGC::PropagationGC(ref_ptr<MagneticField> field, double tolerance,
+		double minStep, double maxStep, double epsilon, double stepFraction) {
+	fullOrbit = new PropagationCK(field, tolerance, minStep, maxStep);
+	setField(field);
+	setEpsilon(epsilon);
+	setStepFraction(stepFraction);
+}
+
+// vector from the guiding centre to the particle, E / (q c B) * (b x u)
+static Vector3d gyrationVector(const Vector3d &B, const Vector3d &u,
+		double energy, double charge) {
+	return B.cross(u) * (energy / (charge * c_light * B.getR2()));
+}
+
+double PropagationGC::fieldGeometry(const Vector3d &position, double z,
+		double delta, Vector3d &B, Vector3d &gradB, Vector3d &curvature) const {
+	B = getFieldAtPosition(position, z);
+	double strength = B.getR();
+	if (strength == 0)
+		return 0;
+	Vector3d b = B / strength;
+
+	// derivatives of the field along the axes, dBdx[j] = dB/dx_j
+	Vector3d dBdx[3];
+	double norm2 = 0;
+	for (int j = 0; j < 3; j++) {
+		Vector3d d(0.);
+		d.data[j] = delta;
+		dBdx[j] = (getFieldAtPosition(position + d, z)
+				- getFieldAtPosition(position - d, z)) / (2 * delta);
+		norm2 += dBdx[j].getR2();
+		gradB.data[j] = b.dot(dBdx[j]);
+	}
+
+	// (b . grad) b = ((b . grad) B - b (b . grad) |B|) / |B|
+	Vector3d dBdb = dBdx[0] * b.x + dBdx[1] * b.y + dBdx[2] * b.z;
+	curvature = (dBdb - b * b.dot(dBdb)) / strength;
+	if (norm2 == 0)
+		return std::numeric_limits<double>::infinity();
+	return strength / sqrt(norm2);
+}
+
+double PropagationGC::derivative(const Vector3d &R, double vPar, double z,
+		double energy, double charge, double delta, Vector3d &dRdt,
+		double &dvPardt, Vector3d &B) const {
+	Vector3d gradB, curvature;
+	double scale = fieldGeometry(R, z, delta, B, gradB, curvature);
+	double strength = B.getR();
+	if (strength == 0)
+		return 0;
+	Vector3d b = B / strength;
+	double vPerp2 = std::max(c_squared - vPar * vPar, 0.);
+
+	// parallel motion, grad-B and curvature drift
+	double f = energy / (charge * strength);
+	dRdt = b * vPar + b.cross(gradB) * (f * vPerp2 / (2 * c_squared * strength))
+			+ b.cross(curvature) * (f * vPar * vPar / c_squared);
+	// mirror force, the magnetic moment v_perp^2 / B is constant
+	dvPardt = -vPerp2 / (2 * strength) * b.dot(gradB);
+	return scale;
+}
+
+double PropagationGC::getAdiabaticity(const Vector3d &position, double z,
+		double energy, double charge) const {
+	Vector3d B = getFieldAtPosition(position, z);
+	if ((charge == 0) || (B.getR2() == 0))
+		return std::numeric_limits<double>::infinity();
+	double rL = energy / (fabs(charge) * c_light * B.getR());
+	Vector3d gradB, curvature;
+	double scale = fieldGeometry(position, z, 0.1 * rL, B, gradB, curvature);
+	return rL / scale;
+}
+
+bool PropagationGC::guidingCentreStep(Candidate *candidate) const {
+	ParticleState &current = candidate->current;
+	double q = current.getCharge();
+	if ((q == 0) || !field.valid())
+		return false;
+	double E = current.getEnergy();
+	double z = candidate->getRedshift();
+	Vector3d x = current.getPosition();
+	Vector3d u = current.getDirection();
+
+	// guiding centre R with x = R + rho(R), iterated once from rho(x)
+	Vector3d B = getFieldAtPosition(x, z);
+	if (B.getR2() == 0)
+		return false;
+	Vector3d R = x - gyrationVector(B, u, E, q);
+	B = getFieldAtPosition(R, z);
+	if (B.getR2() == 0)
+		return false;
+	R = x - gyrationVector(B, u, E, q);
+
+	// first stage, and check that the field is slowly varying
+	double rL = E / (fabs(q) * c_light * B.getR());
+	double delta = 0.1 * rL;
+	double vPar = c_light * u.dot(B.getUnitVector());
+	Vector3d k1, k2, k3, k4, B1, Bs;
+	double l1, l2, l3, l4;
+	double scale = derivative(R, vPar, z, E, q, delta, k1, l1, B1);
+	if ((B1.getR2() == 0) || (rL > epsilon * scale))
+		return false;
+
+	double step = std::min(candidate->getNextStep(), stepFraction * scale);
+	step = clip(step, fullOrbit->getMinimumStep(), fullOrbit->getMaximumStep());
+	double dt = step / c_light;
+
+	// fourth order Runge-Kutta step of the guiding centre
+	derivative(R + k1 * (dt / 2), vPar + l1 * dt / 2, z, E, q, delta, k2, l2, Bs);
+	derivative(R + k2 * (dt / 2), vPar + l2 * dt / 2, z, E, q, delta, k3, l3, Bs);
+	derivative(R + k3 * dt, vPar + l3 * dt, z, E, q, delta, k4, l4, Bs);
+	Vector3d R1 = R + (k1 + k2 * 2 + k3 * 2 + k4) * (dt / 6);
+	double vPar1 = vPar + (l1 + 2 * l2 + 2 * l3 + l4) * dt / 6;
+	vPar1 = clip(vPar1, -c_light, c_light);
+	Vector3d B2 = getFieldAtPosition(R1, z);
+	if (B2.getR2() == 0)
+		return false;
+	Vector3d b = B2.getUnitVector();
+
+	// direction with the pitch from the parallel velocity, and the phase of
+	// the gyration advanced by the mean gyration frequency
+	Vector3d e1 = u - b * u.dot(b);
+	if (e1.getR2() < 1e-20)
+		e1 = b.cross((fabs(b.x) < 0.9) ? Vector3d(1, 0, 0) : Vector3d(0, 1, 0));
+	e1 = e1.getUnitVector();
+	Vector3d e2 = b.cross(e1);
+	double phase = -q * c_squared * (B1.getR() + B2.getR()) / 2 / E * dt;
+	phase = fmod(phase, 2 * M_PI);
+	double cosPitch = vPar1 / c_light;
+	double sinPitch = sqrt(std::max(1 - cosPitch * cosPitch, 0.));
+	Vector3d u1 = b * cosPitch + (e1 * cos(phase) + e2 * sin(phase)) * sinPitch;
+
+	candidate->savePrevious();
+	current.setPosition(R1 + gyrationVector(B2, u1, E, q));
+	current.setDirection(u1.getUnitVector());
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(std::min(5 * step, fullOrbit->getMaximumStep()));
+	return true;
+}
+
+void PropagationGC::process(Candidate *candidate) const {
+	if (!guidingCentreStep(candidate))
+		fullOrbit->process(candidate);
+}
+
+void PropagationGC::setField(ref_ptr<MagneticField> f) {
+	field = f;
+	fullOrbit->setField(f);
+}
+
+ref_ptr<MagneticField> PropagationGC::getField() const {
+	return field;
+}
+
+Vector3d PropagationGC::getFieldAtPosition(Vector3d pos, double z) const {
+	return fullOrbit->getFieldAtPosition(pos, z);
+}
+
+void PropagationGC::setTolerance(double tolerance) {
+	fullOrbit->setTolerance(tolerance);
+}
+
+void PropagationGC::setMinimumStep(double minStep) {
+	fullOrbit->setMinimumStep(minStep);
+}
+
+void PropagationGC::setMaximumStep(double maxStep) {
+	fullOrbit->setMaximumStep(maxStep);
+}
+
+void PropagationGC::setEpsilon(double e) {
+	if ((e < 0) or (e > 1))
+		throw std::runtime_error("PropagationGC: epsilon not in range 0-1");
+	epsilon = e;
+}
+
+void PropagationGC::setStepFraction(double f) {
+	if (f <= 0)
+		throw std::runtime_error("PropagationGC: stepFraction <= 0");
+	stepFraction = f;
+}
+
+double PropagationGC::getTolerance() const {
+	return fullOrbit->getTolerance();
+}
+
+double PropagationGC::getMinimumStep() const {
+	return fullOrbit->getMinimumStep();
+}
+
+double PropagationGC::getMaximumStep() const {
+	return fullOrbit->getMaximumStep();
+}
+
+double PropagationGC::getEpsilon() const {
+	return epsilon;
+}
+
+double PropagationGC::getStepFraction() const {
+	return stepFraction;
+}
+
+std::string PropagationGC::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in magnetic fields following the guiding centre where";
+	s << " r_L / L_B < " << epsilon << ", else using the Cash-Karp method.";
+	s << " Target error: " << getTolerance();
+	s << ", Minimum Step: " << getMinimumStep() / kpc << " kpc";
+	s << ", Maximum Step: " << getMaximumStep() / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -16,6 +16,10 @@ void Redshift::process(Candidate *c) const {
 	// use small step approximation:  dz = H(z) / c * ds
 	double dz = hubbleRate(z) / c_light * c->getCurrentStep();
 
+	// exact step from the comoving distance for long steps
+	if (dz > 1e-3)
+		dz = z - redshiftAfterComovingStep(z, c->getCurrentStep());
+
 	// prevent dz > z
 	dz = std::min(dz, z);
 
@@ -27,6 +31,11 @@ void Redshift::process(Candidate *c) const {
 	c->current.setEnergy(E * (1 - dz / (1 + z)));
 }
 
+void Redshift::processBatch(Candidate **candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		Redshift::process(candidates[i]);
+}
+
 std::string Redshift::getDescription() const {
 	std::stringstream s;
 	s << "Redshift: h0 = " << hubbleRate() / 1e5 * Mpc << ", omegaL = "
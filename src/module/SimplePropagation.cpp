@@ -1,4 +1,5 @@
 #include "crpropa/module/SimplePropagation.h"
+#include "crpropa/ParticleStateBatch.h"
 
 #include <sstream>
 #include <stdexcept>
@@ -12,7 +13,7 @@ SimplePropagation::SimplePropagation(double minStep, double maxStep) :
 }
 
 void SimplePropagation::process(Candidate *c) const {
-	c->previous = c->current;
+	c->savePrevious();
 
 	double step = clip(c->getNextStep(), minStep, maxStep);
 	c->setCurrentStep(step);
@@ -22,6 +23,28 @@ void SimplePropagation::process(Candidate *c) const {
 	c->setNextStep(maxStep);
 }
 
+void SimplePropagation::processBatch(Candidate **candidates, size_t n) const {
+	static thread_local ParticleStateBatch states;
+	static thread_local std::vector<double> steps;
+	states.load(candidates, n);
+	steps.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		Candidate *c = candidates[i];
+		c->savePrevious();
+		steps[i] = clip(c->getNextStep(), minStep, maxStep);
+		c->setCurrentStep(steps[i]);
+		c->setNextStep(maxStep);
+	}
+
+	// straight line step on contiguous arrays
+	for (size_t i = 0; i < n; i++) {
+		states.x[i] += states.dx[i] * steps[i];
+		states.y[i] += states.dy[i] * steps[i];
+		states.z[i] += states.dz[i] * steps[i];
+	}
+	states.store(candidates);
+}
+
 void SimplePropagation::setMinimumStep(double step) {
 	if (step > maxStep)
 		throw std::runtime_error("SimplePropagation: minStep > maxStep");
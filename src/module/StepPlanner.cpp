@@ -0,0 +1,58 @@
+#include "crpropa/module/StepPlanner.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+StepPlanner::StepPlanner(double minStep) {
+	setMinimumStep(minStep);
+}
+
+void StepPlanner::add(Module *module) {
+	modules.push_back(module);
+}
+
+std::size_t StepPlanner::size() const {
+	return modules.size();
+}
+
+ref_ptr<Module> StepPlanner::operator[](const std::size_t i) {
+	if (i >= modules.size())
+		throw std::runtime_error("StepPlanner: index out of range");
+	return modules[i];
+}
+
+void StepPlanner::setMinimumStep(double step) {
+	if (step < 0)
+		throw std::runtime_error("StepPlanner: minStep < 0");
+	minStep = step;
+}
+
+double StepPlanner::getMinimumStep() const {
+	return minStep;
+}
+
+double StepPlanner::getStepLimit(const Candidate *candidate) const {
+	double step = std::numeric_limits<double>::max();
+	for (size_t i = 0; i < modules.size(); i++)
+		step = std::min(step, modules[i]->getStepLimit(candidate));
+	return std::max(step, minStep);
+}
+
+void StepPlanner::process(Candidate *candidate) const {
+	candidate->limitNextStep(getStepLimit(candidate));
+}
+
+std::string StepPlanner::getDescription() const {
+	std::stringstream s;
+	s << "StepPlanner: minStep " << minStep / kpc << " kpc, modules:";
+	for (size_t i = 0; i < modules.size(); i++)
+		s << "\n    " << modules[i]->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,224 @@
+#include "crpropa/module/StreamOutput.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+OutputChunk::OutputChunk(size_t width) : rows(0), width(width), memory(MemoryUsage::OutputBuffers) {
+}
+
+size_t OutputChunk::getRows() const {
+	return rows;
+}
+
+size_t OutputChunk::getWidth() const {
+	return width;
+}
+
+// number of values of a column in the row, positions without Y and Z and no directions in 1D
+static size_t rowColumnWidth(Output::OutputColumn column, bool oneDimensional) {
+	size_t width = ParticleCollector::getColumnWidth(column);
+	if (!oneDimensional)
+		return width;
+	switch (column) {
+	case Output::CurrentPositionColumn:
+	case Output::SourcePositionColumn:
+	case Output::CreatedPositionColumn:
+		return 1;
+	case Output::CurrentDirectionColumn:
+	case Output::SourceDirectionColumn:
+	case Output::CreatedDirectionColumn:
+		return 0;
+	default:
+		return width;
+	}
+}
+
+static double columnScale(Output::OutputColumn column, double lengthScale, double energyScale) {
+	switch (column) {
+	case Output::TrajectoryLengthColumn:
+	case Output::CurrentPositionColumn:
+	case Output::SourcePositionColumn:
+	case Output::CreatedPositionColumn:
+		return lengthScale;
+	case Output::CurrentEnergyColumn:
+	case Output::SourceEnergyColumn:
+	case Output::CreatedEnergyColumn:
+		return energyScale;
+	default:
+		return 1;
+	}
+}
+
+StreamOutput::StreamOutput(size_t chunkSize, OutputType outputType) :
+		Output(outputType), chunkSize(chunkSize), pipeline(0) {
+	if (chunkSize == 0)
+		throw std::runtime_error("StreamOutput: chunk size must be positive");
+}
+
+StreamOutput::~StreamOutput() {
+	delete pipeline;
+}
+
+size_t StreamOutput::getRowWidth() const {
+	size_t width = properties.size();
+	for (size_t i = 0; i <= WeightColumn; i++)
+		if (fields.test(i))
+			width += rowColumnWidth(OutputColumn(i), oneDimensional);
+	return width;
+}
+
+void StreamOutput::fillRow(const Candidate *c, double *row) const {
+	double values[3];
+	for (size_t i = 0; i <= WeightColumn; i++) {
+		OutputColumn column = OutputColumn(i);
+		size_t width = rowColumnWidth(column, oneDimensional);
+		if (!fields.test(i) || (width == 0))
+			continue;
+		ParticleCollector::readColumn(*c, column, values);
+		double scale = columnScale(column, lengthScale, energyScale);
+		for (size_t j = 0; j < width; j++)
+			*row++ = values[j] / scale;
+	}
+	for (size_t i = 0; i < properties.size(); i++) {
+		const Property &p = properties[i];
+		*row++ = c->hasProperty(p.name) ? c->getProperty(p.name).toDouble() : p.defaultValue.toDouble();
+	}
+}
+
+void StreamOutput::process(Candidate *c) const {
+	if (!accept(c))
+		return;
+	std::vector<double> row(getRowWidth());
+	fillRow(c, row.data());
+
+	if (pipeline) {
+		pipeline->push(row);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(chunkMutex);
+	Output::process(c);
+	append(row);
+}
+
+void StreamOutput::append(const std::vector<double> &row) const {
+	// columns changed: pass the rows of the old layout first
+	if (chunk.valid() && chunk->width != row.size())
+		deliver();
+	if (!chunk.valid()) {
+		chunk = new OutputChunk(row.size());
+		chunk->values.reserve(chunkSize * row.size());
+		chunk->memory.set(chunk->values.capacity() * sizeof(double));
+	}
+	chunk->values.insert(chunk->values.end(), row.begin(), row.end());
+	chunk->rows++;
+	if (chunk->rows >= chunkSize)
+		deliver();
+}
+
+void StreamOutput::deliver() const {
+	if (!chunk.valid() || (chunk->rows == 0))
+		return;
+	ref_ptr<OutputChunk> full = chunk;
+	chunk = 0;
+	onChunk(full);
+}
+
+void StreamOutput::consume(std::vector<double> &row) const {
+	count++;
+	append(row);
+}
+
+void StreamOutput::commit() const {
+	deliver();
+}
+
+void StreamOutput::onChunk(OutputChunk *c) const {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	queue.push_back(c);
+}
+
+ref_ptr<OutputChunk> StreamOutput::popChunk() {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (queue.empty())
+		return 0;
+	ref_ptr<OutputChunk> c = queue.front();
+	queue.pop_front();
+	return c;
+}
+
+size_t StreamOutput::getNumberOfQueuedChunks() const {
+	std::lock_guard<std::mutex> lock(queueMutex);
+	return queue.size();
+}
+
+std::vector<std::string> StreamOutput::getColumnNames() const {
+	// value names of the columns in the order of OutputColumn
+	static const char *names[][3] = {{"D"}, {}, {"z"}, {"ID"}, {"E"},
+		{"X", "Y", "Z"}, {"Px", "Py", "Pz"}, {"ID0"}, {"E0"}, {"X0", "Y0", "Z0"},
+		{"P0x", "P0y", "P0z"}, {"ID1"}, {"E1"}, {"X1", "Y1", "Z1"},
+		{"P1x", "P1y", "P1z"}, {}, {"SN", "SN0", "SN1"}, {"W"}};
+
+	std::vector<std::string> result;
+	for (size_t i = 0; i <= WeightColumn; i++) {
+		if (!fields.test(i))
+			continue;
+		size_t width = rowColumnWidth(OutputColumn(i), oneDimensional);
+		for (size_t j = 0; j < width; j++)
+			result.push_back(names[i][j]);
+	}
+	for (size_t i = 0; i < properties.size(); i++)
+		result.push_back(properties[i].name);
+	return result;
+}
+
+void StreamOutput::setChunkSize(size_t size) {
+	if (size == 0)
+		throw std::runtime_error("StreamOutput: chunk size must be positive");
+	chunkSize = size;
+}
+
+size_t StreamOutput::getChunkSize() const {
+	return chunkSize;
+}
+
+void StreamOutput::setAsync(bool async, size_t capacity) {
+	delete pipeline;
+	pipeline = 0;
+	if (async)
+		pipeline = new AsyncPipeline<std::vector<double>, StreamOutput>(this, capacity);
+}
+
+bool StreamOutput::getAsync() const {
+	return pipeline != 0;
+}
+
+void StreamOutput::flush() const {
+	if (pipeline) {
+		pipeline->drain();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(chunkMutex);
+	deliver();
+}
+
+void StreamOutput::close() {
+	std::exception_ptr error = pipeline ? pipeline->close() : std::exception_ptr();
+	setAsync(false);
+	flush();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+std::string StreamOutput::getDescription() const {
+	std::stringstream s;
+	s << "StreamOutput: chunks of " << chunkSize << " rows";
+	if (pipeline)
+		s << ", asynchronous";
+	return s.str();
+}
+
+} // namespace crpropa
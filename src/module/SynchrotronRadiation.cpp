@@ -2,6 +2,7 @@
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -14,8 +15,10 @@ SynchrotronRadiation::SynchrotronRadiation(ref_ptr<MagneticField> field, bool ha
 	initSpectrum();
 	setHavePhotons(havePhotons);
 	setLimit(limit);
+	setExactLoss(false);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setPacketBins(0);
 }
 
 SynchrotronRadiation::SynchrotronRadiation(double Brms, bool havePhotons, double thinning, int nSamples, double limit) {
@@ -23,8 +26,10 @@ SynchrotronRadiation::SynchrotronRadiation(double Brms, bool havePhotons, double
 	initSpectrum();
 	setHavePhotons(havePhotons);
 	setLimit(limit);
+	setExactLoss(false);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setPacketBins(0);
 }
 
 void SynchrotronRadiation::setField(ref_ptr<MagneticField> f) {
@@ -67,6 +72,14 @@ double SynchrotronRadiation::getLimit() {
 	return limit;
 }
 
+void SynchrotronRadiation::setExactLoss(bool exact) {
+	this->exactLoss = exact;
+}
+
+bool SynchrotronRadiation::getExactLoss() const {
+	return exactLoss;
+}
+
 void SynchrotronRadiation::setMaximumSamples(int nmax) {
 	maximumSamples = nmax;
 }
@@ -83,6 +96,32 @@ double SynchrotronRadiation::getSecondaryThreshold() const {
 	return secondaryThreshold;
 }
 
+void SynchrotronRadiation::setPacketBins(int nBins) {
+	if (nBins < 0)
+		throw std::runtime_error("SynchrotronRadiation: number of packet bins < 0");
+	packetBins = std::min(nBins, int(tabx.size()) - 1);
+
+	// packet bins of equal numbers of tabulated (log-spaced) bins 1 ... n - 1
+	packetEdges.clear();
+	packetProbability.clear();
+	meanX = 0;
+	if (packetBins == 0)
+		return;
+	size_t n = tabx.size() - 1;
+	for (int k = 0; k <= packetBins; k++)
+		packetEdges.push_back(1 + (n * k) / packetBins);
+	for (int k = 0; k < packetBins; k++)
+		packetProbability.push_back((tabCDF[packetEdges[k + 1] - 1] - tabCDF[packetEdges[k] - 1]) / tabCDF.back());
+
+	// mean photon energy, x uniformly distributed within the tabulated bins
+	for (size_t i = 1; i <= n; i++)
+		meanX += (tabCDF[i] - tabCDF[i - 1]) / tabCDF.back() * (tabx[i - 1] + tabx[i]) / 2;
+}
+
+int SynchrotronRadiation::getPacketBins() const {
+	return packetBins;
+}
+
 void SynchrotronRadiation::initSpectrum() {
 	std::string filename = getDataPath("Synchrotron/spectrum.txt");
 	std::ifstream infile(filename.c_str());
@@ -106,6 +145,7 @@ void SynchrotronRadiation::initSpectrum() {
 		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
 	}
 	infile.close();
+	tabAlias = AliasTable(tabCDF);
 }
 
 void SynchrotronRadiation::process(Candidate *candidate) const {
@@ -130,6 +170,8 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	double dEdx = 1. / 6 / M_PI / epsilon0 * pow(lf * lf - 1, 2) * pow(charge / Rg, 2); // Jackson p. 770 (14.31)
 	double step = candidate->getCurrentStep() / (1 + z); // step size in local frame
 	double dE = step * dEdx;
+	if (exactLoss) // dE/dx ~ E^2
+		dE = candidate->current.getEnergy() * dE / (candidate->current.getEnergy() + dE);
 
 	// apply energy loss and limit next step
 	double E = candidate->current.getEnergy();
@@ -145,16 +187,38 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	if (14 * Ecrit < secondaryThreshold)
 		return;
 
+	Random &random = Random::instance();
+
+	// aggregated emission: the expected number of photons per packet bin
+	if (packetBins > 0) {
+		double nPhotons = dE / (meanX * Ecrit);
+		for (int k = 0; k < packetBins; k++) {
+			double w = nPhotons * packetProbability[k];
+			if (w <= 0)
+				continue;
+			double lo = tabCDF[packetEdges[k] - 1], hi = tabCDF[packetEdges[k + 1] - 1];
+			std::vector<double>::const_iterator it = std::lower_bound(
+					tabCDF.begin() + packetEdges[k], tabCDF.begin() + packetEdges[k + 1],
+					lo + random.rand() * (hi - lo));
+			size_t i = std::min((size_t) (it - tabCDF.begin()), packetEdges[k + 1] - 1);
+			double Ephoton = (tabx[i - 1] + random.rand() * (tabx[i] - tabx[i - 1])) * Ecrit;
+			if (Ephoton <= secondaryThreshold)
+				continue;
+			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+			candidate->addSecondary(22, Ephoton, pos, w, interactionTag);
+		}
+		return;
+	}
+
 	// draw photons up to the total energy loss
 	// if maximumSamples is reached before that, compensate the total energy afterwards
-	Random &random = Random::instance();
 	double dE0 = dE;
 	std::vector<double> energies;
 	int counter = 0;
 	while (dE > 0) {
 		// draw random value between 0 and maximum of corresponding cdf
 		// choose bin of s where cdf(x) = cdf_rand -> x_rand
-		size_t i = random.randBin(tabCDF); // draw random bin (upper bin boundary returned)
+		size_t i = random.randBin(tabAlias); // draw random bin (upper bin boundary returned)
 		double binWidth = (tabx[i] - tabx[i-1]);
 		double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
 		double Ephoton = x * Ecrit;
@@ -216,6 +280,8 @@ std::string SynchrotronRadiation::getDescription() const {
 		s << "maximum number of photon samples: " << maximumSamples;
 	if (thinning > 0)
 		s << "thinning parameter: " << thinning; 
+	if (packetBins > 0)
+		s << ", photons aggregated in " << packetBins << " bins";
 	return s.str();
 }
 
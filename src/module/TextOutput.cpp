@@ -1,8 +1,11 @@
 #include "crpropa/module/TextOutput.h"
 #include "crpropa/module/ParticleCollector.h"
+#include "crpropa/Common.h"
+#include "crpropa/ParallelGzip.h"
 #include "crpropa/Units.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
+#include "crpropa/Trace.h"
 #include "crpropa/base64.h"
 
 #include "kiss/string.h"
@@ -13,27 +16,26 @@
 
 #ifdef CRPROPA_HAVE_ZLIB
 #include <izstream.hpp>
-#include <ozstream.hpp>
 #endif
 
 namespace crpropa {
 
-TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false) {
+TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 }
 
-TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false) {
+TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 }
 
-TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false) {
+TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 }
 
 TextOutput::TextOutput(std::ostream &out,
-		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false) {
+		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 }
 
 TextOutput::TextOutput(const std::string &filename) :  Output(), outfile(filename.c_str(),
 				std::ios::binary), out(&outfile),  filename(
-				filename), storeRandomSeeds(false) {
+				filename), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 	if (!outfile.is_open())
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 	if (kiss::ends_with(filename, ".gz"))
@@ -43,7 +45,7 @@ TextOutput::TextOutput(const std::string &filename) :  Output(), outfile(filenam
 TextOutput::TextOutput(const std::string &filename,
 				OutputType outputtype) : Output(outputtype), outfile(filename.c_str(),
 				std::ios::binary), out(&outfile), filename(
-				filename), storeRandomSeeds(false) {
+				filename), storeRandomSeeds(false), compressionThreads(1), pipeline(0), ordered(0) {
 	if (!outfile.is_open())
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 	if (kiss::ends_with(filename, ".gz"))
@@ -156,131 +158,188 @@ void TextOutput::printHeader() const {
 	}
 }
 
+namespace {
+
+// appends the columns of a row, with the formats of printf
+class RowWriter {
+	std::string &line;
+	char buffer[32];
+public:
+	RowWriter(std::string &line) : line(line) {
+	}
+	// %8.5E and %1.5E, wider than the fields anyway
+	void scientific(double x) {
+		size_t n = formatScientific(buffer, x, 5);
+		buffer[n] = '\t';
+		line.append(buffer, n + 1);
+	}
+	void scientific(const Vector3d &v) {
+		scientific(v.x);
+		scientific(v.y);
+		scientific(v.z);
+	}
+	void integer(int x) { // %10i
+		size_t n = formatInteger(buffer, x, 10);
+		buffer[n] = '\t';
+		line.append(buffer, n + 1);
+	}
+	void serial(uint64_t x) { // %10lu
+		size_t n = formatUnsigned(buffer, x, 10);
+		buffer[n] = '\t';
+		line.append(buffer, n + 1);
+	}
+	void text(const std::string &x) {
+		line.append(x);
+		line.append(1, '\t');
+	}
+};
+
+} // namespace
+
 void TextOutput::process(Candidate *c) const {
-	if (fields.none() && properties.empty())
+	if ((fields.none() && properties.empty()) || !accept(c))
 		return;
 
-	char buffer[1024];
-	size_t p = 0;
-
-	std::locale old_locale = std::locale::global(std::locale::classic());
+	// formatted by the calling thread into its own buffer, without the locale
+	static thread_local std::string line;
+	line.clear();
+	RowWriter row(line);
 
 	if (fields.test(TrajectoryLengthColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->getTrajectoryLength() / lengthScale);
+		row.scientific(c->getTrajectoryLength() / lengthScale);
 
 	if (fields.test(RedshiftColumn))
-		p += std::sprintf(buffer + p, "%1.5E\t", c->getRedshift());
+		row.scientific(c->getRedshift());
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getSerialNumber());
+		row.serial(c->getSerialNumber());
 	if (fields.test(CurrentIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->current.getId());
+		row.integer(c->current.getId());
 	if (fields.test(CurrentEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->current.getEnergy() / energyScale);
+		row.scientific(c->current.getEnergy() / energyScale);
 	if (fields.test(CurrentPositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->current.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->current.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(CurrentDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->current.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (oneDimensional)
+			row.scientific(c->current.getPosition().x / lengthScale);
+		else
+			row.scientific(c->current.getPosition() / lengthScale);
 	}
+	if (fields.test(CurrentDirectionColumn) && not oneDimensional)
+		row.scientific(c->current.getDirection());
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t", c->getSourceSerialNumber());
+		row.serial(c->getSourceSerialNumber());
 	if (fields.test(SourceIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->source.getId());
+		row.integer(c->source.getId());
 	if (fields.test(SourceEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->source.getEnergy() / energyScale);
+		row.scientific(c->source.getEnergy() / energyScale);
 	if (fields.test(SourcePositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->source.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->source.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(SourceDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->source.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-
+		if (oneDimensional)
+			row.scientific(c->source.getPosition().x / lengthScale);
+		else
+			row.scientific(c->source.getPosition() / lengthScale);
 	}
+	if (fields.test(SourceDirectionColumn) && not oneDimensional)
+		row.scientific(c->source.getDirection());
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getCreatedSerialNumber());
+		row.serial(c->getCreatedSerialNumber());
 	if (fields.test(CreatedIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->created.getId());
+		row.integer(c->created.getId());
 	if (fields.test(CreatedEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->created.getEnergy() / energyScale);
+		row.scientific(c->created.getEnergy() / energyScale);
 	if (fields.test(CreatedPositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->created.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->created.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (oneDimensional)
+			row.scientific(c->created.getPosition().x / lengthScale);
+		else
+			row.scientific(c->created.getPosition() / lengthScale);
 	}
-	if (fields.test(CreatedDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->created.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(WeightColumn)) {
-		p += std::sprintf(buffer + p, "%8.5E\t", c->getWeight());
-	}
-	if (fields.test(CandidateTagColumn)) {
-		p += std::sprintf(buffer + p, "%s\t", c->getTagOrigin().c_str());
-	}
-
-	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
-			iter != properties.end(); ++iter) {
-		  Variant v;
+	if (fields.test(CreatedDirectionColumn) && not oneDimensional)
+		row.scientific(c->created.getDirection());
+	if (fields.test(WeightColumn))
+		row.scientific(c->getWeight());
+	if (fields.test(CandidateTagColumn))
+		row.text(c->getTagOrigin());
+
+	if (!properties.empty()) {
+		// the properties are formatted by streams, in the classic locale
+		std::locale old_locale = std::locale::global(std::locale::classic());
+		for(std::vector<Output::Property>::const_iterator iter = properties.begin();
+				iter != properties.end(); ++iter) {
+			Variant v;
 			if (c->hasProperty((*iter).name)) {
 				v = c->getProperty((*iter).name);
 			} else {
 				v = (*iter).defaultValue;
 			}
-			p += std::sprintf(buffer + p, "%s", v.toString("\t").c_str());
-			p += std::sprintf(buffer + p, "\t");
+			row.text(v.toString("\t"));
+		}
+		std::locale::global(old_locale);
 	}
-	buffer[p - 1] = '\n';
+	line[line.size() - 1] = '\n';
 
-	std::locale::global(old_locale);
+	if (ordered) {
+		ordered->push(c->getSourceSerialNumber(), c->getSerialNumber(), line.data(), line.size());
+		return;
+	}
+
+	if (pipeline) {
+		std::string record(line);
+		pipeline->push(record);
+		return;
+	}
 
+	TraceWait wait("TextOutput");
 #pragma omp critical
 	{
+		wait.acquired();
 		if (count == 0)
 			printHeader();
 		Output::process(c);
-		out->write(buffer, p);
+		out->write(line.data(), line.size());
 	}
 
 }
 
+void TextOutput::consume(std::string &line) const {
+	if (count == 0)
+		printHeader();
+	count++;
+	out->write(line.c_str(), line.size());
+}
+
+void TextOutput::commit() const {
+	TraceSpan span("TextOutput::flush", "flush");
+	out->flush();
+}
+
+void TextOutput::setAsync(bool async, size_t capacity) {
+	if (async && ordered)
+		throw std::runtime_error("TextOutput: the ordered output is not used with setAsync");
+	delete pipeline;
+	pipeline = 0;
+	if (async)
+		pipeline = new AsyncPipeline<std::string, TextOutput>(this, capacity);
+}
+
+bool TextOutput::getAsync() const {
+	return pipeline != 0;
+}
+
+void TextOutput::setOrdered(bool enable, size_t runSize) {
+	if (enable && pipeline)
+		throw std::runtime_error("TextOutput: the ordered output is not used with setAsync");
+	if (ordered && ordered->size())
+		throw std::runtime_error("TextOutput: setOrdered has to be called before the output");
+	delete ordered;
+	ordered = 0;
+	if (enable)
+		ordered = new OrderedRecords(runSize);
+}
+
+bool TextOutput::getOrdered() const {
+	return ordered != 0;
+}
+
 void TextOutput::load(const std::string &filename, ParticleCollector *collector){
 
 	std::string line;
@@ -355,24 +414,51 @@ std::string TextOutput::getDescription() const {
 }
 
 void TextOutput::close() {
-#ifdef CRPROPA_HAVE_ZLIB
-	zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
+	// the lines consumed before an error of the writer thread are still written
+	std::exception_ptr error = pipeline ? pipeline->close() : std::exception_ptr();
+	setAsync(false);
+	if (ordered) {
+		ordered->merge([this](const char *line, size_t size) {
+			if (count == 0)
+				printHeader();
+			count++;
+			out->write(line, size);
+		});
+		delete ordered;
+		ordered = 0;
+	}
+	ParallelGzipStream *zs = dynamic_cast<ParallelGzipStream *>(out);
 	if (zs) {
 		zs->close();
 		delete out;
 		out = 0;
 	}
-#endif
 	outfile.flush();
+	if (error)
+		std::rethrow_exception(error);
 }
 
 TextOutput::~TextOutput() {
+	// an exception of the writer thread can only be thrown by close()
+	delete pipeline;
+	pipeline = 0;
 	close();
 }
 
+void TextOutput::setCompressionThreads(size_t threads) {
+	compressionThreads = threads;
+	ParallelGzipStream *zs = dynamic_cast<ParallelGzipStream *>(out);
+	if (zs)
+		zs->setThreads(threads);
+}
+
+size_t TextOutput::getCompressionThreads() const {
+	return compressionThreads;
+}
+
 void TextOutput::gzip() {
 #ifdef CRPROPA_HAVE_ZLIB
-	out = new zstream::ogzstream(*out);
+	out = new ParallelGzipStream(*out, compressionThreads);
 #else
 	throw std::runtime_error("CRPropa was built without Zlib compression!");
 #endif
@@ -100,7 +100,7 @@ string ParticleFilter::getDescription() const {
 
 // ----------------------------------------------------------------------------
 EmissionMapFiller::EmissionMapFiller(EmissionMap *emissionMap) : emissionMap(emissionMap) {
-
+	setRunOnInactive(true);
 }
 
 void EmissionMapFiller::setEmissionMap(EmissionMap *emissionMap) {
@@ -108,12 +108,9 @@ void EmissionMapFiller::setEmissionMap(EmissionMap *emissionMap) {
 }
 
 void EmissionMapFiller::process(Candidate* candidate) const {
-	if (emissionMap) {
-		#pragma omp critical
-		{
-			emissionMap->fillMap(candidate->source);
-		}
-	}
+	// the map creation and the bins of EmissionMap are thread-safe
+	if (emissionMap)
+		emissionMap->fillMap(candidate->source);
 }
 
 string EmissionMapFiller::getDescription() const {
@@ -0,0 +1,92 @@
+// Comparison of the results of crpropa-bench and crpropa-scenarios with a
+// baseline written by an earlier run, used by the perf tests of CTest.
+// A result is a regression when it is slower than the baseline by more than
+// the tolerance; a missing baseline file is recorded from the current run.
+
+#ifndef CRPROPA_BASELINE_H
+#define CRPROPA_BASELINE_H
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// Value of "key": after pos in a JSON text, 0 if not found before end
+static double findValue(const std::string &text, const std::string &key, size_t pos, size_t end) {
+	size_t found = text.find("\"" + key + "\": ", pos);
+	if ((found == std::string::npos) || (found >= end))
+		return 0;
+	return atof(text.c_str() + found + key.size() + 4);
+}
+
+// Values of a metric per entry of the results, the entries are identified
+// by their name and, if given, the value of a second key (e.g. threads)
+static std::map<std::string, double> readResults(const std::string &text, const std::string &metric,
+		const std::string &key = "") {
+	std::map<std::string, double> values;
+	const std::string marker = "{\"name\": \"";
+	size_t pos = text.find(marker);
+	while (pos != std::string::npos) {
+		size_t begin = pos + marker.size();
+		size_t next = text.find(marker, begin);
+		size_t end = (next == std::string::npos) ? text.size() : next;
+		std::string name = text.substr(begin, text.find('"', begin) - begin);
+		if (!key.empty()) {
+			std::stringstream ss;
+			ss << name << "/" << findValue(text, key, begin, end);
+			name = ss.str();
+		}
+		double value = findValue(text, metric, begin, end);
+		if (value > 0)
+			values[name] = value;
+		pos = next;
+	}
+	return values;
+}
+
+// Compare the results with the baseline file and return the number of
+// regressions. With higherIsBetter the metric is a rate, otherwise a time.
+static int compareBaseline(const std::string &program, const std::string &results,
+		const std::string &filename, const std::string &metric, bool higherIsBetter,
+		double tolerance, const std::string &key = "") {
+	std::ifstream in(filename.c_str());
+	if (!in.good()) {
+		std::ofstream out(filename.c_str());
+		out << results;
+		if (!out.good()) {
+			std::cerr << program << ": could not write the baseline " << filename << std::endl;
+			return 1;
+		}
+		std::cerr << program << ": recorded the baseline " << filename << std::endl;
+		return 0;
+	}
+	std::stringstream baselineText;
+	baselineText << in.rdbuf();
+	std::map<std::string, double> baseline = readResults(baselineText.str(), metric, key);
+	std::map<std::string, double> current = readResults(results, metric, key);
+
+	int regressions = 0;
+	std::map<std::string, double>::const_iterator i;
+	for (i = current.begin(); i != current.end(); i++) {
+		std::map<std::string, double>::const_iterator b = baseline.find(i->first);
+		if (b == baseline.end())
+			continue;
+		double slowdown = higherIsBetter ? b->second / i->second : i->second / b->second;
+		bool regression = slowdown > 1 + tolerance;
+		std::cerr << program << ": " << i->first << " " << metric << " " << i->second
+			<< ", baseline " << b->second << ", " << std::fabs(slowdown - 1) * 100
+			<< ((slowdown > 1) ? "% slower" : "% faster")
+			<< (regression ? " REGRESSION" : "") << std::endl;
+		if (regression)
+			regressions++;
+	}
+	if (regressions)
+		std::cerr << program << ": " << regressions << " regressions by more than "
+			<< tolerance * 100 << "% against " << filename << std::endl;
+	return regressions;
+}
+
+#endif // CRPROPA_BASELINE_H
@@ -0,0 +1,327 @@
+// Microbenchmarks of the core kernels, built with -DENABLE_BENCHMARKS=ON.
+// The results are written as JSON, one entry per benchmark with the median
+// time per operation of several repetitions, for comparisons between versions.
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Common.h"
+#include "crpropa/Grid.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/Version.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/PropagationCK.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "crpropa-baseline.h"
+
+using namespace crpropa;
+
+// results are accumulated here so that the compiler keeps the benchmarked code
+static volatile double sink = 0;
+
+// A benchmark prepares its data once and runs n operations per call
+class Benchmark {
+public:
+	virtual ~Benchmark() {
+	}
+	virtual std::string getName() const = 0;
+	virtual void run(size_t n) = 0;
+};
+
+// n interpolations at random positions inside the grid
+class GridInterpolation: public Benchmark {
+	ref_ptr<Grid3f> grid;
+	std::string name;
+	std::vector<Vector3d> positions;
+public:
+	GridInterpolation(interpolationType type, const std::string &name) : name(name) {
+		grid = new Grid3f(Vector3d(0.), 64, 1.);
+		Random random(42);
+		std::vector<Vector3f> &values = grid->getGrid();
+		for (size_t i = 0; i < values.size(); i++)
+			values[i] = Vector3f(random.rand(), random.rand(), random.rand());
+		grid->setInterpolationType(type);
+		for (size_t i = 0; i < 4096; i++)
+			positions.push_back(Vector3d(random.rand(), random.rand(), random.rand()) * 64.);
+	}
+	std::string getName() const {
+		return "Grid3f::interpolate/" + name;
+	}
+	void run(size_t n) {
+		double s = 0;
+		for (size_t i = 0; i < n; i++)
+			s += grid->interpolate(positions[i % positions.size()]).x;
+		sink += s;
+	}
+};
+
+// n field evaluations at random positions within 10 kpc
+class FieldEvaluation: public Benchmark {
+	ref_ptr<MagneticField> field;
+	std::string name;
+	std::vector<Vector3d> positions;
+public:
+	FieldEvaluation(MagneticField *field, const std::string &name) : field(field), name(name) {
+		Random random(42);
+		for (size_t i = 0; i < 4096; i++)
+			positions.push_back(random.randVector() * random.rand() * 10 * kpc);
+	}
+	std::string getName() const {
+		return name;
+	}
+	void run(size_t n) {
+		double s = 0;
+		for (size_t i = 0; i < n; i++)
+			s += field->getField(positions[i % positions.size()]).x;
+		sink += s;
+	}
+};
+
+// n propagation steps of an electron (no mass table needed) in a turbulent field
+class PropagationStep: public Benchmark {
+	ref_ptr<Module> propagation;
+	std::string name;
+	Candidate candidate;
+public:
+	PropagationStep(Module *propagation, const std::string &name) :
+			propagation(propagation), name(name), candidate(11, 10 * EeV) {
+	}
+	std::string getName() const {
+		return name;
+	}
+	void run(size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			candidate.setNextStep(10 * pc);
+			propagation->process(&candidate);
+		}
+		sink += candidate.current.getPosition().x;
+	}
+};
+
+// n bins drawn from a cumulative distribution of 1000 bins
+class RandomBin: public Benchmark {
+	std::vector<double> cdf;
+	Random random;
+public:
+	RandomBin() : random(42) {
+		double sum = 0;
+		for (size_t i = 0; i < 1000; i++) {
+			sum += random.rand();
+			cdf.push_back(sum);
+		}
+	}
+	std::string getName() const {
+		return "Random::randBin";
+	}
+	void run(size_t n) {
+		size_t s = 0;
+		for (size_t i = 0; i < n; i++)
+			s += random.randBin(cdf);
+		sink += s;
+	}
+};
+
+// n interpolations in a table of 1000 values, or of 100 x 100 values
+class TableInterpolation: public Benchmark {
+	bool twoDimensional;
+	std::vector<double> x, y, z, points;
+public:
+	TableInterpolation(bool twoDimensional) : twoDimensional(twoDimensional) {
+		size_t n = twoDimensional ? 100 : 1000;
+		for (size_t i = 0; i < n; i++) {
+			x.push_back(i);
+			y.push_back(i);
+		}
+		for (size_t i = 0; i < n * (twoDimensional ? n : 1); i++)
+			z.push_back(i);
+		Random random(42);
+		for (size_t i = 0; i < 4096; i++)
+			points.push_back(random.rand() * (n - 1));
+	}
+	std::string getName() const {
+		return twoDimensional ? "interpolate2d" : "interpolate";
+	}
+	void run(size_t n) {
+		double s = 0;
+		size_t m = points.size();
+		if (twoDimensional) {
+			for (size_t i = 0; i < n; i++)
+				s += interpolate2d(points[i % m], points[(i + 1) % m], x, y, z);
+		} else {
+			for (size_t i = 0; i < n; i++)
+				s += interpolate(points[i % m], x, z);
+		}
+		sink += s;
+	}
+};
+
+// n secondaries added to a candidate, cleared every 100
+class AddSecondary: public Benchmark {
+	Candidate candidate;
+public:
+	std::string getName() const {
+		return "Candidate::addSecondary";
+	}
+	void run(size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			candidate.addSecondary(22, 1 * EeV);
+			if (candidate.secondaries.size() == 100)
+				candidate.clearSecondaries();
+		}
+		sink += candidate.secondaries.size();
+	}
+};
+
+static double seconds(size_t n, Benchmark *benchmark) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	benchmark->run(n);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+static std::string jsonEscape(const std::string &text) {
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		if ((text[i] == '"') || (text[i] == '\\'))
+			escaped += '\\';
+		if (text[i] == '\n')
+			escaped += "\\n";
+		else
+			escaped += text[i];
+	}
+	return escaped;
+}
+
+static void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [options]\n"
+		<< "  -f filter   run only the benchmarks with filter in their name\n"
+		<< "  -t seconds  minimum time of one repetition (default 0.2)\n"
+		<< "  -r count    number of repetitions (default 5)\n"
+		<< "  -o file     write the JSON results to a file instead of stdout\n"
+		<< "  -b file     compare with the results in a baseline file, which is written if missing;\n"
+		<< "              fails if one is slower by more than the tolerance\n"
+		<< "  -x fraction tolerance of the comparison with the baseline (default 0.1)\n"
+		<< "  -l          list the benchmarks\n";
+}
+
+int main(int argc, char **argv) {
+	std::string filter, filename, baselineFile;
+	double tolerance = 0.1;
+	double minTime = 0.2;
+	int repetitions = 5;
+	bool list = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "-f") && (i + 1 < argc))
+			filter = argv[++i];
+		else if ((arg == "-t") && (i + 1 < argc))
+			minTime = atof(argv[++i]);
+		else if ((arg == "-r") && (i + 1 < argc))
+			repetitions = std::max(1, atoi(argv[++i]));
+		else if ((arg == "-o") && (i + 1 < argc))
+			filename = argv[++i];
+		else if ((arg == "-b") && (i + 1 < argc))
+			baselineFile = argv[++i];
+		else if ((arg == "-x") && (i + 1 < argc))
+			tolerance = atof(argv[++i]);
+		else if (arg == "-l")
+			list = true;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	TurbulenceSpectrum spectrum(1 * muG, 10 * pc, 1 * kpc);
+	std::vector<Benchmark *> benchmarks;
+	benchmarks.push_back(new GridInterpolation(TRILINEAR, "TRILINEAR"));
+	benchmarks.push_back(new GridInterpolation(TRICUBIC, "TRICUBIC"));
+	benchmarks.push_back(new GridInterpolation(NEAREST_NEIGHBOUR, "NEAREST_NEIGHBOUR"));
+	ref_ptr<PlaneWaveTurbulence> waves = new PlaneWaveTurbulence(spectrum, 256, 42);
+	benchmarks.push_back(new FieldEvaluation(waves, "PlaneWaveTurbulence::getField/EXACT"));
+	waves = new PlaneWaveTurbulence(spectrum, 256, 42);
+	waves->setKernel(PlaneWaveTurbulence::FAST);
+	benchmarks.push_back(new FieldEvaluation(waves, "PlaneWaveTurbulence::getField/FAST"));
+	benchmarks.push_back(new FieldEvaluation(new JF12Field(), "JF12Field::getField"));
+	benchmarks.push_back(new PropagationStep(new PropagationCK(waves, 1e-4, 1 * pc, 10 * pc), "PropagationCK::process"));
+	benchmarks.push_back(new PropagationStep(new PropagationBP(waves, 10 * pc), "PropagationBP::process"));
+	benchmarks.push_back(new RandomBin());
+	benchmarks.push_back(new TableInterpolation(false));
+	benchmarks.push_back(new TableInterpolation(true));
+	benchmarks.push_back(new AddSecondary());
+
+	std::ofstream file;
+	if (!filename.empty()) {
+		file.open(filename.c_str());
+		if (!file.good()) {
+			std::cerr << "crpropa-bench: could not open " << filename << std::endl;
+			return 1;
+		}
+	}
+	// the results are compared at the end with a baseline
+	std::stringstream buffer;
+	std::ostream &output = filename.empty() ? std::cout : file;
+	std::ostream &out = baselineFile.empty() ? output : buffer;
+
+	if (!list)
+		out << "{\n  \"version\": \"" << g_GIT_DESC << "\",\n  \"benchmarks\": [";
+	bool first = true;
+	for (size_t i = 0; i < benchmarks.size(); i++) {
+		Benchmark *benchmark = benchmarks[i];
+		std::string name = benchmark->getName();
+		if (name.find(filter) == std::string::npos)
+			continue;
+		if (list) {
+			out << name << "\n";
+			continue;
+		}
+
+		out << (first ? "\n" : ",\n") << "    {\"name\": \"" << name << "\", ";
+		try {
+			// double the operations until a repetition takes the minimum time
+			size_t n = 1;
+			seconds(n, benchmark);
+			while (seconds(n, benchmark) < minTime)
+				n *= 2;
+			std::vector<double> times;
+			for (int r = 0; r < repetitions; r++)
+				times.push_back(seconds(n, benchmark) / n * 1e9);
+			std::sort(times.begin(), times.end());
+
+			out << "\"operations\": " << n << ", \"repetitions\": " << repetitions
+				<< ", \"ns_per_op\": " << times[times.size() / 2]
+				<< ", \"min_ns_per_op\": " << times.front()
+				<< ", \"max_ns_per_op\": " << times.back() << "}";
+		} catch (std::exception &e) {
+			// e.g. tricubic interpolation without SIMD extensions
+			out << "\"error\": \"" << jsonEscape(e.what()) << "\"}";
+		}
+		out.flush();
+		first = false;
+	}
+	if (!list)
+		out << "\n  ]\n}" << std::endl;
+	int regressions = 0;
+	if (!list && !baselineFile.empty()) {
+		output << buffer.str();
+		output.flush();
+		regressions = compareBaseline("crpropa-bench", buffer.str(), baselineFile, "ns_per_op", false, tolerance);
+	}
+
+	for (size_t i = 0; i < benchmarks.size(); i++)
+		delete benchmarks[i];
+	return regressions ? 1 : 0;
+}
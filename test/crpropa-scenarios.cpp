@@ -0,0 +1,370 @@
+// End-to-end reference workloads, built with -DENABLE_BENCHMARKS=ON.
+// Every scenario is run with a fixed seed and number of primaries for each
+// requested number of threads. The throughput, the peak memory and the time
+// per module of the ModuleList profiler are written as JSON.
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Common.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
+#include "crpropa/Source.h"
+#include "crpropa/Units.h"
+#include "crpropa/Version.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/module/EMPairProduction.h"
+#include "crpropa/module/NuclearDecay.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/module/SimplePropagation.h"
+
+#include <sys/resource.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "crpropa-baseline.h"
+
+using namespace crpropa;
+
+// A scenario builds its modules and source and the number of primaries
+class Scenario {
+public:
+	virtual ~Scenario() {
+	}
+	virtual std::string getName() const = 0;
+	virtual size_t getCount() const = 0;
+	// the first module has to be the propagation, its calls are the steps
+	virtual void build(ModuleList *modules, Source *source) const = 0;
+};
+
+// protons from uniformly distributed sources in 1D with CMB and EBL losses
+class Proton1D: public Scenario {
+public:
+	std::string getName() const {
+		return "proton1D";
+	}
+	size_t getCount() const {
+		return 2000;
+	}
+	void build(ModuleList *modules, Source *source) const {
+		ref_ptr<PhotonField> cmb = new CMB();
+		ref_ptr<PhotonField> ebl = new IRB_Gilmore12();
+		modules->add(new SimplePropagation(10 * kpc, 10 * Mpc));
+		modules->add(new Redshift());
+		modules->add(new PhotoPionProduction(cmb));
+		modules->add(new PhotoPionProduction(ebl));
+		modules->add(new ElectronPairProduction(cmb));
+		modules->add(new ElectronPairProduction(ebl));
+		modules->add(new MinimumEnergy(1 * EeV));
+		ref_ptr<Observer> observer = new Observer();
+		observer->add(new Observer1D());
+		modules->add(observer);
+		source->add(new SourceParticleType(nucleusId(1, 1)));
+		source->add(new SourcePowerLawSpectrum(1 * EeV, 1000 * EeV, -2));
+		source->add(new SourceUniform1D(1 * Mpc, 1000 * Mpc));
+	}
+};
+
+// mixed composition in 1D with photodisintegration and nuclear decay
+class Mixed1D: public Scenario {
+public:
+	std::string getName() const {
+		return "mixed1D";
+	}
+	size_t getCount() const {
+		return 500;
+	}
+	void build(ModuleList *modules, Source *source) const {
+		ref_ptr<PhotonField> cmb = new CMB();
+		ref_ptr<PhotonField> ebl = new IRB_Gilmore12();
+		modules->add(new SimplePropagation(10 * kpc, 10 * Mpc));
+		modules->add(new Redshift());
+		modules->add(new PhotoPionProduction(cmb));
+		modules->add(new PhotoPionProduction(ebl));
+		modules->add(new PhotoDisintegration(cmb));
+		modules->add(new PhotoDisintegration(ebl));
+		modules->add(new ElectronPairProduction(cmb));
+		modules->add(new ElectronPairProduction(ebl));
+		modules->add(new NuclearDecay());
+		modules->add(new MinimumEnergy(1 * EeV));
+		ref_ptr<Observer> observer = new Observer();
+		observer->add(new Observer1D());
+		modules->add(observer);
+		ref_ptr<SourceComposition> composition = new SourceComposition(1 * EeV, 100 * EeV, -1);
+		composition->add(1, 1, 1);
+		composition->add(4, 2, 1);
+		composition->add(14, 7, 1);
+		composition->add(28, 14, 1);
+		composition->add(56, 26, 1);
+		source->add(composition);
+		source->add(new SourceUniform1D(1 * Mpc, 1000 * Mpc));
+	}
+};
+
+// protons in a turbulent field until they leave a sphere of 10 Mpc
+class Turbulent3D: public Scenario {
+public:
+	std::string getName() const {
+		return "turbulent3D";
+	}
+	size_t getCount() const {
+		return 200;
+	}
+	void build(ModuleList *modules, Source *source) const {
+		TurbulenceSpectrum spectrum(1 * nG, 60 * kpc, 800 * kpc);
+		ref_ptr<PlaneWaveTurbulence> field = new PlaneWaveTurbulence(spectrum, 256, 42);
+		modules->add(new PropagationCK(field, 1e-4, 1 * kpc, 1 * Mpc));
+		modules->add(new SphericalBoundary(Vector3d(0.), 10 * Mpc));
+		modules->add(new MaximumTrajectoryLength(1 * Gpc));
+		source->add(new SourceParticleType(nucleusId(1, 1)));
+		source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+		source->add(new SourcePosition(Vector3d(0.)));
+		source->add(new SourceIsotropicEmission());
+	}
+};
+
+// electromagnetic cascades of TeV photons on the CMB and EBL with thinning
+class EMCascade: public Scenario {
+public:
+	std::string getName() const {
+		return "emCascade";
+	}
+	size_t getCount() const {
+		return 50;
+	}
+	void build(ModuleList *modules, Source *source) const {
+		ref_ptr<PhotonField> cmb = new CMB();
+		ref_ptr<PhotonField> ebl = new IRB_Gilmore12();
+		double thinning = 0.9;
+		modules->add(new SimplePropagation(1 * kpc, 10 * Mpc));
+		modules->add(new EMPairProduction(cmb, true, thinning));
+		modules->add(new EMPairProduction(ebl, true, thinning));
+		modules->add(new EMInverseComptonScattering(cmb, true, thinning));
+		modules->add(new EMInverseComptonScattering(ebl, true, thinning));
+		modules->add(new MinimumEnergy(1 * GeV));
+		ref_ptr<Observer> observer = new Observer();
+		observer->add(new Observer1D());
+		modules->add(observer);
+		source->add(new SourceParticleType(22));
+		source->add(new SourcePowerLawSpectrum(1 * TeV, 100 * TeV, -1.5));
+		source->add(new SourcePosition(Vector3d(100 * Mpc, 0, 0)));
+		source->add(new SourceDirection());
+	}
+};
+
+// diffusion of GeV protons in the JF12 Galactic field
+class GalacticDiffusion: public Scenario {
+public:
+	std::string getName() const {
+		return "galacticDiffusion";
+	}
+	size_t getCount() const {
+		return 200;
+	}
+	void build(ModuleList *modules, Source *source) const {
+		modules->add(new DiffusionSDE(new JF12Field(), 1e-4, 1 * pc, 10 * pc));
+		modules->add(new MaximumTrajectoryLength(100 * kpc));
+		modules->add(new SphericalBoundary(Vector3d(0.), 20 * kpc));
+		source->add(new SourceParticleType(nucleusId(1, 1)));
+		source->add(new SourceEnergy(10 * GeV));
+		source->add(new SourcePosition(Vector3d(-8.5 * kpc, 0, 0)));
+		source->add(new SourceIsotropicEmission());
+	}
+};
+
+static std::string jsonEscape(const std::string &text) {
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		if ((text[i] == '"') || (text[i] == '\\'))
+			escaped += '\\';
+		if (text[i] == '\n')
+			escaped += "\\n";
+		else
+			escaped += text[i];
+	}
+	return escaped;
+}
+
+// peak resident set size of the process so far [bytes]
+static double peakRSS() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss * 1024.;
+}
+
+static std::vector<int> parseThreads(const std::string &list) {
+	std::vector<int> threads;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (atoi(item.c_str()) > 0)
+			threads.push_back(atoi(item.c_str()));
+	return threads;
+}
+
+static void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [options]\n"
+		<< "  -f filter   run only the scenarios with filter in their name\n"
+		<< "  -j threads  comma separated numbers of threads, e.g. 1,2,4 (default: OpenMP default)\n"
+		<< "  -s factor   scale the number of primaries (default 1)\n"
+		<< "  -o file     write the JSON results to a file instead of stdout\n"
+		<< "  -b file     compare with the results in a baseline file, which is written if missing;\n"
+		<< "              fails if one is slower by more than the tolerance\n"
+		<< "  -x fraction tolerance of the comparison with the baseline (default 0.1)\n"
+		<< "  -l          list the scenarios\n";
+}
+
+int main(int argc, char **argv) {
+	std::string filter, filename, baselineFile;
+	double tolerance = 0.1;
+	std::vector<int> threads;
+	double scale = 1;
+	bool list = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "-f") && (i + 1 < argc))
+			filter = argv[++i];
+		else if ((arg == "-j") && (i + 1 < argc))
+			threads = parseThreads(argv[++i]);
+		else if ((arg == "-s") && (i + 1 < argc))
+			scale = atof(argv[++i]);
+		else if ((arg == "-o") && (i + 1 < argc))
+			filename = argv[++i];
+		else if ((arg == "-b") && (i + 1 < argc))
+			baselineFile = argv[++i];
+		else if ((arg == "-x") && (i + 1 < argc))
+			tolerance = atof(argv[++i]);
+		else if (arg == "-l")
+			list = true;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (threads.empty())
+		threads.push_back(0);
+
+	std::vector<Scenario *> scenarios;
+	scenarios.push_back(new Proton1D());
+	scenarios.push_back(new Mixed1D());
+	scenarios.push_back(new Turbulent3D());
+	scenarios.push_back(new EMCascade());
+	scenarios.push_back(new GalacticDiffusion());
+
+	std::ofstream file;
+	if (!filename.empty()) {
+		file.open(filename.c_str());
+		if (!file.good()) {
+			std::cerr << "crpropa-scenarios: could not open " << filename << std::endl;
+			return 1;
+		}
+	}
+	// the results are compared at the end with a baseline
+	std::stringstream buffer;
+	std::ostream &output = filename.empty() ? std::cout : file;
+	std::ostream &out = baselineFile.empty() ? output : buffer;
+
+	if (!list)
+		out << "{\n  \"version\": \"" << g_GIT_DESC << "\",\n  \"scenarios\": [";
+	bool first = true;
+	for (size_t i = 0; i < scenarios.size(); i++) {
+		Scenario *scenario = scenarios[i];
+		std::string name = scenario->getName();
+		if (name.find(filter) == std::string::npos)
+			continue;
+		if (list) {
+			out << name << "\n";
+			continue;
+		}
+
+		size_t count = std::max(1., scenario->getCount() * scale);
+		for (size_t j = 0; j < threads.size(); j++) {
+			int nThreads = 1;
+#if _OPENMP
+			if (threads[j] > 0)
+				omp_set_num_threads(threads[j]);
+			nThreads = omp_get_max_threads();
+#endif
+			out << (first ? "\n" : ",\n") << "    {\"name\": \"" << name
+				<< "\", \"threads\": " << nThreads << ", \"primaries\": " << count << ", ";
+			first = false;
+			try {
+				// the mass table is loaded in an OpenMP critical section, whose
+				// exceptions cannot be caught
+				std::string massTable = getDataPath("nuclear_mass.txt");
+				if (!std::ifstream(massTable.c_str()).good())
+					throw std::runtime_error("could not open file " + massTable);
+
+				ref_ptr<ModuleList> modules = new ModuleList();
+				ref_ptr<Source> source = new Source();
+				scenario->build(modules, source);
+
+				// warm up the tables with one candidate in this thread, where
+				// the errors of other missing data files can be caught
+				modules->run(source->getCandidate());
+				modules->setProfiling(true);
+
+				// the same candidates for any number of threads
+				Random::seedStreams(42);
+				Candidate::setNextSerialNumber(0);
+				// keep the messages of run() out of JSON written to stdout
+				std::streambuf *stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				modules->run(source, count);
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				std::cout.rdbuf(stdoutBuffer);
+				Random::disableStreams();
+
+				double seconds = elapsed.count();
+				uint64_t candidates = Candidate::getNextSerialNumber();
+				uint64_t steps = modules->getProfileCalls(0);
+				out << "\"candidates\": " << candidates << ", \"steps\": " << steps
+					<< ", \"seconds\": " << seconds
+					<< ", \"primaries_per_second\": " << count / seconds
+					<< ", \"candidates_per_second\": " << candidates / seconds
+					<< ", \"steps_per_second\": " << steps / seconds
+					<< ", \"peak_rss\": " << peakRSS()
+					<< ", \"profile\": " << modules->getProfileJSON() << "    }";
+			} catch (std::exception &e) {
+				// e.g. missing data files of the interactions
+				Random::disableStreams();
+				out << "\"error\": \"" << jsonEscape(e.what()) << "\"}";
+			}
+			out.flush();
+		}
+	}
+	if (!list)
+		out << "\n  ]\n}" << std::endl;
+	int regressions = 0;
+	if (!list && !baselineFile.empty()) {
+		output << buffer.str();
+		output.flush();
+		regressions = compareBaseline("crpropa-scenarios", buffer.str(), baselineFile, "primaries_per_second", true, tolerance, "threads");
+	}
+
+	for (size_t i = 0; i < scenarios.size(); i++)
+		delete scenarios[i];
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#include "crpropa/Units.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/module/Acceleration.h"
+
+#include "gtest/gtest.h"
+#include <cmath>
+#include <vector>
+
+namespace crpropa {
+
+// candidates with the given step, processed one by one or as a batch
+static std::vector<ref_ptr<Candidate> > scatterCandidates(const AbstractAccelerationModule &module,
+		size_t n, double step, bool batch) {
+	std::vector<ref_ptr<Candidate> > candidates(n);
+	std::vector<Candidate*> pointers(n);
+	for (size_t i = 0; i < n; i++) {
+		candidates[i] = new Candidate(nucleusId(1, 1), 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+		candidates[i]->setCurrentStep(step);
+		pointers[i] = candidates[i];
+	}
+	if (batch) {
+		module.processBatch(&pointers[0], n);
+	} else {
+		for (size_t i = 0; i < n; i++)
+			module.process(pointers[i]);
+	}
+	return candidates;
+}
+
+TEST(AbstractAccelerationModule, constantModifiers) {
+	SecondOrderFermi module(0.1 * c_light, 1 * parsec);
+	module.add(new StepLengthScaling(2));
+	EXPECT_DOUBLE_EQ(2 * parsec, module.getStepLength());
+	EXPECT_EQ(0, module.getNumberOfModifiers());
+
+	// only a leading constant modifier is folded
+	module.add(new QuasiLinearTheory());
+	module.add(new StepLengthScaling(2));
+	EXPECT_DOUBLE_EQ(2 * parsec, module.getStepLength());
+	EXPECT_EQ(2, module.getNumberOfModifiers());
+}
+
+TEST(AbstractAccelerationModule, batchScattering) {
+	// with resting centers, the fraction of unscattered candidates is exp(-step / stepLength)
+	Random::seedThreads(42);
+	DirectedFlowScattering resting(Vector3d(0.), 1 * parsec);
+	size_t n = 10000;
+	for (int batch = 0; batch < 2; batch++) {
+		std::vector<ref_ptr<Candidate> > candidates = scatterCandidates(resting, n, 1 * parsec, batch);
+		size_t unscattered = 0;
+		for (size_t i = 0; i < n; i++) {
+			EXPECT_NEAR(1 * EeV, candidates[i]->current.getEnergy(), 1e-9 * EeV);
+			EXPECT_NEAR(1, candidates[i]->current.getDirection().getR(), 1e-12);
+			if (candidates[i]->current.getDirection() == Vector3d(1, 0, 0))
+				unscattered++;
+		}
+		EXPECT_NEAR(exp(-1), double(unscattered) / n, 0.02);
+	}
+
+	// second order Fermi acceleration, the same mean energy gain
+	SecondOrderFermi fermi(0.1 * c_light, 1 * parsec);
+	double meanEnergy[2] = {0, 0};
+	n = 4000;
+	for (int batch = 0; batch < 2; batch++) {
+		std::vector<ref_ptr<Candidate> > candidates = scatterCandidates(fermi, n, 20 * parsec, batch);
+		for (size_t i = 0; i < n; i++)
+			meanEnergy[batch] += candidates[i]->current.getEnergy() / n;
+	}
+	EXPECT_GT(meanEnergy[0], 1 * EeV);
+	EXPECT_NEAR(meanEnergy[0], meanEnergy[1], 0.05 * meanEnergy[0]);
+}
+
+} // namespace crpropa
@@ -3,6 +3,7 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/advectionField/AdvectionField.h"
 #include "crpropa/module/AdiabaticCooling.h"
+#include "crpropa/module/MomentumDiffusion.h"
 #include "gtest/gtest.h"
 
 //#include <fstream>
@@ -51,5 +52,79 @@ TEST (AdiabaticCooling, ConstantSphericalField) {
 
 }
 
+TEST (AdiabaticCooling, exactLoss) {
+	// Energy change integrated over the step, div(V) = 2 at r = 1
+	AdiabaticCooling AC(new ConstantSphericalAdvectionField(Vector3d(0,0,0), 1));
+	AC.setExactLoss(true);
+	EXPECT_TRUE(AC.getExactLoss());
+	Candidate c(nucleusId(1,1), 10);
+	c.current.setPosition(Vector3d(1,0,0));
+	c.setCurrentStep(c_light);
+	c.setNextStep(c_light);
+	double E = c.current.getEnergy();
+	AC.process(&c);
+	EXPECT_NEAR(c.current.getEnergy(), E * exp(-2./3.), 1e-12 * E);
+	EXPECT_DOUBLE_EQ(c.getNextStep(), 0.15*c_light);
+}
+
+TEST (AdiabaticCooling, processBatch) {
+	// the batch gives the same energies and step limits as process
+	AdiabaticCooling AC(new ConstantSphericalAdvectionField(Vector3d(0,0,0), 1));
+	std::vector<ref_ptr<Candidate> > single, batch;
+	std::vector<Candidate *> pointers;
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 2; j++) {
+			ref_ptr<Candidate> c = new Candidate(nucleusId(1,1), (i + 1) * 10);
+			c->current.setPosition(Vector3d(i + 1, 0, 0));
+			c->setCurrentStep((i + 1) * c_light);
+			c->setNextStep(10 * c_light);
+			(j == 0 ? single : batch).push_back(c);
+		}
+		AC.process(single.back());
+		pointers.push_back(batch.back());
+	}
+	AC.processBatch(&pointers[0], pointers.size());
+	for (size_t i = 0; i < single.size(); i++) {
+		EXPECT_DOUBLE_EQ(batch[i]->current.getEnergy(), single[i]->current.getEnergy());
+		EXPECT_DOUBLE_EQ(batch[i]->getNextStep(), single[i]->getNextStep());
+	}
+}
+
+// ConstantMomentumDiffusion ------------------------------------------------------
+
+TEST (ConstantMomentumDiffusion, processBatch) {
+	// without diffusion the energy gain is deterministic, neutral particles are skipped
+	double p = 1 * GeV / c_light;
+	double dt = 1 * pc / c_light;
+	ConstantMomentumDiffusion MD(0.02 * p * p / dt);
+	Candidate proton(nucleusId(1,1), 1 * GeV);
+	Candidate photon(22, 1 * GeV);
+	Candidate *candidates[] = {&proton, &photon};
+	for (int i = 0; i < 2; i++) {
+		candidates[i]->setCurrentStep(1 * pc);
+		candidates[i]->setNextStep(10 * kpc);
+	}
+	MD.processBatch(candidates, 2);
+	EXPECT_DOUBLE_EQ(photon.current.getEnergy(), 1 * GeV);
+	EXPECT_DOUBLE_EQ(photon.getNextStep(), 10 * kpc);
+	EXPECT_NE(proton.current.getEnergy(), 1 * GeV);
+
+	// the mean gain of many candidates is A dt
+	size_t n = 10000;
+	std::vector<ref_ptr<Candidate> > batch;
+	std::vector<Candidate *> pointers;
+	for (size_t i = 0; i < n; i++) {
+		batch.push_back(new Candidate(nucleusId(1,1), 1 * GeV));
+		batch.back()->setCurrentStep(1 * pc);
+		pointers.push_back(batch.back());
+	}
+	MD.processBatch(&pointers[0], n);
+	double mean = 0;
+	for (size_t i = 0; i < n; i++)
+		mean += batch[i]->current.getEnergy() / c_light - p;
+	mean /= n;
+	double sigma = MD.calculateBScalar() * sqrt(dt / n);
+	EXPECT_NEAR(mean, MD.calculateAScalar(p) * dt, 5 * sigma);
+}
 
 } // namespace crpropa
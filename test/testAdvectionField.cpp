@@ -1,4 +1,6 @@
 #include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
+#include "crpropa/GridTools.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
 
@@ -166,4 +168,74 @@ TEST(testSphericalAdvectionShock, SimpleTest) {
 	
 }
 
+TEST(testAdvectionField, getFieldAndDivergence) {
+	// the fused evaluation equals the separate one for every field
+	ref_ptr<AdvectionFieldList> list = new AdvectionFieldList();
+	list->addField(new UniformAdvectionField(Vector3d(1, 2, 3)));
+	list->addField(new ConstantSphericalAdvectionField(Vector3d(0.), 10.));
+	ref_ptr<OneDimensionalSphericalShock> cooling = new OneDimensionalSphericalShock(5., 100., 4., 0.5, true);
+	ref_ptr<SphericalAdvectionShock> rotating = new SphericalAdvectionShock(Vector3d(0.), 5., 100., 0.5);
+	rotating->setAzimuthalSpeed(20.);
+
+	ref_ptr<AdvectionField> fields[9] = {list, new UniformAdvectionField(Vector3d(-1, 5, 3)),
+			new ConstantSphericalAdvectionField(Vector3d(1, 0, 0), 10.),
+			new SphericalAdvectionField(Vector3d(0.), 10., 100., 3., 2.),
+			new OneDimensionalCartesianShock(4., 100., 0.5), cooling,
+			new OneDimensionalSphericalShock(5., 100., 4., 0.5, false),
+			new ObliqueAdvectionShock(4., 100., 10., 0.5), rotating};
+	Vector3d positions[4] = {Vector3d(0.3, 0.2, 0.1), Vector3d(4.9, 0.5, 0.1),
+			Vector3d(-2, 4, 1), Vector3d(8, 7, -3)};
+	for (int f = 0; f < 9; f++) {
+		for (int i = 0; i < 4; i++) {
+			Vector3d v;
+			double D;
+			fields[f]->getFieldAndDivergence(positions[i], v, D);
+			Vector3d a = fields[f]->getField(positions[i]);
+			EXPECT_DOUBLE_EQ(a.x, v.x);
+			EXPECT_DOUBLE_EQ(a.y, v.y);
+			EXPECT_DOUBLE_EQ(a.z, v.z);
+			EXPECT_DOUBLE_EQ(fields[f]->getDivergence(positions[i]), D);
+		}
+	}
+}
+
+TEST(testAdvectionFieldGrid, fromAdvectionField) {
+	// the grids store the field at the cell centers
+	ref_ptr<ConstantSphericalAdvectionField> field = new ConstantSphericalAdvectionField(Vector3d(0.), 10.);
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(10.), 8, 8, 8, 1.);
+	grid->setReflective(true);
+	ref_ptr<Grid1f> divergence = new Grid1f(Vector3d(10.), 8, 8, 8, 1.);
+	divergence->setReflective(true);
+	fromAdvectionField(grid, divergence, field);
+
+	AdvectionFieldGrid A(grid, divergence);
+	Vector3d cellCenter(12.5, 13.5, 14.5);
+	Vector3d a = A.getField(cellCenter);
+	Vector3d b = field->getField(cellCenter);
+	EXPECT_NEAR(a.x, b.x, 1e-5);
+	EXPECT_NEAR(a.y, b.y, 1e-5);
+	EXPECT_NEAR(a.z, b.z, 1e-5);
+	EXPECT_NEAR(A.getDivergence(cellCenter), field->getDivergence(cellCenter), 1e-5);
+
+	// batch lookups give the same values
+	Vector3d positions[100];
+	for (int i = 0; i < 100; i++)
+		positions[i] = Vector3d(10 + 0.08 * i, 11 + 0.05 * i, 17 - 0.07 * i);
+	Vector3d fields[100];
+	double divergences[100];
+	A.getFields(positions, fields, 100);
+	A.getDivergences(positions, divergences, 100);
+	for (int i = 0; i < 100; i++) {
+		Vector3d f = A.getField(positions[i]);
+		EXPECT_NEAR(f.x, fields[i].x, 1e-5);
+		EXPECT_NEAR(f.y, fields[i].y, 1e-5);
+		EXPECT_NEAR(f.z, fields[i].z, 1e-5);
+		EXPECT_NEAR(A.getDivergence(positions[i]), divergences[i], 1e-5);
+	}
+
+	// the grids need the same geometry
+	ref_ptr<Grid1f> other = new Grid1f(Vector3d(0.), 8, 8, 8, 1.);
+	EXPECT_THROW(AdvectionFieldGrid(grid, other), std::runtime_error);
+}
+
 } //namespace crpropa
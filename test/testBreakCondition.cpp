@@ -7,6 +7,7 @@
 #include "crpropa/module/RestrictToRegion.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Geometry.h"
+#include "crpropa/Random.h"
 
 #include "gtest/gtest.h"
 
@@ -139,6 +140,54 @@ TEST(MinimumRedshift, test) {
 	EXPECT_TRUE(c.hasProperty("Rejected"));
 }
 
+TEST(ConditionList, test) {
+	ConditionList conditions;
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(10);
+	maxLength->setRejectFlag("Rejected", "MaximumTrajectoryLength");
+	ref_ptr<MinimumEnergy> minEnergy = new MinimumEnergy(5);
+	minEnergy->setRejectFlag("Rejected", "MinimumEnergy");
+	ref_ptr<MinimumEnergyPerParticleId> minEnergyPerId = new MinimumEnergyPerParticleId(1);
+	minEnergyPerId->add(nucleusId(1, 1), 20);
+	conditions.add(maxLength);
+	conditions.add(minEnergy);
+	conditions.add(minEnergyPerId);
+	EXPECT_EQ(3, conditions.size());
+
+	// all passed, the next step is limited as by MaximumTrajectoryLength
+	Candidate c(nucleusId(4, 2), 30);
+	c.setNextStep(100);
+	c.setTrajectoryLength(9);
+	conditions.process(&c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_DOUBLE_EQ(1, c.getNextStep());
+
+	// generic conditions are processed
+	Candidate p(nucleusId(1, 1), 10);
+	conditions.process(&p);
+	EXPECT_FALSE(p.isActive());
+	EXPECT_TRUE(p.hasProperty("Rejected"));
+
+	// the first deactivating condition stops the evaluation
+	c.current.setEnergy(4);
+	c.setTrajectoryLength(11);
+	minEnergy->setMakeRejectedInactive(false);
+	conditions.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_EQ("MaximumTrajectoryLength", c.getProperty("Rejected").asString());
+
+	// conditions which do not deactivate are followed by the next one
+	Candidate d(nucleusId(4, 2), 4);
+	conditions.process(&d);
+	EXPECT_TRUE(d.isActive());
+	EXPECT_EQ("MinimumEnergy", d.getProperty("Rejected").asString());
+
+	// inactive candidates are skipped
+	Candidate e(nucleusId(4, 2), 4);
+	e.setActive(false);
+	conditions.process(&e);
+	EXPECT_FALSE(e.hasProperty("Rejected"));
+}
+
 TEST(DetectionLength, test) {
         DetectionLength detL(10);
 	detL.setMakeRejectedInactive(false);
@@ -203,6 +252,32 @@ TEST(ObserverFeature, LargeSphere) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(ObserverFeature, Catalog) {
+	// many small target spheres, the crossed one is recorded
+	Observer obs;
+	ObserverCatalog *catalog = new ObserverCatalog();
+	for (int i = 0; i < 1000; i++)
+		catalog->add(Vector3d(10 * (i % 10), 10 * (i / 10 % 10), 10 * (i / 100)), 1);
+	obs.add(catalog);
+	EXPECT_EQ(1000, catalog->size());
+	Candidate c;
+	c.setNextStep(10);
+
+	// no detection, limit step to the nearest target
+	c.current.setPosition(Vector3d(5, 0, 0));
+	c.previous.setPosition(Vector3d(4, 0, 0));
+	obs.process(&c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_DOUBLE_EQ(4, c.getNextStep());
+
+	// detection: entering the target at (20, 30, 40)
+	c.current.setPosition(Vector3d(20.5, 30, 40));
+	c.previous.setPosition(Vector3d(21.5, 30, 40));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_EQ(432, c.getProperty("TargetIndex").toUInt64());
+}
+
 TEST(ObserverFeature, Point) {
 	Observer obs;
 	obs.add(new Observer1D());
@@ -304,6 +379,77 @@ TEST(ObserverFeature, TimeEvolutionLog) {
   EXPECT_TRUE(c.hasProperty("Detected"));
 }
 
+TEST(FastObserver1D, sameAsObserver) {
+	Observer observer;
+	observer.add(new Observer1D());
+	observer.add(new ObserverNucleusVeto());
+	observer.add(new ObserverParticleIdVeto(12));
+	observer.setFlag("Detected", "Observer1D");
+	FastObserver1D fast;
+	fast.setNucleusVeto();
+	fast.addParticleIdVeto(12);
+	fast.setFlag("Detected", "Observer1D");
+
+	int ids[4] = {22, 12, 11, nucleusId(1, 1)};
+	double xs[3] = {1, 0, -1};
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 3; j++) {
+			Candidate a(ids[i]), b(ids[i]);
+			a.current.setPosition(Vector3d(xs[j], 0, 0));
+			b.current.setPosition(Vector3d(xs[j], 0, 0));
+			a.setNextStep(10);
+			b.setNextStep(10);
+			observer.process(&a);
+			fast.process(&b);
+			EXPECT_EQ(a.isActive(), b.isActive());
+			EXPECT_EQ(a.hasProperty("Detected"), b.hasProperty("Detected"));
+			EXPECT_DOUBLE_EQ(a.getNextStep(), b.getNextStep());
+		}
+	}
+
+	// detected photon
+	Candidate c(22);
+	fast.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_EQ("Observer1D", c.getProperty("Detected").asString());
+}
+
+TEST(ObserverFeature, TimeEvolutionIndex) {
+  Observer obs;
+  obs.setDeactivateOnDetection(false);
+  ObserverTimeEvolution *evolution = new ObserverTimeEvolution();
+  evolution->addTime(10);
+  evolution->addTime(0);
+  evolution->addTime(5);
+  obs.add(evolution);
+  // the times are sorted
+  EXPECT_DOUBLE_EQ(0, evolution->getTimes()[0]);
+  EXPECT_DOUBLE_EQ(5, evolution->getTimes()[1]);
+  EXPECT_DOUBLE_EQ(10, evolution->getTimes()[2]);
+
+  // a candidate created at 3 is first detected at 5
+  Candidate c;
+  c.setNextStep(10);
+  c.setTrajectoryLength(3);
+  obs.process(&c);
+  EXPECT_DOUBLE_EQ(2, c.getNextStep());
+  EXPECT_FALSE(c.hasProperty("DetectionIndex"));
+
+  c.setTrajectoryLength(5);
+  obs.process(&c);
+  EXPECT_EQ(2, c.getProperty("DetectionIndex").asUInt64());
+  c.setTrajectoryLength(10);
+  obs.process(&c);
+  EXPECT_EQ(3, c.getProperty("DetectionIndex").asUInt64());
+
+  // no detection after the last time
+  c.setNextStep(10);
+  c.setTrajectoryLength(20);
+  obs.process(&c);
+  EXPECT_EQ(3, c.getProperty("DetectionIndex").asUInt64());
+  EXPECT_DOUBLE_EQ(10, c.getNextStep());
+}
+
 //** ========================= Boundaries =================================== */
 TEST(PeriodicBox, high) {
 	// Tests if the periodical boundaries place the particle back inside the box and translate the initial position accordingly.
@@ -462,6 +608,90 @@ TEST(SphericalBoundary, limitStep) {
 	EXPECT_DOUBLE_EQ(1.5, c.getNextStep());
 }
 
+TEST(SphericalBoundary, directionAware) {
+	SphericalBoundary sphere(Vector3d(0, 0, 0), 10);
+	sphere.setMargin(1);
+	sphere.setDirectionAware(true);
+	Candidate c(22);
+	c.current.setPosition(Vector3d(0, 0, 9.5));
+	c.current.setDirection(Vector3d(0, 0, -1));
+	c.setNextStep(100);
+	sphere.process(&c);
+	EXPECT_DOUBLE_EQ(20.5, c.getNextStep());
+	EXPECT_DOUBLE_EQ(20.5, sphere.getStepLimit(&c));
+
+	// charged particles are limited by the closest distance
+	c.current.setId(11);
+	c.setNextStep(100);
+	sphere.process(&c);
+	EXPECT_DOUBLE_EQ(1.5, c.getNextStep());
+}
+
+TEST(CubicBoundary, processBatch) {
+	CubicBoundary cube(Vector3d(0, 0, 0), 10);
+	cube.setMargin(1);
+	cube.setDirectionAware(true);
+	Candidate inside(22), outside(22);
+	inside.current.setPosition(Vector3d(9, 5, 5));
+	inside.current.setDirection(Vector3d(-1, 0, 0));
+	inside.setNextStep(100);
+	outside.current.setPosition(Vector3d(11, 5, 5));
+	Candidate *candidates[2] = {&inside, &outside};
+	cube.processBatch(candidates, 2);
+	EXPECT_TRUE(inside.isActive());
+	EXPECT_DOUBLE_EQ(10, inside.getNextStep());
+	EXPECT_FALSE(outside.isActive());
+}
+
+TEST(SimulationDomain, periodicSphere) {
+	SimulationDomain domain;
+	domain.setPeriodicBox(Vector3d(0, 0, 0), Vector3d(10, 10, 10));
+	domain.setSphericalBoundary(Vector3d(5, 5, 5), 4);
+	domain.setMargin(1);
+
+	// wrapped into the box as by PeriodicBox, then inside the sphere
+	Candidate c;
+	c.current.setPosition(Vector3d(15, 5, 5));
+	c.source.setPosition(Vector3d(12, 5, 5));
+	c.setNextStep(100);
+	domain.process(&c);
+	EXPECT_DOUBLE_EQ(5, c.current.getPosition().x);
+	EXPECT_DOUBLE_EQ(2, c.source.getPosition().x);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_DOUBLE_EQ(5, c.getNextStep());
+
+	// the corner of the box is outside the sphere
+	c.current.setPosition(Vector3d(-0.5, 0.5, 0.5));
+	domain.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_TRUE(c.hasProperty("Rejected"));
+	EXPECT_DOUBLE_EQ(9.5, c.current.getPosition().x);
+}
+
+TEST(SimulationDomain, sameAsModules) {
+	PeriodicBox box(Vector3d(0, 0, 0), Vector3d(10, 10, 10));
+	CubicBoundary cube(Vector3d(1, 1, 1), 8);
+	SimulationDomain domain;
+	domain.setPeriodicBox(Vector3d(0, 0, 0), Vector3d(10, 10, 10));
+	domain.setCubicBoundary(Vector3d(1, 1, 1), 8);
+
+	Random random(1);
+	for (int i = 0; i < 100; i++) {
+		Vector3d position = random.randVector() * 30 * random.rand();
+		Candidate a, b;
+		a.current.setPosition(position);
+		b.current.setPosition(position);
+		a.setNextStep(100);
+		b.setNextStep(100);
+		box.process(&a);
+		cube.process(&a);
+		domain.process(&b);
+		EXPECT_DOUBLE_EQ(a.current.getPosition().x, b.current.getPosition().x);
+		EXPECT_EQ(a.isActive(), b.isActive());
+		EXPECT_DOUBLE_EQ(a.getNextStep(), b.getNextStep());
+	}
+}
+
 TEST(EllipsoidalBoundary, inside) {
 	EllipsoidalBoundary ellipsoid(Vector3d(-5, 0, 0), Vector3d(5, 0, 0), 15);
 	Candidate c;
@@ -2,6 +2,7 @@
 #include "crpropa/Common.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/module/CandidateSplitting.h"
+#include "crpropa/Random.h"
 
 #include "gtest/gtest.h"
 #include <stdexcept>
@@ -87,4 +88,38 @@ TEST(testCandidateSplitting, CheckSplits) {
 	c.previous.setEnergy(8);
 }
 
+TEST(testCandidateSplitting, PopulationControl) {
+	Random::seedThreads(42);
+	CandidateSplitting splitting(2, 1, 10, 3, 0.);
+	uint64_t target = 1000;
+	splitting.setPopulationControl(target);
+	EXPECT_EQ(splitting.getPopulationControl(), target);
+
+	// candidates crossing the first bin, split until the bin is full
+	int n = 10000;
+	double weight = 0;
+	size_t alive = 0;
+	for (int i = 0; i < n; i++) {
+		Candidate c(nucleusId(1,1), 2);
+		c.previous.setEnergy(0.5);
+		splitting.process(&c);
+		if (c.isActive()) {
+			weight += c.getWeight();
+			alive++;
+		}
+		for (size_t j = 0; j < c.secondaries.size(); j++) {
+			weight += c.secondaries[j]->getWeight();
+			alive++;
+		}
+	}
+	// about target * (1 + ln(n / target)) candidates, the weight is conserved on average
+	EXPECT_LT(alive, 4 * target);
+	EXPECT_NEAR(weight, n, 0.1 * n);
+	EXPECT_EQ(splitting.getPopulation(0), target + (n - target / 2));
+	EXPECT_EQ(splitting.getPopulation(1), 0);
+
+	splitting.resetPopulation();
+	EXPECT_EQ(splitting.getPopulation(0), 0);
+}
+
 } //namespace crpropa
@@ -0,0 +1,115 @@
+#include "crpropa/Configuration.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+
+#include "gtest/gtest.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+TEST(ConfigNode, parse) {
+	ConfigNode node = ConfigNode::parse(
+		"# comment\n"
+		"{\"a\": 1.5e3, \"b\": [true, false, null], \"c\": \"x\\ty\", \"d\": {}}");
+	EXPECT_EQ(ConfigNode::Object, node.getType());
+	EXPECT_EQ(4, node.size());
+	EXPECT_DOUBLE_EQ(1500, node["a"].asNumber());
+	EXPECT_TRUE(node["b"][0].asBool());
+	EXPECT_FALSE(node["b"][1].asBool());
+	EXPECT_TRUE(node["b"][2].isNull());
+	EXPECT_EQ("x\ty", node["c"].asString());
+	EXPECT_EQ(0, node["d"].size());
+	EXPECT_DOUBLE_EQ(2, node.getNumber("missing", 2));
+	EXPECT_THROW(node["missing"], std::runtime_error);
+	EXPECT_THROW(node["a"].asString(), std::runtime_error);
+}
+
+TEST(ConfigNode, syntaxError) {
+	try {
+		ConfigNode::parse("{\n\"a\": 1,\n\"b\" 2}");
+		FAIL();
+	} catch (std::runtime_error &e) {
+		EXPECT_NE(std::string::npos, std::string(e.what()).find("line 3"));
+	}
+	EXPECT_THROW(ConfigNode::parse("{\"a\": 1, \"a\": 2}"), std::runtime_error);
+	EXPECT_THROW(ConfigNode::parse("[1, 2] 3"), std::runtime_error);
+}
+
+TEST(ConfigNode, quantities) {
+	EXPECT_DOUBLE_EQ(10 * Mpc, ConfigNode::parseQuantity("10 Mpc"));
+	EXPECT_DOUBLE_EQ(1e18 * eV, ConfigNode::parseQuantity("1e18 eV"));
+	EXPECT_DOUBLE_EQ(3 * nG, ConfigNode::parseQuantity("3 * nG"));
+	EXPECT_DOUBLE_EQ(100 * km / second, ConfigNode::parseQuantity("100 km / s"));
+	EXPECT_DOUBLE_EQ(2, ConfigNode::parseQuantity("2"));
+	EXPECT_THROW(ConfigNode::parseQuantity("1 furlong"), std::runtime_error);
+
+	ConfigNode node = ConfigNode::parse("{\"v\": [\"1 kpc\", 0, 2]}");
+	Vector3d v = node.getVector("v", Vector3d(0.));
+	EXPECT_DOUBLE_EQ(1 * kpc, v.x);
+	EXPECT_DOUBLE_EQ(2, v.z);
+}
+
+// counts the detected candidates
+class DetectionCounter: public Module {
+public:
+	mutable size_t count;
+	DetectionCounter() : count(0) {
+	}
+	void process(Candidate *candidate) const {
+#pragma omp atomic
+		count++;
+	}
+};
+
+static DetectionCounter *lastCounter = NULL;
+
+ref_ptr<Module> createDetectionCounter(const ConfigNode &node, const SimulationConfig &config) {
+	lastCounter = new DetectionCounter();
+	return lastCounter;
+}
+
+TEST(SimulationConfig, run) {
+	SimulationConfig::registerModule("DetectionCounter", createDetectionCounter);
+	ref_ptr<SimulationConfig> config = SimulationConfig::fromString(
+		"{\n"
+		"  \"magneticFields\": {\"zero\": {\"type\": \"UniformMagneticField\", \"value\": [0, 0, 0]}},\n"
+		"  \"modules\": [\n"
+		"    {\"type\": \"PropagationCK\", \"field\": \"zero\", \"minStep\": \"1 kpc\", \"maxStep\": \"1 Mpc\"},\n"
+		"    {\"type\": \"MaximumTrajectoryLength\", \"length\": \"50 Mpc\"},\n"
+		"    {\"type\": \"Observer\", \"features\": [{\"type\": \"ObserverSurface\",\n"
+		"      \"surface\": {\"type\": \"Sphere\", \"radius\": \"10 Mpc\"}}],\n"
+		"     \"onDetection\": {\"type\": \"DetectionCounter\"}}\n"
+		"  ],\n"
+		"  \"source\": {\"features\": [\n"
+		"    {\"type\": \"SourceParticleType\", \"nucleus\": [1, 1]},\n"
+		"    {\"type\": \"SourceEnergy\", \"energy\": \"10 EeV\"},\n"
+		"    {\"type\": \"SourcePosition\", \"position\": [0, 0, 0]},\n"
+		"    {\"type\": \"SourceIsotropicEmission\"}]},\n"
+		"  \"run\": {\"count\": 20, \"recursive\": false}\n"
+		"}");
+	EXPECT_EQ(3, config->getModuleList()->size());
+	EXPECT_EQ(20, config->getCount());
+
+	ref_ptr<Candidate> c = config->getSource()->getCandidate();
+	EXPECT_EQ(nucleusId(1, 1), c->current.getId());
+	EXPECT_DOUBLE_EQ(10 * EeV, c->current.getEnergy());
+
+	// all candidates reach the sphere before the maximum trajectory length
+	ASSERT_TRUE(lastCounter != NULL);
+	config->run();
+	EXPECT_EQ(20, lastCounter->count);
+}
+
+TEST(SimulationConfig, errors) {
+	EXPECT_THROW(SimulationConfig::fromString("{\"modules\": [{\"type\": \"NoSuchModule\"}]}"), std::runtime_error);
+	EXPECT_THROW(SimulationConfig::fromString(
+		"{\"modules\": [{\"type\": \"PropagationCK\", \"field\": \"unknown\"}]}"), std::runtime_error);
+	EXPECT_THROW(SimulationConfig::fromString(
+		"{\"modules\": [{\"type\": \"MaximumTrajectoryLength\"}]}"), std::runtime_error);
+	EXPECT_THROW(SimulationConfig::fromString(
+		"{\"modules\": [], \"source\": {\"features\": [{\"type\": \"SourceEnergy\", \"energy\": \"1 EeV\", }]}}"),
+		std::runtime_error);
+}
+
+} // namespace crpropa
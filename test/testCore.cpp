@@ -6,16 +6,27 @@
  */
 
 #include <complex>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 
 #include "crpropa/Candidate.h"
 #include "crpropa/base64.h"
 #include "crpropa/Common.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
+#include "crpropa/ParticleStateBatch.h"
 #include "crpropa/Random.h"
+#include "crpropa/RedshiftCache.h"
+#include "crpropa/TableRegistry.h"
 #include "crpropa/Grid.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/NestedGrid.h"
+#include "crpropa/PagedGrid.h"
+#include "crpropa/TricubicGrid.h"
 #include "crpropa/Geometry.h"
 #include "crpropa/EmissionMap.h"
 #include "crpropa/Vector3.h"
@@ -23,6 +34,10 @@
 #include <HepPID/ParticleIDMethods.hh>
 #include "gtest/gtest.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 TEST(ParticleState, position) {
@@ -102,6 +117,29 @@ TEST(ParticleState, Rigidity) {
 	EXPECT_EQ(particle.getRigidity(), 1e18);
 }
 
+TEST(ParticleStateBatch, loadStore) {
+	Candidate c1(1000010010, 1 * EeV, Vector3d(1, 2, 3), Vector3d(0, 1, 0));
+	Candidate c2(22, 2 * EeV, Vector3d(4, 5, 6), Vector3d(0, 0, 2));
+	Candidate *candidates[2] = {&c1, &c2};
+
+	ParticleStateBatch batch;
+	batch.load(candidates, 2);
+	EXPECT_EQ(2, batch.size());
+	EXPECT_EQ(22, batch.id[1]);
+	EXPECT_DOUBLE_EQ(eplus, batch.charge[0]);
+	EXPECT_DOUBLE_EQ(2 * EeV, batch.energy[1]);
+	EXPECT_DOUBLE_EQ(5, batch.y[1]);
+	EXPECT_DOUBLE_EQ(1, batch.dz[1]);
+
+	batch.setPosition(0, Vector3d(7, 8, 9));
+	batch.setDirection(1, Vector3d(3, 0, 0));
+	batch.energy[0] = 3 * EeV;
+	batch.store(candidates);
+	EXPECT_EQ(Vector3d(7, 8, 9), c1.current.getPosition());
+	EXPECT_EQ(Vector3d(1, 0, 0), c2.current.getDirection());
+	EXPECT_DOUBLE_EQ(3 * EeV, c1.current.getEnergy());
+}
+
 TEST(ParticleState, Mass) {
 	ParticleState particle;
 
@@ -123,6 +161,35 @@ TEST(ParticleState, Mass) {
 	EXPECT_DOUBLE_EQ(nuclearMass(A, Z), A*amu - Z*mass_electron);
 }
 
+TEST(ParticleState, propertyTables) {
+	// the tables give the same mass and charge as the computation
+	std::vector<int> ids;
+	for (int Z = 0; Z <= 30; Z++)
+		for (int A = std::max(Z, 1); A <= 60; A++)
+			ids.push_back(nucleusId(A, Z));
+	ids.push_back(1000260561); // isomer
+	ids.push_back(2112);
+	ids.push_back(2212);
+	const int other[] = {0, 11, 12, 13, 14, 15, 16, 22, 111, 211, 321, 221, 3122};
+	ids.insert(ids.end(), other, other + sizeof(other) / sizeof(other[0]));
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			int id = sign * ids[i];
+			ParticleState particle;
+			double mass = particle.getMass(); // kept for particles without a mass
+			particle.setId(id);
+			if (isNucleus(id))
+				mass = nuclearMass(id);
+			else if (abs(id) == 11)
+				mass = mass_electron;
+			double charge = (isNucleus(id) ? chargeNumber(id) * (id < 0 ? -1 : 1) : HepPID::charge(id)) * eplus;
+			EXPECT_EQ(mass, particle.getMass()) << id;
+			EXPECT_EQ(charge, particle.getCharge()) << id;
+		}
+	}
+}
+
 TEST(ParticleState, lorentzFactor) {
 	ParticleState particle;
 	particle.setId(nucleusId(1, 1));
@@ -246,12 +313,183 @@ TEST(Candidate, candidateTag) {
 	EXPECT_TRUE(c.getTagOrigin() == "myTag");
 }
 
+TEST(Candidate, propertySymbol) {
+	Candidate c;
+	Symbol key = SymbolTable::intern("foo");
+	EXPECT_EQ(key, SymbolTable::intern("foo"));
+	EXPECT_EQ("foo", SymbolTable::name(key));
+	EXPECT_NE(key, SymbolTable::intern("bar"));
+
+	c.setProperty(key, 2.);
+	EXPECT_TRUE(c.hasProperty("foo"));
+	EXPECT_DOUBLE_EQ(2., c.getProperty("foo").toDouble());
+	c.setProperty("foo", 3.);
+	EXPECT_DOUBLE_EQ(3., c.getProperty(key).toDouble());
+	ASSERT_TRUE(c.findProperty(key) != NULL);
+	EXPECT_DOUBLE_EQ(3., c.findProperty(key)->toDouble());
+	EXPECT_TRUE(c.removeProperty(key));
+	EXPECT_FALSE(c.hasProperty("foo"));
+	EXPECT_TRUE(c.findProperty(key) == NULL);
+
+	// queries of unknown names do not add them to the table
+	size_t n = SymbolTable::size();
+	EXPECT_FALSE(c.hasProperty("unknownProperty"));
+	EXPECT_THROW(c.getProperty("unknownProperty"), std::runtime_error);
+	EXPECT_FALSE(c.removeProperty("unknownProperty"));
+	EXPECT_EQ(-1, SymbolTable::find("unknownProperty"));
+	EXPECT_EQ(n, SymbolTable::size());
+	EXPECT_EQ(key, SymbolTable::find("foo"));
+
+	c.setTagOrigin("myTag");
+	EXPECT_EQ(SymbolTable::intern("myTag"), c.getTagOriginSymbol());
+	c.addSecondary(22, 1 * EeV, 1., "mySecondaryTag");
+	EXPECT_EQ("mySecondaryTag", c.secondaries[0]->getTagOrigin());
+}
+
+TEST(Candidate, sharedProperties) {
+	// the secondaries share the properties of the parent until modified
+	Candidate c;
+	c.setProperty("foo", 1.);
+	c.setProperty("bar", "baz");
+	c.addSecondary(22, 1 * EeV);
+	c.addSecondary(22, 1 * EeV);
+	Candidate &s1 = *c.secondaries[0], &s2 = *c.secondaries[1];
+	EXPECT_TRUE(s1.properties.isShared());
+	EXPECT_EQ(2, s1.properties.size());
+	std::string value = s1.getProperty("bar");
+	EXPECT_EQ("baz", value);
+
+	s1.setProperty("foo", 2.);
+	EXPECT_FALSE(s1.properties.isShared());
+	EXPECT_DOUBLE_EQ(2., s1.getProperty("foo").toDouble());
+	EXPECT_DOUBLE_EQ(1., c.getProperty("foo").toDouble());
+	EXPECT_DOUBLE_EQ(1., s2.getProperty("foo").toDouble());
+
+	EXPECT_FALSE(s2.removeProperty("qux"));
+	EXPECT_TRUE(s2.properties.isShared());
+	EXPECT_TRUE(s2.removeProperty("bar"));
+	EXPECT_TRUE(c.hasProperty("bar"));
+	EXPECT_FALSE(c.properties.isShared());
+
+	Candidate empty;
+	EXPECT_TRUE(empty.properties.empty());
+	EXPECT_TRUE(empty.properties.begin() == empty.properties.end());
+	EXPECT_FALSE(empty.removeProperty("foo"));
+}
+
 TEST(Candidate, serialNumber) {
 	Candidate::setNextSerialNumber(42);
 	Candidate c;
 	EXPECT_EQ(43, c.getSourceSerialNumber());
 }
 
+TEST(Candidate, serialNumberThreads) {
+	Candidate::setNextSerialNumber(0);
+	std::vector<uint64_t> serials(10000);
+#pragma omp parallel for
+	for (size_t i = 0; i < serials.size(); i++) {
+		Candidate c;
+		serials[i] = c.getSerialNumber();
+	}
+	std::sort(serials.begin(), serials.end());
+	EXPECT_TRUE(std::adjacent_find(serials.begin(), serials.end()) == serials.end());
+
+	// continuing from the next serial number does not repeat numbers
+	Candidate::setNextSerialNumber(Candidate::getNextSerialNumber());
+	Candidate c;
+	EXPECT_GT(c.getSerialNumber(), serials.back());
+	EXPECT_EQ(c.getSerialNumber(), Candidate::getNextSerialNumber());
+}
+
+TEST(Candidate, threadConfinement) {
+	// atomic reference counting by default
+	EXPECT_FALSE(Candidate::getThreadConfinement());
+	ref_ptr<Candidate> c3 = new Candidate();
+	EXPECT_FALSE(c3->isThreadConfined());
+
+	Candidate::setThreadConfinement(true);
+	ref_ptr<Candidate> c = new Candidate();
+	EXPECT_TRUE(c->isThreadConfined());
+	ref_ptr<Candidate> c2 = c;
+	EXPECT_EQ(2, c->getReferenceCount());
+	c2 = NULL;
+	EXPECT_EQ(1, c->getReferenceCount());
+	Candidate::setThreadConfinement(false);
+}
+
+TEST(Candidate, detachFromParent) {
+	ref_ptr<Candidate> c = new Candidate();
+	c->addSecondary(22, 1 * EeV);
+	ref_ptr<Candidate> s = c->secondaries[0];
+	s->addSecondary(22, 1 * EeV);
+	ref_ptr<Candidate> ss = s->secondaries[0];
+	uint64_t snrSource = c->getSerialNumber();
+	uint64_t snrCreated = s->getSerialNumber();
+
+	ss->detachFromParent();
+	s = NULL;
+	c = NULL; // frees the parents
+	EXPECT_TRUE(ss->parent == NULL);
+	EXPECT_EQ(snrSource, ss->getSourceSerialNumber());
+	EXPECT_EQ(snrCreated, ss->getCreatedSerialNumber());
+}
+
+TEST(Candidate, thinningPolicy) {
+	ref_ptr<ThinningPolicy> policy = new ThinningPolicy();
+	policy->set(22, 1, 0.1); // Hillas thinning of photons below 0.1 of the parent energy
+	policy->set(12, 2, 1, 1 * EeV);
+	EXPECT_DOUBLE_EQ(1, policy->getSurvivalProbability(22, 20 * EeV, 100 * EeV));
+	EXPECT_DOUBLE_EQ(0.5, policy->getSurvivalProbability(22, 5 * EeV, 100 * EeV));
+	EXPECT_DOUBLE_EQ(0.01, policy->getSurvivalProbability(-12, 0.1 * EeV, 1 * EeV));
+	EXPECT_DOUBLE_EQ(1, policy->getSurvivalProbability(12, 2 * EeV, 100 * EeV));
+	EXPECT_DOUBLE_EQ(1, policy->getSurvivalProbability(11, 1 * EeV, 100 * EeV));
+	EXPECT_THROW(policy->set(22, -1), std::runtime_error);
+
+	// the weighted number of secondaries is conserved
+	Candidate::setThinningPolicy(policy);
+	Candidate c(nucleusId(1, 1), 100 * EeV);
+	for (int i = 0; i < 10000; i++) {
+		c.addSecondary(22, 5 * EeV);
+		c.addSecondary(11, 5 * EeV);
+	}
+	Candidate::setThinningPolicy(0);
+	double weight = 0;
+	size_t nPhotons = 0;
+	for (size_t i = 0; i < c.secondaries.size(); i++) {
+		if (c.secondaries[i]->current.getId() != 22)
+			continue;
+		nPhotons++;
+		weight += c.secondaries[i]->getWeight();
+		EXPECT_DOUBLE_EQ(2, c.secondaries[i]->getWeight());
+	}
+	EXPECT_NEAR(5000, nPhotons, 300);
+	EXPECT_EQ(10000 + nPhotons, c.secondaries.size());
+	EXPECT_DOUBLE_EQ(2 * nPhotons, weight);
+}
+
+TEST(Candidate, minimumEnergyCut) {
+	ref_ptr<ThinningPolicy> policy = new ThinningPolicy();
+	policy->setMinimumEnergy(1 * EeV);
+	policy->setMinimumEnergy(12, 0);
+	EXPECT_DOUBLE_EQ(1 * EeV, policy->getMinimumEnergy(22));
+	EXPECT_DOUBLE_EQ(0, policy->getMinimumEnergy(-12));
+	EXPECT_THROW(policy->setMinimumEnergy(-1), std::runtime_error);
+
+	// secondaries below the cut are not created, their energy is tallied
+	Candidate::setThinningPolicy(policy);
+	Candidate c(nucleusId(1, 1), 100 * EeV);
+	c.setWeight(2);
+	c.addSecondary(22, 0.5 * EeV, 3);
+	c.addSecondary(11, 2 * EeV);
+	c.addSecondary(12, 0.1 * EeV);
+	Candidate::setThinningPolicy(0);
+	EXPECT_EQ(2, c.secondaries.size());
+	EXPECT_EQ(1, policy->getDiscardedNumber());
+	EXPECT_DOUBLE_EQ(3 * EeV, policy->getDiscardedEnergy());
+	policy->clearDiscarded();
+	EXPECT_EQ(0, policy->getDiscardedNumber());
+}
+
 TEST(common, digit) {
 	EXPECT_EQ(1, digit(1234, 1000));
 	EXPECT_EQ(2, digit(1234, 100));
@@ -296,6 +534,39 @@ TEST(common, interpolate) {
 	EXPECT_EQ(7, interpolate(2.001, xD, yD));
 }
 
+TEST(common, hunt) {
+	// table with repeated values
+	std::vector<double> X, Y;
+	for (int i = 0; i < 50; i++) {
+		X.push_back(i / 2);
+		Y.push_back(i * i);
+	}
+	std::vector<double> Z(X.size() * Y.size());
+	for (size_t i = 0; i < Z.size(); i++)
+		Z[i] = i;
+
+	// slowly varying values and jumps give the results without hint
+	Random random(7);
+	size_t hintUpper = 0, hintLower = 100, hintY = 3, hintClosest = 0;
+	double x = 10;
+	for (int i = 0; i < 2000; i++) {
+		x += (i % 100 == 0) ? random.randUniform(-30, 30) : random.randUniform(-0.3, 0.3);
+		double y = fmod(x * x, 2500);
+		EXPECT_EQ(std::upper_bound(X.begin(), X.end(), x) - X.begin(), huntUpperBound(x, X, hintUpper));
+		EXPECT_EQ(std::lower_bound(X.begin(), X.end(), x) - X.begin(), huntLowerBound(x, X, hintLower));
+		EXPECT_EQ(interpolate(x, X, Y), interpolate(x, X, Y, hintUpper));
+		EXPECT_EQ(interpolate2d(x, y, X, Y, Z), interpolate2d(x, y, X, Y, Z, hintUpper, hintY));
+		if ((x >= X.front()) and (x <= X.back()))
+			EXPECT_EQ(closestIndex(x, X), closestIndex(x, X, hintClosest));
+	}
+
+	// values on the nodes
+	for (size_t i = 0; i < X.size(); i++) {
+		EXPECT_EQ(std::upper_bound(X.begin(), X.end(), X[i]) - X.begin(), huntUpperBound(X[i], X, hintUpper));
+		EXPECT_EQ(std::lower_bound(X.begin(), X.end(), X[i]) - X.begin(), huntLowerBound(X[i], X, hintLower));
+	}
+}
+
 TEST(common, interpolateEquidistant) {
 	std::vector<double> yD(100);
 	for (int i = 0; i < 100; i++) {
@@ -320,6 +591,28 @@ TEST(common, pow_integer) {
 	EXPECT_FLOAT_EQ(pow_integer<3>(1.234), pow(1.234, 3));
 }
 
+TEST(common, formatScientific) {
+	// the same text as printf for random mantissas and exponents
+	Random random(42);
+	char expected[64], buffer[64];
+	for (int i = 0; i < 100000; i++) {
+		double x = (random.rand() - 0.5) * pow(10, random.randUniform(-300, 300));
+		std::snprintf(expected, sizeof(expected), "%8.5E", x);
+		size_t n = formatScientific(buffer, x, 5);
+		ASSERT_EQ(std::string(expected), std::string(buffer, n)) << x;
+	}
+	double special[] = {0., -0., 1., 9.999995, 9.9999949999, 1e-310, 1e308, 0.5, 1.234565};
+	for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+		std::snprintf(expected, sizeof(expected), "%1.5E", special[i]);
+		EXPECT_EQ(std::string(expected), std::string(buffer, formatScientific(buffer, special[i])));
+	}
+	EXPECT_EQ("1.2E+01", std::string(buffer, formatScientific(buffer, 12.3, 1)));
+
+	EXPECT_EQ("        42", std::string(buffer, formatInteger(buffer, 42, 10)));
+	EXPECT_EQ("       -42", std::string(buffer, formatInteger(buffer, -42, 10)));
+	EXPECT_EQ("18446744073709551615", std::string(buffer, formatUnsigned(buffer, uint64_t(-1), 10)));
+}
+
 TEST(common, gaussInt) {
 	EXPECT_NEAR(gaussInt(([](double x){ return x*x; }), 0, 10), 1000/3., 1e-4);
 	EXPECT_NEAR(gaussInt(([](double x){ return sin(x)*sin(x); }), 0, M_PI), M_PI/2., 1e-4);
@@ -415,6 +708,130 @@ TEST(Random, base64Seed) {
 	}
 }
 
+TEST(Random, aliasTable) {
+	// bins drawn from an alias table have the distribution of randBin
+	std::vector<double> cdf;
+	double weights[6] = {0, 1, 0, 3, 2.5, 0.5};
+	double sum = 0;
+	for (size_t i = 0; i < 6; i++) {
+		sum += weights[i];
+		cdf.push_back(sum);
+	}
+	AliasTable table(cdf);
+	EXPECT_EQ(6, table.size());
+
+	// the bin probabilities are exact on a fine grid of random numbers
+	std::vector<double> count(6, 0.);
+	const size_t n = 60000;
+	for (size_t i = 0; i < n; i++)
+		count[table.sample((i + 0.5) / n)] += 1;
+	for (size_t i = 0; i < 6; i++)
+		EXPECT_NEAR(weights[i] / sum, count[i] / n, 1e-4);
+
+	Random random(42);
+	for (size_t i = 0; i < 100; i++) {
+		size_t j = random.randBin(table);
+		EXPECT_GT(weights[j], 0);
+	}
+
+	// without weight always bin 0, as from randBin
+	AliasTable zero(std::vector<float>(3, 0.f));
+	EXPECT_EQ(0, zero.sample(0.7));
+	EXPECT_THROW(AliasTable().sample(0.5), std::runtime_error);
+}
+
+TEST(Random, bulk) {
+	// the bulk functions return the numbers of the single draws
+	for (int engine = 0; engine < 2; engine++) {
+		Random a(17), b(17);
+		if (engine == 1) {
+			a.seedStream(17, 3);
+			b.seedStream(17, 3);
+		}
+		const size_t n = 1001; // across the reloads of the state
+		std::vector<uint32_t> ints(n);
+		a.randInt(&ints[0], n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_EQ(b.randInt(), ints[i]);
+
+		std::vector<double> values(n);
+		a.rand(&values[0], n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_EQ(b.rand(), values[i]);
+
+		std::vector<Vector3d> vectors(n);
+		a.randVector(&vectors[0], n);
+		for (size_t i = 0; i < n; i++) {
+			Vector3d v = b.randVector();
+			EXPECT_EQ(v.x, vectors[i].x);
+			EXPECT_EQ(v.z, vectors[i].z);
+		}
+
+		// both values of the pairs, an odd number discards one
+		std::vector<double> normals(n);
+		a.randNorm(&normals[0], n);
+		double pair[2];
+		for (size_t i = 0; i < n; i += 2) {
+			b.randNorm(pair, 2);
+			EXPECT_EQ(pair[0], normals[i]);
+			if (i + 1 < n)
+				EXPECT_EQ(pair[1], normals[i + 1]);
+		}
+
+		a.randExponential(&values[0], n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_EQ(b.randExponential(), values[i]);
+
+		a.randPowerLaw(-2.7, 1, 100, &values[0], n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_EQ(b.randPowerLaw(-2.7, 1, 100), values[i]);
+	}
+}
+
+TEST(Random, philoxStreams) {
+	// known answers of the Random123 reference implementation
+	uint32_t zeroCounter[4] = {0, 0, 0, 0}, zeroKey[2] = {0, 0};
+	uint32_t piCounter[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+	uint32_t piKey[2] = {0xa4093822, 0x299f31d0};
+	uint32_t out[4];
+	Random::philox(zeroCounter, zeroKey, out);
+	EXPECT_EQ(0x6627e8d5u, out[0]);
+	EXPECT_EQ(0xe169c58du, out[1]);
+	EXPECT_EQ(0xbc57ac4cu, out[2]);
+	EXPECT_EQ(0x9b00dbd8u, out[3]);
+	Random::philox(piCounter, piKey, out);
+	EXPECT_EQ(0xd16cfe09u, out[0]);
+	EXPECT_EQ(0x94fdccebu, out[1]);
+	EXPECT_EQ(0x5001e420u, out[2]);
+	EXPECT_EQ(0x24126ea1u, out[3]);
+
+	// a stream is continued from its counter
+	Random a, b;
+	a.seedStream(42, 7);
+	EXPECT_TRUE(a.isCounterBased());
+	EXPECT_EQ(7u, a.getStream());
+	std::vector<uint32_t> values;
+	for (size_t i = 0; i < 10; i++)
+		values.push_back(a.randInt());
+	EXPECT_EQ(10u, a.getCounter());
+	b.seedStream(42, 7, 5);
+	for (size_t i = 5; i < 10; i++)
+		EXPECT_EQ(values[i], b.randInt());
+	b.seedStream(42, 8);
+	EXPECT_NE(values[0], b.randInt());
+	b.seed(1);
+	EXPECT_FALSE(b.isCounterBased());
+
+	// instance() draws from the selected stream if enabled
+	Random::seedStreams(42);
+	EXPECT_EQ(3u, Random::reserveStreams(3) + 3);
+	EXPECT_EQ(3u, Random::reserveStreams(1));
+	Random::selectStream(7, 2);
+	EXPECT_EQ(values[2], Random::instance().randInt());
+	Random::disableStreams();
+	EXPECT_FALSE(Random::instance().isCounterBased());
+}
+
 TEST(Grid, PeriodicClamp) {
 	// Test correct determination of lower and upper neighbor
 	int lo, hi;
@@ -672,6 +1089,77 @@ TEST(Grid3f, Interpolation) {
 	#endif // HAVE_SIMD
 }
 
+TEST(Grid3f, TrilinearKernel) {
+	// the float grids, vectorized if available, agree with the double grids
+	int n = 5;
+	Grid3f grid3f(Vector3d(0.), n, 1.);
+	Grid3d grid3d(Vector3d(0.), n, 1.);
+	Grid1f grid1f(Vector3d(0.), n, 1.);
+	Grid1d grid1d(Vector3d(0.), n, 1.);
+	Random random(42);
+	for (int ix = 0; ix < n; ix++)
+		for (int iy = 0; iy < n; iy++)
+			for (int iz = 0; iz < n; iz++) {
+				Vector3f v(random.rand(), random.rand(), random.rand());
+				grid3f.get(ix, iy, iz) = v;
+				grid3d.get(ix, iy, iz) = Vector3d(v.x, v.y, v.z);
+				grid1f.get(ix, iy, iz) = v.x;
+				grid1d.get(ix, iy, iz) = v.x;
+			}
+	grid3f.setReflective(true);
+	grid3d.setReflective(true);
+
+	for (int i = 0; i < 100; i++) {
+		Vector3d position = random.randVector() * 8;
+		Vector3f b = grid3f.interpolate(position);
+		Vector3d c = grid3d.interpolate(position);
+		EXPECT_NEAR(c.x, b.x, 1e-5);
+		EXPECT_NEAR(c.y, b.y, 1e-5);
+		EXPECT_NEAR(c.z, b.z, 1e-5);
+		EXPECT_NEAR(grid1d.interpolate(position), grid1f.interpolate(position), 1e-5);
+	}
+}
+
+TEST(Grid3f, TiledLayout) {
+	// the layout is transparent for the access and the interpolation
+	GridProperties properties(Vector3d(0.), 6, 5, 3, 1.);
+	properties.setLayout(TILED);
+	Grid3f tiled(properties);
+	Grid3f rowMajor(Vector3d(0.), 6, 5, 3, 1.);
+	EXPECT_EQ(TILED, tiled.getLayout());
+	EXPECT_EQ(ROW_MAJOR, rowMajor.getLayout());
+
+	std::vector<bool> used(tiled.getGrid().size(), false);
+	for (int ix = 0; ix < 6; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 3; iz++) {
+				Vector3f v(ix, iy, iz);
+				tiled.get(ix, iy, iz) = v;
+				rowMajor.get(ix, iy, iz) = v;
+				size_t i = tiled.storageIndex(ix, iy, iz);
+				EXPECT_FALSE(used[i]);
+				used[i] = true;
+				EXPECT_EQ(Vector3d(ix, iy, iz) + Vector3d(0.5), tiled.positionFromIndex(i));
+			}
+
+	Random random(7);
+	for (int i = 0; i < 50; i++) {
+		Vector3d position = random.randVector() * 7;
+		Vector3f a = tiled.interpolate(position);
+		Vector3f b = rowMajor.interpolate(position);
+		EXPECT_FLOAT_EQ(b.x, a.x);
+		EXPECT_FLOAT_EQ(b.y, a.y);
+		EXPECT_FLOAT_EQ(b.z, a.z);
+	}
+
+	// reordering keeps the values
+	tiled.setLayout(ROW_MAJOR);
+	EXPECT_EQ(6 * 5 * 3, tiled.getGrid().size());
+	EXPECT_EQ(Vector3f(4, 3, 2), tiled.get(4, 3, 2));
+	rowMajor.setLayout(TILED);
+	EXPECT_EQ(Vector3f(5, 1, 2), rowMajor.get(5, 1, 2));
+}
+
 TEST(VectordGrid, Scale) {
 	// Test scaling a field
 	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 3, 1);
@@ -687,6 +1175,79 @@ TEST(VectordGrid, Scale) {
 				EXPECT_FLOAT_EQ(5, grid->interpolate(Vector3d(0.7, 0, 0.1)).x);
 }
 
+TEST(Grid3h, HalfFloat) {
+	EXPECT_EQ(0x3c00, floatToHalf(1.));
+	EXPECT_EQ(0xc000, floatToHalf(-2.));
+	EXPECT_EQ(0x7bff, floatToHalf(65504.));
+	EXPECT_EQ(0x7c00, floatToHalf(1e5));
+	EXPECT_EQ(0x0001, floatToHalf(pow(2., -24)));
+	EXPECT_EQ(0, floatToHalf(1e-9));
+	EXPECT_FLOAT_EQ(1., halfToFloat(0x3c00));
+	EXPECT_FLOAT_EQ(65504., halfToFloat(0x7bff));
+	EXPECT_FLOAT_EQ(pow(2., -24), halfToFloat(0x0001));
+	EXPECT_FLOAT_EQ(-pow(2., -15), halfToFloat(0x8200));
+
+	// round trip of all finite numbers
+	for (uint32_t h = 0; h < 0x10000; h++)
+		if ((h & 0x7c00) != 0x7c00)
+			EXPECT_EQ(h, floatToHalf(halfToFloat(h)));
+}
+
+TEST(Grid3h, Interpolation) {
+	// a half precision copy interpolates within the half precision
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 5, 4, 3, 1.);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 3; iz++)
+				grid->get(ix, iy, iz) = Vector3f(sin(ix + 2 * iy), cos(iz), -0.5 * ix) * 1e-10;
+	ref_ptr<Grid3h> half = toHalfPrecision(grid);
+	EXPECT_EQ(5, half->getNx());
+	EXPECT_FLOAT_EQ(2e-10 / 32768, half->getStorageScale());
+	EXPECT_EQ(6, sizeof(Vector3h));
+
+	for (int i = 0; i < 50; i++) {
+		Vector3d p(0.31 * i, 0.17 * i, 0.23 * i);
+		Vector3f b = grid->interpolate(p);
+		Vector3f h = half->interpolate(p);
+		EXPECT_NEAR(b.x, h.x, 1e-3 * 2e-10);
+		EXPECT_NEAR(b.y, h.y, 1e-3 * 2e-10);
+		EXPECT_NEAR(b.z, h.z, 1e-3 * 2e-10);
+	}
+
+	half->setValue(1, 2, 0, Vector3f(1e-10, 0, 0));
+	EXPECT_NEAR(1e-10, half->getValue(1, 2, 0).x, 1e-13);
+}
+
+TEST(NestedGrid, findGrid) {
+	ref_ptr<Grid1f> coarse = new Grid1f(Vector3d(0.), 8, 8, 4, 1.);
+	ref_ptr<Grid1f> medium = new Grid1f(Vector3d(2., 2., 0.), 8, 8, 4, 0.5);
+	ref_ptr<Grid1f> fine = new Grid1f(Vector3d(3., 3., 1.), 8, 8, 8, 0.125);
+	coarse->getGrid().assign(coarse->getGrid().size(), 1);
+	medium->getGrid().assign(medium->getGrid().size(), 2);
+	fine->getGrid().assign(fine->getGrid().size(), 3);
+
+	NestedGrid1f nested(coarse);
+	nested.addRefinement(fine);
+	nested.addRefinement(medium);
+	EXPECT_EQ(2, nested.getNumberOfRefinements());
+	EXPECT_EQ(fine, nested.getRefinement(0));
+	EXPECT_TRUE(medium->isReflective());
+
+	EXPECT_EQ(coarse, nested.findGrid(Vector3d(1., 1., 1.)));
+	EXPECT_EQ(medium, nested.findGrid(Vector3d(2.5, 5.9, 1.9)));
+	EXPECT_EQ(fine, nested.findGrid(Vector3d(3.5, 3.5, 1.5)));
+	EXPECT_EQ(medium, nested.findGrid(Vector3d(4.1, 3.5, 1.5)));
+	EXPECT_EQ(coarse, nested.findGrid(Vector3d(-1., 3.5, 1.5)));
+	EXPECT_FLOAT_EQ(3, nested.interpolate(Vector3d(3.5, 3.5, 1.5)));
+	EXPECT_FLOAT_EQ(2, nested.interpolate(Vector3d(5.9, 5.9, 0.1)));
+	EXPECT_FLOAT_EQ(1, nested.interpolate(Vector3d(7., 1., 1.)));
+	EXPECT_EQ(coarse->getSizeOf() + medium->getSizeOf() + fine->getSizeOf(), nested.getSizeOf());
+
+	// refinements have to lie within the coarse grid
+	ref_ptr<Grid1f> outside = new Grid1f(Vector3d(6., 0., 0.), 4, 1.);
+	EXPECT_THROW(nested.addRefinement(outside), std::runtime_error);
+}
+
 TEST(Grid3f, Periodicity) {
 	// Test for periodic boundaries: grid(x+a*n) = grid(x)
 	size_t n = 3;
@@ -872,6 +1433,518 @@ TEST(Grid3f, DumpLoad) {
 	}
 }
 
+TEST(Grid3f, DumpMap) {
+	// Dump a field grid and map it into another grid
+	ref_ptr<Grid3f> grid1 = new Grid3f(Vector3d(0.), 4, 3, 2, 1.);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 3; iy++)
+			for (int iz = 0; iz < 2; iz++)
+				grid1->get(ix, iy, iz) = Vector3f(ix, iy, iz + 0.5);
+	dumpGrid(grid1, "testDumpMap.raw");
+
+	ref_ptr<Grid3f> grid2 = new Grid3f(Vector3d(0.), 4, 3, 2, 1.);
+	mapGrid(grid2, "testDumpMap.raw");
+	EXPECT_TRUE(grid2->isMapped());
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 3; iy++)
+			for (int iz = 0; iz < 2; iz++)
+				EXPECT_EQ(grid1->get(ix, iy, iz), grid2->get(ix, iy, iz));
+	Vector3d p(1.7, 0.4, 1.2);
+	EXPECT_EQ(grid1->interpolate(p), grid2->interpolate(p));
+
+	// modifications are private to the grid
+	grid2->get(1, 1, 1) = Vector3f(-1.);
+	ref_ptr<Grid3f> grid3 = new Grid3f(Vector3d(0.), 4, 3, 2, 1.);
+	mapGrid(grid3, "testDumpMap.raw");
+	EXPECT_EQ(grid1->get(1, 1, 1), grid3->get(1, 1, 1));
+
+	// the values are copied when the grid vector is requested
+	std::vector<Vector3f> &values = grid2->getGrid();
+	EXPECT_FALSE(grid2->isMapped());
+	EXPECT_EQ(24, values.size());
+	EXPECT_EQ(Vector3f(-1.), grid2->get(1, 1, 1));
+
+	// the file has to match the grid
+	ref_ptr<Grid3f> grid4 = new Grid3f(Vector3d(0.), 3, 1.);
+	EXPECT_THROW(mapGrid(grid4, "testDumpMap.raw"), std::runtime_error);
+	ref_ptr<Grid3f> grid5 = new Grid3f(Vector3d(0.), 4, 3, 2, 1.);
+	grid5->setLayout(TILED);
+	EXPECT_THROW(mapGrid(grid5, "testDumpMap.raw"), std::runtime_error);
+	EXPECT_THROW(mapGrid(grid5, "nonexistent.raw"), std::runtime_error);
+}
+
+TEST(Grid3f, SharedMemory) {
+	// a published grid is mapped with its properties by other processes
+	ref_ptr<Grid3f> grid1 = new Grid3f(Vector3d(1., 2., 3.), 5, 4, 3, Vector3d(0.5, 1., 2.));
+	grid1->setLayout(TILED);
+	grid1->setReflective(true);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 3; iz++)
+				grid1->get(ix, iy, iz) = Vector3f(ix, iy, iz + 0.5);
+	std::string name = "/crpropa-testSharedGrid";
+	publishGrid(grid1, name);
+
+	ref_ptr<Grid3f> grid2 = mapSharedGrid3f(name);
+	EXPECT_TRUE(grid2->isMapped());
+	EXPECT_EQ(name, grid2->getMappedFilename());
+	EXPECT_EQ(5, grid2->getNx());
+	EXPECT_EQ(3, grid2->getNz());
+	EXPECT_EQ(grid1->getOrigin(), grid2->getOrigin());
+	EXPECT_EQ(grid1->getSpacing(), grid2->getSpacing());
+	EXPECT_TRUE(grid2->isReflective());
+	EXPECT_EQ(ROW_MAJOR, grid2->getLayout());
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 3; iz++)
+				EXPECT_EQ(grid1->get(ix, iy, iz), grid2->get(ix, iy, iz));
+	Vector3d p(2.3, 4.1, -1.2);
+	EXPECT_EQ(grid1->interpolate(p), grid2->interpolate(p));
+
+	// modifications are private, the mapping stays valid after unlinking
+	grid2->get(1, 1, 1) = Vector3f(-1.);
+	EXPECT_EQ(grid1->get(1, 1, 1), mapSharedGrid3f(name)->get(1, 1, 1));
+	EXPECT_THROW(mapSharedGrid1f(name), std::runtime_error);
+	unlinkSharedGrid(name);
+	EXPECT_THROW(mapSharedGrid3f(name), std::runtime_error);
+	EXPECT_EQ(grid1->get(4, 3, 2), grid2->get(4, 3, 2));
+
+	ref_ptr<Grid1f> scalar = new Grid1f(Vector3d(0.), 3, 1.);
+	scalar->get(2, 1, 0) = 7;
+	publishGrid(scalar, name);
+	EXPECT_EQ(7, mapSharedGrid1f(name)->get(2, 1, 0));
+	unlinkSharedGrid(name);
+}
+
+TEST(Grid1f, DumpValuesMapFile) {
+	// the values of a tiled grid are written in row-major order
+	ref_ptr<Grid1f> grid1 = new Grid1f(Vector3d(0.), 5, 4, 3, 1.);
+	grid1->setLayout(TILED);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 3; iz++)
+				grid1->get(ix, iy, iz) = ix * 100 + iy * 10 + iz;
+	grid1->dumpValues("testDumpValues.raw");
+
+	ref_ptr<Grid1f> grid2 = new Grid1f(Vector3d(0.), 5, 4, 3, 1.);
+	EXPECT_EQ("", grid2->getMappedFilename());
+	grid2->mapFile("testDumpValues.raw");
+	EXPECT_EQ("testDumpValues.raw", grid2->getMappedFilename());
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 3; iz++)
+				EXPECT_EQ(grid1->get(ix, iy, iz), grid2->get(ix, iy, iz));
+
+	// setting a value copies the grid
+	grid2->setValue(1, 2, 0, -1);
+	EXPECT_FALSE(grid2->isMapped());
+	EXPECT_EQ(-1, grid2->get(1, 2, 0));
+	EXPECT_EQ(201, grid2->get(2, 0, 1));
+	std::remove("testDumpValues.raw");
+}
+
+TEST(DataTable, binaryCopy) {
+	// parse a text table, which writes the binary copy
+	std::string filename = "testDataTable.txt";
+	std::remove(DataTable::binaryFilename(filename).c_str());
+	std::ofstream out(filename.c_str());
+	out << "# header\n1 2.5 -3e2\n\n  # indented comment\n4\t5 # trailing\n";
+	out.close();
+	ref_ptr<DataTable> table1 = new DataTable(filename);
+	EXPECT_FALSE(table1->isMapped());
+	EXPECT_EQ(2, table1->size());
+	EXPECT_EQ(3, table1->columns(0));
+	EXPECT_EQ(2, table1->columns(1));
+	EXPECT_EQ(5, table1->count());
+	EXPECT_DOUBLE_EQ(-300, table1->get(0, 2));
+	EXPECT_DOUBLE_EQ(5, table1->row(1)[1]);
+
+	// the second load maps the binary copy
+	ref_ptr<DataTable> table2 = new DataTable(filename);
+	EXPECT_TRUE(table2->isMapped());
+	EXPECT_EQ(table1->size(), table2->size());
+	EXPECT_EQ(table1->count(), table2->count());
+	for (size_t i = 0; i < table1->count(); i++)
+		EXPECT_EQ(table1->data()[i], table2->data()[i]);
+
+	// a changed text is parsed again
+	out.open(filename.c_str());
+	out << "1 2 3 4\n";
+	out.close();
+	ref_ptr<DataTable> table3 = new DataTable(filename);
+	EXPECT_FALSE(table3->isMapped());
+	EXPECT_EQ(1, table3->size());
+	EXPECT_EQ(4, table3->columns(0));
+
+	// invalid values and missing files
+	out.open(filename.c_str());
+	out << "1 x\n";
+	out.close();
+	EXPECT_THROW(new DataTable(filename), std::runtime_error);
+	EXPECT_THROW(new DataTable("nonexistent.txt"), std::runtime_error);
+	std::remove(filename.c_str());
+	std::remove(DataTable::binaryFilename(filename).c_str());
+}
+
+TEST(TableRegistry, sharing) {
+	std::string rateFile = "testRateTable.txt";
+	std::string cdfFile = "testCumulativeRateTable.txt";
+	std::ofstream out(rateFile.c_str());
+	out << "# log10(E/eV) rate [1/Mpc]\n15 1\n16 2\n17 4\n";
+	out.close();
+	out.open(cdfFile.c_str());
+	out << "0 2 3\n15 1 3\n16 2 2\n";
+	out.close();
+	TableRegistry::clear();
+
+	// the same file is loaded once and shared
+	ref_ptr<RateTable> rate1 = RateTable::load(rateFile);
+	ref_ptr<RateTable> rate2 = RateTable::load(rateFile);
+	EXPECT_EQ(rate1.get(), rate2.get());
+	EXPECT_EQ(1, TableRegistry::size());
+	EXPECT_EQ(3, rate1->energy.size());
+	EXPECT_DOUBLE_EQ(1e16 * eV, rate1->energy[1]);
+	EXPECT_DOUBLE_EQ(4 / Mpc, rate1->rate[2]);
+
+	// the kind of table is part of the key
+	ref_ptr<CumulativeRateTable> cdf = CumulativeRateTable::load(cdfFile);
+	EXPECT_EQ(2, TableRegistry::size());
+	EXPECT_EQ(2, cdf->s.size());
+	EXPECT_EQ(2, cdf->alias.size());
+	EXPECT_DOUBLE_EQ(1e3 * eV * eV, cdf->s[1]);
+	EXPECT_DOUBLE_EQ(2 / Mpc, cdf->cdf[1][1]);
+
+	// unused tables are released when the next table is registered
+	rate1 = 0;
+	rate2 = 0;
+	EXPECT_EQ(2, TableRegistry::size());
+	ref_ptr<RateTable> rate3 = RateTable::load("./" + rateFile);
+	EXPECT_EQ(2, TableRegistry::size());
+	EXPECT_EQ(3, rate3->energy.size());
+
+	// without sharing every load returns a new table
+	TableRegistry::setEnabled(false);
+	EXPECT_NE(RateTable::load(rateFile).get(), RateTable::load(rateFile).get());
+	TableRegistry::setEnabled(true);
+	TableRegistry::clear();
+	EXPECT_EQ(0, TableRegistry::size());
+
+	// provided tables are returned instead of loading the file
+	ref_ptr<RateTable> provided = TableRegistry::add("RateTable", "provided.txt", new RateTable(rateFile));
+	EXPECT_EQ(provided.get(), RateTable::load("provided.txt").get());
+	EXPECT_EQ(provided.get(), TableRegistry::add("RateTable", "provided.txt", new RateTable(rateFile)).get());
+	EXPECT_EQ(1, TableRegistry::size());
+	provided = 0;
+	TableRegistry::clear();
+
+	EXPECT_THROW(RateTable::load("nonexistent.txt"), std::runtime_error);
+	std::remove(rateFile.c_str());
+	std::remove(cdfFile.c_str());
+	std::remove(DataTable::binaryFilename(rateFile).c_str());
+	std::remove(DataTable::binaryFilename(cdfFile).c_str());
+}
+
+TEST(TableRegistry, compact) {
+	// nodes interpolated by their neighbours are removed within the tolerance
+	std::vector<double> x, y;
+	for (size_t i = 0; i <= 20; i++) {
+		x.push_back(i);
+		y.push_back(i <= 10 ? 1e-30 * (1 + i) : 1e-30 * (11 + 0.5 * pow(i - 10., 2)));
+	}
+	CompactTable full(x, y);
+	EXPECT_EQ(21, full.size());
+	EXPECT_EQ(21 * 2 * sizeof(float), full.getMemory());
+	CompactTable resampled(x, y, 0.01);
+	EXPECT_LT(resampled.size(), 21);
+	EXPECT_DOUBLE_EQ(0, resampled.getMinX());
+	EXPECT_DOUBLE_EQ(20, resampled.getMaxX());
+	for (size_t i = 0; i <= 40; i++) {
+		double xi = 0.5 * i;
+		double exact = interpolate(xi, x, y);
+		EXPECT_NEAR(exact, full.interpolate(xi), 1e-6 * exact);
+		if (i % 2 == 0)
+			EXPECT_NEAR(y[i / 2], resampled.interpolate(xi), 0.01 * y[i / 2]);
+	}
+	EXPECT_NEAR(y.front(), full.interpolate(-1), 1e-6 * y.front());
+	EXPECT_NEAR(y.back(), full.interpolate(21), 1e-6 * y.back());
+
+	std::string rateFile = "testCompactRateTable.txt";
+	std::string cdfFile = "testCompactCumulativeRateTable.txt";
+	std::ofstream out(rateFile.c_str());
+	out << "15 1\n15.5 1.5\n16 2\n16.5 3\n17 4\n";
+	out.close();
+	out.open(cdfFile.c_str());
+	out << "0 2 3 4\n15 1 3 4\n16 2 2 6\n";
+	out.close();
+	TableRegistry::clear();
+
+	// the compaction is part of the key
+	ref_ptr<RateTable> rate = RateTable::load(rateFile);
+	ref_ptr<RateTable> compact = RateTable::load(rateFile, 0.);
+	ref_ptr<RateTable> resampledRate = RateTable::load(rateFile, 1e-3);
+	EXPECT_EQ(3, TableRegistry::size());
+	EXPECT_EQ(compact.get(), RateTable::load(rateFile, 0.).get());
+	EXPECT_FALSE(rate->isCompact());
+	EXPECT_TRUE(compact->isCompact());
+	EXPECT_TRUE(compact->energy.empty());
+	EXPECT_DOUBLE_EQ(rate->getMinEnergy(), compact->getMinEnergy());
+	EXPECT_DOUBLE_EQ(rate->getMaxEnergy(), resampledRate->getMaxEnergy());
+	for (double lgE = 15; lgE <= 17; lgE += 0.25) {
+		double E = pow(10, lgE) * eV;
+		EXPECT_NEAR(rate->getRate(E), compact->getRate(E), 1e-6 * rate->getRate(E));
+		EXPECT_NEAR(rate->getRate(E), resampledRate->getRate(E), 1e-3 * rate->getRate(E));
+	}
+
+	// the alias tables sample the same bins
+	ref_ptr<CumulativeRateTable> cdf = CumulativeRateTable::load(cdfFile);
+	ref_ptr<CumulativeRateTable> compactCdf = CumulativeRateTable::load(cdfFile, true);
+	EXPECT_EQ(5, TableRegistry::size());
+	EXPECT_TRUE(compactCdf->isCompact());
+	EXPECT_TRUE(compactCdf->cdf.empty());
+	EXPECT_EQ(3, compactCdf->s.size());
+	EXPECT_EQ(1, compactCdf->getEnergyIndex(0.9e16 * eV));
+	for (size_t i = 0; i < 2; i++)
+		for (double u = 0.05; u < 1; u += 0.1)
+			EXPECT_EQ(cdf->sample(i, u), compactCdf->sample(i, u));
+
+	TableRegistry::clear();
+	std::remove(rateFile.c_str());
+	std::remove(cdfFile.c_str());
+	std::remove(DataTable::binaryFilename(rateFile).c_str());
+	std::remove(DataTable::binaryFilename(cdfFile).c_str());
+}
+
+TEST(TableRegistry, adaptive) {
+	// a flat rate with a resonance, on a uniform grid
+	std::vector<double> x, y;
+	for (size_t i = 0; i <= 200; i++) {
+		x.push_back(6 + 0.05 * i);
+		y.push_back(1e-20 * (1 + 0.1 * x.back() + 10 / (1 + pow((x.back() - 12) / 0.1, 2))));
+	}
+	AdaptiveTable full(x, y);
+	EXPECT_EQ(1, full.getNumberOfSegments());
+	EXPECT_EQ(201, full.size());
+	AdaptiveTable adaptive(x, y, 1e-3);
+	EXPECT_LT(1, adaptive.getNumberOfSegments());
+	EXPECT_GT(100, adaptive.size());
+	EXPECT_GT(full.getMemory(), adaptive.getMemory());
+	EXPECT_DOUBLE_EQ(6, adaptive.getMinX());
+	EXPECT_DOUBLE_EQ(16, adaptive.getMaxX());
+	for (size_t i = 0; i <= 800; i++) {
+		double xi = 6 + 0.0125 * i;
+		double exact = interpolate(xi, x, y);
+		EXPECT_NEAR(exact, full.interpolate(xi), 1e-6 * exact);
+		if (i % 4 == 0)
+			EXPECT_NEAR(y[i / 4], adaptive.interpolate(xi), 1.001e-3 * y[i / 4]);
+	}
+	EXPECT_NEAR(y.front(), adaptive.interpolate(0), 1e-6 * y.front());
+	EXPECT_NEAR(y.back(), adaptive.interpolate(20), 1e-6 * y.back());
+	EXPECT_THROW(AdaptiveTable(y, x), std::runtime_error);
+}
+
+TEST(RedshiftCache, reuse) {
+	double tolerance = RedshiftCache::getTolerance();
+	RedshiftCache::setTolerance(1e-3);
+	RedshiftCache cache;
+	bool valid;
+	std::vector<double> &values = cache.get(0.1, valid);
+	EXPECT_FALSE(valid);
+	values.assign(1, 42.);
+
+	// reused within the tolerance, recomputed outside
+	EXPECT_EQ(42., cache.get(0.1005, valid)[0]);
+	EXPECT_TRUE(valid);
+	cache.get(0.102, valid);
+	EXPECT_FALSE(valid);
+
+	// copies and cleared caches do not share the values
+	cache.get(0.2, valid)[0] = 1.;
+	RedshiftCache copy(cache);
+	copy.get(0.2, valid);
+	EXPECT_FALSE(valid);
+	cache.clear();
+	cache.get(0.2, valid);
+	EXPECT_FALSE(valid);
+
+	EXPECT_THROW(RedshiftCache::setTolerance(-1), std::runtime_error);
+	RedshiftCache::setTolerance(tolerance);
+}
+
+TEST(Cosmology, lookups) {
+	// round trips through the indexed tables, across the table nodes
+	for (int i = 0; i <= 600; i++) {
+		double z = pow(10, -5 + i / 100.);
+		EXPECT_NEAR(z, comovingDistance2Redshift(redshift2ComovingDistance(z)), 1e-6 * z + 1e-12);
+		EXPECT_NEAR(z, luminosityDistance2Redshift(redshift2LuminosityDistance(z)), 1e-6 * z + 1e-12);
+		EXPECT_NEAR(z, lightTravelDistance2Redshift(redshift2LightTravelDistance(z)), 1e-6 * z + 1e-12);
+	}
+	EXPECT_DOUBLE_EQ(0, redshift2ComovingDistance(0));
+	// Hubble law at low redshift
+	EXPECT_NEAR(1e-3 * c_light / H0(), redshift2ComovingDistance(1e-3), 1e-3 * 1e-3 * c_light / H0());
+
+	// stepping towards the observer
+	double z = 1;
+	double d = redshift2ComovingDistance(z);
+	EXPECT_DOUBLE_EQ(comovingDistance2Redshift(d - 100 * Mpc), redshiftAfterComovingStep(z, 100 * Mpc));
+	EXPECT_DOUBLE_EQ(z, redshiftAfterComovingStep(z, 0));
+	EXPECT_DOUBLE_EQ(0, redshiftAfterComovingStep(z, 2 * d));
+	EXPECT_THROW(redshiftAfterComovingStep(-1, Mpc), std::runtime_error);
+}
+
+TEST(PagedGrid, interpolate) {
+	// a paged grid with a cache of a few tiles gives the values of the full grid
+	GridProperties properties(Vector3d(1., 2., 3.), 11, 7, 9, 0.5);
+	ref_ptr<Grid3f> grid = new Grid3f(properties);
+	for (int ix = 0; ix < 11; ix++)
+		for (int iy = 0; iy < 7; iy++)
+			for (int iz = 0; iz < 9; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, sin(ix + iy + iz));
+	dumpGrid(grid, "testPagedGrid.raw");
+
+	size_t tileSize = 4 * 4 * 4 * sizeof(Vector3f);
+	PagedGrid3f paged("testPagedGrid.raw", properties, 16 * tileSize, 4);
+	EXPECT_EQ(16 * tileSize, paged.getCacheSize());
+	EXPECT_EQ(grid->get(10, 6, 8), paged.get(10, 6, 8));
+	EXPECT_EQ(grid->get(3, 5, 0), paged.get(3, 5, 0));
+	EXPECT_THROW(paged.get(11, 0, 0), std::out_of_range);
+
+	for (int i = 0; i < 200; i++) {
+		Vector3d p(0.37 * i, 5.1 - 0.1 * i, 0.05 * i * i);
+		Vector3f a = grid->interpolate(p);
+		Vector3f b = paged.interpolate(p);
+		EXPECT_FLOAT_EQ(a.x, b.x);
+		EXPECT_FLOAT_EQ(a.y, b.y);
+		EXPECT_NEAR(a.z, b.z, 1e-6);
+	}
+	// 3 x 2 x 3 tiles, at most one per shard is kept
+	EXPECT_LE(paged.getNumberOfCachedTiles(), 16);
+	EXPECT_GE(paged.getNumberOfLoads(), 18);
+
+	// concurrent lookups
+	int mismatches = 0;
+	#pragma omp parallel for reduction(+:mismatches)
+	for (int i = 0; i < 2000; i++) {
+		Vector3d p(0.037 * i, 0.011 * i, 0.023 * i);
+		if ((grid->interpolate(p) - paged.interpolate(p)).getR() > 1e-5)
+			mismatches++;
+	}
+	EXPECT_EQ(0, mismatches);
+
+	GridProperties wrong(Vector3d(0.), 10, 7, 9, 1.);
+	EXPECT_THROW(PagedGrid3f("testPagedGrid.raw", wrong), std::runtime_error);
+}
+
+TEST(PagedGrid, prefetch) {
+	// tiles that are not cached are requested once, the values do not change
+	GridProperties properties(Vector3d(1., 2., 3.), 11, 7, 9, 0.5);
+	ref_ptr<Grid3f> grid = new Grid3f(properties);
+	for (int ix = 0; ix < 11; ix++)
+		for (int iy = 0; iy < 7; iy++)
+			for (int iz = 0; iz < 9; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy, iz);
+	dumpGrid(grid, "testPagedGridPrefetch.raw");
+
+	PagedGrid3f paged("testPagedGridPrefetch.raw", properties, 1 << 20, 4);
+	// position of grid point (ix, iy, iz)
+	Vector3d origin = Vector3d(1., 2., 3.) + Vector3d(0.25);
+	paged.prefetch(origin + Vector3d(1, 1, 1) * 0.5);
+	EXPECT_EQ(1, paged.getNumberOfPrefetches());
+	paged.prefetch(origin + Vector3d(2, 3, 0) * 0.5);
+	EXPECT_EQ(1, paged.getNumberOfPrefetches());
+	EXPECT_EQ(grid->get(1, 1, 1), paged.get(1, 1, 1));
+
+	paged.prefetch(origin + Vector3d(9, 5, 8) * 0.5);
+	EXPECT_EQ(2, paged.getNumberOfPrefetches());
+	EXPECT_EQ(grid->get(9, 5, 8), paged.get(9, 5, 8));
+	EXPECT_EQ(2, paged.getNumberOfLoads());
+
+	// cached tiles are not requested
+	paged.get(5, 5, 5);
+	paged.get(0, 0, 0);
+	paged.prefetch(origin + Vector3d(6, 6, 6) * 0.5);
+	EXPECT_EQ(2, paged.getNumberOfPrefetches());
+	std::remove("testPagedGridPrefetch.raw");
+}
+
+TEST(TricubicGrid, interpolate) {
+	// precomputed coefficients give the tricubic interpolation of the grid
+	ref_ptr<Grid1f> grid = new Grid1f(Vector3d(-1, 0, 2), 6, 5, 7, Vector3d(1., 2., 0.5));
+	grid->setInterpolationType(TRICUBIC);
+	Random random(42);
+	for (int ix = 0; ix < 6; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 7; iz++)
+				grid->get(ix, iy, iz) = random.rand() - 0.5;
+
+	for (int reflective = 0; reflective < 2; reflective++) {
+		grid->setReflective(reflective);
+		TricubicGrid1f tricubic(grid);
+		int mismatches = 0;
+		for (int i = 0; i < 1000; i++) {
+			Vector3d p(random.randUniform(-10, 15), random.randUniform(-10, 25), random.randUniform(-5, 10));
+			if (fabs(grid->interpolate(p) - tricubic.interpolate(p)) > 1e-5)
+				mismatches++;
+		}
+		EXPECT_EQ(0, mismatches);
+	}
+
+	grid->setClipVolume(true);
+	TricubicGrid1f clipped(grid);
+	EXPECT_FLOAT_EQ(0, clipped.interpolate(Vector3d(-2, 1, 3)));
+	EXPECT_NEAR(grid->interpolate(Vector3d(1.2, 3, 4)), clipped.interpolate(Vector3d(1.2, 3, 4)), 1e-5);
+
+#ifdef HAVE_SIMD
+	ref_ptr<Grid3f> grid3 = new Grid3f(Vector3d(0.), 5, 1.);
+	grid3->setInterpolationType(TRICUBIC);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 5; iz++)
+				grid3->get(ix, iy, iz) = Vector3f(random.rand(), -random.rand(), ix);
+	TricubicGrid3f tricubic3(grid3);
+	Vector3d p(1.3, 4.9, -0.7);
+	EXPECT_NEAR(0, (grid3->interpolate(p) - tricubic3.interpolate(p)).getR(), 1e-5);
+#endif
+}
+
+TEST(GridTools, gridStatistics) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 9, 5, 7, 1.);
+	Vector3d sum(0.), sum2(0.);
+	double sumR = 0, sumR2 = 0, maxR = 0;
+	for (int ix = 0; ix < 9; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 7; iz++) {
+				Vector3f b(sin(ix * iy + 1.), cos(iz - ix) + 0.5, 0.1 * iy);
+				grid->get(ix, iy, iz) = b;
+				Vector3d bd(b);
+				sum += bd;
+				sum2 += bd * bd;
+				sumR += bd.getR();
+				sumR2 += bd.getR2();
+				maxR = std::max(maxR, bd.getR());
+			}
+	double n = 9 * 5 * 7;
+
+	GridStatistics stats = gridStatistics(grid);
+	EXPECT_NEAR(sum.x / n, stats.meanFieldVector.x, 1e-12);
+	EXPECT_NEAR(sum.y / n, stats.meanFieldVector.y, 1e-12);
+	EXPECT_NEAR(sumR / n, stats.meanFieldStrength, 1e-12);
+	EXPECT_NEAR(sqrt(sumR2 / n), stats.rmsFieldStrength, 1e-12);
+	EXPECT_NEAR(sqrt(sum2.z / n), stats.rmsFieldStrengthPerAxis.z, 1e-12);
+	EXPECT_DOUBLE_EQ(maxR, stats.maxFieldStrength);
+	EXPECT_DOUBLE_EQ(stats.rmsFieldStrength, rmsFieldStrength(grid));
+	EXPECT_FLOAT_EQ(stats.rmsFieldStrengthPerAxis.x, rmsFieldStrengthPerAxis(grid)[0]);
+
+#ifdef _OPENMP
+	// the summation order does not depend on the number of threads
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+	GridStatistics serial = gridStatistics(grid);
+	omp_set_num_threads(threads);
+	EXPECT_EQ(serial.meanFieldStrength, stats.meanFieldStrength);
+	EXPECT_EQ(serial.rmsFieldStrength, stats.rmsFieldStrength);
+#endif
+}
+
 TEST(Grid3f, DumpLoadTxt) {
 	// Dump and load a field grid
 	ref_ptr<Grid3f> grid1 = new Grid3f(Vector3d(0.), 3, 1);
@@ -898,6 +1971,49 @@ TEST(Grid3f, DumpLoadTxt) {
 	}
 }
 
+#ifdef CRPROPA_HAVE_HDF5
+TEST(Grid3f, DumpLoadHDF5) {
+	// the grid properties are restored from the file
+	ref_ptr<Grid3f> grid1 = new Grid3f(Vector3d(1., 2., 3.), 12, 256, 200, Vector3d(0.5, 1., 2.));
+	grid1->setReflective(true);
+	grid1->setInterpolationType(NEAREST_NEIGHBOUR);
+	// several chunks of 5 x-slices
+	for (int ix = 0; ix < 12; ix++)
+		for (int iy = 0; iy < 256; iy++)
+			for (int iz = 0; iz < 200; iz++)
+				grid1->get(ix, iy, iz) = Vector3f(ix, iy * iz, sin(ix + iy + iz));
+	dumpGridToHDF5(grid1, "testDump.h5");
+
+	GridProperties p = loadGridPropertiesFromHDF5("testDump.h5");
+	EXPECT_EQ(12, p.Nx);
+	EXPECT_EQ(200, p.Nz);
+	EXPECT_EQ(Vector3d(0.5, 1., 2.), p.spacing);
+
+	ref_ptr<Grid3f> grid2 = new Grid3f(Vector3d(0.), 1, 1.);
+	loadGridFromHDF5(grid2, "testDump.h5", 2);
+	EXPECT_EQ(256, grid2->getNy());
+	EXPECT_EQ(Vector3d(1., 2., 3.), grid2->getOrigin());
+	EXPECT_TRUE(grid2->isReflective());
+	EXPECT_EQ(NEAREST_NEIGHBOUR, grid2->getInterpolationType());
+	int mismatches = 0;
+	for (int ix = 0; ix < 12; ix++)
+		for (int iy = 0; iy < 256; iy++)
+			for (int iz = 0; iz < 200; iz++)
+				mismatches += !(grid1->get(ix, iy, iz) * 2 == grid2->get(ix, iy, iz));
+	EXPECT_EQ(0, mismatches);
+
+	// uncompressed scalar grid
+	ref_ptr<Grid1f> scalar1 = new Grid1f(Vector3d(0.), 5, 4, 3, 1.);
+	scalar1->get(4, 3, 2) = 7;
+	dumpGridToHDF5(scalar1, "testDump1.h5", 1, 0);
+	ref_ptr<Grid1f> scalar2 = new Grid1f(Vector3d(0.), 1, 1.);
+	loadGridFromHDF5(scalar2, "testDump1.h5");
+	EXPECT_FLOAT_EQ(7, scalar2->get(4, 3, 2));
+	EXPECT_THROW(loadGridFromHDF5(grid2, "testDump1.h5"), std::runtime_error);
+	EXPECT_THROW(loadGridFromHDF5(grid2, "testDump.raw"), std::runtime_error);
+}
+#endif
+
 TEST(Grid3f, Speed) {
 	// Dump and load a field grid
 	Grid3f grid(Vector3d(0.), 3, 3);
@@ -965,6 +2081,55 @@ TEST(EmissionMap, merge) {
 	EXPECT_TRUE(cpm->getPdf()[bin] > 0);
 }
 
+TEST(EmissionMap, parallelFill) {
+	// maps created and filled by several threads at once
+	EmissionMap em(36, 18, 10, 1 * EeV, 100 * EeV);
+	const int n = 20000;
+#pragma omp parallel for
+	for (int i = 0; i < n; i++)
+		em.fillMap(i % 3, (1 + i % 90) * EeV, Vector3d(1, 0, 0), 0.5);
+
+	double sum = 0;
+	EmissionMap::map_t::const_iterator it;
+	for (it = em.getMaps().begin(); it != em.getMaps().end(); it++) {
+		const std::vector<double> &pdf = it->second->getPdf();
+		for (size_t j = 0; j < pdf.size(); j++)
+			sum += pdf[j];
+	}
+	EXPECT_EQ(0.5 * n, sum);
+
+	Vector3d d;
+	EXPECT_TRUE(em.drawDirection(1, 50 * EeV, d));
+	EXPECT_TRUE(d.getAngleTo(Vector3d(1, 0, 0)) < 10 * M_PI / 180);
+}
+
+TEST(EmissionMap, freeze) {
+	EmissionMap em(36, 18, 10, 1 * EeV, 100 * EeV);
+	em.fillMap(1, 10 * EeV, Vector3d(1, 0, 0), 1.);
+	em.fillMap(1, 10 * EeV, Vector3d(0, 1, 0), 3.);
+	em.getMap(2, 10 * EeV); // empty map is removed
+	EXPECT_EQ(1, em.freeze());
+	EXPECT_FALSE(em.hasMap(2, 10 * EeV));
+
+	ref_ptr<CylindricalProjectionMap> cpm = em.findMap(1, 10 * EeV);
+	ASSERT_TRUE(cpm.valid());
+	EXPECT_TRUE(cpm->isFrozen());
+	EXPECT_THROW(cpm->fillBin(Vector3d(1, 0, 0)), std::runtime_error);
+
+	int n = 0;
+	for (int i = 0; i < 4000; i++) {
+		Vector3d d;
+		EXPECT_TRUE(em.drawDirection(1, 10 * EeV, d));
+		if (d.getAngleTo(Vector3d(0, 1, 0)) < 15 * M_PI / 180)
+			n++;
+	}
+	EXPECT_NEAR(3000, n, 150);
+
+	// isotropic density 1 / 4pi, map density 3/4 / (4pi / 648)
+	EXPECT_NEAR(4. / (648 * 3), cpm->getIsotropicWeight(Vector3d(0, 1, 0)), 1e-12);
+	EXPECT_EQ(0, cpm->getIsotropicWeight(Vector3d(0, 0, 1)));
+}
+
 TEST(Variant, copyToBuffer) {
 	double a = 23.42;
 	Variant v(a);
@@ -1060,6 +2225,47 @@ TEST(Geometry, ParaxialBox) {
 	EXPECT_NEAR(8., b.distance(Vector3d(-8., 0., 0.)), 1E-10);
 }
 
+TEST(Geometry, SurfaceCollection) {
+	// spheres on a grid and a plane, compared with checking all surfaces
+	SurfaceCollection c;
+	std::vector<ref_ptr<Surface> > all;
+	for (int i = 0; i < 10; i++)
+		for (int j = 0; j < 10; j++) {
+			ref_ptr<Surface> s = new Sphere(Vector3d(10 * i, 10 * j, 0), 1 + 0.1 * i);
+			c.add(s);
+			all.push_back(s);
+		}
+	ref_ptr<Surface> p = new Plane(Vector3d(0, 0, 50), Vector3d(0, 0, 1));
+	c.add(p);
+	all.push_back(p);
+	EXPECT_EQ(101, c.size());
+
+	Random random(42);
+	for (int k = 0; k < 200; k++) {
+		Vector3d x(random.rand(100), random.rand(100), random.rand(60) - 5);
+		Vector3d y = x + random.randVector() * random.rand(20);
+		double dmin = 1e99, amin = 1e99;
+		std::vector<size_t> crossed;
+		for (size_t i = 0; i < all.size(); i++) {
+			double d = all[i]->distance(x);
+			dmin = std::min(dmin, d);
+			amin = std::min(amin, fabs(d));
+			double e = all[i]->distance(y);
+			if (d * e <= 0 && d != 0)
+				crossed.push_back(i);
+		}
+		EXPECT_DOUBLE_EQ(dmin, c.distance(x));
+		EXPECT_DOUBLE_EQ(amin, c.nearestDistance(x));
+		double a;
+		size_t i = c.nearestSurface(x, a);
+		EXPECT_DOUBLE_EQ(amin, fabs(all[i]->distance(x)));
+		EXPECT_EQ(crossed, c.crossedSurfaces(x, y));
+	}
+
+	Vector3d lower, upper;
+	EXPECT_FALSE(c.getBounds(lower, upper));
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -3,6 +3,7 @@
 #include "crpropa/massDistribution/Ferriere.h"
 #include "crpropa/massDistribution/Nakanishi.h"
 #include "crpropa/massDistribution/ConstantDensity.h"
+#include "crpropa/massDistribution/TabulatedDensity.h"
 #include "crpropa/Units.h"
 #include "crpropa/Grid.h"
 
@@ -292,5 +293,111 @@ TEST(testGridDensity, testRetrunValue) {
 	EXPECT_DOUBLE_EQ(nTotal, valueFromGrid);
 }
 
+TEST(testGridDensity, nestedGrid) {
+	ref_ptr<Grid1f> coarse = new Grid1f(Vector3d(0.), 4, 4, 4, 1.);
+	ref_ptr<Grid1f> fine = new Grid1f(Vector3d(1.), 4, 4, 4, 0.25);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++) {
+				coarse->get(ix, iy, iz) = 1;
+				fine->get(ix, iy, iz) = 3;
+			}
+	ref_ptr<NestedGrid1f> grid = new NestedGrid1f(coarse);
+	grid->addRefinement(fine);
+	DensityGrid dens = DensityGrid(grid, false, false, true);
+
+	EXPECT_DOUBLE_EQ(3, dens.getH2Density(Vector3d(1.5)));
+	EXPECT_DOUBLE_EQ(6, dens.getNucleonDensity(Vector3d(1.5)));
+	EXPECT_DOUBLE_EQ(1, dens.getH2Density(Vector3d(2.5)));
+}
+
+TEST(testTabulatedDensity, cylindrical) {
+	ref_ptr<Ferriere> ferriere = new Ferriere();
+	TabulatedDensity dens(ferriere, 0.01);
+	dens.tabulateCylindrical(20 * kpc, -2 * kpc, 2 * kpc, 81, 36, 81);
+	EXPECT_EQ(81 * 36 * 81, dens.getNumberOfNodes());
+	EXPECT_GT(dens.getExactFraction(), 0);
+	EXPECT_LT(dens.getExactFraction(), 1);
+
+	// interpolated or exact within the error bound
+	Vector3d positions[4] = {Vector3d(-8.5 * kpc, 0, 0), Vector3d(3 * kpc, 4 * kpc, 0.1 * kpc),
+			Vector3d(0.1 * kpc, -0.2 * kpc, 0.05 * kpc), Vector3d(-12 * kpc, 2 * kpc, -0.3 * kpc)};
+	for (int i = 0; i < 4; i++) {
+		Vector3d p = positions[i];
+		EXPECT_NEAR(ferriere->getHIDensity(p), dens.getHIDensity(p), 0.05 * ferriere->getHIDensity(p) + 1e-3 / ccm);
+		EXPECT_NEAR(ferriere->getHIIDensity(p), dens.getHIIDensity(p), 0.05 * ferriere->getHIIDensity(p) + 1e-3 / ccm);
+		EXPECT_NEAR(ferriere->getH2Density(p), dens.getH2Density(p), 0.05 * ferriere->getH2Density(p) + 1e-3 / ccm);
+		EXPECT_NEAR(ferriere->getNucleonDensity(p), dens.getNucleonDensity(p), 0.05 * ferriere->getNucleonDensity(p) + 1e-3 / ccm);
+	}
+
+	// outside of the grid
+	Vector3d far(0, 0, 5 * kpc);
+	EXPECT_DOUBLE_EQ(ferriere->getDensity(far), dens.getDensity(far));
+}
+
+TEST(testTabulatedDensity, cartesianSaveLoad) {
+	ref_ptr<ConstantDensity> constant = new ConstantDensity(2 / ccm, 3 / ccm, 1 / ccm);
+	TabulatedDensity dens(constant);
+	dens.tabulateCartesian(Vector3d(-1 * kpc), Vector3d(2 * kpc), 3, 3, 3);
+	EXPECT_EQ(0, dens.getExactFraction());
+	Vector3d p(0.3 * kpc, -0.1 * kpc, 0.7 * kpc);
+	EXPECT_NEAR(2e6, dens.getHIDensity(p), 1e-6 * 2e6);
+	EXPECT_NEAR(7e6, dens.getNucleonDensity(p), 1e-6 * 7e6);
+	EXPECT_EQ(constant->getIsForHI(), dens.getIsForHI());
+
+	dens.save("testTabulatedDensity.bin");
+	ref_ptr<ConstantDensity> other = new ConstantDensity(0, 0, 0);
+	TabulatedDensity loaded(other);
+	loaded.load("testTabulatedDensity.bin");
+	EXPECT_EQ(27, loaded.getNumberOfNodes());
+	EXPECT_NEAR(3e6, loaded.getHIIDensity(p), 1e-6 * 3e6);
+	EXPECT_THROW(loaded.load("nonexistent.bin"), std::runtime_error);
+}
+
+TEST(testDensity, getDensities) {
+	// the combined query equals the single queries for every model
+	ref_ptr<Ferriere> ferriere = new Ferriere();
+	ferriere->setIsForHII(false);
+	ref_ptr<Nakanishi> nakanishi = new Nakanishi();
+	nakanishi->setIsForH2(false);
+	ref_ptr<DensityList> list = new DensityList();
+	list->addDensity(new Ferriere());
+	list->addDensity(new Cordes());
+	list->addDensity(new ConstantDensity(1, 2, 3));
+	ref_ptr<Grid1f> grid = new Grid1f(Vector3d(-10 * kpc), 10, 10, 10, 2 * kpc);
+	grid->get(5, 5, 5) = 7;
+	ref_ptr<DensityGrid> densityGrid = new DensityGrid(grid, true, false, true);
+	ref_ptr<TabulatedDensity> tabulated = new TabulatedDensity(new Ferriere(), 0.01);
+	tabulated->tabulateCylindrical(20 * kpc, -2 * kpc, 2 * kpc, 41, 18, 41);
+
+	ref_ptr<Density> models[6] = {ferriere, nakanishi, new Cordes(), list, densityGrid, tabulated};
+	Vector3d positions[4] = {Vector3d(-8.5 * kpc, 0, 0), Vector3d(0.1 * kpc, -0.2 * kpc, 0.05 * kpc),
+			Vector3d(1 * kpc, 1.5 * kpc, 0.01 * kpc), Vector3d(-12 * kpc, 2 * kpc, -3 * kpc)};
+	for (int m = 0; m < 6; m++) {
+		for (int i = 0; i < 4; i++) {
+			Vector3d p = positions[i];
+			DensityValues n = models[m]->getDensities(p);
+			EXPECT_DOUBLE_EQ(models[m]->getHIDensity(p), n.HI);
+			EXPECT_DOUBLE_EQ(models[m]->getHIIDensity(p), n.HII);
+			EXPECT_DOUBLE_EQ(models[m]->getH2Density(p), n.H2);
+			EXPECT_DOUBLE_EQ(models[m]->getDensity(p), n.total);
+			EXPECT_DOUBLE_EQ(models[m]->getNucleonDensity(p), n.nucleon);
+		}
+	}
+}
+
+TEST(testDensity, getDensitiesAt) {
+	Ferriere ferriere;
+	const size_t n = 100;
+	std::vector<double> xyz(3 * n), out(n);
+	for (size_t i = 0; i < n; i++) {
+		xyz[3 * i] = (i * 0.2 - 10) * kpc;
+		xyz[3 * i + 1] = sin(i) * kpc;
+		xyz[3 * i + 2] = cos(i) * 0.1 * kpc;
+	}
+	ferriere.getDensitiesAt(&xyz[0], &out[0], n);
+	for (size_t i = 0; i < n; i++)
+		EXPECT_DOUBLE_EQ(ferriere.getDensity(Vector3d(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2])), out[i]);
+}
 
 } //namespace crpropa
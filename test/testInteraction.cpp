@@ -2,17 +2,24 @@
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
+#include "crpropa/Source.h"
 #include "crpropa/module/ElectronPairProduction.h"
 #include "crpropa/module/NuclearDecay.h"
 #include "crpropa/module/PhotoDisintegration.h"
 #include "crpropa/module/ElasticScattering.h"
 #include "crpropa/module/PhotoPionProduction.h"
 #include "crpropa/module/Redshift.h"
+#include "crpropa/Cosmology.h"
 #include "crpropa/module/EMPairProduction.h"
 #include "crpropa/module/EMDoublePairProduction.h"
 #include "crpropa/module/EMTripletPairProduction.h"
 #include "crpropa/module/EMInverseComptonScattering.h"
 #include "crpropa/module/SynchrotronRadiation.h"
+#include "crpropa/module/InteractionManager.h"
+#include "crpropa/module/EMCascade.h"
+#include "crpropa/InteractionTables.h"
+#include "crpropa/DataTable.h"
 #include "gtest/gtest.h"
 
 #include <fstream>
@@ -44,6 +51,67 @@ TEST(ElectronPairProduction, allBackgrounds) {
 	epp.setPhotonField(irb);
 }
 
+// TabularPhotonField ---------------------------------------------------------
+class TabularFieldReference: public IRB_Kneiske04 {
+public:
+	double reference(double E, double z) const {
+		return interpolate2d(E, z, photonEnergies, redshifts, photonDensity);
+	}
+};
+
+TEST(TabularPhotonField, indexedInterpolation) {
+	// the indexed lookup on redshift slices agrees with interpolate2d
+	double tolerance = RedshiftCache::getTolerance();
+	RedshiftCache::setTolerance(0);
+	TabularFieldReference field;
+	double Emin = field.getMinimumPhotonEnergy(0);
+	double Emax = field.getMaximumPhotonEnergy(0);
+	for (int j = 0; j < 5; j++) {
+		double z = 0.37 * j;
+		for (int i = 0; i <= 100; i++) {
+			double E = Emin * pow(Emax / Emin, i / 100.);
+			if (i == 100)
+				E = Emax * (1 - 1e-15);
+			double n = field.reference(E, z);
+			EXPECT_NEAR(n, field.getPhotonDensity(E, z), 1e-12 * n);
+		}
+	}
+	EXPECT_DOUBLE_EQ(0, field.getPhotonDensity(0.5 * Emin, 0));
+	EXPECT_DOUBLE_EQ(0, field.getPhotonDensity(2 * Emax, 0));
+	RedshiftCache::setTolerance(tolerance);
+}
+
+TEST(TabularPhotonField, fromTables) {
+	// n ~ E^-1 at z = 0 and twice as dense at z = 1
+	std::vector<double> energies, densities, redshifts;
+	for (int i = 0; i < 10; i++)
+		energies.push_back(pow(10, i) * eV);
+	for (int i = 0; i < 10; i++)
+		for (int j = 0; j < 2; j++)
+			densities.push_back((j + 1) * eV / energies[i]);
+	redshifts.push_back(0);
+	redshifts.push_back(1);
+
+	TabularPhotonField field("testField", energies, densities, redshifts);
+	EXPECT_EQ("testField", field.getFieldName());
+	EXPECT_TRUE(field.hasRedshiftDependence());
+	EXPECT_EQ(energies, field.getPhotonEnergies());
+	EXPECT_EQ(densities, field.getPhotonDensities());
+	EXPECT_DOUBLE_EQ(1, field.getPhotonDensity(1 * eV, 0));
+	EXPECT_DOUBLE_EQ(2, field.getPhotonDensity(1 * eV, 1));
+	EXPECT_DOUBLE_EQ(2, field.getRedshiftScaling(1));
+
+	std::vector<double> staticDensities;
+	for (int i = 0; i < 10; i++)
+		staticDensities.push_back(densities[2 * i]);
+	TabularPhotonField staticField("testField", energies, staticDensities, std::vector<double>());
+	EXPECT_FALSE(staticField.hasRedshiftDependence());
+	EXPECT_DOUBLE_EQ(0.1, staticField.getPhotonDensity(10 * eV));
+
+	staticDensities.pop_back();
+	EXPECT_THROW(TabularPhotonField("testField", energies, staticDensities, std::vector<double>()), std::runtime_error);
+}
+
 TEST(ElectronPairProduction, energyDecreasing) {
 	// Test if energy loss occurs for protons with energies from 1e15 - 1e23 eV.
 	Candidate c;
@@ -69,6 +137,37 @@ TEST(ElectronPairProduction, energyDecreasing) {
 	}
 }
 
+TEST(ElectronPairProduction, exactLoss) {
+	// The energy after a step from the range function agrees with the linear
+	// loss for small steps and two half steps give the same as one full step.
+	ref_ptr<PhotonField> cmb = new CMB();
+	ElectronPairProduction epp(cmb);
+	int id = nucleusId(1, 1);
+	for (int i = 0; i < 8; i++) {
+		double lf = pow(10, 10 + i * 0.4);
+		double z = 0.1 * i;
+		double L = epp.lossLength(id, lf, z);
+		double lf1 = epp.lorentzFactorAfter(id, lf, z, 1e-4 * L);
+		EXPECT_NEAR(1 - lf1 / lf, 1e-4, 1e-5);
+
+		double lf2 = epp.lorentzFactorAfter(id, lf, z, 2 * L);
+		double lf3 = epp.lorentzFactorAfter(id, epp.lorentzFactorAfter(id, lf, z, L), z, L);
+		EXPECT_NEAR(lf2, lf3, 1e-6 * lf2);
+		EXPECT_LT(lf2, lf);
+	}
+
+	// the process uses the range function
+	epp.setExactLoss(true);
+	EXPECT_TRUE(epp.getExactLoss());
+	Candidate c(id, 1 * EeV);
+	double lf = c.current.getLorentzFactor();
+	double step = 5 * epp.lossLength(id, lf, 0);
+	c.setCurrentStep(step);
+	epp.process(&c);
+	EXPECT_NEAR(c.current.getLorentzFactor(), epp.lorentzFactorAfter(id, lf, 0, step), 1e-9 * lf);
+	EXPECT_GT(c.current.getEnergy(), 0);
+}
+
 TEST(ElectronPairProduction, belowEnergyTreshold) {
 	// Test if nothing happens below 1e15 eV.
 	ref_ptr<PhotonField> cmb = new CMB();
@@ -144,6 +243,27 @@ TEST(ElectronPairProduction, interactionTag) {
 	EXPECT_TRUE(secondaryTag == "myTag");
 }
 
+TEST(ElectronPairProduction, packets) {
+	// aggregated pairs: one weighted pair per bin, conserving the energy on average
+	ref_ptr<PhotonField> cmb = new CMB();
+	ElectronPairProduction epp(cmb, true);
+	epp.setPacketBins(17);
+	EXPECT_EQ(17, epp.getPacketBins());
+	EXPECT_THROW(epp.setPacketBins(-1), std::runtime_error);
+
+	double Eloss = 0, Epairs = 0;
+	for (int i = 0; i < 100; i++) {
+		Candidate c(nucleusId(1, 1), 100 * EeV);
+		c.setCurrentStep(10 * Mpc);
+		epp.process(&c);
+		EXPECT_GE(34, c.secondaries.size());
+		Eloss += 100 * EeV - c.current.getEnergy();
+		for (size_t j = 0; j < c.secondaries.size(); j++)
+			Epairs += c.secondaries[j]->getWeight() * c.secondaries[j]->current.getEnergy();
+	}
+	EXPECT_NEAR(1, Epairs / Eloss, 0.05);
+}
+
 TEST(ElectronPairProduction, valuesIRB) {
 	// Test if energy loss corresponds to the data table.
 	std::vector<double> x;
@@ -238,8 +358,10 @@ TEST(NuclearDecay, limitNextStep) {
 	NuclearDecay decay;
 	Candidate c(nucleusId(1, 0), 10 * EeV);
 	c.setNextStep(std::numeric_limits<double>::max());
+	double limit = decay.getStepLimit(&c); // estimate before the step
 	decay.process(&c);
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
+	EXPECT_DOUBLE_EQ(limit, c.getNextStep());
 }
 
 TEST(NuclearDecay, allChannelsWorking) {
@@ -321,6 +443,23 @@ TEST(NuclearDecay, interactionTag) {
 	EXPECT_TRUE(decay.getInteractionTag() == "myTag");
 }
 
+TEST(NuclearDecay, preload) {
+	// Test that the decay modes are loaded on first use or on request
+	NuclearDecay decay;
+	EXPECT_FALSE(decay.isLoaded(nucleusId(44, 21)));
+	Candidate c(nucleusId(44, 21), 1 * EeV);
+	c.setCurrentStep(1 * Mpc);
+	decay.process(&c);
+	EXPECT_TRUE(decay.isLoaded(nucleusId(44, 21)));
+
+	SourceComposition composition(1 * EeV, 100 * EeV, -1);
+	composition.add(nucleusId(4, 2), 1);
+	decay.preload(composition);
+	EXPECT_TRUE(decay.isLoaded(nucleusId(4, 2)));
+	EXPECT_TRUE(decay.isLoaded(nucleusId(3, 1)));
+	EXPECT_FALSE(decay.isLoaded(nucleusId(12, 6)));
+}
+
 // PhotoDisintegration --------------------------------------------------------
 TEST(PhotoDisintegration, allBackgrounds) {
 	// Test if interaction data files are loaded.
@@ -447,8 +586,10 @@ TEST(PhotoDisintegration, limitNextStep) {
 	c.setNextStep(std::numeric_limits<double>::max());
 	c.current.setId(nucleusId(4, 2));
 	c.current.setEnergy(200 * EeV);
+	double limit = pd.getStepLimit(&c); // estimate before the step
 	pd.process(&c);
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
+	EXPECT_DOUBLE_EQ(limit, c.getNextStep());
 }
 
 TEST(PhotoDisintegration, allIsotopes) {
@@ -474,6 +615,28 @@ TEST(PhotoDisintegration, allIsotopes) {
 	}
 }
 
+TEST(PhotoDisintegration, preload) {
+	// Test that the tables of a nucleus are loaded on first use or on request
+	PhotoDisintegration pd(new CMB());
+	EXPECT_FALSE(pd.isLoaded(nucleusId(56, 26)));
+	Candidate c(nucleusId(56, 26), 100 * EeV);
+	pd.getStepLimit(&c);
+	EXPECT_TRUE(pd.isLoaded(nucleusId(56, 26)));
+	EXPECT_FALSE(pd.isLoaded(nucleusId(12, 6)));
+
+	SourceComposition composition(1 * EeV, 100 * EeV, -1);
+	composition.add(nucleusId(12, 6), 1);
+	pd.preload(composition);
+	EXPECT_TRUE(pd.isLoaded(nucleusId(12, 6)));
+	EXPECT_TRUE(pd.isLoaded(nucleusId(4, 2)));
+	EXPECT_FALSE(pd.isLoaded(nucleusId(16, 8)));
+
+	// loading on demand gives the same rates
+	PhotoDisintegration pd2(new CMB());
+	pd2.preload(nucleusId(12, 6));
+	EXPECT_DOUBLE_EQ(pd.lossLength(nucleusId(12, 6), 1e10), pd2.lossLength(nucleusId(12, 6), 1e10));
+}
+
 TEST(Photodisintegration, updateParticleParentProperties) { // Issue: #204
 	ref_ptr<PhotonField> cmb = new CMB();
 	PhotoDisintegration pd(cmb);
@@ -624,8 +787,10 @@ TEST(PhotoPionProduction, limitNextStep) {
 	PhotoPionProduction ppp(cmb);
 	Candidate c(nucleusId(1, 1), 200 * EeV);
 	c.setNextStep(std::numeric_limits<double>::max());
+	double limit = ppp.getStepLimit(&c); // estimate before the step
 	ppp.process(&c);
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
+	EXPECT_DOUBLE_EQ(limit, c.getNextStep());
 }
 
 TEST(PhotoPionProduction, secondaries) {
@@ -656,6 +821,75 @@ TEST(PhotoPionProduction, sampling) {
 	EXPECT_DOUBLE_EQ(pEpsMax,132673934934.922);
 }
 
+TEST(PhotoPionProduction, threads) {
+	// SOPHIA events run concurrently and draw from the generator of their thread:
+	// the same seed gives the same event in parallel as in serial
+	PhotoPionProduction ppp(new CMB());
+	const int n = 8;
+	std::vector<std::vector<double> > serial(n), parallel(n);
+	for (int i = 0; i < n; i++) {
+		Random::instance().seed(i + 1);
+		for (int j = 0; j < 100; j++)
+			serial[i].push_back(ppp.sophiaEvent(true, 100 * EeV, 1e-3 * eV).energy[0]);
+	}
+#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Random::instance().seed(i + 1);
+		for (int j = 0; j < 100; j++)
+			parallel[i].push_back(ppp.sophiaEvent(true, 100 * EeV, 1e-3 * eV).energy[0]);
+	}
+	for (int i = 0; i < n; i++)
+		EXPECT_TRUE(serial[i] == parallel[i]);
+}
+
+TEST(PhotoPionProduction, eventLibrary) {
+	// Interactions are drawn from a library of SOPHIA events.
+	PhotoPionProduction ppp(new CMB(), true, true, true);
+	ref_ptr<SophiaEventLibrary> library = ppp.createEventLibrary(10, 1e19 * eV, 1e21 * eV, 2);
+	EXPECT_TRUE(library->isComplete());
+	library->save("sophia_library.bin");
+	ref_ptr<SophiaEventLibrary> loaded = new SophiaEventLibrary("sophia_library.bin");
+	EXPECT_EQ("CMB", loaded->getFieldName());
+	EXPECT_EQ(2, loaded->getNumberOfBins());
+	EXPECT_EQ(10, loaded->getEventsPerBin());
+	EXPECT_DOUBLE_EQ(1e20 * eV, loaded->getBinEdge(1));
+
+	// the loaded events are the same
+	for (int i = 0; i < 10; i++) {
+		const int8_t *id1, *id2;
+		const float *x1, *x2;
+		Random::instance().seed(i);
+		int n1 = library->sample(true, 5e19 * eV, id1, x1);
+		Random::instance().seed(i);
+		int n2 = loaded->sample(true, 5e19 * eV, id2, x2);
+		EXPECT_EQ(n1, n2);
+		for (int j = 0; j < n1; j++) {
+			EXPECT_EQ(id1[j], id2[j]);
+			EXPECT_EQ(x1[j], x2[j]);
+		}
+	}
+	const int8_t *id;
+	const float *x;
+	EXPECT_EQ(-1, loaded->sample(true, 2e21 * eV, id, x));
+
+	// the energy of the products does not exceed the nucleon energy
+	ppp.setEventLibrary(loaded);
+	for (int i = 0; i < 10; i++) {
+		Candidate c(nucleusId(1, 1), 100 * EeV);
+		ppp.performInteraction(&c, true);
+		double E = c.current.getEnergy();
+		for (size_t j = 0; j < c.secondaries.size(); j++)
+			E += c.secondaries[j]->current.getEnergy();
+		EXPECT_LT(c.current.getEnergy(), 100 * EeV);
+		EXPECT_LT(E, 100 * EeV * (1 + 1e-6));
+	}
+
+	// the library has to match the photon field
+	PhotoPionProduction ppp2(new IRB_Gilmore12());
+	EXPECT_THROW(ppp2.setEventLibrary(loaded), std::runtime_error);
+	remove("sophia_library.bin");
+}
+
 TEST(PhotoPionProduction, interactionTag) {
 	PhotoPionProduction ppp(new CMB());
 
@@ -701,6 +935,20 @@ TEST(Redshift, limitRedshiftDecrease) {
 	EXPECT_DOUBLE_EQ(0, c.getRedshift());
 }
 
+TEST(Redshift, longStep) {
+	// Test if long steps use the comoving distance.
+	Redshift redshift;
+
+	Candidate c;
+	c.setRedshift(1);
+	c.current.setEnergy(100 * EeV);
+	c.setCurrentStep(redshift2ComovingDistance(1) - redshift2ComovingDistance(0.5));
+
+	redshift.process(&c);
+	EXPECT_NEAR(0.5, c.getRedshift(), 1e-6);
+	EXPECT_NEAR(75, c.current.getEnergy() / EeV, 1e-4);
+}
+
 // EMPairProduction -----------------------------------------------------------
 TEST(EMPairProduction, allBackgrounds) {
 	// Test if interaction data files are loaded.
@@ -738,8 +986,10 @@ TEST(EMPairProduction, limitNextStep) {
 	EMPairProduction m(cmb);
 	Candidate c(22, 1E17 * eV);
 	c.setNextStep(std::numeric_limits<double>::max());
+	double limit = m.getStepLimit(&c); // estimate before the step
 	m.process(&c);
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
+	EXPECT_DOUBLE_EQ(limit, c.getNextStep());
 }
 
 TEST(EMPairProduction, secondaries) {
@@ -1144,6 +1394,183 @@ TEST(SynchrotronRadiation, interactionTag) {
 	EXPECT_TRUE(s.getInteractionTag() == "myTag");
 }
 
+TEST(SynchrotronRadiation, exactLoss) {
+	// dE/dx ~ E^2 integrated: two half steps give the same as one full step
+	SynchrotronRadiation s(1 * muG);
+	s.setExactLoss(true);
+	EXPECT_TRUE(s.getExactLoss());
+	Candidate c1(11, 1 * EeV);
+	c1.setCurrentStep(20 * pc);
+	s.process(&c1);
+	Candidate c2(11, 1 * EeV);
+	c2.setCurrentStep(10 * pc);
+	s.process(&c2);
+	s.process(&c2);
+	EXPECT_LT(c1.current.getEnergy(), 1 * EeV);
+	EXPECT_GT(c1.current.getEnergy(), 0);
+	EXPECT_NEAR(c1.current.getEnergy(), c2.current.getEnergy(), 1e-6 * c1.current.getEnergy());
+}
+
+TEST(SynchrotronRadiation, packets) {
+	// aggregated emission: one weighted photon per bin, conserving the energy on average
+	SynchrotronRadiation s(1 * muG, true);
+	s.setSecondaryThreshold(0);
+	s.setPacketBins(16);
+	EXPECT_EQ(16, s.getPacketBins());
+	EXPECT_THROW(s.setPacketBins(-1), std::runtime_error);
+
+	double Eloss = 0, Ephotons = 0;
+	for (int i = 0; i < 200; i++) {
+		Candidate c(11, 10 * TeV);
+		c.setCurrentStep(10 * pc);
+		s.process(&c);
+		EXPECT_GE(16, c.secondaries.size());
+		Eloss += 10 * TeV - c.current.getEnergy();
+		for (size_t j = 0; j < c.secondaries.size(); j++)
+			Ephotons += c.secondaries[j]->getWeight() * c.secondaries[j]->current.getEnergy();
+	}
+	EXPECT_NEAR(1, Ephotons / Eloss, 0.05);
+}
+
+// InteractionManager ---------------------------------------------------------
+class ConstantRateInteraction: public Module {
+public:
+	double rate;
+	mutable int count;
+	ConstantRateInteraction(double rate) : rate(rate), count(0) {
+	}
+	void process(Candidate *candidate) const {
+	}
+	double getInteractionRate(const Candidate *candidate) const {
+		return rate;
+	}
+	void interact(Candidate *candidate) const {
+		count++;
+	}
+};
+
+TEST(InteractionManager, competingRates) {
+	ref_ptr<ConstantRateInteraction> m1 = new ConstantRateInteraction(1 / Mpc);
+	ref_ptr<ConstantRateInteraction> m2 = new ConstantRateInteraction(3 / Mpc);
+	InteractionManager manager;
+	manager.add(m1);
+	manager.add(m2);
+	EXPECT_EQ(2, manager.size());
+	EXPECT_DOUBLE_EQ(4 / Mpc, manager.getInteractionRate(0));
+	EXPECT_DOUBLE_EQ(0.1 * Mpc / 4, manager.getStepLimit(0));
+	EXPECT_EQ(0, manager.select(0, 0.2));
+	EXPECT_EQ(1, manager.select(0, 0.3));
+
+	// the number of interactions follows the total rate, the channels the partial rates
+	Candidate c(nucleusId(1, 1), 1 * EeV);
+	c.setCurrentStep(1000 * Mpc);
+	c.setNextStep(std::numeric_limits<double>::max());
+	manager.process(&c);
+	EXPECT_NEAR(4000, m1->count + m2->count, 300);
+	EXPECT_NEAR(0.25, m1->count / double(m1->count + m2->count), 0.03);
+	EXPECT_DOUBLE_EQ(0.1 * Mpc / 4, c.getNextStep());
+
+	// nothing happens without interaction rates
+	InteractionManager empty;
+	empty.add(new ConstantRateInteraction(0));
+	Candidate c2(nucleusId(1, 1), 1 * EeV);
+	c2.setCurrentStep(1 * Mpc);
+	c2.setNextStep(1 * Mpc);
+	empty.process(&c2);
+	EXPECT_DOUBLE_EQ(1 * Mpc, c2.getNextStep());
+}
+
+// InteractionTables ----------------------------------------------------------
+TEST(InteractionTables, rates) {
+	ref_ptr<PhotonField> cmb = new CMB();
+	// Thomson limit of inverse Compton scattering: sigma_T n_CMB with 411 photons / cm^3
+	double rate = InteractionTables::computeRate("EMInverseComptonScattering", cmb, 1 * GeV);
+	EXPECT_NEAR(sigma_thomson * 411 / ccm, rate, 0.01 * rate);
+	// pair production has a threshold, photo-pion production its GZK suppression
+	EXPECT_DOUBLE_EQ(0, InteractionTables::computeRate("EMPairProduction", cmb, 1e12 * eV));
+	EXPECT_GT(InteractionTables::computeRate("EMPairProduction", cmb, 1e15 * eV), 0);
+	double lambda = 1 / InteractionTables::computeRate("PhotoPionProduction", cmb, 1e21 * eV);
+	EXPECT_GT(lambda, 2 * Mpc);
+	EXPECT_LT(lambda, 8 * Mpc);
+	EXPECT_THROW(InteractionTables::computeRate("NuclearDecay", cmb, 1 * EeV), std::runtime_error);
+}
+
+TEST(InteractionTables, generatedTables) {
+	// a photon field without data files, tables computed into the cache
+	ref_ptr<BlackbodyPhotonField> field = new BlackbodyPhotonField("CustomBlackbody", 10 * kelvin);
+	std::string cache = "InteractionTables_test";
+	InteractionTables::setCacheDirectory(cache);
+	InteractionTables::setGenerationEnabled(true);
+	std::string rateFile = InteractionTables::getTable("EMInverseComptonScattering", "rate", field);
+	std::string cdfFile = InteractionTables::getTable("EMInverseComptonScattering", "cdf", field);
+	EXPECT_EQ(InteractionTables::cacheFilename("EMInverseComptonScattering", "rate", field), rateFile);
+	EMInverseComptonScattering ics(field);
+	field->setFieldName("OtherBlackbody");
+	EXPECT_NE(rateFile, InteractionTables::cacheFilename("EMInverseComptonScattering", "rate", field));
+
+	// the module rates agree with the integration
+	field->setFieldName("CustomBlackbody");
+	Candidate c(11, 10 * GeV);
+	double rate = InteractionTables::computeRate("EMInverseComptonScattering", field, 10 * GeV);
+	EXPECT_NEAR(rate, ics.getInteractionRate(&c), 1e-4 * rate);
+
+	InteractionTables::setGenerationEnabled(false);
+	InteractionTables::setCacheDirectory("");
+	std::remove(rateFile.c_str());
+	std::remove(cdfFile.c_str());
+	std::remove(DataTable::binaryFilename(rateFile).c_str());
+	std::remove(DataTable::binaryFilename(cdfFile).c_str());
+	std::remove((cache + "/EMInverseComptonScattering").c_str());
+	std::remove(cache.c_str());
+}
+
+// EMCascade -----------------------------------------------------------------
+class PhotonConversion: public Module {
+public:
+	double rate;
+	PhotonConversion(double rate) : rate(rate) {
+	}
+	void process(Candidate *candidate) const {
+	}
+	double getInteractionRate(const Candidate *candidate) const {
+		return (candidate->current.getId() == 22) ? rate : 0;
+	}
+	void interact(Candidate *candidate) const {
+		candidate->setActive(false);
+		candidate->addSecondary(11, candidate->current.getEnergy() / 10);
+	}
+};
+
+TEST(EMCascade, conversion) {
+	// 10 energy bins per decade, distance bins of 0.5 Mpc
+	EMCascade cascade(1 * GeV, 1000 * EeV, 120, 100 * Mpc, 0.5 * Mpc);
+	cascade.add(new PhotonConversion(0.1 / Mpc));
+	cascade.setSamples(100);
+	EXPECT_DOUBLE_EQ(0.1 / Mpc, cascade.getRate(22, 50));
+	EXPECT_DOUBLE_EQ(0, cascade.getRate(-11, 50));
+
+	// photons are collected and deactivated, nuclei are left alone
+	Candidate c(22, cascade.getEnergy(100), Vector3d(10.25 * Mpc, 0, 0));
+	c.setWeight(2);
+	cascade.process(&c);
+	EXPECT_FALSE(c.isActive());
+	Candidate p(nucleusId(1, 1), 1 * EeV, Vector3d(10.25 * Mpc, 0, 0));
+	cascade.process(&p);
+	EXPECT_TRUE(p.isActive());
+
+	// photons convert to electrons of a tenth of their energy over 10 Mpc
+	cascade.run();
+	std::vector<double> photons = cascade.getSpectrum(22);
+	std::vector<double> electrons = cascade.getSpectrum(11);
+	EXPECT_NEAR(2 * exp(-1.025), photons[100], 0.05);
+	EXPECT_NEAR(2 * (1 - exp(-1.025)), electrons[90], 0.05);
+	EXPECT_NEAR(2, photons[100] + electrons[90], 1e-9);
+
+	cascade.clear();
+	cascade.run();
+	EXPECT_DOUBLE_EQ(0, cascade.getSpectrum(22)[100]);
+	EXPECT_THROW(cascade.inject(22, 1 * EeV, 200 * Mpc), std::runtime_error);
+}
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
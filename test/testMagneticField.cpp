@@ -1,11 +1,17 @@
 #include <stdexcept>
 
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/CachedMagneticField.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/JF12FieldSolenoidal.h"
 #include "crpropa/magneticField/CMZField.h"
 #include "crpropa/magneticField/PolarizedSingleModeMagneticField.h"
+#include "crpropa/magneticField/ProfiledMagneticField.h"
 #include "crpropa/magneticField/GalacticMagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/GridTools.h"
 #include "crpropa/Units.h"
+#include "crpropa/Random.h"
 #include "crpropa/Common.h"
 
 #include "gtest/gtest.h"
@@ -55,6 +61,121 @@ TEST(testMagneticFieldList, SimpleTest) {
 	EXPECT_DOUBLE_EQ(b.z, 3);
 }
 
+TEST(testMagneticFieldList, freeze) {
+	// nested lists and evolutions, with fields depending on the position
+	ref_ptr<MagneticFieldList> inner = new MagneticFieldList();
+	inner->addField(new UniformMagneticField(Vector3d(0, 2, 0)));
+	inner->addField(new MagneticDipoleField(Vector3d(1, 0, 0), Vector3d(0, 0, 1), 0.1));
+	MagneticFieldList B;
+	B.addField(new UniformMagneticField(Vector3d(1, 0, 0)));
+	B.addField(new MagneticFieldEvolution(inner, 2));
+	B.addField(new MagneticFieldEvolution(new MagneticFieldEvolution(
+			new UniformMagneticField(Vector3d(0, 0, 3)), 1), 1));
+	B.addField(new MagneticDipoleField(Vector3d(0, 1, 0), Vector3d(1, 0, 0), 0.1));
+
+	Vector3d positions[3] = {Vector3d(0.), Vector3d(1, 2, 3), Vector3d(-2, 0.5, 1)};
+	double z = 0.5;
+	Vector3d expected[3], fields[3];
+	for (int i = 0; i < 3; i++)
+		expected[i] = B.getField(positions[i], z);
+	// the uniform fields scale with (1+z)^2, the dipoles are small in comparison
+	EXPECT_NEAR(expected[0].y - B.getField(positions[0], 0).y, 2 * (1.5 * 1.5 - 1), 1e-6);
+	EXPECT_NEAR(expected[0].z - B.getField(positions[0], 0).z, 3 * (1.5 * 1.5 - 1), 1e-6);
+
+	B.freeze();
+	EXPECT_TRUE(B.isFrozen());
+	// the uniform fields with evolution 0 and 2 (2 fields), and both dipoles
+	EXPECT_EQ(B.getNumberOfTerms(), 4);
+	B.getFields(positions, fields, 3, z);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_NEAR(B.getField(positions[i], z).getDistanceTo(expected[i]), 0, 1e-12);
+		EXPECT_NEAR(fields[i].getDistanceTo(expected[i]), 0, 1e-12);
+	}
+
+	B.addField(new UniformMagneticField(Vector3d(1, 0, 0)));
+	EXPECT_FALSE(B.isFrozen());
+	EXPECT_NEAR(B.getField(positions[1], z).x, expected[1].x + 1, 1e-12);
+}
+
+TEST(testMagneticFieldList, boundedTerms) {
+	// localised dipoles, a clipped grid and a uniform field restricted to a box
+	MagneticFieldList B;
+	B.addField(new UniformMagneticField(Vector3d(1, 0, 0)));
+	ref_ptr<MagneticFieldList> dipoles = new MagneticFieldList();
+	for (int i = 0; i < 20; i++) {
+		Vector3d origin(i, 0.5 * i, 0);
+		dipoles->addField(new BoundedMagneticField(
+				new MagneticDipoleField(origin, Vector3d(0, 0, 1e6), 0.1), origin - 1, origin + 1));
+	}
+	B.addField(new MagneticFieldEvolution(dipoles, 1));
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-2.), 4, 1);
+	grid->setClipVolume(true);
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			for (int k = 0; k < 4; k++)
+				grid->get(i, j, k) = Vector3f(i, j, k);
+	B.addField(new MagneticFieldGrid(grid));
+	B.addField(new BoundedMagneticField(new UniformMagneticField(Vector3d(0, 0, 5)),
+			Vector3d(10, 0, -1), Vector3d(12, 8, 1)));
+
+	Vector3d lower, upper;
+	EXPECT_FALSE(B.getBoundingBox(lower, upper));
+	EXPECT_TRUE(dipoles->getBoundingBox(lower, upper));
+	EXPECT_DOUBLE_EQ(lower.x, -1);
+	EXPECT_DOUBLE_EQ(upper.y, 10.5);
+
+	Random random(7);
+	std::vector<Vector3d> positions(200), expected(200), fields(200);
+	for (size_t i = 0; i < positions.size(); i++) {
+		positions[i] = Vector3d(random.randUniform(-3, 22), random.randUniform(-3, 12), random.randUniform(-3, 3));
+		expected[i] = B.getField(positions[i], 0.5);
+	}
+
+	B.freeze();
+	EXPECT_EQ(B.getNumberOfTerms(), 23);
+	EXPECT_EQ(B.getNumberOfBoundedTerms(), 22);
+	B.getFields(positions.data(), fields.data(), positions.size(), 0.5);
+	for (size_t i = 0; i < positions.size(); i++) {
+		EXPECT_NEAR(B.getField(positions[i], 0.5).getDistanceTo(expected[i]), 0, 1e-12);
+		EXPECT_NEAR(fields[i].getDistanceTo(expected[i]), 0, 1e-12);
+	}
+}
+
+TEST(testProfiledMagneticField, counters) {
+	ref_ptr<MagneticField> uniform = new UniformMagneticField(Vector3d(1, 0, 0));
+	ref_ptr<ProfiledMagneticField> field = new ProfiledMagneticField(uniform, "uniform");
+	std::vector<ProfiledMagneticField *> fields = MagneticFieldProfile::getFields();
+	ASSERT_EQ(1u, fields.size());
+	EXPECT_EQ(field.get(), fields[0]);
+
+	// calls from several threads and positions of getFields count one each
+#pragma omp parallel for
+	for (int i = 0; i < 100; i++)
+		EXPECT_DOUBLE_EQ(1, field->getField(Vector3d(i, 0, 0), 0.1).x);
+	Vector3d positions[10], b[10];
+	field->getFields(positions, b, 10, 0);
+	EXPECT_DOUBLE_EQ(1, b[9].x);
+	EXPECT_EQ(110u, field->getCalls());
+	EXPECT_GT(field->getTime(), 0);
+
+	std::string csv = MagneticFieldProfile::getCSV(55);
+	EXPECT_NE(std::string::npos, csv.find("uniform,110,"));
+	EXPECT_NE(std::string::npos, csv.find(",2\n"));
+	std::string json = MagneticFieldProfile::getJSON();
+	EXPECT_NE(std::string::npos, json.find("\"calls\": 110"));
+	EXPECT_EQ(std::string::npos, json.find("callsPerStep"));
+
+	// only counted without timing
+	MagneticFieldProfile::reset();
+	field->setTiming(false);
+	field->getField(Vector3d(0.));
+	EXPECT_EQ(1u, field->getCalls());
+	EXPECT_EQ(0, field->getTime());
+
+	field = NULL;
+	EXPECT_EQ(0u, MagneticFieldProfile::getFields().size());
+}
+
 TEST(testMagneticFieldEvolution, SimpleTest) {
 	// Test if this decorator scales the underlying field as (1+z)^m
 	ref_ptr<UniformMagneticField> B = new UniformMagneticField(Vector3d(1,0,0));
@@ -71,6 +192,54 @@ TEST(testMagneticFieldEvolution, SimpleTest) {
 	EXPECT_DOUBLE_EQ(b.x, 1);
 }
 
+TEST(testMagneticFieldEvolution, cachedScaling) {
+	// the cached factor of a redshift is that of the redshift
+	MagneticFieldEvolution Bz(new UniformMagneticField(Vector3d(1, 0, 0)), -1.5);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_DOUBLE_EQ(pow(1.5, -1.5), Bz.getScaling(0.5));
+		EXPECT_DOUBLE_EQ(pow(3., -1.5), Bz.getField(Vector3d(0.), 2).x);
+	}
+	Vector3d positions[3], fields[3];
+	Bz.getFields(positions, fields, 3, 1);
+	for (int i = 0; i < 3; i++)
+		EXPECT_DOUBLE_EQ(pow(2., -1.5), fields[i].x);
+}
+
+TEST(testSnapshotMagneticFieldGrid, interpolation) {
+	SnapshotMagneticFieldGrid field;
+	EXPECT_THROW(field.getField(Vector3d(0.), 0), std::runtime_error);
+	field.addSnapshot(1, new UniformMagneticField(Vector3d(0, 2, 0)));
+	field.addSnapshot(0, new UniformMagneticField(Vector3d(1, 0, 0)));
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 2, 1);
+	grid->get(0, 0, 0) = grid->get(0, 1, 0) = grid->get(1, 0, 0) = grid->get(1, 1, 0) = Vector3f(0, 0, 4);
+	grid->get(0, 0, 1) = grid->get(0, 1, 1) = grid->get(1, 0, 1) = grid->get(1, 1, 1) = Vector3f(0, 0, 4);
+	field.addSnapshot(3, grid);
+	EXPECT_THROW(field.addSnapshot(1, new UniformMagneticField(Vector3d(0.))), std::runtime_error);
+	EXPECT_EQ(3, field.getNumberOfSnapshots());
+	EXPECT_DOUBLE_EQ(1, field.getSnapshotRedshift(1));
+
+	// constant outside of the snapshots, linear between them
+	EXPECT_DOUBLE_EQ(1, field.getField(Vector3d(0.), -0.5).x);
+	EXPECT_DOUBLE_EQ(1, field.getField(Vector3d(0.)).x);
+	Vector3d b = field.getField(Vector3d(0.5), 0.25);
+	EXPECT_DOUBLE_EQ(0.75, b.x);
+	EXPECT_DOUBLE_EQ(0.5, b.y);
+	b = field.getField(Vector3d(0.5), 2);
+	EXPECT_DOUBLE_EQ(1, b.y);
+	EXPECT_NEAR(2, b.z, 1e-6);
+	EXPECT_NEAR(4, field.getField(Vector3d(0.5), 5).z, 1e-6);
+
+	// batched lookup
+	Vector3d positions[100], fields[100];
+	field.getFields(positions, fields, 100, 0.5);
+	for (int i = 0; i < 100; i++) {
+		EXPECT_DOUBLE_EQ(0.5, fields[i].x);
+		EXPECT_DOUBLE_EQ(1, fields[i].y);
+	}
+	Vector3d lower, upper;
+	EXPECT_FALSE(field.getBoundingBox(lower, upper));
+}
+
 class EchoMagneticField: public MagneticField {
 public:
 	Vector3d getField(const Vector3d &position) const {
@@ -103,6 +272,243 @@ TEST(testPeriodicMagneticField, Exceptions) {
 
 }
 
+TEST(testMagneticFieldGrid, getFields) {
+	// the batch lookup agrees with the single lookups
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1.);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1);
+	MagneticFieldGrid field(grid);
+	UniformMagneticField uniform(Vector3d(1, 2, 3));
+
+	std::vector<Vector3d> positions, fields(100);
+	for (int i = 0; i < 100; i++)
+		positions.push_back(Vector3d(0.37 * i, 5.1 - 0.1 * i, 0.05 * i * i));
+	field.getFields(&positions[0], &fields[0], positions.size(), 0);
+	for (int i = 0; i < 100; i++) {
+		Vector3d b = field.getField(positions[i]);
+		EXPECT_DOUBLE_EQ(b.x, fields[i].x);
+		EXPECT_DOUBLE_EQ(b.y, fields[i].y);
+		EXPECT_DOUBLE_EQ(b.z, fields[i].z);
+	}
+
+	// default implementation
+	uniform.getFields(&positions[0], &fields[0], positions.size(), 0);
+	EXPECT_DOUBLE_EQ(2, fields[99].y);
+}
+
+TEST(testMagneticFieldGrid, halfPrecision) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1.);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1) * nG;
+	MagneticFieldGrid field(grid);
+	MagneticFieldGrid halfField(toHalfPrecision(grid));
+	EXPECT_FALSE(halfField.getGrid().valid());
+
+	std::vector<Vector3d> positions, fields(20);
+	for (int i = 0; i < 20; i++)
+		positions.push_back(Vector3d(0.37 * i, 5.1 - 0.1 * i, 0.05 * i * i));
+	halfField.getFields(&positions[0], &fields[0], positions.size(), 0);
+	for (int i = 0; i < 20; i++) {
+		Vector3d b = field.getField(positions[i]);
+		Vector3d h = halfField.getField(positions[i]);
+		EXPECT_NEAR(b.x, h.x, 1e-2 * nG);
+		EXPECT_NEAR(b.y, h.y, 1e-2 * nG);
+		EXPECT_NEAR(b.z, h.z, 1e-2 * nG);
+		EXPECT_DOUBLE_EQ(h.y, fields[i].y);
+	}
+}
+
+TEST(testModulatedMagneticFieldGrid, fused) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	ref_ptr<Grid1f> modGrid = new Grid1f(Vector3d(0.), 4, 1);
+	Random random(5);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++) {
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand() - 0.5, 1);
+				modGrid->get(ix, iy, iz) = 1 + random.rand();
+			}
+	ModulatedMagneticFieldGrid field(grid, modGrid);
+	EXPECT_FALSE(field.isFused());
+
+	// different boundaries (set by the constructor) cannot be fused
+	EXPECT_THROW(field.setFused(true), std::runtime_error);
+	field.setReflective(true, true);
+	std::vector<Vector3d> positions, expected;
+	for (int i = 0; i < 100; i++) {
+		positions.push_back(Vector3d(random.rand(), random.rand(), random.rand()) * 6 - Vector3d(1));
+		expected.push_back(field.getField(positions.back()));
+	}
+	field.setFused(true);
+	EXPECT_TRUE(field.isFused());
+	for (int i = 0; i < 100; i++) {
+		Vector3d b = field.getField(positions[i]);
+		EXPECT_NEAR(expected[i].x, b.x, 1e-5);
+		EXPECT_NEAR(expected[i].y, b.y, 1e-5);
+		EXPECT_NEAR(expected[i].z, b.z, 1e-5);
+	}
+
+	// changing the boundaries ends the fused mode
+	field.setReflective(false, false);
+	EXPECT_FALSE(field.isFused());
+	field.setFused(true);
+	EXPECT_TRUE(field.isFused());
+	field.setFused(false);
+	EXPECT_FALSE(field.isFused());
+
+	// different geometries cannot be fused
+	field.setModulationGrid(new Grid1f(Vector3d(0.), 2, 2));
+	EXPECT_THROW(field.setFused(true), std::runtime_error);
+}
+
+TEST(testNestedMagneticFieldGrid, SimpleTest) {
+	ref_ptr<Grid3f> coarse = new Grid3f(Vector3d(0.), 4, 1.);
+	ref_ptr<Grid3f> fine = new Grid3f(Vector3d(2.), 8, 0.25);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				coarse->get(ix, iy, iz) = Vector3f(1, 0, 0);
+	for (int ix = 0; ix < 8; ix++)
+		for (int iy = 0; iy < 8; iy++)
+			for (int iz = 0; iz < 8; iz++)
+				fine->get(ix, iy, iz) = Vector3f(0, ix, 0);
+	ref_ptr<NestedGrid3f> grid = new NestedGrid3f(coarse);
+	grid->addRefinement(fine);
+	NestedMagneticFieldGrid field(grid);
+
+	Vector3d b = field.getField(Vector3d(1.));
+	EXPECT_DOUBLE_EQ(1, b.x);
+	b = field.getField(Vector3d(2.125 + 0.25 * 3, 3, 3));
+	EXPECT_DOUBLE_EQ(0, b.x);
+	EXPECT_DOUBLE_EQ(3, b.y);
+}
+
+
+TEST(testTricubicMagneticFieldGrid, SimpleTest) {
+	// a linear field is reproduced by the tricubic interpolation
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 8, 1.);
+	for (int ix = 0; ix < 8; ix++)
+		for (int iy = 0; iy < 8; iy++)
+			for (int iz = 0; iz < 8; iz++)
+				grid->get(ix, iy, iz) = Vector3f(1, iy, 0);
+	TricubicMagneticFieldGrid field(new TricubicGrid3f(grid));
+
+	Vector3d b = field.getField(Vector3d(3.2, 4.1, 2.7));
+	EXPECT_NEAR(1, b.x, 1e-5);
+	EXPECT_NEAR(3.6, b.y, 1e-5);
+	EXPECT_NEAR(0, b.z, 1e-5);
+}
+
+TEST(testJF12Field, getFields) {
+	// the batch evaluation gives the same fields as getField
+	ref_ptr<Grid3f> turbulent = new Grid3f(Vector3d(-20 * kpc), 16, 2.5 * kpc);
+	for (int ix = 0; ix < 16; ix++)
+		for (int iy = 0; iy < 16; iy++)
+			for (int iz = 0; iz < 16; iz++)
+				turbulent->get(ix, iy, iz) = Vector3f(sin(ix), cos(iy), sin(ix + iz));
+	JF12Field jf12;
+	jf12.setTurbulentGrid(turbulent);
+	JF12FieldSolenoidal solenoidal;
+
+	const size_t n = 40;
+	Vector3d positions[n], fields[n], fieldsSolenoidal[n];
+	for (size_t i = 0; i < n; i++)
+		positions[i] = Vector3d(cos(i) * i, sin(3 * i) * i, (i % 7) - 3.) * 0.6 * kpc;
+	positions[0] = Vector3d(0.);
+	jf12.getFields(positions, fields, n, 0);
+	solenoidal.getFields(positions, fieldsSolenoidal, n, 0);
+	for (size_t i = 0; i < n; i++) {
+		// the turbulent grid is interpolated in single precision
+		Vector3d b = jf12.getField(positions[i]);
+		EXPECT_NEAR(0, (b - fields[i]).getR(), 1e-6 * (b.getR() + muG));
+		b = solenoidal.getField(positions[i]);
+		EXPECT_NEAR(0, (b - fieldsSolenoidal[i]).getR(), 1e-12 * (b.getR() + muG));
+	}
+}
+
+TEST(testJF12Field, getFieldsAt) {
+	// flat arrays in parallel, the same fields as getField
+	JF12Field jf12;
+	const size_t n = 200;
+	std::vector<double> xyz(3 * n), out(3 * n);
+	for (size_t i = 0; i < n; i++) {
+		xyz[3 * i] = cos(i) * i * 0.1 * kpc;
+		xyz[3 * i + 1] = sin(3 * i) * i * 0.1 * kpc;
+		xyz[3 * i + 2] = ((i % 7) - 3.) * 0.6 * kpc;
+	}
+	jf12.getFieldsAt(&xyz[0], &out[0], n);
+	for (size_t i = 0; i < n; i++) {
+		Vector3d b = jf12.getField(Vector3d(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+		EXPECT_DOUBLE_EQ(b.x, out[3 * i]);
+		EXPECT_DOUBLE_EQ(b.y, out[3 * i + 1]);
+		EXPECT_DOUBLE_EQ(b.z, out[3 * i + 2]);
+	}
+}
+
+// azimuthal field of constant strength around the z-axis
+class ToroidalTestField: public MagneticField {
+public:
+	Vector3d getField(const Vector3d &p) const {
+		double r = sqrt(p.x * p.x + p.y * p.y);
+		return Vector3d(-p.y / r, p.x / r, p.z / 10);
+	}
+};
+
+TEST(testCachedMagneticField, cartesian) {
+	ref_ptr<MagneticDipoleField> dipole = new MagneticDipoleField(Vector3d(0.), Vector3d(0, 0, 1), 0.1);
+	CachedMagneticField cached(dipole, Vector3d(-4.), Vector3d(8.), 0.5);
+	EXPECT_EQ(CachedMagneticField::CARTESIAN, cached.getCoordinates());
+	EXPECT_EQ(0, cached.getNumberOfExactCells());
+
+	// exact at the nodes, interpolated between them and exact outside
+	Vector3d p(1.5, -2, 3);
+	EXPECT_NEAR(0, (dipole->getField(p) - cached.getField(p)).getR(), 1e-6 * dipole->getField(p).getR());
+	p = Vector3d(2.2, 1.7, -2.6);
+	EXPECT_NEAR(0, (dipole->getField(p) - cached.getField(p)).getR(), 0.2 * dipole->getField(p).getR());
+	p = Vector3d(5, 0, 0);
+	EXPECT_EQ(dipole->getField(p), cached.getField(p));
+
+	// cells close to the dipole exceed the tolerance and are evaluated directly
+	double tolerance = 1e-3 * dipole->getField(Vector3d(4, 0, 0)).getR();
+	CachedMagneticField checked(dipole, Vector3d(-4.), Vector3d(8.), 0.5, tolerance);
+	EXPECT_GT(checked.getNumberOfExactCells(), 0);
+	EXPECT_LT(checked.getNumberOfExactCells(), 16 * 16 * 16);
+	p = Vector3d(0.3, 0.2, 0.4);
+	EXPECT_EQ(dipole->getField(p), checked.getField(p));
+}
+
+TEST(testCachedMagneticField, cylindrical) {
+	// the azimuthal field is a constant in cylindrical components
+	ref_ptr<ToroidalTestField> field = new ToroidalTestField();
+	CachedMagneticField cached(field, 1, 10, -2, 2, 10, 8, 5, true);
+	EXPECT_EQ(CachedMagneticField::LOG_CYLINDRICAL, cached.getCoordinates());
+	Vector3d p(-3.1, -0.7, 1.3);
+	EXPECT_NEAR(0, (field->getField(p) - cached.getField(p)).getR(), 1e-6);
+	p = Vector3d(-5, 0.001, 0);
+	EXPECT_NEAR(0, (field->getField(p) - cached.getField(p)).getR(), 1e-6);
+	p = Vector3d(0.5, 0, 0);
+	EXPECT_EQ(field->getField(p), cached.getField(p));
+
+	EXPECT_THROW(CachedMagneticField(field, 0, 10, -2, 2, 10, 8, 5, true), std::runtime_error);
+}
+
+TEST(testCachedMagneticField, saveLoad) {
+	ref_ptr<ToroidalTestField> field = new ToroidalTestField();
+	CachedMagneticField cached(field, 0.5, 10, -2, 2, 7, 9, 5, false, 0.1);
+	cached.save("testCachedMagneticField.bin");
+	CachedMagneticField loaded(field, "testCachedMagneticField.bin");
+	EXPECT_EQ(CachedMagneticField::CYLINDRICAL, loaded.getCoordinates());
+	EXPECT_EQ(cached.getNumberOfExactCells(), loaded.getNumberOfExactCells());
+	EXPECT_EQ(cached.getSizeOf(), loaded.getSizeOf());
+	Vector3d p(2.3, 4.1, -1.2);
+	EXPECT_EQ(cached.getField(p), loaded.getField(p));
+
+	EXPECT_THROW(CachedMagneticField(field, "testCachedMagneticField.none"), std::runtime_error);
+}
 TEST(testCMZMagneticField, SimpleTest) {
 	ref_ptr<CMZField> field = new CMZField();
 	
@@ -16,7 +16,13 @@
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
+#include "crpropa/magneticLens/LensBuilder.h"
+#ifdef WITH_LENS_CUDA
+#include "crpropa/magneticLens/LensDevice.h"
+#endif
+#include "crpropa/Candidate.h"
 #include "crpropa/Common.h"
+#include "crpropa/ParticleID.h"
 
 using namespace std;
 using namespace crpropa;
@@ -53,6 +59,229 @@ TEST(MagneticLens, Deflection)
 	}
 }
 
+TEST(ModelMatrix, compressedFormat)
+{
+	ModelMatrixType M(48, 48);
+	for (int i = 0; i < 48; i++)
+		M.insert((i * 7) % 48, i) = 0.5 + i;
+	M.insert(3, 5) = 2.;
+	M.makeCompressed();
+
+	serialize("testModelMatrix.bin", M);
+	convertToCompressed("testModelMatrix.bin", "testModelMatrix.csc");
+
+	ModelMatrixType A, B;
+	deserialize("testModelMatrix.bin", A);
+	deserialize("testModelMatrix.csc", B);
+	EXPECT_EQ(M.nonZeros(), B.nonZeros());
+	EXPECT_EQ(0, (A - M).norm());
+	EXPECT_EQ(0, (B - M).norm());
+
+	ref_ptr<MappedModelMatrix> mapped = new MappedModelMatrix("testModelMatrix.csc");
+	EXPECT_EQ(0, (ModelMatrixType(mapped->getMatrix()) - M).norm());
+
+	std::vector<double> x(48, 1.), y(48, 1.);
+	prod_up(M, &x[0]);
+	prod_up(mapped->getMatrix(), &y[0]);
+	for (int i = 0; i < 48; i++)
+		EXPECT_EQ(x[i], y[i]);
+
+	EXPECT_THROW(MappedModelMatrix("testModelMatrix.bin"), std::runtime_error);
+	remove("testModelMatrix.bin");
+	remove("testModelMatrix.csc");
+}
+
+TEST(MagneticLens, lazyLoading)
+{
+	// three diagonal lens parts of 10^18 - 10^19, 10^19 - 10^20 and 10^20 - 10^21 eV
+	Pixelization P(4);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+		M.insert(i, i) = 0.5;
+	std::ofstream lensFile("testLens.cfg");
+	for (int i = 0; i < 3; i++)
+	{
+		std::stringstream name;
+		name << "testLensPart" << i << ".csc";
+		serializeCompressed(name.str(), M);
+		lensFile << name.str() << " " << 18 + i << " " << 19 + i << "\n";
+	}
+	lensFile.close();
+
+	MagneticLens lens;
+	lens.setLazyLoading(true);
+	lens.setRigidityRange(1.5 * EeV, 50 * EeV); // skips the last part
+	lens.loadLens("testLens.cfg");
+	ASSERT_EQ(2, lens.getLensParts().size());
+	EXPECT_FALSE(lens.getLensParts()[0]->isLoaded());
+	EXPECT_EQ(0, lens.getMemoryUsed());
+
+	// at most one part in memory, normalizations are kept when a part is reloaded
+	size_t partMemory = P.nPix() * (sizeof(double) + sizeof(int)) + (P.nPix() + 1) * sizeof(int);
+	lens.setMemoryLimit(partMemory);
+	lens.normalizeLensparts();
+	EXPECT_FALSE(lens.getLensParts()[0]->isLoaded());
+	EXPECT_TRUE(lens.getLensParts()[1]->isLoaded());
+	EXPECT_EQ(partMemory, lens.getMemoryUsed());
+
+	double phi = 0.3, theta = 0.2;
+	EXPECT_TRUE(lens.transformCosmicRay(2 * EeV, phi, theta));
+	EXPECT_TRUE(lens.getLensParts()[0]->isLoaded());
+	EXPECT_FALSE(lens.getLensParts()[1]->isLoaded());
+	EXPECT_TRUE(lens.transformCosmicRay(20 * EeV, phi, theta));
+	EXPECT_FALSE(lens.getLensParts()[0]->isLoaded());
+	EXPECT_DOUBLE_EQ(1, lens.getLensParts()[1]->getMatrix().coeff(5, 5));
+	EXPECT_EQ(partMemory, lens.getMemoryUsed());
+
+	remove("testLens.cfg");
+	for (int i = 0; i < 3; i++)
+	{
+		std::stringstream name;
+		name << "testLensPart" << i << ".csc";
+		remove(name.str().c_str());
+	}
+}
+
+TEST(ModelMatrix, prune)
+{
+	ModelMatrixType M(4, 4);
+	M.insert(0, 0) = 0.6;
+	M.insert(1, 0) = 0.3;
+	M.insert(2, 0) = 0.001;
+	M.insert(3, 1) = 0.0001;
+	M.insert(2, 2) = 0.5;
+	pruneMatrix(M, 0.01);
+	EXPECT_EQ(3, M.nonZeros());
+	EXPECT_NEAR(0.6 * 0.901 / 0.9, M.coeff(0, 0), 1e-12);
+	EXPECT_NEAR(0.3 * 0.901 / 0.9, M.coeff(1, 0), 1e-12);
+	EXPECT_EQ(0, M.coeff(3, 1));
+	EXPECT_DOUBLE_EQ(0.5, M.coeff(2, 2));
+}
+
+TEST(MagneticLens, device)
+{
+	MagneticLens lens;
+	EXPECT_FALSE(lens.getDeviceEnabled());
+	EXPECT_EQ(0, lens.getDeviceMemoryUsed());
+#ifdef WITH_LENS_CUDA
+	if (LensDevice::getDeviceCount() == 0)
+		return;
+	Pixelization P(4);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		M.insert(i, i) = 0.7;
+		M.insert((i + 1) % P.nPix(), i) = 0.3;
+	}
+	lens.setLensPart(M, 1 * EeV, 10 * EeV);
+
+	// same transformation as on the host
+	std::vector<double> model(P.nPix()), expected(P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+		model[i] = expected[i] = i;
+	lens.transformModelVector(&expected[0], 2 * EeV);
+	lens.setDeviceEnabled(true);
+	lens.transformModelVector(&model[0], 2 * EeV);
+	EXPECT_GT(lens.getDeviceMemoryUsed(), 0);
+	for (int i = 0; i < P.nPix(); i++)
+		EXPECT_NEAR(expected[i], model[i], 1e-12 * expected[i]);
+#else
+	EXPECT_THROW(lens.setDeviceEnabled(true), std::runtime_error);
+	EXPECT_NO_THROW(lens.setDeviceEnabled(false));
+#endif
+}
+
+TEST(MagneticLens, singlePrecision)
+{
+	Pixelization P(4);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		M.insert(i, i) = 0.7;
+		M.insert((i + 1) % P.nPix(), i) = 0.3;
+		M.insert((i + 2) % P.nPix(), i) = 1e-6;
+	}
+	serializeCompressed("testLensPart.csc", M);
+	std::ofstream lensFile("testLens.cfg");
+	lensFile << "testLensPart.csc 18 19\n";
+	lensFile.close();
+
+	MagneticLens lens;
+	lens.setSinglePrecision(true);
+	lens.setPruningThreshold(1e-4);
+	lens.loadLens("testLens.cfg");
+	LensPart *part = lens.getLensParts()[0];
+	EXPECT_TRUE(part->isSinglePrecision());
+	EXPECT_THROW(part->getMatrix(), std::runtime_error);
+	EXPECT_EQ(2 * P.nPix(), part->getMatrixFloat().nonZeros());
+	EXPECT_NEAR(2 * P.nPix() * (sizeof(float) + sizeof(int)) + (P.nPix() + 1) * sizeof(int),
+			lens.getMemoryUsed(), 0);
+
+	// same transformation as in double precision
+	std::vector<double> model(P.nPix()), expected(P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+		model[i] = expected[i] = i;
+	lens.transformModelVector(&model[0], 2 * EeV);
+	pruneMatrix(M, 1e-4);
+	prod_up(M, &expected[0]);
+	for (int i = 0; i < P.nPix(); i++)
+		EXPECT_NEAR(expected[i], model[i], 1e-6 * expected[i]);
+
+	double phi = 0.3, theta = 0.2;
+	EXPECT_TRUE(lens.transformCosmicRay(2 * EeV, phi, theta));
+
+	remove("testLens.cfg");
+	remove("testLensPart.csc");
+}
+
+TEST(ModelMatrix, prod_up)
+{
+	// parallel product compared with Eigen
+	const int n = 3000;
+	ModelMatrixType M(n, n);
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < 5; j++)
+			M.insert((i * 31 + j * 7) % n, i) = 0.1 * j + 1. / (i + 1);
+	Eigen::VectorXd x(n);
+	for (int i = 0; i < n; i++)
+		x[i] = sin(i);
+	Eigen::VectorXd expected = M * x;
+
+	for (int k = 0; k < 2; k++) // reused workspace
+	{
+		std::vector<double> model(x.data(), x.data() + n);
+		prod_up(M, &model[0]);
+		for (int i = 0; i < n; i++)
+			EXPECT_NEAR(expected[i], model[i], 1e-12);
+	}
+}
+
+TEST(ModelMatrix, prod_upMany)
+{
+	// several models at once, compared with one at a time
+	const int n = 1000, count = 11;
+	ModelMatrixType M(n, n);
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < 5; j++)
+			M.insert((i * 31 + j * 7) % n, i) = 0.1 * j + 1. / (i + 1);
+	std::vector<std::vector<double> > models(count, std::vector<double>(n));
+	std::vector<double*> pointers;
+	for (int m = 0; m < count; m++)
+	{
+		for (int i = 0; i < n; i++)
+			models[m][i] = sin(i * (m + 1));
+		pointers.push_back(&models[m][0]);
+	}
+	std::vector<std::vector<double> > expected = models;
+	for (int m = 0; m < count; m++)
+		prod_up(M, &expected[m][0]);
+
+	prod_up(M, &pointers[0], count);
+	for (int m = 0; m < count; m++)
+		for (int i = 0; i < n; i++)
+			EXPECT_NEAR(expected[m][i], models[m][i], 1e-12);
+}
+
 TEST(MagneticLens, Vector3Deflection)
 {
 	MagneticLens magneticLens(5);
@@ -112,6 +341,47 @@ TEST(Pixelization, angularDistance)
 }
 
 
+TEST(LensBuilder, build)
+{
+	Pixelization P(4);
+	LensBuilder builder(4, 1 * EeV, 100 * EeV, 2);
+	EXPECT_NEAR(10 * EeV, builder.getRigidityMax(0), 1e-6 * EeV);
+
+	// two protons from pixel a, deflected to b and c, one helium to a
+	Vector3d a(1, 0, 0), b(0, 1, 0), c(0, 0, 1);
+	ref_ptr<Candidate> p1 = new Candidate(nucleusId(1, 1), 5 * EeV);
+	p1->source.setDirection(a);
+	p1->current.setDirection(b);
+	ref_ptr<Candidate> p2 = new Candidate(nucleusId(1, 1), 5 * EeV);
+	p2->source.setDirection(a);
+	p2->current.setDirection(c);
+	ref_ptr<Candidate> he = new Candidate(nucleusId(4, 2), 40 * EeV);
+	he->source.setDirection(a);
+	he->current.setDirection(a);
+	builder.process(p1);
+	builder.process(p2);
+	builder.process(he);
+	builder.build();
+
+	uint32_t ia = P.vector2Pix(1, 0, 0), ib = P.vector2Pix(0, 1, 0), ic = P.vector2Pix(0, 0, 1);
+	const ModelMatrixType &M0 = builder.getMatrix(0);
+	EXPECT_EQ(2, M0.nonZeros());
+	EXPECT_DOUBLE_EQ(0.5, M0.coeff(ia, ib));
+	EXPECT_DOUBLE_EQ(0.5, M0.coeff(ia, ic));
+	const ModelMatrixType &M1 = builder.getMatrix(1);
+	EXPECT_EQ(1, M1.nonZeros());
+	EXPECT_DOUBLE_EQ(1, M1.coeff(ia, ia));
+
+	// lens from the written files
+	builder.write("testLensBuilder");
+	MagneticLens lens("testLensBuilder.cfg");
+	EXPECT_EQ(2, lens.getLensParts().size());
+	std::vector<double> model(P.nPix(), 0.);
+	model[ib] = 1;
+	lens.transformModelVector(&model[0], 5 * EeV);
+	EXPECT_DOUBLE_EQ(0.5, model[ia]);
+}
+
 TEST(ParticleMapsContainer, addParticle)
 {
   ParticleMapsContainer maps;
@@ -151,6 +421,121 @@ TEST(ParticleMapsContainer, getRandomParticles)
 
 }
 
+TEST(ParticleMapsContainer, addParticles)
+{
+  // many maps, more than one pooled block
+  ParticleMapsContainer single, bulk;
+  const size_t N = 200;
+  std::vector<int> ids(N);
+  std::vector<double> energies(N), lons(N), lats(N), weights(N);
+  for (size_t i = 0; i < N; i++) {
+    ids[i] = (i % 2) ? 1000010010 : 1000020040;
+    energies[i] = pow(10, 18 + 0.02 * (i % 25)) * eV;
+    lons[i] = -M_PI + 2 * M_PI * i / N;
+    lats[i] = 0.5 * sin(i);
+    weights[i] = 1 + i % 3;
+    single.addParticle(ids[i], energies[i], lons[i], lats[i], weights[i]);
+  }
+  bulk.addParticles(N, ids.data(), energies.data(), lons.data(), lats.data(), weights.data());
+
+  EXPECT_EQ(bulk.getParticleIds(), single.getParticleIds());
+  EXPECT_EQ(bulk.getEnergies(1000010010), single.getEnergies(1000010010));
+  EXPECT_EQ(bulk.getEnergies(1000020040).size(), 25);
+  for (size_t i = 0; i < N; i++) {
+    EXPECT_DOUBLE_EQ(bulk.getWeight(ids[i], energies[i]), single.getWeight(ids[i], energies[i]));
+    double *a = bulk.getMap(ids[i], energies[i]);
+    double *b = single.getMap(ids[i], energies[i]);
+    for (size_t j = 0; j < bulk.getNumberOfPixels(); j++)
+      EXPECT_EQ(a[j], b[j]);
+  }
+  EXPECT_DOUBLE_EQ(bulk.getSumOfWeights(), 399);
+  EXPECT_EQ(bulk.getWeight(1000010010, 1e21 * eV), 0);
+}
+
+TEST(ParticleMapsContainer, randomParticlesFollowWeights)
+{
+  ParticleMapsContainer maps;
+  maps.addParticle(1000010010, 1 * EeV, 0, 0, 3);
+  maps.addParticle(1000020040, 1 * EeV, 1, 0, 1);
+
+  std::vector<double> energies, lons, lats;
+  std::vector<int> particleIds;
+  size_t N = 4000;
+  maps.getRandomParticles(N, particleIds, energies, lons, lats);
+  size_t nProtons = 0;
+  for (size_t i = 0; i < N; i++) {
+    if (particleIds[i] == 1000010010) {
+      nProtons++;
+      EXPECT_NEAR(lons[i], 0, 2./180*M_PI);
+    } else {
+      EXPECT_NEAR(lons[i], 1, 2./180*M_PI);
+    }
+  }
+  EXPECT_NEAR(nProtons / double(N), 0.75, 0.03);
+}
+
+TEST(ParticleMapsContainer, randomParticlesArrays)
+{
+  ParticleMapsContainer maps;
+  maps.addParticle(1000010010, 1 * EeV, 0, 0, 1);
+  maps.addParticle(1000020040, 2 * EeV, -1, 0.5, 1);
+
+  // vectors and arrays give the same particles for the same seed
+  size_t N = 100000;
+  std::vector<double> energies, lons, lats;
+  std::vector<int> particleIds;
+  Random::seedThreads(42);
+  maps.getRandomParticles(N, particleIds, energies, lons, lats);
+
+  std::vector<int> ids(N);
+  std::vector<double> e(N), lon(N), lat(N);
+  Random::seedThreads(42);
+  maps.getRandomParticles(N, ids.data(), e.data(), lon.data(), lat.data());
+
+  Pixelization p(6);
+  for (size_t i = 0; i < N; i++) {
+    EXPECT_EQ(ids[i], particleIds[i]);
+    EXPECT_EQ(e[i], energies[i]);
+    EXPECT_EQ(lon[i], lons[i]);
+    EXPECT_EQ(lat[i], lats[i]);
+    // the directions lie in the pixel of the particle
+    if (ids[i] == 1000010010)
+      EXPECT_EQ(p.direction2Pix(lon[i], lat[i]), p.direction2Pix(0, 0));
+    else
+      EXPECT_EQ(p.direction2Pix(lon[i], lat[i]), p.direction2Pix(-1, 0.5));
+  }
+}
+
+TEST(Pixelization, cachedGeometry)
+{
+  Pixelization p(4), cached(4);
+  cached.cacheGeometry();
+  EXPECT_TRUE(cached.isGeometryCached());
+  EXPECT_FALSE(p.isGeometryCached());
+
+  size_t n = p.nPix();
+  std::vector<uint32_t> pixels(n);
+  for (size_t i = 0; i < n; i++)
+    pixels[i] = i;
+  std::vector<double> lons(n), lats(n);
+  cached.pix2Direction(n, pixels.data(), lons.data(), lats.data());
+
+  std::vector<uint32_t> back(n);
+  p.direction2Pix(n, lons.data(), lats.data(), back.data());
+  for (size_t i = 0; i < n; i++) {
+    double lon, lat;
+    p.pix2Direction(i, lon, lat);
+    EXPECT_DOUBLE_EQ(lons[i], lon);
+    EXPECT_DOUBLE_EQ(lats[i], lat);
+    EXPECT_EQ(back[i], i);
+
+    double x, y, z;
+    cached.pix2Vector(i, x, y, z);
+    EXPECT_EQ(p.vector2Pix(2 * x, 2 * y, 2 * z), i);
+  }
+  EXPECT_DOUBLE_EQ(cached.angularDistance(3, 100), p.angularDistance(3, 100));
+}
+
 TEST(Pixelization, randomDirectionInPixel)
 {
   Pixelization p(6);
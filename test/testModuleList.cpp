@@ -1,11 +1,33 @@
+#include "crpropa/BackTracking.h"
+#include "crpropa/CandidateStream.h"
+#include "crpropa/Grid.h"
+#include "crpropa/MemoryUsage.h"
+#include "crpropa/ModuleChain.h"
 #include "crpropa/ModuleList.h"
+#include "crpropa/Numa.h"
+#include "crpropa/ParameterSweep.h"
+#include "crpropa/PerfCounters.h"
+#include "crpropa/ProgressBar.h"
+#include "crpropa/PropagationResponse.h"
 #include "crpropa/Source.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/RunStatistics.h"
+#include "crpropa/Trace.h"
 #include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/Boundary.h"
 #include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/BatchModule.h"
+#include "crpropa/module/BinaryOutput.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/TextOutput.h"
+#include "crpropa/magneticField/MagneticField.h"
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <cstdio>
+
 namespace crpropa {
 
 TEST(ModuleList, process) {
@@ -31,6 +53,99 @@ TEST(ModuleList, removeModule) {
 	EXPECT_EQ(modules.size(), 0);
 }
 
+TEST(ModuleList, addParallel) {
+	// the modules are added in the order of the factories
+	std::vector<std::function<ref_ptr<Module>()> > factories;
+	for (int i = 1; i <= 8; i++)
+		factories.push_back([i]() { return ref_ptr<Module>(new MaximumTrajectoryLength(i * Mpc)); });
+	ModuleList modules;
+	modules.addParallel(factories);
+	EXPECT_EQ(8, modules.size());
+	for (int i = 0; i < 8; i++) {
+		MaximumTrajectoryLength *m = dynamic_cast<MaximumTrajectoryLength *>(modules[i].get());
+		ASSERT_TRUE(m != 0);
+		EXPECT_DOUBLE_EQ((i + 1) * Mpc, m->getMaximumTrajectoryLength());
+	}
+
+	// nothing is added if a factory fails
+	factories.push_back([]() -> ref_ptr<Module> { throw std::runtime_error("failed"); });
+	EXPECT_THROW(modules.addParallel(factories, 2), std::runtime_error);
+	EXPECT_EQ(8, modules.size());
+}
+
+TEST(ModuleChain, sameAsModuleList) {
+	// the chain inside a module list propagates as the modules themselves
+	ref_ptr<ModuleList> list = new ModuleList();
+	list->add(new SimplePropagation(1 * Mpc, 3 * Mpc));
+	list->add(new MinimumEnergy(5 * EeV));
+	list->add(new MaximumTrajectoryLength(10 * Mpc));
+
+	ref_ptr<MinimumEnergy> minimumEnergy = new MinimumEnergy(5 * EeV);
+	ref_ptr<ModuleList> chained = new ModuleList();
+	chained->add(makeModuleChain(new SimplePropagation(1 * Mpc, 3 * Mpc), minimumEnergy.get(),
+			new MaximumTrajectoryLength(10 * Mpc)));
+	EXPECT_EQ(1, chained->size());
+
+	for (int i = 0; i < 2; i++) {
+		ref_ptr<Candidate> a = new Candidate(11, (i == 0) ? 10 * EeV : 1 * EeV);
+		ref_ptr<Candidate> b = new Candidate(11, (i == 0) ? 10 * EeV : 1 * EeV);
+		list->run(a);
+		chained->run(b);
+		EXPECT_FALSE(b->isActive());
+		EXPECT_DOUBLE_EQ(a->getTrajectoryLength(), b->getTrajectoryLength());
+		EXPECT_EQ(a->hasProperty("Rejected"), b->hasProperty("Rejected"));
+	}
+}
+
+TEST(ModuleChain, modules) {
+	ref_ptr<SimplePropagation> propagation = new SimplePropagation(1 * Mpc, 3 * Mpc);
+	ref_ptr<CubicBoundary> boundary = new CubicBoundary(Vector3d(-2 * Mpc), 4 * Mpc);
+	boundary->setLimitStep(true);
+	boundary->setMargin(0);
+	ModuleChain<SimplePropagation, CubicBoundary> chain(propagation, boundary);
+	std::vector<ref_ptr<Module> > modules = chain.getModules();
+	ASSERT_EQ(2, modules.size());
+	EXPECT_TRUE(modules[0] == propagation);
+	EXPECT_TRUE(modules[1] == boundary);
+	EXPECT_FALSE(chain.getRunOnInactive());
+
+	// the step limit of the boundary
+	Candidate c(11, 1 * EeV);
+	EXPECT_DOUBLE_EQ(2 * Mpc, chain.getStepLimit(&c));
+
+	// with skipInactive, the propagation is not called after the deactivation
+	chain.setSkipInactive(true);
+	c.setActive(false);
+	chain.process(&c);
+	EXPECT_DOUBLE_EQ(0, c.getTrajectoryLength());
+}
+
+TEST(ModuleList, snapshots) {
+	// without the previous state, the steps do not copy the current state
+	ModuleList modules;
+	modules.add(new SimplePropagation(1 * Mpc, 1 * Mpc));
+	modules.add(new MaximumTrajectoryLength(5 * Mpc));
+	modules.setSnapshots(Candidate::SnapshotNone);
+	EXPECT_EQ(Candidate::SnapshotNone, modules.getSnapshots());
+
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(11, 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0)));
+	modules.run(&candidates);
+	EXPECT_DOUBLE_EQ(5 * Mpc, candidates[0]->current.getPosition().x);
+	EXPECT_DOUBLE_EQ(0, candidates[0]->previous.getPosition().x);
+	EXPECT_EQ(Candidate::SnapshotAll, Candidate::getSnapshots());
+
+	// the created state of a secondary is the current state of the parent
+	Candidate::setSnapshots(Candidate::SnapshotCreated);
+	Candidate &c = *candidates[0];
+	c.addSecondary(22, 1 * EeV);
+	EXPECT_DOUBLE_EQ(5 * Mpc, c.secondaries[0]->created.getPosition().x);
+	EXPECT_DOUBLE_EQ(0, c.secondaries[0]->previous.getPosition().x);
+	Candidate::setSnapshots(Candidate::SnapshotAll);
+	c.addSecondary(22, 1 * EeV);
+	EXPECT_DOUBLE_EQ(0, c.secondaries[1]->created.getPosition().x);
+}
+
 TEST(ModuleList, runCandidateList) {
 	ModuleList modules;
 	modules.add(new SimplePropagation());
@@ -55,6 +170,600 @@ TEST(ModuleList, runSource) {
 	modules.run(&source, 100, false);
 }
 
+// splits every candidate into two secondaries with half the energy until
+// the energy drops below 1 EeV, counting all processed candidates
+class CascadeCounter: public Module {
+public:
+	mutable size_t count;
+	CascadeCounter() : count(0) {
+	}
+	void process(Candidate *c) const {
+#pragma omp atomic
+		count++;
+		double E = c->current.getEnergy();
+		if (E >= 2 * EeV) {
+			c->addSecondary(22, E / 2);
+			c->addSecondary(22, E / 2);
+		}
+		c->setActive(false);
+	}
+};
+
+TEST(ModuleList, runSecondaryTasks) {
+	ModuleList modules;
+	modules.setSecondaryTasks(true);
+	EXPECT_TRUE(modules.getSecondaryTasks());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(22, 64 * EeV));
+	modules.run(&candidates);
+	// each primary branches 6 times: 2^7 - 1 candidates per cascade
+	EXPECT_EQ(4 * 127, counter->count);
+
+	counter->count = 0;
+	for (int i = 0; i < 4; i++) {
+		candidates[i]->clearSecondaries();
+		candidates[i]->restart();
+	}
+	modules.run(&candidates, true, true);
+	EXPECT_EQ(4 * 127, counter->count);
+}
+
+TEST(ModuleList, runBreadthFirst) {
+	ModuleList modules;
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+
+	// a small queue also covers the direct propagation of overflowing secondaries
+	size_t sizes[] = {1000, 4};
+	for (int j = 0; j < 2; j++) {
+		modules.setBreadthFirst(sizes[j]);
+		EXPECT_EQ(sizes[j], modules.getBreadthFirst());
+		counter->count = 0;
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 4; i++)
+			candidates.push_back(new Candidate(22, 64 * EeV));
+		modules.run(&candidates);
+		EXPECT_EQ(4 * 127, counter->count);
+		// finished secondaries are released immediately
+		for (int i = 0; i < 4; i++)
+			EXPECT_EQ(0, candidates[i]->secondaries.size());
+	}
+}
+
+// splits photons into an electron and a photon and electrons into two
+// photons until the energy drops below 1 EeV, recording the processed ids
+class SpeciesCascade: public Module {
+public:
+	mutable std::vector<int> ids;
+	void process(Candidate *c) const {
+		int id = c->current.getId();
+#pragma omp critical(SpeciesCascade)
+		ids.push_back(id);
+		double E = c->current.getEnergy();
+		if (E >= 2 * EeV) {
+			c->addSecondary((id == 22) ? 11 : 22, E / 2);
+			c->addSecondary(22, E / 2);
+		}
+		c->setActive(false);
+	}
+	// number of changes of the id between consecutive candidates
+	size_t changes() const {
+		size_t n = 0;
+		for (size_t i = 1; i < ids.size(); i++)
+			n += (ids[i] != ids[i - 1]);
+		return n;
+	}
+};
+
+TEST(ModuleList, secondaryGrouping) {
+	ModuleList modules;
+	EXPECT_EQ(ModuleList::GroupNone, modules.getSecondaryGrouping());
+	ref_ptr<SpeciesCascade> cascade = new SpeciesCascade();
+	modules.add(cascade);
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(22, 64 * EeV));
+
+	// depth-first, batches and breadth-first with the same candidates
+	size_t changes[2][3];
+	for (int g = 0; g < 2; g++) {
+		modules.setSecondaryGrouping(g ? ModuleList::GroupSpecies : ModuleList::GroupNone);
+		for (int mode = 0; mode < 3; mode++) {
+			modules.setBatchSize(mode == 1 ? 4 : 0);
+			modules.setBreadthFirst(mode == 2 ? 1000 : 0);
+			cascade->ids.clear();
+			for (int i = 0; i < 4; i++) {
+				candidates[i]->clearSecondaries();
+				candidates[i]->restart();
+			}
+			modules.run(&candidates);
+			EXPECT_EQ(4 * 127, cascade->ids.size());
+			EXPECT_EQ(4 * 42, std::count(cascade->ids.begin(), cascade->ids.end(), 11));
+			changes[g][mode] = cascade->changes();
+		}
+	}
+	// the two secondaries of a candidate alternate in any order
+	EXPECT_EQ(changes[0][0], changes[1][0]);
+	// the secondaries of a batch and the queue are propagated per species
+	EXPECT_LT(changes[1][1], changes[0][1]);
+	EXPECT_LT(changes[1][2], changes[0][2]);
+}
+
+TEST(ModuleList, runCandidatePool) {
+	ModuleList modules;
+	modules.setCandidatePool(true);
+	EXPECT_TRUE(modules.getCandidatePool());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(22, 64 * EeV));
+	modules.run(&candidates);
+	EXPECT_EQ(4 * 127, counter->count);
+	// pooling is only active during the run
+	EXPECT_FALSE(Candidate::getPoolAllocation());
+
+	// recycled memory is handed out as valid, fresh candidates
+	Candidate::setPoolAllocation(true);
+	for (int i = 0; i < 4; i++)
+		candidates[i]->clearSecondaries();
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	EXPECT_EQ(22, c->current.getId());
+	EXPECT_EQ(0, c->secondaries.size());
+	EXPECT_EQ(0, c->properties.size());
+	Candidate::setPoolAllocation(false);
+}
+
+TEST(ModuleList, runBatch) {
+	ModuleList modules;
+	modules.setBatchSize(3);
+	EXPECT_EQ(3, modules.getBatchSize());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+
+	// all generations of the cascades are propagated
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(22, 64 * EeV));
+	modules.run(&candidates);
+	EXPECT_EQ(4 * 127, counter->count);
+
+	// same trajectories as the propagation of single candidates
+	ModuleList scalar, batch;
+	scalar.add(new SimplePropagation(1 * Mpc, 1 * Mpc));
+	scalar.add(new MaximumTrajectoryLength(10.5 * Mpc));
+	batch.add(new SimplePropagation(1 * Mpc, 1 * Mpc));
+	batch.add(new MaximumTrajectoryLength(10.5 * Mpc));
+	batch.setBatchSize(2);
+	ModuleList::candidate_vector_t a, b;
+	for (int i = 0; i < 5; i++) {
+		a.push_back(new Candidate(1000010010, (i + 1) * EeV));
+		b.push_back(new Candidate(1000010010, (i + 1) * EeV));
+	}
+	scalar.run(&a);
+	batch.run(&b);
+	for (int i = 0; i < 5; i++) {
+		EXPECT_FALSE(b[i]->isActive());
+		EXPECT_DOUBLE_EQ(a[i]->getTrajectoryLength(), b[i]->getTrajectoryLength());
+		EXPECT_DOUBLE_EQ(a[i]->current.getPosition().x, b[i]->current.getPosition().x);
+	}
+}
+
+// counts the processed candidates
+class CallCounter: public Module {
+public:
+	mutable size_t count;
+	CallCounter() : count(0) {
+	}
+	void process(Candidate *c) const {
+		count++;
+	}
+};
+
+TEST(ModuleList, skipInactive) {
+	ModuleList modules;
+	ref_ptr<CallCounter> physics = new CallCounter();
+	ref_ptr<CallCounter> output = new CallCounter();
+	output->setRunOnInactive(true);
+	modules.add(new MinimumEnergy(5 * EeV));
+	modules.add(physics);
+	modules.add(output);
+
+	// by default all modules are called
+	Candidate c(22, 1 * EeV);
+	modules.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_EQ(1, physics->count);
+	EXPECT_EQ(1, output->count);
+
+	// only the marked modules are called after the deactivation
+	modules.setSkipInactive(true);
+	EXPECT_TRUE(modules.getSkipInactive());
+	Candidate d(22, 1 * EeV);
+	modules.process(&d);
+	EXPECT_EQ(1, physics->count);
+	EXPECT_EQ(2, output->count);
+
+	// the same for batches
+	Candidate e(22, 10 * EeV);
+	Candidate f(22, 1 * EeV);
+	Candidate *batch[2] = {&e, &f};
+	modules.processBatch(batch, 2);
+	EXPECT_EQ(2, physics->count);
+	EXPECT_EQ(4, output->count);
+}
+
+// halves the energy of all candidates and deactivates those below 1 EeV
+class HalvingBatchModule: public BatchModule {
+public:
+	mutable size_t calls;
+	HalvingBatchModule() : calls(0) {
+	}
+	void processCandidates(CandidateArrays &candidates) const {
+#pragma omp atomic
+		calls++;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			candidates.energy[i] /= 2;
+			if (candidates.energy[i] < 1 * EeV)
+				candidates.active[i] = false;
+		}
+	}
+};
+
+TEST(ModuleList, batchModule) {
+	ModuleList modules;
+	modules.setBatchSize(4);
+	ref_ptr<HalvingBatchModule> halving = new HalvingBatchModule();
+	modules.add(new SimplePropagation(1 * Mpc, 1 * Mpc));
+	modules.add(halving);
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(nucleusId(1, 1), (8 << i) * EeV, Vector3d(0.), Vector3d(1, 0, 0)));
+	modules.run(&candidates);
+
+	// one call per step of the batch instead of one per candidate
+	EXPECT_EQ(7, halving->calls);
+	for (int i = 0; i < 4; i++) {
+		EXPECT_FALSE(candidates[i]->isActive());
+		EXPECT_DOUBLE_EQ(0.5 * EeV, candidates[i]->current.getEnergy());
+		EXPECT_DOUBLE_EQ((4 + i) * Mpc, candidates[i]->current.getPosition().x);
+		EXPECT_EQ(Vector3d(1, 0, 0), candidates[i]->current.getDirection());
+	}
+}
+
+class ConfinementCounter: public Module {
+public:
+	mutable size_t confined;
+	ConfinementCounter() : confined(0) {
+	}
+	void process(Candidate *c) const {
+		if (c->isThreadConfined()) {
+#pragma omp atomic
+			confined++;
+		}
+		c->setActive(false);
+	}
+};
+
+TEST(ModuleList, runThreadConfinement) {
+	ModuleList modules;
+	EXPECT_FALSE(modules.getThreadConfinement());
+	ref_ptr<ConfinementCounter> counter = new ConfinementCounter();
+	modules.add(counter);
+	Source source;
+	source.add(new SourceParticleType(22));
+
+	// atomic reference counting unless enabled
+	modules.run(&source, 20);
+	EXPECT_EQ(0, counter->confined);
+
+	modules.setThreadConfinement(true);
+	modules.run(&source, 20);
+	EXPECT_EQ(20, counter->confined);
+	// the confinement is only active during the run
+	EXPECT_FALSE(Candidate::getThreadConfinement());
+}
+
+TEST(ModuleList, runCheckpoint) {
+	std::string filename = "ModuleList_checkpoint.txt";
+	std::remove(filename.c_str());
+
+	ModuleList modules;
+	modules.setCheckpoint(filename, 10);
+	EXPECT_EQ(filename, modules.getCheckpointFile());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+
+	modules.run(&source, 25);
+	EXPECT_EQ(25, counter->count);
+	uint64_t serial = Candidate::getNextSerialNumber();
+
+	// resuming a finished run does not propagate anything again
+	modules.run(&source, 25);
+	EXPECT_EQ(25, counter->count);
+	EXPECT_EQ(serial, Candidate::getNextSerialNumber());
+
+#ifndef CRPROPA_TESTS_SKIP_EXCEPTIONS
+	// a checkpoint of another run is rejected
+	EXPECT_THROW(modules.run(&source, 30), std::runtime_error);
+#endif
+	std::remove(filename.c_str());
+}
+
+TEST(ModuleList, profiling) {
+	ModuleList modules;
+	modules.setProfiling(true);
+	EXPECT_TRUE(modules.getProfiling());
+	modules.add(new CascadeCounter());
+	modules.add(new SimplePropagation());
+
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(22, 4 * EeV));
+	modules.run(&candidates);
+
+	// 7 photons, the secondaries of the cascade
+	std::string csv = modules.getProfileCSV();
+	EXPECT_NE(std::string::npos, csv.find(",all,7,"));
+	EXPECT_NE(std::string::npos, csv.find(",22,7,"));
+	std::string json = modules.getProfileJSON();
+	EXPECT_NE(std::string::npos, json.find("\"calls\": 7"));
+	EXPECT_EQ(7u, modules.getProfileCalls(1));
+
+	modules.resetProfile();
+	EXPECT_NE(std::string::npos, modules.getProfileCSV().find(",all,0,"));
+}
+
+TEST(ModuleList, profileCounters) {
+	ModuleList modules;
+	modules.setProfiling(true);
+	modules.add(new CascadeCounter());
+#ifndef CRPROPA_TESTS_SKIP_EXCEPTIONS
+	EXPECT_THROW(modules.setProfileCounters(std::vector<std::string>(1, "unknown")), std::runtime_error);
+#endif
+	EXPECT_TRUE(PerfCounters::isKnown("raw:0x4c7"));
+	EXPECT_FALSE(PerfCounters::isKnown("raw:"));
+
+	// the counters may not be available, then the profile has zeros
+	std::vector<std::string> names;
+	names.push_back("page-faults");
+	names.push_back("context-switches");
+	modules.setProfileCounters(names);
+	EXPECT_EQ(2u, modules.getProfileCounters().size());
+	modules.run(new Candidate(22, 4 * EeV));
+	EXPECT_NE(std::string::npos, modules.getProfileCSV().find(",calls,time,page-faults,context-switches\n"));
+	std::string json = modules.getProfileJSON();
+	EXPECT_NE(std::string::npos, json.find("\"counters\": {\"page-faults\": "));
+	EXPECT_EQ(0u, modules.getProfileCounter(0, "cycles"));
+
+	PerfCounters counters;
+	std::string error;
+	if (counters.open(names, error)) {
+		uint64_t before[2], after[2];
+		counters.read(before);
+		std::vector<char> memory(1 << 24, 1);
+		counters.read(after);
+		EXPECT_EQ(1, memory.back());
+		EXPECT_GT(after[0], before[0]);
+	}
+}
+
+TEST(ModuleList, loadReport) {
+	ModuleList modules;
+	modules.setLoadReport(true, 2);
+	EXPECT_TRUE(modules.getLoadReport());
+	EXPECT_EQ("", modules.getLoadSummary());
+	modules.add(new CascadeCounter());
+
+	ModuleList::candidate_vector_t candidates;
+	for (size_t i = 0; i < 4; i++)
+		candidates.push_back(new Candidate(22, 4 * EeV));
+	modules.run(&candidates);
+
+	std::vector<double> busy = modules.getThreadBusyTime();
+	EXPECT_FALSE(busy.empty());
+	EXPECT_GE(modules.getIdleFraction(), 0.);
+	EXPECT_LE(modules.getIdleFraction(), 1.);
+	std::string summary = modules.getLoadSummary();
+	EXPECT_NE(std::string::npos, summary.find("4 primaries"));
+	// the two slowest of the four primaries
+	size_t slowest = summary.find("slowest primaries");
+	ASSERT_NE(std::string::npos, slowest);
+	std::string line = summary.substr(slowest, summary.find('\n', slowest) - slowest);
+	EXPECT_EQ(1, std::count(line.begin(), line.end(), ','));
+}
+
+TEST(ModuleList, statistics) {
+	RunStatistics &statistics = RunStatistics::instance();
+	statistics.clear();
+	ModuleList modules;
+	modules.add(new CascadeCounter());
+	modules.setStatistics(true);
+	EXPECT_TRUE(modules.getStatistics());
+
+	// 1 photon of 4 EeV: 2 of 2 EeV, 4 of 1 EeV, one step each
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(22, 4 * EeV));
+	modules.run(&candidates);
+	modules.setStatistics(false);
+
+	EXPECT_EQ(6, statistics.getCount("Candidate: secondaries"));
+	EXPECT_EQ(7, statistics.getEntries("steps per candidate"));
+	EXPECT_DOUBLE_EQ(1, statistics.getMean("steps per candidate"));
+	EXPECT_EQ(1, statistics.getEntries("secondaries per primary"));
+	EXPECT_EQ(6, statistics.getMaximum("secondaries per primary"));
+	EXPECT_EQ(2, statistics.getMaximum("cascade depth"));
+	// 6 is in the bin [4, 8)
+	std::vector<uint64_t> bins = statistics.getHistogram("secondaries per primary");
+	ASSERT_EQ(4, bins.size());
+	EXPECT_EQ(1, bins[3]);
+
+	std::string summary = statistics.getSummary();
+	EXPECT_NE(std::string::npos, summary.find("Candidate: secondaries: 6"));
+	statistics.clear();
+	EXPECT_EQ(0, statistics.getCount("Candidate: secondaries"));
+}
+
+TEST(ModuleList, tracing) {
+	Tracer &tracer = Tracer::instance();
+	tracer.clear();
+	ModuleList modules;
+	modules.add(new CascadeCounter());
+	modules.add(new SimplePropagation());
+
+	// disabled: nothing is recorded
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(22, 4 * EeV));
+	modules.run(&candidates);
+	EXPECT_EQ(0, tracer.getNumberOfEvents());
+
+	// 7 candidates with one step of 2 modules each, all steps sampled
+	modules.setTracing(true, 1);
+	EXPECT_TRUE(modules.getTracing());
+	candidates[0] = new Candidate(22, 4 * EeV);
+	modules.run(&candidates);
+	modules.setTracing(false);
+	EXPECT_EQ(21, tracer.getNumberOfEvents());
+	std::vector<Tracer::Event> events = tracer.getEvents();
+	size_t spans = 0;
+	for (size_t i = 0; i < events.size(); i++)
+		if (std::string(events[i].category) == "candidate")
+			spans++;
+	EXPECT_EQ(7, spans);
+
+	std::string json = tracer.getChromeTraceJSON();
+	EXPECT_NE(std::string::npos, json.find("\"name\": \"SimplePropagation\""));
+	EXPECT_NE(std::string::npos, json.find("\"ph\": \"X\""));
+	tracer.clear();
+	EXPECT_EQ(0, tracer.getNumberOfEvents());
+}
+
+TEST(ModuleList, memoryUsage) {
+	int64_t candidates = MemoryUsage::getObjects(MemoryUsage::Candidates);
+	int64_t bytes = MemoryUsage::getBytes(MemoryUsage::Candidates);
+	{
+		ref_ptr<Candidate> c = new Candidate();
+		ref_ptr<Candidate> copy = c->clone();
+		EXPECT_EQ(candidates + 2, MemoryUsage::getObjects(MemoryUsage::Candidates));
+		EXPECT_EQ(bytes + 2 * int64_t(sizeof(Candidate)), MemoryUsage::getBytes(MemoryUsage::Candidates));
+	}
+	EXPECT_EQ(candidates, MemoryUsage::getObjects(MemoryUsage::Candidates));
+
+	int64_t grids = MemoryUsage::getBytes(MemoryUsage::Grids);
+	{
+		ref_ptr<Grid1f> grid = new Grid1f(Vector3d(0.), 4, 1.);
+		EXPECT_EQ(grids + 64 * 4, MemoryUsage::getBytes(MemoryUsage::Grids));
+	}
+	EXPECT_EQ(grids, MemoryUsage::getBytes(MemoryUsage::Grids));
+	EXPECT_NE(std::string::npos, MemoryUsage::getReport().find("grids"));
+
+	// any process is above a soft limit of 1 byte: the run is cancelled
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.setMemoryLimit(1, true);
+	EXPECT_EQ(1, modules.getMemoryLimit());
+	EXPECT_THROW(modules.run(&source, 100), std::runtime_error);
+	EXPECT_TRUE(MemoryUsage::isOverLimit());
+
+	// without cancel the run finishes
+	modules.setMemoryLimit(1, false);
+	modules.run(&source, 10);
+	modules.setMemoryLimit(0);
+	EXPECT_FALSE(MemoryUsage::isOverLimit());
+}
+
+TEST(ProgressBar, counters) {
+	ProgressBar bar(10);
+	bar.setMachineReadable(true);
+	bar.setThreads(2);
+	bar.setInterval(100);
+	bar.start("ProgressBar");
+	bar.update(3);
+	bar.addThreadWork(0, 300, 0);
+	bar.addThreadWork(1, 200, 0);
+	bar.addThreadWork(2, 100, 0); // unknown thread, ignored
+	{
+		ProgressWork work(&bar, 1, 2);
+		ProgressBar::countSteps(5);
+	}
+	std::string line = bar.getProgressLine();
+	EXPECT_EQ(0, line.find("crpropa::progress done=5 total=10 percent=50.0"));
+	EXPECT_NE(std::string::npos, line.find(" busy=0.00,"));
+	bar.stop();
+}
+
+TEST(ModuleList, schedule) {
+	ModuleList modules;
+	EXPECT_EQ(ModuleList::ScheduleDefault, modules.getSchedulePolicy());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+
+	ModuleList::SchedulePolicy policies[] = {ModuleList::ScheduleStatic,
+		ModuleList::ScheduleDynamic, ModuleList::ScheduleGuided,
+		ModuleList::ScheduleAdaptive, ModuleList::ScheduleAdaptive};
+	for (int j = 0; j < 5; j++) {
+		modules.setSchedule(policies[j], 2);
+		EXPECT_EQ(policies[j], modules.getSchedulePolicy());
+		EXPECT_EQ(2, modules.getScheduleChunkSize());
+		counter->count = 0;
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 16; i++)
+			candidates.push_back(new Candidate(22, 4 * EeV));
+		modules.run(&candidates);
+		EXPECT_EQ(16 * 7, counter->count);
+	}
+}
+
+TEST(ModuleList, threadAffinity) {
+	std::vector<int> cpus = Numa::getCpus();
+	EXPECT_GE(Numa::getNodeCount(), 1u);
+
+	ModuleList modules;
+	EXPECT_EQ(ModuleList::AffinityNone, modules.getThreadAffinity());
+	ref_ptr<CascadeCounter> counter = new CascadeCounter();
+	modules.add(counter);
+	ModuleList::ThreadAffinity affinities[] = {ModuleList::AffinityCompact, ModuleList::AffinitySpread};
+	for (int j = 0; j < 2; j++) {
+		modules.setThreadAffinity(affinities[j]);
+		EXPECT_EQ(affinities[j], modules.getThreadAffinity());
+		counter->count = 0;
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 8; i++)
+			candidates.push_back(new Candidate(22, 4 * EeV));
+		modules.run(&candidates);
+		EXPECT_EQ(8 * 7, counter->count);
+	}
+	// the calling thread may use all CPUs again
+	EXPECT_EQ(cpus, Numa::getCpus());
+}
+
+TEST(Numa, interleaveGrid) {
+	bool interleave = Numa::getInterleave();
+	Numa::setInterleave(true);
+	Numa::setMinimumSize(0);
+	// without several nodes the placement is skipped, the values are unchanged
+	Grid1f grid(Vector3d(0.), 64, 1.);
+	grid.get(1, 2, 3) = 5;
+	EXPECT_FLOAT_EQ(5, grid.get(1, 2, 3));
+	if (Numa::getNodeCount() < 2)
+		EXPECT_FALSE(Numa::interleave(&grid.get(0, 0, 0), 64 * 64 * 64 * sizeof(float)));
+	EXPECT_FALSE(Numa::interleave(0, 0));
+	Numa::setMinimumSize(1 << 20);
+	Numa::setInterleave(interleave);
+}
+
 #if _OPENMP
 #include <omp.h>
 TEST(ModuleList, runOpenMP) {
@@ -71,6 +780,344 @@ TEST(ModuleList, runOpenMP) {
 }
 #endif
 
+// draws a random energy loss per step and a random secondary
+class RandomLoss: public Module {
+public:
+	void process(Candidate *c) const {
+		Random &random = Random::instance();
+		c->current.setEnergy(c->current.getEnergy() * random.rand());
+		if (random.rand() < 0.5)
+			c->addSecondary(22, c->current.getEnergy() * random.rand());
+		if (c->current.getEnergy() < 1 * EeV)
+			c->setActive(false);
+	}
+};
+
+// collects the energies of all processed candidates
+class EnergyCollector: public Module {
+public:
+	mutable std::vector<double> energies;
+	void process(Candidate *c) const {
+		if (c->isActive())
+			return;
+#pragma omp critical(EnergyCollector)
+		energies.push_back(c->current.getEnergy());
+	}
+};
+
+TEST(ModuleList, runStreams) {
+	Source source;
+	source.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+
+	// on one and four threads, without and with tasks for the secondaries
+	std::vector<double> energies[4];
+	for (int i = 0; i < 4; i++) {
+		ModuleList modules;
+		modules.add(new RandomLoss());
+		ref_ptr<EnergyCollector> collector = new EnergyCollector();
+		modules.add(collector);
+		modules.setSecondaryTasks(i >= 2);
+#if _OPENMP
+		omp_set_num_threads((i % 2) ? 4 : 1);
+#endif
+		Random::seedStreams(1234);
+		modules.run(&source, 200);
+		energies[i] = collector->energies;
+		std::sort(energies[i].begin(), energies[i].end());
+	}
+	Random::disableStreams();
+
+	// the same candidates on any number of threads
+	EXPECT_LT(200, energies[0].size());
+	for (int j = 1; j < 4; j++) {
+		ASSERT_EQ(energies[0].size(), energies[j].size());
+		for (size_t i = 0; i < energies[0].size(); i++)
+			EXPECT_EQ(energies[0][i], energies[j][i]);
+	}
+}
+
+TEST(ModuleList, runOrderedOutput) {
+	// the ordered output is the same on any number of threads
+	Source source;
+	source.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+
+	std::string text[2];
+	for (int i = 0; i < 2; i++) {
+		std::stringstream stream;
+		ref_ptr<TextOutput> output = new TextOutput(stream, Output::Event1D);
+		// the numbers of the secondaries depend on the threads, their order does not
+		output->disable(Output::SerialNumberColumn);
+		output->setOrdered(true, 16);
+		ModuleList modules;
+		modules.add(new RandomLoss());
+		modules.add(output);
+#if _OPENMP
+		omp_set_num_threads(i ? 4 : 1);
+#endif
+		Random::seedStreams(4321);
+		modules.run(&source, 300);
+		output->close();
+		text[i] = stream.str();
+	}
+	Random::disableStreams();
+
+	EXPECT_LT(300, std::count(text[0].begin(), text[0].end(), '\n'));
+	EXPECT_EQ(text[0], text[1]);
+}
+
+// copies of candidates in chunks, failing after a number of candidates if given
+class CopyStream: public CandidateStream {
+	const std::vector<ref_ptr<Candidate> > &candidates;
+	size_t position, failAfter;
+public:
+	CopyStream(const std::vector<ref_ptr<Candidate> > &candidates, size_t failAfter = 0) :
+			candidates(candidates), position(0), failAfter(failAfter) {
+	}
+	std::vector<ref_ptr<Candidate> > next(size_t n) {
+		if (failAfter && (position >= failAfter))
+			throw std::runtime_error("CopyStream: failed");
+		n = std::min(n, candidates.size() - position);
+		std::vector<ref_ptr<Candidate> > chunk(n);
+		for (size_t i = 0; i < n; i++)
+			chunk[i] = candidates[position + i]->clone();
+		position += n;
+		return chunk;
+	}
+};
+
+TEST(ModuleList, runCandidateStream) {
+	ref_ptr<Source> source = new Source();
+	source->add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+	source->add(new SourceParticleType(nucleusId(1, 1)));
+	std::vector<ref_ptr<Candidate> > candidates = source->getCandidates(500);
+
+	// the candidates of a stream behave as those of a vector, without and with batches
+	std::vector<double> energies[4];
+	for (int i = 0; i < 4; i++) {
+		ModuleList modules;
+		modules.add(new RandomLoss());
+		ref_ptr<EnergyCollector> collector = new EnergyCollector();
+		modules.add(collector);
+		modules.setBatchSize((i >= 2) ? 16 : 0);
+		Random::seedStreams(1234);
+		ModuleList::candidate_vector_t copies;
+		if (i % 2 == 0) {
+			for (size_t j = 0; j < candidates.size(); j++)
+				copies.push_back(candidates[j]->clone());
+			modules.run(&copies);
+		} else {
+			CopyStream stream(candidates);
+			modules.run(&stream, 64);
+		}
+		energies[i] = collector->energies;
+		std::sort(energies[i].begin(), energies[i].end());
+	}
+	Random::disableStreams();
+	for (int j = 0; j < 4; j += 2) {
+		EXPECT_LT(500, energies[j].size());
+		ASSERT_EQ(energies[j].size(), energies[j + 1].size());
+		for (size_t i = 0; i < energies[j].size(); i++)
+			EXPECT_EQ(energies[j][i], energies[j + 1][i]);
+	}
+
+	// the error of a stream is thrown after the candidates read before
+	ModuleList modules;
+	ref_ptr<EnergyCollector> collector = new EnergyCollector();
+	modules.add(new MaximumTrajectoryLength(0));
+	modules.add(collector);
+	CopyStream failing(candidates, 200);
+	EXPECT_THROW(modules.run(&failing, 100), std::runtime_error);
+	EXPECT_EQ(200, collector->energies.size());
+	EXPECT_THROW(modules.run(&failing, 0), std::runtime_error);
+
+	// the candidates of a BinaryOutput file
+	ParticleCollector input;
+	for (size_t i = 0; i < candidates.size(); i++)
+		input.process(candidates[i]);
+	std::string filename = "testCandidateStream.bin";
+	input.dump(filename);
+	ref_ptr<BinaryStream> binary = new BinaryStream(filename);
+	EXPECT_EQ(500, binary->size());
+	collector->energies.clear();
+	modules.run(binary.get(), 64);
+	EXPECT_EQ(500, collector->energies.size());
+	EXPECT_TRUE(binary->next(10).empty());
+	std::remove(filename.c_str());
+
+	// readers with random access
+	SourceStream indexed(source, 70);
+	EXPECT_EQ(64, indexed.next(64).size());
+	EXPECT_EQ(6, indexed.next(64).size());
+	EXPECT_TRUE(indexed.next(64).empty());
+
+	// a source drawing in the reader thread is reproducible with the streams
+	std::vector<double> drawn[2];
+	for (int i = 0; i < 2; i++) {
+		Random::seedStreams(99);
+		SourceStream random(source, 200);
+		collector->energies.clear();
+		modules.run(&random, 64);
+		drawn[i] = collector->energies;
+		std::sort(drawn[i].begin(), drawn[i].end());
+	}
+	Random::disableStreams();
+	EXPECT_EQ(200, drawn[0].size());
+	EXPECT_EQ(drawn[0], drawn[1]);
+	// without them, the streams are only enabled during the run
+	SourceStream unseeded(source, 50);
+	modules.run(&unseeded, 16);
+	EXPECT_FALSE(Random::getStreamsEnabled());
+}
+
+TEST(ParameterSweep, run) {
+	// two jobs sharing a module, each with its own output
+	ref_ptr<Module> loss = new RandomLoss();
+	ref_ptr<Source> sources[2];
+	ref_ptr<ModuleList> simulations[2];
+	ref_ptr<EnergyCollector> collectors[2];
+	for (int j = 0; j < 2; j++) {
+		sources[j] = new Source();
+		sources[j]->add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -1 - j));
+		sources[j]->add(new SourceParticleType(nucleusId(1, 1)));
+		simulations[j] = new ModuleList();
+		simulations[j]->add(loss);
+		collectors[j] = new EnergyCollector();
+		simulations[j]->add(collectors[j]);
+	}
+
+	// the same candidates as in separate runs of the jobs
+	std::vector<double> energies[2];
+	Random::seedStreams(1234);
+	for (int j = 0; j < 2; j++) {
+		simulations[j]->run((SourceInterface *) sources[j], 100 + 50 * j);
+		energies[j] = collectors[j]->energies;
+		collectors[j]->energies.clear();
+	}
+
+	ref_ptr<ParameterSweep> sweep = new ParameterSweep();
+	sweep->setChunkSize(7);
+	for (int j = 0; j < 2; j++)
+		EXPECT_EQ(j, sweep->add(simulations[j], sources[j], 100 + 50 * j));
+	EXPECT_EQ(2, sweep->size());
+	Random::seedStreams(1234);
+	sweep->run();
+	Random::disableStreams();
+
+	for (int j = 0; j < 2; j++) {
+		EXPECT_LT(100 + 50 * j, energies[j].size());
+		std::vector<double> swept = collectors[j]->energies;
+		std::sort(energies[j].begin(), energies[j].end());
+		std::sort(swept.begin(), swept.end());
+		ASSERT_EQ(energies[j].size(), swept.size());
+		for (size_t i = 0; i < swept.size(); i++)
+			EXPECT_EQ(energies[j][i], swept[i]);
+		EXPECT_GE(sweep->getTime(j), 0);
+	}
+	EXPECT_THROW(sweep->getSimulation(2), std::runtime_error);
+}
+
+TEST(BackTracking, cache) {
+	ref_ptr<BackTracking> tracking = new BackTracking(Vector3d(0.2, 0, 0) * kpc, 1 * kpc);
+	EXPECT_EQ(0, tracking->addEvent(Vector3d(1, 0, 0)));
+	EXPECT_EQ(1, tracking->addEvent(Vector3d(0, 2, 0)));
+	EXPECT_EQ(0, tracking->addRigidity(10 * EeV));
+	EXPECT_EQ(0, tracking->addField("none", new UniformMagneticField(Vector3d(0.))));
+	EXPECT_EQ(1, tracking->addField("uniform", new UniformMagneticField(Vector3d(0, 0, 1) * muG)));
+	EXPECT_THROW(tracking->addField("none", new UniformMagneticField(Vector3d(0.))), std::runtime_error);
+	EXPECT_THROW(tracking->getResult(0, 0, 0), std::runtime_error);
+	EXPECT_EQ(4, tracking->run());
+
+	// straight to the sphere without a field
+	BackTrackingResult straight = tracking->getResult(0, 0, 0);
+	EXPECT_TRUE(straight.escaped);
+	EXPECT_NEAR(0.8 * kpc, straight.trajectoryLength, 1 * parsec);
+	EXPECT_NEAR(1, straight.direction.x, 1e-12);
+	BackTrackingResult deflected = tracking->getResult(0, 0, 1);
+	EXPECT_TRUE(deflected.escaped);
+	EXPECT_GT(deflected.direction.y, 0.01); // negative charge, B along z
+
+	// only the new combinations are tracked
+	EXPECT_EQ(0, tracking->run());
+	EXPECT_EQ(1, tracking->addRigidity(1 * EeV));
+	EXPECT_FALSE(tracking->isCached(1, 1, 1));
+	EXPECT_EQ(4, tracking->run());
+	EXPECT_EQ(8, tracking->getCacheSize());
+
+	std::string filename = "testBackTracking.cache";
+	tracking->saveCache(filename);
+	tracking->clearCache();
+	tracking->loadCache(filename);
+	EXPECT_EQ(8, tracking->getCacheSize());
+	EXPECT_EQ(deflected.direction, tracking->getResult(0, 0, 1).direction);
+	EXPECT_EQ(0, tracking->run());
+
+	// other settings invalidate the results
+	tracking->setMaximumTrajectoryLength(10 * kpc);
+	EXPECT_EQ(0, tracking->getCacheSize());
+	EXPECT_THROW(tracking->loadCache(filename), std::runtime_error);
+	std::remove(filename.c_str());
+}
+
+TEST(PropagationResponse, convolve) {
+	// without interactions each injection bin arrives in its own energy bin
+	ref_ptr<PropagationResponse> response = new PropagationResponse(1 * EeV, 100 * EeV, 4, 0.01, 0.03, 2);
+	response->addSpecies(22);
+	response->addSpecies(11);
+	EXPECT_EQ(16, response->getInjectionSize());
+
+	ModuleList simulation;
+	simulation.add(new SimplePropagation(1 * kpc, 10 * Mpc));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new Observer1D());
+	observer->onDetection(response);
+	simulation.add(observer);
+	response->compute(&simulation, 10);
+
+	EXPECT_EQ(16, response->getEntryCount());
+	std::vector<int> ids = response->getArrivalIds();
+	ASSERT_EQ(2, ids.size());
+	for (size_t s = 0; s < 2; s++)
+		for (size_t ie = 0; ie < 4; ie++)
+			for (size_t iz = 0; iz < 2; iz++) {
+				size_t i = response->getInjectionIndex(s, ie, iz);
+				int id = response->getSpecies()[s];
+				EXPECT_DOUBLE_EQ(1, response->getResponse(i, id, ie));
+				EXPECT_EQ(0, response->getResponse(i, id, (ie + 1) % 4));
+			}
+
+	// power law with a cutoff in the third bin, normalized to 1
+	std::vector<double> abundances(2, 1.);
+	abundances[1] = 3;
+	std::vector<double> weights = response->getInjectionWeights(abundances, 20 * EeV, -2, 3);
+	std::vector<double> spectra = response->convolve(weights);
+	ASSERT_EQ(8, spectra.size());
+	double sum = 0;
+	for (size_t i = 0; i < spectra.size(); i++)
+		sum += spectra[i];
+	EXPECT_NEAR(1, sum, 1e-12);
+	size_t photons = (ids[0] == 22) ? 0 : 4;
+	EXPECT_NEAR(0.25, spectra[photons] + spectra[photons + 1] + spectra[photons + 2], 1e-12);
+	EXPECT_EQ(0, spectra[photons + 3]);
+	EXPECT_GT(spectra[photons], spectra[photons + 1]);
+	// more candidates at higher redshifts with m > 0
+	EXPECT_GT(weights[response->getInjectionIndex(0, 0, 1)], weights[response->getInjectionIndex(0, 0, 0)]);
+	EXPECT_THROW(response->convolve(std::vector<double>(3)), std::runtime_error);
+
+	// the same spectra from a saved response
+	std::string filename = "/tmp/testPropagationResponse.bin";
+	response->save(filename);
+	ref_ptr<PropagationResponse> loaded = new PropagationResponse(1 * EeV, 10 * EeV, 1, 0, 1, 1);
+	loaded->load(filename);
+	std::remove(filename.c_str());
+	EXPECT_EQ(16, loaded->getInjectionSize());
+	std::vector<double> reloaded = loaded->convolve(weights);
+	ASSERT_EQ(spectra.size(), reloaded.size());
+	for (size_t i = 0; i < spectra.size(); i++)
+		EXPECT_EQ(spectra[i], reloaded[i]);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
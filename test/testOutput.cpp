@@ -8,13 +8,24 @@
 
 #include "gtest/gtest.h"
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <string>
+#ifdef __linux__
+#include <dirent.h>
+#endif
 
 
 #ifdef CRPROPA_HAVE_HDF5
 #include <hdf5.h>
 #endif
 
+#ifdef CRPROPA_HAVE_ZLIB
+#include <izstream.hpp>
+#endif
+
 // compare two arrays (intead of using Google Mock)
 // https://stackoverflow.com/a/10062016/6819103
 template <typename T, size_t size>
@@ -121,6 +132,34 @@ TEST(TextOutput, printProperty) {
 	EXPECT_EQ(captured.substr(0, captured.find("\n")), "#\tfoo");
 }
 
+TEST(TextOutput, filters) {
+	std::stringstream stream;
+	TextOutput output(stream, Output::Trajectory1D);
+	output.addIdFilter(22);
+	output.addIdFilter(11);
+	output.setEnergyRange(1 * EeV, 10 * EeV);
+	output.addPropertyRange("stage", 1, 2);
+	EXPECT_TRUE(output.isFiltered());
+
+	Candidate c(22, 5 * EeV);
+	output.process(&c); // without the property
+	c.setProperty("stage", 1);
+	output.process(&c);
+	c.current.setEnergy(10 * EeV);
+	output.process(&c);
+	c.current.setEnergy(2 * EeV);
+	c.current.setId(13);
+	output.process(&c);
+	c.current.setId(11);
+	output.process(&c);
+	EXPECT_EQ(2, output.size());
+
+	output.clearFilters();
+	EXPECT_FALSE(output.isFiltered());
+	output.process(&c);
+	EXPECT_EQ(3, output.size());
+}
+
 TEST(TextOutput, printHeader_Version) {
 	Candidate c;
 	TextOutput output(Output::Event1D);
@@ -157,6 +196,487 @@ TEST(HDF5Output, failOnIllegalOutputFile) {
 #endif
 #endif
 
+TEST(TextOutput, async) {
+	std::stringstream syncStream, asyncStream;
+	TextOutput syncOutput(syncStream, Output::Event1D);
+	TextOutput asyncOutput(asyncStream, Output::Event1D);
+	asyncOutput.setAsync(true, 8);
+	EXPECT_TRUE(asyncOutput.getAsync());
+
+	for (int i = 0; i < 100; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		syncOutput.process(&c);
+		asyncOutput.process(&c);
+	}
+	asyncOutput.close();
+	EXPECT_FALSE(asyncOutput.getAsync());
+	EXPECT_EQ(100, asyncOutput.size());
+	EXPECT_EQ(syncStream.str(), asyncStream.str());
+}
+
+TEST(TextOutput, ordered) {
+	// the same file for any order of the threads
+	std::stringstream expected, orderedStream;
+	TextOutput plain(expected, Output::Event1D);
+	TextOutput ordered(orderedStream, Output::Event1D);
+	ordered.setOrdered(true, 7);
+	EXPECT_TRUE(ordered.getOrdered());
+	EXPECT_THROW(ordered.setAsync(true), std::runtime_error);
+
+	std::vector<ref_ptr<Candidate> > candidates;
+	for (int i = 0; i < 1000; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, (i + 1) * EeV);
+		c->setSerialNumber(i);
+		candidates.push_back(c);
+		plain.process(c);
+	}
+#pragma omp parallel for schedule(dynamic, 3)
+	for (int i = 0; i < 1000; i++)
+		ordered.process(candidates[999 - i]);
+	EXPECT_EQ(0, ordered.size());
+	ordered.close();
+	EXPECT_FALSE(ordered.getOrdered());
+	EXPECT_EQ(1000, ordered.size());
+	EXPECT_EQ(expected.str(), orderedStream.str());
+}
+
+#ifdef __linux__
+// number of open file descriptors of the process
+static size_t openFiles() {
+	size_t n = 0;
+	DIR *dir = opendir("/proc/self/fd");
+	if (!dir)
+		return 0;
+	while (readdir(dir))
+		n++;
+	closedir(dir);
+	return n;
+}
+#endif
+
+TEST(OrderedRecords, memoryLimit) {
+	// over the soft limit the runs stay large enough and are merged,
+	// so only a few temporary files are open
+	MemoryUsage::setSoftLimit(1);
+	MemoryUsage::poll();
+	ASSERT_TRUE(MemoryUsage::isOverLimit());
+
+	OrderedRecords records(64);
+#ifdef __linux__
+	size_t files = openFiles();
+#endif
+	const size_t n = 20000;
+	for (size_t i = 0; i < n; i++) {
+		uint64_t key = (i * 7919) % n;
+		records.push(key, (const char *) &key, sizeof(key));
+	}
+	MemoryUsage::setSoftLimit(0);
+	EXPECT_EQ(n, records.size());
+#ifdef __linux__
+	EXPECT_LE(openFiles(), files + 16);
+#endif
+
+	uint64_t expected = 0;
+	records.merge([&expected](const char *data, size_t size) {
+		ASSERT_EQ(sizeof(uint64_t), size);
+		uint64_t key;
+		memcpy(&key, data, size);
+		EXPECT_EQ(expected, key);
+		expected++;
+	});
+	EXPECT_EQ(n, expected);
+	EXPECT_EQ(0, records.size());
+}
+
+#ifdef CRPROPA_HAVE_ZLIB
+TEST(TextOutput, gzip) {
+	std::stringstream text;
+	TextOutput plain(text, Output::Trajectory3D);
+	std::string filename = "testOutput_gzip.txt.gz";
+	TextOutput output(filename, Output::Trajectory3D);
+	output.setCompressionThreads(2);
+	EXPECT_EQ(2u, output.getCompressionThreads());
+	for (int i = 0; i < 20000; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		plain.process(&c);
+		output.process(&c);
+	}
+	output.close();
+
+	// one gzip stream of several blocks
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	zstream::igzstream in(file);
+	std::stringstream decompressed;
+	decompressed << in.rdbuf();
+	EXPECT_EQ(text.str(), decompressed.str());
+	std::remove(filename.c_str());
+}
+
+TEST(ParallelGzipStream, empty) {
+	std::stringstream compressed;
+	{
+		ParallelGzipStream out(compressed, 0);
+	}
+	zstream::igzstream in(compressed);
+	std::stringstream decompressed;
+	decompressed << in.rdbuf();
+	EXPECT_EQ("", decompressed.str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(HDF5Output, async) {
+	std::string filename = "testOutput_async.h5";
+	HDF5Output output(filename, Output::Event1D);
+	output.setAsync(true, 8);
+#pragma omp parallel for
+	for (int i = 0; i < 100; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		output.process(&c);
+	}
+	output.flush();
+	EXPECT_EQ(100, output.size());
+	output.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(100, H5Sget_simple_extent_npoints(space));
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(HDF5Output, compression) {
+	std::string filename = "testOutput_compression.h5";
+	HDF5Output output;
+	output.setChunkSize(100);
+	output.setCompression(HDF5Output::CompressionDeflate, 9);
+	output.open(filename);
+	output.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t plist = H5Dget_create_plist(dset);
+	hsize_t chunk[1];
+	H5Pget_chunk(plist, 1, chunk);
+	EXPECT_EQ(100, chunk[0]);
+	// shuffle and deflate
+	EXPECT_EQ(2, H5Pget_nfilters(plist));
+	H5Pclose(plist);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(HDF5Output, sharded) {
+	std::string filename = "testOutput_sharded.h5";
+	HDF5Output output;
+	output.setOutputType(Output::Event1D);
+	output.setSharded(true);
+	output.open(filename);
+#pragma omp parallel for
+	for (int i = 0; i < 3000; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		output.process(&c);
+	}
+	output.close();
+	EXPECT_EQ(3000, output.size());
+
+	// the shards are visible as one dataset with the attributes
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(3000, H5Sget_simple_extent_npoints(space));
+	EXPECT_TRUE(H5Aexists(dset, "Version") > 0);
+
+	std::vector<double> energies(3000);
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(double));
+	H5Tinsert(type, "E", 0, H5T_NATIVE_DOUBLE);
+	H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, energies.data());
+	std::sort(energies.begin(), energies.end());
+	EXPECT_DOUBLE_EQ(1, energies.front());
+	EXPECT_DOUBLE_EQ(3000, energies.back());
+
+	H5Tclose(type);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(HDF5Output, packedRows) {
+	std::string filename = "testOutput_packed.h5";
+	HDF5Output output(filename, Output::Event1D);
+	output.enable(Output::CandidateTagColumn);
+	Candidate c(22, 1 * EeV);
+	c.setTagOrigin("PD");
+	output.process(&c);
+	output.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	// D, ID, E, ID0, E0 and the tag without padding
+	hid_t type = H5Dget_type(dset);
+	EXPECT_EQ(3 * sizeof(double) + 3 * sizeof(int32_t), H5Tget_size(type));
+	H5Tclose(type);
+
+	int32_t tag;
+	type = H5Tcreate(H5T_COMPOUND, sizeof(int32_t));
+	H5Tinsert(type, "tag", 0, H5T_NATIVE_INT32);
+	H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &tag);
+	H5Tclose(type);
+
+	hid_t attr = H5Aopen(dset, "TagNames", H5P_DEFAULT);
+	type = H5Aget_type(attr);
+	hid_t space = H5Aget_space(attr);
+	size_t length = H5Tget_size(type);
+	std::vector<char> names(length * H5Sget_simple_extent_npoints(space));
+	ASSERT_LT(tag, H5Sget_simple_extent_npoints(space));
+	H5Aread(attr, type, names.data());
+	EXPECT_EQ("PD", std::string(&names[tag * length]));
+
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(HDF5Reader, readBack) {
+	std::string filename = "testOutput_reader.h5";
+	HDF5Output output(filename, Output::Everything);
+	output.enable(Output::CandidateTagColumn);
+	output.enableProperty("stage", Variant::fromInt32(0));
+	output.enableProperty("depth", Variant::fromDouble(0));
+	for (int i = 0; i < 10; i++) {
+		Candidate c(1000010010, (i + 1) * EeV, Vector3d(i, 0, 1) * Mpc, Vector3d(0, 1, 0));
+		c.source.setEnergy(100 * EeV);
+		c.setWeight(0.5);
+		c.setTagOrigin("ES");
+		c.setProperty("stage", Variant::fromInt32(i));
+		output.process(&c);
+	}
+	output.close();
+
+	HDF5Reader reader(filename);
+	reader.setChunkSize(4);
+	EXPECT_EQ(10, reader.size());
+	std::vector<std::string> names = reader.getPropertyNames();
+	ASSERT_EQ(2, names.size());
+	EXPECT_EQ("stage", names[0]);
+
+	ref_ptr<Candidate> c = reader.getCandidate(7);
+	EXPECT_EQ(1000010010, c->current.getId());
+	EXPECT_DOUBLE_EQ(8 * EeV, c->current.getEnergy());
+	EXPECT_DOUBLE_EQ(7 * Mpc, c->current.getPosition().x);
+	EXPECT_DOUBLE_EQ(1, c->current.getDirection().y);
+	EXPECT_DOUBLE_EQ(100 * EeV, c->source.getEnergy());
+	EXPECT_DOUBLE_EQ(0.5, c->getWeight());
+	EXPECT_EQ("ES", c->getTagOrigin());
+	EXPECT_EQ(7, c->getProperty("stage").toInt32());
+	EXPECT_DOUBLE_EQ(0, c->getProperty("depth").toDouble());
+
+	// consecutive indices across the chunks and a restricted range
+	reader.setRange(2, 6);
+	std::vector<size_t> indices;
+	for (size_t i = 0; i < 6; i++)
+		indices.push_back(i);
+	std::vector<ref_ptr<Candidate> > candidates = reader.getCandidates(indices);
+	ASSERT_EQ(6, candidates.size());
+	EXPECT_EQ(2, candidates[0]->getProperty("stage").toInt32());
+	EXPECT_EQ(7, candidates[5]->getProperty("stage").toInt32());
+	EXPECT_THROW(reader.getCandidate(6), std::runtime_error);
+
+	// restarted candidates begin at the stored current state
+	reader.setRestart(true);
+	c = reader.getCandidate(0);
+	EXPECT_DOUBLE_EQ(3 * EeV, c->source.getEnergy());
+	EXPECT_DOUBLE_EQ(0, c->getTrajectoryLength());
+
+	ParticleCollector collector;
+	collector.load(filename);
+	EXPECT_EQ(10, collector.size());
+	EXPECT_EQ(9, collector[9]->getProperty("stage").toInt32());
+	std::remove(filename.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_PARQUET
+TEST(ParquetOutput, write) {
+	std::string filename = "testOutput.parquet";
+	ParquetOutput output(filename, Output::Event1D);
+	output.setRowGroupSize(10);
+	output.enableProperty("foo", 1.5);
+	for (int i = 0; i < 25; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		output.process(&c);
+	}
+	output.close();
+	EXPECT_EQ(25, output.size());
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	char magic[4];
+	file.read(magic, 4);
+	EXPECT_EQ("PAR1", std::string(magic, 4));
+	std::remove(filename.c_str());
+}
+#endif
+
+//-- HistogramOutput
+TEST(HistogramOutput, spectrum) {
+	HistogramOutput output;
+	std::vector<int> ids;
+	ids.push_back(nucleusId(1, 1));
+	ids.push_back(nucleusId(4, 2));
+	output.addIdAxis(HistogramOutput::CurrentId, ids);
+	output.addAxis(HistogramOutput::CurrentEnergy, 3, 1 * EeV, 1000 * EeV, true);
+	EXPECT_EQ(6, output.getNumberOfBins());
+
+#pragma omp parallel for
+	for (int i = 0; i < 100; i++) {
+		Candidate c(nucleusId(1, 1), 5 * EeV);
+		output.process(&c);
+		c.current.setEnergy(500 * EeV);
+		c.current.setId(nucleusId(4, 2));
+		c.setWeight(2);
+		output.process(&c);
+		// not counted: unlisted id and out of range
+		c.current.setId(nucleusId(12, 6));
+		output.process(&c);
+		c.current.setId(nucleusId(1, 1));
+		c.current.setEnergy(0.1 * EeV);
+		output.process(&c);
+	}
+
+	std::vector<size_t> bins(2, 0);
+	EXPECT_DOUBLE_EQ(100, output.getBinContent(output.getIndex(bins)));
+	bins[0] = 1;
+	bins[1] = 2;
+	EXPECT_DOUBLE_EQ(200, output.getBinContent(output.getIndex(bins)));
+	double sum = 0;
+	for (size_t i = 0; i < output.getNumberOfBins(); i++)
+		sum += output.getBinContent(i);
+	EXPECT_DOUBLE_EQ(300, sum);
+
+	output.clear();
+	EXPECT_DOUBLE_EQ(0, output.getBinContent(0));
+}
+
+#ifdef WITH_GALACTIC_LENSES
+TEST(HistogramOutput, skyMap) {
+	std::string filename = "testOutput_histogram.txt";
+	{
+		HistogramOutput output(filename);
+		output.addPixelAxis(2);
+		EXPECT_EQ(192, output.getNumberOfBins());
+		Candidate c;
+		c.current.setDirection(Vector3d(0, 0, -1));
+		output.process(&c);
+	}
+
+	std::ifstream file(filename.c_str());
+	std::string line;
+	std::getline(file, line);
+	EXPECT_EQ("# HistogramOutput", line);
+	size_t rows = 0;
+	while (std::getline(file, line))
+		if (line[0] != '#')
+			rows++;
+	EXPECT_EQ(1, rows);
+	file.close();
+	std::remove(filename.c_str());
+}
+#endif
+
+TEST(StreamOutput, chunks) {
+	StreamOutput output(4, Output::Event1D);
+	output.enableProperty("w", Variant::fromDouble(-1));
+	std::vector<std::string> names = output.getColumnNames();
+	ASSERT_EQ(6, names.size());
+	EXPECT_EQ("D", names[0]);
+	EXPECT_EQ("E0", names[4]);
+	EXPECT_EQ("w", names[5]);
+
+	for (int i = 0; i < 10; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		if (i == 0)
+			c.setProperty("w", 2.);
+		output.process(&c);
+	}
+	EXPECT_EQ(2, output.getNumberOfQueuedChunks());
+	output.flush();
+	EXPECT_EQ(3, output.getNumberOfQueuedChunks());
+
+	ref_ptr<OutputChunk> chunk = output.popChunk();
+	EXPECT_EQ(4, chunk->getRows());
+	EXPECT_EQ(6, chunk->getWidth());
+	EXPECT_DOUBLE_EQ(22, chunk->values[1]);
+	EXPECT_DOUBLE_EQ(1, chunk->values[2]);
+	EXPECT_DOUBLE_EQ(2, chunk->values[5]);
+	EXPECT_DOUBLE_EQ(-1, chunk->values[11]);
+	output.popChunk();
+	EXPECT_EQ(2, output.popChunk()->getRows());
+	EXPECT_FALSE(output.popChunk().valid());
+}
+
+TEST(StreamOutput, async) {
+	StreamOutput output(8, Output::Event3D);
+	output.setAsync(true, 4);
+#pragma omp parallel for
+	for (int i = 0; i < 100; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		output.process(&c);
+	}
+	output.close();
+	EXPECT_EQ(100, output.size());
+
+	size_t rows = 0;
+	double energy = 0;
+	size_t width = output.getColumnNames().size();
+	while (ref_ptr<OutputChunk> chunk = output.popChunk()) {
+		EXPECT_EQ(width, chunk->getWidth());
+		rows += chunk->getRows();
+		for (size_t i = 0; i < chunk->getRows(); i++)
+			energy += chunk->values[i * width + 2];
+	}
+	EXPECT_EQ(100, rows);
+	EXPECT_DOUBLE_EQ(5050, energy);
+}
+
+#ifndef CRPROPA_TESTS_SKIP_EXCEPTIONS
+class FailingStreamOutput: public StreamOutput {
+public:
+	FailingStreamOutput() : StreamOutput(8, Output::Event1D) {
+	}
+	void onChunk(OutputChunk *) const {
+		throw std::runtime_error("consumer failed");
+	}
+};
+
+TEST(StreamOutput, asyncError) {
+	// an exception of the writer thread is rethrown by close
+	FailingStreamOutput output;
+	output.setAsync(true, 4);
+#pragma omp parallel for
+	for (int i = 0; i < 20; i++) {
+		Candidate c(22, (i + 1) * EeV);
+		output.process(&c);
+	}
+	EXPECT_THROW(output.close(), std::runtime_error);
+	EXPECT_FALSE(output.getAsync());
+}
+#endif
+
 //-- ParticleCollector
 TEST(ParticleCollector, size) {
 	ref_ptr<Candidate> c = new Candidate();
@@ -177,6 +697,15 @@ TEST(ParticleCollector, fetchItem) {
 	EXPECT_EQ(output[0], c);
 }
 
+TEST(ParticleCollector, sharedReference) {
+	ref_ptr<Candidate> c = new Candidate();
+	c->setThreadConfined();
+	ParticleCollector output;
+	output.process(c);
+	EXPECT_FALSE(c->isThreadConfined());
+	EXPECT_EQ(2, c->getReferenceCount());
+}
+
 TEST(ParticleCollector, reprocess) {
 	ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 1 * EeV);
 	ParticleCollector collector;
@@ -213,6 +742,43 @@ TEST(ParticleCollector, dumpload) {
 	EXPECT_EQ(output[3]->getRedshift(), c->getRedshift());
 }
 
+TEST(ParticleCollector, dumploadBinary) {
+	ref_ptr<Candidate> c = new Candidate(nucleusId(4, 2), 1.234 * EeV);
+	c->current.setPosition(Vector3d(1, 2, 3) * kpc);
+	c->current.setDirection(Vector3d(0, 0.6, -0.8));
+	c->source.setEnergy(10 * EeV);
+	c->setTrajectoryLength(1 * Mpc);
+	c->setRedshift(2);
+	c->setWeight(0.5);
+	c->addSecondary(nucleusId(1, 1), 1 * EeV);
+
+	ParticleCollector input;
+	ParticleCollector output;
+	for (int i = 0; i < 10; ++i)
+		input.process(c);
+	input.process(c->secondaries[0]);
+
+	std::string filename = "ParticleCollector_DumpTest.bin";
+	input.dump(filename);
+	EXPECT_TRUE(BinaryOutput::isBinaryFile(filename));
+	output.load(filename);
+	std::remove(filename.c_str());
+
+	// the state is stored without loss
+	ASSERT_EQ(input.size(), output.size());
+	EXPECT_EQ(c->current.getId(), output[0]->current.getId());
+	EXPECT_EQ(c->current.getEnergy(), output[0]->current.getEnergy());
+	EXPECT_EQ(c->current.getPosition(), output[0]->current.getPosition());
+	EXPECT_EQ(c->current.getDirection(), output[0]->current.getDirection());
+	EXPECT_EQ(c->source.getEnergy(), output[0]->source.getEnergy());
+	EXPECT_EQ(c->getTrajectoryLength(), output[0]->getTrajectoryLength());
+	EXPECT_EQ(c->getRedshift(), output[0]->getRedshift());
+	EXPECT_EQ(c->getWeight(), output[0]->getWeight());
+	EXPECT_EQ(c->getSerialNumber(), output[0]->getSerialNumber());
+	EXPECT_EQ(c->getSerialNumber(), output[10]->getCreatedSerialNumber());
+	EXPECT_EQ(nucleusId(1, 1), output[10]->current.getId());
+}
+
 // Just test if the trajectory is on a line for rectilinear propagation
 TEST(ParticleCollector, getTrajectory) {
 	int pos_x[10];
@@ -271,6 +837,95 @@ TEST(ParticleCollector, runModuleList) {
 	modules.run(&candidates);
 }
 
+TEST(ParticleCollector, compact) {
+	ParticleCollector collector;
+	collector.setCompact(ParticleCollector::CompactCurrent | ParticleCollector::CompactSourceIdEnergy);
+#pragma omp parallel for
+	for (int i = 0; i < 10000; i++) {
+		Candidate c(nucleusId(1, 1), (i + 1) * EeV, Vector3d(i, 0, 0), Vector3d(0, 1, 0));
+		c.source.setEnergy(2 * (i + 1) * EeV);
+		collector.process(&c);
+	}
+	ASSERT_EQ(10000, collector.size());
+	EXPECT_TRUE(collector.getContainer().empty());
+	EXPECT_THROW(collector.setCompact(0), std::runtime_error);
+
+	double sum = 0;
+	for (size_t i = 0; i < collector.size(); i++) {
+		ref_ptr<Candidate> c = collector[i];
+		EXPECT_EQ(nucleusId(1, 1), c->current.getId());
+		EXPECT_DOUBLE_EQ(c->current.getPosition().x + 1, c->current.getEnergy() / EeV);
+		EXPECT_DOUBLE_EQ(2 * c->current.getEnergy(), c->source.getEnergy());
+		sum += c->current.getEnergy() / EeV;
+	}
+	EXPECT_DOUBLE_EQ(10000. * 10001 / 2, sum);
+
+	// the candidates are rebuilt for the run
+	ModuleList modules;
+	modules.setShowProgress(false);
+	ref_ptr<ParticleCollector> output = new ParticleCollector();
+	modules.add(output);
+	modules.add(new MaximumTrajectoryLength(0));
+	modules.run(&collector);
+	EXPECT_EQ(10000, output->size());
+
+	collector.clearContainer();
+	EXPECT_EQ(0, collector.size());
+}
+
+TEST(ParticleCollector, columns) {
+	ParticleCollector candidates, compact;
+	compact.setCompact(ParticleCollector::CompactCurrent | ParticleCollector::CompactInfo);
+	for (int i = 0; i < 20; i++) {
+		ref_ptr<Candidate> c = new Candidate(nucleusId(4, 2), (i + 1) * EeV, Vector3d(i, 2, 3), Vector3d(1, i, 0));
+		c->source.setEnergy(2 * (i + 1) * EeV);
+		c->setTrajectoryLength(i * Mpc);
+		c->setWeight(0.5);
+		candidates.process(c);
+		compact.process(c);
+	}
+
+	// the same values as the rebuilt candidates, in both modes
+	ParticleCollector *collectors[2] = {&candidates, &compact};
+	for (int k = 0; k < 2; k++) {
+		for (int col = 0; col <= Output::WeightColumn; col++) {
+			Output::OutputColumn column = Output::OutputColumn(col);
+			size_t width = ParticleCollector::getColumnWidth(column);
+			if (width == 0) {
+				EXPECT_THROW(collectors[k]->exportColumn(column, 0), std::runtime_error);
+				continue;
+			}
+			std::vector<double> values(20 * width), expected(width);
+			collectors[k]->exportColumn(column, &values[0]);
+			ParticleCollector single;
+			for (size_t i = 0; i < 20; i++) {
+				single.clearContainer();
+				single.process((*collectors[k])[i]);
+				single.exportColumn(column, &expected[0]);
+				for (size_t j = 0; j < width; j++)
+					EXPECT_DOUBLE_EQ(expected[j], values[i * width + j]);
+			}
+		}
+	}
+
+	// candidates built from columns
+	std::vector<double> energy(20), position(60), direction(60);
+	candidates.exportColumn(Output::CurrentEnergyColumn, &energy[0]);
+	candidates.exportColumn(Output::CurrentPositionColumn, &position[0]);
+	candidates.exportColumn(Output::CurrentDirectionColumn, &direction[0]);
+	ParticleCollector imported;
+	imported.importColumn(Output::CurrentEnergyColumn, &energy[0], 20);
+	imported.importColumn(Output::CurrentPositionColumn, &position[0], 20);
+	imported.importColumn(Output::CurrentDirectionColumn, &direction[0], 20);
+	ASSERT_EQ(20, imported.size());
+	for (size_t i = 0; i < 20; i++) {
+		EXPECT_DOUBLE_EQ(candidates[i]->current.getEnergy(), imported[i]->current.getEnergy());
+		EXPECT_EQ(candidates[i]->current.getPosition(), imported[i]->current.getPosition());
+		EXPECT_NEAR(0, (candidates[i]->current.getDirection() - imported[i]->current.getDirection()).getR(), 1e-15);
+	}
+	EXPECT_THROW(compact.importColumn(Output::CurrentEnergyColumn, &energy[0], 20), std::runtime_error);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -3,6 +3,22 @@
 #include "crpropa/module/SimplePropagation.h"
 #include "crpropa/module/PropagationBP.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationDP.h"
+#include "crpropa/module/PropagationGC.h"
+#include "crpropa/module/FastNeutralPropagation.h"
+#include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/module/StepPlanner.h"
+#include "crpropa/module/Propagation1D.h"
+#include "crpropa/module/CompositePropagation.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/OffloadEngine.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/module/ParticleCollector.h"
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 
 #include "gtest/gtest.h"
@@ -146,6 +162,37 @@ TEST(testPropagationCK, reduceStep) {
 }
 
 
+// Field counting its evaluations
+class CountingMagneticField: public MagneticField {
+	Vector3d value;
+public:
+	mutable int count;
+	CountingMagneticField(const Vector3d &value) : value(value), count(0) {
+	}
+	Vector3d getField(const Vector3d &position) const {
+		count++;
+		return value;
+	}
+};
+
+TEST(testPropagationCK, reuseFirstStage) {
+	// the field at the start is evaluated once for all rejected steps
+	ref_ptr<CountingMagneticField> field = new CountingMagneticField(Vector3d(0, 0, 100 * nG));
+	PropagationCK propa(field, 1e-15, 0.1 * kpc, 1 * Gpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(100 * TeV);
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	c.setNextStep(1 * Gpc);
+	propa.process(&c);
+
+	EXPECT_GT(field->count, 6); // several tries
+	EXPECT_EQ((field->count - 1) % 5, 0); // 5 evaluations per try and one at the start
+	EXPECT_DOUBLE_EQ(0.1 * kpc, c.getCurrentStep());
+}
+
 // Test if the step size is increased correctly if the error is small with respect to the tolerance: r < 1
 TEST(testPropagationCK, increaseStep) {
 	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
@@ -270,6 +317,182 @@ TEST(testPropagationCK, neutron) {
 }
 
 
+TEST(testPropagationDP, exceptions) {
+	// minStep should be smaller than maxStep
+	EXPECT_THROW(PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 0.42, 10 , 0), std::runtime_error);
+	// Too large tolerance: tolerance should be between 0 and 1
+	EXPECT_THROW(PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 42., 10 * kpc , 20 * kpc), std::runtime_error);
+}
+
+TEST(testPropagationDP, firstSameAsLast) {
+	// the field at the end of a step is the first stage of the next one
+	ref_ptr<CountingMagneticField> field = new CountingMagneticField(Vector3d(0, 0, 1 * nG));
+	PropagationDP propa(field, 1e-4, 1 * Mpc, 1 * Mpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(100 * EeV);
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	for (int i = 0; i < 3; i++)
+		propa.process(&c);
+	EXPECT_EQ(1 + 3 * 6, field->count);
+
+	// not after the candidate was moved, or at a different redshift
+	c.current.setPosition(Vector3d(1 * Mpc, 0, 0));
+	propa.process(&c);
+	EXPECT_EQ(1 + 4 * 6 + 1, field->count);
+	c.setRedshift(0.1);
+	propa.process(&c);
+	EXPECT_EQ(1 + 5 * 6 + 2, field->count);
+}
+
+// Test the numerical results for parallel magnetic field lines along the z-axis
+TEST(testPropagationDP, gyration) {
+	double step = 10. * Mpc;  // gyroradius is 108.1 Mpc
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 1e-4, step, step);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(100 * EeV);
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(1, 1, 1));
+	Candidate c(p);
+	for (int i = 0; i < 10; i++)
+		propa.process(&c);
+
+	// momentum and velocity parallel and perpendicular to the field are conserved
+	double precision = 1e-7;
+	Vector3d dir = c.current.getDirection();
+	double posZ = c.current.getPosition().z;
+	EXPECT_NEAR(2 / 3., dir.x * dir.x + dir.y * dir.y, 2 / 3. * precision);
+	EXPECT_NEAR(1 / 3., dir.z * dir.z, 1 / 3. * precision);
+	EXPECT_NEAR(100 * step * step / 3., posZ * posZ, 100 * step * step / 3. * precision);
+
+	// the gyration matches the PropagationCK solution
+	PropagationCK propaCK(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 1e-4, step, step);
+	Candidate cCK(p);
+	for (int i = 0; i < 10; i++)
+		propaCK.process(&cCK);
+	EXPECT_NEAR(0, (c.current.getPosition() - cCK.current.getPosition()).getR(), 1e-5 * step);
+}
+
+TEST(testPropagationDP, adaptiveStep) {
+	// the step is kept within the tolerance and grows if the error is small
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 1e-4, 0.1 * kpc, 1 * Gpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(100 * EeV);
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	c.setNextStep(0.1 * kpc);
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(0.1 * kpc, c.getCurrentStep());
+	EXPECT_GT(c.getNextStep(), 0.1 * kpc);
+
+	// a too large step is reduced
+	c.setNextStep(1 * Gpc);
+	propa.process(&c);
+	EXPECT_LT(c.getCurrentStep(), 1 * Gpc);
+	EXPECT_NEAR(1, c.current.getDirection().getR(), 1e-12);
+
+	// neutral particles move straight with the maximum next step
+	c.current.setId(nucleusId(1, 0));
+	c.setNextStep(1 * kpc);
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(1 * Gpc, c.getNextStep());
+}
+
+// Field along z with a gradient in x, B = B0 (1 + x / L)
+class GradientMagneticField: public MagneticField {
+	double B0, L;
+public:
+	GradientMagneticField(double B0, double L) : B0(B0), L(L) {
+	}
+	Vector3d getField(const Vector3d &position) const {
+		return Vector3d(0, 0, B0 * (1 + position.x / L));
+	}
+};
+
+TEST(testPropagationGC, exceptions) {
+	EXPECT_THROW(PropagationGC propa(NULL, 1e-4, 0.1 * kpc, 1 * Gpc, 2.), std::runtime_error);
+	EXPECT_THROW(PropagationGC propa(NULL, 1e-4, 0.1 * kpc, 1 * Gpc, 0.01, 0.), std::runtime_error);
+	EXPECT_THROW(PropagationGC propa(NULL, 1e-4, 10 * kpc, 1 * kpc), std::runtime_error);
+}
+
+TEST(testPropagationGC, uniformField) {
+	// in a uniform field the guiding centre step is the exact helix
+	PropagationGC propa(new UniformMagneticField(Vector3d(0, 0, 1 * muG)), 1e-4, 1 * pc, 1 * kpc);
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(1 * PeV);
+	p.setDirection(Vector3d(1, 0, 1));
+	Candidate c(p);
+	c.setNextStep(100 * pc);
+	EXPECT_TRUE(propa.guidingCentreStep(&c));
+	EXPECT_DOUBLE_EQ(100 * pc, c.getCurrentStep());
+
+	// gyration around (0, -rL, z) in the negative sense, for a cos pitch of 1 / sqrt(2)
+	double rL = 1 * PeV / (eplus * c_light * muG) / sqrt(2.);
+	double phase = -100 * pc / sqrt(2.) / rL;
+	Vector3d expected(rL * sin(-phase), -rL + rL * cos(phase), 100 * pc / sqrt(2.));
+	EXPECT_NEAR(0, (c.current.getPosition() - expected).getR(), 1e-6 * pc);
+	EXPECT_NEAR(1 / sqrt(2.), c.current.getDirection().z, 1e-12);
+}
+
+TEST(testPropagationGC, gradientDrift) {
+	// the guiding centre drifts like the full orbit, with far fewer steps
+	ref_ptr<MagneticField> field = new GradientMagneticField(1 * muG, 200 * pc);
+	PropagationGC gc(field, 1e-9, 1e-8 * pc, 1 * kpc);
+	PropagationCK ck(field, 1e-9, 1e-8 * pc, 1 * kpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(1 * PeV); // Larmor radius 1.08 pc
+	p.setDirection(Vector3d(1, 0, 1));
+	EXPECT_NEAR(0.0054, gc.getAdiabaticity(Vector3d(0.), 0, p.getEnergy(), p.getCharge()), 1e-4);
+
+	Candidate cGC(p), cCK(p);
+	int stepsGC = 0, stepsCK = 0;
+	for (; cGC.getTrajectoryLength() < 400 * pc; stepsGC++) {
+		cGC.limitNextStep(400 * pc - cGC.getTrajectoryLength());
+		gc.process(&cGC);
+	}
+	for (; cCK.getTrajectoryLength() < 400 * pc; stepsCK++) {
+		cCK.limitNextStep(400 * pc - cCK.getTrajectoryLength());
+		ck.process(&cCK);
+	}
+	EXPECT_LT(stepsGC * 20, stepsCK);
+
+	// the grad-B drift along B x grad B is 0.37 pc
+	EXPECT_NEAR(0, (cGC.current.getPosition() - cCK.current.getPosition()).getR(), 0.01 * pc);
+	EXPECT_GT(cGC.current.getPosition().y, 0.3 * pc);
+}
+
+TEST(testPropagationGC, fullOrbit) {
+	// where the field varies within a Larmor radius the full orbit is integrated
+	ref_ptr<MagneticField> field = new GradientMagneticField(1 * muG, 1 * pc);
+	PropagationGC gc(field, 1e-4, 1e-4 * pc, 1 * kpc);
+	PropagationCK ck(field, 1e-4, 1e-4 * pc, 1 * kpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(1 * PeV);
+	p.setPosition(Vector3d(0.5 * pc, 0, 0));
+	p.setDirection(Vector3d(1, 0, 1));
+	Candidate cGC(p), cCK(p);
+	cGC.setNextStep(0.01 * pc);
+	cCK.setNextStep(0.01 * pc);
+	EXPECT_FALSE(gc.guidingCentreStep(&cGC));
+	for (int i = 0; i < 10; i++) {
+		gc.process(&cGC);
+		ck.process(&cCK);
+	}
+	EXPECT_EQ(cCK.current.getPosition(), cGC.current.getPosition());
+}
+
 TEST(testPropagationBP, zeroField) {
 	PropagationBP propa(new UniformMagneticField(Vector3d(0, 0, 0)), 1 * kpc);
 
@@ -547,6 +770,444 @@ TEST(testPropagationBP, neutron) {
 	EXPECT_EQ(Vector3d(0, 1, 0), c.current.getDirection());
 }
 
+// Counts the batched field evaluations
+class BatchCountingMagneticField: public GradientMagneticField {
+public:
+	mutable int calls;
+	BatchCountingMagneticField() : GradientMagneticField(1 * nG, 10 * kpc), calls(0) {
+	}
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		calls++;
+		MagneticField::getFields(positions, fields, n, z);
+	}
+};
+
+TEST(testPropagationBP, batch) {
+	// a fixed step batch gives the same as processing the candidates one by one
+	ref_ptr<BatchCountingMagneticField> field = new BatchCountingMagneticField();
+	PropagationBP propa(field, 10 * kpc);
+
+	std::vector<ref_ptr<Candidate> > single, batched;
+	for (int i = 0; i < 9; i++) {
+		ParticleState p;
+		p.setId(nucleusId(1 + i % 4, (i == 4) ? 0 : 1 + i % 4));
+		p.setEnergy((1 + i) * EeV);
+		p.setPosition(Vector3d(i * kpc, -i * kpc, 0));
+		p.setDirection(Vector3d(1, 0.1 * i, -0.2 * i));
+		ref_ptr<Candidate> c = new Candidate(p);
+		c->setRedshift(i < 6 ? 0 : 0.1);
+		single.push_back(c);
+		batched.push_back(new Candidate(*c));
+	}
+	std::vector<Candidate *> candidates;
+	for (size_t i = 0; i < batched.size(); i++)
+		candidates.push_back(batched[i]);
+
+	for (int step = 0; step < 3; step++) {
+		for (size_t i = 0; i < single.size(); i++)
+			propa.process(single[i]);
+		propa.processBatch(&candidates[0], candidates.size());
+	}
+	// one call per step and redshift
+	EXPECT_EQ(6, field->calls);
+
+	for (size_t i = 0; i < single.size(); i++) {
+		EXPECT_EQ(single[i]->current.getPosition(), batched[i]->current.getPosition());
+		EXPECT_EQ(single[i]->current.getDirection(), batched[i]->current.getDirection());
+		EXPECT_EQ(single[i]->previous.getPosition(), batched[i]->previous.getPosition());
+		EXPECT_DOUBLE_EQ(30 * kpc, batched[i]->getTrajectoryLength());
+		EXPECT_DOUBLE_EQ(10 * kpc, batched[i]->getNextStep());
+	}
+}
+
+// module list of a turbulence study with a grid or plane-wave field
+static ref_ptr<ModuleList> offloadModules(ref_ptr<MagneticField> field, bool cashKarp,
+		ref_ptr<ParticleCollector> detected) {
+	ref_ptr<ModuleList> modules = new ModuleList();
+	if (cashKarp)
+		modules->add(new PropagationCK(field, 1e-4, 0.1 * kpc, 10 * kpc));
+	else
+		modules->add(new PropagationBP(field, 1e-4, 0.1 * kpc, 10 * kpc));
+	modules->add(new MaximumTrajectoryLength(2 * Mpc));
+	modules->add(new SphericalBoundary(Vector3d(0.), 300 * kpc));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverSurface(new Sphere(Vector3d(50, 0, 0) * kpc, 100 * kpc)));
+	observer->onDetection(detected);
+	modules->add(observer);
+	return modules;
+}
+
+TEST(OffloadEngine, sameAsModuleList) {
+	// the offloaded propagation gives the trajectories of the module list
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-80 * kpc), 8, 20 * kpc);
+	for (int ix = 0; ix < 8; ix++)
+		for (int iy = 0; iy < 8; iy++)
+			for (int iz = 0; iz < 8; iz++)
+				grid->get(ix, iy, iz) = Vector3f(sin(ix + iz), cos(2. * iy), sin(ix * iy + 1.)) * 1e-10;
+	ref_ptr<MagneticField> fields[] = {new MagneticFieldGrid(grid),
+		new PlaneWaveTurbulence(TurbulenceSpectrum(1e-10, 5 * kpc, 100 * kpc), 16, 2)};
+
+	for (int f = 0; f < 2; f++) {
+		for (int ck = 0; ck < 2; ck++) {
+			ref_ptr<ParticleCollector> hostDetected = new ParticleCollector();
+			ref_ptr<ParticleCollector> deviceDetected = new ParticleCollector();
+			ref_ptr<ModuleList> host = offloadModules(fields[f], ck, hostDetected);
+			ref_ptr<ModuleList> device = offloadModules(fields[f], ck, deviceDetected);
+			OffloadEngine engine(device);
+			EXPECT_TRUE(engine.isSupported()) << engine.getUnsupportedReason();
+			engine.setStepsPerLaunch(7);
+
+			ModuleList::candidate_vector_t hostCandidates, deviceCandidates;
+			for (int i = 0; i < 12; i++) {
+				ParticleState p;
+				p.setId((i % 2) ? 11 : -11);
+				p.setEnergy((1 + i) * 1e16 * eV);
+				p.setPosition(Vector3d(i, -2 * i, 0.5 * i) * kpc);
+				p.setDirection(Vector3d(sin(1. * i), cos(1. * i), 0.3));
+				hostCandidates.push_back(new Candidate(p));
+				deviceCandidates.push_back(new Candidate(p));
+			}
+			// a neutral candidate is propagated on the host
+			deviceCandidates.push_back(new Candidate(22, 1 * EeV));
+			hostCandidates.push_back(new Candidate(22, 1 * EeV));
+
+			host->run(&hostCandidates);
+			engine.run(&deviceCandidates);
+			EXPECT_GT(engine.getDeviceSteps(), 0u);
+
+			EXPECT_EQ(hostDetected->size(), deviceDetected->size());
+			for (size_t i = 0; i < hostCandidates.size(); i++) {
+				Candidate *a = hostCandidates[i], *b = deviceCandidates[i];
+				EXPECT_FALSE(b->isActive());
+				EXPECT_NEAR(0, (a->current.getPosition() - b->current.getPosition()).getR(), 1e-6 * kpc);
+				EXPECT_NEAR(a->getTrajectoryLength(), b->getTrajectoryLength(), 1e-6 * kpc);
+				EXPECT_EQ(a->hasProperty("Rejected"), b->hasProperty("Rejected"));
+			}
+		}
+	}
+}
+
+TEST(OffloadEngine, unsupported) {
+	// other modules are propagated by the module list
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new SimplePropagation(1 * kpc, 1 * kpc));
+	modules->add(new MaximumTrajectoryLength(10 * kpc));
+	OffloadEngine engine(modules);
+	EXPECT_FALSE(engine.isSupported());
+	EXPECT_FALSE(engine.getUnsupportedReason().empty());
+
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(11, 1 * EeV));
+	engine.run(&candidates);
+	EXPECT_FALSE(candidates[0]->isActive());
+	EXPECT_LE(10 * kpc, candidates[0]->getTrajectoryLength());
+	EXPECT_EQ(0u, engine.getDeviceSteps());
+}
+
+TEST(testFastNeutralPropagation, otherParticles) {
+	// charged particles and photons are propagated by the wrapped module
+	FastNeutralPropagation propa(new SimplePropagation(1 * kpc, 1 * kpc));
+	EXPECT_TRUE(propa.hasId(14));
+	EXPECT_TRUE(propa.hasId(-12));
+	EXPECT_FALSE(propa.hasId(22));
+	EXPECT_THROW(propa.addId(nucleusId(1, 1)), std::runtime_error);
+
+	Candidate c(nucleusId(1, 1), 1 * EeV);
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getCurrentStep());
+	Candidate photon(22, 1 * EeV);
+	propa.process(&photon);
+	EXPECT_DOUBLE_EQ(1 * kpc, photon.getCurrentStep());
+
+	// without surfaces the neutrinos are moved by the maximum step
+	Candidate neutrino(14, 1 * EeV);
+	propa.process(&neutrino);
+	EXPECT_DOUBLE_EQ(1 * Gpc, neutrino.getCurrentStep());
+	EXPECT_DOUBLE_EQ(-1 * Gpc, neutrino.current.getPosition().x);
+}
+
+TEST(testFastNeutralPropagation, boundary) {
+	// a neutrino leaves a sphere in one step, instead of 10^4 steps of 1 kpc
+	ref_ptr<FastNeutralPropagation> propa = new FastNeutralPropagation(new SimplePropagation(1 * kpc, 1 * kpc));
+	propa->add(new Sphere(Vector3d(0.), 10 * Mpc));
+	ModuleList modules;
+	modules.add(propa);
+	modules.add(new SphericalBoundary(Vector3d(0.), 10 * Mpc));
+
+	ParticleState p(-12, 1 * PeV, Vector3d(1 * Mpc, 0, 0), Vector3d(1, 1, 0.5));
+	Candidate c(p);
+	int steps = 0;
+	for (; c.isActive(); steps++)
+		modules.process(&c);
+	EXPECT_EQ(1, steps);
+	EXPECT_GT(c.current.getPosition().getR(), 10 * Mpc);
+	EXPECT_LT(c.current.getPosition().getR(), 10 * Mpc + 2 * pc);
+	EXPECT_DOUBLE_EQ(c.getTrajectoryLength(), (c.current.getPosition() - c.previous.getPosition()).getR());
+}
+
+TEST(testFastNeutralPropagation, observer) {
+	// an observer plane is crossed in one step at a grazing angle
+	ref_ptr<FastNeutralPropagation> propa = new FastNeutralPropagation();
+	ref_ptr<Plane> plane = new Plane(Vector3d(1 * Mpc, 0, 0), Vector3d(1, 0, 0));
+	propa->add(plane);
+	ref_ptr<Observer> obs = new Observer();
+	obs->add(new ObserverSurface(plane));
+	ModuleList modules;
+	modules.add(propa);
+	modules.add(obs);
+
+	ParticleState p(16, 1 * PeV, Vector3d(0.), Vector3d(0.05, 1, 0));
+	Candidate c(p);
+	int steps = 0;
+	for (; c.isActive() && (steps < 10); steps++)
+		modules.process(&c);
+	EXPECT_EQ(1, steps);
+	EXPECT_GT(c.current.getPosition().x, 1 * Mpc);
+	EXPECT_LT(c.current.getPosition().x, 1 * Mpc + 0.1 * pc);
+}
+
+// Field lines on circles around the z-axis
+class CircularMagneticField: public MagneticField {
+public:
+	Vector3d getField(const Vector3d &position) const {
+		return Vector3d(-position.y, position.x, 0).getUnitVector() * muG;
+	}
+};
+
+TEST(testDiffusionSDE, batch) {
+	// a batch gives the same as processing the candidates one by one
+	DiffusionSDE propa(new CircularMagneticField(), 1e-4, 0.1 * pc, 1 * kpc);
+
+	std::vector<ref_ptr<Candidate> > single, batched;
+	for (int i = 0; i < 6; i++) {
+		ParticleState p;
+		p.setId((i == 3) ? nucleusId(1, 0) : nucleusId(1, 1));
+		p.setEnergy((1 + i) * 10 * PeV);
+		p.setPosition(Vector3d((1 + i) * 0.1 * kpc, 0, i * pc));
+		ref_ptr<Candidate> c = new Candidate(p);
+		c->setRedshift(i < 4 ? 0 : 0.01);
+		c->setNextStep((i + 1) * 0.1 * kpc);
+		single.push_back(c);
+		batched.push_back(new Candidate(*c));
+	}
+	std::vector<Candidate *> candidates;
+	for (size_t i = 0; i < batched.size(); i++)
+		candidates.push_back(batched[i]);
+
+	Random::instance().seed(42);
+	for (int step = 0; step < 5; step++)
+		for (size_t i = 0; i < single.size(); i++)
+			propa.process(single[i]);
+	Random::instance().seed(42);
+	for (int step = 0; step < 5; step++)
+		propa.processBatch(&candidates[0], candidates.size());
+
+	for (size_t i = 0; i < single.size(); i++) {
+		EXPECT_EQ(single[i]->current.getPosition(), batched[i]->current.getPosition());
+		EXPECT_EQ(single[i]->current.getDirection(), batched[i]->current.getDirection());
+		EXPECT_EQ(single[i]->getNextStep(), batched[i]->getNextStep());
+		EXPECT_EQ(single[i]->getTrajectoryLength(), batched[i]->getTrajectoryLength());
+	}
+	// the steps have been reduced by the field line curvature
+	int reduced = 0;
+	for (size_t i = 0; i < single.size(); i++)
+		reduced += single[i]->getNextStep() < single[i]->getCurrentStep();
+	EXPECT_GT(reduced, 0);
+}
+
+TEST(testDiffusionSDE, diffusionGrids) {
+	DiffusionSDE propa(new UniformMagneticField(Vector3d(0, 0, 1) * nG));
+	double BTen[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	// without grids: D_par = D_0 = 6.1e24 m^2/s at 4 GV, D_perp = epsilon*D_par
+	propa.calculateBTensor(4e9, BTen, Vector3d(0.), Vector3d(1, 0, 0), 0);
+	EXPECT_NEAR(BTen[0], sqrt(2 * 6.1e24), 1e-6 * BTen[0]);
+	EXPECT_NEAR(BTen[4], sqrt(2 * 0.1 * 6.1e24), 1e-6 * BTen[4]);
+
+	// D_par doubles from the first to the second half of the grid
+	ref_ptr<Grid1f> parallel = new Grid1f(Vector3d(0.), 2, 1, 1, 1 * kpc);
+	parallel->setInterpolationType(NEAREST_NEIGHBOUR);
+	parallel->get(0, 0, 0) = 1e28;
+	parallel->get(1, 0, 0) = 2e28;
+	propa.setDiffusionGrids(parallel);
+	propa.calculateBTensor(4e9, BTen, Vector3d(0.5, 0.5, 0.5) * kpc, Vector3d(1, 0, 0), 0);
+	EXPECT_NEAR(BTen[0], sqrt(2e28), 1e-6 * BTen[0]);
+	EXPECT_NEAR(BTen[8], sqrt(0.2e28), 1e-6 * BTen[8]);
+	propa.calculateBTensor(4e9, BTen, Vector3d(1.5, 0.5, 0.5) * kpc, Vector3d(1, 0, 0), 0);
+	EXPECT_NEAR(BTen[0], sqrt(4e28), 1e-6 * BTen[0]);
+
+	// rigidity scaling applies to the grid values
+	propa.calculateBTensor(8 * 4e9, BTen, Vector3d(0.5, 0.5, 0.5) * kpc, Vector3d(1, 0, 0), 0);
+	EXPECT_NEAR(BTen[0], sqrt(2e28 * 2), 1e-6 * BTen[0]);
+
+	// separate perpendicular grid
+	ref_ptr<Grid1f> perpendicular = new Grid1f(Vector3d(0.), 2, 1, 1, 1 * kpc);
+	perpendicular->setInterpolationType(NEAREST_NEIGHBOUR);
+	perpendicular->get(0, 0, 0) = 3e27;
+	perpendicular->get(1, 0, 0) = 3e27;
+	propa.setDiffusionGrids(parallel, perpendicular);
+	propa.calculateBTensor(4e9, BTen, Vector3d(0.5, 0.5, 0.5) * kpc, Vector3d(1, 0, 0), 0);
+	EXPECT_NEAR(BTen[4], sqrt(6e27), 1e-6 * BTen[4]);
+	EXPECT_NEAR(BTen[8], sqrt(6e27), 1e-6 * BTen[8]);
+
+	EXPECT_THROW(propa.setDiffusionGrids(NULL, perpendicular), std::runtime_error);
+}
+
+// Step limit proportional to the energy
+class EnergyStepLimit: public Module {
+public:
+	void process(Candidate *candidate) const {
+	}
+	double getStepLimit(const Candidate *candidate) const {
+		return candidate->current.getEnergy() / EeV * kpc;
+	}
+};
+
+TEST(testStepPlanner, limit) {
+	StepPlanner planner;
+	ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 10 * EeV);
+	c->setNextStep(1 * Mpc);
+
+	// no modules: no limit
+	planner.process(c);
+	EXPECT_DOUBLE_EQ(1 * Mpc, c->getNextStep());
+
+	// modules without an estimate do not limit
+	planner.add(new SimplePropagation());
+	planner.add(new EnergyStepLimit());
+	EXPECT_EQ(2, planner.size());
+	planner.process(c);
+	EXPECT_DOUBLE_EQ(10 * kpc, c->getNextStep());
+
+	// the estimate at the current state is used
+	c->current.setEnergy(2 * EeV);
+	planner.process(c);
+	EXPECT_DOUBLE_EQ(2 * kpc, c->getNextStep());
+
+	// the planned step is at least minStep
+	planner.setMinimumStep(5 * kpc);
+	c->setNextStep(1 * Mpc);
+	planner.process(c);
+	EXPECT_DOUBLE_EQ(5 * kpc, c->getNextStep());
+
+	// the propagation starts with the planned step
+	ModuleList sim;
+	sim.add(new StepPlanner(planner));
+	sim.add(new PropagationCK(new UniformMagneticField(Vector3d(0, 0, 1) * nG), 1e-4, 0.1 * kpc, 1 * Mpc));
+	c->setNextStep(1 * Mpc);
+	sim.process(c);
+	EXPECT_DOUBLE_EQ(5 * kpc, c->getCurrentStep());
+}
+
+// Counts the candidates it is called with
+class CountingModule: public Module {
+public:
+	mutable int count;
+	CountingModule() : count(0) {
+	}
+	void process(Candidate *candidate) const {
+		count++;
+	}
+};
+
+TEST(testPropagation1D, sameAsModules) {
+	// same result as SimplePropagation, Redshift and Observer1D
+	double D = 305 * Mpc;
+	ParticleState p(nucleusId(1, 1), 100 * EeV, Vector3d(D, 0, 0), Vector3d(-1, 0, 0));
+	ref_ptr<Candidate> c1 = new Candidate(p);
+	c1->setRedshift(comovingDistance2Redshift(D));
+	c1->setNextStep(10 * Mpc);
+	ref_ptr<Candidate> c2 = new Candidate(*c1);
+
+	ModuleList sim;
+	sim.add(new SimplePropagation(1 * kpc, 10 * Mpc));
+	sim.add(new Redshift());
+	ref_ptr<Observer> obs = new Observer();
+	obs->add(new Observer1D());
+	sim.add(obs);
+	sim.run(c1);
+
+	ref_ptr<CountingModule> steps = new CountingModule();
+	ref_ptr<CountingModule> detected = new CountingModule();
+	Propagation1D propa(1 * kpc, 10 * Mpc);
+	propa.add(steps);
+	propa.onDetection(detected);
+	propa.process(c2);
+
+	EXPECT_FALSE(c2->isActive());
+	EXPECT_EQ(1, detected->count);
+	EXPECT_EQ(31, steps->count);
+	EXPECT_LE(c2->current.getPosition().x, 0);
+	EXPECT_DOUBLE_EQ(c1->current.getPosition().x, c2->current.getPosition().x);
+	EXPECT_DOUBLE_EQ(c1->getTrajectoryLength(), c2->getTrajectoryLength());
+	EXPECT_DOUBLE_EQ(c1->getRedshift(), c2->getRedshift());
+	EXPECT_DOUBLE_EQ(c1->current.getEnergy(), c2->current.getEnergy());
+}
+
+TEST(testPropagation1D, deactivated) {
+	// a module deactivating the candidate ends the propagation
+	ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 1 * EeV, Vector3d(100 * Mpc, 0, 0), Vector3d(-1, 0, 0));
+	ref_ptr<CountingModule> detected = new CountingModule();
+	Propagation1D propa(1 * kpc, 10 * Mpc);
+	propa.add(new MaximumTrajectoryLength(25 * Mpc));
+	propa.onDetection(detected);
+	propa.process(c);
+	EXPECT_FALSE(c->isActive());
+	EXPECT_EQ(0, detected->count);
+	EXPECT_DOUBLE_EQ(75 * Mpc, c->current.getPosition().x);
+
+	EXPECT_THROW(Propagation1D(10 * Mpc, 1 * Mpc), std::runtime_error);
+}
+
+TEST(testCompositePropagation, select) {
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+	ref_ptr<PropagationCK> ck = new PropagationCK(field, 1e-4, 1 * kpc, 1 * Mpc);
+	ref_ptr<SimplePropagation> simple = new SimplePropagation(1 * kpc, 10 * Mpc);
+	ref_ptr<PropagationBP> bp = new PropagationBP(field, 1e-4, 1 * kpc, 1 * Mpc);
+	CompositePropagation propa(ck);
+	propa.addRegion(new Sphere(Vector3d(0.), 1 * Mpc), bp);
+	EXPECT_EQ(2, propa.size());
+
+	Candidate c(nucleusId(1, 1), 1 * EeV, Vector3d(0.5 * Mpc, 0, 0));
+	c.setNextStep(10 * kpc);
+	EXPECT_EQ(1, propa.select(&c)); // inside the region
+	c.current.setPosition(Vector3d(2 * Mpc, 0, 0));
+	EXPECT_EQ(0, propa.select(&c)); // default
+
+	// weak field: the Larmor radius of 1 EeV protons in 1 nG is about 1 Mpc
+	propa.setWeakField(simple, field, 0.1 * nG, 10);
+	EXPECT_EQ(3, propa.size());
+	EXPECT_EQ(2, propa.select(&c)); // r_L > 10 * 10 kpc
+	c.setNextStep(1 * Mpc);
+	EXPECT_EQ(0, propa.select(&c)); // r_L < 10 * 1 Mpc
+	c.current.setId(nucleusId(1, 0));
+	EXPECT_EQ(2, propa.select(&c)); // neutral
+	propa.setWeakField(simple, new UniformMagneticField(Vector3d(0.)), 0.1 * nG);
+	c.current.setId(nucleusId(1, 1));
+	EXPECT_EQ(2, propa.select(&c)); // below the minimum field strength
+
+	EXPECT_THROW(CompositePropagation(NULL), std::runtime_error);
+}
+
+TEST(testCompositePropagation, handoff) {
+	// switching from the rectilinear propagation in a void to PropagationCK
+	// near a source starts from the last step
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+	CompositePropagation propa(new SimplePropagation(1 * kpc, 10 * Mpc));
+	propa.addRegion(new Sphere(Vector3d(0.), 5 * Mpc), new PropagationCK(field, 1e-4, 1 * kpc, 10 * Mpc));
+
+	Candidate c(nucleusId(1, 1), 100 * EeV, Vector3d(5 * Mpc + 50 * kpc, 0, 0), Vector3d(-1, 0, 0));
+	c.setNextStep(100 * kpc);
+	propa.process(&c); // rectilinear, proposes the maximum step
+	EXPECT_DOUBLE_EQ(100 * kpc, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(10 * Mpc, c.getNextStep());
+	EXPECT_EQ(0, c.getProperty("PropagationIndex").toUInt64());
+
+	propa.process(&c); // inside the sphere
+	EXPECT_EQ(1, c.getProperty("PropagationIndex").toUInt64());
+	EXPECT_DOUBLE_EQ(100 * kpc, c.getCurrentStep());
+}
+
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
@@ -17,6 +17,9 @@ except Exception as e:
     sys.exit(-1)
 
 import numpy as np
+import pickle
+import threading
+import time
 
 
 
@@ -43,6 +46,30 @@ class testCrossLanguagePolymorphism(unittest.TestCase):
             c.current.setId(id)
             filter.process(c)
 
+    def test_BatchModule(self):
+        class HalvingModule(crp.BatchModule):
+            def __init__(self):
+                crp.BatchModule.__init__(self)
+                self.calls = 0
+
+            def processCandidates(self, candidates):
+                self.calls += 1
+                E = candidates.getEnergy()
+                E /= 2
+                candidates.getActive()[:] = E > 1 * crp.EeV
+
+        halving = HalvingModule()
+        m = crp.ModuleList()
+        m.setBatchSize(4)
+        m.add(halving)
+        candidates = crp.CandidateVector()
+        for i in range(4):
+            candidates.push_back(crp.CandidateRefPtr(crp.Candidate(crp.nucleusId(1, 1), 8 * crp.EeV)))
+        m.run(candidates)
+        self.assertEqual(halving.calls, 3)
+        for c in candidates:
+            self.assertAlmostEqual(c.current.getEnergy(), 1 * crp.EeV)
+
     def test_ParticleCollector(self):
         c = crp.Candidate()
         p = crp.ParticleCollector()
@@ -277,6 +304,23 @@ class testVector3(unittest.TestCase):
     self.assertRaises(IndexError, v.__getitem__, 3)
     self.assertRaises(IndexError, v.__setitem__, 3, 10)
 
+  def testArrayView(self):
+    # the view writes through and keeps the vector alive
+    v = crp.Vector3d(1., 2., 3.)
+    a = np.asarray(v)
+    a[0] = 5.
+    self.assertEqual(v.x, 5.)
+    del v
+    self.assertEqual(list(a), [5., 2., 3.])
+    self.assertEqual(np.asarray(crp.Vector3f(1., 2., 3.)).dtype, np.float32)
+
+  def testTuples(self):
+    self.assertEqual(crp.Vector3d(1., 2., 3.).toTuple(), (1., 2., 3.))
+    c = crp.Candidate()
+    c.current.setPosition(crp.Vector3d(1., 2., 3.))
+    self.assertEqual(c.current.getPositionTuple(), (1., 2., 3.))
+    self.assertEqual(c.current.getDirectionTuple(), (-1., 0., 0.))
+
 class testParticleCollector(unittest.TestCase):
   def testParticleCollectorIterator(self):
     collector = crp.ParticleCollector()
@@ -291,6 +335,21 @@ class testParticleCollector(unittest.TestCase):
     for c, l in zip(collector, lengths):
         self.assertEqual(c.getTrajectoryLength(), l)
 
+  def testParticleCollectorNumpy(self):
+    collector = crp.ParticleCollector()
+    for i in range(10):
+      c = crp.Candidate(crp.nucleusId(1, 1), (i + 1) * crp.EeV, crp.Vector3d(i, 0, 0))
+      collector.process(c)
+    columns = collector.toNumpy()
+    self.assertEqual(columns['E'].shape, (10,))
+    self.assertTrue(np.all(columns['ID'] == crp.nucleusId(1, 1)))
+    self.assertAlmostEqual(columns['X'][3], 3)
+
+    imported = crp.ParticleCollector.fromNumpy(collector.toNumpy(['E', 'X', 'Y', 'Z']))
+    self.assertEqual(len(imported), 10)
+    self.assertAlmostEqual(imported[9].current.getEnergy(), 10 * crp.EeV)
+    self.assertRaises(ValueError, crp.ParticleCollector.fromNumpy, {'X': columns['X']})
+
   def testParticleCollectorAsModuleListInput(self):
     sim = crp.ModuleList()
     sim.add(crp.MaximumTrajectoryLength(3.14))
@@ -324,6 +383,107 @@ class testGrid(unittest.TestCase):
     grid = crp.Grid1f(gp)
     self.assertEqual(grid.getNx(), 32)
 
+  def testGridArray(self):
+    gp = crp.GridProperties(crp.Vector3d(0), 4, 0.1)
+    grid = crp.Grid3f(gp)
+    a = grid.getArray()
+    self.assertEqual(a.shape, (4, 4, 4, 3))
+    a[1, 2, 3] = (1, 2, 3)
+    self.assertEqual(grid.getValue(1, 2, 3).y, 2)
+
+    # the array keeps the grid alive
+    scalar = crp.Grid1f(gp).getArray()
+    scalar[:] = 5
+    self.assertEqual(scalar.shape, (4, 4, 4))
+    self.assertEqual(scalar.sum(), 5 * 64)
+
+class testFieldsArray(unittest.TestCase):
+  def testMagneticField(self):
+    field = crp.UniformMagneticField(crp.Vector3d(1, 2, 3))
+    b = field.getFieldsArray(np.zeros((10, 3)))
+    self.assertEqual(b.shape, (10, 3))
+    self.assertTrue(np.all(b == [1, 2, 3]))
+
+  def testDensity(self):
+    density = crp.ConstantDensity(1, 2, 3)
+    n = density.getDensitiesArray(np.ones((5, 3)))
+    self.assertEqual(n.shape, (5,))
+    self.assertTrue(np.all(n == density.getDensity(crp.Vector3d(1))))
+
+class testReleaseGIL(unittest.TestCase):
+  def testSimulationInThread(self):
+    # the main thread keeps running while a simulation runs in a thread
+    sim = crp.ModuleList()
+    sim.add(crp.SimplePropagation(1 * crp.kpc, 1 * crp.kpc))
+    sim.add(crp.MaximumTrajectoryLength(10 * crp.Mpc))
+    source = crp.Source()
+    source.add(crp.SourceParticleType(crp.nucleusId(1, 1)))
+    source.add(crp.SourceEnergy(1 * crp.EeV))
+    thread = threading.Thread(target=sim.run, args=(source, 1000))
+    thread.start()
+    iterations = 0
+    while thread.is_alive():
+      time.sleep(0.001)
+      iterations += 1
+    thread.join()
+    self.assertGreater(iterations, 20)
+
+class testStreamOutput(unittest.TestCase):
+  def testOnChunk(self):
+    class Stream(crp.StreamOutput):
+      def __init__(self):
+        crp.StreamOutput.__init__(self, 16, crp.Output.Event1D)
+        self.arrays = []
+      def onChunk(self, chunk):
+        self.arrays.append(chunk.getArray())
+    output = Stream()
+    for i in range(40):
+      output.process(crp.Candidate(22, (i + 1) * crp.EeV))
+    output.flush()
+    self.assertEqual([a.shape for a in output.arrays], [(16, 5), (16, 5), (8, 5)])
+    self.assertEqual(output.getColumnNames()[2], 'E')
+    self.assertAlmostEqual(output.arrays[2][-1, 2], 40)
+
+class testRunStatistics(unittest.TestCase):
+  def testQuery(self):
+    statistics = crp.RunStatistics.instance()
+    statistics.clear()
+    sim = crp.ModuleList()
+    sim.add(crp.SimplePropagation(1 * crp.kpc, 1 * crp.kpc))
+    sim.add(crp.MaximumTrajectoryLength(9.5 * crp.kpc))
+    sim.setStatistics(True)
+    sim.run(crp.Candidate(22, crp.EeV))
+    sim.setStatistics(False)
+    self.assertIn('steps per candidate', statistics.getHistogramNames())
+    self.assertEqual(statistics.getMaximum('steps per candidate'), 10)
+    self.assertEqual(list(statistics.getHistogram('steps per candidate'))[-1], 1)
+    statistics.clear()
+
+class testPickle(unittest.TestCase):
+  def testGrid(self):
+    grid = crp.Grid1f(crp.Vector3d(1, 2, 3), 4, 5, 6, 0.5)
+    grid.setReflective(True)
+    grid.getArray()[:] = np.random.rand(4, 5, 6)
+    for threshold in (None, 0):
+      crp.setPickleSharing(threshold)
+      copy = pickle.loads(pickle.dumps(grid))
+      self.assertEqual(copy.getOrigin(), grid.getOrigin())
+      self.assertTrue(copy.isReflective())
+      self.assertTrue(np.all(copy.getArray() == grid.getArray()))
+    crp.setPickleSharing()
+    crp.removeSharedFiles()
+
+  def testFields(self):
+    spectrum = crp.TurbulenceSpectrum(crp.muG, crp.pc, 100 * crp.pc)
+    field = crp.PlaneWaveTurbulence(spectrum, 64, 42)
+    copy = pickle.loads(pickle.dumps(field))
+    p = crp.Vector3d(1, 2, 3) * crp.pc
+    self.assertEqual(copy.getField(p), field.getField(p))
+
+    photonField = crp.TabularPhotonField('testField', [1 * crp.eV, 10 * crp.eV], [1., 0.1], [])
+    copy = pickle.loads(pickle.dumps(photonField))
+    self.assertEqual(copy.getFieldName(), 'testField')
+    self.assertAlmostEqual(copy.getPhotonDensity(1 * crp.eV), 1.)
 if hasattr(crp, 'GridTurbulence'):
     class testTurbulentField(unittest.TestCase):
       #check problems brought up in https://github.com/CRPropa/CRPropa3/issues/322
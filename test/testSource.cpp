@@ -1,8 +1,12 @@
+#include "crpropa/EventReweighting.h"
 #include "crpropa/Source.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/module/BinaryOutput.h"
 
 #include "gtest/gtest.h"
+#include <cstdio>
 #include <stdexcept>
 
 namespace crpropa {
@@ -114,6 +118,84 @@ TEST(SourceSNRDistribution, simpleTest) {
 	EXPECT_NEAR(0., Z_mean, 0.1);
 }
 
+TEST(SourcePulsarDistribution, simpleTest) {
+	SourcePulsarDistribution pulsar;
+	ParticleState ps;
+	double Z_mean = 0, absZ_mean = 0;
+	for (size_t i = 0; i < 100000; i++) {
+		pulsar.prepareParticle(ps);
+		Z_mean += ps.getPosition().z / kpc;
+		absZ_mean += fabs(ps.getPosition().z) / kpc;
+	}
+	// exponential height distribution with zg = 0.3 kpc, truncated at 5 kpc
+	EXPECT_NEAR(0., Z_mean / 100000., 0.01);
+	EXPECT_NEAR(0.3, absZ_mean / 100000., 0.01);
+}
+
+// narrow Gaussian disk of width 0.1 kpc
+class DiskDensity: public Density {
+public:
+	double getDensity(const Vector3d &position) const {
+		return exp(-pow(position.z / (0.1 * kpc), 2) / 2);
+	}
+};
+
+TEST(SourceMassDistribution, samplingGrid) {
+	SourceMassDistribution source(new DiskDensity(), 1.);
+	source.setSamplingGrid(4, 4, 80);
+	double absZ_mean = 0;
+	for (size_t i = 0; i < 100000; i++) {
+		Vector3d pos = source.samplePosition();
+		EXPECT_GE(20 * kpc, fabs(pos.x));
+		absZ_mean += fabs(pos.z) / kpc;
+	}
+	// mean of |z| of the Gaussian is sigma * sqrt(2 / pi)
+	EXPECT_NEAR(0.1 * sqrt(2 / M_PI), absZ_mean / 100000., 0.002);
+
+	EXPECT_THROW(SourceMassDistribution(new Density(), 1.).setSamplingGrid(1, 1, 1), std::runtime_error);
+}
+
+TEST(SourceBiasedPowerLawSpectrum, weights) {
+	double Emin = 1 * EeV, Emax = 100 * EeV;
+	SourceBiasedPowerLawSpectrum spectrum(Emin, Emax, -2.7, -1);
+	Candidate c;
+	c.setWeight(2);
+	spectrum.prepareCandidate(c);
+	EXPECT_LE(Emin, c.current.getEnergy());
+	EXPECT_GE(Emax, c.current.getEnergy());
+	EXPECT_DOUBLE_EQ(2 * spectrum.getWeight(c.source.getEnergy()), c.getWeight());
+
+	// weighted fraction above 10 EeV estimates the one of the physical spectrum
+	double sum = 0, sumAbove = 0;
+	for (int i = 0; i < 100000; i++) {
+		Candidate c;
+		spectrum.prepareCandidate(c);
+		sum += c.getWeight();
+		if (c.source.getEnergy() > 10 * EeV)
+			sumAbove += c.getWeight();
+	}
+	double expected = (pow(10., -1.7) - pow(100., -1.7)) / (1 - pow(100., -1.7));
+	EXPECT_NEAR(1, sum / 100000, 0.03);
+	EXPECT_NEAR(expected, sumAbove / sum, 0.002);
+}
+
+TEST(SourceBiasedUniform1D, weights) {
+	SourceBiasedUniform1D source(10 * Mpc, 100 * Mpc, -1, false);
+	double sum = 0, sumD = 0;
+	for (int i = 0; i < 100000; i++) {
+		Candidate c;
+		source.prepareCandidate(c);
+		double d = c.source.getPosition().x;
+		EXPECT_LE(10 * Mpc, d);
+		EXPECT_GE(100 * Mpc, d);
+		sum += c.getWeight();
+		sumD += c.getWeight() * d;
+	}
+	// mean distance of the uniform distribution
+	EXPECT_NEAR(55, sumD / sum / Mpc, 1);
+	EXPECT_THROW(SourceBiasedUniform1D(0, 100 * Mpc, -1, false), std::runtime_error);
+}
+
 TEST(SourceDensityGrid, withInRange) {
 	// Create a grid with 10^3 cells ranging from (0, 0, 0) to (10, 10, 10)
 	Vector3d origin(0, 0, 0);
@@ -180,6 +262,37 @@ TEST(SourceDensityGrid, OneAllowedCell) {
 	EXPECT_NEAR(1, mean.z, 0.2);
 }
 
+TEST(SourceDensityGrid, blocks) {
+	// 16^3 cells in several blocks, density in three cells with weights 1 : 2 : 1
+	auto grid = new Grid1f(Vector3d(0.), 16, 1.);
+	grid->get(1, 2, 3) = 1;
+	grid->get(7, 0, 15) = 2;
+	grid->get(15, 15, 15) = 1;
+	SourceDensityGrid source(grid);
+
+	// the grid is not modified
+	EXPECT_EQ(0, grid->get(0, 0, 0));
+	EXPECT_EQ(2, grid->get(7, 0, 15));
+	EXPECT_EQ(1, grid->get(15, 15, 15));
+
+	ParticleState p;
+	int n[3] = {0, 0, 0};
+	for (int i = 0; i < 10000; i++) {
+		source.prepareParticle(p);
+		Vector3d pos = p.getPosition();
+		if (pos.getDistanceTo(Vector3d(1.5, 2.5, 3.5)) < 1)
+			n[0]++;
+		else if (pos.getDistanceTo(Vector3d(7.5, 0.5, 15.5)) < 1)
+			n[1]++;
+		else if (pos.getDistanceTo(Vector3d(15.5, 15.5, 15.5)) < 1)
+			n[2]++;
+	}
+	EXPECT_EQ(10000, n[0] + n[1] + n[2]);
+	EXPECT_NEAR(2500, n[0], 200);
+	EXPECT_NEAR(5000, n[1], 200);
+	EXPECT_NEAR(2500, n[2], 200);
+}
+
 TEST(SourceDensityGrid1D, withInRange) {
 	// Create a grid with 10 cells ranging from 0 to 10
 	Vector3d origin(0, 0, 0);
@@ -271,6 +384,28 @@ TEST(SourceDirectedEmission, simpleTest) {
 	EXPECT_NEAR(meanDir.z, 0., 0.01);
 }
 
+TEST(SourceEmissionMap, drawDirection) {
+	ref_ptr<EmissionMap> em = new EmissionMap(36, 18, 10, 1 * EeV, 100 * EeV);
+	em->fillMap(nucleusId(1, 1), 10 * EeV, Vector3d(0, 0, 1));
+	em->freeze();
+	SourceEmissionMap feature(em, true);
+
+	Candidate c;
+	c.source.setId(nucleusId(1, 1));
+	c.source.setEnergy(10 * EeV);
+	feature.prepareCandidate(c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_TRUE(c.created.getDirection().getAngleTo(Vector3d(0, 0, 1)) < 30 * M_PI / 180);
+	EXPECT_NEAR(1. / 648, c.getWeight(), 1e-12);
+
+	// no map for this energy
+	Candidate d;
+	d.source.setId(nucleusId(1, 1));
+	d.source.setEnergy(50 * EeV);
+	feature.prepareCandidate(d);
+	EXPECT_FALSE(d.isActive());
+}
+
 TEST(SourceEmissionCone, simpleTest) {
 	Vector3d direction(42., 0., 0.);
 	double aperture = 1/42.;
@@ -384,6 +519,78 @@ TEST(Source, allPropertiesUsed) {
 	EXPECT_EQ(Vector3d(10, 0, 0) * Mpc, p.getPosition());
 }
 
+TEST(Source, getCandidates) {
+	Source source;
+	source.add(new SourceUniform1D(10 * Mpc, 100 * Mpc));
+	source.add(new SourceRedshift1D());
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+	SourceComposition *composition = new SourceComposition(1 * EeV, 10 * EeV, -1);
+	composition->add(nucleusId(1, 1), 1);
+	composition->add(nucleusId(56, 26), 1);
+	source.add(composition);
+	source.add(new SourceTag("batch"));
+
+	std::vector<ref_ptr<Candidate> > candidates = source.getCandidates(1000);
+	ASSERT_EQ(1000, candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		const Candidate &c = *candidates[i];
+		double d = c.source.getPosition().x;
+		EXPECT_LE(10 * Mpc, d);
+		EXPECT_GE(100 * Mpc, d);
+		// the features are applied in order
+		EXPECT_DOUBLE_EQ(comovingDistance2Redshift(d), c.getRedshift());
+		EXPECT_NEAR(1, c.source.getDirection().getR(), 1e-12);
+		EXPECT_LE(1 * EeV, c.source.getEnergy());
+		EXPECT_GE(260 * EeV, c.source.getEnergy());
+		EXPECT_EQ("batch", c.getTagOrigin());
+		EXPECT_EQ(c.source.getEnergy(), c.created.getEnergy());
+		EXPECT_EQ(c.source.getId(), c.current.getId());
+		EXPECT_EQ(c.source.getPosition(), c.previous.getPosition());
+	}
+	EXPECT_EQ(0, source.getCandidates(0).size());
+}
+
+TEST(SourceCatalogue, generateAndRead) {
+	Source source;
+	source.add(new SourceUniform1D(10 * Mpc, 100 * Mpc));
+	source.add(new SourceRedshift1D());
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+	source.add(new SourceParticleType(nucleusId(4, 2)));
+
+	std::string filename = "testSourceCatalogue.bin";
+	Random::instance().seed(5);
+	SourceCatalogue::generate(&source, 1000, filename, 300);
+	Random::instance().seed(5);
+	std::vector<ref_ptr<Candidate> > reference = source.getCandidates(300);
+
+	SourceCatalogue catalogue(filename);
+	EXPECT_EQ(1000, catalogue.size());
+	for (size_t i = 0; i < reference.size(); i++) {
+		ref_ptr<Candidate> c = catalogue.getCandidate(i);
+		EXPECT_EQ(nucleusId(4, 2), c->current.getId());
+		EXPECT_EQ(reference[i]->source.getEnergy(), c->source.getEnergy());
+		EXPECT_EQ(reference[i]->source.getPosition(), c->created.getPosition());
+		EXPECT_NEAR(0, (reference[i]->source.getDirection() - c->current.getDirection()).getR(), 1e-12);
+		EXPECT_EQ(reference[i]->getRedshift(), c->getRedshift());
+	}
+
+	// disjoint ranges, by index and in turn
+	catalogue.setRange(250, 500);
+	EXPECT_EQ(500, catalogue.size());
+	EXPECT_EQ(reference[250]->source.getEnergy(), catalogue.getCandidate(0)->source.getEnergy());
+	std::vector<size_t> indices(1, 49);
+	EXPECT_EQ(reference[299]->source.getEnergy(), catalogue.getCandidates(indices)[0]->source.getEnergy());
+	EXPECT_EQ(reference[250]->source.getEnergy(), catalogue.getCandidate()->source.getEnergy());
+	EXPECT_EQ(reference[251]->source.getEnergy(), catalogue.getCandidates(2)[0]->source.getEnergy());
+	EXPECT_THROW(catalogue.getCandidate(500), std::runtime_error);
+	EXPECT_THROW(catalogue.setRange(900, 101), std::runtime_error);
+
+	EXPECT_THROW(SourceCatalogue("testSource.cpp"), std::runtime_error);
+	std::remove(filename.c_str());
+}
+
 TEST(SourceList, simpleTest) {
 	// test if source list works with one source
 	SourceList sourceList;
@@ -432,6 +639,72 @@ TEST(SourceTag, sourceTag) {
 	EXPECT_TRUE(c.getTagOrigin() == "mySourceTag");
 }
 
+TEST(SourceFeature, density) {
+	ParticleState ps;
+	ps.setId(nucleusId(1, 1));
+	ps.setEnergy(10 * EeV);
+	ps.setPosition(Vector3d(10 * Mpc, 0, 0));
+
+	SourcePowerLawSpectrum spectrum(1 * EeV, 100 * EeV, -1);
+	EXPECT_DOUBLE_EQ(1 / (10 * EeV * log(100.)), spectrum.getDensity(ps, 0));
+	SourceComposition composition(1 * EeV, 100 * EeV, -1);
+	composition.add(nucleusId(1, 1), 1);
+	composition.add(nucleusId(4, 2), 1);
+	double p = log(100.) / (log(100.) + log(200.));
+	EXPECT_DOUBLE_EQ(p / (10 * EeV * log(100.)), composition.getDensity(ps, 0));
+	SourceRedshiftEvolution evolution(2, 0, 1);
+	EXPECT_DOUBLE_EQ(1.5 * 1.5 * 3 / 7., evolution.getDensity(ps, 0.5));
+	EXPECT_EQ(0, evolution.getDensity(ps, 1.5));
+	SourceUniform1D uniform(5 * Mpc, 20 * Mpc, false);
+	EXPECT_DOUBLE_EQ(1 / (15 * Mpc), uniform.getDensity(ps, 0));
+	EXPECT_EQ(1, SourceParticleType(nucleusId(1, 1)).getDensity(ps, 0));
+	EXPECT_EQ(0, SourceParticleType(nucleusId(4, 2)).getDensity(ps, 0));
+	EXPECT_THROW(SourceDirectedEmission(Vector3d(1, 0, 0), 10).getDensity(ps, 0), std::runtime_error);
+}
+
+TEST(EventReweighting, spectrum) {
+	ref_ptr<Source> sampling = new Source();
+	sampling->add(new SourceUniform1D(1 * Mpc, 100 * Mpc));
+	sampling->add(new SourceRedshift1D());
+	sampling->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	sampling->add(new SourceParticleType(22));
+	ref_ptr<Source> target = new Source();
+	target->add(new SourceUniform1D(1 * Mpc, 100 * Mpc));
+	target->add(new SourceRedshift1D());
+	target->add(new SourcePowerLawSpectrum(1 * EeV, 10 * EeV, -2));
+	target->add(new SourceParticleType(22));
+	ref_ptr<EventReweighting> reweighting = new EventReweighting(sampling, target);
+
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	std::string filename = "/tmp/testEventReweighting.bin";
+	ref_ptr<BinaryOutput> output = new BinaryOutput(filename);
+	for (int i = 0; i < 10000; i++) {
+		ref_ptr<Candidate> c = sampling->getCandidate();
+		collector->process(c);
+		output->process(c);
+	}
+	output->close();
+
+	// the ratio of the spectra, the distances cancel
+	std::vector<double> weights = reweighting->reweight(collector);
+	ASSERT_EQ(10000, weights.size());
+	double sum = 0;
+	for (size_t i = 0; i < weights.size(); i++) {
+		double E = (*collector)[i]->source.getEnergy();
+		double expected = (E > 10 * EeV) ? 0 : (log(100.) / (0.9 / EeV)) / E;
+		EXPECT_NEAR(expected, weights[i], 1e-9 * expected);
+		sum += weights[i];
+	}
+	EXPECT_NEAR(1, sum / weights.size(), 0.05);
+
+	// the same weights from the file
+	std::vector<double> fromFile = reweighting->reweight(filename);
+	std::remove(filename.c_str());
+	ASSERT_EQ(weights.size(), fromFile.size());
+	for (size_t i = 0; i < weights.size(); i++)
+		EXPECT_DOUBLE_EQ(weights[i], fromFile[i]);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
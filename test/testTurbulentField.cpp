@@ -4,8 +4,10 @@
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
 #include "crpropa/magneticField/turbulentField/TurbulentField.h"
 #include "crpropa/magneticField/turbulentField/GridTurbulence.h"
+#include "crpropa/magneticField/turbulentField/PagedGridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 #include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
 
@@ -39,6 +41,76 @@ TEST(testTurbulenceSpectrum, correlationLength) {
     EXPECT_NEAR(Lc, 0.498*lBo, 0.001*lBo);
 }
 
+TEST(testPlaneWaveTurbulence, kernels) {
+	PlaneWaveTurbulence field(TurbulenceSpectrum(1 * muG, 1 * pc, 100 * pc), 1000, 42);
+	EXPECT_EQ(field.getKernel(), PlaneWaveTurbulence::EXACT); // unless built with FAST_WAVES
+
+	PlaneWaveTurbulence::SimdLevel supported = PlaneWaveTurbulence::getSupportedSimdLevel();
+	field.setSimdLevel(PlaneWaveTurbulence::SIMD_AVX512);
+	EXPECT_EQ(field.getSimdLevel(), supported);
+
+	Random random(42);
+	for (int n = 0; n < 20; n++) {
+		Vector3d pos = random.randVector() * random.rand() * kpc;
+		field.setKernel(PlaneWaveTurbulence::EXACT);
+		Vector3d exact = field.getField(pos);
+		field.setSimdLevel(PlaneWaveTurbulence::SIMD_NONE);
+		field.setKernel(PlaneWaveTurbulence::FAST);
+		Vector3d fast = field.getField(pos);
+		EXPECT_NEAR(fast.getDistanceTo(exact), 0, 1e-6 * muG);
+
+		// all instruction sets the CPU supports agree up to rounding
+		for (int level = supported; level >= PlaneWaveTurbulence::SIMD_NONE; level--) {
+			field.setSimdLevel(PlaneWaveTurbulence::SimdLevel(level));
+			field.setKernel(PlaneWaveTurbulence::FAST);
+			EXPECT_NEAR(field.getField(pos).getDistanceTo(fast), 0, 1e-12 * muG);
+			field.setKernel(PlaneWaveTurbulence::FAST_FLOAT);
+			EXPECT_NEAR(field.getField(pos).getDistanceTo(exact), 0, 1e-3 * muG);
+		}
+	}
+}
+
+TEST(testPlaneWaveTurbulence, getFields) {
+	PlaneWaveTurbulence field(TurbulenceSpectrum(1 * muG, 1 * pc, 100 * pc), 1000, 42);
+	Random random(42);
+	std::vector<Vector3d> positions(37), fields(37);
+	for (size_t i = 0; i < positions.size(); i++)
+		positions[i] = random.randVector() * random.rand() * kpc;
+
+	PlaneWaveTurbulence::Kernel kernels[3] = {PlaneWaveTurbulence::EXACT,
+			PlaneWaveTurbulence::FAST, PlaneWaveTurbulence::FAST_FLOAT};
+	for (int j = 0; j < 3; j++) {
+		field.setKernel(kernels[j]);
+		double tolerance = (kernels[j] == PlaneWaveTurbulence::FAST_FLOAT) ? 1e-5 : 1e-12;
+		field.getFields(positions.data(), fields.data(), positions.size(), 0);
+		for (size_t i = 0; i < positions.size(); i++)
+			EXPECT_NEAR(fields[i].getDistanceTo(field.getField(positions[i])), 0, tolerance * muG);
+	}
+}
+
+TEST(testPlaneWaveTurbulence, setModes) {
+	TurbulenceSpectrum spectrum(1 * muG, 1 * pc, 100 * pc);
+	PlaneWaveTurbulence field1(spectrum, 100, 42);
+	std::vector<double> modes = field1.getModes();
+	EXPECT_EQ(100 * PlaneWaveTurbulence::modeSize, modes.size());
+
+	// the restored modes give the same field with all kernels
+	PlaneWaveTurbulence field2(spectrum, 2, 1);
+	field2.setModes(modes);
+	EXPECT_EQ(100, field2.getNumberOfModes());
+	PlaneWaveTurbulence::Kernel kernels[3] = {PlaneWaveTurbulence::EXACT,
+			PlaneWaveTurbulence::FAST, PlaneWaveTurbulence::FAST_FLOAT};
+	Random random(42);
+	for (int j = 0; j < 3; j++) {
+		field1.setKernel(kernels[j]);
+		field2.setKernel(kernels[j]);
+		Vector3d pos = random.randVector() * random.rand() * kpc;
+		EXPECT_EQ(field1.getField(pos), field2.getField(pos));
+	}
+
+	EXPECT_THROW(field2.setModes(std::vector<double>(PlaneWaveTurbulence::modeSize)), std::runtime_error);
+}
+
 #ifdef CRPROPA_HAVE_FFTW3F
 
 TEST(testSimpleGridTurbulence, oldFunctionForCrrelationLength) { //TODO: remove in future
@@ -134,6 +206,38 @@ TEST(testGridTurbulence, Turbulence_seed) {
 	Vector3d pos(22 * Mpc);
 	EXPECT_FLOAT_EQ(tf1.getField(pos).x, tf2.getField(pos).x);
 }
+
+TEST(testPagedGridTurbulence, sameAsGridTurbulence) {
+	// the paged field is the field of GridTurbulence for the same seed
+	size_t n = 24;
+	double spacing = 1 * Mpc;
+	double Brms = 1;
+	auto spectrum = TurbulenceSpectrum(Brms, 2 * spacing, 12 * spacing, 2 * spacing);
+	auto gp = GridProperties(Vector3d(0, 0, 0), n, spacing);
+
+	GridTurbulence full(spectrum, gp, 137);
+	PagedGridTurbulence paged(spectrum, gp, 137, "testPagedGridTurbulence.raw",
+	                          1 << 16, 8);
+	std::remove("testPagedGridTurbulence.raw");
+
+	ref_ptr<Grid3f> grid = full.getGrid();
+	for (size_t ix = 0; ix < n; ix++)
+		for (size_t iy = 0; iy < n; iy++)
+			for (size_t iz = 0; iz < n; iz++) {
+				Vector3f d = paged.getGrid()->get(ix, iy, iz) - grid->get(ix, iy, iz);
+				ASSERT_LT(d.getR(), 1e-5 * Brms);
+			}
+
+	Random random(7);
+	for (int i = 0; i < 100; i++) {
+		Vector3d pos = random.randVector() * random.rand() * 100 * Mpc;
+		EXPECT_NEAR((paged.getField(pos) - full.getField(pos)).getR(), 0, 1e-5 * Brms);
+	}
+	// fewer tiles in memory than the 27 of the grid
+	EXPECT_LE(paged.getGrid()->getNumberOfCachedTiles() * 8 * 8 * 8 * sizeof(Vector3f),
+	          paged.getGrid()->getCacheSize());
+	EXPECT_LT(paged.getGrid()->getNumberOfCachedTiles(), 27u);
+}
 #endif // CRPROPA_HAVE_FFTW3F
 
 int main(int argc, char **argv) {
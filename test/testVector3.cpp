@@ -1,4 +1,5 @@
 #include "crpropa/Vector3.h"
+#include "crpropa/Vector3Simd.h"
 #include "gtest/gtest.h"
 
 namespace crpropa {
@@ -154,6 +155,40 @@ TEST(Vector3, parallelPerpendicular) {
 	EXPECT_DOUBLE_EQ(vperp.z, 1);
 }
 
+TEST(Vector3dSimd, sameAsVector3d) {
+	Vector3d a(0.3, -1.7, 2.9), b(-4.1, 0.6, 1.3);
+	Vector3dSimd sa(a), sb(b);
+
+	Vector3d v = sa;
+	EXPECT_TRUE(a == v);
+	EXPECT_DOUBLE_EQ(a.y, sa.getY());
+	EXPECT_DOUBLE_EQ(a.dot(b), sa.dot(sb));
+	EXPECT_DOUBLE_EQ(a.getR(), sa.getR());
+
+	Vector3d c = a.cross(b), sc = sa.cross(sb);
+	EXPECT_DOUBLE_EQ(c.x, sc.x);
+	EXPECT_DOUBLE_EQ(c.y, sc.y);
+	EXPECT_DOUBLE_EQ(c.z, sc.z);
+
+	Vector3d u = a.getUnitVector(), su = sa.getUnitVector();
+	EXPECT_DOUBLE_EQ(u.x, su.x);
+	EXPECT_DOUBLE_EQ(u.y, su.y);
+	EXPECT_DOUBLE_EQ(u.z, su.z);
+
+	Vector3d w = (a + b * 2.) / 3. - a, sw = (sa + sb * 2.) / 3. - sa;
+	EXPECT_DOUBLE_EQ(w.x, sw.x);
+	EXPECT_DOUBLE_EQ(w.y, sw.y);
+	EXPECT_DOUBLE_EQ(w.z, sw.z);
+}
+
+TEST(Vector3dSimd, padding) {
+	// the padding lane stays zero and does not enter the norm
+	Vector3dSimd a(1, 2, 2);
+	Vector3dSimd c = a.cross(Vector3dSimd(0, 0, 1)) + a * 2.;
+	EXPECT_DOUBLE_EQ(3, a.getR());
+	EXPECT_DOUBLE_EQ(Vector3d(4, 3, 4).getR2(), c.getR2());
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();